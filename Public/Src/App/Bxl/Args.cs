@@ -1205,6 +1205,12 @@ namespace BuildXL
                         OptionHandlerFactory.CreateOption(
                             "enforceFullReparsePointsUnderPath",
                             opt => sandboxConfiguration.DirectoriesToEnableFullReparsePointParsing.Add(CommandLineUtilities.ParsePathOption(opt, pathTable))),
+                        OptionHandlerFactory.CreateOption(
+                            "servicePipSandboxCacheBudgetMb",
+                            opt => sandboxConfiguration.ServicePipSandboxCacheBudgetMb = CommandLineUtilities.ParseInt32Option(opt, 0, 1024 * 1024)),
+                        OptionHandlerFactory.CreateOption(
+                            "noReparsePointsUnderPath",
+                            opt => sandboxConfiguration.DirectoriesWithoutReparsePoints.Add(CommandLineUtilities.ParsePathOption(opt, pathTable))),
                         OptionHandlerFactory.CreateBoolOption(
                             "treatAbsentDirectoryAsExistentUnderOpaque",
                             sign => schedulingConfiguration.TreatAbsentDirectoryAsExistentUnderOpaque = sign),
@@ -745,6 +745,16 @@ namespace BuildXL
                 Strings.HelpText_DisplayHelp_EnforceFullReparsePointsUnderPath,
                 HelpLevel.Verbose);
 
+            hw.WriteOption(
+                "/servicePipSandboxCacheBudgetMb:<megabytes>",
+                Strings.HelpText_DisplayHelp_ServicePipSandboxCacheBudgetMb,
+                HelpLevel.Verbose);
+
+            hw.WriteOption(
+                "/noReparsePointsUnderPath:<path>",
+                Strings.HelpText_DisplayHelp_NoReparsePointsUnderPath,
+                HelpLevel.Verbose);
+
             hw.WriteOption(
                 "/analyzeDependencyViolations[+|-]",
                 Strings.HelpText_DisplayHelp_AnalyzeDependencyViolations,
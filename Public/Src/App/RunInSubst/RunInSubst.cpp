@@ -24,6 +24,7 @@
 #define GET_PATH_TARGET_OFFSET  8
 #define RUN_IN_SUBST_VERBOSE L"RUN_IN_SUBST_VERBOSE"
 #define RUN_IN_SUBST_VERBOSE_BUFF_SIZE 2
+#define RUN_IN_SUBST_DOS_DEVICE L"RUN_IN_SUBST_DOS_DEVICE"
 #define MAPPED_PATH_STRING L"\\??\\"
 #define SUBST_FILE_NAME L".SubstLock"
 
@@ -76,6 +77,10 @@ typedef struct _tagSubstListNode
 
 static bool g_isVerbose = false;
 
+// Whether drives are mapped, verified and unmapped through the DOS device API instead of by spawning subst.exe.
+// Opt-in by setting RUN_IN_SUBST_DOS_DEVICE=1.
+static bool g_useDosDeviceApi = false;
+
 template <typename... Args>
 static void printVerbose(PCWSTR format, Args&&... args)
 {
@@ -95,6 +100,14 @@ static void printUsage() noexcept
     wprintf(L"RunInSubst [<target drive>=<source location> ...] <executable-to-start> <arguments-for-the-executable-to-start>\r\n");
 }
 
+// Whether the given environment variable is set to "1".
+static bool IsEnvironmentFlagSet(PCWSTR name) noexcept
+{
+    wchar_t value[RUN_IN_SUBST_VERBOSE_BUFF_SIZE];
+    const DWORD length = GetEnvironmentVariable(name, value, RUN_IN_SUBST_VERBOSE_BUFF_SIZE);
+    return length == 1 && value[0] == L'1';
+}
+
 #pragma warning( push )
 // warning C26409: Avoid calling new and delete explicitly, use std::make_unique<T> instead (r.11).
 // warning C6011: Dereferencing NULL pointer 'ppSubstList'. : Lines: 99, 100, 101, 103
@@ -280,12 +293,72 @@ static bool ParseSubstSourcesAndTargets(int argc, _TCHAR* argv[], PSUBST_LIST_NO
 // warning C26409: Avoid calling new and delete explicitly, use std::make_unique<T> instead (r.11).
 #pragma warning( disable : 6386 26446 26401 26414 26481 26485 26472 26409 )
 
+// Gets the mapped path for each drive to subst by querying its DOS device, without spawning subst.exe.
+// Like the subst.exe listing, only drives that are substituted (their target starts with "\\??\\") get their mapped path updated.
+// Returns 0 if successful and non-zero if failed.
+static int GetMappedPathsFromDosDevices(PSUBST_NODE* pOrderedSubstList)
+{
+    assert(pOrderedSubstList != nullptr);
+
+    auto target = std::vector<wchar_t>(SUBST_SOURCE_LENGTH, 0);
+    std::basic_string<TCHAR> mappedPath;
+
+    for (int i = 0; i < NUMBER_DEFINABLE_SUBST; i++)
+    {
+        PSUBST_NODE pListNode = pOrderedSubstList[i];
+        if (pListNode == nullptr)
+        {
+            continue;
+        }
+
+        const wchar_t drive[3] = { pListNode->szDriveLetter, L':', L'\0' };
+        // The most recent definition comes first in the returned list, which is the one that is in effect.
+        if (QueryDosDevice(drive, target.data(), SUBST_SOURCE_LENGTH) == 0)
+        {
+            continue;
+        }
+
+        if (wcsstr(target.data(), MAPPED_PATH_STRING) != target.data())
+        {
+            continue;
+        }
+
+        mappedPath.assign(target.data() + wcslen(MAPPED_PATH_STRING));
+        std::transform(mappedPath.begin(), mappedPath.end(), mappedPath.begin(),
+            [](TCHAR c) noexcept
+            {
+                return static_cast<TCHAR>(::_totlower(c));
+            });
+
+        // make sure there is a trailing '\\'.
+        if (mappedPath.empty() || mappedPath.back() != L'\\')
+        {
+            mappedPath.push_back(L'\\');
+        }
+
+        if (pListNode->szMappedPath != nullptr)
+        {
+            delete[] pListNode->szMappedPath;
+        }
+
+        pListNode->szMappedPath = new TCHAR[mappedPath.length() + 1];
+        wcscpy_s(pListNode->szMappedPath, mappedPath.length() + 1, mappedPath.c_str());
+    }
+
+    return 0;
+}
+
 // Gets the mapped path for each mapped drive.
 // Returns 0 if successful and non-zero if failed.
 static int GetMappedPaths(PSUBST_NODE* pOrderedSubstList)
 {
     assert(pOrderedSubstList != nullptr);
 
+    if (g_useDosDeviceApi)
+    {
+        return GetMappedPathsFromDosDevices(pOrderedSubstList);
+    }
+
     SECURITY_ATTRIBUTES saAttr{};
     HANDLE g_hChildStd_IN_Rd = NULL;
     HANDLE g_hChildStd_OUT_Rd = NULL;
@@ -535,10 +608,90 @@ static int MapUnmapSubstExecute(std::wstring substCommand)
 #pragma warning( push )
 // warning C26461: The pointer argument 'pSubstNode' for function 'UnmapDrive' can be marked as a pointer to const (con.3).
 #pragma warning( disable : 26461 )
+// Removes the DOS device of a drive, as 'subst /D' does.
+// Returns 0 if successful and non-zero if failed.
+static int UnmapDosDevice(PSUBST_NODE pSubstNode) noexcept
+{
+    const wchar_t drive[3] = { pSubstNode->szDriveLetter, L':', L'\0' };
+    return DefineDosDevice(DDD_REMOVE_DEFINITION, drive, nullptr) ? 0 : 1;
+}
+
+// Defines the DOS device of a drive to point to its source directory, as 'subst' does.
+// Like subst, a drive that is already defined is left alone: the caller finds out through GetMappedPaths and goes through the locking protocol.
+// Returns 0 if successful and non-zero if failed.
+static int MapDosDevice(PSUBST_NODE pSubstNode)
+{
+    const wchar_t drive[3] = { pSubstNode->szDriveLetter, L':', L'\0' };
+    wchar_t existingTarget[MAX_PATH];
+    if (QueryDosDevice(drive, existingTarget, MAX_PATH) != 0 || GetLastError() != ERROR_FILE_NOT_FOUND)
+    {
+        return 1;
+    }
+
+    std::wstring source(pSubstNode->szSourceDirectory, wcslen(pSubstNode->szSourceDirectory) - 1); // Skip the trailing '\\'.
+    return DefineDosDevice(0, drive, source.c_str()) ? 0 : 1;
+}
+
+static DWORD WINAPI MapDosDeviceThreadProc(LPVOID parameter)
+{
+    return static_cast<DWORD>(MapDosDevice(static_cast<PSUBST_NODE>(parameter)));
+}
+
+static DWORD WINAPI UnmapDosDeviceThreadProc(LPVOID parameter) noexcept
+{
+    return static_cast<DWORD>(UnmapDosDevice(static_cast<PSUBST_NODE>(parameter)));
+}
+
+// Runs the given DOS device operation for all the drives to subst, each on its own thread, and waits for all of them.
+// An operation that cannot get a thread runs on the calling thread. Failures are not reported here: mappings are verified
+// afterwards through GetMappedPaths, and unmapping is best effort, as with subst.exe.
+static void ForEachDriveInParallel(PSUBST_NODE* pOrderedSubstList, LPTHREAD_START_ROUTINE operation)
+{
+    assert(pOrderedSubstList != nullptr);
+
+    HANDLE threads[NUMBER_DEFINABLE_SUBST];
+    DWORD threadCount = 0;
+
+    for (int i = 0; i < NUMBER_DEFINABLE_SUBST; i++)
+    {
+        PSUBST_NODE pListNode = pOrderedSubstList[i];
+        if (pListNode == nullptr)
+        {
+            continue;
+        }
+
+        HANDLE thread = CreateThread(nullptr, 0, operation, pListNode, 0, nullptr);
+        if (thread == NULL)
+        {
+            operation(pListNode);
+            continue;
+        }
+
+        threads[threadCount++] = thread;
+    }
+
+    if (threadCount > 0)
+    {
+        printVerbose(L"{}", L"Start waiting for DOS device operations to complete.");
+        WaitForMultipleObjects(threadCount, threads, TRUE, INFINITE);
+        printVerbose(L"{}", L"Done waiting for DOS device operations to complete.");
+    }
+
+    for (DWORD i = 0; i < threadCount; i++)
+    {
+        CloseHandle(threads[i]);
+    }
+}
+
 static int UnmapDrive(PSUBST_NODE pSubstNode)
 {
     int ret = 0;
 
+    if (g_useDosDeviceApi)
+    {
+        return UnmapDosDevice(pSubstNode);
+    }
+
     std::wstring substCommand(L"subst /D \"");
     substCommand.push_back(pSubstNode->szDriveLetter);
     substCommand.push_back(L':');
@@ -553,6 +706,12 @@ static int MapDrive(PSUBST_NODE pSubstNode)
 {
     int ret = 0;
 
+    if (g_useDosDeviceApi)
+    {
+        MapDosDevice(pSubstNode);
+        return 0;
+    }
+
     std::wstring substCommand(L"subst \"");
     substCommand.push_back(pSubstNode->szDriveLetter);
     substCommand.push_back(L':');
@@ -840,6 +999,15 @@ static int SubstDrivesAndExecute(int argc, _TCHAR* argv[], PSUBST_LIST_NODE pSub
             i++;
         }
 
+        // With the DOS device API, map all the drives at once and verify them with a single pass.
+        // Drives that did not end up mapped to their source go through the one-by-one protocol below.
+        const bool mappedInParallel = g_useDosDeviceApi;
+        if (mappedInParallel)
+        {
+            ForEachDriveInParallel(pOrderedSubstList, MapDosDeviceThreadProc);
+            GetMappedPaths(pOrderedSubstList);
+        }
+
         // Now map the drive and check to see if it worked. If not, wait for release and map again.
         for (int i = 0; i < NUMBER_DEFINABLE_SUBST;)
         {
@@ -850,6 +1018,14 @@ static int SubstDrivesAndExecute(int argc, _TCHAR* argv[], PSUBST_LIST_NODE pSub
                 continue;
             };
 
+            if (mappedInParallel &&
+                pListNode->szMappedPath != nullptr &&
+                wcscmp(pListNode->szSourceDirectory, pListNode->szMappedPath) == 0)
+            {
+                i++;
+                continue;
+            }
+
             MapDrive(pListNode);
 
             GetMappedPaths(pOrderedSubstList);
@@ -929,6 +1105,12 @@ static int SubstDrivesAndExecute(int argc, _TCHAR* argv[], PSUBST_LIST_NODE pSub
 
     const int errorCode = ExecuteProcess(argc, argv, executableToRunIndex, pOrderedSubstList);
 
+    // The drives are unmapped before their lock files get closed below.
+    if (g_useDosDeviceApi)
+    {
+        ForEachDriveInParallel(pOrderedSubstList, UnmapDosDeviceThreadProc);
+    }
+
     // Clean up whatever is needed to clean up.
     for (int i = 0; i < NUMBER_DEFINABLE_SUBST; i++)
     {
@@ -941,7 +1123,10 @@ static int SubstDrivesAndExecute(int argc, _TCHAR* argv[], PSUBST_LIST_NODE pSub
         LogToFile(pListNode, L"Done! Unsubst drive {}: - {}.",
             static_cast<char>(pListNode->szDriveLetter), pListNode->szSourceDirectory);
 
-        UnmapDrive(pListNode);
+        if (!g_useDosDeviceApi)
+        {
+            UnmapDrive(pListNode);
+        }
         assert(pListNode->hLockFile != INVALID_HANDLE_VALUE && "Invalid state. Lock file handle should not be invalid.");
 
         if (pListNode->hLockFile == INVALID_HANDLE_VALUE)
@@ -978,6 +1163,8 @@ int _tmain(int argc, _TCHAR* argv[])
 
     SetConsoleCtrlHandler(CtrlHandler, true);
 
+    g_useDosDeviceApi = IsEnvironmentFlagSet(RUN_IN_SUBST_DOS_DEVICE);
+
     const int ret = SubstDrivesAndExecute(argc, argv, pSubstList, pOrderedSubstList, executableToRunIndex);
 
     if (pOrderedSubstList != nullptr)
@@ -341,6 +341,15 @@ namespace BuildXL.ProcessPipExecutor
                 m_fileAccessManifest.DisableDetours = true;
             }
 
+            if (m_pip.IsService && m_sandboxConfig.ServicePipSandboxCacheBudgetMb > 0)
+            {
+                // Service pips live for as long as the build: bound the caches the sandbox keeps in their processes
+                uint budgetKb = (uint)m_sandboxConfig.ServicePipSandboxCacheBudgetMb * 1024;
+                m_fileAccessManifest.AccessCacheBudgetKb = budgetKb;
+                m_fileAccessManifest.FilesCheckedForAccessBudgetKb = budgetKb;
+                m_fileAccessManifest.ResolvedPathCacheBudgetKb = budgetKb;
+            }
+
             m_fileAccessAllowlist = allowlist;
             m_makeInputPrivate = makeInputPrivate;
             m_makeOutputPrivate = makeOutputPrivate;
@@ -2202,6 +2211,17 @@ namespace BuildXL.ProcessPipExecutor
                 }
             }
 
+            if (m_sandboxConfig.DirectoriesWithoutReparsePoints != null)
+            {
+                foreach (var directoryWithoutReparsePoints in m_sandboxConfig.DirectoriesWithoutReparsePoints)
+                {
+                    m_fileAccessManifest.AddScope(
+                        directoryWithoutReparsePoints,
+                        mask: FileAccessPolicy.MaskNothing,
+                        values: FileAccessPolicy.NoReparsePointsInCone);
+                }
+            }
+
             if (!OperatingSystemHelper.IsUnixOS)
             {
                 var binaryPaths = new BinaryPaths();
@@ -5654,6 +5674,10 @@ namespace BuildXL.ProcessPipExecutor
                         Logger.Log.LogDetoursMaxHeapSize(loggingContext, message);
                         break;
 
+                    case Processes.Tracing.LogEventId.LogDetoursProfile:
+                        Logger.Log.LogDetoursProfile(loggingContext, message);
+                        break;
+
                     case Processes.Tracing.LogEventId.ReportArgsMismatch:
                         Logger.Log.ReportArgsMismatch(loggingContext, message);
                         break;
@@ -423,7 +423,7 @@ namespace BuildXL.ProcessPipExecutor.Tracing
             string policyFilePath);
 
         /// <summary>
-        /// Message foramt: "[{PipSemiStableHash}] Maximum detours heap size for process in the pip is {maxDetoursHeapSizeInBytes} bytes. The processName '{processName}'. The processId is: {processId}. The manifestSize in bytes is: {manifestSizeInBytes}. The finalDetoursHeapSize in bytes is: {finalDetoursHeapSizeInBytes}. The allocatedPoolEntries is: {allocatedPoolEntries}. The maxHandleMapEntries is: {maxHandleMapEntries}. The handleMapEntries is: {handleMapEntries}."  
+        /// Message foramt: "[{PipSemiStableHash}] Maximum detours heap size for process in the pip is {maxDetoursHeapSizeInBytes} bytes. The processName '{processName}'. The processId is: {processId}. The manifestSize in bytes is: {manifestSizeInBytes}. The finalDetoursHeapSize in bytes is: {finalDetoursHeapSizeInBytes}. The allocatedPoolEntries is: {allocatedPoolEntries}. The maxHandleMapEntries is: {maxHandleMapEntries}. The handleMapEntries is: {handleMapEntries}. The policySearchCacheHits are: {policySearchCacheHits} out of {policySearchCacheLookups} lookups. The closedHandlesPoolMisses is: {closedHandlesPoolMisses}. The process attach took {attachTotalMicroseconds}us (manifest parsing: {attachManifestParseMicroseconds}us, handle overlay: {attachHandleOverlayMicroseconds}us, detours: {attachDetoursMicroseconds}us). The {reportCount} reports took {reportLatencyP50Microseconds}us (median), {reportLatencyP99Microseconds}us (99th percentile) and {reportLatencyMaxMicroseconds}us (max) to be written."  
         /// </summary>
         [GeneratedEvent(
             (int)LogEventId.LogDetoursMaxHeapSize,
@@ -434,6 +434,18 @@ namespace BuildXL.ProcessPipExecutor.Tracing
             Message = "{message}")]
         public abstract void LogDetoursMaxHeapSize(LoggingContext context, string message);
 
+        /// <summary>
+        /// Message format: "[{PipSemiStableHash}] Detours profile for process {processId}: {detour}: {calls} calls, {microseconds}us; ..."
+        /// </summary>
+        [GeneratedEvent(
+            (int)LogEventId.LogDetoursProfile,
+            EventGenerators = EventGenerators.LocalOnly,
+            EventLevel = Level.Verbose,
+            Keywords = (int)Keywords.Diagnostics,
+            EventTask = (int)Tasks.PipExecutor,
+            Message = "{message}")]
+        public abstract void LogDetoursProfile(LoggingContext context, string message);
+
         [GeneratedEvent(
             (int)LogEventId.LogInternalDetoursErrorFileNotEmpty,
             EventGenerators = EventGenerators.LocalOnly,
@@ -100,6 +100,28 @@ namespace BuildXL.Processes
             AlwaysRemoteInjectDetoursFrom32BitProcess = false;
             UnconditionallyEnableLinuxPTraceSandbox = false;
             IgnoreDeviceIoControlGetReparsePoint = true; // TODO: Change this when customers onboard the feature.
+            EnableLinuxSandboxReportBatching = false;
+            EnableLinuxSandboxBinaryReports = false;
+            EnableLinuxSeccompNotifySandbox = false;
+            EnableUtf8Reports = false;
+            CacheProbesOfImmutableInputs = false;
+            ShareManifestAcrossProcesses = false;
+            ProfileDetours = false;
+            ShareReportCacheAcrossProcesses = false;
+            CacheImagePathSearches = false;
+            CacheFinalPathsByFileId = false;
+            CacheSubstituteProcessExecutionPluginVerdicts = false;
+            CoalesceReportMessageCount = false;
+            EnableLinuxSandboxTraceBuffer = false;
+            RecordLinuxSandboxAccessTrace = false;
+            EnableLinuxFanotifySandbox = false;
+            CacheLinuxPTraceFdPaths = false;
+            FilterLinuxUntrackedScopes = false;
+            AggregateLinuxAccessReports = false;
+            AdaptiveReportBatching = false;
+            DetectLinuxProcessTreeCompletion = false;
+            BatchConcurrentReports = false;
+            CacheLinuxSymlinkResolution = false;
         }
 
         private bool GetFlag(FileAccessManifestFlag flag) => (m_fileAccessManifestFlag & flag) != 0;
@@ -534,6 +556,319 @@ namespace BuildXL.Processes
             set => SetExtraFlag(FileAccessManifestExtraFlag.IgnoreDeviceIoControlGetReparsePoint, value);
         }
 
+        /// <summary>
+        /// When enabled, the Linux sandbox stages access reports per thread and sends them to the report FIFO in batches
+        /// </summary>
+        /// <remarks>
+        /// Reports coming from a single thread keep their relative order. Process start reports are always sent before any access
+        /// of the corresponding process, and a process exit report is sent after all staged reports of that process.
+        /// Reports staged by a process that gets killed before it can flush them are lost.
+        /// </remarks>
+        public bool EnableLinuxSandboxReportBatching
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSandboxReportBatching);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSandboxReportBatching, value);
+        }
+
+        /// <summary>
+        /// When enabled, the Linux sandbox sends access reports using a fixed-layout binary record instead of pipe-delimited text
+        /// </summary>
+        public bool EnableLinuxSandboxBinaryReports
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSandboxBinaryReports);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSandboxBinaryReports, value);
+        }
+
+        /// <summary>
+        /// When enabled, statically linked processes are sandboxed with seccomp user notifications served by a supervisor process
+        /// forked by the Linux sandbox, instead of being traced by the ptrace runner
+        /// </summary>
+        /// <remarks>
+        /// Only takes effect together with <see cref="EnableLinuxPTraceSandbox"/>. Falls back to the ptrace sandbox on kernels older than 5.8.
+        /// </remarks>
+        public bool EnableLinuxSeccompNotifySandbox
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSeccompNotifySandbox);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSeccompNotifySandbox, value);
+        }
+
+        /// <summary>
+        /// When enabled, Detours writes the report lines as UTF-8 instead of UTF-16, which halves the size of the reports for most paths
+        /// </summary>
+        /// <remarks>
+        /// Processes breaking away from the sandbox may report augmented accesses straight to the report pipe (see AugmentedManifestReporter),
+        /// which they always do as UTF-16: this has no effect when <see cref="ProcessesCanBreakaway"/>. See <see cref="UseUtf8Reports"/>.
+        /// </remarks>
+        public bool EnableUtf8Reports
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableUtf8Reports);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableUtf8Reports, value);
+        }
+
+        /// <summary>
+        /// Whether the report lines sent by Detours are UTF-8 encoded
+        /// </summary>
+        /// <remarks>
+        /// CODESYNC: Public/Src/Sandbox/Windows/DetoursServices/SendReport.cpp (UseUtf8Reports)
+        /// </remarks>
+        public bool UseUtf8Reports => EnableUtf8Reports && !ProcessesCanBreakaway;
+
+        /// <summary>
+        /// When enabled, Detours caches the results of GetFileAttributes(Ex) for paths that have an expected USN and can't be written
+        /// </summary>
+        /// <remarks>
+        /// Accesses are still checked and reported every time, only the filesystem queries are saved. Any write, rename or delete
+        /// in the process drops the whole cache.
+        /// </remarks>
+        public bool CacheProbesOfImmutableInputs
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.CacheProbesOfImmutableInputs);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.CacheProbesOfImmutableInputs, value);
+        }
+
+        /// <summary>
+        /// When enabled, the first detoured process of a pip that starts a child puts its copy of the manifest in a read-only section,
+        /// which every process below it maps instead of getting its own copy
+        /// </summary>
+        /// <remarks>
+        /// Saves commit charge and process startup time for pips with big manifests that start many processes. Processes injected remotely
+        /// (see <see cref="AlwaysRemoteInjectDetoursFrom32BitProcess"/>) still get their own copy.
+        /// </remarks>
+        public bool ShareManifestAcrossProcesses
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.ShareManifestAcrossProcesses);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.ShareManifestAcrossProcesses, value);
+        }
+
+        /// <summary>
+        /// When enabled, Detours counts the calls to the most common detoured functions and the time spent in them, and reports the totals
+        /// when each process exits
+        /// </summary>
+        /// <remarks>
+        /// Only calls made directly by the process are counted: a detoured function called from within another one is accounted to the outer one.
+        /// On Linux every interposed function and ptrace syscall handler is profiled, along with the reports it sent and the access cache hits it got;
+        /// the totals are sent as debug messages when each process exits.
+        /// </remarks>
+        public bool ProfileDetours
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.ProfileDetours);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.ProfileDetours, value);
+        }
+
+        /// <summary>
+        /// When enabled, the Linux sandbox keeps the accesses it already reported in a cache shared by all the processes of the pip,
+        /// so an allowed access is only reported by the first process that makes it
+        /// </summary>
+        /// <remarks>
+        /// Cuts report traffic for pips that start many processes reading the same files (e.g., a compiler per source file reading the same headers).
+        /// The accesses of the other processes are not reported, so the reported accesses can't be attributed to every process that made them.
+        /// Denied accesses are still reported by every process. Has no effect on Windows.
+        /// </remarks>
+        public bool ShareReportCacheAcrossProcesses
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.ShareReportCacheAcrossProcesses);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.ShareReportCacheAcrossProcesses, value);
+        }
+
+        /// <summary>
+        /// When enabled, Detours remembers where the images of the processes it creates were found when their names are not rooted
+        /// (e.g., "cmd" or "git" in a command line), so each process only searches PATH once per name
+        /// </summary>
+        /// <remarks>
+        /// On Windows, the cache is per process. A write, rename or delete in the process of a file in any of the searched directories drops it,
+        /// but files created there by other processes are not noticed.
+        /// On Linux, the searches of the exec* and posix_spawnp functions that take a file name are shared among all processes of the pip.
+        /// Creating, removing or renaming a file with a searched name in any process of the pip drops the searches for that name,
+        /// but files created by processes the interposer is not loaded into (e.g. statically linked ones) are not noticed.
+        /// </remarks>
+        public bool CacheImagePathSearches
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.CacheImagePathSearches);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.CacheImagePathSearches, value);
+        }
+
+        /// <summary>
+        /// When enabled, Detours caches the final paths of the files that handle-based operations (renames, deletions, etc.) are applied to,
+        /// keyed by the id of the file
+        /// </summary>
+        /// <remarks>
+        /// Only files with a single hard link are cached. Any rename or hard link creation in the process drops the whole cache,
+        /// but renames by other processes are not noticed.
+        /// </remarks>
+        public bool CacheFinalPathsByFileId
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.CacheFinalPathsByFileId);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.CacheFinalPathsByFileId, value);
+        }
+
+        /// <summary>
+        /// When enabled, Detours remembers the verdicts of the substitute process execution plugin, so a process starting the same
+        /// command line several times only calls the plugin once for it
+        /// </summary>
+        /// <remarks>
+        /// The cache is per process. Verdicts are keyed by the command, its arguments, the working directory and the environment,
+        /// so the plugin must decide on those alone.
+        /// </remarks>
+        public bool CacheSubstituteProcessExecutionPluginVerdicts
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.CacheSubstituteProcessExecutionPluginVerdicts);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.CacheSubstituteProcessExecutionPluginVerdicts, value);
+        }
+
+        /// <summary>
+        /// When enabled, Detours adds the reports a process sent to <see cref="MessageCountSemaphore"/> once, when the process exits,
+        /// instead of releasing the semaphore on every write to the report pipe
+        /// </summary>
+        /// <remarks>
+        /// A process terminated from the outside never adds its count, which shows up as a message count mismatch.
+        /// Only enable this for pips whose processes are not killed by their own process tree.
+        /// </remarks>
+        public bool CoalesceReportMessageCount
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.CoalesceReportMessageCount);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.CoalesceReportMessageCount, value);
+        }
+
+        /// <summary>
+        /// When enabled together with <see cref="EnableLinuxSandboxLogging"/>, the Linux sandbox writes its debug messages to a
+        /// per-process trace file next to the manifest instead of sending them as access reports
+        /// </summary>
+        /// <remarks>
+        /// Each trace file is a fixed-size ring, so only the most recent messages of a long-running process are kept.
+        /// Trace files are logged and deleted when the pip completes, including those of processes that crashed.
+        /// </remarks>
+        public bool EnableLinuxSandboxTraceBuffer
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSandboxTraceBuffer);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxSandboxTraceBuffer, value);
+        }
+
+        /// <summary>
+        /// When enabled, every process of the pip records the access checks the Linux sandbox makes (the intercepted function, the checked
+        /// event, the result and how long it took) to a trace file next to the manifest, to be replayed offline with accesstracereplay
+        /// </summary>
+        /// <remarks>
+        /// Trace files embed a copy of the manifest and are not deleted when the pip completes.
+        /// </remarks>
+        public bool RecordLinuxSandboxAccessTrace
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.RecordLinuxSandboxAccessTrace);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.RecordLinuxSandboxAccessTrace, value);
+        }
+
+        /// <summary>
+        /// When enabled, statically linked processes run untouched while a fanotify listener reports the file accesses of their process tree,
+        /// instead of being stopped on every filtered syscall by the ptrace (or seccomp notification) sandbox
+        /// </summary>
+        /// <remarks>
+        /// Observation only: accesses can't be denied, probes are not seen and renames are reported as a removal plus a creation, so this is
+        /// ignored when unexpected file accesses fail the pip. Needs CAP_SYS_ADMIN and a 5.9+ kernel, and falls back to the other sandboxes otherwise.
+        /// </remarks>
+        public bool EnableLinuxFanotifySandbox
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxFanotifySandbox);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.EnableLinuxFanotifySandbox, value);
+        }
+
+        /// <summary>
+        /// When enabled, the ptrace sandbox remembers the path each file descriptor of a tracee refers to, so reporting a write
+        /// (or any other descriptor-based access) doesn't read the descriptor link from procfs every time
+        /// </summary>
+        /// <remarks>
+        /// Tracees also stop on close, close_range, dup2, dup3 and unshare, so the paths are forgotten when their descriptors go away.
+        /// A file renamed while open keeps being reported under its former path. Has no effect on the seccomp notification sandbox.
+        /// </remarks>
+        public bool CacheLinuxPTraceFdPaths
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.CacheLinuxPTraceFdPaths);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.CacheLinuxPTraceFdPaths, value);
+        }
+
+        /// <summary>
+        /// When enabled, the Linux sandbox drops accesses to paths under untracked scopes (scopes that allow everything without reporting
+        /// anything, and have no other scope under them) straight from the path the process passed, before resolving it or looking up its policy
+        /// </summary>
+        /// <remarks>
+        /// Only absolute paths without '..' components that climb out of a scope are dropped, and symlinks are not resolved to tell: a symlink
+        /// under an untracked scope that points to a tracked location is not followed. Ignored when every file access is reported.
+        /// </remarks>
+        public bool FilterLinuxUntrackedScopes
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.FilterLinuxUntrackedScopes);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.FilterLinuxUntrackedScopes, value);
+        }
+
+        /// <summary>
+        /// When enabled, each process in the Linux sandbox summarizes its allowed read-side accesses (reads, probes, enumerations, lookups)
+        /// instead of reporting every one of them: a single report per path, with the strongest access the process made to it
+        /// </summary>
+        /// <remarks>
+        /// Meant for pips that are monitored but not enforced, where only the set of accessed paths matters. The summary is sent when it gets full,
+        /// before the process execs and before its exit report, so accesses of a process killed before exiting may not be reported.
+        /// Writes, denied accesses and process reports are always sent when they happen. Ignored when unexpected file accesses fail the pip.
+        /// </remarks>
+        public bool AggregateLinuxAccessReports
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.AggregateLinuxAccessReports);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.AggregateLinuxAccessReports, value);
+        }
+
+        /// <summary>
+        /// When enabled, each sandboxed process batches its reports only while it is sending them at a high rate (an access storm),
+        /// and sends them one by one the rest of the time
+        /// </summary>
+        /// <remarks>
+        /// Applies to the Windows report pipe and the Linux report FIFO. Batched reports are sent when the batch fills up, when the process reports
+        /// again more than 100ms after them, when the storm ends and when the process exits, so reports held by a process killed before exiting are lost.
+        /// On Linux, <see cref="EnableLinuxSandboxReportBatching"/> batches every report and takes precedence.
+        /// </remarks>
+        public bool AdaptiveReportBatching
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.AdaptiveReportBatching);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.AdaptiveReportBatching, value);
+        }
+
+        /// <summary>
+        /// When enabled, the processes of a pip keep a count of the live ones in a file next to the manifest, and the last one to exit
+        /// reports the completion of the process tree
+        /// </summary>
+        /// <remarks>
+        /// Linux only. The pip then completes as soon as its last process exits, instead of when BuildXL finds out on its own that no process
+        /// is left. A process killed before it gets to exit (or a pip with too many processes) keeps the count from reaching zero, in which case
+        /// BuildXL finds out on its own, same as when this is not enabled.
+        /// </remarks>
+        public bool DetectLinuxProcessTreeCompletion
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.DetectLinuxProcessTreeCompletion);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.DetectLinuxProcessTreeCompletion, value);
+        }
+
+        /// <summary>
+        /// When enabled, the report lines sent concurrently by the threads of a process are written to the report pipe together
+        /// </summary>
+        /// <remarks>
+        /// Windows only, and implied by <see cref="AdaptiveReportBatching"/>. Batching takes process-wide locks, so a thread terminated while
+        /// holding one hangs every other thread of the process that reports afterwards. Without it, each report line is written on its own.
+        /// </remarks>
+        public bool BatchConcurrentReports
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.BatchConcurrentReports);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.BatchConcurrentReports, value);
+        }
+
+        /// <summary>
+        /// When enabled, each sandboxed process caches whether the paths it resolves are symlinks, and where they point to
+        /// </summary>
+        /// <remarks>
+        /// Linux only. Symlinks created, removed or renamed by any process of the pip drop what every process cached for them,
+        /// but changes made by processes the interposer is not loaded into (e.g. statically linked ones) are not noticed.
+        /// </remarks>
+        public bool CacheLinuxSymlinkResolution
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.CacheLinuxSymlinkResolution);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.CacheLinuxSymlinkResolution, value);
+        }
+
         /// <summary>
         /// A location for a file where Detours to log failure messages.
         /// </summary>
@@ -555,6 +890,28 @@ namespace BuildXL.Processes
         /// </summary>
         public long PipId { get; set; }
 
+        /// <summary>
+        /// Memory, in KB, the sandbox may use to remember the accesses a process already reported before it starts evicting them (Linux only).
+        /// 0 means the default budget.
+        /// </summary>
+        /// <remarks>
+        /// The sandbox caches live as long as the process they are in. Budgets are meant for long-lived processes (e.g. service pips),
+        /// which keep accessing new paths for hours.
+        /// </remarks>
+        public uint AccessCacheBudgetKb { get; set; }
+
+        /// <summary>
+        /// Memory, in KB, the sandbox may use to remember the paths a process already checked for write access before it starts evicting them.
+        /// 0 means the default budget.
+        /// </summary>
+        public uint FilesCheckedForAccessBudgetKb { get; set; }
+
+        /// <summary>
+        /// Memory, in KB, the sandbox may use to cache reparse point resolution before it starts evicting it (Windows only).
+        /// 0 means the default budget.
+        /// </summary>
+        public uint ResolvedPathCacheBudgetKb { get; set; }
+
         /// <summary>
         /// List of child processes that will break away from the sandbox
         /// </summary>
@@ -565,6 +922,20 @@ namespace BuildXL.Processes
         /// </summary>
         public bool ProcessesCanBreakaway => ChildProcessesToBreakawayFromSandbox?.Any() == true;
 
+        /// <summary>
+        /// Reparse points whose targets are already known (e.g. because previous pips resolved them), keyed by the path of the reparse point.
+        /// </summary>
+        /// <remarks>
+        /// On Windows these seed the cache the sandbox keeps of resolved reparse points, so sandboxed processes don't need to query them again.
+        /// The sandbox still invalidates them if the process changes them.
+        /// </remarks>
+        public IReadOnlyDictionary<string, KnownReparsePointTarget>? KnownReparsePointTargets { get; set; }
+
+        /// <summary>
+        /// Target of a reparse point as found in its reparse data, and its reparse tag. A reparse tag of 0 indicates a path known not to be a reparse point.
+        /// </summary>
+        public readonly record struct KnownReparsePointTarget(string Target, uint ReparseTag);
+
         /// <summary>
         /// Sets message count semaphore.
         /// </summary>
@@ -730,8 +1101,10 @@ namespace BuildXL.Processes
             public const uint ErrorDumpLocation             = 0xABCDEF03;
             public const uint SubstituteProcessShim         = 0xABCDEF04;
             public const uint ChildProcessesBreakAwayString = 0xABCDEF05;
+            public const uint KnownReparsePointTargets      = 0xABCDEF06;
             public const uint Flags                         = 0xF1A6B10C;
             public const uint PipId                         = 0xF1A6B10E;
+            public const uint CacheBudgets                  = 0xF1A6B10F;
             public const uint DebugOn                       = 0xDB600001;
             public const uint DebugOff                      = 0xDB600000;
             public const uint ExtraFlags                    = 0xF1A6B10D;
@@ -809,6 +1182,55 @@ namespace BuildXL.Processes
             return directoryTranslator;
         }
 
+        private static void WriteKnownReparsePointTargets(BinaryWriter writer, IReadOnlyDictionary<string, KnownReparsePointTarget>? knownReparsePointTargets)
+        {
+#if DEBUG
+            writer.Write(CheckedCode.KnownReparsePointTargets);
+#endif
+
+            // Write the number of known reparse points.
+            uint knownReparsePointTargetsLen = (uint)(knownReparsePointTargets?.Count ?? 0);
+            writer.Write(knownReparsePointTargetsLen);
+
+            if (knownReparsePointTargetsLen > 0)
+            {
+                foreach (var knownReparsePointTarget in knownReparsePointTargets!)
+                {
+                    WriteChars(writer, knownReparsePointTarget.Key);
+                    WriteChars(writer, knownReparsePointTarget.Value.Target);
+                    writer.Write(knownReparsePointTarget.Value.ReparseTag);
+                }
+            }
+        }
+
+        private static IReadOnlyDictionary<string, KnownReparsePointTarget>? ReadKnownReparsePointTargets(BinaryReader reader)
+        {
+#if DEBUG
+            CheckedCode.EnsureRead(reader, CheckedCode.KnownReparsePointTargets);
+#endif
+
+            uint length = reader.ReadUInt32();
+            if (length == 0)
+            {
+                return null;
+            }
+
+            var knownReparsePointTargets = new Dictionary<string, KnownReparsePointTarget>((int)length, OperatingSystemHelper.PathComparer);
+
+            for (int i = 0; i < length; ++i)
+            {
+                string? path = ReadChars(reader);
+                string? target = ReadChars(reader);
+                uint reparseTag = reader.ReadUInt32();
+                if (path is not null)
+                {
+                    knownReparsePointTargets[path] = new KnownReparsePointTarget(target ?? string.Empty, reparseTag);
+                }
+            }
+
+            return knownReparsePointTargets;
+        }
+
         [SuppressMessage("Microsoft.Globalization", "CA1308:NormalizeStringsToUppercase", Justification = "Architecture strings are USASCII")]
         private static void WriteChildProcessesToBreakAwayFromSandbox(BinaryWriter writer, IReadOnlyCollection<string>? processNames)
         {
@@ -935,6 +1357,25 @@ namespace BuildXL.Processes
             return reader.ReadInt64();
         }
 
+        private void WriteCacheBudgets(BinaryWriter writer)
+        {
+#if DEBUG
+            writer.Write(CheckedCode.CacheBudgets);
+#endif
+            // CODESYNC: DataTypes.h :: ManifestCacheBudgets
+            writer.Write(AccessCacheBudgetKb);
+            writer.Write(FilesCheckedForAccessBudgetKb);
+            writer.Write(ResolvedPathCacheBudgetKb);
+        }
+
+        private static (uint accessCacheKb, uint filesCheckedForAccessKb, uint resolvedPathCacheKb) ReadCacheBudgets(BinaryReader reader)
+        {
+#if DEBUG
+            CheckedCode.EnsureRead(reader, CheckedCode.CacheBudgets);
+#endif
+            return (reader.ReadUInt32(), reader.ReadUInt32(), reader.ReadUInt32());
+        }
+
         private static void WriteReportBlock(BinaryWriter writer, FileAccessSetup setup)
         {
 #if DEBUG
@@ -1058,7 +1499,7 @@ namespace BuildXL.Processes
             }
             else
             {
-                m_rootNode.InternalSerialize(default(NormalizedPathString), writer);
+                m_rootNode.Serialize(writer);
             }
         }
 
@@ -1084,10 +1525,12 @@ namespace BuildXL.Processes
                 WriteInjectionTimeoutBlock(writer, timeoutMins);
                 WriteChildProcessesToBreakAwayFromSandbox(writer, ChildProcessesToBreakawayFromSandbox);
                 WriteTranslationPathStrings(writer, DirectoryTranslator);
+                WriteKnownReparsePointTargets(writer, KnownReparsePointTargets);
                 WriteErrorDumpLocation(writer, InternalDetoursErrorNotificationFile);
                 WriteFlagsBlock(writer, m_fileAccessManifestFlag);
                 WriteExtraFlagsBlock(writer, m_fileAccessManifestExtraFlag);
                 WritePipId(writer, PipId);
+                WriteCacheBudgets(writer);
                 WriteReportBlock(writer, setup);
                 WriteDllBlock(writer, setup);
                 WriteSubstituteProcessShimBlock(writer);
@@ -1131,10 +1574,12 @@ namespace BuildXL.Processes
             using var writer = new BinaryWriter(stream, Encoding.Unicode, true);
             WriteChildProcessesToBreakAwayFromSandbox(writer, ChildProcessesToBreakawayFromSandbox);
             WriteTranslationPathStrings(writer, DirectoryTranslator);
+            WriteKnownReparsePointTargets(writer, KnownReparsePointTargets);
             WriteErrorDumpLocation(writer, InternalDetoursErrorNotificationFile);
             WriteFlagsBlock(writer, m_fileAccessManifestFlag);
             WriteExtraFlagsBlock(writer, m_fileAccessManifestExtraFlag);
             WritePipId(writer, PipId);
+            WriteCacheBudgets(writer);
             WriteChars(writer, m_messageCountSemaphoreName);
 
             // The manifest tree block has to be serialized the last.
@@ -1153,10 +1598,12 @@ namespace BuildXL.Processes
             using var reader = new BinaryReader(stream, Encoding.Unicode, true);
             IReadOnlyCollection<string>? childProcessesToBreakAwayFromSandbox = ReadChildProcessesToBreakAwayFromSandbox(reader);
             DirectoryTranslator? directoryTranslator = ReadTranslationPathStrings(reader);
+            IReadOnlyDictionary<string, KnownReparsePointTarget>? knownReparsePointTargets = ReadKnownReparsePointTargets(reader);
             string? internalDetoursErrorNotificationFile = ReadErrorDumpLocation(reader);
             FileAccessManifestFlag fileAccessManifestFlag = ReadFlagsBlock(reader);
             FileAccessManifestExtraFlag fileAccessManifestExtraFlag = ReadExtraFlagsBlock(reader);
             long pipId = ReadPipId(reader);
+            var cacheBudgets = ReadCacheBudgets(reader);
             string? messageCountSemaphoreName = ReadChars(reader);
 
             byte[] sealedManifestTreeBlock;
@@ -1171,7 +1618,11 @@ namespace BuildXL.Processes
             return new FileAccessManifest(new PathTable(), directoryTranslator, childProcessesToBreakAwayFromSandbox)
             {
                 InternalDetoursErrorNotificationFile = internalDetoursErrorNotificationFile,
+                KnownReparsePointTargets = knownReparsePointTargets,
                 PipId = pipId,
+                AccessCacheBudgetKb = cacheBudgets.accessCacheKb,
+                FilesCheckedForAccessBudgetKb = cacheBudgets.filesCheckedForAccessKb,
+                ResolvedPathCacheBudgetKb = cacheBudgets.resolvedPathCacheKb,
                 m_fileAccessManifestFlag = fileAccessManifestFlag,
                 m_fileAccessManifestExtraFlag = fileAccessManifestExtraFlag,
                 m_sealedManifestTreeBlock = sealedManifestTreeBlock,
@@ -1276,6 +1727,28 @@ namespace BuildXL.Processes
             AlwaysRemoteInjectDetoursFrom32BitProcess = 0x10,
             UnconditionallyEnableLinuxPTraceSandbox = 0x20,
             IgnoreDeviceIoControlGetReparsePoint = 0x40,
+            EnableLinuxSandboxReportBatching = 0x80,
+            EnableLinuxSandboxBinaryReports = 0x100,
+            EnableLinuxSeccompNotifySandbox = 0x200,
+            EnableUtf8Reports = 0x400,
+            CacheProbesOfImmutableInputs = 0x800,
+            ShareManifestAcrossProcesses = 0x1000,
+            ProfileDetours = 0x2000,
+            ShareReportCacheAcrossProcesses = 0x4000,
+            CacheImagePathSearches = 0x8000,
+            CacheFinalPathsByFileId = 0x10000,
+            CacheSubstituteProcessExecutionPluginVerdicts = 0x20000,
+            CoalesceReportMessageCount = 0x40000,
+            EnableLinuxSandboxTraceBuffer = 0x80000,
+            RecordLinuxSandboxAccessTrace = 0x100000,
+            EnableLinuxFanotifySandbox = 0x200000,
+            CacheLinuxPTraceFdPaths = 0x400000,
+            FilterLinuxUntrackedScopes = 0x800000,
+            AggregateLinuxAccessReports = 0x1000000,
+            AdaptiveReportBatching = 0x2000000,
+            DetectLinuxProcessTreeCompletion = 0x4000000,
+            BatchConcurrentReports = 0x8000000,
+            CacheLinuxSymlinkResolution = 0x10000000,
         }
 
         private readonly struct FileAccessScope
@@ -1641,6 +2114,118 @@ namespace BuildXL.Processes
                 ChainMask = 0x03,
             }
 
+            /// <summary>
+            /// Records with at least this many children lay them out with a minimal perfect hash rather than with linear probing.
+            /// </summary>
+            /// <remarks>
+            /// Below that, collision chains are short anyway, and the displacements would take more room than they save.
+            /// </remarks>
+            internal const int PerfectHashMinChildCount = 8;
+
+            /// <summary>
+            /// Attempts per group of children to find a displacement sending them all to free slots, before giving up on the perfect hash.
+            /// </summary>
+            private const uint PerfectHashMaxDisplacement = 1 << 16;
+
+            /// <summary>
+            /// Slot of a child with the given hash in a perfect hash layout of the given number of slots.
+            /// </summary>
+            /// <remarks>
+            /// CODESYNC: DataTypes.h (ManifestRecord::GetPerfectHashSlot)
+            /// The group of a child is its hash modulo the number of displacements; the slot mixes the hash with the displacement of
+            /// the group (MurmurHash3's finalizer), so that trying another displacement moves the whole group somewhere else.
+            /// </remarks>
+            internal static uint GetPerfectHashSlot(uint hash, uint displacement, uint slotCount)
+            {
+                unchecked
+                {
+                    uint x = hash ^ (displacement * 0x9E3779B9);
+                    x ^= x >> 16;
+                    x *= 0x85EBCA6B;
+                    x ^= x >> 13;
+                    x *= 0xC2B2AE35;
+                    x ^= x >> 16;
+                    return x % slotCount;
+                }
+            }
+
+            /// <summary>
+            /// Builds a minimal perfect hash of the given child hashes using hash and displace (CHD): one slot per child, and one
+            /// displacement per group of (about) two children. Returns false if two children have the same hash or if a group
+            /// can't be placed, in which case the children are laid out with linear probing.
+            /// </summary>
+            private static bool TryBuildPerfectHash(uint[] hashes, [NotNullWhen(true)] out uint[]? displacements, [NotNullWhen(true)] out uint[]? slots)
+            {
+                displacements = null;
+                slots = null;
+
+                if (new HashSet<uint>(hashes).Count != hashes.Length)
+                {
+                    return false;
+                }
+
+                uint slotCount = (uint)hashes.Length;
+                uint groupCount = (slotCount + 1) / 2;
+                var groups = new List<int>[groupCount];
+                for (int i = 0; i < hashes.Length; i++)
+                {
+                    uint group = hashes[i] % groupCount;
+                    (groups[group] ??= new List<int>()).Add(i);
+                }
+
+                var groupDisplacements = new uint[groupCount];
+                var childSlots = new uint[hashes.Length];
+                var taken = new bool[slotCount];
+                var groupSlots = new List<uint>();
+
+                // Biggest groups first, while most slots are still free
+                foreach (uint group in Enumerable.Range(0, (int)groupCount).Select(g => (uint)g).OrderByDescending(g => groups[g]?.Count ?? 0))
+                {
+                    List<int>? members = groups[group];
+                    if (members is null)
+                    {
+                        break;
+                    }
+
+                    bool placed = false;
+                    for (uint displacement = 0; displacement < PerfectHashMaxDisplacement && !placed; displacement++)
+                    {
+                        groupSlots.Clear();
+                        foreach (int member in members)
+                        {
+                            uint slot = GetPerfectHashSlot(hashes[member], displacement, slotCount);
+                            if (taken[slot] || groupSlots.Contains(slot))
+                            {
+                                break;
+                            }
+
+                            groupSlots.Add(slot);
+                        }
+
+                        if (groupSlots.Count == members.Count)
+                        {
+                            for (int i = 0; i < members.Count; i++)
+                            {
+                                taken[groupSlots[i]] = true;
+                                childSlots[members[i]] = groupSlots[i];
+                            }
+
+                            groupDisplacements[group] = displacement;
+                            placed = true;
+                        }
+                    }
+
+                    if (!placed)
+                    {
+                        return false;
+                    }
+                }
+
+                displacements = groupDisplacements;
+                slots = childSlots;
+                return true;
+            }
+
             /// <summary>
             /// Add a path to the tree.
             /// </summary>
@@ -1716,6 +2301,7 @@ namespace BuildXL.Processes
             /// <nodoc/>
             public static (Node, NormalizedPathString) InternalDeserialize(BinaryReader reader)
             {
+                long start = reader.BaseStream.Position;
 #if DEBUG
                 uint foodCafe = reader.ReadUInt32(); // "food cafe"
                 Contract.Assert((uint)0xF00DCAFE == foodCafe);
@@ -1725,19 +2311,29 @@ namespace BuildXL.Processes
                 uint nodePolicy = reader.ReadUInt32();
                 uint pathIdValue = reader.ReadUInt32();
                 ulong expectedUsnValue = reader.ReadUInt64();
+                _ = reader.ReadUInt32(); // full reparse point parsing ancestor level, recomputed when serializing
+                uint displacementCount = reader.ReadUInt32();
                 uint bucketCount = reader.ReadUInt32();
 
-                int childrenCount = 0;
+                var childStarts = new List<long>();
                 for (int i = 0; i < bucketCount; i++)
                 {
                     uint offset = reader.ReadUInt32();
+                    _ = reader.ReadUInt32(); // hash of the child, also in the record of the child
+
                     // An offset with 0 means no child was stored there
                     if (offset != 0)
                     {
-                        childrenCount++;
+                        childStarts.Add(start + (offset & ~(uint)FileAccessBucketOffsetFlag.ChainMask));
                     }
                 }
 
+                // The layout of the children is recomputed when serializing
+                for (int i = 0; i < displacementCount; i++)
+                {
+                    _ = reader.ReadUInt32();
+                }
+
                 unchecked
                 {
                     var normalizedPathString = new NormalizedPathString(NormalizedPathString.DeserializeBytes(reader), (int)normalizedFragmentHash);
@@ -1748,13 +2344,17 @@ namespace BuildXL.Processes
                     node.ExpectedUsn = new Usn(expectedUsnValue);
                     node.m_isPolicyFinalized = true;
 
-                    if (childrenCount > 0)
+                    if (childStarts.Count > 0)
                     {
-                        node.m_children = new Dictionary<NormalizedPathString, Node>(childrenCount);
+                        node.m_children = new Dictionary<NormalizedPathString, Node>(childStarts.Count);
                     }
 
-                    for (int i = 0; i < childrenCount; i++)
+                    // Children are not necessarily right after their parent (see Serialize), but they are written in the order they
+                    // were enumerated in, which sorting their offsets gets back
+                    childStarts.Sort();
+                    foreach (long childStart in childStarts)
                     {
+                        reader.BaseStream.Seek(childStart, SeekOrigin.Begin);
                         (Node child, NormalizedPathString childNormalizedPathString) = InternalDeserialize(reader);
                         node.m_children![childNormalizedPathString] = child;
                     }
@@ -1763,7 +2363,45 @@ namespace BuildXL.Processes
                 }
             }
 
-            public void InternalSerialize(NormalizedPathString normalizedFragment, BinaryWriter writer)
+            /// <summary>
+            /// Value of the serialized full reparse point parsing ancestor level when no ancestor of a node enables it.
+            /// </summary>
+            public const uint NoFullReparsePointParsingAncestorLevel = uint.MaxValue;
+
+            /// <summary>
+            /// Levels of the tree holding up to this many records in total, counting from the root, are laid out breadth first.
+            /// </summary>
+            /// <remarks>
+            /// Every lookup goes through the upper levels of the tree: laying them out level by level keeps them together, each
+            /// level's records next to their siblings, so they take fewer cache lines and pages. Below them, each subtree is laid
+            /// out depth first, which keeps it together.
+            /// </remarks>
+            internal const int BreadthFirstRecordBudget = 4096;
+
+            /// <summary>
+            /// A child whose record is yet to be written, along with where its offset goes in the record of its parent.
+            /// </summary>
+            private readonly record struct PendingChild(
+                Node Node,
+                NormalizedPathString Fragment,
+                uint Level,
+                uint FullReparsePointParsingAncestorLevel,
+                long ParentStart,
+                long BucketPosition,
+                uint ChainFlags);
+
+            /// <summary>
+            /// Writes the record of this node, leaving the offsets of its children out: <see cref="WriteChildOffset"/> fills them in
+            /// once the records of the children are written. Returns the children, in the order they are to be written.
+            /// </summary>
+            /// <remarks>
+            /// Besides its own policies, every record carries the level (the root being level 0) of the shallowest strict ancestor
+            /// whose cone policy has <see cref="FileAccessPolicy.EnableFullReparsePointParsing"/>, so the sandbox can tell from the
+            /// record it matched how far up full reparse point parsing goes, without remembering the records on the way down.
+            /// Each bucket holds the hash of its child next to its offset, so the sandbox only reads the children whose hash matches.
+            /// CODESYNC: DataTypes.h (ManifestRecord)
+            /// </remarks>
+            private List<PendingChild> WriteRecord(NormalizedPathString normalizedFragment, BinaryWriter writer, uint level, uint fullReparsePointParsingAncestorLevel)
             {
                 // always finalize when serializing -- note that this prevents adding additional scopes as before
                 if (!IsPolicyFinalized)
@@ -1782,24 +2420,75 @@ namespace BuildXL.Processes
                     writer.Write((uint)NodePolicy);
                     writer.Write((uint)PathId.Value.Value);
                     writer.Write((ulong)ExpectedUsn.Value);
+                    writer.Write(fullReparsePointParsingAncestorLevel);
 
                     var childCount = (uint)(m_children is null ? 0 : m_children.Count);
 
-                    // The children will be added to a hash-table.
+                    // Wide directories get a minimal perfect hash, so looking a child up takes a single comparison.
+                    // The slots are in the enumeration order of m_children, which is the order the children are written in.
+                    uint[]? displacements = null;
+                    uint[]? perfectHashSlots = null;
+                    if (childCount >= PerfectHashMinChildCount)
+                    {
+                        TryBuildPerfectHash(m_children!.Keys.Select(key => (uint)key.HashCode).ToArray(), out displacements, out perfectHashSlots);
+                    }
+
+                    // Otherwise the children will be added to a hash-table.
                     // As it is known that hash-table performance starts to degrade with load factors > 0.7,
                     // we size our hash-table appropriately.
-                    var bucketCount = childCount == 0 ? 0 : checked((uint)(childCount / 0.7));
+                    var bucketCount = displacements is not null ? childCount : childCount == 0 ? 0 : checked((uint)(childCount / 0.7));
                     Contract.Assert((bucketCount == 0) == (childCount == 0));
+                    writer.Write((uint)(displacements?.Length ?? 0));
                     writer.Write(bucketCount);
 
-                    long offsetsStart = 0;
+                    // We are now building a simple hash-table with linear chaining for collisions.
+                    // The lowest two bits of each offset may encode information about whether a collision chain starts at that point, or continues.
+                    // Perfect hash layouts have no collisions, and leave those bits clear.
+                    var chainFlags = new uint[bucketCount];
+                    var hashes = new uint[bucketCount];
+                    var occupied = new bool[bucketCount];
+                    var childBuckets = new uint[childCount];
                     if (m_children is not null)
                     {
-                        offsetsStart = writer.BaseStream.Position;
-                        for (var i = 0; i < bucketCount; i++)
+                        int childIndex = 0;
+                        foreach (var child in m_children)
+                        {
+                            var hash = unchecked((uint)child.Key.HashCode);
+                            var index = perfectHashSlots is not null ? perfectHashSlots[childIndex] : hash % bucketCount;
+
+                            // collision?
+                            if (perfectHashSlots is null && occupied[index])
+                            {
+                                chainFlags[index] |= (uint)FileAccessBucketOffsetFlag.ChainStart;
+                                index = (index + 1) % bucketCount;
+
+                                // collision?
+                                while (occupied[index])
+                                {
+                                    chainFlags[index] |= (uint)FileAccessBucketOffsetFlag.ChainContinuation;
+                                    index = (index + 1) % bucketCount;
+                                }
+                            }
+
+                            occupied[index] = true;
+                            hashes[index] = hash;
+                            childBuckets[childIndex++] = index;
+                        }
+                    }
+
+                    long bucketsStart = writer.BaseStream.Position;
+                    for (var i = 0; i < bucketCount; i++)
+                    {
+                        // the offset is filled in once the child is written
+                        writer.Write(chainFlags[i]);
+                        writer.Write(hashes[i]);
+                    }
+
+                    if (displacements is not null)
+                    {
+                        foreach (uint displacement in displacements)
                         {
-                            // to be patched up later
-                            writer.Write(0U);
+                            writer.Write(displacement);
                         }
                     }
 
@@ -1812,48 +2501,67 @@ namespace BuildXL.Processes
                         writer.Write(0U);
                     }
 
+                    var children = new List<PendingChild>((int)childCount);
                     if (m_children is not null)
                     {
-                        // We are now building a simple hash-table with linear chaining for collisions.
-                        // The lowest two bits of each record may encoding information about whether a collision chain starts at that point, or continues.
-                        uint[] offsets = new uint[bucketCount];
+                        uint childrenFullReparsePointParsingAncestorLevel =
+                            fullReparsePointParsingAncestorLevel == NoFullReparsePointParsingAncestorLevel && (ConePolicy & FileAccessPolicy.EnableFullReparsePointParsing) != 0
+                                ? level
+                                : fullReparsePointParsingAncestorLevel;
+
+                        int childIndex = 0;
                         foreach (var child in m_children)
                         {
-                            var hash = unchecked((uint)child.Key.HashCode);
-                            var index = hash % bucketCount;
-
-                            // collision?
-                            if (offsets[index] != 0)
-                            {
-                                offsets[index] |= (uint)FileAccessBucketOffsetFlag.ChainStart;
-                                index = (index + 1) % bucketCount;
+                            uint index = childBuckets[childIndex++];
+                            children.Add(new PendingChild(
+                                child.Value,
+                                child.Key,
+                                level + 1,
+                                childrenFullReparsePointParsingAncestorLevel,
+                                start,
+                                bucketsStart + index * 2 * sizeof(uint),
+                                chainFlags[index]));
+                        }
+                    }
 
-                                // collision?
-                                while (offsets[index] != 0)
-                                {
-                                    offsets[index] |= (uint)FileAccessBucketOffsetFlag.ChainContinuation;
-                                    index = (index + 1) % bucketCount;
-                                }
-                            }
+                    return children;
+                }
+            }
 
-                            var offset = checked((uint)(writer.BaseStream.Position - start));
-                            Contract.Assume((offset & (uint)FileAccessBucketOffsetFlag.ChainMask) == 0);
-                            offsets[index] = offset;
-                            child.Value.InternalSerialize(child.Key, writer);
-                        }
+            /// <summary>
+            /// Fills in the offset of a child in the record of its parent, now that the record of the child starts at <paramref name="childStart"/>.
+            /// </summary>
+            private static void WriteChildOffset(BinaryWriter writer, in PendingChild child, long childStart)
+            {
+                var offset = checked((uint)(childStart - child.ParentStart));
+                Contract.Assume((offset & (uint)FileAccessBucketOffsetFlag.ChainMask) == 0);
 
-                        long endPosition = writer.BaseStream.Position;
-                        writer.BaseStream.Seek(offsetsStart, SeekOrigin.Begin);
-                        for (var i = 0; i < offsets.Length; i++)
-                        {
-                            writer.Write(offsets[i]);
-                        }
+                long endPosition = writer.BaseStream.Position;
+                writer.BaseStream.Seek(child.BucketPosition, SeekOrigin.Begin);
+                writer.Write(offset | child.ChainFlags);
+                writer.BaseStream.Seek(endPosition, SeekOrigin.Begin);
+            }
 
-                        writer.BaseStream.Seek(endPosition, SeekOrigin.Begin);
-                    }
+            /// <summary>
+            /// Serializes this node and its children, depth first.
+            /// </summary>
+            public void InternalSerialize(NormalizedPathString normalizedFragment, BinaryWriter writer, uint level, uint fullReparsePointParsingAncestorLevel)
+            {
+                foreach (var child in WriteRecord(normalizedFragment, writer, level, fullReparsePointParsingAncestorLevel))
+                {
+                    long childStart = writer.BaseStream.Position;
+                    child.Node.InternalSerialize(child.Fragment, writer, child.Level, child.FullReparsePointParsingAncestorLevel);
+                    WriteChildOffset(writer, child, childStart);
                 }
             }
 
+            /// <summary>
+            /// Serializes this node, as the root, and its children: the upper levels breadth first (see <see cref="BreadthFirstRecordBudget"/>),
+            /// and the subtrees below them depth first.
+            /// </summary>
+            /// <remarks>
+            /// A record only refers to its children through offsets, so the sandbox is unaffected by the order records are laid out in.
+            /// </remarks>
             public void Serialize(BinaryWriter writer)
             {
                 // always finalize when serializing -- note that this prevents adding additional scopes as before
@@ -1862,7 +2570,51 @@ namespace BuildXL.Processes
                     FinalizePolicies();
                 }
 
-                InternalSerialize(default(NormalizedPathString), writer);
+                uint breadthFirstLevels = CountBreadthFirstLevels();
+                var pending = new Queue<PendingChild>(WriteRecord(default(NormalizedPathString), writer, level: 0, NoFullReparsePointParsingAncestorLevel));
+                while (pending.Count > 0)
+                {
+                    PendingChild child = pending.Dequeue();
+                    long childStart = writer.BaseStream.Position;
+                    if (child.Level < breadthFirstLevels)
+                    {
+                        foreach (var grandChild in child.Node.WriteRecord(child.Fragment, writer, child.Level, child.FullReparsePointParsingAncestorLevel))
+                        {
+                            pending.Enqueue(grandChild);
+                        }
+                    }
+                    else
+                    {
+                        child.Node.InternalSerialize(child.Fragment, writer, child.Level, child.FullReparsePointParsingAncestorLevel);
+                    }
+
+                    WriteChildOffset(writer, child, childStart);
+                }
+            }
+
+            /// <summary>
+            /// Number of levels, counting from this node, holding no more than <see cref="BreadthFirstRecordBudget"/> records in total.
+            /// </summary>
+            private uint CountBreadthFirstLevels()
+            {
+                var level = new List<Node> { this };
+                uint levelCount = 0;
+                int recordCount = 0;
+                while (level.Count > 0 && recordCount + level.Count <= BreadthFirstRecordBudget)
+                {
+                    recordCount += level.Count;
+                    levelCount++;
+
+                    // Don't gather a level that won't fit anyway
+                    if (recordCount + level.Sum(node => node.m_children?.Count ?? 0) > BreadthFirstRecordBudget)
+                    {
+                        break;
+                    }
+
+                    level = level.SelectMany(node => (IEnumerable<Node>?)node.m_children?.Values ?? Array.Empty<Node>()).ToList();
+                }
+
+                return levelCount;
             }
 
             private static string ReadUnicodeString(BinaryReader reader, List<byte> buffer)
@@ -1936,18 +2688,26 @@ namespace BuildXL.Processes
 
                             var pathId = reader.ReadUInt32();
                             var expectedUsn = new Usn(reader.ReadUInt64());
+                            _ = reader.ReadUInt32(); // full reparse point parsing ancestor level
+                            int displacementCount = reader.ReadInt32();
 
                             int hashtableCount = reader.ReadInt32();
                             var absoluteChildStarts = new List<long>();
                             for (int i = 0; i < hashtableCount; i++)
                             {
                                 uint childOffset = reader.ReadUInt32();
+                                _ = reader.ReadUInt32(); // hash of the child
                                 if (childOffset != 0)
                                 {
                                     absoluteChildStarts.Add(item.Start + (childOffset & ~0x3));
                                 }
                             }
 
+                            for (int i = 0; i < displacementCount; i++)
+                            {
+                                _ = reader.ReadUInt32();
+                            }
+
                             string partialPath = ReadUnicodeString(reader, buffer);
                             string fullPath = Path.Combine(item.Path, partialPath);
 
@@ -2041,6 +2801,7 @@ namespace BuildXL.Processes
                     Tuple.Create((short)FileAccessPolicy.OverrideAllowWriteForExistingFiles, "OverrideAllowWriteForExistingFiles"),
                     Tuple.Create((short)FileAccessPolicy.TreatDirectorySymlinkAsDirectory, "DirectorySymlinkAsDirectory"),
                     Tuple.Create((short)FileAccessPolicy.EnableFullReparsePointParsing, "EnableFullReparsePointParsing"),
+                    Tuple.Create((short)FileAccessPolicy.NoReparsePointsInCone, "NoReparsePointsInCone"),
                     Tuple.Create((short)FileAccessPolicy.ReportAccess, "ReportAccess"),
                     // Note that composite values must appear before their parts.
                     Tuple.Create((short)FileAccessPolicy.ReportAccessIfExistent, "ReportAccessIfExistent"),
@@ -104,6 +104,16 @@ namespace BuildXL.Processes
         /// </summary>
         EnableFullReparsePointParsing = 0x1000,
 
+        /// <summary>
+        /// If set, no path at or below this scope (including the path of the scope itself) is or goes through a symlink or reparse point,
+        /// so the sandbox can skip resolving paths here.
+        /// </summary>
+        /// <remarks>
+        /// This is a promise made by the engine, not something the sandbox checks: a symlink or junction that does show up under
+        /// such a scope is not resolved, and accesses through it are reported against the unresolved path.
+        /// </remarks>
+        NoReparsePointsInCone = 0x2000,
+
         /// <summary>
         /// If set, then we will report attempts to access files under this scope, whether they exist or not (combination of <see cref="ReportAccessIfExistent"/>
         /// and <see cref="ReportAccessIfNonexistent"/>).
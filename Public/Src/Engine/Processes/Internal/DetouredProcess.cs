@@ -550,11 +550,8 @@ namespace BuildXL.Processes.Internal
 
                         if (!m_jobObjectCreatedExternally)
                         {
-                            m_job = new JobObject(null);
-
-                            // We want the effects of SEM_NOGPFAULTERRORBOX on all children (but can't set that with CreateProcess).
-                            // That's not set otherwise (even if set in this process) due to CREATE_DEFAULT_ERROR_MODE above.
-                            m_job.SetLimitInformation(terminateOnClose: true, failCriticalErrors: false, allowProcessesToBreakAway: m_setJobBreakawayOk);
+                            // Created and configured ahead of time by the pool
+                            m_job = JobObjectPool.Take(allowProcessesToBreakAway: m_setJobBreakawayOk);
                         }
 
                         m_processInjector.Listen();
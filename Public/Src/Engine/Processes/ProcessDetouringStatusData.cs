@@ -90,6 +90,26 @@ namespace BuildXL.Processes
         /// </summary>
         public uint CreateProcessStatusReturn { get; private set; }
 
+        /// <summary>
+        /// Microseconds spent adding the Detours DLL to the imports of the process being started.
+        /// </summary>
+        public long UpdateImportsMicroseconds { get; private set; }
+
+        /// <summary>
+        /// Microseconds spent applying drive mappings to the process being started.
+        /// </summary>
+        public long ApplyMappingMicroseconds { get; private set; }
+
+        /// <summary>
+        /// Microseconds spent duplicating handles into the process being started and copying the payload to it.
+        /// </summary>
+        public long CopyPayloadMicroseconds { get; private set; }
+
+        /// <summary>
+        /// Microseconds spent waiting for the remote injection of the process being started. The value is only relevant if <see cref="NeedsRemoteInjection"/> is true.
+        /// </summary>
+        public long RemoteInjectionMicroseconds { get; private set; }
+
         /// <summary>
         /// Creates an instance of this class.
         /// </summary>
@@ -109,6 +129,10 @@ namespace BuildXL.Processes
         /// <param name="detoured">Whether the process was detoured.</param>
         /// <param name="error">The last error that this create process sets.</param>
         /// <param name="createProcessStatusReturn">The return status of the detoured CreateProcess function.</param>
+        /// <param name="updateImportsMicroseconds">Time spent adding the Detours DLL to the imports of the process.</param>
+        /// <param name="applyMappingMicroseconds">Time spent applying drive mappings to the process.</param>
+        /// <param name="copyPayloadMicroseconds">Time spent duplicating handles and copying the payload to the process.</param>
+        /// <param name="remoteInjectionMicroseconds">Time spent waiting for the remote injection of the process.</param>
         public ProcessDetouringStatusData(
             ulong processId,
             uint reportStatus,
@@ -125,7 +149,11 @@ namespace BuildXL.Processes
             uint creationFlags,
             bool detoured,
             uint error,
-            uint createProcessStatusReturn)
+            uint createProcessStatusReturn,
+            long updateImportsMicroseconds,
+            long applyMappingMicroseconds,
+            long copyPayloadMicroseconds,
+            long remoteInjectionMicroseconds)
         {
             ProcessId = processId;
             ReportStatus = reportStatus;
@@ -143,6 +171,10 @@ namespace BuildXL.Processes
             Detoured = detoured;
             Error = error;
             CreateProcessStatusReturn = createProcessStatusReturn;
+            UpdateImportsMicroseconds = updateImportsMicroseconds;
+            ApplyMappingMicroseconds = applyMappingMicroseconds;
+            CopyPayloadMicroseconds = copyPayloadMicroseconds;
+            RemoteInjectionMicroseconds = remoteInjectionMicroseconds;
         }
 
         /// <nodoc />
@@ -164,7 +196,11 @@ namespace BuildXL.Processes
                 creationFlags: reader.ReadUInt32(),
                 detoured: reader.ReadBoolean(),
                 error: reader.ReadUInt32(),
-                createProcessStatusReturn: reader.ReadUInt32());
+                createProcessStatusReturn: reader.ReadUInt32(),
+                updateImportsMicroseconds: reader.ReadInt64(),
+                applyMappingMicroseconds: reader.ReadInt64(),
+                copyPayloadMicroseconds: reader.ReadInt64(),
+                remoteInjectionMicroseconds: reader.ReadInt64());
         }
 
         /// <nodoc />
@@ -186,6 +222,10 @@ namespace BuildXL.Processes
             writer.Write(Detoured);
             writer.Write(Error);
             writer.Write(CreateProcessStatusReturn);
+            writer.Write(UpdateImportsMicroseconds);
+            writer.Write(ApplyMappingMicroseconds);
+            writer.Write(CopyPayloadMicroseconds);
+            writer.Write(RemoteInjectionMicroseconds);
         }
     }
 }
@@ -52,9 +52,17 @@ namespace BuildXL.Processes
         /// </remarks>
         AugmentedFileAccess = 6,
 
+        /// <summary>
+        /// Report the number of calls to the profiled detoured functions and the time spent in them
+        /// </summary>
+        /// <remarks>
+        /// Only sent when <see cref="FileAccessManifest.ProfileDetours"/> is enabled
+        /// </remarks>
+        DetourProfile = 7,
+
         /// <summary>
         /// This is a non-value, but places an upper-bound on the range of the enum
         /// </summary>
-        Max = 7,
+        Max = 8,
     }
 }
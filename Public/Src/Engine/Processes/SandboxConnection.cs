@@ -58,7 +58,7 @@ namespace BuildXL.Processes
 
         private long LastReportReceivedTimestampTicks => Volatile.Read(ref m_lastReportReceivedTimestampTicks);
 
-        private Sandbox.AccessReportCallback m_AccessReportCallback;
+        private Sandbox.AccessReportBatchCallback m_AccessReportCallback;
 
         static private Sandbox.Configuration ConfigurationForSandboxKind(SandboxKind kind)
         {
@@ -104,7 +104,8 @@ namespace BuildXL.Processes
 
             ProcessUtilities.SetNativeConfiguration(IsInDebugMode);
 
-            m_AccessReportCallback = (Sandbox.AccessReport report, int code) =>
+            // Reports arrive in batches, each holding reports of a single pip
+            m_AccessReportCallback = (Sandbox.AccessReport[] reports, int count, int code) =>
             {
                 if (code != Sandbox.ReportQueueSuccessCode)
                 {
@@ -112,27 +113,36 @@ namespace BuildXL.Processes
                     throw new BuildXLException(message, ExceptionRootCause.MissingRuntimeDependency);
                 }
 
-                // Stamp the access report with a dequeue timestamp
-                report.Statistics.DequeueTime = Sandbox.GetMachAbsoluteTime();
+                // Stamp the access reports with a dequeue timestamp
+                var dequeueTime = Sandbox.GetMachAbsoluteTime();
 
                 // Update last received timestamp
                 Volatile.Write(ref m_lastReportReceivedTimestampTicks, DateTime.UtcNow.Ticks);
 
                 // Remember the latest enqueue time
-                Volatile.Write(ref m_reportQueueLastEnqueueTime, report.Statistics.EnqueueTime);
+                if (count > 0)
+                {
+                    Volatile.Write(ref m_reportQueueLastEnqueueTime, reports[count - 1].Statistics.EnqueueTime);
+                }
 
-                // The only way it can happen that no process is found for 'report.PipId' is when that pip is
-                // explicitly terminated (e.g., because it timed out or Ctrl-c was pressed)
-                if (m_pipProcesses.TryGetValue(report.PipId, out var process))
+                for (int i = 0; i < count; i++)
                 {
-                    // if the process is found, its ProcessId must match the RootPid of the report.
-                    if (process.ProcessId != report.RootPid)
-                    {
-                        throw new BuildXLException("The process id from the lookup did not match the file access report process id", ExceptionRootCause.FailFast);
-                    }
-                    else
+                    var report = reports[i];
+                    report.Statistics.DequeueTime = dequeueTime;
+
+                    // The only way it can happen that no process is found for 'report.PipId' is when that pip is
+                    // explicitly terminated (e.g., because it timed out or Ctrl-c was pressed)
+                    if (m_pipProcesses.TryGetValue(report.PipId, out var process))
                     {
-                        process.PostAccessReport(report);
+                        // if the process is found, its ProcessId must match the RootPid of the report.
+                        if (process.ProcessId != report.RootPid)
+                        {
+                            throw new BuildXLException("The process id from the lookup did not match the file access report process id", ExceptionRootCause.FailFast);
+                        }
+                        else
+                        {
+                            process.PostAccessReport(report);
+                        }
                     }
                 }
             };
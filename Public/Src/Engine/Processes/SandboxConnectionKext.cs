@@ -50,7 +50,24 @@ namespace BuildXL.Processes
         }
 
         /// <inheritdoc />
-        public ulong MinReportQueueEnqueueTime => Volatile.Read(ref m_reportQueueLastEnqueueTime);
+        public ulong MinReportQueueEnqueueTime
+        {
+            get
+            {
+                // queues that haven't received any reports yet don't count
+                ulong min = 0;
+                for (int i = 0; i < m_reportQueueLastEnqueueTimes.Length; i++)
+                {
+                    var enqueueTime = Volatile.Read(ref m_reportQueueLastEnqueueTimes[i]);
+                    if (enqueueTime != 0 && (min == 0 || enqueueTime < min))
+                    {
+                        min = enqueueTime;
+                    }
+                }
+
+                return min;
+            }
+        }
 
         /// <inheritdoc />
         public bool IsInTestMode { get; }
@@ -81,14 +98,14 @@ Use the the following command to load/reload the sandbox kernel extension and fi
         private readonly ConcurrentDictionary<long, SandboxedProcessUnix> m_pipProcesses = new ConcurrentDictionary<long, SandboxedProcessUnix>();
 
         private Sandbox.KextConnectionInfo m_kextConnectionInfo;
-        private readonly Sandbox.KextSharedMemoryInfo m_sharedMemoryInfo;
+        private readonly Sandbox.KextSharedMemoryInfo[] m_sharedMemoryInfos;
         private readonly Sandbox.ManagedFailureCallback m_failureCallback;
-        private readonly Thread m_workerThread;
+        private readonly Thread[] m_workerThreads;
 
         /// <summary>
-        /// Enqueue time of the last received report (or 0 if no reports have been received)
+        /// Enqueue time of the last report received from each report queue (or 0 if no reports have been received from it)
         /// </summary>
-        private ulong m_reportQueueLastEnqueueTime;
+        private readonly ulong[] m_reportQueueLastEnqueueTimes;
 
         /// <summary>
         /// The time (in ticks) when the last report was received.
@@ -106,9 +123,15 @@ Use the the following command to load/reload the sandbox kernel extension and fi
         /// </summary>
         public SandboxConnectionKext(Config config = null, bool skipDisposingForTests = false)
         {
-            m_reportQueueLastEnqueueTime = 0;
             m_kextConnectionInfo = new Sandbox.KextConnectionInfo() { Error = Sandbox.SandboxSuccess };
-            m_sharedMemoryInfo = new Sandbox.KextSharedMemoryInfo() { Error = Sandbox.SandboxSuccess };
+
+            // the kernel extension treats 0 as 1 and caps the number of queues the same way
+            uint numberOfReportQueues = config?.KextConfig?.NumberOfReportQueues ?? 1;
+            numberOfReportQueues = Math.Min(Math.Max(numberOfReportQueues, 1), Sandbox.MaxReportQueues);
+
+            m_reportQueueLastEnqueueTimes = new ulong[numberOfReportQueues];
+            m_sharedMemoryInfos = new Sandbox.KextSharedMemoryInfo[numberOfReportQueues];
+            m_workerThreads = new Thread[numberOfReportQueues];
 
             IsInTestMode = skipDisposingForTests;
 
@@ -153,11 +176,15 @@ Use the the following command to load/reload the sandbox kernel extension and fi
 
             m_failureCallback = config?.FailureCallback;
 
-            // Initialize the shared memory region
-            Sandbox.InitializeKextSharedMemory(m_kextConnectionInfo, ref m_sharedMemoryInfo);
-            if (m_sharedMemoryInfo.Error != Sandbox.SandboxSuccess)
+            // Initialize the shared memory regions (the first one must be initialized first, see InitializeKextSharedMemory)
+            for (uint i = 0; i < m_sharedMemoryInfos.Length; i++)
             {
-                throw new BuildXLException($"Unable to allocate shared memory region for worker (Code:{m_sharedMemoryInfo.Error})");
+                m_sharedMemoryInfos[i] = new Sandbox.KextSharedMemoryInfo() { Error = Sandbox.SandboxSuccess, QueueIndex = i };
+                Sandbox.InitializeKextSharedMemory(m_kextConnectionInfo, ref m_sharedMemoryInfos[i]);
+                if (m_sharedMemoryInfos[i].Error != Sandbox.SandboxSuccess)
+                {
+                    throw new BuildXLException($"Unable to allocate shared memory region for worker {i} (Code:{m_sharedMemoryInfos[i].Error})");
+                }
             }
 
             if (!SetFailureNotificationHandler())
@@ -165,10 +192,14 @@ Use the the following command to load/reload the sandbox kernel extension and fi
                 throw new BuildXLException($"Unable to set sandbox kernel extension failure notification callback handler");
             }
 
-            m_workerThread = new Thread(() => StartReceivingAccessReports(m_sharedMemoryInfo.Address, m_sharedMemoryInfo.Port));
-            m_workerThread.IsBackground = true;
-            m_workerThread.Priority = ThreadPriority.Highest;
-            m_workerThread.Start();
+            for (int i = 0; i < m_workerThreads.Length; i++)
+            {
+                int queueIndex = i;
+                m_workerThreads[i] = new Thread(() => StartReceivingAccessReports(queueIndex, m_sharedMemoryInfos[queueIndex].Address, m_sharedMemoryInfos[queueIndex].Port));
+                m_workerThreads[i].IsBackground = true;
+                m_workerThreads[i].Priority = ThreadPriority.Highest;
+                m_workerThreads[i].Start();
+            }
         }
 
         private unsafe bool SetFailureNotificationHandler()
@@ -197,19 +228,25 @@ Use the the following command to load/reload the sandbox kernel extension and fi
         /// </summary>
         public void ReleaseResources()
         {
-            Sandbox.DeinitializeKextSharedMemory(m_sharedMemoryInfo, m_kextConnectionInfo);
+            foreach (var sharedMemoryInfo in m_sharedMemoryInfos)
+            {
+                Sandbox.DeinitializeKextSharedMemory(sharedMemoryInfo, m_kextConnectionInfo);
+            }
 
-            m_workerThread.Join();
+            foreach (var workerThread in m_workerThreads)
+            {
+                workerThread?.Join();
+            }
 
             Sandbox.DeinitializeKextConnection(m_kextConnectionInfo);
         }
 
         /// <summary>
-        /// Starts listening for reports from the kernel extension on a dedicated thread
+        /// Starts listening for reports from one of the report queues of the kernel extension on a dedicated thread
         /// </summary>
-        private void StartReceivingAccessReports(ulong address, uint port)
+        private void StartReceivingAccessReports(int queueIndex, ulong address, uint port)
         {
-            Sandbox.AccessReportCallback callback = (Sandbox.AccessReport report, int code) =>
+            Sandbox.AccessReportBatchCallback callback = (Sandbox.AccessReport[] reports, int count, int code) =>
             {
                 if (code != Sandbox.ReportQueueSuccessCode)
                 {
@@ -221,20 +258,28 @@ Use the the following command to load/reload the sandbox kernel extension and fi
                 Volatile.Write(ref m_lastReportReceivedTimestampTicks, DateTime.UtcNow.Ticks);
 
                 // Remember the latest enqueue time
-                Volatile.Write(ref m_reportQueueLastEnqueueTime, report.Statistics.EnqueueTime);
+                if (count > 0)
+                {
+                    Volatile.Write(ref m_reportQueueLastEnqueueTimes[queueIndex], reports[count - 1].Statistics.EnqueueTime);
+                }
 
-                // The only way it can happen that no process is found for 'report.PipId' is when that pip is
-                // explicitly terminated (e.g., because it timed out or Ctrl-c was pressed)
-                if (m_pipProcesses.TryGetValue(report.PipId, out var process))
+                for (int i = 0; i < count; i++)
                 {
-                    // if the process is found, its ProcessId must match the RootPid of the report.
-                    if (process.ProcessId != report.RootPid)
-                    {
-                        m_failureCallback?.Invoke(-1, $"Unexpected PID for Pip {report.PipId:X}: Expected {process.ProcessId}, Reported {report.RootPid}");
-                    }
-                    else
+                    var report = reports[i];
+
+                    // The only way it can happen that no process is found for 'report.PipId' is when that pip is
+                    // explicitly terminated (e.g., because it timed out or Ctrl-c was pressed)
+                    if (m_pipProcesses.TryGetValue(report.PipId, out var process))
                     {
-                        process.PostAccessReport(report);
+                        // if the process is found, its ProcessId must match the RootPid of the report.
+                        if (process.ProcessId != report.RootPid)
+                        {
+                            m_failureCallback?.Invoke(-1, $"Unexpected PID for Pip {report.PipId:X}: Expected {process.ProcessId}, Reported {report.RootPid}");
+                        }
+                        else
+                        {
+                            process.PostAccessReport(report);
+                        }
                     }
                 }
             };
@@ -47,6 +47,18 @@ namespace BuildXL.Processes
         // 0 active processes
         private const int EndOfReportsSentinel = -22;
 
+        // Messages bigger than PIPE_BUF are sent in chunks. A chunk is a frame whose length prefix is this value, followed by a chunk header
+        // (pid, message id, message length, chunk offset, chunk length; 4-byte integers each) and the chunk bytes.
+        // CODESYNC: Public/Src/Sandbox/Linux/bxl_observer.hpp (ChunkHeader)
+        private const int ChunkedMessageMarker = -23;
+        private const int ChunkHeaderSize = 5 * sizeof(int);
+
+        // Binary report layout (see FileAccessManifest.EnableLinuxSandboxBinaryReports). Fields are 4-byte integers in host byte order:
+        //  version, pid, access, status, explicitLogging, err, opcode, isDirectory, pathLength, followed by pathLength bytes of path
+        // CODESYNC: Public/Src/Sandbox/Linux/bxl_observer.hpp (BinaryReportHeader)
+        private const uint BinaryReportVersion = 1;
+        private const int BinaryReportHeaderSize = 9 * sizeof(uint);
+
         private static readonly string s_detoursLibFile = SandboxedProcessUnix.EnsureDeploymentFile("libDetours.so");
         private static readonly string s_auditLibFile = SandboxedProcessUnix.EnsureDeploymentFile("libBxlAudit.so");
 
@@ -199,6 +211,77 @@ namespace BuildXL.Processes
                     return totalRead;
                 }
 
+                /// <summary>
+                /// Reads a chunk (the frame marker was already consumed) and adds it to the message it belongs to.
+                /// </summary>
+                /// <remarks>
+                /// Returns false on a read error or a malformed chunk. When the chunk completes its message, the message is removed from
+                /// <paramref name="pendingMessages"/> and returned (together with its length), otherwise the returned length is 0.
+                /// </remarks>
+                private bool TryReceiveChunk(
+                    SafeFileHandle readHandle,
+                    byte[] chunkHeaderBytes,
+                    Dictionary<(int pid, uint messageId), PooledObjectWrapper<byte[]>> pendingMessages,
+                    out PooledObjectWrapper<byte[]> message,
+                    out int messageLength)
+                {
+                    message = default;
+                    messageLength = 0;
+
+                    var numRead = Read(readHandle, chunkHeaderBytes, 0, ChunkHeaderSize);
+                    if (numRead < ChunkHeaderSize)
+                    {
+                        LogError($"Read from FIFO {m_fifoName} failed: read only {numRead} out of {ChunkHeaderSize} bytes of a chunk header.");
+                        return false;
+                    }
+
+                    var pid = BitConverter.ToInt32(chunkHeaderBytes, 0);
+                    var messageId = BitConverter.ToUInt32(chunkHeaderBytes, 1 * sizeof(int));
+                    var totalLength = BitConverter.ToInt32(chunkHeaderBytes, 2 * sizeof(int));
+                    var offset = BitConverter.ToInt32(chunkHeaderBytes, 3 * sizeof(int));
+                    var chunkLength = BitConverter.ToInt32(chunkHeaderBytes, 4 * sizeof(int));
+
+                    if (totalLength <= 0 || offset < 0 || chunkLength <= 0 || offset + chunkLength > totalLength)
+                    {
+                        LogError($"Malformed chunk on FIFO {m_fifoName}: pid {pid}, message {messageId}, length {totalLength}, offset {offset}, chunk length {chunkLength}.");
+                        return false;
+                    }
+
+                    var key = (pid, messageId);
+                    if (offset == 0)
+                    {
+                        // A stale entry can only exist if the sender died in the middle of a message and its pid got reused
+                        if (pendingMessages.TryGetValue(key, out var stale))
+                        {
+                            stale.Dispose();
+                        }
+
+                        pendingMessages[key] = ByteArrayPool.GetInstance(totalLength);
+                    }
+                    else if (!pendingMessages.ContainsKey(key))
+                    {
+                        LogError($"Received chunk at offset {offset} for unknown message {messageId} from pid {pid} on FIFO {m_fifoName}.");
+                        return false;
+                    }
+
+                    var buffer = pendingMessages[key];
+                    numRead = Read(readHandle, buffer.Instance, offset, chunkLength);
+                    if (numRead < chunkLength)
+                    {
+                        LogError($"Read from FIFO {m_fifoName} failed: read only {numRead} out of {chunkLength} bytes of a chunk.");
+                        return false;
+                    }
+
+                    if (offset + chunkLength == totalLength)
+                    {
+                        pendingMessages.Remove(key);
+                        message = buffer;
+                        messageLength = totalLength;
+                    }
+
+                    return true;
+                }
+
                 private void LogDebug(string s) => Info.Process.LogDebug(s);
 
 #if NETCOREAPP
@@ -249,6 +332,10 @@ namespace BuildXL.Processes
                         Analysis.IgnoreResult(fifoHandle.Value);
 
                         byte[] messageLengthBytes = new byte[sizeof(int)];
+                        byte[] chunkHeaderBytes = new byte[ChunkHeaderSize];
+
+                        // Messages being reassembled, keyed by (pid, message id). Only touched by this thread.
+                        var pendingChunkedMessages = new Dictionary<(int pid, uint messageId), PooledObjectWrapper<byte[]>>();
                         while (true)
                         {
                             // read length
@@ -293,14 +380,34 @@ namespace BuildXL.Processes
                                 break;
                             }
 
-                            // read a message of that length
-                            PooledObjectWrapper<byte[]> messageBytes = ByteArrayPool.GetInstance(messageLength);
-                            numRead = Read(readHandle, messageBytes.Instance, 0, messageLength);
-                            if (numRead < messageLength)
+                            PooledObjectWrapper<byte[]> messageBytes;
+                            if (messageLength == ChunkedMessageMarker)
                             {
-                                LogError($"Read from FIFO {fifoName} failed: read only {numRead} out of {messageLength} bytes.");
-                                messageBytes.Dispose();
-                                break;
+                                if (!TryReceiveChunk(readHandle, chunkHeaderBytes, pendingChunkedMessages, out var completedMessage, out var completedMessageLength))
+                                {
+                                    break;
+                                }
+
+                                if (completedMessageLength == 0)
+                                {
+                                    // More chunks are needed for this message
+                                    continue;
+                                }
+
+                                messageLength = completedMessageLength;
+                                messageBytes = completedMessage;
+                            }
+                            else
+                            {
+                                // read a message of that length
+                                messageBytes = ByteArrayPool.GetInstance(messageLength);
+                                numRead = Read(readHandle, messageBytes.Instance, 0, messageLength);
+                                if (numRead < messageLength)
+                                {
+                                    LogError($"Read from FIFO {fifoName} failed: read only {numRead} out of {messageLength} bytes.");
+                                    messageBytes.Dispose();
+                                    break;
+                                }
                             }
 
                             // Add message to processing queue
@@ -316,6 +423,11 @@ namespace BuildXL.Processes
                             }
                         }
 
+                        foreach (var incompleteMessage in pendingChunkedMessages.Values)
+                        {
+                            incompleteMessage.Dispose();
+                        }
+
                         LogDebug($"Completed receiving access reports for fifo '{fifoName}'");
                     }
                     finally
@@ -346,6 +458,8 @@ namespace BuildXL.Processes
             private readonly Sandbox.ManagedFailureCallback m_failureCallback;
             private readonly Dictionary<string, PathCacheRecord> m_pathCache; // TODO: use AbsolutePath instead of string
             private readonly bool m_isInTestMode;
+            private readonly bool m_useBinaryReports;
+            private readonly bool m_useTraceBuffer;
 
             /// <remarks>
             /// This dictionary is accessed both from the report processor threads as well as the thread
@@ -373,9 +487,11 @@ namespace BuildXL.Processes
 
             private ReportProcessor GetReportProcessorFor(Lazy<SafeFileHandle> lazyWriteHandle) => lazyWriteHandle == m_lazyWriteHandle ? m_reportProcessor : m_secondaryReportProcessor;
 
-            internal Info(Sandbox.ManagedFailureCallback failureCallback, SandboxedProcessUnix process, string reportsFifoPath, string secondaryFifoPath, string famPath, bool isInTestMode)
+            internal Info(Sandbox.ManagedFailureCallback failureCallback, SandboxedProcessUnix process, string reportsFifoPath, string secondaryFifoPath, string famPath, bool isInTestMode, bool useBinaryReports, bool useTraceBuffer)
             {
                 m_isInTestMode = isInTestMode;
+                m_useBinaryReports = useBinaryReports;
+                m_useTraceBuffer = useTraceBuffer;
                 m_failureCallback = failureCallback;
                 Process = process;
                 ReportsFifoPath = reportsFifoPath;
@@ -584,6 +700,73 @@ namespace BuildXL.Processes
 
             internal void LogDebug(string s) => Process.LogDebug(s);
 
+            /// <summary>
+            /// Logs the debug messages every process of the pip wrote to its trace buffer (see <see cref="FileAccessManifest.EnableLinuxSandboxTraceBuffer"/>),
+            /// and deletes the trace buffers.
+            /// </summary>
+            /// <remarks>
+            /// A trace buffer is a header followed by a ring of newline-terminated messages. Once the write position went past the capacity
+            /// of the ring, the oldest message was partially overwritten and is skipped.
+            /// CODESYNC: Public/Src/Sandbox/Linux/trace_buffer.hpp
+            /// </remarks>
+            private void LogAndDeleteTraceBuffers()
+            {
+                const ulong TraceBufferMagic = 0x4543415254584c42;
+                const uint TraceBufferVersion = 1;
+                const int TraceBufferHeaderSize = 24;
+
+                // CODESYNC: Public/Src/Sandbox/Linux/bxl_observer.cpp
+                string traceBufferPrefix = Path.GetFileName(FamPath) + ".trace.";
+                string[] traceBuffers;
+                try
+                {
+                    traceBuffers = Directory.GetFiles(Path.GetDirectoryName(FamPath), traceBufferPrefix + "*");
+                }
+                catch (Exception e) when (e is IOException || e is UnauthorizedAccessException)
+                {
+                    LogDebug($"Could not enumerate the sandbox trace buffers: {e.Message}");
+                    return;
+                }
+
+                foreach (string traceBuffer in traceBuffers)
+                {
+                    try
+                    {
+                        byte[] bytes = File.ReadAllBytes(traceBuffer);
+                        if (bytes.Length < TraceBufferHeaderSize
+                            || BitConverter.ToUInt64(bytes, 0) != TraceBufferMagic
+                            || BitConverter.ToUInt32(bytes, 8) != TraceBufferVersion
+                            || bytes.Length != TraceBufferHeaderSize + (long)BitConverter.ToUInt32(bytes, 12))
+                        {
+                            LogDebug($"Skipping malformed sandbox trace buffer '{traceBuffer}'");
+                            continue;
+                        }
+
+                        uint capacity = BitConverter.ToUInt32(bytes, 12);
+                        ulong end = BitConverter.ToUInt64(bytes, 16);
+                        ulong start = end > capacity ? end - capacity : 0;
+                        var messages = new byte[end - start];
+                        for (ulong position = start; position < end; position++)
+                        {
+                            messages[position - start] = bytes[TraceBufferHeaderSize + (int)(position % capacity)];
+                        }
+
+                        string[] lines = Encoding.UTF8.GetString(messages).Split('\n');
+                        // The last line is whatever follows the last newline, which is empty unless a message was being written
+                        for (int i = start > 0 ? 1 : 0; i < lines.Length - 1; i++)
+                        {
+                            LogDebug(lines[i]);
+                        }
+                    }
+                    catch (Exception e) when (e is IOException || e is UnauthorizedAccessException)
+                    {
+                        LogDebug($"Could not read sandbox trace buffer '{traceBuffer}': {e.Message}");
+                    }
+
+                    Analysis.IgnoreResult(FileUtilities.TryDeleteFile(traceBuffer, retryOnFailure: false));
+                }
+            }
+
 #if NETCOREAPP
             private void LogDebug([InterpolatedStringHandlerArgument("")] DebugMessageInterpolatedStringHandler builder) => Process.LogDebug(builder);
 #endif
@@ -607,6 +790,22 @@ namespace BuildXL.Processes
                 m_activeProcesses.Clear();
                 Analysis.IgnoreResult(FileUtilities.TryDeleteFile(ReportsFifoPath, retryOnFailure: false));
                 Analysis.IgnoreResult(FileUtilities.TryDeleteFile(FamPath, retryOnFailure: false));
+                // Libraries already reported by the audit library of the pip
+                // CODESYNC: Public/Src/Sandbox/Linux/bxl_observer.cpp
+                Analysis.IgnoreResult(FileUtilities.TryDeleteFile(FamPath + ".objopen", retryOnFailure: false));
+                // Accesses already reported by the pip (see FileAccessManifest.ShareReportCacheAcrossProcesses)
+                Analysis.IgnoreResult(FileUtilities.TryDeleteFile(FamPath + ".reports", retryOnFailure: false));
+                // PATH searches made by the pip (see FileAccessManifest.CacheImagePathSearches)
+                Analysis.IgnoreResult(FileUtilities.TryDeleteFile(FamPath + ".pathsearches", retryOnFailure: false));
+                // Live processes of the pip (see FileAccessManifest.DetectLinuxProcessTreeCompletion)
+                Analysis.IgnoreResult(FileUtilities.TryDeleteFile(FamPath + ".processes", retryOnFailure: false));
+                // Generations of the symlink resolutions cached by the pip (see FileAccessManifest.CacheLinuxSymlinkResolution)
+                Analysis.IgnoreResult(FileUtilities.TryDeleteFile(FamPath + ".symlinks", retryOnFailure: false));
+                if (m_useTraceBuffer)
+                {
+                    LogAndDeleteTraceBuffers();
+                }
+
                 if (m_isInTestMode)
                 {
                     // The worker thread should complete in all but most extreme cases.  One such extreme case
@@ -649,22 +848,56 @@ namespace BuildXL.Processes
 
                     Contract.Assert(item.length > 0, "No other sentinel but the one above should be posted");
 
-                    var messageStr = s_encoding.GetString(item.wrapper.Instance, index: 0, count: item.length);
-                    var message = messageStr.AsSpan().TrimEnd('\n');
-
-                    // parse the message, consuming the span field by field. The format is:
-                    //  "%s|%d|%d|%d|%d|%d|%d|%d|%s\n", __progname, getpid(), access, status, explicitLogging, err, opcode, isDirectory, reportPath
-                    var restOfMessage = message;
-                    _ = nextField(restOfMessage, out restOfMessage);  // ignore progname
-                    var pid = AssertInt(nextField(restOfMessage, out restOfMessage));
-                    var access = (RequestedAccess)AssertInt(nextField(restOfMessage, out restOfMessage));
-                    var status = AssertInt(nextField(restOfMessage, out restOfMessage));
-                    var explicitlogging = AssertInt(nextField(restOfMessage, out restOfMessage));
-                    var err = AssertInt(nextField(restOfMessage, out restOfMessage));
-                    var opCode = AssertInt(nextField(restOfMessage, out restOfMessage));
-                    var isDirectory = AssertInt(nextField(restOfMessage, out restOfMessage));
-                    var path = nextField(restOfMessage, out restOfMessage);
-                    Contract.Assert(restOfMessage.IsEmpty);  // We should have reached the end of the message
+                    uint pid, status, explicitlogging, err, opCode, isDirectory;
+                    RequestedAccess access;
+                    ReadOnlySpan<char> path;
+
+                    if (m_useBinaryReports)
+                    {
+                        // fixed-layout header followed by the path, see BinaryReportHeaderSize
+                        var bytes = item.wrapper.Instance;
+                        if (item.length < BinaryReportHeaderSize)
+                        {
+                            LogError($"Binary report too short ({item.length} bytes)");
+                            return;
+                        }
+
+                        var version = BitConverter.ToUInt32(bytes, 0);
+                        var pathLength = BitConverter.ToInt32(bytes, 8 * sizeof(uint));
+                        if (version != BinaryReportVersion || pathLength < 0 || BinaryReportHeaderSize + pathLength != item.length)
+                        {
+                            LogError($"Malformed binary report (version {version}, path length {pathLength}, message length {item.length})");
+                            return;
+                        }
+
+                        pid = BitConverter.ToUInt32(bytes, 1 * sizeof(uint));
+                        access = (RequestedAccess)BitConverter.ToUInt32(bytes, 2 * sizeof(uint));
+                        status = BitConverter.ToUInt32(bytes, 3 * sizeof(uint));
+                        explicitlogging = BitConverter.ToUInt32(bytes, 4 * sizeof(uint));
+                        err = BitConverter.ToUInt32(bytes, 5 * sizeof(uint));
+                        opCode = BitConverter.ToUInt32(bytes, 6 * sizeof(uint));
+                        isDirectory = BitConverter.ToUInt32(bytes, 7 * sizeof(uint));
+                        path = s_encoding.GetString(bytes, index: BinaryReportHeaderSize, count: pathLength).AsSpan();
+                    }
+                    else
+                    {
+                        var messageStr = s_encoding.GetString(item.wrapper.Instance, index: 0, count: item.length);
+                        var message = messageStr.AsSpan().TrimEnd('\n');
+
+                        // parse the message, consuming the span field by field. The format is:
+                        //  "%d|%d|%d|%d|%d|%d|%d|%s\n", getpid(), access, status, explicitLogging, err, opcode, isDirectory, reportPath
+                        // The name of the process is not part of it: the process start report of the pid carries the path of its executable
+                        var restOfMessage = message;
+                        pid = AssertInt(nextField(restOfMessage, out restOfMessage));
+                        access = (RequestedAccess)AssertInt(nextField(restOfMessage, out restOfMessage));
+                        status = AssertInt(nextField(restOfMessage, out restOfMessage));
+                        explicitlogging = AssertInt(nextField(restOfMessage, out restOfMessage));
+                        err = AssertInt(nextField(restOfMessage, out restOfMessage));
+                        opCode = AssertInt(nextField(restOfMessage, out restOfMessage));
+                        isDirectory = AssertInt(nextField(restOfMessage, out restOfMessage));
+                        path = nextField(restOfMessage, out restOfMessage);
+                        Contract.Assert(restOfMessage.IsEmpty);  // We should have reached the end of the message
+                    }
 
                     // ignore accesses to libDetours.so, because we injected that library
                     if (path.SequenceEqual(s_detoursLibFile.AsSpan()))
@@ -685,6 +918,19 @@ namespace BuildXL.Processes
                         IsDirectory = isDirectory,
                     };
 
+                    // Sent by the last process of the pip to exit (see FileAccessManifest.DetectLinuxProcessTreeCompletion), after the exit
+                    // reports of every other one: there is no need to wait until we find out on our own that no process is left.
+                    // Not posted: the completion of the process tree is posted once every report got processed (see Info)
+                    if (report.Operation == FileOperation.OpProcessTreeCompleted)
+                    {
+                        Contract.Assert(item.processor.IsPrimaryFifoProcessor, "Process tree completion can only arrive to the primary FIFO");
+
+                        LogDebug($"Received FileOperation.OpProcessTreeCompleted from pid {report.Pid} with {m_activeProcesses.Count} active processes left. Requesting completion to the report processor.");
+                        m_activeProcesses.Clear();
+                        item.processor.Complete();
+                        return;
+                    }
+
                     // update active processes
                     if (report.Operation == FileOperation.OpProcessStart)
                     {
@@ -895,7 +1141,8 @@ namespace BuildXL.Processes
             }
 
             // create and save info for this pip
-            var info = new Info(m_failureCallback, process, fifoPath, secondaryFifoPath, famPath, IsInTestMode);
+            var info = new Info(m_failureCallback, process, fifoPath, secondaryFifoPath, famPath, IsInTestMode, fam.EnableLinuxSandboxBinaryReports,
+                useTraceBuffer: fam.EnableLinuxSandboxLogging && fam.EnableLinuxSandboxTraceBuffer);
             if (!m_pipProcesses.TryAdd(process.PipId, info))
             {
                 throw new BuildXLException($"Process with PidId {process.PipId} already exists");
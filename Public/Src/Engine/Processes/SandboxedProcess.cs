@@ -452,7 +452,7 @@ namespace BuildXL.Processes
         {
             Contract.Assume(!m_processStarted);
 
-            Encoding reportEncoding = Encoding.Unicode;
+            Encoding reportEncoding = m_fileAccessManifest.UseUtf8Reports ? new UTF8Encoding(encoderShouldEmitUTF8Identifier: false) : Encoding.Unicode;
             SafeFileHandle? childHandle = null;
             DetouredProcess detouredProcess = m_detouredProcess!;
 
@@ -56,12 +56,25 @@ namespace BuildXL.Processes
 
         public readonly List<ProcessDetouringStatusData> ProcessDetoursStatuses = new List<ProcessDetouringStatusData>();
         
+        /// <summary>
+        /// Number of counted messages received so far, when <see cref="FileAccessManifest.CoalesceReportMessageCount"/> is on.
+        /// </summary>
+        private int m_receivedMessageCount;
+
         /// <summary>
         /// The last message count in the semaphore.
         /// </summary>
+        /// <remarks>
+        /// When <see cref="FileAccessManifest.CoalesceReportMessageCount"/> is on, Detours only adds to the semaphore when a process exits,
+        /// so received messages are counted here instead of being taken from the semaphore.
+        /// CODESYNC: Public/Src/Sandbox/Windows/DetoursServices/SendReport.h (PublishReportMessageCount)
+        /// </remarks>
         public int GetLastMessageCount()
         {
-            return m_manifest.MessageCountSemaphore?.Release() ?? 0;
+            int lastMessageCount = m_manifest.MessageCountSemaphore?.Release() ?? 0;
+            return m_manifest.MessageCountSemaphore != null && m_manifest.CoalesceReportMessageCount
+                ? lastMessageCount - Volatile.Read(ref m_receivedMessageCount)
+                : lastMessageCount;
         }
 
         private bool m_isFrozen;
@@ -270,14 +283,21 @@ namespace BuildXL.Processes
 
             if (m_manifest.MessageCountSemaphore != null && reportType.ShouldCountReportType())
             {
-                try
+                if (m_manifest.CoalesceReportMessageCount)
                 {
-                    m_manifest.MessageCountSemaphore.WaitOne(0);
+                    Interlocked.Increment(ref m_receivedMessageCount);
                 }
-                catch (Exception ex)
+                else
                 {
-                    MessageProcessingFailure = CreateMessageProcessingFailure(data, I($"Wait error on semaphore for counting Detours messages: {ex.GetLogEventMessage()}."));
-                    return false;
+                    try
+                    {
+                        m_manifest.MessageCountSemaphore.WaitOne(0);
+                    }
+                    catch (Exception ex)
+                    {
+                        MessageProcessingFailure = CreateMessageProcessingFailure(data, I($"Wait error on semaphore for counting Detours messages: {ex.GetLogEventMessage()}."));
+                        return false;
+                    }
                 }
             }
 
@@ -333,6 +353,15 @@ namespace BuildXL.Processes
 
                     break;
 
+                case ReportType.DetourProfile:
+                    if (!DetourProfileReceived(data, out errorMessage))
+                    {
+                        MessageProcessingFailure = CreateMessageProcessingFailure(data, errorMessage);
+                        return false;
+                    }
+
+                    break;
+
                 default:
                     Contract.Assume(false);
                     break;
@@ -364,6 +393,10 @@ namespace BuildXL.Processes
                 out var detoured,
                 out var error,
                 out var createProcessStatusReturn,
+                out var updateImportsMicroseconds,
+                out var applyMappingMicroseconds,
+                out var copyPayloadMicroseconds,
+                out var remoteInjectionMicroseconds,
                 out errorMessage))
             {
                 return false;
@@ -385,7 +418,11 @@ namespace BuildXL.Processes
                 creationFlags,
                 detoured,
                 error,
-                createProcessStatusReturn);
+                createProcessStatusReturn,
+                updateImportsMicroseconds,
+                applyMappingMicroseconds,
+                copyPayloadMicroseconds,
+                remoteInjectionMicroseconds);
 
             // If there is a listener registered and not a process message and notifications allowed, notify over the interface.
             if (m_detoursEventListener != null && (m_detoursEventListener.GetMessageHandlingFlags() & MessageHandlingFlags.ProcessDetoursStatusNotify) != 0)
@@ -424,6 +461,10 @@ namespace BuildXL.Processes
                 out bool detoured,
                 out uint error,
                 out uint createProcessStatusReturn,
+                out long updateImportsMicroseconds,
+                out long applyMappingMicroseconds,
+                out long copyPayloadMicroseconds,
+                out long remoteInjectionMicroseconds,
                 out string errorMessage)
             {
                 reportStatus = 0;
@@ -435,6 +476,10 @@ namespace BuildXL.Processes
                 disableDetours = false;
                 detoured = false;
                 createProcessStatusReturn = 0;
+                updateImportsMicroseconds = 0;
+                applyMappingMicroseconds = 0;
+                copyPayloadMicroseconds = 0;
+                remoteInjectionMicroseconds = 0;
                 error = 0;
                 creationFlags = 0;
                 hJob = 0L;
@@ -446,28 +491,28 @@ namespace BuildXL.Processes
 
                 var items = line.Split('|');
 
-                // A "process data" report is expected to have exactly 14 items. 1 for the process id,
-                // 1 for the command line (last item) and 12 numbers indicating the various counters and
-                // execution times.
+                // A "process detouring status" report is expected to have at least 20 items: the process id, the report status,
+                // the process and application names, 12 numbers describing the process creation, 4 injection timings
+                // and the command line (last item), which may itself contain separators.
                 // If this assert fires, it indicates that we could not successfully parse (split) the data being
                 // sent from the detour (SendReport.cpp).
                 // Make sure the strings are formatted only when the condition is false.
-                if (items.Length < 16)
+                if (items.Length < 20)
                 {
-                    errorMessage = I($"Unexpected message items (potentially due to pipe corruption). Message '{line}'. Expected >= 12 items, Received {items.Length} items");
+                    errorMessage = I($"Unexpected message items (potentially due to pipe corruption). Message '{line}'. Expected >= 20 items, Received {items.Length} items");
                     return false;
                 }
 
-                if (items.Length == 16)
+                if (items.Length == 20)
                 {
-                    startCommandLine = items[15];
+                    startCommandLine = items[19];
                 }
                 else
                 {
                     System.Text.StringBuilder builder = Pools.GetStringBuilder().Instance;
-                    for (int i = 15; i < items.Length; i++)
+                    for (int i = 19; i < items.Length; i++)
                     {
-                        if (i > 15)
+                        if (i > 19)
                         {
                             builder.Append("|");
                         }
@@ -501,7 +546,11 @@ namespace BuildXL.Processes
                     uint.TryParse(items[11], NumberStyles.None, CultureInfo.InvariantCulture, out creationFlags) &&
                     uint.TryParse(items[12], NumberStyles.None, CultureInfo.InvariantCulture, out uintDetoured) &&
                     uint.TryParse(items[13], NumberStyles.None, CultureInfo.InvariantCulture, out error) &&
-                    uint.TryParse(items[14], NumberStyles.None, CultureInfo.InvariantCulture, out createProcessStatusReturn))
+                    uint.TryParse(items[14], NumberStyles.None, CultureInfo.InvariantCulture, out createProcessStatusReturn) &&
+                    long.TryParse(items[15], NumberStyles.None, CultureInfo.InvariantCulture, out updateImportsMicroseconds) &&
+                    long.TryParse(items[16], NumberStyles.None, CultureInfo.InvariantCulture, out applyMappingMicroseconds) &&
+                    long.TryParse(items[17], NumberStyles.None, CultureInfo.InvariantCulture, out copyPayloadMicroseconds) &&
+                    long.TryParse(items[18], NumberStyles.None, CultureInfo.InvariantCulture, out remoteInjectionMicroseconds))
                 {
                     needsInjection = uintNeedsInjection != 0;
                     isCurrent64BitProcess = uintIsCurrent64BitProcess != 0;
@@ -517,6 +566,36 @@ namespace BuildXL.Processes
             }
         }
 
+        private bool DetourProfileReceived(string data, out string errorMessage)
+        {
+            errorMessage = string.Empty;
+
+            // Format: <processId>|<detour>|<calls>|<microseconds>|<detour>|<calls>|<microseconds>...
+            var items = data.Split('|');
+            if (items.Length % 3 != 1 || !uint.TryParse(items[0], NumberStyles.None, CultureInfo.InvariantCulture, out var processId))
+            {
+                errorMessage = I($"Unexpected message items. Message '{data}'. Expected a process id followed by (detour, calls, microseconds) triples, Received {items.Length} items");
+                return false;
+            }
+
+            using var pooledBuilder = Pools.GetStringBuilder();
+            var builder = pooledBuilder.Instance;
+            for (int i = 1; i < items.Length; i += 3)
+            {
+                if (!ulong.TryParse(items[i + 1], NumberStyles.None, CultureInfo.InvariantCulture, out var calls) ||
+                    !ulong.TryParse(items[i + 2], NumberStyles.None, CultureInfo.InvariantCulture, out var microseconds))
+                {
+                    errorMessage = I($"Unexpected detour profile entry '{items[i]}|{items[i + 1]}|{items[i + 2]}'. Message '{data}'");
+                    return false;
+                }
+
+                builder.Append(builder.Length == 0 ? string.Empty : "; ").Append(I($"{items[i]}: {calls} calls, {microseconds}us"));
+            }
+
+            m_loggingAction?.Invoke(LogEventId.LogDetoursProfile, $"[{PipSemiStableHash}] Detours profile for process {processId}: {builder}");
+            return true;
+        }
+
         private bool ProcessDataReportLineReceived(string data, out string errorMessage)
         {
             if (!ProcessDataReportLine.TryParse(
@@ -536,12 +615,23 @@ namespace BuildXL.Processes
                 out var allocatedPoolEntries,
                 out var maxHandleMapEntries,
                 out var handleMapEntries,
+                out var policySearchCacheLookups,
+                out var policySearchCacheHits,
+                out var closedHandlesPoolMisses,
+                out var attachManifestParseMicroseconds,
+                out var attachHandleOverlayMicroseconds,
+                out var attachDetoursMicroseconds,
+                out var attachTotalMicroseconds,
+                out var reportCount,
+                out var reportLatencyP50Microseconds,
+                out var reportLatencyP99Microseconds,
+                out var reportLatencyMaxMicroseconds,
                 out errorMessage))
             {
                 return false;
             }
 
-            m_loggingAction?.Invoke(LogEventId.LogDetoursMaxHeapSize, $"[{PipSemiStableHash}] Maximum detours heap size for process in the pip is {detoursMaxMemHeapSizeInBytes} bytes. The processName '{processName}'. The processId is: {processId}. The manifestSize in bytes is: {manifestSizeInBytes}. The finalDetoursHeapSize in bytes is: {finalDetoursHeapSizeInBytes}. The allocatedPoolEntries is: {allocatedPoolEntries}. The maxHandleMapEntries is: {maxHandleMapEntries}. The handleMapEntries is: {handleMapEntries}.");
+            m_loggingAction?.Invoke(LogEventId.LogDetoursMaxHeapSize, $"[{PipSemiStableHash}] Maximum detours heap size for process in the pip is {detoursMaxMemHeapSizeInBytes} bytes. The processName '{processName}'. The processId is: {processId}. The manifestSize in bytes is: {manifestSizeInBytes}. The finalDetoursHeapSize in bytes is: {finalDetoursHeapSizeInBytes}. The allocatedPoolEntries is: {allocatedPoolEntries}. The maxHandleMapEntries is: {maxHandleMapEntries}. The handleMapEntries is: {handleMapEntries}. The policySearchCacheHits are: {policySearchCacheHits} out of {policySearchCacheLookups} lookups. The closedHandlesPoolMisses is: {closedHandlesPoolMisses}. The process attach took {attachTotalMicroseconds}us (manifest parsing: {attachManifestParseMicroseconds}us, handle overlay: {attachHandleOverlayMicroseconds}us, detours: {attachDetoursMicroseconds}us). The {reportCount} reports took {reportLatencyP50Microseconds}us (median), {reportLatencyP99Microseconds}us (99th percentile) and {reportLatencyMaxMicroseconds}us (max) to be written.");
 
             if (MaxDetoursHeapSize < unchecked((long)detoursMaxMemHeapSizeInBytes))
             {
@@ -1052,6 +1142,17 @@ namespace BuildXL.Processes
                 out uint allocatedPoolEntries,
                 out ulong maxHandleMapEntries,
                 out ulong handleMapEntries,
+                out ulong policySearchCacheLookups,
+                out ulong policySearchCacheHits,
+                out ulong closedHandlesPoolMisses,
+                out ulong attachManifestParseMicroseconds,
+                out ulong attachHandleOverlayMicroseconds,
+                out ulong attachDetoursMicroseconds,
+                out ulong attachTotalMicroseconds,
+                out ulong reportCount,
+                out ulong reportLatencyP50Microseconds,
+                out ulong reportLatencyP99Microseconds,
+                out ulong reportLatencyMaxMicroseconds,
                 out string errorMessage)
             {
                 processName = default;
@@ -1071,8 +1172,19 @@ namespace BuildXL.Processes
                 allocatedPoolEntries = 0;
                 maxHandleMapEntries = 0L;
                 handleMapEntries = 0L;
-
-                const int NumberOfEntriesInMessage = 24;
+                policySearchCacheLookups = 0L;
+                policySearchCacheHits = 0L;
+                closedHandlesPoolMisses = 0L;
+                attachManifestParseMicroseconds = 0L;
+                attachHandleOverlayMicroseconds = 0L;
+                attachDetoursMicroseconds = 0L;
+                attachTotalMicroseconds = 0L;
+                reportCount = 0L;
+                reportLatencyP50Microseconds = 0L;
+                reportLatencyP99Microseconds = 0L;
+                reportLatencyMaxMicroseconds = 0L;
+
+                const int NumberOfEntriesInMessage = 35;
 
                 var items = line.Split('|');
 
@@ -1112,7 +1224,18 @@ namespace BuildXL.Processes
                     ulong.TryParse(items[20], NumberStyles.None, CultureInfo.InvariantCulture, out finalDetoursHeapSizeInBytes) &&
                     uint.TryParse(items[21], NumberStyles.None, CultureInfo.InvariantCulture, out allocatedPoolEntries) &&
                     ulong.TryParse(items[22], NumberStyles.None, CultureInfo.InvariantCulture, out maxHandleMapEntries) &&
-                    ulong.TryParse(items[23], NumberStyles.None, CultureInfo.InvariantCulture, out handleMapEntries))
+                    ulong.TryParse(items[23], NumberStyles.None, CultureInfo.InvariantCulture, out handleMapEntries) &&
+                    ulong.TryParse(items[24], NumberStyles.None, CultureInfo.InvariantCulture, out policySearchCacheLookups) &&
+                    ulong.TryParse(items[25], NumberStyles.None, CultureInfo.InvariantCulture, out policySearchCacheHits) &&
+                    ulong.TryParse(items[26], NumberStyles.None, CultureInfo.InvariantCulture, out closedHandlesPoolMisses) &&
+                    ulong.TryParse(items[27], NumberStyles.None, CultureInfo.InvariantCulture, out attachManifestParseMicroseconds) &&
+                    ulong.TryParse(items[28], NumberStyles.None, CultureInfo.InvariantCulture, out attachHandleOverlayMicroseconds) &&
+                    ulong.TryParse(items[29], NumberStyles.None, CultureInfo.InvariantCulture, out attachDetoursMicroseconds) &&
+                    ulong.TryParse(items[30], NumberStyles.None, CultureInfo.InvariantCulture, out attachTotalMicroseconds) &&
+                    ulong.TryParse(items[31], NumberStyles.None, CultureInfo.InvariantCulture, out reportCount) &&
+                    ulong.TryParse(items[32], NumberStyles.None, CultureInfo.InvariantCulture, out reportLatencyP50Microseconds) &&
+                    ulong.TryParse(items[33], NumberStyles.None, CultureInfo.InvariantCulture, out reportLatencyP99Microseconds) &&
+                    ulong.TryParse(items[34], NumberStyles.None, CultureInfo.InvariantCulture, out reportLatencyMaxMicroseconds))
                 {
                     long fileTime = creationHighDateTime;
                     fileTime = fileTime << 32;
@@ -60,8 +60,21 @@ namespace BuildXL.Processes
         private readonly SandoxedProcessLogAction? m_sandboxedProcessLogAction;
 
         private readonly IList<Task<AsyncProcessExecutor>> m_ptraceRunners;
+
+        /// <summary>
+        /// The first ptrace runner of the pip, which serves as its tracer daemon: processes that need a tracer after it
+        /// are sent to it as attach requests on its standard input, rather than getting a runner of their own.
+        /// </summary>
+        private AsyncProcessExecutor? m_ptraceDaemon;
+        private readonly object m_ptraceDaemonLock = new object();
         private readonly TaskSourceSlim<bool> m_ptraceRunnersCancellation = TaskSourceSlim.Create<bool>();
 
+        /// <summary>
+        /// Source directory of the last directory move reported by each process, which the Linux sandbox reports right before its destination.
+        /// Only accessed from <see cref="HandleAccessReport"/>, which never runs concurrently.
+        /// </summary>
+        private readonly Dictionary<int, string> m_lastDirectoryMoveSources = new Dictionary<int, string>();
+
         /// <summary>
         /// Id of the underlying pip.
         /// </summary>
@@ -918,20 +931,46 @@ namespace BuildXL.Processes
                 //       - since we cannot rewrite the past and directly mutate previously reported paths, we simply enumerate
                 //         the content of the renamed directory and report all the files in there as writes
                 //       - (this is exactly how this is done on Windows, except that it's implemented in the Detours layer)
+                //   - on Linux the sandbox only reports the move of the two roots when the whole subtree is under cones that allow writes,
+                //     so the source paths are reported here as deletes too (the source itself no longer exists, its content is
+                //     mirrored by the destination)
+                else if (report.Operation == FileOperation.OpKAuthMoveSource &&
+                         OperatingSystemHelper.IsLinuxOS &&
+                         report.Status == (uint)FileAccessStatus.Allowed)
+                {
+                    m_lastDirectoryMoveSources[report.Pid] = reportPath;
+                }
                 else if (report.Operation == FileOperation.OpKAuthMoveDest &&
                          report.Status == (uint)FileAccessStatus.Allowed &&
                          FileUtilities.DirectoryExistsNoFollow(reportPath))
                 {
+                    if (m_lastDirectoryMoveSources.Remove(report.Pid, out string? movedFromPath))
+                    {
+                        AccessReport sourceDelete = report;
+                        sourceDelete.Operation = FileOperation.OpKAuthDeleteDir;
+                        sourceDelete.PathOrPipStats = AccessReport.EncodePath(movedFromPath);
+                        ReportFileAccess(ref sourceDelete);
+                    }
+
                     FileUtilities.EnumerateFiles(
                         directoryPath: reportPath,
                         recursive: true,
                         pattern: "*",
                         (dir, fileName, attrs, length) =>
                         {
+                            string path = Path.Combine(dir, fileName);
                             AccessReport reportClone = report;
                             reportClone.Operation = FileOperation.OpKAuthWriteFile;
-                            reportClone.PathOrPipStats = AccessReport.EncodePath(Path.Combine(dir, fileName));
+                            reportClone.PathOrPipStats = AccessReport.EncodePath(path);
                             ReportFileAccess(ref reportClone);
+
+                            if (movedFromPath != null)
+                            {
+                                AccessReport sourceClone = report;
+                                sourceClone.Operation = (attrs & FileAttributes.Directory) != 0 ? FileOperation.OpKAuthDeleteDir : FileOperation.OpKAuthDeleteFile;
+                                sourceClone.PathOrPipStats = AccessReport.EncodePath(movedFromPath + path.Substring(reportPath.Length));
+                                ReportFileAccess(ref sourceClone);
+                            }
                         });
                 }
 
@@ -1090,9 +1129,45 @@ namespace BuildXL.Processes
         }
 
         private void StartPTraceRunner(int pid, string path, bool forceAddExecutionPermission)
+        {
+            lock (m_ptraceDaemonLock)
+            {
+                if (m_ptraceDaemon != null && TrySendPTraceAttachRequest(m_ptraceDaemon, pid, path))
+                {
+                    return;
+                }
+
+                m_ptraceDaemon = StartPTraceDaemon(pid, path, forceAddExecutionPermission);
+            }
+        }
+
+        /// <summary>
+        /// Asks a running tracer daemon to attach to the given process. CODESYNC: PTraceSandbox::ServeAttachRequests
+        /// </summary>
+        private static bool TrySendPTraceAttachRequest(AsyncProcessExecutor daemon, int pid, string path)
+        {
+            try
+            {
+                if (daemon.Process.HasExited)
+                {
+                    return false;
+                }
+
+                daemon.Process.StandardInput.Write($"{pid}\0{path}\0");
+                daemon.Process.StandardInput.Flush();
+                return true;
+            }
+            catch (Exception e) when (e is IOException || e is InvalidOperationException)
+            {
+                // The daemon is going away, a new one is started for this process
+                return false;
+            }
+        }
+
+        private AsyncProcessExecutor StartPTraceDaemon(int pid, string path, bool forceAddExecutionPermission)
         {
             var paths = SandboxConnectionLinuxDetours.GetPaths(RootJailInfo, UniqueName);
-            var args = $"-c {pid} -x {path}";
+            var args = $"-d -c {pid} -x {path}";
             var process = new System.Diagnostics.Process
             {
                 StartInfo = new System.Diagnostics.ProcessStartInfo(PTraceRunnerExecutable.Value, args)
@@ -1101,6 +1176,8 @@ namespace BuildXL.Processes
                     UseShellExecute = false,
                     RedirectStandardError = true,
                     RedirectStandardOutput = true,
+                    RedirectStandardInput = true,
+                    StandardInputEncoding = new UTF8Encoding(encoderShouldEmitUTF8Identifier: false),
                     WorkingDirectory = Path.GetDirectoryName(PTraceRunnerExecutable.Value)
                 },
                 EnableRaisingEvents = true
@@ -1122,6 +1199,7 @@ namespace BuildXL.Processes
 
             ptraceRunner.Start();
             m_ptraceRunners.Add(runnerTask(ptraceRunner));
+            return ptraceRunner;
 
             async Task<AsyncProcessExecutor> runnerTask(AsyncProcessExecutor runner) 
             {
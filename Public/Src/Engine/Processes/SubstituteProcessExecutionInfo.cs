@@ -72,7 +72,7 @@ namespace BuildXL.Processes
     /// <summary>
     /// Process matching information used for including or excluding processes in <see cref="SubstituteProcessExecutionInfo"/>.
     /// </summary>
-    /// <remarks>In unmanaged code this is decoded into class ShimProcessMatch in DetoursHelpers.cpp.</remarks>
+    /// <remarks>In unmanaged code this is compiled into class ShimProcessMatcher in ShimProcessMatcher.h.</remarks>
     public sealed class ShimProcessMatch
     {
         /// <summary>
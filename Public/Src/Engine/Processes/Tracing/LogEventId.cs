@@ -127,6 +127,7 @@ namespace BuildXL.Processes.Tracing
         LogFailedToCreateDirectoryForInternalDetoursFailureFile = 2925,
         LogMismatchedDetoursVerboseCount = 2927,
         LogDetoursMaxHeapSize = 2928,
+        LogDetoursProfile = 2929,
         // Moved to BuildXL.Native
         // MoreBytesWrittenThanBufferSize = 2930,
 
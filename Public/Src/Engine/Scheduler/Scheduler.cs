@@ -6229,6 +6229,7 @@ namespace BuildXL.Scheduler
                             {
                                 ReportQueueSizeMB = m_configuration.Sandbox.KextReportQueueSizeMb,
                                 EnableReportBatching = m_configuration.Sandbox.KextEnableReportBatching,
+                                NumberOfReportQueues = (uint)Math.Max(1, Environment.ProcessorCount / 4),
 #if !PLATFORM_WIN
                                 EnableCatalinaDataPartitionFiltering = OperatingSystemHelperExtension.IsMacWithoutKernelExtensionSupport,
 #endif
@@ -6237,6 +6238,10 @@ namespace BuildXL.Scheduler
                                     CpuUsageBlockPercent = m_configuration.Sandbox.KextThrottleCpuUsageBlockThresholdPercent,
                                     CpuUsageWakeupPercent = m_configuration.Sandbox.KextThrottleCpuUsageWakeupThresholdPercent,
                                     MinAvailableRamMB = m_configuration.Sandbox.KextThrottleMinAvailableRamMB,
+                                    // RAM throttling also kicks in as soon as the OS reports memory pressure (so before swapping starts),
+                                    // and CPU throttling also kicks in when there are twice as many runnable threads as there are cores
+                                    MemoryPressureLevelBlock = m_configuration.Sandbox.KextThrottleMinAvailableRamMB > 0 ? 2u : 0u,
+                                    RunQueueLengthBlockPercent = m_configuration.Sandbox.KextThrottleCpuUsageBlockThresholdPercent > 0 ? 200u : 0u,
                                 }
                             }
                         };
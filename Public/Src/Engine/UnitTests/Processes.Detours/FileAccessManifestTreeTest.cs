@@ -186,6 +186,78 @@ namespace Test.BuildXL.Processes.Detours
             ValidationDataCreator.TestManifestRetrieval(vac.DataItems, fam, serializeManifest);
         }
 
+        /// <summary>
+        /// Directories with many children are laid out with a minimal perfect hash rather than with linear probing.
+        /// Every child must still be found, and paths that are not children must still fall back to the scope.
+        /// </summary>
+        [Theory]
+        [InlineData(true)]
+        [InlineData(false)]
+        public void WideDirectoryManifestTest(bool serializeManifest)
+        {
+            var pt = new PathTable();
+            var fam =
+                new FileAccessManifest(pt, CreateDirectoryTranslator())
+                {
+                    FailUnexpectedFileAccesses = false,
+                    IgnoreCodeCoverage = false,
+                    ReportFileAccesses = false,
+                    ReportUnexpectedFileAccesses = false,
+                    MonitorChildProcesses = false
+                };
+
+            var vac = new ValidationDataCreator(fam, pt);
+
+            AbsolutePath sys32 = vac.AddScope(@"C:\Windows\System32", FileAccessPolicy.AllowReadAlways);
+            for (int i = 0; i < 500; i++)
+            {
+                vac.AddPath($@"C:\Windows\System32\Library{i}.dll", FileAccessPolicy.AllowRead | FileAccessPolicy.ReportAccess);
+            }
+
+            vac.AddScopeCheck(@"C:\Windows\System32\NotInTheManifest.dll", sys32, FileAccessPolicy.AllowReadAlways);
+            vac.AddScopeCheck(@"C:\Windows\System32\Library500.dll", sys32, FileAccessPolicy.AllowReadAlways);
+
+            ValidationDataCreator.TestManifestRetrieval(vac.DataItems, fam, serializeManifest);
+        }
+
+        /// <summary>
+        /// The upper levels of a large tree are laid out breadth first, and the subtrees below them depth first.
+        /// Paths must be found on either side of that boundary.
+        /// </summary>
+        [Theory]
+        [InlineData(true)]
+        [InlineData(false)]
+        public void BreadthFirstLayoutManifestTest(bool serializeManifest)
+        {
+            var pt = new PathTable();
+            var fam =
+                new FileAccessManifest(pt, CreateDirectoryTranslator())
+                {
+                    FailUnexpectedFileAccesses = false,
+                    IgnoreCodeCoverage = false,
+                    ReportFileAccesses = false,
+                    ReportUnexpectedFileAccesses = false,
+                    MonitorChildProcesses = false
+                };
+
+            var vac = new ValidationDataCreator(fam, pt);
+
+            // More records than FileAccessManifest lays out breadth first, spread over a few levels
+            AbsolutePath repo = vac.AddScope(@"C:\Repo", FileAccessPolicy.AllowReadAlways);
+            for (int i = 0; i < 40; i++)
+            {
+                for (int j = 0; j < 40; j++)
+                {
+                    vac.AddPath($@"C:\Repo\Project{i}\Folder{j}\Deeper\File{i}_{j}.cs", FileAccessPolicy.AllowRead | FileAccessPolicy.ReportAccess);
+                }
+            }
+
+            vac.AddScopeCheck(@"C:\Repo\NotInTheManifest.cs", repo, FileAccessPolicy.AllowReadAlways);
+            vac.AddScopeCheck(@"C:\Repo\Project40\Folder0\Deeper\File40_0.cs", repo, FileAccessPolicy.AllowReadAlways);
+
+            ValidationDataCreator.TestManifestRetrieval(vac.DataItems, fam, serializeManifest);
+        }
+
         [Theory]
         [InlineData(true)]
         [InlineData(false)]
@@ -34,7 +34,12 @@ namespace Test.BuildXL.Processes.Detours
                     IgnoreCodeCoverage = false,
                     ReportFileAccesses = false,
                     ReportUnexpectedFileAccesses = false,
-                    MonitorChildProcesses = false
+                    MonitorChildProcesses = false,
+                    KnownReparsePointTargets = new Dictionary<string, FileAccessManifest.KnownReparsePointTarget>
+                    {
+                        [A("C", "Packages", "link")] = new FileAccessManifest.KnownReparsePointTarget(A("C", "Cache", "package"), 0xA0000003),
+                        [A("C", "Source", "source.txt")] = new FileAccessManifest.KnownReparsePointTarget(string.Empty, 0),
+                    }
                 };
 
             var vac = new ValidationDataCreator(fam, pt);
@@ -155,6 +160,12 @@ namespace Test.BuildXL.Processes.Detours
                 XAssert.AreEqual(sidebandLogFile, readInfo.SidebandWriter.SidebandLogFile);
                 XAssert.ArrayEqual(loggerRootDirs, readInfo.SidebandWriter.RootDirectories.ToArray());
 
+                XAssert.AreEqual(fam.KnownReparsePointTargets.Count, readInfo.FileAccessManifest.KnownReparsePointTargets.Count);
+                foreach (var kvp in fam.KnownReparsePointTargets)
+                {
+                    XAssert.AreEqual(kvp.Value, readInfo.FileAccessManifest.KnownReparsePointTargets[kvp.Key]);
+                }
+
                 if (!OperatingSystemHelper.IsUnixOS)
                 {
                     // this validator examines serialized FAM bytes using the same Windows-only native parser used by Detours
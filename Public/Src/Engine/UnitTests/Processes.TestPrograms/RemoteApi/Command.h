@@ -19,6 +19,7 @@ enum class CommandInvocationResult {
 // Arity-specific function types. Note that these are not pointers.
 typedef bool(SingleParam)(std::wstring const&);
 typedef bool(DualParam)(std::wstring const&, std::wstring const&);
+typedef bool(TripleParam)(std::wstring const&, std::wstring const&, std::wstring const&);
 
 // Artiy-specific adapters from a list of size N to fn(1, 2, ...N)
 template<typename Fn> bool invokeList(Fn* fn, std::vector<std::wstring> const& parameters);
@@ -33,6 +34,11 @@ template<> bool invokeList<DualParam>(DualParam* fn, std::vector<std::wstring> c
     return fn(parameters[1], parameters[2]);
 }
 
+template<> bool invokeList<TripleParam>(TripleParam* fn, std::vector<std::wstring> const& parameters) {
+    assert(fn != nullptr);
+    return fn(parameters[1], parameters[2], parameters[3]);
+}
+
 // Arity agnostic base type. Dispatch should be through a pointer to CommandBase.
 // A program may have some collection of CommandBase pointers, and try to dispatch a command string to each.
 class CommandBase {
@@ -22,6 +22,11 @@
 //  EnumerateFileOrDirectoryByHandle: Takes a path parameter to open (e.g. C:\directory\) and enumerates members via NtQueryDirectoryFile.
 //                             Returns 0 on success or 1 on failure (note that success is returned if enumeration proceeded, even if no matches were found or if
 //                             the search path turned out to be a file rather than a directory).
+//  StressFileOperations: Takes a directory, a thread count and a duration in seconds. Each thread runs a mix of CreateFile / CloseHandle,
+//                        GetFileAttributes and FindFirstFileEx enumeration over the files of the directory until the duration elapses,
+//                        for measuring the contention of the detours under real thread counts.
+//                        Operations per second and latency percentiles for each operation are written to stderr, so stdout keeps the response format.
+//                        Returns 0 on success or 1 on failure (bad parameters, or an operation that failed).
 // TODO: These functions should be exposed as a Bond service. For now, we're starting with a trivial text format.
 
 #include "stdafx.h"
@@ -144,11 +149,180 @@ bool DeleteViaNtCreateFile(std::wstring const& path) {
     }
 }
 
+enum class StressOperation {
+    OpenClose,
+    GetAttributes,
+    Enumerate,
+    Count
+};
+
+static wchar_t const* StressOperationNames[] = { L"OpenClose", L"GetAttributes", L"Enumerate" };
+
+// Latencies measured by one thread, in QueryPerformanceCounter ticks, for each StressOperation
+struct StressLatencies {
+    std::vector<LONGLONG> ticks[static_cast<int>(StressOperation::Count)];
+    bool failed = false;
+};
+
+static bool RunStressOperation(StressOperation operation, std::wstring const& file, std::wstring const& searchPath) {
+    switch (operation) {
+    case StressOperation::OpenClose: {
+        const HANDLE handle = CreateFileW(
+            file.c_str(),
+            GENERIC_READ,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr,
+            OPEN_EXISTING,
+            FILE_FLAG_BACKUP_SEMANTICS,
+            NULL);
+        if (handle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        CloseHandle(handle);
+        return true;
+    }
+    case StressOperation::GetAttributes:
+        return GetFileAttributesW(file.c_str()) != INVALID_FILE_ATTRIBUTES;
+    case StressOperation::Enumerate:
+        return EnumerateWithFindFirstFileEx(searchPath);
+    default:
+        assert(false);
+        return false;
+    }
+}
+
+static LONGLONG Percentile(std::vector<LONGLONG> const& sortedTicks, double percentile) {
+    if (sortedTicks.empty()) {
+        return 0;
+    }
+
+    const size_t index = static_cast<size_t>(percentile * static_cast<double>(sortedTicks.size() - 1));
+    return sortedTicks[index];
+}
+
+bool StressFileOperations(std::wstring const& directory, std::wstring const& threadCountString, std::wstring const& secondsString) {
+    const int threadCount = _wtoi(threadCountString.c_str());
+    const int seconds = _wtoi(secondsString.c_str());
+    if (threadCount <= 0 || seconds <= 0) {
+        return false;
+    }
+
+    std::wstring directoryPrefix = directory;
+    if (directoryPrefix.empty() || directoryPrefix.back() != L'\\') {
+        directoryPrefix.push_back(L'\\');
+    }
+
+    const std::wstring searchPath = directoryPrefix + L"*";
+
+    // The files the threads go through; the directory itself when it has none.
+    std::vector<std::wstring> files;
+    WIN32_FIND_DATAW findData{};
+    const HANDLE findHandle = FindFirstFileExW(searchPath.c_str(), FindExInfoBasic, &findData, FindExSearchNameMatch, NULL, 0);
+    if (findHandle != INVALID_HANDLE_VALUE) {
+        do {
+            if ((findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) {
+                files.push_back(directoryPrefix + findData.cFileName);
+            }
+        } while (FindNextFileW(findHandle, &findData));
+
+        FindClose(findHandle);
+    }
+
+    if (files.empty()) {
+        files.push_back(directory);
+    }
+
+    LARGE_INTEGER frequency{};
+    QueryPerformanceFrequency(&frequency);
+
+    LARGE_INTEGER start{};
+    QueryPerformanceCounter(&start);
+    const LONGLONG end = start.QuadPart + frequency.QuadPart * seconds;
+
+    std::vector<StressLatencies> latencies(static_cast<size_t>(threadCount));
+    std::vector<std::thread> threads;
+    std::atomic<bool> go{ false };
+
+    for (int t = 0; t < threadCount; t++) {
+        threads.emplace_back([&, t]() {
+            StressLatencies& mine = latencies[static_cast<size_t>(t)];
+            // Threads start at different files and operations so they don't all hit the same path in lockstep
+            size_t iteration = static_cast<size_t>(t);
+
+            while (!go.load()) {
+                std::this_thread::yield();
+            }
+
+            LARGE_INTEGER now{};
+            QueryPerformanceCounter(&now);
+            while (now.QuadPart < end) {
+                const StressOperation operation = static_cast<StressOperation>(iteration % static_cast<size_t>(StressOperation::Count));
+                std::wstring const& file = files[(iteration / static_cast<size_t>(StressOperation::Count)) % files.size()];
+
+                LARGE_INTEGER before{};
+                QueryPerformanceCounter(&before);
+                mine.failed |= !RunStressOperation(operation, file, searchPath);
+                QueryPerformanceCounter(&now);
+
+                mine.ticks[static_cast<int>(operation)].push_back(now.QuadPart - before.QuadPart);
+                iteration++;
+            }
+        });
+    }
+
+    go.store(true);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    LARGE_INTEGER finish{};
+    QueryPerformanceCounter(&finish);
+    const double elapsedSeconds = static_cast<double>(finish.QuadPart - start.QuadPart) / static_cast<double>(frequency.QuadPart);
+    const double microsecondsPerTick = 1000000.0 / static_cast<double>(frequency.QuadPart);
+
+    bool failed = false;
+    size_t totalOperations = 0;
+    for (int op = 0; op < static_cast<int>(StressOperation::Count); op++) {
+        std::vector<LONGLONG> merged;
+        for (StressLatencies const& threadLatencies : latencies) {
+            merged.insert(merged.end(), threadLatencies.ticks[op].begin(), threadLatencies.ticks[op].end());
+        }
+
+        std::sort(merged.begin(), merged.end());
+        totalOperations += merged.size();
+
+        std::wcerr
+            << StressOperationNames[op]
+            << L": operations=" << merged.size()
+            << L" ops/s=" << static_cast<double>(merged.size()) / elapsedSeconds
+            << L" p50us=" << static_cast<double>(Percentile(merged, 0.50)) * microsecondsPerTick
+            << L" p90us=" << static_cast<double>(Percentile(merged, 0.90)) * microsecondsPerTick
+            << L" p99us=" << static_cast<double>(Percentile(merged, 0.99)) * microsecondsPerTick
+            << L" maxus=" << static_cast<double>(Percentile(merged, 1.0)) * microsecondsPerTick
+            << std::endl;
+    }
+
+    for (StressLatencies const& threadLatencies : latencies) {
+        failed |= threadLatencies.failed;
+    }
+
+    std::wcerr
+        << L"StressFileOperations: threads=" << threadCount
+        << L" seconds=" << elapsedSeconds
+        << L" operations=" << totalOperations
+        << L" ops/s=" << static_cast<double>(totalOperations) / elapsedSeconds
+        << std::endl;
+
+    return !failed;
+}
+
 static CommandBase const* Commands[] = {
     new Command<SingleParam>(L"EnumerateWithFindFirstFileEx", EnumerateWithFindFirstFileEx),
     new Command<SingleParam>(L"EnumerateFileOrDirectoryByHandle", EnumerateFileOrDirectoryByHandle),
     new Command<SingleParam>(L"DeleteViaNtCreateFile", DeleteViaNtCreateFile),
     new Command<DualParam>(L"CreateHardLink", CreateHardLink),
+    new Command<TripleParam>(L"StressFileOperations", StressFileOperations),
     nullptr
 };
 
@@ -208,7 +382,7 @@ int main(int argc, char **argv)
         for (CommandBase const** c = Commands; ; c++) {
             CommandBase const* cmd = *c;
             if (cmd == nullptr) {
-                std::wcerr << L"Unknown command name. Supported: [EnumerateWithFindFirstFileEx, DeleteViaNtCreateFile, CreateHardLink]. Actual: '" << commandName << "'" << std::endl;
+                std::wcerr << L"Unknown command name. Supported: [EnumerateWithFindFirstFileEx, EnumerateFileOrDirectoryByHandle, DeleteViaNtCreateFile, CreateHardLink, StressFileOperations]. Actual: '" << commandName << "'" << std::endl;
                 return 3;
             } 
 
@@ -39,6 +39,9 @@
 #include <vector>
 #include <memory>
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #pragma warning( pop )
 
 // These are taken from ntifs.h in the DDK. Ideally we could include it directly via DDK package.
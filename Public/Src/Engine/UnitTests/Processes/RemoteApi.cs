@@ -132,6 +132,13 @@ namespace Test.BuildXL.Processes
             /// Creates a new hardlink via <c>CreateHardLinkW</c>
             /// </summary>
             CreateHardLink,
+
+            /// <summary>
+            /// Runs a multi-threaded mix of CreateFile / CloseHandle, GetFileAttributes and enumeration over the files of a directory
+            /// for a number of seconds. Operations per second and latency percentiles are written to the standard error.
+            /// The parameters are the directory, the thread count and the duration in seconds.
+            /// </summary>
+            StressFileOperations,
         }
 
         /// <summary>
@@ -154,18 +161,29 @@ namespace Test.BuildXL.Processes
             /// </summary>
             public readonly string Parameter2;
 
+            /// <summary>
+            /// Command parameter 3.
+            /// </summary>
+            public readonly string Parameter3;
+
             /// <nodoc />
-            public Command(CommandType commandType, string parameter1, string parameter2 = null)
+            public Command(CommandType commandType, string parameter1, string parameter2 = null, string parameter3 = null)
             {
                 Contract.Requires(parameter1 != null);
+                Contract.Requires(parameter3 == null || parameter2 != null);
                 Parameter1 = parameter1;
                 Parameter2 = parameter2;
+                Parameter3 = parameter3;
                 CommandType = commandType;
             }
 
             internal string Serialize()
             {
-                if (Parameter2 == null)
+                if (Parameter3 != null)
+                {
+                    return string.Format(CultureInfo.InvariantCulture, "{0:G},{1},{2},{3}", CommandType, Parameter1, Parameter2, Parameter3);
+                }
+                else if (Parameter2 == null)
                 {
                     return string.Format(CultureInfo.InvariantCulture, "{0:G},{1}", CommandType, Parameter1, Parameter2);
                 }
@@ -198,6 +216,18 @@ namespace Test.BuildXL.Processes
             {
                 return new Command(CommandType.CreateHardLink, existingFile, newLink);
             }
+
+            /// <nodoc />
+            public static Command StressFileOperations(string directory, int threadCount, int seconds)
+            {
+                Contract.Requires(threadCount > 0);
+                Contract.Requires(seconds > 0);
+                return new Command(
+                    CommandType.StressFileOperations,
+                    directory,
+                    threadCount.ToString(CultureInfo.InvariantCulture),
+                    seconds.ToString(CultureInfo.InvariantCulture));
+            }
         }
     }
 }
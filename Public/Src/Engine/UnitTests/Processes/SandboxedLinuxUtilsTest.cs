@@ -221,10 +221,10 @@ namespace Test.BuildXL.Processes
 
         [Theory]
         [InlineData(new[] { "HOME=/User/home", "PATH=a:b:c d", "LD_PRELOAD=/before:/my/lib:/after", null }, "/my/lib", new[] { "HOME=/User/home", "PATH=a:b:c d", "LD_PRELOAD=/before:/after" }, false)]
-        [InlineData(new[] { "HOME=/User/home", "PATH=a:b:c d", "LD_PRELOAD=/before", null }, "/my/lib", new[] { "HOME=/User/home", "PATH=a:b:c d", "LD_PRELOAD=/before" }, false)]
+        [InlineData(new[] { "HOME=/User/home", "PATH=a:b:c d", "LD_PRELOAD=/before", null }, "/my/lib", new[] { "HOME=/User/home", "PATH=a:b:c d", "LD_PRELOAD=/before" }, true)]
         [InlineData(new[] { "HOME=/User/home", "PATH=a:b:c d", "USER=someone", null }, "/my/lib", new[] { "HOME=/User/home", "PATH=a:b:c d", "USER=someone" }, true)]
         [InlineData(new[] { "HOME=/User/home", "PATH=a:b:c d", "LD_PRELOAD=", null }, "/my/lib", new[] { "HOME=/User/home", "PATH=a:b:c d", "LD_PRELOAD=" }, true)]
-        [InlineData(new[] { "HOME=/User/home", "PATH=a:b:c d", "LD_PRELOAD=:", null }, "/my/lib", new[] { "HOME=/User/home", "PATH=a:b:c d", "LD_PRELOAD=:" }, false)]
+        [InlineData(new[] { "HOME=/User/home", "PATH=a:b:c d", "LD_PRELOAD=:", null }, "/my/lib", new[] { "HOME=/User/home", "PATH=a:b:c d", "LD_PRELOAD=:" }, true)]
         [InlineData(new[] { "HOME=/User/home", "PATH=a:b:c d", "LD_PRELOAD=/my/lib", null }, "/my/lib", new[] { "HOME=/User/home", "PATH=a:b:c d", "LD_PRELOAD=" }, false)]
         [InlineData(new[] { "HOME=/User/home", "PATH=a:b:c d", "LD_PRELOAD=/my/lib:/after", null }, "/my/lib", new[] { "HOME=/User/home", "PATH=a:b:c d", "LD_PRELOAD=/after" }, false)]
         [InlineData(new[] { "HOME=/User/home", "PATH=a:b:c d", "LD_PRELOAD=/before:/my/lib", null }, "/my/lib", new[] { "HOME=/User/home", "PATH=a:b:c d", "LD_PRELOAD=/before:" }, false)]
@@ -0,0 +1,539 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Generates storms of file system accesses shaped like the ones of real builds, to measure the overhead of each sandbox backend
+// against an unsandboxed run of the same program (see run-access-storm.sh and Run-AccessStorm.ps1).
+//
+// Usage: AccessStorm --scenario <name|all> --root <scratch directory> [--count <n>] [--threads <n>] [--output <file>]
+//
+// Scenarios:
+//   probe      Header include probing: looks headers up through a list of include directories, like a compiler does, so most
+//              stats are misses. Default: 100000 stats.
+//   write      Many small file writes. Default: 10000 files of 1KB.
+//   enumerate  Recursive enumeration of a deep directory tree. Default: 20 enumerations of a tree of ~1.4k directories and ~11k files.
+//   spawn      Process fan-out: starts this program (doing nothing) in waves of --threads concurrent children. Default: 200 processes.
+//   open       Multithreaded opens: --threads threads opening, reading a byte of, and closing a set of files. Default: 200000 opens.
+//
+// Only the storm itself is timed: the files a scenario needs are created beforehand. Each scenario prints one tab separated line:
+// scenario, operations, elapsed milliseconds, operations per second. With --output, the line is also appended to the given file.
+
+#include <atomic>
+#include <chrono>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#if _WIN32
+static const char Separator = '\\';
+#else
+static const char Separator = '/';
+#endif
+
+static string g_self;
+
+// ----------------------------------------------------------------------------
+// Portable file system helpers
+// ----------------------------------------------------------------------------
+
+static bool MakeDirectory(const string &path)
+{
+#if _WIN32
+    return CreateDirectoryA(path.c_str(), nullptr) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+static bool Exists(const string &path)
+{
+#if _WIN32
+    return GetFileAttributesA(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+#else
+    struct stat buffer;
+    return stat(path.c_str(), &buffer) == 0;
+#endif
+}
+
+static bool WriteSmallFile(const string &path, const char *content, size_t length)
+{
+#if _WIN32
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    DWORD written;
+    bool result = WriteFile(handle, content, (DWORD)length, &written, nullptr) && written == length;
+    CloseHandle(handle);
+    return result;
+#else
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    bool result = write(fd, content, length) == (ssize_t)length;
+    close(fd);
+    return result;
+#endif
+}
+
+static bool ReadFirstByte(const string &path)
+{
+    char byte;
+#if _WIN32
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    DWORD read;
+    bool result = ReadFile(handle, &byte, 1, &read, nullptr) != FALSE;
+    CloseHandle(handle);
+    return result;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    bool result = read(fd, &byte, 1) >= 0;
+    close(fd);
+    return result;
+#endif
+}
+
+// Returns the number of entries found under 'directory', recursively
+static size_t EnumerateRecursively(const string &directory)
+{
+    size_t entries = 0;
+#if _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((directory + "\\*").c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        return 0;
+    }
+
+    do
+    {
+        if (strcmp(data.cFileName, ".") == 0 || strcmp(data.cFileName, "..") == 0)
+        {
+            continue;
+        }
+
+        entries++;
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            entries += EnumerateRecursively(directory + Separator + data.cFileName);
+        }
+    } while (FindNextFileA(find, &data));
+
+    FindClose(find);
+#else
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr)
+    {
+        return 0;
+    }
+
+    while (struct dirent *entry = readdir(dir))
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        entries++;
+        if (entry->d_type == DT_DIR)
+        {
+            entries += EnumerateRecursively(directory + Separator + entry->d_name);
+        }
+    }
+
+    closedir(dir);
+#endif
+    return entries;
+}
+
+// Starts this program with '--scenario noop' and returns a handle to wait for it, or 0 on failure
+static intptr_t SpawnSelf()
+{
+#if _WIN32
+    string commandLine = "\"" + g_self + "\" --scenario noop";
+    STARTUPINFOA startupInfo = { sizeof(startupInfo) };
+    PROCESS_INFORMATION processInfo;
+    if (!CreateProcessA(g_self.c_str(), &commandLine[0], nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startupInfo, &processInfo))
+    {
+        return 0;
+    }
+
+    CloseHandle(processInfo.hThread);
+    return (intptr_t)processInfo.hProcess;
+#else
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        execl(g_self.c_str(), g_self.c_str(), "--scenario", "noop", (char *)nullptr);
+        _exit(127);
+    }
+
+    return pid > 0 ? (intptr_t)pid : 0;
+#endif
+}
+
+static bool WaitForChild(intptr_t child)
+{
+#if _WIN32
+    HANDLE process = (HANDLE)child;
+    DWORD exitCode = 1;
+    bool result = WaitForSingleObject(process, INFINITE) == WAIT_OBJECT_0 && GetExitCodeProcess(process, &exitCode) && exitCode == 0;
+    CloseHandle(process);
+    return result;
+#else
+    int status;
+    return waitpid((pid_t)child, &status, 0) == (pid_t)child && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+}
+
+static string FindSelf(const char *argv0)
+{
+#if _WIN32
+    char path[MAX_PATH];
+    DWORD length = GetModuleFileNameA(nullptr, path, MAX_PATH);
+    return length == 0 || length == MAX_PATH ? string(argv0) : string(path, length);
+#else
+    char path[PATH_MAX];
+    return realpath(argv0, path) == nullptr ? string(argv0) : string(path);
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// Scenarios
+// ----------------------------------------------------------------------------
+
+struct Options
+{
+    string root;
+    uint64_t count = 0;     // 0 means the default of the scenario
+    unsigned int threads = 8;
+};
+
+struct Result
+{
+    uint64_t operations;
+    double elapsedMs;
+    bool succeeded;
+};
+
+typedef chrono::steady_clock Clock;
+
+static double MillisecondsSince(Clock::time_point start)
+{
+    return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+static Result Probe(const Options &options)
+{
+    const uint64_t stats = options.count == 0 ? 100000 : options.count;
+    const size_t IncludeDirectories = 20;
+    const size_t Headers = 500;
+
+    // Header i only exists in include directory i % IncludeDirectories
+    vector<string> includeDirectories;
+    for (size_t d = 0; d < IncludeDirectories; d++)
+    {
+        includeDirectories.push_back(options.root + Separator + "include" + to_string(d));
+        MakeDirectory(includeDirectories.back());
+    }
+
+    for (size_t h = 0; h < Headers; h++)
+    {
+        WriteSmallFile(includeDirectories[h % IncludeDirectories] + Separator + "header" + to_string(h) + ".h", "#pragma once\n", 13);
+    }
+
+    Clock::time_point start = Clock::now();
+    uint64_t performed = 0;
+    size_t found = 0;
+    for (size_t h = 0; performed < stats; h = (h + 1) % Headers)
+    {
+        string name = string(1, Separator) + "header" + to_string(h) + ".h";
+        for (size_t d = 0; d < IncludeDirectories && performed < stats; d++)
+        {
+            performed++;
+            if (Exists(includeDirectories[d] + name))
+            {
+                found++;
+                break;
+            }
+        }
+    }
+
+    return { performed, MillisecondsSince(start), found > 0 };
+}
+
+static Result Write(const Options &options)
+{
+    const uint64_t files = options.count == 0 ? 10000 : options.count;
+    const size_t FilesPerDirectory = 100;
+    const string content(1024, 'x');
+
+    for (uint64_t d = 0; d * FilesPerDirectory < files; d++)
+    {
+        MakeDirectory(options.root + Separator + "out" + to_string(d));
+    }
+
+    Clock::time_point start = Clock::now();
+    bool succeeded = true;
+    for (uint64_t f = 0; f < files; f++)
+    {
+        string path = options.root + Separator + "out" + to_string(f / FilesPerDirectory) + Separator + "file" + to_string(f) + ".obj";
+        succeeded &= WriteSmallFile(path, content.data(), content.size());
+    }
+
+    return { files, MillisecondsSince(start), succeeded };
+}
+
+static void CreateTree(const string &directory, size_t depth, size_t fanOut, size_t filesPerDirectory)
+{
+    MakeDirectory(directory);
+    for (size_t f = 0; f < filesPerDirectory; f++)
+    {
+        WriteSmallFile(directory + Separator + "source" + to_string(f) + ".cs", "", 0);
+    }
+
+    if (depth > 0)
+    {
+        for (size_t c = 0; c < fanOut; c++)
+        {
+            CreateTree(directory + Separator + "dir" + to_string(c), depth - 1, fanOut, filesPerDirectory);
+        }
+    }
+}
+
+static Result Enumerate(const Options &options)
+{
+    const uint64_t enumerations = options.count == 0 ? 20 : options.count;
+    string tree = options.root + Separator + "tree";
+    CreateTree(tree, 5, 4, 8);
+
+    Clock::time_point start = Clock::now();
+    uint64_t entries = 0;
+    for (uint64_t i = 0; i < enumerations; i++)
+    {
+        entries += EnumerateRecursively(tree);
+    }
+
+    // One operation per directory entry seen
+    return { entries, MillisecondsSince(start), entries > 0 };
+}
+
+static Result Spawn(const Options &options)
+{
+    const uint64_t processes = options.count == 0 ? 200 : options.count;
+    const unsigned int wave = options.threads == 0 ? 1 : options.threads;
+
+    Clock::time_point start = Clock::now();
+    bool succeeded = true;
+    for (uint64_t started = 0; started < processes; )
+    {
+        vector<intptr_t> children;
+        for (unsigned int i = 0; i < wave && started < processes; i++, started++)
+        {
+            intptr_t child = SpawnSelf();
+            if (child == 0)
+            {
+                succeeded = false;
+                continue;
+            }
+
+            children.push_back(child);
+        }
+
+        for (intptr_t child : children)
+        {
+            succeeded &= WaitForChild(child);
+        }
+    }
+
+    return { processes, MillisecondsSince(start), succeeded };
+}
+
+static Result Open(const Options &options)
+{
+    const uint64_t opens = options.count == 0 ? 200000 : options.count;
+    const unsigned int threadCount = options.threads == 0 ? 1 : options.threads;
+    const size_t Files = 256;
+
+    string directory = options.root + Separator + "inputs";
+    MakeDirectory(directory);
+    vector<string> files;
+    for (size_t f = 0; f < Files; f++)
+    {
+        files.push_back(directory + Separator + "input" + to_string(f) + ".txt");
+        WriteSmallFile(files.back(), "input", 5);
+    }
+
+    atomic<bool> succeeded { true };
+    Clock::time_point start = Clock::now();
+    vector<thread> threads;
+    for (unsigned int t = 0; t < threadCount; t++)
+    {
+        threads.emplace_back([&, t]()
+        {
+            uint64_t threadOpens = opens / threadCount + (t < opens % threadCount ? 1 : 0);
+            for (uint64_t i = 0; i < threadOpens; i++)
+            {
+                if (!ReadFirstByte(files[(i * 31 + t) % Files]))
+                {
+                    succeeded = false;
+                }
+            }
+        });
+    }
+
+    for (thread &t : threads)
+    {
+        t.join();
+    }
+
+    return { opens, MillisecondsSince(start), succeeded.load() };
+}
+
+typedef Result (*Scenario)(const Options &options);
+
+static const struct { const char *name; Scenario run; } Scenarios[] =
+{
+    { "probe",     Probe },
+    { "write",     Write },
+    { "enumerate", Enumerate },
+    { "spawn",     Spawn },
+    { "open",      Open },
+};
+
+static bool RunScenario(const char *name, Scenario run, const Options &options, const char *outputFile)
+{
+    // Every scenario gets a directory of its own, so none of them sees what another one created
+    Options scenarioOptions = options;
+    scenarioOptions.root = options.root + Separator + name;
+    if (!MakeDirectory(options.root) || !MakeDirectory(scenarioOptions.root))
+    {
+        fprintf(stderr, "Could not create '%s'\n", scenarioOptions.root.c_str());
+        return false;
+    }
+
+    Result result = run(scenarioOptions);
+
+    char line[256];
+    snprintf(line, sizeof(line), "%s\t%llu\t%.1f\t%.0f\n", name, (unsigned long long)result.operations, result.elapsedMs,
+        result.elapsedMs > 0 ? result.operations * 1000.0 / result.elapsedMs : 0.0);
+    fputs(line, stdout);
+
+    if (outputFile != nullptr)
+    {
+        FILE *output = fopen(outputFile, "a");
+        if (output != nullptr)
+        {
+            fputs(line, output);
+            fclose(output);
+        }
+    }
+
+    if (!result.succeeded)
+    {
+        fprintf(stderr, "Scenario '%s' failed\n", name);
+    }
+
+    return result.succeeded;
+}
+
+int main(int argc, char **argv)
+{
+    g_self = FindSelf(argv[0]);
+
+    const char *scenario = nullptr;
+    const char *outputFile = nullptr;
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--scenario") == 0)
+        {
+            scenario = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--root") == 0)
+        {
+            options.root = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--count") == 0)
+        {
+            options.count = strtoull(argv[i + 1], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--threads") == 0)
+        {
+            options.threads = (unsigned int)atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--output") == 0)
+        {
+            outputFile = argv[i + 1];
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+            return 2;
+        }
+    }
+
+    // What the spawn scenario starts
+    if (scenario != nullptr && strcmp(scenario, "noop") == 0)
+    {
+        return 0;
+    }
+
+    if (scenario == nullptr || options.root.empty())
+    {
+        fprintf(stderr, "Usage: %s --scenario <name|all> --root <scratch directory> [--count <n>] [--threads <n>] [--output <file>]\n", argv[0]);
+        return 2;
+    }
+
+    bool all = strcmp(scenario, "all") == 0;
+    bool ran = false;
+    bool succeeded = true;
+    for (const auto &candidate : Scenarios)
+    {
+        if (all || strcmp(scenario, candidate.name) == 0)
+        {
+            ran = true;
+            succeeded &= RunScenario(candidate.name, candidate.run, options, outputFile);
+        }
+    }
+
+    if (!ran)
+    {
+        fprintf(stderr, "Unknown scenario '%s'\n", scenario);
+        return 2;
+    }
+
+    return succeeded ? 0 : 1;
+}
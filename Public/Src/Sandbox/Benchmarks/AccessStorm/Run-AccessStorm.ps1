@@ -0,0 +1,113 @@
+<#
+.SYNOPSIS
+    Runs the AccessStorm scenarios unsandboxed (the baseline) and under Detours, then prints, for every scenario and
+    backend, the median run time and its overhead over the baseline. Windows counterpart of run-access-storm.sh.
+
+.PARAMETER Backends
+    baseline (AccessStorm.exe run directly), unsandboxed (bxl with /unsafe_DisableDetours+) and detours (the default sandbox).
+#>
+param(
+    [Parameter(Mandatory = $true)]
+    [string]$BuildXLBin,
+
+    [Parameter(Mandatory = $true)]
+    [string]$Exe,
+
+    [string[]]$Backends = @("baseline", "unsandboxed", "detours"),
+    [string[]]$Scenarios = @("probe", "write", "enumerate", "spawn", "open"),
+    [int]$Repetitions = 3,
+    [int]$Count = 0,
+    [int]$Threads = 0,
+    [string]$Work = (Join-Path (Get-Location) "access-storm")
+)
+
+$ErrorActionPreference = "Stop"
+
+$harnessConfig = Join-Path $PSScriptRoot "Harness\config.dsc"
+$Exe = (Resolve-Path $Exe).Path
+New-Item -ItemType Directory -Force -Path $Work | Out-Null
+
+$optionalArgs = @()
+$optionalProperties = @()
+if ($Count -gt 0) {
+    $optionalArgs += @("--count", $Count)
+    $optionalProperties += "/p:ACCESS_STORM_COUNT=$Count"
+}
+if ($Threads -gt 0) {
+    $optionalArgs += @("--threads", $Threads)
+    $optionalProperties += "/p:ACCESS_STORM_THREADS=$Threads"
+}
+
+# Result lines AccessStorm printed, prefixed with the name of the backend they ran under
+$results = New-Object System.Collections.Generic.List[object]
+
+function Collect([string]$backend, [string[]]$files) {
+    foreach ($line in (Get-Content $files)) {
+        $fields = $line -split "`t"
+        $results.Add([pscustomobject]@{ Backend = $backend; Scenario = $fields[0]; Operations = [long]$fields[1]; ElapsedMs = [double]$fields[2] })
+    }
+}
+
+function Run-Baseline {
+    $scratch = Join-Path $Work "baseline"
+    $output = Join-Path $Work "baseline.tsv"
+    Remove-Item -Force -ErrorAction SilentlyContinue $output
+    foreach ($scenario in $Scenarios) {
+        for ($i = 0; $i -lt $Repetitions; $i++) {
+            Remove-Item -Recurse -Force -ErrorAction SilentlyContinue $scratch
+            & $Exe --scenario $scenario --root $scratch @optionalArgs --output $output | Out-Null
+            if ($LASTEXITCODE -ne 0) { throw "AccessStorm $scenario failed" }
+        }
+    }
+
+    Collect "baseline" @($output)
+}
+
+function Run-BuildXL([string]$backend, [string[]]$backendArgs) {
+    $out = Join-Path $Work $backend
+    Remove-Item -Recurse -Force -ErrorAction SilentlyContinue $out
+    & (Join-Path $BuildXLBin "bxl.exe") `
+        "/c:$harnessConfig" `
+        "/p:BUILDXL_BIN=$BuildXLBin" `
+        "/p:ACCESS_STORM_EXE=$Exe" `
+        "/p:ACCESS_STORM_OUT=$out\Out" `
+        "/p:ACCESS_STORM_SCENARIOS=$($Scenarios -join ',')" `
+        "/p:ACCESS_STORM_REPETITIONS=$Repetitions" `
+        @optionalProperties `
+        "/o:$out\Objects" `
+        "/logsDirectory:$out\Logs" `
+        "/cacheDirectory:$out\Cache" `
+        "/incrementalScheduling-" `
+        "/logObservedFileAccesses-" `
+        @backendArgs > "$out.log"
+    if ($LASTEXITCODE -ne 0) { throw "bxl failed under '$backend', see $out.log" }
+
+    Collect $backend @(Get-ChildItem -Recurse -Filter result.tsv "$out\Out" | ForEach-Object { $_.FullName })
+}
+
+foreach ($backend in $Backends) {
+    Write-Host "Running under '$backend'"
+    switch ($backend) {
+        "baseline"    { Run-Baseline }
+        "unsandboxed" { Run-BuildXL "unsandboxed" @("/unsafe_DisableDetours+") }
+        "detours"     { Run-BuildXL "detours" @() }
+        default       { throw "Unknown backend '$backend'" }
+    }
+}
+
+$medians = $results | Group-Object Scenario, Backend | ForEach-Object {
+    $times = @($_.Group | Sort-Object ElapsedMs | ForEach-Object { $_.ElapsedMs })
+    [pscustomobject]@{
+        Scenario = $_.Group[0].Scenario
+        Backend = $_.Group[0].Backend
+        Operations = $_.Group[0].Operations
+        MedianMs = $times[[int][math]::Floor(($times.Count - 1) / 2)]
+    }
+}
+
+$medians | Sort-Object Scenario, Backend | ForEach-Object {
+    $scenario = $_.Scenario
+    $baseline = $medians | Where-Object { $_.Scenario -eq $scenario -and $_.Backend -eq "baseline" }
+    $overhead = if ($baseline -and $baseline.MedianMs -gt 0) { "{0:+0.0;-0.0}%" -f (($_.MedianMs - $baseline.MedianMs) / $baseline.MedianMs * 100) } else { "-" }
+    $_ | Add-Member -PassThru Overhead $overhead
+} | Format-Table Scenario, Backend, Operations, MedianMs, Overhead
@@ -0,0 +1,152 @@
+#!/bin/bash
+
+# Runs the AccessStorm scenarios unsandboxed (the baseline) and under each sandbox backend available on this machine,
+# then prints, for every scenario and backend, the median run time and its overhead over the baseline.
+#
+# Usage: run-access-storm.sh --buildxl-bin <BuildXL binaries> [--exe <AccessStorm>] [--backends <b1,b2,...>]
+#                            [--scenarios <s1,s2,...>] [--repetitions <n>] [--count <n>] [--threads <n>] [--work <directory>]
+#
+# Backends: baseline (AccessStorm run directly), unsandboxed (bxl with /unsafe_DisableDetours+), and
+#   on Linux:  interpose (the default sandbox), ptrace (/forceEnableLinuxPTraceSandbox+)
+#   on macOS:  es (/sandboxKind:macOsEndpointSecurity), hybrid (/sandboxKind:macOsHybrid), kext (/sandboxKind:macOsKext)
+# When --exe is not given, AccessStorm.cpp is compiled with the c++ on the path.
+
+set -e
+
+readonly MY_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+readonly ALL_SCENARIOS="probe,write,enumerate,spawn,open"
+
+declare arg_BuildXLBin="$BUILDXL_BIN"
+declare arg_Exe=""
+declare arg_Backends=""
+declare arg_Scenarios="$ALL_SCENARIOS"
+declare arg_Repetitions=3
+declare arg_Count=""
+declare arg_Threads=""
+declare arg_Work="$(pwd)/access-storm"
+
+while [[ $# -gt 0 ]]; do
+    case "$1" in
+        --buildxl-bin) arg_BuildXLBin="$2"; shift ;;
+        --exe)         arg_Exe="$2"; shift ;;
+        --backends)    arg_Backends="$2"; shift ;;
+        --scenarios)   arg_Scenarios="$2"; shift ;;
+        --repetitions) arg_Repetitions="$2"; shift ;;
+        --count)       arg_Count="$2"; shift ;;
+        --threads)     arg_Threads="$2"; shift ;;
+        --work)        arg_Work="$2"; shift ;;
+        *) echo "Unknown argument '$1'"; exit 1 ;;
+    esac
+    shift
+done
+
+if [[ -z "$arg_Backends" ]]; then
+    if [[ "$(uname)" == "Darwin" ]]; then
+        arg_Backends="baseline,unsandboxed,es,hybrid,kext"
+    else
+        arg_Backends="baseline,unsandboxed,interpose,ptrace"
+    fi
+fi
+
+mkdir -p "$arg_Work"
+readonly resultsFile="$arg_Work/results.tsv"
+rm -f "$resultsFile"
+
+if [[ -z "$arg_Exe" ]]; then
+    arg_Exe="$arg_Work/bin/AccessStorm"
+    mkdir -p "$arg_Work/bin"
+    c++ -std=c++17 -O2 -o "$arg_Exe" "$MY_DIR/AccessStorm.cpp" -pthread
+fi
+
+# Prefixes every result line AccessStorm printed with the name of the backend it ran under
+function collect {
+    local backend="$1"
+    shift
+    cat "$@" | sed "s/^/$backend\t/" >> "$resultsFile"
+}
+
+function runBaseline {
+    local scratch="$arg_Work/baseline"
+    local output="$arg_Work/baseline.tsv"
+    rm -f "$output"
+    for scenario in ${arg_Scenarios//,/ }; do
+        for ((i = 0; i < arg_Repetitions; i++)); do
+            rm -rf "$scratch"
+            "$arg_Exe" --scenario "$scenario" --root "$scratch" ${arg_Count:+--count "$arg_Count"} ${arg_Threads:+--threads "$arg_Threads"} --output "$output" > /dev/null
+        done
+    done
+
+    collect baseline "$output"
+}
+
+function runBuildXL {
+    local backend="$1"
+    shift
+    local out="$arg_Work/$backend"
+
+    if [[ -z "$arg_BuildXLBin" ]]; then
+        echo "--buildxl-bin (or BUILDXL_BIN) is needed to run under '$backend'"
+        exit 1
+    fi
+
+    rm -rf "$out"
+    "$arg_BuildXLBin/bxl" \
+        "/c:$MY_DIR/Harness/config.dsc" \
+        "/p:BUILDXL_BIN=$arg_BuildXLBin" \
+        "/p:ACCESS_STORM_EXE=$arg_Exe" \
+        "/p:ACCESS_STORM_OUT=$out/Out" \
+        "/p:ACCESS_STORM_SCENARIOS=$arg_Scenarios" \
+        "/p:ACCESS_STORM_REPETITIONS=$arg_Repetitions" \
+        ${arg_Count:+"/p:ACCESS_STORM_COUNT=$arg_Count"} \
+        ${arg_Threads:+"/p:ACCESS_STORM_THREADS=$arg_Threads"} \
+        "/o:$out/Objects" \
+        "/logsDirectory:$out/Logs" \
+        "/cacheDirectory:$out/Cache" \
+        "/incrementalScheduling-" \
+        "/logObservedFileAccesses-" \
+        "$@" > "$out.log" || (echo "bxl failed under '$backend', see $out.log" && exit 1)
+
+    collect "$backend" $(find "$out/Out" -name result.tsv)
+}
+
+for backend in ${arg_Backends//,/ }; do
+    echo "Running under '$backend'"
+    case "$backend" in
+        baseline)    runBaseline ;;
+        unsandboxed) runBuildXL unsandboxed "/unsafe_DisableDetours+" ;;
+        interpose)   runBuildXL interpose ;;
+        ptrace)      runBuildXL ptrace "/forceEnableLinuxPTraceSandbox+" ;;
+        es)          runBuildXL es "/sandboxKind:macOsEndpointSecurity" ;;
+        hybrid)      runBuildXL hybrid "/sandboxKind:macOsHybrid" ;;
+        kext)        runBuildXL kext "/sandboxKind:macOsKext" ;;
+        *) echo "Unknown backend '$backend'"; exit 1 ;;
+    esac
+done
+
+# Lines are: backend, scenario, operations, elapsed ms, operations per second
+echo
+sort -k2,2 -k1,1 -k4,4n "$resultsFile" | awk -F'\t' '
+function flush() {
+    if (count == 0) return
+    median = times[int((count + 1) / 2)]
+    if (backend == "baseline") baseline[scenario] = median
+    lines[++lineCount] = sprintf("%s\t%s\t%d\t%.1f", scenario, backend, operations, median)
+    medians[lineCount] = median
+    scenarios[lineCount] = scenario
+    count = 0
+}
+{
+    if ($1 != backend || $2 != scenario) flush()
+    backend = $1; scenario = $2; operations = $3
+    times[++count] = $4
+}
+END {
+    flush()
+    printf "%-10s %-12s %12s %14s %10s\n", "scenario", "backend", "operations", "median ms", "overhead"
+    for (i = 1; i <= lineCount; i++) {
+        split(lines[i], fields, "\t")
+        base = baseline[scenarios[i]]
+        overhead = base > 0 ? sprintf("%+.1f%%", (medians[i] - base) / base * 100) : "-"
+        printf "%-10s %-12s %12d %14.1f %10s\n", fields[1], fields[2], fields[3], fields[4], overhead
+    }
+}'
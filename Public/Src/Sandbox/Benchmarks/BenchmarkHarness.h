@@ -0,0 +1,99 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Minimal benchmark runner shared by the sandbox benchmarks.
+//
+// Every benchmark is a function taking the number of operations to run. The runner calibrates that number so a run takes
+// about kTargetRunTime, then repeats the run and reports the fastest and median time per operation: the fastest run is the
+// least noisy estimate of the cost of the code, the median shows how much the machine interfered.
+// Results are printed as tab-separated lines so they can be diffed between builds.
+class BenchmarkRunner final
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static constexpr std::chrono::milliseconds kTargetRunTime { 200 };
+
+    BenchmarkRunner(const char *filter, unsigned int repetitions)
+        : m_filter(filter == nullptr ? "" : filter), m_repetitions(std::max(1u, repetitions))
+    {
+        printf("benchmark\toperations\tmin ns/op\tmedian ns/op\n");
+    }
+
+    bool IsSelected(const std::string &name) const
+    {
+        return m_filter.empty() || name.find(m_filter) != std::string::npos;
+    }
+
+    // Runs 'benchmark' (a callable taking a uint64_t number of operations) if its name matches the filter
+    template <typename TBenchmark>
+    void Run(const std::string &name, TBenchmark benchmark)
+    {
+        if (!IsSelected(name))
+        {
+            return;
+        }
+
+        uint64_t operations = Calibrate(benchmark);
+
+        std::vector<double> nsPerOperation;
+        for (unsigned int i = 0; i < m_repetitions; i++)
+        {
+            nsPerOperation.push_back((double)TimeRun(benchmark, operations) / operations);
+        }
+
+        std::sort(nsPerOperation.begin(), nsPerOperation.end());
+        printf("%s\t%llu\t%.1f\t%.1f\n", name.c_str(), (unsigned long long)operations, nsPerOperation.front(), nsPerOperation[nsPerOperation.size() / 2]);
+        fflush(stdout);
+    }
+
+    // Keeps the compiler from optimizing away the computation of 'value'
+    template <typename T>
+    static inline void DoNotOptimize(const T &value)
+    {
+        s_sink = &value;
+    }
+
+private:
+    template <typename TBenchmark>
+    static uint64_t TimeRun(TBenchmark &benchmark, uint64_t operations)
+    {
+        Clock::time_point start = Clock::now();
+        benchmark(operations);
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    }
+
+    template <typename TBenchmark>
+    static uint64_t Calibrate(TBenchmark &benchmark)
+    {
+        const uint64_t targetNs = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(kTargetRunTime).count();
+
+        uint64_t operations = 1;
+        for (;;)
+        {
+            uint64_t elapsed = TimeRun(benchmark, operations);
+            if (elapsed >= targetNs / 10 || operations >= (1ull << 32))
+            {
+                // Close enough to extrapolate
+                uint64_t scaled = elapsed == 0 ? operations * 10 : operations * targetNs / elapsed;
+                return std::max<uint64_t>(1, scaled);
+            }
+
+            operations *= 10;
+        }
+    }
+
+    static inline volatile const void *s_sink = nullptr;
+
+    std::string m_filter;
+    unsigned int m_repetitions;
+};
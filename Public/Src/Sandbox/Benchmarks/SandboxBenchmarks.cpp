@@ -0,0 +1,447 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Microbenchmarks for the hot paths of the sandboxes.
+//
+// Usage: SandboxBenchmarks [--filter <substring>] [--repetitions <n>] [--nodes <n>[,<n>...]] [--fanout <n>] [--threads <n>[,<n>...]]
+//
+// Policy search and path hashing are benchmarked in isolation, against synthetic manifests (10k, 100k and 1M nodes by default).
+// The PolicySearch.*.PerfectHash benchmarks lay the children of wide directories out with a minimal perfect hash, the others
+// with linear probing. The PolicySearch.*.BreadthFirst ones lay records out level by level rather than depth first.
+// The FileSystem benchmarks time file system calls: run outside of any sandbox they give the cost of the calls themselves, and run
+// as a pip (or with the Linux sandbox preloaded) they add everything the sandbox does on each call, i.e. the manifest lookup, path
+// resolution (BxlObserver::resolve_path on Linux) and building and sending the access report (BuildReport, ReportFileAccess).
+// The difference between the two is the sandbox overhead.
+
+// Standard headers go first: the sandbox headers define SAL annotations (__in, __out) that collide with libstdc++ internals
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stdafx.h"
+
+#include "BenchmarkHarness.h"
+#include "PolicySearch.h"
+#include "StringOperations.h"
+#include "SyntheticManifest.h"
+
+#if _WIN32
+#include "ResolvedPathCache.h"
+#else
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Query paths sampled from each manifest. Enough that lookups don't all hit the same cache lines.
+static const size_t SampledPaths = 4096;
+
+static vector<size_t> ParseList(const char *value)
+{
+    vector<size_t> result;
+    for (const char *current = value; *current != '\0'; )
+    {
+        char *end;
+        unsigned long long parsed = strtoull(current, &end, 10);
+        if (end == current)
+        {
+            break;
+        }
+
+        result.push_back((size_t)parsed);
+        current = *end == ',' ? end + 1 : end;
+    }
+
+    return result;
+}
+
+static PathString MakePath(size_t length)
+{
+    PathString path;
+    for (size_t i = 0; path.length() < length; i++)
+    {
+        string component = (i % 2 == 0 ? "Component" : "src") + to_string(i);
+        path.append(component.begin(), component.end());
+        path.push_back(SyntheticPathSeparator);
+    }
+
+    path.resize(length);
+    return path;
+}
+
+static void RunHashingBenchmarks(BenchmarkRunner &runner)
+{
+    for (size_t length : { 32, 128, 512 })
+    {
+        PathString path = MakePath(length);
+        vector<BYTE> buffer((path.length() + 1) * sizeof(PathChar));
+
+        runner.Run("Hashing.HashPath/" + to_string(length), [&](uint64_t operations)
+        {
+            DWORD hash = 0;
+            for (uint64_t i = 0; i < operations; i++)
+            {
+                hash ^= HashPath(path.c_str(), path.length());
+            }
+
+            BenchmarkRunner::DoNotOptimize(hash);
+        });
+
+        runner.Run("Hashing.NormalizeAndHashPath/" + to_string(length), [&](uint64_t operations)
+        {
+            DWORD hash = 0;
+            for (uint64_t i = 0; i < operations; i++)
+            {
+                hash ^= NormalizeAndHashPath(path.c_str(), buffer.data(), (DWORD)buffer.size());
+            }
+
+            BenchmarkRunner::DoNotOptimize(hash);
+        });
+    }
+}
+
+static void RunPolicySearchBenchmarks(BenchmarkRunner &runner, const vector<size_t> &nodeCounts, size_t fanOut, bool perfectHash, bool breadthFirst)
+{
+    for (size_t nodeCount : nodeCounts)
+    {
+        string suffix = string(perfectHash ? ".PerfectHash" : "") + (breadthFirst ? ".BreadthFirst/" : "/") + to_string(nodeCount);
+        if (!runner.IsSelected("PolicySearch.Hit" + suffix) &&
+            !runner.IsSelected("PolicySearch.Miss" + suffix) &&
+            !runner.IsSelected("PolicySearch.Resume" + suffix))
+        {
+            continue;
+        }
+
+        SyntheticManifest manifest(max<size_t>(1, nodeCount), fanOut, SampledPaths, perfectHash, breadthFirst);
+        const vector<PathString> &hits = manifest.GetLeafPaths();
+        PolicySearchCursor root(manifest.GetRoot());
+
+        // Same paths with the last component replaced by one that is not in the manifest, so the search fails at the parent
+        vector<PathString> misses;
+        // The cursor of the parent of each path, and the last component, to resume searches from there
+        vector<pair<PolicySearchCursor, PathString>> resumes;
+        for (const PathString &hit : hits)
+        {
+            size_t lastSeparator = hit.rfind(SyntheticPathSeparator);
+            PathString parent = lastSeparator == PathString::npos ? PathString() : hit.substr(0, lastSeparator);
+            PathString name = lastSeparator == PathString::npos ? hit : hit.substr(lastSeparator + 1);
+
+            string missing = "missing.txt";
+            misses.push_back(parent.empty() ? PathString(missing.begin(), missing.end()) : parent + SyntheticPathSeparator + PathString(missing.begin(), missing.end()));
+            resumes.emplace_back(FindFileAccessPolicyInTreeEx(root, parent.c_str(), parent.length()), name);
+
+            // Timing lookups that don't go where they are meant to would be misleading
+            if (FindFileAccessPolicyInTreeEx(root, hit.c_str(), hit.length()).SearchWasTruncated ||
+                !FindFileAccessPolicyInTreeEx(root, misses.back().c_str(), misses.back().length()).SearchWasTruncated)
+            {
+                fprintf(stderr, "The synthetic manifest of %zu nodes is malformed\n", nodeCount);
+                exit(1);
+            }
+        }
+
+        runner.Run("PolicySearch.Hit" + suffix, [&](uint64_t operations)
+        {
+            DWORD pathIds = 0;
+            for (uint64_t i = 0; i < operations; i++)
+            {
+                const PathString &path = hits[i % hits.size()];
+                pathIds ^= FindFileAccessPolicyInTreeEx(root, path.c_str(), path.length()).Record->GetPathId();
+            }
+
+            BenchmarkRunner::DoNotOptimize(pathIds);
+        });
+
+        runner.Run("PolicySearch.Miss" + suffix, [&](uint64_t operations)
+        {
+            DWORD pathIds = 0;
+            for (uint64_t i = 0; i < operations; i++)
+            {
+                const PathString &path = misses[i % misses.size()];
+                pathIds ^= FindFileAccessPolicyInTreeEx(root, path.c_str(), path.length()).Record->GetPathId();
+            }
+
+            BenchmarkRunner::DoNotOptimize(pathIds);
+        });
+
+        runner.Run("PolicySearch.Resume" + suffix, [&](uint64_t operations)
+        {
+            DWORD pathIds = 0;
+            for (uint64_t i = 0; i < operations; i++)
+            {
+                const pair<PolicySearchCursor, PathString> &resume = resumes[i % resumes.size()];
+                pathIds ^= FindFileAccessPolicyInTreeEx(resume.first, resume.second.c_str(), resume.second.length()).Record->GetPathId();
+            }
+
+            BenchmarkRunner::DoNotOptimize(pathIds);
+        });
+    }
+}
+
+// Splits 'operations' between 'threadCount' threads running 'body(threadIndex, operationsForThread)' concurrently
+template <typename TBody>
+static void RunConcurrently(size_t threadCount, uint64_t operations, TBody body)
+{
+    vector<thread> threads;
+    for (size_t t = 0; t < threadCount; t++)
+    {
+        threads.emplace_back(body, t, operations / threadCount + (t < operations % threadCount ? 1 : 0));
+    }
+
+    for (thread &t : threads)
+    {
+        t.join();
+    }
+}
+
+#if _WIN32
+
+static void RunResolvedPathCacheBenchmarks(BenchmarkRunner &runner, const vector<size_t> &threadCounts)
+{
+    const size_t CachedPaths = 1 << 16;
+    vector<wstring> paths;
+    for (size_t i = 0; i < CachedPaths; i++)
+    {
+        paths.push_back(L"C:\\src\\Dir" + to_wstring(i % 64) + L"\\file" + to_wstring(i) + L".cpp");
+    }
+
+    for (size_t threadCount : threadCounts)
+    {
+        string suffix = "/" + to_string(threadCount) + "threads";
+
+        ResolvedPathCache cache;
+        for (const wstring &path : paths)
+        {
+            cache.InsertResolvingCheckResult(path, false);
+        }
+
+        runner.Run("ResolvedPathCache.Get" + suffix, [&](uint64_t operations)
+        {
+            RunConcurrently(threadCount, operations, [&](size_t thread, uint64_t threadOperations)
+            {
+                size_t found = 0;
+                for (uint64_t i = 0; i < threadOperations; i++)
+                {
+                    found += cache.GetResolvingCheckResult(paths[(i * 7919 + thread) % paths.size()]).Found ? 1 : 0;
+                }
+
+                BenchmarkRunner::DoNotOptimize(found);
+            });
+        });
+
+        // One operation in 8 inserts a path that is not cached yet, the others look up cached ones
+        atomic<uint64_t> nextNewPath { 0 };
+        runner.Run("ResolvedPathCache.InsertAndGet" + suffix, [&](uint64_t operations)
+        {
+            RunConcurrently(threadCount, operations, [&](size_t thread, uint64_t threadOperations)
+            {
+                size_t found = 0;
+                for (uint64_t i = 0; i < threadOperations; i++)
+                {
+                    if (i % 8 == 0)
+                    {
+                        cache.InsertResolvingCheckResult(L"C:\\out\\new" + to_wstring(nextNewPath++) + L".obj", false);
+                    }
+                    else
+                    {
+                        found += cache.GetResolvingCheckResult(paths[(i * 7919 + thread) % paths.size()]).Found ? 1 : 0;
+                    }
+                }
+
+                BenchmarkRunner::DoNotOptimize(found);
+            });
+        });
+    }
+}
+
+#endif // _WIN32
+
+// Creates 'count' empty files in a new temporary directory and returns their paths
+static vector<string> CreateScratchFiles(size_t count)
+{
+    vector<string> files;
+#if _WIN32
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    string directory = string(tempPath) + "SandboxBenchmarks" + to_string(GetCurrentProcessId());
+    CreateDirectoryA(directory.c_str(), nullptr);
+#else
+    const char *tmp = getenv("TMPDIR");
+    string directory = string(tmp == nullptr || *tmp == '\0' ? "/tmp" : tmp) + "/SandboxBenchmarks" + to_string(getpid());
+    mkdir(directory.c_str(), 0755);
+#endif
+
+    for (size_t i = 0; i < count; i++)
+    {
+        string file = directory + (char)SyntheticPathSeparator + "file" + to_string(i) + ".txt";
+        FILE *f = fopen(file.c_str(), "w");
+        if (f != nullptr)
+        {
+            fclose(f);
+            files.push_back(file);
+        }
+    }
+
+    return files;
+}
+
+static void DeleteScratchFiles(const vector<string> &files)
+{
+    for (const string &file : files)
+    {
+        remove(file.c_str());
+    }
+
+    if (!files.empty())
+    {
+        string directory = files[0].substr(0, files[0].rfind((char)SyntheticPathSeparator));
+#if _WIN32
+        RemoveDirectoryA(directory.c_str());
+#else
+        rmdir(directory.c_str());
+#endif
+    }
+}
+
+static void RunFileSystemBenchmarks(BenchmarkRunner &runner)
+{
+    if (!runner.IsSelected("FileSystem."))
+    {
+        return;
+    }
+
+    vector<string> files = CreateScratchFiles(256);
+    if (files.empty())
+    {
+        fprintf(stderr, "Could not create scratch files, skipping the FileSystem benchmarks\n");
+        return;
+    }
+
+#if _WIN32
+    vector<wstring> widePaths;
+    for (const string &file : files)
+    {
+        widePaths.emplace_back(file.begin(), file.end());
+    }
+
+    runner.Run("FileSystem.GetFileAttributes", [&](uint64_t operations)
+    {
+        DWORD attributes = 0;
+        for (uint64_t i = 0; i < operations; i++)
+        {
+            attributes ^= GetFileAttributesW(widePaths[i % widePaths.size()].c_str());
+        }
+
+        BenchmarkRunner::DoNotOptimize(attributes);
+    });
+
+    runner.Run("FileSystem.OpenClose", [&](uint64_t operations)
+    {
+        for (uint64_t i = 0; i < operations; i++)
+        {
+            HANDLE handle = CreateFileW(widePaths[i % widePaths.size()].c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (handle != INVALID_HANDLE_VALUE)
+            {
+                CloseHandle(handle);
+            }
+        }
+    });
+#else
+    runner.Run("FileSystem.Stat", [&](uint64_t operations)
+    {
+        struct stat buffer;
+        int result = 0;
+        for (uint64_t i = 0; i < operations; i++)
+        {
+            result |= stat(files[i % files.size()].c_str(), &buffer);
+        }
+
+        BenchmarkRunner::DoNotOptimize(result);
+    });
+
+    runner.Run("FileSystem.OpenClose", [&](uint64_t operations)
+    {
+        for (uint64_t i = 0; i < operations; i++)
+        {
+            int fd = open(files[i % files.size()].c_str(), O_RDONLY);
+            if (fd != -1)
+            {
+                close(fd);
+            }
+        }
+    });
+
+    runner.Run("FileSystem.RealPath", [&](uint64_t operations)
+    {
+        char resolved[PATH_MAX];
+        for (uint64_t i = 0; i < operations; i++)
+        {
+            BenchmarkRunner::DoNotOptimize(realpath(files[i % files.size()].c_str(), resolved));
+        }
+    });
+#endif
+
+    DeleteScratchFiles(files);
+}
+
+int main(int argc, char **argv)
+{
+    const char *filter = nullptr;
+    unsigned int repetitions = 5;
+    vector<size_t> nodeCounts = { 10000, 100000, 1000000 };
+    vector<size_t> threadCounts = { 1, 2, 4, 8 };
+    size_t fanOut = 16;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--filter") == 0)
+        {
+            filter = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--repetitions") == 0)
+        {
+            repetitions = (unsigned int)atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--nodes") == 0)
+        {
+            nodeCounts = ParseList(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--fanout") == 0)
+        {
+            fanOut = (size_t)atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--threads") == 0)
+        {
+            threadCounts = ParseList(argv[i + 1]);
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+            return 1;
+        }
+    }
+
+    BenchmarkRunner runner(filter, repetitions);
+    RunHashingBenchmarks(runner);
+    RunPolicySearchBenchmarks(runner, nodeCounts, fanOut, /*perfectHash*/ false, /*breadthFirst*/ false);
+    RunPolicySearchBenchmarks(runner, nodeCounts, fanOut, /*perfectHash*/ true, /*breadthFirst*/ false);
+    RunPolicySearchBenchmarks(runner, nodeCounts, fanOut, /*perfectHash*/ false, /*breadthFirst*/ true);
+    RunPolicySearchBenchmarks(runner, nodeCounts, fanOut, /*perfectHash*/ true, /*breadthFirst*/ true);
+#if _WIN32
+    RunResolvedPathCacheBenchmarks(runner, threadCounts);
+#else
+    (void)threadCounts;
+#endif
+    RunFileSystemBenchmarks(runner);
+
+    return 0;
+}
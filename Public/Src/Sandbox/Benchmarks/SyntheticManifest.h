@@ -0,0 +1,288 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <algorithm>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "DataTypes.h"
+#include "StringOperations.h"
+
+typedef std::basic_string<PathChar> PathString;
+
+#if _WIN32
+const PathChar SyntheticPathSeparator = L'\\';
+#else
+const PathChar SyntheticPathSeparator = '/';
+#endif
+
+// A policy tree of a given number of nodes, laid out in memory the way FileAccessManifest.cs serializes it
+// (see FileAccessManifest.Node.InternalSerialize), so FindFileAccessPolicyInTreeEx can be benchmarked without BuildXL.
+//
+// The tree is a complete tree with the given fan-out. Node names mix upper and lower case, so lookups go through path
+// normalization the way real ones do. With 'perfectHash', children are laid out with a minimal perfect hash whenever
+// FileAccessManifest.cs would do it, otherwise always with linear probing. With 'breadthFirst', records are laid out level by level
+// (the way FileAccessManifest.cs lays out the upper levels of a tree), otherwise depth first.
+class SyntheticManifest final
+{
+public:
+    // Same as FileAccessManifest.Node.PerfectHashMinChildCount
+    static const size_t PerfectHashMinChildCount = 8;
+
+    SyntheticManifest(size_t nodeCount, size_t fanOut, size_t maxSampledPaths, bool perfectHash = false, bool breadthFirst = false)
+        : m_nodeCount(nodeCount), m_fanOut(fanOut < 2 ? 2 : fanOut), m_perfectHash(perfectHash)
+    {
+        if (breadthFirst)
+        {
+            SerializeBreadthFirst();
+        }
+        else
+        {
+            Serialize(0);
+        }
+
+        SampleLeafPaths(maxSampledPaths);
+    }
+
+    PCManifestRecord GetRoot() const
+    {
+        return reinterpret_cast<PCManifestRecord>(m_blob.data());
+    }
+
+    // Paths of a sample of the leaves, relative to the root, spread evenly over the tree
+    const std::vector<PathString>& GetLeafPaths() const { return m_leafPaths; }
+
+    size_t GetSizeInBytes() const { return m_blob.size() * sizeof(uint32_t); }
+
+private:
+    // Node 0 is the root, and the children of node i are nodes i * fanOut + 1 to i * fanOut + fanOut
+    size_t FirstChild(size_t node) const { return node * m_fanOut + 1; }
+    size_t Parent(size_t node) const { return (node - 1) / m_fanOut; }
+    size_t ChildCount(size_t node) const
+    {
+        size_t first = FirstChild(node);
+        return first > m_nodeCount ? 0 : std::min(m_fanOut, m_nodeCount - first + 1);
+    }
+
+    static PathString NodeName(size_t node)
+    {
+        std::string name = (node % 2 == 0 ? "Dir" : "src") + std::to_string(node) + (node % 3 == 0 ? ".CPP" : "");
+        return PathString(name.begin(), name.end());
+    }
+
+    void Write(uint32_t value) { m_blob.push_back(value); }
+
+    // Same construction as FileAccessManifest.Node.TryBuildPerfectHash
+    static bool TryBuildPerfectHash(const std::vector<uint32_t> &hashes, std::vector<uint32_t> &displacements, std::vector<uint32_t> &slots)
+    {
+        uint32_t slotCount = (uint32_t)hashes.size();
+        uint32_t groupCount = (slotCount + 1) / 2;
+        std::vector<std::vector<size_t>> groups(groupCount);
+        for (size_t i = 0; i < hashes.size(); i++)
+        {
+            groups[hashes[i] % groupCount].push_back(i);
+        }
+
+        std::vector<uint32_t> order(groupCount);
+        for (uint32_t i = 0; i < groupCount; i++)
+        {
+            order[i] = i;
+        }
+
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return groups[a].size() > groups[b].size(); });
+
+        displacements.assign(groupCount, 0);
+        slots.assign(hashes.size(), 0);
+        std::vector<bool> taken(slotCount, false);
+        std::vector<uint32_t> groupSlots;
+        for (uint32_t group : order)
+        {
+            const std::vector<size_t> &members = groups[group];
+            bool placed = members.empty();
+            for (uint32_t displacement = 0; displacement < (1u << 16) && !placed; displacement++)
+            {
+                groupSlots.clear();
+                for (size_t member : members)
+                {
+                    uint32_t slot = ManifestRecord::GetPerfectHashSlot(hashes[member], displacement, slotCount);
+                    if (taken[slot] || std::find(groupSlots.begin(), groupSlots.end(), slot) != groupSlots.end())
+                    {
+                        break;
+                    }
+
+                    groupSlots.push_back(slot);
+                }
+
+                if (groupSlots.size() == members.size())
+                {
+                    for (size_t i = 0; i < members.size(); i++)
+                    {
+                        taken[groupSlots[i]] = true;
+                        slots[members[i]] = groupSlots[i];
+                    }
+
+                    displacements[group] = displacement;
+                    placed = true;
+                }
+            }
+
+            if (!placed)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Appends the record of the given node, with the hashes of its children in its buckets but not their offsets (see SetChildOffset).
+    // Returns the offset of the record, and outputs the position of the bucket of each child.
+    size_t WriteRecord(size_t node, std::vector<size_t> &childBuckets)
+    {
+        size_t start = m_blob.size();
+        PathString name = node == 0 ? PathString() : NodeName(node);
+
+#ifdef _DEBUG
+        Write(0xF00DCAFE);
+#endif
+        Write(node == 0 ? 0 : HashPath(name.c_str(), name.length()));
+        Write(FileAccessPolicy_AllowRead | FileAccessPolicy_AllowReadIfNonExistent); // cone policy
+        Write(FileAccessPolicy_AllowRead | FileAccessPolicy_ReportAccess);          // node policy
+        Write((uint32_t)node);                                                     // path id
+        Write(0);                                                                  // expected USN, low and high parts
+        Write(0);
+        Write(ManifestRecord::NoLevel);                                            // no ancestor enables full reparse point parsing
+
+        size_t childCount = ChildCount(node);
+        std::vector<uint32_t> childHashes;
+        for (size_t i = 0; i < childCount; i++)
+        {
+            PathString childName = NodeName(FirstChild(node) + i);
+            childHashes.push_back(HashPath(childName.c_str(), childName.length()));
+        }
+
+        std::vector<uint32_t> displacements;
+        std::vector<uint32_t> perfectHashSlots;
+        bool usePerfectHash = m_perfectHash && childCount >= PerfectHashMinChildCount && TryBuildPerfectHash(childHashes, displacements, perfectHashSlots);
+        if (!usePerfectHash)
+        {
+            displacements.clear();
+        }
+
+        uint32_t bucketCount = usePerfectHash ? (uint32_t)childCount : childCount == 0 ? 0 : (uint32_t)(childCount / 0.7);
+        Write((uint32_t)displacements.size());
+        Write(bucketCount);
+
+        // Buckets are pairs of a child offset and the hash of the child
+        size_t bucketsStart = m_blob.size();
+        m_blob.resize(m_blob.size() + 2 * (size_t)bucketCount, 0);
+        m_blob.insert(m_blob.end(), displacements.begin(), displacements.end());
+
+        if (node == 0)
+        {
+            Write(0);
+        }
+        else
+        {
+            // Null terminated normalized name, padded to a 4 byte boundary
+            size_t nameBytes = (name.length() + 1) * sizeof(PathChar);
+            size_t nameStart = m_blob.size();
+            m_blob.resize(nameStart + (nameBytes + 3) / 4, 0);
+            PathChar *fragment = reinterpret_cast<PathChar*>(&m_blob[nameStart]);
+            for (size_t i = 0; i < name.length(); i++)
+            {
+                fragment[i] = NormalizePathChar(name[i]);
+            }
+        }
+
+        // Same open addressing scheme as FileAccessManifest.cs, chain flags included
+        std::vector<bool> occupied(bucketCount, false);
+        childBuckets.clear();
+        for (size_t i = 0; i < childCount; i++)
+        {
+            uint32_t index = usePerfectHash ? perfectHashSlots[i] : childHashes[i] % bucketCount;
+            if (!usePerfectHash && occupied[index])
+            {
+                m_blob[bucketsStart + 2 * index] |= FileAccessBucketOffsetFlag::ChainStart;
+                index = (index + 1) % bucketCount;
+                while (occupied[index])
+                {
+                    m_blob[bucketsStart + 2 * index] |= FileAccessBucketOffsetFlag::ChainContinuation;
+                    index = (index + 1) % bucketCount;
+                }
+            }
+
+            occupied[index] = true;
+            m_blob[bucketsStart + 2 * index + 1] = childHashes[i];
+            childBuckets.push_back(bucketsStart + 2 * index);
+        }
+
+        return start;
+    }
+
+    void SetChildOffset(size_t bucket, size_t parentStart, size_t childStart)
+    {
+        m_blob[bucket] |= (uint32_t)((childStart - parentStart) * sizeof(uint32_t));
+    }
+
+    // Appends the record of the given node and, recursively, the ones of its children. Returns the offset of the record.
+    size_t Serialize(size_t node)
+    {
+        std::vector<size_t> childBuckets;
+        size_t start = WriteRecord(node, childBuckets);
+        for (size_t i = 0; i < childBuckets.size(); i++)
+        {
+            SetChildOffset(childBuckets[i], start, Serialize(FirstChild(node) + i));
+        }
+
+        return start;
+    }
+
+    // Appends the records of all the nodes level by level, which for this tree is in the order of their indices
+    void SerializeBreadthFirst()
+    {
+        std::vector<size_t> starts(m_nodeCount + 1);
+        std::vector<size_t> buckets(m_nodeCount + 1);
+        std::vector<size_t> childBuckets;
+        for (size_t node = 0; node <= m_nodeCount; node++)
+        {
+            starts[node] = WriteRecord(node, childBuckets);
+            for (size_t i = 0; i < childBuckets.size(); i++)
+            {
+                buckets[FirstChild(node) + i] = childBuckets[i];
+            }
+
+            if (node != 0)
+            {
+                SetChildOffset(buckets[node], starts[Parent(node)], starts[node]);
+            }
+        }
+    }
+
+    void SampleLeafPaths(size_t maxSampledPaths)
+    {
+        size_t firstLeaf = Parent(m_nodeCount) + 1;
+        size_t leafCount = m_nodeCount - firstLeaf + 1;
+        size_t stride = std::max<size_t>(1, leafCount / std::max<size_t>(1, maxSampledPaths));
+
+        for (size_t leaf = firstLeaf; leaf <= m_nodeCount && m_leafPaths.size() < maxSampledPaths; leaf += stride)
+        {
+            PathString path = NodeName(leaf);
+            for (size_t node = Parent(leaf); node != 0; node = Parent(node))
+            {
+                path = NodeName(node) + SyntheticPathSeparator + path;
+            }
+
+            m_leafPaths.push_back(path);
+        }
+    }
+
+    size_t m_nodeCount;
+    size_t m_fanOut;
+    bool m_perfectHash;
+    std::vector<uint32_t> m_blob;
+    std::vector<PathString> m_leafPaths;
+};
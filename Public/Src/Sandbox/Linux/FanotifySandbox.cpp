@@ -0,0 +1,704 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "FanotifySandbox.hpp"
+#include <libgen.h>
+#include <sys/epoll.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+// NOTE: the supervisor is a fork of an interposed process. Anything it does on the file system goes through raw syscalls or the
+// real_* functions of the observer, so it never reports its own accesses.
+
+// Events of the tree that get reported. Reads are reported on open, and writes on close, so the volume of events doesn't depend on
+// how the files are read or written.
+static const uint64_t s_eventMask = FAN_OPEN | FAN_OPEN_EXEC | FAN_CLOSE_WRITE | FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ONDIR;
+
+// How often the children of the known processes are listed, so they are known before their parent exits and they get reparented
+static const int s_refreshIntervalMs = 50;
+
+// Size past which the processes known not to be part of the tree are forgotten, which also bounds how long a stale entry
+// (the pid got reused by a new process of the tree) can go unnoticed
+static const size_t s_maxStrangers = 1 << 16;
+
+// Pseudo file systems nothing of interest can happen on, and that don't support file handles anyway
+static const char *s_ignoredFileSystems[] =
+{
+    "proc", "sysfs", "cgroup", "cgroup2", "devpts", "mqueue", "debugfs", "tracefs", "securityfs", "pstore", "bpf", "autofs",
+    "configfs", "fusectl", "hugetlbfs", "binfmt_misc", "nsfs", "rpc_pipefs", "efivarfs",
+};
+
+static uint64_t GetFsidKey(int high, int low)
+{
+    return ((uint64_t)(uint32_t)high << 32) | (uint32_t)low;
+}
+
+// Mount points in /proc/self/mountinfo escape spaces, tabs, newlines and backslashes as octal sequences
+static std::string UnescapeMountPoint(const std::string &escaped)
+{
+    std::string result;
+    for (size_t i = 0; i < escaped.length(); i++)
+    {
+        if (escaped[i] == '\\' && i + 3 < escaped.length())
+        {
+            result.push_back((char)strtol(escaped.substr(i + 1, 3).c_str(), nullptr, 8));
+            i += 3;
+        }
+        else
+        {
+            result.push_back(escaped[i]);
+        }
+    }
+
+    return result;
+}
+
+FanotifySandbox::~FanotifySandbox()
+{
+    for (const auto &mount : m_mountFds)
+    {
+        syscall(SYS_close, mount.second);
+    }
+
+    if (m_fanotifyFd != -1)
+    {
+        syscall(SYS_close, m_fanotifyFd);
+    }
+}
+
+bool FanotifySandbox::Initialize()
+{
+#ifdef FAN_REPORT_DFID_NAME
+    // The queue is unlimited since there is no way to get a lost event back: a build machine makes lots of them
+    m_fanotifyFd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_UNLIMITED_QUEUE | FAN_CLOEXEC | FAN_NONBLOCK, O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+    if (m_fanotifyFd == -1)
+    {
+        BXL_LOG_DEBUG(m_bxl, "[Fanotify] fanotify_init failed with: '%s'", strerror(errno));
+        return false;
+    }
+
+    std::string mountInfo;
+    if (!ReadProcFile("/proc/self/mountinfo", mountInfo))
+    {
+        return false;
+    }
+
+    // Each line reads "<id> <parent id> <major:minor> <root> <mount point> <options> [<optional fields>...] - <type> <source> <options>"
+    std::vector<std::pair<std::string, std::string>> mounts;
+    std::unordered_set<std::string> trackedDevices;
+    size_t lineStart = 0;
+    while (lineStart < mountInfo.length())
+    {
+        size_t lineEnd = mountInfo.find('\n', lineStart);
+        lineEnd = lineEnd == std::string::npos ? mountInfo.length() : lineEnd;
+        std::string line = mountInfo.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+
+        std::vector<std::string> fields;
+        size_t fieldStart = 0;
+        while (fieldStart <= line.length())
+        {
+            size_t fieldEnd = line.find(' ', fieldStart);
+            fieldEnd = fieldEnd == std::string::npos ? line.length() : fieldEnd;
+            fields.push_back(line.substr(fieldStart, fieldEnd - fieldStart));
+            fieldStart = fieldEnd + 1;
+        }
+
+        auto separator = std::find(fields.begin(), fields.end(), "-");
+        if (fields.size() < 5 || separator == fields.end() || separator + 1 == fields.end())
+        {
+            continue;
+        }
+
+        const std::string &type = *(separator + 1);
+        if (std::find(std::begin(s_ignoredFileSystems), std::end(s_ignoredFileSystems), type) != std::end(s_ignoredFileSystems))
+        {
+            continue;
+        }
+
+        // The accesses to a file system that is only visible under untracked scopes of the manifest can't produce reports:
+        // not marking it keeps its events from ever being queued, rather than having them filtered out one by one
+        std::string mountPoint = UnescapeMountPoint(fields[4]);
+        if (!m_bxl->IsUntrackedCone(mountPoint.c_str()))
+        {
+            trackedDevices.insert(fields[2]);
+        }
+
+        mounts.emplace_back(fields[2], std::move(mountPoint));
+    }
+
+    bool rootMarked = false;
+    for (const auto &mount : mounts)
+    {
+        const std::string &mountPoint = mount.second;
+        if (trackedDevices.find(mount.first) == trackedDevices.end())
+        {
+            BXL_LOG_DEBUG(m_bxl, "[Fanotify] Not observing '%s': untracked", mountPoint.c_str());
+            rootMarked |= mountPoint == "/";
+            continue;
+        }
+
+        int mountFd = syscall(SYS_openat, AT_FDCWD, mountPoint.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC, 0);
+        if (mountFd == -1)
+        {
+            continue;
+        }
+
+        // Fails for file systems that can't encode file handles, which just won't be observed
+        struct statfs fs;
+        if (fanotify_mark(m_fanotifyFd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, s_eventMask, mountFd, nullptr) == -1
+            || syscall(SYS_fstatfs, mountFd, &fs) == -1
+            || !m_mountFds.emplace(GetFsidKey(fs.f_fsid.__val[0], fs.f_fsid.__val[1]), mountFd).second)
+        {
+            BXL_LOG_DEBUG(m_bxl, "[Fanotify] Not observing '%s': '%s'", mountPoint.c_str(), strerror(errno));
+            syscall(SYS_close, mountFd);
+            continue;
+        }
+
+        rootMarked |= mountPoint == "/";
+    }
+
+    // Not observing the root file system (unless the manifest doesn't care about it) would miss too much to be worth it
+    return rootMarked;
+#else
+    return false;
+#endif
+}
+
+int FanotifySandbox::ExecuteWithFanotifySandbox(const char *file, char *const argv[], char *const envp[])
+{
+    // Opened here rather than by the supervisor, so the pid can't get reused in between
+    pid_t traceePid = getpid();
+    int traceePidFd = syscall(SYS_pidfd_open, traceePid, 0);
+    if (traceePidFd == -1)
+    {
+        m_bxl->real_fprintf(stderr, "[Fanotify] pidfd_open failed: '%s'\n", strerror(errno));
+        m_bxl->real__exit(-1);
+    }
+
+    // Children of the tracee are only found out about once they show up in an event, so the supervisor keeps the process tree
+    // open until no tracee is left
+    m_bxl->reserve_process_tree();
+    pid_t childPid = m_bxl->real_fork();
+    if (childPid == 0)
+    {
+        // Fork again so the supervisor is not a child of the tracee: a tracee waiting on all of its children would never return otherwise
+        pid_t supervisorPid = m_bxl->real_fork();
+        if (supervisorPid == 0)
+        {
+            RunSupervisor(traceePid, traceePidFd);
+        }
+
+        if (supervisorPid == -1)
+        {
+            m_bxl->release_process_tree();
+        }
+
+        m_bxl->real__exit(0);
+    }
+
+    if (childPid == -1)
+    {
+        m_bxl->release_process_tree();
+        m_bxl->real_fprintf(stderr, "[Fanotify] fork failed: '%s'\n", strerror(errno));
+        m_bxl->real__exit(-1);
+    }
+
+    waitpid(childPid, NULL, 0);
+    syscall(SYS_close, traceePidFd);
+
+    // The group, the pidfd and the mount descriptors are all close-on-exec: from here on, only the supervisor holds them
+    return m_bxl->real_execvpe(file, argv, envp);
+}
+
+void FanotifySandbox::RunSupervisor(pid_t traceePid, int traceePidFd)
+{
+    // Any staged report belongs to the tracee
+    m_bxl->reset_report_batches();
+    m_bxl->reset_trace_buffer();
+    m_bxl->reset_access_trace();
+    m_bxl->disable_fd_table();
+
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event = { .events = EPOLLIN, .data = { .u64 = 0 } };
+    if (m_epollFd == -1 || epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_fanotifyFd, &event) == -1)
+    {
+        // Only the exit of the tracee can be reported
+        BXL_LOG_DEBUG(m_bxl, "[Fanotify] Setting up epoll failed with: '%s'", strerror(errno));
+        waitpid(traceePid, NULL, __WALL);
+        m_bxl->SendExitReport(traceePid);
+        m_bxl->FlushReports();
+        m_bxl->release_process_tree();
+        m_bxl->real__exit(0);
+    }
+
+    // bxl already knows about the tracee, which is the process that started the supervisor
+    m_tracees[traceePid] = traceePidFd;
+    event.data.u64 = (uint64_t)traceePid;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, traceePidFd, &event);
+
+    auto lastRefresh = std::chrono::steady_clock::now();
+    struct epoll_event ready[64];
+    while (!m_tracees.empty())
+    {
+        int count = epoll_wait(m_epollFd, ready, sizeof(ready) / sizeof(ready[0]), s_refreshIntervalMs);
+        if (count == -1 && errno != EINTR)
+        {
+            BXL_LOG_DEBUG(m_bxl, "[Fanotify] epoll_wait failed with: '%s'", strerror(errno));
+            break;
+        }
+
+        std::vector<pid_t> exited;
+        for (int i = 0; i < count; i++)
+        {
+            if (ready[i].data.u64 == 0)
+            {
+                if (!ReadEvents())
+                {
+                    break;
+                }
+            }
+            else
+            {
+                exited.push_back((pid_t)ready[i].data.u64);
+            }
+        }
+
+        if (!exited.empty())
+        {
+            // Events are queued as they happen: everything an exited process did is already there
+            ReadEvents();
+            for (pid_t pid : exited)
+            {
+                RemoveTracee(pid);
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastRefresh >= std::chrono::milliseconds(s_refreshIntervalMs))
+        {
+            RefreshProcessTree();
+            lastRefresh = now;
+        }
+    }
+
+    ReadEvents();
+
+    // Processes that are still running if we got here because of an error
+    std::vector<pid_t> remaining;
+    for (const auto &tracee : m_tracees)
+    {
+        remaining.push_back(tracee.first);
+    }
+
+    for (pid_t pid : remaining)
+    {
+        RemoveTracee(pid);
+    }
+
+    m_bxl->FlushReports();
+    m_bxl->release_process_tree();
+    m_bxl->real__exit(0);
+}
+
+bool FanotifySandbox::ReadEvents()
+{
+    alignas(struct fanotify_event_metadata) char buffer[64 * 1024];
+    while (true)
+    {
+        ssize_t length = read(m_fanotifyFd, buffer, sizeof(buffer));
+        if (length == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            if (errno != EAGAIN)
+            {
+                BXL_LOG_DEBUG(m_bxl, "[Fanotify] Reading events failed with: '%s'", strerror(errno));
+                return false;
+            }
+
+            return true;
+        }
+
+        const struct fanotify_event_metadata *metadata = (const struct fanotify_event_metadata *)buffer;
+        for (; FAN_EVENT_OK(metadata, length); metadata = FAN_EVENT_NEXT(metadata, length))
+        {
+            if (metadata->vers != FANOTIFY_METADATA_VERSION)
+            {
+                BXL_LOG_DEBUG(m_bxl, "[Fanotify] Unexpected event metadata version %d", metadata->vers);
+                return false;
+            }
+
+            HandleEvent(metadata);
+        }
+    }
+}
+
+void FanotifySandbox::HandleEvent(const struct fanotify_event_metadata *metadata)
+{
+    if (metadata->mask & FAN_Q_OVERFLOW)
+    {
+        // Can't happen with an unlimited queue, but if it does there is no telling what got lost
+        m_bxl->real_fprintf(stderr, "[Fanotify] The event queue overflowed: file accesses were lost\n");
+        return;
+    }
+
+    if (!IsTracee(metadata->pid))
+    {
+        return;
+    }
+
+#ifdef FAN_REPORT_DFID_NAME
+    // Events of a FAN_REPORT_DFID_NAME group describe the object by its parent directory and name (or by the object itself when
+    // that is not possible, e.g. for a file system root)
+    std::string path;
+    bool isUntracked = false;
+    const char *end = (const char *)metadata + metadata->event_len;
+    const char *info = (const char *)metadata + metadata->metadata_len;
+    while (info + sizeof(struct fanotify_event_info_header) <= end)
+    {
+        const struct fanotify_event_info_header *header = (const struct fanotify_event_info_header *)info;
+        if (header->len == 0 || info + header->len > end)
+        {
+            break;
+        }
+
+        if (header->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME || header->info_type == FAN_EVENT_INFO_TYPE_DFID || header->info_type == FAN_EVENT_INFO_TYPE_FID)
+        {
+            const struct fanotify_event_info_fid *fid = (const struct fanotify_event_info_fid *)info;
+            const struct file_handle *handle = (const struct file_handle *)fid->handle;
+            const char *name = header->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME ? (const char *)(handle->f_handle + handle->handle_bytes) : nullptr;
+            if (ResolvePath(fid, name, path, isUntracked))
+            {
+                break;
+            }
+        }
+
+        info += header->len;
+    }
+
+    if (path.empty())
+    {
+        // e.g. the directory got removed before we got to the event
+        return;
+    }
+
+    bool isDirectory = (metadata->mask & FAN_ONDIR) != 0;
+    mode_t mode = isDirectory ? S_IFDIR : S_IFREG;
+    pid_t pid = metadata->pid;
+
+    if (isDirectory && (metadata->mask & (FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO)))
+    {
+        // Every directory under it has a different path now
+        m_directoryPaths.clear();
+    }
+
+    // Identical events of a process get merged while queued, so a single event can stand for several of these
+    if (metadata->mask & FAN_OPEN_EXEC)
+    {
+        std::string mutablePath = path;
+        m_bxl->report_exec("execve", basename(&mutablePath[0]), path.c_str(), /* error */ 0, /* mode */ 0, pid);
+    }
+
+    // Execs are still needed to track the processes of the tree, but nothing else under an untracked cone can be reported
+    if (isUntracked)
+    {
+        return;
+    }
+
+    if (metadata->mask & FAN_OPEN)
+    {
+        Report("open", isDirectory ? ES_EVENT_TYPE_NOTIFY_READDIR : ES_EVENT_TYPE_NOTIFY_OPEN, pid, path, mode);
+    }
+
+    if (metadata->mask & (FAN_CREATE | FAN_MOVED_TO))
+    {
+        Report(metadata->mask & FAN_CREATE ? (isDirectory ? "mkdir" : "creat") : "rename", ES_EVENT_TYPE_NOTIFY_CREATE, pid, path, mode);
+    }
+
+    if (metadata->mask & FAN_CLOSE_WRITE)
+    {
+        Report("write", ES_EVENT_TYPE_NOTIFY_WRITE, pid, path, mode);
+    }
+
+    if (metadata->mask & (FAN_DELETE | FAN_MOVED_FROM))
+    {
+        Report(metadata->mask & FAN_DELETE ? (isDirectory ? "rmdir" : "unlink") : "rename", ES_EVENT_TYPE_NOTIFY_UNLINK, pid, path, mode);
+    }
+#endif
+}
+
+void FanotifySandbox::Report(const char *syscallName, es_event_type_t eventType, pid_t pid, const std::string &path, mode_t mode)
+{
+    IOEvent event(
+        pid,
+        /* cpid */ 0,
+        /* ppid */ 0,
+        eventType,
+        ES_ACTION_TYPE_NOTIFY,
+        path,
+        /* dest */ "",
+        m_bxl->GetProgramPath(),
+        mode,
+        /* modified */ false,
+        /* error */ 0
+    );
+
+    m_bxl->report_access(syscallName, event);
+}
+
+bool FanotifySandbox::IsTracee(pid_t pid)
+{
+    if (m_tracees.find(pid) != m_tracees.end())
+    {
+        return true;
+    }
+
+    if (m_strangers.find(pid) != m_strangers.end())
+    {
+        return false;
+    }
+
+    // Walk up the parents until a known process (or init) shows up
+    std::vector<pid_t> chain;
+    pid_t current = pid;
+    bool isTracee = false;
+    while (current > 1)
+    {
+        if (m_tracees.find(current) != m_tracees.end())
+        {
+            isTracee = true;
+            break;
+        }
+
+        if (m_strangers.find(current) != m_strangers.end())
+        {
+            break;
+        }
+
+        chain.push_back(current);
+        current = ReadParentPid(current);
+    }
+
+    if (isTracee)
+    {
+        // Parents first, so process creations are reported in order
+        for (size_t i = chain.size(); i > 0; i--)
+        {
+            AddTracee(chain[i - 1], i == chain.size() ? current : chain[i]);
+        }
+    }
+    else
+    {
+        if (m_strangers.size() + chain.size() > s_maxStrangers)
+        {
+            m_strangers.clear();
+        }
+
+        m_strangers.insert(chain.begin(), chain.end());
+    }
+
+    return isTracee;
+}
+
+void FanotifySandbox::AddTracee(pid_t pid, pid_t parentPid, bool reportStart)
+{
+    m_strangers.erase(pid);
+
+    std::string exePath = m_bxl->GetProgramPath();
+    char path[PATH_MAX];
+    char exe[PATH_MAX];
+    snprintf(path, sizeof(path), "/proc/%d/exe", pid);
+    ssize_t exeLength = m_bxl->real_readlink(path, exe, sizeof(exe) - 1);
+    if (exeLength > 0)
+    {
+        exe[exeLength] = '\0';
+        exePath = exe;
+    }
+
+    // Only keeps the exit of the process paired up: the supervisor holds the tree open until no tracee is left
+    m_bxl->add_to_process_tree(pid);
+
+    if (reportStart)
+    {
+        IOEvent event(parentPid, pid, /* traceeppid */ 0, ES_EVENT_TYPE_NOTIFY_FORK, ES_ACTION_TYPE_NOTIFY, exePath, std::string(""), exePath, /* mode */ 0, false, /* error */ 0);
+        m_bxl->report_access("fork", event, /* checkCache */ false);
+    }
+
+    int pidFd = syscall(SYS_pidfd_open, pid, 0);
+    struct epoll_event event = { .events = EPOLLIN, .data = { .u64 = (uint64_t)pid } };
+    if (pidFd == -1 || epoll_ctl(m_epollFd, EPOLL_CTL_ADD, pidFd, &event) == -1)
+    {
+        // Gone already (or it can't be watched): it won't show up again
+        BXL_LOG_DEBUG(m_bxl, "[Fanotify] Can't watch process '%d': '%s'", pid, strerror(errno));
+        if (pidFd != -1)
+        {
+            syscall(SYS_close, pidFd);
+        }
+
+        m_bxl->SendExitReport(pid);
+        return;
+    }
+
+    m_tracees[pid] = pidFd;
+    BXL_LOG_DEBUG(m_bxl, "[Fanotify] Added new tracee with PID '%d'", pid);
+}
+
+void FanotifySandbox::RemoveTracee(pid_t pid)
+{
+    auto tracee = m_tracees.find(pid);
+    if (tracee == m_tracees.end())
+    {
+        return;
+    }
+
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, tracee->second, nullptr);
+    syscall(SYS_close, tracee->second);
+    m_tracees.erase(tracee);
+    m_bxl->SendExitReport(pid);
+}
+
+void FanotifySandbox::RefreshProcessTree()
+{
+    // NOTE: only the children of the main thread of each process are listed. Children of other threads are still found through
+    // their events, as long as their parent is around.
+    std::vector<std::pair<pid_t, pid_t>> found;
+    char path[PATH_MAX];
+    std::string children;
+    for (const auto &tracee : m_tracees)
+    {
+        snprintf(path, sizeof(path), "/proc/%d/task/%d/children", tracee.first, tracee.first);
+        if (!ReadProcFile(path, children))
+        {
+            continue;
+        }
+
+        const char *current = children.c_str();
+        char *next;
+        for (long child = strtol(current, &next, 10); next != current; child = strtol(current, &next, 10))
+        {
+            current = next;
+            if (m_tracees.find((pid_t)child) == m_tracees.end())
+            {
+                found.emplace_back((pid_t)child, tracee.first);
+            }
+        }
+    }
+
+    for (const auto &child : found)
+    {
+        AddTracee(child.first, child.second);
+    }
+}
+
+bool FanotifySandbox::ResolvePath(const struct fanotify_event_info_fid *fid, const char *name, std::string &path, bool &isUntracked)
+{
+    auto mount = m_mountFds.find(GetFsidKey(fid->fsid.val[0], fid->fsid.val[1]));
+    if (mount == m_mountFds.end())
+    {
+        return false;
+    }
+
+    struct file_handle *handle = (struct file_handle *)fid->handle;
+    std::string key((const char *)&fid->fsid, sizeof(fid->fsid));
+    key.append((const char *)handle, sizeof(struct file_handle) + handle->handle_bytes);
+
+    auto cached = m_directoryPaths.find(key);
+    if (cached != m_directoryPaths.end())
+    {
+        path = cached->second.path;
+        isUntracked = cached->second.isUntracked;
+    }
+    else
+    {
+        int fd = open_by_handle_at(mount->second, handle, O_PATH | O_CLOEXEC);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        char procPath[PATH_MAX];
+        char resolved[PATH_MAX];
+        snprintf(procPath, sizeof(procPath), "/proc/self/fd/%d", fd);
+        ssize_t length = m_bxl->real_readlink(procPath, resolved, sizeof(resolved) - 1);
+        syscall(SYS_close, fd);
+        if (length <= 0)
+        {
+            return false;
+        }
+
+        path.assign(resolved, length);
+        isUntracked = m_bxl->IsUntrackedCone(path.c_str());
+        if (name != nullptr)
+        {
+            // Only directories get cached: the handle of a file is only reported without a name for a handful of events
+            m_directoryPaths.emplace(std::move(key), ResolvedDirectory { path, isUntracked });
+        }
+    }
+
+    if (name != nullptr && strcmp(name, ".") != 0)
+    {
+        if (path.back() != '/')
+        {
+            path.push_back('/');
+        }
+
+        path.append(name);
+    }
+
+    return true;
+}
+
+pid_t FanotifySandbox::ReadParentPid(pid_t pid)
+{
+    // "<pid> (<comm>) <state> <ppid> ...", where comm can contain anything, including spaces and parentheses
+    char path[PATH_MAX];
+    std::string stat;
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    if (!ReadProcFile(path, stat))
+    {
+        return 0;
+    }
+
+    size_t commEnd = stat.rfind(')');
+    if (commEnd == std::string::npos || commEnd + 4 >= stat.length())
+    {
+        return 0;
+    }
+
+    return (pid_t)atoi(stat.c_str() + commEnd + 4);
+}
+
+bool FanotifySandbox::ReadProcFile(const char *path, std::string &contents)
+{
+    contents.clear();
+    int fd = syscall(SYS_openat, AT_FDCWD, path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    char buffer[4096];
+    ssize_t length;
+    while ((length = read(fd, buffer, sizeof(buffer))) > 0 || (length == -1 && errno == EINTR))
+    {
+        if (length > 0)
+        {
+            contents.append(buffer, length);
+        }
+    }
+
+    syscall(SYS_close, fd);
+    return length == 0;
+}
@@ -0,0 +1,84 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <string>
+#include <sys/fanotify.h>
+#include <unordered_map>
+#include <unordered_set>
+#include "bxl_observer.hpp"
+
+/*
+ * Observation-only sandbox for statically linked processes (see BxlObserver::IsFanotifySandboxEnabled).
+ *
+ * Instead of stopping the process on every filtered syscall (see PTraceSandbox), the process runs untouched while a supervisor,
+ * forked from it right before it execs, reads the fanotify events of every file system the process can see and reports the ones
+ * coming from its process tree through the observer, so they look the same as the reports of the other sandboxes. Nothing can be
+ * denied, and fanotify only sees what reaches a file system object: opens (reads and directory enumerations), writes (on close),
+ * creations, removals, renames (as a removal plus a creation) and execs, but no probes.
+ *
+ * The process tree is the process that execs plus every descendant found either when one of its events shows up (by walking up the
+ * parents of the process behind it) or by listing the children of the known processes, which is done periodically so that children
+ * are found while their parent is still around. Each known process is watched through a pidfd, which tells the supervisor when to
+ * report its exit and when the whole tree is gone.
+ *
+ * Setting the fanotify group up needs CAP_SYS_ADMIN and a 5.9+ kernel (FAN_REPORT_DFID_NAME). Resolving the reported directories
+ * needs CAP_DAC_READ_SEARCH. If the group can't be set up, the caller falls back to one of the stopping sandboxes.
+ */
+class FanotifySandbox
+{
+public:
+    FanotifySandbox(BxlObserver *bxl) : m_bxl(bxl) {}
+    ~FanotifySandbox();
+
+    /*
+     * @brief Creates the fanotify group and marks the file systems of the calling process
+     * @return false if fanotify can't be used, in which case nothing else should be called
+     */
+    bool Initialize();
+
+    /*
+     * @brief Starts the supervisor and executes the provided child process
+     * @return The return value from exec if the child fails to execute
+     */
+    int ExecuteWithFanotifySandbox(const char *file, char *const argv[], char *const envp[]);
+
+private:
+    BxlObserver *m_bxl;
+    int m_fanotifyFd = -1;
+    int m_epollFd = -1;
+    // One descriptor per marked file system (keyed by fsid), to open the directories fanotify reports by handle
+    std::unordered_map<uint64_t, int> m_mountFds;
+    // Processes of the tree that are still running, and the pidfd each one is watched through
+    std::unordered_map<pid_t, int> m_tracees;
+    // Processes known not to be part of the tree, which is most of the events of a machine running a build
+    std::unordered_set<pid_t> m_strangers;
+    // Directory handles (plus fsid) that were already resolved, until a directory gets removed or renamed
+    struct ResolvedDirectory
+    {
+        std::string path;
+        // Whether the directory is an untracked cone of the manifest, so the accesses under it are dropped without being checked
+        bool isUntracked;
+    };
+    std::unordered_map<std::string, ResolvedDirectory> m_directoryPaths;
+
+    // Never returns: exits once every process of the tree is gone
+    void RunSupervisor(pid_t traceePid, int traceePidFd);
+
+    // Reads all the pending events. Returns false if the fanotify descriptor can't be read anymore.
+    bool ReadEvents();
+    void HandleEvent(const struct fanotify_event_metadata *metadata);
+    void Report(const char *syscallName, es_event_type_t eventType, pid_t pid, const std::string &path, mode_t mode);
+
+    // Whether the given process is part of the tree, finding out (and remembering) if it isn't known yet
+    bool IsTracee(pid_t pid);
+    void AddTracee(pid_t pid, pid_t parentPid, bool reportStart = true);
+    void RemoveTracee(pid_t pid);
+    // Adds the children of every known process that aren't known yet
+    void RefreshProcessTree();
+
+    bool ResolvePath(const struct fanotify_event_info_fid *fid, const char *name, std::string &path, bool &isUntracked);
+    pid_t ReadParentPid(pid_t pid);
+    bool ReadProcFile(const char *path, std::string &contents);
+};
@@ -2,121 +2,225 @@
 // Licensed under the MIT License.
 
 #include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include "PTraceSandbox.hpp"
 #include <linux/filter.h>
 #include <linux/seccomp.h>
+#include <poll.h>
+#include <sched.h>
 #include <semaphore.h>
+#include <sys/ioctl.h>
 #include <sys/prctl.h>
 #include <sys/ptrace.h>
 #include <sys/reg.h>
+#include <sys/socket.h>
 #include <sys/wait.h>
 
 #define SYSCALL_NAME_TO_NUMBER(name) __NR_##name
 #define SYSCALL_NAME_STRING(name) #name
 
-// This macro fills in the seccomp_data data structure
-// The first statement checks if the current syscall matches the syscall number provided.
-// If so, then it will not modify the program counter (the 0 set in the third arg is for PC + 0)
-// If the syscall number does not match, then it will increment the program counter (PC + 1) and jump to skip over the next statement that has the SECCOMP_RET_TRACE
-// The BPF statement with SECCOMP_RET_TRACE indicates that we should invoke the tracer (ie: the parent process will be signalled by ptrace)
-#define TRACE_SYSCALL(name) \
-        BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, SYSCALL_NAME_TO_NUMBER(name), 0, 1), \
-        BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_TRACE)
-
-// There are "new" versions of certain syscalls (such as fstatat).
-// The name of the function does not include the "new" bit, but the name in the kernel includes this prefix
-// Use this macro to trace those syscalls
-// The other "new" variants of the macros in this file achieve the same thing
-#define TRACE_SYSCALL_NEW(name) TRACE_SYSCALL(new##name)
+// Syscalls the sandbox stops on to report file accesses, both with ptrace and with seccomp notifications.
+// This is the single list both the seccomp filters (see PTraceSandbox::GetSyscallFilter) and the handler dispatch
+// (see PTraceSandbox::HandleSysCallGeneric) are generated from: every entry must have a handler declared in PTraceSandbox.hpp.
+// X is applied to regular syscalls and X_NEW to the ones whose kernel name has a "new" prefix the function name doesn't (such as fstatat).
+// List of available syscalls: https://github.com/torvalds/linux/blob/master/arch/x86/entry/syscalls/syscall_64.tbl
+#define FOR_EACH_REPORTED_SYSCALL(X, X_NEW) \
+        X(execveat) X(execve) X(stat) X(lstat) X(fstat) X_NEW(fstatat) X(access) X(faccessat) X(creat) X(open) X(openat) \
+        X(write) X(writev) X(pwritev) X(pwritev2) X(pwrite64) X(truncate) X(ftruncate) X(rmdir) X(rename) X(renameat) \
+        X(link) X(linkat) X(unlink) X(unlinkat) X(symlink) X(symlinkat) X(readlink) X(readlinkat) X(utime) X(utimes) \
+        X(utimensat) X(futimesat) X(mkdir) X(mkdirat) X(mknod) X(mknodat) X(chmod) X(fchmod) X(fchmodat) X(chown) \
+        X(fchown) X(lchown) X(fchownat) X(sendfile) X(copy_file_range) X(name_to_handle_at)
+
+// Process creation is only traced with ptrace: seccomp notifications don't see syscall results nor ptrace events, so new
+// processes are discovered when they first show up on a notification instead (see PTraceSandbox::TrackSeccompNotifyTracee).
+// NOTE: vfork is explicitly not traced here, see PTraceSandbox::UpdateTraceeTableForExec for more details
+#define FOR_EACH_PTRACE_ONLY_SYSCALL(X) X(fork) X(clone)
+
+// Exits are only traced with seccomp notifications, which see them on the way in (see PTraceSandbox::HandleSeccompNotification)
+#define FOR_EACH_SECCOMP_NOTIFY_ONLY_SYSCALL(X) X(exit) X(exit_group)
+
+// Syscalls that close or replace descriptors, only traced with ptrace and FileAccessManifestExtraFlag::CacheLinuxPTraceFdPaths,
+// so cached descriptor paths are dropped before their descriptor numbers get reused (see PTraceSandbox::GetFdPath).
+// Descriptors are otherwise only created at the lowest free numbers, which never have a cached path.
+#ifdef __NR_close_range
+#define FOR_EACH_FD_LIFETIME_SYSCALL(X) X(close) X(close_range) X(dup2) X(dup3) X(unshare)
+#else
+#define FOR_EACH_FD_LIFETIME_SYSCALL(X) X(close) X(dup2) X(dup3) X(unshare)
+#endif
+
+// Reported syscalls whose first argument is a descriptor, and that are let through without stopping when it is one of the standard
+// descriptors (0, 1 and 2). Those are inherited from the parent or dup'ed from a descriptor whose open was already reported, just like
+// reads from any descriptor, which are not traced at all. This keeps tools logging to the console from stopping on every write.
+#define FOR_EACH_STDIO_EXEMPT_SYSCALL(X) X(write) X(writev) X(pwritev) X(pwritev2) X(pwrite64) X(fstat)
+
+#define SYSCALL_NUMBER_ENTRY(name) SYSCALL_NAME_TO_NUMBER(name),
+#define SYSCALL_NUMBER_ENTRY_NEW(name) SYSCALL_NUMBER_ENTRY(new##name)
+
+static constexpr int s_reportedSyscalls[] = { FOR_EACH_REPORTED_SYSCALL(SYSCALL_NUMBER_ENTRY, SYSCALL_NUMBER_ENTRY_NEW) };
+static constexpr int s_ptraceOnlySyscalls[] = { FOR_EACH_PTRACE_ONLY_SYSCALL(SYSCALL_NUMBER_ENTRY) };
+static constexpr int s_seccompNotifyOnlySyscalls[] = { FOR_EACH_SECCOMP_NOTIFY_ONLY_SYSCALL(SYSCALL_NUMBER_ENTRY) };
+static constexpr int s_fdLifetimeSyscalls[] = { FOR_EACH_FD_LIFETIME_SYSCALL(SYSCALL_NUMBER_ENTRY) };
+static constexpr int s_stdioExemptSyscalls[] = { FOR_EACH_STDIO_EXEMPT_SYSCALL(SYSCALL_NUMBER_ENTRY) };
+
+// The filter reads the two halves of 64-bit syscall arguments separately
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "The syscall filter assumes the low half of an argument comes first");
+
+// Ranges of the syscall table at most this long are matched with a linear chain of comparisons rather than split further
+#define SYSCALL_FILTER_LEAF_SIZE 4
 
 #define HANDLER_FUNCTION(syscallName) void PTraceSandbox::MAKE_HANDLER_FN_NAME(syscallName) ()
 #define HANDLER_FUNCTION_NEW(syscallName) HANDLER_FUNCTION(new##syscallName)
 
 #define CHECK_AND_CALL_HANDLER(syscallName) \
         case SYSCALL_NAME_TO_NUMBER(syscallName): \
+        { \
+            static InterposeProfileSite s_profileSite("Handle" #syscallName); \
+            InterposeProfileScope profile(m_bxl->GetProfiler(), s_profileSite); \
             PTraceSandbox::MAKE_HANDLER_FN_NAME(syscallName) (); \
-            break
+            break; \
+        }
 #define CHECK_AND_CALL_HANDLER_NEW(syscallName) CHECK_AND_CALL_HANDLER(new##syscallName)
 
+std::mutex PTraceSandbox::s_tracersLock;
+std::condition_variable PTraceSandbox::s_tracersDone;
+unsigned int PTraceSandbox::s_activeTracers = 0;
+std::mutex PTraceSandbox::s_notifyTraceesLock;
+std::unordered_map<pid_t, pid_t> PTraceSandbox::s_notifyTracees;
+
 PTraceSandbox::PTraceSandbox(BxlObserver *bxl)
 {
     m_bxl = bxl;
+    m_cacheFdPaths = bxl->IsPTraceFdPathCacheEnabled();
 }
 
 PTraceSandbox::~PTraceSandbox()
 {
 }
 
-int PTraceSandbox::ExecuteWithPTraceSandbox(const char *file, char *const argv[], char *const envp[], const char *fam)
-{    
+struct SyscallFilterEntry
+{
+    unsigned int number;
+    unsigned int action;
+    // Whether the syscall is allowed without the action when its first argument is a standard descriptor (see FOR_EACH_STDIO_EXEMPT_SYSCALL)
+    bool exemptStdioFds;
+
+    bool operator<(const SyscallFilterEntry &other) const { return number < other.number; }
+};
+
+// Appends the statements that return the action of the syscall, or allow it if it is exempt and its first argument is a standard
+// descriptor. The accumulator is overwritten, which is fine since every path ends with a return.
+static void AppendSyscallFilterAction(std::vector<struct sock_filter> &filter, const SyscallFilterEntry &syscall)
+{
+    if (syscall.exemptStdioFds)
+    {
+        // Descriptors are ints, but the argument is 64 bits: anything in the upper half is not a standard descriptor
+        filter.push_back(BPF_STMT(BPF_LD+BPF_W+BPF_ABS, offsetof(struct seccomp_data, args[0]) + sizeof(uint32_t)));
+        filter.push_back(BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, 0, 0, 2));
+        filter.push_back(BPF_STMT(BPF_LD+BPF_W+BPF_ABS, offsetof(struct seccomp_data, args[0])));
+        filter.push_back(BPF_JUMP(BPF_JMP+BPF_JGE+BPF_K, STDERR_FILENO + 1, 0, 1));
+        filter.push_back(BPF_STMT(BPF_RET+BPF_K, syscall.action));
+        filter.push_back(BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW));
+        return;
+    }
+
+    filter.push_back(BPF_STMT(BPF_RET+BPF_K, syscall.action));
+}
+
+// Appends a binary search over the given syscalls, sorted by number, that returns the action of the matching one or allows the syscall.
+// Each node only compares against the number in the middle of its range (seccomp_data.nr is expected to be in the accumulator),
+// so any syscall goes through O(log n) instructions instead of one comparison per traced syscall.
+static void AppendSyscallFilterNode(std::vector<struct sock_filter> &filter, const SyscallFilterEntry *syscalls, size_t count)
+{
+    if (count <= SYSCALL_FILTER_LEAF_SIZE)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            // If the syscall number matches, fall through to the statements that return its action, otherwise skip them
+            size_t comparison = filter.size();
+            filter.push_back(BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, syscalls[i].number, 0, 0));
+            AppendSyscallFilterAction(filter, syscalls[i]);
+            filter[comparison].jf = (unsigned char)(filter.size() - comparison - 1);
+        }
+
+        // SECCOMP_RET_ALLOW tells seccomp to allow the syscall (as opposed to killing it), and therefore not to stop the tracee
+        filter.push_back(BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW));
+        return;
+    }
+
+    // Jumps can only go forward: the upper half is laid out right after the comparison, and the lower half after the upper one.
+    // Jump offsets are 8 bits, which comfortably fits the size of the upper half for the number of syscalls we trace.
+    size_t middle = count / 2;
+    size_t comparison = filter.size();
+    filter.push_back(BPF_JUMP(BPF_JMP+BPF_JGE+BPF_K, syscalls[middle].number, 0, 0));
+    AppendSyscallFilterNode(filter, syscalls + middle, count - middle);
+    filter[comparison].jf = (unsigned char)(filter.size() - comparison - 1);
+    AppendSyscallFilterNode(filter, syscalls, middle);
+}
+
+std::vector<struct sock_filter> PTraceSandbox::GetSyscallFilter(unsigned int action, bool traceFdLifetimes)
+{
     // Filter for the syscalls that BXL is interested in tracing
-    // Only the syscalls in here will be signalled to the main process by seccomp
-    // List of available syscalls to ptrace: https://github.com/torvalds/linux/blob/master/arch/x86/entry/syscalls/syscall_64.tbl
+    // Only the syscalls in here will be signalled to the tracer (or the seccomp notification supervisor) by seccomp
     // NOTE: The set of syscalls here are not equivalent to the set of functions that are interposed by the regular sandbox
     // This is expected because not all of the interposed functions map directly to system calls in the kernel.
     // This set should capture all of the file accesses we already observe on the interpose sandbox.
-    struct sock_filter filter[] = {
+    // SECCOMP_RET_TRACE indicates that we should invoke the tracer (ie: the parent process will be signalled by ptrace),
+    // and SECCOMP_RET_USER_NOTIF that the task should wait for the seccomp notification supervisor to reply
+    std::vector<SyscallFilterEntry> syscalls;
+    for (int syscall : s_reportedSyscalls)
+    {
+        bool exemptStdioFds = std::find(std::begin(s_stdioExemptSyscalls), std::end(s_stdioExemptSyscalls), syscall) != std::end(s_stdioExemptSyscalls);
+        syscalls.push_back({ (unsigned int)syscall, action, exemptStdioFds });
+    }
+
+    if (action == SECCOMP_RET_TRACE)
+    {
+        for (int syscall : s_ptraceOnlySyscalls)
+        {
+            syscalls.push_back({ (unsigned int)syscall, action, false });
+        }
+
+        if (traceFdLifetimes)
+        {
+            for (int syscall : s_fdLifetimeSyscalls)
+            {
+                syscalls.push_back({ (unsigned int)syscall, action, false });
+            }
+        }
+    }
+    else
+    {
+        for (int syscall : s_seccompNotifyOnlySyscalls)
+        {
+            syscalls.push_back({ (unsigned int)syscall, action, false });
+        }
+    }
+
+#ifdef __NR_io_uring_setup
+    // The kernel consumes io_uring requests straight from memory shared with the tracee, so the file accesses they carry
+    // never show up as syscalls. Make io_uring look unsupported so tracees fall back to regular (traced) I/O.
+    syscalls.push_back({ __NR_io_uring_setup, SECCOMP_RET_ERRNO | (ENOSYS & SECCOMP_RET_DATA), false });
+#endif
+
+    std::sort(syscalls.begin(), syscalls.end());
+
+    std::vector<struct sock_filter> filter = {
         // This statement loads the syscall number (seccomp_data.nr) into the accumulator
         BPF_STMT(BPF_LD+BPF_W+BPF_ABS, offsetof(struct seccomp_data, nr)),
-        // The next set of statements indicates that we should stop the tracee if one of these syscalls are detected
-        TRACE_SYSCALL(execveat),
-        TRACE_SYSCALL(execve),
-        TRACE_SYSCALL(stat),
-        TRACE_SYSCALL(lstat),
-        TRACE_SYSCALL(fstat),
-        TRACE_SYSCALL_NEW(fstatat),
-        TRACE_SYSCALL(access),
-        TRACE_SYSCALL(faccessat),
-        TRACE_SYSCALL(creat),
-        TRACE_SYSCALL(open),
-        TRACE_SYSCALL(openat),
-        TRACE_SYSCALL(write),
-        TRACE_SYSCALL(writev),
-        TRACE_SYSCALL(pwritev),
-        TRACE_SYSCALL(pwritev2),
-        TRACE_SYSCALL(pwrite64),
-        TRACE_SYSCALL(truncate),
-        TRACE_SYSCALL(ftruncate),
-        TRACE_SYSCALL(rmdir),
-        TRACE_SYSCALL(rename),
-        TRACE_SYSCALL(renameat),
-        TRACE_SYSCALL(link),
-        TRACE_SYSCALL(linkat),
-        TRACE_SYSCALL(unlink),
-        TRACE_SYSCALL(unlinkat),
-        TRACE_SYSCALL(symlink),
-        TRACE_SYSCALL(symlinkat),
-        TRACE_SYSCALL(readlink),
-        TRACE_SYSCALL(readlinkat),
-        TRACE_SYSCALL(utime),
-        TRACE_SYSCALL(utimes),
-        TRACE_SYSCALL(utimensat),
-        TRACE_SYSCALL(futimesat),
-        TRACE_SYSCALL(mkdir),
-        TRACE_SYSCALL(mkdirat),
-        TRACE_SYSCALL(mknod),
-        TRACE_SYSCALL(mknodat),
-        TRACE_SYSCALL(chmod),
-        TRACE_SYSCALL(fchmod),
-        TRACE_SYSCALL(fchmodat),
-        TRACE_SYSCALL(chown),
-        TRACE_SYSCALL(fchown),
-        TRACE_SYSCALL(lchown),
-        TRACE_SYSCALL(fchownat),
-        TRACE_SYSCALL(sendfile),
-        TRACE_SYSCALL(copy_file_range),
-        TRACE_SYSCALL(name_to_handle_at),
-        // NOTE: vfork is explicitly not traced here, see PTraceSandbox::UpdateTraceeTableForExec for more details
-        TRACE_SYSCALL(fork),
-        TRACE_SYSCALL(clone),
-        // SECCOMP_RET_ALLOW tells seccomp to allow all of the calls that were being filtered above (as opposed to killing them)
-        // This would happen if none of the syscall numbers above get matched, and therefore should not stop the tracee
-        BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW),
     };
+    AppendSyscallFilterNode(filter, syscalls.data(), syscalls.size());
+
+    return filter;
+}
 
+int PTraceSandbox::ExecuteWithPTraceSandbox(const char *file, char *const argv[], char *const envp[], const char *fam)
+{    
+    std::vector<struct sock_filter> filter = GetSyscallFilter(SECCOMP_RET_TRACE, m_cacheFdPaths);
     struct sock_fprog prog = {
-        .len = (unsigned short) (sizeof(filter)/sizeof(filter[0])),
-        .filter = filter,
+        .len = (unsigned short) filter.size(),
+        .filter = filter.data(),
     };
 
     // NOTE: sem_open must be called before we set the seccomp filter
@@ -171,7 +275,363 @@ int PTraceSandbox::ExecuteWithPTraceSandbox(const char *file, char *const argv[]
     return m_bxl->real_execvpe(file, argv, envp);
 }
 
+// The notification fd only exists once the filter is installed by the tracee, so it is handed over to the supervisor through a unix socket
+static bool SendFileDescriptor(int socketFd, int fd)
+{
+    char data = 0;
+    struct iovec iov = { .iov_base = &data, .iov_len = sizeof(data) };
+    char control[CMSG_SPACE(sizeof(int))] = {0};
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(header), &fd, sizeof(int));
+
+    return sendmsg(socketFd, &message, 0) == sizeof(data);
+}
+
+static int ReceiveFileDescriptor(int socketFd)
+{
+    char data = 0;
+    struct iovec iov = { .iov_base = &data, .iov_len = sizeof(data) };
+    char control[CMSG_SPACE(sizeof(int))] = {0};
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t received;
+    while ((received = recvmsg(socketFd, &message, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR);
+
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    if (received <= 0 || header == NULL || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+    {
+        // The tracee closed its end without sending anything: it couldn't install the filter
+        return -1;
+    }
+
+    int fd;
+    memcpy(&fd, CMSG_DATA(header), sizeof(int));
+    return fd;
+}
+
+int PTraceSandbox::ExecuteWithSeccompNotifySandbox(const char *file, char *const argv[], char *const envp[], const char *fam)
+{
+    std::vector<struct sock_filter> filter = GetSyscallFilter(SECCOMP_RET_USER_NOTIF, /* traceFdLifetimes */ false);
+    struct sock_fprog prog = {
+        .len = (unsigned short) filter.size(),
+        .filter = filter.data(),
+    };
+
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) == -1)
+    {
+        BXL_LOG_DEBUG(m_bxl, "[SeccompNotify] socketpair failed with: '%s'", strerror(errno));
+        return FallBackToPTraceSandbox(file, argv, envp, fam);
+    }
+
+    pid_t traceePid = getpid();
+    // The supervisor counts as a process of the pip, which keeps the process tree open until no task is left: children of the tracee
+    // are only found out about once they make a filtered syscall (see RunSeccompNotifySupervisor)
+    m_bxl->reserve_child_process();
+    pid_t childPid = m_bxl->real_fork();
+    if (childPid == 0)
+    {
+        // Fork again so the supervisor is not a child of the tracee: a tracee waiting on all of its children would never return otherwise
+        pid_t supervisorPid = m_bxl->real_fork();
+        if (supervisorPid == 0)
+        {
+            m_bxl->real_close(sockets[0]);
+            RunSeccompNotifySupervisor(sockets[1], traceePid);
+        }
+
+        // The supervisor can't exit before this: it waits for the tracee, which waits for us
+        m_bxl->claim_child_process(supervisorPid);
+        m_bxl->real__exit(0);
+    }
+
+    m_bxl->real_close(sockets[1]);
+    if (childPid == -1)
+    {
+        m_bxl->claim_child_process(-1);
+        BXL_LOG_DEBUG(m_bxl, "[SeccompNotify] fork failed with: '%s'", strerror(errno));
+        m_bxl->real_close(sockets[0]);
+        return FallBackToPTraceSandbox(file, argv, envp, fam);
+    }
+
+    waitpid(childPid, NULL, 0);
+
+    // See ExecuteWithPTraceSandbox
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1) {
+        BXL_LOG_DEBUG(m_bxl, "[SeccompNotify] prctl(PR_SET_NO_NEW_PRIVS) failed with: '%s'", strerror(errno));
+        m_bxl->real_close(sockets[0]);
+        return FallBackToPTraceSandbox(file, argv, envp, fam);
+    }
+
+    int listenerFd = syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_NEW_LISTENER, &prog);
+    if (listenerFd == -1)
+    {
+        // Closing the socket without sending the fd tells the supervisor to exit
+        BXL_LOG_DEBUG(m_bxl, "[SeccompNotify] Installing the seccomp filter failed with: '%s'", strerror(errno));
+        m_bxl->real_close(sockets[0]);
+        return FallBackToPTraceSandbox(file, argv, envp, fam);
+    }
+
+    // NOTE: from here on every filtered syscall waits for the supervisor, and fails with ENOSYS if there is none
+    if (!SendFileDescriptor(sockets[0], listenerFd))
+    {
+        m_bxl->real_fprintf(stderr, "[SeccompNotify] Failed to hand over the seccomp notification fd: '%s'\n", strerror(errno));
+        m_bxl->real__exit(-1);
+    }
+
+    m_bxl->real_close(listenerFd);
+    m_bxl->real_close(sockets[0]);
+
+    return m_bxl->real_execvpe(file, argv, envp);
+}
+
+int PTraceSandbox::FallBackToPTraceSandbox(const char *file, char *const argv[], char *const envp[], const char *fam)
+{
+    // bxl didn't get told about this process yet, so it wouldn't launch the ptrace runner otherwise
+    m_bxl->report_statically_linked_process(file);
+    return ExecuteWithPTraceSandbox(file, argv, envp, fam);
+}
+
+void PTraceSandbox::RunSeccompNotifySupervisor(int socketFd, pid_t traceePid)
+{
+    // Any staged report belongs to the tracee
+    m_bxl->reset_report_batches();
+    m_bxl->reset_trace_buffer();
+    m_bxl->reset_access_trace();
+
+    // Nothing the tracee opened is ours: holding on to it would keep pipes open and files busy for as long as the pip runs
+    m_bxl->close_all_fds_except(socketFd);
+
+    // Reported as a child of the tracee, so BuildXL accounts for it (and cleans it up) as any other process of the pip
+    pid_t supervisorPid = getpid();
+    std::string exePath = m_bxl->GetProgramPath();
+    IOEvent event(traceePid, supervisorPid, /* traceeppid */ 0, ES_EVENT_TYPE_NOTIFY_FORK, ES_ACTION_TYPE_NOTIFY, exePath, std::string(""), exePath, /* mode */ 0, false, /* error */ 0);
+    m_bxl->report_access(SYSCALL_NAME_STRING(fork), event, /* checkCache */ false);
+
+    int listenerFd = ReceiveFileDescriptor(socketFd);
+    m_bxl->real_close(socketFd);
+
+    if (listenerFd == -1)
+    {
+        // The tracee falls back to the ptrace sandbox
+        m_bxl->FlushReports();
+        m_bxl->SendExitReport(supervisorPid);
+        m_bxl->real__exit(0);
+    }
+
+    // Directories are created on behalf of the tasks, which apply their own umask (see GetDirectorySyscallError)
+    umask(0);
+    m_bxl->disable_fd_table();
+    s_notifyTracees[traceePid] = traceePid;
+
+    // A task can only have one pending notification at a time, so each worker serves a different task
+    unsigned int workerCount = std::max(std::thread::hardware_concurrency(), 1u);
+    for (unsigned int i = 0; i < workerCount; i++)
+    {
+        std::thread(&PTraceSandbox::ServeSeccompNotifications, m_bxl, listenerFd).detach();
+    }
+
+    // Workers can't be woken up from SECCOMP_IOCTL_NOTIF_RECV, but the notification fd signals POLLHUP once no task uses the filter anymore
+    struct pollfd pollFd = { .fd = listenerFd, .events = 0, .revents = 0 };
+    while (!(pollFd.revents & (POLLHUP | POLLERR)))
+    {
+        if (poll(&pollFd, 1, -1) == -1 && errno != EINTR)
+        {
+            BXL_LOG_DEBUG(m_bxl, "[SeccompNotify] poll failed with: '%s'", strerror(errno));
+            break;
+        }
+    }
+
+    // Tasks that never made it to exit/exit_group (e.g. killed by a signal) still need their exit report
+    {
+        std::lock_guard<std::mutex> lock(s_notifyTraceesLock);
+        for (const auto &tracee : s_notifyTracees)
+        {
+            m_bxl->SendExitReport(tracee.first);
+        }
+    }
+
+    // Our own exit goes last: it may complete the process tree
+    m_bxl->FlushReports();
+    m_bxl->SendExitReport(supervisorPid);
+    m_bxl->real__exit(0);
+}
+
+void PTraceSandbox::ServeSeccompNotifications(BxlObserver *bxl, int listenerFd)
+{
+    PTraceSandbox tracer(bxl);
+    struct seccomp_notif request;
+
+    while (true)
+    {
+        // The kernel requires the request to be zeroed
+        memset(&request, 0, sizeof(request));
+        if (ioctl(listenerFd, SECCOMP_IOCTL_NOTIF_RECV, &request) == -1)
+        {
+            // ENOENT: the task got killed before we could receive its notification
+            if (errno == EINTR || errno == ENOENT)
+            {
+                continue;
+            }
+
+            BXL_LOG_DEBUG(bxl, "[SeccompNotify] SECCOMP_IOCTL_NOTIF_RECV failed with: '%s'", strerror(errno));
+            return;
+        }
+
+        tracer.HandleSeccompNotification(listenerFd, request);
+    }
+}
+
+void PTraceSandbox::HandleSeccompNotification(int listenerFd, const struct seccomp_notif &request)
+{
+    m_traceePid = request.pid;
+    m_notification = &request;
+
+    TrackSeccompNotifyTracee();
+
+    switch (request.data.nr)
+    {
+        case __NR_exit:
+            RemoveSeccompNotifyTracees(/* wholeProcess */ false);
+            break;
+        case __NR_exit_group:
+            RemoveSeccompNotifyTracees(/* wholeProcess */ true);
+            break;
+        default:
+            HandleSysCallGeneric(request.data.nr);
+            break;
+    }
+
+    m_notification = nullptr;
+
+    // Reports are sent before replying, so they always precede anything that happens after the syscall.
+    // Sending fails with ENOENT if the task got killed in the meantime, which is fine.
+    // A syscall the supervisor already made on behalf of the task (see GetDirectorySyscallError) is not run again: the task gets its result.
+    struct seccomp_notif_resp response = m_emulatedSyscall
+        ? seccomp_notif_resp { .id = request.id, .val = 0, .error = -m_emulatedErrno, .flags = 0 }
+        : seccomp_notif_resp { .id = request.id, .val = 0, .error = 0, .flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE };
+    m_emulatedSyscall = false;
+    ioctl(listenerFd, SECCOMP_IOCTL_NOTIF_SEND, &response);
+}
+
+void PTraceSandbox::TrackSeccompNotifyTracee()
+{
+    {
+        std::lock_guard<std::mutex> lock(s_notifyTraceesLock);
+        if (s_notifyTracees.find(m_traceePid) != s_notifyTracees.end())
+        {
+            return;
+        }
+    }
+
+    // First notification from this task. Threads are reported as children of their thread group leader and processes as children of
+    // their parent, which matches what the ptrace sandbox reports on clone/fork.
+    pid_t tgid = m_traceePid;
+    pid_t ppid = 0;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/proc/%d/status", m_traceePid);
+    int fd = m_bxl->real_open(path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd != -1)
+    {
+        char status[4096];
+        ssize_t length = read(fd, status, sizeof(status) - 1);
+        m_bxl->real_close(fd);
+
+        if (length > 0)
+        {
+            status[length] = '\0';
+            const char *field = strstr(status, "\nTgid:");
+            if (field != nullptr)
+            {
+                tgid = atoi(field + strlen("\nTgid:"));
+            }
+
+            field = strstr(status, "\nPPid:");
+            if (field != nullptr)
+            {
+                ppid = atoi(field + strlen("\nPPid:"));
+            }
+        }
+    }
+
+    std::string exePath = m_bxl->GetProgramPath();
+    char exe[PATH_MAX];
+    snprintf(path, sizeof(path), "/proc/%d/exe", m_traceePid);
+    ssize_t exeLength = m_bxl->real_readlink(path, exe, sizeof(exe) - 1);
+    if (exeLength > 0)
+    {
+        exe[exeLength] = '\0';
+        exePath = exe;
+    }
+
+    bool isThread = tgid != m_traceePid;
+    if (!isThread)
+    {
+        // Only keeps the exit of the process paired up: the supervisor holds the tree open until no task is left
+        m_bxl->add_to_process_tree(m_traceePid);
+    }
+
+    IOEvent event(isThread ? tgid : ppid, m_traceePid, /* traceeppid */ 0, ES_EVENT_TYPE_NOTIFY_FORK, ES_ACTION_TYPE_NOTIFY, exePath, std::string(""), exePath, /* mode */ 0, false, /* error */ 0);
+    m_bxl->report_access(isThread ? SYSCALL_NAME_STRING(clone) : SYSCALL_NAME_STRING(fork), event, /* checkCache */ false);
+
+    std::lock_guard<std::mutex> lock(s_notifyTraceesLock);
+    s_notifyTracees[m_traceePid] = tgid;
+
+    BXL_LOG_DEBUG(m_bxl, "[SeccompNotify] Added new tracee with PID '%d'", m_traceePid);
+}
+
+void PTraceSandbox::RemoveSeccompNotifyTracees(bool wholeProcess)
+{
+    std::vector<pid_t> exited;
+
+    {
+        std::lock_guard<std::mutex> lock(s_notifyTraceesLock);
+        auto tracee = s_notifyTracees.find(m_traceePid);
+        pid_t tgid = tracee != s_notifyTracees.end() ? tracee->second : m_traceePid;
+
+        for (auto it = s_notifyTracees.begin(); it != s_notifyTracees.end();)
+        {
+            if (it->first == m_traceePid || (wholeProcess && it->second == tgid))
+            {
+                exited.push_back(it->first);
+                it = s_notifyTracees.erase(it);
+            }
+            else
+            {
+                it++;
+            }
+        }
+    }
+
+    for (pid_t pid : exited)
+    {
+        m_bxl->SendExitReport(pid);
+    }
+}
+
 void PTraceSandbox::AttachToProcess(pid_t traceePid, std::string exe, std::string semaphoreName)
+{
+    Attach(traceePid, exe, semaphoreName);
+    TraceLoop();
+
+    m_bxl->FlushReports();
+    _exit(0);
+}
+
+void PTraceSandbox::Attach(pid_t traceePid, const std::string &exe, const std::string &semaphoreName)
 {
     BXL_LOG_DEBUG(m_bxl, "[PTrace] Starting tracer PID '%d' to trace PID '%d'", getpid(), traceePid);
 
@@ -181,7 +641,6 @@ void PTraceSandbox::AttachToProcess(pid_t traceePid, std::string exe, std::strin
     // PTRACE_O_TRACEEXIT: ptrace will signal before exit() returns back to the caller.
     unsigned long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACESECCOMP | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACEEXIT;
 
-    int status;
     if (ptrace(PTRACE_SEIZE, traceePid, 0L, options) == -1)
     {
         BXL_LOG_DEBUG(m_bxl, "[PTrace] PTRACE_SEIZE failed with error: '%s'", strerror(errno));
@@ -196,11 +655,11 @@ void PTraceSandbox::AttachToProcess(pid_t traceePid, std::string exe, std::strin
     }
 
     m_traceePid = traceePid;
-    m_traceeTable.push_back(std::make_tuple(traceePid, exe));
+    AddTracee(traceePid, exe);
     m_bxl->disable_fd_table();
 
     // Resume child
-    ptrace(PTRACE_SYSCALL, m_traceePid, 0, 0);
+    ptrace(PTRACE_CONT, m_traceePid, 0, 0);
 
     // Attach complete, signal the semaphore for the child to resume
     sem_t *semaphore = sem_open(semaphoreName.c_str(), O_CREAT, 0644, 0);
@@ -211,8 +670,58 @@ void PTraceSandbox::AttachToProcess(pid_t traceePid, std::string exe, std::strin
     }
     sem_post(semaphore); // Increment the semaphore to unblock the traced process
     sem_close(semaphore);
+}
+
+void PTraceSandbox::ServeAttachRequests(BxlObserver *bxl, pid_t firstTraceePid, std::string firstExe, std::istream &requests)
+{
+    StartAttachThread(bxl, firstTraceePid, firstExe);
+
+    std::string requestedPid;
+    std::string exe;
+    while (std::getline(requests, requestedPid, '\0') && std::getline(requests, exe, '\0'))
+    {
+        pid_t traceePid = atoi(requestedPid.c_str());
+        if (traceePid <= 0)
+        {
+            BXL_LOG_DEBUG(bxl, "[PTrace] Ignoring attach request with invalid pid '%s'", requestedPid.c_str());
+            continue;
+        }
 
-    // Main loop that handles signals from the child
+        StartAttachThread(bxl, traceePid, exe);
+    }
+
+    std::unique_lock<std::mutex> lock(s_tracersLock);
+    s_tracersDone.wait(lock, [] { return s_activeTracers == 0; });
+}
+
+void PTraceSandbox::StartAttachThread(BxlObserver *bxl, pid_t traceePid, std::string exe)
+{
+    // Counted right away (rather than by the thread), so ServeAttachRequests can't miss a thread that hasn't started yet
+    {
+        std::lock_guard<std::mutex> lock(s_tracersLock);
+        s_activeTracers++;
+    }
+
+    // Only the thread that attached a tracee can trace it, so each attached process gets a thread of its own
+    std::thread([bxl, traceePid, exe]()
+    {
+        PTraceSandbox tracer(bxl);
+        tracer.Attach(traceePid, exe, "/" + std::to_string(traceePid));
+        tracer.TraceLoop();
+
+        std::lock_guard<std::mutex> lock(s_tracersLock);
+        s_activeTracers--;
+        s_tracersDone.notify_all();
+    }).detach();
+}
+
+void PTraceSandbox::TraceLoop()
+{
+    int status;
+
+    // Main loop that handles signals from the child.
+    // Tracees are always resumed with PTRACE_CONT: every syscall we care about stops on its seccomp event anyway, and resuming
+    // with PTRACE_SYSCALL would add a syscall-entry-stop and a syscall-exit-stop to each syscall the tracee makes afterwards.
     // wait should get signalled from the following:
     //  1. ptrace event (seccomp, clone, fork, vfork, exit)
     //  2. Child process exited with status code
@@ -220,10 +729,12 @@ void PTraceSandbox::AttachToProcess(pid_t traceePid, std::string exe, std::strin
     while (true)
     {
         // Passing -1 to waitpid has it wait for a signal from any PID
-        // A call to wait is equivalent to waitpid(-1, &status, 0);
         // The wait call will return the PID of the process that signalled, this should be used as the traceepid
-        // NOTE: this must be done in a single thread, we cannot split this up into separate threads because only the thread that attached the tracee can issue ptrace commands
-        m_traceePid = wait(&status);
+        // NOTE: only the thread that attached a tracee can issue ptrace commands on it. Each tracer thread owns the process it attached along
+        // with all of its descendants (see StartAttachThread), so __WNOTHREAD is used to only wait on the tracees of the calling thread.
+        // Forked children can't be handed to another thread: a detached tracee runs untraced until it is seized again, and keeping it
+        // stopped in between takes a SIGSTOP/SIGCONT pair the traced program (and its parent) would see.
+        m_traceePid = waitpid(-1, &status, __WNOTHREAD);
 
         if (m_traceePid == -1)
         {
@@ -235,7 +746,7 @@ void PTraceSandbox::AttachToProcess(pid_t traceePid, std::string exe, std::strin
                 _exit(-1);
             }
 
-            _exit(0);
+            return;
         }
 
         // Handle cases where the child processes has exited
@@ -254,7 +765,7 @@ void PTraceSandbox::AttachToProcess(pid_t traceePid, std::string exe, std::strin
         if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_VFORK << 8)))
         {
             // This case is explicitly skipped, and handled by PTraceSandbox::UpdateTraceeTableForExec
-            ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
+            ptrace(PTRACE_CONT, m_traceePid, NULL, NULL);
         }
         else if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_EXIT << 8)))
         {
@@ -262,14 +773,20 @@ void PTraceSandbox::AttachToProcess(pid_t traceePid, std::string exe, std::strin
             ptrace(PTRACE_GETEVENTMSG, m_traceePid, NULL, &traceeStatus);
             BXL_LOG_DEBUG(m_bxl, "[PTrace] Tracee %d exited with exit code '%d'", m_traceePid, WEXITSTATUS(traceeStatus));
             RemoveFromTraceeTable();
-            ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
+            ptrace(PTRACE_CONT, m_traceePid, NULL, NULL);
         }
         else if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_SECCOMP << 8)))
         {
-            long syscallNumber = ptrace(PTRACE_PEEKUSER, m_traceePid, sizeof(long) * ORIG_RAX, NULL);
+            // Fetch all the registers at once rather than peeking the syscall number and each argument separately
+            m_hasRegs = ptrace(PTRACE_GETREGS, m_traceePid, NULL, &m_regs) == 0;
+            long syscallNumber = m_hasRegs
+                ? (long)m_regs.orig_rax
+                : ptrace(PTRACE_PEEKUSER, m_traceePid, sizeof(long) * ORIG_RAX, NULL);
             HandleSysCallGeneric(syscallNumber);
+            m_hasRegs = false;
 
-            // We can resume the child with PTRACE_CONT here to ignore the ptrace-exit-stop for this syscall
+            // We can resume the child with PTRACE_CONT here to ignore the ptrace-exit-stop for this syscall.
+            // Handlers that need the outcome of the syscall already ran the tracee to its exit (see WaitForSyscallExit).
             ptrace(PTRACE_CONT, m_traceePid, NULL, NULL);
         }
         else if (WIFSTOPPED(status) && !(WSTOPSIG(status) & 0x80))
@@ -277,24 +794,27 @@ void PTraceSandbox::AttachToProcess(pid_t traceePid, std::string exe, std::strin
             // This is a signal-delivery-stop, this means that the tracee stopped during signal delivery
             // We don't care about these events, but when restarting the tracee we must deliver the signal by setting the last argument to ptrace(...)
             // signal-delivery-stop can be differentiated from sys calls events by checking whether the 7th bit is set on the signal (WSTOPSIG(status) & 0x80)
-            ptrace(PTRACE_SYSCALL, m_traceePid, NULL, WSTOPSIG(status));
+            ptrace(PTRACE_CONT, m_traceePid, NULL, WSTOPSIG(status));
         }
         else
         {
             // We can ignore the ptrace-exit-stop for fork/vfork/clone/exit events here
-            ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
+            ptrace(PTRACE_CONT, m_traceePid, NULL, NULL);
         }
     }
 }
 
 void PTraceSandbox::RemoveFromTraceeTable()
 {
-    m_traceeTable.erase(std::remove_if
-    (
-        m_traceeTable.begin(),
-        m_traceeTable.end(),
-        [this](const std::tuple<pid_t, std::string>& item) { return std::get<0>(item) == m_traceePid; }
-    ), m_traceeTable.end());
+    m_traceeTable.erase(m_traceePid);
+    m_fdPaths.erase(m_traceePid);
+
+    // The table of the process is gone along with its last task, and the pid may get reused by some other process
+    auto process = m_fdPathsByProcess.find(m_traceePid);
+    if (process != m_fdPathsByProcess.end() && process->second.expired())
+    {
+        m_fdPathsByProcess.erase(process);
+    }
 
     Handleexit();
 }
@@ -338,57 +858,216 @@ void *PTraceSandbox::GetArgumentAddr(int index)
 
 std::string PTraceSandbox::ReadArgumentString(char *syscall, int argumentIndex, bool nullTerminated, int length)
 {
-    void *addr = GetArgumentAddr(argumentIndex);
     // We are only interested in reading paths from the arguments so PATH_MAX (+1 for null terminator) should be safe to use here
     char argument[PATH_MAX + 1];
-    char *addrRegValue = (char *)ptrace(PTRACE_PEEKUSER, m_traceePid, addr, 0);
-    int currentStringLength = 0;
+    char *addrRegValue = (char *)ReadArgumentLong(argumentIndex);
+    size_t maxLength = length > 0 && length < PATH_MAX ? length : PATH_MAX;
 
-    while (true)
+    ssize_t bytesRead = m_useProcessVmReadv
+        ? ReadTraceeMemory(addrRegValue, argument, maxLength, nullTerminated)
+        : -1;
+
+    if (bytesRead == -1)
+    {
+        // PTRACE_PEEKTEXT needs the tracee to be ptrace-stopped, which is never the case for seccomp notifications
+        bytesRead = m_notification == nullptr
+            ? PeekTraceeMemory(syscall, argumentIndex, addrRegValue, argument, maxLength, nullTerminated)
+            : 0;
+    }
+
+    argument[bytesRead] = '\0';
+    return std::string(argument);
+}
+
+ssize_t PTraceSandbox::ReadTraceeMemory(const char *remoteAddr, char *buffer, size_t maxLength, bool nullTerminated)
+{
+    static const size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t totalRead = 0;
+
+    while (totalRead < maxLength)
     {
-        long addrMemoryLocation = ptrace(PTRACE_PEEKTEXT, m_traceePid, addrRegValue, NULL);
-        if (addrMemoryLocation == -1)
+        // A string can end right before an unmapped page, and a read that touches it would fail altogether.
+        // So never read past the end of the page we are currently on.
+        uintptr_t current = (uintptr_t)remoteAddr + totalRead;
+        size_t chunkLength = std::min(pageSize - (current % pageSize), maxLength - totalRead);
+
+        struct iovec local = { .iov_base = &buffer[totalRead], .iov_len = chunkLength };
+        struct iovec remote = { .iov_base = (void *)current, .iov_len = chunkLength };
+        ssize_t numRead = process_vm_readv(m_traceePid, &local, 1, &remote, 1, 0);
+        if (numRead <= 0)
         {
-            BXL_LOG_DEBUG(m_bxl, "[PTrace] Error occured while executing PTRACE_PEEKTEXT for syscall '%s' argument '%d' : '%s'", syscall, argumentIndex, strerror(errno));
-            argument[currentStringLength] = '\0';
+            if (numRead == -1 && totalRead == 0 && (errno == ENOSYS || errno == EPERM))
+            {
+                // Not supported by the kernel, or not allowed here. Don't try again and fall back to PTRACE_PEEKTEXT.
+                BXL_LOG_DEBUG(m_bxl, "[PTrace] process_vm_readv is not available, falling back to PTRACE_PEEKTEXT: '%s'", strerror(errno));
+                m_useProcessVmReadv = false;
+                return -1;
+            }
+
             break;
         }
 
-        addrRegValue += sizeof(long);
+        if (nullTerminated)
+        {
+            char *terminator = (char *)memchr(&buffer[totalRead], '\0', numRead);
+            if (terminator != nullptr)
+            {
+                return terminator - buffer;
+            }
+        }
+
+        totalRead += numRead;
+    }
 
-        char *currentArgReadChar = (char *)&addrMemoryLocation;
-        bool finishedReadingArgument = false;
+    return totalRead;
+}
 
-        for (int i = 0; i < sizeof(long); i++)
+size_t PTraceSandbox::PeekTraceeMemory(char *syscall, int argumentIndex, const char *remoteAddr, char *buffer, size_t maxLength, bool nullTerminated)
+{
+    size_t currentStringLength = 0;
+
+    while (currentStringLength < maxLength)
+    {
+        errno = 0;
+        long addrMemoryLocation = ptrace(PTRACE_PEEKTEXT, m_traceePid, remoteAddr, NULL);
+        if (addrMemoryLocation == -1 && errno != 0)
         {
-            argument[currentStringLength] = *currentArgReadChar;
-            currentStringLength++;
+            BXL_LOG_DEBUG(m_bxl, "[PTrace] Error occured while executing PTRACE_PEEKTEXT for syscall '%s' argument '%d' : '%s'", syscall, argumentIndex, strerror(errno));
+            break;
+        }
 
-            if ((nullTerminated && *currentArgReadChar == '\0') || (length > 0 && currentStringLength == length))
+        remoteAddr += sizeof(long);
+
+        char *currentArgReadChar = (char *)&addrMemoryLocation;
+        for (int i = 0; i < sizeof(long) && currentStringLength < maxLength; i++)
+        {
+            if (nullTerminated && *currentArgReadChar == '\0')
             {
-                finishedReadingArgument = true;
-                break;
+                return currentStringLength;
             }
 
+            buffer[currentStringLength] = *currentArgReadChar;
+            currentStringLength++;
             currentArgReadChar++;
         }
-
-        if (finishedReadingArgument)
-        {
-            argument[currentStringLength] = '\0';
-            break;
-        }
     }
 
-    return std::string(argument);
+    return currentStringLength;
 }
 
 unsigned long PTraceSandbox::ReadArgumentLong(int argumentIndex)
 {
+    if (m_notification != nullptr)
+    {
+        // Notifications carry the syscall arguments, but happen before the syscall runs so there is no return value yet
+        return argumentIndex > 0 && argumentIndex <= 6 ? m_notification->data.args[argumentIndex - 1] : 0;
+    }
+
+    // The registers were captured at the seccomp stop, when the syscall hadn't run yet. Handlers only read the return value
+    // after resuming the tracee, so it is always peeked; the argument registers are left untouched by the syscall.
+    if (m_hasRegs)
+    {
+        switch (argumentIndex)
+        {
+            case 1: return m_regs.rdi;
+            case 2: return m_regs.rsi;
+            case 3: return m_regs.rdx;
+            case 4: return m_regs.r10;
+            case 5: return m_regs.r8;
+            case 6: return m_regs.r9;
+            default: break;
+        }
+    }
+
     void *addr = GetArgumentAddr(argumentIndex);
     return ptrace(PTRACE_PEEKUSER, m_traceePid, addr, NULL);
 }
 
+int PTraceSandbox::GetDirectorySyscallError(int dirfd, const char *path, mode_t mode, bool isCreate)
+{
+    if (m_notification == nullptr)
+    {
+        WaitForSyscallExit();
+        return GetErrno();
+    }
+
+    // The task would only run the syscall after we reply to the notification, too late to report its outcome. So the supervisor
+    // makes it on behalf of the task instead, and replies with its result (see HandleSeccompNotification). The supervisor has the
+    // credentials of the task since it was forked from the tracee, which can't gain any (PR_SET_NO_NEW_PRIVS).
+    m_emulatedSyscall = true;
+
+    int dir = AT_FDCWD;
+    if (path[0] != '/')
+    {
+        char procPath[PATH_MAX];
+        if (dirfd == AT_FDCWD)
+        {
+            snprintf(procPath, sizeof(procPath), "/proc/%d/cwd", m_traceePid);
+        }
+        else
+        {
+            snprintf(procPath, sizeof(procPath), "/proc/%d/fd/%d", m_traceePid, dirfd);
+        }
+
+        dir = m_bxl->real_open(procPath, O_PATH | O_DIRECTORY | O_CLOEXEC, 0);
+        if (dir == -1)
+        {
+            // ENOENT means the task doesn't have such a descriptor
+            m_emulatedErrno = errno == ENOENT ? EBADF : errno;
+            return m_emulatedErrno;
+        }
+    }
+
+    int result = isCreate
+        ? m_bxl->real_mkdirat(dir, path, mode & ~GetTraceeUmask())
+        : m_bxl->real_unlinkat(dir, path, AT_REMOVEDIR);
+    m_emulatedErrno = result == -1 ? errno : 0;
+
+    if (dir != AT_FDCWD)
+    {
+        m_bxl->real_close(dir);
+    }
+
+    return m_emulatedErrno;
+}
+
+mode_t PTraceSandbox::GetTraceeUmask()
+{
+    // The supervisor runs with a zero umask, so it applies the one of the task itself. The field is there since Linux 4.7,
+    // which is older than seccomp notifications.
+    mode_t mask = S_IWGRP | S_IWOTH;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/proc/%d/status", m_traceePid);
+    int fd = m_bxl->real_open(path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd != -1)
+    {
+        char status[4096];
+        ssize_t length = read(fd, status, sizeof(status) - 1);
+        m_bxl->real_close(fd);
+
+        if (length > 0)
+        {
+            status[length] = '\0';
+            const char *field = strstr(status, "\nUmask:");
+            if (field != nullptr)
+            {
+                mask = (mode_t)strtoul(field + strlen("\nUmask:"), nullptr, 8);
+            }
+        }
+    }
+
+    return mask;
+}
+
+int PTraceSandbox::WaitForSyscallExit()
+{
+    int status = 0;
+    ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
+    waitpid(m_traceePid, &status, 0);
+    return status;
+}
+
 int PTraceSandbox::GetErrno()
 {
     long returnValue = ReadArgumentLong(0);
@@ -400,55 +1079,9 @@ void PTraceSandbox::HandleSysCallGeneric(int syscallNumber)
 {
     switch (syscallNumber)
     {
-        CHECK_AND_CALL_HANDLER(execveat);
-        CHECK_AND_CALL_HANDLER(execve);
-        CHECK_AND_CALL_HANDLER(stat);
-        CHECK_AND_CALL_HANDLER(lstat);
-        CHECK_AND_CALL_HANDLER(fstat);
-        CHECK_AND_CALL_HANDLER_NEW(fstatat);
-        CHECK_AND_CALL_HANDLER(access);
-        CHECK_AND_CALL_HANDLER(faccessat);
-        CHECK_AND_CALL_HANDLER(creat);
-        CHECK_AND_CALL_HANDLER(open);
-        CHECK_AND_CALL_HANDLER(openat);
-        CHECK_AND_CALL_HANDLER(write);
-        CHECK_AND_CALL_HANDLER(writev);
-        CHECK_AND_CALL_HANDLER(pwritev);
-        CHECK_AND_CALL_HANDLER(pwritev2);
-        CHECK_AND_CALL_HANDLER(pwrite64);
-        CHECK_AND_CALL_HANDLER(truncate);
-        CHECK_AND_CALL_HANDLER(ftruncate);
-        CHECK_AND_CALL_HANDLER(rmdir);
-        CHECK_AND_CALL_HANDLER(rename);
-        CHECK_AND_CALL_HANDLER(renameat);
-        CHECK_AND_CALL_HANDLER(link);
-        CHECK_AND_CALL_HANDLER(linkat);
-        CHECK_AND_CALL_HANDLER(unlink);
-        CHECK_AND_CALL_HANDLER(unlinkat);
-        CHECK_AND_CALL_HANDLER(symlink);
-        CHECK_AND_CALL_HANDLER(symlinkat);
-        CHECK_AND_CALL_HANDLER(readlink);
-        CHECK_AND_CALL_HANDLER(readlinkat);
-        CHECK_AND_CALL_HANDLER(utime);
-        CHECK_AND_CALL_HANDLER(utimes);
-        CHECK_AND_CALL_HANDLER(utimensat);
-        CHECK_AND_CALL_HANDLER(futimesat);
-        CHECK_AND_CALL_HANDLER(mkdir);
-        CHECK_AND_CALL_HANDLER(mkdirat);
-        CHECK_AND_CALL_HANDLER(mknod);
-        CHECK_AND_CALL_HANDLER(mknodat);
-        CHECK_AND_CALL_HANDLER(chmod);
-        CHECK_AND_CALL_HANDLER(fchmod);
-        CHECK_AND_CALL_HANDLER(fchmodat);
-        CHECK_AND_CALL_HANDLER(chown);
-        CHECK_AND_CALL_HANDLER(fchown);
-        CHECK_AND_CALL_HANDLER(lchown);
-        CHECK_AND_CALL_HANDLER(fchownat);
-        CHECK_AND_CALL_HANDLER(sendfile);
-        CHECK_AND_CALL_HANDLER(copy_file_range);
-        CHECK_AND_CALL_HANDLER(name_to_handle_at);
-        CHECK_AND_CALL_HANDLER(fork);
-        CHECK_AND_CALL_HANDLER(clone);
+        FOR_EACH_REPORTED_SYSCALL(CHECK_AND_CALL_HANDLER, CHECK_AND_CALL_HANDLER_NEW)
+        FOR_EACH_PTRACE_ONLY_SYSCALL(CHECK_AND_CALL_HANDLER)
+        FOR_EACH_FD_LIFETIME_SYSCALL(CHECK_AND_CALL_HANDLER)
         default:
             // This should not happen in theory with filtering enabled
             // However if it does occur, we can ignore this syscall and log a message for debugging if necessary
@@ -479,6 +1112,7 @@ void PTraceSandbox::ReportOpen(std::string path, int oflag, std::string syscallN
         /* error */ 0
     );
 
+    event.SetModeObserved();
     m_bxl->report_access(syscallName.c_str(), event);
 }
 
@@ -501,22 +1135,43 @@ void PTraceSandbox::ReportCreate(std::string syscallName, int dirfd, const char
     m_bxl->report_access(syscallName.c_str(), event, checkCache);
 }
 
-std::vector<std::tuple<pid_t, std::string>>::iterator PTraceSandbox::FindProcess(pid_t pid)
+std::unordered_map<pid_t, const std::string *>::iterator PTraceSandbox::FindProcess(pid_t pid)
 {
-    return std::find_if
-    (
-        m_traceeTable.begin(),
-        m_traceeTable.end(),
-        [pid](const std::tuple<pid_t, std::string>& item) { return std::get<0>(item) == pid; }
-    );
+    return m_traceeTable.find(pid);
+}
+
+void PTraceSandbox::AddTracee(pid_t pid, const std::string &exePath)
+{
+    m_traceeTable[pid] = InternExePath(exePath);
+}
+
+const std::string *PTraceSandbox::InternExePath(const std::string &exePath)
+{
+    // Elements of an unordered_set are never moved, so pointers to them stay valid for the lifetime of the set
+    return &*m_exePaths.insert(exePath).first;
 }
 
 void PTraceSandbox::UpdateTraceeTableForExec(std::string exePath)
 {
+    if (m_notification != nullptr)
+    {
+        // Seccomp notification tracees are tracked by TrackSeccompNotifyTracee
+        return;
+    }
+
+    // Close-on-exec descriptors are about to go away, and so are the other threads of the process if the exec succeeds (in which
+    // case this task may even take the pid of the thread group leader). The task finds the table of its process again on its next use.
+    auto fdPaths = m_fdPaths.find(m_traceePid);
+    if (fdPaths != m_fdPaths.end())
+    {
+        fdPaths->second->paths.clear();
+        m_fdPaths.erase(fdPaths);
+    }
+
     auto maybeProcess = FindProcess(m_traceePid);
     if (maybeProcess != m_traceeTable.end())
     {
-        std::get<1>(maybeProcess[0]) = exePath;
+        maybeProcess->second = InternExePath(exePath);
     }
     else
     {
@@ -533,9 +1188,10 @@ void PTraceSandbox::UpdateTraceeTableForExec(std::string exePath)
         // the parent will be blocked on the child process to execve
         // and the execve on the child will be blocked by a SIGSTOP from ptrace because the child is automatically traced by ptrace
         // which ptrace can't handle because it's blocked on the waitpid for the parent.
+        m_bxl->add_to_process_tree(m_traceePid);
         IOEvent event(m_traceePid, m_traceePid, /* traceeppid */ 0, ES_EVENT_TYPE_NOTIFY_FORK, ES_ACTION_TYPE_NOTIFY, exePath, std::string(""), exePath, /* mode */ 0, false, /* error */ 0);
         m_bxl->report_access("vfork", event, /* checkCache */ false);
-        m_traceeTable.push_back(std::make_tuple(m_traceePid, exePath));
+        AddTracee(m_traceePid, exePath);
 
         BXL_LOG_DEBUG(m_bxl, "[PTrace] Added new tracee with PID '%d'", m_traceePid);
     }
@@ -642,7 +1298,7 @@ HANDLER_FUNCTION(openat)
 
 void PTraceSandbox::HandleReportAccessFd(const char *syscall, int fd, es_event_type_t event /*ES_EVENT_TYPE_NOTIFY_WRITE*/)
 {
-    auto path = m_bxl->fd_to_path(fd, m_traceePid);
+    auto path = GetFdPath(fd);
 
     // Readlink returns type:[inode] if the path is not a file (files will return absolute paths)
     if (path[0] == '/')
@@ -698,12 +1354,10 @@ HANDLER_FUNCTION(rmdir)
     auto path = ReadArgumentString(SYSCALL_NAME_STRING(rmdir), 1, /*nullTerminated*/ true);
 
     // See comment about the need to propagate the returned value under HANDLER_FUNCTION(mkdir)
-    int status = 0;
-    ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
-    waitpid(m_traceePid, &status, 0);
+    int error = GetDirectorySyscallError(AT_FDCWD, path.c_str(), /* mode */ 0, /* isCreate */ false);
 
     // We don't want to use the cache since we want to distinguish between creation and deletion of directories
-    m_bxl->report_access(SYSCALL_NAME_STRING(rmdir), ES_EVENT_TYPE_NOTIFY_UNLINK, path.c_str(), m_emptyStr, /*mode*/ S_IFDIR, /* error */ GetErrno(), /*checkCache */ false, m_traceePid);
+    m_bxl->report_access(SYSCALL_NAME_STRING(rmdir), ES_EVENT_TYPE_NOTIFY_UNLINK, path.c_str(), m_emptyStr, /*mode*/ S_IFDIR, error, /*checkCache */ false, m_traceePid);
 }
 
 HANDLER_FUNCTION(rename)
@@ -730,24 +1384,20 @@ void PTraceSandbox::HandleRenameGeneric(const char *syscall, int olddirfd, const
     string newStr = m_bxl->normalize_path_at(newdirfd, newpath, O_NOFOLLOW, m_traceePid);
 
     mode_t mode = m_bxl->get_mode(oldStr.c_str());    
-    std::vector<std::string> filesAndDirectories;
     
     if (S_ISDIR(mode))
     {
-        bool enumerateResult = m_bxl->EnumerateDirectory(oldStr, /*recursive*/ true, filesAndDirectories);
-        if (enumerateResult)
+        // The rename is only reported here, never blocked, so each path can be reported as soon as it is enumerated
+        m_bxl->EnumerateDirectory(oldStr, /*recursive*/ true, [&](const char *fileOrDirectory, size_t length)
         {
-            for (auto fileOrDirectory : filesAndDirectories)
-            {
-                // Source
-                auto mode = m_bxl->get_mode(fileOrDirectory.c_str());
-                m_bxl->report_access(syscall, ES_EVENT_TYPE_NOTIFY_UNLINK, fileOrDirectory.c_str(), mode, O_NOFOLLOW, /* error */ 0, /* checkCache */ true, m_traceePid);
-
-                // Destination
-                fileOrDirectory.replace(0, oldStr.length(), newStr);
-                ReportOpen(fileOrDirectory, O_CREAT, std::string(syscall));
-            }
-        }
+            // Source
+            auto mode = m_bxl->get_mode(fileOrDirectory);
+            m_bxl->report_access(syscall, ES_EVENT_TYPE_NOTIFY_UNLINK, fileOrDirectory, mode, O_NOFOLLOW, /* error */ 0, /* checkCache */ true, m_traceePid);
+
+            // Destination
+            std::string target = newStr + (fileOrDirectory + oldStr.length());
+            ReportOpen(target, O_CREAT, std::string(syscall));
+        });
     }
     else
     {
@@ -918,12 +1568,10 @@ HANDLER_FUNCTION(mkdir)
     // report since on managed side bxl needs to understand whether the directory creation succeeded.
     // This is used to determine whether a directory was created by the build, which is an input for 
     // optimizations related to computing directory fingerprints in ObserverdInputProcessor
-    int status = 0;
-    ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
-    waitpid(m_traceePid, &status, 0);
+    int error = GetDirectorySyscallError(AT_FDCWD, path.c_str(), /* mode */ ReadArgumentLong(2), /* isCreate */ true);
 
     // We don't want to use the cache since we want to distinguish between creation and deletion of directories
-    ReportCreate(SYSCALL_NAME_STRING(mkdir), AT_FDCWD, path.c_str(), S_IFDIR, GetErrno(), /* checkCache */ false);
+    ReportCreate(SYSCALL_NAME_STRING(mkdir), AT_FDCWD, path.c_str(), S_IFDIR, error, /* checkCache */ false);
 }
 
 HANDLER_FUNCTION(mkdirat)
@@ -932,12 +1580,10 @@ HANDLER_FUNCTION(mkdirat)
     auto path = ReadArgumentString(SYSCALL_NAME_STRING(mkdirat), 2, /*nullTerminated*/ true);
 
     // See comment about the need to propagate the returned value under HANDLER_FUNCTION(mkdir)
-    int status = 0;
-    ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
-    waitpid(m_traceePid, &status, 0);
+    int error = GetDirectorySyscallError(dirfd, path.c_str(), /* mode */ ReadArgumentLong(3), /* isCreate */ true);
 
     // We don't want to use the cache since we want to distinguish between creation and deletion of directories
-    ReportCreate(SYSCALL_NAME_STRING(mkdirat), dirfd, path.c_str(), S_IFDIR, GetErrno(), /* checkCache */ false);
+    ReportCreate(SYSCALL_NAME_STRING(mkdirat), dirfd, path.c_str(), S_IFDIR, error, /* checkCache */ false);
 }
 
 HANDLER_FUNCTION(mknod)
@@ -1032,17 +1678,183 @@ HANDLER_FUNCTION(name_to_handle_at)
     ReportOpen(pathStr, oflags, SYSCALL_NAME_STRING(name_to_handle_at));
 }
 
+// Reads the thread group id of the given task from procfs. Returns 0 if it can't be read.
+static pid_t ReadThreadGroupId(pid_t tid)
+{
+    char statusPath[64];
+    snprintf(statusPath, sizeof(statusPath), "/proc/%d/status", tid);
+    int fd = open(statusPath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return 0;
+    }
+
+    // Tgid is on the fourth line, well within the first few hundred bytes
+    char status[512];
+    ssize_t length = read(fd, status, sizeof(status) - 1);
+    close(fd);
+    if (length <= 0)
+    {
+        return 0;
+    }
+
+    status[length] = '\0';
+    const char *tgid = strstr(status, "\nTgid:");
+    return tgid == nullptr ? 0 : (pid_t)atoi(tgid + strlen("\nTgid:"));
+}
+
+PTraceSandbox::FdPathTable *PTraceSandbox::GetFdPathTable()
+{
+    // Seccomp notifications are served by several workers, none of which sees every close
+    if (!m_cacheFdPaths || m_notification != nullptr)
+    {
+        return nullptr;
+    }
+
+    auto task = m_fdPaths.find(m_traceePid);
+    if (task == m_fdPaths.end())
+    {
+        std::shared_ptr<FdPathTable> table;
+        pid_t tgid = ReadThreadGroupId(m_traceePid);
+        if (tgid > 0)
+        {
+            auto &process = m_fdPathsByProcess[tgid];
+            table = process.lock();
+            if (table == nullptr)
+            {
+                table = std::make_shared<FdPathTable>();
+                process = table;
+            }
+        }
+        else
+        {
+            // Without knowing which process the task belongs to, it can't share a table with its threads
+            table = std::make_shared<FdPathTable>();
+            table->disabled = true;
+        }
+
+        task = m_fdPaths.emplace(m_traceePid, std::move(table)).first;
+    }
+
+    return task->second->disabled ? nullptr : task->second.get();
+}
+
+void PTraceSandbox::DisableFdPathTable()
+{
+    FdPathTable *table = GetFdPathTable();
+    if (table != nullptr)
+    {
+        table->paths.clear();
+        table->disabled = true;
+    }
+}
+
+std::string PTraceSandbox::GetFdPath(int fd)
+{
+    FdPathTable *table = GetFdPathTable();
+    if (table == nullptr)
+    {
+        return m_bxl->fd_to_path(fd, m_traceePid);
+    }
+
+    auto entry = table->paths.find(fd);
+    if (entry != table->paths.end())
+    {
+        return entry->second;
+    }
+
+    // Non-files (e.g. "pipe:[1234]") are cached too: writes to the standard output are as frequent as any
+    auto path = m_bxl->fd_to_path(fd, m_traceePid);
+    if (!path.empty())
+    {
+        table->paths.emplace(fd, path);
+    }
+
+    return path;
+}
+
+HANDLER_FUNCTION(close)
+{
+    FdPathTable *table = GetFdPathTable();
+    if (table != nullptr)
+    {
+        table->paths.erase((int)ReadArgumentLong(1));
+    }
+}
+
+HANDLER_FUNCTION(close_range)
+{
+    unsigned int first = ReadArgumentLong(1);
+    unsigned int last = ReadArgumentLong(2);
+    unsigned int flags = ReadArgumentLong(3);
+
+#ifdef CLOSE_RANGE_UNSHARE
+    // The descriptor table of the process is no longer the one its other tasks (if any) share
+    if (flags & CLOSE_RANGE_UNSHARE)
+    {
+        DisableFdPathTable();
+        return;
+    }
+#endif
+
+#ifdef CLOSE_RANGE_CLOEXEC
+    // Descriptors are only marked as close-on-exec: nothing is closed yet
+    if (flags & CLOSE_RANGE_CLOEXEC)
+    {
+        return;
+    }
+#endif
+
+    FdPathTable *table = GetFdPathTable();
+    if (table == nullptr)
+    {
+        return;
+    }
+
+    for (auto entry = table->paths.begin(); entry != table->paths.end();)
+    {
+        entry = (unsigned int)entry->first >= first && (unsigned int)entry->first <= last ? table->paths.erase(entry) : std::next(entry);
+    }
+}
+
+HANDLER_FUNCTION(dup2)
+{
+    // The new descriptor gets closed first if it is open. It is dropped even if the syscall fails, which is harmless.
+    FdPathTable *table = GetFdPathTable();
+    if (table != nullptr)
+    {
+        table->paths.erase((int)ReadArgumentLong(2));
+    }
+}
+
+HANDLER_FUNCTION(dup3)
+{
+    FdPathTable *table = GetFdPathTable();
+    if (table != nullptr)
+    {
+        table->paths.erase((int)ReadArgumentLong(2));
+    }
+}
+
+HANDLER_FUNCTION(unshare)
+{
+    // The process gets a descriptor table of its own, which its other tasks (if any) don't see anymore
+    if (ReadArgumentLong(1) & CLONE_FILES)
+    {
+        DisableFdPathTable();
+    }
+}
+
 void PTraceSandbox::HandleChildProcess(const char *syscall)
 {
-    int status = 0;
-    ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
-    waitpid(m_traceePid, &status, 0);
+    // Arguments can only be read while the tracee is still stopped at the seccomp event
+    unsigned long cloneFlags = strcmp(syscall, SYSCALL_NAME_STRING(clone)) == 0 ? ReadArgumentLong(1) : 0;
 
+    int status = WaitForSyscallExit();
     if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_CLONE << 8))
         || status >> 8 == (SIGTRAP | (PTRACE_EVENT_FORK << 8)))
     {
-        ptrace(PTRACE_SYSCALL, m_traceePid, NULL, NULL);
-        waitpid(m_traceePid, &status, 0);
+        WaitForSyscallExit();
     }
     
     long childpid = ReadArgumentLong(0);
@@ -1054,7 +1866,7 @@ void PTraceSandbox::HandleChildProcess(const char *syscall)
     // Best effort to get the ppid/exe of the tracee here. There's no nice way to do this from outside the process
     if (maybeParent != m_traceeTable.end())
     {
-        exePath = std::get<1>(maybeParent[0]);
+        exePath = *maybeParent->second;
     }
     else
     {
@@ -1062,12 +1874,51 @@ void PTraceSandbox::HandleChildProcess(const char *syscall)
         exePath = m_bxl->GetProgramPath();
     }
 
+    // The parent is still stopped, so it can't exit before its child counts as live
+    if (!(cloneFlags & CLONE_THREAD))
+    {
+        m_bxl->add_to_process_tree(childpid);
+    }
+
     IOEvent event(m_traceePid, childpid, /* traceeppid */ 0, ES_EVENT_TYPE_NOTIFY_FORK, ES_ACTION_TYPE_NOTIFY, exePath, std::string(""), exePath, /* mode */ 0, false, /* error */ 0);
     m_bxl->report_access(syscall, event, /* checkCache */ false);
 
+    if (childpid > 0 && m_cacheFdPaths)
+    {
+        // Makes sure the parent has a table, even a disabled one
+        GetFdPathTable();
+        std::shared_ptr<FdPathTable> parentFdPaths = m_fdPaths[m_traceePid];
+        std::shared_ptr<FdPathTable> childFdPaths;
+        if (cloneFlags & CLONE_THREAD)
+        {
+            // Threads share the descriptors of their process
+            childFdPaths = parentFdPaths;
+        }
+        else if (cloneFlags & CLONE_FILES)
+        {
+            // A process sharing its descriptors with another one would have to see every close of the other one,
+            // which its own thread group id doesn't lead to
+            parentFdPaths->paths.clear();
+            parentFdPaths->disabled = true;
+            childFdPaths = parentFdPaths;
+        }
+        else
+        {
+            // The child starts with a copy of the descriptors of its parent
+            childFdPaths = parentFdPaths->disabled ? std::make_shared<FdPathTable>() : std::make_shared<FdPathTable>(*parentFdPaths);
+        }
+
+        if (!(cloneFlags & CLONE_THREAD))
+        {
+            m_fdPathsByProcess[childpid] = childFdPaths;
+        }
+
+        m_fdPaths[childpid] = std::move(childFdPaths);
+    }
+
     // Record the new child tracee
     // When PTRACE_O_TRACEFORK/CLONE/VFORK is set, the child process is automatically ptraced as well
-    m_traceeTable.push_back(std::make_tuple(childpid, exePath));
+    AddTracee(childpid, exePath);
 
     BXL_LOG_DEBUG(m_bxl, "[PTrace] Added new tracee with PID '%d'", childpid);
 }
@@ -3,6 +3,12 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <memory>
+#include <mutex>
+#include <sys/user.h>
 #include "bxl_observer.hpp"
 
 typedef void (*HandlerFunction)(void);
@@ -35,17 +41,99 @@ public:
      */
     void AttachToProcess(pid_t traceePid, std::string exe, std::string semaphoreName);
 
+    /**
+     * Serves the attach requests sent to a pip's tracer daemon, so processes of the pip that need a tracer share a single
+     * runner (and its already parsed FAM) instead of each getting a new one. A request names a process waiting for a tracer
+     * as "<pid>\0<exe>\0", and the process gets its own tracer thread. Returns once 'requests' is exhausted and all the
+     * tracer threads are done.
+     */
+    static void ServeAttachRequests(BxlObserver *bxl, pid_t firstTraceePid, std::string firstExe, std::istream &requests);
+
     /*
      * @brief Executes the provided child process under the ptrace sandbox
      * @return The return value from exec if the child fails to execute
      */
     int ExecuteWithPTraceSandbox(const char *file, char *const argv[], char *const envp[], const char *fam);
 
+    /*
+     * @brief Executes the provided child process with a seccomp filter that notifies a supervisor process instead of stopping for a tracer.
+     * The supervisor is forked from the calling process and handles the notifications with the same handlers as the ptrace sandbox.
+     * Falls back to ExecuteWithPTraceSandbox if the filter can't be set up.
+     * @return The return value from exec if the child fails to execute
+     */
+    int ExecuteWithSeccompNotifySandbox(const char *file, char *const argv[], char *const envp[], const char *fam);
+
 private:
     BxlObserver *m_bxl;
     pid_t m_traceePid = 0;
+    // Cleared the first time process_vm_readv turns out to be unavailable, so we go straight to PTRACE_PEEKTEXT afterwards
+    bool m_useProcessVmReadv = true;
     const char* const m_emptyStr = "";
-    std::vector<std::tuple<pid_t, std::string>> m_traceeTable; // tracee pid, tracee exe path
+    std::unordered_map<pid_t, const std::string *> m_traceeTable; // tracee pid -> tracee exe path (interned in m_exePaths)
+    std::unordered_set<std::string> m_exePaths; // exe paths of the tracees, shared by all the tracees that run the same binary
+    // Set while handling a seccomp notification: arguments are read from it instead of the tracee registers
+    const struct seccomp_notif *m_notification = nullptr;
+    // Set once the syscall of the current notification was made by the supervisor, which replies with its error instead of letting it run
+    bool m_emulatedSyscall = false;
+    int m_emulatedErrno = 0;
+    // Registers of the tracee at the current seccomp stop, fetched with a single PTRACE_GETREGS; only valid while m_hasRegs is set
+    struct user_regs_struct m_regs;
+    bool m_hasRegs = false;
+
+    // Paths the descriptors of a tracee process refer to, as read from procfs the first time each descriptor was used.
+    // Only kept with FileAccessManifestExtraFlag::CacheLinuxPTraceFdPaths, which also has tracees stop on the syscalls that
+    // close or replace descriptors (see FOR_EACH_FD_LIFETIME_SYSCALL) so entries are dropped before they go stale.
+    struct FdPathTable
+    {
+        std::unordered_map<int, std::string> paths;
+        // Set once the descriptor table of the process stops being shared exactly by the tasks we think share it (e.g. after
+        // unshare(CLONE_FILES)): paths are read from procfs every time from then on
+        bool disabled = false;
+    };
+    bool m_cacheFdPaths = false;
+    // Tracee task -> table of its process. Threads of a process share the same table.
+    std::unordered_map<pid_t, std::shared_ptr<FdPathTable>> m_fdPaths;
+    // Thread group id -> table of the process, so threads that were not created through a traced clone (e.g. clone3) find it
+    std::unordered_map<pid_t, std::weak_ptr<FdPathTable>> m_fdPathsByProcess;
+
+    // Tasks seen by the seccomp notification supervisor (pid -> thread group id), shared by all of its workers
+    static std::mutex s_notifyTraceesLock;
+    static std::unordered_map<pid_t, pid_t> s_notifyTracees;
+
+    // Number of tracer threads that were spawned by StartAttachThread and are still tracing
+    static std::mutex s_tracersLock;
+    static std::condition_variable s_tracersDone;
+    static unsigned int s_activeTracers;
+
+    /**
+     * Waits on the tracees of the calling thread and handles their ptrace events until there are none left.
+     */
+    void TraceLoop();
+
+    /**
+     * Seizes the given process (which waits on the semaphore of the given name until it is traced) and lets it run.
+     */
+    void Attach(pid_t traceePid, const std::string &exe, const std::string &semaphoreName);
+
+    /**
+     * Starts a tracer thread of the tracer daemon for a process waiting to be attached (see ServeAttachRequests).
+     */
+    static void StartAttachThread(BxlObserver *bxl, pid_t traceePid, std::string exe);
+
+    /**
+     * Builds the seccomp filter for the syscalls we report on, returning the given action for them.
+     */
+    static std::vector<struct sock_filter> GetSyscallFilter(unsigned int action, bool traceFdLifetimes);
+
+    // Seccomp notification sandbox
+    int FallBackToPTraceSandbox(const char *file, char *const argv[], char *const envp[], const char *fam);
+    void RunSeccompNotifySupervisor(int socketFd, pid_t traceePid);
+    static void ServeSeccompNotifications(BxlObserver *bxl, int listenerFd);
+    void HandleSeccompNotification(int listenerFd, const struct seccomp_notif &request);
+    // Reports a process (or thread) creation the first time a task shows up on a notification
+    void TrackSeccompNotifyTracee();
+    // Reports the exit of the current task, or of all the tasks of its thread group
+    void RemoveSeccompNotifyTracees(bool wholeProcess);
 
     /**
      * Removes the current pid from the tracee table and reports its exit
@@ -55,7 +143,17 @@ private:
     /**
      * Finds the parent process in the tracee table for a given PID.
      */
-    std::vector<std::tuple<pid_t, std::string>>::iterator FindProcess(pid_t pid);
+    std::unordered_map<pid_t, const std::string *>::iterator FindProcess(pid_t pid);
+
+    /**
+     * Adds (or updates) a tracee in the tracee table.
+     */
+    void AddTracee(pid_t pid, const std::string &exePath);
+
+    /**
+     * Returns the single copy of the given exe path kept for the tracee table.
+     */
+    const std::string *InternExePath(const std::string &exePath);
 
     void HandleSysCallGeneric(int syscallNumber);
 
@@ -71,9 +169,27 @@ private:
      * @return String containing the argument
      */
     unsigned long ReadArgumentLong(int argumentIndex);
+    /*
+     * @brief Reads up to maxLength bytes of the tracee memory at the given address with process_vm_readv, page by page
+     * @return Number of bytes read (excluding the null terminator if nullTerminated is set), or -1 if process_vm_readv can't be used
+     */
+    ssize_t ReadTraceeMemory(const char *remoteAddr, char *buffer, size_t maxLength, bool nullTerminated);
+    // Same as ReadTraceeMemory, but one word at a time with PTRACE_PEEKTEXT
+    size_t PeekTraceeMemory(char *syscall, int argumentIndex, const char *remoteAddr, char *buffer, size_t maxLength, bool nullTerminated);
     void ReportOpen(std::string path, int oflag, std::string syscallName);
     void ReportCreate(std::string syscallName, int dirfd, const char *pathname, mode_t mode, long returnValue = 0, bool checkCache = true);
     int GetErrno();
+    /*
+     * @brief Lets the tracee (stopped on the seccomp event of a syscall) run until its next stop, which is the syscall-exit-stop
+     * unless a ptrace event (such as a fork) comes first. Only handlers that need the outcome of their syscall call this:
+     * every other syscall costs a single stop.
+     * @return The wait status of the stop
+     */
+    int WaitForSyscallExit();
+    // Gets the error of the mkdir/mkdirat/rmdir the tracee is stopped on, letting the syscall complete if needed (or, with seccomp
+    // notifications, making it on behalf of the task)
+    int GetDirectorySyscallError(int dirfd, const char *path, mode_t mode, bool isCreate);
+    mode_t GetTraceeUmask();
     void UpdateTraceeTableForExec(std::string exePath);
 
     // Handlers
@@ -130,4 +246,17 @@ private:
     void HandleChildProcess(const char *syscall);
     void HandleRenameGeneric(const char *syscall, int olddirfd, const char *oldpath, int newdirfd, const char *newpath);
     void HandleReportAccessFd(const char *syscall, int fd, es_event_type_t event = ES_EVENT_TYPE_NOTIFY_WRITE);
+
+    // Descriptor path cache (see FdPathTable)
+    MAKE_HANDLER_FN_DEF(close);
+    MAKE_HANDLER_FN_DEF(close_range);
+    MAKE_HANDLER_FN_DEF(dup2);
+    MAKE_HANDLER_FN_DEF(dup3);
+    MAKE_HANDLER_FN_DEF(unshare);
+    // Gets the path the given descriptor of the current tracee refers to, from the cache if possible
+    std::string GetFdPath(int fd);
+    // Gets the table of the process of the current tracee, creating it if needed. Returns null if paths are not cached for it.
+    FdPathTable *GetFdPathTable();
+    // Stops caching paths for the process of the current tracee
+    void DisableFdPathTable();
 };
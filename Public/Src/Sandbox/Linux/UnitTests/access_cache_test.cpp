@@ -0,0 +1,175 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <access_cache.hpp>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(AccessCacheTests)
+
+static bool Check(AccessCache &cache, uint32_t eventClass, const string &path, bool addIfMissing)
+{
+    return cache.Check(eventClass, path.c_str(), path.length(), addIfMissing);
+}
+
+BOOST_AUTO_TEST_CASE(TestHitsAndMisses)
+{
+    AccessCache cache;
+    BOOST_REQUIRE(cache.Initialize());
+
+    BOOST_CHECK(!Check(cache, 1, "/usr/bin/clang", /* addIfMissing */ false));
+    BOOST_CHECK(!Check(cache, 1, "/usr/bin/clang", /* addIfMissing */ true));
+    BOOST_CHECK(Check(cache, 1, "/usr/bin/clang", /* addIfMissing */ false));
+    BOOST_CHECK(Check(cache, 1, "/usr/bin/clang", /* addIfMissing */ true));
+
+    // Same path under a different event class, and a path that only shares a prefix
+    BOOST_CHECK(!Check(cache, 2, "/usr/bin/clang", /* addIfMissing */ false));
+    BOOST_CHECK(!Check(cache, 1, "/usr/bin/clang++", /* addIfMissing */ false));
+
+    AccessCache::Stats stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.hits, 2);
+    BOOST_CHECK_EQUAL(stats.misses, 4);
+    BOOST_CHECK_EQUAL(stats.dropped, 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestAccessesOnlyGrow)
+{
+    AccessCache cache;
+    BOOST_REQUIRE(cache.Initialize());
+
+    const uint32_t probe = 1, read = 2, write = 4;
+    string path = "/home/user/src/main.c";
+
+    // A read implies a probe, but not a write
+    BOOST_CHECK(!cache.CheckAccesses(1, path.c_str(), path.length(), read, read | probe));
+    BOOST_CHECK(cache.CheckAccesses(1, path.c_str(), path.length(), probe, 0));
+    BOOST_CHECK(cache.CheckAccesses(1, path.c_str(), path.length(), read, 0));
+    BOOST_CHECK(!cache.CheckAccesses(1, path.c_str(), path.length(), write, 0));
+
+    // Recording a weaker access never drops a stronger one
+    BOOST_CHECK(!cache.CheckAccesses(1, path.c_str(), path.length(), write, write | read | probe));
+    BOOST_CHECK(cache.CheckAccesses(1, path.c_str(), path.length(), probe, probe));
+    BOOST_CHECK(cache.CheckAccesses(1, path.c_str(), path.length(), write, 0));
+
+    // Accesses are per event class, and Check is the same as a single access
+    BOOST_CHECK(!cache.CheckAccesses(2, path.c_str(), path.length(), probe, 0));
+    BOOST_CHECK(Check(cache, 1, path, /* addIfMissing */ false));
+}
+
+BOOST_AUTO_TEST_CASE(TestEvictionKeepsRecentEntries)
+{
+    // The smallest budget there is: every generation gets its minimum number of slots
+    AccessCache cache;
+    BOOST_REQUIRE(cache.Initialize(1));
+
+    const string hot = "/src/hot.h";
+    BOOST_CHECK(!Check(cache, 1, hot, /* addIfMissing */ true));
+
+    // Way more paths than the cache can hold, with the hot one used in between
+    const int pathCount = 100000;
+    for (int i = 0; i < pathCount; i++)
+    {
+        Check(cache, 1, "/src/file" + to_string(i) + ".cpp", /* addIfMissing */ true);
+        if (i % 1000 == 0)
+        {
+            BOOST_CHECK(Check(cache, 1, hot, /* addIfMissing */ true));
+        }
+    }
+
+    AccessCache::Stats stats = cache.GetStats();
+    BOOST_CHECK_GT(stats.evictions, 0);
+    BOOST_CHECK_LT(stats.evictions, (uint64_t)pathCount);
+
+    // Recently added paths are still there, old ones are gone
+    BOOST_CHECK(Check(cache, 1, hot, /* addIfMissing */ false));
+    BOOST_CHECK(Check(cache, 1, "/src/file" + to_string(pathCount - 1) + ".cpp", /* addIfMissing */ false));
+    BOOST_CHECK(!Check(cache, 1, "/src/file0.cpp", /* addIfMissing */ false));
+}
+
+BOOST_AUTO_TEST_CASE(TestEntriesMovedOutOfEvictedGenerationKeepTheirAccesses)
+{
+    AccessCache cache;
+    BOOST_REQUIRE(cache.Initialize(1));
+
+    const uint32_t probe = 1, read = 2, write = 4;
+    string path = "/home/user/src/main.c";
+    BOOST_CHECK(!cache.CheckAccesses(1, path.c_str(), path.length(), write, write | read | probe));
+
+    // Enough new paths to push the entry to the previous generation at least once, while it keeps being used
+    for (int i = 0; i < 100000; i++)
+    {
+        Check(cache, 1, "/src/file" + to_string(i) + ".cpp", /* addIfMissing */ true);
+        if (i % 1000 == 0)
+        {
+            BOOST_CHECK(cache.CheckAccesses(1, path.c_str(), path.length(), probe, probe));
+        }
+    }
+
+    BOOST_CHECK_GT(cache.GetStats().evictions, 0);
+    BOOST_CHECK(cache.CheckAccesses(1, path.c_str(), path.length(), write, 0));
+}
+
+BOOST_AUTO_TEST_CASE(TestUninitializedCacheAlwaysMisses)
+{
+    AccessCache cache;
+
+    BOOST_CHECK(!Check(cache, 1, "/tmp/file", /* addIfMissing */ true));
+    BOOST_CHECK(!Check(cache, 1, "/tmp/file", /* addIfMissing */ true));
+}
+
+BOOST_AUTO_TEST_CASE(TestConcurrentInserts)
+{
+    AccessCache cache;
+    BOOST_REQUIRE(cache.Initialize());
+
+    const int threadCount = 8;
+    const int pathCount = 2000;
+    vector<int> newEntries(threadCount, 0);
+    vector<thread> threads;
+
+    // Every thread adds the same set of paths: each path must be reported as new by at most one thread
+    for (int t = 0; t < threadCount; t++)
+    {
+        threads.emplace_back([&cache, &newEntries, t]()
+        {
+            for (int i = 0; i < pathCount; i++)
+            {
+                if (!Check(cache, 1, "/src/file" + to_string(i) + ".cpp", /* addIfMissing */ true))
+                {
+                    newEntries[t]++;
+                }
+            }
+        });
+    }
+
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+
+    int totalNewEntries = 0;
+    for (int count : newEntries)
+    {
+        totalNewEntries += count;
+    }
+
+    // A thread that sees an entry that is still being written treats it as a miss, so a few duplicates are allowed
+    AccessCache::Stats stats = cache.GetStats();
+    BOOST_CHECK_GE(totalNewEntries, pathCount);
+    BOOST_CHECK_LE(totalNewEntries, pathCount + (int)stats.contentions);
+
+    for (int i = 0; i < pathCount; i++)
+    {
+        BOOST_CHECK(Check(cache, 1, "/src/file" + to_string(i) + ".cpp", /* addIfMissing */ false));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
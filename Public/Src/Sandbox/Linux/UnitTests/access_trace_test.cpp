@@ -0,0 +1,143 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <access_trace.hpp>
+#include <temp_file.hpp>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(AccessTraceTests)
+
+static const string Fam = "serialized manifest";
+
+static bool Append(AccessTrace &trace, int32_t pid, const string &syscallName, const string &event)
+{
+    AccessTrace::Record record = { };
+    record.pid = pid;
+    record.timestampNs = 42;
+    return trace.Append(record, syscallName.c_str(), syscallName.length(), event.c_str(), event.length());
+}
+
+static vector<string> ReadAll(const AccessTrace &trace)
+{
+    vector<string> records;
+    trace.ForEach([&](const AccessTrace::Record &record, const char *syscallName, size_t syscallNameLength, const char *event, size_t eventLength)
+    {
+        records.push_back(to_string(record.pid) + ":" + string(syscallName, syscallNameLength) + ":" + string(event, eventLength));
+    });
+
+    return records;
+}
+
+BOOST_AUTO_TEST_CASE(TestRecordsRoundTrip)
+{
+    TempFile file;
+    AccessTrace trace;
+    BOOST_REQUIRE(trace.Open(file.path.c_str(), Fam.c_str(), Fam.length()));
+    BOOST_CHECK(ReadAll(trace).empty());
+
+    BOOST_CHECK(Append(trace, 1, "open", "first event"));
+    BOOST_CHECK(Append(trace, 2, "stat", ""));
+    BOOST_CHECK(ReadAll(trace) == vector<string>({ "1:open:first event", "2:stat:" }));
+
+    size_t famLength;
+    const char *fam = trace.GetFam(famLength);
+    BOOST_CHECK_EQUAL(string(fam, famLength), Fam);
+}
+
+BOOST_AUTO_TEST_CASE(TestSurvivesTheWriter)
+{
+    TempFile file;
+    pid_t child = fork();
+    if (child == 0)
+    {
+        AccessTrace trace;
+        if (!trace.Open(file.path.c_str(), Fam.c_str(), Fam.length()))
+        {
+            _exit(1);
+        }
+
+        Append(trace, getpid(), "open", "written by the child");
+        // Die without unmapping anything (and out of reach of the boost signal handlers)
+        kill(getpid(), SIGKILL);
+    }
+
+    int status;
+    BOOST_REQUIRE_EQUAL(waitpid(child, &status, 0), child);
+    BOOST_REQUIRE(WIFSIGNALED(status));
+
+    AccessTrace reader;
+    BOOST_REQUIRE(reader.OpenForReading(file.path.c_str()));
+    BOOST_CHECK(ReadAll(reader) == vector<string>({ to_string(child) + ":open:written by the child" }));
+
+    size_t famLength;
+    const char *fam = reader.GetFam(famLength);
+    BOOST_CHECK_EQUAL(string(fam, famLength), Fam);
+
+    // Opening the trace again appends to it
+    AccessTrace writer;
+    BOOST_REQUIRE(writer.Open(file.path.c_str(), Fam.c_str(), Fam.length()));
+    Append(writer, 1, "stat", "written by the parent");
+    BOOST_CHECK_EQUAL(ReadAll(reader).size(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(TestFullTraceDropsRecords)
+{
+    TempFile file;
+    AccessTrace trace;
+    BOOST_REQUIRE(trace.Open(file.path.c_str(), Fam.c_str(), Fam.length(), /* capacity */ 256));
+
+    int appended = 0;
+    for (int i = 0; i < 100; i++)
+    {
+        appended += Append(trace, i, "open", "event " + to_string(i)) ? 1 : 0;
+    }
+
+    // The oldest records are kept, and the rest are counted
+    BOOST_REQUIRE(appended > 0);
+    vector<string> records = ReadAll(trace);
+    BOOST_CHECK_EQUAL(records.size(), appended);
+    BOOST_CHECK_EQUAL(records[0], "0:open:event 0");
+    BOOST_CHECK_EQUAL(trace.GetDroppedRecords(), 100 - appended);
+}
+
+BOOST_AUTO_TEST_CASE(TestMismatches)
+{
+    TempFile file;
+    AccessTrace first;
+    BOOST_REQUIRE(first.Open(file.path.c_str(), Fam.c_str(), Fam.length(), /* capacity */ 1024));
+
+    AccessTrace second;
+    BOOST_CHECK(!second.Open(file.path.c_str(), Fam.c_str(), Fam.length(), /* capacity */ 2048));
+    BOOST_CHECK(!second.Open(file.path.c_str(), "other", strlen("other"), /* capacity */ 1024));
+    BOOST_CHECK(!second.IsValid());
+
+    // Appending to a trace that isn't open is a no-op
+    BOOST_CHECK(!Append(second, 1, "open", "dropped"));
+    BOOST_CHECK(ReadAll(second).empty());
+}
+
+BOOST_AUTO_TEST_CASE(TestNotATrace)
+{
+    TempFile file;
+    FILE *other = fopen(file.path.c_str(), "w");
+    fputs("some file that is large enough to hold a trace header, but is not a trace", other);
+    fclose(other);
+
+    AccessTrace trace;
+    BOOST_CHECK(!trace.OpenForReading(file.path.c_str()));
+    BOOST_CHECK(!trace.IsValid());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,145 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <climits>
+#include <fd_table.hpp>
+#include <string>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(FdTableTests)
+
+BOOST_AUTO_TEST_CASE(TestSetGetAndReset)
+{
+    FdTable table;
+    string path;
+
+    BOOST_CHECK(!table.Get(3, path));
+
+    table.Set(3, "/tmp/file");
+    BOOST_REQUIRE(table.Get(3, path));
+    BOOST_CHECK_EQUAL(path, "/tmp/file");
+
+    table.Reset(3);
+    BOOST_CHECK(!table.Get(3, path));
+
+    // Out of range descriptors are just never cached
+    table.Set(-1, "/tmp/file");
+    BOOST_CHECK(!table.Get(-1, path));
+}
+
+BOOST_AUTO_TEST_CASE(TestGetIntoBuffer)
+{
+    FdTable table;
+    char path[16];
+
+    BOOST_CHECK(!table.Get(3, path, sizeof(path)));
+
+    table.Set(3, "/tmp/file");
+    BOOST_REQUIRE(table.Get(3, path, sizeof(path)));
+    BOOST_CHECK_EQUAL(string(path), "/tmp/file");
+
+    // A path that doesn't fit (along with its terminator) is a miss rather than a truncated path
+    table.Set(4, "/tmp/0123456789a");
+    BOOST_CHECK(!table.Get(4, path, sizeof(path)));
+}
+
+BOOST_AUTO_TEST_CASE(TestDescriptorsBeyondFirstChunk)
+{
+    FdTable table;
+    string path;
+
+    table.Set(1500, "/src/a.o");
+    table.Set(70000, "/src/b.o");
+
+    BOOST_REQUIRE(table.Get(1500, path));
+    BOOST_CHECK_EQUAL(path, "/src/a.o");
+    BOOST_REQUIRE(table.Get(70000, path));
+    BOOST_CHECK_EQUAL(path, "/src/b.o");
+    BOOST_CHECK(!table.Get(1501, path));
+
+    table.Clear();
+    BOOST_CHECK(!table.Get(1500, path));
+    BOOST_CHECK(!table.Get(70000, path));
+}
+
+BOOST_AUTO_TEST_CASE(TestDuplicate)
+{
+    FdTable table;
+    string path;
+
+    table.Set(4, "/tmp/original");
+    table.Set(5, "/tmp/stale");
+
+    table.Duplicate(4, 2000);
+    BOOST_REQUIRE(table.Get(2000, path));
+    BOOST_CHECK_EQUAL(path, "/tmp/original");
+
+    // Duplicating a descriptor with no entry must not leave the old entry of the target behind
+    table.Duplicate(6, 5);
+    BOOST_CHECK(!table.Get(5, path));
+
+    // Closing the original doesn't affect the duplicate
+    table.Reset(4);
+    BOOST_REQUIRE(table.Get(2000, path));
+    BOOST_CHECK_EQUAL(path, "/tmp/original");
+}
+
+BOOST_AUTO_TEST_CASE(TestFlags)
+{
+    FdTable table;
+
+    BOOST_CHECK(!table.HasFlag(7, FdTable::WriteChecked));
+    table.SetFlag(7, FdTable::WriteChecked);
+    BOOST_CHECK(table.HasFlag(7, FdTable::WriteChecked));
+
+    // Flags don't travel with duplicates and go away with the descriptor
+    table.SetFlag(8, FdTable::WriteChecked);
+    table.Duplicate(7, 8);
+    BOOST_CHECK(!table.HasFlag(8, FdTable::WriteChecked));
+
+    table.Reset(7);
+    BOOST_CHECK(!table.HasFlag(7, FdTable::WriteChecked));
+
+    // Being a non-file is a property of the open file, which duplicates share
+    table.SetFlag(1, FdTable::NonFile);
+    table.SetFlag(1, FdTable::WriteChecked);
+    table.Duplicate(1, 9);
+    BOOST_CHECK(table.HasFlag(9, FdTable::NonFile));
+    BOOST_CHECK(!table.HasFlag(9, FdTable::WriteChecked));
+}
+
+BOOST_AUTO_TEST_CASE(TestResetRange)
+{
+    FdTable table;
+    std::string path;
+
+    table.Set(3, "/tmp/three");
+    table.Set(1023, "/tmp/last-of-first-chunk");
+    table.Set(1024, "/tmp/first-of-second-chunk");
+    table.Set(5000, "/tmp/far");
+    table.SetFlag(5000, FdTable::WriteChecked);
+
+    table.ResetRange(1023, 1024);
+    BOOST_CHECK(table.Get(3, path));
+    BOOST_CHECK(!table.Get(1023, path));
+    BOOST_CHECK(!table.Get(1024, path));
+    BOOST_CHECK(table.Get(5000, path));
+
+    // Open-ended ranges (closefrom, close_range with ~0U) go up to the end of the table
+    table.ResetRange(4, INT_MAX);
+    BOOST_CHECK(table.Get(3, path));
+    BOOST_CHECK(!table.Get(5000, path));
+    BOOST_CHECK(!table.HasFlag(5000, FdTable::WriteChecked));
+
+    // Empty ranges are a no-op
+    table.ResetRange(3, 2);
+    BOOST_CHECK(table.Get(3, path));
+    BOOST_CHECK_EQUAL(path, "/tmp/three");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,146 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <interpose_profiler.hpp>
+#include <string.h>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(InterposeProfilerTests)
+
+// Sites remember the index they got from the first profiler that saw them, so every test uses its own sites
+
+static const InterposeProfiler::SiteStats* FindSite(const vector<InterposeProfiler::SiteStats> &stats, const char *name)
+{
+    for (const InterposeProfiler::SiteStats &site : stats)
+    {
+        if (strcmp(site.name, name) == 0)
+        {
+            return &site;
+        }
+    }
+
+    return nullptr;
+}
+
+BOOST_AUTO_TEST_CASE(TestDisabledProfilerCountsNothing)
+{
+    InterposeProfiler profiler;
+    static InterposeProfileSite site("open");
+
+    profiler.Initialize(false);
+    {
+        InterposeProfileScope scope(profiler, site);
+        profiler.CountReport();
+    }
+
+    BOOST_CHECK(profiler.Collect().empty());
+    BOOST_CHECK(profiler.Summarize(4096).empty());
+}
+
+BOOST_AUTO_TEST_CASE(TestReportsAndHitsGoToInnermostSite)
+{
+    InterposeProfiler profiler;
+    static InterposeProfileSite outer("fopen");
+    static InterposeProfileSite inner("open");
+    static InterposeProfileSite unused("unlink");
+
+    profiler.Initialize(true);
+    {
+        InterposeProfileScope outerScope(profiler, outer);
+        profiler.CountReport();
+        {
+            InterposeProfileScope innerScope(profiler, inner);
+            profiler.CountReport();
+            profiler.CountCacheHit();
+        }
+        profiler.CountCacheHit();
+    }
+
+    // Outside of any scope nothing gets accounted
+    profiler.CountReport();
+
+    vector<InterposeProfiler::SiteStats> stats = profiler.Collect();
+    BOOST_CHECK_EQUAL(stats.size(), 2);
+
+    const InterposeProfiler::SiteStats *fopenStats = FindSite(stats, "fopen");
+    BOOST_REQUIRE(fopenStats != nullptr);
+    BOOST_CHECK_EQUAL(fopenStats->calls, 1);
+    BOOST_CHECK_EQUAL(fopenStats->reports, 1);
+    BOOST_CHECK_EQUAL(fopenStats->cacheHits, 1);
+
+    const InterposeProfiler::SiteStats *openStats = FindSite(stats, "open");
+    BOOST_REQUIRE(openStats != nullptr);
+    BOOST_CHECK_EQUAL(openStats->calls, 1);
+    BOOST_CHECK_EQUAL(openStats->reports, 1);
+    BOOST_CHECK_EQUAL(openStats->cacheHits, 1);
+    BOOST_CHECK(fopenStats->nanoseconds >= openStats->nanoseconds);
+
+    BOOST_CHECK(FindSite(stats, "unlink") == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(TestCountersOfTerminatedThreadsAreKept)
+{
+    InterposeProfiler profiler;
+    static InterposeProfileSite site("stat");
+
+    profiler.Initialize(true);
+    for (int i = 0; i < 4; i++)
+    {
+        thread worker([&]()
+        {
+            for (int j = 0; j < 10; j++)
+            {
+                InterposeProfileScope scope(profiler, site);
+                profiler.CountReport();
+            }
+        });
+        worker.join();
+    }
+
+    vector<InterposeProfiler::SiteStats> collected = profiler.Collect();
+    const InterposeProfiler::SiteStats *stats = FindSite(collected, "stat");
+    BOOST_REQUIRE(stats != nullptr);
+    BOOST_CHECK_EQUAL(stats->calls, 40);
+    BOOST_CHECK_EQUAL(stats->reports, 40);
+}
+
+BOOST_AUTO_TEST_CASE(TestSummaryIsSplitToFitMaxLength)
+{
+    InterposeProfiler profiler;
+    static InterposeProfileSite first("readlink");
+    static InterposeProfileSite second("realpath");
+    static InterposeProfileSite third("opendir");
+
+    profiler.Initialize(true);
+    {
+        InterposeProfileScope scope(profiler, first);
+    }
+    {
+        InterposeProfileScope scope(profiler, second);
+    }
+    {
+        InterposeProfileScope scope(profiler, third);
+    }
+
+    vector<string> whole = profiler.Summarize(4096);
+    BOOST_REQUIRE_EQUAL(whole.size(), 1);
+    BOOST_CHECK(whole[0].find("readlink 1/0/0/") == 0);
+    BOOST_CHECK(whole[0].find(", realpath 1/0/0/") != string::npos);
+    BOOST_CHECK(whole[0].find(", opendir 1/0/0/") != string::npos);
+
+    vector<string> split = profiler.Summarize(40);
+    BOOST_CHECK(split.size() > 1);
+    for (const string &message : split)
+    {
+        BOOST_CHECK(message.length() <= 40);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,6 +6,12 @@
 
 #include <boost/test/included/unit_test.hpp>
 #include <observer_utilities.hpp>
+#include <elf.h>
+#include <fcntl.h>
+#include <fstream>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -20,4 +26,90 @@ BOOST_AUTO_TEST_CASE(TestEnvVarResolution)
     BOOST_CHECK_EQUAL(path.c_str(), "/usr/bin/sh");
 }
 
+static bool IsElfFileStaticallyLinked(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    BOOST_REQUIRE(fd != -1);
+
+    struct stat statbuf;
+    BOOST_REQUIRE(fstat(fd, &statbuf) == 0);
+    void *image = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    BOOST_REQUIRE(image != MAP_FAILED);
+
+    bool isStaticallyLinked = is_elf_statically_linked((const char *)image, statbuf.st_size);
+
+    munmap(image, statbuf.st_size);
+    close(fd);
+    return isStaticallyLinked;
+}
+
+// A program linked with -static, the same way as the StaticLinkingTestProcess
+struct StaticallyLinkedImage
+{
+    StaticallyLinkedImage()
+    {
+        char name[] = "/tmp/static_linking_testXXXXXX";
+        BOOST_REQUIRE(mkdtemp(name) != nullptr);
+        directory = name;
+        source = directory + "/main.cpp";
+        path = directory + "/main";
+
+        std::ofstream(source) << "int main() { return 0; }\n";
+        std::string command = "/usr/bin/g++ -static -o " + path + " " + source;
+        BOOST_REQUIRE_EQUAL(system(command.c_str()), 0);
+    }
+
+    ~StaticallyLinkedImage()
+    {
+        unlink(path.c_str());
+        unlink(source.c_str());
+        rmdir(directory.c_str());
+    }
+
+    std::string directory;
+    std::string source;
+    std::string path;
+};
+
+BOOST_AUTO_TEST_CASE(TestElfStaticLinkingDetection)
+{
+    // The test executable itself links dynamically against libc
+    BOOST_CHECK(!IsElfFileStaticallyLinked("/proc/self/exe"));
+
+    // Not an ELF image, or a truncated one
+    const char script[] = "#!/bin/sh\necho hello\n";
+    BOOST_CHECK(!is_elf_statically_linked(script, sizeof(script)));
+    BOOST_CHECK(!is_elf_statically_linked(ELFMAG, SELFMAG));
+}
+
+BOOST_FIXTURE_TEST_CASE(TestElfStaticLinkingDetectionOfStaticImage, StaticallyLinkedImage)
+{
+    BOOST_CHECK(IsElfFileStaticallyLinked(path.c_str()));
+}
+
+BOOST_AUTO_TEST_CASE(TestPathArena)
+{
+    PathArena arena;
+
+    size_t root = arena.Add("/src", 4);
+    size_t dir = arena.AddChild(root, "lib", 3);
+
+    // Enough children to make the buffer grow while copying from it
+    for (int i = 0; i < 1000; i++)
+    {
+        std::string name = "file" + std::to_string(i) + ".c";
+        arena.AddChild(dir, name.c_str(), name.length());
+    }
+
+    BOOST_CHECK_EQUAL(arena.Count(), 1002);
+    BOOST_CHECK_EQUAL(arena.Get(root), "/src");
+    BOOST_CHECK_EQUAL(arena.Get(dir), "/src/lib");
+    BOOST_CHECK_EQUAL(arena.GetLength(dir), 8);
+    BOOST_CHECK_EQUAL(arena.Get(1001), "/src/lib/file999.c");
+    BOOST_CHECK_EQUAL(arena.GetLength(1001), 18);
+
+    arena.Clear();
+    BOOST_CHECK_EQUAL(arena.Count(), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END();
\ No newline at end of file
@@ -0,0 +1,181 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <path_search_cache.hpp>
+#include <temp_file.hpp>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(PathSearchCacheTests)
+
+static const string SearchPath = "/usr/local/bin:/usr/bin:/bin";
+
+static bool TryGet(PathSearchCache &cache, const string &name, const string &searchPath, uint32_t &foundIndex, mode_t &mode)
+{
+    return cache.TryGet(name.c_str(), name.length(), searchPath.c_str(), searchPath.length(), foundIndex, mode);
+}
+
+static void Add(PathSearchCache &cache, const string &name, const string &searchPath, uint32_t foundIndex, mode_t mode)
+{
+    uint32_t generation = cache.GetNameGeneration(name.c_str(), name.length());
+    cache.Add(name.c_str(), name.length(), searchPath.c_str(), searchPath.length(), generation, foundIndex, mode);
+}
+
+BOOST_AUTO_TEST_CASE(TestRemembersSearches)
+{
+    TempFile file;
+    PathSearchCache cache;
+    BOOST_REQUIRE(cache.Open(file.path.c_str()));
+
+    uint32_t foundIndex;
+    mode_t mode;
+    BOOST_CHECK(!TryGet(cache, "git", SearchPath, foundIndex, mode));
+
+    Add(cache, "git", SearchPath, 1, S_IFREG | 0755);
+    Add(cache, "missing", SearchPath, PathSearchCache::NOT_FOUND, 0);
+
+    BOOST_REQUIRE(TryGet(cache, "git", SearchPath, foundIndex, mode));
+    BOOST_CHECK_EQUAL(foundIndex, 1);
+    BOOST_CHECK_EQUAL(mode, S_IFREG | 0755);
+
+    BOOST_REQUIRE(TryGet(cache, "missing", SearchPath, foundIndex, mode));
+    BOOST_CHECK_EQUAL(foundIndex, (uint32_t)PathSearchCache::NOT_FOUND);
+
+    // Same name under another PATH, and a name that is only a prefix
+    BOOST_CHECK(!TryGet(cache, "git", "/usr/bin:/bin", foundIndex, mode));
+    BOOST_CHECK(!TryGet(cache, "gi", SearchPath, foundIndex, mode));
+}
+
+BOOST_AUTO_TEST_CASE(TestInvalidateName)
+{
+    TempFile file;
+    PathSearchCache cache;
+    BOOST_REQUIRE(cache.Open(file.path.c_str()));
+
+    Add(cache, "make", SearchPath, PathSearchCache::NOT_FOUND, 0);
+    Add(cache, "cc", SearchPath, 2, S_IFLNK | 0777);
+
+    cache.InvalidateName("make", strlen("make"));
+
+    uint32_t foundIndex;
+    mode_t mode;
+    BOOST_CHECK(!TryGet(cache, "make", SearchPath, foundIndex, mode));
+
+    // Searching again after the change remembers the new outcome
+    Add(cache, "make", SearchPath, 0, S_IFREG | 0755);
+    BOOST_REQUIRE(TryGet(cache, "make", SearchPath, foundIndex, mode));
+    BOOST_CHECK_EQUAL(foundIndex, 0);
+
+    cache.InvalidateAll();
+    BOOST_CHECK(!TryGet(cache, "make", SearchPath, foundIndex, mode));
+    BOOST_CHECK(!TryGet(cache, "cc", SearchPath, foundIndex, mode));
+}
+
+BOOST_AUTO_TEST_CASE(TestChangeWhileSearching)
+{
+    TempFile file;
+    PathSearchCache cache;
+    BOOST_REQUIRE(cache.Open(file.path.c_str()));
+
+    string name = "ld";
+    uint32_t generation = cache.GetNameGeneration(name.c_str(), name.length());
+    cache.InvalidateName(name.c_str(), name.length());
+    cache.Add(name.c_str(), name.length(), SearchPath.c_str(), SearchPath.length(), generation, PathSearchCache::NOT_FOUND, 0);
+
+    uint32_t foundIndex;
+    mode_t mode;
+    BOOST_CHECK(!TryGet(cache, name, SearchPath, foundIndex, mode));
+}
+
+BOOST_AUTO_TEST_CASE(TestSharedAmongProcesses)
+{
+    TempFile file;
+    PathSearchCache cache;
+    BOOST_REQUIRE(cache.Open(file.path.c_str()));
+    Add(cache, "bash", SearchPath, 2, S_IFREG | 0755);
+
+    pid_t child = fork();
+    if (child == 0)
+    {
+        PathSearchCache childCache;
+        if (!childCache.Open(file.path.c_str()))
+        {
+            _exit(1);
+        }
+
+        Add(childCache, "python3", SearchPath, 1, S_IFREG | 0755);
+        childCache.InvalidateName("bash", strlen("bash"));
+        _exit(0);
+    }
+
+    int status;
+    BOOST_REQUIRE_EQUAL(waitpid(child, &status, 0), child);
+    BOOST_REQUIRE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    uint32_t foundIndex;
+    mode_t mode;
+    BOOST_REQUIRE(TryGet(cache, "python3", SearchPath, foundIndex, mode));
+    BOOST_CHECK_EQUAL(foundIndex, 1);
+    BOOST_CHECK(!TryGet(cache, "bash", SearchPath, foundIndex, mode));
+}
+
+BOOST_AUTO_TEST_CASE(TestLongNamesAreNotRemembered)
+{
+    TempFile file;
+    PathSearchCache cache;
+    BOOST_REQUIRE(cache.Open(file.path.c_str()));
+
+    string name(PathSearchCache::MAX_NAME_LENGTH + 1, 'x');
+    Add(cache, name, SearchPath, 0, S_IFREG | 0755);
+
+    uint32_t foundIndex;
+    mode_t mode;
+    BOOST_CHECK(!TryGet(cache, name, SearchPath, foundIndex, mode));
+}
+
+BOOST_AUTO_TEST_CASE(TestFullTableStillWorks)
+{
+    TempFile file;
+    PathSearchCache cache;
+    BOOST_REQUIRE(cache.Open(file.path.c_str()));
+
+    // Way more searches than the table can hold: adding must not fail, and whatever is found must be right
+    for (int i = 0; i < 20000; i++)
+    {
+        Add(cache, "tool" + to_string(i), SearchPath, i % 3, S_IFREG | 0755);
+    }
+
+    for (int i = 0; i < 20000; i++)
+    {
+        uint32_t foundIndex;
+        mode_t mode;
+        if (TryGet(cache, "tool" + to_string(i), SearchPath, foundIndex, mode))
+        {
+            BOOST_REQUIRE_EQUAL(foundIndex, (uint32_t)(i % 3));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestInvalidCacheNeverHits)
+{
+    PathSearchCache cache;
+    BOOST_CHECK(!cache.Open("/nonexistent/directory/cache"));
+    BOOST_CHECK(!cache.IsValid());
+
+    Add(cache, "git", SearchPath, 0, S_IFREG | 0755);
+    uint32_t foundIndex;
+    mode_t mode;
+    BOOST_CHECK(!TryGet(cache, "git", SearchPath, foundIndex, mode));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,184 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <process_tree_counter.hpp>
+#include <temp_file.hpp>
+#include <stdlib.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(ProcessTreeCounterTests)
+
+BOOST_AUTO_TEST_CASE(TestLastProcessCompletes)
+{
+    TempFile file;
+    ProcessTreeCounter counter;
+    BOOST_REQUIRE(counter.Open(file.path.c_str()));
+
+    counter.Add(100);
+    // Each image a process execs adds it again
+    counter.Add(100);
+    BOOST_CHECK_EQUAL(counter.GetCount(), 1);
+
+    counter.Reserve();
+    BOOST_CHECK(!counter.Claim(101));
+    BOOST_CHECK_EQUAL(counter.GetCount(), 2);
+
+    BOOST_CHECK(!counter.Remove(100));
+    // Exit paths may run more than once
+    BOOST_CHECK(!counter.Remove(100));
+    BOOST_CHECK(counter.Remove(101));
+    BOOST_CHECK_EQUAL(counter.GetCount(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestChildAddedBeforeClaim)
+{
+    TempFile file;
+    ProcessTreeCounter counter;
+    BOOST_REQUIRE(counter.Open(file.path.c_str()));
+
+    counter.Add(100);
+    counter.Reserve();
+    // The child execs before its parent gets to claim it
+    counter.Add(101);
+    BOOST_CHECK(!counter.Claim(101));
+    BOOST_CHECK_EQUAL(counter.GetCount(), 2);
+
+    BOOST_CHECK(!counter.Remove(101));
+    BOOST_CHECK(counter.Remove(100));
+}
+
+BOOST_AUTO_TEST_CASE(TestChildExitsBeforeClaim)
+{
+    TempFile file;
+    ProcessTreeCounter counter;
+    BOOST_REQUIRE(counter.Open(file.path.c_str()));
+
+    counter.Add(100);
+    counter.Reserve();
+    BOOST_CHECK(!counter.Remove(101));
+    // The reservation keeps the tree open until the parent consumes the tombstone
+    BOOST_CHECK_EQUAL(counter.GetCount(), 2);
+    BOOST_CHECK(!counter.Claim(101));
+    BOOST_CHECK_EQUAL(counter.GetCount(), 1);
+    BOOST_CHECK(counter.Remove(100));
+}
+
+BOOST_AUTO_TEST_CASE(TestReservationKeepsTreeOpen)
+{
+    TempFile file;
+    ProcessTreeCounter counter;
+    BOOST_REQUIRE(counter.Open(file.path.c_str()));
+
+    counter.Add(100);
+    counter.Reserve();
+    BOOST_CHECK(!counter.Remove(100));
+    BOOST_CHECK(counter.Release());
+}
+
+BOOST_AUTO_TEST_CASE(TestThreadsLeaveNoTombstone)
+{
+    TempFile file;
+    ProcessTreeCounter counter;
+    BOOST_REQUIRE(counter.Open(file.path.c_str()));
+
+    counter.Add(100);
+    BOOST_CHECK(!counter.Remove(101, /* isProcess */ false));
+
+    // A child getting the id of the thread is not taken for exited
+    counter.Reserve();
+    BOOST_CHECK(!counter.Claim(101));
+    BOOST_CHECK(!counter.Remove(100));
+    BOOST_CHECK(counter.Remove(101));
+}
+
+BOOST_AUTO_TEST_CASE(TestCompletesOnce)
+{
+    TempFile file;
+    ProcessTreeCounter counter;
+    BOOST_REQUIRE(counter.Open(file.path.c_str()));
+
+    counter.Add(100);
+    BOOST_CHECK(counter.Remove(100));
+
+    // A process the tree didn't know about
+    counter.Add(200);
+    BOOST_CHECK(!counter.Remove(200));
+}
+
+BOOST_AUTO_TEST_CASE(TestNeverCompletesWhenFull)
+{
+    TempFile file;
+    ProcessTreeCounter counter;
+    BOOST_REQUIRE(counter.Open(file.path.c_str(), /* capacity */ 4));
+
+    for (pid_t pid = 1; pid <= 5; pid++)
+    {
+        counter.Add(pid);
+    }
+
+    BOOST_CHECK_EQUAL(counter.GetCount(), 4);
+    for (pid_t pid = 1; pid <= 5; pid++)
+    {
+        BOOST_CHECK(!counter.Remove(pid));
+    }
+
+    BOOST_CHECK_EQUAL(counter.GetCount(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestSharedAmongProcesses)
+{
+    TempFile file;
+    ProcessTreeCounter counter;
+    BOOST_REQUIRE(counter.Open(file.path.c_str()));
+    counter.Add(getpid());
+
+    const int childCount = 8;
+    pid_t children[childCount];
+    for (int i = 0; i < childCount; i++)
+    {
+        counter.Reserve();
+        children[i] = fork();
+        if (children[i] == 0)
+        {
+            // Same as an exec'd image of the child: it opens the counter on its own
+            ProcessTreeCounter own;
+            _exit(own.Open(file.path.c_str()) ? 0 : 1);
+        }
+
+        BOOST_REQUIRE(children[i] > 0);
+        BOOST_CHECK(!counter.Claim(children[i]));
+    }
+
+    for (int i = 0; i < childCount; i++)
+    {
+        int status;
+        BOOST_REQUIRE_EQUAL(waitpid(children[i], &status, 0), children[i]);
+        BOOST_REQUIRE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        BOOST_CHECK(!counter.Remove(children[i]));
+    }
+
+    BOOST_CHECK(counter.Remove(getpid()));
+}
+
+BOOST_AUTO_TEST_CASE(TestSizeMismatch)
+{
+    TempFile file;
+    ProcessTreeCounter first;
+    BOOST_REQUIRE(first.Open(file.path.c_str(), /* capacity */ 1024));
+
+    ProcessTreeCounter second;
+    BOOST_CHECK(!second.Open(file.path.c_str(), /* capacity */ 2048));
+    BOOST_CHECK(!second.IsValid());
+    second.Add(100);
+    BOOST_CHECK(!second.Remove(100));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
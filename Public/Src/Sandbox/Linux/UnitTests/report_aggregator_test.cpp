@@ -0,0 +1,155 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <report_aggregator.hpp>
+#include <atomic>
+#include <map>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(ReportAggregatorTests)
+
+struct TestReport
+{
+    pid_t pid;
+    int access;
+};
+
+typedef ReportAggregator<TestReport> TestAggregator;
+
+static TestAggregator::AddResult Add(TestAggregator &aggregator, pid_t pid, const char *path, int access)
+{
+    return aggregator.Add(pid, path, strlen(path), (uint32_t)access, TestReport { pid, access });
+}
+
+// Drains the aggregator into a map keyed by "<pid>:<path>"
+static map<string, int> Drain(TestAggregator &aggregator)
+{
+    map<string, int> drained;
+    aggregator.Drain([&drained](const TestReport &report, std::string_view path)
+    {
+        BOOST_CHECK_EQUAL(path.data()[path.length()], '\0');
+        string key = to_string(report.pid) + ":" + string(path);
+        BOOST_CHECK(drained.find(key) == drained.end());
+        drained[key] = report.access;
+    });
+
+    return drained;
+}
+
+BOOST_AUTO_TEST_CASE(TestKeepsStrongestAccessPerPath)
+{
+    TestAggregator aggregator;
+    BOOST_CHECK(Add(aggregator, 1, "/a", 1) == TestAggregator::AddResult::Added);
+    BOOST_CHECK(Add(aggregator, 1, "/a", 3) == TestAggregator::AddResult::Added);
+    BOOST_CHECK(Add(aggregator, 1, "/a", 2) == TestAggregator::AddResult::Added);
+    Add(aggregator, 1, "/b", 2);
+    Add(aggregator, 1, "/a/b", 1);
+
+    map<string, int> drained = Drain(aggregator);
+    BOOST_CHECK_EQUAL(drained.size(), 3);
+    BOOST_CHECK_EQUAL(drained["1:/a"], 3);
+    BOOST_CHECK_EQUAL(drained["1:/b"], 2);
+    BOOST_CHECK_EQUAL(drained["1:/a/b"], 1);
+
+    TestAggregator::Stats stats = aggregator.GetStats();
+    BOOST_CHECK_EQUAL(stats.added, 5);
+    BOOST_CHECK_EQUAL(stats.drained, 3);
+
+    // Draining empties the summary
+    BOOST_CHECK(Drain(aggregator).empty());
+}
+
+BOOST_AUTO_TEST_CASE(TestKeepsProcessesApart)
+{
+    TestAggregator aggregator;
+    Add(aggregator, 1, "/a", 1);
+    Add(aggregator, 2, "/a", 2);
+
+    map<string, int> drained = Drain(aggregator);
+    BOOST_CHECK_EQUAL(drained.size(), 2);
+    BOOST_CHECK_EQUAL(drained["1:/a"], 1);
+    BOOST_CHECK_EQUAL(drained["2:/a"], 2);
+}
+
+BOOST_AUTO_TEST_CASE(TestReportsWhenFull)
+{
+    TestAggregator aggregator(/* capacity */ 3);
+    BOOST_CHECK(Add(aggregator, 1, "/a", 1) == TestAggregator::AddResult::Added);
+    BOOST_CHECK(Add(aggregator, 1, "/b", 1) == TestAggregator::AddResult::Added);
+    BOOST_CHECK(Add(aggregator, 1, "/c", 1) == TestAggregator::AddResult::Full);
+
+    // Paths already in the summary don't make it any fuller
+    BOOST_CHECK(Add(aggregator, 1, "/a", 2) == TestAggregator::AddResult::Full);
+    BOOST_CHECK_EQUAL(Drain(aggregator).size(), 3);
+    BOOST_CHECK(Add(aggregator, 1, "/d", 1) == TestAggregator::AddResult::Added);
+}
+
+BOOST_AUTO_TEST_CASE(TestDrainCanAddAgain)
+{
+    TestAggregator aggregator;
+    Add(aggregator, 1, "/a", 1);
+
+    int sent = 0;
+    aggregator.Drain([&](const TestReport &report, std::string_view path)
+    {
+        sent++;
+        BOOST_CHECK(Add(aggregator, 1, "/b", 1) == TestAggregator::AddResult::Added);
+    });
+
+    BOOST_CHECK_EQUAL(sent, 1);
+    map<string, int> drained = Drain(aggregator);
+    BOOST_CHECK_EQUAL(drained.size(), 1);
+    BOOST_CHECK_EQUAL(drained.count("1:/b"), 1);
+}
+
+BOOST_AUTO_TEST_CASE(TestClear)
+{
+    TestAggregator aggregator;
+    Add(aggregator, 1, "/a", 1);
+    aggregator.Clear();
+    BOOST_CHECK(Drain(aggregator).empty());
+}
+
+BOOST_AUTO_TEST_CASE(TestConcurrentAdds)
+{
+    const int threadCount = 8;
+    const int pathCount = 200;
+    TestAggregator aggregator(/* capacity */ 1 << 20);
+
+    // Threads that find the summary busy send their report on their own, like the observer does
+    atomic<int> busy { 0 };
+    vector<thread> threads;
+    for (int t = 0; t < threadCount; t++)
+    {
+        threads.emplace_back([&aggregator, &busy, t]()
+        {
+            for (int i = 0; i < pathCount; i++)
+            {
+                string path = "/p" + to_string(i);
+                if (Add(aggregator, 1, path.c_str(), t + 1) == TestAggregator::AddResult::Busy)
+                {
+                    busy++;
+                }
+            }
+        });
+    }
+
+    for (thread &t : threads)
+    {
+        t.join();
+    }
+
+    map<string, int> drained = Drain(aggregator);
+    BOOST_CHECK(drained.size() <= pathCount);
+    BOOST_CHECK_EQUAL(aggregator.GetStats().added + busy.load(), threadCount * pathCount);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,101 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <resolved_path_generations.hpp>
+#include <temp_file.hpp>
+#include <stdlib.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(ResolvedPathGenerationsTests)
+
+static uint64_t GetPathGeneration(const ResolvedPathGenerations &generations, const string &path)
+{
+    return generations.GetPathGeneration(path.c_str(), path.length());
+}
+
+static void InvalidatePath(ResolvedPathGenerations &generations, const string &path)
+{
+    generations.InvalidatePath(path.c_str(), path.length());
+}
+
+BOOST_AUTO_TEST_CASE(TestInvalidatePath)
+{
+    TempFile file;
+    ResolvedPathGenerations generations;
+    BOOST_REQUIRE(generations.Open(file.path.c_str()));
+
+    uint64_t link = GetPathGeneration(generations, "/src/link");
+    uint64_t chains = generations.GetChainGeneration();
+
+    // Neither the path nor the chains change unless asked to
+    BOOST_CHECK_EQUAL(GetPathGeneration(generations, "/src/link"), link);
+    InvalidatePath(generations, "/src/link");
+    BOOST_CHECK_NE(GetPathGeneration(generations, "/src/link"), link);
+    BOOST_CHECK_EQUAL(generations.GetChainGeneration(), chains);
+
+    generations.InvalidateChains();
+    BOOST_CHECK_NE(generations.GetChainGeneration(), chains);
+}
+
+BOOST_AUTO_TEST_CASE(TestInvalidateAll)
+{
+    TempFile file;
+    ResolvedPathGenerations generations;
+    BOOST_REQUIRE(generations.Open(file.path.c_str()));
+
+    uint64_t first = GetPathGeneration(generations, "/src/a");
+    uint64_t second = GetPathGeneration(generations, "/out/b");
+    uint64_t chains = generations.GetChainGeneration();
+
+    generations.InvalidateAll();
+    BOOST_CHECK_NE(GetPathGeneration(generations, "/src/a"), first);
+    BOOST_CHECK_NE(GetPathGeneration(generations, "/out/b"), second);
+    BOOST_CHECK_NE(generations.GetChainGeneration(), chains);
+}
+
+BOOST_AUTO_TEST_CASE(TestSharedAmongProcesses)
+{
+    TempFile file;
+    ResolvedPathGenerations generations;
+    BOOST_REQUIRE(generations.Open(file.path.c_str()));
+    uint64_t link = GetPathGeneration(generations, "/src/link");
+    uint64_t chains = generations.GetChainGeneration();
+
+    pid_t child = fork();
+    if (child == 0)
+    {
+        ResolvedPathGenerations childGenerations;
+        if (!childGenerations.Open(file.path.c_str()))
+        {
+            _exit(1);
+        }
+
+        InvalidatePath(childGenerations, "/src/link");
+        childGenerations.InvalidateChains();
+        _exit(0);
+    }
+
+    int status;
+    BOOST_REQUIRE_EQUAL(waitpid(child, &status, 0), child);
+    BOOST_REQUIRE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    BOOST_CHECK_NE(GetPathGeneration(generations, "/src/link"), link);
+    BOOST_CHECK_NE(generations.GetChainGeneration(), chains);
+}
+
+BOOST_AUTO_TEST_CASE(TestInvalidGenerations)
+{
+    ResolvedPathGenerations generations;
+    BOOST_CHECK(!generations.Open("/nonexistent/directory/generations"));
+    BOOST_CHECK(!generations.IsValid());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,124 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <shared_path_set.hpp>
+#include <temp_file.hpp>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(SharedPathSetTests)
+
+static bool TryAdd(SharedPathSet &set, const string &path)
+{
+    return set.TryAdd(path.c_str(), path.length());
+}
+
+BOOST_AUTO_TEST_CASE(TestAddOnce)
+{
+    TempFile file;
+    SharedPathSet set;
+    BOOST_REQUIRE(set.Open(file.path.c_str()));
+
+    BOOST_CHECK(TryAdd(set, "/usr/lib/libc.so.6"));
+    BOOST_CHECK(!TryAdd(set, "/usr/lib/libc.so.6"));
+
+    // A path that only shares a prefix, and one that is only a prefix
+    BOOST_CHECK(TryAdd(set, "/usr/lib/libc.so.6.1"));
+    BOOST_CHECK(TryAdd(set, "/usr/lib/libc.so"));
+    BOOST_CHECK(!TryAdd(set, "/usr/lib/libc.so"));
+}
+
+BOOST_AUTO_TEST_CASE(TestSharedAmongInstances)
+{
+    TempFile file;
+    SharedPathSet first;
+    BOOST_REQUIRE(first.Open(file.path.c_str()));
+    BOOST_CHECK(TryAdd(first, "/usr/lib/libm.so.6"));
+
+    SharedPathSet second;
+    BOOST_REQUIRE(second.Open(file.path.c_str()));
+    BOOST_CHECK(!TryAdd(second, "/usr/lib/libm.so.6"));
+    BOOST_CHECK(TryAdd(second, "/usr/lib/libdl.so.2"));
+    BOOST_CHECK(!TryAdd(first, "/usr/lib/libdl.so.2"));
+}
+
+BOOST_AUTO_TEST_CASE(TestSharedAmongProcesses)
+{
+    TempFile file;
+    pid_t child = fork();
+    if (child == 0)
+    {
+        SharedPathSet set;
+        _exit(set.Open(file.path.c_str()) && TryAdd(set, "/usr/lib/libpthread.so.0") ? 0 : 1);
+    }
+
+    int status;
+    BOOST_REQUIRE_EQUAL(waitpid(child, &status, 0), child);
+    BOOST_REQUIRE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    SharedPathSet set;
+    BOOST_REQUIRE(set.Open(file.path.c_str()));
+    BOOST_CHECK(!TryAdd(set, "/usr/lib/libpthread.so.0"));
+}
+
+BOOST_AUTO_TEST_CASE(TestNeverSuppressesWhenFull)
+{
+    TempFile file;
+    SharedPathSet set;
+    BOOST_REQUIRE(set.Open(file.path.c_str()));
+
+    // Way more paths than the set can hold: every one of them must still be reported the first time
+    for (int i = 0; i < 20000; i++)
+    {
+        BOOST_REQUIRE(TryAdd(set, "/usr/lib/lib" + to_string(i) + ".so"));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestKeyClasses)
+{
+    TempFile file;
+    SharedPathSet set;
+    BOOST_REQUIRE(set.Open(file.path.c_str()));
+
+    string path = "/usr/include/stdio.h";
+    BOOST_CHECK(!set.Contains(1, path.c_str(), path.length()));
+    BOOST_CHECK(set.TryAdd(1, path.c_str(), path.length()));
+    BOOST_CHECK(set.Contains(1, path.c_str(), path.length()));
+
+    // Same path under a different class
+    BOOST_CHECK(!set.Contains(2, path.c_str(), path.length()));
+    BOOST_CHECK(set.TryAdd(2, path.c_str(), path.length()));
+    BOOST_CHECK(!set.TryAdd(2, path.c_str(), path.length()));
+}
+
+BOOST_AUTO_TEST_CASE(TestSizeMismatch)
+{
+    TempFile file;
+    SharedPathSet first;
+    BOOST_REQUIRE(first.Open(file.path.c_str(), /* capacity */ 1024, /* arenaSize */ 1 << 16));
+
+    SharedPathSet second;
+    BOOST_CHECK(!second.Open(file.path.c_str(), /* capacity */ 2048, /* arenaSize */ 1 << 16));
+    BOOST_CHECK(TryAdd(second, "/usr/lib/libc.so.6"));
+}
+
+BOOST_AUTO_TEST_CASE(TestInvalidSetNeverSuppresses)
+{
+    SharedPathSet set;
+    BOOST_CHECK(!set.Open("/nonexistent/directory/set"));
+    BOOST_CHECK(!set.IsValid());
+    BOOST_CHECK(TryAdd(set, "/usr/lib/libc.so.6"));
+    BOOST_CHECK(TryAdd(set, "/usr/lib/libc.so.6"));
+    BOOST_CHECK(!set.Contains(0, "/usr/lib/libc.so.6", strlen("/usr/lib/libc.so.6")));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
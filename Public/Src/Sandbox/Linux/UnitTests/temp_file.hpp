@@ -0,0 +1,26 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+// A unique path under /tmp for a file backing a shared mapping, removed when the test is done
+struct TempFile
+{
+    TempFile()
+    {
+        char name[] = "/tmp/bxl_sandbox_testXXXXXX";
+        int fd = mkstemp(name);
+        close(fd);
+        // Start from a missing file, the way the sandbox does
+        unlink(name);
+        path = name;
+    }
+
+    ~TempFile() { unlink(path.c_str()); }
+
+    std::string path;
+};
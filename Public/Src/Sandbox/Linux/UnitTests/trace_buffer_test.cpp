@@ -0,0 +1,112 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <trace_buffer.hpp>
+#include <temp_file.hpp>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(TraceBufferTests)
+
+static void Write(TraceBuffer &buffer, const string &message)
+{
+    buffer.Write(message.c_str(), message.length());
+}
+
+BOOST_AUTO_TEST_CASE(TestMessagesAreLines)
+{
+    TempFile file;
+    TraceBuffer buffer;
+    BOOST_REQUIRE(buffer.Open(file.path.c_str()));
+    BOOST_CHECK_EQUAL(buffer.ReadAll(), "");
+
+    Write(buffer, "first");
+    Write(buffer, "second");
+    BOOST_CHECK_EQUAL(buffer.ReadAll(), "first\nsecond\n");
+}
+
+BOOST_AUTO_TEST_CASE(TestSurvivesTheWriter)
+{
+    TempFile file;
+    pid_t child = fork();
+    if (child == 0)
+    {
+        TraceBuffer buffer;
+        if (!buffer.Open(file.path.c_str()))
+        {
+            _exit(1);
+        }
+
+        Write(buffer, "written by the child");
+        // Die without unmapping anything (and out of reach of the boost signal handlers)
+        kill(getpid(), SIGKILL);
+    }
+
+    int status;
+    BOOST_REQUIRE_EQUAL(waitpid(child, &status, 0), child);
+    BOOST_REQUIRE(WIFSIGNALED(status));
+
+    TraceBuffer buffer;
+    BOOST_REQUIRE(buffer.Open(file.path.c_str()));
+    BOOST_CHECK_EQUAL(buffer.ReadAll(), "written by the child\n");
+
+    // Opening the ring again appends to it
+    Write(buffer, "written by the parent");
+    BOOST_CHECK_EQUAL(buffer.ReadAll(), "written by the child\nwritten by the parent\n");
+}
+
+BOOST_AUTO_TEST_CASE(TestWrapAroundKeepsNewestMessages)
+{
+    TempFile file;
+    TraceBuffer buffer;
+    BOOST_REQUIRE(buffer.Open(file.path.c_str(), /* capacity */ 64));
+
+    for (int i = 0; i < 100; i++)
+    {
+        Write(buffer, "message " + to_string(i));
+    }
+
+    // Only whole messages come back, and the last one is the newest
+    string contents = buffer.ReadAll();
+    BOOST_REQUIRE(!contents.empty());
+    BOOST_CHECK(contents.length() <= 64);
+    BOOST_CHECK_EQUAL(contents.compare(0, strlen("message "), "message "), 0);
+    BOOST_CHECK_EQUAL(contents.compare(contents.length() - strlen("message 99\n"), string::npos, "message 99\n"), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestLongMessagesAreTruncated)
+{
+    TempFile file;
+    TraceBuffer buffer;
+    BOOST_REQUIRE(buffer.Open(file.path.c_str(), /* capacity */ 64));
+
+    Write(buffer, string(100, 'x'));
+    BOOST_CHECK_EQUAL(buffer.ReadAll(), string(16, 'x') + "\n");
+}
+
+BOOST_AUTO_TEST_CASE(TestCapacityMismatch)
+{
+    TempFile file;
+    TraceBuffer first;
+    BOOST_REQUIRE(first.Open(file.path.c_str(), /* capacity */ 1024));
+
+    TraceBuffer second;
+    BOOST_CHECK(!second.Open(file.path.c_str(), /* capacity */ 2048));
+    BOOST_CHECK(!second.IsValid());
+
+    // Writing to a ring that isn't open is a no-op
+    Write(second, "dropped");
+    BOOST_CHECK_EQUAL(second.ReadAll(), "");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,80 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define BOOST_TEST_MODULE LinuxSandboxTest
+#define _DO_NOT_EXPORT
+
+#include <boost/test/included/unit_test.hpp>
+#include <untracked_scope_filter.hpp>
+#include <string.h>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(UntrackedScopeFilterTests)
+
+static void Add(UntrackedScopeFilter &filter, const char *root)
+{
+    filter.Add(root, strlen(root));
+}
+
+BOOST_AUTO_TEST_CASE(TestCoversPathsUnderRoots)
+{
+    UntrackedScopeFilter filter;
+    BOOST_CHECK(filter.IsEmpty());
+    BOOST_CHECK(!filter.Covers("/proc/self/maps"));
+
+    Add(filter, "/proc");
+    Add(filter, "/usr/lib");
+    BOOST_CHECK(!filter.IsEmpty());
+
+    BOOST_CHECK(filter.Covers("/proc"));
+    BOOST_CHECK(filter.Covers("/proc/"));
+    BOOST_CHECK(filter.Covers("/proc/self/maps"));
+    BOOST_CHECK(filter.Covers("/usr/lib/x86_64-linux-gnu/libc.so.6"));
+
+    // Above a root, next to one, or only sharing a prefix
+    BOOST_CHECK(!filter.Covers("/"));
+    BOOST_CHECK(!filter.Covers("/usr"));
+    BOOST_CHECK(!filter.Covers("/usr/include/stdio.h"));
+    BOOST_CHECK(!filter.Covers("/usr/lib64/ld-linux-x86-64.so.2"));
+    BOOST_CHECK(!filter.Covers("/procfs"));
+
+    // Relative paths are never covered
+    BOOST_CHECK(!filter.Covers("proc/self/maps"));
+}
+
+BOOST_AUTO_TEST_CASE(TestOnlyCanonicalPathsAreCovered)
+{
+    UntrackedScopeFilter filter;
+    Add(filter, "/usr/lib");
+
+    // Can't tell without resolving where these end up
+    BOOST_CHECK(!filter.Covers("/usr/./lib/libc.so.6"));
+    BOOST_CHECK(!filter.Covers("/usr//lib/libc.so.6"));
+    BOOST_CHECK(!filter.Covers("/usr/bin/../lib/libc.so.6"));
+    BOOST_CHECK(!filter.Covers("/usr/lib/../../home/user/src/main.c"));
+
+    // These stay under the root
+    BOOST_CHECK(filter.Covers("/usr/lib/./libc.so.6"));
+    BOOST_CHECK(filter.Covers("/usr/lib//libc.so.6"));
+    BOOST_CHECK(filter.Covers("/usr/lib/..so"));
+}
+
+BOOST_AUTO_TEST_CASE(TestNestedRoots)
+{
+    UntrackedScopeFilter filter;
+    Add(filter, "/usr/lib/gcc");
+    Add(filter, "/usr");
+    Add(filter, "/usr/share");
+
+    BOOST_CHECK(filter.Covers("/usr/include/stdio.h"));
+    BOOST_CHECK(filter.Covers("/usr/lib/gcc/x86_64-linux-gnu/12/crtbegin.o"));
+    BOOST_CHECK(!filter.Covers("/home/user/src/main.c"));
+
+    UntrackedScopeFilter everything;
+    Add(everything, "");
+    BOOST_CHECK(everything.Covers("/home/user/src/main.c"));
+    BOOST_CHECK(!everything.Covers("/home/../etc/passwd"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
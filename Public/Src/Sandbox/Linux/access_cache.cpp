@@ -0,0 +1,341 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "access_cache.hpp"
+#include "fnv1a.hpp"
+#include <string.h>
+#include <sys/mman.h>
+
+static size_t RoundUp(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+AccessCache::~AccessCache()
+{
+    if (mapping_ != nullptr)
+    {
+        munmap(mapping_, mappingSize_);
+    }
+}
+
+bool AccessCache::Initialize(size_t budget)
+{
+    // The budget is split evenly between the generations of every shard. Within a generation, slots get about as much
+    // as the paths they point to are expected to take.
+    size_t generationBudget = (budget == 0 ? DEFAULT_BUDGET : budget) / (SHARD_COUNT * 2);
+    uint32_t slots = MIN_SLOTS_PER_GENERATION;
+    while ((size_t)slots * 2 * (sizeof(Slot) + EXPECTED_PATH_LENGTH) <= generationBudget)
+    {
+        slots *= 2;
+    }
+
+    size_t slotsSize = RoundUp(sizeof(Slot) * slots, 64);
+    size_t arenaSize = generationBudget > slotsSize + (size_t)slots * EXPECTED_PATH_LENGTH
+        ? generationBudget - slotsSize
+        : (size_t)slots * EXPECTED_PATH_LENGTH;
+    arenaSize = RoundUp(arenaSize > UINT32_MAX - 1 ? UINT32_MAX - 1 : arenaSize, 64);
+
+    size_t headerSize = RoundUp(sizeof(Shard) * SHARD_COUNT, 64);
+    size_t generationSize = slotsSize + arenaSize;
+    size_t mappingSize = headerSize + generationSize * SHARD_COUNT * 2;
+
+    // Anonymous memory is zero-filled, so every slot starts empty. Pages are only committed when touched.
+    void *mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+
+    Shard *shards = (Shard *)mapping;
+    char *next = (char *)mapping + headerSize;
+    for (uint32_t i = 0; i < SHARD_COUNT; i++)
+    {
+        for (Generation &generation : shards[i].generations)
+        {
+            generation.slots = (Slot *)next;
+            generation.arena = next + slotsSize;
+            next += generationSize;
+        }
+    }
+
+    mapping_ = mapping;
+    mappingSize_ = mappingSize;
+    slotsPerGeneration_ = slots;
+    arenaSize_ = (uint32_t)arenaSize;
+    shards_ = shards;
+    return true;
+}
+
+uint64_t AccessCache::Hash(uint32_t eventClass, const char *path, size_t pathLength)
+{
+    // FNV-1a over the path, followed by a finalizer that spreads the bits so both the shard (high bits)
+    // and the slot (low bits) depend on the whole path
+    uint64_t hash = Fnv1a(path, pathLength);
+    hash ^= (uint64_t)eventClass * 0x9e3779b97f4a7c15ULL;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+
+    // 0 marks empty slots
+    return hash == 0 ? 1 : hash;
+}
+
+bool AccessCache::Matches(const Generation &generation, const Slot &slot, const char *path, size_t pathLength)
+{
+    uint32_t pathOffset = slot.pathOffset.load(std::memory_order_acquire);
+    if (pathOffset == PATH_PENDING || pathOffset == PATH_DROPPED)
+    {
+        return false;
+    }
+
+    // Offsets are stored off by one so a zero-filled slot reads as pending
+    return slot.pathLength == pathLength && memcmp(&generation.arena[pathOffset - 1], path, pathLength) == 0;
+}
+
+bool AccessCache::IsStable(const Shard &shard, uint64_t epoch)
+{
+    // Pairs with the release stores of whatever got read from the shard: if any of it was written after an eviction
+    // started, the epoch read here is the one of that eviction (seqlock style)
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return shard.epoch.load(std::memory_order_relaxed) == epoch;
+}
+
+bool AccessCache::Check(uint32_t eventClass, const char *path, size_t pathLength, bool addIfMissing)
+{
+    return CheckAccesses(eventClass, path, pathLength, /* required */ 1, /* recorded */ addIfMissing ? 1 : 0);
+}
+
+AccessCache::Slot* AccessCache::Find(Shard &shard, Generation &generation, uint64_t hash, const char *path, size_t pathLength, bool claim, bool &claimed)
+{
+    claimed = false;
+    uint32_t mask = slotsPerGeneration_ - 1;
+    uint32_t index = (uint32_t)hash & mask;
+    for (uint32_t probe = 0; probe < MAX_PROBES; probe++, index = (index + 1) & mask)
+    {
+        Slot &slot = generation.slots[index];
+        uint64_t current = slot.hash.load(std::memory_order_acquire);
+
+        if (current == 0)
+        {
+            if (!claim)
+            {
+                return nullptr;
+            }
+
+            if (slot.hash.compare_exchange_strong(current, hash, std::memory_order_acq_rel))
+            {
+                claimed = true;
+                return &slot;
+            }
+
+            // Some other thread claimed the slot first, current now holds what it stored
+            shard.contentions.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (current != hash)
+        {
+            continue;
+        }
+
+        if (Matches(generation, slot, path, pathLength))
+        {
+            return &slot;
+        }
+
+        if (slot.pathOffset.load(std::memory_order_relaxed) == PATH_PENDING)
+        {
+            // Most likely the same path being added by another thread right now. We can't tell yet, so keep looking.
+            shard.contentions.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    return nullptr;
+}
+
+bool AccessCache::CheckAccesses(uint32_t eventClass, const char *path, size_t pathLength, uint32_t required, uint32_t recorded)
+{
+    bool addIfMissing = recorded != 0;
+    if (shards_ == nullptr)
+    {
+        return false;
+    }
+
+    uint64_t hash = Hash(eventClass, path, pathLength);
+    Shard &shard = shards_[hash >> 60];
+    static_assert(SHARD_COUNT == 16, "The shard is picked from the top 4 bits of the hash");
+
+    uint64_t epoch = shard.epoch.load(std::memory_order_acquire);
+    if (epoch & 1)
+    {
+        // A generation is being evicted, which doesn't take long: just report this one
+        if (addIfMissing)
+        {
+            shard.dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        shard.misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    Generation &current = shard.generations[(epoch >> 1) & 1];
+    Generation &previous = shard.generations[((epoch >> 1) + 1) & 1];
+
+    bool claimed;
+    Slot *slot = Find(shard, current, hash, path, pathLength, /* claim */ false, claimed);
+    if (slot != nullptr)
+    {
+        // Same path: only a hit if every required access was recorded for it
+        uint32_t accesses = slot->accesses.load(std::memory_order_relaxed);
+        bool stable = IsStable(shard, epoch);
+        if (stable && (accesses & required) == required)
+        {
+            shard.hits.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // A slot only gets reused for another path two evictions later, which is what IsStable rules out
+        if (stable && addIfMissing)
+        {
+            slot->accesses.fetch_or(recorded, std::memory_order_release);
+        }
+
+        shard.misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Not in the current generation: what the previous one has is moved over, so it survives the next eviction
+    uint32_t carried = 0;
+    Slot *old = Find(shard, previous, hash, path, pathLength, /* claim */ false, claimed);
+    if (old != nullptr)
+    {
+        carried = old->accesses.load(std::memory_order_relaxed);
+        if (!IsStable(shard, epoch))
+        {
+            // The previous generation is being evicted under us, so what was read may belong to some other path
+            old = nullptr;
+            carried = 0;
+        }
+    }
+
+    bool hit = old != nullptr && (carried & required) == required;
+    if (hit || addIfMissing)
+    {
+        Insert(shard, epoch, hash, path, pathLength, hit ? carried : carried | recorded);
+    }
+
+    if (hit)
+    {
+        shard.hits.fetch_add(1, std::memory_order_relaxed);
+    }
+    else
+    {
+        shard.misses.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return hit;
+}
+
+void AccessCache::Insert(Shard &shard, uint64_t epoch, uint64_t hash, const char *path, size_t pathLength, uint32_t accesses)
+{
+    // At most one eviction per insert: if the fresh generation has no room either, the entry is not worth it
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        Generation &generation = shard.generations[(epoch >> 1) & 1];
+        bool claimed;
+        Slot *slot = Find(shard, generation, hash, path, pathLength, /* claim */ true, claimed);
+        if (slot != nullptr && !claimed)
+        {
+            slot->accesses.fetch_or(accesses, std::memory_order_release);
+            return;
+        }
+
+        if (slot != nullptr)
+        {
+            // The slot is ours: copy the path to the arena and publish it
+            uint32_t pathOffset = PATH_DROPPED;
+            if (generation.arenaUsed.load(std::memory_order_relaxed) + pathLength <= arenaSize_)
+            {
+                uint32_t offset = generation.arenaUsed.fetch_add(pathLength, std::memory_order_relaxed);
+                if (offset + pathLength <= arenaSize_)
+                {
+                    memcpy(&generation.arena[offset], path, pathLength);
+                    slot->pathLength = pathLength;
+                    pathOffset = offset + 1;
+                }
+            }
+
+            slot->accesses.store(accesses, std::memory_order_release);
+            slot->pathOffset.store(pathOffset, std::memory_order_release);
+            if (pathOffset != PATH_DROPPED)
+            {
+                return;
+            }
+
+            // Out of arena space: the slot stays wasted until its generation gets evicted
+        }
+
+        if (!Evict(shard, epoch))
+        {
+            break;
+        }
+
+        epoch += 2;
+    }
+
+    shard.dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool AccessCache::Evict(Shard &shard, uint64_t epoch)
+{
+    // Entering the odd epoch keeps every other thread away from the shard until the eviction is done
+    uint64_t expected = epoch;
+    if (!shard.epoch.compare_exchange_strong(expected, epoch + 1, std::memory_order_acq_rel))
+    {
+        return false;
+    }
+
+    Generation &evicted = shard.generations[((epoch >> 1) + 1) & 1];
+    uint64_t evictions = 0;
+    for (uint32_t i = 0; i < slotsPerGeneration_; i++)
+    {
+        Slot &slot = evicted.slots[i];
+        if (slot.hash.load(std::memory_order_relaxed) != 0)
+        {
+            evictions++;
+        }
+
+        slot.pathOffset.store(PATH_PENDING, std::memory_order_relaxed);
+        slot.accesses.store(0, std::memory_order_relaxed);
+        slot.hash.store(0, std::memory_order_release);
+    }
+
+    evicted.arenaUsed.store(0, std::memory_order_relaxed);
+    shard.evictions.fetch_add(evictions, std::memory_order_relaxed);
+
+    // The evicted generation is the current one from now on
+    shard.epoch.store(epoch + 2, std::memory_order_release);
+    return true;
+}
+
+AccessCache::Stats AccessCache::GetStats() const
+{
+    Stats stats = {0};
+    if (shards_ == nullptr)
+    {
+        return stats;
+    }
+
+    for (uint32_t i = 0; i < SHARD_COUNT; i++)
+    {
+        stats.hits += shards_[i].hits.load(std::memory_order_relaxed);
+        stats.misses += shards_[i].misses.load(std::memory_order_relaxed);
+        stats.contentions += shards_[i].contentions.load(std::memory_order_relaxed);
+        stats.dropped += shards_[i].dropped.load(std::memory_order_relaxed);
+        stats.evictions += shards_[i].evictions.load(std::memory_order_relaxed);
+    }
+
+    return stats;
+}
@@ -0,0 +1,121 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Set of (event class, path) pairs that were already reported, used to avoid sending duplicate reports.
+ *
+ * The set is split in shards, each being a fixed-size open-addressing table of 64-bit path hashes plus an arena holding the
+ * path bytes, so a hash collision is never mistaken for a hit. Lookups never block and inserts only use atomic operations,
+ * so callers never give up on caching because some other thread holds a lock.
+ *
+ * Memory is bounded by a budget, reserved up front but only committed as it gets used. Each shard keeps two generations of
+ * entries: new entries go to the current one, and entries found in the previous one are moved back to the current one. When
+ * the current generation runs out of slots or arena space, the previous one is evicted and becomes the new current one, so the
+ * entries used since the last eviction survive the next one (a segmented LRU, evicting a whole segment at a time). This keeps
+ * hit rates up in long-lived processes that keep accessing new paths. Evicting an entry is safe: its access just gets reported again.
+ */
+class AccessCache final
+{
+public:
+    struct Stats
+    {
+        uint64_t hits;
+        uint64_t misses;
+        // Lookups or inserts that raced with an insert of the same hash on another thread
+        uint64_t contentions;
+        // Inserts dropped because the shard was full or busy evicting
+        uint64_t dropped;
+        // Entries evicted to make room for new ones
+        uint64_t evictions;
+    };
+
+    // Memory used when no budget is given
+    static const size_t DEFAULT_BUDGET = 32 << 20;
+
+    AccessCache() = default;
+    ~AccessCache();
+    AccessCache(const AccessCache&) = delete;
+    AccessCache& operator = (const AccessCache&) = delete;
+
+    // Reserves the memory for the cache, given in bytes (0 meaning DEFAULT_BUDGET). Returns false if it can't be reserved,
+    // in which case every check is a miss.
+    bool Initialize(size_t budget = 0);
+
+    bool IsValid() const { return shards_ != nullptr; }
+
+    // Returns whether (eventClass, path) is in the cache. If it is not and addIfMissing is set, adds it.
+    bool Check(uint32_t eventClass, const char *path, size_t pathLength, bool addIfMissing);
+
+    // Each entry also holds a set of access bits. Returns whether (eventClass, path) is in the cache with every bit of 'required'
+    // set. If it is not, the bits of 'recorded' get added to the entry (adding the entry first if needed), so an entry only ever
+    // gains accesses. Check is the same with a single bit.
+    bool CheckAccesses(uint32_t eventClass, const char *path, size_t pathLength, uint32_t required, uint32_t recorded);
+
+    Stats GetStats() const;
+
+private:
+    static const uint32_t SHARD_COUNT = 16;
+    static const uint32_t MIN_SLOTS_PER_GENERATION = 256;
+    static const uint32_t MAX_PROBES = 32;
+    // Used to split the memory of a generation between slots and arena
+    static const uint32_t EXPECTED_PATH_LENGTH = 128;
+
+    // pathOffset values for slots whose hash is set but whose path is not (or will never be) available
+    static const uint32_t PATH_PENDING = 0;
+    static const uint32_t PATH_DROPPED = UINT32_MAX;
+
+    struct Slot
+    {
+        std::atomic<uint64_t> hash;         // 0 means empty
+        std::atomic<uint32_t> pathOffset;   // Offset of the path in the arena + 1, or one of the values above
+        uint32_t pathLength;
+        std::atomic<uint32_t> accesses;     // Set before pathOffset is published
+    };
+
+    struct Generation
+    {
+        Slot *slots;
+        char *arena;
+        std::atomic<uint32_t> arenaUsed;
+    };
+
+    struct Shard
+    {
+        Generation generations[2];
+        // Even while the shard is in use, odd while the previous generation is being evicted. The current generation is (epoch / 2) % 2.
+        std::atomic<uint64_t> epoch;
+        std::atomic<uint64_t> hits;
+        std::atomic<uint64_t> misses;
+        std::atomic<uint64_t> contentions;
+        std::atomic<uint64_t> dropped;
+        std::atomic<uint64_t> evictions;
+    };
+
+    static uint64_t Hash(uint32_t eventClass, const char *path, size_t pathLength);
+    static bool Matches(const Generation &generation, const Slot &slot, const char *path, size_t pathLength);
+
+    // Whether no eviction started in the shard since 'epoch' was read. Anything read from the shard before is consistent if it returns true.
+    static bool IsStable(const Shard &shard, uint64_t epoch);
+
+    // Looks for the slot of hash/path in the generation, claiming an empty one if 'claim' is set and it is not there.
+    // Returns nullptr if it is not there (or, when claiming, if the probe sequence is full).
+    Slot* Find(Shard &shard, Generation &generation, uint64_t hash, const char *path, size_t pathLength, bool claim, bool &claimed);
+
+    // Adds hash/path with the given accesses to the current generation of the shard, evicting the previous one if there is no room
+    void Insert(Shard &shard, uint64_t epoch, uint64_t hash, const char *path, size_t pathLength, uint32_t accesses);
+
+    // Evicts the previous generation of the shard, which becomes the current one. Returns false if some other thread got to it first.
+    bool Evict(Shard &shard, uint64_t epoch);
+
+    Shard *shards_ = nullptr;
+    void *mapping_ = nullptr;
+    size_t mappingSize_ = 0;
+    uint32_t slotsPerGeneration_ = 0;   // Power of 2
+    uint32_t arenaSize_ = 0;
+};
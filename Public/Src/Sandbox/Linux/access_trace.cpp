@@ -0,0 +1,133 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "access_trace.hpp"
+#include "shared_mapping.hpp"
+#include <limits.h>
+#include <string.h>
+
+bool AccessTrace::Open(const char *filePath, const char *fam, size_t famLength, uint64_t capacity)
+{
+    Close();
+    if (famLength > UINT32_MAX || capacity < sizeof(RecordHeader))
+    {
+        return false;
+    }
+
+    // A freshly extended file is all zeros, which is an empty trace. The first process to get here copies the manifest along
+    // with the stamp, and a process racing with it copies the very same manifest. A trace left by a previous image of this
+    // process (exec) is kept and appended to.
+    size_t mappingSize = MappingSize((uint32_t)famLength, capacity);
+    header_ = SharedMapping::Open<Header>(filePath, mappingSize, MAGIC,
+        [&](Header &h)
+        {
+            memcpy((char *)(&h + 1), fam, famLength);
+            h.version = VERSION;
+            h.famLength = (uint32_t)famLength;
+            h.capacity = capacity;
+        },
+        [&](const Header &h) { return h.version == VERSION && h.famLength == famLength && h.capacity == capacity; });
+    if (header_ == nullptr)
+    {
+        return false;
+    }
+
+    mappingSize_ = mappingSize;
+    records_ = (char *)(header_ + 1) + Align(famLength);
+    return true;
+}
+
+bool AccessTrace::OpenForReading(const char *filePath)
+{
+    Close();
+
+    // Raw syscalls, for the same reason as in SharedMapping
+    int fd = syscall(SYS_openat, AT_FDCWD, filePath, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    struct stat statbuf;
+    if (syscall(SYS_fstat, fd, &statbuf) != 0 || (size_t)statbuf.st_size < sizeof(Header))
+    {
+        syscall(SYS_close, fd);
+        return false;
+    }
+
+    void *mapping = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping stays valid after the descriptor is closed
+    syscall(SYS_close, fd);
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+
+    header_ = (Header *)mapping;
+    mappingSize_ = statbuf.st_size;
+
+    if (header_->magic.load(std::memory_order_acquire) != MAGIC
+        || header_->version != VERSION
+        || header_->capacity > mappingSize_
+        || MappingSize(header_->famLength, header_->capacity) != mappingSize_)
+    {
+        Close();
+        return false;
+    }
+
+    records_ = (char *)(header_ + 1) + Align(header_->famLength);
+    return true;
+}
+
+void AccessTrace::Close()
+{
+    if (header_ != nullptr)
+    {
+        munmap(header_, mappingSize_);
+        header_ = nullptr;
+        records_ = nullptr;
+        mappingSize_ = 0;
+    }
+}
+
+const char* AccessTrace::GetFam(size_t &length) const
+{
+    length = header_ == nullptr ? 0 : header_->famLength;
+    return header_ == nullptr ? nullptr : (const char *)(header_ + 1);
+}
+
+bool AccessTrace::Append(const Record &record, const char *syscallName, size_t syscallNameLength, const char *event, size_t eventLength)
+{
+    if (header_ == nullptr)
+    {
+        return false;
+    }
+
+    uint64_t size = Align(sizeof(RecordHeader) + syscallNameLength + eventLength);
+    uint64_t capacity = header_->capacity;
+    // Once the trace is full, stop reserving so the write position can't wrap around
+    if (size > capacity || header_->writePosition.load(std::memory_order_relaxed) > capacity - size)
+    {
+        header_->droppedRecords.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    uint64_t position = header_->writePosition.fetch_add(size, std::memory_order_relaxed);
+    if (position > capacity - size)
+    {
+        // Full. The space is wasted, but so is any further attempt.
+        header_->droppedRecords.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    RecordHeader *recordHeader = (RecordHeader *)&records_[position];
+    recordHeader->size.store((uint32_t)size, std::memory_order_release);
+    recordHeader->syscallNameLength = (uint32_t)syscallNameLength;
+    recordHeader->eventLength = (uint32_t)eventLength;
+    recordHeader->record = record;
+    char *payload = (char *)(recordHeader + 1);
+    memcpy(payload, syscallName, syscallNameLength);
+    memcpy(&payload[syscallNameLength], event, eventLength);
+    recordHeader->committed.store(1, std::memory_order_release);
+    return true;
+}
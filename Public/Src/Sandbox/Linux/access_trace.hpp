@@ -0,0 +1,137 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Append-only log of the access checks a process makes, living in a file mapped by the process
+ * (see FileAccessManifestExtraFlag::RecordLinuxSandboxAccessTrace), so the checks of a real pip can be replayed offline
+ * (see accesstracereplay.cpp).
+ *
+ * The file holds a header, a copy of the manifest the process ran with (the manifest of a pip is deleted once the pip is done,
+ * and a trace is meaningless without it), and the records. A record is a fixed-size RecordHeader followed by the name of the
+ * intercepted function and the serialized IOEvent that was checked. Writers reserve space by bumping the write position, so
+ * several writers (e.g. the interposing and the audit libraries of a process) can append to the same file without locking.
+ * Once the file is full, records are dropped (and counted).
+ *
+ * Records are in the page cache as soon as they are written, so a process that crashes loses none of them. A record whose writer
+ * died before committing it is skipped when reading.
+ */
+class AccessTrace final
+{
+public:
+    // The backing file is sparse: only the pages that get used take any space
+    static const uint64_t DEFAULT_CAPACITY = 64ull << 20;
+
+    // What gets recorded about an access check, besides the function name and the event
+    struct Record
+    {
+        uint64_t timestampNs;   // CLOCK_MONOTONIC, when the check started
+        uint64_t durationNs;
+        int32_t  pid;
+        int32_t  tid;
+        uint32_t checkCache;
+        uint32_t requestedAccess;
+        uint32_t result;
+        uint32_t reportLevel;
+    };
+
+    AccessTrace() = default;
+    ~AccessTrace() { Close(); }
+    AccessTrace(const AccessTrace&) = delete;
+    AccessTrace& operator = (const AccessTrace&) = delete;
+
+    // Opens (creating it if needed) the trace backed by the given file for appending. A new trace gets a copy of 'fam'.
+    // Returns false if it can't be opened, which includes the file having been created with a different manifest size or capacity.
+    // An already open trace is closed first.
+    bool Open(const char *filePath, const char *fam, size_t famLength, uint64_t capacity = DEFAULT_CAPACITY);
+
+    // Opens an existing trace, read-only
+    bool OpenForReading(const char *filePath);
+
+    void Close();
+
+    bool IsValid() const { return header_ != nullptr; }
+
+    // Appends a record. Returns false if it was dropped because the trace is full (or not open).
+    bool Append(const Record &record, const char *syscallName, size_t syscallNameLength, const char *event, size_t eventLength);
+
+    // The manifest the traced process ran with
+    const char* GetFam(size_t &length) const;
+
+    uint64_t GetDroppedRecords() const { return header_ == nullptr ? 0 : header_->droppedRecords.load(std::memory_order_relaxed); }
+
+    // Calls visitor(const Record&, const char *syscallName, size_t syscallNameLength, const char *event, size_t eventLength) for every
+    // committed record, in the order they were reserved. Returns the number of records visited.
+    template <typename Visitor>
+    size_t ForEach(Visitor visitor) const
+    {
+        size_t count = 0;
+        if (header_ == nullptr)
+        {
+            return count;
+        }
+
+        uint64_t end = header_->writePosition.load(std::memory_order_acquire);
+        end = end < header_->capacity ? end : header_->capacity;
+        for (uint64_t position = 0; position + sizeof(RecordHeader) <= end; )
+        {
+            const RecordHeader *recordHeader = (const RecordHeader *)&records_[position];
+            uint32_t size = recordHeader->size.load(std::memory_order_acquire);
+            if (size < sizeof(RecordHeader) || position + size > end)
+            {
+                // A writer died right after reserving: nothing past this point can be told apart
+                break;
+            }
+
+            if (recordHeader->committed.load(std::memory_order_acquire) != 0
+                && sizeof(RecordHeader) + recordHeader->syscallNameLength + recordHeader->eventLength <= size)
+            {
+                const char *syscallName = (const char *)(recordHeader + 1);
+                visitor(recordHeader->record, syscallName, (size_t)recordHeader->syscallNameLength, &syscallName[recordHeader->syscallNameLength], (size_t)recordHeader->eventLength);
+                count++;
+            }
+
+            position += size;
+        }
+
+        return count;
+    }
+
+private:
+    static const uint64_t MAGIC = 0x5254434341584c42; // "BLXACCTR"
+    static const uint32_t VERSION = 1;
+
+    // Followed by the manifest (padded to 8 bytes) and then by the records
+    struct Header
+    {
+        std::atomic<uint64_t> magic;
+        uint32_t version;
+        uint32_t famLength;
+        uint64_t capacity;
+        std::atomic<uint64_t> writePosition;
+        std::atomic<uint64_t> droppedRecords;
+    };
+
+    // Followed by the function name and the event. 'size' (a multiple of 8) is stored as soon as the space is reserved,
+    // 'committed' once the record is complete.
+    struct RecordHeader
+    {
+        std::atomic<uint32_t> size;
+        std::atomic<uint32_t> committed;
+        uint32_t syscallNameLength;
+        uint32_t eventLength;
+        Record record;
+    };
+
+    static uint64_t Align(uint64_t value) { return (value + 7) & ~7ull; }
+    static size_t MappingSize(uint32_t famLength, uint64_t capacity) { return sizeof(Header) + Align(famLength) + capacity; }
+
+    Header *header_ = nullptr;
+    char *records_ = nullptr;
+    size_t mappingSize_ = 0;
+};
@@ -0,0 +1,166 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "access_trace.hpp"
+#include "bxl_observer.hpp"
+
+/**
+ * Replays the access checks recorded with FileAccessManifestExtraFlag::RecordLinuxSandboxAccessTrace through the observer, without
+ * running the traced tools, so changes to the checking logic (policy lookups, caches, path handling) can be measured against the
+ * access streams of real pips.
+ *
+ * Usage: accesstracereplay <trace file>...
+ *
+ * The traces must come from the same pip. The manifest embedded in the first one is written next to it, the observer is initialized
+ * from it as the root process of the pip, and the records of every trace are replayed in the order they were recorded.
+ * For every intercepted function, prints the number of checks, the time they took when recorded and when replayed, and how many
+ * replayed checks got a different result (e.g. because the file system of this machine is not the one of the recording).
+ */
+
+struct ReplayedAccess
+{
+    AccessTrace::Record record;
+    std::string syscallName;
+    IOEvent event;
+};
+
+struct ReplayStats
+{
+    uint64_t checks = 0;
+    uint64_t recordedNs = 0;
+    uint64_t replayedNs = 0;
+    uint64_t mismatches = 0;
+};
+
+static uint64_t GetMonotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool WriteFam(const AccessTrace &trace, const std::string &famPath)
+{
+    size_t famLength;
+    const char *fam = trace.GetFam(famLength);
+    FILE *famFile = fopen(famPath.c_str(), "wb");
+    if (famFile == nullptr)
+    {
+        return false;
+    }
+
+    bool written = fwrite(fam, 1, famLength, famFile) == famLength;
+    return fclose(famFile) == 0 && written;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <trace file>...\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<ReplayedAccess> accesses;
+    std::string famPath;
+    for (int i = 1; i < argc; i++)
+    {
+        AccessTrace trace;
+        if (!trace.OpenForReading(argv[i]))
+        {
+            fprintf(stderr, "'%s' is not an access trace\n", argv[i]);
+            return 1;
+        }
+
+        if (famPath.empty())
+        {
+            famPath = std::string(argv[i]) + ".fam";
+            if (!WriteFam(trace, famPath))
+            {
+                fprintf(stderr, "Could not write the manifest to '%s'; errno: %d\n", famPath.c_str(), errno);
+                return 1;
+            }
+        }
+
+        size_t malformed = 0;
+        trace.ForEach([&](const AccessTrace::Record &record, const char *syscallName, size_t syscallNameLength, const char *event, size_t eventLength)
+        {
+            ReplayedAccess access { record, std::string(syscallName, syscallNameLength), IOEvent() };
+            if (IOEvent::Deserialize(event, eventLength, access.event))
+            {
+                accesses.push_back(std::move(access));
+            }
+            else
+            {
+                malformed++;
+            }
+        });
+
+        if (trace.GetDroppedRecords() > 0 || malformed > 0)
+        {
+            fprintf(stderr, "'%s': %lu records were dropped when recording, %lu are malformed\n", argv[i], trace.GetDroppedRecords(), malformed);
+        }
+    }
+
+    // Checks of different processes (and threads) interleave: replay them the way they happened
+    std::stable_sort(accesses.begin(), accesses.end(), [](const ReplayedAccess &a, const ReplayedAccess &b)
+    {
+        return a.record.timestampNs < b.record.timestampNs;
+    });
+
+    // The observer gets initialized from the environment, as the root process of the pip
+    setenv(BxlEnvFamPath, famPath.c_str(), /* overwrite */ 1);
+    setenv(BxlEnvRootPid, "1", /* overwrite */ 1);
+    unsetenv(BxlPTraceTracedPid);
+    BxlObserver *bxl = BxlObserver::GetInstance();
+    bxl->begin_replay();
+
+    std::map<std::string, ReplayStats> stats;
+    for (ReplayedAccess &access : accesses)
+    {
+        const IOEvent &recorded = access.event;
+        IOEvent event(getpid(), 0, getppid(), recorded.GetEventType(), recorded.GetActionType(), recorded.GetSrcPath(), recorded.GetDstPath(),
+            recorded.GetExecutablePath(), recorded.GetMode(), recorded.FSEntryModified(), recorded.GetError());
+        AccessReportGroup reportGroup;
+
+        uint64_t start = GetMonotonicNs();
+        AccessCheckResult result = bxl->replay_access(access.syscallName.c_str(), event, reportGroup, access.record.checkCache != 0);
+        uint64_t duration = GetMonotonicNs() - start;
+
+        ReplayStats &entry = stats[access.syscallName];
+        entry.checks++;
+        entry.recordedNs += access.record.durationNs;
+        entry.replayedNs += duration;
+        if ((uint32_t)result.Access != access.record.requestedAccess
+            || (uint32_t)result.Result != access.record.result
+            || (uint32_t)result.Level != access.record.reportLevel)
+        {
+            entry.mismatches++;
+        }
+    }
+
+    ReplayStats total;
+    printf("%-24s %10s %14s %14s %10s\n", "function", "checks", "recorded ns", "replayed ns", "mismatches");
+    for (const auto &entry : stats)
+    {
+        printf("%-24s %10lu %14lu %14lu %10lu\n", entry.first.c_str(), entry.second.checks, entry.second.recordedNs, entry.second.replayedNs, entry.second.mismatches);
+        total.checks += entry.second.checks;
+        total.recordedNs += entry.second.recordedNs;
+        total.replayedNs += entry.second.replayedNs;
+        total.mismatches += entry.second.mismatches;
+    }
+
+    printf("%-24s %10lu %14lu %14lu %10lu\n", "total", total.checks, total.recordedNs, total.replayedNs, total.mismatches);
+    fflush(stdout);
+
+    unlink(famPath.c_str());
+    // Created when the manifest asks processes to share their report cache
+    unlink((famPath + ".reports").c_str());
+    // Skip the observer's exit handling, same as the ptrace runner
+    _exit(0);
+}
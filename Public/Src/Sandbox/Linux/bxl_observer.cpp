@@ -2,15 +2,27 @@
 // Licensed under the MIT License.
 
 #include <algorithm>
+#include <memory>
 #include "bxl_observer.hpp"
 #include "IOHandler.hpp"
+#include "observer_utilities.hpp"
+#include <linux/seccomp.h>
 #include <stack>
+#include <sys/mman.h>
 #include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
 #include <sys/wait.h>
 
-static void HandleAccessReport(AccessReport report, int _)
+// Maintained by glibc 2.32 and later. Older ones don't define it, and the process is assumed to be multithreaded then.
+extern "C" char __libc_single_threaded __attribute__((weak));
+
+static void HandleAccessReport(const AccessReport *reports, int count, int _)
 {
-    BxlObserver::GetInstance()->SendReport(report);
+    for (int i = 0; i < count; i++)
+    {
+        BxlObserver::GetInstance()->SendReport(reports[i]);
+    }
 }
 
 AccessCheckResult BxlObserver::sNotChecked = AccessCheckResult::Invalid();
@@ -38,6 +50,9 @@ BxlObserver::BxlObserver()
     }
 
     disposed_ = false;
+    refresh_pid();
+    // Runs on the child of every fork, including the ones of the observer itself (e.g. the ptrace and fanotify supervisors)
+    pthread_atfork(nullptr, nullptr, []() { BxlObserver::GetInstance()->refresh_pid(); });
     const char *rootPidStr = isPTrace ? ptracePid : getenv(BxlEnvRootPid);
     rootPid_ = is_null_or_empty(rootPidStr) ? -1 : atoi(rootPidStr);
     // value of "1" -> special case, set by BuildXL for the root process
@@ -46,7 +61,11 @@ BxlObserver::BxlObserver()
     }
 
     InitFam(isPTrace ? rootPid_ : getpid());
+    InitCaches();
     InitDetoursLibPath();
+#ifndef ENABLE_INTERPOSING
+    InitReportedAuditObjects();
+#endif
 
     const char* const forcedprocesses = getenv(BxlPTraceForcedProcessNames);
     if (!is_null_or_empty(forcedprocesses))
@@ -79,7 +98,241 @@ BxlObserver::BxlObserver()
         // CODESYNC: Public/Src/Engine/Processes/SandboxConnectionLinuxDetours.cs
         secondaryReportPath_[reportLength] = '2';
         secondaryReportPath_[reportLength + 1] = '\0';
+
+        // The ptrace runner never execs anything, so it doesn't need the cache. Neither do pips whose processes are all ptraced
+        // (there is nothing to tell apart) or whose children aren't sandboxed.
+        if (!isPTrace && !CheckUnconditionallyEnableLinuxPTraceSandbox(pip_->GetFamExtraFlags()) && IsMonitoringChildProcesses())
+        {
+            InitStaticLinkingCache();
+        }
+    }
+}
+
+void BxlObserver::InitStaticLinkingCache()
+{
+    // The root process of the pip creates the shared cache, and any other process attaches to the one it inherited.
+    // Failing to do any of it is not an error: each process will just inspect the binaries it execs on its own.
+    bool initialized;
+    if (rootPid_ == getpid())
+    {
+        initialized = sharedStaticLinkingCache_.Create();
+    }
+    else
+    {
+        const char *cacheFd = getenv(BxlEnvStaticLinkingCacheFd);
+        initialized = !is_null_or_empty(cacheFd) && sharedStaticLinkingCache_.Attach(atoi(cacheFd));
+    }
+
+    if (initialized)
+    {
+        snprintf(sharedStaticLinkingCacheFd_, sizeof(sharedStaticLinkingCacheFd_), "%d", sharedStaticLinkingCache_.GetFd());
+    }
+}
+
+void BxlObserver::InitReportedAuditObjects()
+{
+    // The audit library can't rely on the environment to hand the set down to children (it runs in its own namespace,
+    // with its own copy of libc), so the set lives in a file next to the FAM, which every process of the pip knows about.
+    // Failing to open it is not an error: each process will just report every library it loads.
+    // CODESYNC: Public/Src/Engine/Processes/SandboxConnectionLinuxDetours.cs
+    std::string path = std::string(famPath_) + ".objopen";
+    reportedAuditObjects_.Open(path.c_str());
+}
+
+void BxlObserver::InitSharedReportCache()
+{
+    // Same as for the la_objopen set (see InitReportedAuditObjects): the cache lives in a file next to the FAM, so both the
+    // interposing and the audit libraries get to it without going through the environment. The root process, being the first
+    // to get here, creates it. Failing to open it is not an error: each process will just report what its own cache misses.
+    // CODESYNC: Public/Src/Engine/Processes/SandboxConnectionLinuxDetours.cs
+    std::string path = std::string(famPath_) + ".reports";
+    sharedReportCache_.Open(path.c_str(), SharedReportCacheCapacity, SharedReportCacheArenaSize);
+}
+
+void BxlObserver::InitPathSearchCache()
+{
+    // Same as for the shared report cache (see InitSharedReportCache). Failing to open it is not an error: each exec just searches PATH.
+    // CODESYNC: Public/Src/Engine/Processes/SandboxConnectionLinuxDetours.cs
+    std::string path = std::string(famPath_) + ".pathsearches";
+    pathSearchCache_.Open(path.c_str());
+}
+
+void BxlObserver::InitProcessTree()
+{
+    // Same as for the shared report cache (see InitSharedReportCache). Failing to open it is not an error: BuildXL just finds out
+    // on its own that the process tree is done.
+    // CODESYNC: Public/Src/Engine/Processes/SandboxConnectionLinuxDetours.cs
+    std::string path = std::string(famPath_) + ".processes";
+    processTree_.Open(path.c_str());
+}
+
+void BxlObserver::InitResolvedPathGenerations()
+{
+    // Same as for the shared report cache (see InitSharedReportCache). Failing to open it is not an error: resolve_path just doesn't
+    // cache anything, since nothing would tell it about changes made by other processes.
+    // CODESYNC: Public/Src/Engine/Processes/SandboxConnectionLinuxDetours.cs
+    std::string path = std::string(famPath_) + ".symlinks";
+    resolvedPathGenerations_.Open(path.c_str());
+}
+
+// Adds the roots of the untracked cones under node (whose path is 'path') to the filter
+static void AddUntrackedScopes(UntrackedScopeFilter &filter, PCManifestRecord node, std::string &path)
+{
+    // Only leaves can be roots: any node under a cone may give some of it a different policy
+    if (node->BucketCount == 0)
+    {
+        if (AccessHandler::IsUntrackedPolicy(node->GetNodePolicy()) && AccessHandler::IsUntrackedPolicy(node->GetConePolicy()))
+        {
+            filter.Add(path.c_str(), path.length());
+        }
+
+        return;
+    }
+
+    for (uint32_t i = 0; i < node->BucketCount; i++)
+    {
+        PCManifestRecord child = node->GetChildRecord(i);
+        if (child == nullptr)
+        {
+            continue;
+        }
+
+        size_t length = path.length();
+        path.append("/").append(child->GetPartialPath());
+        AddUntrackedScopes(filter, child, path);
+        path.resize(length);
+    }
+}
+
+void BxlObserver::InitCaches()
+{
+    // Budgets only matter for long-lived processes (e.g. service pips): the defaults are large enough for everything else
+    PCManifestCacheBudgets budgets = pip_->GetCacheBudgets();
+    cache_.Initialize((size_t)budgets->AccessCacheKb * 1024);
+    FilesCheckedForAccess::GetInstance()->SetBudget((size_t)budgets->FilesCheckedForAccessKb * 1024);
+}
+
+void BxlObserver::InitUntrackedScopeFilter()
+{
+    std::string path;
+    AddUntrackedScopes(untrackedScopes_, pip_->GetManifestRecord(), path);
+}
+
+// Adds the roots of the cones under node (whose path is 'path') that the manifest marks as free of symlinks to the filter
+static void AddNoReparsePointScopes(UntrackedScopeFilter &filter, PCManifestRecord node, std::string &path)
+{
+    // The flag is part of the cone policy, so every node under the first one that has it does too
+    if ((node->GetNodePolicy() & FileAccessPolicy_NoReparsePointsInCone) != 0 && (node->GetConePolicy() & FileAccessPolicy_NoReparsePointsInCone) != 0)
+    {
+        filter.Add(path.c_str(), path.length());
+        return;
+    }
+
+    for (uint32_t i = 0; i < node->BucketCount; i++)
+    {
+        PCManifestRecord child = node->GetChildRecord(i);
+        if (child == nullptr)
+        {
+            continue;
+        }
+
+        size_t length = path.length();
+        path.append("/").append(child->GetPartialPath());
+        AddNoReparsePointScopes(filter, child, path);
+        path.resize(length);
+    }
+}
+
+void BxlObserver::InitNoReparsePointScopeFilter()
+{
+    std::string path;
+    AddNoReparsePointScopes(noReparsePointScopes_, pip_->GetManifestRecord(), path);
+}
+
+bool BxlObserver::IsInUntrackedScope(es_event_type_t eventType, const char *pathname)
+{
+    if (untrackedScopes_.IsEmpty())
+    {
+        return false;
+    }
+
+    switch (eventType)
+    {
+        // Still needed to track the process tree
+        case ES_EVENT_TYPE_NOTIFY_EXEC:
+        case ES_EVENT_TYPE_NOTIFY_FORK:
+        case ES_EVENT_TYPE_NOTIFY_EXIT:
+        // Still needed to invalidate the PATH searches (see invalidate_path_searches)
+        case ES_EVENT_TYPE_NOTIFY_CREATE:
+        case ES_EVENT_TYPE_NOTIFY_UNLINK:
+        case ES_EVENT_TYPE_NOTIFY_LINK:
+        case ES_EVENT_TYPE_NOTIFY_SETMODE:
+        case ES_EVENT_TYPE_NOTIFY_RENAME:
+            return false;
+
+        default:
+            return untrackedScopes_.Covers(pathname);
+    }
+}
+
+std::string BxlObserver::GetTraceBufferPath()
+{
+    // CODESYNC: Public/Src/Engine/Processes/SandboxConnectionLinuxDetours.cs
+    return std::string(famPath_) + ".trace." + std::to_string(getpid());
+}
+
+void BxlObserver::InitTraceBuffer()
+{
+    // One ring per process, next to the FAM. Failing to open it is not an error: debug messages just go through the FIFO.
+    traceBuffer_.Open(GetTraceBufferPath().c_str());
+}
+
+void BxlObserver::reset_trace_buffer()
+{
+    if (useTraceBuffer_)
+    {
+        InitTraceBuffer();
+    }
+}
+
+std::string BxlObserver::GetAccessTracePath()
+{
+    // CODESYNC: Public/Src/Engine/Processes/SandboxConnectionLinuxDetours.cs
+    return std::string(famPath_) + ".accesses." + std::to_string(getpid());
+}
+
+void BxlObserver::InitAccessTrace()
+{
+    // One trace per process, next to the FAM. Unlike the other files next to the FAM, traces are not deleted when the pip is done.
+    accessTrace_.Open(GetAccessTracePath().c_str(), famPayload_, famLength_);
+}
+
+void BxlObserver::reset_access_trace()
+{
+    if (recordAccessTrace_)
+    {
+        InitAccessTrace();
+    }
+}
+
+void BxlObserver::begin_replay()
+{
+    // The replayed manifest may ask for traces, which the replaying process doesn't need: drop the ones it opened
+    sandboxLoggingEnabled_ = false;
+    if (traceBuffer_.IsValid())
+    {
+        traceBuffer_.Close();
+        real_unlink(GetTraceBufferPath().c_str());
+    }
+
+    useTraceBuffer_ = false;
+    if (accessTrace_.IsValid())
+    {
+        accessTrace_.Close();
+        real_unlink(GetAccessTracePath().c_str());
     }
+
+    recordAccessTrace_ = false;
 }
 
 void BxlObserver::InitDetoursLibPath()
@@ -109,24 +362,35 @@ void BxlObserver::InitFam(pid_t pid)
     // Store the value for future uses, as the environment might be cleared by the running process
     strlcpy(famPath_, famPath, PATH_MAX);
 
-    // read FAM
-    FILE *famFile = real_fopen(famPath_, "rb");
-    if (!famFile)
+    // Map the FAM rather than reading it: every process of the pip shares its pages through the page cache.
+    // The mapping is never unmapped, since the pip parses it in place and lives as long as this process.
+    int famFd = real_open(famPath_, O_RDONLY | O_CLOEXEC, 0);
+    if (famFd == -1)
     {
         _fatal("Could not open file '%s'; errno: %d", famPath_, errno);
     }
 
-    fseek(famFile, 0, SEEK_END);
-    long famLength = ftell(famFile);
-    rewind(famFile);
+    struct stat famStat;
+#if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
+    int famStatResult = real___fxstat(1, famFd, &famStat);
+#else
+    int famStatResult = real_fstat(famFd, &famStat);
+#endif
+    void *famPayload = famStatResult == 0 && famStat.st_size > 0
+        ? mmap(nullptr, famStat.st_size, PROT_READ, MAP_SHARED, famFd, 0)
+        : MAP_FAILED;
+    int mapErrno = errno;
+    real_close(famFd);
+    if (famPayload == MAP_FAILED)
+    {
+        _fatal("Could not map file '%s'; errno: %d", famPath_, mapErrno);
+    }
 
-    char *famPayload = (char *)malloc(famLength);
-    real_fread(famPayload, famLength, 1, famFile);
-    real_fclose(famFile);
+    famPayload_ = (const char *)famPayload;
+    famLength_ = famStat.st_size;
 
-    // create SandboxedPip (which parses FAM and throws on error)
-    pip_ = shared_ptr<SandboxedPip>(new SandboxedPip(pid, famPayload, famLength));
-    free(famPayload);
+    // create SandboxedPip (which parses FAM in place and throws on error)
+    pip_ = shared_ptr<SandboxedPip>(new SandboxedPip(pid, (const char *)famPayload, famStat.st_size, /* copyPayload */ false));
 
     // create sandbox
     sandbox_ = new Sandbox(0, Configuration::DetoursLinuxSandboxType);
@@ -138,66 +402,166 @@ void BxlObserver::InitFam(pid_t pid)
     }
 
     process_ = sandbox_->FindTrackedProcess(pid);
-    process_->SetPath(progFullPath_);
+    process_->SetPath(sandbox_->InternPath(progFullPath_, strlen(progFullPath_)));
     sandbox_->SetAccessReportCallback(HandleAccessReport);
 
+    IOHandler exitHandler(sandbox_);
+    exitHandler.SetProcess(process_);
+    exitHandler.CreateReportProcessExited(0, exitReport_, exitReport_.firstReport);
+    exitReportPath_ = process_->GetPath();
+
     sandboxLoggingEnabled_ = CheckEnableLinuxSandboxLogging(pip_->GetFamExtraFlags());
+    binaryReports_ = CheckEnableLinuxSandboxBinaryReports(pip_->GetFamExtraFlags());
+
+    // Report batching is opt-in, either for every report or only during report storms. The key destructor flushes (and releases)
+    // the batch of a terminating thread.
+    bool batchAllReports = CheckEnableLinuxSandboxReportBatching(pip_->GetFamExtraFlags());
+    adaptiveBatching_ = !batchAllReports && CheckAdaptiveReportBatching(pip_->GetFamExtraFlags());
+    batchReports_ = (batchAllReports || adaptiveBatching_) && pthread_key_create(&reportBatchKey_, ReleaseReportBatch) == 0;
+
+    profiler_.Initialize(CheckProfileDetours(pip_->GetFamExtraFlags()));
+
+    // Only summarize accesses when nothing gets enforced: a denied access must still be reported when it happens
+    aggregateReports_ = CheckAggregateLinuxAccessReports(pip_->GetFamExtraFlags()) && !CheckFailUnexpectedFileAccesses(pip_->GetFamFlags());
+
+    if (CheckShareReportCacheAcrossProcesses(pip_->GetFamExtraFlags()))
+    {
+        InitSharedReportCache();
+    }
+
+    useTraceBuffer_ = sandboxLoggingEnabled_ && CheckEnableLinuxSandboxTraceBuffer(pip_->GetFamExtraFlags());
+    if (useTraceBuffer_)
+    {
+        InitTraceBuffer();
+    }
+
+    recordAccessTrace_ = CheckRecordLinuxSandboxAccessTrace(pip_->GetFamExtraFlags());
+    if (recordAccessTrace_)
+    {
+        InitAccessTrace();
+    }
+
+    // Opened up front even by processes that never search PATH: whatever they create or remove must still invalidate searches
+    if (CheckCacheImagePathSearches(pip_->GetFamExtraFlags()))
+    {
+        InitPathSearchCache();
+    }
+
+    // Reporting every access means no scope is untracked
+    if (CheckFilterLinuxUntrackedScopes(pip_->GetFamExtraFlags()) && !CheckReportAllFileAccesses(pip_->GetFamFlags()))
+    {
+        InitUntrackedScopeFilter();
+    }
+
+    InitNoReparsePointScopeFilter();
+
+    // Processes count themselves once their image is loaded (see _bxl_linux_sandbox_init), but every image needs the counter:
+    // the audit library and the ptrace runner report exits too
+    if (CheckDetectLinuxProcessTreeCompletion(pip_->GetFamExtraFlags()))
+    {
+        InitProcessTree();
+    }
+
+    // Opened up front even by processes that never resolve a symlink: whatever they change must still invalidate what others cached
+    if (CheckCacheLinuxSymlinkResolution(pip_->GetFamExtraFlags()))
+    {
+        InitResolvedPathGenerations();
+    }
 }
 
 void BxlObserver::LogDebug(pid_t pid, const char *fmt, ...)
 {
     if (LogDebugEnabled())
     {
-        // Build an access report that represents the debug message
-        AccessReport debugReport = 
-        {
-            .operation          = kOpDebugMessage,
-            .pid                = pid,
-            .rootPid            = pip_->GetProcessId(),
-            .requestedAccess    = (int)RequestedAccess::Read,
-            .status             = FileAccessStatus::FileAccessStatus_Allowed,
-            .reportExplicitly   = 0,
-            .error              = 0,
-            .pipId              = pip_->GetPipId(),
-            .path               = {0},
-            .stats              = {0},
-            .isDirectory        = 0,
-            .shouldReport       = true,
-        };
-
-        va_list args;
-        va_start(args, fmt);
         // We (re)use the path for the debug message in order to not change the report format just for debugging
         // So we limit the message to MAXPATHLEN (~4k chars, which should be enough)
-        int numWritten = vsnprintf(debugReport.path, MAXPATHLEN, fmt, args);
+        char message[MAXPATHLEN];
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(message, MAXPATHLEN, fmt, args);
         va_end(args);
 
-        // Sanitize the debug message so we don't confuse the parser on managed code:
-        // Pipes (|) are used to delimit the message parts and we expect one line (\n) per report, so
-        // replace those occurrences with something else.
-        for (int i = 0 ; i < MAXPATHLEN; i++)
+        SendDebugMessage(pid, message);
+    }
+}
+
+void BxlObserver::SendDebugMessage(pid_t pid, const char *message)
+{
+    if (traceBuffer_.IsValid())
+    {
+        // Messages in the ring are lines, they are not parsed as reports
+        traceBuffer_.Write(message, strnlen(message, MAXPATHLEN - 1));
+        return;
+    }
+
+    // Build an access report that represents the debug message
+    CompactAccessReport debugReport = 
+    {
+        .operation          = kOpDebugMessage,
+        .pid                = pid,
+        .rootPid            = pip_->GetProcessId(),
+        .requestedAccess    = (int)RequestedAccess::Read,
+        .status             = FileAccessStatus::FileAccessStatus_Allowed,
+        .reportExplicitly   = 0,
+        .error              = 0,
+        .pipId              = pip_->GetPipId(),
+        .stats              = {0},
+        .isDirectory        = 0,
+        .shouldReport       = true,
+        .pathOffset         = 0,
+        .pathLength         = 0,
+    };
+
+    char path[MAXPATHLEN];
+    size_t pathLength = strnlen(message, MAXPATHLEN - 1);
+    memcpy(path, message, pathLength);
+    path[pathLength] = '\0';
+
+    // Sanitize the debug message so we don't confuse the parser on managed code:
+    // Pipes (|) are used to delimit the message parts and we expect one line (\n) per report, so
+    // replace those occurrences with something else.
+    for (size_t i = 0 ; i < pathLength; i++)
+    {
+        if (path[i] == '|')
         {
-            if (debugReport.path[i] == '|')
-            {
-                debugReport.path[i] = '!';
-            }
-            
-            if (debugReport.path[i] == '\n' || debugReport.path[i] == '\r')
-            {
-                debugReport.path[i] = '.';
-            }
+            path[i] = '!';
+        }
+        
+        if (path[i] == '\n' || path[i] == '\r')
+        {
+            path[i] = '.';
         }
-
-        SendReport(debugReport, /* isDebugMessage */ true);
     }
+
+    SendReport(debugReport, path, pathLength, /* useSecondaryPipe */ false);
+}
+
+// Probes, reads and writes of a path share a single cache entry, keyed by this (not an event type), which holds
+// the strongest access requested so far (see CheckCache)
+static const uint32_t AccessStrengthClass = ES_EVENT_TYPE_LAST;
+
+// Each access implies all the weaker ones, the same way RequestedAccess does for CacheRecord on macOS
+enum AccessStrength : uint32_t
+{
+    AccessStrengthNone  = 0,
+    AccessStrengthProbe = 1,
+    AccessStrengthRead  = 2,
+    AccessStrengthWrite = 4,
+};
+
+static uint32_t ImpliedAccesses(uint32_t strength)
+{
+    return strength == AccessStrengthNone ? AccessStrengthNone : (strength << 1) - 1;
 }
 
 // Checks whether cache contains (event, path) pair and returns the result of this check.
-// If the pair is not in cache and addEntryIfMissing is true, attempts to add the pair to cache.
-bool BxlObserver::CheckCache(es_event_type_t event, const string &path, bool addEntryIfMissing)
+// If the pair is not in cache and addEntryIfMissing is true, attempts to add the pair to cache,
+// and to the cache shared by all processes of the pip as well if shareEntry is set.
+bool BxlObserver::CheckCache(es_event_type_t event, std::string_view path, bool addEntryIfMissing, bool shareEntry)
 {
     // coalesce some similar events
     es_event_type_t key;
+    uint32_t strength = AccessStrengthNone;
     switch (event)
     {
         case ES_EVENT_TYPE_NOTIFY_TRUNCATE:
@@ -212,6 +576,7 @@ bool BxlObserver::CheckCache(es_event_type_t event, const string &path, bool add
         case ES_EVENT_TYPE_NOTIFY_SETTIME:
         case ES_EVENT_TYPE_NOTIFY_SETACL:
             key = ES_EVENT_TYPE_NOTIFY_WRITE;
+            strength = AccessStrengthWrite;
             break;
 
         case ES_EVENT_TYPE_NOTIFY_GETATTRLIST:
@@ -220,48 +585,63 @@ bool BxlObserver::CheckCache(es_event_type_t event, const string &path, bool add
         case ES_EVENT_TYPE_NOTIFY_ACCESS:
         case ES_EVENT_TYPE_NOTIFY_STAT:
             key = ES_EVENT_TYPE_NOTIFY_STAT;
+            strength = AccessStrengthProbe;
+            break;
+
+        case ES_EVENT_TYPE_NOTIFY_OPEN:
+            key = event;
+            strength = AccessStrengthRead;
+            break;
 
         default:
             key = event;
             break;
     }
 
-    // This code could possibly be executing from an interrupt routine or from who knows where,
-    // so to avoid deadlocks it's essential to never block here indefinitely.
-    if (!cacheMtx_.try_lock_for(chrono::milliseconds(1)))
+    // The cache memory is gone once the singleton is disposed (see IsCacheHit)
+    if (disposed_)
     {
-        return false; // failed to acquire mutex -> forget about it
+        return false;
     }
 
-    // ============================== in the critical section ================================
+    // E.g., a stat of a path that was already opened is not reported again, since the open was a stronger access.
+    // The other events don't fit in that order and only dedup against themselves.
+    auto checkLocal = [&](bool add)
+    {
+        return strength == AccessStrengthNone
+            ? cache_.Check(key, path.data(), path.length(), add)
+            : cache_.CheckAccesses(AccessStrengthClass, path.data(), path.length(), strength, add ? ImpliedAccesses(strength) : AccessStrengthNone);
+    };
 
-    // make sure the mutex is released by the end
-    shared_ptr<timed_mutex> sp(&cacheMtx_, [](timed_mutex *mtx) { mtx->unlock(); });
+    // This code could possibly be executing from an interrupt routine or from who knows where,
+    // so it must never block: the cache is lock-free (see AccessCache), and so is the shared one (see SharedPathSet).
+    if (checkLocal(addEntryIfMissing))
+    {
+        return true;
+    }
 
-    unordered_map<es_event_type_t, unordered_set<string>>::iterator it = cache_.find(key);
-    if (it == cache_.end())
+    if (addEntryIfMissing)
     {
-        if (addEntryIfMissing) 
+        if (shareEntry)
         {
-            unordered_set<string> set;
-            set.insert(path);
-            cache_.insert(make_pair(key, set));
+            sharedReportCache_.TryAdd(key, path.data(), path.length());
         }
 
         return false;
     }
 
-    if (addEntryIfMissing) 
+    // Some other process of the pip already reported it: remember it locally, so the shared cache is only asked once.
+    // The shared cache is exact (keyed by the event class), so it never turns a weaker access into a hit for a stronger one.
+    if (sharedReportCache_.Contains(key, path.data(), path.length()))
     {
-        return !it->second.insert(path).second;
-    }
-    else 
-    {
-        return (it->second.find(path) != it->second.end());
+        checkLocal(/* add */ true);
+        return true;
     }
+
+    return false;
 }
 
-bool BxlObserver::IsCacheHit(es_event_type_t event, const string &path, const string &secondPath)
+bool BxlObserver::IsCacheHit(es_event_type_t event, std::string_view path, std::string_view secondPath)
 {
     // (1) IMPORTANT           : never do any of this stuff after this object has been disposed!
     //     WHY                 : because the cache date structure is invalid at that point.
@@ -277,107 +657,682 @@ bool BxlObserver::IsCacheHit(es_event_type_t event, const string &path, const st
         return false;
     }
 
-    return CheckCache(event, path, /* addEntryIfMissing */ false);
+    bool hit = CheckCache(event, path, /* addEntryIfMissing */ false);
+    if (hit)
+    {
+        profiler_.CountCacheHit();
+    }
+
+    return hit;
+}
+
+int BxlObserver::GetReportFd(bool useSecondaryPipe)
+{
+    std::atomic<int> &reportFd = useSecondaryPipe ? secondaryReportFd_ : reportFd_;
+    int fd = reportFd.load(std::memory_order_acquire);
+    if (fd != -1)
+    {
+        return fd;
+    }
+
+    if (!real_open)
+    {
+        _fatal("syscall 'open' not found; errno: %d", errno);
+    }
+
+    const char *reportsPath = useSecondaryPipe ? GetSecondaryReportsPath() : GetReportsPath();
+    int newFd = real_open(reportsPath, O_WRONLY | O_APPEND | O_CLOEXEC, 0);
+    if (newFd == -1)
+    {
+        _fatal("Could not open file '%s'; errno: %d", reportsPath, errno);
+    }
+
+    // Move the descriptor away from the low numbers. If this fails (e.g. a very low RLIMIT_NOFILE) we just keep the original one.
+    int highFd = real_fcntl(newFd, F_DUPFD_CLOEXEC, MIN_REPORT_FD);
+    if (highFd != -1)
+    {
+        real_close(newFd);
+        newFd = highFd;
+    }
+
+    // A handle was opened for our own internal purposes. That
+    // could have reused a fd where we missed a close, 
+    // so reset that entry in the fd table
+    reset_fd_table_entry(newFd);
+
+    // Another thread may have raced us opening the FIFO. In that case keep the winner's descriptor.
+    int expected = -1;
+    if (!reportFd.compare_exchange_strong(expected, newFd, std::memory_order_acq_rel))
+    {
+        real_close(newFd);
+        return expected;
+    }
+
+    return newFd;
+}
+
+void BxlObserver::RelocateReportFd(std::atomic<int> &reportFd, int fd, int minFd)
+{
+    int current = fd;
+    if (reportFd.load(std::memory_order_acquire) != fd)
+    {
+        return;
+    }
+
+    // The traced process is about to close/overwrite our descriptor. Keep a duplicate of it instead.
+    // If duplicating fails the descriptor is just forgotten, and it will be lazily reopened on the next report.
+    int moved = real_fcntl(fd, F_DUPFD_CLOEXEC, minFd);
+    if (!reportFd.compare_exchange_strong(current, moved, std::memory_order_acq_rel) && moved != -1)
+    {
+        real_close(moved);
+    }
+}
+
+void BxlObserver::ProtectReportFd(int fd)
+{
+    if (fd < 0)
+    {
+        return;
+    }
+
+    RelocateReportFd(reportFd_, fd);
+    RelocateReportFd(secondaryReportFd_, fd);
+}
+
+void BxlObserver::ProtectReportFdRange(int first, int last)
+{
+    // F_DUPFD fails for a minimum at or past RLIMIT_NOFILE, in which case the descriptor is just forgotten
+    int minFd = last == INT_MAX ? INT_MAX : std::max(last + 1, MIN_REPORT_FD);
+    for (std::atomic<int> *reportFd : { &reportFd_, &secondaryReportFd_ })
+    {
+        int fd = reportFd->load(std::memory_order_acquire);
+        if (fd >= first && fd <= last)
+        {
+            RelocateReportFd(*reportFd, fd, minFd);
+        }
+    }
+}
+
+bool BxlObserver::Send(const char *buf, size_t bufsiz, bool useSecondaryPipe)
+{
+    // Writes to a FIFO are only atomic up to PIPE_BUF bytes. Anything bigger has to be split in chunks
+    // the managed side reassembles.
+    return bufsiz <= PIPE_BUF
+        ? WriteToReportFd(buf, bufsiz, useSecondaryPipe)
+        : SendChunked(buf, bufsiz, useSecondaryPipe);
+}
+
+bool BxlObserver::SendChunked(const char *buf, size_t bufsiz, bool useSecondaryPipe)
+{
+    // 'buf' is a length-prefixed message. The chunks carry the message without its prefix: the chunk headers already
+    // contain its length.
+    const char *message = &buf[sizeof(uint)];
+    size_t messageLength = bufsiz - sizeof(uint);
+    const size_t maxChunkLength = PIPE_BUF - sizeof(ChunkHeader);
+
+    ChunkHeader header =
+    {
+        .marker         = CHUNKED_MESSAGE_MARKER,
+        .pid            = GetPid(),
+        .messageId      = nextChunkedMessageId_.fetch_add(1, std::memory_order_relaxed),
+        .messageLength  = (uint32_t)messageLength,
+        .offset         = 0,
+        .chunkLength    = 0,
+    };
+
+    char chunk[PIPE_BUF];
+    while (header.offset < messageLength)
+    {
+        header.chunkLength = std::min(maxChunkLength, messageLength - header.offset);
+        memcpy(chunk, &header, sizeof(header));
+        memcpy(&chunk[sizeof(header)], &message[header.offset], header.chunkLength);
+
+        WriteToReportFd(chunk, sizeof(header) + header.chunkLength, useSecondaryPipe);
+        header.offset += header.chunkLength;
+    }
+
+    return true;
+}
+
+bool BxlObserver::WriteToReportFd(const char *buf, size_t bufsiz, bool useSecondaryPipe)
+{
+    int logFd = GetReportFd(useSecondaryPipe);
+    ssize_t numWritten = real_write(logFd, buf, bufsiz);
+    if (numWritten == -1 && errno == EBADF)
+    {
+        // The descriptor was closed behind our back (e.g. with a raw close syscall we don't interpose).
+        // Forget about it and try once more with a freshly opened one.
+        std::atomic<int> &reportFd = useSecondaryPipe ? secondaryReportFd_ : reportFd_;
+        reportFd.compare_exchange_strong(logFd, -1, std::memory_order_acq_rel);
+        logFd = GetReportFd(useSecondaryPipe);
+        numWritten = real_write(logFd, buf, bufsiz);
+    }
+
+    if (numWritten < bufsiz)
+    {
+        _fatal("Wrote only %ld bytes out of %ld", numWritten, bufsiz);
+    }
+
+    return true;
+}
+
+bool BxlObserver::SendExitReport(pid_t pid)
+{
+    if (pid == 0)
+    {
+        AccessCache::Stats stats = cache_.GetStats();
+        LOG_DEBUG("Access cache stats: %llu hits, %llu misses, %llu contentions, %llu dropped, %llu evicted",
+            (unsigned long long)stats.hits, (unsigned long long)stats.misses, (unsigned long long)stats.contentions, (unsigned long long)stats.dropped,
+            (unsigned long long)stats.evictions);
+        LOG_DEBUG("Files checked for access: %llu evicted", FilesCheckedForAccess::GetInstance()->GetEvictionCount());
+        LOG_DEBUG("Report latency: %llu reports, %lluus median, %lluus 99th percentile, %lluus max",
+            (unsigned long long)reportLatency_.Count(), (unsigned long long)reportLatency_.Percentile(50),
+            (unsigned long long)reportLatency_.Percentile(99), (unsigned long long)reportLatency_.Max());
+
+        if (aggregateReports_)
+        {
+            // Reports still in the summary are sent along with the exit report below
+            ReportAggregator<CompactAccessReport>::Stats stats = reportAggregator_.GetStats();
+            LOG_DEBUG("Report aggregation: %llu accesses summarized, %llu reports sent so far",
+                (unsigned long long)stats.added, (unsigned long long)stats.drained);
+        }
+
+        if (adaptiveBatching_)
+        {
+            LOG_DEBUG("Adaptive report batching: %llu report storms", (unsigned long long)reportStorms_.Storms());
+        }
+
+        // Sent regardless of debug logging: asking for the profile is what ProfileDetours is for.
+        // Each entry reads "<function> <calls>/<reports>/<cache hits>/<ns>".
+        const char prefix[] = "Interposer profile: ";
+        for (const std::string &summary : profiler_.Summarize(MAXPATHLEN - sizeof(prefix)))
+        {
+            SendDebugMessage(GetPid(), (prefix + summary).c_str());
+        }
+    }
+
+    bool sent;
+    if (process_->GetPath() == exitReportPath_)
+    {
+        CompactAccessReport report = exitReport_.firstReport;
+        report.pid = pid == 0 ? GetPid() : pid;
+        sent = SendReport(report, exitReport_.PathOf(report), report.pathLength, /* useSecondaryPipe */ false);
+    }
+    else
+    {
+        AccessReportGroup report;
+        IOHandler handler(sandbox_);
+        handler.SetProcess(process_);
+        handler.CreateReportProcessExited(pid == 0 ? GetPid() : pid, report, report.firstReport);
+        sent = SendReport(report);
+    }
+
+    // Exits reported on behalf of another process come from its tracer, which may be reporting a thread
+    RemoveFromProcessTree(pid == 0 ? GetPid() : pid, /* isProcess */ pid == 0);
+
+    return sent;
+}
+
+void BxlObserver::RemoveFromProcessTree(pid_t pid, bool isProcess)
+{
+    if (!processTree_.IsValid())
+    {
+        return;
+    }
+
+    // Sending the exit report flushed whatever the process had staged, so nothing of it can arrive after the completion
+    if (processTree_.Remove(pid, isProcess))
+    {
+        SendProcessTreeCompletedReport();
+    }
+}
+
+void BxlObserver::claim_child_process(pid_t childPid)
+{
+    bool completed = childPid > 0 ? processTree_.Claim(childPid) : processTree_.Release();
+    if (completed)
+    {
+        SendProcessTreeCompletedReport();
+    }
+}
+
+void BxlObserver::release_process_tree()
+{
+    if (processTree_.Release())
+    {
+        SendProcessTreeCompletedReport();
+    }
+}
+
+void BxlObserver::SendProcessTreeCompletedReport()
+{
+    // Every other process of the pip sent its exit report before leaving the tree, so this one arrives after all of them
+    AccessReportGroup report;
+    IOHandler handler(sandbox_);
+    handler.SetProcess(process_);
+    handler.CreateReportProcessTreeCompleted(GetPid(), report, report.firstReport);
+    SendUnaggregatedReport(report.firstReport, report.PathOf(report.firstReport), report.firstReport.pathLength, /* useSecondaryPipe */ false);
+}
+
+static uint64_t GetMonotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool BxlObserver::SendReport(const AccessReportGroup &report)
+{
+    if (!report.firstReport.shouldReport || !report.secondReport.shouldReport)
+    {
+        const CompactAccessReport &single = report.firstReport.shouldReport ? report.firstReport : report.secondReport;
+        return single.shouldReport
+            ? SendReport(single, report.PathOf(single), single.pathLength, /* useSecondaryPipe */ false)
+            : true;
+    }
+
+    // Two-path operations (rename, link, copy_file_range, ...) report both paths. Build both reports in the same buffer
+    // so they go out in a single write: the managed side reads them back to back, and no other writer can get in between.
+    uint64_t start = GetMonotonicNs();
+    char buffer[PIPE_BUF];
+    size_t firstSize, secondSize;
+    if (report.firstReport.operation != FileOperation::kOpProcessTreeCompleted
+        && report.secondReport.operation != FileOperation::kOpProcessTreeCompleted
+        && BuildPrefixedReport(buffer, sizeof(buffer), report.firstReport, report.PathOf(report.firstReport), report.firstReport.pathLength, firstSize)
+        && BuildPrefixedReport(&buffer[firstSize], sizeof(buffer) - firstSize, report.secondReport, report.PathOf(report.secondReport), report.secondReport.pathLength, secondSize))
+    {
+        profiler_.CountReport();
+        profiler_.CountReport();
+        bool isProcessStartOrExit = IsProcessStartOrExit(report.firstReport) || IsProcessStartOrExit(report.secondReport);
+        return SendPrefixedReports(buffer, firstSize + secondSize, /* count */ 2, isProcessStartOrExit, start, /* useSecondaryPipe */ false);
+    }
+
+    // The pair doesn't fit in an atomic write: send the reports one at a time
+    bool result = SendReport(report.firstReport, report.PathOf(report.firstReport), report.firstReport.pathLength, /* useSecondaryPipe */ false);
+    result &= SendReport(report.secondReport, report.PathOf(report.secondReport), report.secondReport.pathLength, /* useSecondaryPipe */ false);
+    return result;
+}
+
+bool BxlObserver::SendReport(const AccessReport &report, bool useSecondaryPipe)
+{
+    return SendReport(CompactAccessReportHeader(report), report.path, strnlen(report.path, MAXPATHLEN), useSecondaryPipe);
+}
+
+bool BxlObserver::BuildPrefixedReport(char *buffer, size_t bufferSize, const CompactAccessReport &report, const char *path, size_t pathLength, size_t &size)
+{
+    const size_t PrefixLength = sizeof(uint);
+    size_t reportSize;
+
+    if (binaryReports_)
+    {
+        // The size of a binary report is known upfront, so there is no need to build it to find out whether it fits
+        reportSize = sizeof(BinaryReportHeader) + pathLength;
+        size = PrefixLength + reportSize;
+        if (size > bufferSize)
+        {
+            return false;
+        }
+
+        BuildBinaryReport(&buffer[PrefixLength], report, path, pathLength);
+    }
+    else
+    {
+        // snprintf returns the length the report needs (without the terminating null), which must fit too
+        int maxMessageLength = bufferSize > PrefixLength ? (int)(bufferSize - PrefixLength) : 0;
+        reportSize = BuildReport(&buffer[PrefixLength], maxMessageLength, report, path);
+        size = PrefixLength + reportSize;
+        if (size + 1 > bufferSize)
+        {
+            return false;
+        }
+    }
+
+    *(uint*)(buffer) = reportSize;
+    return true;
+}
+
+uint32_t BxlObserver::GetAggregationStrength(const CompactAccessReport &report)
+{
+    // Only allowed accesses that don't change anything are summarized. Anything else is reported when it happens: the managed side
+    // tracks outputs and the process tree from those reports, and needs them in order.
+    switch (report.operation)
+    {
+        case FileOperation::kOpMacLookup:
+        case FileOperation::kOpMacReadlink:
+        case FileOperation::kOpKAuthOpenDir:
+        case FileOperation::kOpKAuthReadFile:
+        case FileOperation::kOpKAuthVNodeRead:
+        case FileOperation::kOpKAuthVNodeProbe:
+            break;
+        default:
+            return 0;
+    }
+
+    if (report.status != FileAccessStatus::FileAccessStatus_Allowed || (report.requestedAccess & (DWORD)RequestedAccess::Write) != 0)
+    {
+        return 0;
+    }
+
+    // A read tells the most about a path, and a lookup the least
+    if (report.requestedAccess & (DWORD)RequestedAccess::Read)             return 5;
+    if (report.requestedAccess & (DWORD)RequestedAccess::Enumerate)        return 4;
+    if (report.requestedAccess & (DWORD)RequestedAccess::Probe)            return 3;
+    if (report.requestedAccess & (DWORD)RequestedAccess::EnumerationProbe) return 2;
+    return 1;
+}
+
+bool BxlObserver::AggregateReport(const CompactAccessReport &report, const char *path, size_t pathLength)
+{
+    uint32_t strength = GetAggregationStrength(report);
+    if (strength == 0)
+    {
+        return false;
+    }
+
+    switch (reportAggregator_.Add(report.pid, path, pathLength, strength, report))
+    {
+        case ReportAggregator<CompactAccessReport>::AddResult::Added:
+            return true;
+        case ReportAggregator<CompactAccessReport>::AddResult::Full:
+            FlushAggregatedReports();
+            return true;
+        default:
+            return false;
+    }
+}
+
+void BxlObserver::FlushAggregatedReports()
+{
+    if (!aggregateReports_)
+    {
+        return;
+    }
+
+    reportAggregator_.Drain([this](const CompactAccessReport &report, std::string_view path)
+    {
+        SendUnaggregatedReport(report, path.data(), path.length(), /* useSecondaryPipe */ false);
+    });
+}
+
+bool BxlObserver::SendReport(const CompactAccessReport &report, const char *path, size_t pathLength, bool useSecondaryPipe)
+{
+    if (aggregateReports_ && !useSecondaryPipe)
+    {
+        if (AggregateReport(report, path, pathLength))
+        {
+            return true;
+        }
+
+        // Summarized accesses must arrive before the exit report
+        if (IsProcessStartOrExit(report))
+        {
+            FlushAggregatedReports();
+        }
+    }
+
+    return SendUnaggregatedReport(report, path, pathLength, useSecondaryPipe);
+}
+
+bool BxlObserver::SendUnaggregatedReport(const CompactAccessReport &report, const char *path, size_t pathLength, bool useSecondaryPipe)
+{
+    // There is no central sandbox process here (i.e., there is an instance of this guy in every child process):
+    // only the last process of the pip to exit can tell the process tree is done, by keeping count of the live ones
+    // (see SendProcessTreeCompletedReport). Without that count, BuildXL finds out on its own.
+    if (report.operation == FileOperation::kOpProcessTreeCompleted && !processTree_.IsValid())
+    {
+        return true;
+    }
+
+    if (report.operation != FileOperation::kOpDebugMessage)
+    {
+        profiler_.CountReport();
+    }
+
+    uint64_t start = GetMonotonicNs();
+    char stackBuffer[PIPE_BUF];
+    // Only used when the report doesn't fit in PIPE_BUF. Such a report is sent in chunks.
+    std::unique_ptr<char[]> heapBuffer;
+    char *buffer = stackBuffer;
+    size_t totalSize;
+
+    if (!BuildPrefixedReport(buffer, sizeof(stackBuffer), report, path, pathLength, totalSize))
+    {
+        // Build it again in a buffer that fits (text reports need room for the terminating null)
+        heapBuffer.reset(new char[totalSize + 1]);
+        buffer = heapBuffer.get();
+        BuildPrefixedReport(buffer, totalSize + 1, report, path, pathLength, totalSize);
+    }
+
+    return SendPrefixedReports(buffer, totalSize, /* count */ 1, IsProcessStartOrExit(report), start, useSecondaryPipe);
+}
+
+bool BxlObserver::SendPrefixedReports(const char *buffer, size_t totalSize, size_t count, bool isProcessStartOrExit, uint64_t start, bool useSecondaryPipe)
+{
+    // Reports on the secondary pipe are consumed by the ptrace machinery, so they are never batched
+    if (batchReports_ && !useSecondaryPipe)
+    {
+        if (isProcessStartOrExit)
+        {
+            // Process start reports must arrive before any access of the new process, and exit reports after
+            // every access of the exiting one. In both cases flush whatever is staged and send the report right away.
+            FlushReports();
+        }
+        else if (!adaptiveBatching_ || IsInReportStorm(start))
+        {
+            return StageReport(buffer, totalSize, count);
+        }
+        else
+        {
+            // Reports this thread staged during a storm that is over go first
+            FlushOwnReportBatch();
+        }
+    }
+
+    bool result = Send(buffer, totalSize, useSecondaryPipe);
+    reportLatency_.Record((GetMonotonicNs() - start) / 1000, count);
+    return result;
+}
+
+BxlObserver::ReportBatch* BxlObserver::GetReportBatch()
+{
+    ReportBatch *batch = (ReportBatch *)pthread_getspecific(reportBatchKey_);
+    if (batch != nullptr)
+    {
+        return batch;
+    }
+
+    // Try to reuse a batch released by a thread that is already gone
+    for (ReportBatch *candidate = reportBatches_.load(std::memory_order_acquire); candidate != nullptr; candidate = candidate->next)
+    {
+        bool expected = false;
+        if (candidate->claimed.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+        {
+            batch = candidate;
+            break;
+        }
+    }
+
+    if (batch == nullptr)
+    {
+        batch = new (std::nothrow) ReportBatch();
+        if (batch == nullptr)
+        {
+            return nullptr;
+        }
+
+        batch->claimed.store(true, std::memory_order_relaxed);
+        batch->next = reportBatches_.load(std::memory_order_relaxed);
+        while (!reportBatches_.compare_exchange_weak(batch->next, batch, std::memory_order_acq_rel));
+    }
+
+    pthread_setspecific(reportBatchKey_, batch);
+    return batch;
 }
 
-bool BxlObserver::Send(const char *buf, size_t bufsiz, bool useSecondaryPipe)
+bool BxlObserver::StageReport(const char *buf, size_t bufsiz, size_t count)
 {
-    if (!real_open)
+    ReportBatch *batch = GetReportBatch();
+
+    // If we can't get hold of the batch (no memory, or we are re-entering from a signal handler while staging) just send the report right away
+    bool expected = false;
+    if (batch == nullptr || !batch->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire))
     {
-        _fatal("syscall 'open' not found; errno: %d", errno);
+        return Send(buf, bufsiz);
     }
 
-    // TODO: instead of failing, implement a critical section
+    // Chunked messages are never staged. Flush what we have first so the order is kept.
     if (bufsiz > PIPE_BUF)
     {
-        _fatal("Cannot atomically send a buffer whose size (%ld) is greater than PIPE_BUF (%d)", bufsiz, PIPE_BUF);
+        bool result = FlushReportBatch(batch) && Send(buf, bufsiz);
+        batch->inUse.store(false, std::memory_order_release);
+        return result;
     }
 
-    const char *reportsPath = useSecondaryPipe ? GetSecondaryReportsPath() : GetReportsPath();
-    int logFd = real_open(reportsPath, O_WRONLY | O_APPEND, 0);
-    if (logFd == -1)
+    bool result = true;
+    if (batch->length + bufsiz > PIPE_BUF)
     {
-        _fatal("Could not open file '%s'; errno: %d", reportsPath, errno);
+        result = FlushReportBatch(batch);
     }
 
-    ssize_t numWritten = real_write(logFd, buf, bufsiz);
-    if (numWritten < bufsiz)
+    uint64_t now = GetMonotonicNs();
+    if (batch->length == 0)
     {
-        _fatal("Wrote only %ld bytes out of %ld", numWritten, bufsiz);
+        batch->firstStagedNs = now;
     }
 
-    // A handle was opened for our own internal purposes. That
-    // could have reused a fd where we missed a close, 
-    // so reset that entry in the fd table
-    reset_fd_table_entry(logFd);
+    memcpy(&batch->data[batch->length], buf, bufsiz);
+    batch->length += bufsiz;
+    batch->count += count;
 
-    real_close(logFd);
+    if (now - batch->firstStagedNs >= REPORT_BATCH_MAX_DELAY_NS)
+    {
+        result &= FlushReportBatch(batch);
+    }
 
-    return true;
+    batch->inUse.store(false, std::memory_order_release);
+    return result;
 }
 
-bool BxlObserver::SendExitReport(pid_t pid)
+bool BxlObserver::FlushReportBatch(ReportBatch *batch)
 {
-    IOHandler handler(sandbox_);
-    handler.SetProcess(process_);
-    AccessReport report;
-    handler.CreateReportProcessExited(pid == 0 ? getpid() : pid, report);
-    return SendReport(report);
+    // The caller must hold 'inUse'. Staged records are complete length-prefixed reports, and the batch never
+    // exceeds PIPE_BUF, so the managed side sees the same stream it would get with one write per report.
+    if (batch->length == 0)
+    {
+        return true;
+    }
+
+    bool result = Send(batch->data, batch->length);
+    reportLatency_.Record((GetMonotonicNs() - batch->firstStagedNs) / 1000, batch->count);
+    batch->length = 0;
+    batch->count = 0;
+    return result;
 }
 
-bool BxlObserver::SendReport(const AccessReportGroup &report)
+bool BxlObserver::IsInReportStorm(uint64_t nowNs)
 {
-    bool result = report.firstReport.shouldReport 
-        ? SendReport(report.firstReport)
-        : true;
-
-    result &= report.secondReport.shouldReport
-        ? SendReport(report.secondReport)
-        : true;
+    if (reportStorms_.Record(nowNs) == ReportStormDetector::Transition::Left)
+    {
+        // What other threads staged would otherwise wait for their next report
+        FlushReportBatches();
+        return false;
+    }
 
-    return result;
+    return reportStorms_.InStorm();
 }
 
-bool BxlObserver::SendReport(const AccessReport &report, bool isDebugMessage, bool useSecondaryPipe)
+void BxlObserver::FlushOwnReportBatch()
 {
-    // there is no central sendbox process here (i.e., there is an instance of this
-    // guy in every child process), so counting process tree size is not feasible
-    if (report.operation == FileOperation::kOpProcessTreeCompleted)
+    ReportBatch *batch = (ReportBatch *)pthread_getspecific(reportBatchKey_);
+
+    // A busy batch means we are in a signal handler that interrupted staging: leave it to the interrupted code
+    bool expected = false;
+    if (batch != nullptr && batch->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire))
     {
-        return true;
+        FlushReportBatch(batch);
+        batch->inUse.store(false, std::memory_order_release);
     }
+}
+
+void BxlObserver::FlushReports()
+{
+    FlushAggregatedReports();
+    FlushReportBatches();
+}
 
-    const int PrefixLength = sizeof(uint);
-    char buffer[PIPE_BUF] = {0};
-    int maxMessageLength = PIPE_BUF - PrefixLength;
-    int reportSize = BuildReport(&buffer[PrefixLength], maxMessageLength, report, report.path);
+void BxlObserver::FlushReportBatches()
+{
+    if (!batchReports_)
+    {
+        return;
+    }
 
-    if (reportSize >= maxMessageLength)
+    ReportBatch *ownBatch = (ReportBatch *)pthread_getspecific(reportBatchKey_);
+    for (ReportBatch *batch = reportBatches_.load(std::memory_order_acquire); batch != nullptr; batch = batch->next)
     {
-        // For debug messages it is fine to truncate the message, otherwise, this is a problem and we must fail
-        if (!isDebugMessage)
+        bool expected = false;
+        while (!batch->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire))
         {
-            // TODO: once 'send' is capable of sending more than PIPE_BUF at once, allocate a bigger buffer and send that
-            _fatal("Message truncated to fit PIPE_BUF (%d): %s", PIPE_BUF, buffer);
+            // Our own batch can only be busy if we got here from a signal handler that interrupted staging. Spinning would never end.
+            if (batch == ownBatch)
+            {
+                break;
+            }
+
+            // Other threads only hold their batch for a memcpy or a single write
+            expected = false;
+            sched_yield();
         }
-        else
+
+        if (expected)
         {
-            // The report couldn't be fully built for a debug message. Let's crop the message (report.path) so it fits.
-            // We calculate the maximum size allowed, considering that 'path' is the last component of the
-            // message (plus the \n that ends any report, hence the -1), so it's the last thing 
-            // we tried to write when hitting the size limit.
-            int truncatedSize = strlen(report.path) - (reportSize - maxMessageLength) - 1;
-            char truncatedMessage[truncatedSize] = {0};
+            continue;
+        }
 
-            // Let's leave an ending \0
-            strncpy(truncatedMessage, report.path, truncatedSize - 1);
+        FlushReportBatch(batch);
+        batch->inUse.store(false, std::memory_order_release);
+    }
+}
 
-            reportSize = BuildReport(&buffer[PrefixLength], maxMessageLength, report, truncatedMessage);
-        }
+void BxlObserver::ReleaseReportBatch(void *data)
+{
+    ReportBatch *batch = (ReportBatch *)data;
+
+    bool expected = false;
+    while (!batch->inUse.compare_exchange_weak(expected, true, std::memory_order_acquire))
+    {
+        expected = false;
+        sched_yield();
     }
 
-    *(uint*)(buffer) = reportSize;
-    return Send(buffer, std::min(reportSize + PrefixLength, PIPE_BUF), useSecondaryPipe);
+    GetInstance()->FlushReportBatch(batch);
+    batch->inUse.store(false, std::memory_order_release);
+    batch->claimed.store(false, std::memory_order_release);
+}
+
+void BxlObserver::reset_report_batches()
+{
+    if (aggregateReports_)
+    {
+        reportAggregator_.Clear();
+    }
+
+    if (!batchReports_)
+    {
+        return;
+    }
+
+    // Only the forking thread survives in the child. Anything staged (including by the forking thread itself) was staged by
+    // the parent and will be flushed by it, so drop it all and let batches of non-existent threads be reused.
+    ReportBatch *ownBatch = (ReportBatch *)pthread_getspecific(reportBatchKey_);
+    for (ReportBatch *batch = reportBatches_.load(std::memory_order_acquire); batch != nullptr; batch = batch->next)
+    {
+        batch->length = 0;
+        batch->count = 0;
+        batch->firstStagedNs = 0;
+        batch->inUse.store(false, std::memory_order_relaxed);
+        batch->claimed.store(batch == ownBatch, std::memory_order_relaxed);
+    }
 }
 
 void BxlObserver::report_exec(const char *syscallName, const char *procName, const char *file, int error, mode_t mode, pid_t associatedPid)
@@ -395,36 +1350,34 @@ void BxlObserver::report_exec_args(pid_t pid)
     if (IsReportingProcessArgs())
     {
         char path[PATH_MAX] = { 0 };
-        int maxSize = PIPE_BUF + sizeof(uint) - 1;
-        char cmdLineBuffer[maxSize] = { 0 };
+        char cmdLineBuffer[PIPE_BUF];
         std::string cmdLine;
-        bool firstArg = true;
 
         // /proc/<pid>/cmdline has a set of arguments separated by the null terminator
         snprintf(path, PATH_MAX, "/proc/%d/cmdline", pid);
 
+        // The command line can be arbitrarily long (the report is sent in chunks if needed), so read it all
         int fd = open(path, O_RDONLY);
-        int bytesRead = read(fd, cmdLineBuffer, maxSize);
-        char *end = cmdLineBuffer + bytesRead;
+        ssize_t bytesRead;
+        while (fd != -1 && (bytesRead = read(fd, cmdLineBuffer, sizeof(cmdLineBuffer))) > 0)
+        {
+            cmdLine.append(cmdLineBuffer, bytesRead);
+        }
 
-        for (char *currentArg = cmdLineBuffer; currentArg < end; )
+        if (fd != -1)
         {
-            if (firstArg)
-            {
-                firstArg = false;
-            }
-            else
-            {
-                cmdLine.append(" ");
-            }
-            cmdLine.append(currentArg);
+            close(fd);
+        }
 
-            // Increment currentArg until the next null character is reached
-            while(*currentArg++);
+        // Replace the argument separators with spaces (the last argument is null terminated as well)
+        if (!cmdLine.empty() && cmdLine.back() == '\0')
+        {
+            cmdLine.pop_back();
         }
-        close(fd);
 
-        AccessReport report =
+        std::replace(cmdLine.begin(), cmdLine.end(), '\0', ' ');
+
+        CompactAccessReport report =
         {
             .operation        = kOpProcessCommandLine,
             .pid              = pid,
@@ -434,14 +1387,14 @@ void BxlObserver::report_exec_args(pid_t pid)
             .reportExplicitly = (int) ReportLevel::Report,
             .error            = 0,
             .pipId            = pip_->GetPipId(),
-            .path             = {0},
             .stats            = {0},
             .isDirectory      = 0,
             .shouldReport     = true,
+            .pathOffset       = 0,
+            .pathLength       = 0,
         };
 
-        strlcpy(report.path, cmdLine.c_str(), sizeof(report.path));
-        SendReport(report, /* isDebugMessage */ false, /* useSecondaryPipe */ false);
+        SendReport(report, cmdLine.c_str(), cmdLine.length(), /* useSecondaryPipe */ false);
     }
 }
 
@@ -479,12 +1432,15 @@ AccessCheckResult BxlObserver::create_access(const char *syscallName, es_event_t
 AccessCheckResult BxlObserver::create_access_internal(const char *syscallName, es_event_type_t eventType, const char *reportPath, const char *secondPath, AccessReportGroup &reportGroup, mode_t mode, bool checkCache, pid_t associatedPid)
 {
     secondPath = secondPath == nullptr ? empty_str_ : secondPath;  
-    if (checkCache && IsCacheHit(eventType, std::move(std::string(reportPath)), std::move(std::string(secondPath))))
+    if (checkCache && IsCacheHit(eventType, reportPath, secondPath))
     {
+        // Not getting to check_access must not keep a repeated creation or removal from invalidating searches
+        invalidate_path_searches(eventType, reportPath, secondPath);
         return sNotChecked;
     }
 
-    if (mode == 0)
+    bool modeObserved = mode == 0;
+    if (modeObserved)
     {
         // Mode hasn't been computed yet. Let's do it here.
         mode = get_mode(reportPath);
@@ -500,7 +1456,12 @@ AccessCheckResult BxlObserver::create_access_internal(const char *syscallName, e
         ? std::string(reportPath)
         : std::string(progFullPath_);
 
-    IOEvent event(associatedPid == 0 ? getpid() : associatedPid, 0, getppid(), eventType, ES_ACTION_TYPE_NOTIFY, std::move(std::string(reportPath)), std::move(std::string(secondPath)), std::move(execPath), mode, false);
+    IOEvent event(associatedPid == 0 ? GetPid() : associatedPid, 0, getppid(), eventType, ES_ACTION_TYPE_NOTIFY, std::move(std::string(reportPath)), std::move(std::string(secondPath)), std::move(execPath), mode, false);
+    if (modeObserved)
+    {
+        event.SetModeObserved();
+    }
+
     return create_access(syscallName, event, reportGroup, /* checkCache */ false /* because already checked cache above */);
 }
 
@@ -512,8 +1473,45 @@ void BxlObserver::report_access(const char *syscallName, IOEvent &event, bool ch
 }
 
 AccessCheckResult BxlObserver::create_access(const char *syscallName, IOEvent &event, AccessReportGroup &reportGroup, bool checkCache)
+{
+    if (!accessTrace_.IsValid())
+    {
+        return check_access(syscallName, event, reportGroup, checkCache);
+    }
+
+    uint64_t start = GetMonotonicNs();
+    AccessCheckResult result = check_access(syscallName, event, reportGroup, checkCache);
+    record_access(syscallName, event, checkCache, start, result);
+    return result;
+}
+
+void BxlObserver::record_access(const char *syscallName, const IOEvent &event, bool checkCache, uint64_t startNs, const AccessCheckResult &result)
+{
+    AccessTrace::Record record =
+    {
+        .timestampNs        = startNs,
+        .durationNs         = GetMonotonicNs() - startNs,
+        .pid                = GetPid(),
+        .tid                = (int32_t)syscall(SYS_gettid),
+        .checkCache         = checkCache,
+        .requestedAccess    = (uint32_t)result.Access,
+        .result             = (uint32_t)result.Result,
+        .reportLevel        = (uint32_t)result.Level,
+    };
+
+    size_t eventLength = event.SerializedSize();
+    std::unique_ptr<char[]> serializedEvent(new (std::nothrow) char[eventLength]);
+    if (serializedEvent != nullptr)
+    {
+        event.Serialize(serializedEvent.get(), eventLength);
+        accessTrace_.Append(record, syscallName, strlen(syscallName), serializedEvent.get(), eventLength);
+    }
+}
+
+AccessCheckResult BxlObserver::check_access(const char *syscallName, IOEvent &event, AccessReportGroup &reportGroup, bool checkCache)
 {
     es_event_type_t eventType = event.GetEventType();
+    invalidate_path_searches(eventType, event.GetSrcPath(), event.GetDstPath());
     
     if (checkCache && IsCacheHit(eventType, event.GetSrcPath(), event.GetDstPath()))
     {
@@ -527,7 +1525,7 @@ AccessCheckResult BxlObserver::create_access(const char *syscallName, IOEvent &e
     }
 
     AccessCheckResult result = sNotChecked;
-    pid_t pid = event.GetPid() == 0 ? getpid() : event.GetPid();
+    pid_t pid = event.GetPid() == 0 ? GetPid() : event.GetPid();
     bool accessShouldBeBlocked = false;
 
     if (IsEnabled(pid))
@@ -541,7 +1539,8 @@ AccessCheckResult BxlObserver::create_access(const char *syscallName, IOEvent &e
             // This access won't be blocked, so let's cache it.
             // We populate cache even if checkCache is false, but this should be ok.
             // We cache event types that are always a miss in IsCacheHit, but this also shoulld be fine.
-            CheckCache(eventType, event.GetSrcPath(), /* addEntryIfMissing */ true);
+            // Only allowed accesses are shared with the rest of the pip: a denied one is reported by every process that makes it.
+            CheckCache(eventType, event.GetSrcPath(), /* addEntryIfMissing */ true, /* shareEntry */ !result.ShouldDenyAccess());
         }
     }
 
@@ -552,6 +1551,138 @@ AccessCheckResult BxlObserver::create_access(const char *syscallName, IOEvent &e
     return result;
 }
 
+static void InvalidatePathSearchesForName(PathSearchCache &cache, std::string_view path)
+{
+    size_t lastSlash = path.find_last_of('/');
+    size_t nameStart = lastSlash == std::string_view::npos ? 0 : lastSlash + 1;
+    cache.InvalidateName(path.data() + nameStart, path.length() - nameStart);
+}
+
+void BxlObserver::invalidate_path_searches(es_event_type_t eventType, std::string_view path, std::string_view secondPath)
+{
+    if (!pathSearchCache_.IsValid())
+    {
+        return;
+    }
+
+    switch (eventType)
+    {
+        case ES_EVENT_TYPE_NOTIFY_CREATE:
+        case ES_EVENT_TYPE_NOTIFY_UNLINK:
+        case ES_EVENT_TYPE_NOTIFY_LINK:
+        case ES_EVENT_TYPE_NOTIFY_SETMODE:
+            // Only the name matters: the directory may be in some other PATH the name gets searched with
+            InvalidatePathSearchesForName(pathSearchCache_, path);
+            if (secondPath.length() > 0)
+            {
+                InvalidatePathSearchesForName(pathSearchCache_, secondPath);
+            }
+            break;
+
+        case ES_EVENT_TYPE_NOTIFY_RENAME:
+            // Only directory renames get here (a file rename is an unlink and a create), and they move every name under them
+            pathSearchCache_.InvalidateAll();
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Whether every entry of the given PATH value is rooted, so what a search finds doesn't depend on the working directory
+static bool IsRootedSearchPath(const char *searchPath)
+{
+    const char *entry = searchPath;
+    while (true)
+    {
+        if (*entry != '/')
+        {
+            return false;
+        }
+
+        const char *end = strchrnul(entry, ':');
+        if (*end == '\0')
+        {
+            return true;
+        }
+
+        entry = end + 1;
+    }
+}
+
+bool BxlObserver::search_path(const char *filename, mode_t &mode, std::string &path)
+{
+    const char *searchPath = getenv("PATH");
+    size_t nameLength = strlen(filename);
+    if (!pathSearchCache_.IsValid()
+        || searchPath == nullptr
+        || nameLength == 0
+        || nameLength > PathSearchCache::MAX_NAME_LENGTH
+        || strchr(filename, '/') != nullptr
+        || !IsRootedSearchPath(searchPath))
+    {
+        return resolve_filename_with_env(filename, mode, path);
+    }
+
+    mode = 0;
+    size_t searchPathLength = strlen(searchPath);
+    uint32_t foundIndex = PathSearchCache::NOT_FOUND;
+    mode_t foundMode = 0;
+    bool isRemembered = pathSearchCache_.TryGet(filename, nameLength, searchPath, searchPathLength, foundIndex, foundMode);
+    // Taken before searching, so a change made meanwhile keeps the outcome from being remembered
+    uint32_t generation = isRemembered ? 0 : pathSearchCache_.GetNameGeneration(filename, nameLength);
+
+    const char *entry = searchPath;
+    for (uint32_t index = 0; ; index++)
+    {
+        const char *end = strchrnul(entry, ':');
+        std::string candidate = std::string(entry, end - entry) + "/" + filename;
+
+        if (isRemembered)
+        {
+            // Report the probe the search made, so the same accesses get reported whether the search is remembered or not
+            bool isFound = index == foundIndex;
+            report_access("lstat", ES_EVENT_TYPE_NOTIFY_STAT, candidate.c_str(), isFound ? foundMode : 0, O_NOFOLLOW, isFound ? 0 : ENOENT);
+            if (isFound)
+            {
+                mode = foundMode;
+                path = std::move(candidate);
+                return true;
+            }
+        }
+        else
+        {
+            // Call the interposed stat instead of the real one here so we can report it back to the managed layer
+            struct stat buf;
+#if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
+            if (__lxstat(1, candidate.c_str(), &buf) == 0)
+#else
+            if (lstat(candidate.c_str(), &buf) == 0)
+#endif
+            {
+                mode = buf.st_mode;
+                pathSearchCache_.Add(filename, nameLength, searchPath, searchPathLength, generation, index, mode);
+                path = std::move(candidate);
+                return true;
+            }
+        }
+
+        if (*end == '\0')
+        {
+            break;
+        }
+
+        entry = end + 1;
+    }
+
+    if (!isRemembered)
+    {
+        pathSearchCache_.Add(filename, nameLength, searchPath, searchPathLength, generation, PathSearchCache::NOT_FOUND, 0);
+    }
+
+    return false;
+}
+
 void BxlObserver::report_access(const char *syscallName, es_event_type_t eventType, const char *pathname, mode_t mode, int flags, int error, bool checkCache, pid_t associatedPid)
 {
     // If the path is null or if we can't normalize it, we have no meaningful way of reporting this access
@@ -561,31 +1692,37 @@ void BxlObserver::report_access(const char *syscallName, es_event_type_t eventTy
         return;
     }
 
-    auto normalized = normalize_path(pathname, flags, associatedPid);
-    if (normalized.length() == 0) 
+    if (IsInUntrackedScope(eventType, pathname))
+    {
+        return;
+    }
+
+    char normalized[PATH_MAX];
+    if (normalize_path_at(AT_FDCWD, pathname, normalized, flags, associatedPid) == 0) 
     {
         LOG_DEBUG("Couldn't normalize path %s", pathname);
         return;
     }
 
-    report_access_internal(syscallName, eventType, normalized.c_str(), /*secondPath*/ nullptr , mode, error, checkCache, associatedPid);
+    report_access_internal(syscallName, eventType, normalized, /*secondPath*/ nullptr , mode, error, checkCache, associatedPid);
 }
 
 AccessCheckResult BxlObserver::create_access(const char *syscallName, es_event_type_t eventType, const char *pathname, AccessReportGroup &reportGroup, mode_t mode, int flags, bool checkCache, pid_t associatedPid)
 {
     // If the path is null or if we can't normalize it, we have no meaningful way of reporting this access
-    if (pathname == nullptr) 
+    if (pathname == nullptr || IsInUntrackedScope(eventType, pathname)) 
     {
         return sNotChecked;
     }
 
-    auto normalized = normalize_path(pathname, flags, associatedPid);
-    if (normalized.length() == 0)
+    // Stack buffers all the way to the cache check, so an access that was already reported allocates nothing
+    char normalized[PATH_MAX];
+    if (normalize_path_at(AT_FDCWD, pathname, normalized, flags, associatedPid) == 0)
     {
         return sNotChecked;
     }
 
-    return create_access_internal(syscallName, eventType, normalized.c_str(), /* secondPath */ nullptr, reportGroup, mode, checkCache, associatedPid);
+    return create_access_internal(syscallName, eventType, normalized, /* secondPath */ nullptr, reportGroup, mode, checkCache, associatedPid);
 }
 
 void BxlObserver::report_access_fd(const char *syscallName, es_event_type_t eventType, int fd, int error, pid_t associatedPid)
@@ -598,19 +1735,30 @@ void BxlObserver::report_access_fd(const char *syscallName, es_event_type_t even
 
 AccessCheckResult BxlObserver::create_access_fd(const char *syscallName, es_event_type_t eventType, int fd, AccessReportGroup &report, pid_t associatedPid)
 {   
+    if (associatedPid == 0 && is_fd_non_file(fd))
+    {
+        return sNotChecked;
+    }
+
     mode_t mode = get_mode(fd);
 
     // If this file descriptor is a non-file (e.g., a pipe, or socket, etc.) then we don't care about it
     if (is_non_file(mode))
     {
+        // Remember it, so chatty tools logging to stdout/stderr don't pay for an fstat on every call
+        if (associatedPid == 0 && useFdTable_)
+        {
+            fdTable_.SetFlag(fd, FdTable::NonFile);
+        }
+
         return sNotChecked; 
     }
 
-    std::string fullpath = fd_to_path(fd, associatedPid);
+    char fullpath[PATH_MAX];
 
     // Only reports when fd_to_path succeeded.
-    return fullpath.length() > 0
-        ? create_access_internal(syscallName, eventType, fullpath.c_str(), /* secondPath */ nullptr, report, mode, /* checkCache */ true, associatedPid)
+    return fd_to_path(fd, fullpath, associatedPid) > 0
+        ? create_access_internal(syscallName, eventType, fullpath, /* secondPath */ nullptr, report, mode, /* checkCache */ true, associatedPid)
         : sNotChecked;
 }
 
@@ -620,11 +1768,10 @@ bool BxlObserver::is_non_file(const mode_t mode)
     return mode != 0 && !S_ISDIR(mode) && !S_ISREG(mode) && !S_ISLNK(mode);
 }
 
-bool BxlObserver::is_anonymous_file(string path)
+bool BxlObserver::is_anonymous_file(std::string_view path)
 {
     // The path to an anonymous file reported by stat will always be '/memfd:<fileName> (deleted)'
-    // the length of the string prefix '/memfd:', 7, is used as the max for characters to compare in strncmp
-    return strncmp(path.c_str(), "/memfd:", 7) == 0;
+    return path.compare(0, 7, "/memfd:") == 0;
 }
 
 AccessCheckResult BxlObserver::create_access_at(const char *syscallName, es_event_type_t eventType, int dirfd, const char *pathname, AccessReportGroup &report, int flags, bool getModeWithFd, pid_t associatedPid)
@@ -655,8 +1802,6 @@ AccessCheckResult BxlObserver::create_access_at(const char *syscallName, es_even
     }
     else
     {
-        std::string dirPath;
-
         // If getModeWithFd is set, then we can call get_mode directly with the file descriptor instead of a path
         // If false, then use the provided associatedPid to convert the fd to a path and the get_mode on the path
         if (getModeWithFd)
@@ -665,8 +1810,8 @@ AccessCheckResult BxlObserver::create_access_at(const char *syscallName, es_even
         }
         else
         {
-            dirPath = fd_to_path(dirfd, associatedPid);
-            mode = get_mode(dirPath.c_str());
+            len = fd_to_path(dirfd, fullpath, associatedPid);
+            mode = get_mode(fullpath);
         }
 
         // If this file descriptor is a non-file (e.g., a pipe, or socket, etc.) then we don't care about it
@@ -675,13 +1820,10 @@ AccessCheckResult BxlObserver::create_access_at(const char *syscallName, es_even
             return sNotChecked;
         }
 
-        if (dirPath.empty())
+        if (len == 0)
         {
-            dirPath = fd_to_path(dirfd);
+            len = fd_to_path(dirfd, fullpath);
         }
-        
-        len = dirPath.length();
-        strcpy(fullpath, dirPath.c_str());
     }
 
     if (len <= 0)
@@ -701,30 +1843,28 @@ void BxlObserver::report_access_at(const char *syscallName, es_event_type_t even
     SendReport(report);
 }
 
-void BxlObserver::report_firstAllowWriteCheck(const char *fullPath)
+void BxlObserver::report_firstAllowWriteCheck(const char *fullPath, mode_t mode)
 {
-    mode_t mode = get_mode(fullPath);
     bool fileExists = mode != 0 && !S_ISDIR(mode);
      
-    AccessReport report =
+    CompactAccessReport report =
         {
             .operation        = kOpFirstAllowWriteCheckInProcess,
-            .pid              = getpid(),
+            .pid              = GetPid(),
             .rootPid          = pip_->GetProcessId(),
             .requestedAccess  = (int) RequestedAccess::Write,
             .status           = fileExists ? FileAccessStatus::FileAccessStatus_Denied : FileAccessStatus::FileAccessStatus_Allowed,
             .reportExplicitly = (int) ReportLevel::Report,
             .error            = 0,
             .pipId            = pip_->GetPipId(),
-            .path             = {0},
             .stats            = {0},
             .isDirectory      = (uint)S_ISDIR(mode),
-            .shouldReport     = true
+            .shouldReport     = true,
+            .pathOffset       = 0,
+            .pathLength       = 0,
         };
 
-    strlcpy(report.path, fullPath, sizeof(report.path));
-
-    SendReport(report);
+    SendReport(report, fullPath, strnlen(fullPath, MAXPATHLEN - 1), /* useSecondaryPipe */ false);
 
     AccessCheckResult result(RequestedAccess::Write, fileExists ? ResultAction::Deny : ResultAction::Allow, ReportLevel::Report);
 }
@@ -760,162 +1900,210 @@ bool BxlObserver::check_and_report_statically_linked_process(const char *path)
 
         // We force ptrace for this process. 
         // Send a "statically linked" report so that the managed side can track it.
-        AccessReport report =
+        if (!IsSeccompNotifySandboxEnabled() && !IsFanotifySandboxEnabled())
         {
-            .operation        = kOpStaticallyLinkedProcess,
-            .pid              = getpid(),
-            .rootPid          = pip_->GetProcessId(),
-            .requestedAccess  = (int) RequestedAccess::Read,
-            .status           = FileAccessStatus::FileAccessStatus_Allowed,
-            .reportExplicitly = (int) ReportLevel::Report,
-            .error            = 0,
-            .pipId            = pip_->GetPipId(),
-            .path             = {0},
-            .stats            = {0},
-            .isDirectory      = 0,
-            .shouldReport     = true,
-        };
+            report_statically_linked_process(path);
+        }
 
-        strlcpy(report.path, path, sizeof(report.path));
-        SendReport(report, /* isDebugMessage */ false, /* useSecondaryPipe */ true);
         return true;
     }
 
-    // Stat the path to get the last modified time of the path
-    // We need to do this because the executable file could be changed in between this stat and the previous stat
-    // If it was changed (has a different modified time), then we should run objdump on it once more
-    struct stat statbuf;
-#if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
-        real___lxstat(1, path, &statbuf);
-#else
-        real_lstat(path, &statbuf);
-#endif
+    bool isStaticallyLinked = is_statically_linked(path);
+
+    if (isStaticallyLinked)
+    {
+        // Allow this process to be traced by the daemon process
+        set_ptrace_permissions();
+
+        // The seccomp notification and fanotify supervisors are started by the process itself, so bxl doesn't need to launch a tracer.
+        // If the fanotify one can't be started, the report is sent right before falling back (see handle_exec_with_ptrace).
+        if (!IsSeccompNotifySandboxEnabled() && !IsFanotifySandboxEnabled())
+        {
+            report_statically_linked_process(path);
+        }
+    }
 
-    std::string key = std::to_string(statbuf.st_mtim.tv_sec);
-    key.append(":");
-    key.append(path);
+    return isStaticallyLinked;
+}
 
-    auto maybeProcess = std::find_if(
-        staticallyLinkedProcessCache_.begin(),
-        staticallyLinkedProcessCache_.end(),
-        [key](const std::pair<std::string, bool>& item) { return item.first == key; }
-    );
+void BxlObserver::report_statically_linked_process(const char *path)
+{
+    CompactAccessReport report =
+    {
+        .operation        = kOpStaticallyLinkedProcess,
+        .pid              = GetPid(),
+        .rootPid          = pip_->GetProcessId(),
+        .requestedAccess  = (int) RequestedAccess::Read,
+        .status           = FileAccessStatus::FileAccessStatus_Allowed,
+        .reportExplicitly = (int) ReportLevel::Report,
+        .error            = 0,
+        .pipId            = pip_->GetPipId(),
+        .stats            = {0},
+        .isDirectory      = 0,
+        .shouldReport     = true,
+        .pathOffset       = 0,
+        .pathLength       = 0,
+    };
+
+    SendReport(report, path, strnlen(path, MAXPATHLEN - 1), /* useSecondaryPipe */ true);
+}
 
-    bool isStaticallyLinked;
-    if (maybeProcess != staticallyLinkedProcessCache_.end())
+bool BxlObserver::IsSeccompNotifySandboxEnabled()
+{
+    if (!pip_ || !CheckEnableLinuxSeccompNotifySandbox(pip_->GetFamExtraFlags()))
     {
-        // Already checked this process
-        isStaticallyLinked = maybeProcess->second;
+        return false;
     }
-    else
+
+    // SECCOMP_RET_USER_NOTIF is available since 5.0, but the supervisor also relies on SECCOMP_USER_NOTIF_FLAG_CONTINUE (5.5)
+    // and on the notification fd signaling POLLHUP once every process using the filter is gone (5.8).
+    static const bool isSupported = []()
+    {
+        struct utsname name;
+        int major = 0, minor = 0;
+        if (uname(&name) == -1 || sscanf(name.release, "%d.%d", &major, &minor) != 2 || major < 5 || (major == 5 && minor < 8))
+        {
+            return false;
+        }
+
+        unsigned int action = SECCOMP_RET_USER_NOTIF;
+        return syscall(SYS_seccomp, SECCOMP_GET_ACTION_AVAIL, 0, &action) == 0;
+    }();
+
+    return isSupported;
+}
+
+bool BxlObserver::IsFanotifySandboxEnabled()
+{
+    // Accesses are only observed after the fact, so it can't be used when unexpected accesses must be blocked
+    return pip_ && CheckEnableLinuxFanotifySandbox(pip_->GetFamExtraFlags()) && !IsFailingUnexpectedAccesses();
+}
+
+void BxlObserver::set_ptrace_permissions()
+{
+    // This should happen before sending a kOpStaticallyLinkedProcess report to bxl because it will signal bxl to launch the tracer.
+    if (prctl(PR_SET_PTRACER, PR_SET_PTRACER_ANY) == -1)
+    {
+        std::cerr << "[BuildXL] Failed to allow ptrace for process " << getpid() << ": " << strerror(errno) << "\n";
+        // This process is going to fail anyways when the tracer fails to attach, so we should exit here with a bad exit code.
+        // Interposed exit here is used on purpose to inform bxl this process should be removed from its process table.
+        exit(-1);
+    }
+}
+
+// Inspects the ELF headers of the provided path to determine whether the binary is statically linked.
+// Results are cached by file identity (see ExecutableId).
+bool BxlObserver::is_statically_linked(const char *path)
+{
+    int fd = real_open(path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1)
     {
-        isStaticallyLinked = is_statically_linked(path);
-        staticallyLinkedProcessCache_.push_back(std::make_pair(key, isStaticallyLinked));
+        // The exec is going to fail anyway
+        return false;
     }
 
-    if (isStaticallyLinked)
+    struct stat statbuf;
+#if (__GLIBC__ == 2 && __GLIBC_MINOR__ < 33)
+    int statResult = real___fxstat(1, fd, &statbuf);
+#else
+    int statResult = real_fstat(fd, &statbuf);
+#endif
+    if (statResult != 0 || !S_ISREG(statbuf.st_mode))
     {
-        // Allow this process to be traced by the daemon process
-        set_ptrace_permissions();
+        real_close(fd);
+        return false;
+    }
+
+    // The file is stat'ed through the same descriptor its contents are read from, so the identity we cache always matches
+    // what was inspected, even if the path gets replaced concurrently
+    ExecutableId id = { statbuf.st_dev, statbuf.st_ino, statbuf.st_mtim.tv_sec, statbuf.st_mtim.tv_nsec };
 
-        AccessReport report =
+    // To avoid deadlocks never block here indefinitely. Failing to acquire the lock just means we don't use the cache.
+    if (staticallyLinkedProcessCacheMtx_.try_lock_for(chrono::milliseconds(1)))
+    {
+        auto cached = staticallyLinkedProcessCache_.find(id);
+        if (cached != staticallyLinkedProcessCache_.end())
         {
-            .operation        = kOpStaticallyLinkedProcess,
-            .pid              = getpid(),
-            .rootPid          = pip_->GetProcessId(),
-            .requestedAccess  = (int) RequestedAccess::Read,
-            .status           = FileAccessStatus::FileAccessStatus_Allowed,
-            .reportExplicitly = (int) ReportLevel::Report,
-            .error            = 0,
-            .pipId            = pip_->GetPipId(),
-            .path             = {0},
-            .stats            = {0},
-            .isDirectory      = 0,
-            .shouldReport     = true,
-        };
+            bool result = cached->second;
+            staticallyLinkedProcessCacheMtx_.unlock();
+            real_close(fd);
+            return result;
+        }
 
-        strlcpy(report.path, path, sizeof(report.path));
+        staticallyLinkedProcessCacheMtx_.unlock();
+    }
 
-        SendReport(report, /* isDebugMessage */ false, /* useSecondaryPipe */ true);
+    // Some other process of the pip may have already inspected this binary
+    bool isStaticallyLinked = false;
+    if (sharedStaticLinkingCache_.TryGet(id, isStaticallyLinked))
+    {
+        real_close(fd);
+        return isStaticallyLinked;
     }
 
-    return isStaticallyLinked;
-}
+    // Only the headers are looked at, so mapping the file doesn't actually read most of it
+    if (statbuf.st_size > 0)
+    {
+        void *image = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (image != MAP_FAILED)
+        {
+            isStaticallyLinked = is_elf_statically_linked((const char *)image, statbuf.st_size);
+            munmap(image, statbuf.st_size);
+        }
+    }
 
-void BxlObserver::set_ptrace_permissions()
-{
-    // This should happen before sending a kOpStaticallyLinkedProcess report to bxl because it will signal bxl to launch the tracer.
-    if (prctl(PR_SET_PTRACER, PR_SET_PTRACER_ANY) == -1)
+    real_close(fd);
+
+    sharedStaticLinkingCache_.Add(id, isStaticallyLinked);
+    if (staticallyLinkedProcessCacheMtx_.try_lock_for(chrono::milliseconds(1)))
     {
-        std::cerr << "[BuildXL] Failed to allow ptrace for process " << getpid() << ": " << strerror(errno) << "\n";
-        // This process is going to fail anyways when the tracer fails to attach, so we should exit here with a bad exit code.
-        // Interposed exit here is used on purpose to inform bxl this process should be removed from its process table.
-        exit(-1);
+        staticallyLinkedProcessCache_[id] = isStaticallyLinked;
+        staticallyLinkedProcessCacheMtx_.unlock();
     }
+
+    return isStaticallyLinked;
 }
 
-// Executes objdump against the provided path to determine whether the binary is statically linked.
-bool BxlObserver::is_statically_linked(const char *path)
+void BxlObserver::disable_fd_table()
 {
-    std::string result;
-    int pipefd[2];
-    char mutablePath[PATH_MAX];
-
-    pipe(pipefd);
-
-    pid_t objDumpChild = real_fork();
+    useFdTable_ = false;
+}
 
-    if (objDumpChild == 0)
+void BxlObserver::close_all_fds_except(int fd)
+{
+    std::vector<int> keep = { fd, GetReportFd(/* useSecondaryPipe */ false) };
+    if (!is_null_or_empty(GetSecondaryReportsPath()))
     {
-        // Child process to execute objdump
-        real_close(pipefd[0]);    // close reading end in the child
-        real_dup2(pipefd[1], 1);  // send stdout to the pipe
-        real_dup2(pipefd[1], 2);  // send stderr to the pipe
-        real_close(pipefd[1]);    // this descriptor is no longer needed
+        keep.push_back(GetReportFd(/* useSecondaryPipe */ true));
+    }
 
-        char *args[] = {"", "-p", (char *)path, NULL};
-        char *envp[] = { NULL};
+    std::sort(keep.begin(), keep.end());
+    keep.push_back(INT_MAX);
 
-        real_execvpe("/usr/bin/objdump", args, envp);
+    // Without close_range (Linux 5.9+) every descriptor below the limit gets closed one by one. The limit can't be raised past
+    // fs.nr_open, which defaults to 2^20.
+    struct rlimit limit;
+    int maxFd = getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)(1 << 20) ? (int)limit.rlim_cur - 1 : (1 << 20) - 1;
 
-        real__exit(1); // If exec was successful then we should never reach this
-    }
-    else
+    int first = 0;
+    for (int kept : keep)
     {
-        char buffer[4096];
-        real_close(pipefd[1]);  // close the write end of the pipe in the parent
-
-        while (true)
+        if (kept > first)
         {
-            auto bytesRead = read(pipefd[0], buffer, sizeof(buffer)-1);
-            if (bytesRead == 0)
+            int last = kept - 1;
+            if (!real_close_range || real_close_range(first, last, 0) == -1)
             {
-                break;
+                for (int current = first; current <= std::min(last, maxFd); current++)
+                {
+                    real_close(current);
+                }
             }
 
-            buffer[bytesRead] = '\0';
-            result.append(buffer);
+            reset_fd_table_range(first, last);
         }
 
-        // We need to waitpid on the child to allow the OS to release resources for a terminated child
-        // We don't care about the result of the objdump process here, just need to waitpid to ensure proper cleanup
-        int status;
-        waitpid(objDumpChild, &status, 0);
+        first = std::max(first, kept + 1);
     }
-
-    bool isStaticallyLinked = false;
-    // Objdump should be able to dump the headers for any binary
-    // If it doesn't show this output, then the file does not exist, or is not a binary
-    std::string objDumpExeFound = "Program Header:";
-    // This output confirms that the dynamic section in objdump contains libc
-    std::string objDumpOutput = "NEEDED               libc.so.";
-
-    return result.find(objDumpExeFound) != std::string::npos && result.find(objDumpOutput) == std::string::npos;
-}
-
-void BxlObserver::disable_fd_table()
-{
-    useFdTable_ = false;
 }
 
 ssize_t BxlObserver::read_path_for_fd(int fd, char *buf, size_t bufsiz, pid_t associatedPid)
@@ -934,54 +2122,163 @@ ssize_t BxlObserver::read_path_for_fd(int fd, char *buf, size_t bufsiz, pid_t as
     return real_readlink(procPath, buf, bufsiz);
 }
 
-void BxlObserver::reset_fd_table_entry(int fd)
+char *BxlObserver::getcurrentworkingdirectory(char *fullpath, size_t size, pid_t associatedPid)
 {
-    if (fd >= 0 && fd < MAX_FD)
+    if (associatedPid != 0)
+    {
+        // Tracees don't go through our chdir, so their working directory is always read from /proc
+        char linkPath[100] = {0};
+        sprintf(linkPath, "/proc/%d/cwd", associatedPid);
+        ssize_t length = real_readlink(linkPath, fullpath, size - 1);
+        if (length == -1)
+        {
+            return NULL;
+        }
+
+        fullpath[length] = '\0';
+        return fullpath;
+    }
+
+    uint64_t generation = 0;
+    if (cwdMtx_.try_lock_for(chrono::milliseconds(1)))
+    {
+        if (cwdCacheDisabled_)
+        {
+            cwdMtx_.unlock();
+            return getcwd(fullpath, size);
+        }
+
+        if (cwdValid_ && cwd_.length() < size)
+        {
+            strcpy(fullpath, cwd_.c_str());
+            cwdMtx_.unlock();
+            return fullpath;
+        }
+
+        generation = cwdGeneration_;
+        cwdMtx_.unlock();
+    }
+    else
+    {
+        return getcwd(fullpath, size);
+    }
+
+    if (getcwd(fullpath, size) == NULL)
+    {
+        return NULL;
+    }
+
+    if (cwdMtx_.try_lock_for(chrono::milliseconds(1)))
     {
-        fdTable_[fd] = empty_str_;
+        // A chdir in between means what we just read may already be stale
+        if (generation == cwdGeneration_)
+        {
+            cwd_.assign(fullpath);
+            cwdValid_ = true;
+        }
+
+        cwdMtx_.unlock();
     }
+
+    return fullpath;
+}
+
+void BxlObserver::invalidate_cwd(bool disableCache)
+{
+    // This one has to go through: a stale working directory would misreport every relative path from now on
+    std::lock_guard<std::timed_mutex> lock(cwdMtx_);
+    cwdValid_ = false;
+    cwdCacheDisabled_ |= disableCache;
+    cwdGeneration_++;
+}
+
+void BxlObserver::reset_fd_table_entry(int fd)
+{
+    fdTable_.Reset(fd);
+}
+
+void BxlObserver::reset_fd_table_range(int first, int last)
+{
+    fdTable_.ResetRange(first, last);
 }
 
 void BxlObserver::reset_fd_table()
 {
-    for (int i = 0; i < MAX_FD; i++)
+    fdTable_.Clear();
+}
+
+void BxlObserver::prepare_fork()
+{
+#ifdef ENABLE_INTERPOSING
+    if (&__libc_single_threaded == nullptr || !__libc_single_threaded)
+    {
+        RealFunctionSlot::ResolveAll();
+    }
+#endif
+}
+
+bool BxlObserver::begin_vfork()
+{
+    if (&__libc_single_threaded == nullptr || !__libc_single_threaded)
     {
-        fdTable_[i] = empty_str_;
+        return false;
     }
+
+    // The child shares our report batch: leave it empty, so whatever the child stages is only its own.
+    // It shares our cached pid too, which must not be used until we resume.
+    FlushReports();
+    invalidate_pid();
+    return true;
+}
+
+void BxlObserver::end_vfork()
+{
+    // The child is done (it exec'ed or exited). Send the reports it staged in the batch we share (begin_vfork left it empty,
+    // so they are only the child's), then drop the cached state it may have changed: descriptors, working directory and pid.
+    FlushReports();
+    reset_fd_table();
+    invalidate_cwd();
+    refresh_pid();
+}
+
+void BxlObserver::duplicate_fd_table_entry(int oldfd, int newfd)
+{
+    fdTable_.Duplicate(oldfd, newfd);
 }
 
 std::string BxlObserver::fd_to_path(int fd, pid_t associatedPid)
 {
-    char path[PATH_MAX] = {0};
+    char path[PATH_MAX];
+    fd_to_path(fd, path, associatedPid);
+    return path;
+}
 
-    // ignore if fd is out of range
-    if (fd < 0 || fd >= MAX_FD)
+size_t BxlObserver::fd_to_path(int fd, char *path, pid_t associatedPid)
+{
+    // check the file descriptor table
+    if (useFdTable_ && fdTable_.Get(fd, path, PATH_MAX))
     {
-        read_path_for_fd(fd, path, PATH_MAX, associatedPid);
-        return path;
+        return strlen(path);
     }
 
-    if (useFdTable_)
+    // read from the filesystem and update the file descriptor table
+    ssize_t result = read_path_for_fd(fd, path, PATH_MAX - 1, associatedPid);
+    if (result == -1)
     {
-        // check the file descriptor table
-        if (fdTable_[fd].length() > 0)
-        {
-            return fdTable_[fd];
-        }
+        path[0] = '\0';
+        return 0;
     }
 
-    // read from the filesystem and update the file descriptor table
-    ssize_t result = read_path_for_fd(fd, path, PATH_MAX, associatedPid);
-    if (result != -1)
+    // readlink doesn't null-terminate
+    path[result] = '\0';
+
+    // Only cache if read_path_for_fd succeeded.
+    if (useFdTable_)
     {
-        // Only cache if read_path_for_fd succeeded.
-        if (useFdTable_)
-        {
-            fdTable_[fd] = path;
-        }
+        fdTable_.Set(fd, path);
     }
 
-    return path;
+    return result;
 }
 
 void BxlObserver::report_intermediate_symlinks(const char *pathname, pid_t associatedPid)
@@ -1002,6 +2299,13 @@ void BxlObserver::report_intermediate_symlinks(const char *pathname, pid_t assoc
 }
 
 std::string BxlObserver::normalize_path_at(int dirfd, const char *pathname, int oflags, pid_t associatedPid)
+{
+    char normalized[PATH_MAX];
+    normalize_path_at(dirfd, pathname, normalized, oflags, associatedPid);
+    return normalized;
+}
+
+size_t BxlObserver::normalize_path_at(int dirfd, const char *pathname, char *normalized, int oflags, pid_t associatedPid)
 {
     // Observe that dirfd is assumed to point to a directory file descriptor. Under that assumption, it is safe to call fd_to_path for it.
     // TODO: If we wanted to be very defensive, we could also consider the case of some tool invoking any of the *at(... dirfd ...) family with a 
@@ -1011,16 +2315,15 @@ std::string BxlObserver::normalize_path_at(int dirfd, const char *pathname, int
     // no pathname given --> read path for dirfd
     if (pathname == nullptr)
     {
-        return fd_to_path(dirfd, associatedPid);
+        return fd_to_path(dirfd, normalized, associatedPid);
     }
 
-    char fullPath[PATH_MAX] = {0};
-    relative_to_absolute(pathname, dirfd, associatedPid, fullPath);    
+    relative_to_absolute(pathname, dirfd, associatedPid, normalized);    
 
     bool followFinalSymlink = (oflags & O_NOFOLLOW) == 0;
-    resolve_path(fullPath, followFinalSymlink, associatedPid);
+    resolve_path(normalized, followFinalSymlink, associatedPid);
 
-    return fullPath;
+    return strlen(normalized);
 }
 
 void BxlObserver::relative_to_absolute(const char *pathname, int dirfd, int associatedPid, char *fullpath)
@@ -1040,9 +2343,7 @@ void BxlObserver::relative_to_absolute(const char *pathname, int dirfd, int asso
         }
         else
         {
-            std::string dirPath = fd_to_path(dirfd, associatedPid);
-            len = dirPath.length();
-            strcpy(fullpath, dirPath.c_str());
+            len = fd_to_path(dirfd, fullpath, associatedPid);
         }
 
         if (len <= 0)
@@ -1082,7 +2383,29 @@ void BxlObserver::resolve_path(char *fullpath, bool followFinalSymlink, pid_t as
         return;
     }
 
+    // Same as the resolved path cache, chains are not used on behalf of tracees (see readlink_cached)
+    bool useChains = associatedPid == 0 && resolvedPathGenerations_.IsValid();
+    char original[PATH_MAX];
+    size_t chainHash = 0;
+    uint64_t chainGeneration = resolvedPathGenerations_.GetChainGeneration();
+    if (useChains)
+    {
+        size_t length = strlen(fullpath);
+        chainHash = std::hash<std::string_view>{}(std::string_view(fullpath, length)) ^ (size_t)followFinalSymlink;
+        if (hasResolvedChains_.load(std::memory_order_relaxed) && try_get_resolved_chain(fullpath, length, chainHash, followFinalSymlink))
+        {
+            return;
+        }
+
+        memcpy(original, fullpath, length + 1);
+    }
+
+    bool crossedSymlink = false;
     unordered_set<string> visited;
+    // Whether the part of the path resolved so far is under a cone the manifest marks as free of symlinks (see FileAccessPolicy_NoReparsePointsInCone).
+    // Only ".." can take the path back out of it: nothing inside is a symlink, so it is never replaced by a symlink target.
+    bool checkNoReparsePointScopes = !noReparsePointScopes_.IsEmpty();
+    bool inNoReparsePointScope = false;
 
     char readlinkBuf[PATH_MAX];
     char *pFullpath = fullpath + 1;
@@ -1114,6 +2437,7 @@ void BxlObserver::resolve_path(char *fullpath, bool followFinalSymlink, pid_t as
                 int shiftLen = pFullpath - pPrevSlash;
                 shift_left(pFullpath + 1, shiftLen);
                 pFullpath = pPrevSlash + 1;
+                inNoReparsePointScope = false;
                 continue;
             }
         }
@@ -1124,7 +2448,11 @@ void BxlObserver::resolve_path(char *fullpath, bool followFinalSymlink, pid_t as
         if (*pFullpath == '/' || (*pFullpath == '\0' && followFinalSymlink))
         {
             *pFullpath = '\0';
-            nReadlinkBuf = real_readlink(fullpath, readlinkBuf, PATH_MAX);
+            inNoReparsePointScope = inNoReparsePointScope || (checkNoReparsePointScopes && noReparsePointScopes_.Covers(fullpath));
+            if (!inNoReparsePointScope)
+            {
+                nReadlinkBuf = readlink_cached(fullpath, readlinkBuf, PATH_MAX, associatedPid);
+            }
             *pFullpath = ch;
         }
 
@@ -1148,8 +2476,16 @@ void BxlObserver::resolve_path(char *fullpath, bool followFinalSymlink, pid_t as
         // report readlink for the current path
         *pFullpath = '\0';
         // break if the same symlink has already been visited (breaks symlink loops)
-        if (!visited.insert(fullpath).second) break;
+        if (!visited.insert(fullpath).second)
+        {
+            useChains = false;
+            break;
+        }
+
         report_access_internal("_readlink", ES_EVENT_TYPE_NOTIFY_READLINK, fullpath, /* secondPath */ (const char *)nullptr, /* mode */ 0, /* error */ 0, /* checkCache */ true, associatedPid);
+        // Only a chain whose reports the cache would drop can be skipped next time
+        useChains = useChains && CheckCache(ES_EVENT_TYPE_NOTIFY_READLINK, fullpath, /* addEntryIfMissing */ false);
+        crossedSymlink = true;
         *pFullpath = ch;
 
         // append the rest of the original path to the readlink target
@@ -1169,6 +2505,170 @@ void BxlObserver::resolve_path(char *fullpath, bool followFinalSymlink, pid_t as
         pFullpath = find_prev_slash(pFullpath);
         strcpy(++pFullpath, readlinkBuf);
     }
+
+    if (useChains && crossedSymlink)
+    {
+        add_resolved_chain(original, chainHash, fullpath, followFinalSymlink, chainGeneration);
+    }
+}
+
+bool BxlObserver::try_get_resolved_chain(char *fullpath, size_t length, size_t hash, bool followFinalSymlink)
+{
+    uint64_t generation = resolvedPathGenerations_.GetChainGeneration();
+
+    // Never block on the cache: if somebody else holds the lock, just resolve the path
+    if (!resolvedChainsMtx_.try_lock())
+    {
+        return false;
+    }
+
+    bool found = false;
+    auto it = resolvedChains_.find(hash);
+    if (it != resolvedChains_.end()
+        && it->second.generation == generation
+        && it->second.followFinalSymlink == followFinalSymlink
+        && it->second.path == std::string_view(fullpath, length))
+    {
+        memcpy(fullpath, it->second.resolved.c_str(), it->second.resolved.length() + 1);
+        found = true;
+    }
+
+    resolvedChainsMtx_.unlock();
+    return found;
+}
+
+void BxlObserver::add_resolved_chain(const char *path, size_t hash, const char *resolved, bool followFinalSymlink, uint64_t generation)
+{
+    if (!resolvedChainsMtx_.try_lock())
+    {
+        return;
+    }
+
+    // Stale entries are only replaced by the chains that hash the same, so start over once full
+    if (resolvedChains_.size() >= MAX_RESOLVED_CHAINS && resolvedChains_.find(hash) == resolvedChains_.end())
+    {
+        resolvedChains_.clear();
+    }
+
+    ResolvedChainEntry &entry = resolvedChains_[hash];
+    entry.path = path;
+    entry.resolved = resolved;
+    entry.followFinalSymlink = followFinalSymlink;
+    entry.generation = generation;
+
+    resolvedChainsMtx_.unlock();
+    hasResolvedChains_.store(true, std::memory_order_relaxed);
+}
+
+ssize_t BxlObserver::readlink_cached(const char *path, char *buf, size_t bufsiz, pid_t associatedPid)
+{
+    // A tracer resolves paths on behalf of its tracees, whose changes to the file system are not observed here
+    if (associatedPid != 0 || !resolvedPathGenerations_.IsValid())
+    {
+        return real_readlink(path, buf, bufsiz);
+    }
+
+    size_t length = strlen(path);
+    size_t hash = std::hash<std::string_view>{}(std::string_view(path, length));
+    // Taken before calling readlink: a change made in the meantime leaves what it read stale
+    uint64_t generation = resolvedPathGenerations_.GetPathGeneration(path, length);
+
+    // Never block on the cache: if somebody else holds the lock, just call readlink
+    if (resolvedPathsMtx_.try_lock())
+    {
+        auto it = resolvedPaths_.find(hash);
+        if (it != resolvedPaths_.end() && it->second.generation == generation && it->second.path == path)
+        {
+            ssize_t targetLength = -1;
+            if (it->second.isSymlink)
+            {
+                targetLength = std::min(it->second.target.length(), bufsiz);
+                memcpy(buf, it->second.target.c_str(), targetLength);
+            }
+
+            resolvedPathsMtx_.unlock();
+
+            // Same outcome as readlink on something that is not a symlink
+            if (targetLength == -1)
+            {
+                errno = EINVAL;
+            }
+
+            return targetLength;
+        }
+
+        resolvedPathsMtx_.unlock();
+    }
+
+    ssize_t targetLength = real_readlink(path, buf, bufsiz);
+
+    // Missing paths are not cached: they may show up later through a process the interposer is not loaded into
+    if ((targetLength >= 0 || errno == EINVAL) && resolvedPathsMtx_.try_lock())
+    {
+        int readlinkErrno = errno;
+        if (resolvedPaths_.size() < MAX_RESOLVED_PATHS || resolvedPaths_.find(hash) != resolvedPaths_.end())
+        {
+            ResolvedPathEntry &entry = resolvedPaths_[hash];
+            entry.path = path;
+            entry.isSymlink = targetLength >= 0;
+            entry.target.assign(buf, targetLength >= 0 ? targetLength : 0);
+            entry.generation = generation;
+        }
+
+        resolvedPathsMtx_.unlock();
+        errno = readlinkErrno;
+    }
+
+    return targetLength;
+}
+
+void BxlObserver::invalidate_resolved_path(int dirfd, const char *pathname, bool isDirectoryRename)
+{
+    if (pathname == nullptr || !resolvedPathGenerations_.IsValid())
+    {
+        return;
+    }
+
+    // Called once the change was made, by interposers that must return the errno of the call
+    int callErrno = errno;
+
+    if (isDirectoryRename)
+    {
+        resolvedPathGenerations_.InvalidateAll();
+        errno = callErrno;
+        return;
+    }
+
+    // The last component is what changes, so it is not resolved. The path resolution itself goes through the cache.
+    std::string path = normalize_path_at(dirfd, pathname, O_NOFOLLOW);
+    size_t hash = std::hash<std::string_view>{}(std::string_view(path));
+    uint64_t generation = resolvedPathGenerations_.GetPathGeneration(path.c_str(), path.length());
+    resolvedPathGenerations_.InvalidatePath(path.c_str(), path.length());
+
+    // A chain can only depend on this path as a symlink, or as something whose readlink outcome may not have been cached.
+    // Removing a file or directory known not to be a symlink leaves chains alone: making it a symlink comes with another invalidation.
+    bool mayBeInChain = true;
+    if (resolvedPathsMtx_.try_lock_for(chrono::milliseconds(1)))
+    {
+        auto it = resolvedPaths_.find(hash);
+        mayBeInChain = it == resolvedPaths_.end()
+            || it->second.isSymlink
+            || it->second.path != path
+            || it->second.generation != generation;
+        if (it != resolvedPaths_.end())
+        {
+            resolvedPaths_.erase(it);
+        }
+
+        resolvedPathsMtx_.unlock();
+    }
+
+    if (mayBeInChain)
+    {
+        resolvedPathGenerations_.InvalidateChains();
+    }
+
+    errno = callErrno;
 }
 
 char** BxlObserver::ensure_env_value_with_log(char *const envp[], char const *envName, char const *envValue)
@@ -1182,9 +2682,68 @@ char** BxlObserver::ensure_env_value_with_log(char *const envp[], char const *en
     return newEnvp;
 }
 
+bool BxlObserver::envs_already_ensured(char *const envp[])
+{
+    bool monitoring = IsMonitoringChildProcesses();
+    const char *names[] = { BxlEnvFamPath, BxlEnvDetoursPath, BxlEnvRootPid, BxlPTraceForcedProcessNames, BxlEnvStaticLinkingCacheFd };
+    const char *values[] = 
+    {
+        monitoring ? famPath_ : "",
+        monitoring ? detoursLibFullPath_ : "",
+        "",
+        monitoring ? forcedPTraceProcessNamesList_ : "",
+        monitoring ? sharedStaticLinkingCacheFd_ : ""
+    };
+    const int count = sizeof(names) / sizeof(names[0]);
+    const char *found[count] = { nullptr };
+    const char *ldPreload = nullptr;
+
+    // Same matching rules as ensure_env_value (the last occurrence wins) and ensure_paths_included_in_env/remove_path_from_LDPRELOAD
+    // (the last and the first occurrence of LD_PRELOAD win, respectively)
+    for (char *const *pEnv = envp; pEnv && *pEnv; pEnv++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (skip_prefix(*pEnv, names[i]))
+            {
+                found[i] = *pEnv;
+            }
+        }
+
+        if ((monitoring || ldPreload == nullptr) && skip_prefix(*pEnv, LD_PRELOAD_ENV_VAR_PREFIX))
+        {
+            ldPreload = *pEnv;
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        const char *next = skip_prefix(skip_prefix(skip_prefix(found[i], names[i]), "="), values[i]);
+        if (next == nullptr || *next != '\0')
+        {
+            return false;
+        }
+    }
+
+    return monitoring
+        ? ldPreload != nullptr && (detoursLibFullPath_[0] == '\0' || is_value_in_env(ldPreload, detoursLibFullPath_, LD_PRELOAD_ENV_VAR_PREFIX))
+        : ldPreload == nullptr || !is_value_in_env(ldPreload, detoursLibFullPath_, LD_PRELOAD_ENV_VAR_PREFIX);
+}
+
 // Propagate the environment needed for sandbox initialization
 char** BxlObserver::ensureEnvs(char *const envp[])
 {
+    // Every caller is about to exec or spawn with the returned environment. A monitored child gets the shared static linking cache
+    // named in its environment, so it has to inherit the descriptor too (see StaticLinkingCache).
+    sharedStaticLinkingCache_.SetInheritable(IsMonitoringChildProcesses());
+
+    // Every process but the root one typically inherits a correct environment already, so don't go through all the
+    // (scan and copy) steps below one variable at a time
+    if (envs_already_ensured(envp))
+    {
+        return (char **)envp;
+    }
+
     if (!IsMonitoringChildProcesses())
     {
         char **newEnvp = remove_path_from_LDPRELOAD(envp, detoursLibFullPath_);
@@ -1192,6 +2751,7 @@ char** BxlObserver::ensureEnvs(char *const envp[])
         newEnvp = ensure_env_value(newEnvp, BxlEnvDetoursPath, "");
         newEnvp = ensure_env_value(newEnvp, BxlEnvRootPid, "");
         newEnvp = ensure_env_value(newEnvp, BxlPTraceForcedProcessNames, "");
+        newEnvp = ensure_env_value(newEnvp, BxlEnvStaticLinkingCacheFd, "");
         return newEnvp;
     }
     else
@@ -1206,56 +2766,112 @@ char** BxlObserver::ensureEnvs(char *const envp[])
         newEnvp = ensure_env_value_with_log(newEnvp, BxlEnvDetoursPath, detoursLibFullPath_);
         newEnvp = ensure_env_value(newEnvp, BxlEnvRootPid, "");
         newEnvp = ensure_env_value_with_log(newEnvp, BxlPTraceForcedProcessNames, forcedPTraceProcessNamesList_);
+        newEnvp = ensure_env_value(newEnvp, BxlEnvStaticLinkingCacheFd, sharedStaticLinkingCacheFd_);
 
         return newEnvp;
     }
 }
 
-bool BxlObserver::EnumerateDirectory(std::string rootDirectory, bool recursive, std::vector<std::string>& filesAndDirectories)
+bool BxlObserver::IsUniformWritableConeRename(const char *oldPath, const char *newPath, pid_t associatedPid)
+{
+    if (!IsEnabled(associatedPid == 0 ? GetPid() : associatedPid))
+    {
+        return false;
+    }
+
+    IOHandler handler(sandbox_);
+    handler.SetProcess(process_);
+    return handler.IsUniformWritableCone(oldPath) && handler.IsUniformWritableCone(newPath);
+}
+
+bool BxlObserver::IsUntrackedCone(const char *path)
+{
+    if (!IsValid())
+    {
+        return false;
+    }
+
+    IOHandler handler(sandbox_);
+    handler.SetProcess(process_);
+    return handler.IsUntrackedCone(path);
+}
+
+bool BxlObserver::EnumerateDirectory(const std::string &rootDirectory, bool recursive, PathArena &filesAndDirectories)
 {
-    std::stack<std::string> directoriesToEnumerate;
-    DIR *dir;
-    struct dirent *ent;
+    filesAndDirectories.Clear();
+    return EnumerateDirectory(rootDirectory, recursive, [](void *context, const char *path, size_t length)
+    {
+        ((PathArena *)context)->Add(path, length);
+    }, &filesAndDirectories);
+}
+
+bool BxlObserver::EnumerateDirectory(const std::string &rootDirectory, bool recursive, EnumerateDirectoryCallback onEntry, void *context)
+{
+    // Directories still to enumerate, as indexes into directories. Only directories are kept around: every other entry
+    // is handed to onEntry as soon as it is read.
+    PathArena directories;
+    std::stack<size_t, std::vector<size_t>> directoriesToEnumerate;
 
-    filesAndDirectories.clear();
-    directoriesToEnumerate.push(rootDirectory);
-    filesAndDirectories.push_back(rootDirectory);
+    // Entries are read straight from the kernel with getdents64, many at a time into a buffer reused for every directory.
+    // Directory streams would allocate a (smaller) buffer per directory and add a call per entry.
+    static const size_t EnumerationBufferSize = 64 * 1024;
+    std::unique_ptr<char[]> buffer(new char[EnumerationBufferSize]);
+    std::string path;
+
+    onEntry(context, rootDirectory.c_str(), rootDirectory.length());
+    directoriesToEnumerate.push(directories.Add(rootDirectory.c_str(), rootDirectory.length()));
 
     while (!directoriesToEnumerate.empty())
     {
-        auto currentDirectory = directoriesToEnumerate.top();
+        size_t currentDirectory = directoriesToEnumerate.top();
         directoriesToEnumerate.pop();
 
-        dir = real_opendir(currentDirectory.c_str());
+        int fd = real_open(directories.Get(currentDirectory), O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+        if (fd == -1)
+        {
+            LOG_DEBUG("[BxlObserver::EnumerateDirectory] open failed on '%s' with errno %d\n", directories.Get(currentDirectory), errno);
+            return false;
+        }
 
-        if (dir != NULL)
+        // glibc only wraps getdents64 since 2.30
+        long bytesRead;
+        while ((bytesRead = syscall(SYS_getdents64, fd, buffer.get(), EnumerationBufferSize)) > 0)
         {
-            while ((ent = real_readdir(dir)) != NULL)
+            for (long offset = 0; offset < bytesRead;)
             {
-                std::string fileOrDirectory(ent->d_name);
-                if (fileOrDirectory == "." || fileOrDirectory == "..")
+                struct dirent64 *ent = (struct dirent64 *)(buffer.get() + offset);
+                offset += ent->d_reclen;
+
+                if (ent->d_name[0] == '.' && (ent->d_name[1] == '\0' || (ent->d_name[1] == '.' && ent->d_name[2] == '\0')))
                 {
                     continue;
                 }
 
-                std::string fullPath = currentDirectory + "/" + fileOrDirectory;
+                path.assign(directories.Get(currentDirectory), directories.GetLength(currentDirectory));
+                path.push_back('/');
+                path.append(ent->d_name);
+                onEntry(context, path.c_str(), path.length());
 
-                // NOTE: d_type is supported on these filesystems as of 2022 which should cover all BuildXL cases: Btrfs, ext2, ext3, and ext4
-                if (ent->d_type == DT_DIR && recursive)
+                if (!recursive)
                 {
-                    // DT_DIR = Directory
-                    directoriesToEnumerate.push(fullPath);
+                    continue;
                 }
 
-                filesAndDirectories.push_back(fullPath);
+                // NOTE: d_type is supported on these filesystems as of 2022 which should cover all BuildXL cases: Btrfs, ext2, ext3, and ext4.
+                // Only file systems that don't fill it in (DT_UNKNOWN) cost a stat per entry.
+                if (ent->d_type == DT_DIR || (ent->d_type == DT_UNKNOWN && S_ISDIR(get_mode(path.c_str()))))
+                {
+                    directoriesToEnumerate.push(directories.Add(path.c_str(), path.length()));
+                }
             }
-
-            real_closedir(dir);
         }
-        else
+
+        int error = errno;
+        real_close(fd);
+
+        if (bytesRead == -1)
         {
-            // Something went wrong with opendir
-            LOG_DEBUG("[BxlObserver::EnumerateDirectory] opendir failed on '%s' with errno %d\n", currentDirectory, errno);
+            LOG_DEBUG("[BxlObserver::EnumerateDirectory] getdents64 failed on '%s' with errno %d\n", directories.Get(currentDirectory), error);
             return false;
         }
     }
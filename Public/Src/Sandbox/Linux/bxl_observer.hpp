@@ -5,6 +5,7 @@
 
 #include "dirent.h"
 #include <sched.h>
+#include <spawn.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,8 +14,10 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <sys/sendfile.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
@@ -23,16 +26,33 @@
 #include <sys/vfs.h>
 #include <utime.h>
 
+#include <atomic>
 #include <ostream>
 #include <sstream>
 #include <chrono>
 #include <mutex>
+#include <string_view>
 #include <unordered_set>
 #include <unordered_map>
 #include <vector>
 
+#include "access_cache.hpp"
+#include "access_trace.hpp"
+#include "fd_table.hpp"
+#include "interpose_profiler.hpp"
+#include "observer_utilities.hpp"
+#include "path_search_cache.hpp"
+#include "process_tree_counter.hpp"
+#include "resolved_path_generations.hpp"
+#include "report_aggregator.hpp"
+#include "ReportLatencyHistogram.h"
+#include "ReportStormDetector.h"
 #include "Sandbox.hpp"
 #include "SandboxedPip.hpp"
+#include "shared_path_set.hpp"
+#include "static_linking_cache.hpp"
+#include "trace_buffer.hpp"
+#include "untracked_scope_filter.hpp"
 #include "utils.h"
 #include "common.h"
 
@@ -87,13 +107,68 @@ static const char GLIBC_23[] = "GLIBC_2.3";
  * To check what version of a libc function a binary is using, dump it with the following command: objdump -t </path/to/binary> | grep <function_name>
  */
 #ifdef ENABLE_INTERPOSING
+    /*
+     * Slot for the next definition (i.e., the one in libc) of a function the observer forwards to. It is resolved the first time
+     * it is called rather than when the observer gets constructed: most processes only ever call a handful of the 120+ functions.
+     */
+    class RealFunctionSlot
+    {
+    public:
+        RealFunctionSlot(const char *name, const char *version) : name_(name), version_(version), next_(s_slots)
+        {
+            // Slots are only created by the constructor of the observer singleton, which doesn't race with itself
+            s_slots = this;
+        }
+
+        // Resolves every slot that isn't resolved yet (see BxlObserver::prepare_fork)
+        static void ResolveAll()
+        {
+            for (RealFunctionSlot *slot = s_slots; slot != nullptr; slot = slot->next_)
+            {
+                slot->Get();
+            }
+        }
+
+    protected:
+        void *Get() const
+        {
+            void *fn = fn_.load(std::memory_order_acquire);
+            if (fn == nullptr)
+            {
+                // Threads racing here resolve the very same address
+                fn = version_ == nullptr ? dlsym(RTLD_NEXT, name_) : dlvsym(RTLD_NEXT, name_, version_);
+                fn_.store(fn, std::memory_order_release);
+            }
+
+            return fn;
+        }
+
+    private:
+        const char *name_;
+        const char *version_;
+        mutable std::atomic<void *> fn_ { nullptr };
+        RealFunctionSlot *next_;
+        inline static RealFunctionSlot *s_slots = nullptr;
+    };
+
+    template<typename TFn>
+    class RealFunction : public RealFunctionSlot
+    {
+    public:
+        RealFunction(const char *name, const char *version = nullptr) : RealFunctionSlot(name, version) {}
+
+        operator TFn() const { return (TFn)Get(); }
+
+        template<typename ...TArgs> auto operator()(TArgs&& ...args) const { return ((TFn)Get())(std::forward<TArgs>(args)...); }
+    };
+
     #define GEN_FN_DEF_REAL(ret, name, ...)                                         \
         typedef ret (*fn_real_##name)(__VA_ARGS__);                                 \
-        const fn_real_##name real_##name = (fn_real_##name)dlsym(RTLD_NEXT, #name);
+        const RealFunction<fn_real_##name> real_##name { #name };
 
     #define GEN_FN_DEF_REAL_VERSIONED(version, ret, name, ...)                      \
         typedef ret (*fn_real_##name)(__VA_ARGS__);                                 \
-        const fn_real_##name real_##name = (fn_real_##name)dlvsym(RTLD_NEXT, #name, version);
+        const RealFunction<fn_real_##name> real_##name { #name, version };
 
     #define MAKE_BODY(B) \
         B \
@@ -107,6 +182,8 @@ static const char GLIBC_23[] = "GLIBC_2.3";
             short_circuit_check                                      \
             BxlObserver *bxl = BxlObserver::GetInstance();           \
             BXL_LOG_DEBUG(bxl, "Intercepted %s", #name);             \
+            static InterposeProfileSite s_profileSite(#name);        \
+            InterposeProfileScope profile(bxl->GetProfiler(), s_profileSite); \
             MAKE_BODY
 
     #define INTERPOSE(ret, name, ...) \
@@ -246,23 +323,136 @@ private:
 
     volatile int disposed_;
     int rootPid_;
+    // Cached getpid() (see GetPid), or 0 while the cache can't be trusted
+    std::atomic<pid_t> pid_;
     char progFullPath_[PATH_MAX];
     char detoursLibFullPath_[PATH_MAX];
     char famPath_[PATH_MAX];
+    // The FAM as mapped by InitFam, which lives as long as the process
+    const char *famPayload_ = nullptr;
+    size_t famLength_ = 0;
     char forcedPTraceProcessNamesList_[PATH_MAX];
     char secondaryReportPath_[PATH_MAX];
 
-    std::timed_mutex cacheMtx_;
-    std::unordered_map<es_event_type_t, std::unordered_set<std::string>> cache_;
-
-    // In a typical case, a process will not have more than 1024 open file descriptors at a time.
-    // File descriptors start at 3 (1 and 2 are reserved for stdout and stderr).
-    // Whenever a new file descriptor is created, the smallest available positive integer is assigned to it. 
-    // Whenever a file descriptor is closed, its value is returned to the pool and will be used for new ones.
-    // Setting the size of this table to 1024 should accommodate most of the common cases.
-    // File descriptors can be greater than 1024, and if that happens we just won't cache their paths.
-    static const int MAX_FD = 1024;
-    std::string fdTable_[MAX_FD];
+    // Descriptors for the report FIFOs. They are opened lazily the first time a report is sent and kept open for the
+    // lifetime of the process. They are opened with O_CLOEXEC (a new image reinitializes the observer and opens its own)
+    // and moved out of the way whenever the traced process tries to reuse their numbers (see ProtectReportFd).
+    // No locks are involved so a fork happening while another thread is sending a report can't leave the child deadlocked.
+    std::atomic<int> reportFd_ { -1 };
+    std::atomic<int> secondaryReportFd_ { -1 };
+
+    // Report descriptors are moved to a number at least this big, so they don't take the lowest available
+    // numbers some tools assume they'll get back when they open a file right after closing one of the standard descriptors.
+    static constexpr int MIN_REPORT_FD = 100;
+
+    // Staging area for reports when report batching is enabled (FileAccessManifestExtraFlag::EnableLinuxSandboxReportBatching).
+    // Each thread gets its own batch, so staging a report only touches memory owned by the calling thread. The 'inUse' flag is only
+    // contended when another thread flushes every batch (on process start/exit reports), which is rare and short.
+    struct ReportBatch
+    {
+        // Set while the owning thread (or a flusher) is touching 'data'/'length'
+        std::atomic<bool> inUse { false };
+        // Set while a live thread owns this batch. Batches of terminated threads are reused by new ones.
+        std::atomic<bool> claimed { false };
+        ReportBatch *next = nullptr;
+        size_t length = 0;
+        size_t count = 0;
+        uint64_t firstStagedNs = 0;
+        char data[PIPE_BUF];
+    };
+
+    // Batches are never freed: they are kept in a push-only list so flushing all of them doesn't need a lock
+    std::atomic<ReportBatch*> reportBatches_ { nullptr };
+    pthread_key_t reportBatchKey_;
+    bool batchReports_ = false;
+
+    // With FileAccessManifestExtraFlag::AdaptiveReportBatching (and not EnableLinuxSandboxReportBatching), reports are only staged
+    // while the process is in a report storm. Every batch is flushed when the storm ends.
+    ReportStormDetector reportStorms_;
+    bool adaptiveBatching_ = false;
+    bool binaryReports_ = false;
+
+    // Summary of the accesses of this process when FileAccessManifestExtraFlag::AggregateLinuxAccessReports is set (see AggregateReport).
+    // Reports of the summary go out when it gets full and before the exit report or an exec, going through batching like any other report.
+    ReportAggregator<CompactAccessReport> reportAggregator_;
+    bool aggregateReports_ = false;
+
+    // Staged reports older than this are flushed the next time the thread reports an access
+    static const uint64_t REPORT_BATCH_MAX_DELAY_NS = 100 * 1000 * 1000;
+
+    // Messages that don't fit in PIPE_BUF are split in chunks. Each chunk is written atomically as a frame whose length prefix is
+    // CHUNKED_MESSAGE_MARKER, followed by a ChunkHeader and the chunk bytes. Chunks of the same message share
+    // (pid, messageId), so the receiving side can reassemble messages even if chunks from other writers are interleaved.
+    // CODESYNC: Public/Src/Engine/Processes/SandboxConnectionLinuxDetours.cs
+    static const int CHUNKED_MESSAGE_MARKER = -23;
+
+    struct ChunkHeader
+    {
+        int32_t  marker;
+        int32_t  pid;
+        uint32_t messageId;
+        uint32_t messageLength;
+        uint32_t offset;
+        uint32_t chunkLength;
+    };
+
+    std::atomic<uint32_t> nextChunkedMessageId_ { 0 };
+
+    AccessCache cache_;
+
+    // Time from SendReport being called until the report was written to the FIFO. Staged reports are all accounted
+    // with the age of the oldest report of their batch when it gets flushed.
+    ReportLatencyHistogram reportLatency_;
+
+    // Per interposed function / ptrace handler counters (FileAccessManifestExtraFlag::ProfileDetours), summarized on process exit
+    InterposeProfiler profiler_;
+
+    // Cache of the readlink results of resolve_path, keyed by (partially resolved) path prefix. Only existing paths are cached,
+    // either as symlinks (along with their target) or as non-symlinks. Only used with FileAccessManifestExtraFlag::CacheLinuxSymlinkResolution.
+    // Entries are only trusted while the generation of their path stays the one they were read under: the symlink, rename, unlink and rmdir
+    // calls of every process of the pip bump it (see ResolvedPathGenerations).
+    struct ResolvedPathEntry
+    {
+        std::string path;
+        std::string target;
+        bool isSymlink;
+        uint64_t generation;
+    };
+
+    static const size_t MAX_RESOLVED_PATHS = 16384;
+    std::timed_mutex resolvedPathsMtx_;
+    std::unordered_map<size_t, ResolvedPathEntry> resolvedPaths_;
+    ResolvedPathGenerations resolvedPathGenerations_;
+
+    // Paths whose resolution by resolve_path went through symlinks whose readlink reports are all in the report cache, with what they
+    // resolved to. Resolving one of them again would only send reports the cache drops, so the whole chain is skipped: a symlinked
+    // workspace doesn't pay for a readlink per symlink component on every access. Invalidated along with the resolved path cache, but
+    // only by changes to paths that may be symlinks (see invalidate_resolved_path), through a generation of their own.
+    struct ResolvedChainEntry
+    {
+        std::string path;
+        std::string resolved;
+        bool followFinalSymlink;
+        uint64_t generation;
+    };
+
+    static const size_t MAX_RESOLVED_CHAINS = 4096;
+    std::mutex resolvedChainsMtx_;
+    std::unordered_map<size_t, ResolvedChainEntry> resolvedChains_;
+    // Set once the first chain is added, so processes that never cross a symlink don't look chains up
+    std::atomic<bool> hasResolvedChains_ { false };
+
+    // Working directory of this process, shared by all its threads. Invalidated by chdir and fchdir, which bump the generation
+    // so a getcwd racing with them never stores its (possibly stale) result.
+    std::timed_mutex cwdMtx_;
+    std::string cwd_;
+    bool cwdValid_ = false;
+    bool cwdCacheDisabled_ = false;
+    uint64_t cwdGeneration_ = 0;
+
+    // Paths of the file descriptors of this process. Entries are reset whenever a descriptor is closed or reused and
+    // copied when a descriptor is duplicated.
+    FdTable fdTable_;
     const char* const empty_str_ = "";
     bool useFdTable_ = true;
     bool sandboxLoggingEnabled_ = false;
@@ -271,18 +461,103 @@ private:
     std::shared_ptr<SandboxedProcess> process_;
     Sandbox *sandbox_;
 
-    // Cache for statically linked processes in the form <timestamp>:<path>
-    std::vector<std::pair<std::string, bool>> staticallyLinkedProcessCache_;
+    // Exit report of this process built at init (with pid 0), and the executable path it was built with.
+    // SendExitReport only patches the pid, unless the process has exec'ed something else since.
+    AccessReportGroup exitReport_;
+    std::shared_ptr<const PathCacheEntry> exitReportPath_;
+
+    // Cache for statically linked processes
+    std::timed_mutex staticallyLinkedProcessCacheMtx_;
+    std::unordered_map<ExecutableId, bool, ExecutableIdHash> staticallyLinkedProcessCache_;
+    // Verdicts shared among all processes of the pip. Only used when the ptrace sandbox is enabled, some processes of the pip aren't
+    // ptraced, and children are monitored.
+    StaticLinkingCache sharedStaticLinkingCache_;
+    // Descriptor of the shared cache as propagated to children in BxlEnvStaticLinkingCacheFd (empty if there is no shared cache)
+    char sharedStaticLinkingCacheFd_[16] = { 0 };
     std::vector<std::string> forcedPTraceProcessNames_;
+    // Libraries already reported by la_objopen by any process of the pip. Only used by the audit library.
+    SharedPathSet reportedAuditObjects_;
+    // Allowed accesses already reported by any process of the pip, keyed the same way as cache_.
+    // Only used with FileAccessManifestExtraFlag::ShareReportCacheAcrossProcesses.
+    SharedPathSet sharedReportCache_;
+    // The backing file is sparse: only the pages that get used take any space
+    static const uint32_t SharedReportCacheCapacity = 1 << 16;
+    static const uint32_t SharedReportCacheArenaSize = 1 << 23;
+    // Ring debug messages go to instead of the report FIFO. Only used with FileAccessManifestExtraFlag::EnableLinuxSandboxTraceBuffer.
+    TraceBuffer traceBuffer_;
+    bool useTraceBuffer_ = false;
+    // Every access check of this process, for offline replay. Only used with FileAccessManifestExtraFlag::RecordLinuxSandboxAccessTrace.
+    AccessTrace accessTrace_;
+    bool recordAccessTrace_ = false;
+    // PATH searches made by any process of the pip. Only used with FileAccessManifestExtraFlag::CacheImagePathSearches.
+    PathSearchCache pathSearchCache_;
+    // Live processes of the pip. Only used with FileAccessManifestExtraFlag::DetectLinuxProcessTreeCompletion.
+    ProcessTreeCounter processTree_;
+    // Roots of the untracked cones of the manifest. Only used with FileAccessManifestExtraFlag::FilterLinuxUntrackedScopes.
+    UntrackedScopeFilter untrackedScopes_;
+    // Roots of the cones the manifest marks as free of symlinks (see FileAccessPolicy_NoReparsePointsInCone), which resolve_path doesn't readlink under
+    UntrackedScopeFilter noReparsePointScopes_;
 
     void InitFam(pid_t pid);
+    void InitCaches();
     void InitDetoursLibPath();
+    void InitStaticLinkingCache();
+    void InitReportedAuditObjects();
+    void InitSharedReportCache();
+    void InitTraceBuffer();
+    void InitAccessTrace();
+    void InitPathSearchCache();
+    void InitProcessTree();
+    void InitResolvedPathGenerations();
+    void InitUntrackedScopeFilter();
+    void InitNoReparsePointScopeFilter();
+    // Whether an access can be dropped straight from the path the process passed (see UntrackedScopeFilter)
+    bool IsInUntrackedScope(es_event_type_t eventType, const char *pathname);
+    std::string GetTraceBufferPath();
+    std::string GetAccessTracePath();
     bool Send(const char *buf, size_t bufsiz, bool useSecondaryPipe = false);
-    bool IsCacheHit(es_event_type_t event, const string &path, const string &secondPath);
-    bool CheckCache(es_event_type_t event, const string &path, bool addEntryIfMissing);
+    bool SendChunked(const char *buf, size_t bufsiz, bool useSecondaryPipe);
+    bool WriteToReportFd(const char *buf, size_t bufsiz, bool useSecondaryPipe);
+    bool SendReport(const CompactAccessReport &report, const char *path, size_t pathLength, bool useSecondaryPipe);
+    // Same as SendReport, but never adds the report to the summary of accesses
+    bool SendUnaggregatedReport(const CompactAccessReport &report, const char *path, size_t pathLength, bool useSecondaryPipe);
+    // Adds the report to the summary of accesses if it can be summarized, i.e. it is an allowed read-side access (see GetAggregationStrength).
+    // Returns false if the report must be sent on its own.
+    bool AggregateReport(const CompactAccessReport &report, const char *path, size_t pathLength);
+    // Sends every report of the summary of accesses
+    void FlushAggregatedReports();
+    // Takes an exited process out of the count of live ones, reporting the completion of the process tree if it was the last one.
+    // Every report of the process must have been sent already.
+    void RemoveFromProcessTree(pid_t pid, bool isProcess);
+    void SendProcessTreeCompletedReport();
+    // How strong the access of the report is when summarizing accesses to the same path, or 0 if the report can't be summarized
+    static uint32_t GetAggregationStrength(const CompactAccessReport &report);
+    // Builds the length-prefixed report in 'buffer'. 'size' is set to the length of the prefixed report, and the result
+    // indicates whether it fit (text reports also need one extra byte for the terminating null snprintf writes).
+    bool BuildPrefixedReport(char *buffer, size_t bufferSize, const CompactAccessReport &report, const char *path, size_t pathLength, size_t &size);
+    // Sends (or stages) 'count' length-prefixed reports laid out back to back in 'buffer' as a single write
+    bool SendPrefixedReports(const char *buffer, size_t totalSize, size_t count, bool isProcessStartOrExit, uint64_t start, bool useSecondaryPipe);
+    int GetReportFd(bool useSecondaryPipe);
+    void RelocateReportFd(std::atomic<int> &reportFd, int fd, int minFd = MIN_REPORT_FD);
+    bool StageReport(const char *buf, size_t bufsiz, size_t count = 1);
+    ReportBatch* GetReportBatch();
+    bool FlushReportBatch(ReportBatch *batch);
+    void FlushReportBatches();
+    // Flushes the batch of the calling thread, if it has one
+    void FlushOwnReportBatch();
+    // Whether reports should be staged because the process is in a report storm, accounting for a report sent at 'nowNs'
+    bool IsInReportStorm(uint64_t nowNs);
+    static void ReleaseReportBatch(void *batch);
+    void SendDebugMessage(pid_t pid, const char *message);
+    bool IsCacheHit(es_event_type_t event, std::string_view path, std::string_view secondPath);
+    bool CheckCache(es_event_type_t event, std::string_view path, bool addEntryIfMissing, bool shareEntry = false);
     char** ensure_env_value_with_log(char *const envp[], char const *envName, const char *envValue);
+    // Whether ensureEnvs would return envp untouched. A single scan that allocates nothing.
+    bool envs_already_ensured(char *const envp[]);
     void report_access_internal(const char *syscallName, es_event_type_t eventType, const char *reportPath, const char *secondPath = nullptr, mode_t mode = 0, int error = 0, bool checkCache = true, pid_t associatedPid = 0);
     AccessCheckResult create_access_internal(const char *syscallName, es_event_type_t eventType, const char *reportPath, const char *secondPath, AccessReportGroup &reportGroup, mode_t mode = 0, bool checkCache = true, pid_t associatedPid = 0);
+    AccessCheckResult check_access(const char *syscallName, IOEvent &event, AccessReportGroup &reportGroup, bool checkCache);
+    void record_access(const char *syscallName, const IOEvent &event, bool checkCache, uint64_t startNs, const AccessCheckResult &result);
     ssize_t read_path_for_fd(int fd, char *buf, size_t bufsiz, pid_t associatedPid = 0);
 
     bool IsMonitoringChildProcesses() const { return !pip_ || CheckMonitorChildProcesses(pip_->GetFamFlags()); }
@@ -324,34 +599,95 @@ private:
 
     void relative_to_absolute(const char *pathname, int dirfd, int associatedPid, char *fullPath);
     void resolve_path(char *fullpath, bool followFinalSymlink, pid_t associatedPid);
+    // readlink for resolve_path, going through the resolved path cache first
+    ssize_t readlink_cached(const char *path, char *buf, size_t bufsiz, pid_t associatedPid);
+    // Replaces fullpath with what it resolved to if its chain of symlinks was already resolved and reported (see ResolvedChainEntry)
+    bool try_get_resolved_chain(char *fullpath, size_t length, size_t hash, bool followFinalSymlink);
+    void add_resolved_chain(const char *path, size_t hash, const char *resolved, bool followFinalSymlink, uint64_t generation);
     
+    static inline bool IsProcessStartOrExit(const CompactAccessReport &report)
+    {
+        return report.operation == FileOperation::kOpProcessStart || report.operation == FileOperation::kOpProcessExit;
+    }
+
     // Builds the report to be sent over the FIFO in the given buffer
-    inline int BuildReport(char* buffer, int maxMessageLength, const AccessReport &report, const char *path)
+    inline int BuildReport(char* buffer, int maxMessageLength, const CompactAccessReport &report, const char *path)
     {
         // Note: when adding new fields, always leave 'path' as the last component of this message
         // This is for the sake of the arithmetic when truncating debug messages, where this assumption is made (see SendReport). 
         return snprintf(
-            buffer, maxMessageLength, "%s|%d|%d|%d|%d|%d|%d|%d|%s\n",
-            __progname, report.pid <= 0 ? getpid() : report.pid, report.requestedAccess, report.status, report.reportExplicitly, report.error, report.operation, report.isDirectory, path);
+            buffer, maxMessageLength, "%d|%d|%d|%d|%d|%d|%d|%s\n",
+            report.pid <= 0 ? GetPid() : report.pid, report.requestedAccess, report.status, report.reportExplicitly, report.error, report.operation, report.isDirectory, path);
+    }
+
+    // Binary report format, used when FileAccessManifestExtraFlag::EnableLinuxSandboxBinaryReports is set.
+    // A report is a BinaryReportHeader immediately followed by 'pathLength' bytes of path (not null terminated).
+    // All fields are in host byte order.
+    // CODESYNC: Public/Src/Engine/Processes/SandboxConnectionLinuxDetours.cs
+    // The version must be bumped whenever the layout changes
+    static const uint32_t BINARY_REPORT_VERSION = 1;
+
+    struct BinaryReportHeader
+    {
+        uint32_t version;
+        int32_t  pid;
+        uint32_t requestedAccess;
+        uint32_t status;
+        uint32_t reportExplicitly;
+        uint32_t error;
+        uint32_t operation;
+        uint32_t isDirectory;
+        uint32_t pathLength;
+    };
+
+    // The caller must guarantee the buffer can accommodate sizeof(BinaryReportHeader) + pathLength bytes
+    inline int BuildBinaryReport(char* buffer, const CompactAccessReport &report, const char *path, size_t pathLength)
+    {
+        BinaryReportHeader header =
+        {
+            .version            = BINARY_REPORT_VERSION,
+            .pid                = report.pid <= 0 ? GetPid() : report.pid,
+            .requestedAccess    = (uint32_t)report.requestedAccess,
+            .status             = (uint32_t)report.status,
+            .reportExplicitly   = (uint32_t)report.reportExplicitly,
+            .error              = (uint32_t)report.error,
+            .operation          = (uint32_t)report.operation,
+            .isDirectory        = (uint32_t)report.isDirectory,
+            .pathLength         = (uint32_t)pathLength,
+        };
+
+        memcpy(buffer, &header, sizeof(header));
+        memcpy(&buffer[sizeof(header)], path, pathLength);
+        return sizeof(header) + pathLength;
     }
 
     static BxlObserver *sInstance;
     static AccessCheckResult sNotChecked;
 
-#define BXL_LOG_DEBUG(bxl, fmt, ...) if (bxl->LogDebugEnabled()) { pid_t pid = getpid(); bxl->LogDebug(pid, "[%s:%d] " fmt, __progname, pid, __VA_ARGS__); }
+#define BXL_LOG_DEBUG(bxl, fmt, ...) if (bxl->LogDebugEnabled()) { pid_t pid = bxl->GetPid(); bxl->LogDebug(pid, "[%s:%d] " fmt, __progname, pid, __VA_ARGS__); }
 
 #define LOG_DEBUG(fmt, ...) BXL_LOG_DEBUG(this, fmt, __VA_ARGS__)
 
 public:
     static BxlObserver* GetInstance();
 
-    bool SendReport(const AccessReport &report, bool isDebugMessage = false, bool useSecondaryPipe = false);
+    // getpid() without the system call: the pid is part of every report. The cache is refreshed on the child of a fork, and bypassed
+    // for good on children that don't go through fork (clone, vfork), since they start with a copy of (or share) the one of their parent.
+    inline pid_t GetPid() const
+    {
+        pid_t pid = pid_.load(std::memory_order_relaxed);
+        return pid > 0 ? pid : getpid();
+    }
+
+    bool SendReport(const AccessReport &report, bool useSecondaryPipe = false);
     bool SendReport(const AccessReportGroup &report);
     // Specialization for the exit report event. 
     // We may need to send an exit report on exit handlers after destructors
     // have been called. This method avoids accessing shared structures.
     bool SendExitReport(pid_t pid = 0);
     char** ensureEnvs(char *const envp[]);
+    // Undoes what ensureEnvs did to the static linking cache descriptor, for a process that keeps running after spawning a child
+    void restore_static_linking_cache_cloexec() const { sharedStaticLinkingCache_.SetInheritable(false); }
 
     const char* GetProgramPath() { return progFullPath_; }
     const char* GetReportsPath() { int len; return IsValid() ? pip_->GetReportsPath(&len) : NULL; }
@@ -362,6 +698,12 @@ public:
     void report_exec_args(pid_t pid);
     void report_audit_objopen(const char *fullpath)
     {
+        // Every process of the pip loads mostly the same libraries: only the first one to load each of them reports it
+        if (!reportedAuditObjects_.TryAdd(fullpath, strlen(fullpath)))
+        {
+            return;
+        }
+
         IOEvent event(ES_EVENT_TYPE_NOTIFY_OPEN, ES_ACTION_TYPE_NOTIFY, fullpath, progFullPath_, S_IFREG);
         report_access("la_objopen", event, /* checkCache */ true);
     }
@@ -397,39 +739,174 @@ public:
 
     // Send a special message to managed code if the policy to override allowed writes based on file existence is set
     // and the write is allowed by policy
-    void report_firstAllowWriteCheck(const char *fullPath);
+    void report_firstAllowWriteCheck(const char *fullPath) { report_firstAllowWriteCheck(fullPath, get_mode(fullPath)); }
+
+    // Same, for a path whose mode was already read from the file system for the access being checked
+    void report_firstAllowWriteCheck(const char *fullPath, mode_t mode);
+
+    // Drops the remembered PATH searches the given access may change the outcome of (see PathSearchCache)
+    void invalidate_path_searches(es_event_type_t eventType, std::string_view path, std::string_view secondPath);
+
+    // Must be called once a path was removed or replaced (unlink, rmdir, rename, symlink) so no process of the pip uses stale symlink
+    // information for it in resolve_path. Called before, a concurrent resolution could cache the old state again. Directories being
+    // renamed invalidate everything, since any path under them changes too. Preserves errno.
+    void invalidate_resolved_path(int dirfd, const char *pathname, bool isDirectoryRename = false);
+
+    // Resolves a file name against PATH like resolve_filename_with_env does. With FileAccessManifestExtraFlag::CacheImagePathSearches,
+    // a search already made by any process of the pip is not made again: its probes are reported without touching the file system.
+    bool search_path(const char *filename, mode_t &mode, std::string &path);
 
     // Checks and reports when a statically linked binary is about to be executed
     bool check_and_report_statically_linked_process(const char *path);
     bool check_and_report_statically_linked_process(int fd);
     bool is_statically_linked(const char *path);
     void set_ptrace_permissions();
+    // Sends the report that makes bxl launch the ptrace runner for the current process
+    void report_statically_linked_process(const char *path);
+    // Whether statically linked processes are sandboxed with seccomp user notifications instead of the ptrace runner
+    bool IsSeccompNotifySandboxEnabled();
+    // Whether statically linked processes are observed with fanotify (see FanotifySandbox), which can't deny anything
+    bool IsFanotifySandboxEnabled();
+    // Whether the ptrace sandbox caches the paths of the descriptors of its tracees (see PTraceSandbox::GetFdPath)
+    bool IsPTraceFdPathCacheEnabled() const { return pip_ && CheckCacheLinuxPTraceFdPaths(pip_->GetFamExtraFlags()); }
 
     // Clears the specified entry on the file descriptor table
     void reset_fd_table_entry(int fd);
+
+    // Must be called before the traced process closes or overwrites (e.g. dup2) the given file descriptor.
+    // If the descriptor is one of the report FIFO descriptors held by the observer, our descriptor is moved
+    // somewhere else first so reporting keeps working and the traced process gets the behavior it expects.
+    void ProtectReportFd(int fd);
+
+    // Same as ProtectReportFd for every descriptor from first to last (both inclusive), e.g. for close_range and closefrom.
+    // Our descriptors are moved past last, or forgotten (and lazily reopened) when the range is open-ended.
+    void ProtectReportFdRange(int first, int last);
+
+    // Clears the entries on the file descriptor table from first to last (both inclusive)
+    void reset_fd_table_range(int first, int last);
     
     // Clears the entire file descriptor table
     void reset_fd_table();
 
+    // Switches debug messages to the trace buffer of this process. Must be called on the child after a fork: the ring mapped
+    // by the parent is the parent's.
+    void reset_trace_buffer();
+
+    // Switches the access trace to the one of this process. Must be called on the child after a fork, same as reset_trace_buffer.
+    void reset_access_trace();
+
+    // Must be called right before creating a child that doesn't share our memory. A child of a multithreaded process can't
+    // resolve anything with dlsym (another thread may have held the loader lock when it got created), so everything gets resolved first.
+    void prepare_fork();
+
+    // A vfork child runs on the memory of this process until it execs or exits, so whatever it caches about itself (e.g. its
+    // file descriptors or working directory) must be dropped once the parent resumes. begin_vfork must be called right before
+    // creating such a child, and returns false when the child must be created with fork instead: the child runs our code
+    // (e.g. the exec interposers), which is only sound when no other thread can be holding a lock it needs.
+    // end_vfork must be called on the parent once it resumes.
+    bool begin_vfork();
+    void end_vfork();
+
+    // Must be called right before creating a child with clone, which runs on a copy of our memory (or on our very memory) without
+    // going through fork. The cached pid of this process is dropped, and can be restored with refresh_pid once the child got its copy.
+    void invalidate_pid() { pid_.store(0, std::memory_order_relaxed); }
+    void refresh_pid() { pid_.store(getpid(), std::memory_order_relaxed); }
+
+    // Replaying recorded access checks (see accesstracereplay.cpp). Once replaying, nothing gets sent to BuildXL or recorded, and
+    // replay_access goes through the same checks and caches create_access does.
+    void begin_replay();
+    AccessCheckResult replay_access(const char *syscallName, IOEvent &event, AccessReportGroup &reportGroup, bool checkCache)
+    {
+        return check_access(syscallName, event, reportGroup, checkCache);
+    }
+
+    // Must be called after newfd was made a duplicate of oldfd (dup, dup2, dup3, fcntl with F_DUPFD)
+    void duplicate_fd_table_entry(int oldfd, int newfd);
+
+    // Whether a write to the given descriptor was already checked and reported. Further writes can then be forwarded right away,
+    // since their access checks would be cache hits anyway.
+    bool is_fd_write_checked(int fd) const { return useFdTable_ && fdTable_.HasFlag(fd, FdTable::WriteChecked); }
+    void set_fd_write_checked(int fd) { if (useFdTable_) fdTable_.SetFlag(fd, FdTable::WriteChecked); }
+
+    // Whether the given descriptor of this process was already found to be a non-file (see is_non_file), in which case its
+    // accesses are never reported
+    bool is_fd_non_file(int fd) const { return useFdTable_ && fdTable_.HasFlag(fd, FdTable::NonFile); }
+
+    // Whether the enumeration of the directory stream with the given descriptor was already checked and reported, so the
+    // rest of its entries can be read right away
+    bool is_fd_enumerated(int fd) const { return useFdTable_ && fdTable_.HasFlag(fd, FdTable::Enumerated); }
+    void set_fd_enumerated(int fd) { if (useFdTable_) fdTable_.SetFlag(fd, FdTable::Enumerated); }
+
+    // Caches the path of a descriptor that was just opened, when it is already known (e.g. opendir)
+    void set_fd_table_entry(int fd, const char *path) { if (useFdTable_) fdTable_.Set(fd, path); }
+
+    // Sends the summary of accesses and all reports staged by every thread, when report aggregation or batching are enabled. No-op otherwise.
+    // Must be called before the process image is replaced (exec) or the process terminates.
+    void FlushReports();
+
+    // Drops all staged and summarized reports. Must be called on the child after a fork: those reports belong to the parent, who will flush them.
+    void reset_report_batches();
+
+    // Keeping count of the live processes of the pip, so the last one to exit reports the completion of the process tree (see ProcessTreeCounter).
+    // No-ops without FileAccessManifestExtraFlag::DetectLinuxProcessTreeCompletion. Exits are counted by SendExitReport.
+    // A process counts itself once it starts (or, when traced, once its tracer finds out about it). Creating a child takes a reservation
+    // right before, which must be handed over to the child once it got created, or given back if it couldn't be (childPid <= 0).
+    void add_to_process_tree(pid_t pid) { processTree_.Add(pid); }
+    void reserve_child_process() { processTree_.Reserve(); }
+    void claim_child_process(pid_t childPid);
+    // Must be called by a process that reported its exit without going through SendExitReport (i.e. _exit)
+    void leave_process_tree() { RemoveFromProcessTree(GetPid(), /* isProcess */ true); }
+    // Same as a reservation, for a supervisor that must keep the tree open while it runs: released once it is done, after flushing its reports
+    void reserve_process_tree() { processTree_.Reserve(); }
+    void release_process_tree();
+
     // Disables the FD table. Cannot be re-enabled for the remainder of the sandbox lifetime.
     void disable_fd_table();
+
+    // Closes every descriptor but the given one and the report pipes, which get opened first so reports can still be sent.
+    // Meant for a process forked off to serve the sandbox (e.g. the seccomp notification supervisor) rather than run the pip.
+    void close_all_fds_except(int fd);
     
     // Returns the path associated with the given file descriptor
     // Note: This function assumes fd is a file descriptor pointing to a regular file (that is, a file, directory or symlink, not a pipe/socket/etc). The reason for this assumption is that file descriptors
-    // are cached and the corresponding invalidation is tied to opening handles against file names. We are currently not detouring pipe creation, so we run the risk of not invalidating the file descriptor
-    // table properly for the case of pipes when we miss a close.
+    // are cached and the corresponding invalidation is tied to creating and duplicating descriptors (open, pipe, socket, dup, etc.). Descriptors created by calls we
+    // don't detour (e.g. accept or eventfd) run the risk of not invalidating the file descriptor table properly when we also miss a close.
     std::string fd_to_path(int fd, pid_t associatedPid = 0);
+
+    // Same as above, but writes the path to the given buffer (of PATH_MAX bytes) instead of allocating a string.
+    // Returns the length of the path, or 0 if it can't be read.
+    size_t fd_to_path(int fd, char *path, pid_t associatedPid = 0);
     
     std::string normalize_path_at(int dirfd, const char *pathname, int oflags = 0, pid_t associatedPid = 0);
 
+    // Same as above, but writes the path to the given buffer (of PATH_MAX bytes) instead of allocating a string.
+    // Returns the length of the path, or 0 if it can't be normalized.
+    size_t normalize_path_at(int dirfd, const char *pathname, char *normalized, int oflags = 0, pid_t associatedPid = 0);
+
     // Whether the given descriptor is a non-file (e.g., a pipe, or socket, etc.)
     static bool is_non_file(const mode_t mode);
 
     // Checks whether a given path is an anonymous file (a file that lives in RAM and only exists until all references to that file are dropped)
-    bool is_anonymous_file(string path);
+    bool is_anonymous_file(std::string_view path);
 
     // Enumerates a specified directory
-    bool EnumerateDirectory(std::string rootDirectory, bool recursive, std::vector<std::string>& filesAndDirectories);
+    // The root directory is included. Paths are stored in the given arena rather than one std::string each, since directories being renamed can be big.
+    bool EnumerateDirectory(const std::string &rootDirectory, bool recursive, PathArena &filesAndDirectories);
+
+    // Same as above, but every path is handed to onEntry (along with context) as it is found instead of being stored, for callers that don't need them all at once
+    typedef void (*EnumerateDirectoryCallback)(void *context, const char *path, size_t length);
+    bool EnumerateDirectory(const std::string &rootDirectory, bool recursive, EnumerateDirectoryCallback onEntry, void *context);
+
+    template <typename TOnEntry>
+    bool EnumerateDirectory(const std::string &rootDirectory, bool recursive, TOnEntry onEntry)
+    {
+        return EnumerateDirectory(rootDirectory, recursive, [](void *context, const char *path, size_t length) { (*(TOnEntry *)context)(path, length); }, &onEntry);
+    }
+
+    // Whether the rename of directory oldPath to newPath can be checked and reported as a rename of just the two roots (see AccessHandler::IsUniformWritableCone)
+    bool IsUniformWritableConeRename(const char *oldPath, const char *newPath, pid_t associatedPid = 0);
+    // Whether accesses to path or anything under it can be dropped without being checked (see AccessHandler::IsUntrackedCone)
+    bool IsUntrackedCone(const char *path);
 
     const char* getFamPath() const { return famPath_; };
 
@@ -447,6 +924,8 @@ public:
 
     void LogDebug(pid_t pid, const char *fmt, ...);
 
+    inline InterposeProfiler& GetProfiler() { return profiler_; }
+
     mode_t get_mode(const char *path)
     {
         int old = errno;
@@ -477,24 +956,12 @@ public:
         return result;
     }
 
-    char *getcurrentworkingdirectory(char *fullpath, size_t size, pid_t associatedPid = 0)
-    {
-        if (associatedPid == 0)
-        {
-            return getcwd(fullpath, size);
-        }
-        else
-        {
-            char linkPath[100] = {0};
-            sprintf(linkPath, "/proc/%d/cwd", associatedPid);
-            if (real_readlink(linkPath, fullpath, size) == -1)
-            {
-                return NULL;
-            }
-            
-            return fullpath;
-        }
-    }
+    // Returns the working directory of this process (from the cache unless it changed) or the one of the given tracee
+    char *getcurrentworkingdirectory(char *fullpath, size_t size, pid_t associatedPid = 0);
+
+    // Must be called after this process successfully changes its working directory. disableCache is for when the working
+    // directory may change without this process knowing, i.e. it is shared with a child (clone with CLONE_FS but not CLONE_VM).
+    void invalidate_cwd(bool disableCache = false);
 
     std::string normalize_path(const char *pathname, int oflags = 0, pid_t associatedPid = 0)
     {
@@ -521,7 +988,7 @@ public:
     bool should_deny(AccessCheckResult &check)
     {
         // getpid() can be used for IsEnabled() here because this function will not be called for the ptrace sandbox
-        return IsEnabled(getpid()) && check.ShouldDenyAccess() && IsFailingUnexpectedAccesses();
+        return IsEnabled(GetPid()) && check.ShouldDenyAccess() && IsFailingUnexpectedAccesses();
     }
 
     GEN_FN_DEF(void*, dlopen, const char *filename, int flags);
@@ -530,6 +997,8 @@ public:
     GEN_FN_DEF(pid_t, fork, void);
     GEN_FN_DEF(pid_t, vfork, void);
     GEN_FN_DEF(int, clone, int (*fn)(void *), void *child_stack, int flags, void *arg, ... /* pid_t *ptid, void *newtls, pid_t *ctid */ );
+    GEN_FN_DEF(int, posix_spawn, pid_t *, const char *, const posix_spawn_file_actions_t *, const posix_spawnattr_t *, char *const[], char *const[]);
+    GEN_FN_DEF(int, posix_spawnp, pid_t *, const char *, const posix_spawn_file_actions_t *, const posix_spawnattr_t *, char *const[], char *const[]);
     GEN_FN_DEF_REAL(void, _exit, int);
     GEN_FN_DEF(int, fexecve, int, char *const[], char *const[]);
     GEN_FN_DEF(int, execv, const char *, char *const[]);
@@ -617,6 +1086,8 @@ public:
     GEN_FN_DEF(int, vfprintf, FILE*, const char*, va_list);
     GEN_FN_DEF(int, vdprintf, int, const char*, va_list);
     GEN_FN_DEF(int, chmod, const char *pathname, mode_t mode);
+    GEN_FN_DEF(int, chdir, const char *path);
+    GEN_FN_DEF(int, fchdir, int fd);
     GEN_FN_DEF(int, fchmod, int fd, mode_t mode);
     GEN_FN_DEF(int, fchmodat, int dirfd, const char *pathname, mode_t mode, int flags);
     GEN_FN_DEF(int, chown, const char *pathname, uid_t owner, gid_t group);
@@ -630,6 +1101,10 @@ public:
     GEN_FN_DEF(int, dup, int oldfd);
     GEN_FN_DEF(int, dup2, int oldfd, int newfd);
     GEN_FN_DEF(int, dup3, int oldfd, int newfd, int flags);
+    GEN_FN_DEF(int, fcntl, int fd, int cmd, ...);
+    GEN_FN_DEF(int, pipe, int pipefd[2]);
+    GEN_FN_DEF(int, pipe2, int pipefd[2], int flags);
+    GEN_FN_DEF(int, socket, int domain, int type, int protocol);
     GEN_FN_DEF(int, scandir, const char * dirp, struct dirent *** namelist, int (*filter)(const struct dirent *), int (*compar)(const struct dirent **, const struct dirent **));
     GEN_FN_DEF(int, scandir64, const char * dirp, struct dirent64 *** namelist, int (*filter)(const struct dirent64  *), int (*compar)(const dirent64 **, const dirent64 **));
     GEN_FN_DEF(int, scandirat, int dirfd, const char * dirp, struct dirent *** namelist, int (*filter)(const struct dirent *), int (*compar)(const struct dirent **, const struct dirent **));
@@ -643,6 +1118,10 @@ public:
 
     /* ============ don't need to be interposed ======================= */
     GEN_FN_DEF(int, close, int fd);
+#if __GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34)
+    GEN_FN_DEF(int, close_range, unsigned int first, unsigned int last, int flags);
+    GEN_FN_DEF_REAL(void, closefrom, int lowfd);
+#endif
     GEN_FN_DEF(int, fclose, FILE *stream);
     GEN_FN_DEF(int, statfs, const char *, struct statfs *buf);
     GEN_FN_DEF(int, statfs64, const char *, struct statfs64 *buf);
@@ -13,4 +13,7 @@
 #define BxlPTraceTracedPid "__BUILDXL_TRACED_PID"
 #define BxlPTraceTracedPath "__BUILDXL_TRACED_PATH"
 
+// Internal to the native sandbox: descriptor of the statically linked binaries cache shared by all processes of a pip
+#define BxlEnvStaticLinkingCacheFd "__BUILDXL_STATIC_LINKING_CACHE_FD"
+
 #endif //COMMON_H
@@ -19,12 +19,17 @@
 #include <sys/param.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/sysmacros.h>
 #include <sys/fcntl.h>
 #include <sys/xattr.h>
+#ifdef SYS_openat2
+#include <linux/openat2.h>
+#endif
 
 #include "bxl_observer.hpp"
 #include "observer_utilities.hpp"
+#include "FanotifySandbox.hpp"
 #include "PTraceSandbox.hpp"
 
 #define ERROR_RETURN_VALUE -1
@@ -84,44 +89,83 @@ INTERPOSE(int, scandirat64, int dirfd, const char * dirp,
     return bxl->check_fwd_and_report_scandirat64(report, check, ERROR_RETURN_VALUE, dirfd, dirp, namelist, filter, compar);
 })
 
+template<typename T>
+static T ret_readdir(int fd, AccessCheckResult &check, T result, BxlObserver *bxl)
+{
+    // The enumeration is reported on the first read of a directory stream. The rest of its entries (and the ones after a
+    // rewinddir) are read without checking again until the stream is closed.
+    if (!bxl->should_deny(check))
+    {
+        bxl->set_fd_enumerated(fd);
+    }
+
+    return result;
+}
+
 INTERPOSE(struct dirent *, readdir, DIR *dirp)
 ({
+    int fd = dirfd(dirp);
+    if (bxl->is_fd_enumerated(fd))
+    {
+        return bxl->real_readdir(dirp);
+    }
+
     AccessReportGroup report;
-    auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_READDIR, dirfd(dirp), report);
-    return bxl->check_fwd_and_report_readdir(report, check, (struct dirent *)NULL, dirp);
+    auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_READDIR, fd, report);
+    return ret_readdir(fd, check, bxl->check_fwd_and_report_readdir(report, check, (struct dirent *)NULL, dirp), bxl);
 })
 
 INTERPOSE(struct dirent64 *, readdir64, DIR *dirp)
 ({
+    int fd = dirfd(dirp);
+    if (bxl->is_fd_enumerated(fd))
+    {
+        return bxl->real_readdir64(dirp);
+    }
+
     AccessReportGroup report;
-    auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_READDIR, dirfd(dirp), report);
-    return bxl->check_fwd_and_report_readdir64(report, check, (struct dirent64 *)NULL, dirp);
+    auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_READDIR, fd, report);
+    return ret_readdir(fd, check, bxl->check_fwd_and_report_readdir64(report, check, (struct dirent64 *)NULL, dirp), bxl);
 })
 
 INTERPOSE(int, readdir_r, DIR *dirp, struct dirent *entry, struct dirent **result)
 ({
+    int fd = dirfd(dirp);
+    if (bxl->is_fd_enumerated(fd))
+    {
+        return bxl->real_readdir_r(dirp, entry, result);
+    }
+
     AccessReportGroup report;
-    auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_READDIR, dirfd(dirp), report);
-    return bxl->check_fwd_and_report_readdir_r(report, check, ERROR_RETURN_VALUE, dirp, entry, result);
+    auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_READDIR, fd, report);
+    return ret_readdir(fd, check, bxl->check_fwd_and_report_readdir_r(report, check, ERROR_RETURN_VALUE, dirp, entry, result), bxl);
 })
 
 INTERPOSE(int, readdir64_r, DIR *dirp, struct dirent64 *entry, struct dirent64 **result)
 ({
+    int fd = dirfd(dirp);
+    if (bxl->is_fd_enumerated(fd))
+    {
+        return bxl->real_readdir64_r(dirp, entry, result);
+    }
+
     AccessReportGroup report;
-    auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_READDIR, dirfd(dirp), report);
-    return bxl->check_fwd_and_report_readdir64_r(report, check, ERROR_RETURN_VALUE, dirp, entry, result);
+    auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_READDIR, fd, report);
+    return ret_readdir(fd, check, bxl->check_fwd_and_report_readdir64_r(report, check, ERROR_RETURN_VALUE, dirp, entry, result), bxl);
 })
 
 INTERPOSE(void, _exit, int status)({
     char emptystr[1] = {'\0'};
     bxl->report_access("_exit", ES_EVENT_TYPE_NOTIFY_EXIT, emptystr, emptystr);
+    bxl->leave_process_tree();
     bxl->real__exit(status);
     _exit(status);
 })
 
-static void report_child_process(const char *syscall, BxlObserver *bxl, pid_t childPid, pid_t parentPid)
+static void report_child_process(const char *syscall, BxlObserver *bxl, pid_t childPid, pid_t parentPid, const char *childExePath = nullptr)
 {
-    string exePath(bxl->GetProgramPath());
+    // A forked child runs our own image until it execs
+    string exePath(childExePath == nullptr ? bxl->GetProgramPath() : childExePath);
     // Events of type ES_EVENT_TYPE_NOTIFY_FORK are expected to contain the spawned child process id in its cpid field (the parent pid 
     // is actually ignored and not sent as part of the report, we pass it here for consistency only).
     IOEvent event(parentPid, childPid, 0, ES_EVENT_TYPE_NOTIFY_FORK, ES_ACTION_TYPE_NOTIFY, exePath, std::string(""), exePath, 0, false);
@@ -144,11 +188,16 @@ static void HandleForkOrCloneReporting(const char *syscall, BxlObserver *bxl, pi
         // Clear the file descriptor table when we are in the child process
         // File descriptors are unique to a process, so this cache needs to be invalidated on the child
         bxl->reset_fd_table();
-        report_child_process(syscall, bxl, getpid(), getppid());
+        // Reports staged before the fork belong to the parent
+        bxl->reset_report_batches();
+        // Debug messages of the child go to its own trace buffer
+        bxl->reset_trace_buffer();
+        bxl->reset_access_trace();
+        report_child_process(syscall, bxl, bxl->GetPid(), getppid());
     }
     else
     {
-        report_child_process(syscall, bxl, forkOrCloneChildPidResult, getpid());
+        report_child_process(syscall, bxl, forkOrCloneChildPidResult, bxl->GetPid());
     }
 }
 
@@ -161,25 +210,188 @@ static int ret_fd(int fd, BxlObserver *bxl)
 }
 
 INTERPOSE(pid_t, fork, void)({
+    bxl->prepare_fork();
+    bxl->reserve_child_process();
     result_t<pid_t> childPid = bxl->fwd_fork();
 
+    if (childPid.get() != 0)
+    {
+        bxl->claim_child_process(childPid.get());
+    }
+
     HandleForkOrCloneReporting(__func__, bxl, childPid.get());
 
     return childPid.restore();
 })
 
+static pid_t vfork_with_fork(BxlObserver *bxl)
+{
+    // The child gets its own copy of our memory, so it can do anything a forked child can (see the vfork below)
+    bxl->prepare_fork();
+    bxl->reserve_child_process();
+    result_t<pid_t> childPid = bxl->fwd_fork();
+
+    if (childPid.get() != 0)
+    {
+        bxl->claim_child_process(childPid.get());
+    }
+
+    HandleForkOrCloneReporting("vfork", bxl, childPid.get());
+
+    return childPid.restore();
+}
+
+#if defined(__x86_64__)
+
+// vfork can't be interposed with a regular function. The child runs on the stack of the parent, so once it returns from the
+// interposer and calls anything else (i.e. exec), the frame of the interposer, which the parent returns through when it resumes,
+// is gone. The vfork below is frameless instead, same as the one in libc: it keeps the return address in a register across the
+// system call, and only calls into the functions below (which return before it goes on) before creating the child, on the child
+// right before returning, and on the parent once it resumes.
+// Children can then be created without copying the page tables of the parent (e.g. make or bash running under a large parent),
+// except when the observer can't let them share its memory, which is when vfork falls back to fork.
+
+#define BXL_STRINGIFY(x) #x
+#define BXL_TO_STRING(x) BXL_STRINGIFY(x)
+
+// Returns whether the child can be created with vfork
+extern "C" __attribute__((visibility("hidden"), used)) int bxl_vfork_prepare()
+{
+    BxlObserver *bxl = BxlObserver::GetInstance();
+    BXL_LOG_DEBUG(bxl, "Intercepted %s", "vfork");
+    if (!bxl->begin_vfork())
+    {
+        return 0;
+    }
+
+    bxl->reserve_child_process();
+    return 1;
+}
+
+// Returns on the caller of vfork (it is jumped to, not called)
+extern "C" __attribute__((visibility("hidden"), used)) pid_t bxl_vfork_fallback()
+{
+    return vfork_with_fork(BxlObserver::GetInstance());
+}
+
+extern "C" __attribute__((visibility("hidden"), used)) void bxl_vfork_child()
+{
+    BxlObserver *bxl = BxlObserver::GetInstance();
+    // Same as for a forked child, except that the parent is suspended until this child execs or exits, and therefore can't
+    // exit (and have bxl see no active processes) before this report gets sent: the parent doesn't need to report the child too.
+    // The other resets of a forked child don't apply: the trace buffer, access trace and report batch are the ones of the parent.
+    bxl->reset_fd_table();
+    report_child_process("vfork", bxl, getpid(), getppid());
+}
+
+// Gets the raw result of the system call, and returns the one of vfork
+extern "C" __attribute__((visibility("hidden"), used)) pid_t bxl_vfork_parent(long result)
+{
+    BxlObserver *bxl = BxlObserver::GetInstance();
+    bxl->end_vfork();
+    bxl->claim_child_process((pid_t)result);
+    if (result < 0)
+    {
+        errno = (int)-result;
+        return -1;
+    }
+
+    return (pid_t)result;
+}
+
+asm(
+    ".text\n"
+    ".globl vfork\n"
+    ".type vfork, @function\n"
+    "vfork:\n"
+#ifdef __CET__
+    "    endbr64\n"
+#endif
+    // Keep the stack 16-byte aligned across the calls (it is 8 off on entry)
+    "    subq $8, %rsp\n"
+    "    call bxl_vfork_prepare\n"
+    "    addq $8, %rsp\n"
+    "    testl %eax, %eax\n"
+    "    jz bxl_vfork_fallback\n"
+    // %rdi survives the system call, and unlike the stack, the child can't overwrite it for the parent
+    "    popq %rdi\n"
+    "    movl $" BXL_TO_STRING(SYS_vfork) ", %eax\n"
+    "    syscall\n"
+    "    pushq %rdi\n"
+    "    testq %rax, %rax\n"
+    "    jnz 1f\n"
+    "    subq $8, %rsp\n"
+    "    call bxl_vfork_child\n"
+    "    addq $8, %rsp\n"
+    "    xorl %eax, %eax\n"
+    // Return without popping the shadow stack, which is shared with the parent (same as libc)
+    "    popq %rdi\n"
+    "    jmp *%rdi\n"
+    "1:\n"
+    "    movq %rax, %rdi\n"
+    "    subq $8, %rsp\n"
+    "    call bxl_vfork_parent\n"
+    "    addq $8, %rsp\n"
+    "    ret\n"
+    ".size vfork, .-vfork\n"
+);
+
+#else
+
 INTERPOSE(pid_t, vfork, void)({
     // Observe that we explicitly call fork and not vfork.
-    // The reason is that vfork is only designed to call exec* or _exit in the child and was made available for perf reasons. 
+    // The reason is that vfork is only designed to call exec* or _exit in the child and was made available for perf reasons.
     // The stack of the parent is reused for the child in vfork, and therefore nothing else should happen beyond exec* or _exit,
     // including returning from the interpose callback.
-    // On the other hand, vfork is almost obsolete at this point and has been removed from the POSIX.1-2008 already.
-    // Modern Linux distributions should be able to call fork directly with none or minimal perf differences. 
-    result_t<pid_t> childPid = bxl->fwd_fork();
+    return vfork_with_fork(bxl);
+})
 
-    HandleForkOrCloneReporting(__func__, bxl, childPid.get());
+#endif
 
-    return childPid.restore();
+static int handle_posix_spawn(const char *syscall, BxlObserver *bxl, const char *resolvedPath, result_t<int> result, pid_t childPid, pid_t *pid)
+{
+    // The spawning process itself keeps running, so only the child got to inherit the static linking cache (see ensureEnvs)
+    bxl->restore_static_linking_cache_cloexec();
+    bxl->claim_child_process(result.get() == 0 ? childPid : -1);
+    if (result.get() == 0)
+    {
+        // The image the child execs reports itself once it initializes the sandbox (see _bxl_linux_sandbox_init), but the
+        // parent may be done before then. Report the child the same way fork does, as running the image it was spawned with.
+        report_child_process(syscall, bxl, childPid, bxl->GetPid(), bxl->normalize_path(resolvedPath).c_str());
+        if (pid != nullptr)
+        {
+            *pid = childPid;
+        }
+    }
+    else
+    {
+        // posix_spawn returns the error instead of setting errno
+        bxl->report_access(syscall, ES_EVENT_TYPE_NOTIFY_STAT, resolvedPath, /* mode */ 0, /* oflags */ 0, /* error */ result.get());
+    }
+
+    return result.restore();
+}
+
+// libc spawns with CLONE_VM | CLONE_VFORK and execs from the child without going through any of our interposers, so spawning
+// is already as cheap as it gets: these only make sure the child inherits the sandbox, and report it.
+// NOTE: a statically linked image spawned this way is not sandboxed with ptrace, since that needs to happen in the child.
+INTERPOSE(int, posix_spawn, pid_t *pid, const char *path, const posix_spawn_file_actions_t *file_actions, const posix_spawnattr_t *attrp, char *const argv[], char *const envp[])({
+    pid_t childPid = 0;
+    bxl->reserve_child_process();
+    result_t<int> result = bxl->fwd_posix_spawn(&childPid, path, file_actions, attrp, argv, bxl->ensureEnvs(envp));
+    return handle_posix_spawn(__func__, bxl, path, result, childPid, pid);
+})
+
+INTERPOSE(int, posix_spawnp, pid_t *pid, const char *file, const posix_spawn_file_actions_t *file_actions, const posix_spawnattr_t *attrp, char *const argv[], char *const envp[])({
+    pid_t childPid = 0;
+    bxl->reserve_child_process();
+    result_t<int> result = bxl->fwd_posix_spawnp(&childPid, file, file_actions, attrp, argv, bxl->ensureEnvs(envp));
+
+    // Only needed for reporting: the search libc just did can't be told apart from the outside
+    mode_t mode = 0;
+    std::string pathname;
+    bool resolved = bxl->search_path(file, mode, pathname);
+    return handle_posix_spawn(__func__, bxl, resolved ? pathname.c_str() : file, result, childPid, pid);
 })
 
 INTERPOSE(int, clone, int (*fn)(void *), void *child_stack, int flags, void *arg, ... /* pid_t *ptid, void *newtls, pid_t *ctid */ )({
@@ -190,11 +402,40 @@ INTERPOSE(int, clone, int (*fn)(void *), void *child_stack, int flags, void *arg
     pid_t *ctid = va_arg(args, pid_t*);
     va_end(args);
 
+    // A child sharing our file system information but not our memory can chdir behind our back
+    if ((flags & CLONE_FS) && !(flags & CLONE_VM))
+    {
+        bxl->invalidate_cwd(/* disableCache */ true);
+    }
+
+    if (!(flags & CLONE_VM))
+    {
+        bxl->prepare_fork();
+    }
+
+    // The child starts running 'fn' straight away, without going through our fork handling
+    if (!(flags & CLONE_THREAD))
+    {
+        bxl->invalidate_pid();
+        bxl->reserve_child_process();
+    }
+
     result_t<int> result = bxl->fwd_clone(fn, child_stack, flags, arg, ptid, newtls, ctid);
     
     // We don't want to report any process creation if clone was asked to create a new thread (and not a new process)
     if (!(flags & CLONE_THREAD))
     {
+        // A child sharing our memory keeps using the very same cache
+        if (!(flags & CLONE_VM))
+        {
+            bxl->refresh_pid();
+        }
+
+        if (result.get() != 0)
+        {
+            bxl->claim_child_process(result.get());
+        }
+
         HandleForkOrCloneReporting(__func__, bxl, result.get());
     }
 
@@ -212,8 +453,28 @@ static int handle_exec_with_ptrace(const char *file, char *const argv[], char *c
     // we may use the ptrace sandbox even for dynamically linked processes.
     envp = bxl->RemoveLDPreloadFromEnv(envp);
 
+    if (bxl->IsFanotifySandboxEnabled())
+    {
+        FanotifySandbox fanotifySandbox(bxl);
+        if (fanotifySandbox.Initialize())
+        {
+            auto result = fanotifySandbox.ExecuteWithFanotifySandbox(file, argv, envp);
+            bxl->report_exec("execve", argv[0], file, /* error */ errno);
+            return result;
+        }
+
+        // Fall back to the stopping sandboxes, letting bxl know it has to launch the tracer if that's the one
+        BXL_LOG_DEBUG(bxl, "[Fanotify] Can't be used, falling back to %s", bxl->IsSeccompNotifySandboxEnabled() ? "seccomp notifications" : "ptrace");
+        if (!bxl->IsSeccompNotifySandboxEnabled())
+        {
+            bxl->report_statically_linked_process(file);
+        }
+    }
+
     PTraceSandbox ptraceSandbox(bxl);
-    auto result = ptraceSandbox.ExecuteWithPTraceSandbox(file, argv, envp, bxl->getFamPath());
+    auto result = bxl->IsSeccompNotifySandboxEnabled()
+        ? ptraceSandbox.ExecuteWithSeccompNotifySandbox(file, argv, envp, bxl->getFamPath())
+        : ptraceSandbox.ExecuteWithPTraceSandbox(file, argv, envp, bxl->getFamPath());
 
     bxl->report_exec("execve", argv[0], file, /* error */ errno);
 
@@ -227,6 +488,9 @@ static int handle_exec_with_ptrace(int fd, char *const argv[], char *const envp[
 }
 
 INTERPOSE(int, fexecve, int fd, char *const argv[], char *const envp[])({
+    // The current image is about to be replaced, so any staged report would be lost
+    bxl->FlushReports();
+
     // exec* functions start a new instance of the sandbox and therefore the process creation report
     // is sent on __init__
 
@@ -244,6 +508,8 @@ INTERPOSE(int, fexecve, int fd, char *const argv[], char *const envp[])({
 })
 
 INTERPOSE(int, execv, const char *file, char *const argv[])({
+    bxl->FlushReports();
+
     // exec* functions start a new instance of the sandbox and therefore the process creation report
     // is sent on __init__
 
@@ -261,6 +527,8 @@ INTERPOSE(int, execv, const char *file, char *const argv[])({
 })
 
 INTERPOSE(int, execve, const char *file, char *const argv[], char *const envp[])({
+    bxl->FlushReports();
+
     // exec* functions start a new instance of the sandbox and therefore the process creation report
     // is sent on __init__
 
@@ -278,12 +546,14 @@ INTERPOSE(int, execve, const char *file, char *const argv[], char *const envp[])
 })
 
 INTERPOSE(int, execvp, const char *file, char *const argv[])({
+    bxl->FlushReports();
+
     // exec* functions start a new instance of the sandbox and therefore the process creation report
     // is sent on __init__
 
     mode_t mode = 0;
     std::string pathname;
-    auto path_resolution_result = resolve_filename_with_env(file, mode, pathname);
+    auto path_resolution_result = bxl->search_path(file, mode, pathname);
 
     if (path_resolution_result)
     {
@@ -307,12 +577,14 @@ INTERPOSE(int, execvp, const char *file, char *const argv[])({
 })
 
 INTERPOSE(int, execvpe, const char *file, char *const argv[], char *const envp[])({
+    bxl->FlushReports();
+
     // exec* functions start a new instance of the sandbox and therefore the process creation report
     // is sent on __init__
 
     mode_t mode = 0;
     std::string pathname;
-    auto path_resolution_result = resolve_filename_with_env(file, mode, pathname);
+    auto path_resolution_result = bxl->search_path(file, mode, pathname);
 
     // If the path couldn't be resolved, then the exec will likely fail anyways
     if (path_resolution_result)
@@ -337,6 +609,8 @@ INTERPOSE(int, execvpe, const char *file, char *const argv[], char *const envp[]
 })
 
 INTERPOSE(int, execl, const char *pathname, const char *arg, ...)({
+    bxl->FlushReports();
+
     va_list args;
     va_start(args, arg);
     ptrdiff_t argc = get_variadic_argc(args);
@@ -363,6 +637,8 @@ INTERPOSE(int, execl, const char *pathname, const char *arg, ...)({
 })
 
 INTERPOSE(int, execlp, const char *file, const char *arg, ...)({
+    bxl->FlushReports();
+
     va_list args;
     va_start(args, arg);
     ptrdiff_t argc = get_variadic_argc(args);
@@ -380,7 +656,7 @@ INTERPOSE(int, execlp, const char *file, const char *arg, ...)({
 
     mode_t mode = 0;
     std::string pathname;
-    auto path_resolution_result = resolve_filename_with_env(file, mode, pathname);
+    auto path_resolution_result = bxl->search_path(file, mode, pathname);
 
     if (path_resolution_result)
     {
@@ -402,6 +678,8 @@ INTERPOSE(int, execlp, const char *file, const char *arg, ...)({
 })
 
 INTERPOSE(int, execle, const char *pathname, const char *arg, ...)({
+    bxl->FlushReports();
+
     va_list args;
     va_start(args, arg);
     ptrdiff_t argc = get_variadic_argc(args);
@@ -574,36 +852,68 @@ INTERPOSE(size_t, fread, void *ptr, size_t size, size_t nmemb, FILE *stream)({
 })
 
 INTERPOSE(size_t, fwrite, const void *ptr, size_t size, size_t nmemb, FILE *stream)({
+    // Output to a terminal or a pipe (e.g. stdout redirected to BuildXL) is never reported, so skip the access check altogether.
+    // The same goes for the rest of the stdio family below.
+    if (bxl->is_fd_non_file(fileno(stream)))
+    {
+        return bxl->real_fwrite(ptr, size, nmemb, stream);
+    }
+
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fileno(stream), report);
     return bxl->check_fwd_and_report_fwrite(report, check, (size_t)0, ptr, size, nmemb, stream);
 })
 
 INTERPOSE(int, fputc, int c, FILE *stream)({
+    if (bxl->is_fd_non_file(fileno(stream)))
+    {
+        return bxl->real_fputc(c, stream);
+    }
+
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fileno(stream), report);
     return bxl->check_fwd_and_report_fputc(report, check, ERROR_RETURN_VALUE, c, stream);
 })
 
 INTERPOSE(int, fputs, const char *s, FILE *stream)({
+    if (bxl->is_fd_non_file(fileno(stream)))
+    {
+        return bxl->real_fputs(s, stream);
+    }
+
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fileno(stream), report);
     return bxl->check_fwd_and_report_fputs(report, check, ERROR_RETURN_VALUE, s, stream);
 })
 
 INTERPOSE(int, putc, int c, FILE *stream)({
+    if (bxl->is_fd_non_file(fileno(stream)))
+    {
+        return bxl->real_putc(c, stream);
+    }
+
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fileno(stream), report);
     return bxl->check_fwd_and_report_putc(report, check, ERROR_RETURN_VALUE, c, stream);
 })
 
 INTERPOSE(int, putchar, int c)({
+    if (bxl->is_fd_non_file(fileno(stdout)))
+    {
+        return bxl->real_putchar(c);
+    }
+
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fileno(stdout), report);
     return bxl->check_fwd_and_report_putchar(report, check, ERROR_RETURN_VALUE, c);
 })
 
 INTERPOSE(int, puts, const char *s)({
+    if (bxl->is_fd_non_file(fileno(stdout)))
+    {
+        return bxl->real_puts(s);
+    }
+
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fileno(stdout), report);
     return bxl->check_fwd_and_report_puts(report, check, ERROR_RETURN_VALUE, s);
@@ -635,6 +945,9 @@ static AccessCheckResult CreateFileOpen(BxlObserver *bxl, string &pathStr, int o
         isCreate ? ES_EVENT_TYPE_NOTIFY_CREATE : isWrite ? ES_EVENT_TYPE_NOTIFY_WRITE : ES_EVENT_TYPE_NOTIFY_OPEN,
         ES_ACTION_TYPE_NOTIFY,
         pathStr, bxl->GetProgramPath(), pathMode, false, "");
+
+    // A first write to the file is checked against whether it existed, which 'pathMode' already tells
+    event.SetModeObserved();
     return bxl->create_access(__func__, event, report);
 }
 
@@ -690,46 +1003,94 @@ INTERPOSE(int, creat, const char *pathname, mode_t mode)({
     return open(pathname, O_CREAT | O_WRONLY | O_TRUNC, mode);
 })
 
+static ssize_t ret_write(int fd, AccessCheckResult &check, ssize_t result, BxlObserver *bxl)
+{
+    // Once a write went through, writes to the same descriptor are not checked and reported again until it gets closed
+    // or reused: they would be cache hits anyway. Denied writes stay on the slow path, so each of them keeps failing.
+    if (result != -1 && !bxl->should_deny(check))
+    {
+        bxl->set_fd_write_checked(fd);
+    }
+
+    return result;
+}
+
 INTERPOSE(ssize_t, write, int fd, const void *buf, size_t bufsiz)({
+    if (bxl->is_fd_write_checked(fd))
+    {
+        return bxl->real_write(fd, buf, bufsiz);
+    }
+
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fd, report);
-    return bxl->check_fwd_and_report_write(report, check, (ssize_t)ERROR_RETURN_VALUE, fd, buf, bufsiz);
+    return ret_write(fd, check, bxl->check_fwd_and_report_write(report, check, (ssize_t)ERROR_RETURN_VALUE, fd, buf, bufsiz), bxl);
 })
 
 INTERPOSE(ssize_t, pwrite, int fd, const void *buf, size_t count, off_t offset)({
+    if (bxl->is_fd_write_checked(fd))
+    {
+        return bxl->real_pwrite(fd, buf, count, offset);
+    }
+
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fd, report);
-    return bxl->check_fwd_and_report_pwrite(report, check, (ssize_t)ERROR_RETURN_VALUE, fd, buf, count, offset);
+    return ret_write(fd, check, bxl->check_fwd_and_report_pwrite(report, check, (ssize_t)ERROR_RETURN_VALUE, fd, buf, count, offset), bxl);
 })
 
 INTERPOSE(ssize_t, writev, int fd, const struct iovec *iov, int iovcnt)({
+    if (bxl->is_fd_write_checked(fd))
+    {
+        return bxl->real_writev(fd, iov, iovcnt);
+    }
+
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fd, report);
-    return bxl->check_fwd_and_report_writev(report, check, (ssize_t)ERROR_RETURN_VALUE, fd, iov, iovcnt);
+    return ret_write(fd, check, bxl->check_fwd_and_report_writev(report, check, (ssize_t)ERROR_RETURN_VALUE, fd, iov, iovcnt), bxl);
 })
 
 INTERPOSE(ssize_t, pwritev, int fd, const struct iovec *iov, int iovcnt, off_t offset)({
+    if (bxl->is_fd_write_checked(fd))
+    {
+        return bxl->real_pwritev(fd, iov, iovcnt, offset);
+    }
+
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fd, report);
-    return bxl->check_fwd_and_report_pwritev(report, check, (ssize_t)ERROR_RETURN_VALUE, fd, iov, iovcnt, offset);
+    return ret_write(fd, check, bxl->check_fwd_and_report_pwritev(report, check, (ssize_t)ERROR_RETURN_VALUE, fd, iov, iovcnt, offset), bxl);
 })
 
 INTERPOSE(ssize_t, pwritev2, int fd, const struct iovec *iov, int iovcnt, off_t offset, int flags)({
+    if (bxl->is_fd_write_checked(fd))
+    {
+        return bxl->real_pwritev2(fd, iov, iovcnt, offset, flags);
+    }
+
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fd, report);
-    return bxl->check_fwd_and_report_pwritev2(report, check, (ssize_t)ERROR_RETURN_VALUE, fd, iov, iovcnt, offset, flags);
+    return ret_write(fd, check, bxl->check_fwd_and_report_pwritev2(report, check, (ssize_t)ERROR_RETURN_VALUE, fd, iov, iovcnt, offset, flags), bxl);
 })
 
 INTERPOSE(ssize_t, pwrite64, int fd, const void *buf, size_t count, off_t offset)({
+    if (bxl->is_fd_write_checked(fd))
+    {
+        return bxl->real_pwrite64(fd, buf, count, offset);
+    }
+
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fd, report);
-    return bxl->check_fwd_and_report_pwrite64(report, check, (ssize_t)ERROR_RETURN_VALUE, fd, buf, count, offset);
+    return ret_write(fd, check, bxl->check_fwd_and_report_pwrite64(report, check, (ssize_t)ERROR_RETURN_VALUE, fd, buf, count, offset), bxl);
 })
 
 INTERPOSE(int, remove, const char *pathname)({
     AccessReportGroup report;
     auto check = bxl->create_access(__func__, ES_EVENT_TYPE_NOTIFY_UNLINK, pathname, report, /*mode*/0, O_NOFOLLOW);
-    return bxl->check_fwd_and_report_remove(report, check, ERROR_RETURN_VALUE, pathname);
+    int result = bxl->check_fwd_and_report_remove(report, check, ERROR_RETURN_VALUE, pathname);
+    if (result != ERROR_RETURN_VALUE)
+    {
+        bxl->invalidate_resolved_path(AT_FDCWD, pathname);
+    }
+
+    return result;
 })
 
 INTERPOSE(int, truncate, const char *path, off_t length)({
@@ -758,7 +1119,13 @@ INTERPOSE(int, rmdir, const char *pathname)({
     // This is so we can track directory creation/deletion flow. Using the cache lumps all these operations into one report line
     auto check = bxl->create_access(__func__, ES_EVENT_TYPE_NOTIFY_UNLINK, pathname, report, /* mode */ 0, /* flags */ 0 , /* checkCache */ false);
 
-    return bxl->check_fwd_and_report_rmdir(report, check, ERROR_RETURN_VALUE, pathname);
+    int result = bxl->check_fwd_and_report_rmdir(report, check, ERROR_RETURN_VALUE, pathname);
+    if (result != ERROR_RETURN_VALUE)
+    {
+        bxl->invalidate_resolved_path(AT_FDCWD, pathname);
+    }
+
+    return result;
 })
 
 INTERPOSE(int, renameat, int olddirfd, const char *oldpath, int newdirfd, const char *newpath)({
@@ -767,26 +1134,29 @@ INTERPOSE(int, renameat, int olddirfd, const char *oldpath, int newdirfd, const
 
     mode_t mode = bxl->get_mode(oldStr.c_str());    
     AccessCheckResult check = AccessCheckResult::Invalid();
-    std::vector<std::string> filesAndDirectories;
+    PathArena filesAndDirectories;
     std::vector<AccessReportGroup> accessesToReport;
 
     if (S_ISDIR(mode))
     {
-        bool enumerateResult = bxl->EnumerateDirectory(oldStr, /*recursive*/true, filesAndDirectories);
+        // When both directories are uniformly writable cones, checking the rename of their roots stands for every path under them,
+        // and the managed side expands it from the renamed directory: skip enumerating the whole subtree.
+        bool reportRootsOnly = bxl->IsUniformWritableConeRename(oldStr.c_str(), newStr.c_str());
+        bool enumerateResult = !reportRootsOnly && bxl->EnumerateDirectory(oldStr, /*recursive*/true, filesAndDirectories);
         if (enumerateResult)
         {
             // reserve all the content for both source and destination
-            accessesToReport.reserve(filesAndDirectories.size() * 2);
+            accessesToReport.reserve(filesAndDirectories.Count() * 2);
 
-            for (auto fileOrDirectory : filesAndDirectories)
+            for (size_t i = 0; i < filesAndDirectories.Count(); i++)
             {
                 // Access check for the source file
                 AccessReportGroup sourceReport;
-                check = bxl->create_access(__func__, ES_EVENT_TYPE_NOTIFY_UNLINK, fileOrDirectory.c_str(), sourceReport, /*mode*/ 0, O_NOFOLLOW);
+                check = bxl->create_access(__func__, ES_EVENT_TYPE_NOTIFY_UNLINK, filesAndDirectories.Get(i), sourceReport, /*mode*/ 0, O_NOFOLLOW);
                 accessesToReport.emplace_back(sourceReport);
 
                 // Access check for the destination file
-                fileOrDirectory.replace(0, oldStr.length(), newStr);
+                std::string fileOrDirectory = newStr + (filesAndDirectories.Get(i) + oldStr.length());
                 AccessReportGroup targetReport;
                 check = AccessCheckResult::Combine(check, CreateFileOpen(bxl, fileOrDirectory, O_CREAT | O_WRONLY, targetReport));
                 accessesToReport.emplace_back(targetReport);
@@ -800,7 +1170,6 @@ INTERPOSE(int, renameat, int olddirfd, const char *oldpath, int newdirfd, const
         }
         else
         {
-            // TODO: [pgunasekara] Remove this case when we're certain the enumeration logic above is solid
             AccessReportGroup report;
             IOEvent event(ES_EVENT_TYPE_NOTIFY_RENAME, ES_ACTION_TYPE_NOTIFY, oldStr, bxl->GetProgramPath(), mode, false, newStr);
             check = bxl->create_access(__func__, event, report);
@@ -828,6 +1197,12 @@ INTERPOSE(int, renameat, int olddirfd, const char *oldpath, int newdirfd, const
     else 
     {
         result = bxl->fwd_renameat(olddirfd, oldpath, newdirfd, newpath);
+        if (result.get() != ERROR_RETURN_VALUE)
+        {
+            bxl->invalidate_resolved_path(AT_FDCWD, oldStr.c_str(), /*isDirectoryRename*/ S_ISDIR(mode));
+            bxl->invalidate_resolved_path(AT_FDCWD, newStr.c_str());
+        }
+
         for (auto access : accessesToReport)
         {
             access.SetErrno(get_errno_from_result(result));
@@ -872,7 +1247,13 @@ INTERPOSE(int, unlink, const char *path)({
     
     AccessReportGroup report;
     auto check = bxl->create_access(__func__, ES_EVENT_TYPE_NOTIFY_UNLINK, path, report, /*mode*/ 0, O_NOFOLLOW);
-    return bxl->check_fwd_and_report_unlink(report, check, ERROR_RETURN_VALUE, path);
+    int result = bxl->check_fwd_and_report_unlink(report, check, ERROR_RETURN_VALUE, path);
+    if (result != ERROR_RETURN_VALUE)
+    {
+        bxl->invalidate_resolved_path(AT_FDCWD, path);
+    }
+
+    return result;
 })
 
 INTERPOSE(int, unlinkat, int dirfd, const char *path, int flags)({
@@ -884,21 +1265,39 @@ INTERPOSE(int, unlinkat, int dirfd, const char *path, int flags)({
     AccessReportGroup report;
     int oflags = (flags & AT_REMOVEDIR) ? 0 : O_NOFOLLOW;
     auto check = bxl->create_access_at(__func__, ES_EVENT_TYPE_NOTIFY_UNLINK, dirfd, path, report, oflags);
-    return bxl->check_fwd_and_report_unlinkat(report, check, ERROR_RETURN_VALUE, dirfd, path, flags);
+    int result = bxl->check_fwd_and_report_unlinkat(report, check, ERROR_RETURN_VALUE, dirfd, path, flags);
+    if (result != ERROR_RETURN_VALUE)
+    {
+        bxl->invalidate_resolved_path(dirfd, path);
+    }
+
+    return result;
 })
 
 INTERPOSE(int, symlink, const char *target, const char *linkPath)({
     IOEvent event(ES_EVENT_TYPE_NOTIFY_CREATE, ES_ACTION_TYPE_NOTIFY, bxl->normalize_path(linkPath, O_NOFOLLOW), bxl->GetProgramPath(), S_IFLNK);
     AccessReportGroup report;
     auto check = bxl->create_access(__func__, event, report);
-    return bxl->check_fwd_and_report_symlink(report, check, ERROR_RETURN_VALUE, target, linkPath);
+    int result = bxl->check_fwd_and_report_symlink(report, check, ERROR_RETURN_VALUE, target, linkPath);
+    if (result != ERROR_RETURN_VALUE)
+    {
+        bxl->invalidate_resolved_path(AT_FDCWD, linkPath);
+    }
+
+    return result;
 })
 
 INTERPOSE(int, symlinkat, const char *target, int dirfd, const char *linkPath)({
     IOEvent event(ES_EVENT_TYPE_NOTIFY_CREATE, ES_ACTION_TYPE_NOTIFY, bxl->normalize_path_at(dirfd, linkPath, O_NOFOLLOW), bxl->GetProgramPath(), S_IFLNK);
     AccessReportGroup report;
     auto check = bxl->create_access(__func__, event, report);
-    return bxl->check_fwd_and_report_symlinkat(report, check, ERROR_RETURN_VALUE, target, dirfd, linkPath);
+    int result = bxl->check_fwd_and_report_symlinkat(report, check, ERROR_RETURN_VALUE, target, dirfd, linkPath);
+    if (result != ERROR_RETURN_VALUE)
+    {
+        bxl->invalidate_resolved_path(dirfd, linkPath);
+    }
+
+    return result;
 })
 
 INTERPOSE_SOMETIMES(
@@ -963,7 +1362,7 @@ INTERPOSE(char *, realpath, const char *path, char *resolved_path)({
         // realpath returned an error, but the original path is not null
         // Let's try to report the intermediate symlinks anyway ourselves, because
         // technically they could have been probed before any failure.
-        bxl->report_intermediate_symlinks(path, getpid());
+        bxl->report_intermediate_symlinks(path, bxl->GetPid());
         return result;
     }
 
@@ -972,7 +1371,7 @@ INTERPOSE(char *, realpath, const char *path, char *resolved_path)({
     if (strcmp(path, result) != 0)
     {
         BXL_LOG_DEBUG(bxl, "[realpath] Resolving intermediate symlinks for '%s'", path);
-        bxl->report_intermediate_symlinks(path, getpid());
+        bxl->report_intermediate_symlinks(path, bxl->GetPid());
 
         // Report a probe on the returned path, as the success of this function
         // indicates to the caller that the path exists. 
@@ -986,11 +1385,23 @@ INTERPOSE(char *, realpath, const char *path, char *resolved_path)({
     return result;
 })
 
-INTERPOSE(DIR*, opremotendir, const char *name)({
+INTERPOSE(DIR*, opendir, const char *name)({
+    if (name == nullptr)
+    {
+        return bxl->fwd_opendir(name).restore();
+    }
+
+    std::string path = bxl->normalize_path(name);
     AccessReportGroup report;
-    auto check = bxl->create_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, name, report);
+    auto check = bxl->create_access(__func__, ES_EVENT_TYPE_NOTIFY_STAT, path.c_str(), /* secondPath */ "", report);
     DIR *d = bxl->check_fwd_and_report_opendir(report, check, (DIR*)NULL, name);
-    if (d) { bxl->reset_fd_table_entry(dirfd(d)); }
+    if (d)
+    {
+        // The stream gets a brand new descriptor whose path we already know, so readdir doesn't have to look it up
+        bxl->reset_fd_table_entry(dirfd(d));
+        bxl->set_fd_table_entry(dirfd(d), path.c_str());
+    }
+
     return d;
 })
 
@@ -1063,18 +1474,33 @@ INTERPOSE(int, mknodat, int dirfd, const char *pathname, mode_t mode, dev_t dev)
 })
 
 INTERPOSE(int, vprintf, const char *fmt, va_list args)({
+    if (bxl->is_fd_non_file(1))
+    {
+        return bxl->real_vprintf(fmt, args);
+    }
+
     AccessReportGroup report;
     bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, 1, report);
     return bxl->fwd_vprintf(fmt, args).restore();
 })
 
 INTERPOSE(int, vfprintf, FILE *f, const char *fmt, va_list args)({
+    if (bxl->is_fd_non_file(fileno(f)))
+    {
+        return bxl->real_vfprintf(f, fmt, args);
+    }
+
     AccessReportGroup report;
     bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fileno(f), report);
     return bxl->fwd_vfprintf(f, fmt, args).restore();
 })
 
 INTERPOSE(int, vdprintf, int fd, const char *fmt, va_list args)({
+    if (bxl->is_fd_non_file(fd))
+    {
+        return bxl->real_vdprintf(fd, fmt, args);
+    }
+
     AccessReportGroup report;
     bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_WRITE, fd, report);
     return bxl->fwd_and_report_vdprintf(report, -1, fd, fmt, args).restore();
@@ -1110,6 +1536,26 @@ INTERPOSE(int, chmod, const char *pathname, mode_t mode)({
     return bxl->check_fwd_and_report_chmod(report, check, ERROR_RETURN_VALUE, pathname, mode);
 })
 
+INTERPOSE(int, chdir, const char *path)({
+    result_t<int> result = bxl->fwd_chdir(path);
+    if (result.get() == 0)
+    {
+        bxl->invalidate_cwd();
+    }
+
+    return result.restore();
+})
+
+INTERPOSE(int, fchdir, int fd)({
+    result_t<int> result = bxl->fwd_fchdir(fd);
+    if (result.get() == 0)
+    {
+        bxl->invalidate_cwd();
+    }
+
+    return result.restore();
+})
+
 INTERPOSE(int, fchmod, int fd, mode_t mode)({
     AccessReportGroup report;
     auto check = bxl->create_access_fd(__func__, ES_EVENT_TYPE_NOTIFY_SETMODE, fd, report);
@@ -1269,22 +1715,188 @@ INTERPOSE(int, name_to_handle_at, int dirfd, const char *pathname, struct file_h
 })
 
 INTERPOSE(int, close, int fd) ({ 
+    bxl->ProtectReportFd(fd);
     bxl->reset_fd_table_entry(fd);
     return bxl->fwd_close(fd).restore();
 })
 
+// Closing a range of descriptors at once (e.g. right before an exec) has to leave the descriptor table just as coherent as
+// closing them one by one would. Otherwise stale paths would be reported for whatever reuses those numbers later.
+static void before_close_range(BxlObserver *bxl, unsigned int first, unsigned int last, int flags)
+{
+#ifdef CLOSE_RANGE_CLOEXEC
+    // Descriptors are only marked as close-on-exec: nothing is closed yet, and ours are already close-on-exec
+    if (flags & CLOSE_RANGE_CLOEXEC)
+    {
+        return;
+    }
+#endif
+
+    int firstFd = first > INT_MAX ? INT_MAX : (int)first;
+    int lastFd = last > INT_MAX ? INT_MAX : (int)last;
+    bxl->ProtectReportFdRange(firstFd, lastFd);
+    bxl->reset_fd_table_range(firstFd, lastFd);
+}
+
+#if __GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34)
+INTERPOSE(int, close_range, unsigned int first, unsigned int last, int flags) ({
+    before_close_range(bxl, first, last, flags);
+    return bxl->fwd_close_range(first, last, flags).restore();
+})
+
+INTERPOSE(void, closefrom, int lowfd) ({
+    before_close_range(bxl, lowfd < 0 ? 0 : lowfd, ~0U, 0);
+    bxl->real_closefrom(lowfd);
+})
+#endif
+
+// Only callers of the libc wrapper are covered: programs making syscalls with their own inline instructions (e.g. liburing 2.2+
+// setting up its rings) are only seen by the ptrace and seccomp notification sandboxes. See syscalls.md.
+#if defined(__x86_64__) || defined(__aarch64__)
+typedef long (*fn_real_syscall)(long number, ...);
+
+static long fwd_raw_syscall(long number, va_list args)
+{
+    static const fn_real_syscall real_syscall = (fn_real_syscall)dlsym(RTLD_NEXT, "syscall");
+
+    // The kernel takes up to 6 arguments. Reading more than the caller passed relies on the SysV x86-64 and AAPCS64 ABIs: every
+    // argument is register sized, and the ones the caller didn't pass read leftover registers (or, for the last one on x86-64, a
+    // slot of the caller's stack frame), which the kernel ignores.
+    long a1 = va_arg(args, long);
+    long a2 = va_arg(args, long);
+    long a3 = va_arg(args, long);
+    long a4 = va_arg(args, long);
+    long a5 = va_arg(args, long);
+    long a6 = va_arg(args, long);
+    return real_syscall(number, a1, a2, a3, a4, a5, a6);
+}
+
+// Syscalls libc has no wrapper for (or only got one recently), so dynamically linked processes reach them through syscall(2)
+static bool is_interposed_raw_syscall(long number)
+{
+    switch (number)
+    {
+#ifdef SYS_io_uring_setup
+        case SYS_io_uring_setup:
+#endif
+#ifdef SYS_openat2
+        case SYS_openat2:
+#endif
+#ifdef SYS_close_range
+        case SYS_close_range:
+#endif
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Any syscall not handled below is forwarded before touching the observer, which issues syscalls of its own while initializing.
+INTERPOSE_SOMETIMES(
+    long,
+    syscall,
+    if (!is_interposed_raw_syscall(number)) {
+        va_list args;
+        va_start(args, number);
+        long result = fwd_raw_syscall(number, args);
+        va_end(args);
+        return result;
+    },
+    long number, ...)(
+{
+#ifdef SYS_io_uring_setup
+    // Requests submitted to an io_uring are picked up by the kernel straight from memory shared with the process (with
+    // SQPOLL, without the process entering the kernel at all), so none of the file accesses they carry can be observed.
+    // Fail it as if the kernel didn't support io_uring, which every io_uring user has to handle anyway by falling back to regular I/O.
+    if (number == SYS_io_uring_setup)
+    {
+        BXL_LOG_DEBUG(bxl, "[%s] io_uring is not supported under the sandbox, failing io_uring_setup with ENOSYS", __func__);
+        errno = ENOSYS;
+        return -1;
+    }
+#endif
+
+    va_list args;
+    va_list forwardedArgs;
+    va_start(args, number);
+    va_copy(forwardedArgs, args);
+
+    long result;
+    switch (number)
+    {
+#ifdef SYS_close_range
+        case SYS_close_range:
+        {
+            unsigned int first = va_arg(args, unsigned int);
+            unsigned int last = va_arg(args, unsigned int);
+            int flags = va_arg(args, int);
+            before_close_range(bxl, first, last, flags);
+            result = fwd_raw_syscall(number, forwardedArgs);
+            break;
+        }
+#endif
+#ifdef SYS_openat2
+        case SYS_openat2:
+        {
+            // Same as openat, with the flags in a struct open_how
+            int dirfd = va_arg(args, int);
+            const char *pathname = va_arg(args, const char *);
+            const struct open_how *how = va_arg(args, const struct open_how *);
+            if (pathname == nullptr || how == nullptr)
+            {
+                // The kernel fails these with EFAULT before accessing anything
+                result = fwd_raw_syscall(number, forwardedArgs);
+                break;
+            }
+
+            std::string pathStr = bxl->normalize_path_at(dirfd, pathname);
+            AccessReportGroup report;
+            AccessCheckResult check = CreateFileOpen(bxl, pathStr, (int)how->flags, report);
+            result_t<long> openResult = bxl->should_deny(check)
+                ? result_t<long>(ERROR_RETURN_VALUE, EPERM)
+                : result_t<long>(fwd_raw_syscall(number, forwardedArgs));
+            report.SetErrno(openResult.get() == ERROR_RETURN_VALUE ? openResult.get_errno() : 0);
+            bxl->SendReport(report);
+            result = openResult.get() == ERROR_RETURN_VALUE ? openResult.restore() : ret_fd((int)openResult.restore(), bxl);
+            break;
+        }
+#endif
+        default:
+            result = fwd_raw_syscall(number, forwardedArgs);
+            break;
+    }
+
+    va_end(forwardedArgs);
+    va_end(args);
+    return result;
+})
+#endif // defined(__x86_64__) || defined(__aarch64__)
+
 INTERPOSE(int, fclose, FILE *f) ({
+    bxl->ProtectReportFd(fileno(f));
     bxl->reset_fd_table_entry(fileno(f));
     return bxl->fwd_fclose(f).restore();
 })
 
 INTERPOSE(int, closedir, DIR *dirp) ({ 
+    bxl->ProtectReportFd(dirfd(dirp));
     bxl->reset_fd_table_entry(dirfd(dirp));
     return bxl->fwd_closedir(dirp).restore();
 })
 
+static int ret_dup_fd(int oldfd, int newfd, BxlObserver *bxl)
+{
+    // A duplicate refers to the same file as the original, so it inherits its entry in the fd table
+    if (newfd != -1)
+    {
+        bxl->duplicate_fd_table_entry(oldfd, newfd);
+    }
+
+    return newfd;
+}
+
 INTERPOSE(int, dup, int fd) ({ 
-    return ret_fd(bxl->real_dup(fd), bxl);    
+    return ret_dup_fd(fd, bxl->real_dup(fd), bxl);    
     // Sometimes useful (for debugging) to interpose without access checking:
     // return bxl->fwd_dup(fd).restore();     
 })
@@ -1292,9 +1904,14 @@ INTERPOSE(int, dup, int fd) ({
 INTERPOSE(int, dup2, int oldfd, int newfd)({
     // If the file descriptor newfd was previously open, it is closed
     // before being reused; the close is performed silently, so we should reset the fd table.
-    bxl->reset_fd_table_entry(newfd);
+    // This also applies to the descriptors we keep open for reporting.
+    if (oldfd != newfd)
+    {
+        bxl->ProtectReportFd(newfd);
+        bxl->reset_fd_table_entry(newfd);
+    }
 
-    return bxl->real_dup2(oldfd, newfd); 
+    return ret_dup_fd(oldfd, bxl->real_dup2(oldfd, newfd), bxl); 
     // Sometimes useful (for debugging) to interpose without access checking:
     // return bxl->fwd_dup2(oldfd, newfd).restore();  
 })
@@ -1302,13 +1919,119 @@ INTERPOSE(int, dup2, int oldfd, int newfd)({
 INTERPOSE(int, dup3, int oldfd, int newfd, int flags)({
     // If the file descriptor newfd was previously open, it is closed
     // before being reused; the close is performed silently, so we should reset the fd table.
-    bxl->reset_fd_table_entry(newfd);
+    // This also applies to the descriptors we keep open for reporting, which have to be moved out of the way before the call.
+    // Unlike dup2, dup3 fails with EINVAL when oldfd == newfd, and then closes nothing.
+    if (oldfd != newfd)
+    {
+        bxl->ProtectReportFd(newfd);
+    }
+
+    int result = bxl->real_dup3(oldfd, newfd, flags);
+    if (result != -1)
+    {
+        bxl->reset_fd_table_entry(newfd);
+    }
 
-    return bxl->real_dup3(oldfd, newfd, flags); 
+    return ret_dup_fd(oldfd, result, bxl); 
     // Sometimes useful (for debugging) to interpose without access checking:
     //return bxl->fwd_dup3(oldfd, newfd).restore();  
 })
 
+// Whether the third argument of an fcntl command is a pointer (the lock and owner commands) rather than an int
+static bool fcntl_takes_pointer(int cmd)
+{
+    switch (cmd)
+    {
+        case F_GETLK:
+        case F_SETLK:
+        case F_SETLKW:
+#if defined(F_GETLK64) && F_GETLK64 != F_GETLK
+        case F_GETLK64:
+        case F_SETLK64:
+        case F_SETLKW64:
+#endif
+#ifdef F_OFD_GETLK
+        case F_OFD_GETLK:
+        case F_OFD_SETLK:
+        case F_OFD_SETLKW:
+#endif
+#ifdef F_GETOWN_EX
+        case F_GETOWN_EX:
+        case F_SETOWN_EX:
+#endif
+#ifdef F_GET_RW_HINT
+        case F_GET_RW_HINT:
+        case F_SET_RW_HINT:
+        case F_GET_FILE_RW_HINT:
+        case F_SET_FILE_RW_HINT:
+#endif
+            return true;
+        default:
+            return false;
+    }
+}
+
+static int handle_fcntl(BxlObserver *bxl, int fd, int cmd, va_list args)
+{
+    // Every other command takes an int or no argument at all, in which case whatever is read is ignored by the real fcntl
+    int result = fcntl_takes_pointer(cmd)
+        ? bxl->real_fcntl(fd, cmd, va_arg(args, void*))
+        : bxl->real_fcntl(fd, cmd, va_arg(args, int));
+
+    if (cmd == F_DUPFD || cmd == F_DUPFD_CLOEXEC)
+    {
+        ret_dup_fd(fd, result, bxl);
+    }
+
+    return result;
+}
+
+INTERPOSE(int, fcntl, int fd, int cmd, ...)({
+    va_list args;
+    va_start(args, cmd);
+    int result = handle_fcntl(bxl, fd, cmd, args);
+    va_end(args);
+
+    return result;
+})
+
+// Newer glibc versions redirect fcntl to fcntl64 when building with 64-bit file offsets
+INTERPOSE(int, fcntl64, int fd, int cmd, ...)({
+    va_list args;
+    va_start(args, cmd);
+    int result = handle_fcntl(bxl, fd, cmd, args);
+    va_end(args);
+
+    return result;
+})
+
+INTERPOSE(int, pipe, int pipefd[2])({
+    // Pipes are not files, but their descriptors may reuse numbers whose close we missed
+    result_t<int> result = bxl->fwd_pipe(pipefd);
+    if (result.get() == 0)
+    {
+        bxl->reset_fd_table_entry(pipefd[0]);
+        bxl->reset_fd_table_entry(pipefd[1]);
+    }
+
+    return result.restore();
+})
+
+INTERPOSE(int, pipe2, int pipefd[2], int flags)({
+    result_t<int> result = bxl->fwd_pipe2(pipefd, flags);
+    if (result.get() == 0)
+    {
+        bxl->reset_fd_table_entry(pipefd[0]);
+        bxl->reset_fd_table_entry(pipefd[1]);
+    }
+
+    return result.restore();
+})
+
+INTERPOSE(int, socket, int domain, int type, int protocol)({
+    return ret_fd(bxl->real_socket(domain, type, protocol), bxl);
+})
+
 static void report_exit(int exitCode, void *args)
 {
     BxlObserver::GetInstance()->SendExitReport();
@@ -1320,6 +2043,9 @@ void __attribute__ ((constructor)) _bxl_linux_sandbox_init(void)
     // set up an on-exit handler
     on_exit(report_exit, NULL);
 
+    // A process counts itself as live before reporting anything (its parent may have counted it already, see claim_child_process)
+    BxlObserver::GetInstance()->add_to_process_tree(getpid());
+
     // report that a new process has been created 
     BxlObserver::GetInstance()->report_access("__init__", ES_EVENT_TYPE_NOTIFY_EXEC, __progname);
     BxlObserver::GetInstance()->report_exec_args(getpid());
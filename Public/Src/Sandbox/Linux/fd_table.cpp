@@ -0,0 +1,227 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "fd_table.hpp"
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <string.h>
+
+FdTable::~FdTable()
+{
+    for (int i = 0; i < MAX_CHUNKS; i++)
+    {
+        delete chunks_[i].load(std::memory_order_relaxed);
+    }
+}
+
+FdTable::Chunk *FdTable::GetChunk(int fd, bool create)
+{
+    if (fd < 0 || fd / CHUNK_SIZE >= MAX_CHUNKS)
+    {
+        return nullptr;
+    }
+
+    std::atomic<Chunk *> &slot = chunks_[fd / CHUNK_SIZE];
+    Chunk *chunk = slot.load(std::memory_order_acquire);
+    if (chunk != nullptr || !create)
+    {
+        return chunk;
+    }
+
+    Chunk *newChunk = new (std::nothrow) Chunk;
+    if (newChunk == nullptr)
+    {
+        return nullptr;
+    }
+
+    for (int i = 0; i < CHUNK_SIZE; i++)
+    {
+        newChunk->entries[i].store(nullptr, std::memory_order_relaxed);
+        newChunk->flags[i].store(0, std::memory_order_relaxed);
+    }
+
+    // Another thread may have allocated the same chunk concurrently. In that case keep the winner's.
+    if (!slot.compare_exchange_strong(chunk, newChunk, std::memory_order_acq_rel))
+    {
+        delete newChunk;
+        return chunk;
+    }
+
+    return newChunk;
+}
+
+const std::string *FdTable::Intern(const char *path)
+{
+    // Never block: failing to acquire the lock just means the path is not cached this time
+    if (!pathsMtx_.try_lock_for(std::chrono::milliseconds(1)))
+    {
+        return nullptr;
+    }
+
+    const std::string *interned = nullptr;
+    auto it = paths_.find(path);
+    if (it != paths_.end())
+    {
+        interned = &*it;
+    }
+    else if (paths_.size() < MAX_INTERNED_PATHS)
+    {
+        // Elements of a node-based set don't move on rehash, so the pointer stays valid
+        interned = &*paths_.emplace(path).first;
+    }
+
+    pathsMtx_.unlock();
+    return interned;
+}
+
+const std::string *FdTable::Lookup(int fd) const
+{
+    if (fd < 0 || fd / CHUNK_SIZE >= MAX_CHUNKS)
+    {
+        return nullptr;
+    }
+
+    Chunk *chunk = chunks_[fd / CHUNK_SIZE].load(std::memory_order_acquire);
+    return chunk == nullptr ? nullptr : chunk->entries[fd % CHUNK_SIZE].load(std::memory_order_acquire);
+}
+
+bool FdTable::Get(int fd, std::string &path) const
+{
+    const std::string *entry = Lookup(fd);
+    if (entry == nullptr)
+    {
+        return false;
+    }
+
+    path = *entry;
+    return true;
+}
+
+bool FdTable::Get(int fd, char *path, size_t size) const
+{
+    const std::string *entry = Lookup(fd);
+    if (entry == nullptr || entry->length() >= size)
+    {
+        return false;
+    }
+
+    memcpy(path, entry->c_str(), entry->length() + 1);
+    return true;
+}
+
+void FdTable::Set(int fd, const char *path)
+{
+    Chunk *chunk = GetChunk(fd, /* create */ true);
+    if (chunk == nullptr)
+    {
+        return;
+    }
+
+    // If the path can't be interned the entry is reset, so it never keeps pointing to whatever was there before
+    chunk->entries[fd % CHUNK_SIZE].store(Intern(path), std::memory_order_release);
+}
+
+void FdTable::Reset(int fd)
+{
+    Chunk *chunk = GetChunk(fd, /* create */ false);
+    if (chunk != nullptr)
+    {
+        chunk->flags[fd % CHUNK_SIZE].store(0, std::memory_order_release);
+        chunk->entries[fd % CHUNK_SIZE].store(nullptr, std::memory_order_release);
+    }
+}
+
+void FdTable::ResetRange(int first, int last)
+{
+    first = std::max(first, 0);
+    last = std::min(last, MAX_CHUNKS * CHUNK_SIZE - 1);
+    if (first > last)
+    {
+        return;
+    }
+
+    for (int i = first / CHUNK_SIZE; i <= last / CHUNK_SIZE; i++)
+    {
+        Chunk *chunk = chunks_[i].load(std::memory_order_acquire);
+        if (chunk == nullptr)
+        {
+            continue;
+        }
+
+        int begin = i == first / CHUNK_SIZE ? first % CHUNK_SIZE : 0;
+        int end = i == last / CHUNK_SIZE ? last % CHUNK_SIZE : CHUNK_SIZE - 1;
+        for (int j = begin; j <= end; j++)
+        {
+            chunk->flags[j].store(0, std::memory_order_release);
+            chunk->entries[j].store(nullptr, std::memory_order_release);
+        }
+    }
+}
+
+bool FdTable::HasFlag(int fd, Flag flag) const
+{
+    if (fd < 0 || fd / CHUNK_SIZE >= MAX_CHUNKS)
+    {
+        return false;
+    }
+
+    Chunk *chunk = chunks_[fd / CHUNK_SIZE].load(std::memory_order_acquire);
+    return chunk != nullptr && (chunk->flags[fd % CHUNK_SIZE].load(std::memory_order_acquire) & flag) != 0;
+}
+
+void FdTable::SetFlag(int fd, Flag flag)
+{
+    Chunk *chunk = GetChunk(fd, /* create */ true);
+    if (chunk != nullptr)
+    {
+        chunk->flags[fd % CHUNK_SIZE].fetch_or(flag, std::memory_order_acq_rel);
+    }
+}
+
+void FdTable::Duplicate(int oldFd, int newFd)
+{
+    if (oldFd == newFd)
+    {
+        return;
+    }
+
+    Chunk *oldChunk = GetChunk(oldFd, /* create */ false);
+    const std::string *entry = oldChunk != nullptr
+        ? oldChunk->entries[oldFd % CHUNK_SIZE].load(std::memory_order_acquire)
+        : nullptr;
+    uint8_t flags = oldChunk != nullptr
+        ? oldChunk->flags[oldFd % CHUNK_SIZE].load(std::memory_order_acquire) & NonFile
+        : 0;
+
+    Reset(newFd);
+    if (entry == nullptr && flags == 0)
+    {
+        return;
+    }
+
+    Chunk *newChunk = GetChunk(newFd, /* create */ true);
+    if (newChunk != nullptr)
+    {
+        newChunk->flags[newFd % CHUNK_SIZE].store(flags, std::memory_order_release);
+        newChunk->entries[newFd % CHUNK_SIZE].store(entry, std::memory_order_release);
+    }
+}
+
+void FdTable::Clear()
+{
+    for (int i = 0; i < MAX_CHUNKS; i++)
+    {
+        Chunk *chunk = chunks_[i].load(std::memory_order_acquire);
+        if (chunk == nullptr)
+        {
+            continue;
+        }
+
+        for (int j = 0; j < CHUNK_SIZE; j++)
+        {
+            chunk->flags[j].store(0, std::memory_order_release);
+            chunk->entries[j].store(nullptr, std::memory_order_release);
+        }
+    }
+}
@@ -0,0 +1,85 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_set>
+
+/**
+ * Maps file descriptors to the paths they were resolved to.
+ *
+ * The table is split in chunks of CHUNK_SIZE descriptors that are only allocated when a descriptor in their range gets an
+ * entry, so processes with a handful of descriptors pay for a single chunk while the ones with many thousands still get
+ * cached paths. Entries point to interned paths: a path is stored once no matter how many descriptors refer to it.
+ *
+ * Besides its path, every descriptor has a set of flags (see Flag) that are reset along with it.
+ *
+ * Lookups never block. Interned paths are never freed (readers may be copying them), so once MAX_INTERNED_PATHS distinct
+ * paths were seen new paths just don't get cached anymore.
+ */
+class FdTable final
+{
+public:
+    enum Flag : uint8_t
+    {
+        // A write to the descriptor was already checked and reported
+        WriteChecked = 1,
+        // The descriptor is a non-file (e.g. a pipe, a socket or a terminal). Duplicates inherit this one.
+        NonFile = 2,
+        // The descriptor belongs to a directory stream whose enumeration was already checked and reported
+        Enumerated = 4,
+    };
+
+    FdTable() = default;
+    ~FdTable();
+    FdTable(const FdTable&) = delete;
+    FdTable& operator = (const FdTable&) = delete;
+
+    // Sets path to the cached path for fd and returns true, or returns false if there is none
+    bool Get(int fd, std::string &path) const;
+
+    // Same as above, but copies the cached path (null-terminated) to a buffer of the given size, so a hit allocates nothing.
+    // Returns false if there is no cached path or it doesn't fit.
+    bool Get(int fd, char *path, size_t size) const;
+
+    // Caches path for fd. Might not cache anything if the interned paths are exhausted or busy.
+    void Set(int fd, const char *path);
+
+    void Reset(int fd);
+
+    // Resets every entry from first to last (both inclusive), like close_range does. Chunks that were never allocated are skipped.
+    void ResetRange(int first, int last);
+
+    bool HasFlag(int fd, Flag flag) const;
+    void SetFlag(int fd, Flag flag);
+
+    // Makes newFd refer to whatever oldFd refers to, like dup does. Only NonFile is copied, the rest of the flags of newFd are reset.
+    void Duplicate(int oldFd, int newFd);
+
+    // Resets every entry
+    void Clear();
+
+private:
+    static const int CHUNK_SIZE = 1024;
+    // Enough for 1M descriptors, which is the default hard limit of RLIMIT_NOFILE on most distributions
+    static const int MAX_CHUNKS = 1024;
+    static const size_t MAX_INTERNED_PATHS = 65536;
+
+    struct Chunk
+    {
+        std::atomic<const std::string *> entries[CHUNK_SIZE];
+        std::atomic<uint8_t> flags[CHUNK_SIZE];
+    };
+
+    Chunk *GetChunk(int fd, bool create);
+    const std::string *Lookup(int fd) const;
+    const std::string *Intern(const char *path);
+
+    std::atomic<Chunk *> chunks_[MAX_CHUNKS] = {};
+    std::timed_mutex pathsMtx_;
+    std::unordered_set<std::string> paths_;
+};
@@ -0,0 +1,22 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+static const uint64_t FNV1A_OFFSET_BASIS = 0xcbf29ce484222325ull;
+
+// FNV-1a over the given bytes. Tables shared between processes hash with it, so it must stay the same across builds.
+inline uint64_t Fnv1a(const char *data, size_t length, uint64_t seed = FNV1A_OFFSET_BASIS)
+{
+    uint64_t hash = seed;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
@@ -0,0 +1,200 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "interpose_profiler.hpp"
+
+#include <new>
+#include <stdio.h>
+#include <string.h>
+
+void InterposeProfiler::Initialize(bool enabled)
+{
+    // The key destructor hands the counters of a terminating thread over to the next thread that starts
+    enabled_ = enabled && pthread_key_create(&countersKey_, ReleaseThreadCounters) == 0;
+}
+
+int InterposeProfiler::GetSiteIndex(InterposeProfileSite &site)
+{
+    int index = site.index_.load(std::memory_order_acquire);
+    if (index >= 0)
+    {
+        return index;
+    }
+
+    // Reserving an index for a site that another thread is registering at the same time just wastes that index
+    int reserved = siteCount_.fetch_add(1, std::memory_order_relaxed);
+    if (reserved >= MAX_SITES)
+    {
+        siteCount_.store(MAX_SITES, std::memory_order_relaxed);
+        return -1;
+    }
+
+    siteNames_[reserved].store(site.name_, std::memory_order_release);
+    if (site.index_.compare_exchange_strong(index, reserved, std::memory_order_acq_rel))
+    {
+        return reserved;
+    }
+
+    // Lost the race: the reserved index stays unnamed, and never gets counted
+    siteNames_[reserved].store(nullptr, std::memory_order_release);
+    return index;
+}
+
+InterposeProfiler::Counters* InterposeProfiler::GetThreadCounters()
+{
+    Counters *counters = (Counters *)pthread_getspecific(countersKey_);
+    if (counters != nullptr)
+    {
+        return counters;
+    }
+
+    // Reuse the counters of a terminated thread if there is one
+    for (counters = counters_.load(std::memory_order_acquire); counters != nullptr; counters = counters->next)
+    {
+        bool expected = false;
+        if (counters->claimed.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        {
+            break;
+        }
+    }
+
+    if (counters == nullptr)
+    {
+        counters = new (std::nothrow) Counters();
+        if (counters == nullptr)
+        {
+            return nullptr;
+        }
+
+        counters->currentSite = -1;
+        counters->claimed.store(true, std::memory_order_relaxed);
+        counters->next = counters_.load(std::memory_order_relaxed);
+        while (!counters_.compare_exchange_weak(counters->next, counters, std::memory_order_release, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    pthread_setspecific(countersKey_, counters);
+    return counters;
+}
+
+void InterposeProfiler::ReleaseThreadCounters(void *data)
+{
+    Counters *counters = (Counters *)data;
+    counters->currentSite = -1;
+    counters->claimed.store(false, std::memory_order_release);
+}
+
+void InterposeProfiler::CountReport()
+{
+    if (!enabled_)
+    {
+        return;
+    }
+
+    Counters *counters = (Counters *)pthread_getspecific(countersKey_);
+    if (counters != nullptr && counters->currentSite >= 0)
+    {
+        counters->reports[counters->currentSite]++;
+    }
+}
+
+void InterposeProfiler::CountCacheHit()
+{
+    if (!enabled_)
+    {
+        return;
+    }
+
+    Counters *counters = (Counters *)pthread_getspecific(countersKey_);
+    if (counters != nullptr && counters->currentSite >= 0)
+    {
+        counters->cacheHits[counters->currentSite]++;
+    }
+}
+
+std::vector<InterposeProfiler::SiteStats> InterposeProfiler::Collect() const
+{
+    std::vector<SiteStats> result;
+    if (!enabled_)
+    {
+        return result;
+    }
+
+    int siteCount = siteCount_.load(std::memory_order_acquire);
+    if (siteCount > MAX_SITES)
+    {
+        siteCount = MAX_SITES;
+    }
+
+    // Counters are not synchronized with the threads still writing them, which is fine for a summary sent on process exit
+    Counters *head = counters_.load(std::memory_order_acquire);
+    for (int i = 0; i < siteCount; i++)
+    {
+        const char *name = siteNames_[i].load(std::memory_order_acquire);
+        if (name == nullptr)
+        {
+            continue;
+        }
+
+        SiteStats stats = { name, 0, 0, 0, 0 };
+        for (Counters *counters = head; counters != nullptr; counters = counters->next)
+        {
+            stats.calls += counters->calls[i];
+            stats.reports += counters->reports[i];
+            stats.cacheHits += counters->cacheHits[i];
+            stats.nanoseconds += counters->nanoseconds[i];
+        }
+
+        if (stats.calls > 0)
+        {
+            result.push_back(stats);
+        }
+    }
+
+    return result;
+}
+
+std::vector<std::string> InterposeProfiler::Summarize(size_t maxLength) const
+{
+    std::vector<std::string> messages;
+    std::string current;
+    char entry[256];
+
+    for (const SiteStats &stats : Collect())
+    {
+        int length = snprintf(entry, sizeof(entry), "%s %llu/%llu/%llu/%llu", stats.name,
+            (unsigned long long)stats.calls, (unsigned long long)stats.reports,
+            (unsigned long long)stats.cacheHits, (unsigned long long)stats.nanoseconds);
+        if (length <= 0)
+        {
+            continue;
+        }
+
+        size_t entryLength = (size_t)length < sizeof(entry) ? (size_t)length : sizeof(entry) - 1;
+        if (entryLength > maxLength)
+        {
+            continue;
+        }
+
+        if (!current.empty() && current.length() + 2 + entryLength > maxLength)
+        {
+            messages.push_back(current);
+            current.clear();
+        }
+
+        if (!current.empty())
+        {
+            current.append(", ");
+        }
+
+        current.append(entry, entryLength);
+    }
+
+    if (!current.empty())
+    {
+        messages.push_back(current);
+    }
+
+    return messages;
+}
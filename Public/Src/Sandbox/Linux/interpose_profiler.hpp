@@ -0,0 +1,154 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+/**
+ * A place whose calls get profiled: an interposed libc function or a ptrace syscall handler.
+ *
+ * Sites are declared as function-local statics (see INTERPOSE_SOMETIMES), which are constant-initialized, so declaring one
+ * costs nothing. A site gets its index the first time it is profiled.
+ */
+class InterposeProfileSite final
+{
+public:
+    constexpr explicit InterposeProfileSite(const char *name) : name_(name) { }
+
+    const char* GetName() const { return name_; }
+
+private:
+    friend class InterposeProfiler;
+
+    const char *name_;
+    std::atomic<int> index_ { -1 };
+};
+
+/**
+ * Per-site call counts, reports sent, cache hits and time spent, enabled by FileAccessManifestExtraFlag::ProfileDetours.
+ *
+ * Every thread gets its own counters, which only that thread writes, so counting is just plain increments. Counters are kept in
+ * a push-only list and never freed, so the ones of terminated threads are still accounted in the summary sent on process exit;
+ * they get reused (and keep accumulating) when new threads start.
+ * Reports and cache hits are accounted to the innermost site being profiled on the calling thread.
+ */
+class InterposeProfiler final
+{
+public:
+    // Comfortably above the number of interposed functions and ptrace handlers. Sites past this are not profiled.
+    static const int MAX_SITES = 512;
+
+    struct SiteStats
+    {
+        const char *name;
+        uint64_t calls;
+        uint64_t reports;
+        uint64_t cacheHits;
+        uint64_t nanoseconds;
+    };
+
+    InterposeProfiler() = default;
+    InterposeProfiler(const InterposeProfiler&) = delete;
+    InterposeProfiler& operator = (const InterposeProfiler&) = delete;
+
+    // Profiling is off until this is called with enabled set
+    void Initialize(bool enabled);
+
+    inline bool IsEnabled() const { return enabled_; }
+
+    // Accounted to the site being profiled on the calling thread, if any
+    void CountReport();
+    void CountCacheHit();
+
+    // Sums the counters of every thread, for the sites that were called at least once
+    std::vector<SiteStats> Collect() const;
+
+    // Returns the collected counters as "name calls/reports/cacheHits/ns" entries separated by ", ". Every returned string is at most
+    // maxLength characters long, so it can be sent as a single message.
+    std::vector<std::string> Summarize(size_t maxLength) const;
+
+    static inline uint64_t GetMonotonicNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+private:
+    friend class InterposeProfileScope;
+
+    struct Counters
+    {
+        uint64_t calls[MAX_SITES];
+        uint64_t reports[MAX_SITES];
+        uint64_t cacheHits[MAX_SITES];
+        uint64_t nanoseconds[MAX_SITES];
+        // Innermost site being profiled on the owning thread, or -1
+        int currentSite;
+        // Set while a live thread owns these counters
+        std::atomic<bool> claimed;
+        Counters *next;
+    };
+
+    // Counters of the calling thread, allocated on first use. Returns nullptr if they couldn't be allocated.
+    Counters* GetThreadCounters();
+    int GetSiteIndex(InterposeProfileSite &site);
+    static void ReleaseThreadCounters(void *counters);
+
+    bool enabled_ = false;
+    pthread_key_t countersKey_;
+    std::atomic<Counters*> counters_ { nullptr };
+    std::atomic<int> siteCount_ { 0 };
+    std::atomic<const char*> siteNames_[MAX_SITES] = { };
+};
+
+/**
+ * Counts a call to a site and the time spent in it. Does nothing when the profiler is disabled.
+ */
+class InterposeProfileScope final
+{
+public:
+    InterposeProfileScope(InterposeProfiler &profiler, InterposeProfileSite &site)
+    {
+        if (!profiler.IsEnabled())
+        {
+            return;
+        }
+
+        int index = profiler.GetSiteIndex(site);
+        counters_ = index < 0 ? nullptr : profiler.GetThreadCounters();
+        if (counters_ != nullptr)
+        {
+            index_ = index;
+            previousSite_ = counters_->currentSite;
+            counters_->currentSite = index;
+            counters_->calls[index]++;
+            start_ = InterposeProfiler::GetMonotonicNs();
+        }
+    }
+
+    ~InterposeProfileScope()
+    {
+        if (counters_ != nullptr)
+        {
+            counters_->nanoseconds[index_] += InterposeProfiler::GetMonotonicNs() - start_;
+            counters_->currentSite = previousSite_;
+        }
+    }
+
+    InterposeProfileScope(const InterposeProfileScope&) = delete;
+    InterposeProfileScope& operator = (const InterposeProfileScope&) = delete;
+
+private:
+    InterposeProfiler::Counters *counters_ = nullptr;
+    int index_ = -1;
+    int previousSite_ = -1;
+    uint64_t start_ = 0;
+};
@@ -2,6 +2,9 @@
 // Licensed under the MIT License.
 
 #include "observer_utilities.hpp"
+#include <algorithm>
+#include <elf.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
@@ -105,3 +108,157 @@ void parse_variadic_args(const char *arg, ptrdiff_t argc, va_list args, char **a
         argv[i] = va_arg(args, char *);
     }
 }
+
+// Translates a virtual address to a file offset using the PT_LOAD segments of the image
+template <typename Phdr>
+static bool vaddr_to_offset(const Phdr *phdrs, size_t phnum, uint64_t vaddr, uint64_t &offset)
+{
+    for (size_t i = 0; i < phnum; i++)
+    {
+        if (phdrs[i].p_type == PT_LOAD && vaddr >= phdrs[i].p_vaddr && vaddr - phdrs[i].p_vaddr < phdrs[i].p_filesz)
+        {
+            offset = phdrs[i].p_offset + (vaddr - phdrs[i].p_vaddr);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+template <typename Ehdr, typename Phdr, typename Dyn>
+static bool is_elf_statically_linked(const char *image, size_t size)
+{
+    if (size < sizeof(Ehdr))
+    {
+        return false;
+    }
+
+    const Ehdr *ehdr = (const Ehdr *)image;
+    if (ehdr->e_phnum == 0 || ehdr->e_phentsize != sizeof(Phdr) || ehdr->e_phoff > size || (size - ehdr->e_phoff) / sizeof(Phdr) < ehdr->e_phnum)
+    {
+        // Not an image with program headers (e.g. an object file)
+        return false;
+    }
+
+    const Phdr *phdrs = (const Phdr *)(image + ehdr->e_phoff);
+    const Phdr *dynamic = nullptr;
+    for (size_t i = 0; i < ehdr->e_phnum; i++)
+    {
+        if (phdrs[i].p_type == PT_DYNAMIC)
+        {
+            dynamic = &phdrs[i];
+            break;
+        }
+    }
+
+    // No dynamic section at all: nothing gets loaded into this process.
+    // Observe that a PT_INTERP segment doesn't imply libc gets loaded (e.g. static-pie binaries), only DT_NEEDED entries do.
+    if (dynamic == nullptr)
+    {
+        return true;
+    }
+
+    if (dynamic->p_offset > size || dynamic->p_filesz > size - dynamic->p_offset)
+    {
+        return false;
+    }
+
+    const Dyn *dyns = (const Dyn *)(image + dynamic->p_offset);
+    size_t dynCount = dynamic->p_filesz / sizeof(Dyn);
+
+    // The string table is referenced by its virtual address
+    uint64_t strtabOffset = 0;
+    uint64_t strtabSize = 0;
+    bool strtabFound = false;
+    for (size_t i = 0; i < dynCount && dyns[i].d_tag != DT_NULL; i++)
+    {
+        if (dyns[i].d_tag == DT_STRTAB)
+        {
+            strtabFound = vaddr_to_offset(phdrs, ehdr->e_phnum, dyns[i].d_un.d_ptr, strtabOffset);
+        }
+        else if (dyns[i].d_tag == DT_STRSZ)
+        {
+            strtabSize = dyns[i].d_un.d_val;
+        }
+    }
+
+    if (!strtabFound || strtabOffset > size)
+    {
+        return false;
+    }
+
+    strtabSize = std::min<uint64_t>(strtabSize, size - strtabOffset);
+    const char *strtab = image + strtabOffset;
+
+    const char libc[] = "libc.so.";
+    for (size_t i = 0; i < dynCount && dyns[i].d_tag != DT_NULL; i++)
+    {
+        uint64_t nameOffset = dyns[i].d_un.d_val;
+        if (dyns[i].d_tag == DT_NEEDED
+            && nameOffset < strtabSize
+            && strtabSize - nameOffset >= sizeof(libc) - 1
+            && strncmp(&strtab[nameOffset], libc, sizeof(libc) - 1) == 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool is_elf_statically_linked(const char *image, size_t size)
+{
+    if (size < EI_NIDENT || memcmp(image, ELFMAG, SELFMAG) != 0)
+    {
+        return false;
+    }
+
+    switch (image[EI_CLASS])
+    {
+        case ELFCLASS64:
+            return is_elf_statically_linked<Elf64_Ehdr, Elf64_Phdr, Elf64_Dyn>(image, size);
+        case ELFCLASS32:
+            return is_elf_statically_linked<Elf32_Ehdr, Elf32_Phdr, Elf32_Dyn>(image, size);
+        default:
+            return false;
+    }
+}
+
+void PathArena::Clear()
+{
+    buffer_.clear();
+    offsets_.clear();
+}
+
+size_t PathArena::Add(const char *path, size_t length)
+{
+    size_t offset = buffer_.size();
+    buffer_.resize(offset + length + 1);
+    memcpy(&buffer_[offset], path, length);
+    buffer_[offset + length] = '\0';
+
+    offsets_.push_back(offset);
+    return offsets_.size() - 1;
+}
+
+size_t PathArena::AddChild(size_t parent, const char *name, size_t nameLength)
+{
+    size_t parentLength = GetLength(parent);
+    size_t offset = buffer_.size();
+
+    // Resize first: the parent is copied from the buffer itself, which may move
+    buffer_.resize(offset + parentLength + 1 + nameLength + 1);
+    memcpy(&buffer_[offset], &buffer_[offsets_[parent]], parentLength);
+    buffer_[offset + parentLength] = '/';
+    memcpy(&buffer_[offset + parentLength + 1], name, nameLength);
+    buffer_[offset + parentLength + 1 + nameLength] = '\0';
+
+    offsets_.push_back(offset);
+    return offsets_.size() - 1;
+}
+
+size_t PathArena::GetLength(size_t index) const
+{
+    size_t end = index + 1 < offsets_.size() ? offsets_[index + 1] : buffer_.size();
+    return end - offsets_[index] - 1;
+}
@@ -7,6 +7,7 @@
 #include <string>
 #include <stdarg.h>
 #include <cstddef>
+#include <vector>
 
 // Resolves a provided filename against the environment by checking if it exists by using stat
 // This closely follows the logic used by glibc: https://codebrowser.dev/glibc/glibc/posix/execvpe.c.html
@@ -21,4 +22,31 @@ bool check_if_path_exists(std::string root, std::string filename, std::string &p
 ptrdiff_t get_variadic_argc(va_list args);
 
 // Given a va_list and an argument count, parse arguments into argv
-void parse_variadic_args(const char *arg, ptrdiff_t argc, va_list args, char **argv);
\ No newline at end of file
+void parse_variadic_args(const char *arg, ptrdiff_t argc, va_list args, char **argv);
+
+// Inspects the ELF image in the given buffer (typically the mapped contents of an executable) and determines whether it is a
+// statically linked binary, i.e., its dynamic section (if any) does not list a 'libc.so.*' dependency, so the interposer cannot be loaded into it.
+// Returns false if the buffer does not contain a well-formed ELF image with program headers.
+bool is_elf_statically_linked(const char *image, size_t size);
+
+// Stores NUL-terminated paths back to back in a single buffer, so collecting many of them (e.g. when enumerating a directory)
+// doesn't take an allocation per path. Paths are identified by their index. Pointers returned by Get are invalidated by Add.
+class PathArena final
+{
+public:
+    void Clear();
+
+    // Adds a path and returns its index
+    size_t Add(const char *path, size_t length);
+
+    // Adds the path at index parent followed by '/' and name, and returns its index
+    size_t AddChild(size_t parent, const char *name, size_t nameLength);
+
+    const char *Get(size_t index) const { return &buffer_[offsets_[index]]; }
+    size_t GetLength(size_t index) const;
+    size_t Count() const { return offsets_.size(); }
+
+private:
+    std::vector<char> buffer_;
+    std::vector<size_t> offsets_;
+};
@@ -0,0 +1,164 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "path_search_cache.hpp"
+#include "fnv1a.hpp"
+#include "shared_mapping.hpp"
+#include <string.h>
+#include <sys/mman.h>
+
+PathSearchCache::~PathSearchCache()
+{
+    if (table_ != nullptr)
+    {
+        munmap(table_, sizeof(Table));
+    }
+}
+
+bool PathSearchCache::Open(const char *filePath)
+{
+    // A freshly extended file is all zeros, which is an empty table
+    table_ = SharedMapping::Open<Table>(filePath, sizeof(Table), MAGIC,
+        [](Table &t)
+        {
+            t.version = VERSION;
+            t.capacity = CAPACITY;
+        },
+        [](const Table &t) { return t.version == VERSION && t.capacity == CAPACITY; });
+    return table_ != nullptr;
+}
+
+bool PathSearchCache::Matches(const Entry &entry, const char *name, size_t nameLength, uint64_t searchPathHash, size_t searchPathLength)
+{
+    return entry.searchPathHash == searchPathHash
+        && entry.searchPathLength == searchPathLength
+        && entry.nameLength == nameLength
+        && memcmp(entry.name, name, nameLength) == 0;
+}
+
+uint32_t PathSearchCache::GetNameGeneration(const char *name, size_t nameLength) const
+{
+    if (table_ == nullptr)
+    {
+        return 0;
+    }
+
+    // Both counters only go up, so bumping either changes the sum
+    return table_->generation.load(std::memory_order_acquire)
+        + table_->nameGenerations[Fnv1a(name, nameLength) % NAME_GENERATIONS].load(std::memory_order_acquire);
+}
+
+void PathSearchCache::InvalidateName(const char *name, size_t nameLength)
+{
+    // Longer names are never remembered, so there is nothing to drop
+    if (table_ != nullptr && nameLength <= MAX_NAME_LENGTH)
+    {
+        table_->nameGenerations[Fnv1a(name, nameLength) % NAME_GENERATIONS].fetch_add(1, std::memory_order_acq_rel);
+    }
+}
+
+void PathSearchCache::InvalidateAll()
+{
+    if (table_ != nullptr)
+    {
+        table_->generation.fetch_add(1, std::memory_order_acq_rel);
+    }
+}
+
+bool PathSearchCache::TryGet(const char *name, size_t nameLength, const char *searchPath, size_t searchPathLength, uint32_t &foundIndex, mode_t &mode) const
+{
+    if (table_ == nullptr || nameLength > MAX_NAME_LENGTH)
+    {
+        return false;
+    }
+
+    uint64_t searchPathHash = Fnv1a(searchPath, searchPathLength);
+    size_t start = Fnv1a(name, nameLength) ^ searchPathHash;
+    for (uint32_t probe = 0; probe < MAX_PROBES; probe++)
+    {
+        const Entry &entry = table_->entries[(start + probe) % CAPACITY];
+        uint32_t sequence = entry.sequence.load(std::memory_order_acquire);
+        if (sequence == 0)
+        {
+            // Entries are never removed, so the chain ends here
+            return false;
+        }
+
+        if (sequence % 2 != 0)
+        {
+            // Being written by another process: the lookup just misses
+            continue;
+        }
+
+        Entry copy;
+        memcpy((char *)&copy + sizeof(copy.sequence), (const char *)&entry + sizeof(entry.sequence), sizeof(Entry) - sizeof(entry.sequence));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (entry.sequence.load(std::memory_order_relaxed) != sequence || !Matches(copy, name, nameLength, searchPathHash, searchPathLength))
+        {
+            continue;
+        }
+
+        // A name is in at most one entry, so a stale one is a miss
+        if (copy.nameGeneration != GetNameGeneration(name, nameLength))
+        {
+            return false;
+        }
+
+        foundIndex = copy.foundIndex;
+        mode = (mode_t)copy.mode;
+        return true;
+    }
+
+    return false;
+}
+
+void PathSearchCache::Add(const char *name, size_t nameLength, const char *searchPath, size_t searchPathLength, uint32_t nameGeneration, uint32_t foundIndex, mode_t mode)
+{
+    if (table_ == nullptr || nameLength > MAX_NAME_LENGTH)
+    {
+        return;
+    }
+
+    uint64_t searchPathHash = Fnv1a(searchPath, searchPathLength);
+    size_t start = Fnv1a(name, nameLength) ^ searchPathHash;
+    for (uint32_t probe = 0; probe < MAX_PROBES; probe++)
+    {
+        Entry &entry = table_->entries[(start + probe) % CAPACITY];
+        uint32_t sequence = entry.sequence.load(std::memory_order_acquire);
+        if (sequence % 2 != 0)
+        {
+            // Someone else is writing it, maybe the same search: leave it to them
+            if (entry.nameLength == nameLength && memcmp(entry.name, name, nameLength) == 0)
+            {
+                return;
+            }
+
+            continue;
+        }
+
+        // An empty entry gets claimed, and the entry of the same search gets rewritten (it is stale, or we wouldn't be searching)
+        if (sequence != 0 && !Matches(entry, name, nameLength, searchPathHash, searchPathLength))
+        {
+            continue;
+        }
+
+        if (!entry.sequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_acquire))
+        {
+            // Lost a race for this entry. Whoever won is most likely adding the very same search.
+            return;
+        }
+
+        entry.nameGeneration = nameGeneration;
+        entry.searchPathHash = searchPathHash;
+        entry.searchPathLength = (uint32_t)searchPathLength;
+        entry.foundIndex = foundIndex;
+        entry.mode = (uint32_t)mode;
+        entry.nameLength = (uint32_t)nameLength;
+        memcpy(entry.name, name, nameLength);
+        entry.name[nameLength] = '\0';
+        entry.sequence.store(sequence + 2, std::memory_order_release);
+        return;
+    }
+
+    // Too many collisions (or the table is full). The search is not remembered.
+}
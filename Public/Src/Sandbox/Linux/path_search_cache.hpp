@@ -0,0 +1,90 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * A fixed-size, lock-free table of PATH searches (the ones execvp and friends make for a name without a '/') living in a file
+ * mapped by all processes of a pip, so a name gets searched once per PATH value instead of once per exec.
+ *
+ * A search is keyed by the name and by a hash of the PATH value (plus its length), and remembers the index of the PATH entry
+ * the name was found in (or that it wasn't found anywhere) along with the mode of what was found.
+ *
+ * A search only stays valid as long as nothing named the same gets created or removed: every such change observed by any process
+ * of the pip bumps the generation of the name (see InvalidateName), and a search recorded under an older generation is a miss.
+ * Names share generations by hash, so an unrelated change may drop a search too. Changes that can't be pinned to a name (e.g. a
+ * renamed directory) bump the generation of every name at once (see InvalidateAll).
+ *
+ * When the table is full, or the file can't be opened, searches are just not remembered.
+ */
+class PathSearchCache final
+{
+public:
+    // Longer names are not remembered
+    static const size_t MAX_NAME_LENGTH = 63;
+    // Index of a search that didn't find the name
+    static const uint32_t NOT_FOUND = UINT32_MAX;
+
+    PathSearchCache() = default;
+    ~PathSearchCache();
+    PathSearchCache(const PathSearchCache&) = delete;
+    PathSearchCache& operator = (const PathSearchCache&) = delete;
+
+    // Opens (creating it if needed) the table backed by the given file. Returns false if it can't be opened.
+    bool Open(const char *filePath);
+
+    bool IsValid() const { return table_ != nullptr; }
+
+    // Must be taken before searching, and passed to Add: a change made while searching invalidates what the search found
+    uint32_t GetNameGeneration(const char *name, size_t nameLength) const;
+
+    bool TryGet(const char *name, size_t nameLength, const char *searchPath, size_t searchPathLength, uint32_t &foundIndex, mode_t &mode) const;
+    void Add(const char *name, size_t nameLength, const char *searchPath, size_t searchPathLength, uint32_t nameGeneration, uint32_t foundIndex, mode_t mode);
+
+    // Drops every search for the given name (e.g. because a file with that name got created, removed or renamed)
+    void InvalidateName(const char *name, size_t nameLength);
+
+    // Drops every search
+    void InvalidateAll();
+
+private:
+    static const uint64_t MAGIC = 0x48435253484c5842; // "BXLHSRCH"
+    static const uint32_t VERSION = 1;
+    static const uint32_t CAPACITY = 4096;
+    static const uint32_t NAME_GENERATIONS = 1024;
+    static const uint32_t MAX_PROBES = 16;
+
+    // 'sequence' is 0 for an empty entry, odd while the entry is being (re)written, and even otherwise. Readers copy the entry
+    // out and only trust the copy if the sequence was the same (and even) before and after.
+    struct Entry
+    {
+        std::atomic<uint32_t> sequence;
+        uint32_t nameGeneration;
+        uint64_t searchPathHash;
+        uint32_t searchPathLength;
+        uint32_t foundIndex;
+        uint32_t mode;
+        uint32_t nameLength;
+        char name[MAX_NAME_LENGTH + 1];
+    };
+
+    struct Table
+    {
+        std::atomic<uint64_t> magic;
+        uint32_t version;
+        uint32_t capacity;
+        // Added to the generation of every name
+        std::atomic<uint32_t> generation;
+        std::atomic<uint32_t> nameGenerations[NAME_GENERATIONS];
+        Entry entries[CAPACITY];
+    };
+
+    static bool Matches(const Entry &entry, const char *name, size_t nameLength, uint64_t searchPathHash, size_t searchPathLength);
+
+    Table *table_ = nullptr;
+};
@@ -0,0 +1,188 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "process_tree_counter.hpp"
+#include "shared_mapping.hpp"
+
+bool ProcessTreeCounter::Open(const char *filePath, uint32_t capacity)
+{
+    if (capacity == 0)
+    {
+        return false;
+    }
+
+    // A freshly extended file is all zeros: no processes, and every entry free
+    Header *header = SharedMapping::Open<Header>(filePath, MappingSize(capacity), MAGIC,
+        [&](Header &h)
+        {
+            h.version = VERSION;
+            h.capacity = capacity;
+        },
+        [&](const Header &h) { return h.version == VERSION && h.capacity == capacity; });
+    if (header == nullptr)
+    {
+        return false;
+    }
+
+    header_ = header;
+    entries_ = (Entry *)(header + 1);
+    return true;
+}
+
+ProcessTreeCounter::Entry *ProcessTreeCounter::FindOrAdd(pid_t pid)
+{
+    uint32_t capacity = header_->capacity;
+    uint32_t probes = capacity < MAX_PROBES ? capacity : MAX_PROBES;
+    uint64_t hash = (uint64_t)(uint32_t)pid * 0x9E3779B97F4A7C15ull;
+    for (uint32_t probe = 0; probe < probes; probe++)
+    {
+        Entry &entry = entries_[(hash + probe) % capacity];
+        pid_t current = entry.pid.load(std::memory_order_acquire);
+        if (current == 0 && entry.pid.compare_exchange_strong(current, pid, std::memory_order_acq_rel))
+        {
+            return &entry;
+        }
+
+        // Either the entry was taken already, or another process just took it (maybe for the very same pid)
+        if (current == pid)
+        {
+            return &entry;
+        }
+    }
+
+    // From here on, a process may go uncounted: the tree can't be told complete anymore
+    header_->done.store(Overflowed, std::memory_order_release);
+    return nullptr;
+}
+
+bool ProcessTreeCounter::Decrement()
+{
+    if (header_->count.fetch_sub(1, std::memory_order_acq_rel) != 1)
+    {
+        return false;
+    }
+
+    uint32_t expected = NotDone;
+    return header_->done.compare_exchange_strong(expected, Completed, std::memory_order_acq_rel);
+}
+
+void ProcessTreeCounter::Add(pid_t pid)
+{
+    if (header_ == nullptr || pid <= 0)
+    {
+        return;
+    }
+
+    Entry *entry = FindOrAdd(pid);
+    if (entry == nullptr)
+    {
+        return;
+    }
+
+    // Counted before it shows up as live, so whoever removes it never takes the count below what it should be
+    header_->count.fetch_add(1, std::memory_order_acq_rel);
+    uint32_t state = entry->state.load(std::memory_order_acquire);
+    while (state != Live)
+    {
+        if (entry->state.compare_exchange_weak(state, Live, std::memory_order_acq_rel))
+        {
+            return;
+        }
+    }
+
+    // Added before: the entry already holds a count, so ours can't be the last one
+    header_->count.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void ProcessTreeCounter::Reserve()
+{
+    if (header_ != nullptr)
+    {
+        header_->count.fetch_add(1, std::memory_order_acq_rel);
+    }
+}
+
+bool ProcessTreeCounter::Release()
+{
+    return header_ != nullptr && Decrement();
+}
+
+bool ProcessTreeCounter::Claim(pid_t childPid)
+{
+    if (header_ == nullptr)
+    {
+        return false;
+    }
+
+    // A child that can't be found a place in the table keeps the reservation for good (and the tree open)
+    Entry *entry = childPid > 0 ? FindOrAdd(childPid) : nullptr;
+    if (entry == nullptr)
+    {
+        return false;
+    }
+
+    uint32_t state = entry->state.load(std::memory_order_acquire);
+    while (true)
+    {
+        switch (state)
+        {
+            case Live:
+                // The child added itself already (e.g. it execed): it doesn't need the reservation
+                return Decrement();
+            case Exited:
+                // The child is done already: consume its tombstone along with the reservation
+                if (entry->state.compare_exchange_weak(state, Gone, std::memory_order_acq_rel))
+                {
+                    return Decrement();
+                }
+                break;
+            default:
+                // The reservation becomes the count of the child
+                if (entry->state.compare_exchange_weak(state, Live, std::memory_order_acq_rel))
+                {
+                    return false;
+                }
+                break;
+        }
+    }
+}
+
+bool ProcessTreeCounter::Remove(pid_t pid, bool isProcess)
+{
+    if (header_ == nullptr || pid <= 0)
+    {
+        return false;
+    }
+
+    Entry *entry = FindOrAdd(pid);
+    if (entry == nullptr)
+    {
+        return false;
+    }
+
+    uint32_t state = entry->state.load(std::memory_order_acquire);
+    while (true)
+    {
+        switch (state)
+        {
+            case Live:
+                if (entry->state.compare_exchange_weak(state, Gone, std::memory_order_acq_rel))
+                {
+                    return Decrement();
+                }
+                break;
+            case Unset:
+                // Not claimed yet by its parent, which holds its count: leave a tombstone for the claim. A thread never
+                // gets claimed, and its tombstone could be mistaken for the one of a child that gets the same id later.
+                if (!isProcess || entry->state.compare_exchange_weak(state, Exited, std::memory_order_acq_rel))
+                {
+                    return false;
+                }
+                break;
+            default:
+                // Removed already. A process that reused the pid of a removed one and exits before being claimed ends up
+                // here too: its reservation is never given back, which only keeps the tree open.
+                return false;
+        }
+    }
+}
@@ -0,0 +1,100 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Count of the live processes of a pip, living in a file mapped by all of them, so the last one to exit can tell BuildXL the
+ * process tree is done instead of BuildXL having to find out on its own.
+ *
+ * Processes are kept in a fixed-size, lock-free table keyed by pid, so a process counts once no matter how many times it gets
+ * added (e.g. once by its parent and once more by each image it execs). A parent creating a child takes a reservation first
+ * (see Reserve), which keeps the count from reaching zero before the child is in the table: the parent then hands the reservation
+ * over to the child once it knows its pid (see Claim), or gives it back if the child couldn't be created (see Release).
+ * A child that exits before its parent claims it leaves a tombstone behind, which the claim consumes.
+ *
+ * Every mistake this can make errs on the side of never completing: a process that is never removed (e.g. killed by a signal), or
+ * a table that fills up, just means BuildXL finds out about the tree on its own, the same way it does when this is not used.
+ */
+class ProcessTreeCounter final
+{
+public:
+    static const uint32_t DEFAULT_CAPACITY = 1 << 14;
+
+    ProcessTreeCounter() = default;
+    // The mapping is left in place: processes remove themselves from on_exit handlers, which may run after static destructors
+    ~ProcessTreeCounter() = default;
+    ProcessTreeCounter(const ProcessTreeCounter&) = delete;
+    ProcessTreeCounter& operator = (const ProcessTreeCounter&) = delete;
+
+    // Opens (creating it if needed) the counter backed by the given file. Returns false if it can't be opened, which includes
+    // the file having been created with a different capacity.
+    bool Open(const char *filePath, uint32_t capacity = DEFAULT_CAPACITY);
+
+    bool IsValid() const { return header_ != nullptr; }
+
+    // Adds a live process. No-op if it is already there.
+    void Add(pid_t pid);
+
+    // Takes a reservation for a child about to be created
+    void Reserve();
+
+    // Hands a reservation over to the child it was taken for, which was created with the given pid.
+    // Returns true if this completed the process tree (see Remove).
+    bool Claim(pid_t childPid);
+
+    // Gives back a reservation whose child couldn't be created (or that was taken by something else than a child, e.g. a supervisor
+    // keeping the tree open while it runs). Returns true if this completed the process tree (see Remove).
+    bool Release();
+
+    // Removes a process that exited. Returns true if it was the last one, in which case the process tree is complete: this
+    // happens at most once per counter, and never after the table filled up.
+    // A process removed by someone else than itself (e.g. a tracee by its tracer) may turn out to be a thread: 'isProcess'
+    // tells whether a tombstone can be left for its parent to claim.
+    bool Remove(pid_t pid, bool isProcess = true);
+
+    // Live processes plus reservations
+    int64_t GetCount() const { return header_ == nullptr ? 0 : header_->count.load(std::memory_order_acquire); }
+
+private:
+    static const uint64_t MAGIC = 0x45455254434f5250; // "PROCTREE"
+    static const uint32_t VERSION = 1;
+    static const uint32_t MAX_PROBES = 64;
+
+    // Pids are never taken out of the table: their state tells whether they count. A pid that was just added is Unset.
+    // Exited is the tombstone of a process that exited before being claimed, and Gone the state of any other exited one.
+    enum EntryState : uint32_t { Unset = 0, Live = 1, Exited = 2, Gone = 3 };
+
+    enum DoneState : uint32_t { NotDone = 0, Completed = 1, Overflowed = 2 };
+
+    struct Entry
+    {
+        std::atomic<pid_t> pid;
+        std::atomic<uint32_t> state;
+    };
+
+    // Followed by the entries
+    struct Header
+    {
+        std::atomic<uint64_t> magic;
+        uint32_t version;
+        uint32_t capacity;
+        std::atomic<int64_t> count;
+        // A DoneState: once the tree was reported complete, or the table was found full, it is never reported complete (again)
+        std::atomic<uint32_t> done;
+    };
+
+    static size_t MappingSize(uint32_t capacity) { return sizeof(Header) + (size_t)capacity * sizeof(Entry); }
+
+    // Returns the entry of the given pid, adding it if it is not in the table yet. Null if the table is full.
+    Entry *FindOrAdd(pid_t pid);
+    bool Decrement();
+
+    Header *header_ = nullptr;
+    Entry *entries_ = nullptr;
+};
@@ -30,6 +30,9 @@ bool verifyargs(BxlObserver *bxl, pid_t traceepid, std::string exe)
 /**
  * The PTraceDaemon will launch this runner with a PID.
  * An instance of PTraceSandbox will then be created to trace the process tree starting from the root pid.
+ *
+ * With -d, the runner is the tracer daemon of the pip: after the first process, it keeps reading attach requests for the other
+ * processes of the pip that need a tracer from its standard input (see PTraceSandbox::ServeAttachRequests) until it is closed.
  */
 int main(int argc, char **argv)
 {
@@ -37,9 +40,10 @@ int main(int argc, char **argv)
     pid_t traceepid;
     std::string exe;
     std::string semaphoreName = "/";
+    bool daemon = false;
     
     // Parse arguments
-    while((opt = getopt(argc, argv, "cx")) != -1)
+    while((opt = getopt(argc, argv, "cxd")) != -1)
     {
         switch (opt)
         {
@@ -51,6 +55,10 @@ int main(int argc, char **argv)
                 // -x <path to statically linked executable>
                 exe = std::string(argv[optind]);
                 break;
+            case 'd':
+                // -d: serve attach requests from stdin after the first process
+                daemon = true;
+                break;
         }
     }
 
@@ -70,9 +78,17 @@ int main(int argc, char **argv)
         _exit(-10);
     }
 
+    if (daemon)
+    {
+        PTraceSandbox::ServeAttachRequests(bxl, traceepid, exe, std::cin);
+        bxl->FlushReports();
+        _exit(0);
+    }
+
     semaphoreName.append(std::to_string(traceepid));
 
     sandbox.AttachToProcess(traceepid, exe, semaphoreName);
 
+    bxl->FlushReports();
     _exit(0);
 }
\ No newline at end of file
@@ -0,0 +1,133 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <mutex>
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <unordered_map>
+
+/**
+ * Summary of the accesses of a process, used instead of one report per access when only the set of accessed paths matters
+ * (monitoring without enforcement). Each (pid, path) pair keeps a single report: the one with the strongest access seen so far,
+ * as ranked by the caller. Reports are held until the summary is drained, which the caller does when it gets full, and before
+ * anything that must come after them (process exit, exec).
+ *
+ * Adding never blocks: if another thread holds the summary, the caller is told to send its report right away instead.
+ */
+template <typename TReport>
+class ReportAggregator final
+{
+public:
+    enum class AddResult
+    {
+        // The report is part of the summary
+        Added,
+        // Same as Added, but the summary reached its capacity and should be drained
+        Full,
+        // Another thread is using the summary: the report was not added
+        Busy,
+    };
+
+    struct Stats
+    {
+        // Reports added to the summary
+        uint64_t added;
+        // Reports that went out of it, one per distinct (pid, path) pair between drains
+        uint64_t drained;
+    };
+
+    // Distinct (pid, path) pairs held when no capacity is given
+    static const size_t DEFAULT_CAPACITY = 4096;
+
+    explicit ReportAggregator(size_t capacity = DEFAULT_CAPACITY) : capacity_(capacity == 0 ? DEFAULT_CAPACITY : capacity) { }
+    ReportAggregator(const ReportAggregator&) = delete;
+    ReportAggregator& operator = (const ReportAggregator&) = delete;
+
+    // Adds the report of an access to 'path' by 'pid'. 'strength' ranks the access: a report only replaces the one already held
+    // for the same pair if its access is stronger.
+    AddResult Add(pid_t pid, const char *path, size_t pathLength, uint32_t strength, const TReport &report)
+    {
+        std::unique_lock<std::mutex> lock(lock_, std::try_to_lock);
+        if (!lock.owns_lock())
+        {
+            return AddResult::Busy;
+        }
+
+        std::string key((const char *)&pid, sizeof(pid));
+        key.append(path, pathLength);
+
+        auto result = entries_.emplace(std::move(key), Entry { strength, report });
+        if (!result.second && result.first->second.strength < strength)
+        {
+            result.first->second = Entry { strength, report };
+        }
+
+        added_++;
+        return entries_.size() >= capacity_ ? AddResult::Full : AddResult::Added;
+    }
+
+    // Empties the summary, calling 'send(report, path)' for each report it held ('path' is null-terminated). The summary is free while
+    // the reports are being sent, so 'send' may add reports again.
+    template <typename TSend>
+    void Drain(TSend send)
+    {
+        std::unordered_map<std::string, Entry> entries;
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            if (entries_.empty())
+            {
+                return;
+            }
+
+            entries.swap(entries_);
+            drained_ += entries.size();
+        }
+
+        for (const auto &entry : entries)
+        {
+            send(entry.second.report, std::string_view(entry.first).substr(sizeof(pid_t)));
+        }
+    }
+
+    // Drops every report held. Used on the child after a fork: the reports held belong to the parent, which sends them.
+    void Clear()
+    {
+        if (lock_.try_lock())
+        {
+            entries_.clear();
+            lock_.unlock();
+            return;
+        }
+
+        // The summary was in use by a thread that doesn't exist in the child, and may have been left half updated:
+        // start over without touching it (what it held is leaked)
+        new (&lock_) std::mutex();
+        new (&entries_) std::unordered_map<std::string, Entry>();
+    }
+
+    Stats GetStats() const
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return Stats { added_, drained_ };
+    }
+
+private:
+    struct Entry
+    {
+        uint32_t strength;
+        TReport report;
+    };
+
+    const size_t capacity_;
+    mutable std::mutex lock_;
+    // Keyed by the bytes of the pid followed by the path
+    std::unordered_map<std::string, Entry> entries_;
+    uint64_t added_ = 0;
+    uint64_t drained_ = 0;
+};
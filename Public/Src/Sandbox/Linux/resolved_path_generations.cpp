@@ -0,0 +1,74 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "resolved_path_generations.hpp"
+#include "fnv1a.hpp"
+#include "shared_mapping.hpp"
+#include <sys/mman.h>
+
+ResolvedPathGenerations::~ResolvedPathGenerations()
+{
+    if (table_ != nullptr)
+    {
+        munmap(table_, sizeof(Table));
+    }
+}
+
+bool ResolvedPathGenerations::Open(const char *filePath)
+{
+    // A freshly extended file is all zeros, which is every generation at zero
+    table_ = SharedMapping::Open<Table>(filePath, sizeof(Table), MAGIC,
+        [](Table &t)
+        {
+            t.version = VERSION;
+            t.pathGenerationCount = PATH_GENERATIONS;
+        },
+        [](const Table &t) { return t.version == VERSION && t.pathGenerationCount == PATH_GENERATIONS; });
+    return table_ != nullptr;
+}
+
+uint64_t ResolvedPathGenerations::GetPathGeneration(const char *path, size_t length) const
+{
+    if (table_ == nullptr)
+    {
+        return 0;
+    }
+
+    // Both counters only go up, so bumping either changes the sum
+    return table_->generation.load(std::memory_order_acquire)
+        + table_->pathGenerations[Fnv1a(path, length) % PATH_GENERATIONS].load(std::memory_order_acquire);
+}
+
+uint64_t ResolvedPathGenerations::GetChainGeneration() const
+{
+    if (table_ == nullptr)
+    {
+        return 0;
+    }
+
+    return table_->generation.load(std::memory_order_acquire) + table_->chainGeneration.load(std::memory_order_acquire);
+}
+
+void ResolvedPathGenerations::InvalidatePath(const char *path, size_t length)
+{
+    if (table_ != nullptr)
+    {
+        table_->pathGenerations[Fnv1a(path, length) % PATH_GENERATIONS].fetch_add(1, std::memory_order_acq_rel);
+    }
+}
+
+void ResolvedPathGenerations::InvalidateChains()
+{
+    if (table_ != nullptr)
+    {
+        table_->chainGeneration.fetch_add(1, std::memory_order_acq_rel);
+    }
+}
+
+void ResolvedPathGenerations::InvalidateAll()
+{
+    if (table_ != nullptr)
+    {
+        table_->generation.fetch_add(1, std::memory_order_acq_rel);
+    }
+}
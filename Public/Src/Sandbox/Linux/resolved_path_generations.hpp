@@ -0,0 +1,63 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Generations of the symlink resolutions cached by each process of a pip (see BxlObserver::readlink_cached), living in a file
+ * mapped by all of them, so a change made by any process of the pip invalidates what every other one cached.
+ *
+ * A process takes the generation of a path before calling readlink on it, and only trusts what it cached for the path for as long
+ * as the generation stays the same. Creating, removing or renaming a path bumps its generation (see InvalidatePath), after the
+ * change was made. Paths share generations by hash, so an unrelated change may drop a cached resolution too. Changes that can't be
+ * pinned to a path (e.g. a renamed directory) bump the generation of every path at once (see InvalidateAll).
+ *
+ * Resolved symlink chains depend on many paths, so they get a generation of their own, bumped along with the one of any path that
+ * may be part of a chain (see InvalidateChains).
+ *
+ * Changes made by processes the interposer is not loaded into (e.g. statically linked ones, or processes outside the pip) are not seen.
+ */
+class ResolvedPathGenerations final
+{
+public:
+    ResolvedPathGenerations() = default;
+    ~ResolvedPathGenerations();
+    ResolvedPathGenerations(const ResolvedPathGenerations&) = delete;
+    ResolvedPathGenerations& operator = (const ResolvedPathGenerations&) = delete;
+
+    // Opens (creating it if needed) the generations backed by the given file. Returns false if it can't be opened.
+    bool Open(const char *filePath);
+
+    bool IsValid() const { return table_ != nullptr; }
+
+    uint64_t GetPathGeneration(const char *path, size_t length) const;
+    uint64_t GetChainGeneration() const;
+
+    void InvalidatePath(const char *path, size_t length);
+    void InvalidateChains();
+
+    // Invalidates every path and every chain
+    void InvalidateAll();
+
+private:
+    static const uint64_t MAGIC = 0x4b4e494c4d595342; // "BSYMLINK"
+    static const uint32_t VERSION = 1;
+    static const uint32_t PATH_GENERATIONS = 4096;
+
+    struct Table
+    {
+        std::atomic<uint64_t> magic;
+        uint32_t version;
+        uint32_t pathGenerationCount;
+        // Added to every other generation
+        std::atomic<uint64_t> generation;
+        std::atomic<uint64_t> chainGeneration;
+        std::atomic<uint64_t> pathGenerations[PATH_GENERATIONS];
+    };
+
+    Table *table_ = nullptr;
+};
@@ -0,0 +1,79 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * Opening of the files mapped by all processes of a pip (SharedPathSet, PathSearchCache, ProcessTreeCounter, ...).
+ *
+ * Observe that raw syscalls are used for anything the interposer detours (open, close, fstat, ftruncate): this code runs while the
+ * observer is being initialized, so it can't re-enter it, and the backing file is not something to report accesses on anyway.
+ */
+namespace SharedMapping
+{
+    // Opens (creating it if needed) the given file and maps its first mappingSize bytes for reading and writing. Returns nullptr if
+    // the file can't be opened or has a different size. Every process sizes the file the same way, so racing to do it is harmless,
+    // and a freshly extended file is all zeros.
+    inline void *Map(const char *filePath, size_t mappingSize)
+    {
+        int fd = syscall(SYS_openat, AT_FDCWD, filePath, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if (fd == -1)
+        {
+            return nullptr;
+        }
+
+        struct stat statbuf;
+        if (syscall(SYS_fstat, fd, &statbuf) != 0
+            || ((size_t)statbuf.st_size != mappingSize && (statbuf.st_size != 0 || syscall(SYS_ftruncate, fd, mappingSize) != 0)))
+        {
+            syscall(SYS_close, fd);
+            return nullptr;
+        }
+
+        void *mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        // The mapping stays valid after the descriptor is closed
+        syscall(SYS_close, fd);
+        return mapping == MAP_FAILED ? nullptr : mapping;
+    }
+
+    // Maps the given file (see Map) and returns its header, whose first field must be an std::atomic<uint64_t> magic.
+    //
+    // The first process to get here stamps the header: stamp fills in everything but the magic, which is published last. A process
+    // racing with it waits for nothing: it either sees the stamp or stamps the very same values. A header stamped with a different
+    // magic, or one matches rejects (e.g. a different version or capacity), is unmapped and nullptr is returned.
+    template <typename THeader, typename TStamp, typename TMatches>
+    THeader *Open(const char *filePath, size_t mappingSize, uint64_t expectedMagic, TStamp stamp, TMatches matches)
+    {
+        void *mapping = Map(filePath, mappingSize);
+        if (mapping == nullptr)
+        {
+            return nullptr;
+        }
+
+        THeader *header = (THeader *)mapping;
+        uint64_t magic = header->magic.load(std::memory_order_acquire);
+        if (magic == 0)
+        {
+            stamp(*header);
+            header->magic.compare_exchange_strong(magic, expectedMagic, std::memory_order_acq_rel);
+            magic = header->magic.load(std::memory_order_acquire);
+        }
+
+        if (magic != expectedMagic || !matches(*header))
+        {
+            munmap(mapping, mappingSize);
+            return nullptr;
+        }
+
+        return header;
+    }
+}
@@ -0,0 +1,154 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "shared_path_set.hpp"
+#include "fnv1a.hpp"
+#include "shared_mapping.hpp"
+#include <string.h>
+#include <sys/mman.h>
+
+SharedPathSet::~SharedPathSet()
+{
+    if (header_ != nullptr)
+    {
+        munmap(header_, mappingSize_);
+    }
+}
+
+bool SharedPathSet::Open(const char *filePath, uint32_t capacity, uint32_t arenaSize)
+{
+    if (capacity == 0 || arenaSize == 0)
+    {
+        return false;
+    }
+
+    // A freshly extended file is all zeros, so every entry is already Empty
+    size_t mappingSize = MappingSize(capacity, arenaSize);
+    Header *header = SharedMapping::Open<Header>(filePath, mappingSize, MAGIC,
+        [&](Header &h)
+        {
+            h.version = VERSION;
+            h.capacity = capacity;
+            h.arenaSize = arenaSize;
+        },
+        [&](const Header &h) { return h.version == VERSION && h.capacity == capacity && h.arenaSize == arenaSize; });
+    if (header == nullptr)
+    {
+        return false;
+    }
+
+    header_ = header;
+    entries_ = (Entry *)(header + 1);
+    arena_ = (char *)(entries_ + capacity);
+    mappingSize_ = mappingSize;
+    return true;
+}
+
+uint64_t SharedPathSet::Hash(uint32_t keyClass, const char *path, size_t pathLength)
+{
+    // FNV-1a over the path, seeded with the key class
+    return Fnv1a(path, pathLength, FNV1A_OFFSET_BASIS ^ keyClass);
+}
+
+bool SharedPathSet::Matches(const Entry &entry, uint64_t hash, uint32_t keyClass, const char *path, size_t pathLength) const
+{
+    return entry.hash == hash
+        && entry.keyClass == keyClass
+        && entry.pathLength == pathLength
+        && memcmp(&arena_[entry.pathOffset], path, pathLength) == 0;
+}
+
+bool SharedPathSet::Contains(uint32_t keyClass, const char *path, size_t pathLength) const
+{
+    if (header_ == nullptr)
+    {
+        return false;
+    }
+
+    uint64_t hash = Hash(keyClass, path, pathLength);
+    for (uint32_t probe = 0; probe < MAX_PROBES; probe++)
+    {
+        const Entry &entry = entries_[(hash + probe) % header_->capacity];
+        uint32_t state = entry.state.load(std::memory_order_acquire);
+        if (state == Empty)
+        {
+            // TryAdd never skips an empty entry, so the key can't be further down the probe sequence
+            return false;
+        }
+
+        if (state == Ready && Matches(entry, hash, keyClass, path, pathLength))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool SharedPathSet::TryAdd(uint32_t keyClass, const char *path, size_t pathLength)
+{
+    if (header_ == nullptr || pathLength >= header_->arenaSize)
+    {
+        return true;
+    }
+
+    uint32_t arenaSize = header_->arenaSize;
+    uint64_t hash = Hash(keyClass, path, pathLength);
+    for (uint32_t probe = 0; probe < MAX_PROBES; probe++)
+    {
+        Entry &entry = entries_[(hash + probe) % header_->capacity];
+        uint32_t state = entry.state.load(std::memory_order_acquire);
+        if (state == Ready)
+        {
+            if (Matches(entry, hash, keyClass, path, pathLength))
+            {
+                return false;
+            }
+
+            continue;
+        }
+
+        if (state == Writing)
+        {
+            // Being added by another process, maybe the same key. Adding it again (and reporting it twice) is harmless.
+            continue;
+        }
+
+        // Reserve the arena space before claiming the entry, so a claimed entry always gets written.
+        // Once the arena is full, stop reserving so the counter can't wrap around over used space.
+        if (header_->arenaUsed.load(std::memory_order_relaxed) > arenaSize - pathLength)
+        {
+            return true;
+        }
+
+        uint32_t offset = header_->arenaUsed.fetch_add((uint32_t)pathLength, std::memory_order_relaxed);
+        if (offset > arenaSize - pathLength)
+        {
+            // Full. The space is wasted, but so is any further attempt.
+            return true;
+        }
+
+        uint32_t expected = Empty;
+        if (!entry.state.compare_exchange_strong(expected, Writing, std::memory_order_acquire))
+        {
+            // Someone else took the entry in the meantime: the reserved space is lost, keep probing
+            if (expected == Ready && Matches(entry, hash, keyClass, path, pathLength))
+            {
+                return false;
+            }
+
+            continue;
+        }
+
+        memcpy(&arena_[offset], path, pathLength);
+        entry.keyClass = keyClass;
+        entry.pathLength = (uint32_t)pathLength;
+        entry.pathOffset = offset;
+        entry.hash = hash;
+        entry.state.store(Ready, std::memory_order_release);
+        return true;
+    }
+
+    // Too many collisions (or the table is full). The key is not remembered.
+    return true;
+}
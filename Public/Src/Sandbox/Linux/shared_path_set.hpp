@@ -0,0 +1,81 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A fixed-size, lock-free set of (key class, path) pairs living in a file mapped by all processes of a pip, so something that gets
+ * reported the same way by every process (e.g. the shared libraries la_objopen sees) is reported by the first one only.
+ *
+ * Every process opens the same file, creating it if it is the first one. Keys are hashed into an open-addressing table and their
+ * paths are kept in an arena next to it, so a hash collision is never mistaken for a hit. When the table or the arena is full,
+ * or the file can't be opened, keys are just not remembered (and get reported by every process).
+ */
+class SharedPathSet final
+{
+public:
+    static const uint32_t DEFAULT_CAPACITY = 4096;
+    static const uint32_t DEFAULT_ARENA_SIZE = 1 << 19;
+
+    SharedPathSet() = default;
+    ~SharedPathSet();
+    SharedPathSet(const SharedPathSet&) = delete;
+    SharedPathSet& operator = (const SharedPathSet&) = delete;
+
+    // Opens (creating it if needed) the set backed by the given file. Returns false if it can't be opened, which includes
+    // the file having been created with a different capacity or arena size.
+    bool Open(const char *filePath, uint32_t capacity = DEFAULT_CAPACITY, uint32_t arenaSize = DEFAULT_ARENA_SIZE);
+
+    bool IsValid() const { return header_ != nullptr; }
+
+    // Adds the key to the set. Returns false if it was added before (by this or any other process), true otherwise,
+    // including when it can't be remembered.
+    bool TryAdd(uint32_t keyClass, const char *path, size_t pathLength);
+    bool TryAdd(const char *path, size_t pathLength) { return TryAdd(0, path, pathLength); }
+
+    // Returns whether the key was added before by this or any other process
+    bool Contains(uint32_t keyClass, const char *path, size_t pathLength) const;
+
+private:
+    static const uint64_t MAGIC = 0x5445534854415042; // "BPATHSET"
+    static const uint32_t VERSION = 2;
+    static const uint32_t MAX_PROBES = 16;
+
+    enum EntryState : uint32_t { Empty = 0, Writing = 1, Ready = 2 };
+
+    struct Entry
+    {
+        std::atomic<uint32_t> state;
+        uint32_t keyClass;
+        uint32_t pathLength;
+        uint32_t pathOffset;
+        uint64_t hash;
+    };
+
+    // Followed by the entries and then by the arena
+    struct Header
+    {
+        std::atomic<uint64_t> magic;
+        uint32_t version;
+        uint32_t capacity;
+        uint32_t arenaSize;
+        std::atomic<uint32_t> arenaUsed;
+    };
+
+    static size_t MappingSize(uint32_t capacity, uint32_t arenaSize)
+    {
+        return sizeof(Header) + (size_t)capacity * sizeof(Entry) + arenaSize;
+    }
+
+    static uint64_t Hash(uint32_t keyClass, const char *path, size_t pathLength);
+    bool Matches(const Entry &entry, uint64_t hash, uint32_t keyClass, const char *path, size_t pathLength) const;
+
+    Header *header_ = nullptr;
+    Entry *entries_ = nullptr;
+    char *arena_ = nullptr;
+    size_t mappingSize_ = 0;
+};
@@ -0,0 +1,166 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "static_linking_cache.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+StaticLinkingCache::~StaticLinkingCache()
+{
+    // The descriptor is intentionally left open: children need to inherit it
+    if (table_ != nullptr)
+    {
+        munmap(table_, sizeof(Table));
+    }
+}
+
+// Observe that raw syscalls are used for anything the interposer detours (close, fstat, ftruncate): this code runs while the
+// observer is being initialized, so it can't re-enter it, and the memfd is not something to report accesses on anyway.
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+bool StaticLinkingCache::Create()
+{
+    // Close-on-exec until a monitored child is about to be exec'ed (see SetInheritable).
+    // The raw syscall is used since memfd_create is only exposed by glibc 2.27+.
+    int fd = syscall(SYS_memfd_create, "bxl_static_linking_cache", MFD_CLOEXEC);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    if (syscall(SYS_ftruncate, fd, sizeof(Table)) != 0)
+    {
+        syscall(SYS_close, fd);
+        return false;
+    }
+
+    void *mapping = mmap(nullptr, sizeof(Table), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+        syscall(SYS_close, fd);
+        return false;
+    }
+
+    // A freshly truncated file is all zeros, so every entry is already Empty
+    Table *table = (Table *)mapping;
+    table->version = VERSION;
+    table->capacity = CAPACITY;
+    __atomic_store_n(&table->magic, MAGIC, __ATOMIC_RELEASE);
+
+    fd_ = fd;
+    table_ = table;
+    return true;
+}
+
+bool StaticLinkingCache::Attach(int fd)
+{
+    struct stat statbuf;
+    if (fd < 0 || syscall(SYS_fstat, fd, &statbuf) != 0 || !S_ISREG(statbuf.st_mode) || statbuf.st_size != sizeof(Table))
+    {
+        return false;
+    }
+
+    void *mapping = mmap(nullptr, sizeof(Table), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+
+    // The descriptor number came from the environment and may have been reused for something else by now
+    Table *table = (Table *)mapping;
+    if (__atomic_load_n(&table->magic, __ATOMIC_ACQUIRE) != MAGIC || table->version != VERSION || table->capacity != CAPACITY)
+    {
+        munmap(mapping, sizeof(Table));
+        return false;
+    }
+
+    // Inherited without close-on-exec, which only the images that attach to the table should get
+    fd_ = fd;
+    table_ = table;
+    SetInheritable(false);
+    return true;
+}
+
+void StaticLinkingCache::SetInheritable(bool inheritable) const
+{
+    if (fd_ != -1)
+    {
+        syscall(SYS_fcntl, fd_, F_SETFD, inheritable ? 0 : FD_CLOEXEC);
+    }
+}
+
+bool StaticLinkingCache::Matches(const Entry &entry, const ExecutableId &id)
+{
+    return entry.device == (uint64_t)id.device 
+        && entry.inode == (uint64_t)id.inode
+        && entry.mtimeSec == (int64_t)id.mtimeSec
+        && entry.mtimeNsec == (int64_t)id.mtimeNsec;
+}
+
+bool StaticLinkingCache::TryGet(const ExecutableId &id, bool &isStaticallyLinked) const
+{
+    if (table_ == nullptr)
+    {
+        return false;
+    }
+
+    size_t start = id.Hash();
+    for (uint32_t probe = 0; probe < MAX_PROBES; probe++)
+    {
+        const Entry &entry = table_->entries[(start + probe) % CAPACITY];
+        uint32_t state = entry.state.load(std::memory_order_acquire);
+        if (state == Empty)
+        {
+            // Entries are never removed, so the chain ends here
+            return false;
+        }
+
+        // Entries being written by another process are skipped: the lookup just misses
+        if (state == Ready && Matches(entry, id))
+        {
+            isStaticallyLinked = entry.isStaticallyLinked != 0;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void StaticLinkingCache::Add(const ExecutableId &id, bool isStaticallyLinked)
+{
+    if (table_ == nullptr)
+    {
+        return;
+    }
+
+    size_t start = id.Hash();
+    for (uint32_t probe = 0; probe < MAX_PROBES; probe++)
+    {
+        Entry &entry = table_->entries[(start + probe) % CAPACITY];
+        uint32_t expected = Empty;
+        if (entry.state.compare_exchange_strong(expected, Writing, std::memory_order_acquire))
+        {
+            entry.isStaticallyLinked = isStaticallyLinked ? 1 : 0;
+            entry.device = id.device;
+            entry.inode = id.inode;
+            entry.mtimeSec = id.mtimeSec;
+            entry.mtimeNsec = id.mtimeNsec;
+            entry.state.store(Ready, std::memory_order_release);
+            return;
+        }
+
+        // Two processes may race to add the same verdict. A duplicate is harmless, but avoid it when we can see it.
+        if (expected == Ready && Matches(entry, id))
+        {
+            return;
+        }
+    }
+
+    // Too many collisions (or the table is full). The verdict is not shared.
+}
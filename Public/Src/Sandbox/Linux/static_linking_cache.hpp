@@ -0,0 +1,104 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+// Identity of an executable file for the purpose of caching whether it is statically linked. The modification time
+// is part of it so a binary that gets rewritten in place is inspected again.
+struct ExecutableId
+{
+    dev_t device;
+    ino_t inode;
+    time_t mtimeSec;
+    long mtimeNsec;
+
+    bool operator==(const ExecutableId &other) const
+    {
+        return device == other.device && inode == other.inode && mtimeSec == other.mtimeSec && mtimeNsec == other.mtimeNsec;
+    }
+
+    size_t Hash() const
+    {
+        size_t hash = (size_t)inode;
+        hash = hash * 31 + (size_t)device;
+        hash = hash * 31 + (size_t)mtimeSec;
+        return hash * 31 + (size_t)mtimeNsec;
+    }
+};
+
+struct ExecutableIdHash
+{
+    size_t operator()(const ExecutableId &id) const { return id.Hash(); }
+};
+
+/**
+ * A fixed-size, lock-free hash table of 'is statically linked' verdicts living in an anonymous shared memory
+ * file (memfd), so all processes of a pip share the verdicts instead of each inspecting the same binaries again.
+ *
+ * The root process of the pip creates the table, and the file descriptor is inherited by its children across fork and exec
+ * (see BxlEnvStaticLinkingCacheFd). The descriptor is close-on-exec, and only made inheritable right before the sandbox execs
+ * or spawns a child it monitors (see SetInheritable), so images that don't attach to the table never get it. When the table
+ * is full, or the descriptor is lost (e.g. the process closed all its descriptors before exec), verdicts are just not shared.
+ */
+class StaticLinkingCache final
+{
+public:
+    StaticLinkingCache() = default;
+    ~StaticLinkingCache();
+    StaticLinkingCache(const StaticLinkingCache&) = delete;
+    StaticLinkingCache& operator = (const StaticLinkingCache&) = delete;
+
+    // Creates a new (empty) shared table. Returns false if it can't be created.
+    bool Create();
+
+    // Attaches to an existing shared table given its descriptor. Returns false if the descriptor does not point to a valid table.
+    bool Attach(int fd);
+
+    bool IsValid() const { return table_ != nullptr; }
+
+    // Descriptor of the shared table, or -1 if there is none
+    int GetFd() const { return fd_; }
+
+    // Clears (or sets back) the close-on-exec flag of the descriptor, so the image about to be exec'ed inherits it
+    void SetInheritable(bool inheritable) const;
+
+    bool TryGet(const ExecutableId &id, bool &isStaticallyLinked) const;
+    void Add(const ExecutableId &id, bool isStaticallyLinked);
+
+private:
+    static const uint64_t MAGIC = 0x4c4c415453495842; // "BXISTALL"
+    static const uint32_t VERSION = 1;
+    static const uint32_t CAPACITY = 4096;
+    static const uint32_t MAX_PROBES = 16;
+
+    enum EntryState : uint32_t { Empty = 0, Writing = 1, Ready = 2 };
+
+    struct Entry
+    {
+        std::atomic<uint32_t> state;
+        uint32_t isStaticallyLinked;
+        uint64_t device;
+        uint64_t inode;
+        int64_t mtimeSec;
+        int64_t mtimeNsec;
+    };
+
+    struct Table
+    {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t capacity;
+        Entry entries[CAPACITY];
+    };
+
+    static bool Matches(const Entry &entry, const ExecutableId &id);
+
+    int fd_ = -1;
+    Table *table_ = nullptr;
+};
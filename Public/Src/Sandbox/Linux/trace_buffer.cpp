@@ -0,0 +1,102 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "trace_buffer.hpp"
+#include "shared_mapping.hpp"
+#include <string.h>
+#include <sys/mman.h>
+
+bool TraceBuffer::Open(const char *filePath, uint32_t capacity)
+{
+    Close();
+    if (capacity == 0)
+    {
+        return false;
+    }
+
+    // A freshly extended file is all zeros, which is an empty ring. A ring left by a previous image of this process (exec)
+    // is kept and appended to.
+    size_t mappingSize = MappingSize(capacity);
+    Header *header = SharedMapping::Open<Header>(filePath, mappingSize, MAGIC,
+        [&](Header &h)
+        {
+            h.version = VERSION;
+            h.capacity = capacity;
+        },
+        [&](const Header &h) { return h.version == VERSION && h.capacity == capacity; });
+    if (header == nullptr)
+    {
+        return false;
+    }
+
+    header_ = header;
+    ring_ = (char *)(header + 1);
+    mappingSize_ = mappingSize;
+    return true;
+}
+
+void TraceBuffer::Close()
+{
+    if (header_ != nullptr)
+    {
+        munmap(header_, mappingSize_);
+        header_ = nullptr;
+        ring_ = nullptr;
+        mappingSize_ = 0;
+    }
+}
+
+void TraceBuffer::CopyIn(uint64_t position, const char *bytes, size_t length)
+{
+    uint32_t capacity = header_->capacity;
+    size_t offset = position % capacity;
+    size_t head = length < capacity - offset ? length : capacity - offset;
+    memcpy(&ring_[offset], bytes, head);
+    memcpy(ring_, &bytes[head], length - head);
+}
+
+void TraceBuffer::Write(const char *message, size_t length)
+{
+    if (header_ == nullptr)
+    {
+        return;
+    }
+
+    size_t maxLength = header_->capacity / 4;
+    if (length > maxLength)
+    {
+        length = maxLength;
+    }
+
+    // Reserving is the only synchronization: writers never wait on each other
+    uint64_t position = header_->writePosition.fetch_add(length + 1, std::memory_order_relaxed);
+    CopyIn(position, message, length);
+    CopyIn(position + length, "\n", 1);
+}
+
+std::string TraceBuffer::ReadAll() const
+{
+    std::string result;
+    if (header_ == nullptr)
+    {
+        return result;
+    }
+
+    uint32_t capacity = header_->capacity;
+    uint64_t end = header_->writePosition.load(std::memory_order_acquire);
+    uint64_t start = end > capacity ? end - capacity : 0;
+    result.reserve(end - start);
+    for (uint64_t position = start; position < end; position++)
+    {
+        result.push_back(ring_[position % capacity]);
+    }
+
+    // Once the ring wrapped around, the oldest message was partially overwritten
+    if (start > 0)
+    {
+        size_t firstNewline = result.find('\n');
+        result.erase(0, firstNewline == std::string::npos ? result.length() : firstNewline + 1);
+    }
+
+    return result;
+}
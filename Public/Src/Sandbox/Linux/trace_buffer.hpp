@@ -0,0 +1,67 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+/**
+ * A fixed-size, lock-free ring of debug messages living in a file mapped by a process, so sandbox logging doesn't compete with
+ * access reports for the report FIFO (see FileAccessManifestExtraFlag::EnableLinuxSandboxTraceBuffer).
+ *
+ * Writers reserve space by bumping the write position and copy their message (followed by a newline) into the ring, so once
+ * the ring wraps around the oldest messages get overwritten. The file is shared, so every writer mapping it (e.g. the interposing
+ * and the audit libraries of the same process) appends to the same ring. Messages live in the page cache as soon as they are
+ * written: nothing needs to be flushed when the process exits, or when it crashes.
+ *
+ * The file is read once all the processes of the pip are done (see ReadAll): a message being written while the file is read
+ * may come out torn.
+ * CODESYNC: Public/Src/Engine/Processes/SandboxConnectionLinuxDetours.cs
+ */
+class TraceBuffer final
+{
+public:
+    static const uint32_t DEFAULT_CAPACITY = 1 << 20;
+
+    TraceBuffer() = default;
+    ~TraceBuffer() { Close(); }
+    TraceBuffer(const TraceBuffer&) = delete;
+    TraceBuffer& operator = (const TraceBuffer&) = delete;
+
+    // Opens (creating it if needed) the ring backed by the given file. Returns false if it can't be opened, which includes
+    // the file having been created with a different capacity. An already open ring is closed first.
+    bool Open(const char *filePath, uint32_t capacity = DEFAULT_CAPACITY);
+    void Close();
+
+    bool IsValid() const { return header_ != nullptr; }
+
+    // Appends the message and a newline. Messages longer than a quarter of the ring are truncated.
+    void Write(const char *message, size_t length);
+
+    // Returns the messages still in the ring, oldest first, each followed by a newline
+    std::string ReadAll() const;
+
+private:
+    static const uint64_t MAGIC = 0x4543415254584c42; // "BLXTRACE"
+    static const uint32_t VERSION = 1;
+
+    // Followed by the ring
+    struct Header
+    {
+        std::atomic<uint64_t> magic;
+        uint32_t version;
+        uint32_t capacity;
+        std::atomic<uint64_t> writePosition;
+    };
+
+    static size_t MappingSize(uint32_t capacity) { return sizeof(Header) + capacity; }
+
+    void CopyIn(uint64_t position, const char *bytes, size_t length);
+
+    Header *header_ = nullptr;
+    char *ring_ = nullptr;
+    size_t mappingSize_ = 0;
+};
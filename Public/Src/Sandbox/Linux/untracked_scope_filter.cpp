@@ -0,0 +1,109 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "untracked_scope_filter.hpp"
+#include <string.h>
+
+static bool IsDotOrDotDot(const char *component, size_t length)
+{
+    return (length == 1 && component[0] == '.') || (length == 2 && component[0] == '.' && component[1] == '.');
+}
+
+int UntrackedScopeFilter::FindChild(const Node &node, const char *component, size_t length) const
+{
+    for (uint32_t child : node.children)
+    {
+        const std::string &childComponent = nodes_[child].component;
+        if (childComponent.length() == length && memcmp(childComponent.c_str(), component, length) == 0)
+        {
+            return child;
+        }
+    }
+
+    return -1;
+}
+
+void UntrackedScopeFilter::Add(const char *root, size_t length)
+{
+    if (nodes_.empty())
+    {
+        nodes_.push_back(Node { "", {}, false });
+    }
+
+    uint32_t current = 0;
+    const char *end = root + length;
+    const char *component = root;
+    while (component < end && !nodes_[current].isRoot)
+    {
+        const char *separator = (const char *)memchr(component, '/', end - component);
+        const char *componentEnd = separator == nullptr ? end : separator;
+        size_t componentLength = componentEnd - component;
+
+        if (componentLength > 0)
+        {
+            int child = FindChild(nodes_[current], component, componentLength);
+            if (child == -1)
+            {
+                child = (int)nodes_.size();
+                nodes_.push_back(Node { std::string(component, componentLength), {}, false });
+                nodes_[current].children.push_back(child);
+            }
+
+            current = child;
+        }
+
+        component = componentEnd + 1;
+    }
+
+    // A root under another root adds nothing. A root above other roots makes them redundant.
+    nodes_[current].isRoot = true;
+    nodes_[current].children.clear();
+}
+
+bool UntrackedScopeFilter::Covers(const char *path) const
+{
+    if (nodes_.empty() || path == nullptr || path[0] != '/')
+    {
+        return false;
+    }
+
+    uint32_t current = 0;
+    const char *component = path + 1;
+    while (!nodes_[current].isRoot)
+    {
+        if (*component == '\0')
+        {
+            return false;
+        }
+
+        const char *componentEnd = strchrnul(component, '/');
+        size_t componentLength = componentEnd - component;
+        if (componentLength == 0 || IsDotOrDotDot(component, componentLength))
+        {
+            return false;
+        }
+
+        int child = FindChild(nodes_[current], component, componentLength);
+        if (child == -1)
+        {
+            return false;
+        }
+
+        current = child;
+        component = *componentEnd == '\0' ? componentEnd : componentEnd + 1;
+    }
+
+    // Whatever follows the root must not climb out of it
+    while (*component != '\0')
+    {
+        const char *componentEnd = strchrnul(component, '/');
+        if (componentEnd - component == 2 && component[0] == '.' && component[1] == '.')
+        {
+            return false;
+        }
+
+        component = *componentEnd == '\0' ? componentEnd : componentEnd + 1;
+    }
+
+    return true;
+}
@@ -0,0 +1,51 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * The roots of the untracked cones of a manifest (the ones nothing under can produce a report, see AccessHandler::IsUntrackedCone),
+ * kept as a trie of path components so an access can be dropped straight from the path the caller passed, before it is resolved
+ * and its policy looked up.
+ *
+ * Only absolute paths are matched, and only lexically: a path with an empty, "." or ".." component before reaching a root, or with a
+ * ".." component anywhere after it, is never covered. Symlinks are not resolved, which is what makes the check cheap: a symlink under
+ * an untracked root that points somewhere else is not followed.
+ *
+ * Also used for the roots of the cones the manifest marks as free of symlinks (FileAccessPolicy_NoReparsePointsInCone), where there is
+ * nothing to follow in the first place.
+ */
+class UntrackedScopeFilter final
+{
+public:
+    UntrackedScopeFilter() = default;
+    UntrackedScopeFilter(const UntrackedScopeFilter&) = delete;
+    UntrackedScopeFilter& operator = (const UntrackedScopeFilter&) = delete;
+
+    // Adds an untracked root, given as an absolute path ("" or "/" being the root directory)
+    void Add(const char *root, size_t length);
+
+    bool IsEmpty() const { return nodes_.empty(); }
+
+    // Whether the given absolute path is (lexically) at or under one of the roots
+    bool Covers(const char *path) const;
+
+private:
+    struct Node
+    {
+        std::string component;
+        std::vector<uint32_t> children;
+        // Whether the path up to this node is one of the roots, in which case its children don't matter
+        bool isRoot;
+    };
+
+    int FindChild(const Node &node, const char *component, size_t length) const;
+
+    // nodes_[0] is the root directory. Empty until a root is added.
+    std::vector<Node> nodes_;
+};
@@ -50,21 +50,21 @@ char** replace_KVP_in_envp(const char *const envp[], int env_num, int i, const c
     return newenvp;
 }
 
-const char* add_value_to_env(const char *src, const char *value_to_add, const char *envPrefix)
+bool is_value_in_env(const char *src, const char *value, const char *envPrefix)
 {
     const char *pSrc = skip_prefix(src, envPrefix);
-    if (!pSrc || strlen(value_to_add) == 0)
+    if (!pSrc)
     {
-        return src;
+        return false;
     }
 
     while (*pSrc)
     {
-        const char *next = skip_prefix(pSrc, value_to_add);
+        const char *next = skip_prefix(pSrc, value);
         if (next && (*next == '\0' || *next == PATH_SEP_CHAR))
         {
-            // found a match --> return the original src
-            return src;
+            // found a match
+            return true;
         }
         else
         {
@@ -83,6 +83,16 @@ const char* add_value_to_env(const char *src, const char *value_to_add, const ch
         }
     }   
 
+    return false;
+}
+
+const char* add_value_to_env(const char *src, const char *value_to_add, const char *envPrefix)
+{
+    if (!skip_prefix(src, envPrefix) || strlen(value_to_add) == 0 || is_value_in_env(src, value_to_add, envPrefix))
+    {
+        return src;
+    }
+
     // no match
     int srcLen = strlen(src);
     int totalLen = srcLen + strlen(value_to_add) + 1;
@@ -380,14 +390,16 @@ char** remove_path_from_LDPRELOAD(const char *const envp[], const char *path)
         {
             foundLdPreload = true;
             int len = strlen(*pEnv);
-            char *buf = malloc(len);
+            // scrub_ld_preload may write one byte past the terminator of an unchanged value
+            char *buf = malloc(len + 2);
             if (buf == NULL)
             {
                 return (char**)envp;
             }
 
+            // scrub_ld_preload rewrites any non-empty value, so only treat it as a removal if something actually went away
             result = scrub_ld_preload(*pEnv, path, buf);
-            if (result == buf)
+            if (result == buf && strcmp(buf, *pEnv) != 0)
             {
                 removed = true;
                 ldPreloadEnv_index = env_num;
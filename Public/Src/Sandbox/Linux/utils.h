@@ -58,6 +58,12 @@ DLL_EXPORT const char* skip_prefix(const char *src, const char *prefix);
  */
 DLL_EXPORT const char* add_value_to_env(const char *src, const char *value_to_add, const char *envPrefix);
 
+/**
+ * envPrefix is in the format of the env name and "=", e.g. LD_PRELOAD=
+ * Returns whether 'src' begins with envPrefix and 'value' is one of the colon-separated values that follow it.
+ */
+DLL_EXPORT bool is_value_in_env(const char *src, const char *value, const char *envPrefix);
+
 /**
  * Scrubs the 'value_to_scrub' values from 'src' if 'src' begins with "LD_PRELOAD=";
  * otherwise returns the original value provided in 'src'.
@@ -7,6 +7,11 @@
 #include <EndpointSecurity/EndpointSecurity.h>
 #include <Foundation/Foundation.h>
 
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <vector>
+
 class ESClient final
 {
 
@@ -18,11 +23,74 @@ private:
     dispatch_queue_t eventQueue_ = nullptr;
     xpc_connection_t build_host_ = nullptr;
 
+    /*!
+     * Bounded queue handing retained ES messages over from the ES delivery thread to 'eventQueue_', so that the delivery thread never
+     * waits for BuildXL.  Producers claim a slot by bumping 'enqueuePos_' and publish it through its sequence number, 'DrainMessages'
+     * is the only consumer and takes the messages in the order ES delivered them.
+     */
+    static const uint64_t kMessageQueueSize = 4096;
+
+    struct QueuedMessage
+    {
+        std::atomic<uint64_t> sequence;
+        const es_message_t *message;
+    };
+
+    QueuedMessage messages_[kMessageQueueSize];
+    std::atomic<uint64_t> enqueuePos_ { 0 };
+    uint64_t dequeuePos_ = 0;
+    std::atomic<bool> drainScheduled_ { false };
+
+    /*! Last 'seq_num' seen per event type, to notice when ES dropped messages of this client (consumer only) */
+    uint64_t lastSeqNums_[ES_EVENT_TYPE_LAST] = { 0 };
+
+    /*! Events subscribed to on top of the ones the client was created with, see 'SetDemandedEvents' */
+    std::set<es_event_type_t> demandedEvents_;
+
+    bool TryEnqueue(const es_message_t *message);
+
+    /*! Queues a retained message, waiting for room when the queue is full rather than dropping it */
+    void Enqueue(const es_message_t *message);
+
+    void ScheduleDrain();
+
+    /*! Processes every queued message in order, runs on 'eventQueue_' */
+    void DrainMessages();
+
+    /*! Hands a retained message to BuildXL, answers it if it's an auth event and releases it once BuildXL replied */
+    void HandleMessage(const es_message_t *message);
+
+    /*! Live clients, so that a path unmute requested through one of them applies to all of them */
+    static std::mutex clientsLock_;
+    static std::set<ESClient *> clients_;
+
+    /*! Mutes the executables in 'kMutedExecutablePathPrefixes' and 'kMutedExecutablePaths' */
+    void MutePaths();
+
+    /*! Drops the path mutes of every live client, for when a tracked process executes a muted path */
+    static void UnmuteAllPaths();
+
+    /*!
+     * Bumped by 'ClearAllCaches': an answer BuildXL allowed to cache is only cached if no clear happened since its event was sent,
+     * otherwise it could have been decided before a pip whose manifest tracks the path started.
+     */
+    static std::atomic<uint64_t> cacheEpoch_;
+
 public:
 
+    /*! Drops the auth results cached by every live client, see 'xpc_response_auth_cache' */
+    static bool ClearAllCaches();
+
     ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t endpoint, es_event_type_t *events, uint32_t event_count);
     ~ESClient();
 
+    /*!
+     * Subscribes to 'events' on top of the events the client was created with, and unsubscribes from the ones an earlier call
+     * subscribed to that aren't in 'events' anymore, so ES only generates the events some running pip needs (see 'xpc_set_es_event_demand').
+     * Returns false if the events couldn't be subscribed to.
+     */
+    bool SetDemandedEvents(const std::vector<es_event_type_t> &events);
+
     int TearDown(xpc_object_t remote = nullptr, xpc_object_t reply = nullptr);
 };
 
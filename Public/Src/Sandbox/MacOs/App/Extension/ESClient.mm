@@ -1,13 +1,21 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <algorithm>
 #include <cstdio>
+#include <fcntl.h>
+#include <iterator>
+#include <sched.h>
 
 #include "ESClient.hpp"
 #include "ESConstants.hpp"
 #include "IOEvent.hpp"
 #include "XPCConstants.hpp"
 
+std::mutex ESClient::clientsLock_;
+std::set<ESClient *> ESClient::clients_;
+std::atomic<uint64_t> ESClient::cacheEpoch_ { 0 };
+
 ESClient::ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t endpoint, es_event_type_t *events, uint32_t event_count)
 {
     assert(event_queue != nullptr);
@@ -16,6 +24,13 @@ ESClient::ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t
 
     host_pid_ = host_pid;
     eventQueue_ = event_queue;
+
+    for (uint64_t i = 0; i < kMessageQueueSize; i++)
+    {
+        messages_[i].sequence.store(i, std::memory_order_relaxed);
+        messages_[i].message = nullptr;
+    }
+
     build_host_ = xpc_connection_create_from_endpoint(endpoint);
 
     xpc_connection_set_event_handler(build_host_, ^(xpc_object_t message)
@@ -30,16 +45,12 @@ ESClient::ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t
     xpc_connection_resume(build_host_);
     
     /*
-        Remark: XPC Event transfer happens within the ES callback here, this adds latency. The ES documentation mentions that an
-                event message can be processed asynchronously through instantly responding (allowing it) and then copying them out
-                using es_retain_message(), to then store and sort them using the appropriate event sequence number `seq_num` -
-                maintaining order is important. This could help alleviate losing events due to ES backpressure!
-     
-                Additionally, ES now offers es_mute_path(...) and a path blacklist could be created that mutes events from processes
-                from this list on setup to avoid tons of events being captured if the system is subscribed to a lot of events, e.g.
-                    - launchd and other apple daemons
-                    - browsers
-                    - etc.
+        Remark: The ES callback only retains messages and queues them, XPC event transfer happens on 'eventQueue_' (see DrainMessages).
+                This keeps the ES delivery thread free, so ES backpressure doesn't make the kernel drop events.  Messages are processed
+                in delivery order by a single consumer, gaps in their per event type `seq_num` are logged as dropped events.
+
+                System daemons are muted by path on setup (see MutePaths), other processes are muted one by one once the build
+                host reports that they don't belong to the build.
     */
     
     es_new_client_result_t result = es_new_client(&client_, ^(es_client_t *c, const es_message_t *message)
@@ -70,105 +81,320 @@ ESClient::ESClient(dispatch_queue_t event_queue, pid_t host_pid, xpc_endpoint_t
             return;
         }
 
-        IOEvent event(message);
-        size_t msg_length = IOEvent::max_size();
-        char msg[msg_length];
+        es_retain_message(message);
+        Enqueue(message);
+    });
+
+    /*
+        TODO: Calling exit() within the system extension / daemon causes it to be killed and restarted, in general we have to
+              implement a nicer way to indicate errors and recover from them; currently we log and exit only!
+     */
+
+    if (result != ES_NEW_CLIENT_RESULT_SUCCESS)
+    {
+        log_error("Failed creating an EndpointSecurity client: %d", result);
+        exit(EXIT_FAILURE);
+    }
+
+    {
+        const std::lock_guard<std::mutex> lock(clientsLock_);
+        clients_.insert(this);
+    }
+
+    MutePaths();
+
+    es_clear_cache_result_t clear_result = es_clear_cache(client_);
+    if (clear_result != ES_CLEAR_CACHE_RESULT_SUCCESS)
+    {
+        log_error("Failed cleaning the EndpointSecurity client cache: %d", clear_result);
+        exit(EXIT_FAILURE);
+    }
+
+    es_return_t subscribe_result = es_subscribe(client_, (es_event_type_t *)events, event_count);
+    if (subscribe_result != ES_RETURN_SUCCESS)
+    {
+        log_error("Failed subscribing to the EndpointSecurity backend: %d", subscribe_result);
+        exit(EXIT_FAILURE);
+    }
+
+    log_debug("Successfully initialized an EndpointSecurity client, tracking: %d event(s).", event_count);
+}
+
+bool ESClient::TryEnqueue(const es_message_t *message)
+{
+    QueuedMessage *slot;
+    uint64_t pos = enqueuePos_.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        slot = &messages_[pos & (kMessageQueueSize - 1)];
+        int64_t diff = (int64_t)slot->sequence.load(std::memory_order_acquire) - (int64_t)pos;
+        if (diff == 0)
+        {
+            if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = enqueuePos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->message = message;
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+void ESClient::Enqueue(const es_message_t *message)
+{
+    while (!TryEnqueue(message))
+    {
+        ScheduleDrain();
+        sched_yield();
+    }
+
+    ScheduleDrain();
+}
+
+void ESClient::ScheduleDrain()
+{
+    if (!drainScheduled_.exchange(true))
+    {
+        dispatch_async(eventQueue_, ^{
+            DrainMessages();
+        });
+    }
+}
+
+void ESClient::DrainMessages()
+{
+    // Messages queued from here on schedule another drain, the fence orders the reset before reading the slots
+    drainScheduled_.store(false);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    for (;;)
+    {
+        QueuedMessage &slot = messages_[dequeuePos_ & (kMessageQueueSize - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != dequeuePos_ + 1)
+        {
+            return;
+        }
+
+        const es_message_t *message = slot.message;
+        slot.sequence.store(dequeuePos_ + kMessageQueueSize, std::memory_order_release);
+        dequeuePos_++;
+
+        if (message->version >= 2 && message->event_type < ES_EVENT_TYPE_LAST)
+        {
+            uint64_t &lastSeqNum = lastSeqNums_[message->event_type];
+            if (lastSeqNum != 0 && message->seq_num > lastSeqNum + 1)
+            {
+                log_error("EndpointSecurity dropped %llu event(s) of type %d - sandboxing is no longer reliable!", message->seq_num - lastSeqNum - 1, message->event_type);
+            }
+
+            lastSeqNum = message->seq_num;
+        }
+
+        if (client_ == nullptr)
+        {
+            // Torn down, nobody to report to anymore
+            es_release_message(message);
+            continue;
+        }
+
+        HandleMessage(message);
+    }
+}
+
+void ESClient::HandleMessage(const es_message_t *message)
+{
+    // Serialized straight from the message, its paths are only copied into the XPC payload
+    ESMessageView event(message);
+    size_t msg_length = event.SerializedSize();
+    char msg[msg_length];
+    event.Serialize(msg, msg_length);
 
-        omemorystream oms(msg, sizeof(msg));
-        oms << event;
+    xpc_object_t xpc_payload = xpc_dictionary_create(NULL, NULL, 0);
+    xpc_dictionary_set_data(xpc_payload, IOEventKey, msg, msg_length);
 
-        xpc_object_t xpc_payload = xpc_dictionary_create(NULL, NULL, 0);
-        xpc_dictionary_set_string(xpc_payload, IOEventKey, msg);
-        xpc_dictionary_set_uint64(xpc_payload, IOEventLengthKey, event.Size());
+    uint64_t epoch = cacheEpoch_.load();
 
-        xpc_connection_send_message_with_reply(build_host_, xpc_payload, eventQueue_, ^(xpc_object_t response)
+    xpc_connection_send_message_with_reply(build_host_, xpc_payload, eventQueue_, ^(xpc_object_t response)
+    {
+        uint64_t status = 0;
+        xpc_type_t xpc_type = xpc_get_type(response);
+        if (xpc_type == XPC_TYPE_DICTIONARY)
         {
-            uint64_t status = 0;
-            xpc_type_t xpc_type = xpc_get_type(response);
-            if (xpc_type == XPC_TYPE_DICTIONARY)
+            status = xpc_dictionary_get_uint64(response, "response");
+            switch (status)
             {
-                status = xpc_dictionary_get_uint64(response, "response");
-                switch (status)
+                case xpc_response_mute_process:
+                case xpc_response_auth:
+                case xpc_response_auth_unmute_paths:
+                case xpc_response_auth_cache:
                 {
-                    case xpc_response_mute_process:
-                    case xpc_response_auth:
+                    if (client_)
                     {
-                        if (client_)
+                        if (status == xpc_response_auth_unmute_paths)
                         {
-                            switch(message->event_type)
+                            UnmuteAllPaths();
+                        }
+
+                        switch(message->event_type)
+                        {
+                            case ES_EVENT_TYPE_AUTH_OPEN:
                             {
-                                case ES_EVENT_TYPE_AUTH_OPEN:
-                                    es_respond_flags_result(client_,message, 0x7fffffff, false);
-                                    break;
-                                default:
-                                    es_respond_auth_result(client_, message, ES_AUTH_RESULT_ALLOW, false);
+                                // Only read-only opens get cached, and only for the flags they asked for, so a later open for writing
+                                // of the same file still gets delivered
+                                uint32_t fflag = (uint32_t)message->event.open.fflag;
+                                if (status == xpc_response_auth_cache && (fflag & FWRITE) == 0)
+                                {
+                                    // Under the lock 'ClearAllCaches' takes, so the result can't get cached right after a clear
+                                    const std::lock_guard<std::mutex> lock(clientsLock_);
+                                    bool cache = epoch == cacheEpoch_.load();
+                                    es_respond_flags_result(client_,message, cache ? fflag : 0x7fffffff, cache);
                                     break;
+                                }
+
+                                es_respond_flags_result(client_,message, 0x7fffffff, false);
+                                break;
                             }
-                            
-                            if (status == xpc_response_mute_process)
-                            {
-                                es_mute_process(client_, event.GetProcessAuditToken());
-                            }
-                            
-                            break;
+                            default:
+                                es_respond_auth_result(client_, message, ES_AUTH_RESULT_ALLOW, false);
+                                break;
                         }
+                        
+                        if (status == xpc_response_mute_process)
+                        {
+                            es_mute_process(client_, event.GetProcessAuditToken());
+                        }
+                        
                         break;
                     }
-                    case xpc_response_error:
-                    case xpc_response_failure:
-                    {
-                        log_error("%s", "XPC event processing error - sandboxing is no longer reliable!\n");
-                        // If we can't guarantee conistent event reporting, we forcefully exit and abort the build.
-                        exit(EXIT_FAILURE);
-                        break;
-                    }
+                    break;
                 }
-            }
-            else
-            {
-                // Ignore cases when BuildXL quits and invalidates / interrupts the XPC connection.
-                if (response != XPC_ERROR_CONNECTION_INTERRUPTED && response != XPC_ERROR_CONNECTION_INVALID)
+                case xpc_response_error:
+                case xpc_response_failure:
                 {
-                    const char *desc = xpc_copy_description(response);
-                    log_error("Non-recoverable error in ES client message parsing queue: %{public}s", desc);
+                    log_error("%s", "XPC event processing error - sandboxing is no longer reliable!\n");
+                    // If we can't guarantee conistent event reporting, we forcefully exit and abort the build.
                     exit(EXIT_FAILURE);
+                    break;
                 }
             }
-        });
+        }
+        else
+        {
+            // Ignore cases when BuildXL quits and invalidates / interrupts the XPC connection.
+            if (response != XPC_ERROR_CONNECTION_INTERRUPTED && response != XPC_ERROR_CONNECTION_INVALID)
+            {
+                const char *desc = xpc_copy_description(response);
+                log_error("Non-recoverable error in ES client message parsing queue: %{public}s", desc);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        es_release_message(message);
     });
+}
 
-    /*
-        TODO: Calling exit() within the system extension / daemon causes it to be killed and restarted, in general we have to
-              implement a nicer way to indicate errors and recover from them; currently we log and exit only!
-     */
+void ESClient::MutePaths()
+{
+    for (const char *prefix : kMutedExecutablePathPrefixes)
+    {
+        if (es_mute_path_prefix(client_, prefix) != ES_RETURN_SUCCESS)
+        {
+            log_error("Failed muting executable path prefix: %{public}s", prefix);
+        }
+    }
 
-    if (result != ES_NEW_CLIENT_RESULT_SUCCESS)
+    for (const char *path : kMutedExecutablePaths)
     {
-        log_error("Failed creating an EndpointSecurity client: %d", result);
-        exit(EXIT_FAILURE);
+        if (es_mute_path_literal(client_, path) != ES_RETURN_SUCCESS)
+        {
+            log_error("Failed muting executable path: %{public}s", path);
+        }
     }
+}
 
-    es_clear_cache_result_t clear_result = es_clear_cache(client_);
-    if (clear_result != ES_CLEAR_CACHE_RESULT_SUCCESS)
+void ESClient::UnmuteAllPaths()
+{
+    const std::lock_guard<std::mutex> lock(clientsLock_);
+    for (ESClient *client : clients_)
     {
-        log_error("Failed cleaning the EndpointSecurity client cache: %d", clear_result);
-        exit(EXIT_FAILURE);
+        if (client->client_ != nullptr && es_unmute_all_paths(client->client_) != ES_RETURN_SUCCESS)
+        {
+            log_error("%s", "Failed unmuting executable paths - sandboxing is no longer reliable!\n");
+            exit(EXIT_FAILURE);
+        }
     }
+}
 
-    es_return_t subscribe_result = es_subscribe(client_, (es_event_type_t *)events, event_count);
-    if (subscribe_result != ES_RETURN_SUCCESS)
+bool ESClient::SetDemandedEvents(const std::vector<es_event_type_t> &events)
+{
+    if (client_ == nullptr)
     {
-        log_error("Failed subscribing to the EndpointSecurity backend: %d", subscribe_result);
-        exit(EXIT_FAILURE);
+        return false;
     }
 
-    log_debug("Successfully initialized an EndpointSecurity client, tracking: %d event(s).", event_count);
+    std::set<es_event_type_t> demanded(events.begin(), events.end());
+
+    std::vector<es_event_type_t> added;
+    std::set_difference(demanded.begin(), demanded.end(), demandedEvents_.begin(), demandedEvents_.end(), std::back_inserter(added));
+
+    std::vector<es_event_type_t> removed;
+    std::set_difference(demandedEvents_.begin(), demandedEvents_.end(), demanded.begin(), demanded.end(), std::back_inserter(removed));
+
+    if (!added.empty() && es_subscribe(client_, added.data(), (uint32_t)added.size()) != ES_RETURN_SUCCESS)
+    {
+        log_error("Failed subscribing to %lu demanded EndpointSecurity event(s) - sandboxing is no longer reliable!", added.size());
+        return false;
+    }
+
+    if (!removed.empty() && es_unsubscribe(client_, removed.data(), (uint32_t)removed.size()) != ES_RETURN_SUCCESS)
+    {
+        // Only costs the events nobody needs, they are unsubscribed from on the next change
+        log_error("Failed unsubscribing from %lu EndpointSecurity event(s) no longer demanded", removed.size());
+        demanded.insert(removed.begin(), removed.end());
+    }
+
+    demandedEvents_.swap(demanded);
+    log_debug("Updated demanded EndpointSecurity events, subscribed: %lu, unsubscribed: %lu", added.size(), removed.size());
+
+    return true;
+}
+
+bool ESClient::ClearAllCaches()
+{
+    const std::lock_guard<std::mutex> lock(clientsLock_);
+    cacheEpoch_++;
+
+    for (ESClient *client : clients_)
+    {
+        if (client->client_ != nullptr && es_clear_cache(client->client_) != ES_CLEAR_CACHE_RESULT_SUCCESS)
+        {
+            log_error("%s", "Failed cleaning the EndpointSecurity client cache!");
+            return false;
+        }
+    }
+
+    return true;
 }
 
 int ESClient::TearDown(xpc_object_t remote, xpc_object_t reply)
 {
     if (client_ != nullptr)
     {
+        {
+            const std::lock_guard<std::mutex> lock(clientsLock_);
+            clients_.erase(this);
+        }
+
         es_return_t result = es_unsubscribe_all(client_);
         if (result != ES_RETURN_SUCCESS)
         {
@@ -176,6 +402,8 @@ int ESClient::TearDown(xpc_object_t remote, xpc_object_t reply)
             return ES_RETURN_ERROR;
         }
 
+        demandedEvents_.clear();
+
         result = es_delete_client(client_);
         if (result != ES_RETURN_SUCCESS)
         {
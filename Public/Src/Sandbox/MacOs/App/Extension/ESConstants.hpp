@@ -25,7 +25,6 @@ static const char* xpc_broker_version = "1.0.0";
 
  Currently the following events are not hooked up, maybe useful for later:
 
-    ES_EVENT_TYPE_NOTIFY_READDIR,
     ES_EVENT_TYPE_NOTIFY_FSGETPATH,
     ES_EVENT_TYPE_NOTIFY_DUP,
     ES_EVENT_TYPE_NOTIFY_WRITE, // Slows down ES due to callback being invoked on every write on block size bytes
@@ -76,20 +75,33 @@ const es_event_type_t es_read_events_[] =
  (OS constraint). To reduce backpressure, more clients should be created and the events bucketed by their 'amount reported', this
  needs to be dynamically encoded depending on the host CPU configuration. Hence the following structure should be used (uncommented
  and clients re-enabled in main.c).
+
+ These are by far the most frequent events, and they only produce reports for pips whose manifest asks for them, so they are not
+ subscribed to up front: the read client subscribes to them while some running pip can report them (see 'xpc_set_es_event_demand').
+ They are notify events, the sandbox never denies these accesses and has no reason to hold up the process for them.
  
 */
 
+// es_demand_probes
 const es_event_type_t es_probe_events_[] =
 {
-//    ES_EVENT_TYPE_NOTIFY_STAT,
-//    ES_EVENT_TYPE_AUTH_GETATTRLIST,
-//    ES_EVENT_TYPE_AUTH_GETEXTATTR,
-//    ES_EVENT_TYPE_AUTH_LISTEXTATTR
+    ES_EVENT_TYPE_NOTIFY_STAT,
+    ES_EVENT_TYPE_NOTIFY_ACCESS,
+    ES_EVENT_TYPE_NOTIFY_GETATTRLIST,
+    ES_EVENT_TYPE_NOTIFY_GETEXTATTR,
+    ES_EVENT_TYPE_NOTIFY_LISTEXTATTR
 };
 
+// es_demand_probes
 const es_event_type_t es_spammy_events_[] =
 {
-//    ES_EVENT_TYPE_NOTIFY_LOOKUP
+    ES_EVENT_TYPE_NOTIFY_LOOKUP
+};
+
+// es_demand_enumerations
+const es_event_type_t es_enumeration_events_[] =
+{
+    ES_EVENT_TYPE_NOTIFY_READDIR
 };
 
 #endif /* ESConstants_h */
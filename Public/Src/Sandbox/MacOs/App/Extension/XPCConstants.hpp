@@ -4,6 +4,8 @@
 #ifndef XPCConstants_h
 #define XPCConstants_h
 
+#include <stdint.h>
+
 enum XPCCommands : unsigned int
 {
     xpc_response_error = 0,
@@ -19,6 +21,32 @@ enum XPCCommands : unsigned int
     xpc_get_es_connection,
     xpc_set_es_connection,
     xpc_kill_es_connection,
+
+    xpc_response_auth_unmute_paths,
+
+    xpc_drain_detours_event_ring,
+
+    xpc_response_auth_cache,
+    xpc_clear_es_cache,
+
+    xpc_set_es_event_demand,
 };
 
+/*!
+ * Bits of the demand sent with 'xpc_set_es_event_demand': the kinds of accesses some running pip can report, only the ES events
+ * that these come from are subscribed to (see ESClient::SetDemandedEvents)
+ */
+enum ESEventDemand : uint64_t
+{
+    es_demand_none = 0,
+    es_demand_probes = 0x1,
+    es_demand_enumerations = 0x2,
+};
+
+// Key of the ESEventDemand bits in 'xpc_set_es_event_demand' messages
+#define ESEventDemandKey "demand"
+
+// Key of the shared memory holding the IOEventRing in the XPC messages that hand it over, as an XPC shmem object
+#define IOEventRingKey "IOEventRing"
+
 #endif /* XPCConstants_h */
@@ -5,10 +5,13 @@
 #import "ESConstants.hpp"
 #import "XPCConstants.hpp"
 
+#include <iterator>
+
 // TODO: Get rid of the global state once the prototype is more mature
 
 xpc_endpoint_t detours_endpoint = nullptr;
 xpc_endpoint_t es_endpoint = nullptr;
+xpc_object_t detours_event_ring = nullptr;
 
 ESClient *lifetime_client = nullptr;
 ESClient *exit_client = nullptr;
@@ -67,6 +70,11 @@ int main(void)
                                 xpc_connection_t connection = (command == xpc_get_detours_connection ? detours_endpoint : es_endpoint);
 
                                 xpc_dictionary_set_value(reply, "connection", connection);
+                                if (command == xpc_get_detours_connection && detours_event_ring != nullptr)
+                                {
+                                    xpc_dictionary_set_value(reply, IOEventRingKey, detours_event_ring);
+                                }
+
                                 xpc_dictionary_set_uint64(reply, "response", connection != nullptr ? xpc_response_success : xpc_response_failure);
                                 xpc_connection_send_message(peer, reply);
 
@@ -78,6 +86,12 @@ int main(void)
                                 if (command == xpc_set_detours_connection)
                                 {
                                     detours_endpoint = xpc_dictionary_get_value(message, "connection");
+
+                                    // Optional, interposed processes fall back to XPC messages without it
+                                    xpc_object_t event_ring = xpc_dictionary_get_value(message, IOEventRingKey);
+                                    if (event_ring != nullptr) xpc_retain(event_ring);
+                                    if (detours_event_ring != nullptr) xpc_release(detours_event_ring);
+                                    detours_event_ring = event_ring;
                                 }
                                 else
                                 {
@@ -108,6 +122,47 @@ int main(void)
                             case xpc_kill_detours_connection:
                             {
                                 detours_endpoint = nullptr;
+                                if (detours_event_ring != nullptr)
+                                {
+                                    xpc_release(detours_event_ring);
+                                    detours_event_ring = nullptr;
+                                }
+                                break;
+                            }
+                            case xpc_clear_es_cache:
+                            {
+                                xpc_object_t reply = xpc_dictionary_create_reply(message);
+                                xpc_dictionary_set_uint64(reply, "response", ESClient::ClearAllCaches() ? xpc_response_success : xpc_response_failure);
+                                xpc_connection_send_message(peer, reply);
+                                break;
+                            }
+                            case xpc_set_es_event_demand:
+                            {
+                                uint64_t demand = xpc_dictionary_get_uint64(message, ESEventDemandKey);
+
+                                std::vector<es_event_type_t> events;
+                                if ((demand & es_demand_probes) != 0)
+                                {
+                                    events.insert(events.end(), std::begin(es_probe_events_), std::end(es_probe_events_));
+                                    events.insert(events.end(), std::begin(es_spammy_events_), std::end(es_spammy_events_));
+                                }
+
+                                if ((demand & es_demand_enumerations) != 0)
+                                {
+                                    events.insert(events.end(), std::begin(es_enumeration_events_), std::end(es_enumeration_events_));
+                                }
+
+                                // There are no probe and spammy clients (see above), the read client takes their events
+                                bool success = read_client != nullptr && read_client->SetDemandedEvents(events);
+
+                                // Demand that drops events is sent without waiting for a reply
+                                xpc_object_t reply = xpc_dictionary_create_reply(message);
+                                if (reply != nullptr)
+                                {
+                                    xpc_dictionary_set_uint64(reply, "response", success ? xpc_response_success : xpc_response_failure);
+                                    xpc_connection_send_message(peer, reply);
+                                }
+
                                 break;
                             }
                             case xpc_kill_es_connection:
@@ -2,6 +2,7 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include "Detours.hpp"
+#include "IOEventRing.hpp"
 #include "MemoryStreams.hpp"
 #include "PathCacheEntry.hpp"
 #include "Trie.hpp"
@@ -14,6 +15,7 @@ static std::once_flag InitializeWritePathCache;
 static std::once_flag InitializeXPC;
 
 static xpc_connection_t bxl_connection = nullptr;
+static IOEventRing *event_ring = nullptr;
 static thread_local bool bxl_realpath_execution = false;
 
 #pragma mark Utility Functions
@@ -26,6 +28,112 @@ char *bxl_realpath(const char* file_name, char* buffer)
     return result;
 }
 
+#pragma mark Path Resolution
+
+/*
+    realpath walks every component of a path (lstat, readlink, getattrlist), and all paths of an event get resolved before it is sent.
+    The resolved form of the directories seen so far is cached instead, for all threads: resolving a path whose last component isn't a
+    symlink then takes a lookup and a single lstat. A directory only resolves differently once something was renamed, unlinked or replaced
+    by a symlink, so the interposed rename, exchangedata, symlink and unlink drop the whole cache. Like the other caches in here, changes
+    made by other processes go unnoticed.
+*/
+
+// Never destroyed: threads can still report while the process exits
+static std::shared_timed_mutex &resolved_directories_lock()
+{
+    static std::shared_timed_mutex *lock = new std::shared_timed_mutex();
+    return *lock;
+}
+
+static std::unordered_map<std::string, std::string> &resolved_directories()
+{
+    static std::unordered_map<std::string, std::string> *directories = new std::unordered_map<std::string, std::string>();
+    return *directories;
+}
+
+// Bumped on every invalidation, so a resolution that raced with one isn't cached. Guarded by resolved_directories_lock().
+static uint64_t resolved_directories_generation = 0;
+
+static void invalidate_resolved_directories()
+{
+    std::unique_lock<std::shared_timed_mutex> exclusive(resolved_directories_lock());
+    resolved_directories().clear();
+    resolved_directories_generation++;
+}
+
+static bool resolve_directory(const char *path, size_t length, std::string &resolved)
+{
+    std::string directory(path, length);
+    uint64_t generation;
+    {
+        std::shared_lock<std::shared_timed_mutex> shared(resolved_directories_lock());
+        auto cached = resolved_directories().find(directory);
+        if (cached != resolved_directories().end())
+        {
+            resolved = cached->second;
+            return true;
+        }
+
+        generation = resolved_directories_generation;
+    }
+
+    char buffer[PATH_MAX + 1] = { '\0' };
+    if (bxl_realpath(directory.c_str(), buffer) == nullptr)
+    {
+        return false;
+    }
+
+    resolved = buffer;
+
+    std::unique_lock<std::shared_timed_mutex> exclusive(resolved_directories_lock());
+    if (generation == resolved_directories_generation)
+    {
+        resolved_directories().emplace(std::move(directory), resolved);
+    }
+
+    return true;
+}
+
+// Same result as bxl_realpath, going through the cache for the directory of 'path' when it is absolute and ends with a plain name
+static void resolve_path(const char *path, char *buffer)
+{
+    const char *separator = path[0] == '/' ? strrchr(path, '/') : nullptr;
+    const char *name = separator != nullptr ? separator + 1 : nullptr;
+    bool plain_name = name != nullptr && name[0] != '\0' && strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
+
+    std::string directory;
+    if (plain_name && resolve_directory(path, separator == path ? 1 : separator - path, directory))
+    {
+        size_t directory_length = directory.length() > 1 ? directory.length() : 0;
+        size_t name_length = strlen(name);
+        if (directory_length + 1 + name_length <= PATH_MAX)
+        {
+            memcpy(buffer, directory.data(), directory_length);
+            buffer[directory_length] = '/';
+            memcpy(buffer + directory_length + 1, name, name_length + 1);
+
+            // realpath also reports a missing file under its resolved directory
+            struct stat s;
+            if (lstat(buffer, &s) == 0 ? !S_ISLNK(s.st_mode) : errno == ENOENT)
+            {
+                return;
+            }
+        }
+    }
+
+    bxl_realpath(path, buffer);
+}
+
+static void prepare_resolved_directories_for_fork()
+{
+    resolved_directories_lock().lock();
+}
+
+static void resume_resolved_directories_after_fork()
+{
+    resolved_directories_lock().unlock();
+}
+
 int setup_xpc()
 {
     char queue_name[PATH_MAX] = { '\0' };
@@ -77,6 +185,22 @@ int setup_xpc()
             xpc_connection_set_target_queue(bxl_connection, xpc_queue);
             xpc_connection_resume(bxl_connection);
             xpc_connection_suspend(xpc_connection);
+
+            // Optional, notifications go over XPC when BuildXL doesn't share an event ring
+            xpc_object_t ring_memory = xpc_dictionary_get_value(response, IOEventRingKey);
+            if (event_ring == nullptr && ring_memory != nullptr)
+            {
+                void *region = nullptr;
+                size_t size = xpc_shmem_map(ring_memory, &region);
+                if (size >= IOEventRing::RegionSize())
+                {
+                    event_ring = (IOEventRing *) region;
+                }
+                else if (size > 0)
+                {
+                    munmap(region, size);
+                }
+            }
         }
         else
         {
@@ -109,6 +233,167 @@ inline mode_t get_mode(const char *path)
     return stat(path, &s) == 0 ? s.st_mode : 0;    
 }
 
+#pragma mark Event Batching
+
+/*
+    Notifications go into the event ring shared with BuildXL (see IOEventRing) when there is one, XPC is then only used to wake up its consumer.
+    Otherwise, or once a thread found the ring full, they are sent without waiting for a reply and batched per thread: a batch is a single
+    XPC data object (see IOEventBatchKey).
+    Only exec, fork and exit events are sent synchronously, after flushing the batches of all threads, so BuildXL has seen every event
+    of a process before it processes those ordering points. Batches are also flushed when full and when their thread exits.
+*/
+
+// Size a batch is sent at, the last event can take it past this
+#define MAX_EVENT_BATCH_SIZE (16 * 1024)
+
+struct EventBatch;
+
+// The batch of the current thread, if it has reported anything yet
+static thread_local EventBatch *current_event_batch = nullptr;
+
+// Never destroyed: threads can still report while the process exits
+static std::mutex &event_batches_lock()
+{
+    static std::mutex *lock = new std::mutex();
+    return *lock;
+}
+
+static std::vector<EventBatch *> &event_batches()
+{
+    static std::vector<EventBatch *> *batches = new std::vector<EventBatch *>();
+    return *batches;
+}
+
+inline void send_event_batch(std::vector<char> &buffer)
+{
+    if (buffer.empty())
+    {
+        return;
+    }
+
+    xpc_object_t xpc_payload = xpc_dictionary_create(NULL, NULL, 0);
+    xpc_dictionary_set_data(xpc_payload, IOEventBatchKey, buffer.data(), buffer.size());
+    xpc_connection_send_message(bxl_connection, xpc_payload);
+    xpc_release(xpc_payload);
+
+    buffer.clear();
+}
+
+inline void send_event_ring_wakeup()
+{
+    xpc_object_t xpc_payload = xpc_dictionary_create(NULL, NULL, 0);
+    xpc_dictionary_set_uint64(xpc_payload, "command", xpc_drain_detours_event_ring);
+    xpc_connection_send_message(bxl_connection, xpc_payload);
+    xpc_release(xpc_payload);
+}
+
+struct EventBatch
+{
+    std::mutex lock;
+    std::vector<char> buffer;
+
+    // Set once the event ring was found full: the events of this thread then all go through XPC, so they stay in order
+    bool bypass_ring = false;
+
+    EventBatch()
+    {
+        std::lock_guard<std::mutex> registry(event_batches_lock());
+        event_batches().push_back(this);
+        current_event_batch = this;
+    }
+
+    ~EventBatch()
+    {
+        std::lock_guard<std::mutex> registry(event_batches_lock());
+        std::vector<EventBatch *> &batches = event_batches();
+        batches.erase(std::remove(batches.begin(), batches.end(), this), batches.end());
+
+        std::lock_guard<std::mutex> guard(lock);
+        send_event_batch(buffer);
+        current_event_batch = nullptr;
+    }
+};
+
+static thread_local EventBatch thread_event_batch;
+
+static void flush_event_batches_locked()
+{
+    for (EventBatch *batch : event_batches())
+    {
+        std::lock_guard<std::mutex> guard(batch->lock);
+        send_event_batch(batch->buffer);
+    }
+}
+
+static void flush_event_batches()
+{
+    std::lock_guard<std::mutex> registry(event_batches_lock());
+    flush_event_batches_locked();
+}
+
+inline void add_to_event_batch(const IOEvent &event)
+{
+    EventBatch &batch = thread_event_batch;
+    std::lock_guard<std::mutex> guard(batch.lock);
+
+    if (event_ring != nullptr && !batch.bypass_ring)
+    {
+        bool needs_wakeup = false;
+        if (event_ring->TryPush(event, needs_wakeup))
+        {
+            if (needs_wakeup)
+            {
+                send_event_ring_wakeup();
+            }
+
+            return;
+        }
+
+        batch.bypass_ring = true;
+    }
+
+    uint32_t msg_length = (uint32_t)event.SerializedSize();
+    size_t offset = batch.buffer.size();
+    batch.buffer.resize(offset + sizeof(uint32_t) + msg_length);
+    memcpy(batch.buffer.data() + offset, &msg_length, sizeof(uint32_t));
+    event.Serialize(batch.buffer.data() + offset + sizeof(uint32_t), msg_length);
+
+    if (batch.buffer.size() >= MAX_EVENT_BATCH_SIZE)
+    {
+        send_event_batch(batch.buffer);
+    }
+}
+
+// A forked child only has the forking thread: flush everything beforehand so the child doesn't send the events of the parent again,
+// and keep the registry locked across the fork so the child doesn't inherit it locked by a thread it doesn't have
+static void prepare_event_batches_for_fork()
+{
+    event_batches_lock().lock();
+    flush_event_batches_locked();
+}
+
+static void resume_event_batches_in_parent()
+{
+    event_batches_lock().unlock();
+}
+
+static void resume_event_batches_in_child()
+{
+    std::vector<EventBatch *> &batches = event_batches();
+    EventBatch *current = current_event_batch;
+    batches.erase(std::remove_if(batches.begin(), batches.end(), [current](EventBatch *batch) { return batch != current; }), batches.end());
+
+    // Nothing guarantees the mapping of the event ring is still shared with BuildXL in a forked child
+    event_ring = nullptr;
+    event_batches_lock().unlock();
+}
+
+inline bool is_ordering_event(const IOEvent &event)
+{
+    es_event_type_t type = event.GetEventType();
+    return type == ES_EVENT_TYPE_NOTIFY_EXEC || type == ES_EVENT_TYPE_NOTIFY_FORK || type == ES_EVENT_TYPE_NOTIFY_EXIT;
+}
+
 inline void send_to_sandbox(IOEvent &event, es_event_type_t type = ES_EVENT_TYPE_LAST, bool force_xpc_init = false, bool resolve_paths = true)
 {
     if (event.IsPlistEvent() || event.IsDirectorySpecialCharacterEvent())
@@ -121,6 +406,13 @@ inline void send_to_sandbox(IOEvent &event, es_event_type_t type = ES_EVENT_TYPE
         handle_xpc_setup();
     });
 
+    bool synchronous = is_ordering_event(event);
+    if (synchronous)
+    {
+        // Batched events go out on the current connection, before it is possibly re-initialized below
+        flush_event_batches();
+    }
+
     // Some interposed syscalls invalidate XPC sessions, re-initialize when required
     if (force_xpc_init)
     {
@@ -129,24 +421,34 @@ inline void send_to_sandbox(IOEvent &event, es_event_type_t type = ES_EVENT_TYPE
 
     if (resolve_paths)
     {
-        char src_resolved[PATH_MAX + 1] = { '\0' };
-        bxl_realpath(event.GetEventPath(SRC_PATH), src_resolved);
-        event.SetEventPath(src_resolved, SRC_PATH);
+        // Most events only have a source path, an empty one stays empty
+        if (event.GetEventPath(SRC_PATH)[0] != '\0')
+        {
+            char src_resolved[PATH_MAX + 1] = { '\0' };
+            resolve_path(event.GetEventPath(SRC_PATH), src_resolved);
+            event.SetEventPath(src_resolved, SRC_PATH);
+        }
 
-        char dst_resolved[PATH_MAX + 1] = { '\0' };
-        bxl_realpath(event.GetEventPath(DST_PATH), dst_resolved);
-        event.SetEventPath(dst_resolved, DST_PATH);
+        if (event.GetEventPath(DST_PATH)[0] != '\0')
+        {
+            char dst_resolved[PATH_MAX + 1] = { '\0' };
+            resolve_path(event.GetEventPath(DST_PATH), dst_resolved);
+            event.SetEventPath(dst_resolved, DST_PATH);
+        }
     }
 
-    size_t msg_length = IOEvent::max_size();
-    char msg[msg_length];
+    if (!synchronous)
+    {
+        add_to_event_batch(event);
+        return;
+    }
 
-    omemorystream oms(msg, sizeof(msg));
-    oms << event;
+    size_t msg_length = event.SerializedSize();
+    char msg[msg_length];
+    event.Serialize(msg, msg_length);
 
     xpc_object_t xpc_payload = xpc_dictionary_create(NULL, NULL, 0);
-    xpc_dictionary_set_string(xpc_payload, IOEventKey, msg);
-    xpc_dictionary_set_uint64(xpc_payload, IOEventLengthKey, event.Size());
+    xpc_dictionary_set_data(xpc_payload, IOEventKey, msg, msg_length);
 
     xpc_object_t response = xpc_connection_send_message_with_reply_sync(bxl_connection, xpc_payload);
     xpc_type_t xpc_type = xpc_get_type(response);
@@ -334,6 +636,9 @@ DYLD_INTERPOSE(bxl__Exit, _Exit)
 
 void __attribute__ ((constructor)) _bxl_linux_sandbox_init(void)
 {
+    pthread_atfork(prepare_event_batches_for_fork, resume_event_batches_in_parent, resume_event_batches_in_child);
+    pthread_atfork(prepare_resolved_directories_for_fork, resume_resolved_directories_after_fork, resume_resolved_directories_after_fork);
+
     atexit_b(^()
     {
         EXIT_EVENT_CONSTRUCTOR()
@@ -414,6 +719,7 @@ DYLD_INTERPOSE(bxl_link, link)
 int bxl_symlink(const char *path1, const char *path2)
 {
     int result = symlink(path1, path2);
+    if (result == 0) invalidate_resolved_directories();
     DEFAULT_EVENT_CONSTRUCTOR_NO_RESOLVE(ES_EVENT_TYPE_NOTIFY_CREATE, path1, path2, true, true)
 }
 DYLD_INTERPOSE(bxl_symlink, symlink)
@@ -421,6 +727,7 @@ DYLD_INTERPOSE(bxl_symlink, symlink)
 int bxl_unlink(const char *path)
 {
     int result = unlink(path);
+    if (result == 0) invalidate_resolved_directories();
     DEFAULT_EVENT_CONSTRUCTOR_NO_RESOLVE(ES_EVENT_TYPE_NOTIFY_UNLINK, path, "", true, true)
 }
 DYLD_INTERPOSE(bxl_unlink, unlink)
@@ -518,6 +825,7 @@ DYLD_INTERPOSE(bxl_acl_get_link_np, acl_get_link_np)
 int bxl_rename(const char *src, const char *dst)
 {
     int result = rename(src, dst);
+    if (result == 0) invalidate_resolved_directories();
     DEFAULT_EVENT_CONSTRUCTOR(ES_EVENT_TYPE_NOTIFY_RENAME, src, dst, false)
 }
 DYLD_INTERPOSE(bxl_rename, rename)
@@ -525,6 +833,7 @@ DYLD_INTERPOSE(bxl_rename, rename)
 int bxl_exchangedata(const char * path1, const char * path2, unsigned int options)
 {
     int result = exchangedata(path1, path2, options);
+    if (result == 0) invalidate_resolved_directories();
     DEFAULT_EVENT_CONSTRUCTOR(ES_EVENT_TYPE_NOTIFY_EXCHANGEDATA, path1, path2, false)
 }
 DYLD_INTERPOSE(bxl_exchangedata, exchangedata)
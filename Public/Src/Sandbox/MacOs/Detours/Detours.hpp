@@ -7,12 +7,21 @@
 #include <assert.h>
 #include <libproc.h>
 #include <os/log.h>
+#include <pthread.h>
 #include <spawn.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/clonefile.h>
 #include <sys/fcntl.h>
 #include <sys/fsgetpath.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <EndpointSecurity/EndpointSecurity.h>
 
@@ -70,7 +79,7 @@
     if (success == 0) { \
         bool reported = trackedPaths_->get(path) != nullptr; \
         if (!reported) { \
-            std::shared_ptr<PathCacheEntry> entry(new PathCacheEntry(fildes)); \
+            std::shared_ptr<PathCacheEntry> entry(new PathCacheEntry(path, 0)); \
             trackedPaths_->insert(path, entry); \
             IOEvent event(getpid(), 0, getppid(), ES_EVENT_TYPE_NOTIFY_WRITE, ES_ACTION_TYPE_NOTIFY, path, dst, get_executable_path(getpid()), get_mode(path)); \
             send_to_sandbox(event, ES_EVENT_TYPE_NOTIFY_WRITE); \
@@ -1,8 +1,18 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "cpu.h"
 
+struct CpuLoadSampler
+{
+    host_t host;
+    natural_t coreCount;
+    unsigned int *previousTicks;    // CPU_STATE_MAX per core
+};
+
 int GetCpuLoadInfo(CpuLoadInfo *buffer, long bufferSize)
 {
     if (sizeof(CpuLoadInfo) != bufferSize)
@@ -19,7 +29,9 @@ int GetCpuLoadInfo(CpuLoadInfo *buffer, long bufferSize)
     unsigned long totalSystemTime = 0;
     unsigned long totalIdleTime = 0;
     
-    kern_return_t error = host_processor_info(mach_host_self(), PROCESSOR_CPU_LOAD_INFO, &numberOfLogicalCores, &cpuInfo, &cpuInfoCount);
+    host_t host = mach_host_self();
+    kern_return_t error = host_processor_info(host, PROCESSOR_CPU_LOAD_INFO, &numberOfLogicalCores, &cpuInfo, &cpuInfoCount);
+    mach_port_deallocate(mach_task_self(), host);
     if(error != KERN_SUCCESS)
     {
         return error;
@@ -33,9 +45,109 @@ int GetCpuLoadInfo(CpuLoadInfo *buffer, long bufferSize)
         totalIdleTime += cpuInfo[(CPU_STATE_MAX * i) + CPU_STATE_IDLE];
     }
     
+    vm_deallocate(mach_task_self(), (vm_address_t)cpuInfo, cpuInfoCount * sizeof(integer_t));
+
     buffer->systemTime = totalSystemTime;
     buffer->userTime = totalUserTime;
     buffer->idleTime = totalIdleTime;
     
     return KERN_SUCCESS;
 }
+
+CpuLoadSampler *CreateCpuLoadSampler(void)
+{
+    CpuLoadSampler *sampler = (CpuLoadSampler *)calloc(1, sizeof(CpuLoadSampler));
+    if (sampler != NULL)
+    {
+        sampler->host = mach_host_self();
+    }
+
+    return sampler;
+}
+
+void FreeCpuLoadSampler(CpuLoadSampler *sampler)
+{
+    if (sampler == NULL)
+    {
+        return;
+    }
+
+    mach_port_deallocate(mach_task_self(), sampler->host);
+    free(sampler->previousTicks);
+    free(sampler);
+}
+
+int SampleCpuLoad(CpuLoadSampler *sampler, CpuLoadInfo *delta, long deltaSize, double *coreUtilization, int *coreCount)
+{
+    if (sizeof(CpuLoadInfo) != deltaSize)
+    {
+        printf("ERROR: Wrong size of CpuLoadInfo buffer; expected %ld, received %ld\n", sizeof(CpuLoadInfo), deltaSize);
+        return KERN_MEMORY_ERROR;
+    }
+
+    if (sampler == NULL || coreCount == NULL || (*coreCount > 0 && coreUtilization == NULL))
+    {
+        return KERN_INVALID_ARGUMENT;
+    }
+
+    mach_msg_type_number_t cpuInfoCount;
+    processor_info_array_t cpuInfo;
+    natural_t numberOfLogicalCores = 0U;
+
+    kern_return_t error = host_processor_info(sampler->host, PROCESSOR_CPU_LOAD_INFO, &numberOfLogicalCores, &cpuInfo, &cpuInfoCount);
+    if (error != KERN_SUCCESS)
+    {
+        return error;
+    }
+
+    // Cores going on- or offline change the layout: start over from zero
+    if (numberOfLogicalCores != sampler->coreCount)
+    {
+        unsigned int *ticks = (unsigned int *)calloc(numberOfLogicalCores * CPU_STATE_MAX, sizeof(unsigned int));
+        if (ticks == NULL)
+        {
+            vm_deallocate(mach_task_self(), (vm_address_t)cpuInfo, cpuInfoCount * sizeof(integer_t));
+            return KERN_RESOURCE_SHORTAGE;
+        }
+
+        free(sampler->previousTicks);
+        sampler->previousTicks = ticks;
+        sampler->coreCount = numberOfLogicalCores;
+    }
+
+    unsigned long totalUserTime = 0;
+    unsigned long totalSystemTime = 0;
+    unsigned long totalIdleTime = 0;
+
+    for (natural_t i = 0; i < numberOfLogicalCores; ++i)
+    {
+        unsigned int *previous = &sampler->previousTicks[CPU_STATE_MAX * i];
+        unsigned int *current = (unsigned int *)&cpuInfo[CPU_STATE_MAX * i];
+
+        // The counters are 32 bits and wrap around, unsigned subtraction still gives the right difference
+        unsigned int user = (current[CPU_STATE_USER] - previous[CPU_STATE_USER]) + (current[CPU_STATE_NICE] - previous[CPU_STATE_NICE]);
+        unsigned int system = current[CPU_STATE_SYSTEM] - previous[CPU_STATE_SYSTEM];
+        unsigned int idle = current[CPU_STATE_IDLE] - previous[CPU_STATE_IDLE];
+
+        totalUserTime += user;
+        totalSystemTime += system;
+        totalIdleTime += idle;
+
+        if (i < (natural_t)*coreCount)
+        {
+            unsigned long total = (unsigned long)user + system + idle;
+            coreUtilization[i] = total > 0 ? 100.0 * ((unsigned long)user + system) / total : 0.0;
+        }
+
+        memcpy(previous, current, CPU_STATE_MAX * sizeof(unsigned int));
+    }
+
+    vm_deallocate(mach_task_self(), (vm_address_t)cpuInfo, cpuInfoCount * sizeof(integer_t));
+
+    delta->systemTime = totalSystemTime;
+    delta->userTime = totalUserTime;
+    delta->idleTime = totalIdleTime;
+    *coreCount = (int)numberOfLogicalCores;
+
+    return KERN_SUCCESS;
+}
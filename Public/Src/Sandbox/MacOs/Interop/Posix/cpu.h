@@ -15,4 +15,15 @@ typedef struct {
 
 int GetCpuLoadInfo(CpuLoadInfo *buffer, long bufferSize);
 
+// Keeps the per-core ticks of the previous sample, so that each sample reports only what happened since
+typedef struct CpuLoadSampler CpuLoadSampler;
+
+CpuLoadSampler *CreateCpuLoadSampler(void);
+void FreeCpuLoadSampler(CpuLoadSampler *sampler);
+
+// Fills 'delta' with the ticks of all cores since the previous sample (since boot for the first one), and 'coreUtilization' with the busy
+// percentage of every core over that period. 'coreCount' holds the capacity of 'coreUtilization' on input and the number of cores on output,
+// only the first 'capacity' cores are written when there are more.
+int SampleCpuLoad(CpuLoadSampler *sampler, CpuLoadInfo *delta, long deltaSize, double *coreUtilization, int *coreCount);
+
 #endif /* cpu_h */
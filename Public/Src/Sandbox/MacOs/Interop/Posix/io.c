@@ -2,10 +2,15 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/attr.h>
 #include <sys/errno.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
+#include <sys/vnode.h>
 #include <unistd.h>
 
 #include "io.h"
@@ -25,6 +30,13 @@ static int CallStat(const char *path, bool followSymlink, struct stat *result)
     return ret;
 }
 
+static int CallStatAt(int dirfd, const char *name, bool followSymlink, struct stat *result)
+{
+    int ret;
+    while ((ret = fstatat(dirfd, name, result, followSymlink ? 0 : AT_SYMLINK_NOFOLLOW)) < 0 && errno == EINTR);
+    return ret;
+}
+
 static void ConvertStatToStatBuffer(struct stat *fileStat, StatBuffer *statBuffer)
 {
     statBuffer->st_dev                = fileStat->st_dev;
@@ -88,6 +100,186 @@ int StatFileDescriptor(intptr_t fd, StatBuffer *statBuffer, long bufferSize)
     return result;
 }
 
+// Length of the parent directory of 'path', or 0 when it has none worth opening (no slash, the root, or a trailing slash)
+static size_t ParentLength(const char *path)
+{
+    const char *lastSlash = strrchr(path, '/');
+    return lastSlash == NULL || lastSlash == path || lastSlash[1] == '\0' ? 0 : (size_t)(lastSlash - path);
+}
+
+static bool HasParent(const char *path, const char *parent, size_t parentLength)
+{
+    return ParentLength(path) == parentLength && strncmp(path, parent, parentLength) == 0;
+}
+
+int StatFiles(const char **paths, int count, bool followSymlink, StatBuffer *statBuffers, int *results, long bufferSize)
+{
+    if (sizeof(StatBuffer) != bufferSize)
+    {
+        printf("ERROR: Wrong size of StatBuffer buffer; expected %ld, received %ld\n", sizeof(StatBuffer), bufferSize);
+        return RUNTIME_ERROR;
+    }
+
+    int succeeded = 0;
+    int dirfd = -1;
+    const char *parent = NULL;
+    size_t parentLength = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        const char *path = paths[i];
+        size_t length = ParentLength(path);
+
+        if (length == 0 || !HasParent(path, parent, parentLength))
+        {
+            if (dirfd >= 0)
+            {
+                close(dirfd);
+                dirfd = -1;
+            }
+
+            parent = path;
+            parentLength = length;
+
+            // A directory is only worth opening when the next path is in it too
+            if (length > 0 && length < PATH_MAX && i + 1 < count && HasParent(paths[i + 1], parent, parentLength))
+            {
+                char directory[PATH_MAX];
+                memcpy(directory, path, length);
+                directory[length] = '\0';
+                while ((dirfd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0 && errno == EINTR);
+            }
+        }
+
+        // Without a descriptor (e.g., no read permission on the directory), fall back to the full path
+        struct stat fileStat;
+        int result = dirfd >= 0
+            ? CallStatAt(dirfd, path + parentLength + 1, followSymlink, &fileStat)
+            : CallStat(path, followSymlink, &fileStat);
+
+        if (result == 0)
+        {
+            ConvertStatToStatBuffer(&fileStat, &statBuffers[i]);
+            results[i] = 0;
+            succeeded++;
+        }
+        else
+        {
+            results[i] = errno;
+        }
+    }
+
+    if (dirfd >= 0)
+    {
+        close(dirfd);
+    }
+
+    return succeeded;
+}
+
+// Layout of the records 'getattrlistbulk' returns for the attributes requested below; with FSOPT_PACK_INVAL_ATTRS every
+// attribute is present, and they are only 4-byte aligned
+typedef struct __attribute__((packed)) {
+    uint32_t length;
+    attribute_set_t returned;
+    uint32_t error;
+    attrreference_t name;
+    fsobj_type_t objectType;
+    struct timespec modificationTime;
+    uint64_t fileId;
+    off_t dataLength;
+} EnumerationRecord;
+
+// Even a one-byte name takes 4 bytes after the fixed part of a record, so a buffer of 'count' times this size can't hold more
+// than 'count' records
+#define MIN_ENUMERATION_RECORD_SIZE (sizeof(EnumerationRecord) + 4)
+
+// Names are at most NAME_MAX UTF-16 code units on HFS+, up to three UTF-8 bytes each
+_Static_assert(MIN_DIRECTORY_ENTRY_COUNT * MIN_ENUMERATION_RECORD_SIZE >= sizeof(EnumerationRecord) + 3 * NAME_MAX + 1,
+               "The enumeration buffer must fit a record with the longest name");
+
+static uint16_t ObjectTypeToMode(fsobj_type_t objectType)
+{
+    switch (objectType)
+    {
+        case VREG:  return S_IFREG;
+        case VDIR:  return S_IFDIR;
+        case VLNK:  return S_IFLNK;
+        case VBLK:  return S_IFBLK;
+        case VCHR:  return S_IFCHR;
+        case VSOCK: return S_IFSOCK;
+        case VFIFO: return S_IFIFO;
+        default:    return 0;
+    }
+}
+
+int EnumerateDirectoryWithAttributes(intptr_t fd, DirectoryEntry *entries, int count, long entrySize)
+{
+    if (sizeof(DirectoryEntry) != entrySize)
+    {
+        printf("ERROR: Wrong size of DirectoryEntry buffer; expected %ld, received %ld\n", sizeof(DirectoryEntry), entrySize);
+        return RUNTIME_ERROR;
+    }
+
+    if (count < MIN_DIRECTORY_ENTRY_COUNT)
+    {
+        errno = EINVAL;
+        return RUNTIME_ERROR;
+    }
+
+    struct attrlist attributes = {0};
+    attributes.bitmapcount = ATTR_BIT_MAP_COUNT;
+    attributes.commonattr = ATTR_CMN_RETURNED_ATTRS | ATTR_CMN_ERROR | ATTR_CMN_NAME | ATTR_CMN_OBJTYPE | ATTR_CMN_MODTIME | ATTR_CMN_FILEID;
+    attributes.fileattr = ATTR_FILE_DATALENGTH;
+
+    size_t bufferSize = count * MIN_ENUMERATION_RECORD_SIZE;
+    char *buffer = malloc(bufferSize);
+    if (buffer == NULL)
+    {
+        errno = ENOMEM;
+        return RUNTIME_ERROR;
+    }
+
+    int entryCount;
+    while ((entryCount = getattrlistbulk(ToFileDescriptorUnchecked(fd), &attributes, buffer, bufferSize, FSOPT_PACK_INVAL_ATTRS)) < 0 && errno == EINTR);
+
+    char *current = buffer;
+    for (int i = 0; i < entryCount; i++)
+    {
+        EnumerationRecord record;
+        memcpy(&record, current, sizeof(EnumerationRecord));
+
+        DirectoryEntry *entry = &entries[i];
+        entry->error = record.error;
+        entry->st_ino = record.fileId;
+        entry->st_mode = ObjectTypeToMode(record.objectType);
+        entry->st_size = (record.returned.fileattr & ATTR_FILE_DATALENGTH) ? record.dataLength : 0;
+        entry->st_mtimespec = record.modificationTime.tv_sec;
+        entry->st_mtimespec_nsec = record.modificationTime.tv_nsec;
+
+        // The name is null-terminated and its offset is relative to its attrreference_t
+        const char *name = current + offsetof(EnumerationRecord, name) + record.name.attr_dataoffset;
+        size_t nameLength = strnlen(name, record.name.attr_length);
+        if (nameLength > NAME_MAX)
+        {
+            entry->error = ENAMETOOLONG;
+            nameLength = 0;
+        }
+
+        memcpy(entry->name, name, nameLength);
+        entry->name[nameLength] = '\0';
+        entry->nameLength = (uint16_t)nameLength;
+
+        current += record.length;
+    }
+
+    int error = errno;
+    free(buffer);
+    errno = error;
+
+    return entryCount;
+}
+
 intptr_t Open(const char *path, int32_t flags, int32_t mode)
 {
     int result;
@@ -4,6 +4,8 @@
 #ifndef io_h
 #define io_h
 
+#include <limits.h>
+
 #include "Dependencies.h"
 
 #define STD_ERROR_CODE -1
@@ -28,6 +30,18 @@ typedef struct {
     int64_t st_birthtimespec_nsec;   /* Time of birth (or creation) - nsec */
 } StatBuffer;
 
+typedef struct {
+    uint64_t st_ino;                  /* Inode number */
+    int64_t st_size;                  /* Total size, in bytes (0 for anything but regular files) */
+    int64_t st_mtimespec;             /* Time of last modification */
+    int64_t st_mtimespec_nsec;        /* Time of last modification - nsec*/
+    uint16_t st_mode;                 /* File type, only the S_IFMT bits are set */
+    uint16_t nameLength;              /* Length of 'name', in bytes */
+    int32_t error;                    /* Non-zero if the attributes of the entry could not be retrieved; ENAMETOOLONG (and an
+                                         empty 'name') if its UTF-8 name doesn't fit 'name', which HFS+ names can exceed */
+    char name[NAME_MAX + 1];          /* Null-terminated, UTF-8 encoded name of the entry */
+} DirectoryEntry;
+
 /*!
  * Returns information about a file specified by the given path.
  * @param path Location of the file
@@ -47,6 +61,32 @@ int StatFile(const char *path, bool followSymlink, StatBuffer *statBuffer, long
 */
 int StatFileDescriptor(intptr_t fd, StatBuffer *statBuffer, long bufferSize);
 
+/*!
+ * Same as 'StatFile' for several paths in a single call. Consecutive paths in the same directory are stat'ed relative to a descriptor
+ * of that directory, so only their last component gets looked up.
+ * @param paths Locations of the files
+ * @param count Number of entries in 'paths', 'statBuffers' and 'results'
+ * @param followSymlink Whether to follow symlinks
+ * @param statBuffers Buffers where the file information is stored, only written for the paths that succeed
+ * @param results 0 for every path that succeeds, its errno otherwise
+ * @param bufferSize Allocated size of a single 'StatBuffer' struct
+ * @result The number of paths that succeeded, or RUNTIME_ERROR.
+*/
+int StatFiles(const char **paths, int count, bool followSymlink, StatBuffer *statBuffers, int *results, long bufferSize);
+
+/*!
+ * Reads the next entries of a directory together with their type, size, modification time and inode, using 'getattrlistbulk'
+ * so the attributes of many entries come back in a single system call.  Call repeatedly until it returns 0.
+ * @param fd Descriptor of the directory to enumerate, its offset is advanced past the returned entries
+ * @param entries Buffer where the entries are stored
+ * @param count Number of entries that fit in 'entries', must be at least MIN_DIRECTORY_ENTRY_COUNT
+ * @param entrySize Allocated size of a single 'DirectoryEntry' struct
+ * @result The number of entries read, 0 once the directory is exhausted, or -1 on error (errno is set).
+*/
+int EnumerateDirectoryWithAttributes(intptr_t fd, DirectoryEntry *entries, int count, long entrySize);
+
+#define MIN_DIRECTORY_ENTRY_COUNT 16
+
 /*!
  * Opens file specified by path.
  * @param path Given path to open
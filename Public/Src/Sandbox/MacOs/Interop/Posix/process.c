@@ -14,12 +14,19 @@
 
 void DumpThreadState(void);
 
-static int ProcessTreeResourceUsage(pid_t pid, const rlim_t max_proc_count, ProcessResourceUsage *buffer, bool includeChildren)
+static ProcessTreeResourceUsageProvider processTreeResourceUsageProvider = NULL;
+
+void SetProcessTreeResourceUsageProvider(ProcessTreeResourceUsageProvider provider)
+{
+    processTreeResourceUsageProvider = provider;
+}
+
+static bool AddProcessResourceUsage(pid_t pid, ProcessResourceUsage *buffer)
 {
     rusage_info_current rusage;
     if (proc_pid_rusage(pid, RUSAGE_INFO_CURRENT, (void **)&rusage) != 0)
     {
-        return GET_RUSAGE_ERROR;
+        return false;
     }
     
     buffer->systemTime += rusage.ri_system_time;
@@ -29,20 +36,57 @@ static int ProcessTreeResourceUsage(pid_t pid, const rlim_t max_proc_count, Proc
     buffer->diskio_bytesWritten += rusage.ri_diskio_byteswritten;
     
     buffer->rss += rusage.ri_resident_size;
-    
+    return true;
+}
+
+static int ProcessTreeResourceUsage(pid_t pid, ProcessResourceUsage *buffer, bool includeChildren)
+{
+    if (!includeChildren)
+    {
+        return AddProcessResourceUsage(pid, buffer) ? KERN_SUCCESS : GET_RUSAGE_ERROR;
+    }
+
+    ProcessTreeResourceUsageProvider provider = processTreeResourceUsageProvider;
+    if (provider != NULL && provider(pid, buffer))
+    {
+        return KERN_SUCCESS;
+    }
+
+    // Walk the process tree breadth-first, using a single heap-allocated work list (bounded by the maximum number of processes)
+    struct rlimit rl;
+    int max_proc_count = 0;
+    size_t length = sizeof(max_proc_count);
+    if (getrlimit(RLIMIT_NPROC, &rl) != 0 || sysctlbyname("kern.maxproc", &max_proc_count, &length, NULL, 0) != 0 || max_proc_count <= 0)
+    {
+        return GET_RUSAGE_ERROR;
+    }
+
+    if (rl.rlim_cur < (rlim_t)max_proc_count)
+    {
+        max_proc_count = (int)rl.rlim_cur;
+    }
+
+    pid_t *pids = (pid_t *)malloc(max_proc_count * sizeof(pid_t));
+    if (pids == NULL)
+    {
+        return GET_RUSAGE_ERROR;
+    }
+
     bool success = true;
-    if (includeChildren)
+    int count = 1;
+    pids[0] = pid;
+    for (int i = 0; i < count; i++)
     {
-        pid_t child_pids[max_proc_count];
-        int child_count = proc_listchildpids(pid, child_pids, (int) max_proc_count);
-        
-        for (int i = 0; i < child_count; i++)
+        success &= AddProcessResourceUsage(pids[i], buffer);
+
+        int child_count = proc_listchildpids(pids[i], pids + count, (max_proc_count - count) * (int)sizeof(pid_t));
+        if (child_count > 0)
         {
-            int child_pid = child_pids[i];
-            success &= (ProcessTreeResourceUsage(child_pid, max_proc_count, buffer, includeChildren) == 0);
+            count += child_count;
         }
     }
-    
+
+    free(pids);
     return success ? KERN_SUCCESS : GET_RUSAGE_ERROR;
 }
 
@@ -54,12 +98,6 @@ int GetProcessResourceUsageSnapshot(pid_t pid, ProcessResourceUsage *buffer, lon
         return GET_RUSAGE_ERROR;
     }
 
-    struct rlimit rl;
-    if (getrlimit(RLIMIT_NPROC, &rl) != 0)
-    {
-        return GET_RUSAGE_ERROR;
-    }
-    
     mach_timebase_info_data_t timebase;
     kern_return_t ret = mach_timebase_info(&timebase);
     uint32_t numer = 1, denom = 1;
@@ -86,7 +124,7 @@ int GetProcessResourceUsageSnapshot(pid_t pid, ProcessResourceUsage *buffer, lon
     
     buffer->peak_rss = 0; // Not supported on macOS
     
-    return ProcessTreeResourceUsage(pid, rl.rlim_cur, buffer, includeChildProcesses);
+    return ProcessTreeResourceUsage(pid, buffer, includeChildProcesses);
 }
 
 static CoreDumpConfiguration *dump_config = NULL;
@@ -24,6 +24,19 @@ typedef struct {
 
 int GetProcessResourceUsageSnapshot(pid_t pid, ProcessResourceUsage *buffer, long bufferSize, bool includeChildProcesses);
 
+/*!
+ * Adds the resource usage of the process tree rooted at 'pid' to 'buffer' and returns true,
+ * or returns false if it doesn't keep track of that process tree.
+ */
+typedef bool (*ProcessTreeResourceUsageProvider)(pid_t pid, ProcessResourceUsage *buffer);
+
+/*!
+ * Sets (or, given NULL, clears) the provider that 'GetProcessResourceUsageSnapshot' asks first for the resource usage
+ * of a process tree.  The sandbox, which sees every process of a pip start and exit, registers one so that process trees
+ * don't have to be walked; process trees the provider doesn't know about are still walked.
+ */
+void SetProcessTreeResourceUsageProvider(ProcessTreeResourceUsageProvider provider);
+
 typedef struct {
     char *outputPath;
 } CoreDumpConfiguration;
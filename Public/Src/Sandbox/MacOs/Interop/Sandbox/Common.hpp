@@ -29,7 +29,11 @@ extern "C"
      */
     int NormalizePathAndReturnHash(const char *path, char *buffer, int bufferSize);
 
-    typedef void (__cdecl *AccessReportCallback)(AccessReport, int);
+    /*! Maximum number of reports handed to an 'AccessReportBatchCallback' at once */
+    const int kAccessReportBatchSize = 64;
+
+    /*! Receives 'count' reports (or none, along with an error code, when reports can't be delivered) */
+    typedef void (__cdecl *AccessReportBatchCallback)(const AccessReport *reports, int count, int error);
 
     bool SendPipStarted(const pid_t processId, pipid_t pipId, const char *const famBytes, int famBytesLength, ConnectionType type, void *connection);
     bool SendPipProcessTerminated(pipid_t pipId, pid_t processId, ConnectionType type, void *connection);
@@ -1,11 +1,13 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <cstring>
+
 #include "IOEvent.hpp"
 #include "BuildXLException.hpp"
 
 #if __APPLE__
-IOEvent::IOEvent(const es_message_t *msg)
+ESMessageView::ESMessageView(const es_message_t *msg)
 {
     pid_ = audit_token_to_pid(msg->process->audit_token);
     cpid_ = 0;
@@ -14,8 +16,9 @@ IOEvent::IOEvent(const es_message_t *msg)
     eventType_ = msg->event_type;
     actionType_ = msg->action_type;
     modified_ = false;
+    error_ = 0;
 
-    executable_ = PathExtractor(msg->process->executable).Path();
+    executable_ = ESPathView(msg->process->executable);
     auditToken_ = msg->process->audit_token;
 
     switch (eventType_)
@@ -33,7 +36,7 @@ IOEvent::IOEvent(const es_message_t *msg)
         case ES_EVENT_TYPE_NOTIFY_FORK:
         {
             es_event_fork_t fork = msg->event.fork;
-            executable_ = PathExtractor(fork.child->executable).Path();
+            executable_ = ESPathView(fork.child->executable);
             cpid_ = audit_token_to_pid(fork.child->audit_token);
             break;
         }
@@ -51,12 +54,12 @@ IOEvent::IOEvent(const es_message_t *msg)
 
             if (existingFile)
             {
-                src_path_ = PathExtractor(create.destination.existing_file).Path();
+                src_ = ESPathView(create.destination.existing_file);
                 mode_ = create.destination.existing_file->stat.st_mode;
             }
             else
             {
-                src_path_ = PathExtractor(create.destination.new_path.dir, create.destination.new_path.filename).Path();
+                src_ = ESPathView(create.destination.new_path.dir, create.destination.new_path.filename);
                 mode_ = create.destination.new_path.mode;
             }
 
@@ -65,8 +68,8 @@ IOEvent::IOEvent(const es_message_t *msg)
         case ES_EVENT_TYPE_AUTH_EXCHANGEDATA:
         case ES_EVENT_TYPE_NOTIFY_EXCHANGEDATA: {
             es_event_exchangedata_t exchange = msg->event.exchangedata;
-            src_path_ = PathExtractor(exchange.file1).Path();
-            dst_path_ = PathExtractor(exchange.file2).Path();
+            src_ = ESPathView(exchange.file1);
+            dst_ = ESPathView(exchange.file2);
             break;
         }
         case ES_EVENT_TYPE_NOTIFY_EXIT:
@@ -78,25 +81,25 @@ IOEvent::IOEvent(const es_message_t *msg)
         case ES_EVENT_TYPE_NOTIFY_LINK:
         {
             es_event_link_t link = msg->event.link;
-            src_path_ = PathExtractor(link.source).Path();
-            dst_path_ = PathExtractor(link.target_dir, link.target_filename).Path();
+            src_ = ESPathView(link.source);
+            dst_ = ESPathView(link.target_dir, link.target_filename);
             break;
         }
         case ES_EVENT_TYPE_AUTH_RENAME:
         case ES_EVENT_TYPE_NOTIFY_RENAME:
         {
             es_event_rename_t rename = msg->event.rename;
-            src_path_ = PathExtractor(rename.source).Path();
+            src_ = ESPathView(rename.source);
 
             bool existingFile = rename.destination_type == ES_DESTINATION_TYPE_EXISTING_FILE;
             if (existingFile)
             {
-                dst_path_ = PathExtractor(rename.destination.existing_file).Path();
+                dst_ = ESPathView(rename.destination.existing_file);
                 mode_ = rename.destination.existing_file->stat.st_mode;
             }
             else
             {
-                dst_path_ = PathExtractor(rename.destination.new_path.dir, rename.destination.new_path.filename).Path();
+                dst_ = ESPathView(rename.destination.new_path.dir, rename.destination.new_path.filename);
                 mode_ = 0;
             }
 
@@ -148,7 +151,7 @@ IOEvent::IOEvent(const es_message_t *msg)
         case ES_EVENT_TYPE_NOTIFY_LOOKUP:
         {
             es_event_lookup_t lookup = msg->event.lookup;
-            src_path_ = PathExtractor(lookup.source_dir, lookup.relative_target).Path();
+            src_ = ESPathView(lookup.source_dir, lookup.relative_target);
             mode_ = lookup.source_dir->stat.st_mode;
             break;
         }
@@ -177,8 +180,8 @@ IOEvent::IOEvent(const es_message_t *msg)
         case ES_EVENT_TYPE_NOTIFY_CLONE:
         {
             es_event_clone_t clone = msg->event.clone;
-            src_path_ = PathExtractor(clone.source).Path();
-            dst_path_ = PathExtractor(clone.target_dir, clone.target_name).Path();
+            src_ = ESPathView(clone.source);
+            dst_ = ESPathView(clone.target_dir, clone.target_name);
             break;
         }
         case ES_EVENT_TYPE_NOTIFY_FCNTL:
@@ -222,6 +225,14 @@ IOEvent::IOEvent(const es_message_t *msg)
         }
     }
 }
+
+IOEvent::IOEvent(const ESMessageView &view)
+    : pid_(view.GetPid()), cpid_(view.GetChildPid()), ppid_(view.GetParentPid()),
+      eventType_(view.GetEventType()), actionType_(view.GetActionType()), mode_(view.GetMode()), modified_(view.FSEntryModified()),
+      executable_(view.GetExecutable().ToString()), src_path_(view.GetSrcPath().ToString()), dst_path_(view.GetDstPath().ToString()),
+      error_(view.GetError()), oppid_(view.GetOriginalParentPid()), auditToken_(*view.GetProcessAuditToken())
+{
+}
 #endif
 
 // When inserting the detours library dynamically, interposed executables automatically search for the default Info.plist
@@ -250,85 +261,150 @@ const bool IOEvent::IsDirectorySpecialCharacterEvent() const
     return src_path_.compare(".") == 0 || src_path_.compare("..") == 0;
 }
 
-const size_t IOEvent::Size() const
+// Fixed-size part of the serialized event: pids, type, action, mode, modified, error, and the audit token
+static const size_t kSerializedFixedSize = 4 * sizeof(pid_t) + 4 * sizeof(uint32_t) + sizeof(uint8_t) + sizeof(audit_token_t);
+
+template <typename T>
+static inline void WriteValue(char *&cursor, const T &value)
+{
+    memcpy(cursor, &value, sizeof(T));
+    cursor += sizeof(T);
+}
+
+static inline void WriteString(char *&cursor, const std::string &value)
+{
+    WriteValue<uint32_t>(cursor, (uint32_t)value.length());
+    memcpy(cursor, value.data(), value.length());
+    cursor += value.length();
+}
+
+#if __APPLE__
+static inline void WriteString(char *&cursor, const ESPathView &value)
+{
+    WriteValue<uint32_t>(cursor, (uint32_t)value.Length());
+    value.CopyTo(cursor);
+    cursor += value.Length();
+}
+#endif
+
+// Writes the fields of an event in the order 'IOEvent::Deserialize' reads them, for both IOEvent and ESMessageView
+template <typename Event>
+static void WriteEvent(char *cursor, const Event &event)
 {
-    return
-        std::to_string(pid_).length() +
-        std::to_string(cpid_).length() +
-        std::to_string(ppid_).length() +
-        std::to_string(eventType_).length() +
-        std::to_string(actionType_).length() +
-        std::to_string(mode_).length() +
-        std::to_string(modified_).length() +
-        executable_.length() + (executable_.length() > 0 ? 1 : 0) +
-        src_path_.length() + (src_path_.length() > 0 ? 1 : 0) +
-        dst_path_.length() + (dst_path_.length() > 0 ? 1 : 0) +
-        std::to_string(error_).length() +
-        8; // 8 delimiters + 1 per string (if string is present)
+    WriteValue(cursor, event.GetPid());
+    WriteValue(cursor, event.GetChildPid());
+    WriteValue(cursor, event.GetParentPid());
+    WriteValue(cursor, event.GetOriginalParentPid());
+    WriteValue<uint32_t>(cursor, (uint32_t)event.GetEventType());
+    WriteValue<uint32_t>(cursor, (uint32_t)event.GetActionType());
+    WriteValue<uint32_t>(cursor, (uint32_t)event.GetMode());
+    WriteValue<uint8_t>(cursor, event.FSEntryModified() ? 1 : 0);
+    WriteValue<uint32_t>(cursor, event.GetError());
+    WriteValue(cursor, *event.GetProcessAuditToken());
+    WriteString(cursor, event.GetExecutable());
+    WriteString(cursor, event.GetSrcPath());
+    WriteString(cursor, event.GetDstPath());
 }
 
-omemorystream& operator<<(omemorystream &os, const IOEvent &event)
+template <typename T>
+static inline bool ReadValue(const char *&cursor, const char *end, T &value)
 {
-    os
-    << event.pid_                   << "|"
-    << event.cpid_                  << "|"
-    << event.ppid_                  << "|"
-    << event.eventType_             << "|"
-    << event.actionType_            << "|"
-    << event.mode_                  << "|"
-    << event.modified_              << "|"
-    << event.error_                 << "|"
-    ;
-
-    if (event.executable_.size() > 0)
+    if ((size_t)(end - cursor) < sizeof(T))
     {
-        os << event.executable_ << "|";
+        return false;
     }
 
-    if (event.src_path_.size() > 0)
+    memcpy(&value, cursor, sizeof(T));
+    cursor += sizeof(T);
+    return true;
+}
+
+static inline bool ReadString(const char *&cursor, const char *end, std::string &value)
+{
+    uint32_t length;
+    if (!ReadValue(cursor, end, length) || (size_t)(end - cursor) < length)
     {
-        os << event.src_path_ << "|";
+        return false;
     }
 
-    if (event.dst_path_.size() > 0)
+    value.assign(cursor, length);
+    cursor += length;
+    return true;
+}
+
+const size_t IOEvent::SerializedSize() const
+{
+    return kSerializedFixedSize + 3 * sizeof(uint32_t) + executable_.length() + src_path_.length() + dst_path_.length();
+}
+
+size_t IOEvent::Serialize(char *buffer, size_t size) const
+{
+    size_t serializedSize = SerializedSize();
+    if (size < serializedSize)
     {
-        os << event.dst_path_ << "|";
+        return 0;
     }
 
-    return os;
+    WriteEvent(buffer, *this);
+    return serializedSize;
 }
 
-std::istream& operator>>(std::istream &is, es_event_type_t &t)
+#if __APPLE__
+const size_t ESMessageView::SerializedSize() const
 {
-    unsigned int value = 0;
-    is >> value;
-    t = (es_event_type_t) value;
-    return is;
+    return kSerializedFixedSize + 3 * sizeof(uint32_t) + executable_.Length() + src_.Length() + dst_.Length();
 }
 
-std::istream& operator>>(std::istream &is, es_action_type_t &t)
+size_t ESMessageView::Serialize(char *buffer, size_t size) const
 {
-    unsigned int value = 0;
-    is >> value;
-    t = (es_action_type_t) value;
-    return is;
+    size_t serializedSize = SerializedSize();
+    if (size < serializedSize)
+    {
+        return 0;
+    }
+
+    WriteEvent(buffer, *this);
+    return serializedSize;
 }
+#endif
 
-imemorystream& operator>>(imemorystream &is, IOEvent &event)
+bool IOEvent::PeekPid(const char *buffer, size_t size, pid_t &pid)
 {
-    is
-    >> event.pid_
-    >> event.cpid_
-    >> event.ppid_
-    >> event.eventType_
-    >> event.actionType_
-    >> event.mode_
-    >> event.modified_
-    >> event.error_
-    >> event.executable_
-    >> event.src_path_
-    >> event.dst_path_
-    ;
-
-    return is;
+    return ReadValue(buffer, buffer + size, pid);
+}
+
+bool IOEvent::Deserialize(const char *buffer, size_t size, IOEvent &event)
+{
+    const char *cursor = buffer;
+    const char *end = buffer + size;
+
+    uint32_t type, action, mode, error;
+    uint8_t modified;
+
+    bool success =
+        ReadValue(cursor, end, event.pid_) &&
+        ReadValue(cursor, end, event.cpid_) &&
+        ReadValue(cursor, end, event.ppid_) &&
+        ReadValue(cursor, end, event.oppid_) &&
+        ReadValue(cursor, end, type) &&
+        ReadValue(cursor, end, action) &&
+        ReadValue(cursor, end, mode) &&
+        ReadValue(cursor, end, modified) &&
+        ReadValue(cursor, end, error) &&
+        ReadValue(cursor, end, event.auditToken_) &&
+        ReadString(cursor, end, event.executable_) &&
+        ReadString(cursor, end, event.src_path_) &&
+        ReadString(cursor, end, event.dst_path_);
+
+    if (!success || cursor != end)
+    {
+        return false;
+    }
+
+    event.eventType_  = (es_event_type_t)type;
+    event.actionType_ = (es_action_type_t)action;
+    event.mode_       = (mode_t)mode;
+    event.modified_   = modified != 0;
+    event.error_      = error;
+    return true;
 }
@@ -6,8 +6,8 @@
 
 #include "stdafx.h"
 
-#include <iostream>
-#include <istream>
+#include <cstring>
+#include <string>
 
 #include <sys/types.h>
 #include <unistd.h>
@@ -16,8 +16,6 @@
 #include <bsm/libbsm.h>
 #endif
 
-#include "MemoryStreams.hpp"
-
 #define SRC_PATH 0
 #define DST_PATH 1
 
@@ -25,12 +23,9 @@
 #include "PathExtractor.hpp"
 #endif
 
-// See: https://opensource.apple.com/source/xnu/xnu-1699.24.23/bsd/sys/proc_internal.h
-#define PID_MAX 99999
-
 #define ES_EVENT_CONSTRUCTOR(type, dir, file, mode, do_break) \
     es_event_##type##_t event = msg->event.type; \
-    src_path_ = PathExtractor(event.file).Path(); \
+    src_ = ESPathView(event.file); \
     if (mode) {mode_ = event.file->stat.st_mode; } \
     if (do_break) break;
 
@@ -45,17 +40,162 @@ enum class ProcessCallbackResult
 {
     Done = 0,
     MuteSource,
-    Auth
+    Auth,
+    AuthUnmutePaths,
+
+    /*!
+     * Like 'Auth', but the answer to this read-only AUTH_OPEN may be cached by EndpointSecurity: the path is untracked for every
+     * running pip (see Sandbox::IsUntrackedForAllPips), so repeated opens of it would never produce a report.
+     */
+    AuthCache
+};
+
+/*!
+ * Executables of system daemons that no pip runs: the ES clients mute them by path when they are set up, so their events never
+ * leave the kernel.  A tracked process that executes one of them anyway gets its AUTH_EXEC answered with 'AuthUnmutePaths', which
+ * makes the ES clients drop these mutes before the new image runs.
+ */
+static const char *const kMutedExecutablePathPrefixes[] =
+{
+    "/System/Library/CoreServices/",
+    "/System/Library/PrivateFrameworks/",
 };
 
+static const char *const kMutedExecutablePaths[] =
+{
+    "/sbin/launchd",
+    "/usr/libexec/logd",
+    "/usr/libexec/opendirectoryd",
+    "/usr/libexec/syspolicyd",
+    "/usr/libexec/trustd",
+    "/usr/sbin/cfprefsd",
+    "/usr/sbin/distnoted",
+    "/usr/sbin/mDNSResponder",
+    "/usr/sbin/notifyd",
+    "/usr/sbin/syslogd",
+};
+
+inline bool IsMutedExecutablePath(const char *path)
+{
+    for (const char *prefix : kMutedExecutablePathPrefixes)
+    {
+        if (strncmp(path, prefix, strlen(prefix)) == 0) return true;
+    }
+
+    for (const char *muted : kMutedExecutablePaths)
+    {
+        if (strcmp(path, muted) == 0) return true;
+    }
+
+    return false;
+}
+
+// Key of the serialized IOEvent (see IOEvent::Serialize) in the XPC messages that carry it, as an XPC data object
 #define IOEventKey "IOEvent"
-#define IOEventLengthKey "IOEvent::Length"
 
-struct IOEvent final
+// Key of a batch of serialized IOEvents in the XPC messages that carry several, as an XPC data object: each event is prefixed by its 32-bit length
+#define IOEventBatchKey "IOEventBatch"
+
+#if __APPLE__
+/*!
+ * A path in an es_message_t, referenced rather than copied: a path token, optionally followed by a file name (joined with a separator,
+ * unless the path is the root directory, like PathExtractor does).  Only valid as long as the message is retained.
+ */
+struct ESPathView final
+{
+private:
+
+    const char *path_ = nullptr;
+    size_t pathLength_ = 0;
+    const char *name_ = nullptr;
+    size_t nameLength_ = 0;
+    bool hasName_ = false;
+
+    inline bool HasSeparator() const { return hasName_ && !(pathLength_ == 1 && path_[0] == '/'); }
+
+public:
+
+    ESPathView() {}
+    ESPathView(es_string_token_t token) : path_(token.data), pathLength_(token.length) {}
+    ESPathView(const es_file_t *file) : ESPathView(file->path) {}
+    ESPathView(const es_file_t *dir, es_string_token_t name) : ESPathView(dir->path)
+    {
+        name_ = name.data;
+        nameLength_ = name.length;
+        hasName_ = true;
+    }
+
+    inline size_t Length() const { return pathLength_ + (HasSeparator() ? 1 : 0) + nameLength_; }
+
+    /*! Writes the 'Length()' characters of this path to 'buffer' (without a terminating null character) */
+    inline void CopyTo(char *buffer) const
+    {
+        if (pathLength_ > 0) memcpy(buffer, path_, pathLength_);
+        buffer += pathLength_;
+        if (HasSeparator()) *buffer++ = '/';
+        if (nameLength_ > 0) memcpy(buffer, name_, nameLength_);
+    }
+
+    inline std::string ToString() const
+    {
+        std::string result(Length(), '\0');
+        CopyTo(&result[0]);
+        return result;
+    }
+};
+
+/*!
+ * The fields of an IOEvent, read from a retained es_message_t without copying any of its paths.  The ES clients serialize events
+ * straight from it, so handing a message over to BuildXL doesn't allocate anything but the XPC message.
+ */
+struct ESMessageView final
 {
-    friend omemorystream& operator<<(omemorystream &os, const IOEvent &event);
-    friend imemorystream& operator>>(imemorystream &is, IOEvent &event);
+private:
+
+    pid_t pid_;
+    pid_t cpid_;
+    pid_t ppid_;
+    pid_t oppid_;
+    es_event_type_t eventType_;
+    es_action_type_t actionType_;
+    mode_t mode_ = 0;
+    bool modified_ = false;
+    uint error_;
+    audit_token_t auditToken_;
+
+    ESPathView executable_;
+    ESPathView src_;
+    ESPathView dst_;
+
+public:
+
+    ESMessageView(const es_message_t *msg);
+
+    inline const pid_t GetPid() const { return pid_; }
+    inline const pid_t GetParentPid() const { return ppid_; }
+    inline const pid_t GetChildPid() const { return cpid_; }
+    inline const pid_t GetOriginalParentPid() const { return oppid_; }
+    inline const es_event_type_t GetEventType() const { return eventType_; }
+    inline const es_action_type_t GetActionType() const { return actionType_; }
+    inline const mode_t GetMode() const { return mode_; }
+    inline const bool FSEntryModified() const { return modified_; }
+    inline const uint GetError() const { return error_; }
+    inline const audit_token_t* GetProcessAuditToken() const { return &auditToken_; }
+
+    inline const ESPathView& GetExecutable() const { return executable_; }
+    inline const ESPathView& GetSrcPath() const { return src_; }
+    inline const ESPathView& GetDstPath() const { return dst_; }
 
+    /*! Same as IOEvent::SerializedSize */
+    const size_t SerializedSize() const;
+
+    /*! Same as IOEvent::Serialize, IOEvent::Deserialize reads it back */
+    size_t Serialize(char *buffer, size_t size) const;
+};
+#endif
+
+struct IOEvent final
+{
 private:
 
     pid_t pid_;
@@ -66,6 +206,10 @@ private:
     mode_t mode_ = 0;
     bool modified_ = false;
 
+    // Whether 'mode_' was read from the file system for the source path (so 0 means it doesn't exist) rather than taken from the
+    // operation.  Not serialized: only the sandbox that queried the path can vouch for it.
+    bool modeObserved_ = false;
+
     std::string executable_;
     std::string src_path_;
     std::string dst_path_;
@@ -82,7 +226,8 @@ public:
     IOEvent() {}
 
 #if __APPLE__
-    IOEvent(const es_message_t *msg);
+    IOEvent(const es_message_t *msg) : IOEvent(ESMessageView(msg)) {}
+    IOEvent(const ESMessageView &view);
 #endif
 
     IOEvent(pid_t pid,
@@ -118,6 +263,7 @@ public:
     inline const pid_t GetChildPid() const { return cpid_; }
     inline const pid_t GetOriginalParentPid() const { return oppid_; }
     inline const char* GetExecutablePath() const { return executable_.c_str(); }
+    inline const std::string& GetExecutable() const { return executable_; }
 
     inline const audit_token_t* GetProcessAuditToken() const { return &auditToken_; }
     inline const es_event_type_t GetEventType() const { return eventType_; }
@@ -145,23 +291,37 @@ public:
     inline const bool FSEntryModified() const { return modified_; }
     inline const bool EventPathExists() const { return mode_ != 0; }
 
+    /*! Lets checks reuse the mode of the source path when the sandbox got it from the file system, see 'SetModeObserved' */
+    inline const mode_t* GetObservedMode() const { return modeObserved_ ? &mode_ : nullptr; }
+    inline void SetModeObserved() { modeObserved_ = true; }
+
     const bool IsPlistEvent() const;
     const bool IsDirectorySpecialCharacterEvent() const;
 
-    const size_t Size() const;
+    /*!
+     * Binary serialization, for handing events to another process (e.g., over XPC): the fixed-size fields in native byte order,
+     * followed by the executable, source and destination paths, each prefixed by its 32-bit length.
+     */
 
-    static inline const size_t max_size()
-    {
-        // IMPORTANT: Keep this in sync with the de- and serialization logic in the implementation file (IOEvent.cpp), especially Size()!
-        return (3 * std::to_string(PID_MAX).length()) +   // Pids
-               (3 * std::to_string(USHRT_MAX).length()) + // Type + Action + Mode
-               std::to_string(true).length() +            // Modified
-               std::to_string(UINT_MAX).length() +        // error
-               (3 * PATH_MAX) +                           // Executable, src and dst paths
-               10;                                        // Delimiters
-    }
+    /*! Number of bytes 'Serialize' writes for this event */
+    const size_t SerializedSize() const;
+
+    /*! Writes this event into 'buffer' and returns the number of bytes written, or 0 if 'size' is less than 'SerializedSize()' */
+    size_t Serialize(char *buffer, size_t size) const;
+
+    /*! Reads back an event written by 'Serialize'.  Returns false if 'buffer' doesn't hold exactly one serialized event. */
+    static bool Deserialize(const char *buffer, size_t size, IOEvent &event);
+
+    /*! Reads only the pid of an event written by 'Serialize', so events can be triaged before paying for their paths */
+    static bool PeekPid(const char *buffer, size_t size, pid_t &pid);
 };
 
-typedef ProcessCallbackResult (*process_callback)(void *sandbox, const IOEvent event, pid_t host, IOEventBacking backing);
+typedef ProcessCallbackResult (*process_callback)(void *sandbox, const IOEvent &event, pid_t host, IOEventBacking backing);
+
+/*! Whether the process 'pid' has been muted, i.e., its events are answered with 'MuteSource' without looking at them */
+typedef bool (*muted_pid_callback)(void *sandbox, pid_t pid);
+
+/*! Returns the serial queue an event must be processed on, events of the same process tree always go to the same queue */
+typedef dispatch_queue_t (*event_queue_callback)(void *sandbox, const IOEvent &event);
 
 #endif /* IOEvent_hpp */
@@ -0,0 +1,156 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef IOEventRing_hpp
+#define IOEventRing_hpp
+
+#include <atomic>
+#include <new>
+#include <stdint.h>
+
+#include "IOEvent.hpp"
+
+/*!
+ * Bounded multi-producer, single-consumer queue of serialized IOEvents (see IOEvent::Serialize), laid out in a memory region
+ * that BuildXL shares with the interposed processes.
+ *
+ * Producers claim a slot by bumping 'enqueuePos_' and publish it by setting the sequence of the slot to one past its position,
+ * the consumer reads published slots in order and hands them back by moving their sequence one lap ahead.  A producer that
+ * finds the ring full, or an event that doesn't fit in a slot, falls back to XPC.  XPC is also used for wakeups: the first
+ * producer to publish after the consumer started draining tells it to drain again.
+ *
+ * A producer killed between claiming and publishing a slot stalls the consumer at that slot: producers then see a full ring
+ * and everything goes through XPC.
+ */
+struct IOEventRing final
+{
+public:
+
+    // Must be a power of two
+    static const uint64_t kSlotCount = 1024;
+    static const size_t kSlotPayloadSize = 4096 - 2 * sizeof(uint64_t);
+
+private:
+
+    struct Slot
+    {
+        std::atomic<uint64_t> sequence;
+        uint64_t length;
+        char payload[kSlotPayloadSize];
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+                  "The ring is shared between processes, its atomics can't rely on locks");
+
+    alignas(64) std::atomic<uint64_t> enqueuePos_;
+    alignas(64) uint64_t dequeuePos_;   // Only touched by the consumer
+    alignas(64) std::atomic<uint32_t> wakeupPending_;
+    alignas(64) Slot slots_[kSlotCount];
+
+    IOEventRing() : enqueuePos_(0), dequeuePos_(0), wakeupPending_(0)
+    {
+        for (uint64_t i = 0; i < kSlotCount; i++)
+        {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+            slots_[i].length = 0;
+        }
+    }
+
+public:
+
+    IOEventRing(const IOEventRing&) = delete;
+    IOEventRing& operator=(const IOEventRing&) = delete;
+
+    /*! Number of bytes the shared region must hold */
+    static constexpr size_t RegionSize() { return sizeof(IOEventRing); }
+
+    /*! Lays out an empty ring at the start of 'region', only the process that owns the region calls this */
+    static IOEventRing* Create(void *region)
+    {
+        return new (region) IOEventRing();
+    }
+
+    /*!
+     * Producer side: publishes 'event' into the ring.
+     *
+     * @param needsWakeup Set when the consumer has to be told to drain the ring
+     * @result False if the ring is full or the event doesn't fit in a slot
+     */
+    bool TryPush(const IOEvent &event, bool &needsWakeup)
+    {
+        needsWakeup = false;
+        if (event.SerializedSize() > kSlotPayloadSize)
+        {
+            return false;
+        }
+
+        Slot *slot;
+        uint64_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            slot = &slots_[pos & (kSlotCount - 1)];
+            int64_t diff = (int64_t)slot->sequence.load(std::memory_order_acquire) - (int64_t)pos;
+            if (diff == 0)
+            {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->length = event.Serialize(slot->payload, kSlotPayloadSize);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+
+        needsWakeup = wakeupPending_.exchange(1, std::memory_order_seq_cst) == 0;
+        return true;
+    }
+
+    /*!
+     * Consumer side: calls 'callback' with every published event, in order, and returns the number of slots drained.
+     * Slots that don't hold a valid event are skipped and counted in 'malformed'.
+     */
+    template <typename Callback>
+    size_t Drain(Callback callback, size_t &malformed)
+    {
+        // Producers publishing from here on send a new wakeup, the fence orders the reset before reading the slots
+        wakeupPending_.store(0, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        size_t count = 0;
+        malformed = 0;
+        for (;;)
+        {
+            Slot &slot = slots_[dequeuePos_ & (kSlotCount - 1)];
+            if (slot.sequence.load(std::memory_order_acquire) != dequeuePos_ + 1)
+            {
+                return count;
+            }
+
+            IOEvent event;
+            bool valid = slot.length <= kSlotPayloadSize && IOEvent::Deserialize(slot.payload, slot.length, event);
+            slot.sequence.store(dequeuePos_ + kSlotCount, std::memory_order_release);
+            dequeuePos_++;
+            count++;
+
+            if (valid)
+            {
+                callback(event);
+            }
+            else
+            {
+                malformed++;
+            }
+        }
+    }
+};
+
+#endif /* IOEventRing_hpp */
@@ -4,45 +4,53 @@
 #ifndef PathCacheEntry_h
 #define PathCacheEntry_h
 
+#include <string>
+
+#if __APPLE__
 #include <fcntl.h>
 #include <libproc.h>
+#endif
 
-typedef struct _buf {
-    char data[PATH_MAX] = { '\0' };
-    size_t length;
-} Buffer;
-
+/*!
+ * An immutable path, stored with its actual length.  Entries are reference counted through std::shared_ptr and are meant to be
+ * shared rather than copied: path tries intern them (see Sandbox::InternPath) and tracked processes point at the entry of their
+ * executable, which their children share after a fork.
+ */
 struct PathCacheEntry final
 {
 private:
-    Buffer buffer_;
-public:
-    PathCacheEntry(const char *path, size_t length)
-    {
-        memcpy(buffer_.data, path, length);
-        buffer_.length = length;
-    }
 
-    PathCacheEntry(int identifier, bool isPid = false)
+    const std::string path_;
+
+#if __APPLE__
+    /*! Path of an open file descriptor, or executable of a process; empty if the system doesn't know it */
+    static std::string QueryPath(int identifier, bool isPid)
     {
         assert(identifier > 0);
 
-        if (!isPid)
-        {
-            assert(fcntl(identifier, F_GETPATH, buffer_.data) != -1);
-        }
-        else
-        {
-            assert(proc_pidpath(identifier, (void *)buffer_.data, PATH_MAX) > 0);
-        }
+        char buffer[PATH_MAX] = { '\0' };
+        bool found = isPid
+            ? proc_pidpath(identifier, (void *)buffer, PATH_MAX) > 0
+            : fcntl(identifier, F_GETPATH, buffer) != -1;
 
-        buffer_.length = strlen(buffer_.data);
+        return found ? std::string(buffer) : std::string();
     }
+#endif
+
+public:
+
+    PathCacheEntry(const char *path, size_t length) : path_(path, length) { }
+
+    PathCacheEntry(const char *path) : path_(path) { }
+
+#if __APPLE__
+    PathCacheEntry(int identifier, bool isPid = false) : path_(QueryPath(identifier, isPid)) { }
+#endif
 
     ~PathCacheEntry() = default;
 
-    inline const char* GetPath() const { return buffer_.data; }
-    inline const size_t GetPathLength() const { return buffer_.length; }
+    inline const char* GetPath() const { return path_.c_str(); }
+    inline const size_t GetPathLength() const { return path_.length(); }
 };
 
 #endif /* PathCacheEntry_h */
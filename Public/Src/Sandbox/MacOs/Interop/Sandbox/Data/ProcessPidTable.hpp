@@ -0,0 +1,192 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef ProcessPidTable_hpp
+#define ProcessPidTable_hpp
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include <sys/types.h>
+
+/*! The pid sets kept in a 'ProcessPidTable' */
+enum class PidSet
+{
+    /*! Descendants of the build host, mapped to their parent */
+    Allowlisted = 0,
+
+    /*! Children for which a fork event was forced before their parent reported it, mapped to that parent */
+    ForceForked,
+
+    Count
+};
+
+/*!
+ * Open-addressing hash table from pids to their parent pid in each of the 'PidSet's, plus a negative cache of pids that are
+ * known not to belong to the build.  It is consulted for every ES and interposing event, so lookups are lock-free and an event
+ * is usually filtered with a single probe; updates (forks and exits) are serialized by a mutex.
+ *
+ * A slot is claimed by a pid for the lifetime of the table and only its values change afterwards, which keeps readers from
+ * ever seeing a slot change hands.  On macOS pids never exceed PID_MAX, so the default capacity can't fill up.
+ */
+class ProcessPidTable final
+{
+
+private:
+
+    static const pid_t kNoPid  = -1;
+    static const pid_t kNoSlot = 0;
+
+    struct Slot
+    {
+        std::atomic<pid_t> pid { kNoSlot };
+        std::atomic<pid_t> parents[(int)PidSet::Count] { { kNoPid }, { kNoPid } };
+        std::atomic<bool> untracked { false };
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t mask_;
+    size_t numSlotsInUse_ = 0;
+    std::atomic<int> counts_[(int)PidSet::Count] { { 0 }, { 0 } };
+    std::mutex updateLock_;
+
+    inline size_t Hash(pid_t pid) const { return ((uint32_t)pid * 2654435761u) & mask_; }
+
+    /*! Returns the slot claimed by 'pid', or nullptr if there is none */
+    const Slot* Find(pid_t pid) const
+    {
+        for (size_t i = Hash(pid); ; i = (i + 1) & mask_)
+        {
+            pid_t slotPid = slots_[i].pid.load(std::memory_order_acquire);
+            if (slotPid == pid)    return &slots_[i];
+            if (slotPid == kNoSlot) return nullptr;
+        }
+    }
+
+    /*! Must be called holding 'updateLock_'.  Returns nullptr only when the table is full. */
+    Slot* FindOrClaim(pid_t pid)
+    {
+        for (size_t i = Hash(pid); ; i = (i + 1) & mask_)
+        {
+            pid_t slotPid = slots_[i].pid.load(std::memory_order_relaxed);
+            if (slotPid == pid)
+            {
+                return &slots_[i];
+            }
+
+            if (slotPid == kNoSlot)
+            {
+                // Always leave an empty slot so that probing for a missing pid terminates
+                if (numSlotsInUse_ + 1 > mask_)
+                {
+                    return nullptr;
+                }
+
+                numSlotsInUse_++;
+                slots_[i].pid.store(pid, std::memory_order_release);
+                return &slots_[i];
+            }
+        }
+    }
+
+public:
+
+    /*! 'capacityLog2' is the base 2 logarithm of the number of slots */
+    ProcessPidTable(int capacityLog2 = 17) : slots_(new Slot[(size_t)1 << capacityLog2]), mask_(((size_t)1 << capacityLog2) - 1) { }
+
+    ProcessPidTable(const ProcessPidTable&) = delete;
+    ProcessPidTable& operator = (const ProcessPidTable&) = delete;
+
+    /*! Number of pids in 'set' */
+    inline int Count(PidSet set) const { return counts_[(int)set].load(std::memory_order_relaxed); }
+
+    inline bool Contains(PidSet set, pid_t pid) const
+    {
+        pid_t ppid;
+        return TryGet(set, pid, &ppid);
+    }
+
+    bool TryGet(PidSet set, pid_t pid, pid_t *ppid) const
+    {
+        const Slot *slot = pid != kNoSlot ? Find(pid) : nullptr;
+        if (slot == nullptr)
+        {
+            return false;
+        }
+
+        pid_t parent = slot->parents[(int)set].load(std::memory_order_acquire);
+        if (parent == kNoPid)
+        {
+            return false;
+        }
+
+        *ppid = parent;
+        return true;
+    }
+
+    /*! Adds 'pid' with parent 'ppid' to 'set', which also drops 'pid' from the negative cache.  Returns false if 'pid' was already in 'set'. */
+    bool Add(PidSet set, pid_t pid, pid_t ppid)
+    {
+        if (pid == kNoSlot || ppid == kNoPid)
+        {
+            return false;
+        }
+
+        const std::lock_guard<std::mutex> lock(updateLock_);
+        Slot *slot = FindOrClaim(pid);
+        if (slot == nullptr || slot->parents[(int)set].load(std::memory_order_relaxed) != kNoPid)
+        {
+            return false;
+        }
+
+        slot->parents[(int)set].store(ppid, std::memory_order_release);
+        slot->untracked.store(false, std::memory_order_release);
+        counts_[(int)set]++;
+        return true;
+    }
+
+    /*! Returns false if 'pid' was not in 'set' */
+    bool Remove(PidSet set, pid_t pid)
+    {
+        if (pid == kNoSlot)
+        {
+            return false;
+        }
+
+        const std::lock_guard<std::mutex> lock(updateLock_);
+        Slot *slot = const_cast<Slot *>(Find(pid));
+        if (slot == nullptr || slot->parents[(int)set].load(std::memory_order_relaxed) == kNoPid)
+        {
+            return false;
+        }
+
+        slot->parents[(int)set].store(kNoPid, std::memory_order_release);
+        counts_[(int)set]--;
+        return true;
+    }
+
+    /*! Remembers that the events of 'pid' are of no interest until it is added to a set again */
+    void MarkUntracked(pid_t pid)
+    {
+        if (pid == kNoSlot)
+        {
+            return;
+        }
+
+        const std::lock_guard<std::mutex> lock(updateLock_);
+        Slot *slot = FindOrClaim(pid);
+        if (slot != nullptr && slot->parents[(int)PidSet::Allowlisted].load(std::memory_order_relaxed) == kNoPid)
+        {
+            slot->untracked.store(true, std::memory_order_release);
+        }
+    }
+
+    inline bool IsMarkedUntracked(pid_t pid) const
+    {
+        const Slot *slot = pid != kNoSlot ? Find(pid) : nullptr;
+        return slot != nullptr && slot->untracked.load(std::memory_order_acquire);
+    }
+};
+
+#endif /* ProcessPidTable_hpp */
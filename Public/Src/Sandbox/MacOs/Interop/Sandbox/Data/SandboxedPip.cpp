@@ -1,23 +1,33 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#if __APPLE__
+#include <libproc.h>
+#endif
+
 #include "SandboxedPip.hpp"
 #include "BuildXLException.hpp"
 
 #pragma mark SandboxedPip Implementation
 
-SandboxedPip::SandboxedPip(pid_t pid, const char *payload, size_t length)
+SandboxedPip::SandboxedPip(pid_t pid, const char *payload, size_t length, bool copyPayload)
 {
     log_debug("Initializing with pid (%d) from: %{public}s", pid, __FUNCTION__);
 
-    payload_ = (char *) malloc(length);
-    if (payload == NULL)
+    payload_ = nullptr;
+    if (copyPayload)
     {
-        throw BuildXLException("Could not allocate memory for FAM payload storage!");
+        payload_ = (char *) malloc(length);
+        if (payload_ == NULL)
+        {
+            throw BuildXLException("Could not allocate memory for FAM payload storage!");
+        }
+
+        memcpy(payload_, payload, length);
+        payload = payload_;
     }
 
-    memcpy(payload_, payload, length);
-    fam_.init((BYTE*)payload_, length);
+    fam_.init((BYTE*)payload, length);
 
     if (fam_.HasErrors())
     {
@@ -27,6 +37,43 @@ SandboxedPip::SandboxedPip(pid_t pid, const char *payload, size_t length)
 
     processId_ = pid;
     processTreeCount_ = 1;
+    exitedUsage_ = {0};
+    liveProcesses_.insert(pid);
+
+    reportBatchFlushScheduled_ = false;
+
+    reportsProbes_ = false;
+    reportsEnumerations_ = false;
+    if (!CheckDisableDetours(GetFamFlags()))
+    {
+        if (CheckReportAllFileAccesses(GetFamFlags()))
+        {
+            reportsProbes_ = true;
+            reportsEnumerations_ = true;
+        }
+        else
+        {
+            FindReportedAccessKinds(GetManifestRecord());
+        }
+    }
+}
+
+void SandboxedPip::FindReportedAccessKinds(PCManifestRecord record)
+{
+    for (FileAccessPolicy policy : { record->GetNodePolicy(), record->GetConePolicy() })
+    {
+        reportsProbes_ |= (policy & FileAccessPolicy_ReportAccess) != 0 || (policy & FileAccessPolicy_AllowRead) == 0;
+        reportsEnumerations_ |= (policy & FileAccessPolicy_ReportDirectoryEnumerationAccess) != 0;
+    }
+
+    for (ManifestRecord::BucketCountType i = 0; i < record->BucketCount && !(reportsProbes_ && reportsEnumerations_); i++)
+    {
+        PCManifestRecord child = record->GetChildRecord(i);
+        if (child != nullptr)
+        {
+            FindReportedAccessKinds(child);
+        }
+    }
 }
 
 SandboxedPip::~SandboxedPip()
@@ -34,3 +81,102 @@ SandboxedPip::~SandboxedPip()
     log_debug("Releasing pip object (%#llX) - freed from %{public}s", GetPipId(),  __FUNCTION__);
     free(payload_);
 }
+
+#pragma mark Resource Usage Accounting
+
+static bool AddCurrentResourceUsage(pid_t pid, PipResourceUsage &usage, bool includeResidentSize)
+{
+#if __APPLE__
+    rusage_info_current rusage;
+    if (proc_pid_rusage(pid, RUSAGE_INFO_CURRENT, (void **)&rusage) != 0)
+    {
+        return false;
+    }
+
+    usage.systemTime         += rusage.ri_system_time;
+    usage.userTime           += rusage.ri_user_time;
+    usage.diskioBytesRead    += rusage.ri_diskio_bytesread;
+    usage.diskioBytesWritten += rusage.ri_diskio_byteswritten;
+    if (includeResidentSize)
+    {
+        usage.residentSize   += rusage.ri_resident_size;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void SandboxedPip::AddProcess(pid_t pid)
+{
+    std::lock_guard<std::mutex> lock(resourceUsageLock_);
+    liveProcesses_.insert(pid);
+}
+
+void SandboxedPip::RemoveProcess(pid_t pid)
+{
+    std::lock_guard<std::mutex> lock(resourceUsageLock_);
+    if (liveProcesses_.erase(pid) > 0)
+    {
+        // the process hasn't been reaped yet when its exit is handled, so its usage can still be sampled
+        AddCurrentResourceUsage(pid, exitedUsage_, /*includeResidentSize*/ false);
+    }
+}
+
+PipResourceUsage SandboxedPip::GetResourceUsage()
+{
+    std::lock_guard<std::mutex> lock(resourceUsageLock_);
+
+    PipResourceUsage usage = exitedUsage_;
+    for (pid_t pid : liveProcesses_)
+    {
+        AddCurrentResourceUsage(pid, usage, /*includeResidentSize*/ true);
+    }
+
+    return usage;
+}
+
+#pragma mark Access Report Batching
+
+bool SandboxedPip::BatchAccessReport(const AccessReport &report, bool flush, AccessReportBatchCallback callback)
+{
+    std::lock_guard<std::mutex> lock(reportBatchLock_);
+
+    if (reportBatch_.capacity() == 0)
+    {
+        reportBatch_.reserve(kAccessReportBatchSize);
+    }
+
+    reportBatch_.push_back(report);
+    if (flush || reportBatch_.size() >= kAccessReportBatchSize)
+    {
+        FlushAccessReportsLocked(callback);
+        return false;
+    }
+
+    if (reportBatchFlushScheduled_)
+    {
+        return false;
+    }
+
+    reportBatchFlushScheduled_ = true;
+    return true;
+}
+
+void SandboxedPip::FlushAccessReports(AccessReportBatchCallback callback)
+{
+    std::lock_guard<std::mutex> lock(reportBatchLock_);
+    reportBatchFlushScheduled_ = false;
+    FlushAccessReportsLocked(callback);
+}
+
+void SandboxedPip::FlushAccessReportsLocked(AccessReportBatchCallback callback)
+{
+    // The lock is held while calling back, so the reports of a pip reach the callback in order
+    if (!reportBatch_.empty())
+    {
+        callback(reportBatch_.data(), (int)reportBatch_.size(), REPORT_QUEUE_SUCCESS);
+        reportBatch_.clear();
+    }
+}
@@ -4,9 +4,23 @@
 #ifndef SandboxedPip_hpp
 #define SandboxedPip_hpp
 
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
 #include "BuildXLSandboxShared.hpp"
+#include "Common.hpp"
 #include "FileAccessManifestParser.hpp"
 
+/*! Resource usage summed over (the current and past processes of) a pip's process tree, in 'rusage_info' units */
+typedef struct {
+    uint64_t systemTime;
+    uint64_t userTime;
+    uint64_t diskioBytesRead;
+    uint64_t diskioBytesWritten;
+    uint64_t residentSize;
+} PipResourceUsage;
+
 /*!
  * Represents the root of the process tree being tracked.
  *
@@ -26,7 +40,7 @@ private:
     /*! Process id of the root process of this pip. */
     pid_t processId_;
 
-    /*! File access manifest payload bytes */
+    /*! File access manifest payload bytes; null when the manifest is parsed in place (see constructor) */
     char *payload_;
 
     /*! File access manifest (contains pointers into the 'payload_' byte array */
@@ -35,10 +49,41 @@ private:
     /*! Number of processses in this pip's process tree */
     std::atomic<int> processTreeCount_;
 
+    /*! Guards 'liveProcesses_' and 'exitedUsage_' */
+    std::mutex resourceUsageLock_;
+
+    /*! Processes of this pip's process tree that haven't exited yet */
+    std::unordered_set<pid_t> liveProcesses_;
+
+    /*! Resource usage of the processes of this pip's process tree that have exited ('residentSize' is not used) */
+    PipResourceUsage exitedUsage_;
+
+    /*! Guards 'reportBatch_' and 'reportBatchFlushScheduled_' */
+    std::mutex reportBatchLock_;
+
+    /*! Reports that haven't been handed to the access report callback yet; cleared on every flush, but keeps its capacity */
+    std::vector<AccessReport> reportBatch_;
+
+    /*! Whether a call to 'FlushAccessReports' has been scheduled and not run yet */
+    bool reportBatchFlushScheduled_;
+
+    /*! Whether accesses of these kinds can produce a report for this pip, see 'ReportsProbes' */
+    bool reportsProbes_;
+    bool reportsEnumerations_;
+
+    void FindReportedAccessKinds(PCManifestRecord record);
+
+    void FlushAccessReportsLocked(AccessReportBatchCallback callback);
+
 public:
 
     SandboxedPip() = delete;
-    SandboxedPip(pid_t pid, const char *payload, size_t length);
+    /*!
+     * Parses the file access manifest in 'payload' (and throws a BuildXLException if it is invalid).
+     * Unless 'copyPayload' is false, the pip works on its own copy; otherwise the manifest is parsed in place and
+     * the caller must keep 'payload' alive and unchanged for as long as the pip exists (e.g., a read-only mapping).
+     */
+    SandboxedPip(pid_t pid, const char *payload, size_t length, bool copyPayload = true);
     ~SandboxedPip();
 
     /*! Process id of the root process of this pip. */
@@ -56,6 +101,9 @@ public:
     /*! File access manifest extra flags */
     inline const FileAccessManifestExtraFlag GetFamExtraFlags() const { return fam_.GetFamExtraFlags(); }
 
+    /*! Memory budgets of the per-process caches of the sandbox */
+    inline const PCManifestCacheBudgets GetCacheBudgets() const       { return fam_.GetCacheBudgets(); }
+
     /*!
      * Returns the full path of the root process of this pip.
      * The lenght of the path is stored in the 'length' argument because the path is not necessarily 0-terminated.
@@ -69,6 +117,16 @@ public:
     /*! When this returns true, child processes should not be tracked. */
     bool AllowChildProcessesToBreakAway() const                       { return fam_.AllowChildProcessesToBreakAway(); }
 
+    /*!
+     * Whether a probe or lookup (stat, getattrlist, access, ...) by this pip can produce a report, i.e., whether its manifest reports
+     * all accesses, or has a node that reports accesses or doesn't allow reads (so probes there are unexpected accesses).
+     * Found once when the pip is created, so the events only these accesses come from can be left out while no pip needs them.
+     */
+    inline const bool ReportsProbes() const                           { return reportsProbes_; }
+
+    /*! Same as 'ReportsProbes', for directory enumerations (readdir) */
+    inline const bool ReportsEnumerations() const                     { return reportsEnumerations_; }
+
 
 #pragma mark Process Tree Tracking
 
@@ -77,6 +135,37 @@ public:
 
     /*! Atomically dencrements this pip's process tree size and returns the size before decrement. */
     inline const int DecrementProcessTreeCount() { return --processTreeCount_; }
+
+#pragma mark Resource Usage Accounting
+
+    /*! Starts accounting for the resource usage of a process that joined this pip's process tree. */
+    void AddProcess(pid_t pid);
+
+    /*!
+     * Stops accounting for a process of this pip's process tree, which is about to exit: its final resource usage
+     * is added to that of the processes that exited before it, so that it doesn't have to be sampled anymore.
+     */
+    void RemoveProcess(pid_t pid);
+
+    /*!
+     * Resource usage of this pip's process tree: the accumulated usage of the processes that exited plus
+     * the current usage of the live ones (so sampling it is linear in the number of live processes).
+     */
+    PipResourceUsage GetResourceUsage();
+
+#pragma mark Access Report Batching
+
+    /*!
+     * Adds 'report' to the batch of reports of this pip, which is handed to 'callback' once it holds kAccessReportBatchSize
+     * reports or right away when 'flush' is set.
+     *
+     * Returns true when 'report' starts a batch that no flush is scheduled for yet: the caller must then make sure
+     * 'FlushAccessReports' gets called, within the latency it allows for reports.
+     */
+    bool BatchAccessReport(const AccessReport &report, bool flush, AccessReportBatchCallback callback);
+
+    /*! Hands the reports batched so far to 'callback', if there are any. */
+    void FlushAccessReports(AccessReportBatchCallback callback);
 };
 
 #endif /* SandboxedPip_hpp */
@@ -12,8 +12,7 @@ SandboxedProcess::SandboxedProcess(pid_t processId, std::shared_ptr<SandboxedPip
 
     pip_ = pip;
     id_  = processId;
-    bzero(path_, sizeof(path_));
-    pathLength_ = 0;
+    path_ = std::make_shared<const PathCacheEntry>("");
 }
 
 SandboxedProcess::~SandboxedProcess()
@@ -24,3 +23,26 @@ SandboxedProcess::~SandboxedProcess()
         pip_.reset();
     }
 }
+
+PolicySearchCursor SandboxedProcess::FindDirectoryCursor(PCManifestRecord manifest, const char *directory, size_t length)
+{
+    std::unique_lock<std::mutex> lock(lastDirectoryLock_, std::try_to_lock);
+    if (lock.owns_lock() && lastDirectoryCursor_.IsValid() &&
+        lastDirectory_.length() == length && memcmp(lastDirectory_.c_str(), directory, length) == 0)
+    {
+        return lastDirectoryCursor_;
+    }
+
+    // The search expects a NUL-terminated path; the cached copy (or a local one when contended) provides it
+    std::string copy;
+    std::string &target = lock.owns_lock() ? lastDirectory_ : copy;
+    target.assign(directory, length);
+
+    PolicySearchCursor cursor = FindFileAccessPolicyInTreeEx(manifest, target.c_str(), length);
+    if (lock.owns_lock())
+    {
+        lastDirectoryCursor_ = cursor;
+    }
+
+    return cursor;
+}
@@ -4,6 +4,7 @@
 #ifndef SandboxedProcess_hpp
 #define SandboxedProcess_hpp
 
+#include "PathCacheEntry.hpp"
 #include "SandboxedPip.hpp"
 
 /*!
@@ -14,6 +15,7 @@
  *
  * Process path is updated every time the process performs the 'exec' system call.
  * When a process forks, the child process inherits the path from its parent.
+ * The path is a shared entry that is swapped atomically, so it can be read while the process is exec-ing.
  */
 
 class SandboxedProcess final
@@ -28,10 +30,16 @@ private:
     pid_t id_;
 
     /*! Full path to this process' executable */
-    char path_[PATH_MAX];
+    std::shared_ptr<const PathCacheEntry> path_;
 
-    /*! The length of the path stored in 'path_' */
-    int pathLength_;
+    /*!
+     * Manifest search cursor of the directory this process last accessed a file in (path without the root sentinel).
+     * Accesses tend to come in bursts within one directory, so sibling lookups resume the search from this cursor.
+     * Threads of a process share it; a contended lookup simply falls back to searching from the root.
+     */
+    std::mutex lastDirectoryLock_;
+    std::string lastDirectory_;
+    PolicySearchCursor lastDirectoryCursor_;
 
 public:
 
@@ -46,13 +54,18 @@ public:
     inline const pid_t GetPid() const                            { return id_; }
 
     /*! Returns whether a full absolute path has been set */
-    inline bool HasPath() const                                  { return path_[0] == '/'; }
+    inline bool HasPath() const                                  { return GetPath()->GetPath()[0] == '/'; }
 
-    /*! 0-terminated full path to the executable file of this process */
-    inline const char* GetPath() const                           { return path_; }
+    /*! Full path to the executable file of this process; the caller keeps the entry alive for as long as it holds it */
+    inline std::shared_ptr<const PathCacheEntry> GetPath() const { return std::atomic_load(&path_); }
 
-    /*! Copies the 0-terminated string in 'path' to its own path buffer. */
-    inline void SetPath(const char *path) { strlcpy(path_, path, PATH_MAX); }
+    inline void SetPath(std::shared_ptr<const PathCacheEntry> path) { std::atomic_store(&path_, path); }
+
+    /*!
+     * Returns the manifest search cursor for a given directory (path without the root sentinel, not NUL-terminated),
+     * searching the manifest only when it is not the directory this process last looked up.
+     */
+    PolicySearchCursor FindDirectoryCursor(PCManifestRecord manifest, const char *directory, size_t length);
 };
 
 #endif /* SandboxedProcess_hpp */
@@ -1,6 +1,7 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <algorithm>
 #include "BuildXLException.hpp"
 #include "Trie.hpp"
 
@@ -11,42 +12,234 @@ template <typename T>
 std::atomic<uint> Node<T>::s_numPathNodes(0);
 
 template <typename T>
-Node<T>::Node(uint numChildren)
+std::atomic<size_t> Node<T>::s_uintNodeBytes(0);
+
+template <typename T>
+std::atomic<size_t> Node<T>::s_pathNodeBytes(0);
+
+// ================================== Children layouts ==================================
+
+/*! Children that are found by scanning their symbols. Used for kChildren4 and kChildren16. */
+template <typename T, uint8_t Capacity>
+struct ScannedChildren : Children<T>
 {
-    if (numChildren == s_uintNodeChildrenCount) ++s_numUintNodes;
-    else if (numChildren == s_pathNodeChildrenCount) ++s_numPathNodes;
+    uint8_t symbols[Capacity];
+    std::atomic<Node<T>*> nodes[Capacity];
+};
 
-    record_ = nullptr;
-    childrenLength_ = numChildren;
+/*! Children that are found through an index with an entry per symbol. Used for kChildren48. */
+template <typename T>
+struct IndexedChildren : Children<T>
+{
+    static const uint8_t Capacity = 48;
+
+    /*! 0 when there is no child for a symbol, otherwise 1 + the slot of the child in 'nodes' */
+    std::atomic<uint8_t> index[Node<T>::s_pathNodeChildrenCount];
+    std::atomic<Node<T>*> nodes[Capacity];
+};
+
+/*! Children in a slot per symbol. Used for kChildrenFull. */
+template <typename T>
+struct FullChildren : Children<T>
+{
+    std::atomic<Node<T>*> nodes[Node<T>::s_pathNodeChildrenCount];
+};
+
+template <typename T>
+using Children4 = ScannedChildren<T, 4>;
 
-    children_ = (Node **) malloc(numChildren * sizeof(Node *));
-    if (children_)
+template <typename T>
+using Children16 = ScannedChildren<T, 16>;
+
+template <typename T>
+static Children<T>* createChildren(typename Children<T>::Kind kind)
+{
+    // Value-initialization zeroes all the slots
+    Children<T> *children =
+        kind == Children<T>::kChildren4  ? (Children<T>*)new Children4<T>() :
+        kind == Children<T>::kChildren16 ? (Children<T>*)new Children16<T>() :
+        kind == Children<T>::kChildren48 ? (Children<T>*)new IndexedChildren<T>() :
+                                           (Children<T>*)new FullChildren<T>();
+    if (children != nullptr)
+    {
+        children->kind = kind;
+    }
+
+    return children;
+}
+
+template <typename T>
+static void deleteChildren(Children<T> *children)
+{
+    switch (children->kind)
     {
-        for (int i = 0; i < childrenLength_; i++)
+        case Children<T>::kChildren4:    delete (Children4<T>*)children; break;
+        case Children<T>::kChildren16:   delete (Children16<T>*)children; break;
+        case Children<T>::kChildren48:   delete (IndexedChildren<T>*)children; break;
+        case Children<T>::kChildrenFull: delete (FullChildren<T>*)children; break;
+    }
+}
+
+template <typename T>
+static size_t childrenSize(const Children<T> *children)
+{
+    if (children == nullptr) return 0;
+
+    switch (children->kind)
+    {
+        case Children<T>::kChildren4:    return sizeof(Children4<T>);
+        case Children<T>::kChildren16:   return sizeof(Children16<T>);
+        case Children<T>::kChildren48:   return sizeof(IndexedChildren<T>);
+        case Children<T>::kChildrenFull: return sizeof(FullChildren<T>);
+    }
+
+    return 0;
+}
+
+template <typename T, uint8_t Capacity>
+static std::atomic<Node<T>*>* findScannedSlot(ScannedChildren<T, Capacity> *children, uint8_t symbol)
+{
+    uint8_t count = children->count.load(std::memory_order_acquire);
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (children->symbols[i] == symbol)
         {
-            children_[i] = nullptr;
+            return &children->nodes[i];
         }
     }
+
+    return nullptr;
 }
 
+/*! Returns the slot holding the child for 'symbol', or NULL if there is none. */
 template <typename T>
-Node<T>::~Node()
+static std::atomic<Node<T>*>* findSlot(Children<T> *children, uint8_t symbol)
 {
-    if (children_)
+    if (children == nullptr) return nullptr;
+
+    switch (children->kind)
     {
-        for (int i = 0; i < childrenLength_; i++)
+        case Children<T>::kChildren4:
+            return findScannedSlot((Children4<T>*)children, symbol);
+
+        case Children<T>::kChildren16:
+            return findScannedSlot((Children16<T>*)children, symbol);
+
+        case Children<T>::kChildren48:
+        {
+            IndexedChildren<T> *indexed = (IndexedChildren<T>*)children;
+            uint8_t slot = indexed->index[symbol].load(std::memory_order_acquire);
+            return slot == 0 ? nullptr : &indexed->nodes[slot - 1];
+        }
+
+        case Children<T>::kChildrenFull:
+            return &((FullChildren<T>*)children)->nodes[symbol];
+    }
+
+    return nullptr;
+}
+
+template <typename T, uint8_t Capacity>
+static uint getScannedChildren(const ScannedChildren<T, Capacity> *children, uint8_t *symbols, Node<T> **nodes)
+{
+    uint count = children->count.load(std::memory_order_acquire);
+    for (uint i = 0; i < count; i++)
+    {
+        symbols[i] = children->symbols[i];
+        nodes[i] = children->nodes[i].load(std::memory_order_acquire);
+    }
+
+    return count;
+}
+
+/*! Copies the (symbol, child) pairs of 'children' into 'symbols' and 'nodes', which must fit them all, and returns how many there are. */
+template <typename T>
+static uint getChildren(const Children<T> *children, uint8_t *symbols, Node<T> **nodes)
+{
+    if (children == nullptr) return 0;
+
+    uint count = 0;
+    switch (children->kind)
+    {
+        case Children<T>::kChildren4:
+            return getScannedChildren((const Children4<T>*)children, symbols, nodes);
+
+        case Children<T>::kChildren16:
+            return getScannedChildren((const Children16<T>*)children, symbols, nodes);
+
+        case Children<T>::kChildren48:
+        {
+            const IndexedChildren<T> *indexed = (const IndexedChildren<T>*)children;
+            for (uint symbol = 0; symbol < Node<T>::s_pathNodeChildrenCount; symbol++)
+            {
+                uint8_t slot = indexed->index[symbol].load(std::memory_order_acquire);
+                if (slot != 0)
+                {
+                    symbols[count] = symbol;
+                    nodes[count++] = indexed->nodes[slot - 1].load(std::memory_order_acquire);
+                }
+            }
+            break;
+        }
+
+        case Children<T>::kChildrenFull:
         {
-            children_[i] = nullptr;
+            const FullChildren<T> *full = (const FullChildren<T>*)children;
+            for (uint symbol = 0; symbol < Node<T>::s_pathNodeChildrenCount; symbol++)
+            {
+                Node<T> *node = full->nodes[symbol].load(std::memory_order_acquire);
+                if (node != nullptr)
+                {
+                    symbols[count] = symbol;
+                    nodes[count++] = node;
+                }
+            }
+            break;
         }
+    }
+
+    return count;
+}
+
+/*! Puts 'child' in the first free slot, 'count', and only then makes it visible to readers. */
+template <typename T, uint8_t Capacity>
+static void addScannedChild(ScannedChildren<T, Capacity> *children, uint8_t count, uint8_t symbol, Node<T> *child)
+{
+    children->symbols[count] = symbol;
+    children->nodes[count].store(child, std::memory_order_relaxed);
+    children->count.store(count + 1, std::memory_order_release);
+}
 
-        free(children_);
+// ================================== class Node ==================================
+
+template <typename T>
+Node<T>::Node(const uint8_t *key, uint depth, bool ownsKey)
+{
+    record_ = nullptr;
+    key_ = key;
+    depth_ = depth;
+    ownsKey_ = ownsKey;
+    children_ = nullptr;
+}
+
+template <typename T>
+Node<T>::~Node()
+{
+    Children<T> *children = children_.load(std::memory_order_relaxed);
+    if (children != nullptr)
+    {
+        deleteChildren(children);
         children_ = nullptr;
     }
 
-    if (record_ != nullptr) record_.reset();
+    if (ownsKey_)
+    {
+        delete[] key_;
+    }
+
+    key_ = nullptr;
 
-    if (length() == s_uintNodeChildrenCount) --s_numUintNodes;
-    else if (length() == s_pathNodeChildrenCount) --s_numPathNodes;
+    if (record_ != nullptr) record_.reset();
 }
 
 // ================================== class Trie ==================================
@@ -55,8 +248,11 @@ template <typename T>
 Trie<T>::Trie(TrieKind kind)
 {
     kind_ = kind;
-    root_ = createNode();
-    if (root_->children_ == nullptr)
+    size_ = 0;
+    onChangeCallback_ = nullptr;
+    onChangeData_ = nullptr;
+    root_ = createNode(/*key*/ nullptr, /*depth*/ 0, /*ownsKey*/ false);
+    if (root_ == nullptr)
     {
         throw BuildXLException("Trie creation failed as no root node could be allocated!");
     }
@@ -65,73 +261,290 @@ Trie<T>::Trie(TrieKind kind)
 template <typename T>
 Trie<T>::~Trie()
 {
-    traverse(/*computeKey*/ false, /*callbackArgs*/ nullptr, [](Trie<T>*, void*, uint64_t, Node<T> *node)
+    traverse(/*computeKey*/ false, /*callbackArgs*/ nullptr, [](Trie<T> *me, void*, uint64_t, Node<T> *node)
     {
+        std::atomic<uint> &count = me->kind_ == kUintTrie ? Node<T>::s_numUintNodes : Node<T>::s_numPathNodes;
+        --count;
+        me->accountBytes(-(ssize_t)(sizeof(Node<T>) + childrenSize(node->children_.load()) + (node->ownsKey_ ? node->depth_ : 0)));
         delete node;
     });
 
+    for (Children<T> *children : retiredChildren_)
+    {
+        accountBytes(-(ssize_t)childrenSize(children));
+        deleteChildren(children);
+    }
+
+    retiredChildren_.clear();
     root_ = nullptr;
     size_ = 0;
 }
 
 template <typename T>
-bool Trie<T>::findChildNode(Node<T> *node, int idx, bool createIfMissing)
+void Trie<T>::accountBytes(ssize_t bytes)
+{
+    std::atomic<size_t> &total = kind_ == kUintTrie ? Node<T>::s_uintNodeBytes : Node<T>::s_pathNodeBytes;
+    total += bytes;
+}
+
+template <typename T>
+Node<T>* Trie<T>::createNode(const uint8_t *key, uint depth, bool ownsKey)
 {
-    if (idx < 0 || idx >= node->length())
+    Node<T> *node = new Node<T>(key, depth, ownsKey);
+    if (node != nullptr)
     {
-        return false;
+        ++(kind_ == kUintTrie ? Node<T>::s_numUintNodes : Node<T>::s_numPathNodes);
+        accountBytes(sizeof(Node<T>) + (ownsKey ? depth : 0));
     }
 
-    bool childNodeExists = node->children()[idx] != nullptr;
+    return node;
+}
+
+template <typename T>
+Node<T>* Trie<T>::findChild(const Node<T> *node, uint8_t symbol)
+{
+    std::atomic<Node<T>*> *slot = findSlot(node->children_.load(std::memory_order_acquire), symbol);
+    return slot != nullptr ? slot->load(std::memory_order_acquire) : nullptr;
+}
 
-    if (childNodeExists)
+template <typename T>
+void Trie<T>::replaceChild(Node<T> *node, uint8_t symbol, Node<T> *child)
+{
+    std::atomic<Node<T>*> *slot = findSlot(node->children_.load(std::memory_order_relaxed), symbol);
+    assert(slot != nullptr);
+    slot->store(child, std::memory_order_release);
+}
+
+template <typename T>
+bool Trie<T>::addChild(Node<T> *node, uint8_t symbol, Node<T> *child)
+{
+    Children<T> *children = node->children_.load(std::memory_order_relaxed);
+    uint8_t count = children != nullptr ? children->count.load(std::memory_order_relaxed) : 0;
+
+    bool full =
+        children == nullptr ||
+        (children->kind == Children<T>::kChildren4  && count == 4) ||
+        (children->kind == Children<T>::kChildren16 && count == 16) ||
+        (children->kind == Children<T>::kChildren48 && count == IndexedChildren<T>::Capacity);
+
+    if (full)
     {
-        return true;
+        // Grow into the next layout. Readers may still be looking at the current one, so it is kept around.
+        typename Children<T>::Kind kind =
+            children == nullptr                         ? Children<T>::kChildren4 :
+            children->kind == Children<T>::kChildren4   ? Children<T>::kChildren16 :
+            children->kind == Children<T>::kChildren16  ? Children<T>::kChildren48 :
+                                                          Children<T>::kChildrenFull;
+
+        Children<T> *grown = createChildren<T>(kind);
+        if (grown == nullptr)
+        {
+            return false;
+        }
+
+        accountBytes(childrenSize(grown));
+
+        if (children != nullptr)
+        {
+            uint8_t symbols[Node<T>::s_pathNodeChildrenCount];
+            Node<T> *nodes[Node<T>::s_pathNodeChildrenCount];
+            uint existingCount = getChildren(children, symbols, nodes);
+
+            for (uint i = 0; i < existingCount; i++)
+            {
+                if (kind == Children<T>::kChildren16)
+                {
+                    ((Children16<T>*)grown)->symbols[i] = symbols[i];
+                    ((Children16<T>*)grown)->nodes[i].store(nodes[i], std::memory_order_relaxed);
+                }
+                else if (kind == Children<T>::kChildren48)
+                {
+                    ((IndexedChildren<T>*)grown)->nodes[i].store(nodes[i], std::memory_order_relaxed);
+                    ((IndexedChildren<T>*)grown)->index[symbols[i]].store(i + 1, std::memory_order_relaxed);
+                }
+                else
+                {
+                    ((FullChildren<T>*)grown)->nodes[symbols[i]].store(nodes[i], std::memory_order_relaxed);
+                }
+            }
+
+            grown->count.store(existingCount, std::memory_order_relaxed);
+            retiredChildren_.push_back(children);
+        }
+
+        // Publishing the grown block makes all of the above visible to readers that find it
+        node->children_.store(grown, std::memory_order_release);
+        children = grown;
     }
 
-    // child is missing
-    if (!createIfMissing)
+    switch (children->kind)
     {
-        return false;
+        case Children<T>::kChildren4:
+            addScannedChild((Children4<T>*)children, count, symbol, child);
+            break;
+
+        case Children<T>::kChildren16:
+            addScannedChild((Children16<T>*)children, count, symbol, child);
+            break;
+
+        case Children<T>::kChildren48:
+        {
+            IndexedChildren<T> *indexed = (IndexedChildren<T>*)children;
+            indexed->nodes[count].store(child, std::memory_order_relaxed);
+            indexed->count.store(count + 1, std::memory_order_relaxed);
+            indexed->index[symbol].store(count + 1, std::memory_order_release);
+            break;
+        }
+
+        case Children<T>::kChildrenFull:
+        {
+            children->count.store(count + 1, std::memory_order_relaxed);
+            ((FullChildren<T>*)children)->nodes[symbol].store(child, std::memory_order_release);
+            break;
+        }
     }
 
-    Node<T>* newNode = createNode();
+    return true;
+}
 
-    // This should never happen except if we run out of memory.
-    if (newNode == nullptr)
+template <typename T>
+Node<T>* Trie<T>::findNode(const uint8_t *key, uint length) const
+{
+    Node<T> *node = root_;
+    uint depth = 0;
+    while (depth < length)
     {
-        return false;
+        Node<T> *child = findChild(node, key[depth]);
+        if (child == nullptr || child->depth_ > length)
+        {
+            return nullptr;
+        }
+
+        // The symbols the edge to 'child' skips must match too
+        for (uint i = depth + 1; i < child->depth_; i++)
+        {
+            if (child->key_[i] != key[i])
+            {
+                return nullptr;
+            }
+        }
+
+        node = child;
+        depth = child->depth_;
     }
 
-    // TODO: Make thread safe!
-    node->children()[idx] = newNode;
+    return node;
+}
 
-    return true;
+template <typename T>
+Node<T>* Trie<T>::findOrCreateNode(const uint8_t *key, uint length)
+{
+    Node<T> *existing = findNode(key, length);
+    if (existing != nullptr)
+    {
+        return existing;
+    }
+
+    std::lock_guard<std::mutex> guard(lock_);
+
+    Node<T> *node = root_;
+    uint depth = 0;
+    while (depth < length)
+    {
+        uint8_t symbol = key[depth];
+        Node<T> *child = findChild(node, symbol);
+        Node<T> *middle = nullptr;
+        uint splitDepth = depth;
+
+        if (child != nullptr)
+        {
+            uint end = std::min(child->depth_, length);
+            splitDepth = depth + 1;
+            while (splitDepth < end && child->key_[splitDepth] == key[splitDepth])
+            {
+                splitDepth++;
+            }
+
+            if (splitDepth == child->depth_)
+            {
+                node = child;
+                depth = splitDepth;
+                continue;
+            }
+
+            // The key leaves (or ends in) the edge to 'child': split the edge with a node for the common part, which
+            // shares the key of 'child'. It only gets published once complete, so readers see either edge.
+            middle = createNode(child->key_, splitDepth, /*ownsKey*/ false);
+            if (middle == nullptr || !addChild(middle, child->key_[splitDepth], child))
+            {
+                return nullptr;
+            }
+
+            if (splitDepth == length)
+            {
+                replaceChild(node, symbol, middle);
+                return middle;
+            }
+        }
+
+        uint8_t *leafKey = new uint8_t[length];
+        if (leafKey == nullptr)
+        {
+            return nullptr;
+        }
+
+        memcpy(leafKey, key, length);
+        Node<T> *leaf = createNode(leafKey, length, /*ownsKey*/ true);
+        if (leaf == nullptr)
+        {
+            delete[] leafKey;
+            return nullptr;
+        }
+
+        if (middle != nullptr)
+        {
+            if (!addChild(middle, key[splitDepth], leaf))
+            {
+                return nullptr;
+            }
+
+            replaceChild(node, symbol, middle);
+        }
+        else if (!addChild(node, symbol, leaf))
+        {
+            return nullptr;
+        }
+
+        return leaf;
+    }
+
+    return node;
 }
 
 template <typename T>
 TrieResult Trie<T>::makeSentinel(Node<T> *node, std::shared_ptr<T> record)
 {
     // if this is a sentinel node --> nothing to do
-    if (node->record_ != nullptr)
+    if (std::atomic_load(&node->record_) != nullptr)
     {
         return kTrieResultAlreadyExists;
     }
 
-    std::shared_ptr<T> newRecord = record;
-    if (newRecord == nullptr)
+    if (record == nullptr)
     {
         return kTrieResultAlreadyExists;
     }
 
-    if (node->record_ != nullptr)
     {
-        newRecord.reset();
-        return kTrieResultAlreadyExists;
+        std::lock_guard<std::mutex> guard(lock_);
+        if (node->record_ != nullptr)
+        {
+            return kTrieResultAlreadyExists;
+        }
+
+        std::atomic_store(&node->record_, record);
     }
 
-    // TODO: Make thread safe!
-    node->record_ = newRecord;
     int oldCount = (++size_);
     triggerOnChange(oldCount, oldCount + 1);
 
@@ -141,7 +554,7 @@ TrieResult Trie<T>::makeSentinel(Node<T> *node, std::shared_ptr<T> record)
 template <typename T>
 std::shared_ptr<T> Trie<T>::get(Node<T> *node)
 {
-    return node != nullptr ? node->record_ : nullptr;
+    return node != nullptr ? std::atomic_load(&node->record_) : nullptr;
 }
 
 template <typename T>
@@ -151,7 +564,7 @@ std::shared_ptr<T> Trie<T>::getOrAdd(Node<T> *node, std::shared_ptr<T> record, T
     auto sentinelResult = makeSentinel(node, record);
     if (result) *result = sentinelResult;
 
-    return node->record_;
+    return std::atomic_load(&node->record_);
 }
 
 template <typename T>
@@ -162,19 +575,21 @@ TrieResult Trie<T>::replace(Node<T> *node, const std::shared_ptr<T> value)
         return kTrieResultFailure;
     }
 
-    std::shared_ptr<T> previousValue = node->record_;
+    std::shared_ptr<T> previousValue;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        previousValue = node->record_;
+        std::atomic_store(&node->record_, value);
+    }
 
     if (previousValue != nullptr)
     {
-        node->record_ = value;
         previousValue.reset();
 
         return kTrieResultReplaced;
     }
     else
     {
-        node->record_ = value;
-
         int oldCount = (++size_);
         triggerOnChange(oldCount, oldCount + 1);
 
@@ -190,9 +605,13 @@ TrieResult Trie<T>::insert(Node<T> *node, const std::shared_ptr<T> value)
         return kTrieResultFailure;
     }
 
-    if (node->record_ != nullptr) return kTrieResultAlreadyExists;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (node->record_ != nullptr) return kTrieResultAlreadyExists;
+
+        std::atomic_store(&node->record_, value);
+    }
 
-    node->record_ = value;
     int oldCount = (++size_);
     triggerOnChange(oldCount, oldCount + 1);
 
@@ -202,23 +621,27 @@ TrieResult Trie<T>::insert(Node<T> *node, const std::shared_ptr<T> value)
 template <typename T>
 TrieResult Trie<T>::remove(Node<T> *node)
 {
-    if (node == nullptr || node->record_ == nullptr)
+    if (node == nullptr)
     {
         return kTrieResultAlreadyEmpty;
     }
 
-
-    if (node->record_ != nullptr)
+    std::shared_ptr<T> previousValue;
     {
-        node->record_.reset();
-
-        int oldCount = (--size_);
-        triggerOnChange(oldCount, oldCount - 1);
+        std::lock_guard<std::mutex> guard(lock_);
+        previousValue = node->record_;
+        if (previousValue == nullptr)
+        {
+            return kTrieResultAlreadyEmpty;
+        }
 
-        return kTrieResultRemoved;
+        std::atomic_store(&node->record_, std::shared_ptr<T>());
     }
 
-    return kTrieResultFailure;
+    int oldCount = (--size_);
+    triggerOnChange(oldCount, oldCount - 1);
+
+    return kTrieResultRemoved;
 }
 
 /*
@@ -528,51 +951,54 @@ static uint64_t pow10(int exp)
     return result;
 }
 
+/*! Paths up to this long are turned into symbols on the stack */
+static const size_t s_pathKeyBufferLength = 256;
+
 template <typename T>
 Node<T>* Trie<T>::findPathNode(const char *path, bool createIfMissing)
 {
-    Node<T> *currNode = root_;
-    unsigned char ch;
-    while ((ch = *path++) != '\0')
+    size_t length = strlen(path);
+    if (length > UINT_MAX)
     {
-        int idx = s_char2idx<T>[ch];
-        if (!findChildNode(currNode, idx, createIfMissing))
+        return nullptr;
+    }
+
+    uint8_t buffer[s_pathKeyBufferLength];
+    std::unique_ptr<uint8_t[]> heapBuffer;
+    uint8_t *key = buffer;
+    if (length > s_pathKeyBufferLength)
+    {
+        heapBuffer.reset(new uint8_t[length]);
+        key = heapBuffer.get();
+    }
+
+    for (size_t i = 0; i < length; i++)
+    {
+        int idx = s_char2idx<T>[(unsigned char)path[i]];
+        if (idx < 0)
         {
             return nullptr;
         }
-        currNode = currNode->children()[idx];
+
+        key[i] = (uint8_t)idx;
     }
 
-    return currNode;
+    return createIfMissing ? findOrCreateNode(key, (uint)length) : findNode(key, (uint)length);
 }
 
 template <typename T>
 Node<T>* Trie<T>::findUintNode(uint64_t key, bool createIfMissing)
 {
-    Node<T> *currNode = root_;
-
-    while (true)
+    // Least significant digit first; 0 is a single digit too
+    uint8_t digits[20];
+    uint length = 0;
+    do
     {
-        assert(currNode->length() == 10);
-
-        int lsd = key % 10;
-
-        if (!findChildNode(currNode, lsd, createIfMissing))
-        {
-            return nullptr;
-        }
-
-        currNode = currNode->children()[lsd];
-
-        if (key < 10)
-        {
-            break;
-        }
-
+        digits[length++] = key % 10;
         key = key / 10;
-    }
+    } while (key != 0);
 
-    return currNode;
+    return createIfMissing ? findOrCreateNode(digits, length) : findNode(digits, length);
 }
 
 template <typename T>
@@ -604,7 +1030,7 @@ void Trie<T>::forEach(void *callbackArgs, for_each_fn callback)
     traverse(/*computeKey*/ kind_ == kUintTrie, /*callbackArgs*/ &state, [](Trie<T> *me, void *s, uint64_t key, Node<T> *node)
     {
         State *state = (State*)s;
-        std::shared_ptr<T> record = node->record_;
+        std::shared_ptr<T> record = std::atomic_load(&node->record_);
         if (record)
         {
             state->callback(state->args, key, record);
@@ -620,7 +1046,7 @@ void Trie<T>::removeMatching(void *filterArgs, filter_fn filter)
     traverse(/*computeKey*/ false, /*callbackArgs*/ &state, [](Trie<T> *me, void *s, uint64_t, Node<T> *node)
     {
         State *state = (State*)s;
-        std::shared_ptr<T> record = node->record_;
+        std::shared_ptr<T> record = std::atomic_load(&node->record_);
         if (record)
         {
             if (state->filter(state->args, record))
@@ -631,52 +1057,29 @@ void Trie<T>::removeMatching(void *filterArgs, filter_fn filter)
     });
 }
 
-template <typename T>
-struct Stack {
-    Node<T> *node;
-    Stack *next;
-    uint32_t depth;
-    uint64_t key;
-};
-
-template <typename T>
-static void push(Stack<T> **stack, Node<T> *node, uint64_t path, uint32_t depth)
-{
-    if (node == nullptr) return;
-
-    Stack<T> *top = new Stack<T>();
-    top->node  = node;
-    top->next  = *stack;
-    top->key   = path;
-    top->depth = depth;
-
-    *stack = top;
-}
-
-template <typename T>
-static Node<T>* pop(Stack<T> **stack)
-{
-    Stack<T> *top = *stack;
-    *stack = top->next;
-    Node<T> *node = top->node;
-    delete top;
-    return node;
-}
-
 template <typename T>
 void Trie<T>::traverse(bool computeKey, void *callbackArgs, traverse_fn callback)
 {
-    Stack<T> *stack = nullptr;
-    push(&stack, root_, /*key*/ 0, /*depth*/ 0);
-    while (stack != nullptr)
+    uint8_t symbols[Node<T>::s_pathNodeChildrenCount];
+    Node<T> *children[Node<T>::s_pathNodeChildrenCount];
+
+    std::vector<Node<T>*> stack;
+    stack.push_back(root_);
+    while (!stack.empty())
     {
-        uint64_t key = stack->key;
-        uint32_t depth = stack->depth;
+        Node<T> *curr = stack.back();
+        stack.pop_back();
+
+        uint count = getChildren(curr->children_.load(std::memory_order_acquire), symbols, children);
+        stack.insert(stack.end(), children, children + count);
 
-        Node<T> *curr = pop(&stack);
-        for (int i = 0; i < curr->length(); ++i)
+        uint64_t key = 0;
+        if (computeKey)
         {
-            push(&stack, curr->children()[i], computeKey ? (i * pow10<T>(depth) + key) : 0, depth + 1);
+            for (uint i = 0; i < curr->depth_; i++)
+            {
+                key += curr->key_[i] * pow10<T>(i);
+            }
         }
 
         // the callback may deallocate 'curr' node, hence this must be the last statement in this loop
@@ -689,7 +1092,7 @@ void Trie<T>::traverse(bool computeKey, void *callbackArgs, traverse_fn callback
 #ifndef MAC_DETOURS
     #include "SandboxedProcess.hpp"
     template class Trie<SandboxedProcess>;
-#else
-    #include "PathCacheEntry.hpp"
-    template class Trie<PathCacheEntry>;
 #endif
+
+#include "PathCacheEntry.hpp"
+template class Trie<PathCacheEntry>;
@@ -8,14 +8,43 @@
 
 #include <atomic>
 #include <memory>
+#include <mutex>
+#include <vector>
 #include <limits.h>
 #include <sys/types.h>
 
 template <typename T> class Trie;
 
+/*!
+ * The children of a node, in one of four layouts that grow with the number of children:
+ * up to 4 or 16 children are kept as (symbol, node) pairs that are scanned, up to 48 behind a per-symbol index,
+ * and beyond that in an array with a slot for every symbol.
+ *
+ * Children are only ever added in place by publishing them after they are fully written, so readers never see
+ * a partially added child. Growing a block replaces it with a copy; the old block is kept until the trie goes
+ * away, since readers may still be looking at it.
+ */
+template <typename T>
+struct Children
+{
+    typedef enum : uint8_t { kChildren4, kChildren16, kChildren48, kChildrenFull } Kind;
+
+    Kind kind;
+
+    /*! Number of children; only published with release semantics for kChildren4 and kChildren16 */
+    std::atomic<uint8_t> count;
+};
+
+// ================================== class Node ==================================
+
 /*!
  * A node in a Trie.
  * Only accessible to its friend class Trie.
+ *
+ * Keys are sequences of symbols (see 'Trie') and the trie is path compressed: nodes only exist where keys end
+ * or branch. The symbols a node skips past its parent are not stored in the parent but read from 'key_',
+ * which holds all the symbols that lead to the node. That lets a compressed edge be split by putting a new
+ * node in between, without touching the node below it.
  */
 template <typename T>
 class Node final
@@ -26,11 +55,29 @@ private:
 
     static std::atomic<uint> s_numUintNodes;
     static std::atomic<uint> s_numPathNodes;
+    static std::atomic<size_t> s_uintNodeBytes;
+    static std::atomic<size_t> s_pathNodeBytes;
+
+    /*! Arbitrary value */
+    std::shared_ptr<T> record_;
+
+    /*! The symbols of the key of this node; only the first 'depth_' are meaningful */
+    const uint8_t *key_;
+
+    /*! Number of symbols in the key of this node */
+    uint depth_;
+
+    /*! Whether 'key_' was allocated for this node (otherwise it belongs to a descendant) */
+    bool ownsKey_;
+
+    /*! Null until the node gets its first child */
+    std::atomic<Children<T>*> children_;
+
+public:
 
     /*!
      * The value 65 is chosen so that all ASCII characters between 32 (' ') and 122 ('z')
-     * get a unique entry in the 'children_' array.  The formula for mapping a character
-     * ch to an array index is:
+     * get a unique symbol.  The formula for mapping a character ch to a symbol is:
      *
      *   toupper(ch) - 32
      */
@@ -39,25 +86,8 @@ private:
     /*! For 10 digits */
     static const uint s_uintNodeChildrenCount = 10;
 
-    /*! Arbitrary value */
-    std::shared_ptr<T> record_;
-
-    /*! The length of the 'children_' array (i.e., the the number of allocated nodes) */
-    uint childrenLength_;
-
-    /*! Pre-allocated pointers to all possible children nodes. */
-    Node **children_;
-
-    uint length()     const { return childrenLength_; }
-    Node** children() const { return children_; }
-
-    static Node* createUintNode() { return new Node(s_uintNodeChildrenCount); }
-    static Node* createPathNode() { return new Node(s_pathNodeChildrenCount); }
-
-public:
-
     Node() = delete;
-    Node(uint numChildren);
+    Node(const uint8_t *key, uint depth, bool ownsKey);
     ~Node();
 };
 
@@ -74,7 +104,7 @@ typedef enum {
 } TrieResult;
 
 /*!
- * A thread-safe, lock-free, dictionary implementation.
+ * A thread-safe dictionary implementation, as a path-compressed adaptive radix tree.
  *
  * Only 2 types of keys are allowed: (1) an unsigned integer, and (2) an ascii path.
  *
@@ -85,7 +115,11 @@ typedef enum {
  * Paths are considered case-insensitive.  Attempting to add a path with a non-ascii
  * character will fail gracefully by returning 'kTrieResultFailure'.
  *
- * Thread-safe.  Non-blocking.
+ * Keys are turned into sequences of symbols: the digits of an unsigned integer (least significant first), or the
+ * characters of a path (see 'Node::s_pathNodeChildrenCount').  Nodes are only allocated where keys end or branch
+ * and are sized to their number of children, so a path costs roughly its own length plus a couple of small nodes.
+ *
+ * Thread-safe.  Lookups are lock-free; modifications are serialized.
  */
 template <typename T>
 class Trie final
@@ -98,22 +132,22 @@ public:
 
     static void getUintNodeCounts(uint *count, double *sizeMB)
     {
-        getNodeCounts(Node<T>::s_numUintNodes, Node<T>::s_uintNodeChildrenCount, count, sizeMB);
+        getNodeCounts(Node<T>::s_numUintNodes, Node<T>::s_uintNodeBytes, count, sizeMB);
     }
 
     static void getPathNodeCounts(uint *count, double *sizeMB)
     {
-        getNodeCounts(Node<T>::s_numPathNodes, Node<T>::s_pathNodeChildrenCount, count, sizeMB);
+        getNodeCounts(Node<T>::s_numPathNodes, Node<T>::s_pathNodeBytes, count, sizeMB);
     }
 
 private:
 
     static const uint BytesInAMegabyte = 1 << 20;
 
-    inline static void getNodeCounts(uint count, uint numChildren, uint *outCount, double *outSizeMB)
+    inline static void getNodeCounts(uint count, size_t bytes, uint *outCount, double *outSizeMB)
     {
         *outCount = count;
-        *outSizeMB = (1.0 * count * (sizeof(Node<T>) + numChildren * sizeof(Node<T>*))) / BytesInAMegabyte;
+        *outSizeMB = (1.0 * bytes) / BytesInAMegabyte;
     }
 
     typedef enum { kUintTrie, kPathTrie } TrieKind;
@@ -134,24 +168,39 @@ private:
     /*! Payload for the 'onChangeCallback_' function */
     void *onChangeData_;
 
+    /*! Serializes all modifications of the tree. Lookups don't take it. */
+    std::mutex lock_;
+
+    /*! Children blocks that were replaced by bigger ones, freed along with the tree. Guarded by 'lock_'. */
+    std::vector<Children<T>*> retiredChildren_;
+
     /*! Invokes the 'onChangeCallback_' if it's set and 'newCount' is different from 'oldCount' */
     void triggerOnChange(int oldCount, int newCount) const;
 
+    /*! Returns the child of 'node' for 'symbol', or NULL if there is none. */
+    static Node<T>* findChild(const Node<T> *node, uint8_t symbol);
+
+    /*! Adds 'child' to 'node' for 'symbol', which 'node' must not have a child for yet. Must hold 'lock_'. */
+    bool addChild(Node<T> *node, uint8_t symbol, Node<T> *child);
+
+    /*! Replaces the existing child of 'node' for 'symbol' with 'child'. Must hold 'lock_'. */
+    static void replaceChild(Node<T> *node, uint8_t symbol, Node<T> *child);
+
     /*!
-     * Checks if a child node of 'node' exists at position 'idx'.
-     * If no such child node exists and 'createIfMissing' is true,
-     * a new child node is created and saved at position 'idx'.
-     *
-     * @param node The parent node.  Must not be null.
-     * @param idx Must be between 0 (inclusive) and 'node.length()' (exclusive); otherwise this method returns false.
-     * @param createIfMissing When true, this method creates a new child node at position 'idx' if one doesn't already exist.
-     * @result True IFF 'node' contains a child node at position 'idx' after this method returns.
+     * Returns the node for the key made of the 'length' symbols in 'key', or NULL if there is none yet.
+     * Doesn't take 'lock_'.
+     */
+    Node<T>* findNode(const uint8_t *key, uint length) const;
+
+    /*!
+     * Returns the node for the key made of the 'length' symbols in 'key', creating the nodes it takes (at most 2,
+     * thanks to path compression) if missing. Returns NULL if the system is out of memory.
      */
-    bool findChildNode(Node<T> *node, int idx, bool createIfMissing);
+    Node<T>* findOrCreateNode(const uint8_t *key, uint length);
 
     /*!
      * Ensures that 'node' has its 'record_' field set to a non-null value.
-     * If not already set, uses the 'factory' function to create a new value and assign it to the 'record_' field.
+     * If not already set, sets it to 'record'.
      *
      * @param node The node that must become sentinel.
      * @param record The object to use to set the sentinel record to
@@ -162,12 +211,8 @@ private:
     TrieResult makeSentinel(Node<T> *node, std::shared_ptr<T> record);
 
     /*!
-     * Returns the record already assigned to 'node' or, if no record is assigned to it, creates a new one by invoking
-     * 'factory', assigns it to 'node', and returns it.
-     *
-     * IMPORTANT: The caller must not assume that 'factory' is invoked IFF its return value is assigned to 'node'.
-     *            It is possible that 'factory' is invoked, but due to a race some other record gets assigned to this
-     *            node first; in that case, the OSObject returned by 'factory' is released and simply ignored.
+     * Returns the record already assigned to 'node' or, if no record is assigned to it, assigns 'record'
+     * to 'node' and returns it.
      *
      * @result The record associated with 'node' or NULL if 'node' is NULL.
      */
@@ -179,21 +224,15 @@ private:
     std::shared_ptr<T> get(Node<T> *node);
 
     /*!
-     * Attempts to associate 'value' with 'node', even if there is already a value associated with 'node'.
+     * Associates 'value' with 'node', even if there is already a value associated with 'node'.
      *
      * If either 'node' or 'value' is NULL, the result is 'kTrieResultFailure'.
      *
-     * If 'value' has been associated with 'node' and there wasn't a record previously associated with 'node':
-     * retains 'value', increments size, and returns 'kTrieResultInserted'.
-     *
-     * If 'value' has been associated with 'node' and there was a record previously associated with 'node':
-     * retains 'value', releases the previous record, and returns 'kTrieResultReplaced'.
+     * If there wasn't a record previously associated with 'node': increments size and returns 'kTrieResultInserted'.
      *
-     * If 'value' has not beed associated with 'node' because there was a race (i.e., someone else associated a
-     * different record first), it does nothing and returns 'kTrieResultRace'.  The caller should decide whether to
-     * retry or accept the existing outcome.
+     * If there was a record previously associated with 'node': releases the previous record and returns 'kTrieResultReplaced'.
      *
-     * @result kTrieResultInserted, kTrieResultReplaced, kTrieResultRace, or kTrieResultFailure
+     * @result kTrieResultInserted, kTrieResultReplaced, or kTrieResultFailure
      */
     TrieResult replace(Node<T> *node, const std::shared_ptr<T> value);
 
@@ -209,16 +248,10 @@ private:
     /*!
      * Attempts to remove any record currently associated with 'node'.
      *
-     * If 'node' is NULL, returns 'kTrieResultFailure'.
-     *
-     * If no record is currently associated with 'node', returns 'kTrieResultAlreadyEmpty'.
+     * If no record is currently associated with 'node' (or 'node' is NULL), returns 'kTrieResultAlreadyEmpty'.
      *
      * If there is a record currently associated with 'node', it releases that record, decrements the size, and
      * returns 'kTrieResultRemoved'.
-     *
-     * If there is a record currently associated with 'node' but it gets changed in the middle of this method,
-     * this method simply returns 'kTrieResultRace'; the caller should decide whether to retry the operation or accept
-     * the existing outcome.
      */
     TrieResult remove(Node<T> *node);
 
@@ -255,13 +288,11 @@ private:
     /*! Calls 'findPathNode' with 'createIfMissing' set to false. */
     inline Node<T>* findExistingNodeForPath(const char *key) { return findPathNode(key, false); }
 
-    /*! Creates either a Uint or a Path node, based on the kind of this trie. */
-    inline Node<T>* createNode()
-    {
-        return kind_ == kUintTrie ? Node<T>::createUintNode() :
-               kind_ == kPathTrie ? Node<T>::createPathNode() :
-               nullptr;
-    }
+    /*! Creates a node and accounts for it in the node counts of the kind of this trie. */
+    Node<T>* createNode(const uint8_t *key, uint depth, bool ownsKey);
+
+    /*! Adds 'bytes' (which may be negative) to the node bytes of the kind of this trie. */
+    void accountBytes(ssize_t bytes);
 
 public:
 
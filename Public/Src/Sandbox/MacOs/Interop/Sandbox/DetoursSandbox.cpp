@@ -1,18 +1,36 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <sys/mman.h>
+
 #include "BuildXLSandboxShared.hpp"
 #include "BuildXLException.hpp"
 #include "DetoursSandbox.hpp"
 #include "XPCConstants.hpp"
 
-DetoursSandbox::DetoursSandbox(pid_t host_pid, process_callback callback, void *sandbox, xpc_connection_t bridge)
+DetoursSandbox::DetoursSandbox(pid_t host_pid, process_callback callback, event_queue_callback queue_callback, void *sandbox, xpc_connection_t bridge)
 {
-    assert(callback != nullptr && bridge != nullptr);
+    assert(callback != nullptr && queue_callback != nullptr && bridge != nullptr);
 
     eventCallback_ = callback;
+    eventQueueCallback_ = queue_callback;
     xpc_bridge_ = bridge;
     hostPid_ = host_pid;
+    sandbox_ = sandbox;
+
+    size_t pageSize = (size_t)getpagesize();
+    eventRingSize_ = (IOEventRing::RegionSize() + pageSize - 1) & ~(pageSize - 1);
+    void *region = mmap(NULL, eventRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+    if (region != MAP_FAILED)
+    {
+        eventRing_ = IOEventRing::Create(region);
+        eventRingMemory_ = xpc_shmem_create(region, eventRingSize_);
+    }
+    else
+    {
+        log_error("Could not map the shared Detours event ring, interposed processes report over XPC only - errno(%d)", errno);
+        eventRingSize_ = 0;
+    }
 
     char queueName[PATH_MAX] = { '\0' };
     sprintf(queueName, "com.microsoft.buildxl.detours.eventqueue_%d", host_pid);
@@ -32,19 +50,74 @@ DetoursSandbox::DetoursSandbox(pid_t host_pid, process_callback callback, void *
                 xpc_type_t type = xpc_get_type(message);
                 if (type == XPC_TYPE_DICTIONARY)
                 {
-                    const char *msg = xpc_dictionary_get_string(message, IOEventKey);
-                    const uint64_t msg_length = xpc_dictionary_get_uint64(message, IOEventLengthKey);
+                    DrainEventRing();
+                    if (xpc_dictionary_get_uint64(message, "command") == xpc_drain_detours_event_ring)
+                    {
+                        return;
+                    }
 
-                    imemorystream ims(msg, msg_length);
-                    ims.imbue(std::locale(ims.getloc(), new PipeDelimiter));
-                    IOEvent event;
-                    ims >> event;
+                    process_callback eventCallback = eventCallback_;
+                    pid_t hostPid = hostPid_;
 
-                    eventCallback_(sandbox, const_cast<const IOEvent &>(event), hostPid_, IOEventBacking::Interposing);
+                    // Notifications come in batches and expect no reply, see send_to_sandbox in the interposing library
+                    size_t batch_length = 0;
+                    const char *batch = (const char *) xpc_dictionary_get_data(message, IOEventBatchKey, &batch_length);
+                    if (batch != nullptr)
+                    {
+                        const char *cursor = batch;
+                        const char *end = batch + batch_length;
+                        while (cursor < end)
+                        {
+                            IOEvent event;
+                            uint32_t event_length = 0;
+                            bool valid = (size_t)(end - cursor) >= sizeof(uint32_t);
+                            if (valid)
+                            {
+                                memcpy(&event_length, cursor, sizeof(uint32_t));
+                                cursor += sizeof(uint32_t);
+                                valid = (size_t)(end - cursor) >= event_length && IOEvent::Deserialize(cursor, event_length, event);
+                            }
+
+                            if (!valid)
+                            {
+                                log_error("Received a malformed IOEvent batch of length %zu", batch_length);
+                                return;
+                            }
+
+                            cursor += event_length;
+                            dispatch_async(eventQueueCallback_(sandbox, event), ^{
+                                eventCallback(sandbox, event, hostPid, IOEventBacking::Interposing);
+                            });
+                        }
+
+                        return;
+                    }
+
+                    size_t msg_length = 0;
+                    const char *msg = (const char *) xpc_dictionary_get_data(message, IOEventKey, &msg_length);
 
+                    IOEvent event;
                     xpc_object_t reply = xpc_dictionary_create_reply(message);
-                    xpc_dictionary_set_uint64(reply, "response", xpc_response_success);
-                    xpc_connection_send_message((xpc_connection_t) peer, reply);
+                    if (msg == nullptr || !IOEvent::Deserialize(msg, msg_length, event))
+                    {
+                        log_error("Received a malformed IOEvent of length %zu", msg_length);
+                        xpc_dictionary_set_uint64(reply, "response", xpc_response_error);
+                        xpc_connection_send_message((xpc_connection_t) peer, reply);
+                        xpc_release(reply);
+                        return;
+                    }
+
+                    // Interposed processes block until their event is replied to, so per-process ordering only needs the
+                    // reply to be sent once the event has been processed on the queue of its process tree
+                    xpc_retain(peer);
+                    dispatch_async(eventQueueCallback_(sandbox, event), ^{
+                        eventCallback(sandbox, event, hostPid, IOEventBacking::Interposing);
+
+                        xpc_dictionary_set_uint64(reply, "response", xpc_response_success);
+                        xpc_connection_send_message((xpc_connection_t) peer, reply);
+                        xpc_release(reply);
+                        xpc_release(peer);
+                    });
                 }
                 else if (type == XPC_TYPE_ERROR)
                 {
@@ -73,6 +146,10 @@ DetoursSandbox::DetoursSandbox(pid_t host_pid, process_callback callback, void *
     xpc_object_t post = xpc_dictionary_create(NULL, NULL, 0);
     xpc_dictionary_set_uint64(post, "command", xpc_set_detours_connection);
     xpc_dictionary_set_connection(post, "connection", detours_);
+    if (eventRingMemory_ != nullptr)
+    {
+        xpc_dictionary_set_value(post, IOEventRingKey, eventRingMemory_);
+    }
 
     xpc_object_t response = xpc_connection_send_message_with_reply_sync(xpc_bridge_, post);
     xpc_type_t type = xpc_get_type(response);
@@ -94,6 +171,35 @@ DetoursSandbox::DetoursSandbox(pid_t host_pid, process_callback callback, void *
     }
 }
 
+void DetoursSandbox::DrainEventRing()
+{
+    if (eventRing_ == nullptr)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(eventRingLock_);
+
+    process_callback eventCallback = eventCallback_;
+    event_queue_callback eventQueueCallback = eventQueueCallback_;
+    pid_t hostPid = hostPid_;
+    void *sandbox = sandbox_;
+
+    size_t malformed = 0;
+    eventRing_->Drain([=](const IOEvent &published)
+    {
+        IOEvent event = published;
+        dispatch_async(eventQueueCallback(sandbox, event), ^{
+            eventCallback(sandbox, event, hostPid, IOEventBacking::Interposing);
+        });
+    }, malformed);
+
+    if (malformed > 0)
+    {
+        log_error("Drained %zu malformed IOEvents from the shared Detours event ring", malformed);
+    }
+}
+
 DetoursSandbox::~DetoursSandbox()
 {
     xpc_object_t post = xpc_dictionary_create(NULL, NULL, 0);
@@ -106,12 +212,25 @@ DetoursSandbox::~DetoursSandbox()
     xpc_bridge_ = nullptr;
     detours_ = nullptr;
 
+    if (eventRingMemory_ != nullptr)
+    {
+        xpc_release(eventRingMemory_);
+        eventRingMemory_ = nullptr;
+    }
+
+    if (eventRing_ != nullptr)
+    {
+        munmap(eventRing_, eventRingSize_);
+        eventRing_ = nullptr;
+    }
+
     if (eventQueue_ != nullptr)
     {
         dispatch_release(eventQueue_);
     }
 
     eventCallback_ = nullptr;
+    eventQueueCallback_ = nullptr;
     
     log_debug("%s", "Successfully shut-down Detours sandbox subsystem.");
 }
@@ -4,8 +4,11 @@
 #ifndef DetoursSandbox_hpp
 #define DetoursSandbox_hpp
 
+#include <mutex>
+
 #include "stdafx.h"
 #include "IOEvent.hpp"
+#include "IOEventRing.hpp"
 
 class DetoursSandbox final
 {
@@ -15,11 +18,25 @@ private:
     pid_t hostPid_;
     dispatch_queue_t eventQueue_ = nullptr;
     process_callback eventCallback_ = nullptr;
+    event_queue_callback eventQueueCallback_ = nullptr;
+    void *sandbox_ = nullptr;
+
+    // Shared with the interposed processes, which fall back to XPC messages when it's missing or full
+    IOEventRing *eventRing_ = nullptr;
+    size_t eventRingSize_ = 0;
+    std::mutex eventRingLock_;
 
 #if __APPLE__
     xpc_connection_t xpc_bridge_ = nullptr;
     xpc_connection_t detours_ = nullptr;
+    xpc_object_t eventRingMemory_ = nullptr;
 #endif
+
+    /*!
+     * Hands every event published in the shared ring to the queue of its process tree.  Runs before any XPC message of an
+     * interposed process is handled, so the events a process wrote into the ring are processed before the ones it sent later.
+     */
+    void DrainEventRing();
     
 public:
     
@@ -27,7 +44,7 @@ public:
     ~DetoursSandbox();
     
 #if __APPLE__
-    DetoursSandbox(pid_t host_pid, process_callback callback, void *sandbox, xpc_connection_t bridge);
+    DetoursSandbox(pid_t host_pid, process_callback callback, event_queue_callback queue_callback, void *sandbox, xpc_connection_t bridge);
 #endif
 };
 
@@ -8,11 +8,14 @@
 #include "EndpointSecuritySandbox.hpp"
 #include "XPCConstants.hpp"
 
-EndpointSecuritySandbox::EndpointSecuritySandbox(pid_t host_pid, process_callback callback, void *sandbox, xpc_connection_t bridge)
+EndpointSecuritySandbox::EndpointSecuritySandbox(pid_t host_pid, process_callback callback, event_queue_callback queue_callback, muted_pid_callback muted_callback,
+                                                 void *sandbox, xpc_connection_t bridge)
 {
-    assert(callback != nullptr && bridge != nullptr);
+    assert(callback != nullptr && queue_callback != nullptr && muted_callback != nullptr && bridge != nullptr);
 
     eventCallback_ = callback;
+    eventQueueCallback_ = queue_callback;
+    mutedPidCallback_ = muted_callback;
     xpc_bridge_ = bridge;
     hostPid_ = host_pid;
 
@@ -34,33 +37,65 @@ EndpointSecuritySandbox::EndpointSecuritySandbox(pid_t host_pid, process_callbac
                 xpc_type_t type = xpc_get_type(message);
                 if (type == XPC_TYPE_DICTIONARY)
                 {
-                    const char *msg = xpc_dictionary_get_string(message, IOEventKey);
-                    const uint64_t msg_length = xpc_dictionary_get_uint64(message, IOEventLengthKey);
+                    size_t msg_length = 0;
+                    const char *msg = (const char *) xpc_dictionary_get_data(message, IOEventKey, &msg_length);
 
-                    imemorystream ims(msg, msg_length);
-                    ims.imbue(std::locale(ims.getloc(), new PipeDelimiter));
-                    IOEvent event;
-                    ims >> event;
+                    xpc_object_t reply = xpc_dictionary_create_reply(message);
 
-                    ProcessCallbackResult result = eventCallback_ != nullptr ? eventCallback_(sandbox, const_cast<const IOEvent &>(event), hostPid_, IOEventBacking::EndpointSecurity) : ProcessCallbackResult::Done;
+                    // Most ES traffic comes from processes that don't belong to the build and got muted already: answer
+                    // their events straight away, without materializing their paths or going through an event queue
+                    pid_t pid;
+                    if (msg != nullptr && IOEvent::PeekPid(msg, msg_length, pid) && pid != hostPid_ && mutedPidCallback_(sandbox, pid))
+                    {
+                        xpc_dictionary_set_uint64(reply, "response", xpc_response_mute_process);
+                        xpc_connection_send_message((xpc_connection_t) peer, reply);
+                        xpc_release(reply);
+                        return;
+                    }
 
-                    uint64_t response = xpc_response_error;
-                    switch (result)
+                    IOEvent event;
+                    if (msg == nullptr || !IOEvent::Deserialize(msg, msg_length, event))
                     {
-                        case ProcessCallbackResult::Done:
-                            response = xpc_response_success;
-                            break;
-                        case ProcessCallbackResult::MuteSource:
-                            response = xpc_response_mute_process;
-                            break;
-                        case ProcessCallbackResult::Auth:
-                            response = xpc_response_auth;
-                            break;
+                        log_error("Received a malformed IOEvent of length %zu", msg_length);
+                        xpc_dictionary_set_uint64(reply, "response", xpc_response_error);
+                        xpc_connection_send_message((xpc_connection_t) peer, reply);
+                        xpc_release(reply);
+                        return;
                     }
 
-                    xpc_object_t reply = xpc_dictionary_create_reply(message);
-                    xpc_dictionary_set_uint64(reply, "response", response);
-                    xpc_connection_send_message((xpc_connection_t) peer, reply);
+                    // The EndpointSecurity extension doesn't wait for replies before sending more events, so events are processed
+                    // on the queue of their process tree and replied to from there
+                    process_callback eventCallback = eventCallback_;
+                    pid_t hostPid = hostPid_;
+                    xpc_retain(peer);
+                    dispatch_async(eventQueueCallback_(sandbox, event), ^{
+                        ProcessCallbackResult result = eventCallback != nullptr ? eventCallback(sandbox, event, hostPid, IOEventBacking::EndpointSecurity) : ProcessCallbackResult::Done;
+
+                        uint64_t response = xpc_response_success;
+                        switch (result)
+                        {
+                            case ProcessCallbackResult::Done:
+                                response = xpc_response_success;
+                                break;
+                            case ProcessCallbackResult::MuteSource:
+                                response = xpc_response_mute_process;
+                                break;
+                            case ProcessCallbackResult::Auth:
+                                response = xpc_response_auth;
+                                break;
+                            case ProcessCallbackResult::AuthUnmutePaths:
+                                response = xpc_response_auth_unmute_paths;
+                                break;
+                            case ProcessCallbackResult::AuthCache:
+                                response = xpc_response_auth_cache;
+                                break;
+                        }
+
+                        xpc_dictionary_set_uint64(reply, "response", response);
+                        xpc_connection_send_message((xpc_connection_t) peer, reply);
+                        xpc_release(reply);
+                        xpc_release(peer);
+                    });
                 }
                 else if (type == XPC_TYPE_ERROR)
                 {
@@ -115,6 +150,45 @@ EndpointSecuritySandbox::EndpointSecuritySandbox(pid_t host_pid, process_callbac
     }
 }
 
+void EndpointSecuritySandbox::ClearCache()
+{
+    xpc_object_t post = xpc_dictionary_create(NULL, NULL, 0);
+    xpc_dictionary_set_uint64(post, "command", xpc_clear_es_cache);
+
+    xpc_object_t response = xpc_connection_send_message_with_reply_sync(xpc_bridge_, post);
+    if (xpc_get_type(response) != XPC_TYPE_DICTIONARY || xpc_dictionary_get_uint64(response, "response") != xpc_response_success)
+    {
+        log_error("%s", "Failed clearing the EndpointSecurity auth result cache - sandboxing is no longer reliable!");
+    }
+
+    xpc_release(response);
+    xpc_release(post);
+}
+
+void EndpointSecuritySandbox::SetEventDemand(uint64_t demand, bool waitForReply)
+{
+    xpc_object_t post = xpc_dictionary_create(NULL, NULL, 0);
+    xpc_dictionary_set_uint64(post, "command", xpc_set_es_event_demand);
+    xpc_dictionary_set_uint64(post, ESEventDemandKey, demand);
+
+    if (waitForReply)
+    {
+        xpc_object_t response = xpc_connection_send_message_with_reply_sync(xpc_bridge_, post);
+        if (xpc_get_type(response) != XPC_TYPE_DICTIONARY || xpc_dictionary_get_uint64(response, "response") != xpc_response_success)
+        {
+            log_error("Failed subscribing to the EndpointSecurity events of demand %#llx - sandboxing is no longer reliable!", demand);
+        }
+
+        xpc_release(response);
+    }
+    else
+    {
+        xpc_connection_send_message(xpc_bridge_, post);
+    }
+
+    xpc_release(post);
+}
+
 EndpointSecuritySandbox::~EndpointSecuritySandbox()
 {
     xpc_object_t post = xpc_dictionary_create(NULL, NULL, 0);
@@ -133,6 +207,7 @@ EndpointSecuritySandbox::~EndpointSecuritySandbox()
     }
 
     eventCallback_ = nullptr;
+    eventQueueCallback_ = nullptr;
 
     log_debug("%s", "Successfully shut-down EndpointSecurity sandbox subsystem.");
 }
@@ -14,6 +14,8 @@ private:
     pid_t hostPid_;
     dispatch_queue_t eventQueue_ = nullptr;
     process_callback eventCallback_ = nullptr;
+    event_queue_callback eventQueueCallback_ = nullptr;
+    muted_pid_callback mutedPidCallback_ = nullptr;
     
 #if __APPLE__
     xpc_connection_t xpc_bridge_ = nullptr;
@@ -26,7 +28,20 @@ public:
     ~EndpointSecuritySandbox();
     
 #if __APPLE__
-    EndpointSecuritySandbox(pid_t host_pid, process_callback callback, void *sandbox, xpc_connection_t bridge);
+    EndpointSecuritySandbox(pid_t host_pid, process_callback callback, event_queue_callback queue_callback, muted_pid_callback muted_callback,
+                            void *sandbox, xpc_connection_t bridge);
+
+    /*!
+     * Drops the auth results the ES clients let EndpointSecurity cache (see ProcessCallbackResult::AuthCache), so the opens they
+     * covered get delivered again.  Returns once the clients are done.
+     */
+    void ClearCache();
+
+    /*!
+     * Has the ES clients subscribe to the events of the kinds of accesses in 'demand' (ESEventDemand bits) and drop the others.
+     * With 'waitForReply' this returns once the events are subscribed to, otherwise right away (for demand that only drops events).
+     */
+    void SetEventDemand(uint64_t demand, bool waitForReply);
 #endif
 };
 
@@ -23,14 +23,17 @@ static ProcessCallbackResult _process_event(Sandbox *sandbox, const IOEvent &eve
 
     bool isInterposedEvent = backing == IOEventBacking::Interposing;
 
-    bool ppid_found = sandbox->GetAllowlistedPidMap().find(event.GetParentPid()) != sandbox->GetAllowlistedPidMap().end();
-    bool original_ppid_found = sandbox->GetAllowlistedPidMap().find(event.GetOriginalParentPid()) != sandbox->GetAllowlistedPidMap().end();
+    ProcessPidTable &pids = sandbox->GetProcessPids();
 
-    size_t msg_length = IOEvent::max_size();
-    char msg[msg_length];
+    // Processes that were muted stay muted, so the ES events still in flight for them only cost a single probe
+    if (!isInterposedEvent && pids.IsMarkedUntracked(pid))
+    {
+        return ProcessCallbackResult::MuteSource;
+    }
 
-    omemorystream oms(msg, sizeof(msg));
-    oms << event;
+    bool ppid_found = pids.Contains(PidSet::Allowlisted, event.GetParentPid());
+    bool original_ppid_found = !ppid_found && event.GetOriginalParentPid() != event.GetParentPid() &&
+                               pids.Contains(PidSet::Allowlisted, event.GetOriginalParentPid());
 
     if (isInterposedEvent || (ppid_found || original_ppid_found))
     {
@@ -44,14 +47,14 @@ static ProcessCallbackResult _process_event(Sandbox *sandbox, const IOEvent &eve
             // the posix_spawn* call returns, we have to manually add a fork event here if the parent of the binary in question is
             // already being tracked.
 
-            if (event.GetEventType() == ES_EVENT_TYPE_NOTIFY_FORK && !sandbox->GetForceForkedPidMap().empty())
+            if (event.GetEventType() == ES_EVENT_TYPE_NOTIFY_FORK && pids.Count(PidSet::ForceForked) > 0)
             {
-                auto it = sandbox->GetForceForkedPidMap().find(event.GetChildPid());
-                if (it != sandbox->GetForceForkedPidMap().end())
+                pid_t forcedParentPid;
+                if (pids.TryGet(PidSet::ForceForked, event.GetChildPid(), &forcedParentPid))
                 {
-                    if (it->first == event.GetChildPid() && it->second == event.GetPid())
+                    if (forcedParentPid == event.GetPid())
                     {
-                        sandbox->RemoveProcessPid(sandbox->GetForceForkedPidMap(), event.GetChildPid());
+                        pids.Remove(PidSet::ForceForked, event.GetChildPid());
 
                         log_debug("Ignoring fork event, previously forced fork for child PID(%d) and PPID(%d) with path: %{public}s",
                                   event.GetChildPid(), event.GetPid(), event.GetExecutablePath());
@@ -72,12 +75,13 @@ static ProcessCallbackResult _process_event(Sandbox *sandbox, const IOEvent &eve
                     log_debug("Forced fork event for child PID(%d) and PPID(%d) with path: %{public}s",
                               fork_event.GetChildPid(), fork_event.GetPid(), fork_event.GetExecutablePath());
 
-                    sandbox->GetForceForkedPidMap().emplace(fork_event.GetChildPid(), fork_event.GetPid());
+                    pids.Add(PidSet::ForceForked, fork_event.GetChildPid(), fork_event.GetPid());
                     handler.HandleEvent(fork_event);
                 }
             }
         }
 
+        bool unmutePaths = false;
         if (handler.TryInitializeWithTrackedProcess(pid))
         {
     #pragma clang diagnostic push
@@ -89,11 +93,14 @@ static ProcessCallbackResult _process_event(Sandbox *sandbox, const IOEvent &eve
                 {
                     case ES_EVENT_TYPE_NOTIFY_FORK:
                     {
-                        sandbox->SetProcessPidPair(sandbox->GetAllowlistedPidMap(), pid, event.GetParentPid());
+                        pids.Add(PidSet::Allowlisted, pid, event.GetParentPid());
                         break;
                     }
                     case ES_EVENT_TYPE_NOTIFY_EXIT:
-                        sandbox->RemoveProcessPid(sandbox->GetAllowlistedPidMap(), pid);
+                        pids.Remove(PidSet::Allowlisted, pid);
+                        break;
+                    case ES_EVENT_TYPE_AUTH_EXEC:
+                        unmutePaths = IsMutedExecutablePath(event.GetEventPath());
                         break;
                 }
             }
@@ -104,18 +111,21 @@ static ProcessCallbackResult _process_event(Sandbox *sandbox, const IOEvent &eve
         }
         else
         {
-            // TODO: Delete
-            size_t msg_length = IOEvent::max_size();
-            char msg[msg_length];
+            log_debug("Not tracked: PID(%d) PPID(%d) Type(%d) Path: %{public}s",
+                      event.GetPid(), event.GetParentPid(), event.GetEventType(), event.GetEventPath());
+        }
 
-            omemorystream oms(msg, sizeof(msg));
-            oms << event;
-            log_debug("Not tracked: %{public}.*s",(int) event.Size(), msg);
+        if (unmutePaths)
+        {
+            log_debug("Tracked process PID(%d) executes muted path %{public}s, unmuting all paths", pid, event.GetEventPath());
+            return ProcessCallbackResult::AuthUnmutePaths;
         }
 
         if (event.GetActionType() == ES_ACTION_TYPE_AUTH)
         {
-            return ProcessCallbackResult::Auth;
+            return !isInterposedEvent && event.GetEventType() == ES_EVENT_TYPE_AUTH_OPEN && sandbox->IsUntrackedForAllPips(event.GetEventPath())
+                ? ProcessCallbackResult::AuthCache
+                : ProcessCallbackResult::Auth;
         }
     }
     else
@@ -125,6 +135,7 @@ static ProcessCallbackResult _process_event(Sandbox *sandbox, const IOEvent &eve
             case IOEventBacking::EndpointSecurity:
             {
                 log_debug("Muting process PID(%d), PPID(%d) %{public}s", event.GetPid(), event.GetParentPid(), event.GetExecutablePath());
+                pids.MarkUntracked(pid);
                 return ProcessCallbackResult::MuteSource;
                 break;
             }
@@ -139,24 +150,23 @@ static ProcessCallbackResult _process_event(Sandbox *sandbox, const IOEvent &eve
     return ProcessCallbackResult::Done;
 }
 
-static ProcessCallbackResult process_event(void *handle, const IOEvent event, pid_t host, IOEventBacking backing)
+static ProcessCallbackResult process_event(void *handle, const IOEvent &event, pid_t host, IOEventBacking backing)
 {
-    Sandbox* sandbox = (Sandbox *) handle;
-#if __APPLE__
-    if (sandbox->IsRunningHybrid())
-    {
-        dispatch_async(sandbox->GetHybridQueue(), ^{
-            // TODO: We can't mute processes when merging ES and detours events asynchronously without introducing some async callback
-            _process_event(sandbox, event, host, backing);
-        });
+    // ES and interposing events of a process tree are already merged on the same event queue (see Sandbox::GetEventQueue),
+    // so hybrid mode can process them synchronously too and mute sources like the ES-only mode does
+    return _process_event((Sandbox *) handle, event, host, backing);
+}
 
-        return ProcessCallbackResult::Done;
-    }
-    else
-#endif
-    {
-        return _process_event(sandbox, event, host, backing);
-    }
+static bool is_muted_pid(void *handle, pid_t pid)
+{
+    return ((Sandbox *) handle)->GetProcessPids().IsMarkedUntracked(pid);
 }
 
+#if __APPLE__
+static dispatch_queue_t event_queue_for(void *handle, const IOEvent &event)
+{
+    return ((Sandbox *) handle)->GetEventQueue(event);
+}
+#endif
+
 #endif /* EventProcessor_h */
@@ -21,12 +21,31 @@ PolicySearchCursor AccessHandler::FindManifestRecord(const char *absolutePath, s
     const char *pathWithoutRootSentinel = absolutePath + 1;
 
     size_t len = pathLength == -1 ? strlen(pathWithoutRootSentinel) : pathLength;
-    return FindFileAccessPolicyInTreeEx(GetPip()->GetManifestRecord(), pathWithoutRootSentinel, len);
+
+    // Resume the search for the final component from the cursor of its parent directory, which the process keeps
+    // for the directory it last accessed (e.g., both paths of an atomic rename, or a run of sibling files).
+    // Searching "a/b" and then resuming with "c" yields the same cursor as searching "a/b/c" from the root.
+    const char *lastSeparator = pathWithoutRootSentinel + len;
+    while (lastSeparator > pathWithoutRootSentinel && *lastSeparator != '/')
+    {
+        lastSeparator--;
+    }
+
+    if (lastSeparator == pathWithoutRootSentinel)
+    {
+        return FindFileAccessPolicyInTreeEx(GetPip()->GetManifestRecord(), pathWithoutRootSentinel, len);
+    }
+
+    size_t directoryLength = lastSeparator - pathWithoutRootSentinel;
+    PolicySearchCursor directoryCursor = process_->FindDirectoryCursor(GetPip()->GetManifestRecord(), pathWithoutRootSentinel, directoryLength);
+    return FindFileAccessPolicyInTreeEx(directoryCursor, lastSeparator + 1, len - directoryLength - 1);
 }
 
-void AccessHandler::SetProcessPath(AccessReport *report)
+void AccessHandler::SetProcessPath(AccessReportGroup &group, CompactAccessReport &report)
 {
-    strlcpy(report->path, process_->GetPath(), sizeof(report->path));
+    // The entry is interned once per exec and knows its length, so there is no need to scan it again here
+    std::shared_ptr<const PathCacheEntry> path = process_->GetPath();
+    group.paths.SetPath(report, path->GetPath(), path->GetPathLength());
 }
 
 ReportResult AccessHandler::CreateReportFileOpAccess(FileOperation operation,
@@ -35,7 +54,8 @@ ReportResult AccessHandler::CreateReportFileOpAccess(FileOperation operation,
                                                pid_t processID,
                                                uint isDirectory,
                                                uint error,
-                                               AccessReport &accessReport)
+                                               AccessReportGroup &group,
+                                               CompactAccessReport &accessReport)
 {
     accessReport.operation          = operation;
     accessReport.pid                = processID;
@@ -45,25 +65,24 @@ ReportResult AccessHandler::CreateReportFileOpAccess(FileOperation operation,
     accessReport.reportExplicitly   = checkResult.Level == ReportLevel::ReportExplicit;
     accessReport.error              = error;
     accessReport.pipId              = GetPipId();
-    accessReport.stats              = {0};
+    accessReport.stats              = { .creationTime = creationTime_ };
     accessReport.isDirectory        = isDirectory;
     accessReport.shouldReport       = checkResult.ShouldReport();
-    std::fill_n(accessReport.path, MAXPATHLEN, 0);
 
     assert(strlen(policyResult.Path()) > 0);
-    strlcpy(accessReport.path, policyResult.Path(), sizeof(accessReport.path));
+    group.paths.SetPath(accessReport, policyResult.Path());
 
     return kReported;
 }
 
-ReportResult AccessHandler::SendReport(AccessReport& report)
+ReportResult AccessHandler::SendReport(AccessReportGroup &group, CompactAccessReport &report)
 {
-    sandbox_->SendAccessReport(report, GetPip());
+    sandbox_->SendAccessReport(report, group.PathOf(report), GetPip());
 
     return kReported;
 }
 
-bool AccessHandler::CreateReportProcessTreeCompleted(pid_t processId, AccessReport &accessReport)
+bool AccessHandler::CreateReportProcessTreeCompleted(pid_t processId, AccessReportGroup &group, CompactAccessReport &accessReport)
 {
     accessReport.operation        = kOpProcessTreeCompleted;
     accessReport.pid              = processId;
@@ -73,17 +92,16 @@ bool AccessHandler::CreateReportProcessTreeCompleted(pid_t processId, AccessRepo
     accessReport.reportExplicitly = 0;
     accessReport.error            = 0;
     accessReport.pipId            = GetPipId();
-    accessReport.stats            = {0};
+    accessReport.stats            = { .creationTime = creationTime_ };
     accessReport.isDirectory      = 0;
     accessReport.shouldReport     = true;
-    std::fill_n(accessReport.path, MAXPATHLEN, 0);
 
-    SetProcessPath(&accessReport);
+    SetProcessPath(group, accessReport);
 
     return kReported;
 }
 
-bool AccessHandler::CreateReportProcessExited(pid_t childPid, AccessReport &accessReport)
+bool AccessHandler::CreateReportProcessExited(pid_t childPid, AccessReportGroup &group, CompactAccessReport &accessReport)
 {
     accessReport.operation        = kOpProcessExit;
     accessReport.pid              = childPid;
@@ -93,17 +111,16 @@ bool AccessHandler::CreateReportProcessExited(pid_t childPid, AccessReport &acce
     accessReport.reportExplicitly = 0;
     accessReport.error            = 0;
     accessReport.pipId            = GetPipId();
-    accessReport.stats            = {0};
+    accessReport.stats            = { .creationTime = creationTime_ };
     accessReport.isDirectory      = 0;
     accessReport.shouldReport     = true;
-    std::fill_n(accessReport.path, MAXPATHLEN, 0);
 
-    SetProcessPath(&accessReport);
+    SetProcessPath(group, accessReport);
 
     return kReported;
 }
 
-bool AccessHandler::CreateReportChildProcessSpawned(pid_t childPid, AccessReport &accessReport)
+bool AccessHandler::CreateReportChildProcessSpawned(pid_t childPid, AccessReportGroup &group, CompactAccessReport &accessReport)
 {
     accessReport.operation          = kOpProcessStart;
     accessReport.pid                = childPid;
@@ -113,13 +130,12 @@ bool AccessHandler::CreateReportChildProcessSpawned(pid_t childPid, AccessReport
     accessReport.reportExplicitly   = 0;
     accessReport.error              = 0;
     accessReport.pipId              = GetPipId();
-    accessReport.stats              = {0};
+    accessReport.stats              = { .creationTime = creationTime_ };
     accessReport.isDirectory        = 0;
     accessReport.shouldReport       = true;
-    std::fill_n(accessReport.path, MAXPATHLEN, 0);
 
-    SetProcessPath(&accessReport);
-    assert(strlen(accessReport.path) > 0);
+    SetProcessPath(group, accessReport);
+    assert(accessReport.pathLength > 0);
 
 
     return kReported;
@@ -136,6 +152,47 @@ PolicyResult AccessHandler::PolicyForPath(const char *absolutePath)
     return PolicyResult(GetPip()->GetFamFlags(), GetPip()->GetFamExtraFlags(), absolutePath, cursor);
 }
 
+bool AccessHandler::IsUniformWritableCone(const char *absolutePath)
+{
+    PolicySearchCursor cursor = FindManifestRecord(absolutePath);
+    if (!cursor.IsValid())
+    {
+        return false;
+    }
+
+    // A truncated search means there is no node for the path, so none for its descendants either. Otherwise the node must be a leaf.
+    if (!cursor.SearchWasTruncated && cursor.Record->BucketCount != 0)
+    {
+        return false;
+    }
+
+    FileAccessPolicy conePolicy = cursor.Record->GetConePolicy();
+    return (conePolicy & FileAccessPolicy_AllowWrite) != 0
+        && (conePolicy & FileAccessPolicy_OverrideAllowWriteForExistingFiles) == 0;
+}
+
+bool AccessHandler::IsUntrackedCone(const char *absolutePath)
+{
+    if (CheckReportAllFileAccesses(GetFamFlags()))
+    {
+        return false;
+    }
+
+    PolicySearchCursor cursor = FindManifestRecord(absolutePath);
+    if (!cursor.IsValid() || (!cursor.SearchWasTruncated && cursor.Record->BucketCount != 0))
+    {
+        return false;
+    }
+
+    return IsUntrackedPolicy(cursor.Record->GetConePolicy());
+}
+
+bool AccessHandler::IsUntrackedPolicy(FileAccessPolicy policy)
+{
+    return (policy & FileAccessPolicy_AllowAll) == FileAccessPolicy_AllowAll
+        && (policy & (FileAccessPolicy_ReportAccess | FileAccessPolicy_ReportDirectoryEnumerationAccess | FileAccessPolicy_OverrideAllowWriteForExistingFiles)) == 0;
+}
+
 static bool is_prefix(const char *s1, const char *s2)
 {
     int c;
@@ -167,13 +224,20 @@ AccessCheckResult AccessHandler::CheckAndCreateReportInternal(FileOperation oper
                                                         const pid_t pid,
                                                         bool isDir,
                                                         uint error,
-                                                        AccessReport &accessToReport)
+                                                        AccessReportGroup &group,
+                                                        CompactAccessReport &accessToReport,
+                                                        const mode_t *observedMode)
 {
     PolicyResult policy = PolicyForPath(IgnoreDataPartitionPrefix(path));
+    if (observedMode != nullptr)
+    {
+        policy.SetObservedMode(*observedMode);
+    }
+
     AccessCheckResult result = AccessCheckResult::Invalid();
     checker(policy, isDir, &result);
 
-    CreateReportFileOpAccess(operation, policy, result, pid, (uint)isDir, error, accessToReport);
+    CreateReportFileOpAccess(operation, policy, result, pid, (uint)isDir, error, group, accessToReport);
 
     return result;
 }
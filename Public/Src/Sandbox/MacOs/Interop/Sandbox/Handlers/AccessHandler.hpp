@@ -30,6 +30,9 @@ private:
 
     std::shared_ptr<SandboxedProcess> process_;
 
+    // When the observation this handler was created for got picked up: the creation time of the reports it creates
+    uint64_t creationTime_;
+
 protected:
 
     ReportResult CreateReportFileOpAccess(FileOperation operation,
@@ -38,9 +41,10 @@ protected:
                                     pid_t processID,
                                     uint isDirectory,
                                     uint error,
-                                    AccessReport &accessReport);
+                                    AccessReportGroup &group,
+                                    CompactAccessReport &accessReport);
 
-    ReportResult SendReport(AccessReport& report);
+    ReportResult SendReport(AccessReportGroup &group, CompactAccessReport &report);
 
     inline Sandbox* GetSandbox()                                const { return sandbox_; }
     inline const std::shared_ptr<SandboxedProcess> GetProcess() const { return process_; }
@@ -49,9 +53,9 @@ protected:
     PolicySearchCursor FindManifestRecord(const char *absolutePath, size_t pathLength = -1);
 
     /*!
-     * Copies 'process_->getPath()' into 'report->path'.
+     * Copies 'process_->getPath()' into the arena of 'group' as the path of 'report'.
      */
-    void SetProcessPath(AccessReport *report);
+    void SetProcessPath(AccessReportGroup &group, CompactAccessReport &report);
 
     /*!
      * Template for checking and creating a file access report. The report is created but not sent
@@ -65,6 +69,8 @@ protected:
      * @param pid The id of the process belonging to this I/O obsevation
      * @param isDir Indicates if the report is being generated for a directory or file
      * @param error errno of the operation
+     * @param group Group 'accessToReport' belongs to, its path goes to the arena of the group
+     * @param observedMode Mode of 'path' as the sandbox read it from the file system for this access, if it did (see IOEvent::GetObservedMode)
      */
     AccessCheckResult CheckAndCreateReportInternal(FileOperation operation,
                                      const char *path,
@@ -72,11 +78,14 @@ protected:
                                      const pid_t pid,
                                      bool isDir,
                                      uint error,
-                                     AccessReport &accessToReport);
+                                     AccessReportGroup &group,
+                                     CompactAccessReport &accessToReport,
+                                     const mode_t *observedMode);
 
-    inline AccessCheckResult CheckAndCreateReport(FileOperation operation, const char *path, CheckFunc checker, const pid_t pid, bool isDir, uint error, AccessReport &accessToReport)
+    inline AccessCheckResult CheckAndCreateReport(FileOperation operation, const char *path, CheckFunc checker, const pid_t pid, bool isDir, uint error, AccessReportGroup &group, CompactAccessReport &accessToReport,
+                                                  const mode_t *observedMode = nullptr)
     {
-        return CheckAndCreateReportInternal(operation, path, checker, pid, isDir, error, accessToReport);
+        return CheckAndCreateReportInternal(operation, path, checker, pid, isDir, error, group, accessToReport, observedMode);
     }
 
 public:
@@ -87,6 +96,7 @@ public:
     {
         sandbox_           = sandbox;
         process_           = nullptr;
+        creationTime_      = Sandbox::ReportTimestamp();
     }
 
     ~AccessHandler()
@@ -117,9 +127,31 @@ public:
 
     PolicyResult PolicyForPath(const char *absolutePath);
 
-    bool CreateReportProcessTreeCompleted(pid_t processId, AccessReport &accessReport);
-    bool CreateReportProcessExited(pid_t childPid, AccessReport &accessReport);
-    bool CreateReportChildProcessSpawned(pid_t childPid, AccessReport &accessReport);
+    /*!
+     * Whether every path under 'absolutePath' gets the same policy, that policy allows writes and it doesn't depend on
+     * whether files exist. This is the case when the manifest has no nodes below 'absolutePath'.
+     *
+     * A move of such a directory into another such directory can be checked and reported once, as a move of its root,
+     * instead of once per file: the outcome would be the same for every file under it.
+     */
+    bool IsUniformWritableCone(const char *absolutePath);
+
+    /*!
+     * Whether no access to 'absolutePath' or anything under it can produce a report: every path under it gets the same policy,
+     * which allows everything without asking for reports, and the manifest doesn't ask for every access to be reported.
+     *
+     * Observers that can filter accesses before they get checked (e.g. by not listening to a whole file system) can drop such accesses.
+     */
+    bool IsUntrackedCone(const char *absolutePath);
+
+    /*!
+     * Whether a path with the given policy can be accessed in any way without producing a report (see IsUntrackedCone)
+     */
+    static bool IsUntrackedPolicy(FileAccessPolicy policy);
+
+    bool CreateReportProcessTreeCompleted(pid_t processId, AccessReportGroup &group, CompactAccessReport &accessReport);
+    bool CreateReportProcessExited(pid_t childPid, AccessReportGroup &group, CompactAccessReport &accessReport);
+    bool CreateReportChildProcessSpawned(pid_t childPid, AccessReportGroup &group, CompactAccessReport &accessReport);
 };
 
 #endif /* AccessHandler_hpp */
@@ -7,7 +7,7 @@
 
 static AccessCheckResult s_allowedCheckResult(RequestedAccess::None, ResultAction::Allow, ReportLevel::Report);
 
-AccessCheckResult IOHandler::HandleProcessFork(const IOEvent &event, AccessReport &accessToReport)
+AccessCheckResult IOHandler::HandleProcessFork(const IOEvent &event, AccessReportGroup &group)
 {
     if (GetPip()->AllowChildProcessesToBreakAway())
     {
@@ -17,58 +17,61 @@ AccessCheckResult IOHandler::HandleProcessFork(const IOEvent &event, AccessRepor
     pid_t childProcessPid = event.GetChildPid();
     if (GetSandbox()->TrackChildProcess(childProcessPid, event.GetExecutablePath(), GetProcess()))
     {
-        CreateReportChildProcessSpawned(childProcessPid, accessToReport);
+        CreateReportChildProcessSpawned(childProcessPid, group, group.firstReport);
     }
 
     return s_allowedCheckResult;
 }
 
-AccessCheckResult IOHandler::HandleProcessExec(const IOEvent &event, AccessReport &accessToReport)
+AccessCheckResult IOHandler::HandleProcessExec(const IOEvent &event, AccessReportGroup &group)
 {
-    GetProcess()->SetPath(event.GetExecutablePath());
-    CreateReportChildProcessSpawned(GetProcess()->GetPid(), accessToReport);
+    GetProcess()->SetPath(GetSandbox()->InternPath(event.GetExecutablePath(), strlen(event.GetExecutablePath())));
+    CreateReportChildProcessSpawned(GetProcess()->GetPid(), group, group.firstReport);
     return s_allowedCheckResult;
 }
 
-AccessCheckResult IOHandler::HandleProcessExit(const IOEvent &event, AccessReport &processExitReport, AccessReport &processTreeCompletedReport)
+AccessCheckResult IOHandler::HandleProcessExit(const IOEvent &event, AccessReportGroup &group)
 {
     pid_t pid = event.GetPid();
 
-    CreateReportProcessExited(pid, processExitReport);
-    HandleProcessUntracked(pid, processTreeCompletedReport);
+    CreateReportProcessExited(pid, group, group.firstReport);
+    HandleProcessUntracked(pid, group, group.secondReport);
 
     return s_allowedCheckResult;
 }
 
-AccessCheckResult IOHandler::HandleProcessUntracked(const pid_t pid, AccessReport &accessToReport)
+AccessCheckResult IOHandler::HandleProcessUntracked(const pid_t pid, AccessReportGroup &group, CompactAccessReport &accessToReport)
 {
     GetSandbox()->UntrackProcess(pid, GetProcess());
     if (GetPip()->GetTreeSize() == 0)
     {
-        CreateReportProcessTreeCompleted(GetPip()->GetProcessId(), accessToReport);
+        CreateReportProcessTreeCompleted(GetPip()->GetProcessId(), group, accessToReport);
     }
     return s_allowedCheckResult;
 }
 
 AccessCheckResult IOHandler::HandleProcessUntracked(const pid_t pid)
 {
-    AccessReport accessReport;
+    AccessReportGroup report;
 
-    AccessCheckResult result = HandleProcessUntracked(pid, accessReport);
+    AccessCheckResult result = HandleProcessUntracked(pid, report, report.firstReport);
 
-    GetSandbox()->SendAccessReport(accessReport, GetPip());
+    if (report.firstReport.shouldReport)
+    {
+        SendReport(report, report.firstReport);
+    }
 
     return result;
 }
 
 #pragma mark Process I/O observation
 
-AccessCheckResult IOHandler::HandleLookup(const IOEvent &event, AccessReport &accessToReport)
+AccessCheckResult IOHandler::HandleLookup(const IOEvent &event, AccessReportGroup &group)
 {
-    return CheckAndCreateReport(kOpMacLookup, event.GetEventPath(SRC_PATH), Checkers::CheckLookup, event.GetPid(), /*isDir*/ false, event.GetError(), accessToReport);
+    return CheckAndCreateReport(kOpMacLookup, event.GetEventPath(SRC_PATH), Checkers::CheckLookup, event.GetPid(), /*isDir*/ false, event.GetError(), group, group.firstReport);
 }
 
-AccessCheckResult IOHandler::HandleOpen(const IOEvent &event, AccessReport &accessToReport)
+AccessCheckResult IOHandler::HandleOpen(const IOEvent &event, AccessReportGroup &group)
 {
     if (!event.EventPathExists())
     {
@@ -83,10 +86,10 @@ AccessCheckResult IOHandler::HandleOpen(const IOEvent &event, AccessReport &acce
             CheckFunc checker = isDir ? Checkers::CheckEnumerateDir : Checkers::CheckRead;
             FileOperation op  = isDir ? kOpKAuthOpenDir : kOpKAuthReadFile;
 
-            return CheckAndCreateReport(op, event.GetEventPath(SRC_PATH), checker, event.GetPid(), isDir, event.GetError(), accessToReport);
+            return CheckAndCreateReport(op, event.GetEventPath(SRC_PATH), checker, event.GetPid(), isDir, event.GetError(), group, group.firstReport);
         }
 
-        return CheckAndCreateReport(kOpMacLookup, event.GetEventPath(SRC_PATH), Checkers::CheckLookup, event.GetPid(), false, event.GetError(), accessToReport);
+        return CheckAndCreateReport(kOpMacLookup, event.GetEventPath(SRC_PATH), Checkers::CheckLookup, event.GetPid(), false, event.GetError(), group, group.firstReport);
     }
 
     bool isDir = S_ISDIR(event.GetMode());
@@ -94,69 +97,69 @@ AccessCheckResult IOHandler::HandleOpen(const IOEvent &event, AccessReport &acce
     CheckFunc checker = isDir ? Checkers::CheckEnumerateDir : Checkers::CheckRead;
     FileOperation op  = isDir ? kOpKAuthOpenDir : kOpKAuthReadFile;
 
-    return CheckAndCreateReport(op, event.GetEventPath(SRC_PATH), checker, event.GetPid(), isDir, event.GetError(), accessToReport);
+    return CheckAndCreateReport(op, event.GetEventPath(SRC_PATH), checker, event.GetPid(), isDir, event.GetError(), group, group.firstReport);
 }
 
-AccessCheckResult IOHandler::HandleClose(const IOEvent &event, AccessReport &accessToReport)
+AccessCheckResult IOHandler::HandleClose(const IOEvent &event, AccessReportGroup &group)
 {
     if (event.FSEntryModified())
     {
-        return CheckAndCreateReport(kOpKAuthCloseModified, event.GetEventPath(SRC_PATH), Checkers::CheckWrite, event.GetPid(), /*isDir*/ false, event.GetError(), accessToReport);
+        return CheckAndCreateReport(kOpKAuthCloseModified, event.GetEventPath(SRC_PATH), Checkers::CheckWrite, event.GetPid(), /*isDir*/ false, event.GetError(), group, group.firstReport, event.GetObservedMode());
     }
 
     bool isDir = S_ISDIR(event.GetMode());
-    return CheckAndCreateReport(kOpKAuthClose, event.GetEventPath(SRC_PATH), Checkers::CheckRead, event.GetPid(), isDir, event.GetError(), accessToReport);
+    return CheckAndCreateReport(kOpKAuthClose, event.GetEventPath(SRC_PATH), Checkers::CheckRead, event.GetPid(), isDir, event.GetError(), group, group.firstReport);
 }
 
-AccessCheckResult IOHandler::HandleLink(const IOEvent &event, AccessReport &sourceAccessToReport, AccessReport &destinationAccessToReport)
+AccessCheckResult IOHandler::HandleLink(const IOEvent &event, AccessReportGroup &group)
 {
     bool isDir = S_ISDIR(event.GetMode());
     
-    AccessCheckResult sourceResult = CheckAndCreateReport(kOpKAuthCreateHardlinkSource, event.GetEventPath(SRC_PATH), Checkers::CheckRead, event.GetPid(), isDir, event.GetError(), sourceAccessToReport);
-    AccessCheckResult destResult = CheckAndCreateReport(kOpKAuthCreateHardlinkDest, event.GetEventPath(DST_PATH), Checkers::CheckWrite, event.GetPid(), isDir, event.GetError(), destinationAccessToReport);
+    AccessCheckResult sourceResult = CheckAndCreateReport(kOpKAuthCreateHardlinkSource, event.GetEventPath(SRC_PATH), Checkers::CheckRead, event.GetPid(), isDir, event.GetError(), group, group.firstReport);
+    AccessCheckResult destResult = CheckAndCreateReport(kOpKAuthCreateHardlinkDest, event.GetEventPath(DST_PATH), Checkers::CheckWrite, event.GetPid(), isDir, event.GetError(), group, group.secondReport);
     
     return AccessCheckResult::Combine(sourceResult, destResult);
 }
 
-AccessCheckResult IOHandler::HandleUnlink(const IOEvent &event, AccessReport &accessToReport)
+AccessCheckResult IOHandler::HandleUnlink(const IOEvent &event, AccessReportGroup &group)
 {
     bool isDir = S_ISDIR(event.GetMode());
     FileOperation operation = isDir ? kOpKAuthDeleteDir : kOpKAuthDeleteFile;
-    return CheckAndCreateReport(operation, event.GetEventPath(SRC_PATH), Checkers::CheckWrite, event.GetPid(), isDir, event.GetError(), accessToReport);
+    return CheckAndCreateReport(operation, event.GetEventPath(SRC_PATH), Checkers::CheckWrite, event.GetPid(), isDir, event.GetError(), group, group.firstReport, event.GetObservedMode());
 }
 
-AccessCheckResult IOHandler::HandleReadlink(const IOEvent &event, AccessReport &accessToReport)
+AccessCheckResult IOHandler::HandleReadlink(const IOEvent &event, AccessReportGroup &group)
 {
-    return CheckAndCreateReport(kOpMacReadlink, event.GetEventPath(SRC_PATH), Checkers::CheckRead, event.GetPid(), false, event.GetError(), accessToReport);
+    return CheckAndCreateReport(kOpMacReadlink, event.GetEventPath(SRC_PATH), Checkers::CheckRead, event.GetPid(), false, event.GetError(), group, group.firstReport);
 }
 
-AccessCheckResult IOHandler::HandleRename(const IOEvent &event, AccessReport &sourceAccessToReport, AccessReport &destinationAccessToReport)
+AccessCheckResult IOHandler::HandleRename(const IOEvent &event, AccessReportGroup &group)
 {
     bool isDir = S_ISDIR(event.GetMode());
     
-    AccessCheckResult sourceResult = CheckAndCreateReport(kOpKAuthMoveSource, event.GetEventPath(SRC_PATH), Checkers::CheckRead, event.GetPid(), isDir, event.GetError(), sourceAccessToReport);
-    AccessCheckResult destResult = CheckAndCreateReport(kOpKAuthMoveDest, event.GetEventPath(DST_PATH), Checkers::CheckWrite, event.GetPid(), isDir, event.GetError(), destinationAccessToReport);
+    AccessCheckResult sourceResult = CheckAndCreateReport(kOpKAuthMoveSource, event.GetEventPath(SRC_PATH), Checkers::CheckRead, event.GetPid(), isDir, event.GetError(), group, group.firstReport);
+    AccessCheckResult destResult = CheckAndCreateReport(kOpKAuthMoveDest, event.GetEventPath(DST_PATH), Checkers::CheckWrite, event.GetPid(), isDir, event.GetError(), group, group.secondReport);
 
     return AccessCheckResult::Combine(sourceResult, destResult);
 }
 
-AccessCheckResult IOHandler::HandleClone(const IOEvent &event, AccessReport &sourceAccessToReport, AccessReport &destinationAccessToReport)
+AccessCheckResult IOHandler::HandleClone(const IOEvent &event, AccessReportGroup &group)
 {
-    AccessCheckResult sourceResult = CheckAndCreateReport(kOpMacVNodeCloneSource, event.GetEventPath(SRC_PATH), Checkers::CheckReadWrite, event.GetPid(), false, event.GetError(), sourceAccessToReport);
-    AccessCheckResult destResult = CheckAndCreateReport(kOpMacVNodeCloneDest, event.GetEventPath(DST_PATH), Checkers::CheckReadWrite, event.GetPid(), false, event.GetError(), destinationAccessToReport);
+    AccessCheckResult sourceResult = CheckAndCreateReport(kOpMacVNodeCloneSource, event.GetEventPath(SRC_PATH), Checkers::CheckReadWrite, event.GetPid(), false, event.GetError(), group, group.firstReport);
+    AccessCheckResult destResult = CheckAndCreateReport(kOpMacVNodeCloneDest, event.GetEventPath(DST_PATH), Checkers::CheckReadWrite, event.GetPid(), false, event.GetError(), group, group.secondReport);
 
     return AccessCheckResult::Combine(sourceResult, destResult);
 }
 
-AccessCheckResult IOHandler::HandleExchange(const IOEvent &event, AccessReport &sourceAccessToReport, AccessReport &destinationAccessToReport)
+AccessCheckResult IOHandler::HandleExchange(const IOEvent &event, AccessReportGroup &group)
 {
-    AccessCheckResult sourceResult = CheckAndCreateReport(kOpKAuthCopySource, event.GetEventPath(SRC_PATH), Checkers::CheckReadWrite, event.GetPid(), /*isDir*/false, event.GetError(), sourceAccessToReport);
-    AccessCheckResult destResult = CheckAndCreateReport(kOpKAuthCopyDest, event.GetEventPath(DST_PATH), Checkers::CheckReadWrite, event.GetPid(), /*isDir*/false, event.GetError(), destinationAccessToReport);
+    AccessCheckResult sourceResult = CheckAndCreateReport(kOpKAuthCopySource, event.GetEventPath(SRC_PATH), Checkers::CheckReadWrite, event.GetPid(), /*isDir*/false, event.GetError(), group, group.firstReport);
+    AccessCheckResult destResult = CheckAndCreateReport(kOpKAuthCopyDest, event.GetEventPath(DST_PATH), Checkers::CheckReadWrite, event.GetPid(), /*isDir*/false, event.GetError(), group, group.secondReport);
 
     return AccessCheckResult::Combine(sourceResult, destResult);
 }
 
-AccessCheckResult IOHandler::HandleCreate(const IOEvent &event, AccessReport &accessToReport)
+AccessCheckResult IOHandler::HandleCreate(const IOEvent &event, AccessReportGroup &group)
 {
     CheckFunc checker = Checkers::CheckWrite;
     bool isDir = false;
@@ -176,19 +179,19 @@ AccessCheckResult IOHandler::HandleCreate(const IOEvent &event, AccessReport &ac
                                 : Checkers::CheckCreateDirectoryNoEnforcement;
     }
 
-    return CheckAndCreateReport(isDir ? kOpKAuthCreateDir : kOpMacVNodeCreate, event.GetEventPath(SRC_PATH), checker, event.GetPid(), isDir, event.GetError(), accessToReport);
+    return CheckAndCreateReport(isDir ? kOpKAuthCreateDir : kOpMacVNodeCreate, event.GetEventPath(SRC_PATH), checker, event.GetPid(), isDir, event.GetError(), group, group.firstReport, event.GetObservedMode());
 }
 
-AccessCheckResult IOHandler::HandleGenericWrite(const IOEvent &event, AccessReport &accessToReport)
+AccessCheckResult IOHandler::HandleGenericWrite(const IOEvent &event, AccessReportGroup &group)
 {
     const char *path = event.GetEventPath(SRC_PATH);
     mode_t mode = event.GetMode();
     bool isDir = S_ISDIR(mode);
 
-    return CheckAndCreateReport(kOpKAuthVNodeWrite, path, Checkers::CheckWrite, event.GetPid(), isDir, event.GetError(), accessToReport);
+    return CheckAndCreateReport(kOpKAuthVNodeWrite, path, Checkers::CheckWrite, event.GetPid(), isDir, event.GetError(), group, group.firstReport, event.GetObservedMode());
 }
 
-AccessCheckResult IOHandler::HandleGenericRead(const IOEvent &event, AccessReport &accessToReport)
+AccessCheckResult IOHandler::HandleGenericRead(const IOEvent &event, AccessReportGroup &group)
 {
     const char *path = event.GetEventPath(SRC_PATH);
     mode_t mode = event.GetMode();
@@ -196,26 +199,26 @@ AccessCheckResult IOHandler::HandleGenericRead(const IOEvent &event, AccessRepor
 
     if (!event.EventPathExists())
     {
-        return CheckAndCreateReport(kOpMacLookup, path, Checkers::CheckLookup, event.GetPid(), false, event.GetError(), accessToReport);
+        return CheckAndCreateReport(kOpMacLookup, path, Checkers::CheckLookup, event.GetPid(), false, event.GetError(), group, group.firstReport);
     }
     else
     {
-        return CheckAndCreateReport(kOpKAuthVNodeRead, path, Checkers::CheckRead, event.GetPid(), isDir, event.GetError(), accessToReport);
+        return CheckAndCreateReport(kOpKAuthVNodeRead, path, Checkers::CheckRead, event.GetPid(), isDir, event.GetError(), group, group.firstReport);
     }
 }
 
-AccessCheckResult IOHandler::HandleGenericProbe(const IOEvent &event, AccessReport &accessToReport)
+AccessCheckResult IOHandler::HandleGenericProbe(const IOEvent &event, AccessReportGroup &group)
 {
     const char *path = event.GetEventPath(SRC_PATH);
     bool isDir = S_ISDIR(event.GetMode());
 
     if (!event.EventPathExists())
     {
-        return CheckAndCreateReport(kOpMacLookup, path, Checkers::CheckLookup, event.GetPid(), false, event.GetError(), accessToReport);
+        return CheckAndCreateReport(kOpMacLookup, path, Checkers::CheckLookup, event.GetPid(), false, event.GetError(), group, group.firstReport);
     }
     else
     {
-        return CheckAndCreateReport(kOpKAuthVNodeProbe, path, Checkers::CheckProbe, event.GetPid(), isDir, event.GetError(), accessToReport);
+        return CheckAndCreateReport(kOpKAuthVNodeProbe, path, Checkers::CheckProbe, event.GetPid(), isDir, event.GetError(), group, group.firstReport);
     }
 }
 
@@ -226,12 +229,12 @@ AccessCheckResult IOHandler::HandleEvent(const IOEvent &event)
 
     if (report.firstReport.shouldReport)
     {
-        SendReport(report.firstReport);
+        SendReport(report, report.firstReport);
     }
 
     if (report.secondReport.shouldReport)
     {
-        SendReport(report.secondReport);
+        SendReport(report, report.secondReport);
     }
 
     return result;
@@ -241,35 +244,36 @@ AccessCheckResult IOHandler::CheckAccessAndBuildReport(const IOEvent &event, Acc
 {
     // The second report may not be set below, so prevently flag it as a no report one.
     accessToReportGroup.secondReport.shouldReport = false;
+    accessToReportGroup.paths.length = 0;
 
     switch (event.GetEventType())
     {
         case ES_EVENT_TYPE_AUTH_EXEC:
         case ES_EVENT_TYPE_NOTIFY_EXEC:
         {
-            return HandleProcessExec(event, accessToReportGroup.firstReport);
+            return HandleProcessExec(event, accessToReportGroup);
         }
         case ES_EVENT_TYPE_NOTIFY_FORK:
-            return HandleProcessFork(event, accessToReportGroup.firstReport);
+            return HandleProcessFork(event, accessToReportGroup);
 
         case ES_EVENT_TYPE_NOTIFY_EXIT:
-            return HandleProcessExit(event, accessToReportGroup.firstReport, accessToReportGroup.secondReport);
+            return HandleProcessExit(event, accessToReportGroup);
 
         case ES_EVENT_TYPE_NOTIFY_LOOKUP:
-            return HandleLookup(event, accessToReportGroup.firstReport);
+            return HandleLookup(event, accessToReportGroup);
 
         case ES_EVENT_TYPE_AUTH_OPEN:
         case ES_EVENT_TYPE_NOTIFY_OPEN:
         {
-            return HandleOpen(event, accessToReportGroup.firstReport);
+            return HandleOpen(event, accessToReportGroup);
         }
         case ES_EVENT_TYPE_NOTIFY_CLOSE:
-            return HandleClose(event, accessToReportGroup.firstReport);
+            return HandleClose(event, accessToReportGroup);
 
         case ES_EVENT_TYPE_AUTH_CREATE:
         case ES_EVENT_TYPE_NOTIFY_CREATE:
         {
-            return HandleCreate(event, accessToReportGroup.firstReport);
+            return HandleCreate(event, accessToReportGroup);
         }
         case ES_EVENT_TYPE_AUTH_TRUNCATE:
         case ES_EVENT_TYPE_NOTIFY_TRUNCATE:
@@ -290,12 +294,12 @@ AccessCheckResult IOHandler::CheckAccessAndBuildReport(const IOEvent &event, Acc
         case ES_EVENT_TYPE_NOTIFY_SETTIME:
         case ES_EVENT_TYPE_AUTH_SETACL:
         case ES_EVENT_TYPE_NOTIFY_SETACL:
-            return HandleGenericWrite(event, accessToReportGroup.firstReport);
+            return HandleGenericWrite(event, accessToReportGroup);
 
         case ES_EVENT_TYPE_NOTIFY_CHDIR:
         case ES_EVENT_TYPE_NOTIFY_READDIR:
         case ES_EVENT_TYPE_NOTIFY_FSGETPATH:
-            return HandleGenericRead(event, accessToReportGroup.firstReport);
+            return HandleGenericRead(event, accessToReportGroup);
 
         case ES_EVENT_TYPE_AUTH_GETATTRLIST:
         case ES_EVENT_TYPE_NOTIFY_GETATTRLIST:
@@ -305,37 +309,37 @@ AccessCheckResult IOHandler::CheckAccessAndBuildReport(const IOEvent &event, Acc
         case ES_EVENT_TYPE_NOTIFY_LISTEXTATTR:
         case ES_EVENT_TYPE_NOTIFY_ACCESS:
         case ES_EVENT_TYPE_NOTIFY_STAT:
-            return HandleGenericProbe(event, accessToReportGroup.firstReport);
+            return HandleGenericProbe(event, accessToReportGroup);
 
         case ES_EVENT_TYPE_AUTH_CLONE:
         case ES_EVENT_TYPE_NOTIFY_CLONE:
         {
-            return HandleClone(event, accessToReportGroup.firstReport, accessToReportGroup.secondReport);
+            return HandleClone(event, accessToReportGroup);
         }
         case ES_EVENT_TYPE_AUTH_EXCHANGEDATA:
         case ES_EVENT_TYPE_NOTIFY_EXCHANGEDATA:
         {
-            return HandleExchange(event, accessToReportGroup.firstReport, accessToReportGroup.secondReport);
+            return HandleExchange(event, accessToReportGroup);
         }
         case ES_EVENT_TYPE_AUTH_RENAME:
         case ES_EVENT_TYPE_NOTIFY_RENAME:
         {
-            return HandleRename(event, accessToReportGroup.firstReport, accessToReportGroup.secondReport);
+            return HandleRename(event, accessToReportGroup);
         }
         case ES_EVENT_TYPE_AUTH_READLINK:
         case ES_EVENT_TYPE_NOTIFY_READLINK:
         {
-            return HandleReadlink(event, accessToReportGroup.firstReport);
+            return HandleReadlink(event, accessToReportGroup);
         }
         case ES_EVENT_TYPE_AUTH_LINK:
         case ES_EVENT_TYPE_NOTIFY_LINK:
         {
-            return HandleLink(event, accessToReportGroup.firstReport, accessToReportGroup.secondReport);
+            return HandleLink(event, accessToReportGroup);
         }
         case ES_EVENT_TYPE_AUTH_UNLINK:
         case ES_EVENT_TYPE_NOTIFY_UNLINK:
         {
-            return HandleUnlink(event, accessToReportGroup.firstReport);
+            return HandleUnlink(event, accessToReportGroup);
         }
         case ES_EVENT_TYPE_LAST:
             accessToReportGroup.firstReport.shouldReport = false;
@@ -24,48 +24,48 @@ public:
     // The provided event is reported via the sandbox send report callback
     AccessCheckResult HandleEvent(const IOEvent &event);
 
-    // This is an overload of HandleProcessUntracked(const pid_t pid, AccessReport &accessToReport) that
+    // This is an overload of HandleProcessUntracked(const pid_t pid, AccessReportGroup &group, CompactAccessReport &accessToReport) that
     // sends out the report via the sandbox send report callback. This method is used by the Mac machinery.
     AccessCheckResult HandleProcessUntracked(const pid_t pid);
 
 protected:
 #pragma mark Process life cycle
 
-    AccessCheckResult HandleProcessFork(const IOEvent &event, AccessReport &accessToReport);
+    AccessCheckResult HandleProcessFork(const IOEvent &event, AccessReportGroup &group);
 
-    AccessCheckResult HandleProcessExec(const IOEvent &event, AccessReport &accessToReport);
+    AccessCheckResult HandleProcessExec(const IOEvent &event, AccessReportGroup &group);
 
-    AccessCheckResult HandleProcessExit(const IOEvent &event, AccessReport &processExitReport, AccessReport &processTreeCompletedReport);
+    AccessCheckResult HandleProcessExit(const IOEvent &event, AccessReportGroup &group);
 
-    AccessCheckResult HandleProcessUntracked(const pid_t pid, AccessReport &accessToReport);
+    AccessCheckResult HandleProcessUntracked(const pid_t pid, AccessReportGroup &group, CompactAccessReport &accessToReport);
 
 #pragma mark Process I/O observation
 
-    AccessCheckResult HandleLookup(const IOEvent &event, AccessReport &accessToReport);
+    AccessCheckResult HandleLookup(const IOEvent &event, AccessReportGroup &group);
 
-    AccessCheckResult HandleOpen(const IOEvent &event, AccessReport &accessToReport);
+    AccessCheckResult HandleOpen(const IOEvent &event, AccessReportGroup &group);
 
-    AccessCheckResult HandleClose(const IOEvent &event, AccessReport &accessToReport);
+    AccessCheckResult HandleClose(const IOEvent &event, AccessReportGroup &group);
 
-    AccessCheckResult HandleCreate(const IOEvent &event, AccessReport &accessToReport);
+    AccessCheckResult HandleCreate(const IOEvent &event, AccessReportGroup &group);
 
-    AccessCheckResult HandleLink(const IOEvent &event, AccessReport &sourceAccessToReport, AccessReport &destinationAccessToReport);
+    AccessCheckResult HandleLink(const IOEvent &event, AccessReportGroup &group);
 
-    AccessCheckResult HandleUnlink(const IOEvent &event, AccessReport &accessToReport);
+    AccessCheckResult HandleUnlink(const IOEvent &event, AccessReportGroup &group);
 
-    AccessCheckResult HandleReadlink(const IOEvent &event, AccessReport &accessToReport);
+    AccessCheckResult HandleReadlink(const IOEvent &event, AccessReportGroup &group);
 
-    AccessCheckResult HandleRename(const IOEvent &event, AccessReport &sourceAccessToReport, AccessReport &destinationAccessToReport);
+    AccessCheckResult HandleRename(const IOEvent &event, AccessReportGroup &group);
 
-    AccessCheckResult HandleClone(const IOEvent &event, AccessReport &sourceAccessToReport, AccessReport &destinationAccessToReport);
+    AccessCheckResult HandleClone(const IOEvent &event, AccessReportGroup &group);
 
-    AccessCheckResult HandleExchange(const IOEvent &event, AccessReport &sourceAccessToReport, AccessReport &destinationAccessToReport);
+    AccessCheckResult HandleExchange(const IOEvent &event, AccessReportGroup &group);
 
-    AccessCheckResult HandleGenericWrite(const IOEvent &event, AccessReport &accessToReport);
+    AccessCheckResult HandleGenericWrite(const IOEvent &event, AccessReportGroup &group);
 
-    AccessCheckResult HandleGenericRead(const IOEvent &event, AccessReport &accessToReport);
+    AccessCheckResult HandleGenericRead(const IOEvent &event, AccessReportGroup &group);
 
-    AccessCheckResult HandleGenericProbe(const IOEvent &event, AccessReport &accessToReport);
+    AccessCheckResult HandleGenericProbe(const IOEvent &event, AccessReportGroup &group);
 };
 
 #endif /* IOHandler_hpp */
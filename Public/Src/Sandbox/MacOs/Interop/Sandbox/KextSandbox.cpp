@@ -2,6 +2,7 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include <IOKit/kext/KextManager.h>
+#include <sys/sysctl.h>
 #include "KextSandbox.hpp"
 
 class AutoRelease
@@ -101,9 +102,11 @@ extern "C"
             return;
         }
 
+        uint type = FileAccessReporting + memoryInfo->queueIndex;
         do
         {
-            if (!SendClientAttached(info))
+            // the client is allocated (along with all its report queues) once, when its first queue gets mapped
+            if (memoryInfo->queueIndex == 0 && !SendClientAttached(info))
             {
                 log_error("%s", "Failed sending BuildXL launch signal to kernel extension");
                 memoryInfo->error = KEXT_BUILDXL_LAUNCH_SIGNAL_FAIL;
@@ -119,7 +122,7 @@ extern "C"
             }
             memoryInfo->port = port;
 
-            kern_return_t result = IOConnectSetNotificationPort(info.connection, FileAccessReporting, port, 0);
+            kern_return_t result = IOConnectSetNotificationPort(info.connection, type, port, 0);
             if (result != KERN_SUCCESS)
             {
                 log_error("%s", "Failed allocating notification port for shared memory region");
@@ -129,7 +132,7 @@ extern "C"
 
             mach_vm_size_t size = 0;
             mach_vm_address_t address = 0;
-            result = IOConnectMapMemory(info.connection, FileAccessReporting, mach_task_self(), &address, &size, kIOMapAnywhere);
+            result = IOConnectMapMemory(info.connection, type, mach_task_self(), &address, &size, kIOMapAnywhere);
             if (result != KERN_SUCCESS)
             {
                 log_error("%s", "Failed mapping shared memory region");
@@ -164,7 +167,7 @@ extern "C"
         log_debug("%s", "Freeing mapped memory, mach port for shared data queue");
         if (memoryInfo.address != 0)
         {
-            IOConnectUnmapMemory(info.connection, FileAccessReporting, memoryInfo.port, memoryInfo.address);
+            IOConnectUnmapMemory(info.connection, FileAccessReporting + memoryInfo.queueIndex, memoryInfo.port, memoryInfo.address);
         }
 
         if (MACH_PORT_VALID(memoryInfo.port))
@@ -293,6 +296,36 @@ extern "C"
         return status == KERN_SUCCESS;
     }
 
+    /*! Same as 'GetMemoryPressureLevel' from Posix/memory.c; returns 0 when the level cannot be obtained */
+    static uint GetCurrentMemoryPressureLevel()
+    {
+        int level = 0;
+        size_t length = sizeof(level);
+        return sysctlbyname("kern.memorystatus_vm_pressure_level", &level, &length, NULL, 0) == 0 && level > 0
+            ? (uint)level
+            : 0;
+    }
+
+    /*! Scheduler's (1 minute) load average per logical core, in basis points; returns 0 when it cannot be obtained */
+    static uint GetCurrentRunQueueLengthBasisPoints()
+    {
+        host_load_info_data_t loadInfo;
+        mach_msg_type_number_t count = HOST_LOAD_INFO_COUNT;
+        if (host_statistics(mach_host_self(), HOST_LOAD_INFO, (host_info_t)&loadInfo, &count) != KERN_SUCCESS)
+        {
+            return 0;
+        }
+
+        int numCores = 0;
+        size_t length = sizeof(numCores);
+        if (sysctlbyname("hw.logicalcpu", &numCores, &length, NULL, 0) != 0 || numCores <= 0)
+        {
+            return 0;
+        }
+
+        return (uint)(((uint64_t)loadInfo.avenrun[0] * 10000) / ((uint64_t)LOAD_SCALE * numCores));
+    }
+
     bool UpdateCurrentResourceUsage(uint cpuUsageBasisPoints, uint ramUsageBasisPoints, KextConnectionInfo info)
     {
         if (info.connection == IO_OBJECT_NULL)
@@ -300,9 +333,15 @@ extern "C"
             return false;
         }
 
-        uint64_t usages[2] = { cpuUsageBasisPoints, ramUsageBasisPoints };
+        uint64_t usages[4] =
+        {
+            cpuUsageBasisPoints,
+            ramUsageBasisPoints,
+            GetCurrentMemoryPressureLevel(),
+            GetCurrentRunQueueLengthBasisPoints()
+        };
         kern_return_t status = IOConnectCallScalarMethod(info.connection, kIpcActionUpdateResourceUsage,
-                                                         usages, 2, NULL, NULL);
+                                                         usages, 4, NULL, NULL);
         return status == KERN_SUCCESS;
     }
 
@@ -329,19 +368,36 @@ extern "C"
         return status == KERN_SUCCESS;
     }
 
+    bool DrainKextTelemetry(KextConnectionInfo info, TelemetryResponse *result)
+    {
+        if (info.connection == IO_OBJECT_NULL)
+        {
+            return false;
+        }
+
+        size_t resultSize = sizeof(TelemetryResponse);
+        kern_return_t status = IOConnectCallStructMethod(info.connection, kIpcActionDrainTelemetry,
+                                                         NULL, 0,
+                                                         result, &resultSize);
+        return status == KERN_SUCCESS;
+    }
+
 #pragma mark IOSharedDataQueue consumer code
 
     /**
      * Call this function once only from a dedicated thread and pass a valid C# delegate callback, the address to
      * the shared memory region and a valid mach port.
+     *
+     * Reports are handed to the callback in batches of all the reports available in the queue (up to
+     * kAccessReportBatchSize), so that the managed side is called into once per batch instead of once per report.
      */
-    __cdecl void ListenForFileAccessReports(AccessReportCallback callback, long accessReportSize, mach_vm_address_t address, mach_port_t port)
+    __cdecl void ListenForFileAccessReports(AccessReportBatchCallback callback, long accessReportSize, mach_vm_address_t address, mach_port_t port)
     {
         if (sizeof(AccessReport) != accessReportSize)
         {
             log_error("Wrong size of the AccessReport buffer: expected %ld, received %ld",
                       sizeof(AccessReport), accessReportSize);
-            if (callback != NULL) callback(AccessReport{}, KEXT_WRONG_BUFFER_SIZE);
+            if (callback != NULL) callback(NULL, 0, KEXT_WRONG_BUFFER_SIZE);
             return;
         }
 
@@ -349,7 +405,7 @@ extern "C"
         {
             if (callback != NULL)
             {
-                callback(AccessReport{}, REPORT_QUEUE_CONNECTION_ERROR);
+                callback(NULL, 0, REPORT_QUEUE_CONNECTION_ERROR);
             }
             return;
         }
@@ -357,31 +413,45 @@ extern "C"
         log_debug("Listening for data on shared queue from process: %d", getpid());
 
         IODataQueueMemory *queue = (IODataQueueMemory *)address;
+        AccessReport batch[kAccessReportBatchSize];
+        char entry[sizeof(AccessReport)];
         do
         {
+            int batchCount = 0;
             while (IODataQueueDataAvailable(queue))
             {
-                AccessReport report;
-                uint32_t reportSize = sizeof(report);
-
-                kern_return_t result = IODataQueueDequeue(queue, &report, &reportSize);
+                uint32_t entrySize = sizeof(entry);
+                kern_return_t result = IODataQueueDequeue(queue, entry, &entrySize);
 
                 if (result != kIOReturnSuccess)
                 {
-                    log_error("Received bogus access report: PID(%d) PIP(%#llX) Error Code: %#X", report.rootPid, report.pipId, result);
-                    callback(AccessReport{}, REPORT_QUEUE_DEQUEUE_ERROR);
+                    log_error("Received bogus access report entry: Error Code: %#X", result);
+                    if (batchCount > 0) callback(batch, batchCount, REPORT_QUEUE_SUCCESS);
+                    callback(NULL, 0, REPORT_QUEUE_DEQUEUE_ERROR);
                     return;
                 }
 
-                if (reportSize != sizeof(report))
+                AccessReport &report = batch[batchCount];
+                if (!UnpackAccessReport(entry, entrySize, &report))
                 {
-                    log_error("AccessReport size mismatch :: reported: %d, expected: %ld", reportSize, sizeof(report));
-                    callback(AccessReport{}, REPORT_QUEUE_DEQUEUE_ERROR);
+                    log_error("AccessReport entry size mismatch :: reported: %d, expected at least: %ld", entrySize, kAccessReportEntryHeaderSize);
+                    if (batchCount > 0) callback(batch, batchCount, REPORT_QUEUE_SUCCESS);
+                    batchCount = 0;
+                    callback(NULL, 0, REPORT_QUEUE_DEQUEUE_ERROR);
                     continue;
                 }
 
                 report.stats.dequeueTime = GetMachAbsoluteTime();
-                callback(report, REPORT_QUEUE_SUCCESS);
+                if (++batchCount == kAccessReportBatchSize)
+                {
+                    callback(batch, batchCount, REPORT_QUEUE_SUCCESS);
+                    batchCount = 0;
+                }
+            }
+
+            if (batchCount > 0)
+            {
+                callback(batch, batchCount, REPORT_QUEUE_SUCCESS);
             }
         }
         while (IODataQueueWaitForAvailableData(queue, port) == kIOReturnSuccess);
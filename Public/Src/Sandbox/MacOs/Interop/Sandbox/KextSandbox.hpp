@@ -26,6 +26,8 @@ typedef struct {
     int error;
     mach_vm_address_t address;
     mach_port_t port;
+    /*! Set by the caller: which of the client's report queues (see 'KextConfig::numberOfReportQueues') to map */
+    uint queueIndex;
 } KextSharedMemoryInfo;
 
 extern "C"
@@ -43,19 +45,25 @@ extern "C"
      * The kernel extension currently relies on being externally notified of the current CPU usage
      * in order for fork throttling to work correctly.  If fork throttling is enabled, invoke this
      * function at steady intervals to provide the latest CPU/RAM usage (to obtain CPU usage, you can
-     * use 'host_statistics()' or 'host_processor_info()').
+     * use 'host_statistics()' or 'host_processor_info()').  Memory pressure level and run-queue length
+     * are obtained by this function and sent along.
      */
     bool UpdateCurrentResourceUsage(uint cpuUsageBasisPoints, uint ramUsageBasisPoints, KextConnectionInfo info);
 
     typedef void (__cdecl *FailureNotificationCallback)(void *, IOReturn);
     bool SetFailureNotificationHandler(FailureNotificationCallback callback, KextConnectionInfo info);
 
-    __cdecl void ListenForFileAccessReports(AccessReportCallback callback, long accessReportSize, mach_vm_address_t address, mach_port_t port);
+    __cdecl void ListenForFileAccessReports(AccessReportBatchCallback callback, long accessReportSize, mach_vm_address_t address, mach_port_t port);
 
     uint64_t GetMachAbsoluteTime(void);
     __cdecl void KextVersionString(char *version, int size);
 
     bool IntrospectKernelExtension(KextConnectionInfo info, IntrospectResponse *result);
+
+    /*!
+     * Returns what changed for every active pip since the previous call (by any client), see 'TelemetryResponse'.
+     */
+    bool DrainKextTelemetry(KextConnectionInfo info, TelemetryResponse *result);
 };
 
 bool KEXT_SendPipStarted(const pid_t processId, pipid_t pipId, const char *const famBytes, int famBytesLength, KextConnectionInfo info);
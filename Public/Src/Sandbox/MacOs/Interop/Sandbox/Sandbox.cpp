@@ -5,6 +5,15 @@
 #include "IOHandler.hpp"
 #include "Sandbox.hpp"
 
+#if __APPLE__
+#include "XPCConstants.hpp"
+
+extern "C"
+{
+#include "process.h"
+}
+#endif
+
 static Sandbox* sandbox;
 
 extern "C"
@@ -31,12 +40,12 @@ extern "C"
         log_debug("%s", "Successfully shut-down gerneric sandbox subsystem.");
     }
 
-    __cdecl void ObserverFileAccessReports(SandboxConnectionInfo *info, AccessReportCallback callback, long accessReportSize)
+    __cdecl void ObserverFileAccessReports(SandboxConnectionInfo *info, AccessReportBatchCallback callback, long accessReportSize)
     {
         if (sizeof(AccessReport) != accessReportSize)
         {
             log_error("Wrong size of the AccessReport buffer: expected %ld, received %ld!", sizeof(AccessReport), accessReportSize);
-            if (callback != NULL) callback(AccessReport{}, SB_WRONG_BUFFER_SIZE);
+            if (callback != NULL) callback(NULL, 0, SB_WRONG_BUFFER_SIZE);
             return;
         }
 
@@ -84,6 +93,29 @@ bool Sandbox_SendPipProcessTerminated(pipid_t pipId, pid_t pid)
     return true;
 }
 
+#if __APPLE__
+/*!
+ * Resource usage of the process tree of the pip whose root process is 'pid', from the accounting kept by the sandbox
+ * (see 'SetProcessTreeResourceUsageProvider').  Returns false if 'pid' isn't the root process of a tracked pip.
+ */
+static bool GetTrackedProcessTreeResourceUsage(pid_t pid, ProcessResourceUsage *buffer)
+{
+    std::shared_ptr<SandboxedProcess> process = sandbox != nullptr ? sandbox->FindTrackedProcess(pid) : nullptr;
+    if (process == nullptr || process->GetPip()->GetProcessId() != pid)
+    {
+        return false;
+    }
+
+    PipResourceUsage usage = process->GetPip()->GetResourceUsage();
+    buffer->systemTime          += usage.systemTime;
+    buffer->userTime            += usage.userTime;
+    buffer->diskio_bytesRead    += usage.diskioBytesRead;
+    buffer->diskio_bytesWritten += usage.diskioBytesWritten;
+    buffer->rss                 += usage.residentSize;
+    return true;
+}
+#endif
+
 #pragma mark Sandbox implementation
 
 Sandbox::Sandbox(pid_t host_pid, Configuration config)
@@ -91,17 +123,26 @@ Sandbox::Sandbox(pid_t host_pid, Configuration config)
     hostPid_ = host_pid;
     configuration_ = config;
 
-    if (!SetProcessPidPair(GetAllowlistedPidMap(), host_pid, getppid()))
+    if (!processPids_.Add(PidSet::Allowlisted, host_pid, getppid()))
     {
         throw BuildXLException("Could not allowlist build host process id!");
     }
 
     accessReportCallback_ = nullptr;
 
-    trackedProcesses_ = Trie<SandboxedProcess>::createUintTrie();
-    if (!trackedProcesses_)
+    for (Trie<SandboxedProcess> *&shard : trackedProcesses_)
+    {
+        shard = Trie<SandboxedProcess>::createUintTrie();
+        if (!shard)
+        {
+            throw BuildXLException("Could not create Trie for process tracking!");
+        }
+    }
+
+    executablePaths_ = Trie<PathCacheEntry>::createPathTrie();
+    if (!executablePaths_)
     {
-        throw BuildXLException("Could not create Trie for process tracking!");
+        throw BuildXLException("Could not create Trie for executable paths!");
     }
 
 #if __APPLE__
@@ -116,25 +157,36 @@ Sandbox::Sandbox(pid_t host_pid, Configuration config)
     });
     xpc_connection_resume(xpc_bridge_);
 
-    hybird_event_queue_ = dispatch_queue_create("com.microsoft.buildxl.interop.hybrid_events", dispatch_queue_attr_make_with_qos_class(
-        DISPATCH_QUEUE_SERIAL, QOS_CLASS_USER_INTERACTIVE, -1
-    ));
+    long numQueues = sysconf(_SC_NPROCESSORS_ONLN);
+    for (long i = 0; i < (numQueues > 0 ? numQueues : 1); i++)
+    {
+        char queueName[PATH_MAX] = { '\0' };
+        sprintf(queueName, "com.microsoft.buildxl.interop.eventqueue_%d_%ld", host_pid, i);
+
+        eventQueues_.push_back(dispatch_queue_create(queueName, dispatch_queue_attr_make_with_qos_class(
+            DISPATCH_QUEUE_SERIAL, QOS_CLASS_USER_INTERACTIVE, -1
+        )));
+    }
+#endif
+
+#if __APPLE__
+    SetProcessTreeResourceUsageProvider(&GetTrackedProcessTreeResourceUsage);
 #endif
 
     switch (configuration_)
     {
 #if __APPLE__
         case EndpointSecuritySandboxType: {
-            es_ = new EndpointSecuritySandbox(host_pid, &process_event, (void *)this, xpc_bridge_);
+            es_ = new EndpointSecuritySandbox(host_pid, &process_event, &event_queue_for, &is_muted_pid, (void *)this, xpc_bridge_);
             break;
         }
         case DetoursSandboxType: {
-            detours_ = new DetoursSandbox(host_pid, &process_event, (void *)this, xpc_bridge_);
+            detours_ = new DetoursSandbox(host_pid, &process_event, &event_queue_for, (void *)this, xpc_bridge_);
             break;
         }
         case HybridSandboxType: {
-            es_ = new EndpointSecuritySandbox(host_pid, &process_event, (void *)this, xpc_bridge_);
-            detours_ = new DetoursSandbox(host_pid, &process_event, (void *)this, xpc_bridge_);
+            es_ = new EndpointSecuritySandbox(host_pid, &process_event, &event_queue_for, &is_muted_pid, (void *)this, xpc_bridge_);
+            detours_ = new DetoursSandbox(host_pid, &process_event, &event_queue_for, (void *)this, xpc_bridge_);
             break;
         }
 #elif __linux__
@@ -148,14 +200,9 @@ Sandbox::Sandbox(pid_t host_pid, Configuration config)
 
 Sandbox::~Sandbox()
 {
-    accessReportCallback_ = nullptr;
-
-    if (trackedProcesses_ != nullptr)
-    {
-        delete trackedProcesses_;
-    }
-
 #if __APPLE__
+    SetProcessTreeResourceUsageProvider(nullptr);
+
     if (es_ != nullptr)
     {
         delete es_;
@@ -170,16 +217,75 @@ Sandbox::~Sandbox()
     xpc_release(xpc_bridge_);
     xpc_bridge_ = nullptr;
 
-    if (hybird_event_queue_)
+    // Let the events that are still queued up finish before tearing down what they use
+    for (dispatch_queue_t queue : eventQueues_)
     {
-        dispatch_release(hybird_event_queue_);
+        dispatch_sync(queue, ^{});
+        dispatch_release(queue);
     }
 #endif
+
+    // No more reports come in, hand over the ones still batched while there is a callback for them
+    if (accessReportCallback_ != nullptr)
+    {
+        for (const std::shared_ptr<SandboxedPip> &pip : activePips_)
+        {
+            pip->FlushAccessReports(accessReportCallback_);
+        }
+    }
+
+    accessReportCallback_ = nullptr;
+
+    for (Trie<SandboxedProcess> *shard : trackedProcesses_)
+    {
+        if (shard != nullptr)
+        {
+            delete shard;
+        }
+    }
+
+    if (executablePaths_ != nullptr)
+    {
+        delete executablePaths_;
+    }
 }
 
+std::shared_ptr<const PathCacheEntry> Sandbox::InternPath(const char *path, size_t length)
+{
+    std::shared_ptr<PathCacheEntry> entry = std::make_shared<PathCacheEntry>(path, length);
+    std::shared_ptr<PathCacheEntry> interned = executablePaths_->getOrAdd(entry->GetPath(), entry);
+
+    if (interned == nullptr || interned->GetPathLength() != length || memcmp(interned->GetPath(), path, length) != 0)
+    {
+        return entry;
+    }
+
+    return interned;
+}
+
+#if __APPLE__
+dispatch_queue_t Sandbox::GetEventQueue(const IOEvent &event)
+{
+    pid_t shardPid = event.GetPid();
+
+    std::shared_ptr<SandboxedProcess> process = FindTrackedProcess(event.GetPid());
+    if (process == nullptr)
+    {
+        process = FindTrackedProcess(event.GetParentPid());
+    }
+
+    if (process != nullptr)
+    {
+        shardPid = process->GetPip()->GetProcessId();
+    }
+
+    return eventQueues_[(size_t)shardPid % eventQueues_.size()];
+}
+#endif
+
 std::shared_ptr<SandboxedProcess> Sandbox::FindTrackedProcess(pid_t pid)
 {
-    return trackedProcesses_->get(pid);
+    return TrackedProcessShard(pid)->get(pid);
 }
 
 bool Sandbox::TrackRootProcess(std::shared_ptr<SandboxedPip> pip)
@@ -193,14 +299,29 @@ bool Sandbox::TrackRootProcess(std::shared_ptr<SandboxedPip> pip)
     }
 
     int len = PATH_MAX;
-    process->SetPath(pip->GetProcessPath(&len));
+    const char *processPath = pip->GetProcessPath(&len);
+    process->SetPath(InternPath(processPath, strnlen(processPath, len)));
 
-    log_debug("Pip with PipId = %#llX, PID = %d launching (path: %{public}s)", pip->GetPipId(), pid, process->GetPath());
+    log_debug("Pip with PipId = %#llX, PID = %d launching (path: %{public}s)", pip->GetPipId(), pid, process->GetPath()->GetPath());
+
+    {
+        const std::lock_guard<std::shared_timed_mutex> lock(activePipsLock_);
+        activePips_.push_back(pip);
+    }
+
+#if __APPLE__
+    // Opens cached while only the other pips were running may have to be reported for this one
+    if (es_ != nullptr)
+    {
+        UpdateEventDemand();
+        es_->ClearCache();
+    }
+#endif
 
     int numAttempts = 0;
     while (++numAttempts <= 3)
     {
-        TrieResult result = trackedProcesses_->insert(pid, process);
+        TrieResult result = TrackedProcessShard(pid)->insert(pid, process);
         if (result == TrieResult::kTrieResultAlreadyExists)
         {
             // if mapping for 'pid' exists (this can happen only if clients are nested) --> remove it and retry
@@ -218,12 +339,18 @@ bool Sandbox::TrackRootProcess(std::shared_ptr<SandboxedPip> pip)
         {
             bool insertedNew = result == TrieResult::kTrieResultInserted;
             log_debug("Tracking root process PID(%d), PipId: %#llX, tree size: %d, path: %{public}s, code: %d",
-                      pid, pip->GetPipId(), pip->GetTreeSize(), process->GetPath(), result);
+                      pid, pip->GetPipId(), pip->GetTreeSize(), process->GetPath()->GetPath(), result);
+
+            if (!insertedNew)
+            {
+                RemoveActivePip(pip);
+            }
 
             return insertedNew;
         }
     }
 
+    RemoveActivePip(pip);
     process.reset();
     log_error("Exceeded max number of attempts in TrackRootProcess: %d - aborting!", numAttempts);
     return false;
@@ -240,7 +367,7 @@ bool Sandbox::TrackChildProcess(pid_t childPid, const char *childExecutable, std
     }
 
     TrieResult getOrAddResult;
-    std::shared_ptr<SandboxedProcess> newValue = trackedProcesses_->getOrAdd(childPid, childProcess, &getOrAddResult);
+    std::shared_ptr<SandboxedProcess> newValue = TrackedProcessShard(childPid)->getOrAdd(childPid, childProcess, &getOrAddResult);
 
     // Operation getOrAdd failed:
     //   -> skip everything and return error (should not happen under normal circumstances)
@@ -275,8 +402,12 @@ bool Sandbox::TrackChildProcess(pid_t childPid, const char *childExecutable, std
     if (getOrAddResult == TrieResult::kTrieResultInserted)
     {
         // copy the path from the parent process (because the child process always starts out as a fork of the parent)
-        childProcess->SetPath(childExecutable);
+        std::shared_ptr<const PathCacheEntry> parentPath = parentProcess->GetPath();
+        childProcess->SetPath(strcmp(parentPath->GetPath(), childExecutable) == 0
+            ? parentPath
+            : InternPath(childExecutable, strlen(childExecutable)));
         pip->IncrementProcessTreeCount();
+        pip->AddProcess(childPid);
 
         log_debug("Track entry %d -> %d, PipId: %#llX, New tree size: %d", childPid, pip->GetProcessId(), pip->GetPipId(), pip->GetTreeSize());
 
@@ -295,26 +426,139 @@ error:
 bool Sandbox::UntrackProcess(pid_t pid, std::shared_ptr<SandboxedProcess> process)
 {
     // remove the mapping for 'pid'
-    auto removeResult = trackedProcesses_->remove(pid);
+    auto removeResult = TrackedProcessShard(pid)->remove(pid);
     bool removedExisting = removeResult == TrieResult::kTrieResultRemoved;
+    bool removedLast = false;
     if (removedExisting)
     {
-        process->GetPip()->DecrementProcessTreeCount();
+        removedLast = process->GetPip()->DecrementProcessTreeCount() == 0;
+        process->GetPip()->RemoveProcess(pid);
     }
 
     std::shared_ptr<SandboxedPip> pip = process->GetPip();
+    if (removedLast)
+    {
+        RemoveActivePip(pip);
+    }
 
     log_debug("Untrack entry %d (%{public}s) -> %d, PipId: %#llX, New tree size: %d, Code: %d",
-              pid, process->GetPath(), pip->GetProcessId(), pip->GetPipId(), pip->GetTreeSize(), removeResult);
+              pid, process->GetPath()->GetPath(), pip->GetProcessId(), pip->GetPipId(), pip->GetTreeSize(), removeResult);
 
     return removedExisting;
 }
 
-void const Sandbox::SendAccessReport(AccessReport &report, std::shared_ptr<SandboxedPip> pip)
+void Sandbox::RemoveActivePip(const std::shared_ptr<SandboxedPip> &pip)
+{
+    bool removed = false;
+    {
+        const std::lock_guard<std::shared_timed_mutex> lock(activePipsLock_);
+        for (auto it = activePips_.begin(); it != activePips_.end(); ++it)
+        {
+            if (*it == pip)
+            {
+                activePips_.erase(it);
+                removed = true;
+                break;
+            }
+        }
+    }
+
+#if __APPLE__
+    if (removed && es_ != nullptr)
+    {
+        UpdateEventDemand();
+    }
+#endif
+}
+
+#if __APPLE__
+void Sandbox::UpdateEventDemand()
+{
+    // Held while sending, so the demand the ES clients end up with is that of the last change to the active pips
+    const std::lock_guard<std::mutex> demandLock(esEventDemandLock_);
+
+    uint64_t demand = es_demand_none;
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(activePipsLock_);
+        for (const std::shared_ptr<SandboxedPip> &pip : activePips_)
+        {
+            if (pip->ReportsProbes())
+            {
+                demand |= es_demand_probes;
+            }
+
+            if (pip->ReportsEnumerations())
+            {
+                demand |= es_demand_enumerations;
+            }
+        }
+    }
+
+    if (demand != esEventDemand_)
+    {
+        // Events a new pip needs must be subscribed to before its processes run, dropping events can't miss anything
+        es_->SetEventDemand(demand, /*waitForReply*/ (demand & ~esEventDemand_) != 0);
+        esEventDemand_ = demand;
+    }
+}
+#endif
+
+bool Sandbox::IsUntrackedForAllPips(const char *absolutePath)
 {
-    assert(strlen(report.path) > 0);
-    accessReportCallback_(report, REPORT_QUEUE_SUCCESS);
+    if (absolutePath[0] != '/')
+    {
+        return false;
+    }
+
+    std::shared_lock<std::shared_timed_mutex> lock(activePipsLock_);
+    for (const std::shared_ptr<SandboxedPip> &pip : activePips_)
+    {
+        if (CheckDisableDetours(pip->GetFamFlags()))
+        {
+            // Processes of this pip aren't tracked, nothing gets reported for it either way
+            continue;
+        }
+
+        if (CheckReportAllFileAccesses(pip->GetFamFlags()))
+        {
+            return false;
+        }
+
+        const char *pathWithoutRootSentinel = absolutePath + 1;
+        PolicySearchCursor cursor = FindFileAccessPolicyInTreeEx(pip->GetManifestRecord(), pathWithoutRootSentinel, strlen(pathWithoutRootSentinel));
+        if (!cursor.IsValid() || (!cursor.SearchWasTruncated && cursor.Record->BucketCount != 0) ||
+            !AccessHandler::IsUntrackedPolicy(cursor.Record->GetConePolicy()))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void const Sandbox::SendAccessReport(CompactAccessReport &report, const char *path, std::shared_ptr<SandboxedPip> pip)
+{
+    assert(report.pathLength > 0);
+    report.stats.enqueueTime = ReportTimestamp();
+
+    AccessReport accessReport;
+    ExpandAccessReport(report, path, &accessReport);
+
+#if __APPLE__
+    AccessReportBatchCallback callback = accessReportCallback_;
+    bool flush = report.operation == kOpProcessExit || report.operation == kOpProcessTreeCompleted;
+    if (pip->BatchAccessReport(accessReport, flush, callback))
+    {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, kAccessReportBatchLatencyNs),
+                       dispatch_get_global_queue(QOS_CLASS_USER_INTERACTIVE, 0), ^{
+            pip->FlushAccessReports(callback);
+        });
+    }
+#else
+    // The callback of the Linux sandbox writes to a pipe from within the sandboxed process, there's nothing to amortize
+    accessReportCallback_(&accessReport, 1, REPORT_QUEUE_SUCCESS);
+#endif
 
     log_debug("Enqueued PID(%d), Root PID(%d), PIP(%#llX), Operation: %{public}s, Path: %{public}s, Status: %d",
-              report.pid, report.rootPid, report.pipId, OpNames[report.operation], report.path, report.status);
+              report.pid, report.rootPid, report.pipId, OpNames[report.operation], path, report.status);
 }
@@ -9,12 +9,15 @@
 #include "DetoursSandbox.hpp"
 #include "EndpointSecuritySandbox.hpp"
 #include "IOEvent.hpp"
+#include "ProcessPidTable.hpp"
 #include "SandboxedPip.hpp"
 #include "SandboxedProcess.hpp"
 #include "Trie.hpp"
 
+#include <mutex>
+#include <shared_mutex>
 #include <signal.h>
-#include <map>
+#include <vector>
 
 #define SB_WRONG_BUFFER_SIZE    0x8
 #define SB_INSTANCE_ERROR       0x16
@@ -37,7 +40,7 @@ extern "C"
     void InitializeSandbox(SandboxConnectionInfo *info, pid_t host_pid);
     void DeinitializeSandbox();
 
-    void __cdecl ObserverFileAccessReports(SandboxConnectionInfo *info, AccessReportCallback callback, long accessReportSize);
+    void __cdecl ObserverFileAccessReports(SandboxConnectionInfo *info, AccessReportBatchCallback callback, long accessReportSize);
 };
 
 bool Sandbox_SendPipStarted(const pid_t pid, pipid_t pipId, const char *const famBytes, int famBytesLength);
@@ -51,16 +54,43 @@ private:
     pid_t hostPid_ = 0;
     
 #if __APPLE__
-    dispatch_queue_t hybird_event_queue_;
+    /*! Pool of serial queues that ES and interposing events are processed on, see 'GetEventQueue' */
+    std::vector<dispatch_queue_t> eventQueues_;
     xpc_connection_t xpc_bridge_ = nullptr;
-    std::mutex access_mutex;
 #endif
     
-    std::map<pid_t, pid_t> allowlistedPids_;
-    std::map<pid_t, pid_t> forceForkedPids_;
+    ProcessPidTable processPids_;
     
-    Trie<SandboxedProcess> *trackedProcesses_ = nullptr;
-    AccessReportCallback accessReportCallback_ = nullptr;
+    /*!
+     * Tracked processes, sharded by pid: lookups are lock-free either way, but every fork and exit updates the table,
+     * and a shard serializes only the updates for its own pids (the low bits of concurrently forked pids differ).
+     */
+    static const size_t kNumTrackedProcessShards = 16;
+    Trie<SandboxedProcess> *trackedProcesses_[kNumTrackedProcessShards] = { nullptr };
+
+    inline Trie<SandboxedProcess>* TrackedProcessShard(pid_t pid) const { return trackedProcesses_[(uint32_t)pid % kNumTrackedProcessShards]; }
+    
+    /*! Pips that still have tracked processes, see 'IsUntrackedForAllPips' */
+    std::vector<std::shared_ptr<SandboxedPip>> activePips_;
+    std::shared_timed_mutex activePipsLock_;
+
+    void RemoveActivePip(const std::shared_ptr<SandboxedPip> &pip);
+
+#if __APPLE__
+    /*! ESEventDemand the ES clients were last sent, see 'UpdateEventDemand' */
+    uint64_t esEventDemand_ = 0;
+    std::mutex esEventDemandLock_;
+
+    /*!
+     * Sends the ES clients the kinds of accesses the active pips can report (see SandboxedPip::ReportsProbes) when they changed, so
+     * EndpointSecurity only generates the frequent probe, lookup and readdir events while a running pip can use them.
+     */
+    void UpdateEventDemand();
+#endif
+
+    /*! Interned executable paths of tracked processes, see 'InternPath' */
+    Trie<PathCacheEntry> *executablePaths_ = nullptr;
+    AccessReportBatchCallback accessReportCallback_ = nullptr;
     
     DetoursSandbox* detours_ = nullptr;
     EndpointSecuritySandbox* es_ = nullptr;
@@ -75,43 +105,64 @@ public:
     
 #if __APPLE__
     inline const bool IsRunningHybrid() const { return configuration_ == Configuration::HybridSandboxType; }
-    inline const dispatch_queue_t GetHybridQueue() const { return hybird_event_queue_; }
+
+    /*!
+     * Events are sharded by the root process of the pip they belong to, so the events of a process tree are processed in order
+     * (a fork is always handled before the first event of the child) while independent pips are processed in parallel.
+     * Events of processes that aren't tracked yet go by their parent, and otherwise by their own pid.
+     */
+    dispatch_queue_t GetEventQueue(const IOEvent &event);
 #endif
     
-    inline std::map<pid_t, pid_t>& GetAllowlistedPidMap() { return allowlistedPids_; }
-    inline std::map<pid_t, pid_t>& GetForceForkedPidMap() { return forceForkedPids_; }
+    /*! Allowlisted and force-forked pids, see ProcessPidTable */
+    inline ProcessPidTable& GetProcessPids() { return processPids_; }
     
-    inline const bool SetProcessPidPair(std::map<pid_t, pid_t>& map, pid_t pid, pid_t ppid)
-    {
-#if __APPLE__
-        const std::lock_guard<std::mutex> lock(access_mutex);
-#endif
-        return map.emplace(pid, ppid).second;
-    }
+    inline const void SetAccessReportCallback(AccessReportBatchCallback callback) { accessReportCallback_ = callback; }
     
-    inline const bool RemoveProcessPid(std::map<pid_t, pid_t>& map, pid_t pid)
-    {
-#if __APPLE__
-        const std::lock_guard<std::mutex> lock(access_mutex);
-#endif
-        
-        auto result = map.find(pid);
-        if (result != map.end())
-        {
-            return (map.erase(pid) == 1);
-        }
-        
-        return false;
-    }
-    
-    inline const void SetAccessReportCallback(AccessReportCallback callback) { accessReportCallback_ = callback; }
+    /*!
+     * Returns the shared entry for 'path', so that processes running the same executable don't each hold a copy of its path.
+     * The path trie is case-insensitive, paths it can't hold or that only match an entry case-insensitively get their own entry.
+     */
+    std::shared_ptr<const PathCacheEntry> InternPath(const char *path, size_t length);
     
     std::shared_ptr<SandboxedProcess> FindTrackedProcess(pid_t pid);
     bool TrackRootProcess(std::shared_ptr<SandboxedPip> pip);
     bool TrackChildProcess(pid_t childPid, const char* childExecutable, std::shared_ptr<SandboxedProcess> parentProcess);
     bool UntrackProcess(pid_t pid, std::shared_ptr<SandboxedProcess> process);
+
+    /*!
+     * Whether no access to 'absolutePath' can produce a report for any of the running pips (see AccessHandler::IsUntrackedCone).
+     *
+     * EndpointSecurity caches auth results by executable and file, for every process, so an open of such a path is the only kind
+     * whose answer it may cache.  Starting a pip brings in a new manifest, which is why the cache is cleared then (see 'TrackRootProcess').
+     */
+    bool IsUntrackedForAllPips(const char *absolutePath);
     
-    void const SendAccessReport(AccessReport &report, std::shared_ptr<SandboxedPip> pip);
+    /*! How long a report may wait in the batch of its pip before the batch is handed to the access report callback */
+    static const uint64_t kAccessReportBatchLatencyNs = 2 * 1000 * 1000;
+
+    /*!
+     * Hands 'report', whose path is 'path', to the access report callback.  The callback takes AccessReports, so this is
+     * where the compact report gets expanded.
+     *
+     * On macOS every callback crosses into managed code, so reports are batched per pip (see SandboxedPip::BatchAccessReport) and
+     * handed over when a batch is full or 'kAccessReportBatchLatencyNs' after its first report.  Process exit and process
+     * tree completed reports are handed over right away, along with the batch they end, since BuildXL waits for them.
+     */
+    void const SendAccessReport(CompactAccessReport &report, const char *path, std::shared_ptr<SandboxedPip> pip);
+
+    /*!
+     * Timestamp for the 'stats' of access reports. On macOS this is the same clock the kernel extension and managed
+     * BuildXL (Sandbox.GetMachAbsoluteTime) use, so report latencies are measured the same way for every sandbox.
+     */
+    static inline uint64_t ReportTimestamp()
+    {
+#if __APPLE__
+        return mach_absolute_time();
+#else
+        return 0;
+#endif
+    }
 };
 
 #endif /* Sandbox_h */
@@ -7,6 +7,7 @@
 #include "BuildXLSandbox.hpp"
 #include "CacheRecord.hpp"
 #include "Listeners.hpp"
+#include "SlabCache.hpp"
 #include "Stopwatch.hpp"
 #include "SysCtl.hpp"
 #include "TrustedBsdHandler.hpp"
@@ -23,11 +24,14 @@ static KextConfig sDefaultConfig =
     .reportQueueSizeMB    = kSharedDataQueueSizeDefault,
     .enableReportBatching = false,
     .enableCatalinaDataPartitionFiltering = false,
+    .numberOfReportQueues = 1,
     .resourceThresholds   =
     {
-        .cpuUsageBlock     = 0,
-        .cpuUsageWakeup    = 0,
-        .minAvailableRamMB = 0
+        .cpuUsageBlock            = 0,
+        .cpuUsageWakeup           = 0,
+        .minAvailableRamMB        = 0,
+        .memoryPressureLevelBlock = 0,
+        .runQueueLengthBlock      = 0
     }
 };
 
@@ -45,6 +49,11 @@ bool BuildXLSandbox::init(OSDictionary *dictionary)
     bxl_sysctl_register();
     InitializePolicyStructures();
 
+    if (!Slabs::Init())
+    {
+        return false;
+    }
+
     lock_ = BXLRecursiveLockAlloc();
     if (!lock_)
     {
@@ -52,6 +61,9 @@ bool BuildXLSandbox::init(OSDictionary *dictionary)
     }
 
     ResetCounters();
+    telemetrySequenceNumber_ = 0;
+    lastTelemetryDrainTime_  = mach_absolute_time();
+
     resourceManager_ = ResourceManager::create(&counters_.resourceCounters);
     if (!resourceManager_)
     {
@@ -83,6 +95,9 @@ void BuildXLSandbox::free(void)
 
     bxl_sysctl_unregister();
 
+    // last, once everything allocated from the slab caches is released
+    Slabs::Cleanup();
+
     super::free();
 }
 
@@ -161,7 +176,7 @@ bool BuildXLSandbox::InitializeTries()
         return false;
     }
 
-    trackedProcesses_ = Trie::createUintTrie();
+    trackedProcesses_ = PidTable::create();
     if (!trackedProcesses_)
     {
         return false;
@@ -250,7 +265,7 @@ kern_return_t BuildXLSandbox::InitializeListeners()
 
 void BuildXLSandbox::UninitializeListeners()
 {
-    counters_ = {0};
+    ResetCounters();
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated"
@@ -297,6 +312,9 @@ void BuildXLSandbox::Configure(const KextConfig *config)
 
     config_ = *config;
 
+    // The configuration affects the policy found for a path (see 'enableCatalinaDataPartitionFiltering')
+    SandboxedPip::invalidateVNodeCaches();
+
     if (resourceManager_)
     {
         resourceManager_->SetThresholds(config_.resourceThresholds);
@@ -307,6 +325,11 @@ void BuildXLSandbox::Configure(const KextConfig *config)
     {
         config_.reportQueueSizeMB = kSharedDataQueueSizeDefault;
     }
+
+    if (config_.numberOfReportQueues == 0 || config_.numberOfReportQueues > kMaxReportQueues)
+    {
+        config_.numberOfReportQueues = 1;
+    }
 }
 
 UInt32 BuildXLSandbox::GetReportQueueEntryCount()
@@ -327,9 +350,10 @@ IOReturn BuildXLSandbox::AllocateNewClient(pid_t clientPid)
     {
         .entryCount     = GetReportQueueEntryCount(),
         .entrySize      = sizeof(AccessReport),
+        .spillCapacity  = GetReportQueueEntryCount() * kReportSpillFactor,
         .enableBatching = config_.enableReportBatching,
         .counters       = &counters_.reportCounters
-    });
+    }, config_.numberOfReportQueues);
     AutoRelease _(client);
 
     if (client == nullptr)
@@ -390,25 +414,25 @@ IOReturn BuildXLSandbox::DeallocateClient(pid_t clientPid)
     return kIOReturnError;
 }
 
-IOReturn BuildXLSandbox::SetReportQueueNotificationPort(mach_port_t port, pid_t clientPid)
+IOReturn BuildXLSandbox::SetReportQueueNotificationPort(mach_port_t port, pid_t clientPid, uint queueIndex)
 {
     EnterMonitor
 
     ClientInfo *client = GetClientInfo(clientPid);
     bool success =
         client != nullptr &&
-        client->setNotifactonPort(port);
+        client->setNotifactonPort(port, queueIndex);
 
     return success ? kIOReturnSuccess : kIOReturnError;
 }
 
-IOMemoryDescriptor* const BuildXLSandbox::GetReportQueueMemoryDescriptor(pid_t clientPid)
+IOMemoryDescriptor* const BuildXLSandbox::GetReportQueueMemoryDescriptor(pid_t clientPid, uint queueIndex)
 {
     EnterMonitor
 
     ClientInfo *client = GetClientInfo(clientPid);
     return client != nullptr
-        ? client->getMemoryDescriptor()
+        ? client->getMemoryDescriptor(queueIndex)
         : nullptr;
 }
 
@@ -430,9 +454,17 @@ bool const BuildXLSandbox::SendAccessReport(AccessReport &report, SandboxedPip *
     }
 
     AddTimeStampToAccessReport(&report, enqueueTime);
+    pip->recordReportLatency(report.stats.creationTime, report.stats.enqueueTime);
 
     bool success = client->enqueueReport({.report = report, .cacheRecord = cacheRecord});
 
+    // let the client catch up when reports come in faster than it drains them
+    if (success && resourceManager_ != nullptr && resourceManager_->ThrottleReportProducer(client->getSpilledPercent(report.pipId)))
+    {
+        Counters()->reportCounters.numThrottledReports++;
+        pip->Counters()->reportCounters.numThrottledReports++;
+    }
+
     Timespan reportFileAccessDuration  = stopwatch.lap();
     Counters()->reportFileAccess      += reportFileAccessDuration;
     pip->Counters()->reportFileAccess += reportFileAccessDuration;
@@ -583,7 +615,7 @@ error:
 bool BuildXLSandbox::UntrackProcess(pid_t pid, SandboxedProcess *process)
 {
     // remove the mapping for 'pid'
-    auto removeResult = trackedProcesses_->remove(pid);
+    auto removeResult = trackedProcesses_->remove(pid, process);
     bool removedExisting = removeResult == Trie::TrieResult::kTrieResultRemoved;
     if (removedExisting)
     {
@@ -612,20 +644,67 @@ static int BytesInAMegabyte = 1024 * 1024;
 
 #define COUNT_AND_SIZE(cls) { .count = cls::metaClass->getInstanceCount(), .size = (double)sizeof(cls) }
 
+static void AddDuration(DurationCounter *total, const DurationCounter &counter)
+{
+    total->count_      += counter.count_;
+    total->durationUs_ += counter.durationUs_;
+}
+
+AllCounters BuildXLSandbox::AggregateCounters() const
+{
+    AllCounters result = counters_;
+    for (int i = 0; i < kMaxCounterCpus; i++)
+    {
+        const AllCounters &cpu = cpuCounters_[i].counters;
+
+        AddDuration(&result.findTrackedProcess,  cpu.findTrackedProcess);
+        AddDuration(&result.setLastLookedUpPath, cpu.setLastLookedUpPath);
+        AddDuration(&result.checkPolicy,         cpu.checkPolicy);
+        AddDuration(&result.cacheLookup,         cpu.cacheLookup);
+        AddDuration(&result.getClientInfo,       cpu.getClientInfo);
+        AddDuration(&result.reportFileAccess,    cpu.reportFileAccess);
+        AddDuration(&result.accessHandler,       cpu.accessHandler);
+
+        result.numHardLinkRetries = result.numHardLinkRetries + cpu.numHardLinkRetries;
+        result.numForks           = result.numForks           + cpu.numForks;
+        result.numCacheHits       = result.numCacheHits       + cpu.numCacheHits;
+        result.numCacheMisses     = result.numCacheMisses     + cpu.numCacheMisses;
+        result.numCacheEvictions  = result.numCacheEvictions  + cpu.numCacheEvictions;
+    }
+
+    return result;
+}
+
 IntrospectResponse BuildXLSandbox::Introspect() const
 {
     EnterMonitor
 
+    SlabCounts cacheRecordSlabs = {0};
+    Slabs::cacheRecords.addCounts(&cacheRecordSlabs);
+
+    SlabCounts trieNodeSlabs = {0};
+    Slabs::lightNodes.addCounts(&trieNodeSlabs);
+    Slabs::fastNodes.addCounts(&trieNodeSlabs);
+    Slabs::uintNodeChildren.addCounts(&trieNodeSlabs);
+    Slabs::pathNodeChildren.addCounts(&trieNodeSlabs);
+
+    SlabCounts reportSlabs = {0};
+    Slabs::reportPayloads.addCounts(&reportSlabs);
+    Slabs::reportQueueElems.addCounts(&reportSlabs);
+
     IntrospectResponse result
     {
         .numAttachedClients  = connectedClients_->getCount(),
-        .counters            = counters_,
+        .counters            = AggregateCounters(),
         .memory              =
         {
             .totalAllocatedBytes = Alloc::numCurrentlyAllocatedBytes(),
             .fastNodes           = COUNT_AND_SIZE(NodeFast),
             .lightNodes          = COUNT_AND_SIZE(NodeLight),
-            .cacheRecords        = COUNT_AND_SIZE(CacheRecord)
+            .cacheRecords        = COUNT_AND_SIZE(CacheRecord),
+            .cacheRecordSlabs    = cacheRecordSlabs,
+            .trieNodeSlabs       = trieNodeSlabs,
+            .reportSlabs         = reportSlabs
         },
         .kextConfig          = config_,
         .numReportedPips     = 0,
@@ -710,4 +789,58 @@ IntrospectResponse BuildXLSandbox::Introspect() const
     return result;
 }
 
+typedef struct {
+    UInt32 sequenceNumber;
+    TelemetryResponse *response;
+} DrainTelemetryState;
+
+void BuildXLSandbox::DrainTelemetry(TelemetryResponse *response)
+{
+    EnterMonitor
+
+    uint64_t now = mach_absolute_time();
+
+    response->sequenceNumber    = (UInt32)OSIncrementAtomic(&telemetrySequenceNumber_) + 1;
+    response->intervalStartTime = lastTelemetryDrainTime_;
+    response->intervalEndTime   = now;
+    response->numQueuedReports  = counters_.reportCounters.numQueued.count();
+    response->numPips           = 0;
+    response->numDroppedPips    = 0;
+
+    lastTelemetryDrainTime_ = now;
+
+    DrainTelemetryState state
+    {
+        .sequenceNumber = (UInt32)response->sequenceNumber,
+        .response       = response
+    };
+
+    trackedProcesses_->forEach(&state, [](void *data, uint64_t key, const OSObject *value)
+    {
+        DrainTelemetryState *state = (DrainTelemetryState*)data;
+        SandboxedProcess *proc = OSDynamicCast(SandboxedProcess, value);
+        if (proc == nullptr)
+        {
+            return;
+        }
+
+        proc->retain();
+        AutoRelease _(proc);
+
+        SandboxedPip *pip = proc->getPip();
+        TelemetryResponse *response = state->response;
+        if (response->numPips == kMaxTelemetryPips)
+        {
+            // don't drain pips that don't fit (their deltas keep accumulating until the next drain)
+            if (key == pip->getProcessId()) response->numDroppedPips++;
+            return;
+        }
+
+        if (pip->drainTelemetry(state->sequenceNumber, &response->pips[response->numPips]))
+        {
+            response->numPips++;
+        }
+    });
+}
+
 #undef super
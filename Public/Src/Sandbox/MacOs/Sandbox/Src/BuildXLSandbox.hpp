@@ -6,23 +6,34 @@
 
 #include <IOKit/IOService.h>
 #include <sys/kauth.h>
+#include <kern/cpu_number.h>
 
 #include "AutoRelease.hpp"
 #include "Listeners.hpp"
 #include "BuildXLSandboxShared.hpp"
 #include "ConcurrentDictionary.hpp"
+#include "PidTable.hpp"
 #include "ClientInfo.hpp"
 #include "ResourceManager.hpp"
 #include "SandboxedProcess.hpp"
 
 #if RELEASE
-    #define kSharedDataQueueSizeDefault 256
+    #define kSharedDataQueueSizeDefault 64
 #else
     #define kSharedDataQueueSizeDefault 16
 #endif
 
 #define kSharedDataQueueSizeMax 2048
 
+/*!
+ * Reports that don't fit into a report queue are spilled (see 'ConcurrentSharedDataQueue'), up to this many times the
+ * number of entries of the queue.  Unlike the queue, which is allocated up front, memory for spilled reports is only allocated once a burst needs it.
+ */
+#define kReportSpillFactor 4
+
+/*! Number of per-CPU counter blocks; CPUs beyond this share blocks (which is still correct, see 'CpuCounters') */
+#define kMaxCounterCpus 64
+
 #define AddTimeStampToAccessReport(report, struct_property)\
 do { (report)->stats.struct_property = mach_absolute_time(); }while(0);
 
@@ -39,8 +50,31 @@ private:
     struct mac_policy_ops buildxlPolicyOps_;
     struct mac_policy_conf policyConfiguration_;
 
+    /*!
+     * Counters that are not bumped per file access: 'resourceCounters' (maintained by 'resourceManager_') and
+     * 'reportCounters' (maintained by the report queues), which hold gauges that are read live.
+     */
     AllCounters counters_;
 
+    /*!
+     * The event counters bumped on every kauth/MAC callback (see 'Counters'), one block per CPU so that the
+     * cores don't keep stealing the same cache lines from one another.  A thread can migrate between picking
+     * a block and updating it, so updates stay atomic; they are just not contended anymore.
+     *
+     * Aggregated only on demand (see 'AggregateCounters').
+     */
+    typedef struct alignas(64) { AllCounters counters; } CpuCounters;
+    CpuCounters cpuCounters_[kMaxCounterCpus];
+
+    /*! 'counters_' plus the sum of the event counters of all 'cpuCounters_' */
+    AllCounters AggregateCounters() const;
+
+    /*! Sequence number of the last telemetry drain (see 'DrainTelemetry') */
+    volatile UInt32 telemetrySequenceNumber_;
+
+    /*! Time (mach absolute time) of the last telemetry drain */
+    uint64_t lastTelemetryDrainTime_;
+
     /*!
      * A dictionary (PID -> ClientInfo*) keeping track of connected clients.
      * The key in the dictionary is the process id of the connected client.
@@ -79,8 +113,10 @@ private:
      *     is being tracked, hence, a VERY EFFICIENT implementation of utmost importance;
      *
      *   - when a tracked process exits the process is removed from this dictionary.
+     *
+     * A direct-mapped PidTable rather than a uint Trie, so that the lookup on every file access is a single load.
      */
-    Trie *trackedProcesses_;
+    PidTable *trackedProcesses_;
 
     ClientInfo* GetClientInfo(pid_t clientPid);
 
@@ -110,35 +146,40 @@ public:
     IOReturn InitializeListeners();
     void UninitializeListeners();
 
-    AllCounters* Counters()           { return &counters_; }
+    /*! The counter block of the current CPU; only meant for event counters, i.e., not 'resourceCounters' or 'reportCounters' */
+    AllCounters* Counters()           { return &cpuCounters_[cpu_number() % kMaxCounterCpus].counters; }
     ResourceManager* ResourceManger() { return resourceManager_; }
 
     inline void ResetCounters()
     {
         counters_ = {0};
+        for (int i = 0; i < kMaxCounterCpus; i++)
+        {
+            cpuCounters_[i].counters = {0};
+        }
     }
 
     /*!
-     * Sets the notification port for the shared data queue for the client process 'pid'.
+     * Sets the notification port for the shared data queue at 'queueIndex' for the client process 'pid'.
      */
-    IOReturn SetReportQueueNotificationPort(mach_port_t port, pid_t pid);
+    IOReturn SetReportQueueNotificationPort(mach_port_t port, pid_t pid, uint queueIndex);
 
     /*!
-     * Returns a newly allocated memory descriptor of the shared data queue for the client process 'pid'.
+     * Returns a newly allocated memory descriptor of the shared data queue at 'queueIndex' for the client process 'pid'.
      *
      * NOTE: the caller is responsible for releasing the returned object.
      */
-    IOMemoryDescriptor* const GetReportQueueMemoryDescriptor(pid_t pid);
+    IOMemoryDescriptor* const GetReportQueueMemoryDescriptor(pid_t pid, uint queueIndex);
 
     /*!
-     * Send the access report to only one queue using the round robin strategy
+     * Sends the access report to the client's shared data queue for the report's pip
      */
     bool const SendAccessReport(AccessReport &report, SandboxedPip *pip, const CacheRecord *cacheRecord);
 
 #pragma mark Client Failure Notification Mapping
 
     /*!
-     * Sets the async failure handle for the shared data queue belonging to client process 'pid'
+     * Sets the async failure handle for the shared data queues belonging to client process 'pid'
      */
     inline IOReturn SetFailureNotificationHandlerForClientPid(pid_t pid, OSAsyncReference64 ref, OSObject *client)
     {
@@ -186,6 +227,14 @@ public:
      * Introspect the current state of the sandbox.
      */
     IntrospectResponse Introspect() const;
+
+    /*!
+     * Fills 'response' with what changed for every active pip since the previous call (per-pip report counts,
+     * report latency histograms, and cache hits/misses), so that telemetry can be streamed without full snapshots.
+     *
+     * Draining resets the per-pip deltas, so there should be a single consumer of this telemetry at a time.
+     */
+    void DrainTelemetry(TelemetryResponse *response);
 };
 
 #endif /* BuildXLSandbox_hpp */
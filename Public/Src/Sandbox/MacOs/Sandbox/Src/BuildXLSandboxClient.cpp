@@ -4,6 +4,7 @@
 #include <IOKit/IOLib.h>
 
 #include "AccessHandler.hpp"
+#include "Alloc.hpp"
 #include "Buffer.hpp"
 #include "TrustedBsdHandler.hpp"
 #include "BuildXLSandboxClient.hpp"
@@ -86,54 +87,46 @@ IOReturn BuildXLSandboxClient::registerNotificationPort(mach_port_t port, UInt32
     }
 
     // Extend this to add additional shared data queues later, e.g. logging
-    switch(type)
+    if (type >= FileAccessReporting && type < FileAccessReporting + kMaxReportQueues)
     {
-        case FileAccessReporting:
+        pid_t pid = proc_selfpid();
+        IOReturn result = sandbox_->SetReportQueueNotificationPort(port, pid, type - FileAccessReporting);
+        if (result != kIOReturnSuccess)
         {
-            pid_t pid = proc_selfpid();
-            IOReturn result = sandbox_->SetReportQueueNotificationPort(port, pid);
-            if (result != kIOReturnSuccess)
-            {
-                log_error("%s", "Failed setting the notifacation port!");
-                return result;
-            }
-
-            LogVerbose("Registered port for pid (%d)", pid);
-            break;
+            log_error("%s", "Failed setting the notifacation port!");
+            return result;
         }
-        default:
-            return kIOReturnBadArgument;
+
+        LogVerbose("Registered port for pid (%d), queue (%d)", pid, type - FileAccessReporting);
+        return kIOReturnSuccess;
     }
 
-    return kIOReturnSuccess;
+    return kIOReturnBadArgument;
 }
 
 // Called in response to IOConnectMapMemory from user space
 IOReturn BuildXLSandboxClient::clientMemoryForType(UInt32 type, IOOptionBits *options, IOMemoryDescriptor **memory)
 {
-    switch (type)
+    if (type >= FileAccessReporting && type < FileAccessReporting + kMaxReportQueues)
     {
-        case FileAccessReporting:
+        pid_t pid = proc_selfpid();
+        *options = 0;
+        // NOTE: GetReportQueueMemoryDescriptor allocates a new object that must be released;
+        //       here we are assigning that value to '*memory' which is as an "out argument",
+        //       so the caller is responsible for releasing it.  Concretely, the caller is
+        //       the super class IOUserClient, which indeed releases this object appropriately.
+        *memory = sandbox_->GetReportQueueMemoryDescriptor(pid, type - FileAccessReporting);
+        if (*memory == nullptr)
         {
-            pid_t pid = proc_selfpid();
-            *options = 0;
-            // NOTE: GetReportQueueMemoryDescriptor allocates a new object that must be released;
-            //       here we are assigning that value to '*memory' which is as an "out argument",
-            //       so the caller is responsible for releasing it.  Concretely, the caller is
-            //       the super class IOUserClient, which indeed releases this object appropriately.
-            *memory = sandbox_->GetReportQueueMemoryDescriptor(pid);
-            if (*memory == nullptr)
-            {
-                log_error("%s", "Descriptor creation failed!");
-                return kIOReturnVMError;
-            }
-
-            LogVerbose("Descriptor set for pid (%d)", pid);
-            return kIOReturnSuccess;
+            log_error("%s", "Descriptor creation failed!");
+            return kIOReturnVMError;
         }
-        default:
-            return kIOReturnBadArgument;
+
+        LogVerbose("Descriptor set for pid (%d), queue (%d)", pid, type - FileAccessReporting);
+        return kIOReturnSuccess;
     }
+
+    return kIOReturnBadArgument;
 }
 
 #pragma mark IPC implementation
@@ -167,7 +160,7 @@ IOExternalMethodDispatch BuildXLSandboxClient::ipcMethods[kSandboxMethodCount] =
     // kIpcActionUpdateResourceUsage
     {
         .function                 = (IOExternalMethodAction) &BuildXLSandboxClient::sUpdateResourceUsage,
-        .checkScalarInputCount    = 2,
+        .checkScalarInputCount    = 4,
         .checkStructureInputSize  = 0,
         .checkScalarOutputCount   = 0,
         .checkStructureOutputSize = 0
@@ -188,6 +181,14 @@ IOExternalMethodDispatch BuildXLSandboxClient::ipcMethods[kSandboxMethodCount] =
         .checkScalarOutputCount   = 0,
         .checkStructureOutputSize = sizeof(IntrospectResponse)
     },
+    // kIpcActionDrainTelemetry
+    {
+        .function                 = (IOExternalMethodAction) &BuildXLSandboxClient::sDrainTelemetryHandler,
+        .checkScalarInputCount    = 0,
+        .checkStructureInputSize  = 0,
+        .checkScalarOutputCount   = 0,
+        .checkStructureOutputSize = sizeof(TelemetryResponse)
+    },
 };
 
 IOReturn BuildXLSandboxClient::externalMethod(uint32_t selector, IOExternalMethodArguments *arguments,
@@ -229,8 +230,11 @@ IOReturn BuildXLSandboxClient::sConfigure(BuildXLSandboxClient *target, void *re
 
 IOReturn BuildXLSandboxClient::sUpdateResourceUsage(BuildXLSandboxClient *target, void *reference, IOExternalMethodArguments *arguments)
 {
-    target->sandbox_->ResourceManger()->UpdateCpuUsage({ .value = (uint)arguments->scalarInput[0] });
-    target->sandbox_->ResourceManger()->UpdateAvailableRam((uint)arguments->scalarInput[1]);
+    target->sandbox_->ResourceManger()->UpdateResourceUsage(
+        /* cpuUsage */            { .value = (uint)arguments->scalarInput[0] },
+        /* availableRamMB */      (uint)arguments->scalarInput[1],
+        /* memoryPressureLevel */ (uint)arguments->scalarInput[2],
+        /* runQueueLength */      { .value = (uint)arguments->scalarInput[3] });
     return kIOReturnSuccess;
 }
 
@@ -257,6 +261,32 @@ IOReturn BuildXLSandboxClient::sIntrospectHandler(BuildXLSandboxClient *target,
     return bytesWritten == sizeof(result) ? kIOReturnSuccess : kIOReturnError;
 }
 
+IOReturn BuildXLSandboxClient::sDrainTelemetryHandler(BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args)
+{
+    IOMemoryDescriptor *outMemDesc = args->structureOutputDescriptor;
+
+    IOReturn prepared = outMemDesc->prepare();
+    if (prepared != kIOReturnSuccess)
+    {
+        return kIOReturnNoMemory;
+    }
+
+    TelemetryResponse *result = Alloc::New<TelemetryResponse>(1);
+    if (result == nullptr)
+    {
+        outMemDesc->complete();
+        return kIOReturnNoMemory;
+    }
+
+    target->sandbox_->DrainTelemetry(result);
+    IOByteCount bytesWritten = outMemDesc->writeBytes(0, result, sizeof(TelemetryResponse));
+    Alloc::Delete<TelemetryResponse>(result, 1);
+
+    outMemDesc->complete();
+
+    return bytesWritten == sizeof(TelemetryResponse) ? kIOReturnSuccess : kIOReturnError;
+}
+
 IOReturn BuildXLSandboxClient::sPipStateChanged(BuildXLSandboxClient *target, void *reference, IOExternalMethodArguments *arguments)
 {
     return target->PipStateChanged((PipStateChangedRequest *)arguments->structureInput);
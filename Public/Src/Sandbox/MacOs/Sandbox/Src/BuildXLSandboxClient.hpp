@@ -61,6 +61,7 @@ protected:
     static IOReturn sUpdateResourceUsage          (BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
     static IOReturn sSetFailureNotificationHandler(BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
     static IOReturn sIntrospectHandler            (BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
+    static IOReturn sDrainTelemetryHandler        (BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
 
     IOReturn PipStateChanged(PipStateChangedRequest *data);
     IOReturn ProcessPipStarted(PipStateChangedRequest *data);
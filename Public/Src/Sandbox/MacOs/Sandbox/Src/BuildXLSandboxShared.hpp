@@ -53,6 +53,7 @@ typedef enum {
     kIpcActionUpdateResourceUsage,
     kIpcActionSetupFailureNotificationHandler,
     kIpcActionIntrospect,
+    kIpcActionDrainTelemetry,
     kSandboxMethodCount
 } IpcAction;
 
@@ -81,12 +82,12 @@ public:
     Counter() : count_(0) {}
     Counter(uint32_t cnt) : count_(cnt) {}
 
-    uint32_t count()
+    uint32_t count() const
     {
         return count_;
     }
 
-    uint32_t operator+ (Counter other) { return count_ + other.count_; }
+    uint32_t operator+ (Counter other) const { return count_ + other.count_; }
     double operator* (double other)    { return count_ * other; }
 
     void operator++ (int)
@@ -104,6 +105,15 @@ public:
        if (g_bxl_enable_counters) OSDecrementAtomic(&count_);
 #else
         --count_;
+#endif
+    }
+
+    void operator+= (uint32_t cnt)
+    {
+#if MAC_OS_SANDBOX
+       if (g_bxl_enable_counters) OSAddAtomic(cnt, &count_);
+#else
+        count_ += cnt;
 #endif
     }
 } Counter;
@@ -151,6 +161,15 @@ typedef struct {
     uint availableRamMB;
     uint numTrackedProcesses;
     uint numBlockedProcesses;
+
+    /*! Value of 'kern.memorystatus_vm_pressure_level' (1: normal, 2: warning, 4: critical); 0 when unknown */
+    uint memoryPressureLevel;
+
+    /*! Number of runnable threads per logical core (10000 basis points = one runnable thread on every core) */
+    basis_points runQueueLength;
+
+    /*! CPU usage predicted from the recent trend of 'cpuUsage' (exponentially weighted moving averages) */
+    basis_points predictedCpuUsage;
 } ResourceCounters;
 
 typedef struct {
@@ -159,6 +178,12 @@ typedef struct {
     Counter freeListNodeCount;
     double freeListSizeMB;
     Counter numCoalescedReports;
+
+    /*! Reports that were kept aside because a report queue was full */
+    Counter numSpilledReports;
+
+    /*! Reports after which the reporting process was slowed down because of spilled reports */
+    Counter numThrottledReports;
 } ReportCounters;
 
 typedef struct {
@@ -166,11 +191,26 @@ typedef struct {
     double size;
 } CountAndSize;
 
+/*! Counts of the slab caches objects of a given kind are allocated from (see SlabCache) */
+typedef struct {
+    /*! Objects currently allocated */
+    uint numInUse;
+
+    /*! Objects ready to be handed out again without allocating */
+    uint numFree;
+
+    /*! Memory taken by the slabs */
+    uint64_t slabBytes;
+} SlabCounts;
+
 typedef struct mcas_ {
     int64_t totalAllocatedBytes;
     CountAndSize fastNodes;
     CountAndSize lightNodes;
     CountAndSize cacheRecords;
+    SlabCounts cacheRecordSlabs;
+    SlabCounts trieNodeSlabs;
+    SlabCounts reportSlabs;
 } MemoryCountsAndSizes;
 
 typedef struct ac_ {
@@ -187,6 +227,10 @@ typedef struct ac_ {
     Counter numForks;
     Counter numCacheHits;
     Counter numCacheMisses;
+    Counter numCacheEvictions;
+
+    /*! Lookups that needed no handling because they were relative to a directory in a uniform lookup cone */
+    Counter numSkippedLookups;
 } AllCounters;
 
 typedef struct rt_ {
@@ -194,6 +238,12 @@ typedef struct rt_ {
     percent cpuUsageWakeup;
     uint minAvailableRamMB;
 
+    /*! Block processes when memory pressure level reaches this value (0 means never) */
+    uint memoryPressureLevelBlock;
+
+    /*! Block processes when the number of runnable threads per core (in percent) reaches this value (0 means never) */
+    percent runQueueLengthBlock;
+
     percent GetCpuUsageForWakeup() const
     {
         return cpuUsageWakeup.value > 0 ? cpuUsageWakeup : cpuUsageBlock;
@@ -205,6 +255,7 @@ typedef struct {
     bool enableReportBatching;
     ResourceThresholds resourceThresholds;
     bool enableCatalinaDataPartitionFiltering;
+    uint numberOfReportQueues;
 } KextConfig;
 
 #define kMaxReportedPips 30
@@ -239,6 +290,40 @@ typedef struct {
     PipInfo pips[kMaxReportedPips];
 } IntrospectResponse;
 
+// Report latency histograms have kTelemetryLatencyBuckets buckets: bucket 0 counts latencies below 1us, bucket i (i > 0)
+// counts latencies in [2^(i-1), 2^i) us, except for the last bucket which counts all latencies from 2^(i-1) us on.
+#define kTelemetryLatencyBuckets 16
+#define kMaxTelemetryPips 64
+
+/*! What changed for a pip since the previous telemetry drain */
+typedef struct {
+    pipid_t pipId;
+    pid_t pid;
+    pid_t clientPid;
+    uint32_t numReports;
+    uint32_t numCacheHits;
+    uint32_t numCacheMisses;
+    uint32_t enqueueLatency[kTelemetryLatencyBuckets]; // from report creation to report enqueue
+} PipTelemetryDelta;
+
+/*!
+ * Telemetry accumulated since the previous drain (by any client).  Only pips that were active in that interval are included,
+ * and only the first 'numPips' entries of 'pips' are valid, so consumers can stream just those.
+ */
+typedef struct {
+    uint64_t sequenceNumber;
+    uint64_t intervalStartTime; // mach absolute time
+    uint64_t intervalEndTime;   // mach absolute time
+    uint32_t numQueuedReports;  // current depth of all report queues (not a delta)
+    uint32_t numPips;
+    uint32_t numDroppedPips;    // active pips that didn't fit into 'pips' (their deltas are carried over to the next drain)
+    PipTelemetryDelta pips[kMaxTelemetryPips];
+} TelemetryResponse;
+
+// Every client gets 'KextConfig::numberOfReportQueues' report queues (between 1 and kMaxReportQueues), and reports are sharded
+// between them by pip id.  The memory/notification port type of the report queue at index i is 'FileAccessReporting + i'.
+#define kMaxReportQueues 16
+
 typedef enum {
     FileAccessReporting,
 } ReportQueueType;
@@ -261,6 +346,7 @@ typedef struct {
     uint32_t cacheNodeSize;
     uint32_t numForks;
     uint32_t numHardLinkRetries;
+    uint32_t numCacheEvictions;
 } PipCompletionStats; // sizeof(PipCompletionStats) must be less than MAXPATHLEN, i.e., 1024
 
 typedef struct {
@@ -286,15 +372,163 @@ typedef struct {
     bool shouldReport;
 } AccessReport;
 
+// Reports are sent through the shared data queue as variable-length entries: the fields of an AccessReport other than its
+// path buffer, followed by only the used part of the path buffer (the 0-terminated path, or the pip stats).
+#define kAccessReportPathOffset   offsetof(AccessReport, path)
+#define kAccessReportSuffixOffset offsetof(AccessReport, stats)
+#define kAccessReportSuffixSize   (sizeof(AccessReport) - kAccessReportSuffixOffset)
+#define kAccessReportEntryHeaderSize (kAccessReportPathOffset + kAccessReportSuffixSize)
+
+/*!
+ * Writes the shared data queue entry for 'report' into 'entry' (which must be at least sizeof(AccessReport) bytes long),
+ * keeping only the first 'pathLength' bytes of its path buffer.  Returns the size of the entry.
+ */
+inline uint32_t PackAccessReport(const AccessReport &report, uint32_t pathLength, char *entry)
+{
+    if (pathLength > MAXPATHLEN) pathLength = MAXPATHLEN;
+    memcpy(entry, &report, kAccessReportPathOffset);
+    memcpy(entry + kAccessReportPathOffset, (const char*)&report + kAccessReportSuffixOffset, kAccessReportSuffixSize);
+    memcpy(entry + kAccessReportEntryHeaderSize, report.path, pathLength);
+    return (uint32_t)(kAccessReportEntryHeaderSize + pathLength);
+}
+
+/*!
+ * Reads back a report written by 'PackAccessReport' (the unused part of its path buffer is zeroed).
+ * Returns false if 'entrySize' is not the size of a valid entry.
+ */
+inline bool UnpackAccessReport(const char *entry, uint32_t entrySize, AccessReport *report)
+{
+    if (entrySize < kAccessReportEntryHeaderSize || entrySize > kAccessReportEntryHeaderSize + MAXPATHLEN)
+    {
+        return false;
+    }
+
+    uint32_t pathLength = entrySize - kAccessReportEntryHeaderSize;
+    memcpy(report, entry, kAccessReportPathOffset);
+    memcpy((char*)report + kAccessReportSuffixOffset, entry + kAccessReportPathOffset, kAccessReportSuffixSize);
+    memcpy(report->path, entry + kAccessReportEntryHeaderSize, pathLength);
+    memset(report->path + pathLength, 0, MAXPATHLEN - pathLength);
+    return true;
+}
+
+/*!
+ * Fixed-size part of an AccessReport, with the path kept out of line: 'pathOffset' and 'pathLength' (not counting the
+ * terminating 0) locate it in the path arena of the batch the report belongs to (see AccessReportArena).
+ *
+ * Reports are built and passed around in this form on the hot path, where most paths are much shorter than the MAXPATHLEN
+ * buffer of an AccessReport, and only expanded into an AccessReport where that layout is part of an interface
+ * (see ExpandAccessReport).
+ */
+typedef struct {
+    FileOperation operation;
+    pid_t pid;
+    pid_t rootPid;
+    DWORD requestedAccess;
+    DWORD status;
+    uint reportExplicitly;
+    DWORD error;
+    pipid_t pipId;
+    AccessReportStatistics stats;
+    uint isDirectory;
+    bool shouldReport;
+    uint32_t pathOffset;
+    uint32_t pathLength;
+} CompactAccessReport;
+
+/*!
+ * Append-only storage for the paths of a batch of CompactAccessReports.  Only the bytes that get used are ever written.
+ */
+template <uint32_t kCapacity>
+struct AccessReportArena
+{
+    uint32_t length = 0;
+    char buffer[kCapacity];
+
+    /*!
+     * Copies 'path' into the arena and points 'report' at the copy.  Like AccessReport::path, paths are truncated to
+     * MAXPATHLEN - 1 bytes, and further if the arena runs out of space.
+     */
+    inline void SetPath(CompactAccessReport &report, const char *path, size_t pathLength)
+    {
+        uint32_t available = kCapacity - length;
+        if (available == 0)
+        {
+            // The last byte of a full arena is the terminating 0 of the last path it got
+            report.pathOffset = kCapacity - 1;
+            report.pathLength = 0;
+            return;
+        }
+
+        size_t maxLength = (available < MAXPATHLEN ? available : MAXPATHLEN) - 1;
+        if (pathLength > maxLength) pathLength = maxLength;
+
+        memcpy(buffer + length, path, pathLength);
+        buffer[length + pathLength] = '\0';
+        report.pathOffset = length;
+        report.pathLength = (uint32_t)pathLength;
+        length += (uint32_t)pathLength + 1;
+    }
+
+    inline void SetPath(CompactAccessReport &report, const char *path)
+    {
+        SetPath(report, path, strnlen(path, MAXPATHLEN));
+    }
+
+    inline const char *PathOf(const CompactAccessReport &report) const { return buffer + report.pathOffset; }
+};
+
+/*! The fixed-size fields of 'report', with an empty path */
+inline CompactAccessReport CompactAccessReportHeader(const AccessReport &report)
+{
+    return
+    {
+        .operation        = report.operation,
+        .pid              = report.pid,
+        .rootPid          = report.rootPid,
+        .requestedAccess  = report.requestedAccess,
+        .status           = report.status,
+        .reportExplicitly = report.reportExplicitly,
+        .error            = report.error,
+        .pipId            = report.pipId,
+        .stats            = report.stats,
+        .isDirectory      = report.isDirectory,
+        .shouldReport     = report.shouldReport,
+        .pathOffset       = 0,
+        .pathLength       = 0,
+    };
+}
+
+/*!
+ * Writes 'compact', whose path is 'path', into 'report' for the consumers of the AccessReport layout.
+ * Only the used part of the path buffer is written.
+ */
+inline void ExpandAccessReport(const CompactAccessReport &compact, const char *path, AccessReport *report)
+{
+    report->operation        = compact.operation;
+    report->pid              = compact.pid;
+    report->rootPid          = compact.rootPid;
+    report->requestedAccess  = compact.requestedAccess;
+    report->status           = compact.status;
+    report->reportExplicitly = compact.reportExplicitly;
+    report->error            = compact.error;
+    report->pipId            = compact.pipId;
+    report->stats            = compact.stats;
+    report->isDirectory      = compact.isDirectory;
+    report->shouldReport     = compact.shouldReport;
+    memcpy(report->path, path, compact.pathLength);
+    report->path[compact.pathLength] = '\0';
+}
+
 // Some IOEvents may result in a pair of reports (the typical case is an operation that involves a source and a 
 // destination). To avoid allocations related to arrays/vectors, an AccessReportGroup is used, representing
 // one or two access reports that need to be reported to managed BuildXL. Therefore, an access report group 
 // typically contains a valid first report, and  may or may not contain a valid second report. 
 // The 'shouldReport' member should be used to determine whether an actual report is there to be reported.
-// is actually
+// The paths of both reports live in the arena of the group.
 struct AccessReportGroup {
-    AccessReport firstReport;
-    AccessReport secondReport;
+    CompactAccessReport firstReport;
+    CompactAccessReport secondReport;
+    AccessReportArena<2 * MAXPATHLEN> paths;
 
     // Initializes both reports by setting `shouldReport` to false
     AccessReportGroup()
@@ -309,6 +543,8 @@ struct AccessReportGroup {
         firstReport.error = err;
         secondReport.error = err;
     }
+
+    inline const char *PathOf(const CompactAccessReport &report) const { return paths.PathOf(report); }
 };
 
 inline bool HasAnyFlags(const int source, const int bitMask)
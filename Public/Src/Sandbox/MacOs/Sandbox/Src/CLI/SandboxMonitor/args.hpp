@@ -11,6 +11,7 @@
   m(stacked,     bool,   false)                \
   m(no_header,   bool,   false)                \
   m(interactive, bool,   false)                \
+  m(telemetry,   bool,   false)                \
   m(ps_fmt,      string, "%cpu,%mem,ucomm")
 
 GEN_CONFIG_DECL(ALL_ARGS)
@@ -46,6 +47,12 @@ void ConfigureArgs() {
         ->ShortName("i")
         ->Description("Runs the monitor continuously until interrupted.");
     
+    Config::argMeta(kArg_telemetry)
+        ->LongName("telemetry")
+        ->ShortName("m")
+        ->Description("Streams per-pip telemetry deltas to stdout in binary form instead of rendering tables: every 'delay' seconds "
+                      "(until interrupted), one TelemetryResponse header followed by its 'numPips' PipTelemetryDelta entries.");
+
     Config::argMeta(kArg_ps_fmt)
         ->LongName("ps-fmt")
         ->ShortName("f")
@@ -86,6 +86,14 @@ string renderCountAndSize(CountAndSize cnt)
     return str.str();
 }
 
+string renderSlabCounts(SlabCounts cnt)
+{
+    stringstream str;
+    str << to_string(cnt.numInUse) << " used, " << to_string(cnt.numFree) << " free"
+        << " (" << renderBytesAsMebabytes(cnt.slabBytes) << ")";
+    return str.str();
+}
+
 string to_string(Counter cnt)         { return to_string(cnt.count()); }
 string to_string(DurationCounter cnt) { return renderCounterMicros(cnt); }
 string to_string(string str)          { return str; }
@@ -106,6 +114,7 @@ vector<vector<HeaderColumn<Tuple>>> getStackedHeaders(const Config &cfg)
             {   6, "#Forks",  to_getter(t.pip.counters.numForks) },
             {   8, "#C+",     to_getter(t.pip.counters.numCacheHits) },
             {   8, "#C-",     to_getter(t.pip.counters.numCacheMisses) },
+            {   8, "#C~",     to_getter(t.pip.counters.numCacheEvictions) },
             {   8, "#C",      to_getter(t.pip.cacheSize) },
             {   4, "C%",      to_getter((int)floor(PERCENT(t.pip.counters.numCacheHits.count(), t.pip.counters.numCacheMisses.count()))) },
             {   8, "avg(FP)", to_getter(t.pip.counters.findTrackedProcess) },
@@ -238,6 +247,36 @@ bool sanitizePsFormat(Config *cfg)
     return true;
 }
 
+/*!
+ * Writes a telemetry record to stdout every 'cfg.delay' seconds until interrupted.  Only the valid part of each
+ * 'TelemetryResponse' is written: the header (everything before 'pips') followed by 'numPips' entries.
+ */
+int streamTelemetry(const Config &cfg, KextConnectionInfo info)
+{
+    // discard what has accumulated so far, so the first record covers a full interval
+    TelemetryResponse *response = new TelemetryResponse;
+    bool success = DrainKextTelemetry(info, response);
+
+    while (success && !g_interrupted)
+    {
+        sleep(cfg.delay);
+
+        success = DrainKextTelemetry(info, response);
+        if (!success)
+        {
+            error("%s", "Failed to drain sandbox kernel extension telemetry");
+            break;
+        }
+
+        fwrite(response, offsetof(TelemetryResponse, pips), 1, stdout);
+        fwrite(response->pips, sizeof(PipTelemetryDelta), response->numPips, stdout);
+        fflush(stdout);
+    }
+
+    delete response;
+    return success || g_interrupted ? 0 : 1;
+}
+
 int main(int argc, const char * argv[])
 {
     signal(SIGINT, signalHandler);
@@ -280,6 +319,13 @@ int main(int argc, const char * argv[])
         return 1;
     }
     
+    if (cfg.telemetry)
+    {
+        int exitCode = streamTelemetry(cfg, info);
+        DeinitializeKextConnection(info);
+        return exitCode;
+    }
+
     char version[10];
     KextVersionString(version, 10);
     
@@ -340,10 +386,13 @@ int main(int argc, const char * argv[])
             output << "Config     :: "
                    << "Catalina Data Partition filtering: " << (kextCfg->enableCatalinaDataPartitionFiltering ? "YES" : "NO")
                    << ", Report Queue Size: " << kextCfg->reportQueueSizeMB << " MB"
+                   << ", #Report Queues: " << kextCfg->numberOfReportQueues
                    << endl;
             output << "Thresholds :: "
                    << "Min Available RAM: " << thresholds->minAvailableRamMB << " MB"
                    << ", CPU usage: [" << thresholds->GetCpuUsageForWakeup().value << "..." << thresholds->cpuUsageBlock.value << "]%"
+                   << ", Memory pressure level: " << thresholds->memoryPressureLevelBlock
+                   << ", Run queue: " << thresholds->runQueueLengthBlock.value << "%"
                    << endl;
             output << "Counters   :: "
                    << "Avg(FindProcess/SetLastPath/PolicyCheck/CacheLookup/GetClient/ReportFileAccess/AccessHandler): "
@@ -359,8 +408,11 @@ int main(int argc, const char * argv[])
                    << "#Queued: " << to_string(response.counters.reportCounters.numQueued)
                    << ", Total: " << to_string(response.counters.reportCounters.totalNumSent)
                    << ", #HardLink retries: " << to_string(response.counters.numHardLinkRetries)
+                   << ", #Skipped lookups: " << to_string(response.counters.numSkippedLookups)
                    << ", #CoalescedReports: " << to_string(response.counters.reportCounters.numCoalescedReports)
                    << " (" << renderDouble(PERCENT(response.counters.reportCounters.numCoalescedReports.count(), response.counters.reportCounters.totalNumSent.count())) << "%)"
+                   << ", #Spilled: " << to_string(response.counters.reportCounters.numSpilledReports)
+                   << ", #Throttled: " << to_string(response.counters.reportCounters.numThrottledReports)
                    << endl;
             output << "Memory     :: "
                    << "FastTrieNodes: " << renderCountAndSize(response.memory.fastNodes)
@@ -370,10 +422,18 @@ int main(int argc, const char * argv[])
                    << " (" << renderDouble(response.counters.reportCounters.freeListSizeMB) << " MB)"
                    << ", IONew allocations: " << renderBytesAsMebabytes(response.memory.totalAllocatedBytes)
                    << endl;
+            output << "Slabs      :: "
+                   << "TrieNodes: " << renderSlabCounts(response.memory.trieNodeSlabs)
+                   << ", CacheRecords: " << renderSlabCounts(response.memory.cacheRecordSlabs)
+                   << ", Reports: " << renderSlabCounts(response.memory.reportSlabs)
+                   << endl;
             output << "Processes  :: #Client: " << response.numAttachedClients
                    << ", #Pips: " << response.numReportedPips
                    << ", Available RAM: " << counters->availableRamMB << " MB"
                    << ", CPU usage: " << renderDouble(counters->cpuUsage.value / 100.0) << "%"
+                   << " (predicted: " << renderDouble(counters->predictedCpuUsage.value / 100.0) << "%)"
+                   << ", Memory pressure level: " << counters->memoryPressureLevel
+                   << ", Run queue: " << renderDouble(counters->runQueueLength.value / 100.0) << "%"
                    << ", #Processes [active: " << to_string(counters->numTrackedProcesses)
                    << ", blocked: " << to_string(counters->numBlockedProcesses) << "]"
                    << endl
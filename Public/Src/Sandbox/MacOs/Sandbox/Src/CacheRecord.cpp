@@ -22,38 +22,32 @@ CacheRecord* CacheRecord::create()
     return instance;
 }
 
-bool CacheRecord::init()
+void* CacheRecord::operator new(size_t size)
 {
-    if (!super::init())
+    // zeroed, like OSObject's 'new' does
+    void *mem = Slabs::cacheRecords.allocate();
+    if (mem != nullptr)
     {
-        return false;
+        bzero(mem, size);
     }
 
-    lock_ = BXLLockAlloc();
-    if (lock_ == nullptr)
-    {
-        return false;
-    }
+    return mem;
+}
 
-    requestedAccess_ = RequestedAccess::None;
-    return true;
+void CacheRecord::operator delete(void *mem, size_t size)
+{
+    Slabs::cacheRecords.deallocate(mem);
 }
 
-void CacheRecord::free()
+bool CacheRecord::init()
 {
-    if (lock_ != nullptr)
+    if (!super::init())
     {
-        BXLLockFree(lock_);
-        lock_ = nullptr;
+        return false;
     }
 
-    super::free();
-}
-
-bool CacheRecord::Check(const AccessCheckResult *result) const
-{
-    // It's a cache hit if we've previously seen all the requested accesses.
-    return HasAllFlags(requestedAccess_, result->Access);
+    requestedAccess_ = (UInt32)RequestedAccess::None;
+    return true;
 }
 
 static const RequestedAccess LookupProbe     = RequestedAccess::Lookup | RequestedAccess::Probe;
@@ -121,27 +115,23 @@ bool CacheRecord::HasStrongerRequestedAccess(RequestedAccess access, int *outCac
         HasAnyFlags(cachedAccess, (int)accessesThatImplyGiveAccess);
 }
 
-void CacheRecord::Update(const AccessCheckResult *result)
+bool CacheRecord::CheckAndUpdate(const AccessCheckResult *checkResult)
 {
+    RequestedAccess access = checkResult->Access;
+
+    // Fast path: most checks are hits, and those don't need to write to the record's cache line.
+    if (HasAllFlags(Access(), access))
+    {
+        return true;
+    }
+
     // Update requested access:
     //   - whenever Probe is seen, add Lookup as well;
     //   - whenever Read is seen, add Probe and Lookup as well;
     //   - whenever Write is seen, add Read, Probe, and Lookup as well.
-    RequestedAccess access = result->Access;
-    requestedAccess_ |= access | implies(access);
-}
-
-bool CacheRecord::CheckAndUpdate(const AccessCheckResult *checkResult)
-{
-    bool isHit;
-    BXLLockLock(lock_);
-    {
-        isHit = Check(checkResult);
-        if (!isHit)
-        {
-            Update(checkResult);
-        }
-    }
-    BXLLockUnlock(lock_);
-    return isHit;
+    //
+    // It's a cache hit if we had previously seen all the requested accesses, which is decided
+    // on the value the record held right before this (atomic) update.
+    UInt32 previous = OSBitOrAtomic((UInt32)(access | implies(access)), &requestedAccess_);
+    return HasAllFlags((RequestedAccess)previous, access);
 }
@@ -8,7 +8,7 @@
 #include <IOKit/IOLib.h>
 #include "BuildXLSandboxShared.hpp"
 #include "FileAccessHelpers.h"
-#include "BXLLocks.hpp"
+#include "SlabCache.hpp"
 
 #define CacheRecord BXL_CLASS(CacheRecord)
 
@@ -21,35 +21,20 @@ private:
 
     OSDeclareDefaultStructors(CacheRecord)
 
-    BXLLock *lock_;
-
     /*!
-     * A bitwise disjunction of reported accesses.
-     */
-    RequestedAccess requestedAccess_;
-    
-    /*!
-     * Determines if the given 'checkResult' should be deemed a cache hit (and thus not reported).
+     * A bitwise disjunction of reported accesses (of type 'RequestedAccess').
      *
-     * It is a cache hit if this cache record's 'Access' property already contains all the
-     * requested accesses contained in the given 'checkResult' ('checkResult.RequestedAccess' field).
+     * Only ever grows, and only through 'OSBitOrAtomic', so no lock is needed to guard it.
      */
-    bool Check(const AccessCheckResult *checkResult) const;
-    
-    /*!
-     * Updates this record w.r.t. a given 'checkResult' (so that subsequently, given the same
-     * 'checkResult', 'Check' returns True)
-     */
-    void Update(const AccessCheckResult *checkResult);
+    volatile UInt32 requestedAccess_;
 
 protected:
 
     bool init() override;
-    void free() override;
 
 public:
     
-    inline RequestedAccess Access() const  { return requestedAccess_; }
+    inline RequestedAccess Access() const  { return (RequestedAccess)requestedAccess_; }
 
     bool HasStrongerRequestedAccess(RequestedAccess access, int *outCacheAccess = nullptr) const;
     
@@ -58,6 +43,9 @@ public:
      *   (1) determines if the given 'checkResult' should be deemed a cache hit, and
      *   (2) if not, updates this record so that subsequently, the same 'checkResult' becomes a cache hit.
      *
+     * It is a cache hit if this record's 'Access' property already contains all the
+     * requested accesses contained in the given 'checkResult' ('checkResult.Access' field).
+     *
      * @return Whether 'checkResult' was a cache hit.
      */
     bool CheckAndUpdate(const AccessCheckResult *checkResult);
@@ -72,6 +60,10 @@ public:
      * If new object cannot not be created, nullptr is returned.
      */
     static CacheRecord* create();
+
+    /*! Records are allocated from their own slab cache (see 'Slabs') */
+    static void* operator new(size_t size);
+    static void operator delete(void *mem, size_t size);
 };
 
 #endif /* CacheRecord_hpp */
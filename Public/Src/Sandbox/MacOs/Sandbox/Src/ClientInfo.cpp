@@ -7,12 +7,12 @@
 
 OSDefineMetaClassAndStructors(ClientInfo, OSObject)
 
-ClientInfo* ClientInfo::create(const InitArgs& args)
+ClientInfo* ClientInfo::create(const InitArgs& args, uint numQueues)
 {
     auto *instance = new ClientInfo;
     if (instance)
     {
-        bool initialized = instance->init(args);
+        bool initialized = instance->init(args, numQueues);
         if (!initialized)
         {
             instance->release();
@@ -28,7 +28,7 @@ ClientInfo* ClientInfo::create(const InitArgs& args)
     return instance;
 }
 
-bool ClientInfo::init(const InitArgs& args)
+bool ClientInfo::init(const InitArgs& args, uint numQueues)
 {
     if (!super::init())
     {
@@ -37,11 +37,20 @@ bool ClientInfo::init(const InitArgs& args)
 
     frozen_          = false;
     reportCounters_  = args.counters;
+    numQueues_       = 0;
 
-    queue_ = ConcurrentSharedDataQueue::create(args);
-    if (queue_ == nullptr)
+    if (numQueues < 1) numQueues = 1;
+    if (numQueues > kMaxReportQueues) numQueues = kMaxReportQueues;
+
+    for (uint i = 0; i < numQueues; i++)
     {
-        return false;
+        queues_[i] = ConcurrentSharedDataQueue::create(args);
+        if (queues_[i] == nullptr)
+        {
+            return false;
+        }
+
+        numQueues_++;
     }
 
     lock_ = BXLRecursiveLockAlloc();
@@ -55,7 +64,10 @@ bool ClientInfo::init(const InitArgs& args)
 
 void ClientInfo::free()
 {
-    OSSafeReleaseNULL(queue_);
+    for (uint i = 0; i < numQueues_; i++)
+    {
+        OSSafeReleaseNULL(queues_[i]);
+    }
 
     if (lock_)
     {
@@ -66,39 +78,24 @@ void ClientInfo::free()
     super::free();
 }
 
-bool ClientInfo::createQueue(uint32_t entryCount, uint32_t entrySize, bool enableBatching)
-{
-    EnterMonitor
-
-    if (frozen_ || queue_ != nullptr) return false;
-
-    queue_ = ConcurrentSharedDataQueue::create(
-    {
-        .entryCount = entryCount,
-        .entrySize  = entrySize,
-        .enableBatching = enableBatching,
-        .counters = reportCounters_
-    });
-
-    return queue_ != nullptr;
-}
-
-bool ClientInfo::setNotifactonPort(mach_port_t port)
+bool ClientInfo::setNotifactonPort(mach_port_t port, uint queueIndex)
 {
     EnterMonitor
 
-    if (frozen_ || queue_ == nullptr) return false;
+    ConcurrentSharedDataQueue *queue = getQueue(queueIndex);
+    if (frozen_ || queue == nullptr) return false;
 
-    queue_->setNotificationPort(port);
+    queue->setNotificationPort(port);
     return true;
 }
 
-IOMemoryDescriptor* ClientInfo::getMemoryDescriptor()
+IOMemoryDescriptor* ClientInfo::getMemoryDescriptor(uint queueIndex)
 {
     EnterMonitor
 
-    return !frozen_ && queue_
-        ? queue_->getMemoryDescriptor()
+    ConcurrentSharedDataQueue *queue = getQueue(queueIndex);
+    return !frozen_ && queue
+        ? queue->getMemoryDescriptor()
         : nullptr;
 }
 
@@ -106,9 +103,13 @@ bool ClientInfo::setFailureNotificationHandler(OSAsyncReference64 ref, OSObject
 {
     EnterMonitor
 
-    if (frozen_ || queue_ == nullptr) return false;
+    if (frozen_ || numQueues_ == 0) return false;
+
+    for (uint i = 0; i < numQueues_; i++)
+    {
+        queues_[i]->setClientAsyncFailureHandle(ref, client);
+    }
 
-    queue_->setClientAsyncFailureHandle(ref, client);
     return true;
 }
 
@@ -116,5 +117,6 @@ bool ClientInfo::enqueueReport(const EnqueueArgs &args)
 {
     frozen_ = true;
 
-    return queue_ && queue_->enqueueReport(args);
+    ConcurrentSharedDataQueue *queue = getQueueForPip(args.report.pipId);
+    return queue && queue->enqueueReport(args);
 }
@@ -34,9 +34,26 @@ private:
     ReportCounters *reportCounters_;
 
     /*!
-     * A wrapper around IOSharedDataQueue.
+     * Wrappers around IOSharedDataQueue, each drained by its own thread in user space (and, when batching
+     * is enabled, fed by its own drain thread in the kernel).  Reports are sharded between them by pip id,
+     * so the reports of a pip stay ordered.
      */
-    ConcurrentSharedDataQueue *queue_;
+    ConcurrentSharedDataQueue *queues_[kMaxReportQueues];
+
+    /*! Number of elements of 'queues_' in use */
+    uint numQueues_;
+
+    /*! Returns the queue at 'index', or nullptr if there is no such queue. */
+    ConcurrentSharedDataQueue* getQueue(uint index) const
+    {
+        return index < numQueues_ ? queues_[index] : nullptr;
+    }
+
+    /*! Returns the queue the reports of 'pipId' go to, or nullptr if there is none. */
+    ConcurrentSharedDataQueue* getQueueForPip(pipid_t pipId) const
+    {
+        return numQueues_ > 0 ? getQueue((uint)((uint64_t)pipId % numQueues_)) : nullptr;
+    }
 
     /*!
      * A client becomes frozen after the first call to 'enqueueData'.
@@ -50,7 +67,7 @@ private:
      *
      * @result indicates success.
      */
-    bool init(const InitArgs& args);
+    bool init(const InitArgs& args, uint numQueues);
 
 public:
 
@@ -59,47 +76,50 @@ public:
      */
     void free() override;
 
-    /*!
-     * Creates a shared data queue for this client.  May only be called once.
-     *
-     * @result indicates success (it's False, e.g., if a queue had already been created).
-     */
-    bool createQueue(uint32_t entryCount, uint32_t entrySize, bool enableBatching);
+    /*! Number of report queues of this client */
+    uint getNumQueues() const { return numQueues_; }
 
     /*!
-     * Sets the notification port for the underlying shared data queue.
-     *
-     * 'createQueue' must be called prior to calling this method.
+     * Sets the notification port for the shared data queue at 'queueIndex'.
      *
-     * @result indicates success (it's False, e.g., if 'createQueue' hadn't been called first).
+     * @result indicates success (it's False, e.g., if there is no queue at 'queueIndex').
      */
-    bool setNotifactonPort(mach_port_t port);
+    bool setNotifactonPort(mach_port_t port, uint queueIndex);
 
     /*!
-     * Returns the memory descriptor of the underlying shared data queue.
+     * Returns the memory descriptor of the shared data queue at 'queueIndex'.
      *
      * @result a newly allocated memory descriptor.  The caller is responsible for releasing it.
      */
-    IOMemoryDescriptor* getMemoryDescriptor();
+    IOMemoryDescriptor* getMemoryDescriptor(uint queueIndex);
 
     /*!
-     * Sets the failure notification async callback handle for the underlying shared data queue.
+     * Sets the failure notification async callback handle for all the underlying shared data queues.
      *
      * @result indicates success.
      */
     bool setFailureNotificationHandler(OSAsyncReference64 ref, OSObject *client);
 
     /*!
-     * Enqueues a report into the underlying shared data queue.
+     * Enqueues a report into the shared data queue of the report's pip.
      *
      * @result indicates success.
      */
     bool enqueueReport(const EnqueueArgs &args);
 
+    /*!
+     * Returns how full (in percent) the spill list of the shared data queue of 'pipId' is.
+     */
+    uint getSpilledPercent(pipid_t pipId) const
+    {
+        ConcurrentSharedDataQueue *queue = getQueueForPip(pipId);
+        return queue ? queue->getSpilledPercent() : 0;
+    }
+
 #pragma mark Static Methods
 
     /*! Static factory method, following the OSObject pattern */
-    static ClientInfo* create(const InitArgs& args);
+    static ClientInfo* create(const InitArgs& args, uint numQueues);
 };
 
 #endif /* ClientInfo_hpp */
@@ -6,6 +6,7 @@
 #include "Alloc.hpp"
 #include "BuildXLSandboxClient.hpp"
 #include "ConcurrentSharedDataQueue.hpp"
+#include "SlabCache.hpp"
 
 #define super OSObject
 
@@ -22,8 +23,8 @@ static void setValue(FreeListElem *e, ElemPayload *p) { LFDS711_FREELIST_SET_VAL
 static void deallocateFreeListElem(FreeListElem *elem)
 {
     ElemPayload *payload = getValue(elem);
-    Alloc::Delete<QueueElem>(payload->queueElem, 1);
-    Alloc::Delete<ElemPayload>(payload, 1);
+    Slabs::reportQueueElems.deallocate(payload->queueElem);
+    Slabs::reportPayloads.deallocate(payload);
 }
 
 QueueElem* ConcurrentSharedDataQueue::allocateElem(const EnqueueArgs &args)
@@ -40,16 +41,16 @@ QueueElem* ConcurrentSharedDataQueue::allocateElem(const EnqueueArgs &args)
     else
     {
         reportCounters_->freeListNodeCount++;
-        payload = Alloc::New<ElemPayload>(1);
+        payload = (ElemPayload*)Slabs::reportPayloads.allocate();
         if (payload == nullptr)
         {
             return nullptr;
         }
 
-        payload->queueElem = Alloc::New<QueueElem>(1);
+        payload->queueElem = (QueueElem*)Slabs::reportQueueElems.allocate();
         if (payload->queueElem == nullptr)
         {
-            Alloc::Delete<ElemPayload>(payload, 1);
+            Slabs::reportPayloads.deallocate(payload);
             return nullptr;
         }
 
@@ -108,6 +109,10 @@ bool ConcurrentSharedDataQueue::init(const InitArgs& args)
 
     drainingDone_                 = false;
     unrecoverableFailureOccurred_ = false;
+    spillHead_                    = nullptr;
+    spillTail_                    = nullptr;
+    numSpilled_                   = 0;
+    spillCapacity_                = args.spillCapacity;
     reportCounters_               = args.counters;
     enableBatching_               = args.enableBatching;
 
@@ -117,6 +122,12 @@ bool ConcurrentSharedDataQueue::init(const InitArgs& args)
         return false;
     }
 
+    entryBuffer_ = Alloc::New<char>(sizeof(AccessReport));
+    if (entryBuffer_ == nullptr)
+    {
+        return false;
+    }
+
     queue_ = IOSharedDataQueue::withCapacity((args.entrySize + DATA_QUEUE_ENTRY_HEADER_SIZE) * args.entryCount);
     if (queue_ == nullptr)
     {
@@ -135,7 +146,7 @@ bool ConcurrentSharedDataQueue::init(const InitArgs& args)
         return false;
     }
 
-    QueueElem *dummy = Alloc::New<QueueElem>(1); // this is dealocated in lfds711_queue_umm_cleanup()
+    QueueElem *dummy = (QueueElem*)Slabs::reportQueueElems.allocate(); // this is dealocated in lfds711_queue_umm_cleanup()
     if (dummy == nullptr)
     {
         return false;
@@ -176,6 +187,17 @@ void ConcurrentSharedDataQueue::free()
 
     LFDS711_MISC_MAKE_VALID_ON_CURRENT_LOGICAL_CORE_INITS_COMPLETED_BEFORE_NOW_ON_ANY_OTHER_LOGICAL_CORE;
 
+    // drop reports that were never sent (can happen if the client exits abnormally)
+    while (spillHead_ != nullptr)
+    {
+        ElemPayload *payload = spillHead_;
+        spillHead_ = payload->nextSpilled;
+        releaseElem(payload->queueElem);
+    }
+
+    spillTail_ = nullptr;
+    numSpilled_ = 0;
+
     // purge any left over elements in the queue (can happen if the client exits abnormally)
     if (pendingReports_ != nullptr)
     {
@@ -183,7 +205,7 @@ void ConcurrentSharedDataQueue::free()
         while (lfds711_queue_umm_dequeue(pendingReports_, &e)) releaseElem(e);
         lfds711_queue_umm_cleanup(pendingReports_, [](Queue *q, QueueElem *e, lfds711_misc_flag flag)
                                   {
-                                      Alloc::Delete<QueueElem>(e, 1);
+                                      Slabs::reportQueueElems.deallocate(e);
                                   });
 
         Alloc::Delete<Queue>(pendingReports_, 1);
@@ -215,6 +237,12 @@ void ConcurrentSharedDataQueue::free()
         lock_ = nullptr;
     }
 
+    if (entryBuffer_ != nullptr)
+    {
+        Alloc::Delete<char>(entryBuffer_, sizeof(AccessReport));
+        entryBuffer_ = nullptr;
+    }
+
     OSSafeReleaseNULL(consumerThread_);
     OSSafeReleaseNULL(queue_);
 
@@ -290,20 +318,104 @@ bool ConcurrentSharedDataQueue::enqueueWithLocking(const EnqueueArgs &args)
 
 bool ConcurrentSharedDataQueue::sendReport(const AccessReport &report)
 {
-    bool sent = queue_->enqueue((void*)&report, sizeof(AccessReport));
-    if (!sent)
+    // reports must reach the client in order, so nothing goes to the shared queue while older reports are still spilled
+    if (flushSpilledReports() && enqueueEntry(report))
+    {
+        reportCounters_->totalNumSent++;
+        return true;
+    }
+
+    if (spillReport(report))
+    {
+        return true;
+    }
+
+    log_error("Could not send data to shared queue from TID(%lld), %d reports spilled", thread_tid(current_thread()), numSpilled_);
+    drainingDone_ = true;
+    unrecoverableFailureOccurred_ = true;
+    InvokeAsyncFailureHandle(kIOReturnNoMemory);
+    return false;
+}
+
+bool ConcurrentSharedDataQueue::enqueueEntry(const AccessReport &report)
+{
+    uint32_t pathLength = report.operation == kOpProcessTreeCompleted
+        ? sizeof(PipCompletionStats)
+        : (uint32_t)strnlen(report.path, MAXPATHLEN - 1) + 1;
+    uint32_t entrySize = PackAccessReport(report, pathLength, entryBuffer_);
+
+    return queue_->enqueue(entryBuffer_, entrySize);
+}
+
+bool ConcurrentSharedDataQueue::spillReport(const AccessReport &report)
+{
+    if ((uint)numSpilled_ >= spillCapacity_)
+    {
+        return false;
+    }
+
+    LFDS711_MISC_MAKE_VALID_ON_CURRENT_LOGICAL_CORE_INITS_COMPLETED_BEFORE_NOW_ON_ANY_OTHER_LOGICAL_CORE;
+
+    // coalescing (the only use of the cache record) was already decided by the time a report gets here
+    QueueElem *elem = allocateElem({.report = report, .cacheRecord = nullptr});
+    if (elem == nullptr)
     {
-        log_error("Could not send data to shared queue from TID(%lld)", thread_tid(current_thread()));
-        drainingDone_ = true;
-        unrecoverableFailureOccurred_ = true;
-        InvokeAsyncFailureHandle(kIOReturnNoMemory);
+        return false;
+    }
+
+    ElemPayload *payload = getValue(elem);
+    payload->nextSpilled = nullptr;
+    if (spillTail_ != nullptr)
+    {
+        spillTail_->nextSpilled = payload;
     }
     else
     {
+        spillHead_ = payload;
+    }
+
+    spillTail_ = payload;
+    OSIncrementAtomic(&numSpilled_);
+    reportCounters_->numSpilledReports++;
+    return true;
+}
+
+bool ConcurrentSharedDataQueue::flushSpilledReports()
+{
+    if (spillHead_ == nullptr)
+    {
+        return true;
+    }
+
+    LFDS711_MISC_MAKE_VALID_ON_CURRENT_LOGICAL_CORE_INITS_COMPLETED_BEFORE_NOW_ON_ANY_OTHER_LOGICAL_CORE;
+
+    while (spillHead_ != nullptr)
+    {
+        if (!enqueueEntry(spillHead_->report))
+        {
+            return false;
+        }
+
+        ElemPayload *payload = spillHead_;
+        spillHead_ = payload->nextSpilled;
+        if (spillHead_ == nullptr)
+        {
+            spillTail_ = nullptr;
+        }
+
+        OSDecrementAtomic(&numSpilled_);
         reportCounters_->totalNumSent++;
+        releaseElem(payload->queueElem);
     }
 
-    return sent;
+    return true;
+}
+
+bool ConcurrentSharedDataQueue::flushSpilledReportsWithLocking()
+{
+    EnterMonitor
+
+    return flushSpilledReports();
 }
 
 bool ConcurrentSharedDataQueue::enqueueWithBatching(const EnqueueArgs &args)
@@ -327,19 +439,21 @@ static uint s_backoffIntervalsLen = sizeof(s_backoffIntervalsMs) / sizeof(s_back
 
 void ConcurrentSharedDataQueue::drainQueue()
 {
-    if (!enableBatching_)
-    {
-        return;
-    }
-
     LFDS711_MISC_MAKE_VALID_ON_CURRENT_LOGICAL_CORE_INITS_COMPLETED_BEFORE_NOW_ON_ANY_OTHER_LOGICAL_CORE;
 
     uint backoffCounter = 0;
     while (!drainingDone_)
     {
         QueueElem *elem;
-        if (!lfds711_queue_umm_dequeue(pendingReports_, &elem) || elem == nullptr)
+        if (!enableBatching_ || !lfds711_queue_umm_dequeue(pendingReports_, &elem) || elem == nullptr)
         {
+            // nothing new to send: move spilled reports over as the client makes room for them, polling again soon
+            // while some are left (without batching, producers call 'sendReport' under 'lock_', hence the locking)
+            if (numSpilled_ > 0 && !flushSpilledReportsWithLocking())
+            {
+                backoffCounter = 0;
+            }
+
             uint backoffIndex = backoffCounter < s_backoffIntervalsLen ? backoffCounter : s_backoffIntervalsLen - 1;
             IOSleep(/*milliseconds*/ s_backoffIntervalsMs[backoffIndex]);
             ++backoffCounter;
@@ -30,6 +30,10 @@ typedef struct{
 
 /*!
  * A straightforward wrapper around IOSharedDataQueue to provide a thread-safe way of enqueuing entries.
+ *
+ * When the shared queue is full (e.g., during a burst of reports the client can't keep up with), reports are kept aside
+ * in a bounded spill list and sent, in order, as soon as the client makes room.  That way the shared queue (which is
+ * wired kernel memory) can stay small, and the build only fails when the spill list fills up as well.
  */
 class ConcurrentSharedDataQueue : public OSObject
 {
@@ -40,6 +44,10 @@ public:
     typedef struct {
         uint entryCount;
         uint entrySize;
+
+        /*! Maximum number of reports kept aside while the shared queue is full (0 means none) */
+        uint spillCapacity;
+
         bool enableBatching;
         ReportCounters *counters;
     } InitArgs;
@@ -52,11 +60,14 @@ public:
         const CacheRecord *cacheRecord;
     } EnqueueArgs;
 
-    typedef struct {
+    typedef struct ep_ {
         QueueElem *queueElem;
         FreeListElem freeListElem;
         AccessReport report;
         const CacheRecord *cacheRecord;
+
+        /*! Next report in the spill list (only used while this element is spilled) */
+        struct ep_ *nextSpilled;
     } ElemPayload;
 
 private:
@@ -64,6 +75,12 @@ private:
     /*! Backing queue */
     IOSharedDataQueue *queue_;
 
+    /*!
+     * Buffer where 'sendReport' packs reports into shared data queue entries (see 'PackAccessReport').
+     * 'sendReport' calls are always serialized (by 'lock_', or by running on 'consumerThread_'), so one buffer is enough.
+     */
+    char *entryBuffer_;
+
     /*! Recursive lock used for synchronization */
     BXLRecursiveLock *lock_;
 
@@ -103,8 +120,8 @@ private:
     Queue *pendingReports_;
 
     /*!
-     * A dedicated thread for draining 'pendingReports_'.
-     * If batching is not enabled, this thread immediately finished without doing any work.
+     * A dedicated thread for draining 'pendingReports_' and sending spilled reports.
+     * If batching is not enabled, this thread only sends spilled reports.
      */
     Thread *consumerThread_;
 
@@ -115,12 +132,26 @@ private:
 
     void drainQueue();
 
+    /*!
+     * Reports that did not fit into the shared queue, oldest first.  Elements come from 'freeList_'.
+     *
+     * Only accessed by whoever calls 'sendReport', so it needs no synchronization of its own.
+     */
+    ElemPayload *spillHead_;
+    ElemPayload *spillTail_;
+
+    /*! Number of reports in the spill list; read without synchronization by producers (see 'getSpilledPercent') */
+    volatile SInt32 numSpilled_;
+
+    /*! Maximum number of reports in the spill list */
+    uint spillCapacity_;
+
     /*!
      * Indicates if an unrecoverable error has occured. This happens when the sandbox was not able to successfully
-     * enqueue an access report message. There is no logic to recover from this and mostly indicates that either a)
-     * the report queue size is to small for the amount of transfered reports or b) the number of connections to the
-     * sandbox kernel connection and with it the number of threads draining the report queues in user space are not
-     * sufficient. After this occures, the extension has to be reloaded!
+     * enqueue an access report message, even to the spill list. There is no logic to recover from this and mostly
+     * indicates that either a) the report queue and spill list are too small for the amount of transfered reports or
+     * b) the number of connections to the sandbox kernel connection and with it the number of threads draining the
+     * report queues in user space are not sufficient. After this occures, the extension has to be reloaded!
      */
     volatile bool unrecoverableFailureOccurred_;
 
@@ -134,13 +165,30 @@ private:
     bool enqueueWithLocking(const EnqueueArgs &args);
 
     /*!
-     * Enqueues the data to the shared IO queue.
+     * Enqueues the data to the shared IO queue, as an entry that only carries the used part of the report's path buffer.
+     * If the queue is full, or older reports are still spilled, the report is added to the spill list instead.
      *
      * IMPORTANT: the IO queue is not thread-safe and this method does not ensure synchronization;
      * ensuring proper synchronization is the responsibility of the callers.
      */
     bool sendReport(const AccessReport &report);
 
+    /*! Packs the report and enqueues it to the shared IO queue (same synchronization requirements as 'sendReport'). */
+    bool enqueueEntry(const AccessReport &report);
+
+    /*! Adds the report to the end of the spill list; returns false if the spill list is full. */
+    bool spillReport(const AccessReport &report);
+
+    /*!
+     * Moves spilled reports to the shared IO queue until either the spill list is empty or the queue is full.
+     *
+     * @result True if the spill list is empty.
+     */
+    bool flushSpilledReports();
+
+    /*! Enters the critical section and then calls 'flushSpilledReports'. */
+    bool flushSpilledReportsWithLocking();
+
     /*!
      * Initializes this object, following the OSObject pattern.
      *
@@ -165,6 +213,14 @@ public:
      */
     long long getCount() const;
 
+    /*!
+     * Returns how full the spill list is, in percent.  Producers use this to slow down (see 'ResourceManager::ThrottleReportProducer').
+     */
+    uint getSpilledPercent() const
+    {
+        return spillCapacity_ == 0 ? 0 : (uint)numSpilled_ * 100 / spillCapacity_;
+    }
+
     /*!
      * Enters monitor then delegates to IOSharedDataQueue::setNotificationPort
      */
@@ -120,6 +120,17 @@ bool FileAccessManifestParseResult::init(const BYTE *payload, size_t payloadSize
             SkipOverCharArray(payloadCursor); // 'to' path
         }
 
+        // Reparse points are a Windows concept, so the known targets are just skipped
+        PManifestKnownReparsePointTargets knownReparsePointTargets = ParseAndAdvancePointer<PManifestKnownReparsePointTargets>(payloadCursor);
+        if (HasErrors()) continue;
+
+        for (uint32_t i = 0; i < knownReparsePointTargets->Count; i++)
+        {
+            SkipOverCharArray(payloadCursor); // reparse point path
+            SkipOverCharArray(payloadCursor); // target
+            ParseUint32(payloadCursor);       // reparse tag
+        }
+
         ParseAndAdvancePointer<PManifestInternalDetoursErrorNotificationFileString>(payloadCursor);
         if (HasErrors()) continue;
 
@@ -134,6 +145,9 @@ bool FileAccessManifestParseResult::init(const BYTE *payload, size_t payloadSize
         pipId_ = ParseAndAdvancePointer<PCManifestPipId>(payloadCursor);
         if (HasErrors()) continue;
 
+        cacheBudgets_ = ParseAndAdvancePointer<PCManifestCacheBudgets>(payloadCursor);
+        if (HasErrors()) continue;
+
         report_ = ParseAndAdvancePointer<PCManifestReport>(payloadCursor);
         if (HasErrors()) continue;
 
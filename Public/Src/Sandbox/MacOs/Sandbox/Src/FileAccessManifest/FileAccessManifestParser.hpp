@@ -18,6 +18,7 @@ private:
     PCManifestFlags flags_;
     PCManifestExtraFlags extraFlags_;
     PCManifestPipId pipId_;
+    PCManifestCacheBudgets cacheBudgets_;
     PCManifestReport report_;
     PCManifestDllBlock dllBlock_;
     PCManifestSubstituteProcessExecutionShim shim_;
@@ -50,6 +51,7 @@ public:
     inline PCManifestRecord GetManifestRootNode() const           { return root_; }
     inline PCManifestRecord GetUnixRootNode() const               { return root_->BucketCount > 0 ? root_->GetChildRecord(0) : root_; }
     inline PCManifestPipId GetPipId() const                       { return pipId_; }
+    inline PCManifestCacheBudgets GetCacheBudgets() const         { return cacheBudgets_; }
     inline FileAccessManifestFlag GetFamFlags() const             { return static_cast<FileAccessManifestFlag>(flags_->Flags); }
     inline FileAccessManifestExtraFlag GetFamExtraFlags() const   { return static_cast<FileAccessManifestExtraFlag>(extraFlags_->ExtraFlags); }
     inline bool AllowChildProcessesToBreakAway() const            { return manifestChildProcessesToBreakAwayFromJob_->Count > 0; }
@@ -97,6 +97,7 @@ bool AccessHandler::ReportProcessTreeCompleted()
             .cacheNodeSize           = GetPip()->getPathCacheNodeSize(),
             .numForks                = GetPip()->Counters()->numForks.count(),
             .numHardLinkRetries      = GetPip()->Counters()->numHardLinkRetries.count(),
+            .numCacheEvictions       = GetPip()->Counters()->numCacheEvictions.count(),
         },
         .stats     = { .creationTime = creationTimestamp_ },
         .isDirectory = 0
@@ -250,13 +251,17 @@ bool AccessHandler::CheckAccess(vnode_t vp,
     checker(*policy, isDir, result);
 
     bool notAllowed = result->GetFileAccessStatus() != FileAccessStatus_Allowed;
-    const char *lastLookupPath;
+    if (!notAllowed)
+    {
+        return false;
+    }
+
+    char lastLookupPath[MAXPATHLEN];
     // special handling for denied accesses to files with multiple hard links
     if (
-        notAllowed &&                                               // access is denied for current policy
-        (lastLookupPath = GetPip()->getLastLookedUpPath()) &&       // we remembered a path that was last looked up
-        strncmp(lastLookupPath, policy->Path(), MAXPATHLEN) != 0 && // that path is different from the policy path
-        VNodeMatchesPath(vp, ctx, lastLookupPath))                  // both paths point to the same vnode
+        GetPip()->getLastLookedUpPath(lastLookupPath, sizeof(lastLookupPath)) && // we remembered a path that was last looked up
+        strncmp(lastLookupPath, policy->Path(), MAXPATHLEN) != 0 &&             // that path is different from the policy path
+        VNodeMatchesPath(vp, ctx, lastLookupPath))                              // both paths point to the same vnode
     {
         // update policy and check again
         sandbox_->Counters()->numHardLinkRetries++;
@@ -271,8 +276,21 @@ bool AccessHandler::CheckAccess(vnode_t vp,
     }
 }
 
+PolicyResult AccessHandler::PolicyForAccessedPath(const char *path)
+{
+    Stopwatch stopwatch;
+    PolicyResult policy = PolicyForPath(IgnoreCatalinaDataPartitionPrefix(path));
+
+    Timespan duration                  = stopwatch.lap();
+    GetPip()->Counters()->checkPolicy += duration;
+    sandbox_->Counters()->checkPolicy += duration;
+
+    return policy;
+}
+
 AccessCheckResult AccessHandler::CheckAndReportInternal(FileOperation operation,
                                                         const char *path,
+                                                        const PolicyResult &pathPolicy,
                                                         CheckFunc checker,
                                                         vfs_context_t ctx,
                                                         vnode_t vp,
@@ -280,8 +298,8 @@ AccessCheckResult AccessHandler::CheckAndReportInternal(FileOperation operation,
 {    
     Stopwatch stopwatch;
 
-    // 1: check operation against given policy
-    PolicyResult policy = PolicyForPath(IgnoreCatalinaDataPartitionPrefix(path));
+    // 1: check operation against given policy ('CheckAccess' may replace it, hence the copy)
+    PolicyResult policy = pathPolicy;
     AccessCheckResult result = AccessCheckResult::Invalid();
     if (vp != nullptr && ctx != nullptr)
     {
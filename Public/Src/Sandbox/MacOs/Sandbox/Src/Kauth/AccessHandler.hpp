@@ -104,6 +104,7 @@ protected:
      *
      * @param operation Operation to be executed
      * @param path Absolute path against which the operation is to be executed
+     * @param policy Policy for 'path' (see 'PolicyForAccessedPath')
      * @param checker Checker function to apply to policy
      * @param ctx (Can be NULL) Current VFS context; if NULL, instead of delegating to 'CheckAccess' (which implements
      *            a fallback logic for files with multiple hard links), 'checker' is called directly.
@@ -112,19 +113,32 @@ protected:
      */
     AccessCheckResult CheckAndReportInternal(FileOperation operation,
                                      const char *path,
+                                     const PolicyResult &policy,
                                      CheckFunc checker,
                                      vfs_context_t ctx,
                                      vnode_t vp,
                                      bool isDir);
 
+    /*!
+     * Returns the policy for a given absolute 'path' as accessed by the process, i.e., what 'CheckAndReport' checks accesses against.
+     *
+     * Callers checking several operations against the same path should get its policy once, and pass it to 'CheckAndReport'.
+     */
+    PolicyResult PolicyForAccessedPath(const char *path);
+
     AccessCheckResult CheckAndReport(FileOperation operation, const char *path, CheckFunc checker, vfs_context_t ctx, vnode_t vp)
     {
-        return CheckAndReportInternal(operation, path, checker, ctx, vp, false);
+        return CheckAndReportInternal(operation, path, PolicyForAccessedPath(path), checker, ctx, vp, false);
+    }
+
+    AccessCheckResult CheckAndReport(FileOperation operation, const char *path, const PolicyResult &policy, CheckFunc checker, vfs_context_t ctx, vnode_t vp)
+    {
+        return CheckAndReportInternal(operation, path, policy, checker, ctx, vp, false);
     }
 
     AccessCheckResult CheckAndReport(FileOperation operation, const char *path, CheckFunc checker, bool isDir)
     {
-        return CheckAndReportInternal(operation, path, checker, nullptr, nullptr, isDir);
+        return CheckAndReportInternal(operation, path, PolicyForAccessedPath(path), checker, nullptr, nullptr, isDir);
     }
 
 public:
@@ -4,7 +4,32 @@
 #include "TrustedBsdHandler.hpp"
 #include "OpNames.hpp"
 
-int TrustedBsdHandler::HandleLookup(const char *path)
+static bool IsSinglePathComponent(const char *relPath, size_t relPathLength)
+{
+    for (size_t i = 0; i < relPathLength; i++)
+    {
+        if (relPath[i] == '/')
+        {
+            return false;
+        }
+    }
+
+    return relPathLength > 0;
+}
+
+bool TrustedBsdHandler::CanSkipLookupsIn(vnode_t dvp, UInt32 vnodeCacheGeneration)
+{
+    if (!GetPip()->vnodeCacheLookupUniformLookupCone(dvp, vnode_vid(dvp), vnodeCacheGeneration))
+    {
+        return false;
+    }
+
+    GetSandbox()->Counters()->numSkippedLookups++;
+    GetPip()->Counters()->numSkippedLookups++;
+    return true;
+}
+
+int TrustedBsdHandler::HandleLookup(vnode_t dvp, const char *relPath, size_t relPathLength, const char *path, UInt32 vnodeCacheGeneration)
 {
     // set last looked up path
     Stopwatch stopwatch;
@@ -15,7 +40,23 @@ int TrustedBsdHandler::HandleLookup(const char *path)
     GetPip()->Counters()->setLastLookedUpPath += duration;
 
     // Check, report, but never deny lookups
-    CheckAndReport(kOpMacLookup, path, Checkers::CheckLookup, /*isDir*/ false);
+    PolicyResult policy = PolicyForAccessedPath(path);
+    CheckAndReport(kOpMacLookup, path, policy, Checkers::CheckLookup, /*ctx*/ nullptr, /*vp*/ nullptr);
+
+    // When the policy of 'path' comes from the cone of a manifest record without children, that record is 'dvp' or one of
+    // its ancestors (a single component was looked up), so every lookup relative to 'dvp' gets this very policy.  If that
+    // policy allows lookups without reporting them, handling them only costs time (constructing the path, and remembering
+    // it as the last looked up one, which only matters for accesses that get denied, see 'CheckAccess').
+    if (policy.IsInLeafCone() && IsSinglePathComponent(relPath, relPathLength))
+    {
+        AccessCheckResult lookupResult = AccessCheckResult::Invalid();
+        Checkers::CheckLookup(policy, /*isDir*/ false, &lookupResult);
+        if (lookupResult.Result == ResultAction::Allow && !lookupResult.ShouldReport())
+        {
+            GetPip()->vnodeCacheAddUniformLookupCone(dvp, vnode_vid(dvp), vnodeCacheGeneration);
+        }
+    }
+
     return KERN_SUCCESS;
 }
 
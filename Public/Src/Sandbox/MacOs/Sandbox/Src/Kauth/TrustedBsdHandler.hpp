@@ -13,7 +13,19 @@ public:
     TrustedBsdHandler(BuildXLSandbox *sandbox)
         : AccessHandler(sandbox) { }
 
-    int HandleLookup(const char *path);
+    /*!
+     * Returns whether lookups relative to directory 'dvp' need no handling, because 'dvp' was found to be in a uniform
+     * lookup cone (see 'SandboxedPip::vnodeCacheAddUniformLookupCone') during vnode cache generation 'vnodeCacheGeneration'.
+     */
+    bool CanSkipLookupsIn(vnode_t dvp, UInt32 vnodeCacheGeneration);
+
+    /*!
+     * Handles the lookup of 'path', which is 'relPath' relative to directory 'dvp'.  When 'relPath' is a single path
+     * component, also records whether 'dvp' is in a uniform lookup cone (see 'CanSkipLookupsIn').
+     *
+     * @param vnodeCacheGeneration Vnode cache generation observed before the path of 'dvp' was looked up
+     */
+    int HandleLookup(vnode_t dvp, const char *relPath, size_t relPathLength, const char *path, UInt32 vnodeCacheGeneration);
 
     int HandleReadVnode(vnode_t vnode, FileOperation operationToReport, bool isVnodeDir);
 
@@ -160,6 +160,21 @@ int VNodeHandler::HandleVNodeEvent(const kauth_cred_t credential,
                                    const vnode_t dvp,
                                    const uintptr_t arg3)
 {
+    // Repeated accesses to the same vnode are answered by the vnode cache, without constructing the path of the vnode
+    kauth_action_t handledActions = 0;
+    for (int i = 0; i < s_handlersCount; i++)
+    {
+        handledActions |= action & s_handlers[i].flags;
+    }
+
+    uint32_t vid = vnode_vid(vp);
+    UInt32 vnodeCacheGeneration = SandboxedPip::getVNodeCacheGeneration();
+    if (GetPip()->vnodeCacheLookup(vp, vid, vnodeCacheGeneration, handledActions))
+    {
+        GetPip()->Counters()->numCacheHits++;
+        return KAUTH_RESULT_DEFER;
+    }
+
     int len = MAXPATHLEN;
     char path[MAXPATHLEN] = {0};
 
@@ -170,6 +185,10 @@ int VNodeHandler::HandleVNodeEvent(const kauth_cred_t credential,
     }
 
     bool shouldDeny = false;
+    bool allAllowed = true;
+
+    // Every handler checks the same path, so the manifest is only searched once
+    PolicyResult policy = PolicyForAccessedPath(path);
 
     // even after the first match we have to continue looping because multiple flags can be set in a single action
     for (int i = 0; i < s_handlersCount; i++)
@@ -181,10 +200,18 @@ int VNodeHandler::HandleVNodeEvent(const kauth_cred_t credential,
         }
 
         AccessCheckResult checkResult = CheckAndReport(s_handlers[i].operation,
-                                                       path, s_handlers[i].checker,
+                                                       path, policy, s_handlers[i].checker,
                                                        ctx, vp);
 
         shouldDeny = shouldDeny || checkResult.ShouldDenyAccess();
+        allAllowed = allAllowed && checkResult.GetFileAccessStatus() == FileAccessStatus_Allowed;
+    }
+
+    // Only allowed accesses are cached: whether they are allowed doesn't depend on anything but the path of the vnode
+    // (denied ones are retried with the last looked up path, see 'CheckAccess'), and they have been reported by now.
+    if (allAllowed)
+    {
+        GetPip()->vnodeCacheAdd(vp, vid, vnodeCacheGeneration, handledActions);
     }
 
     if (shouldDeny)
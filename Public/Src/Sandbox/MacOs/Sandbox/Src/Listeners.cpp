@@ -64,6 +64,12 @@ int Listeners::buildxl_file_op_listener(kauth_cred_t credential,
                                        uintptr_t arg2,
                                        uintptr_t arg3)
 {
+    // These can change the path of a vnode, whichever process does it
+    if (action == KAUTH_FILEOP_RENAME || action == KAUTH_FILEOP_EXCHANGE || action == KAUTH_FILEOP_LINK || action == KAUTH_FILEOP_DELETE)
+    {
+        SandboxedPip::invalidateVNodeCaches();
+    }
+
     BuildXLSandbox *sandbox = OSDynamicCast(BuildXLSandbox, reinterpret_cast<OSObject *>(idata));
 
     FileOpHandler fileOpHandler = FileOpHandler(sandbox);
@@ -126,6 +132,13 @@ int Listeners::mpo_vnode_check_lookup_pre(kauth_cred_t cred,
             break;
         }
 
+        // the bulk of lookups happens in directories (e.g., SDKs) where lookups are allowed and never reported
+        UInt32 vnodeCacheGeneration = SandboxedPip::getVNodeCacheGeneration();
+        if (handler.CanSkipLookupsIn(dvp, vnodeCacheGeneration))
+        {
+            break;
+        }
+
         size_t pathlen = strnlen(path, MAXPATHLEN);
         char fullpath[MAXPATHLEN] = {0};
         int errorCode = ComputeAbsolutePath(dvp, path, pathlen, fullpath, sizeof(fullpath));
@@ -135,7 +148,7 @@ int Listeners::mpo_vnode_check_lookup_pre(kauth_cred_t cred,
             break;
         }
 
-        handler.HandleLookup(fullpath);
+        handler.HandleLookup(dvp, path, pathlen, fullpath, vnodeCacheGeneration);
     } while(false);
 
     return KERN_SUCCESS;
@@ -7,6 +7,24 @@
 
 OSDefineMetaClassAndStructors(ResourceManager, OSObject)
 
+/*! Weight of a new sample in the CPU usage moving averages is 1/2^kCpuUsageSmoothingShift */
+static const int kCpuUsageSmoothingShift = 2;
+
+/*! Number of resource updates ahead for which CPU usage is predicted */
+static const int kCpuUsagePredictionHorizon = 2;
+
+/*! Estimated CPU usage of a newly admitted process (in basis points) */
+static const SInt32 kAdmissionCostBasisPoints = 500;
+
+/*! Upper bound on the number of processes admitted between two resource updates */
+static const SInt32 kMaxAdmissionsPerUpdate = 16;
+
+/*! Report producers are not throttled while the spill list of their report queue is less full than this (in percent) */
+static const uint kSpillThrottlingStartPercent = 25;
+
+/*! Longest a report producer is put to sleep for after a single report */
+static const uint kMaxReportThrottlingMs = 8;
+
 ResourceManager* ResourceManager::create(ResourceCounters *counters)
 {
     ResourceManager *instance = new ResourceManager;
@@ -30,12 +48,17 @@ bool ResourceManager::init(ResourceCounters *counters)
 
     thresholds_ =
     {
-        .cpuUsageBlock     = {0},
-        .cpuUsageWakeup    = {0},
-        .minAvailableRamMB = 0,
+        .cpuUsageBlock            = {0},
+        .cpuUsageWakeup           = {0},
+        .minAvailableRamMB        = 0,
+        .memoryPressureLevelBlock = 0,
+        .runQueueLengthBlock      = {0},
     };
 
-    counters_ = counters;
+    counters_        = counters;
+    cpuUsageAverage_ = 0;
+    cpuUsageTrend_   = 0;
+    admissionBudget_ = kMaxAdmissionsPerUpdate;
 
     procBarrier_ = BXLLockAlloc();
     if (procBarrier_ == nullptr)
@@ -73,17 +96,26 @@ static bool shouldThrottle(basis_points value, percent threshold)
     return isThresholdValid(threshold) && !isBelowThreshold(value, threshold);
 }
 
+static inline uint max(uint a, uint b)
+{
+    return a > b ? a : b;
+}
+
 inline bool ResourceManager::shouldThrottleProcesses() const
 {
     return
         counters_->availableRamMB < thresholds_.minAvailableRamMB ||
-        shouldThrottle(counters_->cpuUsage, thresholds_.cpuUsageBlock);
+        (thresholds_.memoryPressureLevelBlock > 0 && counters_->memoryPressureLevel >= thresholds_.memoryPressureLevelBlock) ||
+        (thresholds_.runQueueLengthBlock.value > 0 && counters_->runQueueLength.value >= thresholds_.runQueueLengthBlock.value * 100) ||
+        shouldThrottle({ max(counters_->cpuUsage.value, counters_->predictedCpuUsage.value) }, thresholds_.cpuUsageBlock);
 }
 
 inline bool ResourceManager::IsProcessThrottlingEnabled() const
 {
     return
         thresholds_.minAvailableRamMB > 0 ||
+        thresholds_.memoryPressureLevelBlock > 0 ||
+        thresholds_.runQueueLengthBlock.value > 0 ||
         isThresholdValid(thresholds_.cpuUsageBlock);
 }
 
@@ -93,54 +125,122 @@ void ResourceManager::UpdateNumTrackedProcesses(uint newCount)
     OSCompareAndSwap(oldCount, newCount, &counters_->numTrackedProcesses);
     if (newCount < oldCount)
     {
-        wakeupBlockedProcesses(/* justOne */ newCount == oldCount - 1);
+        // a process that exited makes room for a blocked one
+        OSIncrementAtomic(&admissionBudget_);
+        wakeupBlockedProcesses();
     }
 }
 
-void ResourceManager::UpdateCpuUsage(basis_points cpuUsage)
+void ResourceManager::updateCpuUsagePrediction(basis_points cpuUsage)
+{
+    // Updates are only ever made from a single (the client's) thread, so no need for atomics here
+    SInt32 prevAverage = cpuUsageAverage_;
+    cpuUsageAverage_  += ((SInt32)cpuUsage.value - prevAverage) >> kCpuUsageSmoothingShift;
+    cpuUsageTrend_    += ((cpuUsageAverage_ - prevAverage) - cpuUsageTrend_) >> kCpuUsageSmoothingShift;
+
+    SInt32 predicted = cpuUsageAverage_ + kCpuUsagePredictionHorizon * cpuUsageTrend_;
+    predicted = predicted < 0 ? 0 : predicted > 10000 ? 10000 : predicted;
+    counters_->predictedCpuUsage.value = (uint)predicted;
+}
+
+SInt32 ResourceManager::computeAdmissionBudget() const
 {
-    basis_points oldCpuUsage = counters_->cpuUsage;
-    OSCompareAndSwap(oldCpuUsage.value, cpuUsage.value, &counters_->cpuUsage.value);
-    if (isBelowThreshold(cpuUsage, thresholds_.GetCpuUsageForWakeup()))
+    if (shouldThrottleProcesses())
+    {
+        return 0;
+    }
+
+    percent wakeupThreshold = thresholds_.GetCpuUsageForWakeup();
+    if (!isThresholdValid(wakeupThreshold))
     {
-        wakeupBlockedProcesses(/* justOne */ true);
+        return kMaxAdmissionsPerUpdate;
     }
+
+    SInt32 headroom = (SInt32)(wakeupThreshold.value * 100) -
+                      (SInt32)max(counters_->cpuUsage.value, counters_->predictedCpuUsage.value);
+    if (headroom <= 0)
+    {
+        return 0;
+    }
+
+    SInt32 budget = headroom / kAdmissionCostBasisPoints;
+    return budget < 1 ? 1 : budget > kMaxAdmissionsPerUpdate ? kMaxAdmissionsPerUpdate : budget;
 }
 
-void ResourceManager::UpdateAvailableRam(uint availableRamMB)
+bool ResourceManager::tryConsumeAdmission()
 {
-    uint oldRam = counters_->availableRamMB;
-    OSCompareAndSwap(oldRam, availableRamMB, &counters_->availableRamMB);
-    if (availableRamMB > oldRam)
+    while (true)
     {
-        wakeupBlockedProcesses(/* justOne */ true);
+        SInt32 budget = admissionBudget_;
+        if (budget <= 0)
+        {
+            return false;
+        }
+
+        if (OSCompareAndSwap(budget, budget - 1, (volatile UInt32 *)&admissionBudget_))
+        {
+            return true;
+        }
     }
 }
 
+void ResourceManager::UpdateResourceUsage(basis_points cpuUsage, uint availableRamMB, uint memoryPressureLevel, basis_points runQueueLength)
+{
+    counters_->cpuUsage            = cpuUsage;
+    counters_->availableRamMB      = availableRamMB;
+    counters_->memoryPressureLevel = memoryPressureLevel;
+    counters_->runQueueLength      = runQueueLength;
+    updateCpuUsagePrediction(cpuUsage);
+
+    // admissions granted at previous updates don't carry over
+    admissionBudget_ = computeAdmissionBudget();
+    wakeupBlockedProcesses();
+}
+
 void ResourceManager::WaitForCpu()
 {
     if (!IsProcessThrottlingEnabled())
     {
         return;
     }
-    
-    if (shouldThrottleProcesses())
+
+    // fast path: no need to wait for admission when no other process is already waiting for it
+    if (!shouldThrottleProcesses() && counters_->numBlockedProcesses == 0)
+    {
+        return;
+    }
+
+    BXLLockLock(procBarrier_);
     {
-        BXLLockLock(procBarrier_);
-        while (shouldThrottleProcesses())
+        OSIncrementAtomic(&counters_->numBlockedProcesses);
+        while (shouldThrottleProcesses() || !tryConsumeAdmission())
         {
-            OSIncrementAtomic(&counters_->numBlockedProcesses);
             BXLLockSleep(procBarrier_, this, THREAD_INTERRUPTIBLE);
-            OSDecrementAtomic(&counters_->numBlockedProcesses);
         }
-        BXLLockUnlock(procBarrier_);
+        OSDecrementAtomic(&counters_->numBlockedProcesses);
     }
+    BXLLockUnlock(procBarrier_);
+
+    // let the next blocked process in (if admissions remain)
+    wakeupBlockedProcesses();
+}
+
+bool ResourceManager::ThrottleReportProducer(uint spilledPercent)
+{
+    if (spilledPercent < kSpillThrottlingStartPercent)
+    {
+        return false;
+    }
+
+    uint excess = (spilledPercent > 100 ? 100 : spilledPercent) - kSpillThrottlingStartPercent;
+    IOSleep(/*milliseconds*/ 1 + excess * (kMaxReportThrottlingMs - 1) / (100 - kSpillThrottlingStartPercent));
+    return true;
 }
 
-void ResourceManager::wakeupBlockedProcesses(bool justOne)
+void ResourceManager::wakeupBlockedProcesses()
 {
-    if (procBarrier_ != nullptr && counters_->numBlockedProcesses > 0 && !shouldThrottleProcesses())
+    if (procBarrier_ != nullptr && counters_->numBlockedProcesses > 0 && admissionBudget_ > 0 && !shouldThrottleProcesses())
     {
-        BXLLockWakeup(procBarrier_, this, justOne);
+        BXLLockWakeup(procBarrier_, this, /*oneThread*/ true);
     }
 }
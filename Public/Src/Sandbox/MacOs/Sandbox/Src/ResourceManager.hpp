@@ -17,7 +17,12 @@
  *
  * This class relies on being externally notified whenever
  *   - number of tracked processes changed (see 'UpdateNumTrackedProcesses')
- *   - CPU/RAM usage changed (see 'Update{Cpu|Ram}Usage')
+ *   - CPU/RAM usage, memory pressure, or run-queue length changed (see 'UpdateResourceUsage')
+ *
+ * Blocked processes are let through under admission control: every resource update (and every exiting
+ * process) grants a bounded number of admissions, proportional to the estimated CPU headroom, and
+ * blocked processes are woken up one at a time, each admitted process waking up the next one while
+ * admissions remain.  That way, resources freeing up don't let all blocked processes in at once.
  */
 class ResourceManager : public OSObject
 {
@@ -35,18 +40,36 @@ private:
      */
     ResourceCounters *counters_;
 
+    /*! Exponentially weighted moving average of CPU usage (in basis points) */
+    SInt32 cpuUsageAverage_;
+
+    /*! Exponentially weighted moving average of the change of 'cpuUsageAverage_' between two updates */
+    SInt32 cpuUsageTrend_;
+
+    /*! Number of blocked processes that may still be let through before the next resource update. */
+    SInt32 admissionBudget_;
+
+    /*! Updates the CPU usage predictor with a new sample and stores the prediction into 'counters_'. */
+    void updateCpuUsagePrediction(basis_points cpuUsage);
+
+    /*! Number of admissions to grant based on the current resource usage. */
+    SInt32 computeAdmissionBudget() const;
+
+    /*! Atomically takes one admission from 'admissionBudget_'; returns false if none is left. */
+    bool tryConsumeAdmission();
+
     /*!
-     * Wakes up one or more blocked processes if the throttling condition
-     * (see 'shouldThrottleProcesses') is not met any longer.
-     *
-     * @param justOne Whether to wake up one or all blocked processes.
+     * Wakes up one blocked process if the throttling condition (see 'shouldThrottleProcesses')
+     * is not met any longer and there are admissions left.
      */
-    void wakeupBlockedProcesses(bool justOne);
+    void wakeupBlockedProcesses();
 
     /*!
-     * Returns whether the condition for throttling processes is met, which is:
-     *   - current CPU usage is greater or equal than the cpu usage threshold, AND
-     *   - current number of tracked processes is greater or equal than the tracked processes threshold.
+     * Returns whether the condition for throttling processes is met, which is any of:
+     *   - available RAM is below the RAM threshold,
+     *   - memory pressure level is at or above the memory pressure threshold,
+     *   - run-queue length is at or above the run-queue threshold,
+     *   - current or predicted CPU usage is at or above the CPU usage threshold.
      */
     bool shouldThrottleProcesses() const;
 
@@ -60,9 +83,9 @@ public:
     inline ResourceThresholds GetThresholds() const { return thresholds_; }
 
     /*!
-     * Returns whether process throttling is enabled; process throttling is enabled when:
-     *   - CPU usage threshold is set to a value from [1..99], AND
-     *   - tracked processes threshold is set to a value greater than 0.
+     * Returns whether process throttling is enabled; process throttling is enabled when any of:
+     *   - CPU usage threshold is set to a value from [1..99],
+     *   - any of the RAM, memory pressure, or run-queue length thresholds is set to a value greater than 0.
      */
     bool IsProcessThrottlingEnabled() const;
 
@@ -78,24 +101,36 @@ public:
     void UpdateNumTrackedProcesses(uint count);
 
     /*!
-     * Should be called at steady intervals to continuously update the current CPU usage (in basis points).
-     */
-    void UpdateCpuUsage(basis_points cpuUsage);
-
-    /*!
-     * Should be called at steady intervals to continuously update the current RAM usage (in basis points).
+     * Should be called at steady intervals to continuously update the current resource usage:
+     *
+     * @param cpuUsage Current CPU usage
+     * @param availableRamMB Currently available RAM
+     * @param memoryPressureLevel Current value of 'kern.memorystatus_vm_pressure_level' (0 if unknown)
+     * @param runQueueLength Current number of runnable threads per logical core
      */
-    void UpdateAvailableRam(uint availableRamMB);
+    void UpdateResourceUsage(basis_points cpuUsage, uint availableRamMB, uint memoryPressureLevel, basis_points runQueueLength);
 
     /*!
      * Blocks the current thread if 'IsProcessThrottlingEnabled()' and 'ShouldThrottleProcesses()' are both true.
      *
-     * The blocked thread will be awakened whenever that condition changes.
+     * The blocked thread will be awakened (and admitted) whenever that condition changes and admissions are available.
      *
      * NOTE: should not be called from an interrupt routine, or everything will grind to a halt.
      */
     void WaitForCpu();
 
+    /*!
+     * Briefly puts the current thread to sleep if the report queue it just reported to has a spill list that is
+     * filling up, giving the client a chance to catch up before the spill list is full.  The fuller the spill
+     * list, the longer the sleep (a few milliseconds at most).
+     *
+     * @param spilledPercent How full the spill list of the report queue is (see 'ConcurrentSharedDataQueue::getSpilledPercent')
+     * @result Whether the current thread was put to sleep.
+     *
+     * NOTE: should only be called from the threads of sandboxed processes.
+     */
+    bool ThrottleReportProducer(uint spilledPercent);
+
     /*!
      * Factory method.
      * @return New instance or NULL.
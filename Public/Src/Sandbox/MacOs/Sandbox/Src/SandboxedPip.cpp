@@ -7,6 +7,8 @@
 
 OSDefineMetaClassAndStructors(SandboxedPip, OSObject)
 
+volatile UInt32 SandboxedPip::s_vnodeCacheGeneration = 0;
+
 bool SandboxedPip::init(pid_t clientPid, pid_t processPid, Buffer *payload)
 {
     if (!super::init())
@@ -22,6 +24,16 @@ bool SandboxedPip::init(pid_t clientPid, pid_t processPid, Buffer *payload)
     disableCaching_   = !g_bxl_enable_cache;
     cacheCallCnt_     = 0;
 
+    for (int i = 0; i < kTelemetryLatencyBuckets; i++)
+    {
+        telemetryLatency_[i] = 0;
+    }
+
+    telemetryNumReports_     = 0;
+    telemetryCacheHits_      = 0;
+    telemetryCacheMisses_    = 0;
+    telemetrySequenceNumber_ = 0;
+
     payload_->retain();
 
     fam_.init((BYTE*)payload_->getBytes(), payload_->getSize());
@@ -31,18 +43,44 @@ bool SandboxedPip::init(pid_t clientPid, pid_t processPid, Buffer *payload)
         return false;
     }
 
-    oldPathCache_ = nullptr;
-    pathCache_    = Trie::createPathTrie();
+    oldPathCache_       = nullptr;
+    prevPathCache_      = nullptr;
+    numPromotedRecords_ = 0;
+    rotatingPathCache_  = 0;
+    pathCache_          = Trie::createPathTrie();
     if (!pathCache_)
     {
         return false;
     }
     
-    lastPathLookup_ = ThreadLocal::create();
+    lastPathLookup_ = (LastLookupSlot*)IOMalloc(kLastLookupSlotCount * sizeof(LastLookupSlot));
     if (!lastPathLookup_)
     {
         return false;
     }
+
+    for (int i = 0; i < kLastLookupSlotCount; i++)
+    {
+        lastPathLookup_[i].seq    = 0;
+        lastPathLookup_[i].length = 0;
+        lastPathLookup_[i].tid    = 0;
+    }
+
+    vnodeCache_ = (VNodeCacheSlot*)IOMalloc(kVNodeCacheSlotCount * sizeof(VNodeCacheSlot));
+    if (!vnodeCache_)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < kVNodeCacheSlotCount; i++)
+    {
+        vnodeCache_[i].seq            = 0;
+        vnodeCache_[i].generation     = 0;
+        vnodeCache_[i].vp             = nullptr;
+        vnodeCache_[i].vid            = 0;
+        vnodeCache_[i].handledActions = 0;
+        vnodeCache_[i].uniformLookupCone = false;
+    }
     
     return true;
 }
@@ -53,14 +91,26 @@ void SandboxedPip::free()
     {
         log_verbose(
             g_bxl_verbose_logging,
-           "Process Stats PID(%d) :: #cache hits = %d, #cache misses = %d, cache size = %d, thread local size = %d",
-            processId_, counters_.numCacheHits.count(), counters_.numCacheMisses.count(),
-            pathCache_->getCount(), lastPathLookup_->getCount());
+           "Process Stats PID(%d) :: #cache hits = %d, #cache misses = %d, #cache evictions = %d, cache size = %d, thread local size = %d",
+            processId_, counters_.numCacheHits.count(), counters_.numCacheMisses.count(), counters_.numCacheEvictions.count(),
+            pathCache_->getCount(), getLastPathLookupElemCount());
     }
 
     OSSafeReleaseNULL(payload_);
-    OSSafeReleaseNULL(lastPathLookup_);
+    if (lastPathLookup_ != nullptr)
+    {
+        IOFree(lastPathLookup_, kLastLookupSlotCount * sizeof(LastLookupSlot));
+        lastPathLookup_ = nullptr;
+    }
+
+    if (vnodeCache_ != nullptr)
+    {
+        IOFree(vnodeCache_, kVNodeCacheSlotCount * sizeof(VNodeCacheSlot));
+        vnodeCache_ = nullptr;
+    }
+
     OSSafeReleaseNULL(pathCache_);
+    OSSafeReleaseNULL(prevPathCache_);
     OSSafeReleaseNULL(oldPathCache_);
     super::free();
 }
@@ -100,42 +150,247 @@ PipInfo SandboxedPip::introspect()
     };
 }
 
-bool SandboxedPip::RefreshDisableCaching()
+/*! Atomically sets '*address' to 0 and returns its previous value. */
+static UInt32 exchangeWithZero(volatile UInt32 *address)
 {
-    if (!disableCaching_)
+    UInt32 value;
+    do
     {
-        if (ShouldDisableCaching())
-        {
-            // once caching is disabled, it must stay disabled
-            disableCaching_ = true;
-            Trie *oldCache = pathCache_;
-            Trie *newCache = Trie::createPathTrie();
-            if (OSCompareAndSwapPtr(oldCache, newCache, &pathCache_))
-            {
-                // we swapped --> save oldCache for garbage collection
-                // (releasing is immediately is dangerous because it might still be in use in a concurrent thread)
-                oldPathCache_ = oldCache;
-            }
-            else
-            {
-                // someone else did it --> release newCache that was created for nothing
-                OSSafeReleaseNULL(newCache);
-            }
-        }
+        value = *address;
+    }
+    while (value != 0 && !OSCompareAndSwap(value, 0, address));
+
+    return value;
+}
+
+void SandboxedPip::recordReportLatency(uint64_t creationTime, uint64_t enqueueTime)
+{
+    uint64_t latencyNs = 0;
+    if (enqueueTime > creationTime)
+    {
+        absolutetime_to_nanoseconds(enqueueTime - creationTime, &latencyNs);
     }
 
-    return disableCaching_;
+    uint64_t latencyUs = latencyNs / 1000;
+    int bucket = latencyUs == 0 ? 0 : 64 - __builtin_clzll(latencyUs);
+    bucket = bucket < kTelemetryLatencyBuckets ? bucket : kTelemetryLatencyBuckets - 1;
+
+    OSIncrementAtomic(&telemetryLatency_[bucket]);
+    OSIncrementAtomic(&telemetryNumReports_);
 }
 
-# define PCT(a, b) (int)(((a) * 1.0) / ((a) + (b)) * 100)
+bool SandboxedPip::drainTelemetry(UInt32 sequenceNumber, PipTelemetryDelta *delta)
+{
+    UInt32 lastSequenceNumber = telemetrySequenceNumber_;
+    if (lastSequenceNumber == sequenceNumber || !OSCompareAndSwap(lastSequenceNumber, sequenceNumber, &telemetrySequenceNumber_))
+    {
+        // already visited (every process of the pip leads here)
+        return false;
+    }
+
+    uint32_t cacheHits   = counters_.numCacheHits.count();
+    uint32_t cacheMisses = counters_.numCacheMisses.count();
+
+    delta->pipId          = getPipId();
+    delta->pid            = getProcessId();
+    delta->clientPid      = getClientPid();
+    delta->numReports     = exchangeWithZero(&telemetryNumReports_);
+    delta->numCacheHits   = cacheHits - telemetryCacheHits_;
+    delta->numCacheMisses = cacheMisses - telemetryCacheMisses_;
+    for (int i = 0; i < kTelemetryLatencyBuckets; i++)
+    {
+        delta->enqueueLatency[i] = exchangeWithZero(&telemetryLatency_[i]);
+    }
+
+    telemetryCacheHits_   = cacheHits;
+    telemetryCacheMisses_ = cacheMisses;
+
+    return delta->numReports > 0 || delta->numCacheHits > 0 || delta->numCacheMisses > 0;
+}
 
-inline bool SandboxedPip::ShouldDisableCaching()
+uint SandboxedPip::getLastPathLookupElemCount() const
 {
-    return
-        // above the min_entries threshold
-        pathCache_->getCount() > g_bxl_disable_cache_min_entries &&
-        // below the max_hit_pct threshold
-        PCT(counters_.numCacheHits, counters_.numCacheMisses) < g_bxl_disable_cache_max_hit_pct;
+    uint count = 0;
+    for (int i = 0; i < kLastLookupSlotCount; i++)
+    {
+        if (lastPathLookup_[i].tid != 0) count++;
+    }
+
+    return count;
+}
+
+void SandboxedPip::setLastLookedUpPath(const char *path)
+{
+    uint64_t tid = self_tid();
+    LastLookupSlot *slot = getLastLookupSlot(tid);
+
+    UInt32 seq = slot->seq;
+    if ((seq & 1) != 0 || !OSCompareAndSwap(seq, seq + 1, &slot->seq))
+    {
+        // another thread is writing to this slot
+        return;
+    }
+
+    size_t length = strlcpy(slot->path, path, sizeof(slot->path));
+    slot->length  = (uint32_t)(length < sizeof(slot->path) ? length : sizeof(slot->path) - 1);
+    slot->tid     = tid;
+
+    OSMemoryBarrier();
+    slot->seq = seq + 2;
+}
+
+bool SandboxedPip::getLastLookedUpPath(char *buffer, size_t bufferSize) const
+{
+    uint64_t tid = self_tid();
+    const LastLookupSlot *slot = getLastLookupSlot(tid);
+
+    UInt32 seq = slot->seq;
+    OSMemoryBarrier();
+    if ((seq & 1) != 0 || slot->tid != tid || slot->length >= bufferSize)
+    {
+        return false;
+    }
+
+    memcpy(buffer, slot->path, slot->length);
+    buffer[slot->length] = '\0';
+
+    // the copy is only valid if no writer came in while we were copying
+    OSMemoryBarrier();
+    return slot->seq == seq;
+}
+
+bool SandboxedPip::vnodeCacheLookup(vnode_t vp, uint32_t vid, UInt32 generation, kauth_action_t actions) const
+{
+    if (disableCaching_)
+    {
+        return false;
+    }
+
+    const VNodeCacheSlot *slot = getVNodeCacheSlot(vp);
+
+    UInt32 seq = slot->seq;
+    OSMemoryBarrier();
+    if ((seq & 1) != 0)
+    {
+        return false;
+    }
+
+    bool hit =
+        slot->vp == vp &&
+        slot->vid == vid &&
+        slot->generation == generation &&
+        (actions & ~slot->handledActions) == 0;
+
+    // the fields read are only valid if no writer came in while we were reading them
+    OSMemoryBarrier();
+    return hit && slot->seq == seq;
+}
+
+bool SandboxedPip::vnodeCacheLookupUniformLookupCone(vnode_t vp, uint32_t vid, UInt32 generation) const
+{
+    if (disableCaching_)
+    {
+        return false;
+    }
+
+    const VNodeCacheSlot *slot = getVNodeCacheSlot(vp);
+
+    UInt32 seq = slot->seq;
+    OSMemoryBarrier();
+    if ((seq & 1) != 0)
+    {
+        return false;
+    }
+
+    bool hit =
+        slot->vp == vp &&
+        slot->vid == vid &&
+        slot->generation == generation &&
+        slot->uniformLookupCone;
+
+    // the fields read are only valid if no writer came in while we were reading them
+    OSMemoryBarrier();
+    return hit && slot->seq == seq;
+}
+
+void SandboxedPip::vnodeCacheUpdate(vnode_t vp, uint32_t vid, UInt32 generation, kauth_action_t actions, bool uniformLookupCone)
+{
+    if (disableCaching_ || generation != s_vnodeCacheGeneration)
+    {
+        // the path looked up for this vnode may be outdated already
+        return;
+    }
+
+    VNodeCacheSlot *slot = getVNodeCacheSlot(vp);
+
+    UInt32 seq = slot->seq;
+    if ((seq & 1) != 0 || !OSCompareAndSwap(seq, seq + 1, &slot->seq))
+    {
+        // another thread is writing to this slot
+        return;
+    }
+
+    if (slot->vp == vp && slot->vid == vid && slot->generation == generation)
+    {
+        slot->handledActions    |= actions;
+        slot->uniformLookupCone |= uniformLookupCone;
+    }
+    else
+    {
+        slot->vp                = vp;
+        slot->vid               = vid;
+        slot->generation        = generation;
+        slot->handledActions    = actions;
+        slot->uniformLookupCone = uniformLookupCone;
+    }
+
+    OSMemoryBarrier();
+    slot->seq = seq + 2;
+}
+
+void SandboxedPip::RotatePathCacheIfNeeded(Trie *cache)
+{
+    if (getPathCacheSize(cache) * 2 <= getPathCacheBudget())
+    {
+        return;
+    }
+
+    // the retired generation must be garbage collected before another one can be retired
+    if (oldPathCache_ != nullptr)
+    {
+        return;
+    }
+
+    if (!OSCompareAndSwap(0, 1, &rotatingPathCache_))
+    {
+        // someone else is rotating
+        return;
+    }
+
+    // check again, someone else might have rotated in the meantime
+    if (cache == pathCache_ && oldPathCache_ == nullptr)
+    {
+        Trie *newCache = Trie::createPathTrie();
+        if (newCache != nullptr)
+        {
+            Trie *retired = prevPathCache_;
+            if (retired != nullptr)
+            {
+                // every record of the retired generation that wasn't promoted is evicted
+                int numPromoted = numPromotedRecords_;
+                int numEvicted  = (int)retired->getCount() - numPromoted;
+                counters_.numCacheEvictions += numEvicted > 0 ? numEvicted : 0;
+            }
+
+            // (releasing the retired generation immediately is dangerous because it might still be in use in a concurrent thread)
+            oldPathCache_       = retired;
+            prevPathCache_      = cache;
+            numPromotedRecords_ = 0;
+            pathCache_          = newCache;
+        }
+    }
+
+    rotatingPathCache_ = 0;
 }
 
 #undef super
@@ -9,6 +9,7 @@
 #include <IOKit/IOSharedDataQueue.h>
 #include <sys/proc.h>
 #include <sys/vnode.h>
+#include <kern/thread.h>
 
 #include "AutoIncDec.hpp"
 #include "BuildXLSandboxShared.hpp"
@@ -16,11 +17,18 @@
 #include "FileAccessManifestParser.hpp"
 #include "Buffer.hpp"
 #include "PolicyResult.h"
-#include "ThreadLocal.hpp"
 #include "Trie.hpp"
 
 #define SandboxedPip BXL_CLASS(SandboxedPip)
 
+/*! Per-thread slots for remembering last looked up paths (there are 2^kLastLookupSlotBits of them). */
+#define kLastLookupSlotBits  5
+#define kLastLookupSlotCount (1 << kLastLookupSlotBits)
+
+/*! Slots of the vnode cache (there are 2^kVNodeCacheSlotBits of them). */
+#define kVNodeCacheSlotBits  8
+#define kVNodeCacheSlotCount (1 << kVNodeCacheSlotBits)
+
 /*!
  * Represents the root of the process tree being tracked.
  *
@@ -53,34 +61,129 @@ private:
     int processTreeCount_;
 
     /*!
-     * Maps every accessed path to a 'CacheRecord' object (which contains caching information regarding that path).
+     * The path cache maps every accessed path to a 'CacheRecord' object (which contains caching information regarding that path).
+     *
+     * It is bounded by a memory budget (see 'g_bxl_path_cache_budget_mb'), and kept as two generations of tries to approximate
+     * LRU eviction: new paths go into the current generation; a path found only in the previous generation is promoted to the
+     * current one.  Once the current generation uses half the budget, the previous generation is retired, which evicts
+     * every path that wasn't looked up since the last rotation, and the current one becomes the previous one.
+     * (Trie nodes can't be removed individually, so dropping a whole generation is the only way to reclaim their memory.)
+     *
      * IMPORTANT: increment/decrement cacheCallCnt_ around every use.
      */
     Trie *pathCache_;
 
-    /*! Old path cache left to be garbage collected (in 'cacheLookup' method) after caching was dynamically disabled. */
+    /*! Previous generation of the path cache (nullptr until the first rotation). */
+    Trie *prevPathCache_;
+
+    /*! Retired generation of the path cache, left to be garbage collected (in 'cacheLookup' method). */
     Trie *oldPathCache_;
 
+    /*! Number of records promoted from 'prevPathCache_' to 'pathCache_' since the last rotation. */
+    int numPromotedRecords_;
+
+    /*! Set while some thread is rotating the path cache generations. */
+    UInt32 rotatingPathCache_;
+
     /*! Counts the number of concurrent calls to 'pathCache_' */
     int cacheCallCnt_;
 
+    /*! True when caching is disabled for this pip (see 'g_bxl_enable_cache'). */
+    bool disableCaching_;
+
     /*!
-     * Starts out as false and becomes true if we decide to disable caching for this pip.
-     * INVARIANT: once disabled, it stays disabled.
+     * A slot remembering the last path looked up by a thread.
+     *
+     * Writers and readers synchronize through 'seq' like a seqlock: it is odd while a writer is copying
+     * the path in, and a reader only trusts what it copied out if 'seq' was even and unchanged throughout.
      */
-    bool disableCaching_;
+    typedef struct {
+        volatile UInt32 seq;
+        uint32_t length;
+        uint64_t tid;
+        char path[MAXPATHLEN];
+    } LastLookupSlot;
 
-    /*! A thread-local storage for remembering the last looked up path by every thread. */
-    ThreadLocal *lastPathLookup_;
+    /*!
+     * Fixed-size array of slots (allocated once, in 'init') for remembering the last looked up path by every thread.
+     * A thread uses the slot its thread id hashes to; a thread hashing to the same slot simply takes it over.
+     */
+    LastLookupSlot *lastPathLookup_;
+
+    static uint64_t self_tid() { return thread_tid(current_thread()); }
+
+    /*!
+     * A slot of the vnode cache, synchronized through 'seq' the same way as 'LastLookupSlot'.
+     *
+     * 'handledActions' are the kauth vnode actions on ('vp', 'vid') that were found to be allowed and already reported
+     * (or not to be reported at all) while the vnode cache generation was 'generation'.  'uniformLookupCone' is set when
+     * ('vp', 'vid') is a directory in whose cone lookups are allowed and never reported (see 'vnodeCacheAddUniformLookupCone').
+     */
+    typedef struct {
+        volatile UInt32 seq;
+        UInt32 generation;
+        vnode_t vp;
+        uint32_t vid;
+        kauth_action_t handledActions;
+        bool uniformLookupCone;
+    } VNodeCacheSlot;
+
+    /*!
+     * Fixed-size array of slots (allocated once, in 'init'), forming a direct-mapped cache in front of the path cache for
+     * kauth vnode events, so that repeated accesses to the same vnode don't have to construct its path (vn_getpath) at all.
+     *
+     * Vnodes are identified by their pointer and vid: the vid of a vnode changes when it is reclaimed and recycled, so entries
+     * of a reclaimed vnode can never be hit again. What can change the path of a live vnode (renames, links, deletes) bumps
+     * the generation of every vnode cache instead (see 'invalidateVNodeCaches').
+     */
+    VNodeCacheSlot *vnodeCache_;
+
+    /*! Generation of the vnode caches of all pips. */
+    static volatile UInt32 s_vnodeCacheGeneration;
+
+    /*! Adds 'actions' (and 'uniformLookupCone', if set) to the vnode cache slot of ('vp', 'vid'); see 'vnodeCacheAdd'. */
+    void vnodeCacheUpdate(vnode_t vp, uint32_t vid, UInt32 generation, kauth_action_t actions, bool uniformLookupCone);
+
+    VNodeCacheSlot* getVNodeCacheSlot(vnode_t vp) const
+    {
+        // Fibonacci hashing, because vnodes are allocated from a zone and their addresses share most bits
+        return &vnodeCache_[((uint64_t)vp * 0x9E3779B97F4A7C15ull) >> (64 - kVNodeCacheSlotBits)];
+    }
+
+    LastLookupSlot* getLastLookupSlot(uint64_t tid) const
+    {
+        // Fibonacci hashing, because thread ids are mostly consecutive numbers
+        return &lastPathLookup_[(tid * 0x9E3779B97F4A7C15ull) >> (64 - kLastLookupSlotBits)];
+    }
 
     /*! Various counters.  IMPORTANT: counters may be globally disabled so no logic may rely on their values. */
     AllCounters counters_;
 
+    /*! Histogram of report enqueue latencies (see 'kTelemetryLatencyBuckets') since the last telemetry drain. */
+    volatile UInt32 telemetryLatency_[kTelemetryLatencyBuckets];
+
+    /*! Number of reports since the last telemetry drain. */
+    volatile UInt32 telemetryNumReports_;
+
+    /*! Values of the cache hit/miss counters at the last telemetry drain. */
+    uint32_t telemetryCacheHits_;
+    uint32_t telemetryCacheMisses_;
+
+    /*! Sequence number of the last telemetry drain that visited this pip. */
+    volatile UInt32 telemetrySequenceNumber_;
+
     static OSObject* CacheRecordFactory(void *)
     {
         return CacheRecord::create();
     };
 
+    static OSObject* PromotedCacheRecordFactory(void *record)
+    {
+        CacheRecord *cacheRecord = (CacheRecord*)record;
+        cacheRecord->retain();
+        return cacheRecord;
+    };
+
     bool init(pid_t clientPid, pid_t processPid, Buffer *payload);
 
 protected:
@@ -119,48 +222,58 @@ public:
     /*! Various counters. */
     AllCounters* Counters() { return &counters_; }
 
-    /*! Number of elements in the 'lastPathLookup' dictionary. */
-    uint getLastPathLookupElemCount() const { return lastPathLookup_->getCount(); }
+    /*! Number of 'lastPathLookup' slots currently associated with some thread. */
+    uint getLastPathLookupElemCount() const;
 
-    /*! Number of nodes in the 'lastPathLookup' dictionary. */
-    uint getLastPathLookupNodeCount() const { return lastPathLookup_->getNodeCount(); }
+    /*! Number of 'lastPathLookup' slots. */
+    uint getLastPathLookupNodeCount() const { return kLastLookupSlotCount; }
 
-    /*! Size in bytes of each node in the 'lastPathLookup' dictionary. */
-    uint getLastPathLookupNodeSize() const { return lastPathLookup_->getNodeSize(); }
+    /*! Size in bytes of each 'lastPathLookup' slot. */
+    uint getLastPathLookupNodeSize() const { return sizeof(LastLookupSlot); }
 
-    /*! Number of elements in the 'pathCache' dictionary. */
+    /*! Number of elements in the current generation of the 'pathCache' dictionary. */
     uint getPathCacheElemCount() { AutoIncDec cnt(&cacheCallCnt_); return pathCache_->getCount(); }
 
-    /*! Number of nodes in the 'pathCache' dictionary. */
+    /*! Number of nodes in the current generation of the 'pathCache' dictionary. */
     uint getPathCacheNodeCount() { AutoIncDec cnt(&cacheCallCnt_); return pathCache_->getNodeCount(); }
 
     /*! Size in bytes of each node in the 'pathCache' dictionary. */
     uint getPathCacheNodeSize() { AutoIncDec cnt(&cacheCallCnt_); return pathCache_->getNodeSize(); }
 
     /*!
-     * Uses a thread-local storage to save a given path as the last path that was looked up on the current thread.
+     * Saves a given path as the last path that was looked up on the current thread.
+     *
+     * Doesn't allocate and doesn't block: if another thread is concurrently writing to the same slot,
+     * the path is dropped (that slot is about to be associated with the other thread anyway).
      */
-    void setLastLookedUpPath(const char *path)
-    {
-        const OSSymbol *pathSym = OSSymbol::withCString(path);
-        lastPathLookup_->insert(pathSym);
-        OSSafeReleaseNULL(pathSym);
-    }
+    void setLastLookedUpPath(const char *path);
 
     /*!
-     * Returns the last path saved by the current thread by calling the 'setLastLookedUpPath' method.
+     * Copies the last path saved by the current thread by calling the 'setLastLookedUpPath' method into 'buffer'.
      *
      * (In practice, this is the path associated with the last MAC_LOOKUP event that happened on the current thread).
+     *
+     * @result False if no such path is available (i.e., the slot was taken over by a different thread, or is
+     *         being written to concurrently), in which case the content of 'buffer' is unspecified.
      */
-    const char* getLastLookedUpPath()
-    {
-        OSSymbol *value = OSDynamicCast(OSSymbol, lastPathLookup_->get());
-        return value != nullptr ? value->getCStringNoCopy() : nullptr;
-    }
+    bool getLastLookedUpPath(char *buffer, size_t bufferSize) const;
 
     /*! Information about this pip that can be queried from user space */
     PipInfo introspect();
 
+#pragma mark Telemetry
+
+    /*! Records the latency of a report of this pip, from its creation to its enqueueing (both in mach absolute time). */
+    void recordReportLatency(uint64_t creationTime, uint64_t enqueueTime);
+
+    /*!
+     * Moves what was recorded since the previous drain into 'delta' (when this pip hasn't been visited by
+     * drain 'sequenceNumber' yet), so that the next drain starts from zero.
+     *
+     * @result Whether there was anything to report for this pip.
+     */
+    bool drainTelemetry(UInt32 sequenceNumber, PipTelemetryDelta *delta);
+
 #pragma mark Process Tree Tracking
 
     /*! Number of currently active processes in this pip's process tree */
@@ -183,26 +296,87 @@ public:
     {
         AutoIncDec callCnt(&cacheCallCnt_);
 
-        // check if we dynamically decided to disable caching for this pip
-        if (RefreshDisableCaching())
+        if (disableCaching_)
         {
-            // If caching is disabled, and no one else is using pathCache_, and we came here first:
-            //   --> safe to release old path cache left to be garbage collected
-            // NOTE: even if someone else comes in after we've checked `cacheCallCnt_ == 1`, 
-            //       because once caching is disabled it stays disabled, they'll get to use the new path 
-            //       cache object, so it's still safe to release oldPathCache_)
-            if (cacheCallCnt_ == 1 && callCnt.ValueBeforeTheIncrement() == 0 && oldPathCache_ != nullptr)
-            {
-                OSSafeReleaseNULL(oldPathCache_);
-            }
+            return nullptr;
+        }
+
+        // If no one else is using the path cache, and we came here first:
+        //   --> safe to release the retired generation left to be garbage collected
+        // NOTE: even if someone else comes in after we've checked `cacheCallCnt_ == 1`, they can't
+        //       get to the retired generation anymore because it is neither 'pathCache_' nor 'prevPathCache_'
+        if (cacheCallCnt_ == 1 && callCnt.ValueBeforeTheIncrement() == 0 && oldPathCache_ != nullptr)
+        {
+            OSSafeReleaseNULL(oldPathCache_);
+        }
 
+        Trie *cache = pathCache_;
+        CacheRecord *record = OSDynamicCast(CacheRecord, cache->get(path));
+        if (record != nullptr)
+        {
+            return record;
+        }
+
+        Trie *prevCache = prevPathCache_;
+        CacheRecord *prevRecord = prevCache != nullptr ? OSDynamicCast(CacheRecord, prevCache->get(path)) : nullptr;
+        if (prevRecord == nullptr && getPathCacheSize(cache) > getPathCacheBudget())
+        {
+            // the previous rotation hasn't been garbage collected yet --> don't grow past the budget
             return nullptr;
         }
-        else
+
+        OSObject *value = prevRecord != nullptr
+            ? cache->getOrAdd(path, prevRecord, PromotedCacheRecordFactory)
+            : cache->getOrAdd(path, nullptr, CacheRecordFactory);
+
+        if (prevRecord != nullptr)
         {
-            OSObject *value = pathCache_->getOrAdd(path, nullptr, CacheRecordFactory);
-            return OSDynamicCast(CacheRecord, value);
+            OSIncrementAtomic(&numPromotedRecords_);
         }
+
+        RotatePathCacheIfNeeded(cache);
+        return OSDynamicCast(CacheRecord, value);
+    }
+
+#pragma mark VNode Caching
+
+    /*! Current generation of the vnode caches, to be passed to 'vnodeCacheLookup' and 'vnodeCacheAdd'. */
+    static UInt32 getVNodeCacheGeneration() { return s_vnodeCacheGeneration; }
+
+    /*! Drops every entry of the vnode cache of every pip, e.g., because a vnode may have changed its path. */
+    static void invalidateVNodeCaches() { OSIncrementAtomic(&s_vnodeCacheGeneration); }
+
+    /*!
+     * Returns whether all the given kauth vnode 'actions' on vnode ('vp', 'vid') were already handled (allowed and reported,
+     * see 'vnodeCacheAdd') during the given vnode cache 'generation'.
+     */
+    bool vnodeCacheLookup(vnode_t vp, uint32_t vid, UInt32 generation, kauth_action_t actions) const;
+
+    /*!
+     * Records that the given kauth vnode 'actions' on vnode ('vp', 'vid') were handled (allowed, and either reported or not
+     * to be reported at all), where 'generation' is the vnode cache generation observed before the path of the vnode was looked up.
+     *
+     * Doesn't allocate and doesn't block: if another thread is concurrently writing to the same slot, the actions are not recorded.
+     */
+    void vnodeCacheAdd(vnode_t vp, uint32_t vid, UInt32 generation, kauth_action_t actions)
+    {
+        vnodeCacheUpdate(vp, vid, generation, actions, /*uniformLookupCone*/ false);
+    }
+
+    /*!
+     * Returns whether directory vnode ('vp', 'vid') was found to be in a uniform lookup cone (see 'vnodeCacheAddUniformLookupCone')
+     * during the given vnode cache 'generation'.
+     */
+    bool vnodeCacheLookupUniformLookupCone(vnode_t vp, uint32_t vid, UInt32 generation) const;
+
+    /*!
+     * Records that directory vnode ('vp', 'vid') is in a cone of the manifest where every path gets the same policy, and
+     * where that policy allows lookups without reporting them, so lookups relative to it need no handling at all.
+     * Same as 'vnodeCacheAdd' otherwise.
+     */
+    void vnodeCacheAddUniformLookupCone(vnode_t vp, uint32_t vid, UInt32 generation)
+    {
+        vnodeCacheUpdate(vp, vid, generation, /*actions*/ 0, /*uniformLookupCone*/ true);
     }
 
 #pragma mark Static Methods
@@ -212,8 +386,16 @@ public:
 
 private:
 
-    bool RefreshDisableCaching();
-    inline bool ShouldDisableCaching();
+    /*! Approximate number of bytes used by a given generation of the path cache. */
+    static uint64_t getPathCacheSize(Trie *cache)
+    {
+        return (uint64_t)cache->getNodeCount() * cache->getNodeSize() + (uint64_t)cache->getCount() * sizeof(CacheRecord);
+    }
+
+    /*! Memory budget of the path cache (both generations included), in bytes. */
+    static uint64_t getPathCacheBudget() { return (uint64_t)g_bxl_path_cache_budget_mb * 1024 * 1024; }
+
+    void RotatePathCacheIfNeeded(Trie *cache);
 };
 
 #endif /* SandboxedPip_hpp */
@@ -13,9 +13,8 @@ int g_bxl_enable_cache = 1;
 int g_bxl_enable_counters = 1;	
 int g_bxl_enable_light_trie = 1;
 
-// for caching to be disabled for a pip, it must have at least 20000 entries and no more than 20% cache hit rate
-int g_bxl_disable_cache_min_entries = 20000;
-int g_bxl_disable_cache_max_hit_pct = 20;
+// beyond this, the least recently used paths of a pip get evicted from its path cache
+int g_bxl_path_cache_budget_mb = 64;
 
 SYSCTL_INT(_kern,                               // parent
            OID_AUTO,                            // oid
@@ -51,19 +50,11 @@ SYSCTL_INT(_kern,
 
 SYSCTL_INT(_kern,
            OID_AUTO,
-           bxl_disable_cache_min_entries,
+           bxl_path_cache_budget_mb,
            CTLFLAG_RW,
-           &g_bxl_disable_cache_min_entries,
-           g_bxl_disable_cache_min_entries,
-           "For pip caching to be disabled, the cache must have at least this many entries");
-
-SYSCTL_INT(_kern,
-           OID_AUTO,
-           bxl_disable_cache_max_hit_pct,
-           CTLFLAG_RW,
-           &g_bxl_disable_cache_max_hit_pct,
-           g_bxl_disable_cache_max_hit_pct,
-           "For pip caching to be disabled, its cache hit rate must be less than this percent");
+           &g_bxl_path_cache_budget_mb,
+           g_bxl_path_cache_budget_mb,
+           "Memory budget (in MB) of the path cache of each pip, least recently used paths are evicted beyond it");
 
 void bxl_sysctl_register()
 {
@@ -71,8 +62,7 @@ void bxl_sysctl_register()
     sysctl_register_oid(&sysctl__kern_bxl_verbose_logging);
     sysctl_register_oid(&sysctl__kern_bxl_enable_cache);
     sysctl_register_oid(&sysctl__kern_bxl_enable_light_trie);
-    sysctl_register_oid(&sysctl__kern_bxl_disable_cache_min_entries);
-    sysctl_register_oid(&sysctl__kern_bxl_disable_cache_max_hit_pct);
+    sysctl_register_oid(&sysctl__kern_bxl_path_cache_budget_mb);
 }
 
 void bxl_sysctl_unregister()
@@ -81,6 +71,5 @@ void bxl_sysctl_unregister()
     sysctl_unregister_oid(&sysctl__kern_bxl_verbose_logging);
     sysctl_unregister_oid(&sysctl__kern_bxl_enable_cache);
     sysctl_unregister_oid(&sysctl__kern_bxl_enable_light_trie);
-    sysctl_unregister_oid(&sysctl__kern_bxl_disable_cache_min_entries);
-    sysctl_unregister_oid(&sysctl__kern_bxl_disable_cache_max_hit_pct);
+    sysctl_unregister_oid(&sysctl__kern_bxl_path_cache_budget_mb);
 }
@@ -0,0 +1,198 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "PidTable.hpp"
+#include "Alloc.hpp"
+
+#define super OSObject
+
+OSDefineMetaClassAndStructors(PidTable, OSObject)
+
+static const size_t s_slotCount = PidTable::kMaxPid + 1;
+
+PidTable* PidTable::create()
+{
+    PidTable *instance = new PidTable;
+    if (instance != nullptr)
+    {
+        if (!instance->init())
+        {
+            OSSafeReleaseNULL(instance);
+        }
+    }
+
+    return instance;
+}
+
+bool PidTable::init()
+{
+    if (!super::init())
+    {
+        return false;
+    }
+
+    size_ = 0;
+    onChangeData_ = nullptr;
+    onChangeCallback_ = nullptr;
+
+    slots_ = Alloc::New<OSObject*>(s_slotCount);
+    if (slots_ == nullptr)
+    {
+        return false;
+    }
+
+    bzero(slots_, sizeof(OSObject*) * s_slotCount);
+    return true;
+}
+
+void PidTable::free()
+{
+    if (slots_ != nullptr)
+    {
+        for (size_t pid = 0; pid < s_slotCount; pid++)
+        {
+            OSSafeReleaseNULL(slots_[pid]);
+        }
+
+        Alloc::Delete<OSObject*>(slots_, s_slotCount);
+        slots_ = nullptr;
+    }
+
+    size_ = 0;
+
+    super::free();
+}
+
+bool PidTable::onChange(void *callbackArgs, Trie::on_change_fn callback)
+{
+    if (onChangeCallback_) return false;
+    onChangeData_ = callbackArgs;
+    onChangeCallback_ = callback;
+    return true;
+}
+
+void PidTable::triggerOnChange(int oldCount, int newCount) const
+{
+    if (onChangeCallback_ && oldCount != newCount)
+    {
+        onChangeCallback_(onChangeData_, oldCount, newCount);
+    }
+}
+
+OSObject* PidTable::getOrAdd(uint64_t pid, void *factoryArgs, Trie::factory_fn factory, TrieResult *result)
+{
+    if (!inRange(pid))
+    {
+        if (result) *result = Trie::kTrieResultFailure;
+        return nullptr;
+    }
+
+    if (slots_[pid] != nullptr)
+    {
+        if (result) *result = Trie::kTrieResultAlreadyExists;
+        return slots_[pid];
+    }
+
+    OSObject *newRecord = factory(factoryArgs);
+    if (newRecord != nullptr && OSCompareAndSwapPtr(nullptr, newRecord, &slots_[pid]))
+    {
+        // we updated the slot --> retain (by not releasing created newRecord) and increase size
+        int oldCount = OSIncrementAtomic(&size_);
+        triggerOnChange(oldCount, oldCount + 1);
+        if (result) *result = Trie::kTrieResultInserted;
+    }
+    else
+    {
+        // someone else came first --> release 'newRecord' that we created for nothing
+        OSSafeReleaseNULL(newRecord);
+        if (result) *result = Trie::kTrieResultAlreadyExists;
+    }
+
+    return slots_[pid];
+}
+
+PidTable::TrieResult PidTable::insert(uint64_t pid, const OSObject *value)
+{
+    if (!inRange(pid) || value == nullptr)
+    {
+        return Trie::kTrieResultFailure;
+    }
+
+    if (OSCompareAndSwapPtr(nullptr, (void*)value, &slots_[pid]))
+    {
+        // slot was empty and we updated it --> retain the new value and increment size
+        value->retain();
+        int oldCount = OSIncrementAtomic(&size_);
+        triggerOnChange(oldCount, oldCount + 1);
+        return Trie::kTrieResultInserted;
+    }
+    else
+    {
+        return Trie::kTrieResultAlreadyExists;
+    }
+}
+
+PidTable::TrieResult PidTable::removeExpected(uint64_t pid, OSObject *expected)
+{
+    if (OSCompareAndSwapPtr(expected, nullptr, &slots_[pid]))
+    {
+        // we cleared the slot --> release previous value and decrease size
+        OSSafeReleaseNULL(expected);
+        int oldCount = OSDecrementAtomic(&size_);
+        triggerOnChange(oldCount, oldCount - 1);
+        return Trie::kTrieResultRemoved;
+    }
+    else
+    {
+        // someone else came first --> declare race and do nothing
+        return Trie::kTrieResultRace;
+    }
+}
+
+PidTable::TrieResult PidTable::remove(uint64_t pid, const OSObject *value)
+{
+    OSObject *current = get(pid);
+    if (current == nullptr)
+    {
+        return Trie::kTrieResultAlreadyEmpty;
+    }
+
+    if (current != value)
+    {
+        // 'pid' has been reused by a process other than the one the caller is after
+        return Trie::kTrieResultRace;
+    }
+
+    return removeExpected(pid, current);
+}
+
+void PidTable::forEach(void *callbackArgs, Trie::for_each_fn callback)
+{
+    for (size_t pid = 0; pid < s_slotCount; pid++)
+    {
+        OSObject *record = slots_[pid];
+        if (record)
+        {
+            record->retain();
+            callback(callbackArgs, pid, record);
+            record->release();
+        }
+    }
+}
+
+void PidTable::removeMatching(void *filterArgs, Trie::filter_fn filter)
+{
+    for (size_t pid = 0; pid < s_slotCount; pid++)
+    {
+        OSObject *record = slots_[pid];
+        if (record)
+        {
+            record->retain();
+            if (filter(filterArgs, record))
+            {
+                removeExpected(pid, record);
+            }
+            record->release();
+        }
+    }
+}
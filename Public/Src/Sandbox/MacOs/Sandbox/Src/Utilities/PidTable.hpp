@@ -0,0 +1,126 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef PidTable_hpp
+#define PidTable_hpp
+
+#include "Trie.hpp"
+
+#define PidTable BXL_CLASS(PidTable)
+
+/*!
+ * A thread-safe dictionary keyed by process id, implemented as a direct-mapped array of record pointers.
+ *
+ * Process ids on macOS never exceed PID_MAX, so every pid gets its own slot and a lookup is a single load,
+ * as opposed to a uint Trie which walks one node per decimal digit of the key.  The price is a fixed
+ * allocation of (kMaxPid + 1) pointers and a full scan of the array in 'forEach' and 'removeMatching'.
+ *
+ * Records are installed and cleared with a compare-and-swap, so concurrent readers only ever observe
+ * a slot as either empty or holding a fully constructed record.  Like Trie, added records are retained by
+ * this table and released once they are removed from it.  Pids out of range are never stored: adding one
+ * fails with 'kTrieResultFailure' and looking one up returns NULL.
+ *
+ * Thread-safe.  Non-blocking.
+ */
+class PidTable : public OSObject
+{
+    OSDeclareDefaultStructors(PidTable);
+
+public:
+
+    typedef Trie::TrieResult TrieResult;
+
+    /*! Largest pid the kernel hands out (PID_MAX from sys/proc_internal.h, which is not exported to kexts) */
+    static const pid_t kMaxPid = 99999;
+
+private:
+
+    /*! One slot per pid in [0, kMaxPid] */
+    OSObject **slots_;
+
+    /*! Number of non-empty slots */
+    uint size_;
+
+    /*! Callback function (and associated payload) to call whenever the size changes. */
+    Trie::on_change_fn onChangeCallback_;
+    void *onChangeData_;
+
+    bool init() override;
+
+    /*! Invokes the 'onChangeCallback_' if it's set and 'newCount' is different from 'oldCount' */
+    void triggerOnChange(int oldCount, int newCount) const;
+
+    static bool inRange(uint64_t pid) { return pid <= kMaxPid; }
+
+    /*! Clears the slot for 'pid' if it holds 'expected'; releases 'expected' and decrements size when it does. */
+    TrieResult removeExpected(uint64_t pid, OSObject *expected);
+
+protected:
+
+    void free() override;
+
+public:
+
+    /*! Number of records stored in this table. */
+    uint getCount() const { return size_; }
+
+    /*!
+     * Installs a callback to be called whenever the size of this table changes.
+     *
+     * This method may only be called once, i.e., multiple callbacks are not supported.
+     *
+     * @result Indicates whether the callback was successfully installed.
+     */
+    bool onChange(void *callbackArgs, Trie::on_change_fn callback);
+
+    /*!
+     * Returns the record associated with 'pid' or NULL if there is no such record.  The returned object is not retained.
+     *
+     * This is a single load, making it suitable for the hot path of every kauth and MAC callback.
+     */
+    OSObject* get(uint64_t pid) const
+    {
+        return inRange(pid) ? slots_[pid] : nullptr;
+    }
+
+    template<typename T>
+    T* getAs(uint64_t pid) const
+    {
+        return OSDynamicCast(T, get(pid));
+    }
+
+    /*!
+     * Same semantics as Trie::getOrAdd: returns the record already associated with 'pid' or, if there is none,
+     * creates a new one by invoking 'factory', associates it with 'pid', and returns it.
+     */
+    OSObject* getOrAdd(uint64_t pid, void *factoryArgs, Trie::factory_fn factory, TrieResult *result = nullptr);
+
+    /*!
+     * Associates 'value' with 'pid' only if no value is currently associated with it.
+     *
+     * @result 'kTrieResultInserted' if 'value' was added, 'kTrieResultAlreadyExists' if 'pid' already had
+     *         a record, and 'kTrieResultFailure' if 'value' is NULL or 'pid' is out of range.
+     */
+    TrieResult insert(uint64_t pid, const OSObject *value);
+
+    /*!
+     * Removes the record associated with 'pid', but only if it is 'value'.
+     *
+     * A pid can be reused as soon as its process exits, so removing by pid alone could drop the record of a
+     * newer process that got the same pid; comparing against the record the caller looked up guards against that.
+     *
+     * @result 'kTrieResultRemoved' if 'value' was removed, 'kTrieResultAlreadyEmpty' if there is no record
+     *         for 'pid', and 'kTrieResultRace' if a different record is associated with 'pid'.
+     */
+    TrieResult remove(uint64_t pid, const OSObject *value);
+
+    /*! Same semantics as Trie::forEach; the keys passed to 'callback' are pids. */
+    void forEach(void *callbackArgs, Trie::for_each_fn callback);
+
+    /*! Same semantics as Trie::removeMatching. */
+    void removeMatching(void *filterArgs, Trie::filter_fn filter);
+
+    static PidTable* create();
+};
+
+#endif /* PidTable_hpp */
@@ -0,0 +1,156 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "Alloc.hpp"
+#include "CacheRecord.hpp"
+#include "ConcurrentSharedDataQueue.hpp"
+#include "SlabCache.hpp"
+#include "TrieNode.hpp"
+
+typedef struct lfds711_freelist_element SlabFreeListElem;
+
+bool SlabCache::init(size_t objectSize)
+{
+    size_t slotSize = objectSize > sizeof(SlabFreeListElem) ? objectSize : sizeof(SlabFreeListElem);
+    slotSize_     = (slotSize + kAlignment - 1) & ~(kAlignment - 1);
+    slotsPerSlab_ = slotSize_ + headerSize() < kSlabSize ? (uint)((kSlabSize - headerSize()) / slotSize_) : 1;
+    slabs_        = nullptr;
+    numSlabs_     = 0;
+    numInUse_     = 0;
+
+    freeList_ = Alloc::New<struct lfds711_freelist_state>(1);
+    if (freeList_ == nullptr)
+    {
+        return false;
+    }
+
+    lfds711_freelist_init_valid_on_current_logical_core(freeList_, nullptr, 0, nullptr);
+    return true;
+}
+
+void SlabCache::cleanup()
+{
+    if (freeList_ == nullptr)
+    {
+        return;
+    }
+
+    if (numInUse_ != 0)
+    {
+        log_error("Slab cache of %lu-byte objects still has %d objects in use; leaking its %d slabs", slotSize_, numInUse_, numSlabs_);
+        return;
+    }
+
+    // The objects in the free list all live in the slabs, which are freed below
+    lfds711_freelist_cleanup(freeList_, nullptr);
+    Alloc::Delete<struct lfds711_freelist_state>(freeList_, 1);
+    freeList_ = nullptr;
+
+    while (slabs_ != nullptr)
+    {
+        Slab *slab = slabs_;
+        slabs_ = slab->next;
+        Alloc::Delete<char>((char*)slab, slabBytes());
+    }
+
+    numSlabs_ = 0;
+}
+
+bool SlabCache::grow()
+{
+    char *memory = Alloc::New<char>(slabBytes());
+    if (memory == nullptr)
+    {
+        return false;
+    }
+
+    // slabs are only ever prepended (and only freed by 'cleanup'), so a CAS on the head is enough
+    Slab *slab = (Slab*)memory;
+    do
+    {
+        slab->next = slabs_;
+    } while (!OSCompareAndSwapPtr(slab->next, slab, &slabs_));
+
+    OSIncrementAtomic(&numSlabs_);
+
+    for (uint i = 0; i < slotsPerSlab_; i++)
+    {
+        lfds711_freelist_push(freeList_, (SlabFreeListElem*)(memory + headerSize() + i * slotSize_), nullptr);
+    }
+
+    return true;
+}
+
+void* SlabCache::allocate()
+{
+    SlabFreeListElem *elem = nullptr;
+    while (!lfds711_freelist_pop(freeList_, &elem, nullptr))
+    {
+        // other threads may take the objects of the new slab before we get to pop one, hence the loop
+        if (!grow())
+        {
+            return nullptr;
+        }
+    }
+
+    OSIncrementAtomic(&numInUse_);
+    return elem;
+}
+
+void SlabCache::deallocate(void *object)
+{
+    if (object == nullptr)
+    {
+        return;
+    }
+
+    lfds711_freelist_push(freeList_, (SlabFreeListElem*)object, nullptr);
+    OSDecrementAtomic(&numInUse_);
+}
+
+void SlabCache::addCounts(SlabCounts *counts) const
+{
+    uint numSlots = numSlabs_ * slotsPerSlab_;
+    uint numInUse = numInUse_;
+
+    counts->numInUse  += numInUse;
+    counts->numFree   += numSlots > numInUse ? numSlots - numInUse : 0;
+    counts->slabBytes += (uint64_t)numSlabs_ * slabBytes();
+}
+
+// ============================== class Slabs ==============================
+
+SlabCache Slabs::cacheRecords;
+SlabCache Slabs::lightNodes;
+SlabCache Slabs::fastNodes;
+SlabCache Slabs::uintNodeChildren;
+SlabCache Slabs::pathNodeChildren;
+SlabCache Slabs::reportPayloads;
+SlabCache Slabs::reportQueueElems;
+
+bool Slabs::Init()
+{
+    bool initialized =
+        cacheRecords.init(sizeof(CacheRecord)) &&
+        lightNodes.init(sizeof(NodeLight)) &&
+        fastNodes.init(sizeof(NodeFast)) &&
+        uintNodeChildren.init(sizeof(NodeFast*) * Node::s_uintNodeMaxKey) &&
+        pathNodeChildren.init(sizeof(NodeFast*) * Node::s_pathNodeMaxKey) &&
+        reportPayloads.init(sizeof(ConcurrentSharedDataQueue::ElemPayload)) &&
+        reportQueueElems.init(sizeof(QueueElem));
+
+    // the free lists are used from every core from now on
+    LFDS711_MISC_MAKE_VALID_ON_CURRENT_LOGICAL_CORE_INITS_COMPLETED_BEFORE_NOW_ON_ANY_OTHER_LOGICAL_CORE;
+    return initialized;
+}
+
+void Slabs::Cleanup()
+{
+    cacheRecords.cleanup();
+    lightNodes.cleanup();
+    fastNodes.cleanup();
+    uintNodeChildren.cleanup();
+    pathNodeChildren.cleanup();
+    reportPayloads.cleanup();
+    reportQueueElems.cleanup();
+}
@@ -0,0 +1,112 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef SlabCache_hpp
+#define SlabCache_hpp
+
+#include <IOKit/IOLib.h>
+#include "BuildXLSandboxShared.hpp"
+
+extern "C" {
+#include "liblfds711.h"
+}
+
+/*!
+ * A cache of fixed-size objects, carved out of large slabs instead of being allocated one by one.
+ *
+ * Freed objects go to a lock-free free list and are handed out again by 'allocate', so objects allocated on hot paths
+ * (cache records, trie nodes, report queue elements) don't go through the general kernel allocator, and don't fragment it,
+ * once the cache has warmed up.  A free object holds its free list element in its own memory.  Slabs are only given back
+ * by 'cleanup', so the memory of a free object stays mapped (the free list may read it after another thread popped it).
+ *
+ * Kexts have no access to kernel zones (zinit & co. are private), which is why this is done here.
+ *
+ * Thread-safe.  Non-blocking, except when a new slab has to be allocated.
+ */
+class SlabCache
+{
+private:
+
+    /*! Slabs allocated so far, linked through their first bytes */
+    typedef struct slab_ {
+        struct slab_ *next;
+    } Slab;
+
+    /*! Objects are aligned to this many bytes (lfds711 queue elements need a double-pointer alignment) */
+    static const size_t kAlignment = 16;
+
+    /*! Approximate size of a slab (at least one object fits in a slab, however large it is) */
+    static const size_t kSlabSize = 64 * 1024;
+
+    /*! Size of an object, rounded up so it can hold a free list element and keep the next object aligned */
+    size_t slotSize_;
+
+    /*! Number of objects in a slab */
+    uint slotsPerSlab_;
+
+    struct lfds711_freelist_state *freeList_;
+
+    Slab *volatile slabs_;
+
+    volatile SInt32 numSlabs_;
+    volatile SInt32 numInUse_;
+
+    static size_t headerSize() { return (sizeof(Slab) + kAlignment - 1) & ~(kAlignment - 1); }
+    size_t slabBytes() const   { return headerSize() + slotSize_ * slotsPerSlab_; }
+
+    /*! Allocates a new slab and adds all its objects to the free list.  Threads racing to grow may allocate one slab each. */
+    bool grow();
+
+public:
+
+    /*!
+     * Prepares the cache for objects of 'objectSize' bytes.  Must be called before any other method.
+     * SlabCache has no constructor so caches can be statically allocated without static initializers.
+     */
+    bool init(size_t objectSize);
+
+    /*!
+     * Gives all the slabs back.  If objects are still in use (which is a leak), the slabs are left allocated instead.
+     * Safe to call on a cache that was never initialized.
+     */
+    void cleanup();
+
+    /*! Returns an object-sized block of uninitialized memory, or NULL if a new slab was needed and could not be allocated */
+    void* allocate();
+
+    /*! Returns to the cache a block obtained from 'allocate' (NULL is ignored) */
+    void deallocate(void *object);
+
+    /*! Adds the counts of this cache to 'counts' */
+    void addCounts(SlabCounts *counts) const;
+};
+
+/*!
+ * The slab caches of the kext, one per type of fixed-size object it allocates on hot paths.
+ * Initialized by BuildXLSandbox before anything is allocated from them, and cleaned up once it is freed.
+ */
+class Slabs
+{
+private:
+
+    Slabs() {}
+
+public:
+
+    static SlabCache cacheRecords;
+    static SlabCache lightNodes;
+    static SlabCache fastNodes;
+
+    /*! The children arrays of the two kinds of NodeFast */
+    static SlabCache uintNodeChildren;
+    static SlabCache pathNodeChildren;
+
+    /*! ConcurrentSharedDataQueue elements: the payloads and the lfds711 queue elements they are enqueued with */
+    static SlabCache reportPayloads;
+    static SlabCache reportQueueElems;
+
+    static bool Init();
+    static void Cleanup();
+};
+
+#endif /* SlabCache_hpp */
@@ -35,12 +35,6 @@ bool Trie::init(TrieKind kind)
     onChangeData_ = nullptr;
     onChangeCallback_ = nullptr;
 
-    lock_ = BXLRecursiveLockAlloc();
-    if (!lock_)
-    {
-        return false;
-    }
-
     root_ = createNode(0);
     if (root_ == nullptr)
     {
@@ -57,8 +51,6 @@ void Trie::free()
                  OSSafeReleaseNULL(n);
              });
 
-    BXLRecursiveLockFree(lock_);
-    lock_ = nullptr;
     root_ = nullptr;
     size_ = 0;
     nodeCount_ = 0;
@@ -482,7 +474,7 @@ Node* Trie::findPathNode(const char *path, bool createIfMissing)
         {
             return nullptr;
         }
-        currNode = currNode->findChild(idx, createIfMissing, lock_, &outNewNodeCreated);
+        currNode = currNode->findChild(idx, createIfMissing, &outNewNodeCreated);
         if (currNode == nullptr)
         {
             return nullptr;
@@ -509,7 +501,7 @@ Node* Trie::findUintNode(uint64_t key, bool createIfMissing)
     while (true)
     {
         int lsd = key % 10;
-        currNode = currNode->findChild(lsd, createIfMissing, lock_, &outNewNodeCreated);
+        currNode = currNode->findChild(lsd, createIfMissing, &outNewNodeCreated);
         if (!currNode)
         {
             return nullptr;
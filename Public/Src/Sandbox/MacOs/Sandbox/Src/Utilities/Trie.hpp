@@ -15,8 +15,9 @@
  * Only 2 types of keys are allowed: (1) an unsigned integer, and (2) an ascii path.
  *
  * Additionally, two different implementations are provided: fast and light.  The former
- * is lock-free and fast but has a potentially huge memory footprint; the latter has a
- * much smaller memory footprint, is not lock-free, but still has good performance.
+ * is fast but has a potentially huge memory footprint; the latter has a much smaller
+ * memory footprint and still has good performance.  Both are lock-free: new nodes are
+ * installed with a compare-and-swap, and the loser of a race releases its node.
  *
  * Each node in a tree can be assigned a record which must be a pointer to an arbitrary OSObject.
  * Once an OSObject is added to a trie, it is automatically retained by the trie; once it is removed,
@@ -25,7 +26,7 @@
  * Paths are considered case-insensitive.  Attempting to add a path with a non-ascii
  * character will fail gracefully by returning 'kTrieResultFailure'.
  *
- * Thread-safe.
+ * Thread-safe.  Non-blocking.
  */
 class Trie : public OSObject
 {
@@ -81,9 +82,6 @@ private:
     /*! Payload for the 'onChangeCallback_' function */
     void *onChangeData_;
 
-    /*! Used only when modifying a node's list of children */
-    BXLRecursiveLock *lock_;
-
     /*! Initialized a new Trie.  The return value indicates the success of the operation. */
     bool init(TrieKind kind);
 
@@ -2,7 +2,6 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include "Alloc.hpp"
-#include "Monitor.hpp"
 #include "TrieNode.hpp"
 
 OSDefineMetaClassAndAbstractStructors(Node, OSObject)
@@ -117,55 +116,56 @@ void NodeLight::free()
     Node::free();
 }
 
-NodeLight* NodeLight::findChild(uint key,
-                                bool createIfMissing,
-                                BXLRecursiveLock *maybeNullLock,
-                                BXLRecursiveLock *nonNullLock,
-                                bool *outNewNodeCreated)
+NodeLight* NodeLight::findSibling(NodeLight *first, NodeLight *last, uint key)
 {
-    Monitor __monitor(maybeNullLock); // this will only acquire the lock if lock is not null
+    for (NodeLight *curr = first; curr != last; curr = curr->next_)
+    {
+        if (curr->key_ == key)
+        {
+            return curr;
+        }
+    }
+
+    return nullptr;
+}
 
+Node* NodeLight::findChild(uint key, bool createIfMissing, bool *outNewNodeCreated)
+{
     *outNewNodeCreated = false;
 
-    NodeLight *prev = nullptr;
-    NodeLight *curr = children_;
-    while (curr != nullptr && curr->key_ != key)
+    NodeLight *head = children_;
+    NodeLight *found = findSibling(head, nullptr, key);
+    if (found != nullptr || !createIfMissing)
     {
-        prev = curr;
-        curr = curr->next_;
+        return found;
     }
 
-    if (curr != nullptr)
-    {
-        // found it
-        assert(curr->key_ == key);
-        return curr;
-    }
-    else if (!createIfMissing)
+    NodeLight *newNode = NodeLight::create(key);
+    if (newNode == nullptr)
     {
-        // didn't find it and shouldn't create it
         return nullptr;
     }
-    else if (maybeNullLock == nullptr)
-    {
-        // didn't find it and didn't acquire lock --> must do it all over again with a lock
-        return findChild(key, createIfMissing, nonNullLock, nonNullLock, outNewNodeCreated);
-    }
-    else
+
+    while (true)
     {
-        // didn't find it and we are holding the lock -> create a new node and link it
-        NodeLight *newNode = NodeLight::create(key);
-        *outNewNodeCreated = newNode != nullptr;
-        if (prev != nullptr)
+        newNode->next_ = head;
+        if (OSCompareAndSwapPtr(head, newNode, &children_))
         {
-            prev->next_ = newNode;
+            *outNewNodeCreated = true;
+            return newNode;
         }
-        else
+
+        // someone else prepended children before us --> only those need to be checked for our key
+        NodeLight *newHead = children_;
+        found = findSibling(newHead, head, key);
+        if (found != nullptr)
         {
-            assert(children_ == nullptr);
-            children_ = newNode;
+            // someone else created this child node before us --> release 'newNode' that we created for nothing
+            OSSafeReleaseNULL(newNode);
+            return found;
         }
-        return newNode;
+
+        head = newHead;
     }
 }
 
@@ -215,6 +215,13 @@ error:
     return nullptr;
 }
 
+SlabCache* NodeFast::childrenSlabs(uint numChildren)
+{
+    if (numChildren == s_uintNodeMaxKey) return &Slabs::uintNodeChildren;
+    if (numChildren == s_pathNodeMaxKey) return &Slabs::pathNodeChildren;
+    return nullptr;
+}
+
 bool NodeFast::init(uint numChildren)
 {
     if (!Node::init())
@@ -222,8 +229,16 @@ bool NodeFast::init(uint numChildren)
         return false;
     }
 
+    SlabCache *slabs = childrenSlabs(numChildren);
     childrenLength_ = numChildren;
-    children_ = Alloc::New<NodeFast*>(numChildren);
+    children_ = slabs != nullptr
+        ? (NodeFast**)slabs->allocate()
+        : Alloc::New<NodeFast*>(numChildren);
+
+    if (children_ == nullptr)
+    {
+        return false;
+    }
 
     for (int i = 0; i < childrenLength_; i++)
     {
@@ -235,13 +250,26 @@ bool NodeFast::init(uint numChildren)
 
 void NodeFast::free()
 {
-    for (int i = 0; i < childrenLength_; i++)
+    // 'children_' is NULL if 'init' could not allocate it
+    if (children_ != nullptr)
     {
-        children_[i] = nullptr;
-    }
+        for (int i = 0; i < childrenLength_; i++)
+        {
+            children_[i] = nullptr;
+        }
 
-    Alloc::Delete<NodeFast*>(children_, childrenLength_);
-    children_ = nullptr;
+        SlabCache *slabs = childrenSlabs(childrenLength_);
+        if (slabs != nullptr)
+        {
+            slabs->deallocate(children_);
+        }
+        else
+        {
+            Alloc::Delete<NodeFast*>(children_, childrenLength_);
+        }
+
+        children_ = nullptr;
+    }
 
     if (length() == s_uintNodeMaxKey)      OSDecrementAtomic(&s_numUintNodes);
     else if (length() == s_pathNodeMaxKey) OSDecrementAtomic(&s_numPathNodes);
@@ -249,7 +277,7 @@ void NodeFast::free()
     Node::free();
 }
 
-Node* NodeFast::findChild(uint key, bool createIfMissing, BXLRecursiveLock *lock, bool *outNewNodeCreated)
+Node* NodeFast::findChild(uint key, bool createIfMissing, bool *outNewNodeCreated)
 {
     *outNewNodeCreated = false;
 
@@ -8,6 +8,7 @@
 #include <IOKit/IOService.h>
 #include "BuildXLSandboxShared.hpp"
 #include "BXLLocks.hpp"
+#include "SlabCache.hpp"
 
 #define Node BXL_CLASS(Node)
 #define NodeLight BXL_CLASS(NodeLight)
@@ -27,6 +28,9 @@ class Node : public OSObject
 
     friend class Trie;
 
+    /*! For the sizes of the slab caches of children arrays */
+    friend class Slabs;
+
 protected:
 
     static uint s_numUintNodes;
@@ -54,10 +58,9 @@ protected:
      *
      * @param key Must be between 0 (inclusive) and 'node.maxKey_' (exclusive); otherwise this method returns NULL
      * @param createIfMissing When true, this method creates a new child node at position 'idx' if one doesn't already exist.
-     * @param lock A lock unique to the parent tree to use when needed.
      * @result True IFF this node contains a child node with key 'key' after this method returns.
      */
-    virtual Node* findChild(uint key, bool createIfMissing, BXLRecursiveLock *lock, bool *outNewNodeCreated) = 0;
+    virtual Node* findChild(uint key, bool createIfMissing, bool *outNewNodeCreated) = 0;
 
     /*! Calls 'callback' for every node in the tree rooted in this node (the traversal is pre-order) */
     virtual void traverse(bool computeKey, void *callbackArgs, traverse_fn callback) = 0;
@@ -68,6 +71,18 @@ protected:
         return OSObject::init();
     }
 
+    /*! Allocates the memory of a node from 'slabs', zeroed like OSObject's 'new' does */
+    static void* allocateNode(SlabCache *slabs, size_t size)
+    {
+        void *mem = slabs->allocate();
+        if (mem != nullptr)
+        {
+            bzero(mem, size);
+        }
+
+        return mem;
+    }
+
     void free() override
     {
         OSSafeReleaseNULL(record_);
@@ -88,14 +103,14 @@ private:
     /*! Pointer to the next sibling. */
     NodeLight *next_;
 
-    /*! Pointer to the first child node */
+    /*!
+     * Pointer to the first child node.  Children are only ever prepended, with a CAS on this pointer,
+     * and never unlinked, so the list can be walked without any locking.
+     */
     NodeLight *children_;
 
-    NodeLight* findChild(uint key,
-                         bool createIfMissing,
-                         BXLRecursiveLock *maybeNulllock,
-                         BXLRecursiveLock *nonNullLock,
-                         bool *outNewNodeCreated);
+    /*! Returns the node with key 'key' among 'first' and its next siblings up to (excluding) 'last', or NULL */
+    static NodeLight* findSibling(NodeLight *first, NodeLight *last, uint key);
 
     bool init(uint key);
 
@@ -103,12 +118,13 @@ public:
 
     static NodeLight* create(uint key);
 
+    /*! Nodes are allocated from their own slab cache (see 'Slabs') */
+    static void* operator new(size_t size)              { return allocateNode(&Slabs::lightNodes, size); }
+    static void operator delete(void *mem, size_t size) { Slabs::lightNodes.deallocate(mem); }
+
 protected:
 
-    Node* findChild(uint key, bool createIfMissing, BXLRecursiveLock *lock, bool *outNewNodeCreated) override
-    {
-        return findChild(key, createIfMissing, nullptr, lock, outNewNodeCreated);
-    }
+    Node* findChild(uint key, bool createIfMissing, bool *outNewNodeCreated) override;
 
     void traverse(bool computeKey, void *callbackArgs, traverse_fn callback) override;
 
@@ -135,14 +151,21 @@ private:
 
     static NodeFast* create(uint numChildren);
 
+    /*! The slab cache children arrays of 'numChildren' pointers come from, or NULL if there is none for that size */
+    static SlabCache* childrenSlabs(uint numChildren);
+
 public:
 
     static NodeFast* createUintNode() { return create(s_uintNodeMaxKey); }
     static NodeFast* createPathNode() { return create(s_pathNodeMaxKey); }
 
+    /*! Nodes are allocated from their own slab cache (see 'Slabs') */
+    static void* operator new(size_t size)              { return allocateNode(&Slabs::fastNodes, size); }
+    static void operator delete(void *mem, size_t size) { Slabs::fastNodes.deallocate(mem); }
+
 protected:
 
-    Node* findChild(uint key, bool createIfMissing, BXLRecursiveLock *lock, bool *outNewNodeCreated) override;
+    Node* findChild(uint key, bool createIfMissing, bool *outNewNodeCreated) override;
     void traverse(bool computeKey, void *callbackArgs, traverse_fn callback) override;
     void free() override;
 };
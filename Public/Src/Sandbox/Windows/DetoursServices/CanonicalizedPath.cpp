@@ -3,59 +3,82 @@
 
 #include "CanonicalizedPath.h"
 
-// Applies GetFullPathnameW to 'path'. This function should not be used on \\?\ or \??\ style paths.
-static DWORD GetFullPath(__in PCWSTR path, std::wstring& fullPath)
+// Canonicalizes 'noncanonicalPath' without calling into the OS (see GetFullPathLexically), the current directory aside for relative paths.
+// Returns false for the paths that need GetFullPathNameW. This function should not be used on \\?\ or \??\ style paths.
+bool CanonicalizedPath::TryCanonicalizeLexically(wchar_t const* noncanonicalPath, CanonicalizedPath& canonicalizedPath)
 {
-    // First, we try with a fixed-sized buffer, which should be good enough for all practical cases
+    wchar_t currentDirectory[MAX_PATH];
+    wchar_t const* currentDirectoryOrNull = nullptr;
+    size_t currentDirectoryLength = 0;
+    bool isAbsolute = IsDriveBasedAbsolutePath(noncanonicalPath) || (IsDirectorySeparator(noncanonicalPath[0]) && IsDirectorySeparator(noncanonicalPath[1]));
+    if (!isAbsolute) {
+        DWORD length = GetCurrentDirectoryW(MAX_PATH, currentDirectory);
+        if (length == 0 || length >= MAX_PATH) {
+            return false;
+        }
+
+        currentDirectoryOrNull = currentDirectory;
+        currentDirectoryLength = length;
+    }
 
-    WCHAR wszBuffer[MAX_PATH];
-    DWORD nBufferLength = sizeof(wszBuffer) / sizeof(WCHAR);
+    // First, try with the inline storage, which is good enough for all practical cases
+    size_t length;
+    LexicalFullPathResult result = GetFullPathLexically(
+        noncanonicalPath,
+        currentDirectoryOrNull,
+        canonicalizedPath.Allocate(InlineCapacity - 1),
+        InlineCapacity,
+        &length);
+
+    if (result == LexicalFullPathResult::BufferTooSmall) {
+        size_t maxLength = wcslen(noncanonicalPath) + currentDirectoryLength + 2;
+        result = GetFullPathLexically(noncanonicalPath, currentDirectoryOrNull, canonicalizedPath.Allocate(maxLength), maxLength + 1, &length);
+    }
 
-    DWORD result = GetFullPathNameW(path, nBufferLength, wszBuffer, NULL);
+    if (result != LexicalFullPathResult::Success) {
+        return false;
+    }
+
+    canonicalizedPath.SetLength(length);
+    return true;
+}
+
+// Applies GetFullPathNameW to 'noncanonicalPath'. This function should not be used on \\?\ or \??\ style paths.
+bool CanonicalizedPath::TryCanonicalizeWithGetFullPathName(wchar_t const* noncanonicalPath, CanonicalizedPath& canonicalizedPath)
+{
+    // First, we try with the inline storage, which should be good enough for all practical cases
+    DWORD nBufferLength = static_cast<DWORD>(InlineCapacity);
+    DWORD result = GetFullPathNameW(noncanonicalPath, nBufferLength, canonicalizedPath.Allocate(InlineCapacity - 1), NULL);
 
     if (result == 0)
     {
-        return GetLastError();
+        return false;
     }
 
     if (result < nBufferLength)
     {
         // The buffer was big enough. The return value indicates the length of the full path, NOT INCLUDING the terminating null character.
         // http://msdn.microsoft.com/en-us/library/windows/desktop/aa364963(v=vs.85).aspx
-        fullPath = std::wstring(wszBuffer, static_cast<size_t>(result));
+        canonicalizedPath.SetLength(result);
+        return true;
     }
-    else
-    {
-        // Second, if that buffer wasn't big enough, we try again with a dynamically allocated buffer with sufficient size
-
-        // Note that in this case, the return value indicates the required buffer length, INCLUDING the terminating null character.
-        // http://msdn.microsoft.com/en-us/library/windows/desktop/aa364963(v=vs.85).aspx
-        unique_ptr<wchar_t[]> buffer(new wchar_t[result]);
-        assert(buffer.get());
 
-        DWORD result2 = GetFullPathNameW(path, result, buffer.get(), NULL);
+    // Second, if that buffer wasn't big enough, we try again with a heap allocated buffer with sufficient size
 
-        if (result2 == 0)
-        {
-            return GetLastError();
-        }
+    // Note that in this case, the return value indicates the required buffer length, INCLUDING the terminating null character.
+    // http://msdn.microsoft.com/en-us/library/windows/desktop/aa364963(v=vs.85).aspx
+    DWORD result2 = GetFullPathNameW(noncanonicalPath, result, canonicalizedPath.Allocate(result - 1), NULL);
 
-        if (result2 < result)
-        {
-            fullPath = std::wstring(buffer.get(), result2);
-        }
-        else
-        {
-            return ERROR_NOT_ENOUGH_MEMORY;
-        }
+    if (result2 == 0 || result2 >= result)
+    {
+        return false;
     }
 
-    return ERROR_SUCCESS;
+    canonicalizedPath.SetLength(result2);
+    return true;
 }
 
 CanonicalizedPath CanonicalizedPath::Canonicalize(wchar_t const* noncanonicalPath) {
-    PathType pathType;
-    std::wstring fullPath;
     if (IsWin32NtPathName(noncanonicalPath)) {
         // Caller is using escape syntax to avoid Win32 interpretation of path.
         // That's actually really good for us.  The text after the prefix is
@@ -63,51 +86,59 @@ CanonicalizedPath CanonicalizedPath::Canonicalize(wchar_t const* noncanonicalPat
         // the kernel's effective algorithm for translating to an NT path is something like 
         //    IsWin32NtPathName(path) ? path : GetFullPathName(path),
         // and in fact GetFullPathName(path) and path aren't always equivalent if IsWin32NtPathName(path).
-        pathType = PathType::Win32Nt;
-        fullPath = std::wstring(noncanonicalPath);
+        return CanonicalizedPath(PathType::Win32Nt, noncanonicalPath, wcslen(noncanonicalPath));
+    }
+
+    // The path is not a Win32-NT pathname so it is subject to GetFullPathName canonicalization by the kernel.
+    // So, C:\foo\..\bar becomes C:\bar. But also \\.\C:\foo\..\bar becomes \\.\C:\bar ; note that the local device (\\.\)
+    // prefix is preserved. That's fine for reporting (we keep it as m_canonicalizedPath), but for computing special cases
+    // and traversing the manifest tree, we should further canonicalize to the plain C:\bar (C: is in the tree, \\.\ isn't understood). 
+    // Note that even non-drive-letter devices like \\.\nul, \\.\Harddisk0Partition1, etc. can safely become nul and Harddisk0Partition1 respectively; 
+    // imagine the manifest tree root as implicitly \??\ (the session's DosDevices namespace).
+    // Most paths canonicalize lexically, exactly as GetFullPathName would; it is only called for the ones that don't.
+    CanonicalizedPath canonicalizedPath;
+    if (!TryCanonicalizeLexically(noncanonicalPath, canonicalizedPath)
+        && !TryCanonicalizeWithGetFullPathName(noncanonicalPath, canonicalizedPath)) {
+        return CanonicalizedPath();
     }
-    else {
-        // The path is not a Win32-NT pathname so it is subject to GetFullPathName canonicalization by the kernel.
-        // So, C:\foo\..\bar becomes C:\bar. But also \\.\C:\foo\..\bar becomes \\.\C:\bar ; note that the local device (\\.\)
-        // prefix is preserved. That's fine for reporting (we keep it as m_canonicalizedPath), but for computing special cases
-        // and traversing the manifest tree, we should further canonicalize to the plain C:\bar (C: is in the tree, \\.\ isn't understood). 
-        // Note that even non-drive-letter devices like \\.\nul, \\.\Harddisk0Partition1, etc. can safely become nul and Harddisk0Partition1 respectively; 
-        // imagine the manifest tree root as implicitly \??\ (the session's DosDevices namespace).
-
-        DWORD error = GetFullPath(noncanonicalPath, fullPath);
-        if (error != ERROR_SUCCESS) {
-            return CanonicalizedPath();
-        }
 
-        // Note that GetFullPath("nul") == "\\.\nul" (similar for other classic devices), so we check for the local device type after that step.
-        pathType = IsLocalDevicePathName(fullPath.c_str()) ? PathType::LocalDevice : PathType::Win32;
+    // Note that GetFullPathName("nul") == "\\.\nul" (similar for other classic devices), so we check for the local device type after that step.
+    canonicalizedPath.Type = PathType::Win32;
+    if (IsLocalDevicePathName(canonicalizedPath.GetPathString())) {
+        canonicalizedPath.Type = PathType::LocalDevice;
     }
 
-    return CanonicalizedPath(pathType, std::move(fullPath));
+    return canonicalizedPath;
 }
 
 CanonicalizedPath CanonicalizedPath::Extend(wchar_t const* additionalComponents, size_t* extensionStartIndex) const {
     assert(additionalComponents);
-    assert(!IsNull() && m_value);
+    assert(!IsNull());
     while (IsDirectorySeparator(additionalComponents[0])) {
         additionalComponents++;
     }
 
-    std::wstring extended{};
-    extended.reserve(wcslen(additionalComponents) + Length() + 1);
-    extended.append(*m_value);
+    size_t additionalLength = wcslen(additionalComponents);
+    bool needsSeparator = m_length > 0 && !IsDirectorySeparator(GetPathString()[m_length - 1]);
+    size_t extendedLength = m_length + (needsSeparator ? 1 : 0) + additionalLength;
 
-    if (!extended.empty() && !IsDirectorySeparator(extended.back())) {
-        extended.push_back(NT_DIRECTORY_SEPARATOR);
+    CanonicalizedPath extended;
+    extended.Type = Type;
+    wchar_t* buffer = extended.Allocate(extendedLength);
+    wmemcpy(buffer, GetPathString(), m_length);
+    if (needsSeparator) {
+        buffer[m_length] = NT_DIRECTORY_SEPARATOR;
     }
 
+    size_t extensionStart = extendedLength - additionalLength;
+    wmemcpy(buffer + extensionStart, additionalComponents, additionalLength);
+    extended.SetLength(extendedLength);
+
     if (extensionStartIndex != nullptr) {
-        *extensionStartIndex = extended.size();
+        *extensionStartIndex = extensionStart;
     }
 
-    extended.append(additionalComponents);
-
-    return CanonicalizedPath(Type, std::move(extended));
+    return extended;
 }
 
 wchar_t const* CanonicalizedPath::GetLastComponent() const {
@@ -128,10 +159,10 @@ wchar_t const* CanonicalizedPath::GetLastComponent() const {
 }
 
 CanonicalizedPath CanonicalizedPath::RemoveLastComponent() const {
-    assert(!IsNull() && m_value);
+    assert(!IsNull());
 
     // If the last path separator is at zero-based index N, we want the preceding N characters.
     // If there are no path separators (or a path separator at index 0), we want a zero length string.
-    size_t lastSeparatorIndex = FindFinalPathSeparator(m_value->c_str());
-    return CanonicalizedPath(Type, m_value->substr(0, lastSeparatorIndex));
+    size_t lastSeparatorIndex = FindFinalPathSeparator(GetPathString());
+    return CanonicalizedPath(Type, GetPathString(), lastSeparatorIndex);
 }
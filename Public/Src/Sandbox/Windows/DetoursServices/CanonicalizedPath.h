@@ -7,24 +7,47 @@
 
 // Immutable, typed, and canonical path string. The represented path is absolute, free of .. and . traversals, redundant path separators, etc.
 // A canonicalized path is independent of the current directory (which is mutable and process global).
-// Since the path is immutable, the underlying storage for the path string is shared among instances under copy construction and assignment.
+// Paths shorter than InlineCapacity characters are stored inline, so canonicalizing, extending or copying them doesn't allocate.
+// Longer paths are stored on the heap; since the path is immutable, that storage is shared among instances under copy construction and assignment.
 struct CanonicalizedPath {
     CanonicalizedPath()
-        : Type(PathType::Null), m_value(nullptr)
-    { }
+        : Type(PathType::Null), m_length(0), m_heapValue(nullptr)
+    {
+        m_inlineValue[0] = L'\0';
+    }
 
     CanonicalizedPath(PathType type, wchar_t const* value, size_t valuePrefixLength)
-        : Type(type), m_value(std::make_shared<std::wstring>(value, valuePrefixLength))
-    { }
+        : Type(type), m_length(0), m_heapValue(nullptr)
+    {
+        wchar_t* buffer = Allocate(valuePrefixLength);
+        wmemcpy(buffer, value, valuePrefixLength);
+        SetLength(valuePrefixLength);
+    }
 
     CanonicalizedPath(CanonicalizedPath&& other)
-        : Type(other.Type), m_value(std::move(other.m_value))
+        : Type(other.Type), m_length(other.m_length), m_heapValue(std::move(other.m_heapValue))
     {
+        CopyInlineValue(other);
         other.Type = PathType::Null;
+        other.m_length = 0;
     }
 
-    CanonicalizedPath(const CanonicalizedPath& other) = default;
-    CanonicalizedPath& operator=(const CanonicalizedPath&) = default;
+    CanonicalizedPath(const CanonicalizedPath& other)
+        : Type(other.Type), m_length(other.m_length), m_heapValue(other.m_heapValue)
+    {
+        CopyInlineValue(other);
+    }
+
+    CanonicalizedPath& operator=(const CanonicalizedPath& other) {
+        if (this != &other) {
+            Type = other.Type;
+            m_length = other.m_length;
+            m_heapValue = other.m_heapValue;
+            CopyInlineValue(other);
+        }
+
+        return *this;
+    }
 
     CanonicalizedPath Extend(wchar_t const* additionalComponents, size_t* extensionStartIndex = nullptr) const;
     CanonicalizedPath RemoveLastComponent() const;
@@ -32,11 +55,15 @@ struct CanonicalizedPath {
     bool IsNull() const { return Type == PathType::Null; }
 
     size_t Length() const {
-        return m_value ? m_value->length() : 0;
+        return m_length;
     }
 
     wchar_t const* GetPathString() const {
-        return m_value ? m_value->c_str() : nullptr;
+        if (IsNull()) {
+            return nullptr;
+        }
+
+        return m_heapValue ? m_heapValue->c_str() : m_inlineValue;
     }
 
     // Returns the path string with the type prefix (\\?\, \??\, or \\.\) omitted if present.
@@ -63,12 +90,42 @@ struct CanonicalizedPath {
 
     PathType Type;
 
+    // Number of characters, including the null terminator, of the inline storage.
+    static constexpr size_t InlineCapacity = MAX_PATH;
+
 private:
-    // Private constructor for Canonicalize, which creates a wstring for m_value.
-    // This constructor allocates a new shared_ptr managed string but moves the contents rather than copying them.
-    CanonicalizedPath(PathType type, std::wstring&& value)
-        : Type(type), m_value(std::make_shared<std::wstring>(std::move(value)))
-    { }
+    // Returns storage for a path of up to 'maxLength' characters (plus the null terminator), which must be followed by SetLength once the path is written.
+    wchar_t* Allocate(size_t maxLength) {
+        if (maxLength < InlineCapacity) {
+            m_heapValue.reset();
+            return m_inlineValue;
+        }
+
+        m_heapValue = std::make_shared<std::wstring>(maxLength, L'\0');
+        return &(*m_heapValue)[0];
+    }
+
+    void SetLength(size_t length) {
+        m_length = length;
+        if (m_heapValue) {
+            m_heapValue->resize(length);
+        }
+        else {
+            m_inlineValue[length] = L'\0';
+        }
+    }
+
+    // Completes a copy or a move, once m_length and m_heapValue are set: inline paths have to be copied
+    void CopyInlineValue(const CanonicalizedPath& other) {
+        if (!m_heapValue) {
+            wmemcpy(m_inlineValue, other.m_inlineValue, other.m_length + 1);
+        }
+    }
+
+    static bool TryCanonicalizeLexically(wchar_t const* noncanonicalPath, CanonicalizedPath& canonicalizedPath);
+    static bool TryCanonicalizeWithGetFullPathName(wchar_t const* noncanonicalPath, CanonicalizedPath& canonicalizedPath);
 
-    std::shared_ptr<std::wstring> m_value;
+    size_t m_length;
+    std::shared_ptr<std::wstring> m_heapValue;
+    wchar_t m_inlineValue[InlineCapacity];
 };
@@ -109,6 +109,28 @@ inline bool CheckReportAnyAccess(FileAccessManifestFlag flags, bool accessDenied
     m(AlwaysRemoteInjectDetoursFrom32BitProcess,        0x10) \
     m(UnconditionallyEnableLinuxPTraceSandbox,          0x20) \
     m(IgnoreDeviceIoControlGetReparsePoint,             0x40) \
+    m(EnableLinuxSandboxReportBatching,                 0x80) \
+    m(EnableLinuxSandboxBinaryReports,                 0x100) \
+    m(EnableLinuxSeccompNotifySandbox,                 0x200) \
+    m(EnableUtf8Reports,                               0x400) \
+    m(CacheProbesOfImmutableInputs,                    0x800) \
+    m(ShareManifestAcrossProcesses,                   0x1000) \
+    m(ProfileDetours,                                 0x2000) \
+    m(ShareReportCacheAcrossProcesses,                0x4000) \
+    m(CacheImagePathSearches,                         0x8000) \
+    m(CacheFinalPathsByFileId,                       0x10000) \
+    m(CacheSubstituteProcessExecutionPluginVerdicts, 0x20000) \
+    m(CoalesceReportMessageCount,                    0x40000) \
+    m(EnableLinuxSandboxTraceBuffer,                 0x80000) \
+    m(RecordLinuxSandboxAccessTrace,                0x100000) \
+    m(EnableLinuxFanotifySandbox,                   0x200000) \
+    m(CacheLinuxPTraceFdPaths,                      0x400000) \
+    m(FilterLinuxUntrackedScopes,                   0x800000) \
+    m(AggregateLinuxAccessReports,                 0x1000000) \
+    m(AdaptiveReportBatching,                      0x2000000) \
+    m(DetectLinuxProcessTreeCompletion,            0x4000000) \
+    m(BatchConcurrentReports,                      0x8000000) \
+    m(CacheLinuxSymlinkResolution,                0x10000000) \
 
 enum class FileAccessManifestExtraFlag {
     FOR_ALL_FAM_EXTRA_FLAGS(GEN_FAM_FLAG_ENUM_NAME_VALUE)
@@ -171,6 +193,10 @@ enum FileAccessPolicy
     // If set, full reparse point tracking should be done for this path/file
     FileAccessPolicy_EnableFullReparsePointParsing = 0x1000,
 
+    // If set, no path at or below this scope (including the path of the scope itself) is or goes through a reparse point / symlink,
+    // so any path here resolves to itself and reparse point resolution can be skipped for it.
+    FileAccessPolicy_NoReparsePointsInCone = 0x2000,
+
     // If set, then we will report all attempts to access files under this scope (whether existent or not).
     // BuildXL uses this information to discover dynamic dependencies, such as #include-ed files.
     FileAccessPolicy_ReportAccess = FileAccessPolicy_ReportAccessIfNonExistent | FileAccessPolicy_ReportAccessIfExistent,
@@ -211,7 +237,8 @@ enum class ReportType
     ReportType_ProcessData = 4,
     ReportType_ProcessDetouringStatus = 5,
     ReportType_AugmentedFileAccess = 6,
-    ReportType_Max = 7,
+    ReportType_DetourProfile = 7,
+    ReportType_Max = 8,
 };
 
 // Keep this in sync with the C# version declared in FileAccessManifest.cs
@@ -413,6 +440,26 @@ typedef struct ManifestChildProcessesToBreakAwayFromJob_t
 } ManifestChildProcessesToBreakAwayFromJob_t;
 typedef const ManifestChildProcessesToBreakAwayFromJob_t* PManifestChildProcessesToBreakAwayFromJob;
 
+// ==========================================================================
+// == ManifestKnownReparsePointTargets
+// ==========================================================================
+// Followed by Count entries, each one made of the path of a reparse point, its target (both as written by
+// FileAccessManifest.WriteChars) and its reparse tag (0 for a path known not to be a reparse point).
+typedef struct ManifestKnownReparsePointTargets_t
+{
+    GENERATE_TAG("ManifestKnownReparsePointTargets", 0xABCDEF06)
+
+    typedef uint32_t    CountType;
+    CountType           Count;
+
+    /// There are no variable-length members, so the length of this struct can be determined using sizeof.
+    size_t GetSize() const noexcept
+    {
+        return sizeof(ManifestKnownReparsePointTargets_t);
+    }
+} ManifestKnownReparsePointTargets_t;
+typedef const ManifestKnownReparsePointTargets_t* PManifestKnownReparsePointTargets;
+
 // ==========================================================================
 // == ManifestInternalDetoursErrorNotificationFileString
 // ==========================================================================
@@ -495,6 +542,33 @@ typedef struct ManifestPipId_t
 } ManifestPipId;
 typedef const ManifestPipId * PCManifestPipId;
 
+// ==========================================================================
+// == ManifestCacheBudgets
+// ==========================================================================
+// Memory, in KB, each per-process cache of the sandbox may use before it starts evicting entries. 0 means the default budget of the cache.
+// Long-lived processes (e.g. service pips) keep accessing new paths for hours, so without a budget these caches would grow for as long.
+typedef struct ManifestCacheBudgets_t
+{
+    GENERATE_TAG("ManifestCacheBudgets", 0xF1A6B10F)
+
+    typedef uint32_t    BudgetType;
+    // Cache of the accesses already reported (Linux, see AccessCache)
+    BudgetType          AccessCacheKb;
+    // Overflow of the paths already checked for write access (see FilesCheckedForAccess)
+    BudgetType          FilesCheckedForAccessKb;
+    // Cache of reparse point resolution (Windows, see ResolvedPathCache)
+    BudgetType          ResolvedPathCacheKb;
+
+    /// GetSize
+    ///
+    /// There are no variable-length members, so the length of this struct can be determined using sizeof.
+    size_t GetSize() const noexcept
+    {
+        return sizeof(ManifestCacheBudgets_t);
+    }
+} ManifestCacheBudgets;
+typedef const ManifestCacheBudgets * PCManifestCacheBudgets;
+
 // ==========================================================================
 // == ManifestReport
 // ==========================================================================
@@ -644,6 +718,9 @@ typedef struct ManifestRecord_t
     typedef uint32_t    PolicyType;
     typedef uint32_t    PathIdType;
     typedef uint32_t    ExpectedUsnPartType;
+    typedef uint32_t    LevelType;
+    typedef uint32_t    DisplacementCountType;
+    typedef uint32_t    DisplacementType;
     typedef uint32_t    BucketCountType;
     typedef uint32_t    ChildOffsetType;
     typedef PCPathChar  PartialPathType;
@@ -653,9 +730,22 @@ typedef struct ManifestRecord_t
     PolicyType          NodePolicy;
     PathIdType          PathId;
     ExpectedUsnPartType ExpectedUsnLo, ExpectedUsnHi; // we split this value up as we don't want to introduce 64-bit alignment here (USN is a 64-bit integer)
+    LevelType           FullReparsePointParsingAncestorLevel; // precomputed by FileAccessManifest.cs, see TryGetFullReparsePointParsingAncestorLevel
+    DisplacementCountType DisplacementCount; // nonzero if the children are laid out with a minimal perfect hash, see GetPerfectHashIndex
     BucketCountType     BucketCount;
-    ChildOffsetType     Buckets[ANYSIZE_ARRAY];
-    // PartialPathType PartialPath (after the end of the Buckets array)
+
+    // The offset of a child, and a copy of the child's hash: probing only touches the children whose hash matches,
+    // rather than every child on the way.
+    // CODESYNC: FileAccessManifest.cs (Node.WriteRecord)
+    typedef struct Bucket_t
+    {
+        ChildOffsetType Offset;
+        HashType        Hash;
+    } BucketType;
+
+    BucketType          Buckets[ANYSIZE_ARRAY];
+    // DisplacementType Displacements[DisplacementCount] (after the end of the Buckets array)
+    // PartialPathType PartialPath (after the end of the Displacements array)
 
 #pragma warning( push )
 // warning C26472: Don't use a static_cast for arithmetic conversions. Use brace initialization, gsl::narrow_cast or gsl::narrow (type.1).
@@ -677,13 +767,26 @@ typedef struct ManifestRecord_t
     inline FileAccessPolicy GetNodePolicy() const noexcept {
         return static_cast<FileAccessPolicy>(this->NodePolicy);
     }
+
+    static const LevelType NoLevel = 0xFFFFFFFF;
+
+    // Level (the root being level 0) of the shallowest strict ancestor of this node whose cone policy has FileAccessPolicy_EnableFullReparsePointParsing.
+    // Returns false if there is no such ancestor.
+    inline bool TryGetFullReparsePointParsingAncestorLevel(size_t& level) const noexcept {
+        if (this->FullReparsePointParsingAncestorLevel == NoLevel) {
+            return false;
+        }
+
+        level = static_cast<size_t>(this->FullReparsePointParsingAncestorLevel);
+        return true;
+    }
 #pragma warning( pop )
 
     PCManifestRecord GetChildRecord(BucketCountType index) const noexcept
     {
         assert(index < this->BucketCount);
 
-        const ChildOffsetType childOffset = this->Buckets[index];
+        const ChildOffsetType childOffset = this->Buckets[index].Offset;
         if (childOffset == 0)
         {
             return nullptr;
@@ -700,7 +803,7 @@ typedef struct ManifestRecord_t
     {
         assert(index < this->BucketCount);
 
-        const ChildOffsetType childOffset = this->Buckets[index];
+        const ChildOffsetType childOffset = this->Buckets[index].Offset;
         return (childOffset & FileAccessBucketOffsetFlag::ChainStart) != 0;
     }
 
@@ -708,14 +811,49 @@ typedef struct ManifestRecord_t
     {
         assert(index < this->BucketCount);
 
-        const ChildOffsetType childOffset = this->Buckets[index];
+        const ChildOffsetType childOffset = this->Buckets[index].Offset;
         return (childOffset & FileAccessBucketOffsetFlag::ChainContinuation) != 0;
     }
 
+    // Whether the given bucket holds a child with the given hash, which can be told without touching the child
+    bool IsChildHashAt(BucketCountType index, HashType hash) const noexcept
+    {
+        assert(index < this->BucketCount);
+
+        return this->Buckets[index].Offset != 0 && this->Buckets[index].Hash == hash;
+    }
+
+    // Index of the only bucket a child with the given hash can be in, when the children are laid out with a minimal perfect hash
+    // (hash and displace): the hash picks a displacement, and the bucket is the hash mixed with it. FileAccessManifest.cs picked
+    // the displacements so that every child lands in its own bucket.
+    // CODESYNC: FileAccessManifest.cs (Node.GetPerfectHashSlot)
+    BucketCountType GetPerfectHashIndex(uint32_t hash) const noexcept
+    {
+        assert(this->DisplacementCount != 0 && this->BucketCount != 0);
+
+        const DisplacementType displacement = GetDisplacements()[hash % this->DisplacementCount];
+        return GetPerfectHashSlot(hash, displacement, this->BucketCount);
+    }
+
+    static BucketCountType GetPerfectHashSlot(uint32_t hash, DisplacementType displacement, BucketCountType bucketCount) noexcept
+    {
+        uint32_t x = hash ^ (displacement * 0x9E3779B9u);
+        x ^= x >> 16;
+        x *= 0x85EBCA6Bu;
+        x ^= x >> 13;
+        x *= 0xC2B2AE35u;
+        x ^= x >> 16;
+        return x % bucketCount;
+    }
+
+    const DisplacementType *GetDisplacements() const noexcept
+    {
+        return reinterpret_cast<const DisplacementType *>(&(this->Buckets[this->BucketCount]));
+    }
+
     PartialPathType GetPartialPath() const noexcept
     {
-        const BucketCountType numBuckets = this->BucketCount;
-        const PartialPathType path = reinterpret_cast<PartialPathType>(&(this->Buckets[numBuckets]));
+        const PartialPathType path = reinterpret_cast<PartialPathType>(GetDisplacements() + this->DisplacementCount);
 
         return path;
     }
@@ -725,6 +863,14 @@ typedef struct ManifestRecord_t
         __in  PCPathChar target,
         __in  size_t targetLength,
         __out PCManifestRecord& child) const;
+
+    // Same as above, for a target whose HashPath is already known
+    __success(return)
+    bool FindChild(
+        __in  PCPathChar target,
+        __in  size_t targetLength,
+        __in  DWORD targetHash,
+        __out PCManifestRecord& child) const;
 } ManifestRecord;
 typedef const ManifestRecord * PCManifestRecord; // duplicated for use in scopes outside of the struct
 
@@ -8,6 +8,7 @@
 #include "FileAccessHelpers.h"
 #include "DetoursServices.h"
 #include "DetoursHelpers.h"
+#include "SendReport.h"
 #include "buildXL_mem.h"
 
 using std::unique_ptr;
@@ -150,18 +151,10 @@ void Dbg(PCWSTR format, ...)
     fputws(buffer, stderr);
 #endif
 
-    OVERLAPPED overlapped;
-    ZeroMemory(&overlapped, sizeof(OVERLAPPED));
-    // This offset specifies "append".
-    overlapped.Offset = 0xFFFFFFFF;
-    overlapped.OffsetHigh = 0xFFFFFFFF;
-
-    size_t bufferLength = sizeof(wchar_t) * report.length(); // The size should be in bytes.
-    DWORD bytesWritten;
     DWORD lastError = GetLastError();
-    if (!WriteFile(g_reportFileHandle, buffer, (DWORD)bufferLength, &bytesWritten, &overlapped))
+    DWORD error = WriteToReportPipe(buffer, report.length());
+    if (error != ERROR_SUCCESS)
     {
-        DWORD error = GetLastError();
         std::wstring errorMsg = DebugStringFormat(L"Dbg: Failed to write Dbg diagnostics message '[ %s ]' to report pipe (error code: 0x%08X)", resultArgs.c_str(), (int)error);
         HandleDetoursInjectionAndCommunicationErrors(DETOURS_PIPE_WRITE_ERROR_2, errorMsg.c_str(), DETOURS_WINDOWS_LOG_MESSAGE_2);
     }
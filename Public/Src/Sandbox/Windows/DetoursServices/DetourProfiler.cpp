@@ -0,0 +1,74 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "DetourProfiler.h"
+
+// ----------------------------------------------------------------------------
+// GLOBALS
+// ----------------------------------------------------------------------------
+
+static __declspec(thread) DetourProfileCounters* gt_detourProfileCounters = nullptr;
+
+// Counters of every thread that ever called a profiled detour. Entries are only pushed, and never freed: the counters
+// of a thread must outlive it so they can be reported when the process exits.
+static DetourProfileCounters* volatile g_detourProfileCounters = nullptr;
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+DetourProfileCounters* GetThreadDetourProfileCounters()
+{
+    DetourProfileCounters* counters = gt_detourProfileCounters;
+    if (counters != nullptr)
+    {
+        return counters;
+    }
+
+    counters = new (std::nothrow) DetourProfileCounters();
+    if (counters == nullptr)
+    {
+        return nullptr;
+    }
+
+    DetourProfileCounters* head;
+    do
+    {
+        head = g_detourProfileCounters;
+        counters->Next = head;
+    } while (InterlockedCompareExchangePointer((PVOID volatile*)&g_detourProfileCounters, counters, head) != head);
+
+    gt_detourProfileCounters = counters;
+    return counters;
+}
+
+bool CollectDetourProfile(DetourProfileCounters& totals)
+{
+    ZeroMemory(&totals, sizeof(totals));
+
+    DetourProfileCounters* head = (DetourProfileCounters*)InterlockedCompareExchangePointer((PVOID volatile*)&g_detourProfileCounters, nullptr, nullptr);
+    if (head == nullptr)
+    {
+        return false;
+    }
+
+    for (DetourProfileCounters* counters = head; counters != nullptr; counters = counters->Next)
+    {
+        for (size_t i = 0; i < PROFILED_DETOUR_COUNT; i++)
+        {
+            totals.Calls[i] += counters->Calls[i];
+            totals.Ticks[i] += counters->Ticks[i];
+        }
+    }
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    for (size_t i = 0; i < PROFILED_DETOUR_COUNT; i++)
+    {
+        totals.Ticks[i] = totals.Ticks[i] * 1000000 / frequency.QuadPart;
+    }
+
+    return true;
+}
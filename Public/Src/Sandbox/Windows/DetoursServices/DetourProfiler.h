@@ -0,0 +1,123 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "DetouredScope.h"
+#include "DetourTracing.h"
+#include "FileAccessHelpers.h"
+
+// Detoured functions whose calls are counted and timed when the ProfileDetours extra manifest flag is set.
+// Functions that forward to another detour (e.g. NtOpenFile to NtCreateFile) are accounted to the one they forward to.
+// The report carries the names, so entries can be added or removed without changing BuildXL.
+#define FOR_ALL_PROFILED_DETOURS(m) \
+    m(CreateProcessW) \
+    m(CreateFileW) \
+    m(CloseHandle) \
+    m(GetFileAttributesW) \
+    m(GetFileAttributesExW) \
+    m(CopyFileExW) \
+    m(MoveFileWithProgressW) \
+    m(DeleteFileW) \
+    m(CreateHardLinkW) \
+    m(CreateSymbolicLinkW) \
+    m(FindFirstFileExW) \
+    m(FindNextFileW) \
+    m(GetFileInformationByHandle) \
+    m(GetFileInformationByHandleEx) \
+    m(CreateDirectoryW) \
+    m(RemoveDirectoryW) \
+    m(GetFinalPathNameByHandleW) \
+    m(NtQueryDirectoryFile) \
+    m(ZwQueryDirectoryFile) \
+    m(NtCreateFile) \
+    m(ZwCreateFile) \
+    m(DeviceIoControl)
+
+#define GEN_PROFILED_DETOUR_ENUM(name) name,
+enum class ProfiledDetour
+{
+    FOR_ALL_PROFILED_DETOURS(GEN_PROFILED_DETOUR_ENUM)
+    Count
+};
+
+#define PROFILED_DETOUR_COUNT ((size_t)ProfiledDetour::Count)
+
+inline const wchar_t* ProfiledDetourName(size_t detour)
+{
+#define GEN_PROFILED_DETOUR_NAME(name) L#name,
+    static const wchar_t* const names[] = { FOR_ALL_PROFILED_DETOURS(GEN_PROFILED_DETOUR_NAME) };
+#undef GEN_PROFILED_DETOUR_NAME
+    return names[detour];
+}
+
+// Call counts and time spent in each profiled detour.
+// Each thread gets its own instance, which only that thread writes, so counting a call takes no interlocked operations.
+typedef struct DetourProfileCounters_t
+{
+    LONG64 Calls[PROFILED_DETOUR_COUNT];
+    LONG64 Ticks[PROFILED_DETOUR_COUNT]; // QueryPerformanceCounter ticks
+    struct DetourProfileCounters_t* Next;
+} DetourProfileCounters;
+
+// Counters of the calling thread, allocated the first time the thread calls a profiled detour. Returns nullptr if they couldn't be allocated.
+DetourProfileCounters* GetThreadDetourProfileCounters();
+
+// Sums the counters of every thread that called a profiled detour into 'totals', with Ticks converted to microseconds.
+// Returns false if no profiled detour was called.
+bool CollectDetourProfile(DetourProfileCounters& totals);
+
+// Counts a call to a detour and the time spent in it, including the call to the real function.
+// Only top-level detours are profiled: a detour called from within another one is accounted to the outer detour.
+// The call is also traced to ETW when the detours keyword of the provider is enabled (see DetourTracing.h).
+class DetourProfileScope
+{
+public:
+    DetourProfileScope(ProfiledDetour detour, DetouredScope& scope) noexcept
+        : m_counters(nullptr), m_detour((size_t)detour), m_traced(false)
+    {
+        if (scope.Detoured_IsDisabled())
+        {
+            return;
+        }
+
+        if (DetourTraceEnabled(DETOUR_TRACE_KEYWORD_DETOURS))
+        {
+            m_traced = true;
+            TraceDetourStart(m_detour);
+        }
+
+        if (!ProfileDetours())
+        {
+            return;
+        }
+
+        m_counters = GetThreadDetourProfileCounters();
+        QueryPerformanceCounter(&m_start);
+    }
+
+    ~DetourProfileScope()
+    {
+        if (m_traced)
+        {
+            TraceDetourStop(m_detour);
+        }
+
+        if (m_counters != nullptr)
+        {
+            LARGE_INTEGER end;
+            QueryPerformanceCounter(&end);
+            m_counters->Calls[m_detour]++;
+            m_counters->Ticks[m_detour] += end.QuadPart - m_start.QuadPart;
+        }
+    }
+
+private:
+    DetourProfileCounters* m_counters;
+    size_t m_detour;
+    bool m_traced;
+    LARGE_INTEGER m_start;
+
+    DetourProfileScope(const DetourProfileScope&) = delete;
+    DetourProfileScope& operator=(const DetourProfileScope&) = delete;
+};
@@ -0,0 +1,142 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "DetourTracing.h"
+#include "DetourProfiler.h"
+
+// ----------------------------------------------------------------------------
+// GLOBALS
+// ----------------------------------------------------------------------------
+
+// The GUID is the one EventSource derives from the provider name, so sessions can enable the provider by name.
+TRACELOGGING_DEFINE_PROVIDER(
+    g_detoursTraceProvider,
+    "BuildXL.DetoursServices",
+    (0x80652929, 0xe74a, 0x59f5, 0x8d, 0xd5, 0x58, 0x4b, 0x86, 0xad, 0x65, 0x2d));
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+void RegisterDetoursTraceProvider()
+{
+    // Failing to register only leaves the provider disabled
+    TraceLoggingRegister(g_detoursTraceProvider);
+}
+
+void UnregisterDetoursTraceProvider()
+{
+    TraceLoggingUnregister(g_detoursTraceProvider);
+}
+
+void TraceDetourStart(size_t detour)
+{
+    DWORD lastError = GetLastError();
+    TraceLoggingWrite(
+        g_detoursTraceProvider,
+        "Detour",
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+        TraceLoggingKeyword(DETOUR_TRACE_KEYWORD_DETOURS),
+        TraceLoggingOpcode(WINEVENT_OPCODE_START),
+        TraceLoggingWideString(ProfiledDetourName(detour), "Name"));
+    SetLastError(lastError);
+}
+
+void TraceDetourStop(size_t detour)
+{
+    DWORD lastError = GetLastError();
+    TraceLoggingWrite(
+        g_detoursTraceProvider,
+        "Detour",
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+        TraceLoggingKeyword(DETOUR_TRACE_KEYWORD_DETOURS),
+        TraceLoggingOpcode(WINEVENT_OPCODE_STOP),
+        TraceLoggingWideString(ProfiledDetourName(detour), "Name"),
+        TraceLoggingWinError(lastError, "LastError"));
+    SetLastError(lastError);
+}
+
+void TracePolicyLookup(PCWSTR path, size_t pathLength, LONG64 microseconds)
+{
+    DWORD lastError = GetLastError();
+    TraceLoggingWrite(
+        g_detoursTraceProvider,
+        "PolicyLookup",
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+        TraceLoggingKeyword(DETOUR_TRACE_KEYWORD_POLICY),
+        TraceLoggingCountedWideString(path, (USHORT)(pathLength < USHRT_MAX ? pathLength : USHRT_MAX), "Path"),
+        TraceLoggingInt64(microseconds, "Microseconds"));
+    SetLastError(lastError);
+}
+
+void TraceReparsePointResolution(PCWSTR path, bool cached, bool success, LONG64 microseconds)
+{
+    DWORD lastError = GetLastError();
+    TraceLoggingWrite(
+        g_detoursTraceProvider,
+        "ReparsePointResolution",
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+        TraceLoggingKeyword(DETOUR_TRACE_KEYWORD_REPARSE),
+        TraceLoggingWideString(path, "Path"),
+        TraceLoggingBoolean(cached, "Cached"),
+        TraceLoggingBoolean(success, "Success"),
+        TraceLoggingInt64(microseconds, "Microseconds"));
+    SetLastError(lastError);
+}
+
+void TraceHandleOverlayRegister(HANDLE handle, LONG64 microseconds)
+{
+    DWORD lastError = GetLastError();
+    TraceLoggingWrite(
+        g_detoursTraceProvider,
+        "HandleOverlayRegister",
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+        TraceLoggingKeyword(DETOUR_TRACE_KEYWORD_HANDLE_OVERLAY),
+        TraceLoggingPointer(handle, "Handle"),
+        TraceLoggingInt64(microseconds, "Microseconds"));
+    SetLastError(lastError);
+}
+
+void TraceHandleOverlayLookup(HANDLE handle, bool found, LONG64 microseconds)
+{
+    DWORD lastError = GetLastError();
+    TraceLoggingWrite(
+        g_detoursTraceProvider,
+        "HandleOverlayLookup",
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+        TraceLoggingKeyword(DETOUR_TRACE_KEYWORD_HANDLE_OVERLAY),
+        TraceLoggingPointer(handle, "Handle"),
+        TraceLoggingBoolean(found, "Found"),
+        TraceLoggingInt64(microseconds, "Microseconds"));
+    SetLastError(lastError);
+}
+
+void TraceHandleOverlayClose(HANDLE handle, LONG64 microseconds)
+{
+    DWORD lastError = GetLastError();
+    TraceLoggingWrite(
+        g_detoursTraceProvider,
+        "HandleOverlayClose",
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+        TraceLoggingKeyword(DETOUR_TRACE_KEYWORD_HANDLE_OVERLAY),
+        TraceLoggingPointer(handle, "Handle"),
+        TraceLoggingInt64(microseconds, "Microseconds"));
+    SetLastError(lastError);
+}
+
+void TraceReportWrite(size_t length, LONG lineCount, DWORD error, LONG64 microseconds)
+{
+    DWORD lastError = GetLastError();
+    TraceLoggingWrite(
+        g_detoursTraceProvider,
+        "ReportWrite",
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+        TraceLoggingKeyword(DETOUR_TRACE_KEYWORD_REPORT),
+        TraceLoggingUInt64((UINT64)length, "Characters"),
+        TraceLoggingInt32(lineCount, "Lines"),
+        TraceLoggingWinError(error, "Error"),
+        TraceLoggingInt64(microseconds, "Microseconds"));
+    SetLastError(lastError);
+}
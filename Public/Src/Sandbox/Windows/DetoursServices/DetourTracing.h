@@ -0,0 +1,73 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "stdafx.h"
+
+#pragma warning( push )
+#pragma warning( disable : 4668 )
+#include <TraceLoggingProvider.h>
+#include <winmeta.h>
+#pragma warning( pop )
+
+// ETW provider of the detours, named BuildXL.DetoursServices, which can be enabled by name in WPR or tracelog (*BuildXL.DetoursServices).
+// Events are only built when a session enabled the provider with their keyword: otherwise each one costs a load and a compare.
+// The provider is only registered by the detours dll, so the events of the natives library are never enabled.
+TRACELOGGING_DECLARE_PROVIDER(g_detoursTraceProvider);
+
+// Keywords of the events of the provider
+#define DETOUR_TRACE_KEYWORD_DETOURS        0x1ULL  // Start and stop of the profiled detours (see FOR_ALL_PROFILED_DETOURS)
+#define DETOUR_TRACE_KEYWORD_POLICY         0x2ULL  // Manifest policy lookups
+#define DETOUR_TRACE_KEYWORD_REPARSE        0x4ULL  // Reparse point resolution of the paths being accessed
+#define DETOUR_TRACE_KEYWORD_HANDLE_OVERLAY 0x8ULL  // Handle overlay registrations, lookups and closes
+#define DETOUR_TRACE_KEYWORD_REPORT         0x10ULL // Writes to the report pipe
+
+void RegisterDetoursTraceProvider();
+void UnregisterDetoursTraceProvider();
+
+inline bool DetourTraceEnabled(ULONGLONG keyword)
+{
+    return TraceLoggingProviderEnabled(g_detoursTraceProvider, WINEVENT_LEVEL_VERBOSE, keyword);
+}
+
+// Event writers. They leave the last error as they found it, since most of them run after the real function was called.
+void TraceDetourStart(size_t detour);
+void TraceDetourStop(size_t detour);
+void TracePolicyLookup(PCWSTR path, size_t pathLength, LONG64 microseconds);
+void TraceReparsePointResolution(PCWSTR path, bool cached, bool success, LONG64 microseconds);
+void TraceHandleOverlayRegister(HANDLE handle, LONG64 microseconds);
+void TraceHandleOverlayLookup(HANDLE handle, bool found, LONG64 microseconds);
+void TraceHandleOverlayClose(HANDLE handle, LONG64 microseconds);
+void TraceReportWrite(size_t length, LONG lineCount, DWORD error, LONG64 microseconds);
+
+// Times an operation, but only if its keyword is enabled when the operation starts
+class DetourTraceTimer
+{
+public:
+    explicit DetourTraceTimer(ULONGLONG keyword) noexcept
+    {
+        m_start.QuadPart = 0;
+        if (DetourTraceEnabled(keyword))
+        {
+            QueryPerformanceCounter(&m_start);
+        }
+    }
+
+    bool IsTracing() const { return m_start.QuadPart != 0; }
+
+    LONG64 ElapsedMicroseconds() const
+    {
+        LARGE_INTEGER now;
+        LARGE_INTEGER frequency;
+        QueryPerformanceCounter(&now);
+        QueryPerformanceFrequency(&frequency);
+        return (now.QuadPart - m_start.QuadPart) * 1000000 / frequency.QuadPart;
+    }
+
+private:
+    LARGE_INTEGER m_start;
+
+    DetourTraceTimer(const DetourTraceTimer&) = delete;
+    DetourTraceTimer& operator=(const DetourTraceTimer&) = delete;
+};
@@ -5,8 +5,12 @@
 
 #include "DetouredFunctions.h"
 #include "DetouredScope.h"
+#include "DetourProfiler.h"
+#include "DetourTracing.h"
+#include "FinalPathCache.h"
 #include "HandleOverlay.h"
 #include "MetadataOverrides.h"
+#include "ProbeResultCache.h"
 #include "ResolvedPathCache.h"
 #include "SendReport.h"
 #include "StringOperations.h"
@@ -36,11 +40,39 @@ using std::wstring;
 #define _MAX_EXTENDED_PATH_LENGTH 32768 // see https://docs.microsoft.com/en-us/cpp/c-runtime-library/path-field-limits?view=vs-2019
 #define _MAX_EXTENDED_DIR_LENGTH (_MAX_EXTENDED_PATH_LENGTH - _MAX_DRIVE - _MAX_FNAME - _MAX_EXT - 4)
 
+// Instantiation of Detoured_<name>T for the given values of two manifest flags. A detour specialized over a single flag passes it twice.
+#define SPECIALIZED_DETOUR(name, flag1, flag2, set1, set2) \
+    Detoured_##name##T<FamFlags< \
+        (DWORD)FileAccessManifestFlag::flag1 | (DWORD)FileAccessManifestFlag::flag2, \
+        ((set1) ? (DWORD)FileAccessManifestFlag::flag1 : 0) | ((set2) ? (DWORD)FileAccessManifestFlag::flag2 : 0)>>
+
+// Picks the instantiation of Detoured_<name>T matching the flags of the manifest, which must have been parsed already
+#define SELECT_SPECIALIZED_DETOUR(name, flag1, flag2) \
+    SelectSpecializedDetour<name##_t>( \
+        CheckFileAccessManifestFlag(FileAccessManifestFlag::flag1), \
+        CheckFileAccessManifestFlag(FileAccessManifestFlag::flag2), \
+        SPECIALIZED_DETOUR(name, flag1, flag2, false, false), \
+        SPECIALIZED_DETOUR(name, flag1, flag2, true, false), \
+        SPECIALIZED_DETOUR(name, flag1, flag2, false, true), \
+        SPECIALIZED_DETOUR(name, flag1, flag2, true, true))
+
+static bool CheckFileAccessManifestFlag(FileAccessManifestFlag flag)
+{
+    return (g_fileAccessManifestFlags & flag) != FileAccessManifestFlag::None;
+}
+
+template <typename TDetour>
+static TDetour SelectSpecializedDetour(bool set1, bool set2, TDetour neither, TDetour first, TDetour second, TDetour both)
+{
+    return set1 ? (set2 ? both : first) : (set2 ? second : neither);
+}
+
 #define NTQUERYDIRECTORYFILE_MIN_BUFFER_SIZE 4096
 
 static bool IgnoreFullReparsePointResolvingForPath(const PolicyResult& policyResult)
 {
-    return IgnoreFullReparsePointResolving() && !policyResult.EnableFullReparsePointParsing();
+    // There is nothing to resolve where the manifest vouches that there are no reparse points
+    return (IgnoreFullReparsePointResolving() && !policyResult.EnableFullReparsePointParsing()) || policyResult.NoReparsePointsInCone();
 }
 
 /// <summary>
@@ -48,11 +80,11 @@ static bool IgnoreFullReparsePointResolvingForPath(const PolicyResult& policyRes
 /// d: is level 0, d:\a is level 1, etc...
 /// Every level >= the returned level should be checked for a reparse point.
 /// If a reparse point is found, all levels of the newly resolved path should be checked for reparse points again.
-/// Calls <code>IgnoreFullReparsePointResolving</code> and <code>PolicyResult.GetFirstLevelForFileAccessPolicy</code> to determine the level.
+/// Calls <code>IgnoreFullReparsePointResolving</code> and <code>PolicyResult.FindLowestLevelWithFullReparsePointParsing</code> to determine the level.
 /// </summary>
 static size_t GetLevelToEnableFullReparsePointParsing(const PolicyResult& policyResult)
 {
-    return IgnoreFullReparsePointResolving() ? policyResult.FindLowestConsecutiveLevelThatStillHasProperty(FileAccessPolicy::FileAccessPolicy_EnableFullReparsePointParsing) : 0;
+    return IgnoreFullReparsePointResolving() ? policyResult.FindLowestLevelWithFullReparsePointParsing() : 0;
 }
 
 /// <summary>
@@ -139,7 +171,7 @@ static bool AccessReparsePointTarget(
 /// <remarks>
 /// This function encapsulates calls to <code>GetFinalPathNameByHandleW</code> and allocates memory as needed.
 /// </remarks>
-static DWORD DetourGetFinalPathByHandle(_In_ HANDLE hFile, _Inout_ wstring& fullPath)
+static DWORD QueryFinalPathByHandle(_In_ HANDLE hFile, _Inout_ wstring& fullPath)
 {
     // First, try with a fixed-sized buffer which should be good enough for all practical cases.
     wchar_t wszBuffer[MAX_PATH];
@@ -186,6 +218,53 @@ static DWORD DetourGetFinalPathByHandle(_In_ HANDLE hFile, _Inout_ wstring& full
     return ERROR_SUCCESS;
 }
 
+/// <summary>
+/// Gets the id of the file a handle refers to, if its final path can be cached (see FinalPathCache).
+/// </summary>
+static bool FinalPathCache_TryGetFileId(_In_ HANDLE hFile, _Out_ FILE_ID_INFO& fileId)
+{
+    FILE_STANDARD_INFO standardInfo;
+    return Real_GetFileInformationByHandleEx(hFile, FileStandardInfo, &standardInfo, sizeof(standardInfo))
+        && standardInfo.NumberOfLinks == 1
+        && !standardInfo.DeletePending
+        && Real_GetFileInformationByHandleEx(hFile, FileIdInfo, &fileId, sizeof(fileId));
+}
+
+static void FinalPathCache_Invalidate()
+{
+    if (CacheFinalPathsByFileId())
+    {
+        FinalPathCache::Instance().Invalidate();
+    }
+}
+
+/// <summary>
+/// Gets the final full path by handle, from FinalPathCache when it is enabled.
+/// </summary>
+static DWORD DetourGetFinalPathByHandle(_In_ HANDLE hFile, _Inout_ wstring& fullPath)
+{
+    FILE_ID_INFO fileId;
+    if (!CacheFinalPathsByFileId() || !FinalPathCache_TryGetFileId(hFile, fileId))
+    {
+        return QueryFinalPathByHandle(hFile, fullPath);
+    }
+
+    FinalPathCache& cache = FinalPathCache::Instance();
+    if (cache.TryGetFinalPath(fileId, fullPath))
+    {
+        return ERROR_SUCCESS;
+    }
+
+    const unsigned long long generation = cache.Generation();
+    const DWORD result = QueryFinalPathByHandle(hFile, fullPath);
+    if (result == ERROR_SUCCESS)
+    {
+        cache.InsertFinalPath(fileId, generation, fullPath);
+    }
+
+    return result;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////// Resolved path cache /////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -269,6 +348,19 @@ static const Possible<ResolvedPathCacheEntries> PathCache_GetResolvedPaths(const
     return ResolvedPathCache::Instance().GetResolvedPaths(path, preserveLastReparsePointInPath);
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////// Probe result cache //////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Whether the attribute probes of the path policyResult was initialized with can be answered from the probe result cache.
+// Must be called before the policy is adjusted to the fully resolved path: the cache is keyed by the path as requested.
+static bool ProbeCache_IsEligible(const PolicyResult& policyResult)
+{
+    return CacheProbesOfImmutableInputs()
+        && policyResult.GetExpectedUsn() != NoUsn
+        && !policyResult.AllowWrite(/* basedOnlyOnPolicy */ true);
+}
+
 /// <summary>
 /// Gets target name from <code>REPARSE_DATA_BUFFER</code>.
 /// </summary>
@@ -499,6 +591,12 @@ static bool ShouldResolveReparsePointsInPath(
         return false;
     }
 
+    // Neither the path nor any of its prefixes is a reparse point, so don't even look at the final component
+    if (policyResult.NoReparsePointsInCone())
+    {
+        return false;
+    }
+
     if (IgnoreFullReparsePointResolvingForPath(policyResult))
     {
         return AccessReparsePointTarget(path.GetPathString(), dwFlagsAndAttributes, INVALID_HANDLE_VALUE);
@@ -1502,6 +1600,7 @@ static bool EnforceChainOfReparsePointAccesses(
         return true;
     }
 
+    DetourTraceTimer trace(DETOUR_TRACE_KEYWORD_REPARSE);
 
     bool cached = true;
     const Possible<ResolvedPathCacheEntries> cachedEntries = PathCache_GetResolvedPaths(
@@ -1526,7 +1625,7 @@ static bool EnforceChainOfReparsePointAccesses(
         }
         else
         {
-            return ResolveAllReparsePointsAndEnforceAccess(
+            bool resolved = ResolveAllReparsePointsAndEnforceAccess(
                 path,
                 dwDesiredAccess,
                 dwShareMode,
@@ -1539,6 +1638,13 @@ static bool EnforceChainOfReparsePointAccesses(
                 resolvedPath,
                 enforceAccessForResolvedPath,
                 preserveLastReparsePoint);
+
+            if (trace.IsTracing())
+            {
+                TraceReparsePointResolution(path.GetPathString(), /* cached */ false, resolved, trace.ElapsedMicroseconds());
+            }
+
+            return resolved;
         }
     }
     else
@@ -1589,9 +1695,47 @@ static bool EnforceChainOfReparsePointAccesses(
             contextOperationName);
     }
 
+    if (trace.IsTracing())
+    {
+        TraceReparsePointResolution(path.GetPathString(), cached, success, trace.ElapsedMicroseconds());
+    }
+
     return success;
 }
 
+/// <summary>
+/// Whether non CreateFile-like functions should enforce accesses on the chain of reparse points of their paths.
+/// </summary>
+static bool ShouldEnforceReparsePointChainForNonCreateFile()
+{
+    return !IgnoreNonCreateFileReparsePoints() && !IgnoreReparsePoints();
+}
+
+/// <summary>
+/// Enforces allowed accesses for all paths leading to and including the target of 'reparsePointPath', already known to be a reparse point,
+/// for non CreateFile-like functions.
+/// </summary>
+static bool EnforceChainOfKnownReparsePointAccessesForNonCreateFile(
+    const CanonicalizedPath& reparsePointPath,
+    const FileOperationContext& fileOperationContext,
+    const PolicyResult& policyResult,
+    const bool enforceAccess = true,
+    const bool isCreateDirectory = false)
+{
+    return EnforceChainOfReparsePointAccesses(
+        reparsePointPath,
+        INVALID_HANDLE_VALUE,
+        fileOperationContext.DesiredAccess,
+        fileOperationContext.ShareMode,
+        fileOperationContext.CreationDisposition,
+        fileOperationContext.FlagsAndAttributes,
+        false,
+        policyResult,
+        nullptr,
+        enforceAccess,
+        isCreateDirectory);
+}
+
 /// <summary>
 /// Enforces allowed accesses for all paths leading to and including the target of a reparse point for non CreateFile-like functions.
 /// </summary>
@@ -1601,29 +1745,14 @@ static bool EnforceChainOfReparsePointAccessesForNonCreateFile(
     const bool enforceAccess = true,
     const bool isCreateDirectory = false)
 {
-    if (!IgnoreNonCreateFileReparsePoints() && !IgnoreReparsePoints())
+    if (ShouldEnforceReparsePointChainForNonCreateFile())
     {
         CanonicalizedPath canonicalPath = CanonicalizedPath::Canonicalize(fileOperationContext.NoncanonicalPath);
 
-        if (IsReparsePoint(canonicalPath.GetPathString(), INVALID_HANDLE_VALUE))
+        if (IsReparsePoint(canonicalPath.GetPathString(), INVALID_HANDLE_VALUE)
+            && !EnforceChainOfKnownReparsePointAccessesForNonCreateFile(canonicalPath, fileOperationContext, policyResult, enforceAccess, isCreateDirectory))
         {
-            bool accessResult = EnforceChainOfReparsePointAccesses(
-                canonicalPath,
-                INVALID_HANDLE_VALUE,
-                fileOperationContext.DesiredAccess,
-                fileOperationContext.ShareMode,
-                fileOperationContext.CreationDisposition,
-                fileOperationContext.FlagsAndAttributes,
-                false,
-                policyResult,
-                nullptr,
-                enforceAccess,
-                isCreateDirectory);
-
-            if (!accessResult)
-            {
-                return false;
-            }
+            return false;
         }
     }
 
@@ -1739,7 +1868,7 @@ static bool ValidateMoveDirectory(
         return true;
     }
 
-    if (!EnumerateDirectory(lpExistingFileName, L"*", true, true, filesAndDirectories))
+    if (!EnumerateDirectory(lpExistingFileName, true, true, filesAndDirectories))
     {
         SetLastError(error);
         return false;
@@ -1965,6 +2094,124 @@ typedef struct _FILE_MODE_INFORMATION {
     ULONG Mode;
 } FILE_MODE_INFORMATION, *PFILE_MODE_INFORMATION;
 
+// The entries NtQueryDirectoryFile returns for the information classes that carry timestamps all start like FILE_DIRECTORY_INFORMATION,
+// and differ in what goes between FileNameLength and FileName.
+typedef struct _FILE_DIRECTORY_INFORMATION {
+    ULONG NextEntryOffset;
+    ULONG FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG FileAttributes;
+    ULONG FileNameLength;
+    WCHAR FileName[1];
+} FILE_DIRECTORY_INFORMATION, *PFILE_DIRECTORY_INFORMATION;
+
+typedef struct _FILE_FULL_DIR_INFORMATION {
+    ULONG NextEntryOffset;
+    ULONG FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG FileAttributes;
+    ULONG FileNameLength;
+    ULONG EaSize;
+    WCHAR FileName[1];
+} FILE_FULL_DIR_INFORMATION, *PFILE_FULL_DIR_INFORMATION;
+
+typedef struct _FILE_ID_FULL_DIR_INFORMATION {
+    ULONG NextEntryOffset;
+    ULONG FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG FileAttributes;
+    ULONG FileNameLength;
+    ULONG EaSize;
+    LARGE_INTEGER FileId;
+    WCHAR FileName[1];
+} FILE_ID_FULL_DIR_INFORMATION, *PFILE_ID_FULL_DIR_INFORMATION;
+
+typedef struct _FILE_BOTH_DIR_INFORMATION {
+    ULONG NextEntryOffset;
+    ULONG FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG FileAttributes;
+    ULONG FileNameLength;
+    ULONG EaSize;
+    CCHAR ShortNameLength;
+    WCHAR ShortName[12];
+    WCHAR FileName[1];
+} FILE_BOTH_DIR_INFORMATION, *PFILE_BOTH_DIR_INFORMATION;
+
+typedef struct _FILE_ID_BOTH_DIR_INFORMATION {
+    ULONG NextEntryOffset;
+    ULONG FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG FileAttributes;
+    ULONG FileNameLength;
+    ULONG EaSize;
+    CCHAR ShortNameLength;
+    WCHAR ShortName[12];
+    LARGE_INTEGER FileId;
+    WCHAR FileName[1];
+} FILE_ID_BOTH_DIR_INFORMATION, *PFILE_ID_BOTH_DIR_INFORMATION;
+
+typedef struct _FILE_ID_EXTD_DIR_INFORMATION {
+    ULONG NextEntryOffset;
+    ULONG FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG FileAttributes;
+    ULONG FileNameLength;
+    ULONG EaSize;
+    ULONG ReparsePointTag;
+    FILE_ID_128 FileId;
+    WCHAR FileName[1];
+} FILE_ID_EXTD_DIR_INFORMATION, *PFILE_ID_EXTD_DIR_INFORMATION;
+
+typedef struct _FILE_ID_EXTD_BOTH_DIR_INFORMATION {
+    ULONG NextEntryOffset;
+    ULONG FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG FileAttributes;
+    ULONG FileNameLength;
+    ULONG EaSize;
+    ULONG ReparsePointTag;
+    FILE_ID_128 FileId;
+    CCHAR ShortNameLength;
+    WCHAR ShortName[12];
+    WCHAR FileName[1];
+} FILE_ID_EXTD_BOTH_DIR_INFORMATION, *PFILE_ID_EXTD_BOTH_DIR_INFORMATION;
+
 static bool TryGetFileNameFromFileInformation(
     _In_  PWCHAR   fileName,
     _In_  ULONG    fileNameLength,
@@ -2677,6 +2924,36 @@ NTSTATUS HandleFileNameInformation(
     return result;
 }
 
+// Renames and new hard links change the paths leading to a file, so they drop the final paths cached by file id once they are done.
+// Every rename and hard link creation in the process ends up here (Win32 ones included), whether or not it is checked.
+static NTSTATUS SetPathChangingInformationFile(
+    _In_  HANDLE                 FileHandle,
+    _Out_ PIO_STATUS_BLOCK       IoStatusBlock,
+    _In_  PVOID                  FileInformation,
+    _In_  ULONG                  Length,
+    _In_  FILE_INFORMATION_CLASS FileInformationClass,
+    _In_  bool                   isRename)
+{
+    const FILE_INFORMATION_CLASS_EXTRA fileInformationClassExtra = (FILE_INFORMATION_CLASS_EXTRA)FileInformationClass;
+    NTSTATUS result;
+
+    if (isRename && !IgnoreZwRenameFileInformation())
+    {
+        result = HandleFileRenameInformation(FileHandle, IoStatusBlock, FileInformation, Length, FileInformationClass);
+    }
+    else if (!isRename && !IgnoreZwOtherFileInformation())
+    {
+        result = HandleFileLinkInformation(FileHandle, IoStatusBlock, FileInformation, Length, FileInformationClass, fileInformationClassExtra == FILE_INFORMATION_CLASS_EXTRA::FileLinkInformationEx);
+    }
+    else
+    {
+        result = Real_ZwSetInformationFile(FileHandle, IoStatusBlock, FileInformation, Length, FileInformationClass);
+    }
+
+    FinalPathCache_Invalidate();
+    return result;
+}
+
 IMPLEMENTED(Detoured_ZwSetInformationFile)
 NTSTATUS NTAPI Detoured_ZwSetInformationFile(
     _In_  HANDLE                 FileHandle,
@@ -2694,18 +2971,10 @@ NTSTATUS NTAPI Detoured_ZwSetInformationFile(
         case FILE_INFORMATION_CLASS_EXTRA::FileRenameInformationEx:
         case FILE_INFORMATION_CLASS_EXTRA::FileRenameInformationBypassAccessCheck:
         case FILE_INFORMATION_CLASS_EXTRA::FileRenameInformationExBypassAccessCheck:
-            if (!IgnoreZwRenameFileInformation())
-            {
-                return HandleFileRenameInformation(FileHandle, IoStatusBlock, FileInformation, Length, FileInformationClass);
-            }
-            break;
+            return SetPathChangingInformationFile(FileHandle, IoStatusBlock, FileInformation, Length, FileInformationClass, /* isRename */ true);
         case FILE_INFORMATION_CLASS_EXTRA::FileLinkInformation:
         case FILE_INFORMATION_CLASS_EXTRA::FileLinkInformationEx:
-            if (!IgnoreZwOtherFileInformation())
-            {
-                return HandleFileLinkInformation(FileHandle, IoStatusBlock, FileInformation, Length, FileInformationClass, fileInformationClassExtra == FILE_INFORMATION_CLASS_EXTRA::FileLinkInformationEx);
-            }
-            break;
+            return SetPathChangingInformationFile(FileHandle, IoStatusBlock, FileInformation, Length, FileInformationClass, /* isRename */ false);
         case FILE_INFORMATION_CLASS_EXTRA::FileDispositionInformation:
         case FILE_INFORMATION_CLASS_EXTRA::FileDispositionInformationEx:
             if (!IgnoreZwOtherFileInformation())
@@ -2742,18 +3011,19 @@ NTSTATUS NTAPI Detoured_ZwSetInformationFile(
 
 static bool ShouldBreakawayFromJob(const CanonicalizedPath& fullApplicationPath)
 {
-    if (g_processNamesToBreakAwayFromJob->empty() || fullApplicationPath.IsNull())
+    if (!HasProcessesToBreakAwayFromJob() || fullApplicationPath.IsNull())
     {
         return false;
     }
 
-    std::wstring imageName(fullApplicationPath.GetLastComponent());
+    // The image name is matched in place against the names in the payload, so no string gets built for it
+    const wchar_t* imageName = fullApplicationPath.GetLastComponent();
 
 #if SUPER_VERBOSE
-    Dbg(L"Allowing process to breakaway from job object. Image name: '%s'", imageName.c_str());
+    Dbg(L"Allowing process to breakaway from job object. Image name: '%s'", imageName);
 #endif
 
-    return g_processNamesToBreakAwayFromJob->find(imageName) != g_processNamesToBreakAwayFromJob->end();
+    return IsProcessToBreakAwayFromJob(imageName);
 }
 
 IMPLEMENTED(Detoured_CreateProcessW)
@@ -2789,6 +3059,7 @@ BOOL WINAPI Detoured_CreateProcessW(
     }
 
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::CreateProcessW, scope);
 
     if (!MonitorChildProcesses() || scope.Detoured_IsDisabled())
     {
@@ -3049,8 +3320,9 @@ static bool TryGetUsn(
 // If we are not attached this is not App use of RAM but the OS proess startup side of the world.
 extern bool g_isAttached;
 
-IMPLEMENTED(Detoured_CreateFileW)
-HANDLE WINAPI Detoured_CreateFileW(
+// Specialized over IgnoreReparsePoints and ForceReadOnlyForRequestedReadWrite, which are fixed once the manifest is parsed (see SelectDetoured_CreateFileW)
+template <typename Flags>
+static HANDLE WINAPI Detoured_CreateFileWT(
     _In_     LPCWSTR               lpFileName,
     _In_     DWORD                 dwDesiredAccess,
     _In_     DWORD                 dwShareMode,
@@ -3060,6 +3332,7 @@ HANDLE WINAPI Detoured_CreateFileW(
     _In_opt_ HANDLE                hTemplateFile)
 {
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::CreateFileW, scope);
 
     // The are potential complication here: How to handle a call to CreateFile with the FILE_FLAG_OPEN_REPARSE_POINT?
     // Is it a real file access. Some code in Windows (urlmon.dll) inspects reparse points when mapping a path to a particular security "Zone".
@@ -3105,7 +3378,7 @@ HANDLE WINAPI Detoured_CreateFileW(
         error = GetLastError();
         accessCheck = policyResult.CheckWriteAccess();
 
-        if (ForceReadOnlyForRequestedReadWrite() && accessCheck.Result != ResultAction::Allow)
+        if (Flags::Check(FileAccessManifestFlag::ForceReadOnlyForRequestedReadWrite) && accessCheck.Result != ResultAction::Allow)
         {
             // If ForceReadOnlyForRequestedReadWrite() is true, then we allow read for requested read-write access so long as the tool is allowed to read.
             // In such a case, we change the desired access to read only (see the call to Real_CreateFileW below).
@@ -3258,7 +3531,7 @@ HANDLE WINAPI Detoured_CreateFileW(
     bool isHandleToReparsePoint = (dwFlagsAndAttributes & FILE_FLAG_OPEN_REPARSE_POINT) != 0;
     bool shouldReportAccessCheck = true;
 
-    bool shouldResolveReparsePointsInPath = ShouldResolveReparsePointsInPath(policyResult.GetCanonicalizedPath(), opContext.FlagsAndAttributes, policyResult);
+    bool shouldResolveReparsePointsInPath = !Flags::Check(FileAccessManifestFlag::IgnoreReparsePoints) && ShouldResolveReparsePointsInPath(policyResult.GetCanonicalizedPath(), opContext.FlagsAndAttributes, policyResult);
     if (shouldResolveReparsePointsInPath)
     {
         bool accessResult = EnforceChainOfReparsePointAccesses(
@@ -3336,10 +3609,29 @@ HANDLE WINAPI Detoured_CreateFileW(
     return handle;
 }
 
+IMPLEMENTED(Detoured_CreateFileW)
+HANDLE WINAPI Detoured_CreateFileW(
+    _In_     LPCWSTR               lpFileName,
+    _In_     DWORD                 dwDesiredAccess,
+    _In_     DWORD                 dwShareMode,
+    _In_opt_ LPSECURITY_ATTRIBUTES lpSecurityAttributes,
+    _In_     DWORD                 dwCreationDisposition,
+    _In_     DWORD                 dwFlagsAndAttributes,
+    _In_opt_ HANDLE                hTemplateFile)
+{
+    return Detoured_CreateFileWT<RuntimeFamFlags>(lpFileName, dwDesiredAccess, dwShareMode, lpSecurityAttributes, dwCreationDisposition, dwFlagsAndAttributes, hTemplateFile);
+}
+
+CreateFileW_t SelectDetoured_CreateFileW()
+{
+    return SELECT_SPECIALIZED_DETOUR(CreateFileW, IgnoreReparsePoints, ForceReadOnlyForRequestedReadWrite);
+}
+
 IMPLEMENTED(Detoured_CloseHandle)
 BOOL WINAPI Detoured_CloseHandle(_In_ HANDLE handle)
 {
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::CloseHandle, scope);
 
     if (scope.Detoured_IsDisabled() || IsNullOrInvalidHandle(handle))
     {
@@ -3412,10 +3704,12 @@ BOOL WINAPI Detoured_GetVolumePathNameW(
     return Real_GetVolumePathNameW(lpszFileName, lpszVolumePathName, cchBufferLength);
 }
 
-IMPLEMENTED(Detoured_GetFileAttributesW)
-DWORD WINAPI Detoured_GetFileAttributesW(_In_  LPCWSTR lpFileName)
+// Specialized over ProbeDirectorySymlinkAsDirectory, which is fixed once the manifest is parsed (see SelectDetoured_GetFileAttributesW)
+template <typename Flags>
+static DWORD WINAPI Detoured_GetFileAttributesWT(_In_  LPCWSTR lpFileName)
 {
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::GetFileAttributesW, scope);
     if (scope.Detoured_IsDisabled() || IsNullOrEmptyW(lpFileName) || IsSpecialDeviceName(lpFileName))
     {
 #pragma warning(suppress: 6387)
@@ -3431,6 +3725,10 @@ DWORD WINAPI Detoured_GetFileAttributesW(_In_  LPCWSTR lpFileName)
         return INVALID_FILE_ATTRIBUTES;
     }
 
+    const bool useProbeCache = ProbeCache_IsEligible(policyResult);
+    const std::wstring probeCacheKey = useProbeCache ? std::wstring(policyResult.GetCanonicalizedPath().GetPathString()) : std::wstring();
+    const USN expectedUsn = policyResult.GetExpectedUsn();
+
     if (!AdjustOperationContextAndPolicyResultWithFullyResolvedPath(fileOperationContext, policyResult, true))
     {
         return INVALID_FILE_ATTRIBUTES;
@@ -3439,17 +3737,27 @@ DWORD WINAPI Detoured_GetFileAttributesW(_In_  LPCWSTR lpFileName)
     DWORD attributes = INVALID_FILE_ATTRIBUTES;
     DWORD error = ERROR_SUCCESS;
 
-    attributes = Real_GetFileAttributesW(lpFileName);
-
-    if (attributes == INVALID_FILE_ATTRIBUTES)
+    if (!useProbeCache || !ProbeResultCache::Instance().TryGetAttributes(probeCacheKey, expectedUsn, attributes, error))
     {
-        error = GetLastError();
+        const unsigned long long probeCacheGeneration = useProbeCache ? ProbeResultCache::Instance().Generation() : 0;
+
+        attributes = Real_GetFileAttributesW(lpFileName);
+
+        if (attributes == INVALID_FILE_ATTRIBUTES)
+        {
+            error = GetLastError();
+        }
+
+        if (useProbeCache)
+        {
+            ProbeResultCache::Instance().InsertAttributes(probeCacheKey, expectedUsn, probeCacheGeneration, attributes, error);
+        }
     }
 
     // Now we can make decisions based on the file's existence and type.
     FileReadContext fileReadContext;
     fileReadContext.InferExistenceFromError(error);
-    fileReadContext.OpenedDirectory = IsDirectoryFromAttributes(attributes, !ProbeDirectorySymlinkAsDirectory());
+    fileReadContext.OpenedDirectory = IsDirectoryFromAttributes(attributes, !Flags::Check(FileAccessManifestFlag::ProbeDirectorySymlinkAsDirectory));
     fileOperationContext.OpenedFileOrDirectoryAttributes = attributes;
 
     AccessCheckResult accessCheck = policyResult.CheckReadAccess(RequestedReadAccess::Probe, fileReadContext);
@@ -3465,6 +3773,17 @@ DWORD WINAPI Detoured_GetFileAttributesW(_In_  LPCWSTR lpFileName)
     return attributes;
 }
 
+IMPLEMENTED(Detoured_GetFileAttributesW)
+DWORD WINAPI Detoured_GetFileAttributesW(_In_  LPCWSTR lpFileName)
+{
+    return Detoured_GetFileAttributesWT<RuntimeFamFlags>(lpFileName);
+}
+
+GetFileAttributesW_t SelectDetoured_GetFileAttributesW()
+{
+    return SELECT_SPECIALIZED_DETOUR(GetFileAttributesW, ProbeDirectorySymlinkAsDirectory, ProbeDirectorySymlinkAsDirectory);
+}
+
 IMPLEMENTED(Detoured_GetFileAttributesA)
 DWORD WINAPI Detoured_GetFileAttributesA(_In_  LPCSTR lpFileName)
 {
@@ -3488,6 +3807,7 @@ BOOL WINAPI Detoured_GetFileAttributesExW(
     _Out_ LPVOID                 lpFileInformation)
 {
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::GetFileAttributesExW, scope);
     if (scope.Detoured_IsDisabled() || IsNullOrEmptyW(lpFileName) || IsSpecialDeviceName(lpFileName))
     {
         return Real_GetFileAttributesExW(lpFileName, fInfoLevelId, lpFileInformation);
@@ -3504,19 +3824,38 @@ BOOL WINAPI Detoured_GetFileAttributesExW(
         return FALSE;
     }
 
+    WIN32_FILE_ATTRIBUTE_DATA* fileStandardInfo = (fInfoLevelId == GetFileExInfoStandard && lpFileInformation != nullptr) ?
+        (WIN32_FILE_ATTRIBUTE_DATA*)lpFileInformation : nullptr;
+
+    // Timestamps are overridden below on every call, so the cache keeps the data as returned by the filesystem
+    const bool useProbeCache = fileStandardInfo != nullptr && ProbeCache_IsEligible(policyResult);
+    const std::wstring probeCacheKey = useProbeCache ? std::wstring(policyResult.GetCanonicalizedPath().GetPathString()) : std::wstring();
+    const USN expectedUsn = policyResult.GetExpectedUsn();
+
     DWORD error = ERROR_SUCCESS;
     BOOL querySucceeded = TRUE;
-    // We could be clever and avoid calling this when already doomed to failure. However:
-    // - Unlike CreateFile, this query can't interfere with other processes
-    // - We want lpFileInformation to be zeroed according to whatever policy GetFileAttributesEx has.
-    querySucceeded = Real_GetFileAttributesExW(lpFileName, fInfoLevelId, lpFileInformation);
-    if (!querySucceeded)
+    if (useProbeCache && ProbeResultCache::Instance().TryGetAttributeData(probeCacheKey, expectedUsn, *fileStandardInfo, error))
     {
-        error = GetLastError();
+        querySucceeded = error == ERROR_SUCCESS;
     }
+    else
+    {
+        const unsigned long long probeCacheGeneration = useProbeCache ? ProbeResultCache::Instance().Generation() : 0;
 
-    WIN32_FILE_ATTRIBUTE_DATA* fileStandardInfo = (fInfoLevelId == GetFileExInfoStandard && lpFileInformation != nullptr) ?
-        (WIN32_FILE_ATTRIBUTE_DATA*)lpFileInformation : nullptr;
+        // We could be clever and avoid calling this when already doomed to failure. However:
+        // - Unlike CreateFile, this query can't interfere with other processes
+        // - We want lpFileInformation to be zeroed according to whatever policy GetFileAttributesEx has.
+        querySucceeded = Real_GetFileAttributesExW(lpFileName, fInfoLevelId, lpFileInformation);
+        if (!querySucceeded)
+        {
+            error = GetLastError();
+        }
+
+        if (useProbeCache)
+        {
+            ProbeResultCache::Instance().InsertAttributeData(probeCacheKey, expectedUsn, probeCacheGeneration, *fileStandardInfo, error);
+        }
+    }
 
     if (!AdjustOperationContextAndPolicyResultWithFullyResolvedPath(fileOperationContext, policyResult, true))
     {
@@ -3643,6 +3982,7 @@ BOOL WINAPI Detoured_CopyFileExW(
     _In_     DWORD              dwCopyFlags)
 {
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::CopyFileExW, scope);
     if (scope.Detoured_IsDisabled() ||
         IsNullOrEmptyW(lpExistingFileName) ||
         IsNullOrEmptyW(lpNewFileName) ||
@@ -3723,13 +4063,18 @@ BOOL WINAPI Detoured_CopyFileExW(
         return FALSE;
     }
 
-    if ((!copySymlink || !IsReparsePoint(lpExistingFileName, INVALID_HANDLE_VALUE)) && IsReparsePoint(lpNewFileName, INVALID_HANDLE_VALUE))
+    // The (possibly resolved) destination path was already canonicalized by its policy result, so probe it only once
+    // and hand it over as is rather than letting EnforceChainOfReparsePointAccessesForNonCreateFile canonicalize and probe it again.
+    const CanonicalizedPath& destPath = destPolicyResult.GetCanonicalizedPath();
+    if (ShouldEnforceReparsePointChainForNonCreateFile()
+        && (!copySymlink || !IsReparsePoint(sourcePolicyResult.GetCanonicalizedPath().GetPathString(), INVALID_HANDLE_VALUE))
+        && IsReparsePoint(destPath.GetPathString(), INVALID_HANDLE_VALUE))
     {
         // If not copying symlink or the source of copy is not a symlink
         // but the destination of the copy is a symlink, then enforce chain of reparse point.
         // For example, if we copy a concrete file f to an existing symlink s pointing to g, then
         // if g exists, then g will be modified, but if g doesn't exist, then g will be created.
-        if (!EnforceChainOfReparsePointAccessesForNonCreateFile(destinationOpContext, sourcePolicyResult))
+        if (!EnforceChainOfKnownReparsePointAccessesForNonCreateFile(destPath, destinationOpContext, sourcePolicyResult))
         {
             return FALSE;
         }
@@ -3916,6 +4261,7 @@ BOOL WINAPI Detoured_MoveFileWithProgressW(
     _In_      DWORD              dwFlags)
 {
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::MoveFileWithProgressW, scope);
     if (scope.Detoured_IsDisabled()
         || IsNullOrEmptyW(lpExistingFileName)
         || IsNullOrEmptyW(lpNewFileName)
@@ -4123,10 +4469,10 @@ BOOL WINAPI Detoured_ReplaceFileW(
     __reserved LPVOID  lpExclude,
     __reserved LPVOID  lpReserved)
 {
-    auto path = CanonicalizedPath::Canonicalize(lpReplacedFileName);
+    // The policy result canonicalizes the path already, no need to do it twice
     PolicyResult policyResult;
     policyResult.Initialize(lpReplacedFileName);
-    PathCache_Invalidate(path.GetPathStringWithoutTypePrefix(), false, policyResult);
+    PathCache_Invalidate(policyResult.GetCanonicalizedPath().GetPathStringWithoutTypePrefix(), false, policyResult);
 
     // TODO:implement detours logic
     return Real_ReplaceFileW(
@@ -4239,6 +4585,7 @@ IMPLEMENTED(Detoured_DeleteFileW)
 BOOL WINAPI Detoured_DeleteFileW(_In_ LPCWSTR lpFileName)
 {
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::DeleteFileW, scope);
     if (scope.Detoured_IsDisabled() ||
         IsNullOrEmptyW(lpFileName) ||
         IsSpecialDeviceName(lpFileName))
@@ -4338,6 +4685,7 @@ BOOL WINAPI Detoured_CreateHardLinkW(
     __reserved LPSECURITY_ATTRIBUTES lpSecurityAttributes)
 {
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::CreateHardLinkW, scope);
     if (scope.Detoured_IsDisabled() ||
         IsNullOrEmptyW(lpFileName) ||
         IsNullOrEmptyW(lpExistingFileName) ||
@@ -4469,6 +4817,7 @@ BOOLEAN WINAPI Detoured_CreateSymbolicLinkW(
     _In_ DWORD   dwFlags)
 {
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::CreateSymbolicLinkW, scope);
     if (scope.Detoured_IsDisabled() ||
         IgnoreReparsePoints() ||
         IsNullOrEmptyW(lpSymlinkFileName) ||
@@ -4794,6 +5143,7 @@ HANDLE WINAPI Detoured_FindFirstFileExW(
     }
 
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::FindFirstFileExW, scope);
     if (scope.Detoured_IsDisabled() ||
         IsNullOrEmptyW(lpFileName) ||
         lpFindFileData == NULL ||
@@ -4839,6 +5189,7 @@ BOOL WINAPI Detoured_FindNextFileW(
     _Out_ LPWIN32_FIND_DATAW lpFindFileData)
 {
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::FindNextFileW, scope);
     DWORD error = ERROR_SUCCESS;
     BOOL result = Real_FindNextFileW(hFindFile, lpFindFileData);
     error = GetLastError();
@@ -4857,16 +5208,23 @@ BOOL WINAPI Detoured_FindNextFileW(
     HandleOverlayRef overlay = TryLookupHandleOverlay(hFindFile);
     if (overlay != nullptr)
     {
-        FileOperationContext fileOperationContext = FileOperationContext::CreateForRead(L"FindNextFile", overlay->Policy.GetCanonicalizedPath().GetPathString());
-
-        wchar_t const* enumeratedComponent = &lpFindFileData->cFileName[0];
-        PolicyResult filePolicyResult = overlay->Policy.GetPolicyForSubpath(enumeratedComponent);
+        PolicyResult directoryPolicyResult = overlay->GetPolicy();
+        FileOperationContext fileOperationContext = FileOperationContext::CreateForRead(L"FindNextFile", directoryPolicyResult.GetCanonicalizedPath().GetPathString());
 
-        if (!AdjustOperationContextAndPolicyResultWithFullyResolvedPath(fileOperationContext, overlay->Policy, true))
+        if (!overlay->EnumerationPathResolved)
         {
-            return FALSE;
+            if (!AdjustOperationContextAndPolicyResultWithFullyResolvedPath(fileOperationContext, directoryPolicyResult, true))
+            {
+                return FALSE;
+            }
+
+            overlay->SetPolicy(directoryPolicyResult);
+            overlay->EnumerationPathResolved = true;
         }
 
+        wchar_t const* enumeratedComponent = &lpFindFileData->cFileName[0];
+        PolicyResult filePolicyResult = directoryPolicyResult.GetPolicyForSubpath(enumeratedComponent);
+
         FileReadContext readContext;
         readContext.Existence = FileExistence::Existent;
         readContext.OpenedDirectory = IsDirectoryFromAttributes(lpFindFileData->dwFileAttributes, false);
@@ -4921,6 +5279,7 @@ BOOL WINAPI Detoured_GetFileInformationByHandleEx(
     _In_  DWORD                     dwBufferSize)
 {
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::GetFileInformationByHandleEx, scope);
 
     DWORD error = ERROR_SUCCESS;
     BOOL result = Real_GetFileInformationByHandleEx(
@@ -4942,10 +5301,10 @@ BOOL WINAPI Detoured_GetFileInformationByHandleEx(
     HandleOverlayRef overlay = TryLookupHandleOverlay(hFile);
     if (overlay != nullptr)
     {
-        if (overlay->Policy.ShouldOverrideTimestamps(overlay->AccessCheck))
+        if (overlay->ShouldOverrideTimestamps())
         {
 #if SUPER_VERBOSE
-            Dbg(L"GetFileInformationByHandleEx: Overriding timestamps for %s", overlay->Policy.GetCanonicalizedPath().GetPathString());
+            Dbg(L"GetFileInformationByHandleEx: Overriding timestamps for %s", overlay->GetPathString());
 #endif // SUPER_VERBOSE
             OverrideTimestampsForInputFile(fileBasicInfo);
         }
@@ -4990,6 +5349,7 @@ BOOL WINAPI Detoured_GetFileInformationByHandle(
     _Out_ LPBY_HANDLE_FILE_INFORMATION lpFileInformation)
 {
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::GetFileInformationByHandle, scope);
 
     DWORD error = ERROR_SUCCESS;
     BOOL result = Real_GetFileInformationByHandle(hFile, lpFileInformation);
@@ -5003,10 +5363,10 @@ BOOL WINAPI Detoured_GetFileInformationByHandle(
     HandleOverlayRef overlay = TryLookupHandleOverlay(hFile);
     if (overlay != nullptr)
     {
-        if (overlay->Policy.ShouldOverrideTimestamps(overlay->AccessCheck))
+        if (overlay->ShouldOverrideTimestamps())
         {
 #if SUPER_VERBOSE
-            Dbg(L"GetFileInformationByHandle: Overriding timestamps for %s", overlay->Policy.GetCanonicalizedPath().GetPathString());
+            Dbg(L"GetFileInformationByHandle: Overriding timestamps for %s", overlay->GetPathString());
 #endif // SUPER_VERBOSE
             OverrideTimestampsForInputFile(lpFileInformation);
         }
@@ -5472,6 +5832,7 @@ BOOL WINAPI Detoured_CreateDirectoryW(
     _In_opt_ LPSECURITY_ATTRIBUTES lpSecurityAttributes)
 {
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::CreateDirectoryW, scope);
     if (scope.Detoured_IsDisabled() ||
         IsNullOrEmptyW(lpPathName) ||
         IsSpecialDeviceName(lpPathName))
@@ -5615,6 +5976,7 @@ IMPLEMENTED(Detoured_RemoveDirectoryW)
 BOOL WINAPI Detoured_RemoveDirectoryW(_In_ LPCWSTR lpPathName)
 {
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::RemoveDirectoryW, scope);
     if (scope.Detoured_IsDisabled() ||
         IsNullOrEmptyW(lpPathName) ||
         IsSpecialDeviceName(lpPathName))
@@ -5876,6 +6238,7 @@ DWORD WINAPI Detoured_GetFinalPathNameByHandleW(
     _In_  DWORD  dwFlags)
 {
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::GetFinalPathNameByHandleW, scope);
 
     if (scope.Detoured_IsDisabled() || IgnoreGetFinalPathNameByHandle())
     {
@@ -5910,6 +6273,113 @@ DWORD WINAPI Detoured_GetFinalPathNameByHandleW(
     return err;
 }
 
+// Gets where the file name and the short name (if any) are in the entries NtQueryDirectoryFile returns for the given class.
+// Returns false for the classes whose entries don't carry timestamps.
+static bool TryGetDirectoryEntryLayout(_In_ FILE_INFORMATION_CLASS fileInformationClass, _Out_ size_t& fileNameOffset, _Out_ size_t& shortNameLengthOffset)
+{
+    shortNameLengthOffset = 0;
+
+    switch ((FILE_INFORMATION_CLASS_EXTRA)fileInformationClass)
+    {
+        case FILE_INFORMATION_CLASS_EXTRA::FileDirectoryInformation:
+            fileNameOffset = offsetof(FILE_DIRECTORY_INFORMATION, FileName);
+            return true;
+        case FILE_INFORMATION_CLASS_EXTRA::FileFullDirectoryInformation:
+            fileNameOffset = offsetof(FILE_FULL_DIR_INFORMATION, FileName);
+            return true;
+        case FILE_INFORMATION_CLASS_EXTRA::FileIdFullDirectoryInformation:
+            fileNameOffset = offsetof(FILE_ID_FULL_DIR_INFORMATION, FileName);
+            return true;
+        case FILE_INFORMATION_CLASS_EXTRA::FileIdExtdDirectoryInformation:
+            fileNameOffset = offsetof(FILE_ID_EXTD_DIR_INFORMATION, FileName);
+            return true;
+        case FILE_INFORMATION_CLASS_EXTRA::FileBothDirectoryInformation:
+            fileNameOffset = offsetof(FILE_BOTH_DIR_INFORMATION, FileName);
+            shortNameLengthOffset = offsetof(FILE_BOTH_DIR_INFORMATION, ShortNameLength);
+            return true;
+        case FILE_INFORMATION_CLASS_EXTRA::FileIdBothDirectoryInformation:
+            fileNameOffset = offsetof(FILE_ID_BOTH_DIR_INFORMATION, FileName);
+            shortNameLengthOffset = offsetof(FILE_ID_BOTH_DIR_INFORMATION, ShortNameLength);
+            return true;
+        case FILE_INFORMATION_CLASS_EXTRA::FileIdExtdBothDirectoryInformation:
+            fileNameOffset = offsetof(FILE_ID_EXTD_BOTH_DIR_INFORMATION, FileName);
+            shortNameLengthOffset = offsetof(FILE_ID_EXTD_BOTH_DIR_INFORMATION, ShortNameLength);
+            return true;
+        default:
+            return false;
+// Without the warning suppression below, some compilation flag can produce a warning because the cases above are not
+// exhaustive with respect to the FILE_INFORMATION_CLASS_EXTRA enums.
+#pragma warning(suppress: 4061)
+    }
+}
+
+// Overrides the metadata of the entries of a batch returned by NtQueryDirectoryFile the way FindFirstFile and FindNextFile do for
+// each entry: timestamps of inputs are overridden and short names are scrubbed. The whole batch is rewritten in a single pass, and
+// the policy of an entry (searched from the directory's policy cursor) is only needed when overriding could change its timestamps.
+// Entries are not reported: the enumeration is.
+static void OverrideDirectoryEntries(
+    _In_ PolicyResult const&    directoryPolicyResult,
+    _In_ FILE_INFORMATION_CLASS fileInformationClass,
+    _In_ PVOID                  buffer,
+    _In_ size_t                 length)
+{
+    size_t fileNameOffset;
+    size_t shortNameLengthOffset;
+    if (!TryGetDirectoryEntryLayout(fileInformationClass, fileNameOffset, shortNameLengthOffset))
+    {
+        return;
+    }
+
+    BYTE* entryStart = reinterpret_cast<BYTE*>(buffer);
+    BYTE* const end = entryStart + length;
+    wstring fileName;
+
+    while (entryStart + fileNameOffset <= end)
+    {
+        PFILE_DIRECTORY_INFORMATION entry = reinterpret_cast<PFILE_DIRECTORY_INFORMATION>(entryStart);
+        if (entryStart + fileNameOffset + entry->FileNameLength > end)
+        {
+            break;
+        }
+
+        if (shortNameLengthOffset != 0)
+        {
+            // Every layout with a short name has it right after its length (see FILE_BOTH_DIR_INFORMATION)
+            ScrubShortFileName(
+                reinterpret_cast<CCHAR*>(entryStart + shortNameLengthOffset),
+                reinterpret_cast<WCHAR*>(entryStart + shortNameLengthOffset + offsetof(FILE_BOTH_DIR_INFORMATION, ShortName) - offsetof(FILE_BOTH_DIR_INFORMATION, ShortNameLength)),
+                std::extent<decltype(FILE_BOTH_DIR_INFORMATION::ShortName)>::value);
+        }
+
+        if (TimestampsNeedOverrideForInputFile(entry->CreationTime, entry->LastAccessTime, entry->LastWriteTime, entry->ChangeTime))
+        {
+            fileName.assign(reinterpret_cast<const wchar_t*>(entryStart + fileNameOffset), entry->FileNameLength / sizeof(wchar_t));
+
+            if (fileName != L"." && fileName != L"..")
+            {
+                PolicyResult filePolicyResult = directoryPolicyResult.GetPolicyForSubpath(fileName.c_str());
+
+                FileReadContext readContext;
+                readContext.Existence = FileExistence::Existent;
+                readContext.OpenedDirectory = IsDirectoryFromAttributes(entry->FileAttributes, false);
+
+                AccessCheckResult accessCheck = filePolicyResult.CheckReadAccess(RequestedReadAccess::EnumerationProbe, readContext);
+                if (filePolicyResult.ShouldOverrideTimestamps(accessCheck))
+                {
+                    OverrideTimestampsForInputFile(&entry->CreationTime, &entry->LastAccessTime, &entry->LastWriteTime, &entry->ChangeTime);
+                }
+            }
+        }
+
+        if (entry->NextEntryOffset == 0)
+        {
+            break;
+        }
+
+        entryStart += entry->NextEntryOffset;
+    }
+}
+
 // Detoured_NtQueryDirectoryFile
 //
 // FileHandle            - a handle for the file object that represents the directory for which information is being requested.
@@ -5935,8 +6405,9 @@ DWORD WINAPI Detoured_GetFinalPathNameByHandleW(
 //                         within the directory specified by FileHandle.This parameter is optional and can be NULL, in which case all files in the directory
 //                         are returned.
 // RestartScan           - Set to TRUE if the scan is to start at the first entry in the directory.Set to FALSE if resuming the scan from a previous call.
-IMPLEMENTED(Detoured_NtQueryDirectoryFile)
-NTSTATUS NTAPI Detoured_NtQueryDirectoryFile(
+// Specialized over UseLargeEnumerationBuffer, which is fixed once the manifest is parsed (see SelectDetoured_NtQueryDirectoryFile)
+template <typename Flags>
+static NTSTATUS NTAPI Detoured_NtQueryDirectoryFileT(
     _In_     HANDLE                 FileHandle,
     _In_opt_ HANDLE                 Event,
     _In_opt_ PIO_APC_ROUTINE        ApcRoutine,
@@ -5950,11 +6421,14 @@ NTSTATUS NTAPI Detoured_NtQueryDirectoryFile(
     _In_     BOOLEAN                RestartScan)
 {
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::NtQueryDirectoryFile, scope);
     LPCWSTR directoryName = nullptr;
     wstring filter;
     bool isEnumeration = true;
     CanonicalizedPath canonicalizedDirectoryPath;
     HandleOverlayRef overlay = nullptr;
+    // Set for directory handles, whose returned entries get their metadata overridden whether or not the enumeration still needs a report
+    HandleOverlayRef entriesOverlay = nullptr;
 
     bool noDetour = scope.Detoured_IsDisabled();
 
@@ -5971,14 +6445,18 @@ NTSTATUS NTAPI Detoured_NtQueryDirectoryFile(
 
         // See if the handle is known
         overlay = TryLookupHandleOverlay(FileHandle);
-        
-        if (overlay == nullptr || overlay->EnumerationHasBeenReported)
+        if (overlay != nullptr && overlay->Type == HandleType::Directory)
+        {
+            entriesOverlay = overlay;
+        }
+
+        if (overlay == nullptr || overlay->EnumerationHasBeenReported || (isEnumeration && overlay->EnumerationNeedsNoReport))
         {
             noDetour = true;
         }
         else
         {
-            canonicalizedDirectoryPath = overlay->Policy.GetCanonicalizedPath();
+            canonicalizedDirectoryPath = overlay->GetPolicy().GetCanonicalizedPath();
             directoryName = canonicalizedDirectoryPath.GetPathString();
 
             if (_wcsicmp(directoryName, L"\\\\.\\MountPointManager") == 0 ||
@@ -5993,7 +6471,7 @@ NTSTATUS NTAPI Detoured_NtQueryDirectoryFile(
     ULONG bufferSize = Length;
     std::unique_ptr<char[]> largerBuffer;
 
-    if (ShouldUseLargeEnumerationBuffer() && Length < NTQUERYDIRECTORYFILE_MIN_BUFFER_SIZE)
+    if (Flags::Check(FileAccessManifestFlag::UseLargeEnumerationBuffer) && Length < NTQUERYDIRECTORYFILE_MIN_BUFFER_SIZE)
     {
         largerBuffer = std::make_unique<char[]>(NTQUERYDIRECTORYFILE_MIN_BUFFER_SIZE);
         buffer = largerBuffer.get();
@@ -6044,7 +6522,7 @@ NTSTATUS NTAPI Detoured_NtQueryDirectoryFile(
             //       given a policy flag for allowing enumeration, we'd apply it globally anyway.
             // TODO: Should include the wildcard in enumeration reports, so that directory enumeration assertions can be more precise.
 
-            PolicyResult directoryPolicyResult = overlay->Policy;
+            PolicyResult directoryPolicyResult = overlay->GetPolicy();
             FileOperationContext fileOperationContext = FileOperationContext::CreateForRead(L"NtQueryDirectoryFile", directoryName);
             fileOperationContext.OpenedFileOrDirectoryAttributes = FILE_ATTRIBUTE_DIRECTORY;
 
@@ -6070,15 +6548,44 @@ NTSTATUS NTAPI Detoured_NtQueryDirectoryFile(
 
             // Remember that we already enumerated this directory if successful
             overlay->EnumerationHasBeenReported = NT_SUCCESS(result) && directoryAccessCheck.ShouldReport();
+            overlay->EnumerationNeedsNoReport = NT_SUCCESS(result) && isEnumeration && !directoryAccessCheck.ShouldReport();
 
             // We can report the status for directory now.
             ReportIfNeeded(directoryAccessCheck, fileOperationContext, directoryPolicyResult, (DWORD)(NT_SUCCESS(result) ? ERROR_SUCCESS : result), -1, filter.c_str());
         }
     }
 
+    // A pending query fills the buffer later, out of our sight
+    if (entriesOverlay != nullptr && NT_SUCCESS(result) && result != STATUS_PENDING)
+    {
+        OverrideDirectoryEntries(entriesOverlay->GetPolicy(), FileInformationClass, FileInformation, std::min<size_t>(IoStatusBlock->Information, Length));
+    }
+
     return result;
 }
 
+IMPLEMENTED(Detoured_NtQueryDirectoryFile)
+NTSTATUS NTAPI Detoured_NtQueryDirectoryFile(
+    _In_     HANDLE                 FileHandle,
+    _In_opt_ HANDLE                 Event,
+    _In_opt_ PIO_APC_ROUTINE        ApcRoutine,
+    _In_opt_ PVOID                  ApcContext,
+    _Out_    PIO_STATUS_BLOCK       IoStatusBlock,
+    _Out_    PVOID                  FileInformation,
+    _In_     ULONG                  Length,
+    _In_     FILE_INFORMATION_CLASS FileInformationClass,
+    _In_     BOOLEAN                ReturnSingleEntry,
+    _In_opt_ PUNICODE_STRING        FileName,
+    _In_     BOOLEAN                RestartScan)
+{
+    return Detoured_NtQueryDirectoryFileT<RuntimeFamFlags>(FileHandle, Event, ApcRoutine, ApcContext, IoStatusBlock, FileInformation, Length, FileInformationClass, ReturnSingleEntry, FileName, RestartScan);
+}
+
+NtQueryDirectoryFile_t SelectDetoured_NtQueryDirectoryFile()
+{
+    return SELECT_SPECIALIZED_DETOUR(NtQueryDirectoryFile, UseLargeEnumerationBuffer, UseLargeEnumerationBuffer);
+}
+
 // Detoured_ZwQueryDirectoryFile
 // See comments for Detoured_NtQueryDirectoryFile
 IMPLEMENTED(Detoured_ZwQueryDirectoryFile)
@@ -6096,11 +6603,14 @@ NTSTATUS NTAPI Detoured_ZwQueryDirectoryFile(
     _In_     BOOLEAN                RestartScan)
 {
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::ZwQueryDirectoryFile, scope);
     LPCWSTR directoryName = nullptr;
     wstring filter;
     bool isEnumeration = true;
     CanonicalizedPath canonicalizedDirectoryPath;
     HandleOverlayRef overlay = nullptr;
+    // Set for directory handles, whose returned entries get their metadata overridden whether or not the enumeration still needs a report
+    HandleOverlayRef entriesOverlay = nullptr;
 
     // MonitorZwCreateOpenQueryFile allows disabling of ZwCreateFile, ZwOpenFile and ZwQueryDirectoryFile functions.
     bool noDetour = scope.Detoured_IsDisabled() || MonitorZwCreateOpenQueryFile();
@@ -6118,13 +6628,18 @@ NTSTATUS NTAPI Detoured_ZwQueryDirectoryFile(
 
         // See if the handle is known
         overlay = TryLookupHandleOverlay(FileHandle);
-        if (overlay == nullptr || overlay->EnumerationHasBeenReported)
+        if (overlay != nullptr && overlay->Type == HandleType::Directory)
+        {
+            entriesOverlay = overlay;
+        }
+
+        if (overlay == nullptr || overlay->EnumerationHasBeenReported || (isEnumeration && overlay->EnumerationNeedsNoReport))
         {
             noDetour = true;
         }
         else
         {
-            canonicalizedDirectoryPath = overlay->Policy.GetCanonicalizedPath();
+            canonicalizedDirectoryPath = overlay->GetPolicy().GetCanonicalizedPath();
             directoryName = canonicalizedDirectoryPath.GetPathString();
 
             if (_wcsicmp(directoryName, L"\\\\.\\MountPointManager") == 0 ||
@@ -6189,7 +6704,7 @@ NTSTATUS NTAPI Detoured_ZwQueryDirectoryFile(
             //       Since enumeration has historically not been understood or reported at all, this is a fine incremental move -
             //       given a policy flag for allowing enumeration, we'd apply it globally anyway.
             // TODO: Should include the wildcard in enumeration reports, so that directory enumeration assertions can be more precise.
-            PolicyResult directoryPolicyResult = overlay->Policy;
+            PolicyResult directoryPolicyResult = overlay->GetPolicy();
             FileOperationContext fileOperationContext = FileOperationContext::CreateForRead(L"ZwQueryDirectoryFile", directoryName);
             fileOperationContext.OpenedFileOrDirectoryAttributes = FILE_ATTRIBUTE_DIRECTORY;
 
@@ -6215,12 +6730,19 @@ NTSTATUS NTAPI Detoured_ZwQueryDirectoryFile(
 
             // Remember that we already enumerated this directory if successful
             overlay->EnumerationHasBeenReported = NT_SUCCESS(result) && directoryAccessCheck.ShouldReport();
+            overlay->EnumerationNeedsNoReport = NT_SUCCESS(result) && isEnumeration && !directoryAccessCheck.ShouldReport();
 
             // We can report the status for directory now.
-            ReportIfNeeded(directoryAccessCheck, fileOperationContext, overlay->Policy, (DWORD)(NT_SUCCESS(result) ? ERROR_SUCCESS : result));
+            ReportIfNeeded(directoryAccessCheck, fileOperationContext, overlay->GetPolicy(), (DWORD)(NT_SUCCESS(result) ? ERROR_SUCCESS : result));
         }
     }
 
+    // See Detoured_NtQueryDirectoryFile
+    if (entriesOverlay != nullptr && NT_SUCCESS(result) && result != STATUS_PENDING)
+    {
+        OverrideDirectoryEntries(entriesOverlay->GetPolicy(), FileInformationClass, FileInformation, std::min<size_t>(IoStatusBlock->Information, Length));
+    }
+
     return result;
 }
 
@@ -6294,7 +6816,7 @@ static bool PathFromObjectAttributes(POBJECT_ATTRIBUTES attributes, Canonicalize
     {
         overlay = TryLookupHandleOverlay(attributes->RootDirectory);
         // If root directory is specified, we better know about it by know -- ignore unknown relative paths
-        if (overlay == nullptr || overlay->Policy.GetCanonicalizedPath().IsNull())
+        if (overlay == nullptr || overlay->GetPathString() == nullptr)
         {
             return false;
         }
@@ -6307,7 +6829,8 @@ static bool PathFromObjectAttributes(POBJECT_ATTRIBUTES attributes, Canonicalize
     {
         // If there is no 'name' set (name is empty), just use the canonicalized path. Otherwise need to extend,
         // so '\' is appended to the canonicalized path and then the name is appended.
-        path = name.empty() ? overlay->Policy.GetCanonicalizedPath() : overlay->Policy.GetCanonicalizedPath().Extend(name.c_str());
+        CanonicalizedPath directoryPath = overlay->GetPolicy().GetCanonicalizedPath();
+        path = name.empty() ? directoryPath : directoryPath.Extend(name.c_str());
     }
     else
     {
@@ -6394,6 +6917,7 @@ NTSTATUS NTAPI Detoured_ZwCreateFile(
     _In_     ULONG              EaLength)
 {
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::ZwCreateFile, scope);
 
     // As a performance workaround, neuter the FILE_RANDOM_ACCESS hint (even if Detoured_IsDisabled() and there's another detoured API higher on the stack).
     // Prior investigations have shown that some tools do mention this hint, and as a result the cache manager holds on to pages more aggressively than
@@ -6685,8 +7209,9 @@ NTSTATUS NTAPI Detoured_ZwCreateFile(
     return result;
 }
 
-IMPLEMENTED(Detoured_NtCreateFile)
-NTSTATUS NTAPI Detoured_NtCreateFile(
+// Specialized over MonitorNtCreateFile and IgnoreReparsePoints, which are fixed once the manifest is parsed (see SelectDetoured_NtCreateFile)
+template <typename Flags>
+static NTSTATUS NTAPI Detoured_NtCreateFileT(
     _Out_    PHANDLE            FileHandle,
     _In_     ACCESS_MASK        DesiredAccess,
     _In_     POBJECT_ATTRIBUTES ObjectAttributes,
@@ -6700,6 +7225,7 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
     _In_     ULONG              EaLength)
 {
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::NtCreateFile, scope);
 
     // As a performance workaround, neuter the FILE_RANDOM_ACCESS hint (even if Detoured_IsDisabled() and there's another detoured API higher on the stack).
     // Prior investigations have shown that some tools do mention this hint, and as a result the cache manager holds on to pages more aggressively than
@@ -6772,7 +7298,7 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
         accessCheck = policyResult.CheckWriteAccess();
 
         // Note: The MonitorNtCreateFile() flag is temporary until OSG (we too) fixes all newly discovered dependencies.
-        if (accessCheck.Result != ResultAction::Allow && !MonitorNtCreateFile())
+        if (accessCheck.Result != ResultAction::Allow && !Flags::Check(FileAccessManifestFlag::MonitorNtCreateFile))
         {
             // TODO: As part of gradually turning on NtCreateFile detour reports, we currently only enforce deletes (some cmd builtins delete this way),
             //       and we ignore potential deletes on *directories* (specifically, robocopy likes to open target directories with delete access, without actually deleting them).
@@ -6887,7 +7413,7 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
             /*ref*/ opContext.OpenedFileOrDirectoryAttributes);
 
         // Note: The MonitorNtCreateFile() flag is temporary until OSG (we too) fixes all newly discovered dependencies.
-        if (MonitorNtCreateFile())
+        if (Flags::Check(FileAccessManifestFlag::MonitorNtCreateFile))
         {
             if (WantsReadAccess(opContext.DesiredAccess))
             {
@@ -6913,7 +7439,7 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
     readContext.OpenedDirectory = IsHandleOrPathToDirectory(*FileHandle, path.GetPathString(), opContext.DesiredAccess, CreateOptions, &policyResult, /*ref*/ opContext.OpenedFileOrDirectoryAttributes);
 
     // Note: The MonitorNtCreateFile() flag is temporary until OSG (we too) fixes all newly discovered dependencies.
-    if (MonitorNtCreateFile())
+    if (Flags::Check(FileAccessManifestFlag::MonitorNtCreateFile))
     {
         if (WantsReadAccess(opContext.DesiredAccess))
         {
@@ -6930,7 +7456,7 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
     bool isHandleToReparsePoint = (CreateOptions & FILE_OPEN_REPARSE_POINT) != 0;
     bool shouldReportAccessCheck = true;
 
-    bool shouldResolveReparsePointsInPath = ShouldResolveReparsePointsInPath(policyResult.GetCanonicalizedPath(), opContext.FlagsAndAttributes, policyResult);
+    bool shouldResolveReparsePointsInPath = !Flags::Check(FileAccessManifestFlag::IgnoreReparsePoints) && ShouldResolveReparsePointsInPath(policyResult.GetCanonicalizedPath(), opContext.FlagsAndAttributes, policyResult);
     if (shouldResolveReparsePointsInPath)
     {
         NTSTATUS ntStatus;
@@ -7003,6 +7529,28 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
     return result;
 }
 
+IMPLEMENTED(Detoured_NtCreateFile)
+NTSTATUS NTAPI Detoured_NtCreateFile(
+    _Out_    PHANDLE            FileHandle,
+    _In_     ACCESS_MASK        DesiredAccess,
+    _In_     POBJECT_ATTRIBUTES ObjectAttributes,
+    _Out_    PIO_STATUS_BLOCK   IoStatusBlock,
+    _In_opt_ PLARGE_INTEGER     AllocationSize,
+    _In_     ULONG              FileAttributes,
+    _In_     ULONG              ShareAccess,
+    _In_     ULONG              CreateDisposition,
+    _In_     ULONG              CreateOptions,
+    _In_opt_ PVOID              EaBuffer,
+    _In_     ULONG              EaLength)
+{
+    return Detoured_NtCreateFileT<RuntimeFamFlags>(FileHandle, DesiredAccess, ObjectAttributes, IoStatusBlock, AllocationSize, FileAttributes, ShareAccess, CreateDisposition, CreateOptions, EaBuffer, EaLength);
+}
+
+NtCreateFile_t SelectDetoured_NtCreateFile()
+{
+    return SELECT_SPECIALIZED_DETOUR(NtCreateFile, MonitorNtCreateFile, IgnoreReparsePoints);
+}
+
 IMPLEMENTED(Detoured_ZwOpenFile)
 NTSTATUS NTAPI Detoured_ZwOpenFile(
     _Out_ PHANDLE            FileHandle,
@@ -7076,7 +7624,9 @@ NTSTATUS NTAPI Detoured_NtClose(_In_ HANDLE handle)
     // This way the handle will never be assigned to a another object before removed from the map
     // (whenever the map is accessed, the closed handle list is drained).
 
-    if (!IsNullOrInvalidHandle(handle))
+    // Handles that never had an overlay (most of them: events, threads, registry keys, sections...) don't go near the
+    // overlay locks or the closed handle list.
+    if (!IsNullOrInvalidHandle(handle) && MayHaveHandleOverlay(handle))
     {
         if (MonitorNtCreateFile())
         {
@@ -7133,6 +7683,7 @@ BOOL WINAPI Detoured_DeviceIoControl(
 )
 {
     DetouredScope scope;
+    DetourProfileScope profile(ProfiledDetour::DeviceIoControl, scope);
 
     auto result = Real_DeviceIoControl(
         hDevice, dwIoControlCode, lpInBuffer, nInBufferSize, lpOutBuffer, nOutBufferSize, lpBytesReturned, lpOverlapped);
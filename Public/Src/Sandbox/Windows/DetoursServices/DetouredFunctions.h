@@ -602,6 +602,13 @@ BOOL WINAPI Detoured_DeviceIoControl(
   _Out_               LPOVERLAPPED lpOverlapped
 );
 
+// Return the version of the detour specialized for the flags of the manifest, which must have been parsed already.
+// Detoured_X behaves the same but checks the flags on every call.
+CreateFileW_t SelectDetoured_CreateFileW();
+GetFileAttributesW_t SelectDetoured_GetFileAttributesW();
+NtQueryDirectoryFile_t SelectDetoured_NtQueryDirectoryFile();
+NtCreateFile_t SelectDetoured_NtCreateFile();
+
 /*
 
 // ---------------------------
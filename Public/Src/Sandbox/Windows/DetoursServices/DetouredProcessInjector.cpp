@@ -39,10 +39,19 @@ void DetouredProcessInjector::Clear()
 {
     _initialized = false;
     _mapDirectory.reset();
+    _runsUnderMapDirectory = false;
     _remoteInjectorPipe.reset();
     _reportPipe.reset();
     _payload.reset(nullptr);
     _payloadSize = 0;
+    _inheritedHandlesPayloadWrapper.reset(nullptr);
+    if (_payloadSectionView != nullptr)
+    {
+        UnmapViewOfFile(_payloadSectionView);
+        _payloadSectionView = nullptr;
+    }
+    _payloadSection.reset();
+    _payloadSectionCreationAttempted = false;
     _otherHandles.clear();
     _dllX64.clear();
     _dllX86.clear();
@@ -53,7 +62,8 @@ void DetouredProcessInjector::Clear()
 // uint32_t handleCount - the number of handles
 // uint64_t handles - handles passed from the parent.
 //                    There must be c_minHandleCount handles there.
-// payload
+// payload          - unless the payload section handle is valid, in which case
+//                    the payload is in the section
 bool DetouredProcessInjector::Init(LPCBYTE payloadWrapper, std::wstring& errorMessage, _Out_ LPCBYTE* payload, _Out_ uint32_t& payloadSize)
 {
     errorMessage = L"";
@@ -112,8 +122,11 @@ bool DetouredProcessInjector::Init(LPCBYTE payloadWrapper, std::wstring& errorMe
     // Compute the size remaining after the handles are copied
     size -= handleCount * sizeof(uint64_t);
     _mapDirectory.reset(Uint64ToHandle(*handles++));
+    // Injecting a process fails if the map directory cannot be applied to it, so if there is one we run under it
+    _runsUnderMapDirectory = _mapDirectory.isValid();
     _remoteInjectorPipe.reset(Uint64ToHandle(*handles++));
     _reportPipe.reset(Uint64ToHandle(*handles++));
+    _payloadSection.reset(Uint64ToHandle(*handles++));
 
     handleCount -= c_minHandleCount;
 
@@ -129,8 +142,27 @@ bool DetouredProcessInjector::Init(LPCBYTE payloadWrapper, std::wstring& errorMe
         }
     }
 
+    if (_payloadSection.isValid())
+    {
+        // The payload is shared by the process tree: map it rather than copying it.
+        // Processes started from this one get the section handle as well.
+        _payloadSectionView = reinterpret_cast<LPCBYTE>(MapViewOfFile(_payloadSection.get(), FILE_MAP_READ, 0, 0, 0));
+        if (_payloadSectionView == nullptr)
+        {
+            errorMessage = L"Failed to map the payload section: ";
+            errorMessage += std::to_wstring(GetLastError());
+
+            return false;
+        }
+
+        _payloadSize = *reinterpret_cast<const uint32_t *>(_payloadSectionView);
+        _payloadSectionCreationAttempted = true;
+
+        *payload = Payload();
+        payloadSize = _payloadSize;
+    }
     // Copy payload immediately only if this process is not WOW64 process.
-    if (!s_isWow64Process)
+    else if (!s_isWow64Process)
     {
         _payloadSize = size;
 
@@ -194,7 +226,7 @@ void DetouredProcessInjector::Init(
 
 void DetouredProcessInjector::SetPayload(LPCBYTE payload, uint32_t payloadSize)
 {
-    if (_payload.get() != nullptr)
+    if (Payload() != nullptr)
     {
         // Payload can be set only once.
         return;
@@ -234,13 +266,121 @@ void DetouredProcessInjector::SetHandles(uint32_t otherHandleCount, PHANDLE othe
     }
 }
 
-DWORD DetouredProcessInjector::LocalInjectProcess(HANDLE processHandle, bool inheritedHandles)
+void DetouredProcessInjector::EnsurePayloadSection()
 {
     LockGuard lock(_injectorLock);
 
+    if (_payloadSectionCreationAttempted)
+    {
+        return;
+    }
+
+    // Whatever happens, the wrapper size must not change after the first injection
+    _payloadSectionCreationAttempted = true;
+
+    if (_payloadSize == 0)
+    {
+        return;
+    }
+
+    // Inheritable, like the rest of the handles in the wrapper
+    SECURITY_ATTRIBUTES securityAttributes = { sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+    uint64_t sectionSize = static_cast<uint64_t>(c_payloadSectionHeaderSize) + _payloadSize;
+    unique_handle<nullptr> section(CreateFileMappingW(
+        INVALID_HANDLE_VALUE,
+        &securityAttributes,
+        PAGE_READWRITE,
+        static_cast<DWORD>(sectionSize >> 32),
+        static_cast<DWORD>(sectionSize & UINT32_MAX),
+        nullptr));
+
+    if (!section.isValid())
+    {
+        Dbg(L"DetouredProcessInjector::EnsurePayloadSection: Failed to create the payload section (error code: 0x%08x)", (int)GetLastError());
+        return;
+    }
+
+    unsigned char* view = reinterpret_cast<unsigned char *>(MapViewOfFile(section.get(), FILE_MAP_WRITE, 0, 0, 0));
+    if (view == nullptr)
+    {
+        Dbg(L"DetouredProcessInjector::EnsurePayloadSection: Failed to map the payload section (error code: 0x%08x)", (int)GetLastError());
+        return;
+    }
+
+    *reinterpret_cast<uint32_t *>(view) = _payloadSize;
+    memcpy_s(view + c_payloadSectionHeaderSize, _payloadSize, Payload(), _payloadSize);
+    UnmapViewOfFile(view);
+
+    // Injected processes only ever get read access to the section
+    HANDLE readOnlySection;
+    if (!DuplicateHandle(GetCurrentProcess(), section.get(), GetCurrentProcess(), &readOnlySection, FILE_MAP_READ, TRUE, 0))
+    {
+        Dbg(L"DetouredProcessInjector::EnsurePayloadSection: Failed to duplicate the payload section handle (error code: 0x%08x)", (int)GetLastError());
+        return;
+    }
+
+    _payloadSection.reset(readOnlySection);
+}
+
+unsigned char* DetouredProcessInjector::WriteWrapperHeader(unsigned char* wrapper, HANDLE processHandle, bool inheritedHandles) const
+{
+    // Write sizes
+    uint32_t *sizes = reinterpret_cast<uint32_t *>(wrapper);
+    *sizes++ = WrapperSize();
+    *sizes++ = static_cast<uint32_t>(c_minHandleCount + _otherHandles.size());
+
+    // Write handles
+    uint64_t *handles = reinterpret_cast<uint64_t *>(sizes);
+    *handles++ = inheritedHandles ? HandleToUint64(_mapDirectory.get()) : DuplicateHandleToUint64(processHandle, _mapDirectory.get());
+    *handles++ = inheritedHandles ? HandleToUint64(_remoteInjectorPipe.get()) : DuplicateHandleToUint64(processHandle, _remoteInjectorPipe.get());
+    *handles++ = inheritedHandles ? HandleToUint64(_reportPipe.get()) : DuplicateHandleToUint64(processHandle, _reportPipe.get());
+    *handles++ = inheritedHandles ? HandleToUint64(_payloadSection.get()) : DuplicateHandleToUint64(processHandle, _payloadSection.get());
+
+    if (!_otherHandles.empty())
+    {
+        for (auto i : _otherHandles)
+        {
+            *handles++ = inheritedHandles ? HandleToUint64(i) : DuplicateHandleToUint64(processHandle, i);
+        }
+    }
+
+    return reinterpret_cast<unsigned char *>(handles);
+}
+
+const unsigned char* DetouredProcessInjector::GetInheritedHandlesPayloadWrapper()
+{
+    LockGuard lock(_injectorLock);
+
+    if (_inheritedHandlesPayloadWrapper == nullptr)
+    {
+        // Inherited handles keep their values in the child, so the wrapper is the same for all of them
+        unique_ptr<unsigned char[]> wrapper = make_unique<unsigned char[]>(WrapperSize());
+        unsigned char* payload = WriteWrapperHeader(wrapper.get(), INVALID_HANDLE_VALUE, /* inheritedHandles */ true);
+        if (memcpy_s(payload, WrappedPayloadSize(), Payload(), WrappedPayloadSize()) != 0)
+        {
+            return nullptr;
+        }
+
+        _inheritedHandlesPayloadWrapper = std::move(wrapper);
+    }
+
+    return _inheritedHandlesPayloadWrapper.get();
+}
+
+DWORD DetouredProcessInjector::LocalInjectProcess(HANDLE processHandle, bool inheritedHandles, ProcessInjectionTimings* timings)
+{
+    LARGE_INTEGER stageStart;
+    QueryPerformanceCounter(&stageStart);
+
     // Install detours
     LPCSTR dll = isWow64Process(processHandle) ? _dllX86.data() : _dllX64.data();
-    if (!DetourUpdateProcessWithDll(processHandle, &dll, 1))
+    BOOL importsUpdated = DetourUpdateProcessWithDll(processHandle, &dll, 1);
+    if (timings != nullptr)
+    {
+        timings->UpdateImportsMicroseconds = MicrosecondsSince(stageStart);
+    }
+
+    if (!importsUpdated)
     {
         DWORD err = GetLastError();
         Dbg(L"DetouredProcessInjector::LocalInjectProcess: Failed to inject %S from %s process into %s process (error code: 0x%08x)",
@@ -248,7 +388,17 @@ DWORD DetouredProcessInjector::LocalInjectProcess(HANDLE processHandle, bool inh
         return err;
     }
 
-    if (_mapDirectory.isValid() && !ApplyMapping(processHandle, _mapDirectory.get()))
+    QueryPerformanceCounter(&stageStart);
+    // A process created without extended startup information has this one as its parent and inherits its device map,
+    // so the object manager work of applying the same map directory again is skipped.
+    bool mappingInherited = _runsUnderMapDirectory && inheritedHandles;
+    bool mappingFailed = _mapDirectory.isValid() && !mappingInherited && !ApplyMapping(processHandle, _mapDirectory.get());
+    if (timings != nullptr)
+    {
+        timings->ApplyMappingMicroseconds = MicrosecondsSince(stageStart);
+    }
+
+    if (mappingFailed)
     {
         DWORD err = GetLastError();
         Dbg(L"DetouredProcessInjector::LocalInjectProcess: Failed to apply mapping handle %d from %s to %s process (error code: 0x%08x)",
@@ -258,38 +408,49 @@ DWORD DetouredProcessInjector::LocalInjectProcess(HANDLE processHandle, bool inh
         return err;
     }
 
-    // Allocate space for the payload wrapper.
-    uint32_t size = WrapperSize();
-    std::unique_ptr<unsigned char[]> payloadWrapper = make_unique<unsigned char[]>(size);
-
-    // Write sizes
-    uint32_t *sizes = reinterpret_cast<uint32_t *>(payloadWrapper.get());
-    *sizes++ = size;
-    *sizes++ = static_cast<uint32_t>(c_minHandleCount + _otherHandles.size());
+    QueryPerformanceCounter(&stageStart);
+    if (_sharePayloadSection)
+    {
+        EnsurePayloadSection();
+    }
 
-    // Write handles
-    uint64_t *handles = reinterpret_cast<uint64_t *>(sizes);
-    *handles++ = inheritedHandles ? HandleToUint64(_mapDirectory.get()) : DuplicateHandleToUint64(processHandle, _mapDirectory.get());
-    *handles++ = inheritedHandles ? HandleToUint64(_remoteInjectorPipe.get()) : DuplicateHandleToUint64(processHandle, _remoteInjectorPipe.get());
-    *handles++ = inheritedHandles ? HandleToUint64(_reportPipe.get()) : DuplicateHandleToUint64(processHandle, _reportPipe.get());
+    uint32_t size = WrapperSize();
+    std::unique_ptr<unsigned char[]> payloadWrapper = nullptr;
+    const unsigned char* wrapperToCopy;
 
-    if (!_otherHandles.empty())
+    if (inheritedHandles)
     {
-        for (auto i : _otherHandles)
+        wrapperToCopy = GetInheritedHandlesPayloadWrapper();
+        if (wrapperToCopy == nullptr)
         {
-            *handles++ = inheritedHandles ? HandleToUint64(i) : DuplicateHandleToUint64(processHandle, i);
+            Dbg(L"DetouredProcessInjector::LocalInjectProcess: Failed to do memcpy building the payload wrapper");
+            return ERROR_PARTIAL_COPY;
+        }
+    }
+    else
+    {
+        // The handles are duplicated into every process, so the wrapper is built for each one of them
+        payloadWrapper = make_unique<unsigned char[]>(size);
+        unsigned char* payload = WriteWrapperHeader(payloadWrapper.get(), processHandle, inheritedHandles);
+
+        // Copy payload
+        errno_t memcpyerror = memcpy_s(payload, WrappedPayloadSize(), Payload(), WrappedPayloadSize());
+        if (memcpyerror != 0)
+        {
+            Dbg(L"DetouredProcessInjector::LocalInjectProcess: Failed to do memcpy (error code: 0x%08x)", (int)memcpyerror);
+            return ERROR_PARTIAL_COPY;
         }
+
+        wrapperToCopy = payloadWrapper.get();
     }
 
-    // Copy payload
-    errno_t memcpyerror = memcpy_s(handles, _payloadSize, _payload.get(), _payloadSize);
-    if (memcpyerror != 0)
+    BOOL payloadCopied = DetourCopyPayloadToProcess(processHandle, _payloadGuid, const_cast<unsigned char*>(wrapperToCopy), size);
+    if (timings != nullptr)
     {
-        Dbg(L"DetouredProcessInjector::LocalInjectProcess: Failed to do memcpy (error code: 0x%08x)", (int)memcpyerror);
-        return ERROR_PARTIAL_COPY;
+        timings->CopyPayloadMicroseconds = MicrosecondsSince(stageStart);
     }
 
-    if (!DetourCopyPayloadToProcess(processHandle, _payloadGuid, payloadWrapper.get(), size))
+    if (!payloadCopied)
     {
         DWORD err = GetLastError();
         Dbg(L"DetouredProcessInjector::LocalInjectProcess: Failed to copy payload to process (error code: 0x%08x)", (int)err);
@@ -299,7 +460,7 @@ DWORD DetouredProcessInjector::LocalInjectProcess(HANDLE processHandle, bool inh
     return ERROR_SUCCESS;
 }
 
-DWORD DetouredProcessInjector::RemoteInjectProcess(HANDLE processHandle, bool inheritedHandles) const
+DWORD DetouredProcessInjector::RemoteInjectProcess(HANDLE processHandle, bool inheritedHandles, ProcessInjectionTimings* timings) const
 {
     DWORD processId = GetProcessId(processHandle);
 
@@ -393,8 +554,15 @@ DWORD DetouredProcessInjector::RemoteInjectProcess(HANDLE processHandle, bool in
     }
 
     ULONGLONG startWait = GetTickCount64();
+    LARGE_INTEGER waitStart;
+    QueryPerformanceCounter(&waitStart);
     DWORD result = WaitForMultipleObjects(2, events, FALSE, g_injectionTimeoutInMinutes * 60000); // Convert to ms.
     ULONGLONG endWait = GetTickCount64();
+    if (timings != nullptr)
+    {
+        timings->RemoteInjectionMicroseconds = MicrosecondsSince(waitStart);
+    }
+
     if (((endWait - startWait) / 60000) > (g_injectionTimeoutInMinutes - 1))
     {
         Dbg(L"DetouredProcessInjector::RemoteInjectProcess: Wait time > %d min. - %d min.", g_injectionTimeoutInMinutes, (int)((endWait - startWait) / 60000));
@@ -9,6 +9,19 @@ using std::unique_ptr;
 using std::vector;
 using std::string;
 
+// Time spent in each stage of detouring a process, in microseconds. Stages that didn't run are 0.
+struct ProcessInjectionTimings
+{
+    // Adding the detours DLL to the imports of the process
+    LONG64 UpdateImportsMicroseconds;
+    // Applying the drive mappings to the process
+    LONG64 ApplyMappingMicroseconds;
+    // Duplicating handles into the process and copying the payload to it
+    LONG64 CopyPayloadMicroseconds;
+    // Waiting for the injection requested from the remote injector
+    LONG64 RemoteInjectionMicroseconds;
+};
+
 // This class does drive mapping and injection of payload and DLL into
 // a process. It may do it directly or remotely. The remote injection
 // is required when a WOW64 process creates a child. Exact conditions
@@ -30,16 +43,32 @@ private:
     static bool s_is64BitProcess;
 
     // Minimum number of handles required
-    static const uint32_t c_minHandleCount = 3;
+    static const uint32_t c_minHandleCount = 4;
+
+    // The payload section starts with the size of the payload, padded to keep the payload aligned
+    static const uint32_t c_payloadSectionHeaderSize = 16;
 
     static const uint32_t c_buildxlInjectorTag = 0xD031B09E;      // DOMIno BONE
 
     // We own these handles
     unique_handle<INVALID_HANDLE_VALUE> _mapDirectory;
+    // Whether this process already runs under _mapDirectory. The injector that created this process applied it before
+    // the process started, and processes created by this one with this process as their parent inherit it.
+    bool _runsUnderMapDirectory = false;
     unique_handle<INVALID_HANDLE_VALUE> _remoteInjectorPipe;
     unique_handle<INVALID_HANDLE_VALUE> _reportPipe;
     unique_ptr<unsigned char[]> _payload = nullptr;
     uint32_t _payloadSize = 0;
+    // A read-only section with the payload, shared by all the processes below the one that created it.
+    // When valid, the payload wrapper carries this handle instead of the payload.
+    unique_handle<INVALID_HANDLE_VALUE> _payloadSection;
+    // The view of _payloadSection, when this process got its payload from it
+    LPCBYTE _payloadSectionView = nullptr;
+    bool _sharePayloadSection = false;
+    bool _payloadSectionCreationAttempted = false;
+    // The payload wrapped along with the handles of this process, built on the first injection of a process
+    // that inherits all of them so that further ones copy it straight to the process
+    unique_ptr<unsigned char[]> _inheritedHandlesPayloadWrapper = nullptr;
     vector<HANDLE> _otherHandles;
     string _dllX86;
     string _dllX64;
@@ -103,13 +132,28 @@ private:
     }
 #pragma warning( pop )
 
+    // Size of the payload as it goes in the wrapper, which has none when the payload is shared through a section
+    uint32_t inline WrappedPayloadSize() const
+    {
+        return _payloadSection.isValid() ? 0 : _payloadSize;
+    }
+
     // Given all data, compute the size of the wrapped payload
     uint32_t inline WrapperSize() const
     {
         // The data must contain the size, handle count, the handles, and the payload
-        return static_cast<uint32_t>(2 * sizeof(uint32_t) + (c_minHandleCount + _otherHandles.size()) * sizeof(uint64_t) + _payloadSize);
+        return static_cast<uint32_t>(2 * sizeof(uint32_t) + (c_minHandleCount + _otherHandles.size()) * sizeof(uint64_t) + WrappedPayloadSize());
     }
 
+    // Create _payloadSection from the payload, once. Failing to do so just means the payload keeps being copied.
+    void EnsurePayloadSection();
+
+
+    // Write the sizes and the handles (duplicated into processHandle unless inheritedHandles) of the payload wrapper.
+    // Returns where the payload goes.
+    unsigned char* WriteWrapperHeader(unsigned char* wrapper, HANDLE processHandle, bool inheritedHandles) const;
+
+    const unsigned char* GetInheritedHandlesPayloadWrapper();
 
     // Clear the object (free memory, etc.)
     void Clear();
@@ -126,6 +170,11 @@ public:
 
     ~DetouredProcessInjector()
     {
+        if (_payloadSectionView != nullptr)
+        {
+            UnmapViewOfFile(_payloadSectionView);
+        }
+
         DeleteCriticalSection(&_injectorLock);
     }
 
@@ -149,6 +198,12 @@ public:
         _alwaysRemoteInjectFromWow64Process = alwaysRemoteInjectFromWow64Process;
     }
 
+    // When set, the first local injection puts the payload in a read-only section that every injected process maps
+    void inline SetSharePayloadSection(bool sharePayloadSection)
+    {
+        _sharePayloadSection = sharePayloadSection;
+    }
+
     // Set "other" handles. These are duplicated if needed.
     void SetHandles(uint32_t otherHandleCount, PHANDLE otherHandles);
 
@@ -164,7 +219,7 @@ public:
     HANDLE MapDirectory() const { return _mapDirectory.get(); }
     HANDLE RemoteInjectorPipe() const { return _remoteInjectorPipe.get(); }
     HANDLE ReportPipe() const { return _reportPipe.get(); }
-    LPCBYTE Payload() const { return _payload.get(); }
+    LPCBYTE Payload() const { return _payloadSectionView != nullptr ? _payloadSectionView + c_payloadSectionHeaderSize : _payload.get(); }
     uint32_t PayloadSize() const { return _payloadSize; }
     uint32_t OtherHandleCount() const { return static_cast<uint32_t>(_otherHandles.size()); }
     const HANDLE *OtherHandles() const { return _otherHandles.data(); }
@@ -176,17 +231,24 @@ public:
     //                      When false, none or only some handles
     //                      are inherited. The handles stored in
     //                      the object need to be duplicated.
-    DWORD LocalInjectProcess(HANDLE processHandle, bool inheritedHandles);
+    //                      When true, the process also inherits the
+    //                      device map of this one, so the mapping is
+    //                      not applied again if this process runs
+    //                      under it.
+    //   timings - when not null, gets the time spent in each stage.
+    // Once initialized the object is read-only, so processes can be injected
+    // from several threads at once.
+    DWORD LocalInjectProcess(HANDLE processHandle, bool inheritedHandles, ProcessInjectionTimings* timings = nullptr);
     // This method will ask for the remote injection
-    DWORD RemoteInjectProcess(HANDLE processHandle, bool inheritedHandles) const;
+    DWORD RemoteInjectProcess(HANDLE processHandle, bool inheritedHandles, ProcessInjectionTimings* timings = nullptr) const;
 
     // Do either local or remote injection, depending on bitness of the
     // injector and injectee processes.
-    DWORD InjectProcess(HANDLE processHandle, bool inheritedHandles)
+    DWORD InjectProcess(HANDLE processHandle, bool inheritedHandles, ProcessInjectionTimings* timings = nullptr)
     {
         return NeedRemoteInjection(processHandle)
-            ? RemoteInjectProcess(processHandle, inheritedHandles)
-            : LocalInjectProcess(processHandle, inheritedHandles);
+            ? RemoteInjectProcess(processHandle, inheritedHandles, timings)
+            : LocalInjectProcess(processHandle, inheritedHandles, timings);
     }
 
     // No default constructor, no copies
@@ -13,7 +13,11 @@
 #include "DeviceMap.h"
 #include "CanonicalizedPath.h"
 #include "PolicyResult.h"
-#include <list>
+#include "ImagePathCache.h"
+#include "ResolvedPathCache.h"
+#include "FilesCheckedForAccess.h"
+#include "SpecialCaseMatcher.h"
+#include "TranslatePathTrie.h"
 #include <string>
 #include <stdio.h>
 #include <stack>
@@ -48,178 +52,105 @@ void TranslateFilePath(_In_ const std::wstring& inFileName, _Out_ std::wstring&
     }
 
     CanonicalizedPath canonicalizedPath = CanonicalizedPath::Canonicalize(inFileName.c_str());
-    std::wstring tempStr(canonicalizedPath.GetPathString());
+    const wchar_t* path = canonicalizedPath.GetPathStringWithoutTypePrefix();
 
     // If the canonicalized string is null or empty, just return. No need to do anything.
-    if (tempStr.empty() || tempStr.c_str() == nullptr)
+    if (path == nullptr || *path == L'\0')
     {
         return;
     }
 
-    const std::wstring prefix(L"\\??\\");
-    bool hasPrefix = !tempStr.compare(0, prefix.size(), prefix);
-
-    const std::wstring prefixNt(L"\\\\?\\");
-    bool hasPrefixNt = !tempStr.compare(0, prefixNt.size(), prefixNt);
-
-    tempStr.assign(canonicalizedPath.GetPathStringWithoutTypePrefix());
-
-    bool translated = false;
-    bool needsTranslation = true;
+    const size_t typePrefixLength = path - canonicalizedPath.GetPathString();
+    const size_t pathLength = canonicalizedPath.Length() - typePrefixLength;
 
     if (debug)
     {
-        Dbg(L"TranslateFilePath-0: initial: '%s'", tempStr.c_str());
+        Dbg(L"TranslateFilePath-0: initial: '%s'", path);
     }
 
-    std::list<TranslatePathTuple*> manifestTranslatePathTuples(g_pManifestTranslatePathTuples->begin(), g_pManifestTranslatePathTuples->end());
-
-    while (needsTranslation)
+    // Each translation applies at most once, always the one with the longest path to translate from first.
+    // Nothing gets allocated unless some translation applies.
+    std::vector<bool> usedTranslations;
+    size_t translationId;
+    size_t matchLength = g_pManifestTranslatePathTrie->FindLongestPrefix(path, pathLength, usedTranslations, translationId);
+    if (matchLength == 0)
     {
-        needsTranslation = false;
-        size_t longestPath = 0;
-        std::list<TranslatePathTuple*>::iterator replacementIt;
-
-        std::wstring lowCaseFinalPath(tempStr);
-        for (basic_string<wchar_t>::iterator p = lowCaseFinalPath.begin();
-            p != lowCaseFinalPath.end(); ++p) {
-            *p = towlower(*p);
-        }
+        return;
+    }
 
-        // Find the longest path that can be used for translation from the g_pManifestTranslatePathTuples list.
-        // Note: The g_pManifestTranslatePathTuples always comes canonicalized from the managed code.
-        for (std::list<TranslatePathTuple*>::iterator it = manifestTranslatePathTuples.begin(); it != manifestTranslatePathTuples.end(); ++it)
-        {
-            TranslatePathTuple* tpTuple = *it;
-            const std::wstring& lowCaseTargetPath = tpTuple->GetFromPath();
-            size_t targetLen = lowCaseTargetPath.length();
-            bool mayBeDirectoryPath = false;
+    const wchar_t prefix[] = L"\\??\\";
+    bool hasPrefix = !wcsncmp(canonicalizedPath.GetPathString(), prefix, _countof(prefix) - 1);
 
-            int comp = lowCaseFinalPath.compare(0, targetLen, lowCaseTargetPath);
-            if (debug)
-            {
-                Dbg(L"TranslateFilePath-.5: comparing: '%ws' and %ws", lowCaseFinalPath.c_str(), lowCaseTargetPath.c_str());
-            }
+    const wchar_t prefixNt[] = L"\\\\?\\";
+    bool hasPrefixNt = !wcsncmp(canonicalizedPath.GetPathString(), prefixNt, _countof(prefixNt) - 1);
 
-            if (comp != 0)
-            {
-                // The path to be translated can be a directory path that does not have trailing '\\'.
+    std::wstring tempStr(path, pathLength);
+    usedTranslations.resize(g_pManifestTranslatePathTuples->size());
 
-                if (lowCaseFinalPath.back() != L'\\'
-                    && lowCaseTargetPath.back() == L'\\'
-                    && lowCaseFinalPath.length() == (targetLen - 1))
-                {
-                    std::wstring lowCaseFinalPathWithBs = lowCaseFinalPath + L'\\';
-                    comp = lowCaseFinalPathWithBs.compare(0, targetLen, lowCaseTargetPath);
-                    mayBeDirectoryPath = true;
-                }
-            }
+    while (matchLength != 0)
+    {
+        TranslatePathTuple* replacementTuple = (*g_pManifestTranslatePathTuples)[translationId];
 
-            if (comp == 0)
-            {
-                if (longestPath < targetLen)
-                {
-                    replacementIt = it;
-                    longestPath = !mayBeDirectoryPath ? targetLen : targetLen - 1;
-                    translated = true;
-                    needsTranslation = true;
-                }
-            }
-        }
+        std::wstring t(replacementTuple->GetToPath());
+        t.append(tempStr, matchLength);
 
-        // Translate using the longest translation path.
-        if (needsTranslation)
+        if (debug)
         {
-            TranslatePathTuple* replacementTuple = *replacementIt;
-
-            std::wstring t(replacementTuple->GetToPath());
-            t.append(tempStr, longestPath);
-
-            if (debug)
-            {
-                Dbg(
-                    L"TranslateFilePath-1: from: '%s', to '%s' (used mapping: '%s' --> '%s')",
-                    tempStr.c_str(),
-                    t.c_str(),
-                    replacementTuple->GetFromPath().c_str(),
-                    replacementTuple->GetToPath().c_str());
-            }
-
-            tempStr.assign(t);
-            manifestTranslatePathTuples.erase(replacementIt);
+            Dbg(
+                L"TranslateFilePath-1: from: '%s', to '%s' (used mapping: '%s' --> '%s')",
+                tempStr.c_str(),
+                t.c_str(),
+                replacementTuple->GetFromPath().c_str(),
+                replacementTuple->GetToPath().c_str());
         }
+
+        tempStr.swap(t);
+        usedTranslations[translationId] = true;
+        matchLength = g_pManifestTranslatePathTrie->FindLongestPrefix(tempStr.c_str(), tempStr.length(), usedTranslations, translationId);
     }
 
-    if (translated)
+    if (hasPrefix)
+    {
+        outFileName.assign(prefix);
+    }
+    else
     {
-        if (hasPrefix)
+        if (hasPrefixNt)
         {
-            outFileName.assign(prefix);
+            outFileName.assign(prefixNt);
         }
         else
         {
-            if (hasPrefixNt)
-            {
-                outFileName.assign(prefixNt);
-            }
-            else
-            {
-                outFileName.assign(L"");
-            }
-        }
-
-        outFileName.append(tempStr);
-
-        if (debug)
-        {
-            Dbg(L"TranslateFilePath-2: final: '%s' --> '%s'", inFileName.c_str(), outFileName.c_str());
+            outFileName.assign(L"");
         }
     }
-}
 
-bool GetSpecialCaseRulesForWindows(
-    __in  PCWSTR absolutePath,
-    __in  size_t absolutePathLength,
-    __out FileAccessPolicy& policy)
-{
-    assert(absolutePath);
-    assert(absolutePathLength == wcslen(absolutePath));
+    outFileName.append(tempStr);
 
-    size_t rootLength = GetRootLength(absolutePath);
-    if (HasPrefix(absolutePath + rootLength, L"$Extend\\$Deleted"))
+    if (debug)
     {
-        // Windows can have an "unlink" behavior where deleted files are not really deleted if there's an opened handle.
-        // This behavior is possible because a process can open a file with FILE_SHARE_DELETE that makes other processes able to delete it.
-        // If a file is opened by specifying the FILE_SHARE_DELETE flag for the CreateFile function and another process tries to delete it,
-        // the file is actually moved to the \$Extend\$Deleted directory on the same volume. When the last handle to such a file is closed,
-        // it's deleted as usual. When the file system is mounted, all existing files in the \$Extend\$Deleted directory, if any, are deleted,
-        // The same logic also applies to deleted directories.
-        // Details can be found in this unofficial documentation: https://dfir.ru/2020/03/21/the-extenddeleted-directory/
-#if SUPER_VERBOSE
-        Dbg(L"special case: files in staged deletion: %s", absolutePath);
-#endif // SUPER_VERBOSE
-        policy = FileAccessPolicy::FileAccessPolicy_AllowAll;
-        return true;
+        Dbg(L"TranslateFilePath-2: final: '%s' --> '%s'", inFileName.c_str(), outFileName.c_str());
     }
-
-    return false;
 }
 
-// Some perform file accesses, which don't yet fall into any configurable file access manifest category.
-// These files now can be allowlisted, but there are already users deployed without the allowlisting feature
-// that rely on these file accesses not blocked.
-// These are some tools that use internal files or do some implicit directory creation, etc.
-// In this list the tools are the CCI based set of products, csc compiler, resource compiler, build.exe trace log, etc.
-// For such tools we allow file accesses on the special file patterns and report the access to BuildXL. BuildXL filters these
-// accesses, but makes sure that there are reports for these accesses if some of them are declared as outputs.
-bool GetSpecialCaseRulesForSpecialTools(
-    __in  PCWSTR absolutePath,
-    __in  size_t absolutePathLength,
-    __out FileAccessPolicy& policy)
+SpecialCaseMatcher* CreateSpecialCaseMatcher()
 {
-    assert(absolutePath);
-    assert(absolutePathLength == wcslen(absolutePath));
+    SpecialCaseMatcher* matcher = new SpecialCaseMatcher();
+
+    // When running test cases with Code Coverage enabled, some more files are loaded that we should ignore
+    if (IgnoreCodeCoverage()) {
+        matcher->AddSuffix(L".pdb", SpecialCaseMatcher::CodeCoverageFile);
+        matcher->AddSuffix(L".nls", SpecialCaseMatcher::CodeCoverageFile);
+        matcher->AddSuffix(L".dll", SpecialCaseMatcher::CodeCoverageFile);
+    }
 
+    // Some tools perform file accesses, which don't yet fall into any configurable file access manifest category.
+    // These files now can be allowlisted, but there are already users deployed without the allowlisting feature
+    // that rely on these file accesses not blocked.
+    // These are some tools that use internal files or do some implicit directory creation, etc.
+    // In this list the tools are the CCI based set of products, csc compiler, resource compiler, build.exe trace log, etc.
+    // For such tools we allow file accesses on the special file patterns and report the access to BuildXL. BuildXL filters these
+    // accesses, but makes sure that there are reports for these accesses if some of them are declared as outputs.
     switch (GetProcessKind())
     {
     case SpecialProcessKind::Csc:
@@ -227,39 +158,18 @@ bool GetSpecialCaseRulesForSpecialTools(
     case SpecialProcessKind::Resonexe:
         // Some tools emit temporary files into the same directory
         // as the final output file.
-        if (HasSuffix(absolutePath, absolutePathLength, L".tmp")) {
-#if SUPER_VERBOSE
-            Dbg(L"special case: temp file: %s", absolutePath);
-#endif // SUPER_VERBOSE
-            int intPolicy = (int)policy | (int)FileAccessPolicy_AllowAll;
-            policy = (FileAccessPolicy)intPolicy;
-            return true;
-        }
+        matcher->AddSuffix(L".tmp", SpecialCaseMatcher::SpecialToolFile);
         break;
 
     case SpecialProcessKind::RC:
         // The native resource compiler (RC) emits temporary files into the same
         // directory as the final output file.
-        if (StringLooksLikeRCTempFile(absolutePath, absolutePathLength)) {
-#if SUPER_VERBOSE
-            Dbg(L"special case: temp file: %s", absolutePath);
-#endif // SUPER_VERBOSE
-            int intPolicy = (int)policy | (int)FileAccessPolicy_AllowAll;
-            policy = (FileAccessPolicy)intPolicy;
-            return true;
-        }
+        matcher->MatchRCTempFiles();
         break;
 
     case SpecialProcessKind::Mt:
         // The Mt tool emits temporary files into the same directory as the final output file.
-        if (StringLooksLikeMtTempFile(absolutePath, absolutePathLength, L".tmp")) {
-#if SUPER_VERBOSE
-            Dbg(L"special case: temp file: %s", absolutePath);
-#endif // SUPER_VERBOSE
-            int intPolicy = (int)policy | (int)FileAccessPolicy_AllowAll;
-            policy = (FileAccessPolicy)intPolicy;
-            return true;
-        }
+        matcher->MatchMtTempFiles();
         break;
 
     case SpecialProcessKind::CCCheck:
@@ -268,14 +178,7 @@ bool GetSpecialCaseRulesForSpecialTools(
     case SpecialProcessKind::CCRewrite:
         // The cc-line of tools like to find pdb files by using the pdb path embedded in a dll/exe.
         // If the dll/exe was built with different roots, then this results in somewhat random file accesses.
-        if (HasSuffix(absolutePath, absolutePathLength, L".pdb")) {
-#if SUPER_VERBOSE
-            Dbg(L"special case: pdb file: %s", absolutePath);
-#endif // SUPER_VERBOSE
-            int intPolicy = (int)policy | (int)FileAccessPolicy_AllowAll;
-            policy = (FileAccessPolicy)intPolicy;
-            return true;
-        }
+        matcher->AddSuffix(L".pdb", SpecialCaseMatcher::SpecialToolFile);
         break;
 
     case SpecialProcessKind::WinDbg:
@@ -285,25 +188,20 @@ bool GetSpecialCaseRulesForSpecialTools(
     }
 
     // build.exe and tracelog.dll capture dependency information in temporary files in the object root called _buildc_dep_out.<pass#>
-    if (StringLooksLikeBuildExeTraceLog(absolutePath, absolutePathLength)) {
-        int intPolicy = (int)policy | (int)FileAccessPolicy_AllowAll;
-        policy = (FileAccessPolicy)intPolicy;
-#if SUPER_VERBOSE
-        Dbg(L"Build.exe trace log path: %s", absolutePath);
-#endif // SUPER_VERBOSE
-        return true;
-    }
+    matcher->AddSuffixBeforeDigits(BUILD_EXE_TRACE_FILE, SpecialCaseMatcher::SpecialToolFile);
 
-    return false;
+    return matcher;
 }
 
-// This functions allows file accesses for special undeclared files.
-// In the special set set we include:
-//     1. Code coverage runs
-//     2. Te drive devices
-//     3. Dos devices and special system devices/names (pipes, null dev etc).
+// The rules are checked in this order, the first one that applies wins:
+//     1. Files in staged deletion
+//     2. Code coverage runs
+//     3. Drive devices, Dos devices and special system devices/names (pipes, null dev etc)
+//     4. Named streams
+//     5. Special tools (see CreateSpecialCaseMatcher)
+// The rules that depend on the final path component (2, 4 and 5) are all matched in one pass by g_pSpecialCaseMatcher.
 // These accesses now should be allowlisted, but many users have deployed products that have specs not declaring such accesses.
-bool GetSpecialCaseRulesForCoverageAndSpecialDevices(
+bool GetSpecialCaseRules(
     __in  PCWSTR absolutePath,
     __in  size_t absolutePathLength,
     __in  PathType pathType,
@@ -312,19 +210,32 @@ bool GetSpecialCaseRulesForCoverageAndSpecialDevices(
     assert(absolutePath);
     assert(absolutePathLength == wcslen(absolutePath));
 
-    // When running test cases with Code Coverage enabled, some more files are loaded that we should ignore
-    if (IgnoreCodeCoverage()) {
-        if (HasSuffix(absolutePath, absolutePathLength, L".pdb") ||
-            HasSuffix(absolutePath, absolutePathLength, L".nls") ||
-            HasSuffix(absolutePath, absolutePathLength, L".dll"))
-        {
+    size_t rootLength = GetRootLength(absolutePath);
+    if (HasPrefix(absolutePath + rootLength, L"$Extend\\$Deleted"))
+    {
+        // Windows can have an "unlink" behavior where deleted files are not really deleted if there's an opened handle.
+        // This behavior is possible because a process can open a file with FILE_SHARE_DELETE that makes other processes able to delete it.
+        // If a file is opened by specifying the FILE_SHARE_DELETE flag for the CreateFile function and another process tries to delete it,
+        // the file is actually moved to the \$Extend\$Deleted directory on the same volume. When the last handle to such a file is closed,
+        // it's deleted as usual. When the file system is mounted, all existing files in the \$Extend\$Deleted directory, if any, are deleted,
+        // The same logic also applies to deleted directories.
+        // Details can be found in this unofficial documentation: https://dfir.ru/2020/03/21/the-extenddeleted-directory/
 #if SUPER_VERBOSE
-            Dbg(L"Ignoring possibly code coverage related path: %s", absolutePath);
+        Dbg(L"special case: files in staged deletion: %s", absolutePath);
 #endif // SUPER_VERBOSE
-            int intPolicy = (int)policy | (int)FileAccessPolicy_AllowAll;
-            policy = (FileAccessPolicy)intPolicy;
-            return true;
-        }
+        policy = FileAccessPolicy::FileAccessPolicy_AllowAll;
+        return true;
+    }
+
+    const uint8_t categories = g_pSpecialCaseMatcher->Match(absolutePath, absolutePathLength);
+
+    if ((categories & SpecialCaseMatcher::CodeCoverageFile) != 0) {
+#if SUPER_VERBOSE
+        Dbg(L"Ignoring possibly code coverage related path: %s", absolutePath);
+#endif // SUPER_VERBOSE
+        int intPolicy = (int)policy | (int)FileAccessPolicy_AllowAll;
+        policy = (FileAccessPolicy)intPolicy;
+        return true;
     }
 
     if (pathType == PathType::LocalDevice || pathType == PathType::Win32Nt) {
@@ -356,7 +267,7 @@ bool GetSpecialCaseRulesForCoverageAndSpecialDevices(
         }
     }
 
-    if (IsPathToNamedStream(absolutePath, absolutePathLength)) {
+    if ((categories & SpecialCaseMatcher::NamedStream) != 0) {
 #if SUPER_VERBOSE
         Dbg(L"Ignoring path to a named stream: %s", absolutePath);
 #endif // SUPER_VERBOSE
@@ -364,6 +275,15 @@ bool GetSpecialCaseRulesForCoverageAndSpecialDevices(
         return true;
     }
 
+    if ((categories & SpecialCaseMatcher::SpecialToolFile) != 0) {
+#if SUPER_VERBOSE
+        Dbg(L"special case: special tool file: %s", absolutePath);
+#endif // SUPER_VERBOSE
+        int intPolicy = (int)policy | (int)FileAccessPolicy_AllowAll;
+        policy = (FileAccessPolicy)intPolicy;
+        return true;
+    }
+
     return false;
 }
 
@@ -549,36 +469,6 @@ void WriteToInternalErrorsFile(PCWSTR format, ...)
     }
 }
 
-inline uint32_t ParseUint32(const byte *payloadBytes, size_t &offset)
-{
-    uint32_t i = *(uint32_t*)(&payloadBytes[offset]);
-    offset += sizeof(uint32_t);
-    return i;
-}
-
-/// Decodes a length plus UTF-16 non-null-terminated string written by FileAccessManifest.WriteChars()
-/// into an allocated, null-terminated string. Returns nullptr if the encoded string length is zero.
-wchar_t *CreateStringFromWriteChars(const byte *payloadBytes, size_t &offset, uint32_t *pStrLen = nullptr)
-{
-    uint32_t len = ParseUint32(payloadBytes, offset);
-    if (pStrLen != nullptr)
-    {
-        *pStrLen = len;
-    }
-
-    WCHAR *pStr = nullptr;
-    if (len != 0)
-    {
-        pStr = new wchar_t[len + 1]; // Reserve some space for \0 terminator at end.
-        uint32_t strSizeBytes = sizeof(wchar_t) * (len + 1);
-        ZeroMemory((void*)pStr, strSizeBytes);
-        memcpy_s((void*)pStr, strSizeBytes, (wchar_t*)(&payloadBytes[offset]), sizeof(wchar_t) * len);
-        offset += sizeof(wchar_t) * len;
-    }
-
-    return pStr;
-}
-
 void AppendStringFromWriteChars(const byte* payloadBytes, size_t& offset, _Out_ std::wstring& result)
 {
     uint32_t len = ParseUint32(payloadBytes, offset);
@@ -597,81 +487,41 @@ static inline void SkipWriteCharsString(const byte* payloadBytes, size_t& offset
     offset += sizeof(wchar_t) * len;
 }
 
-static SubstituteProcessExecutionPluginFunc GetSubstituteProcessExecutionPluginFunc()
+bool IsProcessToBreakAwayFromJob(std::wstring_view imageName)
 {
-    assert(g_SubstituteProcessExecutionPluginDllHandle != nullptr);
-
-    // Different compiler or different compiler settings can result in different function name variants.
-    //
-    // X64 version typically has:
-    //     ordinal hint RVA      name
-    //
-    //     1    0 00011069 CommandMatches = @ILT + 100(CommandMatches)
-    //
-    // X86 version can have:
-    //     ordinal hint RVA      name
-    //
-    //     1    0 00011276 _CommandMatches@24 = @ILT + 625(_CommandMatches@24)
-
-
-    // (1) Check for CommandMatches.
-    std::string winApiProcName("CommandMatches");
-    SubstituteProcessExecutionPluginFunc substituteProcessExecutionPluginFunc = reinterpret_cast<SubstituteProcessExecutionPluginFunc>(
-        reinterpret_cast<void*>(GetProcAddress(g_SubstituteProcessExecutionPluginDllHandle, winApiProcName.c_str())));
-    if (substituteProcessExecutionPluginFunc != nullptr)
-    {
-        return substituteProcessExecutionPluginFunc;
-    }
-
-    // (2) Check for CommandMatches@<param_size> based on platform.
-#if defined(_WIN64)
-    winApiProcName.append("@48"); // 6 64-bit parameters
-#elif defined(_WIN32)
-    winApiProcName.append("@24"); // 6 32-bit parameters
-#endif
-    substituteProcessExecutionPluginFunc = reinterpret_cast<SubstituteProcessExecutionPluginFunc>(
-        reinterpret_cast<void*>(GetProcAddress(g_SubstituteProcessExecutionPluginDllHandle, winApiProcName.c_str())));
-    if (substituteProcessExecutionPluginFunc != nullptr)
+    if (!HasProcessesToBreakAwayFromJob())
     {
-        return substituteProcessExecutionPluginFunc;
+        return false;
     }
 
-    // (3) Check for _CommandMatches@<param_size>.
-    winApiProcName.insert(0, 1, '_');
-    substituteProcessExecutionPluginFunc = reinterpret_cast<SubstituteProcessExecutionPluginFunc>(
-        reinterpret_cast<void*>(GetProcAddress(g_SubstituteProcessExecutionPluginDllHandle, winApiProcName.c_str())));
-    if (substituteProcessExecutionPluginFunc != nullptr)
+    // The names are matched where they are in the payload: there are usually a handful of them and they are
+    // only looked at when a process gets created, so building a set for them on every process attach doesn't pay off
+    size_t offset = 0;
+    for (uint32_t i = 0; i < g_manifestChildProcessesToBreakAwayFromJob->Count; i++)
     {
-        return substituteProcessExecutionPluginFunc;
-    }
-
-    Dbg(L"Unable to find 'CommandMatches', 'CommandMatches@<param_size>', or '_CommandMatches@<param_size>' functions in SubstituteProcessExecutionPluginFunc '%s', lasterr=%d", g_SubstituteProcessExecutionPluginDllPath, GetLastError());
-    return nullptr;
-}
-
-static void LoadSubstituteProcessExecutionPluginDll()
-{
-    assert(g_SubstituteProcessExecutionPluginDllPath != nullptr);
-
-    Dbg(L"Loading substitute process plugin DLL at '%s'", g_SubstituteProcessExecutionPluginDllPath);
+        uint32_t len = ParseUint32(g_processNamesToBreakAwayFromJob, offset);
+        const wchar_t* name = reinterpret_cast<const wchar_t*>(&g_processNamesToBreakAwayFromJob[offset]);
+        offset += sizeof(wchar_t) * len;
 
-    g_SubstituteProcessExecutionPluginDllHandle = LoadLibraryW(g_SubstituteProcessExecutionPluginDllPath);
+        if (len == 0 || len != imageName.length())
+        {
+            continue;
+        }
 
-    if (g_SubstituteProcessExecutionPluginDllHandle != nullptr)
-    {
-        g_SubstituteProcessExecutionPluginFunc = GetSubstituteProcessExecutionPluginFunc();
+        uint32_t j = 0;
+        while (j < len && (name[j] == imageName[j] || towlower(name[j]) == towlower(imageName[j])))
+        {
+            j++;
+        }
 
-        if (g_SubstituteProcessExecutionPluginFunc == nullptr)
+        if (j == len)
         {
-            FreeLibrary(g_SubstituteProcessExecutionPluginDllHandle);
+            return true;
         }
     }
-    else
-    {
-        Dbg(L"Failed LoadLibrary for LoadSubstituteProcessExecutionPluginDll %s, lasterr=%d", g_SubstituteProcessExecutionPluginDllPath, GetLastError());
-    }
-}
 
+    return false;
+}
 
 /// <summary>
 /// Gets the final full path by handle.
@@ -736,6 +586,7 @@ static bool ShouldResolveReparsePointsInPath(
     bool ignoreReparsePointForPath =
         IgnoreReparsePoints() ||
         (IgnoreFullReparsePointResolving() && !policyResult.EnableFullReparsePointParsing()) ||
+        policyResult.NoReparsePointsInCone() ||
         policyResult.IndicateUntracked();
     return !ignoreReparsePointForPath;
 }
@@ -805,14 +656,11 @@ bool ParseFileAccessManifest(
     g_manifestChildProcessesToBreakAwayFromJob->AssertValid();
     offset += g_manifestChildProcessesToBreakAwayFromJob->GetSize();
 
+    // The process names stay in the payload, see IsProcessToBreakAwayFromJob
+    g_processNamesToBreakAwayFromJob = &payloadBytes[offset];
     for (uint32_t i = 0; i < g_manifestChildProcessesToBreakAwayFromJob->Count; i++)
     {
-        std::wstring processNameToBrakeAway(L"");
-        AppendStringFromWriteChars(payloadBytes, offset, processNameToBrakeAway);
-        if (!processNameToBrakeAway.empty())
-        {
-            g_processNamesToBreakAwayFromJob->insert(processNameToBrakeAway);
-        }
+        SkipWriteCharsString(payloadBytes, offset);
     }
 
     g_manifestTranslatePathsStrings = reinterpret_cast<const PManifestTranslatePathsStrings>(&payloadBytes[offset]);
@@ -837,6 +685,7 @@ bool ParseFileAccessManifest(
 
         if (!translateFrom.empty() && !translateTo.empty())
         {
+            g_pManifestTranslatePathTrie->Insert(translateFrom, g_pManifestTranslatePathTuples->size());
             g_pManifestTranslatePathTuples->push_back(new TranslatePathTuple(translateFrom, translateTo));
 
             if (translateFrom.back() == L'\\')
@@ -858,6 +707,29 @@ bool ParseFileAccessManifest(
         }
     }
 
+    // Reparse points BuildXL already resolved seed the resolved path cache, so this process doesn't query them again.
+    // They go into the regular cache (rather than being looked up in the payload) so they get invalidated like any other entry
+    // if the process changes them.
+    PManifestKnownReparsePointTargets knownReparsePointTargets = reinterpret_cast<PManifestKnownReparsePointTargets>(&payloadBytes[offset]);
+    knownReparsePointTargets->AssertValid();
+    offset += knownReparsePointTargets->GetSize();
+
+    for (uint32_t i = 0; i < knownReparsePointTargets->Count; i++)
+    {
+        std::wstring reparsePointPath(L"");
+        AppendStringFromWriteChars(payloadBytes, offset, reparsePointPath);
+
+        std::wstring target(L"");
+        AppendStringFromWriteChars(payloadBytes, offset, target);
+
+        DWORD reparseTag = ParseUint32(payloadBytes, offset);
+
+        if (!reparsePointPath.empty())
+        {
+            ResolvedPathCache::Instance().InsertResolvedPathWithType(reparsePointPath, target, reparseTag);
+        }
+    }
+
     g_manifestInternalDetoursErrorNotificationFileString = reinterpret_cast<const PManifestInternalDetoursErrorNotificationFileString>(&payloadBytes[offset]);
     g_manifestInternalDetoursErrorNotificationFileString->AssertValid();
 #ifdef _DEBUG
@@ -875,6 +747,7 @@ bool ParseFileAccessManifest(
     extraFlags->AssertValid();
     g_fileAccessManifestExtraFlags = static_cast<FileAccessManifestExtraFlag>(extraFlags->ExtraFlags);
     g_pDetouredProcessInjector->SetAlwaysRemoteInjectFromWow64Process(CheckAlwaysRemoteInjectDetoursFrom32BitProcess(g_fileAccessManifestExtraFlags));
+    g_pDetouredProcessInjector->SetSharePayloadSection(CheckShareManifestAcrossProcesses(g_fileAccessManifestExtraFlags));
     g_pDetouredProcessInjector->SetPayload(payloadBytes, payloadSize);
     offset += extraFlags->GetSize();
 
@@ -883,6 +756,12 @@ bool ParseFileAccessManifest(
     g_FileAccessManifestPipId = static_cast<uint64_t>(pipId->PipId);
     offset += pipId->GetSize();
 
+    PCManifestCacheBudgets cacheBudgets = reinterpret_cast<PCManifestCacheBudgets>(&payloadBytes[offset]);
+    cacheBudgets->AssertValid();
+    FilesCheckedForAccess::GetInstance()->SetBudget(static_cast<size_t>(cacheBudgets->FilesCheckedForAccessKb) * 1024);
+    ResolvedPathCache::Instance().SetBudget(static_cast<size_t>(cacheBudgets->ResolvedPathCacheKb) * 1024);
+    offset += cacheBudgets->GetSize();
+
     // Semaphore names don't allow '\\'
     if (CheckDetoursMessageCount() && g_internalDetoursErrorNotificationFile != nullptr)
     {
@@ -988,21 +867,17 @@ bool ParseFileAccessManifest(
         g_SubstituteProcessExecutionPluginDllPath = CreateStringFromWriteChars(payloadBytes, offset);
         SkipWriteCharsString(payloadBytes, offset);  // Skip 64-bit path.
 #endif
+
+        // The process matches are only materialized when this process creates a child, see ShouldSubstituteShim
+        g_shimProcessMatchesPayload = &payloadBytes[offset];
         uint32_t numProcessMatches = ParseUint32(payloadBytes, offset);
-        g_pShimProcessMatches = new vector<ShimProcessMatch*>();
         for (uint32_t i = 0; i < numProcessMatches; i++)
         {
-            wchar_t *processName = CreateStringFromWriteChars(payloadBytes, offset);
-            wchar_t *argumentMatch = CreateStringFromWriteChars(payloadBytes, offset);
-            g_pShimProcessMatches->push_back(new ShimProcessMatch(processName, argumentMatch));
+            SkipWriteCharsString(payloadBytes, offset);
+            SkipWriteCharsString(payloadBytes, offset);
         }
     }
 
-    if (g_SubstituteProcessExecutionPluginDllPath != nullptr)
-    {
-        LoadSubstituteProcessExecutionPluginDll();
-    }
-
     g_manifestTreeRoot = reinterpret_cast<PCManifestRecord>(&payloadBytes[offset]);
     VerifyManifestRoot(g_manifestTreeRoot);
 
@@ -1195,61 +1070,99 @@ void ReportIfNeeded(AccessCheckResult const& checkResult, FileOperationContext c
         filter);
 }
 
+// Size of the buffer EnumerateDirectory reads directory entries into, reused for every directory it enumerates
+#define ENUMERATE_DIRECTORY_BUFFER_SIZE (64 * 1024)
+
 bool EnumerateDirectory(
     const std::wstring& directoryPath,
-    const std::wstring& filter,
     bool recursive,
     bool treatReparsePointAsFile,
     _Inout_ std::vector<std::pair<std::wstring, DWORD>>& filesAndDirectories)
 {
-    HANDLE hFind = INVALID_HANDLE_VALUE;
-    WIN32_FIND_DATA ffd;
-    std::stack<std::wstring> directoriesToEnumerate;
+    // Entries are read in batches filling the whole buffer (FileIdBothDirectoryInfo is NtQueryDirectoryFile with FileIdBothDirectoryInformation)
+    // rather than one FindNextFile call at a time. Directories still to enumerate are kept as indices into filesAndDirectories, so their paths
+    // are only copied when their turn comes.
+    unique_ptr<char[]> buffer(new (std::nothrow) char[ENUMERATE_DIRECTORY_BUFFER_SIZE]);
+    if (buffer == nullptr) {
+        return false;
+    }
 
-    directoriesToEnumerate.push(directoryPath);
+    const size_t rootIndex = SIZE_MAX;
+    std::stack<size_t> directoriesToEnumerate;
+    std::wstring path;
+
+    directoriesToEnumerate.push(rootIndex);
     filesAndDirectories.clear();
 
     while (!directoriesToEnumerate.empty()) {
-        std::wstring directoryToEnumerate = directoriesToEnumerate.top();
-        std::wstring spec = PathCombine(directoryToEnumerate, filter.c_str());
-
+        size_t directoryIndex = directoriesToEnumerate.top();
         directoriesToEnumerate.pop();
 
-        hFind = FindFirstFileW(NormalizePath(spec).c_str(), &ffd);
-        if (hFind == INVALID_HANDLE_VALUE) {
+        path = directoryIndex == rootIndex ? directoryPath : filesAndDirectories[directoryIndex].first;
+
+        HANDLE hDirectory = Real_CreateFileW(
+            NormalizePath(path).c_str(),
+            FILE_LIST_DIRECTORY | SYNCHRONIZE,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr,
+            OPEN_EXISTING,
+            FILE_FLAG_BACKUP_SEMANTICS,
+            nullptr);
+
+        if (hDirectory == INVALID_HANDLE_VALUE) {
             return false;
         }
 
-        do {
-            if (wcscmp(ffd.cFileName, L".") != 0 &&
-                wcscmp(ffd.cFileName, L"..") != 0) {
+        // Same separator rules as PathCombine. Entries are appended to the path of their directory in place.
+        if (!path.empty() && path.back() != L'\\' && path.back() != L'/' && path.back() != L':') {
+            path.push_back(L'\\');
+        }
 
-                std::wstring path = PathCombine(directoryToEnumerate, ffd.cFileName);
+        size_t directoryLength = path.length();
+        FILE_INFO_BY_HANDLE_CLASS infoClass = FileIdBothDirectoryRestartInfo;
 
-                filesAndDirectories.push_back(std::make_pair(path, ffd.dwFileAttributes));
+        while (Real_GetFileInformationByHandleEx(hDirectory, infoClass, buffer.get(), ENUMERATE_DIRECTORY_BUFFER_SIZE)) {
+            infoClass = FileIdBothDirectoryInfo;
 
-                if (recursive) {
+            for (const char* current = buffer.get();;) {
+                const FILE_ID_BOTH_DIR_INFO* entry = reinterpret_cast<const FILE_ID_BOTH_DIR_INFO*>(current);
+                size_t nameLength = entry->FileNameLength / sizeof(WCHAR);
 
-                    bool isDirectory = (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+                bool isDotOrDotDot = entry->FileName[0] == L'.' && (nameLength == 1 || (nameLength == 2 && entry->FileName[1] == L'.'));
+                if (!isDotOrDotDot) {
+                    path.resize(directoryLength);
+                    path.append(entry->FileName, nameLength);
 
-                    if (isDirectory && treatReparsePointAsFile) {
-                        isDirectory = (ffd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0;
-                    }
+                    filesAndDirectories.emplace_back(path, entry->FileAttributes);
 
-                    if (isDirectory) {
-                        directoriesToEnumerate.push(path);
+                    if (recursive) {
+
+                        bool isDirectory = (entry->FileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+
+                        if (isDirectory && treatReparsePointAsFile) {
+                            isDirectory = (entry->FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0;
+                        }
+
+                        if (isDirectory) {
+                            directoriesToEnumerate.push(filesAndDirectories.size() - 1);
+                        }
                     }
                 }
+
+                if (entry->NextEntryOffset == 0) {
+                    break;
+                }
+
+                current += entry->NextEntryOffset;
             }
-        } while (FindNextFile(hFind, &ffd) != 0);
+        }
+
+        DWORD error = GetLastError();
+        Real_CloseHandle(hDirectory);
 
-        if (GetLastError() != ERROR_NO_MORE_FILES) {
-            FindClose(hFind);
+        if (error != ERROR_NO_MORE_FILES) {
             return false;
         }
-
-        FindClose(hFind);
-        hFind = INVALID_HANDLE_VALUE;
     }
 
     return true;
@@ -1316,6 +1229,135 @@ static DWORD SearchFullPath(
     return ERROR_SUCCESS;
 }
 
+// Reads a variable of the environment of this process. Returns false if it is not set.
+static bool TryGetEnvironmentVariable(_In_ LPCWSTR lpName, _Out_ std::wstring& value)
+{
+    // The returned length includes the terminating null character when the buffer is too small, and excludes it otherwise
+    DWORD length = GetEnvironmentVariableW(lpName, nullptr, 0);
+    while (length > 0)
+    {
+        value.resize(length);
+        const DWORD result = GetEnvironmentVariableW(lpName, &value[0], length);
+        if (result < length)
+        {
+            value.resize(result);
+            return result > 0;
+        }
+
+        // The variable grew in between
+        length = result;
+    }
+
+    value.clear();
+    return false;
+}
+
+static bool TryGetCurrentDirectory(_Out_ std::wstring& currentDirectory)
+{
+    DWORD length = GetCurrentDirectoryW(0, nullptr);
+    while (length > 0)
+    {
+        currentDirectory.resize(length);
+        const DWORD result = GetCurrentDirectoryW(length, &currentDirectory[0]);
+        if (result < length)
+        {
+            currentDirectory.resize(result);
+            return result > 0;
+        }
+
+        length = result;
+    }
+
+    currentDirectory.clear();
+    return false;
+}
+
+// Adds a directory in the form ImagePathCache compares them: without quotes, prefix or trailing separators
+static void AddSearchedDirectory(_In_ PCWSTR directory, size_t length, _Inout_ std::vector<std::wstring>& directories)
+{
+    if (length >= 2 && directory[0] == L'"' && directory[length - 1] == L'"')
+    {
+        ++directory;
+        length -= 2;
+    }
+
+    const std::wstring quotesRemoved(directory, length);
+    PCWSTR withoutPrefix = GetPathWithoutPrefix(quotesRemoved.c_str());
+    length -= withoutPrefix - quotesRemoved.c_str();
+
+    while (length > 0 && IsDirectorySeparator(withoutPrefix[length - 1]))
+    {
+        --length;
+    }
+
+    if (length > 0)
+    {
+        directories.emplace_back(withoutPrefix, length);
+    }
+}
+
+// Same as SearchFullPath(nullptr, lpFileName, L".exe", fullPath), answered from ImagePathCache when it is enabled.
+static DWORD SearchImagePath(_In_ LPCWSTR lpFileName, _Inout_ std::wstring& fullPath)
+{
+    std::wstring currentDirectory;
+    if (!CacheImagePathSearches() || !TryGetCurrentDirectory(currentDirectory))
+    {
+        return SearchFullPath(nullptr, lpFileName, L".exe", fullPath);
+    }
+
+    // An unset PATH is searched as an empty one
+    std::wstring pathVariable;
+    TryGetEnvironmentVariable(L"PATH", pathVariable);
+    const unsigned long long pathHash = CaseInsensitiveHash64(pathVariable);
+    const std::wstring name(lpFileName);
+
+    ImagePathCache& cache = ImagePathCache::Instance();
+    if (cache.TryGetImagePath(name, currentDirectory, pathHash, fullPath))
+    {
+        return ERROR_SUCCESS;
+    }
+
+    const unsigned long long generation = cache.Generation();
+    const DWORD result = SearchFullPath(nullptr, lpFileName, L".exe", fullPath);
+    if (result != ERROR_SUCCESS)
+    {
+        return result;
+    }
+
+    // The search goes through the directory of the executable, the current directory, the system directories and PATH.
+    // A file created in any of them but the system directories can change where the name is found from now on.
+    std::vector<std::wstring> searchedDirectories;
+
+    wchar_t wszFileName[MAX_PATH];
+    const DWORD nFileName = GetModuleFileNameW(NULL, wszFileName, MAX_PATH);
+    if (nFileName > 0 && nFileName < MAX_PATH)
+    {
+        const size_t fileNameStart = FindFinalPathSeparator(wszFileName);
+        AddSearchedDirectory(wszFileName, fileNameStart, searchedDirectories);
+    }
+
+    AddSearchedDirectory(currentDirectory.c_str(), currentDirectory.length(), searchedDirectories);
+
+    size_t start = 0;
+    while (start <= pathVariable.length())
+    {
+        size_t end = pathVariable.find(L';', start);
+        if (end == std::wstring::npos)
+        {
+            end = pathVariable.length();
+        }
+
+        AddSearchedDirectory(pathVariable.c_str() + start, end - start, searchedDirectories);
+        start = end + 1;
+    }
+
+    // Deleting or renaming the image found also changes the result
+    AddSearchedDirectory(fullPath.c_str(), FindFinalPathSeparator(fullPath.c_str()), searchedDirectories);
+
+    cache.InsertImagePath(name, currentDirectory, pathHash, generation, searchedDirectories, fullPath);
+    return ERROR_SUCCESS;
+}
+
 static bool ExistsImageFile(_In_ CanonicalizedPath& candidatePath)
 {
     if (candidatePath.IsNull())
@@ -1361,7 +1403,7 @@ static CanonicalizedPath GetCanonicalizedApplicationPath(_In_ LPCWSTR lpApplicat
     // GetFullPathNameW will simply prepend the file name with the current directory, which result in
     // a non-existent path for executables like "cmd.exe".
     std::wstring applicationPath;
-    return SearchFullPath(nullptr, lpApplicationName, L".exe", applicationPath) != ERROR_SUCCESS
+    return SearchImagePath(lpApplicationName, applicationPath) != ERROR_SUCCESS
         ? CanonicalizedPath()
         : CanonicalizedPath::Canonicalize(applicationPath.c_str());;
 }
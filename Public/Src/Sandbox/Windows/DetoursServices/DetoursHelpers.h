@@ -59,30 +59,71 @@
 
 inline SpecialProcessKind GetProcessKind() { return g_ProcessKind; }
 
+// Whether the manifest lists any process that is allowed to break away from the job object
+inline bool HasProcessesToBreakAwayFromJob()
+{
+    return g_manifestChildProcessesToBreakAwayFromJob != nullptr && g_manifestChildProcessesToBreakAwayFromJob->Count > 0;
+}
+
+inline uint32_t ParseUint32(const byte *payloadBytes, size_t &offset)
+{
+    uint32_t i = *(uint32_t*)(&payloadBytes[offset]);
+    offset += sizeof(uint32_t);
+    return i;
+}
+
+/// Decodes a length plus UTF-16 non-null-terminated string written by FileAccessManifest.WriteChars()
+/// into an allocated, null-terminated string. Returns nullptr if the encoded string length is zero.
+inline wchar_t *CreateStringFromWriteChars(const byte *payloadBytes, size_t &offset, uint32_t *pStrLen = nullptr)
+{
+    uint32_t len = ParseUint32(payloadBytes, offset);
+    if (pStrLen != nullptr)
+    {
+        *pStrLen = len;
+    }
+
+    WCHAR *pStr = nullptr;
+    if (len != 0)
+    {
+        pStr = new wchar_t[len + 1]; // Reserve some space for \0 terminator at end.
+        uint32_t strSizeBytes = sizeof(wchar_t) * (len + 1);
+        ZeroMemory((void*)pStr, strSizeBytes);
+        memcpy_s((void*)pStr, strSizeBytes, (wchar_t*)(&payloadBytes[offset]), sizeof(wchar_t) * len);
+        offset += sizeof(wchar_t) * len;
+    }
+
+    return pStr;
+}
+
+// Microseconds elapsed since start, which must have been taken with QueryPerformanceCounter
+inline LONG64 MicrosecondsSince(const LARGE_INTEGER& start)
+{
+    LARGE_INTEGER now;
+    LARGE_INTEGER frequency;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&frequency);
+
+    return (now.QuadPart - start.QuadPart) * 1000000 / frequency.QuadPart;
+}
+
 // ----------------------------------------------------------------------------
 // FUNCTION DECLARATIONS
 // ----------------------------------------------------------------------------
 
 void HandleDetoursInjectionAndCommunicationErrors(int errorCode, LPCWSTR eventLogMsgPtr, LPCWSTR eventLogMsgId);
 
+// Builds the matcher for the special-case rules that apply to this process (see GetSpecialCaseRules).
+// Must be called once the manifest is parsed and the process kind is known (see InitProcessKind).
+SpecialCaseMatcher* CreateSpecialCaseMatcher();
+
 // Indicates if the path matches a special-case rule and if so sets a policy to use.
 // Note that the given path has been canonicalized so that it does not have a prefix like \\?\, \\.\, or \??\.
-bool GetSpecialCaseRulesForCoverageAndSpecialDevices(
+bool GetSpecialCaseRules(
     __in  PCWSTR absolutePath,
     __in  size_t absolutePathLength,
     __in PathType pathType,
     __out FileAccessPolicy& policy);
 
-bool GetSpecialCaseRulesForSpecialTools(
-    __in  PCWSTR absolutePath,
-    __in  size_t absolutePathLength,
-    __out FileAccessPolicy& policy);
-
-bool GetSpecialCaseRulesForWindows(
-    __in  PCWSTR absolutePath,
-    __in  size_t absolutePathLength,
-    __out FileAccessPolicy& policy);
-
 bool WantsWriteAccess(DWORD access);
 bool WantsReadAccess(DWORD access);
 bool WantsReadOnlyAccess(DWORD access);
@@ -106,6 +147,10 @@ bool ParseFileAccessManifest(
 
 bool LocateAndParseFileAccessManifest();
 
+// Whether the given image name (the last component of a path) is one of the processes allowed to break away from the job object.
+// The comparison is case-insensitive and does not allocate, so callers can pass a view into the path they already hold.
+bool IsProcessToBreakAwayFromJob(std::wstring_view imageName);
+
 void WriteToInternalErrorsFile(PCWSTR format, ...);
 
 void InitProcessKind();
@@ -120,9 +165,10 @@ void ReportIfNeeded(
     USN usn = -1,
     wchar_t const* filter = nullptr);
 
+// Lists the entries of a directory (every one of them: there is no filter), along with their attributes.
+// When recursive, directories are descended into, except for directory symlinks and junctions if treatReparsePointAsFile is set.
 bool EnumerateDirectory(
     const std::wstring& directoryPath,
-    const std::wstring& filter,
     bool recursive,
     bool treatReparsePointAsFile,
     _Inout_ std::vector<std::pair<std::wstring, DWORD>>& filesAndDirectories);
@@ -25,12 +25,17 @@
 #include "globals.h"
 #include "buildXL_mem.h"
 #include "DetouredScope.h"
+#include "DetourProfiler.h"
+#include "DetourTracing.h"
 #include "StringOperations.h"
 #include "HandleOverlay.h"
 #include "DetouredProcessInjector.h"
 #include "SendReport.h"
 #include <Psapi.h>
 #include "FilesCheckedForAccess.h"
+#include "ResolvedPathCache.h"
+#include "TranslatePathTrie.h"
+#include "SpecialCaseMatcher.h"
 #include "locale.h"
 
 #define BUILDXL_DETOURS_CREATE_PROCESS_RETRY_COUNT 5
@@ -228,10 +233,12 @@ uint64_t g_FileAccessManifestPipId;
 PCManifestRecord g_manifestTreeRoot;
 
 PManifestChildProcessesToBreakAwayFromJob g_manifestChildProcessesToBreakAwayFromJob;
-unordered_set<std::wstring, CaseInsensitiveStringHasher, CaseInsensitiveStringComparer>* g_processNamesToBreakAwayFromJob = nullptr;
+LPCBYTE g_processNamesToBreakAwayFromJob = nullptr;
 PManifestTranslatePathsStrings g_manifestTranslatePathsStrings;
 vector<TranslatePathTuple*>* g_pManifestTranslatePathTuples = nullptr;
+TranslatePathTrie* g_pManifestTranslatePathTrie = nullptr;
 unordered_set<std::wstring>* g_pManifestTranslatePathLookupTable = nullptr;
+SpecialCaseMatcher* g_pSpecialCaseMatcher = nullptr;
 
 PManifestInternalDetoursErrorNotificationFileString g_manifestInternalDetoursErrorNotificationFileString;
 LPCTSTR g_internalDetoursErrorNotificationFile = nullptr;
@@ -249,6 +256,9 @@ DetouredProcessInjector* g_pDetouredProcessInjector = nullptr;
 
 HANDLE g_hPrivateHeap = nullptr;
 
+// Blocks freed from the private heap, kept by size class to serve later allocations of the same size (see buildXL_mem.h).
+SLIST_HEADER g_detoursSizeClassFreeLists[DD_SIZE_CLASS_COUNT];
+
 // Peak Detours allocated memory. It is allocated in a private heap.
 volatile LONG64 g_detoursMaxAllocatedMemoryInBytes = 0;
 
@@ -262,7 +272,21 @@ volatile LONG g_detoursAllocatedNoLockConcurentPoolEntries = 0;
 volatile LONG64 g_detoursMaxHandleHeapEntries = 0;
 
 // Currently allocated entries in the HandleHeapMap hash table. Allocated in private heap.
-volatile LONG64 g_detoursHandleHeapEntries = 0;\
+volatile LONG64 g_detoursHandleHeapEntries = 0;
+
+// Number of closed handles that could not be queued for removal from the HandleHeapMap because the pre-allocated pool was empty.
+volatile LONG64 g_closedHandlesPoolMissCount = 0;
+
+// Number of policy searches that went through the policy search cache, and how many of them were found there.
+volatile LONG64 g_policySearchCacheLookupCount = 0;
+volatile LONG64 g_policySearchCacheHitCount = 0;
+
+// Time spent by DllProcessAttach, in microseconds: parsing the manifest, initializing the handle overlay, attaching the detours,
+// and in total (which also covers checking the preloaded DLLs).
+volatile LONG64 g_attachManifestParseMicroseconds = 0;
+volatile LONG64 g_attachHandleOverlayMicroseconds = 0;
+volatile LONG64 g_attachDetoursMicroseconds = 0;
+volatile LONG64 g_attachTotalMicroseconds = 0;
 
 //
 // Substitute process execution shim.
@@ -272,7 +296,8 @@ bool g_ProcessExecutionShimAllProcesses;
 wchar_t* g_SubstituteProcessExecutionPluginDllPath = nullptr;
 HMODULE g_SubstituteProcessExecutionPluginDllHandle;
 SubstituteProcessExecutionPluginFunc g_SubstituteProcessExecutionPluginFunc;
-vector<ShimProcessMatch*>* g_pShimProcessMatches = nullptr;
+LPCBYTE g_shimProcessMatchesPayload = nullptr;
+ShimProcessMatcher* volatile g_pShimProcessMatcher = nullptr;
 
 //
 // Real Windows API function pointers
@@ -505,13 +530,14 @@ InternalCreateDetouredProcess(
     bool isCurrentWow64Process = false;
     bool isProcessWow64 = false;
     bool needsRemoteInjection = false;
+    ProcessInjectionTimings injectionTimings = { 0 };
 
     // If there are configured processes that need to break away from
     // the current job object, that means the job object was configured with
     // the JOB_OBJECT_LIMIT_BREAKAWAY_OK limit. But if we reached this point
     // the process being created is not allowed to break away. So make
     // sure we don't pass CREATE_BREAKAWAY_FROM_JOB
-    if (!g_processNamesToBreakAwayFromJob->empty())
+    if (HasProcessesToBreakAwayFromJob())
     {
         creationFlags &= ~CREATE_BREAKAWAY_FROM_JOB;
     }
@@ -594,7 +620,7 @@ InternalCreateDetouredProcess(
 
         while (!fProcDetoured && (nRetryCount < BUILDXL_DETOURS_INJECT_PROCESS_RETRY_COUNT))
         {
-            error = pInjector->InjectProcess(lpProcessInformation->hProcess, fullInheritHandles);
+            error = pInjector->InjectProcess(lpProcessInformation->hProcess, fullInheritHandles, LogProcessDetouringStatus() ? &injectionTimings : nullptr);
             fProcDetoured = error == ERROR_SUCCESS;
 
             // Retry for payload memcpy failure in process injector
@@ -672,7 +698,8 @@ InternalCreateDetouredProcess(
             creationFlags,
             fProcDetoured,
             error,
-            status);
+            status,
+            &injectionTimings);
     }
 
     SetLastError(error);
@@ -720,6 +747,9 @@ struct ProcessCreationAttributes {
     vector<HANDLE> handles;
 };
 
+// Allocation size of the attribute lists, which only depends on the attribute count. Established by the first process creation.
+static volatile SIZE_T g_attributeListSize = 0;
+
 /** Initializes the list of attributes.
 */
 static bool InitializeAttributeList(ProcessCreationAttributes& attr) {
@@ -727,10 +757,14 @@ static bool InitializeAttributeList(ProcessCreationAttributes& attr) {
     DWORD attributeCount = 1ul;
 
     // First we establish the required allocation size.
-    SIZE_T requiredSize = 0;
-    if (!InitializeProcThreadAttributeList(NULL, attributeCount, /*flags*/ 0, &requiredSize) &&
-        GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
-        return false;
+    SIZE_T requiredSize = g_attributeListSize;
+    if (requiredSize == 0) {
+        if (!InitializeProcThreadAttributeList(NULL, attributeCount, /*flags*/ 0, &requiredSize) &&
+            GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+            return false;
+        }
+
+        g_attributeListSize = requiredSize;
     }
 
     assert(requiredSize > 0);
@@ -948,6 +982,60 @@ CreateDetouredProcess(
     return status;
 }
 
+CreateDetouredProcessStatus
+WINAPI
+CreateDetouredProcesses(
+    DetouredProcessCreation* creations,
+    DWORD count
+)
+{
+    // No detours should be called recursively from here.
+    DetouredScope scope;
+
+    CreateDetouredProcessStatus result = CreateDetouredProcessStatus::Succeeded;
+
+    for (DWORD i = 0; i < count; i++) {
+        DetouredProcessCreation& creation = creations[i];
+        creation.status = CreateDetouredProcess(
+            creation.lpcwCommandLine,
+            creation.dwCreationFlags | CREATE_SUSPENDED,
+            creation.lpEnvironment,
+            creation.lpcwWorkingDirectory,
+            creation.hStdInput, creation.hStdOutput, creation.hStdError,
+            creation.hJob,
+            creation.injector,
+            &creation.hProcess, &creation.hThread, &creation.dwProcessId);
+        creation.error = creation.status == CreateDetouredProcessStatus::Succeeded ? ERROR_SUCCESS : GetLastError();
+    }
+
+    for (DWORD i = 0; i < count; i++) {
+        DetouredProcessCreation& creation = creations[i];
+        if (creation.status == CreateDetouredProcessStatus::Succeeded &&
+            !(creation.dwCreationFlags & CREATE_SUSPENDED) &&
+            ResumeThread(creation.hThread) == -1) {
+
+            creation.status = CreateDetouredProcessStatus::ProcessResumeFailed;
+            creation.error = GetLastError();
+            Dbg(L"Resuming a batch created process failed. Command line: '%s' Error: 0x%08X", creation.lpcwCommandLine, (int)creation.error);
+
+            // Same clean-up as InternalCreateDetouredProcess: the process never ran any code
+            if (TerminateProcess(creation.hProcess, PROCESS_DETOURING_FAILED_EXIT_CODE)) {
+                CloseHandle(creation.hProcess);
+                creation.hProcess = 0;
+                CloseHandle(creation.hThread);
+                creation.hThread = 0;
+                creation.dwProcessId = 0;
+            }
+        }
+
+        if (result == CreateDetouredProcessStatus::Succeeded) {
+            result = creation.status;
+        }
+    }
+
+    return result;
+}
+
 //
 // Code that runs in detoured process
 //
@@ -969,6 +1057,19 @@ static int __cdecl CrtDebugHook(int nReportType, wchar_t* szMsg, int* pnRet) {
 
 static bool DllProcessDetach()
 {
+    // The profile and process data reports below are written unbatched: send the accesses still pending first, so they don't
+    // arrive after the process data
+    FlushPendingReports();
+
+    if (ProfileDetours())
+    {
+        DetourProfileCounters detourProfile;
+        if (CollectDetourProfile(detourProfile))
+        {
+            ReportDetourProfile(detourProfile);
+        }
+    }
+
     if (ShouldLogProcessData())
     {
         FILETIME creationTime;
@@ -1023,6 +1124,8 @@ static bool DllProcessDetach()
     }
     Dbg(L"ReparsePoint target resolver cache hit count for PID(%d) and PPID(%d): %ld", g_reparsePointTargetCacheHitCount, g_currentProcessId, g_parentProcessId);
     Dbg(L"Resolved paths cache hit count for PID(%d) and PPID(%d): %ld", g_resolvedPathsCacheHitCout, g_currentProcessId, g_parentProcessId);
+    Dbg(L"Resolved path cache evictions for PID(%d) and PPID(%d): %llu", g_currentProcessId, g_parentProcessId, ResolvedPathCache::Instance().GetEvictionCount());
+    Dbg(L"Files checked for access evictions for PID(%d) and PPID(%d): %llu", g_currentProcessId, g_parentProcessId, FilesCheckedForAccess::GetInstance()->GetEvictionCount());
 #endif // MEASURE_REPARSEPOINT_RESOLVING_IMPACT
 
     return TRUE;
@@ -1041,6 +1144,16 @@ static bool DllProcessDetach()
         delete g_pManifestTranslatePathTuples;
     }
 
+    if (g_pManifestTranslatePathTrie != nullptr)
+    {
+        delete g_pManifestTranslatePathTrie;
+    }
+
+    if (g_pSpecialCaseMatcher != nullptr)
+    {
+        delete g_pSpecialCaseMatcher;
+    }
+
     if (g_pManifestTranslatePathLookupTable != nullptr)
     {
         delete g_pManifestTranslatePathLookupTable;
@@ -1099,6 +1212,10 @@ bool g_isAttached = false;
 
 static bool DllProcessAttach()
 {
+    LARGE_INTEGER attachStart;
+    QueryPerformanceCounter(&attachStart);
+    LARGE_INTEGER phaseStart;
+
 #if MEASURE_DETOURED_NT_CLOSE_IMPACT
     g_pipExecutionStart = GetTickCount64();
 #endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
@@ -1117,19 +1234,22 @@ static bool DllProcessAttach()
         return false;
     }
 
-    g_processNamesToBreakAwayFromJob = new unordered_set<std::wstring, CaseInsensitiveStringHasher, CaseInsensitiveStringComparer>();
     g_pManifestTranslatePathTuples = new vector<TranslatePathTuple*>();
+    g_pManifestTranslatePathTrie = new TranslatePathTrie();
     g_pManifestTranslatePathLookupTable = new unordered_set<std::wstring>();
     g_pDetouredProcessInjector = new DetouredProcessInjector(g_manifestGuid);
 
     int error;
 
+    QueryPerformanceCounter(&phaseStart);
     if (!LocateAndParseFileAccessManifest()) {
         // When DetoursServices.dll is loaded, there always must be a valid FileAccess manifest.
         // Otherwise it is an error.
         return false;
     }
 
+    g_attachManifestParseMicroseconds = MicrosecondsSince(phaseStart);
+
     // Retrieve the id of the current processe's parent process
     if (ShouldLogProcessData())
     {
@@ -1138,14 +1258,18 @@ static bool DllProcessAttach()
 
     g_invariantLocale = _wcreate_locale(LC_CTYPE, L"");
     InitProcessKind();
+    g_pSpecialCaseMatcher = CreateSpecialCaseMatcher();
+
+    QueryPerformanceCounter(&phaseStart);
     InitializeHandleOverlay();
+    g_attachHandleOverlayMicroseconds = MicrosecondsSince(phaseStart);
 
     // If there are configured processes that will break away from the sandbox, expose
     // an environment variable with the handle pointer to the detour manifest.
     // This is the way the AugmentedManifestReporter (the API to directly talk to detours
     // internal tools can use) can actually interact with the manifest
     // Keep in sync with C# side
-    if (!g_processNamesToBreakAwayFromJob->empty())
+    if (HasProcessesToBreakAwayFromJob())
     {
         // CODESYNC: Keep variable name in sync with the C# side
         SetEnvironmentVariable(
@@ -1162,8 +1286,19 @@ static bool DllProcessAttach()
     }
 // end #define ATTACH
 
+// For detours specialized over manifest flags, which are known by now
+#define ATTACH_SPECIALIZED(Name) \
+    Real_##Name = ::Name; \
+    error = DetourAttach((PVOID*)&Real_##Name, (PVOID)SelectDetoured_##Name()); \
+    if (error != ERROR_SUCCESS) { \
+        Dbg(L"Failed to attach to function: " L#Name); \
+        failed = true; \
+    }
+// end #define ATTACH_SPECIALIZED
+
     bool failed = false;
 
+    QueryPerformanceCounter(&phaseStart);
     error = DetourTransactionBegin();
     if (error != NO_ERROR) {
         Dbg(L"DetourTransactionBegin() failed.  Cannot detour file access.");
@@ -1179,12 +1314,12 @@ static bool DllProcessAttach()
         ATTACH(CreateProcessW);
 
         if (GetProcessKind() != SpecialProcessKind::WinDbg) {
-            ATTACH(CreateFileW);
+            ATTACH_SPECIALIZED(CreateFileW);
             ATTACH(CreateFileA);
        
             ATTACH(GetVolumePathNameW);
             ATTACH(GetFileAttributesA);
-            ATTACH(GetFileAttributesW);
+            ATTACH_SPECIALIZED(GetFileAttributesW);
             ATTACH(GetFileAttributesExW);
             ATTACH(GetFileAttributesExA);
 
@@ -1238,11 +1373,11 @@ static bool DllProcessAttach()
             ATTACH(GetFinalPathNameByHandleW);
             ATTACH(GetFinalPathNameByHandleA);
 
-            ATTACH(NtCreateFile);
+            ATTACH_SPECIALIZED(NtCreateFile);
             ATTACH(NtOpenFile);
             ATTACH(ZwCreateFile);
             ATTACH(ZwOpenFile);
-            ATTACH(NtQueryDirectoryFile);
+            ATTACH_SPECIALIZED(NtQueryDirectoryFile);
             ATTACH(ZwQueryDirectoryFile);
             // See comments in DetorsFunctions.cpp
             // on the Detoured_NtClose for more information 
@@ -1273,6 +1408,8 @@ static bool DllProcessAttach()
         return false;
     }
 
+    g_attachDetoursMicroseconds = MicrosecondsSince(phaseStart);
+
     //
     // File APIs successfully detoured.
     //
@@ -1288,6 +1425,10 @@ static bool DllProcessAttach()
 
     g_isAttached = true;
 
+    // Only registered once attaching can't fail anymore: a dll that fails to attach is unloaded without being detached,
+    // which would leave ETW calling into it
+    RegisterDetoursTraceProvider();
+
     if (!IgnorePreloadedDlls())
     {
         HMODULE hMods[1024];
@@ -1350,6 +1491,8 @@ static bool DllProcessAttach()
         CloseHandle(hProcess);
     }
 
+    g_attachTotalMicroseconds = MicrosecondsSince(attachStart);
+
     return true;
 }
 #elif defined(BUILDXL_NATIVES_LIBRARY) 
@@ -1362,10 +1505,11 @@ static bool DllProcessAttach()
         return false;
     }
 
-    g_processNamesToBreakAwayFromJob = new unordered_set<std::wstring, CaseInsensitiveStringHasher, CaseInsensitiveStringComparer>();
     g_pManifestTranslatePathTuples = new vector<TranslatePathTuple*>();
+    g_pManifestTranslatePathTrie = new TranslatePathTrie();
     g_pManifestTranslatePathLookupTable = new unordered_set<std::wstring>();
     g_pDetouredProcessInjector = new DetouredProcessInjector(g_manifestGuid);
+    g_pSpecialCaseMatcher = CreateSpecialCaseMatcher();
 
     return true;
 }
@@ -1412,7 +1556,14 @@ _In_ PVOID reserved)
         return FALSE;
 
     case DLL_PROCESS_DETACH:
-        if (DllProcessDetach()) {
+    {
+        bool detached = DllProcessDetach();
+#ifdef DETOURS_SERVICES_NATIVES_LIBRARY
+        // DllProcessDetach sends the last reports of the process: count everything that was sent
+        PublishReportMessageCount();
+        UnregisterDetoursTraceProvider();
+#endif // DETOURS_SERVICES_NATIVES_LIBRARY
+        if (detached) {
             return TRUE;
         }
 #ifdef DETOURS_SERVICES_NATIVES_LIBRARY
@@ -1421,6 +1572,7 @@ _In_ PVOID reserved)
 #endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
 #endif // DETOURS_SERVICES_NATIVES_LIBRARY
         return FALSE;
+    }
 
     default:
         return TRUE;
@@ -81,6 +81,37 @@ CreateDetouredProcess(
 	HANDLE* phProcess, HANDLE* phThread, DWORD* pdwProcessId
 );
 
+// One of the processes created by CreateDetouredProcesses: the parameters of CreateDetouredProcess, followed by its results.
+struct DetouredProcessCreation {
+    LPCWSTR lpcwCommandLine;
+    DWORD dwCreationFlags;
+    LPVOID lpEnvironment;
+    LPCWSTR lpcwWorkingDirectory;
+    HANDLE hStdInput;
+    HANDLE hStdOutput;
+    HANDLE hStdError;
+    HANDLE hJob;
+    DetouredProcessInjector *injector;
+
+    HANDLE hProcess;
+    HANDLE hThread;
+    DWORD dwProcessId;
+    CreateDetouredProcessStatus status;
+    // Last error of the creation, ERROR_SUCCESS if it succeeded
+    DWORD error;
+};
+
+// Creates a burst of detoured processes, as CreateDetouredProcess does for each of them. All of them are created (and injected) suspended,
+// and the ones that were not asked to be suspended are then resumed together, so none starts competing for the machine with the
+// creation of the rest. The status and error of each creation are set in its entry; a failed creation doesn't prevent the others.
+// Returns Succeeded if all the processes were created, otherwise the status of the first one that wasn't.
+CreateDetouredProcessStatus
+WINAPI
+CreateDetouredProcesses(
+    DetouredProcessCreation* creations,
+    DWORD count
+);
+
 bool
 WINAPI
 IsDetoursDebug();
@@ -127,29 +158,3 @@ public:
         return fromPath;
     }
 };
-
-// CODESYNC: SubstituteProcessExecutionInfo.cs :: ShimProcessMatch class
-class ShimProcessMatch
-{
-public:
-    std::unique_ptr<wchar_t> ProcessName;
-    std::unique_ptr<wchar_t> ArgumentMatch;
-
-    // Assumes params are heap strings and takes control of their lifetime.
-    ShimProcessMatch(wchar_t *processName, wchar_t *argMatch)
-    {
-        ProcessName = std::unique_ptr<wchar_t>(processName);
-        ArgumentMatch = std::unique_ptr<wchar_t>(argMatch);
-    }
-
-    ShimProcessMatch(const ShimProcessMatch &other)
-        : ShimProcessMatch(other.ProcessName.get(), other.ArgumentMatch.get())
-    {}
-
-    ShimProcessMatch& operator=(ShimProcessMatch& other)
-    {
-        // Implementing as a move instead of copy, just to satisfy the compiler.
-        ProcessName.reset(other.ProcessName.release());
-        ArgumentMatch.reset(other.ArgumentMatch.release());
-    }
-};
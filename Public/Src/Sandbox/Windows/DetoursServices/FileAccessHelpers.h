@@ -344,6 +344,22 @@ inline bool Should##flag_name() { return Check##flag_name(g_fileAccessManifestEx
 
 FOR_ALL_FAM_EXTRA_FLAGS(GEN_CHECK_GLOBAL_FAM_EXTRA_FLAG)
 
+// Flag checks for detours specialized over some manifest flags: the flags in Fixed are known to have the values in Values,
+// so checking them folds into a constant, while any other flag is read from the manifest.
+template <DWORD Fixed, DWORD Values>
+struct FamFlags
+{
+    static inline bool Check(FileAccessManifestFlag flag)
+    {
+        return (Fixed & (DWORD)flag) != 0
+            ? (Values & (DWORD)flag) != 0
+            : (g_fileAccessManifestFlags & flag) != FileAccessManifestFlag::None;
+    }
+};
+
+// Every flag is read from the manifest
+typedef FamFlags<0, 0> RuntimeFamFlags;
+
 inline LPCTSTR InternalDetoursErrorNotificationFile()
 {
     return g_internalDetoursErrorNotificationFile;
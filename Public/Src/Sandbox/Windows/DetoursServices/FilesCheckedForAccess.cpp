@@ -5,29 +5,193 @@
 #include "string.h"
 
 FilesCheckedForAccess::FilesCheckedForAccess()
+    : m_table(new Slot[TABLE_SIZE]), m_arena(nullptr), m_overflowSize(0), m_overflowBudget(DEFAULT_OVERFLOW_BUDGET), m_evictions(0)
 {
+    for (size_t i = 0; i < TABLE_SIZE; i++) {
+        m_table[i].Hash.store(0, std::memory_order_relaxed);
+        m_table[i].Path.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+FilesCheckedForAccess::~FilesCheckedForAccess()
+{
+    delete[] m_table;
+
+    ArenaBlock* block = m_arena.load(std::memory_order_relaxed);
+    while (block != nullptr) {
+        ArenaBlock* next = block->Next;
+        delete[] block->Data;
+        delete block;
+        block = next;
+    }
+}
+
+// Case-folding on Windows must agree with CaseInsensitiveStringComparer
+static inline unsigned long long FoldCase(wchar_t c) {
+    return (c >= L'A' && c <= L'Z') ? c + (L'a' - L'A') : (c < 0x80 ? c : towlower(c));
+}
+
+unsigned long long FilesCheckedForAccess::Hash(const PathChar* path, size_t length) {
+    // 64-bit FNV-1a
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+#if _WIN32
+        hash ^= FoldCase(path[i]);
+#else
+        hash ^= static_cast<unsigned char>(path[i]);
+#endif
+        hash *= 1099511628211ULL;
+    }
+
+    // 0 marks empty slots
+    return hash == 0 ? 1 : hash;
+}
+
+bool FilesCheckedForAccess::PathsAreEqual(const PathChar* lhs, const PathChar* rhs) {
+#if _WIN32
+    for (; *lhs != L'\0' && *rhs != L'\0'; lhs++, rhs++) {
+        if (*lhs != *rhs && FoldCase(*lhs) != FoldCase(*rhs)) {
+            return false;
+        }
+    }
+
+    return *lhs == *rhs;
+#else
+    return strcmp(lhs, rhs) == 0;
+#endif
+}
+
+const FilesCheckedForAccess::PathChar* FilesCheckedForAccess::CopyToArena(const PathChar* path, size_t length) {
+    const size_t size = length + 1;
+
+    while (true) {
+        ArenaBlock* block = m_arena.load(std::memory_order_acquire);
+        if (block != nullptr) {
+            size_t offset = block->Used.fetch_add(size, std::memory_order_relaxed);
+            if (offset + size <= block->Size) {
+                PathChar* copy = block->Data + offset;
+                memcpy(copy, path, length * sizeof(PathChar));
+                copy[length] = 0;
+                return copy;
+            }
+        }
+
+        // The block is exhausted (or there is none yet): put a new one in front. Whatever was left at the end of the old one is wasted.
+        ArenaBlock* newBlock = new ArenaBlock();
+        newBlock->Next = block;
+        newBlock->Size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        newBlock->Used.store(0, std::memory_order_relaxed);
+        newBlock->Data = new PathChar[newBlock->Size];
+
+        if (!m_arena.compare_exchange_strong(block, newBlock, std::memory_order_acq_rel)) {
+            // Someone else got a new block in first, use that one
+            delete[] newBlock->Data;
+            delete newBlock;
+        }
+    }
+}
+
+FilesCheckedForAccess::Slot* FilesCheckedForAccess::FindOrInsert(const PathChar* path, size_t length, bool insert, bool& found) {
+    const unsigned long long hash = Hash(path, length);
+
+    for (size_t probe = 0; probe < MAX_PROBES; probe++) {
+        Slot& slot = m_table[(hash + probe) & (TABLE_SIZE - 1)];
+        unsigned long long slotHash = slot.Hash.load(std::memory_order_acquire);
+
+        if (slotHash == 0) {
+            if (!insert) {
+                // Slots are filled in probe order and never released, so the path can't be any further
+                found = false;
+                return &slot;
+            }
+
+            if (slot.Hash.compare_exchange_strong(slotHash, hash, std::memory_order_acq_rel)) {
+                slot.Path.store(CopyToArena(path, length), std::memory_order_release);
+                found = false;
+                return &slot;
+            }
+
+            // Another thread claimed the slot first, slotHash is now its hash
+        }
+
+        if (slotHash == hash) {
+            const PathChar* slotPath;
+            do {
+                // Spins while the thread that claimed the slot copies the path, which is just a copy to the arena
+                slotPath = slot.Path.load(std::memory_order_acquire);
+            } while (slotPath == nullptr);
+
+            if (PathsAreEqual(slotPath, path)) {
+                found = true;
+                return &slot;
+            }
+        }
+    }
+
+    return nullptr;
 }
 
 bool FilesCheckedForAccess::TryRegisterPath(const CanonicalizedPathType& path) {
-    const std::unique_lock<std::shared_mutex> lock(m_lock);
 #if _WIN32
-    auto result = m_pathSet.insert(path.GetPathString());
+    const PathChar* pathString = path.IsNull() ? L"" : path.GetPathString();
+    const size_t length = path.Length();
 #else
-    auto result = m_pathSet.insert(path);
+    const PathChar* pathString = path.c_str();
+    const size_t length = path.length();
 #endif
 
-    return result.second;
+    bool found;
+    if (FindOrInsert(pathString, length, /* insert */ true, found) != nullptr) {
+        return !found;
+    }
+
+    const std::unique_lock<std::shared_mutex> lock(m_overflowLock);
+    if (m_overflowSet.find(pathString) != m_overflowSet.end()) {
+        return false;
+    }
+
+    // A path checked again is a recent one: keep it around for the next generation too
+    const bool registered = m_previousOverflowSet.erase(pathString) > 0;
+    m_overflowSet.insert(pathString);
+    m_overflowSize += (length + 1) * sizeof(PathChar) + OVERFLOW_ENTRY_OVERHEAD;
+    RotateOverflowIfNeeded();
+
+    return !registered;
 }
 
 bool FilesCheckedForAccess::IsRegistered(const CanonicalizedPathType& path) {
-    const std::shared_lock<std::shared_mutex> lock(m_lock);
 #if _WIN32
-    auto result = m_pathSet.find(path.GetPathString());
+    const PathChar* pathString = path.IsNull() ? L"" : path.GetPathString();
+    const size_t length = path.Length();
 #else
-    auto result = m_pathSet.find(path);
+    const PathChar* pathString = path.c_str();
+    const size_t length = path.length();
 #endif
 
-    return (result != m_pathSet.end());
+    bool found;
+    if (FindOrInsert(pathString, length, /* insert */ false, found) != nullptr) {
+        return found;
+    }
+
+    const std::shared_lock<std::shared_mutex> lock(m_overflowLock);
+    return m_overflowSet.find(pathString) != m_overflowSet.end() || m_previousOverflowSet.find(pathString) != m_previousOverflowSet.end();
+}
+
+void FilesCheckedForAccess::RotateOverflowIfNeeded() {
+    if (m_overflowSize < m_overflowBudget / 2) {
+        return;
+    }
+
+    m_evictions.fetch_add(m_previousOverflowSet.size(), std::memory_order_relaxed);
+    m_previousOverflowSet.clear();
+    m_previousOverflowSet.swap(m_overflowSet);
+    m_overflowSize = 0;
+}
+
+void FilesCheckedForAccess::SetBudget(size_t budget) {
+    const std::unique_lock<std::shared_mutex> lock(m_overflowLock);
+    m_overflowBudget = budget == 0 ? DEFAULT_OVERFLOW_BUDGET : budget;
+    RotateOverflowIfNeeded();
 }
 
 FilesCheckedForAccess* FilesCheckedForAccess::GetInstance() {
@@ -12,6 +12,7 @@
     typedef std::string CanonicalizedPathType;
 #endif // _WIN32
 
+#include <atomic>
 #include <unordered_set>
 #include <cwctype>
 #include <mutex>
@@ -24,10 +25,26 @@
 
 // Keeps a set of case-insensitive paths that were checked for access 
 // All operations are thread-safe
+//
+// Paths are kept in an insert-only open addressing table of (case-folded) 64-bit hashes, where a slot is claimed with a single
+// compare-and-swap, so registering and looking up paths never takes a lock. Every slot points to a copy of its path, allocated in
+// an arena, which is compared against on hash collisions. Paths whose whole probe sequence is taken go to an overflow set that
+// is protected by a lock: since slots are never released, every thread probing for a given path agrees on whether it overflowed.
+//
+// The table is fixed-size, so only the overflow set can grow, and it is bounded by a memory budget: it is kept in two generations,
+// new paths going to the current one and paths found in the previous one moving back to the current one. Once the current one
+// takes half the budget, the previous one is evicted and the current one takes its place, so the paths checked recently stay.
+// Evicting a path is safe, it just gets checked (and reported) again.
 class FilesCheckedForAccess {
 public:
     static FilesCheckedForAccess* GetInstance();
 
+    // Sets how much memory, in bytes, the overflow set may take. 0 means the default budget.
+    void SetBudget(size_t budget);
+
+    // Number of paths evicted from the overflow set so far
+    unsigned long long GetEvictionCount() const { return m_evictions.load(std::memory_order_relaxed); }
+
     // Tries to register that a given path was checked for access
     // Returns whether the path was not registered before
     bool TryRegisterPath(const CanonicalizedPathType& path);
@@ -36,15 +53,64 @@ public:
     bool IsRegistered(const CanonicalizedPathType& path);
 
 private:
+#if _WIN32
+    typedef wchar_t PathChar;
+#else
+    typedef char PathChar;
+#endif
+
+    static const size_t TABLE_SIZE = 16384; // Must be a power of 2
+    static const size_t MAX_PROBES = 64;
+    static const size_t ARENA_BLOCK_SIZE = 65536; // In characters
+    static const size_t DEFAULT_OVERFLOW_BUDGET = 32 * 1024 * 1024;
+    // Approximate memory taken by an entry of the overflow set, besides its characters (string header, node and bucket)
+    static const size_t OVERFLOW_ENTRY_OVERHEAD = 64;
+
+    struct Slot {
+        // 0 for an empty slot
+        std::atomic<unsigned long long> Hash;
+        // Set right after the hash is claimed, null while the claiming thread hasn't copied the path yet
+        std::atomic<const PathChar*> Path;
+    };
+
+    struct ArenaBlock {
+        ArenaBlock* Next;
+        size_t Size;
+        std::atomic<size_t> Used;
+        PathChar* Data;
+    };
+
     FilesCheckedForAccess();
+    ~FilesCheckedForAccess();
     FilesCheckedForAccess(const FilesCheckedForAccess&) = delete;
     FilesCheckedForAccess& operator = (const FilesCheckedForAccess&) = delete;
 
+    static unsigned long long Hash(const PathChar* path, size_t length);
+    static bool PathsAreEqual(const PathChar* lhs, const PathChar* rhs);
+
+    // Looks for path in the table, claiming a slot for it if insert is true and it is not there.
+    // Returns the slot of the path (whether it was there before is set in found), or nullptr if the path overflowed.
+    Slot* FindOrInsert(const PathChar* path, size_t length, bool insert, bool& found);
+
+    const PathChar* CopyToArena(const PathChar* path, size_t length);
+
+    // Evicts the previous generation of the overflow set if the current one takes half the budget. Requires m_overflowLock exclusively.
+    void RotateOverflowIfNeeded();
+
+    Slot* m_table;
+    std::atomic<ArenaBlock*> m_arena;
+
 // We only want case insensitive comparisons on Windows
 #if _WIN32
-    std::unordered_set<std::wstring, CaseInsensitiveStringHasher, CaseInsensitiveStringComparer> m_pathSet;
+    typedef std::unordered_set<std::wstring, CaseInsensitiveStringHasher, CaseInsensitiveStringComparer> OverflowSet;
 #else
-    std::unordered_set<std::string> m_pathSet;
+    typedef std::unordered_set<std::string> OverflowSet;
 #endif
-    std::shared_mutex m_lock;
+    OverflowSet m_overflowSet;
+    OverflowSet m_previousOverflowSet;
+    // Approximate memory taken by m_overflowSet
+    size_t m_overflowSize;
+    size_t m_overflowBudget;
+    std::atomic<unsigned long long> m_evictions;
+    std::shared_mutex m_overflowLock;
 };
@@ -0,0 +1,102 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+// Caches the final paths (GetFinalPathNameByHandleW) of the files handle-based operations are applied to, keyed by the volume
+// serial number and file id of the file. Normalizing the name of a handle opens every directory up the path, while the id of the
+// file is a single query, so repeated operations on handles to the same file (e.g. a PDB writer's SetFileInformationByHandle calls)
+// skip the name query.
+//
+// A file with more than one hard link has a final path per link, depending on the handle, so callers only cache files with a single
+// link. The cache is opt-in (see CacheFinalPathsByFileId) and lives as long as the process. Every rename and hard link creation in
+// the process drops all of it, since either can change the paths leading to a cached file. Results are inserted along with the
+// generation observed before querying the name, so a name queried before an invalidation is never inserted after it.
+class FinalPathCache {
+public:
+    // Id of the current set of entries, changes whenever the cache is invalidated
+    inline unsigned long long Generation() const
+    {
+        return m_generation.load(std::memory_order_acquire);
+    }
+
+    inline bool TryGetFinalPath(const FILE_ID_INFO& fileId, std::wstring& finalPath)
+    {
+        FinalPathCacheReadLock r_lock(m_lock);
+        auto it = m_entries.find(fileId);
+        if (it == m_entries.end())
+        {
+            return false;
+        }
+
+        finalPath = it->second;
+        return true;
+    }
+
+    inline void InsertFinalPath(const FILE_ID_INFO& fileId, unsigned long long generation, const std::wstring& finalPath)
+    {
+        FinalPathCacheWriteLock w_lock(m_lock);
+        if (generation != m_generation.load(std::memory_order_acquire) || m_entries.size() >= MAX_ENTRIES)
+        {
+            return;
+        }
+
+        m_entries.emplace(fileId, finalPath);
+    }
+
+    void Invalidate()
+    {
+        // Bumping the generation before taking the lock makes any pending insertion drop its (possibly stale) result
+        m_generation.fetch_add(1, std::memory_order_acq_rel);
+
+        FinalPathCacheWriteLock w_lock(m_lock);
+        m_entries.clear();
+    }
+
+    FinalPathCache() = default;
+    ~FinalPathCache() = default;
+    FinalPathCache(const FinalPathCache&) = delete;
+    FinalPathCache& operator=(const FinalPathCache&) = delete;
+
+    static FinalPathCache& Instance()
+    {
+        static FinalPathCache instance;
+        return instance;
+    }
+
+private:
+    typedef std::shared_mutex FinalPathCacheLock;
+    typedef std::unique_lock<FinalPathCacheLock> FinalPathCacheWriteLock;
+    typedef std::shared_lock<FinalPathCacheLock> FinalPathCacheReadLock;
+
+    // Handle-based operations touch few files compared to path-based ones. Beyond that new files just don't get cached.
+    static const size_t MAX_ENTRIES = 4096;
+
+    struct FileIdHasher {
+        size_t operator()(const FILE_ID_INFO& fileId) const noexcept
+        {
+            unsigned long long id[2];
+            std::memcpy(id, fileId.FileId.Identifier, sizeof(id));
+            return (size_t)((fileId.VolumeSerialNumber * 1099511628211ULL) ^ (id[0] * 14695981039346656037ULL) ^ id[1]);
+        }
+    };
+
+    struct FileIdComparer {
+        bool operator()(const FILE_ID_INFO& lhs, const FILE_ID_INFO& rhs) const noexcept
+        {
+            return lhs.VolumeSerialNumber == rhs.VolumeSerialNumber
+                && std::memcmp(lhs.FileId.Identifier, rhs.FileId.Identifier, sizeof(lhs.FileId.Identifier)) == 0;
+        }
+    };
+
+    FinalPathCacheLock m_lock;
+    std::atomic<unsigned long long> m_generation { 0 };
+    std::unordered_map<FILE_ID_INFO, std::wstring, FileIdHasher, FileIdComparer> m_entries;
+};
@@ -5,22 +5,39 @@
 #include "HandleOverlay.h"
 #include <map>
 #include "buildXL_mem.h"
+#include "DetourTracing.h"
 
 // A pre-allocated list with entries to be used to accumulate the closed handles by NtClose.
 // During testing there were never more than 2 entries in this list on SelfHost and Office builds.
-// Allocating 1000 should be safe we are not skipping handles. If we need more than 1000,
-// a warning will be issued and the handle will not removed from the fie handle map.
-// In such case we will behave exactly as we behave now - without this change we don't remove any handles from the map.
-// If the list is full we will not remove the handle from the map. If that happens, increase the preallocated list size.
+// If the pool runs out, a warning will be issued and the handle will not removed from the fie handle map
+// (which is counted and reported with the process data).
+//
+// The pool starts with CLOSED_HANDLES_POOL_ENTRIES entries (times LARGE_LIST_MULTIPLIER for a large list).
+// Whenever less than a CLOSED_HANDLES_POOL_LOW_FRACTION of it is free, it is doubled the next time closed handles are
+// drained, up to CLOSED_HANDLES_POOL_MAX_GROWTH new entries at a time. Processes closing handles faster than they are
+// drained thus get a bigger pool, and the rest don't pay for it.
 #define CLOSED_HANDLES_POOL_ENTRIES 2000
-#define NT_CLOSE_CLEANUP_THRESHOLD 500
+#define CLOSED_HANDLES_POOL_LOW_FRACTION 4
 #define LARGE_LIST_MULTIPLIER 20
+#define CLOSED_HANDLES_POOL_MAX_GROWTH (CLOSED_HANDLES_POOL_ENTRIES * LARGE_LIST_MULTIPLIER)
+
+// The overlay map is split in stripes, each one with its own lock, so threads working on different handles
+// (e.g. the compiler threads of cl /MP) rarely wait on each other.
+#define HANDLE_OVERLAY_STRIPES 64
+
+// Handle values (divided by 4) covered by g_handleOverlayBitmap. The bitmap takes 256KB of zeroed memory, of which only the pages
+// for the handle values a process actually uses get committed.
+#define HANDLE_OVERLAY_BITMAP_BITS (1 << 21)
 
 bool g_initialized;
-CRITICAL_SECTION g_handleOverlayLock;
+CRITICAL_SECTION g_handleOverlayLocks[HANDLE_OVERLAY_STRIPES];
+
+// One bit per handle, set while the handle has an overlay in the map. Bits are only changed while holding the lock of the stripe
+// of their handle, but the handles sharing a word belong to different stripes, hence the interlocked operations.
+static volatile LONG64 g_handleOverlayBitmap[HANDLE_OVERLAY_BITMAP_BITS / 64];
 
 class HandleOverlayMap;
-HandleOverlayMap* g_handleOverlayMap;
+HandleOverlayMap* g_handleOverlayMaps;
 PSLIST_HEADER g_pClosedHandles = nullptr;
 
 // Used to pre-create entries for closed handles in NtClose, 
@@ -30,9 +47,31 @@ PSLIST_HEADER g_pClosedHandlesPool = nullptr;
 extern volatile LONG g_detoursAllocatedNoLockConcurentPoolEntries;
 extern volatile LONG64 g_detoursMaxHandleHeapEntries;
 extern volatile LONG64 g_detoursHandleHeapEntries;
+extern volatile LONG64 g_closedHandlesPoolMissCount;
 
 static volatile LONG g_usedPoolEntries = 0;
 
+// Set while a CleanupNtClosedHandles thread is running, so a burst of closes doesn't start one thread per close
+static volatile LONG g_cleanupThreadRunning = 0;
+
+// Handle values are multiples of 4, so the low bits are dropped to index the bitmap. Returns false for handles beyond it.
+static inline bool GetHandleOverlayBit(HANDLE handle, size_t& word, LONG64& mask) {
+    ULONG_PTR index = reinterpret_cast<ULONG_PTR>(handle) >> 2;
+    if (index >= HANDLE_OVERLAY_BITMAP_BITS) {
+        return false;
+    }
+
+    word = index / 64;
+    mask = static_cast<LONG64>(1ULL << (index % 64));
+    return true;
+}
+
+bool MayHaveHandleOverlay(HANDLE handle) {
+    size_t word;
+    LONG64 mask;
+    return !GetHandleOverlayBit(handle, word, mask) || (g_handleOverlayBitmap[word] & mask) != 0;
+}
+
 typedef struct _HANDLE_TO_CLOSE {
     SLIST_ENTRY ItemEntry;
     HANDLE Handle;
@@ -40,12 +79,19 @@ typedef struct _HANDLE_TO_CLOSE {
 
 class HandleOverlayMap {
 public:
+    // Inserts or replaces the overlay of the given handle. The replaced overlay, if any, is left in newRef for the caller
+    // to release once it doesn't hold the lock anymore (see RegisterHandleOverlay).
     void MapRegisterHandleOverlay(HANDLE handle, HandleOverlayRef& newRef) {
         
-        // Now, insert (move-assign to empty) or replace (destruct then move-assign). Note that despite perhaps
-        // holding g_handleOverlayLock, we require here that shared_ptr is thread safe for refcount changes (as documented).
-        // When destructing, we need to atomically decrement the ref-count ; some other routine may still be using another ref to the same overlay.
-        m_map[handle] = std::move(newRef);
+        // Note that despite holding the lock of the stripe, we require here that shared_ptr is thread safe for refcount changes (as documented).
+        // Some other routine may still be using another ref to the same overlay.
+        m_map[handle].swap(newRef);
+
+        size_t word;
+        LONG64 mask;
+        if (GetHandleOverlayBit(handle, word, mask)) {
+            InterlockedOr64(&g_handleOverlayBitmap[word], mask);
+        }
 
         // If we are tracking process data, track also the HandleOverlay map entries.
         if (ShouldLogProcessData())
@@ -73,11 +119,25 @@ public:
         }
     }
 
-    void CloseHandleOverlay(HANDLE handle) {
-        size_t removed = m_map.erase(handle);
-        if (removed != 0 && ShouldLogProcessData())
+    // Removes the overlay of the given handle, if any. It is moved to removed for the caller
+    // to release once it doesn't hold the lock anymore (see CloseHandleOverlay).
+    void CloseHandleOverlay(HANDLE handle, HandleOverlayRef& removed) {
+        auto iter = m_map.find(handle);
+        if (iter == m_map.end()) {
+            return;
+        }
+
+        removed = std::move(iter->second);
+        m_map.erase(iter);
+
+        size_t word;
+        LONG64 mask;
+        if (GetHandleOverlayBit(handle, word, mask)) {
+            InterlockedAnd64(&g_handleOverlayBitmap[word], ~mask);
+        }
+        if (ShouldLogProcessData())
         {
-            InterlockedAdd64(&g_detoursHandleHeapEntries, -((LONG64)removed));
+            InterlockedDecrement64(&g_detoursHandleHeapEntries);
         }
     }
 
@@ -85,36 +145,44 @@ private:
     std::map<HANDLE, HandleOverlayRef> m_map;
 };
 
-// Holds g_handleOverlayLock
+// Handle values are multiples of 4, so the low bits are dropped to spread consecutive handles over the stripes.
+static inline size_t GetHandleOverlayStripe(HANDLE handle) {
+    return (reinterpret_cast<ULONG_PTR>(handle) >> 2) % HANDLE_OVERLAY_STRIPES;
+}
+
+// Holds the lock of the stripe of g_handleOverlayMaps the given handle belongs to
 struct HandleOverlayLockGuard {
-    HandleOverlayLockGuard() {
+    HandleOverlayLockGuard(HANDLE handle)
+        : m_stripe(GetHandleOverlayStripe(handle)) {
         assert(g_initialized);
-        EnterCriticalSection(&g_handleOverlayLock);
+        EnterCriticalSection(&g_handleOverlayLocks[m_stripe]);
     }
 
     ~HandleOverlayLockGuard() {
-        LeaveCriticalSection(&g_handleOverlayLock);
+        LeaveCriticalSection(&g_handleOverlayLocks[m_stripe]);
     }
 
     // This is a member function to make sure we always get the map inside a lock.
     inline HandleOverlayMap* GetGlobalOverlayMap() {
-        assert(g_handleOverlayMap != nullptr);
-        return g_handleOverlayMap;
+        assert(g_handleOverlayMaps != nullptr);
+        return &g_handleOverlayMaps[m_stripe];
     }
+
+private:
+    const size_t m_stripe;
 };
 
-static void PopulateNtCloseListPool()
+static inline bool IsNtCloseListPoolLow()
+{
+    LONG allocated = g_detoursAllocatedNoLockConcurentPoolEntries;
+    return (allocated - g_usedPoolEntries) < allocated / CLOSED_HANDLES_POOL_LOW_FRACTION;
+}
+
+static void PopulateNtCloseListPool(unsigned allocationSize)
 {
 #if MEASURE_DETOURED_NT_CLOSE_IMPACT
    ULONGLONG startTime = GetTickCount64();
 #endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
-    unsigned allocationSize = CLOSED_HANDLES_POOL_ENTRIES;
-    if (UseLargeNtClosePreallocatedList())
-    {
-        // Allocate a large list.
-        allocationSize *= LARGE_LIST_MULTIPLIER;
-    }
-
     for (unsigned i = 0; i < allocationSize; i++)
     {
         PHANDLE_TO_CLOSE pPoolHandleEntry = (PHANDLE_TO_CLOSE)_dd_aligned_malloc(sizeof(HANDLE_TO_CLOSE), MEMORY_ALLOCATION_ALIGNMENT);
@@ -150,6 +218,7 @@ DWORD WINAPI CleanupNtClosedHandles(LPVOID lpParam)
         RemoveClosedHandles();
     }
 
+    InterlockedExchange(&g_cleanupThreadRunning, 0);
     return 0;
 }
 
@@ -163,9 +232,10 @@ void StartCleanupNtClosedHandlesThread()
         0,
         nullptr);
     
-    if (threadHandle == INVALID_HANDLE_VALUE)
+    if (threadHandle == NULL || threadHandle == INVALID_HANDLE_VALUE)
     {
         Dbg(L"Warning: Could not create CleanupNtClosedHandlesThread.");
+        InterlockedExchange(&g_cleanupThreadRunning, 0);
     }
     else
     {
@@ -176,10 +246,13 @@ void StartCleanupNtClosedHandlesThread()
 void InitializeHandleOverlay() {
 
     assert(!g_initialized);
-    InitializeCriticalSection(&g_handleOverlayLock);
+    for (size_t i = 0; i < HANDLE_OVERLAY_STRIPES; i++) {
+        InitializeCriticalSection(&g_handleOverlayLocks[i]);
+    }
+
     // Always create the OverlayMap.This is called from DllAttach, so it is inside alock already.
     // Doing it here, we save check and creating the map inside the GetOverlayMap.
-    g_handleOverlayMap = new HandleOverlayMap();
+    g_handleOverlayMaps = new HandleOverlayMap[HANDLE_OVERLAY_STRIPES];
 
     // The NtClose(d) handles are in the g_pClosedHandles. (It is a lock free list.)
     // Since allocation of memory is unsafe inside the NtClose execution path (there should
@@ -201,12 +274,15 @@ void InitializeHandleOverlay() {
 
     assert(g_pClosedHandlesPool != nullptr);
     InitializeSListHead(g_pClosedHandlesPool);
-    PopulateNtCloseListPool();
+    PopulateNtCloseListPool(UseLargeNtClosePreallocatedList()
+        ? CLOSED_HANDLES_POOL_ENTRIES * LARGE_LIST_MULTIPLIER
+        : CLOSED_HANDLES_POOL_ENTRIES);
 
     g_initialized = true;
 }
 
 void RegisterHandleOverlay(HANDLE handle, AccessCheckResult const& accessCheck, PolicyResult const& policy, HandleType type) {
+    DetourTraceTimer trace(DETOUR_TRACE_KEYWORD_HANDLE_OVERLAY);
     if (UseExtraThreadToDrainNtClose())
     {
         RemoveClosedHandles();
@@ -218,34 +294,47 @@ void RegisterHandleOverlay(HANDLE handle, AccessCheckResult const& accessCheck,
     //       
     HandleOverlayRef newRef = std::make_shared<HandleOverlay>(accessCheck, policy, type);
 
-    // Get an extra reference to the handle. This way the shared_ptr is not deleted when removed from the map.
+    // The overlay replaced in the map, if any, is swapped into newRef, so it is not deleted while holding the lock.
     //
     // The issue of destroying the object when removing from the map is that there is a potential for a deadlock.
-    // The removal from the map happens while holding the HandleOverlayLockGuard lock 
-    // (in the MapRegisterHandleOverlay method we do std::move that can call an object destruction and RtlFreeHeap).
+    // The removal from the map happens while holding the HandleOverlayLockGuard lock, and destroying the object calls RtlFreeHeap.
     // The freeing of memory happens while a heap lock is held - so if destruction happens,
     // the order of lock aquisition is HandleMapLock--> HeapLock.
     // RtlFreeHeap also calls NtClose, while holding the heap lock, so it is possible to try to get the locks in 
     // order HeapLock-->HandleMapLock.
     // These two clearly point to a deadlock due to inverted lock aquisition.
-    HandleOverlayRef overlay = TryLookupHandleOverlay(handle, false);
-
     {
-        HandleOverlayLockGuard lock;
+        HandleOverlayLockGuard lock(handle);
         HandleOverlayMap* map = lock.GetGlobalOverlayMap();
         map->MapRegisterHandleOverlay(handle, newRef);
     }
+
+    if (trace.IsTracing())
+    {
+        TraceHandleOverlayRegister(handle, trace.ElapsedMicroseconds());
+    }
 }
 
 HandleOverlayRef TryLookupHandleOverlay(HANDLE handle, bool drain) {
+    DetourTraceTimer trace(DETOUR_TRACE_KEYWORD_HANDLE_OVERLAY);
     if (drain && UseExtraThreadToDrainNtClose())
     {
         RemoveClosedHandles();
     }
 
-    HandleOverlayLockGuard lock;
-    HandleOverlayMap* map = lock.GetGlobalOverlayMap();
-    return map->TryLookupHandleOverlay(handle);
+    HandleOverlayRef overlay;
+    {
+        HandleOverlayLockGuard lock(handle);
+        HandleOverlayMap* map = lock.GetGlobalOverlayMap();
+        overlay = map->TryLookupHandleOverlay(handle);
+    }
+
+    if (trace.IsTracing())
+    {
+        TraceHandleOverlayLookup(handle, overlay != nullptr, trace.ElapsedMicroseconds());
+    }
+
+    return overlay;
 }
 
 void CloseHandleOverlay(HANDLE handle, bool inRecursion) {
@@ -257,9 +346,16 @@ void CloseHandleOverlay(HANDLE handle, bool inRecursion) {
             RemoveClosedHandles();
         }
     }
+
+    // Most handles being closed never had an overlay (events, threads, registry keys, sections...)
+    if (!MayHaveHandleOverlay(handle))
+    {
+        return;
+    }
+
+    DetourTraceTimer trace(DETOUR_TRACE_KEYWORD_HANDLE_OVERLAY);
     
-    // Get an extra reference to the handle. This way the shared_ptr is not deleted when removed from the 
-    // map.
+    // The overlay is moved out of the map into this reference, so the shared_ptr is not deleted when removed from the map.
     // The issue of destroying the object when removing from the map is that there is a potential for a deadlock.
     // The removal from the map happens while holding the HandleOverlayLockGuard lock (see below).
     // If the map holds the last ref to the shared_ptr, when removing it, the destructor of the object will be called,
@@ -268,14 +364,19 @@ void CloseHandleOverlay(HANDLE handle, bool inRecursion) {
     // RtlAllocateHeap also calls NtClose, while holding the heap lock, so it is possible to try to get the locks in 
     // order HeapLock-->HandleMapLock.
     // These two clearly point to a deadlock due to inverted lock aquisition.
-    HandleOverlayRef overlay = TryLookupHandleOverlay(handle, false);
+    HandleOverlayRef overlay;
     
     {
         // Extra scope here to make sure the lock is destroied before the overlay above goes out of scope
         // and releases the last ref to the object pointer.
-        HandleOverlayLockGuard lock;
+        HandleOverlayLockGuard lock(handle);
         HandleOverlayMap* map = lock.GetGlobalOverlayMap();
-        map->CloseHandleOverlay(handle);
+        map->CloseHandleOverlay(handle, overlay);
+    }
+
+    if (trace.IsTracing())
+    {
+        TraceHandleOverlayClose(handle, trace.ElapsedMicroseconds());
     }
 }
 
@@ -285,12 +386,12 @@ void AddClosedHandle(HANDLE handle) {
 #if MEASURE_DETOURED_NT_CLOSE_IMPACT
     ULONGLONG startAdd = GetTickCount64();
 #endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
-    // Cleaup any pending NtClose handles, if the remaining unused are less than NT_CLOSE_CLEANUP_THRESHOLD
-    if ((g_detoursAllocatedNoLockConcurentPoolEntries - g_usedPoolEntries) < NT_CLOSE_CLEANUP_THRESHOLD)
+    // Cleaup any pending NtClose handles, if the pool is running low.
+    // Usually the pending handles are drained by whatever thread accesses the overlay map next. But some processes
+    // barely touch it (e.g. Perl only logging to pipes), so start a thread with higher priority to drain the list.
+    // Only one such thread runs at a time.
+    if (IsNtCloseListPoolLow() && InterlockedCompareExchange(&g_cleanupThreadRunning, 1, 0) == 0)
     {
-        // When below threshold start a new thread. It will be with higher priority to drain the list.
-        // The thread routine is completely thread safe and we might create multiple threads and that is just fine.
-        // The expectation is that multiple threads creation will happen very rarely.
         StartCleanupNtClosedHandlesThread();
     }
 
@@ -300,6 +401,7 @@ void AddClosedHandle(HANDLE handle) {
         if (pEntry == nullptr)
         {
             Dbg(L"Warning: No available entries in g_pClosedHandlesPool list.");
+            InterlockedIncrement64(&g_closedHandlesPoolMissCount);
         }
         else
         {
@@ -321,24 +423,29 @@ void RemoveClosedHandles() {
 #if MEASURE_DETOURED_NT_CLOSE_IMPACT
     ULONGLONG startAdd = GetTickCount64();
 #endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
-    if (g_initialized && g_pClosedHandles != nullptr && g_pClosedHandlesPool != nullptr) {
-        PSLIST_ENTRY pEntry = InterlockedPopEntrySList(g_pClosedHandles);
+    // Every access to the map comes through here, so don't write to the shared list header when there is nothing to drain.
+    if (g_initialized && g_pClosedHandles != nullptr && g_pClosedHandlesPool != nullptr && QueryDepthSList(g_pClosedHandles) != 0) {
+        // Take all the pending handles at once rather than popping them one by one, keeping other threads
+        // draining or closing handles off the list header.
+        PSLIST_ENTRY pEntry = InterlockedFlushSList(g_pClosedHandles);
         while (pEntry != NULL)
         {
+            PSLIST_ENTRY pNext = pEntry->Next;
             CloseHandleOverlay(((PHANDLE_TO_CLOSE)pEntry)->Handle, true);
             ((PHANDLE_TO_CLOSE)pEntry)->Handle = INVALID_HANDLE_VALUE;
             InterlockedPushEntrySList(g_pClosedHandlesPool, &(((PHANDLE_TO_CLOSE)pEntry)->ItemEntry));
-            pEntry = InterlockedPopEntrySList(g_pClosedHandles);
+            pEntry = pNext;
             InterlockedDecrement(&g_usedPoolEntries);
 #if MEASURE_DETOURED_NT_CLOSE_IMPACT
             InterlockedDecrement(&g_maxClosedListCount);
 #endif // MEASURE_DETOURED_NT_CLOSE_IMPACT        
         }
 
-        // Grow the list if needed.
-        if ((g_detoursAllocatedNoLockConcurentPoolEntries - g_usedPoolEntries) < NT_CLOSE_CLEANUP_THRESHOLD)
+        // Grow the list if needed, proportionally to what the process used so far.
+        if (IsNtCloseListPoolLow())
         {
-            PopulateNtCloseListPool();
+            LONG allocated = g_detoursAllocatedNoLockConcurentPoolEntries;
+            PopulateNtCloseListPool(allocated < CLOSED_HANDLES_POOL_MAX_GROWTH ? (unsigned)allocated : CLOSED_HANDLES_POOL_MAX_GROWTH);
         }
     }
 #if MEASURE_DETOURED_NT_CLOSE_IMPACT
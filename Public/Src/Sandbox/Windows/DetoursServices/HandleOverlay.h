@@ -26,12 +26,24 @@ struct HandleOverlay {
     // Constructs a handle overlay for a handle, wrapping the creating operation's policy / access check.
     // The policy represents what operations should be allowed via operations on this handle.
     HandleOverlay(AccessCheckResult const& accessCheck, PolicyResult const& policy, HandleType type)
-        : Policy(policy), AccessCheck(accessCheck), Type(type), EnumerationHasBeenReported(false) { }
+        : AccessCheck(accessCheck), Type(type), EnumerationHasBeenReported(false), EnumerationNeedsNoReport(false), EnumerationPathResolved(false), m_policy(policy.ToCompact()) { }
 
     HandleOverlay(const HandleOverlay& other) = default;
     HandleOverlay& operator=(const HandleOverlay&) = default;
 
-    PolicyResult Policy;
+    // The policy of the handle. It is rebuilt from its compact form on every call, so callers needing it more than once should keep a copy.
+    PolicyResult GetPolicy() const { return PolicyResult(m_policy); }
+    void SetPolicy(PolicyResult const& policy) { m_policy = policy.ToCompact(); }
+
+    // The canonicalized path of the handle, valid until the next SetPolicy. Null if the policy has no path.
+    wchar_t const* GetPathString() const { return m_policy.GetPathString(); }
+
+    // Same as PolicyResult::ShouldOverrideTimestamps for the policy and access check of the handle.
+    bool ShouldOverrideTimestamps() const {
+        return (AccessCheck.Result == ResultAction::Allow || AccessCheck.Result == ResultAction::Warn)
+            && (m_policy.Policy & FileAccessPolicy_AllowRealInputTimestamps) == 0;
+    }
+
     AccessCheckResult AccessCheck;
     HandleType Type;
 
@@ -39,6 +51,18 @@ struct HandleOverlay {
     // by NtQueryDirectoryFile. It prevents multiple reports for the same directory
     // (some big enumerations require multiple calls to NtQueryDirectoryFile).
     bool EnumerationHasBeenReported;
+
+    // Set by NtQueryDirectoryFile when an enumeration of the directory was checked and the policy said not to report it.
+    // Further enumerations through the same handle would come to the same conclusion, so they skip the check.
+    bool EnumerationNeedsNoReport;
+
+    // Set by FindNextFile once the reparse points in the path of the directory being enumerated have been resolved.
+    // Policy is then the one of the fully resolved path, which the rest of the enumerated entries reuse.
+    bool EnumerationPathResolved;
+
+private:
+    // Processes can hold tens of thousands of handles, so overlays don't keep a PolicyResult (its CanonicalizedPath alone holds MAX_PATH characters inline).
+    PolicyResult::Compact m_policy;
 };
 
 // Sets up structures for recording handle overlays.
@@ -66,5 +90,9 @@ void CloseHandleOverlay(HANDLE handle, bool inRecursion = false);
 // Adds a closed handle to the closed handle list.
 void AddClosedHandle(HANDLE handle);
 
+// Whether the given handle may have an overlay. Lock-free, so closing a handle that never had one costs a single bit test.
+// A handle registered with RegisterHandleOverlay has one until CloseHandleOverlay runs for it (or a pending close of it is drained).
+bool MayHaveHandleOverlay(HANDLE handle);
+
 // Remove all closed handlefrom the overlay map.
 void RemoveClosedHandles();
@@ -0,0 +1,158 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "UtilityHelpers.h"
+
+// Caches where the image of a process to be created was found when its name is not rooted (e.g. "cmd" or "git.exe" in
+// a command line), which otherwise takes a SearchPathW probing every directory in PATH. Entries are keyed by the name,
+// the current directory and a hash of PATH, which is all the search depends on besides the contents of the searched directories.
+//
+// The cache is opt-in (see CacheImagePathSearches) and lives as long as the process. Each entry records the directories its
+// search went through, and a write check in the process for a path directly in one of them drops all of it. The system and
+// Windows directories are not recorded: builds don't write there. Results are inserted along with the generation observed
+// before searching, so a result found before an invalidation is never inserted after it.
+class ImagePathCache {
+public:
+    // Id of the current set of entries, changes whenever the cache is invalidated
+    inline unsigned long long Generation() const
+    {
+        return m_generation.load(std::memory_order_acquire);
+    }
+
+    inline bool TryGetImagePath(const std::wstring& name, const std::wstring& currentDirectory, unsigned long long pathHash, std::wstring& imagePath)
+    {
+        if (m_entryCount.load(std::memory_order_acquire) == 0)
+        {
+            return false;
+        }
+
+        const std::wstring key = GetKey(name, currentDirectory, pathHash);
+
+        ImagePathCacheReadLock r_lock(m_lock);
+        auto it = m_entries.find(key);
+        if (it == m_entries.end())
+        {
+            return false;
+        }
+
+        imagePath = it->second;
+        return true;
+    }
+
+    inline void InsertImagePath(
+        const std::wstring& name,
+        const std::wstring& currentDirectory,
+        unsigned long long pathHash,
+        unsigned long long generation,
+        const std::vector<std::wstring>& searchedDirectories,
+        const std::wstring& imagePath)
+    {
+        const std::wstring key = GetKey(name, currentDirectory, pathHash);
+
+        ImagePathCacheWriteLock w_lock(m_lock);
+        if (generation != m_generation.load(std::memory_order_acquire) || m_entries.size() >= MAX_ENTRIES)
+        {
+            return;
+        }
+
+        for (const std::wstring& directory : searchedDirectories)
+        {
+            m_searchedDirectories.insert(directory);
+        }
+
+        m_entries.emplace(key, imagePath);
+        m_entryCount.store(m_entries.size(), std::memory_order_release);
+    }
+
+    // Drops the cache if the given path is directly in a directory searched by any of its entries
+    inline void InvalidateIfSearched(const wchar_t* path)
+    {
+        if (m_entryCount.load(std::memory_order_acquire) == 0)
+        {
+            return;
+        }
+
+        const wchar_t* lastSeparator = nullptr;
+        for (const wchar_t* cursor = path; *cursor != L'\0'; ++cursor)
+        {
+            if (*cursor == L'\\' || *cursor == L'/')
+            {
+                lastSeparator = cursor;
+            }
+        }
+
+        if (lastSeparator == nullptr)
+        {
+            return;
+        }
+
+        const std::wstring directory(path, lastSeparator - path);
+        {
+            ImagePathCacheReadLock r_lock(m_lock);
+            if (m_searchedDirectories.find(directory) == m_searchedDirectories.end())
+            {
+                return;
+            }
+        }
+
+        Invalidate();
+    }
+
+    void Invalidate()
+    {
+        // Bumping the generation before taking the lock makes any pending insertion drop its (possibly stale) result
+        m_generation.fetch_add(1, std::memory_order_acq_rel);
+
+        ImagePathCacheWriteLock w_lock(m_lock);
+        m_entries.clear();
+        m_searchedDirectories.clear();
+        m_entryCount.store(0, std::memory_order_release);
+    }
+
+    ImagePathCache() = default;
+    ~ImagePathCache() = default;
+    ImagePathCache(const ImagePathCache&) = delete;
+    ImagePathCache& operator=(const ImagePathCache&) = delete;
+
+    static ImagePathCache& Instance()
+    {
+        static ImagePathCache instance;
+        return instance;
+    }
+
+private:
+    typedef std::shared_mutex ImagePathCacheLock;
+    typedef std::unique_lock<ImagePathCacheLock> ImagePathCacheWriteLock;
+    typedef std::shared_lock<ImagePathCacheLock> ImagePathCacheReadLock;
+
+    // Processes only start a handful of different tools. Beyond that new names just don't get cached.
+    static const size_t MAX_ENTRIES = 1024;
+
+    // '|' can't be part of a file name or a directory, so keys of different lookups never collide
+    static inline std::wstring GetKey(const std::wstring& name, const std::wstring& currentDirectory, unsigned long long pathHash)
+    {
+        std::wstring key(name);
+        key.push_back(L'|');
+        key.append(currentDirectory);
+        key.push_back(L'|');
+        key.append(std::to_wstring(pathHash));
+        return key;
+    }
+
+    ImagePathCacheLock m_lock;
+    std::atomic<unsigned long long> m_generation { 0 };
+    // Size of m_entries, so processes that don't use the cache never take the lock
+    std::atomic<size_t> m_entryCount { 0 };
+    std::unordered_map<std::wstring, std::wstring, CaseInsensitiveStringHasher, CaseInsensitiveStringComparer> m_entries;
+    std::unordered_set<std::wstring, CaseInsensitiveStringHasher, CaseInsensitiveStringComparer> m_searchedDirectories;
+};
@@ -18,36 +18,55 @@ static LARGE_INTEGER GetNewInputTimestampAsLargeInteger() {
 }
 
 void OverrideTimestampsForInputFile(FILE_BASIC_INFO* result) {
+    OverrideTimestampsForInputFile(&result->CreationTime, &result->LastAccessTime, &result->LastWriteTime, &result->ChangeTime);
+}
+
+void OverrideTimestampsForInputFile(LARGE_INTEGER* creationTime, LARGE_INTEGER* lastAccessTime, LARGE_INTEGER* lastWriteTime, LARGE_INTEGER* changeTime) {
     LARGE_INTEGER newTimestamp = GetNewInputTimestampAsLargeInteger();
 
     if (NormalizeReadTimestamps())
     {
-        result->CreationTime = newTimestamp;
-        result->LastAccessTime = newTimestamp;
-        result->LastWriteTime = newTimestamp;
-        result->ChangeTime = newTimestamp;
+        *creationTime = newTimestamp;
+        *lastAccessTime = newTimestamp;
+        *lastWriteTime = newTimestamp;
+        *changeTime = newTimestamp;
     }
     else
     {
-        if (result->CreationTime.QuadPart < newTimestamp.QuadPart)
+        if (creationTime->QuadPart < newTimestamp.QuadPart)
         {
-            result->CreationTime = newTimestamp;
+            *creationTime = newTimestamp;
         }
-        if (result->LastAccessTime.QuadPart < newTimestamp.QuadPart)
+        if (lastAccessTime->QuadPart < newTimestamp.QuadPart)
         {
-            result->LastAccessTime = newTimestamp;
+            *lastAccessTime = newTimestamp;
         }
-        if (result->LastWriteTime.QuadPart < newTimestamp.QuadPart)
+        if (lastWriteTime->QuadPart < newTimestamp.QuadPart)
         {
-            result->LastWriteTime = newTimestamp;
+            *lastWriteTime = newTimestamp;
         }
-        if (result->ChangeTime.QuadPart < newTimestamp.QuadPart)
+        if (changeTime->QuadPart < newTimestamp.QuadPart)
         {
-            result->ChangeTime = newTimestamp;
+            *changeTime = newTimestamp;
         }
     }
 }
 
+bool TimestampsNeedOverrideForInputFile(LARGE_INTEGER const& creationTime, LARGE_INTEGER const& lastAccessTime, LARGE_INTEGER const& lastWriteTime, LARGE_INTEGER const& changeTime) {
+    LARGE_INTEGER newTimestamp = GetNewInputTimestampAsLargeInteger();
+
+    return NormalizeReadTimestamps()
+        || creationTime.QuadPart < newTimestamp.QuadPart
+        || lastAccessTime.QuadPart < newTimestamp.QuadPart
+        || lastWriteTime.QuadPart < newTimestamp.QuadPart
+        || changeTime.QuadPart < newTimestamp.QuadPart;
+}
+
 void ScrubShortFileName(WIN32_FIND_DATAW* result) {
     ZeroMemory(&(result->cAlternateFileName[0]), sizeof(result->cAlternateFileName));
 }
+
+void ScrubShortFileName(CCHAR* shortNameLength, WCHAR* shortName, size_t shortNameCapacity) {
+    *shortNameLength = 0;
+    ZeroMemory(shortName, shortNameCapacity * sizeof(WCHAR));
+}
@@ -42,6 +42,15 @@ void OverrideTimestampsForInputFile(TResult* result) {
 
 void OverrideTimestampsForInputFile(FILE_BASIC_INFO* result);
 
+// Same as above, for the timestamps of the entries NtQueryDirectoryFile returns (FILE_DIRECTORY_INFORMATION and similar).
+void OverrideTimestampsForInputFile(LARGE_INTEGER* creationTime, LARGE_INTEGER* lastAccessTime, LARGE_INTEGER* lastWriteTime, LARGE_INTEGER* changeTime);
+
+// Whether OverrideTimestampsForInputFile would change any of the given timestamps. Unless read timestamps are normalized,
+// overriding only raises the timestamps older than NewInputTimestamp, which is rare.
+bool TimestampsNeedOverrideForInputFile(LARGE_INTEGER const& creationTime, LARGE_INTEGER const& lastAccessTime, LARGE_INTEGER const& lastWriteTime, LARGE_INTEGER const& changeTime);
+
 // Removes the short file name from directory-entry data (simulate short file names disabled on the volume).
-// TODO: Could scrub FILE_ID_BOTH_DIR_INFO too (https://msdn.microsoft.com/en-us/library/windows/desktop/aa364226(v=vs.85).aspx)
 void ScrubShortFileName(WIN32_FIND_DATAW* result);
+
+// Same as above, for the short name of the entries NtQueryDirectoryFile returns (FILE_BOTH_DIR_INFORMATION and similar).
+void ScrubShortFileName(CCHAR* shortNameLength, WCHAR* shortName, size_t shortNameCapacity);
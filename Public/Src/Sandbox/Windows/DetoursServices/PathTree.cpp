@@ -39,9 +39,14 @@ PathTree::~PathTree()
 }
 #pragma warning( pop )
 
-bool PathTree::TryInsert(const std::wstring& path)
+void PathTree::Clear()
 {
-    std::vector<std::wstring> elements;
+    RemoveAllDescendants(m_root);
+}
+
+bool PathTree::TryInsert(std::wstring_view path)
+{
+    PathAtoms elements;
     const int err = TryDecomposePath(path, elements);
     if (err != 0)
     {
@@ -51,7 +56,7 @@ bool PathTree::TryInsert(const std::wstring& path)
 
     TreeNode* currentNode = m_root;
 
-    for (unsigned int i = 0; i < elements.size(); i++)
+    for (size_t i = 0; i < elements.size(); i++)
     {
         // Only the last element is a final node
         const bool isIntermediate = (i != (elements.size() - 1));
@@ -61,15 +66,15 @@ bool PathTree::TryInsert(const std::wstring& path)
     return true;
 }
 
-TreeNode* PathTree::Append(const std::wstring& atom, TreeNode* node, bool isIntermediate)
+TreeNode* PathTree::Append(std::wstring_view atom, TreeNode* node, bool isIntermediate)
 {
     // First check if the node is already there
-    std::pair<std::wstring, TreeNode*> search;
-    if (node->children.find(atom, search))
+    TreeNode* existing = node->children.find(atom);
+    if (existing != nullptr)
     {
         // If the node being appended is not an intermediate, that overrides the existing node flag
-        (search.second)->intermediate &= isIntermediate;
-        return search.second;
+        existing->intermediate &= isIntermediate;
+        return existing;
     }
 
     // It is not there. Create it and add it as a child of the given node
@@ -171,6 +176,30 @@ void PathTree::RetrieveAndRemoveAllDescendants(const std::wstring& path, TreeNod
     node->children.clear();
 }
 
+bool PathTree::Contains(std::wstring_view path)
+{
+    PathAtoms elements;
+    const int err = TryDecomposePath(path, elements);
+    if (err != 0)
+    {
+        Dbg(L"PathTree::Contains: TryDecomposePath failed, not resolving path: %d", err);
+        return false;
+    }
+
+    // Intermediate nodes only exist on the way to final ones, so finding a node is enough
+    TreeNode* currentNode = m_root;
+    for (const std::wstring_view& element : elements)
+    {
+        currentNode = currentNode->children.find(element);
+        if (currentNode == nullptr)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 void PathTree::RemoveAllDescendants(TreeNode* node)
 {
     const auto remove = [this](std::pair<std::wstring, TreeNode*>* iter)
@@ -185,9 +214,9 @@ void PathTree::RemoveAllDescendants(TreeNode* node)
     node->children.clear();
 }
 
-bool PathTree::TryFind(const std::wstring& path, std::vector<std::pair<std::wstring, TreeNode*>>& nodeTrace)
+bool PathTree::TryFind(std::wstring_view path, std::vector<std::pair<std::wstring, TreeNode*>>& nodeTrace)
 {
-    std::vector<std::wstring> elements;
+    PathAtoms elements;
     const int err = TryDecomposePath(path, elements);
     if (err != 0)
     {
@@ -199,7 +228,7 @@ bool PathTree::TryFind(const std::wstring& path, std::vector<std::pair<std::wstr
 
     nodeTrace.push_back(std::make_pair(L"", m_root));
 
-    for (unsigned int i = 0; i < elements.size(); i++)
+    for (size_t i = 0; i < elements.size(); i++)
     {
         std::pair<std::wstring, TreeNode*> search;
         if (!currentNode->children.find(elements[i], search))
@@ -19,7 +19,7 @@
 class PathTree {
 public:
     // Adds a path to the tree. Returns whether the provided path could be properly interpreted.
-    EXPORT bool TryInsert(const std::wstring& path);
+    EXPORT bool TryInsert(std::wstring_view path);
 
     // Adds all explicitly inserted descendants of the given path into the given vector
     // All descendants are removed from this tree
@@ -31,6 +31,12 @@ public:
     // Check Public\Src\Sandbox\Windows\UnitTests\PathTreeTests.cpp for additional examples and expected behavior
     EXPORT void RetrieveAndRemoveAllDescendants(const std::wstring& path, std::vector<std::wstring>& descendants);
 
+    // Returns whether the given path or any of its descendants was inserted (and not removed since)
+    EXPORT bool Contains(std::wstring_view path);
+
+    // Removes every path from the tree
+    EXPORT void Clear();
+
     EXPORT PathTree();
     EXPORT ~PathTree();
 
@@ -42,11 +48,11 @@ public:
 
 private:
     // Adds an edge from the given node with the provided atom
-    TreeNode* Append(const std::wstring& atom, TreeNode* node, bool isIntermediate);
+    TreeNode* Append(std::wstring_view atom, TreeNode* node, bool isIntermediate);
 
     // Tries to find the provided path in the current tree. On success, returns the trace in the tree that leads to the
     // path final atom
-    bool TryFind(const std::wstring& path, std::vector<std::pair<std::wstring, TreeNode*>>& nodeTrace);
+    bool TryFind(std::wstring_view path, std::vector<std::pair<std::wstring, TreeNode*>>& nodeTrace);
 
     // Removes all descendants from the given node and builds the descendants collection using the given path as a prefix
     void RetrieveAndRemoveAllDescendants(const std::wstring& path, TreeNode* lastNode, std::vector<std::wstring>& descendants);
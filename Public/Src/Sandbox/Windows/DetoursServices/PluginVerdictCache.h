@@ -0,0 +1,113 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+// What the substitute process execution plugin decided for a command
+struct PluginVerdict {
+    bool Matches = false;
+    // Whether the plugin replaced the arguments of the command with ModifiedArguments
+    bool HasModifiedArguments = false;
+    std::wstring ModifiedArguments;
+};
+
+// Caches the verdicts of the substitute process execution plugin, which is called on every process creation and can be
+// expensive, while build drivers keep starting the same command lines (e.g., the same compiler probe over and over).
+// Entries are keyed by the command, its arguments, the working directory and a hash of the environment block, which is
+// everything the plugin gets to see. The plugin is assumed to decide on those alone.
+//
+// The cache is opt-in (see CacheSubstituteProcessExecutionPluginVerdicts) and lives as long as the process.
+class PluginVerdictCache {
+public:
+    inline bool TryGetVerdict(
+        const std::wstring& command,
+        const std::wstring& arguments,
+        const wchar_t* workingDirectory,
+        unsigned long long environmentHash,
+        PluginVerdict& verdict)
+    {
+        if (m_entryCount.load(std::memory_order_acquire) == 0)
+        {
+            return false;
+        }
+
+        const std::wstring key = GetKey(command, arguments, workingDirectory, environmentHash);
+
+        PluginVerdictCacheReadLock r_lock(m_lock);
+        auto it = m_entries.find(key);
+        if (it == m_entries.end())
+        {
+            return false;
+        }
+
+        verdict = it->second;
+        return true;
+    }
+
+    inline void InsertVerdict(
+        const std::wstring& command,
+        const std::wstring& arguments,
+        const wchar_t* workingDirectory,
+        unsigned long long environmentHash,
+        const PluginVerdict& verdict)
+    {
+        const std::wstring key = GetKey(command, arguments, workingDirectory, environmentHash);
+
+        PluginVerdictCacheWriteLock w_lock(m_lock);
+        if (m_entries.size() >= MAX_ENTRIES)
+        {
+            return;
+        }
+
+        m_entries.emplace(key, verdict);
+        m_entryCount.store(m_entries.size(), std::memory_order_release);
+    }
+
+    PluginVerdictCache() = default;
+    ~PluginVerdictCache() = default;
+    PluginVerdictCache(const PluginVerdictCache&) = delete;
+    PluginVerdictCache& operator=(const PluginVerdictCache&) = delete;
+
+    static PluginVerdictCache& Instance()
+    {
+        static PluginVerdictCache instance;
+        return instance;
+    }
+
+private:
+    typedef std::shared_mutex PluginVerdictCacheLock;
+    typedef std::unique_lock<PluginVerdictCacheLock> PluginVerdictCacheWriteLock;
+    typedef std::shared_lock<PluginVerdictCacheLock> PluginVerdictCacheReadLock;
+
+    // Arguments can be long, so the number of command lines remembered is kept small. Beyond that new ones just don't get cached.
+    static const size_t MAX_ENTRIES = 512;
+
+    // None of the parts can contain a null character, so keys of different commands never collide.
+    // Arguments are compared as they are: unlike paths, they are case-sensitive.
+    static inline std::wstring GetKey(
+        const std::wstring& command,
+        const std::wstring& arguments,
+        const wchar_t* workingDirectory,
+        unsigned long long environmentHash)
+    {
+        std::wstring key(command);
+        key.push_back(L'\0');
+        key.append(arguments);
+        key.push_back(L'\0');
+        key.append(workingDirectory);
+        key.push_back(L'\0');
+        key.append(std::to_wstring(environmentHash));
+        return key;
+    }
+
+    PluginVerdictCacheLock m_lock;
+    // Size of m_entries, so processes that don't use the cache never take the lock
+    std::atomic<size_t> m_entryCount { 0 };
+    std::unordered_map<std::wstring, PluginVerdict> m_entries;
+};
@@ -3,8 +3,127 @@
 
 #include "PolicyResult.h"
 #include "DetoursHelpers.h"
+#include "DetourTracing.h"
 #include "SendReport.h"
 #include "FilesCheckedForAccess.h"
+#include "ImagePathCache.h"
+#include "ProbeResultCache.h"
+#include "StringOperations.h"
+
+#include <atomic>
+
+extern volatile LONG64 g_policySearchCacheLookupCount;
+extern volatile LONG64 g_policySearchCacheHitCount;
+
+// Cache of policy searches, keyed by the record the search starts from and the searched path.
+//
+// Tools keep probing the same paths over and over, and each search walks the manifest tree allocating a parent cursor
+// per level. The manifest doesn't change for the lifetime of the process, so a search result never gets stale.
+//
+// The cache is an open addressing table of at most POLICY_SEARCH_CACHE_SIZE entries, probed at most
+// POLICY_SEARCH_CACHE_PROBES times. Entries are published with a compare-exchange and never replaced or freed
+// (readers may be copying them), so lookups never block. Once the slots a path probes are taken, its searches just
+// aren't cached.
+#define POLICY_SEARCH_CACHE_SIZE 4096
+#define POLICY_SEARCH_CACHE_PROBES 4
+
+struct PolicySearchCacheEntry
+{
+    PolicySearchCacheEntry(PCManifestRecord startRecord, DWORD hash, std::wstring&& path, PolicySearchCursor const& cursor)
+        : StartRecord(startRecord), Hash(hash), Path(std::move(path)), Cursor(cursor)
+    { }
+
+    const PCManifestRecord StartRecord;
+    const DWORD Hash;
+    const std::wstring Path;
+    const PolicySearchCursor Cursor;
+};
+
+static std::atomic<PolicySearchCacheEntry*> g_policySearchCache[POLICY_SEARCH_CACHE_SIZE];
+
+static bool IsPolicySearchCacheEntryFor(
+    PolicySearchCacheEntry const* entry,
+    PCManifestRecord startRecord,
+    DWORD hash,
+    wchar_t const* path,
+    size_t pathLength)
+{
+    return entry->StartRecord == startRecord
+        && entry->Hash == hash
+        && entry->Path.length() == pathLength
+        && ArePathsEqual(entry->Path.c_str(), path, pathLength);
+}
+
+// Same as FindFileAccessPolicyInTreeEx, but going through the policy search cache.
+// Different cursors on the same record are equivalent (the record determines its ancestors and level), so the cached
+// cursor is as good as the one a search would produce, parent chain included.
+static PolicySearchCursor FindFileAccessPolicyInTreeCached(
+    PolicySearchCursor const& cursor,
+    wchar_t const* path,
+    size_t pathLength)
+{
+    if (!cursor.IsValid() || cursor.SearchWasTruncated)
+    {
+        return FindFileAccessPolicyInTreeEx(cursor, path, pathLength);
+    }
+
+    // Only summarized in the process data report: don't make every lookup contend on the counters for nothing
+    bool countLookups = ShouldLogProcessData();
+    if (countLookups)
+    {
+        InterlockedIncrement64(&g_policySearchCacheLookupCount);
+    }
+
+    DWORD hash = HashPath(path, pathLength);
+    size_t index = (hash ^ (DWORD)(reinterpret_cast<ULONG_PTR>(cursor.Record) >> 4)) % POLICY_SEARCH_CACHE_SIZE;
+
+    size_t probe = 0;
+    for (; probe < POLICY_SEARCH_CACHE_PROBES; probe++)
+    {
+        PolicySearchCacheEntry* entry = g_policySearchCache[(index + probe) % POLICY_SEARCH_CACHE_SIZE].load(std::memory_order_acquire);
+        if (entry == nullptr)
+        {
+            break;
+        }
+
+        if (IsPolicySearchCacheEntryFor(entry, cursor.Record, hash, path, pathLength))
+        {
+            if (countLookups)
+            {
+                InterlockedIncrement64(&g_policySearchCacheHitCount);
+            }
+
+            return entry->Cursor;
+        }
+    }
+
+    PolicySearchCursor result = FindFileAccessPolicyInTreeEx(cursor, path, pathLength);
+
+    if (probe < POLICY_SEARCH_CACHE_PROBES)
+    {
+        PolicySearchCacheEntry* newEntry = new PolicySearchCacheEntry(cursor.Record, hash, std::wstring(path, pathLength), result);
+
+        // Other threads may be filling the same slots concurrently; take the first one still free, if any.
+        for (; probe < POLICY_SEARCH_CACHE_PROBES; probe++)
+        {
+            PolicySearchCacheEntry* expected = nullptr;
+            if (g_policySearchCache[(index + probe) % POLICY_SEARCH_CACHE_SIZE].compare_exchange_strong(expected, newEntry, std::memory_order_acq_rel))
+            {
+                newEntry = nullptr;
+                break;
+            }
+
+            if (IsPolicySearchCacheEntryFor(expected, cursor.Record, hash, path, pathLength))
+            {
+                break;
+            }
+        }
+
+        delete newEntry;
+    }
+
+    return result;
+}
 
 bool PolicyResult::Initialize(PCPathChar path)
 {
@@ -37,36 +156,59 @@ void PolicyResult::InitializeFromCursor(CanonicalizedPathType const& canonicaliz
     assert(m_canonicalizedPath.IsNull());
     assert(!canonicalizedPath.IsNull());
 
+    DetourTraceTimer trace(DETOUR_TRACE_KEYWORD_POLICY);
+
     // The path is already canonicalized; now we are committed to set a policy, which doesn't fail.
     // We will do so via special-case rules (no policy search or cursor) or via the policy tree (which is searched, producing a cursor).
     m_canonicalizedPath = canonicalizedPath;
 
-    TranslateFilePath(std::wstring(canonicalizedPath.GetPathString()), m_translatedPath, false);
+    // Without translations, the translated path is the canonicalized one (see GetTranslatedPath): skip copying it.
+    if (!g_pManifestTranslatePathTuples->empty()) {
+        TranslateFilePath(std::wstring(canonicalizedPath.GetPathString()), m_translatedPath, false);
+    }
+
     wchar_t const* translatedSearchSuffix = searchSuffix != nullptr ? searchSuffix : GetTranslatedPathWithoutTypePrefix();
     size_t searchSuffixLength = wcslen(translatedSearchSuffix);
 
-    PolicySearchCursor newCursor = FindFileAccessPolicyInTreeEx(policySearchCursor, translatedSearchSuffix, searchSuffixLength);
+    PolicySearchCursor newCursor = FindFileAccessPolicyInTreeCached(policySearchCursor, translatedSearchSuffix, searchSuffixLength);
     Initialize(canonicalizedPath, newCursor);
 
-    if (GetSpecialCaseRulesForWindows(translatedSearchSuffix, searchSuffixLength, /*out*/ m_policy)) 
+    if (GetSpecialCaseRules(translatedSearchSuffix, searchSuffixLength, canonicalizedPath.Type, /*out*/ m_policy))
     {
 #if SUPER_VERBOSE
-        Dbg(L"match (special case rules for Windows): %s - policySearchCursor: %x, searchSuffix: %s", canonicalizedPath.GetPathString(), policySearchCursor, searchSuffix);
+        Dbg(L"match (special case rules): %s - policySearchCursor: %x, searchSuffix: %s", canonicalizedPath.GetPathString(), policySearchCursor, searchSuffix);
 #endif // SUPER_VERBOSE
     }
-    else if (GetSpecialCaseRulesForCoverageAndSpecialDevices(translatedSearchSuffix, searchSuffixLength, canonicalizedPath.Type, /*out*/ m_policy)) {
-#if SUPER_VERBOSE
-        Dbg(L"match (special case rules for coverage and special devices): %s - policySearchCursor: %x, searchSuffix: %s", canonicalizedPath.GetPathString(), policySearchCursor, searchSuffix);
-#endif // SUPER_VERBOSE
-    }
-    else if (GetSpecialCaseRulesForSpecialTools(translatedSearchSuffix, searchSuffixLength, /*out*/ m_policy))
+
+    if (trace.IsTracing())
     {
-#if SUPER_VERBOSE
-            Dbg(L"match (special case rules for special tools): %s - policySearchCursor: %x, searchSuffix: %s", canonicalizedPath.GetPathString(), policySearchCursor, searchSuffix);
-#endif // SUPER_VERBOSE
+        TracePolicyLookup(translatedSearchSuffix, searchSuffixLength, trace.ElapsedMicroseconds());
     }
 }
 
+PolicyResult::Compact PolicyResult::ToCompact() const
+{
+    Compact compact;
+    compact.Type = m_canonicalizedPath.Type;
+    if (!m_canonicalizedPath.IsNull()) {
+        compact.Path.assign(m_canonicalizedPath.GetPathString(), m_canonicalizedPath.Length());
+    }
+
+    compact.TranslatedPath = m_translatedPath;
+    compact.Policy = m_policy;
+    compact.Cursor = m_policySearchCursor;
+    compact.IsIndeterminate = m_isIndeterminate;
+    return compact;
+}
+
+PolicyResult::PolicyResult(Compact const& compact)
+    : m_canonicalizedPath(compact.Type == PathType::Null ? CanonicalizedPath() : CanonicalizedPath(compact.Type, compact.Path.c_str(), compact.Path.length())),
+    m_policy(compact.Policy), m_policySearchCursor(compact.Cursor),
+    m_isIndeterminate(compact.IsIndeterminate),
+    m_translatedPath(compact.TranslatedPath)
+{
+}
+
 PolicyResult PolicyResult::GetPolicyForSubpath(wchar_t const* pathSuffix) const {
     assert(!m_isIndeterminate);
     assert(!m_canonicalizedPath.IsNull());
@@ -146,5 +288,15 @@ bool PolicyResult::AllowWrite(bool basedOnlyOnPolicy) const {
         }
     }
 
+    // This is the check every write, rename and delete goes through, so the cached probes can't outlive any of them
+    if (!basedOnlyOnPolicy && CacheProbesOfImmutableInputs()) {
+        ProbeResultCache::Instance().Invalidate();
+    }
+
+    // A file written in a directory searched for the image of a process can change where that image is found
+    if (!basedOnlyOnPolicy && CacheImagePathSearches()) {
+        ImagePathCache::Instance().InvalidateIfSearched(GetPathWithoutPrefix(m_canonicalizedPath.GetPathString()));
+    }
+
     return isWriteAllowedByPolicy;
 }
\ No newline at end of file
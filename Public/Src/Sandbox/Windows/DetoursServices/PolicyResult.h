@@ -58,7 +58,7 @@ public:
 #if _WIN32
 
 private:
-    // Result of path translation.
+    // Result of path translation. Empty when no translation is configured, in which case the translated path is m_canonicalizedPath.
     std::wstring m_translatedPath;
 
     /// Checks the file access manifest to determine a policy for the given already-canonicalized path.
@@ -78,7 +78,7 @@ public:
         : m_canonicalizedPath(std::move(other.m_canonicalizedPath)),
         m_policy(other.m_policy), m_policySearchCursor(other.m_policySearchCursor),
         m_isIndeterminate(other.m_isIndeterminate),
-        m_translatedPath(other.m_translatedPath)
+        m_translatedPath(std::move(other.m_translatedPath))
     {
         other.m_isIndeterminate = true;
         other.m_policy = (FileAccessPolicy)0;
@@ -95,6 +95,26 @@ public:
     /// If 'false' is returned, the caller should fail the access and report the failure with ReportIndeterminatePolicyAndSetLastError.
     bool Initialize(PCPathChar path);
 
+    // A policy result in a form meant to be kept around for long (see HandleOverlay): the canonicalized path is stored at its own length
+    // instead of in the inline buffer of CanonicalizedPath, which is sized for the longest path that fits in MAX_PATH.
+    struct Compact {
+        PathType Type;
+        std::wstring Path;
+        // Empty when no translation is configured, as m_translatedPath.
+        std::wstring TranslatedPath;
+        FileAccessPolicy Policy;
+        PolicySearchCursor Cursor;
+        bool IsIndeterminate;
+
+        // The canonicalized path, or nullptr for a null one (as CanonicalizedPath::GetPathString).
+        PCPathChar GetPathString() const { return Type == PathType::Null ? nullptr : Path.c_str(); }
+    };
+
+    Compact ToCompact() const;
+
+    // Rebuilds the policy result a Compact was made from. No policy search is performed.
+    explicit PolicyResult(Compact const& compact);
+
     /// Checks the file access manifest to determine a policy for the given already-canonicalized path.
     void Initialize(CanonicalizedPathType const& canonicalizedPath);
 
@@ -103,17 +123,19 @@ public:
     // TODO: This is a poorly exercised and very exceptional path; for simplicity consider throwing (failfast exception?)
     void ReportIndeterminatePolicyAndSetLastError(FileOperationContext const& fileOperationContext) const;
 
-    PCPathChar GetTranslatedPath() const { return m_translatedPath.c_str(); }
+    PCPathChar GetTranslatedPath() const {
+        return m_translatedPath.empty() ? m_canonicalizedPath.GetPathString() : m_translatedPath.c_str();
+    }
 
     PCPathChar GetTranslatedPathWithoutTypePrefix() const {
         switch (m_canonicalizedPath.Type) {
             case PathType::Null:
                 return nullptr;
             case PathType::Win32:
-                return m_translatedPath.c_str();
+                return GetTranslatedPath();
             case Win32Nt:
             case LocalDevice:
-                return m_translatedPath.c_str() + 4;
+                return GetTranslatedPath() + 4;
             default:
                 assert(false);
                 return nullptr;
@@ -125,9 +147,13 @@ private:
     FileAccessManifestFlag m_famFlag;
     FileAccessManifestExtraFlag m_famExtraFlag;
 
+    // Mode of the path as the sandbox already read it from the file system for the access being checked (0 if it doesn't exist)
+    mode_t m_observedMode;
+    bool m_hasObservedMode;
+
 public:
     PolicyResult(FileAccessManifestFlag famFlag, FileAccessManifestExtraFlag famExtraFlag)
-        : m_famFlag(famFlag), m_isIndeterminate(true), m_famExtraFlag(famExtraFlag)
+        : m_famFlag(famFlag), m_isIndeterminate(true), m_famExtraFlag(famExtraFlag), m_observedMode(0), m_hasObservedMode(false)
     {
     }
 
@@ -144,6 +170,9 @@ public:
     #define GEN_CHECK_FAM_EXTRA_FLAG_FUNC(flag_name, flag_value) inline bool flag_name() const { return Check##flag_name(m_famExtraFlag); }
     FOR_ALL_FAM_EXTRA_FLAGS(GEN_CHECK_FAM_EXTRA_FLAG_FUNC)
 
+    // Lets checks that depend on whether the path exists (see AllowWrite) use 'mode' instead of querying the file system again
+    void SetObservedMode(mode_t mode) { m_observedMode = mode; m_hasObservedMode = true; }
+
 #endif // _WIN32
 
     // Performs an access check for a read-access, based on dynamically-observed read context (existence, etc.)
@@ -184,44 +213,42 @@ public:
     bool IndicateUntracked() const { return ((m_policy & FileAccessPolicy_AllowAll) == FileAccessPolicy_AllowAll) && ((m_policy & FileAccessPolicy_ReportAccess) == 0); }
     bool TreatDirectorySymlinkAsDirectory() const { return (m_policy & FileAccessPolicy_TreatDirectorySymlinkAsDirectory) != 0; }
     bool EnableFullReparsePointParsing() const { return (m_policy & FileAccessPolicy_EnableFullReparsePointParsing) != 0; }
+    bool NoReparsePointsInCone() const { return (m_policy & FileAccessPolicy_NoReparsePointsInCone) != 0; }
     DWORD GetPathId() const { return m_policySearchCursor.IsValid() ? m_policySearchCursor.Record->GetPathId() : 0; }
     FileAccessPolicy GetPolicy() const { return m_policy; }
     USN GetExpectedUsn() const { return m_policySearchCursor.GetExpectedUsn(); }
     // Indicates if this policy is invalid (iff Initialize did not complete successfully or has not been called).
     bool IsIndeterminate() const { return m_isIndeterminate; }
 
+    // Indicates if this policy comes from the cone of a manifest record without children: every path below the
+    // path of this policy then gets the very same policy.
+    bool IsInLeafCone() const
+    {
+        return m_policySearchCursor.IsValid() && m_policySearchCursor.SearchWasTruncated && m_policySearchCursor.Record->BucketCount == 0;
+    }
+
     // d: is level 0, d:\office is level 1, d:\office\dev is level 2, etc...
     // Level of a policy search cursor refers to the level of the remainder of the path after this policyresult.
     // To find the level including this policy result, we subtract 1
     size_t Level() const { return m_policySearchCursor.Level -1; }
 
-    // Given a file access policy to search for, search from this policy result through parents to find the lowest level at which the given file access policy is detected consecutively.
-    // All parents from the given policy result's level through to the returned level inclusive must have fileAccessPolicy set.
-    // For instance, if the policy manifests for levels 0,1,2,3,4 are 10, 5, 10, 10, 10, and you searched for fileAccess policy 10, it would return level 2.
-    // 0 is not returned because level 1 have a policy of 5, and the chain of matching fileAccessPolicys must be consecutive
-    // The choice of being consecutive is somewhat arbitrary and was chosen to match EnableFullReparsePointParsing(),
-    // which is always set on the cone policy and thus if one policy has it, all children will.
-    size_t FindLowestConsecutiveLevelThatStillHasProperty(const FileAccessPolicy fileAccessPolicy) const
+    // Finds the lowest level from which FileAccessPolicy_EnableFullReparsePointParsing is set consecutively down to this policy result.
+    // The flag is always set on the cone policy, so once a node has it all of its descendants do: the answer is the level of the shallowest
+    // ancestor that has it, which FileAccessManifest.cs precomputes into every record, so no parent needs to be visited.
+    // Returns 0 if the flag is not set for this policy result.
+    size_t FindLowestLevelWithFullReparsePointParsing() const
     {
         size_t first_level = 0;
-        if ((m_policy & fileAccessPolicy) != 0)
+        if ((m_policy & FileAccessPolicy_EnableFullReparsePointParsing) != 0)
         {
-            if (m_policy & fileAccessPolicy)
-            {
-                first_level = Level();
-            }
+            first_level = Level();
 
-            PolicySearchCursor::PPolicySearchCursor parent = m_policySearchCursor.Parent;
-            while (parent != nullptr)
+            size_t ancestorLevel;
+            if (m_policySearchCursor.IsValid() && m_policySearchCursor.Record->TryGetFullReparsePointParsingAncestorLevel(ancestorLevel))
             {
-                if ((parent->Record->GetConePolicy() & fileAccessPolicy) != 0)
-                {
-                    // Level of a policy search cursor refers to the level of the remainder of the path after this policyresult.
-                    // To find the level including this policy result, we subtract 1
-                    first_level = parent->Level - 1;
-                }
-
-                parent = parent->Parent;
+                // Level of a policy search cursor refers to the level of the remainder of the path after this policyresult.
+                // To find the level including this policy result, we subtract 1
+                first_level = ancestorLevel - 1;
             }
         }
 
@@ -0,0 +1,349 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef policysearchcore_h
+#define policysearchcore_h
+
+#include "PolicySearch.h"
+#include "StringOperations.h"
+
+// ----------------------------------------------------------------------------
+// Manifest policy tree search, specialized for the path semantics of a platform
+// ----------------------------------------------------------------------------
+
+// The manifest tree stores partial paths already normalized, and hashed with HashPath, by FileAccessManifest.cs.
+// Everything the search does per path character (normalizing, hashing, looking for a separator, comparing against a
+// partial path) goes through a PathSemantics, so each sandbox compiles a search loop with no per-character branching
+// beyond what its file system needs: on a case-sensitive file system, normalizing is gone altogether and comparing a
+// path component is a plain memcmp instead of a call into ArePathsEqual.
+//
+// The managed side builds a single manifest format for all platforms, so a PathSemantics must normalize and hash
+// exactly the way NormalizePathChar and HashPath do for the platform it is used on (see PlatformPathSemantics).
+template <typename TChar, bool CaseSensitive, TChar Separator, TChar AltSeparator>
+struct PathSemantics;
+
+template <typename TChar, TChar Separator, TChar AltSeparator>
+struct PathSemantics<TChar, /* CaseSensitive */ false, Separator, AltSeparator>
+{
+    typedef TChar CharType;
+
+    static inline TChar Normalize(TChar c) noexcept
+    {
+        return NormalizePathChar(c);
+    }
+
+    static constexpr bool IsSeparator(TChar c) noexcept
+    {
+        return c == Separator || c == AltSeparator;
+    }
+
+    // Checks if the first 'length' characters of 'path' are equal to 'normalizedPath' (which is null-terminated)
+    static inline bool AreComponentsEqual(const TChar* path, const TChar* normalizedPath, size_t length) noexcept
+    {
+        return ArePathsEqual(path, normalizedPath, length) ? true : false;
+    }
+};
+
+template <typename TChar, TChar Separator, TChar AltSeparator>
+struct PathSemantics<TChar, /* CaseSensitive */ true, Separator, AltSeparator>
+{
+    typedef TChar CharType;
+
+    static constexpr TChar Normalize(TChar c) noexcept
+    {
+        return c;
+    }
+
+    static constexpr bool IsSeparator(TChar c) noexcept
+    {
+        return c == Separator || c == AltSeparator;
+    }
+
+    static inline bool AreComponentsEqual(const TChar* path, const TChar* normalizedPath, size_t length) noexcept
+    {
+        return memcmp(path, normalizedPath, length * sizeof(TChar)) == 0 && normalizedPath[length] == 0;
+    }
+};
+
+// Both separators are honored everywhere: neither of them can show up in a partial path of the manifest, and paths
+// reported by tools are not always canonical.
+#if __linux__
+typedef PathSemantics<PathChar, /* CaseSensitive */ true, (PathChar)UNIX_DIRECTORY_SEPARATOR, (PathChar)NT_DIRECTORY_SEPARATOR> PlatformPathSemantics;
+#else
+typedef PathSemantics<PathChar, /* CaseSensitive */ false, (PathChar)NT_DIRECTORY_SEPARATOR, (PathChar)UNIX_DIRECTORY_SEPARATOR> PlatformPathSemantics;
+#endif
+
+// Prefetching never faults, so it is fine to prefetch past the end of the manifest
+#if _WIN32
+#if defined(_M_X64) || defined(_M_IX86)
+#include <xmmintrin.h>
+#define PREFETCH_FOR_READ(address) _mm_prefetch((address), _MM_HINT_T0)
+#elif defined(_M_ARM64)
+#include <intrin.h>
+#define PREFETCH_FOR_READ(address) __prefetch(address)
+#else
+#define PREFETCH_FOR_READ(address) ((void)(address))
+#endif
+#else
+#define PREFETCH_FOR_READ(address) __builtin_prefetch((address), 0, 3)
+#endif
+
+// The search itself: header-only, so it inlines into whatever instantiates it (see PolicySearch.cpp).
+template <typename TSemantics>
+class PolicySearchCore final
+{
+public:
+    typedef typename TSemantics::CharType CharType;
+
+    /// GetPartialPathAndRemainder
+    ///
+    /// Takes a path and trims out the first partial path. Because the contract
+    /// for this and all functions is not to modify or copy strings, return the
+    /// length of the partial path, and the caller will use absolutePath along
+    /// with the return value and treat that as if it were the partial path.
+    /// Keep in mind that said partial path string is not null-terminated.
+    ///
+    /// Remainder is the string beginning after the dividing path separator.
+    ///
+    /// The partial path is hashed (with the same result as HashPath) in the same
+    /// scan that looks for its end, so it doesn't need to be read again to look it up.
+    ///
+    /// Returns:
+    ///     The length of the partial path, not including the null terminator or path separator.
+    /// Outputs:
+    ///     absolutePath (unmodified): The partial path (as a prefix of absolutePath), with no path separator.
+    ///     remainder: The remainder of the input string after the partial path has been stripped off.
+    ///     hash: The hash of the partial path.
+    static inline size_t GetPartialPathAndRemainder(
+        __in  const CharType* absolutePath,
+        __in  size_t absolutePathLength,
+        __out const CharType*& remainder,
+        __out DWORD& hash) noexcept
+    {
+        assert(absolutePath);
+
+        size_t found = 0; // look for a path separator or end of string
+        DWORD partialPathHash = Fnv1Basis32;
+
+        // Skip all the leading PathSeparators.
+        // This is needed for the case of network path ("\\foo-server\bar").
+        // They are still part of the partial path, so they are hashed too.
+        while (TSemantics::IsSeparator(absolutePath[found]))
+        {
+            partialPathHash = HashNormalizedPathChar(partialPathHash, TSemantics::Normalize(absolutePath[found]));
+            found++;
+        }
+
+        for (; found < absolutePathLength && !TSemantics::IsSeparator(absolutePath[found]); found++)
+        {
+            partialPathHash = HashNormalizedPathChar(partialPathHash, TSemantics::Normalize(absolutePath[found]));
+        }
+
+        remainder = (absolutePath + found);
+        hash = partialPathHash;
+
+        if (found < absolutePathLength) {
+            assert(TSemantics::IsSeparator(remainder[0]));
+            // we found a path separator, and we need to increment the remainder past the path separator
+            remainder++;
+        }
+        else {
+            // absolutely do not increment past the null terminator
+            assert(remainder[0] == 0);
+        }
+
+        return found;
+    }
+
+    /// FindChildCandidate
+    ///
+    /// Looks for a child with the given hash among the children of the given record. This only reads the buckets of the
+    /// record, which hold the hashes of the children: the candidate child itself is not touched, so the caller can
+    /// prefetch it and do something else while it is on its way.
+    /// If found, returns true and outputs the index of the bucket of the candidate. Resuming from there (see
+    /// FindNextChildCandidate) finds any other child with the same hash.
+    __success(return)
+    static inline bool FindChildCandidate(
+        __in  ManifestRecord const& record,
+        __in  DWORD hash,
+        __out ManifestRecord::BucketCountType& index) noexcept
+    {
+        // Wide directories are laid out with a minimal perfect hash: the child, if any, can only be in one bucket
+        if (record.DisplacementCount != 0)
+        {
+            index = record.GetPerfectHashIndex(hash);
+            return record.IsChildHashAt(index, hash);
+        }
+
+        // We are searching a hash-table that has been constructed in FileAccessManifest.cs
+        index = hash % record.BucketCount;
+        if (record.IsChildHashAt(index, hash))
+        {
+            return true;
+        }
+
+        return record.IsCollisionChainStart(index) && FindNextChildCandidate(record, hash, index);
+    }
+
+    // Continues the search of FindChildCandidate past the candidate at 'index' (which gets updated), which turned out not to be the child
+    __success(return)
+    static inline bool FindNextChildCandidate(
+        __in  ManifestRecord const& record,
+        __in  DWORD hash,
+        ManifestRecord::BucketCountType& index) noexcept
+    {
+        // A perfect hash has a single candidate, and a chain ends with the first bucket that doesn't continue it
+        if (record.DisplacementCount != 0 || !(record.IsCollisionChainStart(index) || record.IsCollisionChainContinuation(index)))
+        {
+            return false;
+        }
+
+        ManifestRecord::BucketCountType numBuckets = record.BucketCount;
+        do {
+            index = (index + 1) % numBuckets;
+            if (record.IsChildHashAt(index, hash))
+            {
+                return true;
+            }
+        } while (record.IsCollisionChainContinuation(index));
+
+        return false;
+    }
+
+    /// FindChild
+    ///
+    /// Search for the given partial path, whose hash is already known, in the children of the given record.
+    /// If found, returns true and outputs the child.
+    __success(return)
+    static inline bool FindChild(
+        __in  ManifestRecord const& record,
+        __in  const CharType* target,
+        __in  size_t targetLength,
+        __in  DWORD hash,
+        __out PCManifestRecord& child) noexcept
+    {
+        ManifestRecord::BucketCountType index;
+        for (bool found = FindChildCandidate(record, hash, index); found; found = FindNextChildCandidate(record, hash, index))
+        {
+            child = record.GetChildRecord(index);
+            if (TSemantics::AreComponentsEqual(target, child->GetPartialPath(), targetLength))
+            {
+                return true;
+            }
+        }
+
+        child = nullptr;
+        return false;
+    }
+
+    // See FindFileAccessPolicyInTreeEx
+    static inline PolicySearchCursor FindPolicy(
+        __in  PolicySearchCursor const& cursor,
+        __in  const CharType* absolutePath,
+        __in  size_t absolutePathLength) noexcept
+    {
+        assert(cursor.Record != nullptr);
+        assert(absolutePath != nullptr);
+
+        // For a truncated cursor, any further search should yield the same policy and remain truncated.
+        // One can imagine that below each record, there is a default record for any unmatched path
+        // which is an equivalent copy. But instead of realizing those records we just remember that
+        // we have begun traversing them.
+        if (cursor.SearchWasTruncated) {
+            return cursor;
+        }
+
+        PolicySearchCursor current = cursor;
+
+        // The path component to look up next, tokenized (and hashed) one iteration ahead: see below
+        PathComponent component;
+        if (absolutePath[0] != 0) {
+            component.Tokenize(absolutePath, absolutePathLength);
+        }
+
+        // Each iteration consumes one path component, walking one level down the tree.
+        for (;;)
+        {
+            // Terminal cases: Maybe we can't walk further down the tree, or maybe we've matched all of the path.
+            bool isLeaf = current.Record->BucketCount == 0; // we found a leaf, even if there is more path, we have gone as far as we can
+            bool endOfPath = absolutePath[0] == 0; // no more path to search, wherever we ended up is the node to consider
+            if (isLeaf || endOfPath)
+            {
+                current.SearchWasTruncated = !endOfPath;
+                return current;
+            }
+
+            // We're now committed to trying to find a child matching the component.
+            ManifestRecord::BucketCountType index;
+            if (!FindChildCandidate(*current.Record, component.Hash, /*out*/ index))
+            {
+                // There was path to consume, and a chance of finding a child record, but that didn't work.
+                // So, this is a third terminal case (but we had to do a bit of work to determine so).
+                current.SearchWasTruncated = true;
+                return current;
+            }
+
+            // The candidate is almost always the child: get it on its way, and tokenize the component after this one while
+            // waiting for it, rather than stalling on the comparison below. Its first cache lines hold both its partial path
+            // (for all but wide records) and the start of its buckets, which the next iteration looks at.
+            PCManifestRecord childRecord = current.Record->GetChildRecord(index);
+            PrefetchRecord(childRecord);
+
+            PathComponent nextComponent;
+            if (component.Remainder[0] != 0) {
+                nextComponent.Tokenize(component.Remainder, component.RemainderLength);
+            }
+
+            if (!TSemantics::AreComponentsEqual(component.Start, childRecord->GetPartialPath(), component.Length))
+            {
+                // A sibling with the same hash: keep looking past it
+                bool found = false;
+                while (!found && FindNextChildCandidate(*current.Record, component.Hash, index))
+                {
+                    childRecord = current.Record->GetChildRecord(index);
+                    found = TSemantics::AreComponentsEqual(component.Start, childRecord->GetPartialPath(), component.Length);
+                }
+
+                if (!found)
+                {
+                    current.SearchWasTruncated = true;
+                    return current;
+                }
+            }
+
+            // Consume some more of the path, if any. Note that the cursor is never truncated here due to the terminal cases above.
+            current.Descend(childRecord);
+            absolutePath = component.Remainder;
+            absolutePathLength = component.RemainderLength;
+            component = nextComponent;
+        }
+    }
+
+private:
+    // A path component, along with its hash and what follows it in the path (see GetPartialPathAndRemainder)
+    struct PathComponent
+    {
+        const CharType* Start = nullptr;
+        size_t Length = 0;
+        DWORD Hash = 0;
+        const CharType* Remainder = nullptr;
+        size_t RemainderLength = 0;
+
+        void Tokenize(const CharType* path, size_t pathLength) noexcept
+        {
+            Start = path;
+            Length = GetPartialPathAndRemainder(path, pathLength, /*out*/ Remainder, /*out*/ Hash);
+            assert(Remainder <= path + pathLength);
+            RemainderLength = pathLength - (Remainder - path);
+        }
+    };
+
+    static inline void PrefetchRecord(PCManifestRecord record) noexcept
+    {
+        const char* start = reinterpret_cast<const char*>(record);
+        PREFETCH_FOR_READ(start);
+        PREFETCH_FOR_READ(start + 64);
+    }
+};
+
+#endif
@@ -0,0 +1,155 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+#include "UtilityHelpers.h"
+
+// Caches the results of the attribute probes (GetFileAttributes and GetFileAttributesEx) of immutable inputs: paths for which
+// the manifest has an expected USN and that can't be written. Only the filesystem query is cached: callers still check and report
+// every access.
+//
+// The cache is opt-in (see CacheProbesOfImmutableInputs) and lives as long as the process. Any write check in the process
+// invalidates all of it, since a write, rename or delete through a different path can still change what a cached path sees.
+// Results are inserted along with the generation observed before querying the filesystem, so a result queried before an
+// invalidation is never inserted after it.
+class ProbeResultCache {
+public:
+    // Id of the current set of entries, changes whenever the cache is invalidated
+    inline unsigned long long Generation() const
+    {
+        return m_generation.load(std::memory_order_acquire);
+    }
+
+    inline bool TryGetAttributes(const std::wstring& path, USN expectedUsn, DWORD& attributes, DWORD& error)
+    {
+        ProbeResultCacheReadLock r_lock(m_lock);
+        auto it = m_entries.find(path);
+        if (it == m_entries.end() || it->second.ExpectedUsn != expectedUsn || !it->second.HasAttributes)
+        {
+            return false;
+        }
+
+        attributes = it->second.Attributes;
+        error = it->second.AttributesError;
+        return true;
+    }
+
+    inline void InsertAttributes(const std::wstring& path, USN expectedUsn, unsigned long long generation, DWORD attributes, DWORD error)
+    {
+        ProbeResultCacheWriteLock w_lock(m_lock);
+        Entry* entry = GetEntryForInsertion(path, expectedUsn, generation);
+        if (entry != nullptr)
+        {
+            entry->HasAttributes = true;
+            entry->Attributes = attributes;
+            entry->AttributesError = error;
+        }
+    }
+
+    // Only GetFileExInfoStandard queries are cached. data is the buffer as the query left it, error is ERROR_SUCCESS iff the query succeeded.
+    inline bool TryGetAttributeData(const std::wstring& path, USN expectedUsn, WIN32_FILE_ATTRIBUTE_DATA& data, DWORD& error)
+    {
+        ProbeResultCacheReadLock r_lock(m_lock);
+        auto it = m_entries.find(path);
+        if (it == m_entries.end() || it->second.ExpectedUsn != expectedUsn || !it->second.HasAttributeData)
+        {
+            return false;
+        }
+
+        data = it->second.AttributeData;
+        error = it->second.AttributeDataError;
+        return true;
+    }
+
+    inline void InsertAttributeData(const std::wstring& path, USN expectedUsn, unsigned long long generation, const WIN32_FILE_ATTRIBUTE_DATA& data, DWORD error)
+    {
+        ProbeResultCacheWriteLock w_lock(m_lock);
+        Entry* entry = GetEntryForInsertion(path, expectedUsn, generation);
+        if (entry != nullptr)
+        {
+            entry->HasAttributeData = true;
+            entry->AttributeData = data;
+            entry->AttributeDataError = error;
+        }
+    }
+
+    void Invalidate()
+    {
+        // Bumping the generation before taking the lock makes any pending insertion drop its (possibly stale) result
+        m_generation.fetch_add(1, std::memory_order_acq_rel);
+
+        ProbeResultCacheWriteLock w_lock(m_lock);
+        m_entries.clear();
+    }
+
+    ProbeResultCache() = default;
+    ~ProbeResultCache() = default;
+    ProbeResultCache(const ProbeResultCache&) = delete;
+    ProbeResultCache& operator=(const ProbeResultCache&) = delete;
+
+    static ProbeResultCache& Instance()
+    {
+        static ProbeResultCache instance;
+        return instance;
+    }
+
+private:
+    typedef std::shared_mutex ProbeResultCacheLock;
+    typedef std::unique_lock<ProbeResultCacheLock> ProbeResultCacheWriteLock;
+    typedef std::shared_lock<ProbeResultCacheLock> ProbeResultCacheReadLock;
+
+    // Enough for the headers and libraries of the largest compilations. Beyond that new paths just don't get cached.
+    static const size_t MAX_ENTRIES = 65536;
+
+    struct Entry
+    {
+        USN ExpectedUsn;
+
+        bool HasAttributes;
+        DWORD Attributes;
+        DWORD AttributesError;
+
+        bool HasAttributeData;
+        WIN32_FILE_ATTRIBUTE_DATA AttributeData;
+        DWORD AttributeDataError;
+    };
+
+    // Must be called holding m_lock exclusively. Returns nullptr if the result must not be inserted.
+    inline Entry* GetEntryForInsertion(const std::wstring& path, USN expectedUsn, unsigned long long generation)
+    {
+        if (generation != m_generation.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+
+        auto it = m_entries.find(path);
+        if (it == m_entries.end())
+        {
+            if (m_entries.size() >= MAX_ENTRIES)
+            {
+                return nullptr;
+            }
+
+            Entry entry = {};
+            entry.ExpectedUsn = expectedUsn;
+            it = m_entries.emplace(path, entry).first;
+        }
+        else if (it->second.ExpectedUsn != expectedUsn)
+        {
+            return nullptr;
+        }
+
+        return &it->second;
+    }
+
+    ProbeResultCacheLock m_lock;
+    std::atomic<unsigned long long> m_generation { 0 };
+    std::unordered_map<std::wstring, Entry, CaseInsensitiveStringHasher, CaseInsensitiveStringComparer> m_entries;
+};
@@ -0,0 +1,125 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#if _WIN32
+#include <intrin.h>
+#endif
+
+// Histogram of the time it takes a sandbox to get an access report from where the access was intercepted to where it was
+// handed over to BuildXL, in microseconds. Shared by the Windows, Linux and macOS sandboxes.
+//
+// Buckets are log-linear: every power of two is split in kSubBuckets linear sub-buckets, so a percentile is off by at most
+// 1/kSubBuckets of its value regardless of its magnitude. Values that don't fit the last bucket are counted in it.
+// Recording is lock-free and safe to call from any thread; reads are not synchronized with concurrent recordings, which
+// is fine for a summary reported when the process exits.
+class ReportLatencyHistogram final
+{
+public:
+    static const unsigned int kSubBucketBits = 2;
+    static const unsigned int kSubBuckets    = 1 << kSubBucketBits;
+    static const unsigned int kMaxExponent   = 26; // ~67s
+    static const unsigned int kBucketCount   = (kMaxExponent - kSubBucketBits + 2) * kSubBuckets;
+
+    ReportLatencyHistogram()
+    {
+        for (unsigned int i = 0; i < kBucketCount; i++)
+        {
+            m_buckets[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Records 'times' reports that took the given time
+    inline void Record(uint64_t microseconds, uint64_t times = 1)
+    {
+        m_buckets[BucketIndex(microseconds)].fetch_add(times, std::memory_order_relaxed);
+        m_count.fetch_add(times, std::memory_order_relaxed);
+
+        uint64_t max = m_max.load(std::memory_order_relaxed);
+        while (microseconds > max && !m_max.compare_exchange_weak(max, microseconds, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    inline uint64_t Count() const { return m_count.load(std::memory_order_relaxed); }
+    inline uint64_t Max()   const { return m_max.load(std::memory_order_relaxed); }
+
+    // Upper bound of the bucket holding the given percentile (0-100) of the recorded values, or 0 if nothing was recorded
+    uint64_t Percentile(unsigned int percentile) const
+    {
+        uint64_t count = Count();
+        if (count == 0)
+        {
+            return 0;
+        }
+
+        uint64_t rank = (count * percentile + 99) / 100;
+        uint64_t seen = 0;
+        for (unsigned int i = 0; i < kBucketCount; i++)
+        {
+            seen += m_buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank && seen > 0)
+            {
+                uint64_t upperBound = BucketUpperBound(i);
+                return upperBound < Max() ? upperBound : Max();
+            }
+        }
+
+        return Max();
+    }
+
+private:
+
+    static inline unsigned int BucketIndex(uint64_t value)
+    {
+        if (value < kSubBuckets)
+        {
+            return (unsigned int)value;
+        }
+
+        unsigned int exponent = 63 - CountLeadingZeros(value);
+        if (exponent > kMaxExponent)
+        {
+            return kBucketCount - 1;
+        }
+
+        unsigned int subBucket = (unsigned int)(value >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+        return (exponent - kSubBucketBits + 1) * kSubBuckets + subBucket;
+    }
+
+    static inline uint64_t BucketUpperBound(unsigned int index)
+    {
+        if (index < kSubBuckets)
+        {
+            return index;
+        }
+
+        unsigned int exponent = index / kSubBuckets + kSubBucketBits - 1;
+        uint64_t subBucket = index % kSubBuckets;
+        return ((kSubBuckets + subBucket + 1) << (exponent - kSubBucketBits)) - 1;
+    }
+
+    static inline unsigned int CountLeadingZeros(uint64_t value)
+    {
+#if _WIN32
+        // _BitScanReverse64 is not available on x86
+        unsigned long index;
+        if (_BitScanReverse(&index, (unsigned long)(value >> 32)))
+        {
+            return 31 - (unsigned int)index;
+        }
+
+        _BitScanReverse(&index, (unsigned long)value);
+        return 63 - (unsigned int)index;
+#else
+        return (unsigned int)__builtin_clzll(value);
+#endif
+    }
+
+    std::atomic<uint64_t> m_buckets[kBucketCount];
+    std::atomic<uint64_t> m_count { 0 };
+    std::atomic<uint64_t> m_max { 0 };
+};
@@ -0,0 +1,72 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+// Tells when a process sends access reports fast enough for batching them to pay off (FileAccessManifestExtraFlag::AdaptiveReportBatching).
+// Shared by the Windows and Linux sandboxes.
+//
+// Keeps an exponentially weighted moving average of the time between consecutive reports of the process, where the newest interval
+// weighs 1/8. The process enters a storm when the average drops below kEnterIntervalNs and leaves it when the average goes back above
+// kLeaveIntervalNs: the gap between the two keeps a process whose rate hovers around a threshold from flapping between modes.
+// Recording is lock-free. Concurrent recordings may overwrite each other's update of the average, which only makes it a bit less exact.
+class ReportStormDetector final
+{
+public:
+    // 50,000 reports per second
+    static const uint64_t kEnterIntervalNs = 20 * 1000;
+    // 5,000 reports per second
+    static const uint64_t kLeaveIntervalNs = 200 * 1000;
+
+    enum class Transition
+    {
+        None,
+        Entered,
+        Left,
+    };
+
+    // Accounts for a report sent at 'nowNs', taken from a monotonic clock. Only one of the threads recording concurrently gets a transition.
+    Transition Record(uint64_t nowNs)
+    {
+        uint64_t last = m_lastNs.exchange(nowNs, std::memory_order_relaxed);
+        if (last == 0)
+        {
+            return Transition::None;
+        }
+
+        // Another thread may have read the clock before us but recorded after us
+        uint64_t interval = nowNs > last ? nowNs - last : 0;
+        uint64_t average = m_averageNs.load(std::memory_order_relaxed);
+        average = average - (average >> 3) + (interval >> 3);
+        m_averageNs.store(average, std::memory_order_relaxed);
+
+        bool inStorm = m_inStorm.load(std::memory_order_relaxed);
+        if (!inStorm && average < kEnterIntervalNs && m_inStorm.compare_exchange_strong(inStorm, true, std::memory_order_relaxed))
+        {
+            m_storms.fetch_add(1, std::memory_order_relaxed);
+            return Transition::Entered;
+        }
+
+        if (inStorm && average > kLeaveIntervalNs && m_inStorm.compare_exchange_strong(inStorm, false, std::memory_order_relaxed))
+        {
+            return Transition::Left;
+        }
+
+        return Transition::None;
+    }
+
+    inline bool InStorm() const { return m_inStorm.load(std::memory_order_relaxed); }
+
+    // Number of times the process entered a storm
+    inline uint64_t Storms() const { return m_storms.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> m_lastNs { 0 };
+    // Starts out calm: it takes a burst of about 20 reports in a row to enter a storm
+    std::atomic<uint64_t> m_averageNs { kLeaveIntervalNs };
+    std::atomic<bool> m_inStorm { false };
+    std::atomic<uint64_t> m_storms { 0 };
+};
@@ -3,10 +3,14 @@
 
 #pragma once
 
+#include <atomic>
 #include <map>
 #include <set>
 #include <memory>
+#include <mutex>
 #include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include "PathTree.h"
@@ -15,6 +19,15 @@ typedef std::shared_mutex ResolvedPathCacheLock;
 typedef std::unique_lock<ResolvedPathCacheLock> ResolvedPathCacheWriteLock;
 typedef std::shared_lock<ResolvedPathCacheLock> ResolvedPathCacheReadLock;
 
+// Number of shards the per-path caches are split in, each one with its own lock
+#define RESOLVED_PATH_CACHE_SHARDS 16
+
+// Memory the cache may take when the manifest does not set a budget
+#define RESOLVED_PATH_CACHE_DEFAULT_BUDGET (64 * 1024 * 1024)
+
+// Approximate memory taken by an entry of the cache, besides its paths (map node, string headers, generation)
+#define RESOLVED_PATH_CACHE_ENTRY_OVERHEAD 96
+
 enum class ResolvedPathType
 {
     Intermediate, // Identifies a path that was found as an intermediate result when resolving all reparse point occurences of a specific base path
@@ -27,6 +40,13 @@ template<typename K> struct Possible
     K Value;
 };
 
+// A value cached for a path, along with the generation of the cache it was inserted at (see ResolvedPathCache::IsCurrent)
+template<typename V> struct Generational
+{
+    V Value;
+    unsigned long long Generation;
+};
+
 // Shared pointers are used because keeping the actual objects in the map either results in copying, or getting pointers to the map memory which can become invalid when the map is changed.
 // Raw pointers are not used because the creation of the object is in a different location than the removal/destruction of the object, and it is hard to know when the last reference will be gone.
 typedef std::pair<std::shared_ptr<std::vector<std::wstring>>, std::shared_ptr<std::map<std::wstring, ResolvedPathType, CaseInsensitiveStringLessThan>>> ResolvedPathCacheEntries;
@@ -34,18 +54,83 @@ typedef std::pair<std::shared_ptr<std::vector<std::wstring>>, std::shared_ptr<st
 static CaseInsensitiveStringLessThan caseInsensitiveLessThan = CaseInsensitiveStringLessThan();
 
 // Case insensitive comparer for the target cache to handle pairs (wstring, bool). Delegates the wstrings to
-// the CaseInsensitiveStringLessThan class.
+// the CaseInsensitiveStringLessThan class. Transparent, so the cache can be looked up with (wstring_view, bool) pairs.
 struct CaseInsensitiveTargetCacheLessThan {
-    bool operator()(const std::pair<std::wstring, bool>& lhs, const std::pair<std::wstring, bool>& rhs) const {
+    typedef void is_transparent;
+
+    template<typename L, typename R>
+    bool operator()(const std::pair<L, bool>& lhs, const std::pair<R, bool>& rhs) const {
         if (lhs.second != rhs.second)
         {
             return lhs.second;
         }
         else
         {
-            return caseInsensitiveLessThan.operator()(lhs.first, rhs.first);
+            return caseInsensitiveLessThan.operator()(std::wstring_view(lhs.first), std::wstring_view(rhs.first));
+        }
+    }
+};
+
+// A map keyed by paths compared case-insensitively. Entries are bucketed by the case-folded 64-bit hash of their path
+// (see CaseInsensitiveHash64), which callers compute once per path, so a lookup takes a path view, never allocates and
+// only compares the full path against the entries with the same hash.
+template<typename V> class CaseInsensitivePathMap
+{
+public:
+    typedef V mapped_type;
+
+    inline const V* Find(std::wstring_view path, unsigned long long hash) const
+    {
+        const auto range = m_entries.equal_range(hash);
+        for (auto iter = range.first; iter != range.second; ++iter)
+        {
+            if (s_comparer(std::wstring_view(iter->second.first), path))
+            {
+                return &iter->second.second;
+            }
+        }
+
+        return nullptr;
+    }
+
+    // Returns false if there is already an entry for the path
+    inline bool Emplace(std::wstring_view path, unsigned long long hash, const V& value)
+    {
+        if (Find(path, hash) != nullptr)
+        {
+            return false;
+        }
+
+        m_entries.emplace(hash, std::make_pair(std::wstring(path), value));
+        return true;
+    }
+
+    inline void Clear()
+    {
+        m_entries.clear();
+    }
+
+    inline void Erase(std::wstring_view path, unsigned long long hash)
+    {
+        const auto range = m_entries.equal_range(hash);
+        for (auto iter = range.first; iter != range.second; ++iter)
+        {
+            if (s_comparer(std::wstring_view(iter->second.first), path))
+            {
+                m_entries.erase(iter);
+                return;
+            }
         }
     }
+
+private:
+    // The keys are already hashes
+    struct IdentityHasher {
+        size_t operator()(unsigned long long hash) const noexcept { return (size_t)hash; }
+    };
+
+    std::unordered_multimap<unsigned long long, std::pair<std::wstring, V>, IdentityHasher> m_entries;
+    static inline const CaseInsensitiveStringComparer s_comparer = CaseInsensitiveStringComparer();
 };
 
 // A note on how paths are stored in the cache: Paths coming from detoured functions may vary in casing and may or may not
@@ -53,54 +138,89 @@ struct CaseInsensitiveTargetCacheLessThan {
 // differences, but the resolved path cache should treat those as equivalent paths (e.g C:\foo, C:\FOO and C:\foo\ should be considered equivalent directories).
 // All cache related structures use a case insensitive comparer for paths. Observe this doesn't change any user-facing paths (i.e. 
 // paths reported or used for real accesses)
+// Lookups normalize paths into views of the caller's string (see NormalizeView) and hash them once, and m_pathTree walks the atoms of
+// those views (see PathAtoms), so they don't allocate. Insertions only copy the paths they keep.
+//
+// A note on invalidation: Invalidating a path erases what is cached for it. Invalidating a directory also makes stale everything cached
+// under it, which is not erased: the directory is recorded as invalidated at a new generation of the cache (m_invalidatedDirectories),
+// and entries are stamped with the generation they were inserted at. A lookup treats an entry as a miss if one of the ancestors of its
+// path was invalidated after it was inserted (see IsCurrent), and an insertion replaces a stale entry. So invalidating a directory costs
+// the same however many paths were cached under it.
+//
+// A note on locking: The caches keyed by a single path (m_resolverCache and m_targetCache) are split in shards by path hash, each
+// one with its own lock, so threads looking up or inserting different paths don't wait for each other. The cache of resolved paths
+// and its back pointers (m_paths and m_paths_reverse) refer to each other and share a lock. Inserting takes m_invalidationLock in
+// shared mode and Invalidate takes it exclusively, so an entry is never stamped with a generation in the middle of an invalidation.
+// Locks are always taken in this order: m_invalidationLock, m_pathTreeLock, the lock of a shard, m_pathsLock, m_generationsLock.
+//
+// A note on the memory budget: The cache keeps a rough account of the memory its entries take, and once that goes over the budget
+// (see SetBudget) the next insertion starts over from an empty cache. Entries can't be evicted one by one: the entries of m_paths
+// and their back pointers refer to each other, and m_pathTree would still keep every path ever inserted. Starting over is the same
+// as invalidating everything, so it is always safe; it only matters for processes that keep resolving new paths for long (e.g. services).
 class ResolvedPathCache {
 public:
     inline bool InsertResolvingCheckResult(const std::wstring& path, bool result)
     {
-        // Using the cache is best effort, as this is faster than waiting on locks.  It is not incorrect to not have a value in the cache, just might result in more I/O when the file is not found in the cache.
-        ResolvedPathCacheWriteLock w_lock(m_lock, std::try_to_lock);
-        if (!w_lock.owns_lock())
-        {
-            return false;
-        }
+        ClearIfOverBudget();
+        ResolvedPathCacheReadLock invalidation_lock(m_invalidationLock);
 
-        const std::wstring normalizedPath = Normalize(path);
-        if (!m_pathTree.TryInsert(normalizedPath))
+        const std::wstring_view normalizedPath = NormalizeView(path);
+        if (!TryInsertInPathTree(normalizedPath))
         {
             return false;
         }
 
-        return m_resolverCache.emplace(normalizedPath, result).second;
+        const unsigned long long hash = CaseInsensitiveHash64(normalizedPath);
+        Shard& shard = GetShard(hash);
+        ResolvedPathCacheWriteLock w_lock(shard.Lock);
+        return Emplace(shard.ResolverCache, normalizedPath, hash, result);
     }
 
     inline const Possible<bool> GetResolvingCheckResult(const std::wstring& path)
     {
-        // The resolver cache is essentially caching GetFileAttributesW when trying to discover reparse points. This is a very frequent IO operation and a relatively cheap
-        // one, so use best effort basis.
-        return Find(m_resolverCache, Normalize(path), true);
+        // The resolver cache is essentially caching GetFileAttributesW when trying to discover reparse points. This is a very frequent IO operation,
+        // which is why this cache is sharded and looked up without allocating.
+        const std::wstring_view normalizedPath = NormalizeView(path);
+        const unsigned long long hash = CaseInsensitiveHash64(normalizedPath);
+        Shard& shard = GetShard(hash);
+        Possible<Generational<bool>> found;
+        {
+            ResolvedPathCacheReadLock r_lock(shard.Lock);
+            found = Find(shard.ResolverCache, normalizedPath, hash);
+        }
+
+        return IfCurrent(found, normalizedPath);
     }
 
     inline bool InsertResolvedPathWithType(const std::wstring& path, std::wstring& resolved, DWORD type)
     {
-        ResolvedPathCacheWriteLock w_lock(m_lock, std::try_to_lock);
-        if (!w_lock.owns_lock())
-        {
-            return false;
-        }
+        ClearIfOverBudget();
+        ResolvedPathCacheReadLock invalidation_lock(m_invalidationLock);
 
-        const std::wstring normalizedPath = Normalize(path);
-        if (!m_pathTree.TryInsert(normalizedPath))
+        const std::wstring_view normalizedPath = NormalizeView(path);
+        if (!TryInsertInPathTree(normalizedPath))
         {
             return false;
         }
 
-        return m_targetCache.emplace(normalizedPath, std::make_pair(resolved, type)).second;
+        const unsigned long long hash = CaseInsensitiveHash64(normalizedPath);
+        Shard& shard = GetShard(hash);
+        ResolvedPathCacheWriteLock w_lock(shard.Lock);
+        return Emplace(shard.TargetCache, normalizedPath, hash, std::make_pair(resolved, type));
     }
 
     inline const Possible<std::pair<std::wstring, DWORD>> GetResolvedPathAndType(const std::wstring& path)
     {
-        // This cache is only accessed on the case of reparse points, so we don't expect high contention on the lock. Not using best effort basis should be fine.
-        return Find(m_targetCache, Normalize(path), false);
+        const std::wstring_view normalizedPath = NormalizeView(path);
+        const unsigned long long hash = CaseInsensitiveHash64(normalizedPath);
+        Shard& shard = GetShard(hash);
+        Possible<Generational<std::pair<std::wstring, DWORD>>> found;
+        {
+            ResolvedPathCacheReadLock r_lock(shard.Lock);
+            found = Find(shard.TargetCache, normalizedPath, hash);
+        }
+
+        return IfCurrent(found, normalizedPath);
     }
 
     inline bool InsertResolvedPaths(
@@ -109,27 +229,29 @@ public:
         std::shared_ptr<std::vector<std::wstring>>& insertion_order,
         std::shared_ptr<std::map<std::wstring, ResolvedPathType, CaseInsensitiveStringLessThan>>& resolved_paths)
     {
-        ResolvedPathCacheWriteLock w_lock(m_lock, std::try_to_lock);
-        if (!w_lock.owns_lock())
-        {
-            return false;
-        }
+        ClearIfOverBudget();
+        ResolvedPathCacheReadLock invalidation_lock(m_invalidationLock);
 
         std::wstring normalizedPath = Normalize(path);
 
-        if (!m_pathTree.TryInsert(normalizedPath))
         {
-            return false;
-        }
-
-        for (auto iter = resolved_paths->begin(); iter != resolved_paths->end(); ++iter)
-        {
-            if (!m_pathTree.TryInsert(Normalize(iter->first)))
+            std::lock_guard<std::mutex> tree_lock(m_pathTreeLock);
+            if (!m_pathTree.TryInsert(normalizedPath))
             {
                 return false;
             }
+
+            for (auto iter = resolved_paths->begin(); iter != resolved_paths->end(); ++iter)
+            {
+                if (!m_pathTree.TryInsert(NormalizeView(iter->first)))
+                {
+                    return false;
+                }
+            }
         }
 
+        ResolvedPathCacheWriteLock w_lock(m_pathsLock);
+
         for (auto iter = insertion_order->begin(); iter != insertion_order->end(); ++iter)
         {
             auto reverseLookup = m_paths_reverse.find(*iter);
@@ -144,38 +266,286 @@ public:
             }
         }
 
-        return m_paths.emplace(std::make_pair(normalizedPath, preserveLastReparsePointInPath), std::make_pair(insertion_order, resolved_paths)).second;
+        auto existing = m_paths.find(std::make_pair(std::wstring_view(normalizedPath), preserveLastReparsePointInPath));
+        if (existing != m_paths.end())
+        {
+            if (IsCurrent(normalizedPath, existing->second))
+            {
+                return false;
+            }
+
+            // The back pointers of the stale entry are left behind: they can only cause this entry to be erased more often than needed
+            m_paths.erase(existing);
+        }
+
+        Generational<ResolvedPathCacheEntries> entries { std::make_pair(insertion_order, resolved_paths), m_generation.load(std::memory_order_relaxed) };
+        if (!m_paths.emplace(std::make_pair(normalizedPath, preserveLastReparsePointInPath), entries).second)
+        {
+            return false;
+        }
+
+        // The back pointers take about as much as the entry itself
+        size_t size = ApproximateSize(normalizedPath);
+        for (auto iter = resolved_paths->begin(); iter != resolved_paths->end(); ++iter)
+        {
+            size += 2 * ApproximateSize(iter->first);
+        }
+
+        Account(size);
+        return true;
     }
 
     inline const Possible<ResolvedPathCacheEntries> GetResolvedPaths(const std::wstring& path, bool preserveLastReparsePointInPath)
     {
-        // A hit in m_paths involves many IO operations. Let's not make the search best effort basis since waiting for a read lock is worth it
-        return Find(m_paths, std::make_pair(Normalize(path), preserveLastReparsePointInPath), false);
+        const std::wstring_view normalizedPath = NormalizeView(path);
+        Possible<Generational<ResolvedPathCacheEntries>> found;
+        {
+            ResolvedPathCacheReadLock r_lock(m_pathsLock);
+            found = Find(m_paths, std::make_pair(normalizedPath, preserveLastReparsePointInPath));
+        }
+
+        Possible<ResolvedPathCacheEntries> p;
+        p.Found = found.Found && IsCurrent(normalizedPath, found.Value);
+        if (p.Found)
+        {
+            p.Value = found.Value.Value;
+        }
+
+        return p;
     }
 
     void Invalidate(const std::wstring& path, bool isDirectory)
     {
-        ResolvedPathCacheWriteLock w_lock(m_lock);
+        // Every path the cache holds something about is in m_pathTree, as are the ancestors of those paths. Most invalidations
+        // are for paths that were never resolved (e.g. the files and directories of a tree being deleted one by one), so
+        // check for that first without blocking the threads that look up or insert paths.
+        if (!IsInPathTree(NormalizeView(path)))
+        {
+            return;
+        }
 
         const std::wstring normalizedPath = Normalize(path);
 
+        ResolvedPathCacheWriteLock invalidation_lock(m_invalidationLock);
+
         // Invalidating the back references to this normalized path is important only because by deleting or creating this link other links type (intermediate/fully resolved) may be out of date.
         InvalidateThisPath(normalizedPath);
 
         if (isDirectory)
         {
-
             // Invalidate all its descendants
             // This is for absent path probes, if something probes a\b\c and suddently a\b changes, a\b\c might point somewhere different.  The same is not true for file symlinks
-            std::vector<std::wstring> descendants;
-            m_pathTree.RetrieveAndRemoveAllDescendants(normalizedPath, descendants);
-            for (auto iter = descendants.begin(); iter != descendants.end(); ++iter)
+            // The descendants are not visited: everything cached under the directory before this generation becomes stale (see IsCurrent)
+            const unsigned long long generation = m_generation.load(std::memory_order_relaxed) + 1;
+            const unsigned long long hash = CaseInsensitiveHash64(normalizedPath);
             {
-                InvalidateThisPath(*iter);
+                ResolvedPathCacheWriteLock generations_lock(m_generationsLock);
+                m_invalidatedDirectories.Erase(normalizedPath, hash);
+                m_invalidatedDirectories.Emplace(normalizedPath, hash, generation);
             }
+
+            // Published once the directory is recorded, so a lookup seeing the new generation finds it
+            m_generation.store(generation, std::memory_order_release);
         }
     }
 
+    // Sets how much memory, in bytes, the cache may take. 0 means the default budget.
+    void SetBudget(size_t budget)
+    {
+        m_budget.store(budget == 0 ? RESOLVED_PATH_CACHE_DEFAULT_BUDGET : budget, std::memory_order_relaxed);
+    }
+
+    // Number of entries dropped so far because the cache went over its budget
+    unsigned long long GetEvictionCount() const { return m_evictions.load(std::memory_order_relaxed); }
+
+    ResolvedPathCache() = default;
+    ~ResolvedPathCache() = default;
+    ResolvedPathCache(const ResolvedPathCache&) = delete;
+    ResolvedPathCache& operator=(const ResolvedPathCache&) = delete;
+
+    static ResolvedPathCache& Instance()
+    {
+        static ResolvedPathCache instance;
+        return instance;
+    }
+
+private:
+    struct Shard
+    {
+        ResolvedPathCacheLock Lock;
+
+        // A mapping used to cache if base paths need to be resolved (no entry) or have previously been fully resolved
+        CaseInsensitivePathMap<Generational<bool>> ResolverCache;
+
+        // A mapping used to cache DeviceControl calls when querying targets of reparse points, used to avoid unnecessary I/O
+        CaseInsensitivePathMap<Generational<std::pair<std::wstring, DWORD>>> TargetCache;
+    };
+
+    // The shard is picked with the high bits of the hash: the maps of a shard bucket their entries with the low bits,
+    // which are the same for all the paths in a shard
+    inline Shard& GetShard(unsigned long long hash)
+    {
+        return m_shards[(hash >> 32) % RESOLVED_PATH_CACHE_SHARDS];
+    }
+
+    inline bool IsInPathTree(std::wstring_view normalizedPath)
+    {
+        ResolvedPathCacheReadLock invalidation_lock(m_invalidationLock);
+        std::lock_guard<std::mutex> tree_lock(m_pathTreeLock);
+        return m_pathTree.Contains(normalizedPath);
+    }
+
+    inline bool TryInsertInPathTree(std::wstring_view normalizedPath)
+    {
+        std::lock_guard<std::mutex> tree_lock(m_pathTreeLock);
+        return m_pathTree.TryInsert(normalizedPath);
+    }
+
+    // Whether an entry inserted for the given normalized path at the given generation is still current, i.e. none of the ancestors of
+    // the path was invalidated since. Costs a load when no directory was invalidated since, and a lookup per ancestor otherwise.
+    inline bool IsCurrent(std::wstring_view normalizedPath, unsigned long long generation)
+    {
+        if (generation == m_generation.load(std::memory_order_acquire))
+        {
+            return true;
+        }
+
+        ResolvedPathCacheReadLock generations_lock(m_generationsLock);
+
+        // The hashes of the ancestors are the ones of the prefixes of the path, so they are computed in one pass
+        unsigned long long hash = CaseInsensitiveHash64(std::wstring_view());
+        size_t hashed = 0;
+        for (size_t i = 1; i < normalizedPath.size(); i++)
+        {
+            if (!IsDirectorySeparator(normalizedPath[i]))
+            {
+                continue;
+            }
+
+            hash = CaseInsensitiveHash64(normalizedPath.substr(hashed, i - hashed), hash);
+            hashed = i;
+
+            const unsigned long long* invalidatedAt = m_invalidatedDirectories.Find(normalizedPath.substr(0, i), hash);
+            if (invalidatedAt != nullptr && *invalidatedAt > generation)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Same as above for an entry of m_paths, which is also stale if any path it resolves through is
+    inline bool IsCurrent(std::wstring_view normalizedPath, const Generational<ResolvedPathCacheEntries>& entries)
+    {
+        if (!IsCurrent(normalizedPath, entries.Generation))
+        {
+            return false;
+        }
+
+        for (auto iter = entries.Value.first->begin(); iter != entries.Value.first->end(); ++iter)
+        {
+            if (!IsCurrent(NormalizeView(*iter), entries.Generation))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    template<typename V>
+    const Possible<V> IfCurrent(const Possible<Generational<V>>& found, std::wstring_view normalizedPath)
+    {
+        Possible<V> p;
+        p.Found = found.Found && IsCurrent(normalizedPath, found.Value.Generation);
+        if (p.Found)
+        {
+            p.Value = found.Value.Value;
+        }
+
+        return p;
+    }
+
+    // Inserts a value in one of the caches of a shard, replacing the one there if it is stale. Returns false if there is a current one.
+    // The caller holds m_invalidationLock in shared mode and the lock of the shard.
+    template<typename V>
+    bool Emplace(CaseInsensitivePathMap<Generational<V>>& map, std::wstring_view normalizedPath, unsigned long long hash, const V& value)
+    {
+        const Generational<V>* existing = map.Find(normalizedPath, hash);
+        if (existing != nullptr)
+        {
+            if (IsCurrent(normalizedPath, existing->Generation))
+            {
+                return false;
+            }
+
+            map.Erase(normalizedPath, hash);
+        }
+
+        if (!map.Emplace(normalizedPath, hash, Generational<V> { value, m_generation.load(std::memory_order_relaxed) }))
+        {
+            return false;
+        }
+
+        Account(ApproximateSize(normalizedPath) + ApproximateSize(value));
+        return true;
+    }
+
+    static inline size_t ApproximateSize(std::wstring_view path) { return path.size() * sizeof(wchar_t); }
+    static inline size_t ApproximateSize(bool) { return 0; }
+    static inline size_t ApproximateSize(const std::pair<std::wstring, DWORD>& target) { return ApproximateSize(target.first); }
+
+    inline void Account(size_t size)
+    {
+        m_size.fetch_add(size + RESOLVED_PATH_CACHE_ENTRY_OVERHEAD, std::memory_order_relaxed);
+        m_entryCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Empties the cache if its entries take more than the budget. Called before inserting, without holding any lock.
+    void ClearIfOverBudget()
+    {
+        if (m_size.load(std::memory_order_relaxed) <= m_budget.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+
+        ResolvedPathCacheWriteLock invalidation_lock(m_invalidationLock);
+
+        // Some other thread may have gotten here first
+        if (m_size.load(std::memory_order_relaxed) <= m_budget.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> tree_lock(m_pathTreeLock);
+            m_pathTree.Clear();
+        }
+
+        for (size_t i = 0; i < RESOLVED_PATH_CACHE_SHARDS; i++)
+        {
+            ResolvedPathCacheWriteLock w_lock(m_shards[i].Lock);
+            m_shards[i].ResolverCache.Clear();
+            m_shards[i].TargetCache.Clear();
+        }
+
+        {
+            ResolvedPathCacheWriteLock w_lock(m_pathsLock);
+            m_paths.clear();
+            m_paths_reverse.clear();
+        }
+
+        // Nothing is left that was inserted before any of these invalidations
+        {
+            ResolvedPathCacheWriteLock generations_lock(m_generationsLock);
+            m_invalidatedDirectories.Clear();
+        }
+
+        m_evictions.fetch_add(m_entryCount.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+        m_size.store(0, std::memory_order_relaxed);
+    }
+
     /*
      * Suppose we have symlink chain A-> B ->C
      * In m_paths, we have:
@@ -195,8 +565,15 @@ public:
      */
     void InvalidateThisPath(const std::wstring& path)
     {
-        m_resolverCache.erase(path);
-        m_targetCache.erase(path);
+        {
+            const unsigned long long hash = CaseInsensitiveHash64(path);
+            Shard& shard = GetShard(hash);
+            ResolvedPathCacheWriteLock w_lock(shard.Lock);
+            shard.ResolverCache.Erase(path, hash);
+            shard.TargetCache.Erase(path, hash);
+        }
+
+        ResolvedPathCacheWriteLock w_lock(m_pathsLock);
 
         // Erase B from (3)
         // This must go before 'Erase B from (2)' because it needs to be able to find [C]
@@ -225,7 +602,7 @@ public:
         if (lookup != m_paths.end())
         {
             // Iterate through [C] in (2)
-            for (auto it = lookup->second.first->begin(), it_next = it; it != lookup->second.first->end(); it = it_next)
+            for (auto it = lookup->second.Value.first->begin(), it_next = it; it != lookup->second.Value.first->end(); it = it_next)
             {
                 ++it_next;
                 // Find C in (3)
@@ -259,30 +636,13 @@ public:
         }
     }
 
-    ResolvedPathCache() = default;
-    ~ResolvedPathCache() = default;
-    ResolvedPathCache(const ResolvedPathCache&) = delete;
-    ResolvedPathCache& operator=(const ResolvedPathCache&) = delete;
-
-    static ResolvedPathCache& Instance()
-    {
-        static ResolvedPathCache instance;
-        return instance;
-    }
-
-private:
     // Find should not return a pointer, as that memory can become invalid if a different thread adds/removes from the map.
     // Instead, the value store in the map should be a pointer so that the memory isn't copied.
-    template<typename K, typename V, typename C>
-    const Possible<V> Find(std::map<K, V, C>& map, const K& path, bool bestEffortBasis)
+    // The caller holds the lock protecting the map.
+    template<typename M, typename K>
+    const Possible<typename M::mapped_type> Find(M& map, const K& path)
     {
-        Possible<V> p;
-        ResolvedPathCacheReadLock r_lock = bestEffortBasis? ResolvedPathCacheReadLock(m_lock, std::try_to_lock) : ResolvedPathCacheReadLock(m_lock);
-        if (bestEffortBasis && !r_lock.owns_lock())
-        {
-            p.Found = false;
-            return p;
-        }
+        Possible<typename M::mapped_type> p;
 
         auto iter = map.find(path);
         p.Found = iter != map.end();
@@ -294,42 +654,86 @@ private:
         return p;
     }
 
+    template<typename V>
+    const Possible<V> Find(const CaseInsensitivePathMap<V>& map, std::wstring_view path, unsigned long long hash)
+    {
+        Possible<V> p;
+
+        const V* value = map.Find(path, hash);
+        p.Found = value != nullptr;
+        if (p.Found)
+        {
+            p.Value = *value;
+        }
+
+        return p;
+    }
+
     // CanonicalPath does not canonicalize trailing slashes for directories
     // But the cache structures need exact string matching, so we do it here
     // Normalization also removes NT/local device prefix from path because callers may not guarantee that,
     // and methods inside tree, like _wsplitpath relies on the fact that the path does not have such prefixes.
-    inline std::wstring Normalize(const std::wstring& path)
+    // The result is a view of the given path.
+    inline std::wstring_view NormalizeView(const std::wstring& path)
     {
         if (path.size() > 0 && IsDirectorySeparator(path.back()))
         {
-            std::wstring normal = path.substr(0, path.size() - 1);
-            return normal;
+            return std::wstring_view(path.c_str(), path.size() - 1);
         }
 
-        return GetPathWithoutPrefix(path.c_str());
+        const wchar_t* withoutPrefix = GetPathWithoutPrefix(path.c_str());
+        return std::wstring_view(withoutPrefix, path.size() - (withoutPrefix - path.c_str()));
+    }
+
+    // Same as NormalizeView, for the paths the cache keeps
+    inline std::wstring Normalize(const std::wstring& path)
+    {
+        return std::wstring(NormalizeView(path));
     }
 
-    ResolvedPathCacheLock m_lock;
+    // Held in shared mode while inserting and exclusively while invalidating
+    ResolvedPathCacheLock m_invalidationLock;
 
-    // A mapping used to cache if base paths need to be resolved (no entry) or have previously been fully resolved
-    std::map<std::wstring, bool, CaseInsensitiveStringLessThan> m_resolverCache;
+    Shard m_shards[RESOLVED_PATH_CACHE_SHARDS];
 
-    // A mapping used to cache DeviceControl calls when querying targets of reparse points, used to avoid unnecessary I/O
-    std::map<std::wstring, std::pair<std::wstring, DWORD>, CaseInsensitiveStringLessThan> m_targetCache;
+    // Protects m_paths and m_paths_reverse
+    ResolvedPathCacheLock m_pathsLock;
 
     // A mapping used to cache all intermediate paths and the final fully resolved path (value) of an unresolved base 
     // path where its last segment has to be resolved or not(key)
-    std::map<std::pair<std::wstring, bool>, ResolvedPathCacheEntries, CaseInsensitiveTargetCacheLessThan> m_paths;
+    std::map<std::pair<std::wstring, bool>, Generational<ResolvedPathCacheEntries>, CaseInsensitiveTargetCacheLessThan> m_paths;
 
     // Reverse pointers of m_paths.  If m_paths has A -> B, then m_paths_reverse has B -> A
     // Used to make removing values faster.
     std::map<std::wstring, std::set<std::wstring, CaseInsensitiveStringLessThan>, CaseInsensitiveStringLessThan> m_paths_reverse;
 
-    // All the paths the cache is aware of.
-    //
-    // This path tree is used for cache invalidation. Suppose that a process accesses D1 and D1\E1 where both D1 and E1 are
-    // symlinks. The cache will have entries for both D1 and D1\E1. If D1 is removed (e.g., by calling RemoveDirectory), then
-    // the entry for D1\E1 in the cache needs to be removed as well. Otherwise, if subsequently the process decides to create
-    // D1\E1 again but D1 points to a different target, then any access of D1\E1 will get the wrong entry from the cache.
+    // Protects m_pathTree while inserting (insertions run concurrently with each other)
+    std::mutex m_pathTreeLock;
+
+    // All the paths the cache is aware of, and their ancestors: invalidating a path not in the tree is a no-op.
     PathTree m_pathTree;
+
+    // Incremented by every directory invalidation. Entries are stamped with the value at the time they are inserted.
+    std::atomic<unsigned long long> m_generation { 0 };
+
+    // Protects m_invalidatedDirectories
+    ResolvedPathCacheLock m_generationsLock;
+
+    // The generation at which each directory was last invalidated.
+    //
+    // Suppose that a process accesses D1 and D1\E1 where both D1 and E1 are symlinks. The cache will have entries for both
+    // D1 and D1\E1. If D1 is removed (e.g., by calling RemoveDirectory), then the entry for D1\E1 in the cache needs to go
+    // stale as well. Otherwise, if subsequently the process decides to create D1\E1 again but D1 points to a different target,
+    // then any access of D1\E1 will get the wrong entry from the cache.
+    CaseInsensitivePathMap<unsigned long long> m_invalidatedDirectories;
+
+    // Memory the cache may take (see ClearIfOverBudget)
+    std::atomic<size_t> m_budget { RESOLVED_PATH_CACHE_DEFAULT_BUDGET };
+
+    // Approximate memory taken by the entries inserted since the cache was last emptied, and how many they are
+    std::atomic<size_t> m_size { 0 };
+    std::atomic<unsigned long long> m_entryCount { 0 };
+
+    // Number of entries dropped by ClearIfOverBudget so far
+    std::atomic<unsigned long long> m_evictions { 0 };
 };
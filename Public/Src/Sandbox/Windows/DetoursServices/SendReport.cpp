@@ -9,9 +9,12 @@
 #include "DataTypes.h"
 #include "DebuggingHelpers.h"
 #include "DetoursHelpers.h"
+#include "DetourTracing.h"
 #include "FileAccessHelpers.h"
 #include "SendReport.h"
 #include "PolicyResult.h"
+#include "ReportLatencyHistogram.h"
+#include "ReportStormDetector.h"
 #include "buildXL_mem.h"
 
 using std::unique_ptr;
@@ -19,43 +22,486 @@ using std::unique_ptr;
 extern volatile LONG g_detoursAllocatedNoLockConcurentPoolEntries;
 extern volatile LONG64 g_detoursMaxHandleHeapEntries;
 extern volatile LONG64 g_detoursHandleHeapEntries;
+extern volatile LONG64 g_policySearchCacheLookupCount;
+extern volatile LONG64 g_policySearchCacheHitCount;
+extern volatile LONG64 g_closedHandlesPoolMissCount;
+extern volatile LONG64 g_attachManifestParseMicroseconds;
+extern volatile LONG64 g_attachHandleOverlayMicroseconds;
+extern volatile LONG64 g_attachDetoursMicroseconds;
+extern volatile LONG64 g_attachTotalMicroseconds;
 
 // ----------------------------------------------------------------------------
 // HELPER FUNCTION DEFINITIONS
 // ----------------------------------------------------------------------------
 
+// With BatchConcurrentReports (or AdaptiveReportBatching), report lines sent concurrently are written to the report pipe together.
+// While a thread is writing, the threads that come in append their lines to g_pendingReports and wait for the write lock. The first one to get it writes all the
+// pending lines at once, so the others find their lines already written. Unless held (see below), every report still returns
+// only after its own line was written, which keeps reports ordered with respect to whatever the reporting thread does next.
+// The buffers are statically allocated: lines that don't fit are written on their own.
+// Both locks are process-wide, so a thread terminated while holding one (e.g. by TerminateThread, or by ExitProcess while another
+// thread exits) hangs every thread that reports after it. Without batching, each line is written with a single WriteFile and no lock.
+#define REPORT_BATCH_BUFFER_LENGTH 16384
+
+static SRWLOCK g_pendingReportsLock = SRWLOCK_INIT;
+static wchar_t g_pendingReports[REPORT_BATCH_BUFFER_LENGTH];
+static size_t g_pendingReportsLength = 0;   // in characters
+static ULONG64 g_enqueuedReportCount = 0;   // Total number of lines added to g_pendingReports
+static LARGE_INTEGER g_pendingReportsSince; // When the oldest line of g_pendingReports was added
+
+// With AdaptiveReportBatching, threads of a process in a report storm leave their line pending and return without waiting
+// for it to be written, unless that would make the pending lines too many or too old. The held lines are written along with
+// the next line that isn't held, which includes the first line after the storm ends, and when the process exits.
+#define REPORT_HOLD_MAX_LENGTH (REPORT_BATCH_BUFFER_LENGTH / 2)
+#define REPORT_HOLD_MAX_MICROSECONDS (100 * 1000)
+
+static ReportStormDetector g_reportStorms;
+static LONG g_heldReportCount = 0;          // Lines of g_pendingReports whose thread didn't wait for them, guarded by g_pendingReportsLock
+
+// A UTF-16 code unit takes at most 3 bytes in UTF-8 (surrogate pairs take 4 bytes for 2 code units)
+#define MAX_UTF8_BYTES_PER_WCHAR 3
+
+// Most lines that are not batched fit in this many bytes once converted to UTF-8
+#define REPORT_UTF8_STACK_BUFFER_SIZE 4096
+
+static SRWLOCK g_reportWriteLock = SRWLOCK_INIT;
+static wchar_t g_reportWriteBuffer[REPORT_BATCH_BUFFER_LENGTH];
+static char g_reportWriteUtf8Buffer[MAX_UTF8_BYTES_PER_WCHAR * REPORT_BATCH_BUFFER_LENGTH];
+static ULONG64 g_writtenReportCount = 0;    // Total number of lines from g_pendingReports already written, guarded by g_reportWriteLock
+
+// Time from a report line being handed to SendReportString until it was written to the report pipe, summarized in the process data report
+static ReportLatencyHistogram g_reportLatency;
+
+// Lines written while CoalesceReportMessageCount is on that are not yet added to the message count semaphore
+static volatile LONG g_unpublishedReportCount = 0;
+
+/// <summary>
+/// Whether BuildXL reads the report pipe as UTF-8 rather than UTF-16.
+/// Processes breaking away from the sandbox get the report handle to report augmented accesses, which they always write as UTF-16.
+/// </summary>
+/// <remarks>
+/// CODESYNC: Public/Src/Engine/Processes/FileAccessManifest.cs (UseUtf8Reports)
+/// </remarks>
+static bool UseUtf8Reports()
+{
+    return EnableUtf8Reports() && !HasProcessesToBreakAwayFromJob();
+}
+
+static DWORD WriteReportBytes(_In_reads_bytes_(size) void const* bytes, size_t size)
+{
+    OVERLAPPED overlapped;
+    ZeroMemory(&overlapped, sizeof(OVERLAPPED));
+    // This offset specifies "append".
+    overlapped.Offset = 0xFFFFFFFF;
+    overlapped.OffsetHigh = 0xFFFFFFFF;
+
+    DWORD bytesWritten;
+    return WriteFile(g_reportFileHandle, bytes, (DWORD)size, &bytesWritten, &overlapped)
+        ? ERROR_SUCCESS
+        : GetLastError();
+}
+
+/// <summary>
+/// Writes the given text to the report pipe in the encoding BuildXL reads it with.
+/// The UTF-8 conversion goes to utf8Buffer, unless the converted text doesn't fit there.
+/// </summary>
+static bool BatchReports()
+{
+    return BatchConcurrentReports() || AdaptiveReportBatching();
+}
+
+static DWORD WriteReportText(_In_reads_(length) wchar_t const* text, size_t length, _Out_writes_bytes_(utf8BufferSize) char* utf8Buffer, size_t utf8BufferSize)
+{
+    if (!UseUtf8Reports())
+    {
+        return WriteReportBytes(text, sizeof(wchar_t) * length);
+    }
+
+    if (length == 0)
+    {
+        return ERROR_SUCCESS;
+    }
+
+    // Reports are mostly ASCII paths: narrow the ASCII prefix directly and only hand what follows to WideCharToMultiByte.
+    // A non-ASCII character can't be half of a surrogate pair started in the prefix, so the remainder converts on its own.
+    const size_t asciiLength = length <= utf8BufferSize ? NarrowAsciiPrefix(text, length, utf8Buffer) : 0;
+    if (asciiLength == length)
+    {
+        return WriteReportBytes(utf8Buffer, length);
+    }
+
+    // asciiLength < length <= utf8BufferSize, or asciiLength is 0: some room is left, so WideCharToMultiByte converts rather than measures
+    int size = WideCharToMultiByte(CP_UTF8, 0, text + asciiLength, (int)(length - asciiLength), utf8Buffer + asciiLength, (int)(utf8BufferSize - asciiLength), nullptr, nullptr);
+    if (size > 0)
+    {
+        return WriteReportBytes(utf8Buffer, asciiLength + size);
+    }
+
+    size = WideCharToMultiByte(CP_UTF8, 0, text, (int)length, nullptr, 0, nullptr, nullptr);
+    if (size <= 0)
+    {
+        return GetLastError();
+    }
+
+    unique_ptr<char[]> heapBuffer(new char[size]);
+    WideCharToMultiByte(CP_UTF8, 0, text, (int)length, heapBuffer.get(), size, nullptr, nullptr);
+    return WriteReportBytes(heapBuffer.get(), size);
+}
+
+DWORD WriteToReportPipe(_In_reads_(length) wchar_t const* text, size_t length)
+{
+    char utf8Buffer[REPORT_UTF8_STACK_BUFFER_SIZE];
+    return WriteReportText(text, length, utf8Buffer, sizeof(utf8Buffer));
+}
+
+/// <summary>
+/// Writes the given report lines to the report pipe right away. Returns the error code if the write failed, or ERROR_SUCCESS.
+/// </summary>
+static DWORD WriteReportLines(_In_reads_(length) wchar_t const* lines, size_t length, LONG lineCount, _Out_writes_bytes_(utf8BufferSize) char* utf8Buffer, size_t utf8BufferSize)
+{
+    DetourTraceTimer trace(DETOUR_TRACE_KEYWORD_REPORT);
+    DWORD error = WriteReportText(lines, length, utf8Buffer, utf8BufferSize);
+
+    // Only lines that made it to the pipe are counted: BuildXL waits for as many lines as the semaphore says were sent
+    if (error == ERROR_SUCCESS && g_messageCountSemaphore != INVALID_HANDLE_VALUE)
+    {
+        if (CoalesceReportMessageCount())
+        {
+            // Counted once for the whole process by PublishReportMessageCount
+            InterlockedAdd(&g_unpublishedReportCount, lineCount);
+        }
+        else
+        {
+            // Increment the message sent counter.
+            ReleaseSemaphore(g_messageCountSemaphore, lineCount, nullptr);
+        }
+    }
+
+    if (trace.IsTracing())
+    {
+        TraceReportWrite(length, lineCount, error, trace.ElapsedMicroseconds());
+    }
+
+    return error;
+}
+
+void PublishReportMessageCount()
+{
+    LONG count = InterlockedExchange(&g_unpublishedReportCount, 0);
+    if (count > 0 && g_messageCountSemaphore != INVALID_HANDLE_VALUE)
+    {
+        ReleaseSemaphore(g_messageCountSemaphore, count, nullptr);
+    }
+}
+
+static void HandleReportWriteError(_In_z_ wchar_t const* dataString, DWORD error)
+{
+    std::wstring errorMsg = DebugStringFormat(L"SendReportString: Failed to write file access report line '%s' (error code: 0x%08X)", dataString, (int)error);
+    Dbg(errorMsg.c_str());
+    HandleDetoursInjectionAndCommunicationErrors(DETOURS_PIPE_WRITE_ERROR_4, errorMsg.c_str(), DETOURS_WINDOWS_LOG_MESSAGE_4);
+}
+
+/// <summary>
+/// Sends a report line to BuildXL without batching it with the lines reported by other threads.
+/// This takes no locks, so it is safe to call during DLL_PROCESS_DETACH, when other threads may have been terminated while holding them.
+/// </summary>
+static void SendReportStringUnbatched(_In_z_ wchar_t const* dataString)
+{
+    if (g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    DWORD lastError = GetLastError();
+    char utf8Buffer[REPORT_UTF8_STACK_BUFFER_SIZE];
+    DWORD error = WriteReportLines(dataString, wcslen(dataString), 1, utf8Buffer, sizeof(utf8Buffer));
+    if (error != ERROR_SUCCESS)
+    {
+        HandleReportWriteError(dataString, error);
+    }
+
+    SetLastError(lastError);
+}
+
+/// <summary>
+/// Writes every pending line to the report pipe. The caller must hold g_reportWriteLock.
+/// </summary>
+static DWORD WritePendingReports()
+{
+    AcquireSRWLockExclusive(&g_pendingReportsLock);
+    size_t batchLength = g_pendingReportsLength;
+    ULONG64 batchEnd = g_enqueuedReportCount;
+    LONG heldCount = g_heldReportCount;
+    LARGE_INTEGER heldSince = g_pendingReportsSince;
+    wmemcpy(g_reportWriteBuffer, g_pendingReports, batchLength);
+    g_pendingReportsLength = 0;
+    g_heldReportCount = 0;
+    ReleaseSRWLockExclusive(&g_pendingReportsLock);
+
+    if (batchLength == 0)
+    {
+        return ERROR_SUCCESS;
+    }
+
+    DWORD error = WriteReportLines(g_reportWriteBuffer, batchLength, (LONG)(batchEnd - g_writtenReportCount), g_reportWriteUtf8Buffer, sizeof(g_reportWriteUtf8Buffer));
+    g_writtenReportCount = batchEnd;
+
+    // Nobody waited for the held lines: account them all with the age of the oldest pending line
+    if (heldCount > 0)
+    {
+        g_reportLatency.Record((uint64_t)MicrosecondsSince(heldSince), (uint64_t)heldCount);
+    }
+
+    return error;
+}
+
+/// <summary>
+/// Whether the process is in a report storm, accounting for a report sent at 'now'. Always false without AdaptiveReportBatching.
+/// </summary>
+static bool IsInReportStorm(LARGE_INTEGER const& now)
+{
+    if (!AdaptiveReportBatching())
+    {
+        return false;
+    }
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    uint64_t nowNs = (uint64_t)(now.QuadPart / frequency.QuadPart) * 1000000000 + (uint64_t)(now.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+
+    // Leaving the storm is seen by one thread only, whose line then gets written along with every held one
+    return g_reportStorms.Record(nowNs) != ReportStormDetector::Transition::Left && g_reportStorms.InStorm();
+}
+
+void FlushPendingReports()
+{
+    // Nothing is ever pending without batching, and this runs on DLL_PROCESS_DETACH: don't take the lock for nothing
+    if (g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE || !BatchReports()) {
+        return;
+    }
+
+    DWORD lastError = GetLastError();
+
+    AcquireSRWLockExclusive(&g_reportWriteLock);
+    DWORD error = WritePendingReports();
+    ReleaseSRWLockExclusive(&g_reportWriteLock);
+
+    if (error != ERROR_SUCCESS)
+    {
+        HandleReportWriteError(L"(pending reports)", error);
+    }
+
+    SetLastError(lastError);
+}
+
 void SendReportString(_In_z_ wchar_t const* dataString)
 {
     if (g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE) {
         return;
     }
 
-    // Increment the message sent counter.
-    if (g_messageCountSemaphore != INVALID_HANDLE_VALUE)
+    if (!BatchReports())
     {
-        ReleaseSemaphore(g_messageCountSemaphore, 1, nullptr);
+        LARGE_INTEGER start;
+        QueryPerformanceCounter(&start);
+        SendReportStringUnbatched(dataString);
+        g_reportLatency.Record((uint64_t)MicrosecondsSince(start));
+        return;
     }
 
-    OVERLAPPED overlapped;
-    ZeroMemory(&overlapped, sizeof(OVERLAPPED));
-    // This offset specifies "append".
-    overlapped.Offset = 0xFFFFFFFF;
-    overlapped.OffsetHigh = 0xFFFFFFFF;
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+
+    size_t length = wcslen(dataString);
+    ULONG64 ticket = 0;
+    bool held = false;
+    bool inStorm = IsInReportStorm(start);
+
+    AcquireSRWLockExclusive(&g_pendingReportsLock);
+    if (g_pendingReportsLength + length <= REPORT_BATCH_BUFFER_LENGTH)
+    {
+        if (g_pendingReportsLength == 0)
+        {
+            g_pendingReportsSince = start;
+        }
+
+        wmemcpy(&g_pendingReports[g_pendingReportsLength], dataString, length);
+        g_pendingReportsLength += length;
+        ticket = ++g_enqueuedReportCount;
+
+        held = inStorm
+            && g_pendingReportsLength <= REPORT_HOLD_MAX_LENGTH
+            && MicrosecondsSince(g_pendingReportsSince) < REPORT_HOLD_MAX_MICROSECONDS;
+        if (held)
+        {
+            g_heldReportCount++;
+        }
+    }
+    ReleaseSRWLockExclusive(&g_pendingReportsLock);
+
+    if (held)
+    {
+        return;
+    }
+
+    if (ticket == 0)
+    {
+        // Lines held by this thread must go first
+        if (AdaptiveReportBatching())
+        {
+            FlushPendingReports();
+        }
+
+        SendReportStringUnbatched(dataString);
+        g_reportLatency.Record((uint64_t)MicrosecondsSince(start));
+        return;
+    }
 
-    size_t reportLineLength = sizeof(wchar_t) * wcslen(dataString);
-    DWORD bytesWritten;
     DWORD lastError = GetLastError();
-    if (!WriteFile(g_reportFileHandle, dataString, (DWORD)reportLineLength, &bytesWritten, &overlapped))
+    DWORD error = ERROR_SUCCESS;
+
+    AcquireSRWLockExclusive(&g_reportWriteLock);
+    if (g_writtenReportCount < ticket)
+    {
+        // Our line is still pending: write it along with whatever other threads added in the meantime
+        error = WritePendingReports();
+    }
+    ReleaseSRWLockExclusive(&g_reportWriteLock);
+
+    g_reportLatency.Record((uint64_t)MicrosecondsSince(start));
+
+    // Handling the error may end up exiting the process, which reports again: this must happen without holding any locks
+    if (error != ERROR_SUCCESS)
     {
-        DWORD error = GetLastError();
-        std::wstring errorMsg = DebugStringFormat(L"SendReportString: Failed to write file access report line '%s' (error code: 0x%08X)", dataString, (int)error);
-        Dbg(errorMsg.c_str());
-        HandleDetoursInjectionAndCommunicationErrors(DETOURS_PIPE_WRITE_ERROR_4, errorMsg.c_str(), DETOURS_WINDOWS_LOG_MESSAGE_4);
+        HandleReportWriteError(dataString, error);
     }
 
     SetLastError(lastError);
 }
 
+// Most reports fit in this many characters
+#define REPORT_STACK_BUFFER_LENGTH 1024
+
+/// <summary>
+/// Writes a report line into a caller-provided buffer, field by field.
+/// </summary>
+/// <remarks>
+/// Writing past the end of the buffer is not possible: Finish fails if anything didn't fit.
+/// </remarks>
+class ReportLineWriter
+{
+public:
+    ReportLineWriter(_Out_writes_(length) wchar_t* buffer, size_t length)
+        : m_buffer(buffer), m_current(buffer), m_end(buffer + length), m_overflow(false)
+    {
+    }
+
+    void AppendChar(wchar_t c)
+    {
+        if (Reserve(1))
+        {
+            *m_current++ = c;
+        }
+    }
+
+    void AppendString(_In_reads_(length) wchar_t const* str, size_t length)
+    {
+        if (Reserve(length))
+        {
+            wmemcpy(m_current, str, length);
+            m_current += length;
+        }
+    }
+
+    void AppendStringReplacingNewLines(_In_reads_(length) wchar_t const* str, size_t length)
+    {
+        if (Reserve(length))
+        {
+            for (size_t i = 0; i < length; i++)
+            {
+                *m_current++ = (str[i] == L'\r' || str[i] == L'\n') ? L' ' : str[i];
+            }
+        }
+    }
+
+    /// <summary>
+    /// Same as %x (or %llx): lower case, no leading zeros.
+    /// </summary>
+    void AppendHex(ULONG64 value)
+    {
+        wchar_t digits[16];
+        size_t count = 0;
+        do
+        {
+            digits[count++] = L"0123456789abcdef"[value & 0xF];
+            value >>= 4;
+        } while (value != 0);
+
+        AppendReversed(digits, count);
+    }
+
+    void AppendSeparatedHex(ULONG64 value)
+    {
+        AppendChar(L'|');
+        AppendHex(value);
+    }
+
+    void AppendDecimal(ULONG64 value)
+    {
+        wchar_t digits[20];
+        size_t count = 0;
+        do
+        {
+            digits[count++] = (wchar_t)(L'0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+
+        AppendReversed(digits, count);
+    }
+
+    void AppendSeparatedDecimal(ULONG64 value)
+    {
+        AppendChar(L'|');
+        AppendDecimal(value);
+    }
+
+    /// <summary>
+    /// Null-terminates the line. Returns the number of characters written (not counting the terminator), or -1 if the buffer was too small.
+    /// </summary>
+    int Finish()
+    {
+        if (!Reserve(1))
+        {
+            return -1;
+        }
+
+        *m_current = L'\0';
+        return (int)(m_current - m_buffer);
+    }
+
+private:
+    bool Reserve(size_t length)
+    {
+        m_overflow = m_overflow || (size_t)(m_end - m_current) < length;
+        return !m_overflow;
+    }
+
+    void AppendReversed(wchar_t const* digits, size_t count)
+    {
+        if (Reserve(count))
+        {
+            while (count > 0)
+            {
+                *m_current++ = digits[--count];
+            }
+        }
+    }
+
+    wchar_t* const m_buffer;
+    wchar_t* m_current;
+    wchar_t* const m_end;
+    bool m_overflow;
+};
+
 /**
  ** Escapes new line characters from filenames by replacing the \ with \\
  ** Returns true if the filename needed to be escaped, with the escaped name set in escapedFileName.
@@ -145,8 +591,12 @@ void ReportFileAccess(
         g_currentProcessCommandLine = L"";
     }
 
+    // Only report the process command line args when the C# code has requested it and when the file operation context is "Process"
+    // This way we only transmit the command line arguments once
+    bool reportProcessArgs = ReportProcessArgs() && !_wcsicmp(fileOperationContext.Operation, L"Process");
+
     size_t filterLength = wcslen(filterStr); // in characters
-    size_t fileProcessCommandLineLength = wcslen(g_currentProcessCommandLine); // in characters
+    size_t fileProcessCommandLineLength = reportProcessArgs ? wcslen(g_currentProcessCommandLine) : 0; // in characters
     size_t operationLen = wcslen(fileOperationContext.Operation); // in characters
     size_t reportBufferSize = fileNameLength + filterLength + fileProcessCommandLineLength + operationLen + 116; // in characters
 
@@ -168,18 +618,49 @@ void ReportFileAccess(
     // filename separately added
     // filterStr separately added
     // fileOrDirectoryAttribute � 8 chars
-    // g_currentProcessCommandLine � separately added
+    // g_currentProcessCommandLine � separately added, only for process reports
     // 15 chars for | chars
     // 5 chars for �, �  � : � �\r� �\n� �\0� chars
     // Total : 120 characters.
 
-    unique_ptr<wchar_t[]> report(new wchar_t[reportBufferSize]);
-    assert(report.get());
+    // This is the most frequent report, so don't go to the heap for it unless the line doesn't fit in a stack buffer
+    wchar_t stackBuffer[REPORT_STACK_BUFFER_LENGTH];
+    unique_ptr<wchar_t[]> heapBuffer;
+    wchar_t* report = stackBuffer;
+    if (reportBufferSize > REPORT_STACK_BUFFER_LENGTH)
+    {
+        heapBuffer.reset(new wchar_t[reportBufferSize]);
+        assert(heapBuffer.get());
+        report = heapBuffer.get();
+    }
 
-    // Only report the process command line args when the C# code has requested it and when the file operation context is "Process"
-    // This way we only transmit the command line arguments once
-    int constructReportResult = -1;
-    if (ReportProcessArgs() && !_wcsicmp(fileOperationContext.Operation, L"Process")) {
+    // The line is written field by field rather than with swprintf_s (which parses the format on every call). It is equivalent to
+    // L"%d,%s:%lx|%lx|%lx|%x|%x|%x|%lx|%llx|%lx|%lx|%lx|%lx|%lx|%lx|%s|%s\r\n", optionally followed by the command line before the new line.
+    ReportLineWriter writer(report, reportBufferSize);
+    writer.AppendDecimal((DWORD)ReportType::ReportType_FileAccess);
+    writer.AppendChar(L',');
+    writer.AppendString(fileOperationContext.Operation, operationLen);
+    writer.AppendChar(L':');
+    writer.AppendHex(g_currentProcessId);
+    writer.AppendSeparatedHex(fileOperationContext.Id);
+    writer.AppendSeparatedHex(fileOperationContext.CorrelationId);
+    writer.AppendSeparatedHex((DWORD)accessCheckResult.Access);
+    writer.AppendSeparatedHex((DWORD)status);
+    writer.AppendSeparatedHex((DWORD)(accessCheckResult.Level == ReportLevel::ReportExplicit));
+    writer.AppendSeparatedHex(error);
+    writer.AppendSeparatedHex((ULONG64)usn);
+    writer.AppendSeparatedHex(fileOperationContext.DesiredAccess);
+    writer.AppendSeparatedHex(fileOperationContext.ShareMode);
+    writer.AppendSeparatedHex(fileOperationContext.CreationDisposition);
+    writer.AppendSeparatedHex(fileOperationContext.FlagsAndAttributes);
+    writer.AppendSeparatedHex(fileOperationContext.OpenedFileOrDirectoryAttributes);
+    writer.AppendSeparatedHex(policyResult.IsIndeterminate() ? 0 : policyResult.GetPathId());
+    writer.AppendChar(L'|');
+    writer.AppendString(fileName, fileNameLength);
+    writer.AppendChar(L'|');
+    writer.AppendString(filterStr, filterLength);
+
+    if (reportProcessArgs) {
         // The command line arguments may contain the | (pipe) character - the same character that is used here as a field separator.
         // It is important to keep the command line arguments last in this string because the C# code will 
         // check how many | chars the string contains and if there are more fields than expected, it will assume that  
@@ -189,62 +670,21 @@ void ReportFileAccess(
         // the command line. Thus, the command line needs to be sanitized. This is OK because no further consumer should rely on the exact
         // form of the command line. Here, newline characters are simply replaced with space. Replacing it with space is fine because
         // it won't change the length of the string, and thus no need to resize the report buffer.
-        std::wstring commandLine(g_currentProcessCommandLine);
-        std::replace(commandLine.begin(), commandLine.end(), L'\r', L' ');
-        std::replace(commandLine.begin(), commandLine.end(), L'\n', L' ');
-
-        constructReportResult = swprintf_s(report.get(), reportBufferSize, L"%d,%s:%lx|%lx|%lx|%x|%x|%x|%lx|%llx|%lx|%lx|%lx|%lx|%lx|%lx|%s|%s|%s\r\n",
-            ReportType::ReportType_FileAccess,
-            fileOperationContext.Operation,
-            g_currentProcessId,
-            fileOperationContext.Id,
-            fileOperationContext.CorrelationId,
-            accessCheckResult.Access,
-            status,
-            (int)(accessCheckResult.Level == ReportLevel::ReportExplicit),
-            error,
-            usn,
-            fileOperationContext.DesiredAccess,
-            fileOperationContext.ShareMode,
-            fileOperationContext.CreationDisposition,
-            fileOperationContext.FlagsAndAttributes,
-            fileOperationContext.OpenedFileOrDirectoryAttributes,
-            policyResult.IsIndeterminate() ? 0 : policyResult.GetPathId(),
-            fileName,
-            filterStr,
-            commandLine.c_str());
-    }
-    else
-    {
-        constructReportResult = swprintf_s(report.get(), reportBufferSize, L"%d,%s:%lx|%lx|%lx|%x|%x|%x|%lx|%llx|%lx|%lx|%lx|%lx|%lx|%lx|%s|%s\r\n",
-            ReportType::ReportType_FileAccess,
-            fileOperationContext.Operation,
-            g_currentProcessId,
-            fileOperationContext.Id,
-            fileOperationContext.CorrelationId,
-            accessCheckResult.Access,
-            status,
-            (int)(accessCheckResult.Level == ReportLevel::ReportExplicit),
-            error,
-            usn,
-            fileOperationContext.DesiredAccess,
-            fileOperationContext.ShareMode,
-            fileOperationContext.CreationDisposition,
-            fileOperationContext.FlagsAndAttributes,
-            fileOperationContext.OpenedFileOrDirectoryAttributes,
-            policyResult.IsIndeterminate() ? 0 : policyResult.GetPathId(),
-            fileName,
-            filterStr);
+        writer.AppendChar(L'|');
+        writer.AppendStringReplacingNewLines(g_currentProcessCommandLine, fileProcessCommandLineLength);
     }
 
+    writer.AppendString(L"\r\n", 2);
+    int constructReportResult = writer.Finish();
+
     if (constructReportResult <= 0)
     {
-        Dbg(L"ReportFileAccess:swprintf_s: %d <= 0", constructReportResult);
-        assert(!L"ReportFileAccess:swprintf_s: %d <= 0");
+        Dbg(L"ReportFileAccess: %d <= 0", constructReportResult);
+        assert(!L"ReportFileAccess: %d <= 0");
     }
     else
     {
-        SendReportString(report.get());
+        SendReportString(report);
     }
 }
 
@@ -262,7 +702,8 @@ void ReportProcessDetouringStatus(
     const DWORD dwCreationFlags,
     const BOOL detoured,
     const DWORD error,
-    const CreateDetouredProcessStatus createProcessStatus)
+    const CreateDetouredProcessStatus createProcessStatus,
+    const ProcessInjectionTimings* injectionTimings)
 {
     if (g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE || !ShouldLogProcessDetouringStatus()) {
         return;
@@ -307,7 +748,8 @@ void ReportProcessDetouringStatus(
         30 /*Report ID type*/ +
         30 /*Process ID*/ +
         (30 * 14) /*4-byte int values*/ +
-        16 /*Separators*/ +
+        (30 * 4) /*Injection timings*/ +
+        20 /*Separators*/ +
         (processName != nullptr ? wcslen(processName.get()) : 10) /*processName*/ +
         (lpApplicationName != nullptr ? wcslen(lpApplicationName) : 10) /*lpApplicationName*/ +
         (lpCommandLine != nullptr ? wcslen(lpCommandLine) : 10) /*lpCommandLine*/ +
@@ -319,10 +761,16 @@ void ReportProcessDetouringStatus(
     std::replace(commandLine.begin(), commandLine.end(), L'\r', L' ');
     std::replace(commandLine.begin(), commandLine.end(), L'\n', L' ');
 
+    const ProcessInjectionTimings noTimings = { 0 };
+    if (injectionTimings == nullptr)
+    {
+        injectionTimings = &noTimings;
+    }
+
     unique_ptr<wchar_t[]> report(new wchar_t[reportBufferSize]);
 
 #pragma warning(suppress: 4826)
-    int const constructReportResult = swprintf_s(report.get(), reportBufferSize, L"%u,%lu|%u|%s|%s|%u|%u|%u|%u|%u|%llu|%u|%u|%u|%u|%u|%s\r\n",
+    int const constructReportResult = swprintf_s(report.get(), reportBufferSize, L"%u,%lu|%u|%s|%s|%u|%u|%u|%u|%u|%llu|%u|%u|%u|%u|%u|%lld|%lld|%lld|%lld|%s\r\n",
         ReportType::ReportType_ProcessDetouringStatus,
         GetCurrentProcessId(),
         status,
@@ -339,6 +787,10 @@ void ReportProcessDetouringStatus(
         detoured ? 1 : 0,
         (unsigned)error,
         (unsigned)createProcessStatus,
+        injectionTimings->UpdateImportsMicroseconds,
+        injectionTimings->ApplyMappingMicroseconds,
+        injectionTimings->CopyPayloadMicroseconds,
+        injectionTimings->RemoteInjectionMicroseconds,
         commandLine.c_str());
 
     assert(constructReportResult > 0);
@@ -372,63 +824,105 @@ void ReportProcessData(
         return;
     }
 
-    // There is 1 32-bit report type (ReportType_ProcessData), which has a max character length of 10 characters.
-    // There is 1 32-bit process ID, which has a max character length of 10 characters.
-    // There are 6 64-bit values, each value has a max length of 20 characters each. These represent the IO counters,
-    // There are 7 32-bit values, each value has a max length of 10 characters each. These represent the creation time, 
-    // exit time, and the kernel and user mode execution times. They have a high and low DWORD value.
-    // There is 1 32 bit process exit code.
-    // There is 1 32 bit parent process id.
-    // There are 29 separators for the "," and "|" characters. (30 values total gives us 29 separators)
-    // There are 5 * 64 bit and 2 * 32 bit for detours max memory heap size * and payload size, final heap allocated, max and final HandleHeapEntries, allocated pool entries for the non-locking list.
-    // There are 6 * 64 bit for the max allocated/reallocated, virtual allocated data, max realloc chunck, final and max app used heap space
-    // And the length of the module file name.
-    // 3 characters for "\r\n" and null.
-    size_t const reportBufferSize = 
-        10 /*Report ID type*/ +
-        10 /*Process ID*/ +
-        (20 * 6) /*IO Counters*/ +
-        (10 * 7) /*Creation, exit, kernel, user times*/ +
-        29 /*Separators*/ +
-        MAX_PATH + /*Module file name*/ +
-        10 /*Process exit code*/ +
-        10 /*Parent process id*/ +
-        120 /*Detours max memory heap size * and payload size, final heap allocated, max and final HandleHeapEntries, allocated pool entries for the non-locking list. */ +
+    // The line has 35 numeric values of up to 20 digits each, 36 separators, the module file name and "\r\n" and null.
+    size_t const reportBufferSize =
+        (20 * 35) /*Numeric values*/ +
+        36 /*Separators*/ +
+        MAX_PATH /*Module file name*/ +
         3; /*\r\n null*/
 
     wchar_t report[reportBufferSize];
 
-    int const constructReportResult = swprintf_s(report, reportBufferSize, L"%u,%lu|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%lu|%lu|%lu|%lu|%lu|%lu|%lu|%lu|%s|%lu|%lu|%I64u|%lu|%I64u|%lu|%I64u|%I64u\r\n",
-        ReportType::ReportType_ProcessData,
-        GetCurrentProcessId(),
-        ioCounters.ReadOperationCount,
-        ioCounters.WriteOperationCount,
-        ioCounters.OtherOperationCount,
-        ioCounters.ReadTransferCount,
-        ioCounters.WriteTransferCount,
-        ioCounters.OtherTransferCount,
-        creationTime.dwHighDateTime,
-        creationTime.dwLowDateTime,
-        exitTime.dwHighDateTime,
-        exitTime.dwLowDateTime,
-        kernelTime.dwHighDateTime,
-        kernelTime.dwLowDateTime,
-        userTime.dwHighDateTime,
-        userTime.dwLowDateTime,
-        fileName,
-        exitCode,
-        parentProcessId,
-        (ULONG64)detoursMaxMemHeapSize,
-        (ULONG)g_manifestSize,
-        (ULONG64)g_detoursHeapAllocatedMemoryInBytes,
-        (ULONG)g_detoursAllocatedNoLockConcurentPoolEntries,
-        (ULONG64)g_detoursMaxHandleHeapEntries,
-        (ULONG64)g_detoursHandleHeapEntries);
+    // Most processes only run for a few milliseconds, so the line is written field by field rather than with swprintf_s
+    // (which parses the format and goes through the locale for each of the values). It is equivalent to
+    // L"%u,%lu|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%lu|%lu|%lu|%lu|%lu|%lu|%lu|%lu|%s|%lu|%lu|%I64u|%lu|%I64u|%lu|%I64u|..|%I64u\r\n".
+    ReportLineWriter writer(report, reportBufferSize);
+    writer.AppendDecimal((DWORD)ReportType::ReportType_ProcessData);
+    writer.AppendChar(L',');
+    writer.AppendDecimal(GetCurrentProcessId());
+    writer.AppendSeparatedDecimal(ioCounters.ReadOperationCount);
+    writer.AppendSeparatedDecimal(ioCounters.WriteOperationCount);
+    writer.AppendSeparatedDecimal(ioCounters.OtherOperationCount);
+    writer.AppendSeparatedDecimal(ioCounters.ReadTransferCount);
+    writer.AppendSeparatedDecimal(ioCounters.WriteTransferCount);
+    writer.AppendSeparatedDecimal(ioCounters.OtherTransferCount);
+    writer.AppendSeparatedDecimal(creationTime.dwHighDateTime);
+    writer.AppendSeparatedDecimal(creationTime.dwLowDateTime);
+    writer.AppendSeparatedDecimal(exitTime.dwHighDateTime);
+    writer.AppendSeparatedDecimal(exitTime.dwLowDateTime);
+    writer.AppendSeparatedDecimal(kernelTime.dwHighDateTime);
+    writer.AppendSeparatedDecimal(kernelTime.dwLowDateTime);
+    writer.AppendSeparatedDecimal(userTime.dwHighDateTime);
+    writer.AppendSeparatedDecimal(userTime.dwLowDateTime);
+    writer.AppendChar(L'|');
+    writer.AppendString(fileName, wcslen(fileName));
+    writer.AppendSeparatedDecimal(exitCode);
+    writer.AppendSeparatedDecimal(parentProcessId);
+    writer.AppendSeparatedDecimal((ULONG64)detoursMaxMemHeapSize);
+    writer.AppendSeparatedDecimal((ULONG)g_manifestSize);
+    writer.AppendSeparatedDecimal((ULONG64)g_detoursHeapAllocatedMemoryInBytes);
+    writer.AppendSeparatedDecimal((ULONG)g_detoursAllocatedNoLockConcurentPoolEntries);
+    writer.AppendSeparatedDecimal((ULONG64)g_detoursMaxHandleHeapEntries);
+    writer.AppendSeparatedDecimal((ULONG64)g_detoursHandleHeapEntries);
+    writer.AppendSeparatedDecimal((ULONG64)g_policySearchCacheLookupCount);
+    writer.AppendSeparatedDecimal((ULONG64)g_policySearchCacheHitCount);
+    writer.AppendSeparatedDecimal((ULONG64)g_closedHandlesPoolMissCount);
+    writer.AppendSeparatedDecimal((ULONG64)g_attachManifestParseMicroseconds);
+    writer.AppendSeparatedDecimal((ULONG64)g_attachHandleOverlayMicroseconds);
+    writer.AppendSeparatedDecimal((ULONG64)g_attachDetoursMicroseconds);
+    writer.AppendSeparatedDecimal((ULONG64)g_attachTotalMicroseconds);
+    writer.AppendSeparatedDecimal((ULONG64)g_reportLatency.Count());
+    writer.AppendSeparatedDecimal((ULONG64)g_reportLatency.Percentile(50));
+    writer.AppendSeparatedDecimal((ULONG64)g_reportLatency.Percentile(99));
+    writer.AppendSeparatedDecimal((ULONG64)g_reportLatency.Max());
+    writer.AppendString(L"\r\n", 2);
+    int const constructReportResult = writer.Finish();
 
     assert(constructReportResult > 0);
 
     if (constructReportResult > 0)
     {
-        SendReportString(report);
+        SendReportStringUnbatched(report);
+    }
+}
+
+/// <summary>
+/// Report the calls to each profiled detour and the time spent in them. Only detours that were called are reported.
+/// Avoid dynamic memory allocation in this method as this method is called during DLL_PROCESS_DETACH where heaps may be in inconsistent state.
+/// </summary>
+void ReportDetourProfile(DetourProfileCounters const& totals)
+{
+    if (g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    // Report type and process id, then name, call count and microseconds for each detour. 3 characters for "\r\n" and null.
+    size_t const reportBufferSize =
+        10 /*Report ID type*/ +
+        10 /*Process ID*/ +
+        PROFILED_DETOUR_COUNT * (3 /*Separators*/ + 32 /*Detour name*/ + 20 /*Calls*/ + 20 /*Microseconds*/) +
+        3; /*\r\n null*/
+
+    wchar_t report[reportBufferSize];
+
+    int length = swprintf_s(report, reportBufferSize, L"%u,%lu", ReportType::ReportType_DetourProfile, GetCurrentProcessId());
+    for (size_t i = 0; i < PROFILED_DETOUR_COUNT && length > 0; i++)
+    {
+        if (totals.Calls[i] == 0)
+        {
+            continue;
+        }
+
+        int written = swprintf_s(&report[length], reportBufferSize - length, L"|%s|%I64u|%I64u", ProfiledDetourName(i), (ULONG64)totals.Calls[i], (ULONG64)totals.Ticks[i]);
+        length = written > 0 ? length + written : -1;
+    }
+
+    if (length > 0 && swprintf_s(&report[length], reportBufferSize - length, L"\r\n") > 0)
+    {
+        SendReportStringUnbatched(report);
+    }
+    else
+    {
+        assert(!L"ReportDetourProfile: report didn't fit");
     }
 }
@@ -8,11 +8,25 @@
 #include "DataTypes.h"
 #include "PolicyResult.h"
 #include "globals.h"
+#include "DetouredProcessInjector.h"
+#include "DetourProfiler.h"
 
 // ----------------------------------------------------------------------------
 // FUNCTION DECLARATIONS
 // ----------------------------------------------------------------------------
 
+// Writes text to the report pipe as is, in the encoding BuildXL reads the pipe with. Returns ERROR_SUCCESS or the error of the write.
+DWORD WriteToReportPipe(_In_reads_(length) wchar_t const* text, size_t length);
+
+// Adds the lines written so far to the message count semaphore when CoalesceReportMessageCount is on, so they are released
+// with a single call instead of one per write. Must run after the last report of the process.
+// CODESYNC: Public/Src/Engine/Processes/SandboxedProcessReports.cs (GetLastMessageCount)
+void PublishReportMessageCount();
+
+// Writes the report lines still pending with BatchConcurrentReports or AdaptiveReportBatching, which with the latter may include
+// lines held during a report storm. Must run after the last report of the process.
+void FlushPendingReports();
+
 void ReportFileAccess(
     FileOperationContext const& fileOperationContext,
     FileAccessStatus status,
@@ -32,6 +46,8 @@ void ReportProcessData(
     DWORD const& parentProcessId,
     LONG64 const& detoursMaxMemHeapSize);
 
+void ReportDetourProfile(DetourProfileCounters const& totals);
+
 void ReportProcessDetouringStatus(
     ProcessDetouringStatus status,
     const LPCWSTR lpApplicationName,
@@ -46,4 +62,5 @@ void ReportProcessDetouringStatus(
     const DWORD dwCreationFlags,
     const BOOL detoured,
     const DWORD error,
-    const CreateDetouredProcessStatus createProcessStatus);
+    const CreateDetouredProcessStatus createProcessStatus,
+    const ProcessInjectionTimings* injectionTimings = nullptr);
@@ -0,0 +1,275 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <cwctype>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// An Aho-Corasick automaton that tells whether a text contains any of a set of strings, compared case-sensitively, with a single
+// pass over the text regardless of how many strings there are.
+// Nodes live in a single vector and refer to their children by index, like in TranslatePathTrie. Build must be called once all
+// the strings are inserted and before searching.
+class SubstringAutomaton
+{
+public:
+    SubstringAutomaton() : m_nodes(1)
+    {
+    }
+
+    void Insert(const wchar_t* str, size_t length)
+    {
+        size_t node = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            size_t child = FindChild(node, str[i]);
+            if (child == 0)
+            {
+                child = m_nodes.size();
+                m_nodes.emplace_back();
+                m_nodes[node].Children.emplace_back(str[i], child);
+            }
+
+            node = child;
+        }
+
+        m_nodes[node].Terminal = true;
+    }
+
+    // Computes the failure links. A node is terminal when it, or any of its suffixes, is an inserted string.
+    void Build()
+    {
+        std::queue<size_t> pending;
+        for (const auto& child : m_nodes[0].Children)
+        {
+            m_nodes[child.second].Fail = 0;
+            pending.push(child.second);
+        }
+
+        while (!pending.empty())
+        {
+            size_t node = pending.front();
+            pending.pop();
+
+            for (const auto& child : m_nodes[node].Children)
+            {
+                size_t fail = m_nodes[node].Fail;
+                size_t next = FindChild(fail, child.first);
+                while (next == 0 && fail != 0)
+                {
+                    fail = m_nodes[fail].Fail;
+                    next = FindChild(fail, child.first);
+                }
+
+                m_nodes[child.second].Fail = next;
+                m_nodes[child.second].Terminal |= m_nodes[next].Terminal;
+                pending.push(child.second);
+            }
+        }
+    }
+
+    bool IsContainedIn(const wchar_t* text, size_t length) const
+    {
+        // The empty string is contained in anything
+        if (m_nodes[0].Terminal)
+        {
+            return true;
+        }
+
+        size_t node = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            size_t next = FindChild(node, text[i]);
+            while (next == 0 && node != 0)
+            {
+                node = m_nodes[node].Fail;
+                next = FindChild(node, text[i]);
+            }
+
+            node = next;
+            if (m_nodes[node].Terminal)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+private:
+    struct Node
+    {
+        // (character, node index) pairs. Arguments to match are few and short, so nodes have very few children and those are just scanned.
+        std::vector<std::pair<wchar_t, size_t>> Children;
+        size_t Fail = 0;
+        bool Terminal = false;
+    };
+
+    // Returns 0 (the root, which is nobody's child) if the node has no child for c
+    size_t FindChild(size_t node, wchar_t c) const
+    {
+        for (const auto& child : m_nodes[node].Children)
+        {
+            if (child.first == c)
+            {
+                return child.second;
+            }
+        }
+
+        return 0;
+    }
+
+    std::vector<Node> m_nodes;
+};
+
+// The shim process matches of the substitute process execution shim, compiled so that matching a process creation costs a hash of
+// the image name of the command plus a single pass over its arguments, no matter the number of matches.
+// A match applies to a command that is its process name, or that ends with a backslash followed by it, compared case-insensitively.
+// When it has an argument match, the arguments must also contain it, compared case-sensitively.
+// CODESYNC: SubstituteProcessExecutionInfo.cs :: ShimProcessMatch class
+// This class is not thread safe for writing. Matching doesn't modify it.
+class ShimProcessMatcher
+{
+public:
+    // Adds a match. Matches without a process name never apply to anything. An empty argument match means any arguments.
+    void Add(const wchar_t* processName, size_t processNameLength, const wchar_t* argumentMatch, size_t argumentMatchLength)
+    {
+        if (processNameLength == 0)
+        {
+            return;
+        }
+
+        std::wstring lowCaseProcessName(processName, processNameLength);
+        for (wchar_t& c : lowCaseProcessName)
+        {
+            c = (wchar_t)towlower(c);
+        }
+
+        std::vector<ProcessMatches>& matches = m_matchesByImageName[ImageName(lowCaseProcessName.c_str(), lowCaseProcessName.length())];
+        ProcessMatches* processMatches = nullptr;
+        for (ProcessMatches& candidate : matches)
+        {
+            if (candidate.LowCaseProcessName == lowCaseProcessName)
+            {
+                processMatches = &candidate;
+                break;
+            }
+        }
+
+        if (processMatches == nullptr)
+        {
+            matches.emplace_back();
+            processMatches = &matches.back();
+            processMatches->LowCaseProcessName = std::move(lowCaseProcessName);
+        }
+
+        if (argumentMatchLength == 0)
+        {
+            processMatches->MatchesAnyArguments = true;
+        }
+        else
+        {
+            processMatches->Arguments.Insert(argumentMatch, argumentMatchLength);
+        }
+
+        m_empty = false;
+    }
+
+    // Must be called once all the matches are added and before calling Matches
+    void Build()
+    {
+        for (auto& entry : m_matchesByImageName)
+        {
+            for (ProcessMatches& processMatches : entry.second)
+            {
+                processMatches.Arguments.Build();
+            }
+        }
+    }
+
+    bool IsEmpty() const
+    {
+        return m_empty;
+    }
+
+    bool Matches(const wchar_t* command, size_t commandLength, const wchar_t* arguments, size_t argumentsLength) const
+    {
+        auto it = m_matchesByImageName.find(ImageName(command, commandLength));
+        if (it == m_matchesByImageName.end())
+        {
+            return false;
+        }
+
+        for (const ProcessMatches& processMatches : it->second)
+        {
+            if (IsCommandFor(command, commandLength, processMatches.LowCaseProcessName)
+                && (processMatches.MatchesAnyArguments || processMatches.Arguments.IsContainedIn(arguments, argumentsLength)))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+private:
+    // The matches that share a process name
+    struct ProcessMatches
+    {
+        std::wstring LowCaseProcessName;
+        bool MatchesAnyArguments = false;
+        SubstringAutomaton Arguments;
+    };
+
+    // The lowercased last component of a path, which is what matches are looked up by
+    static std::wstring ImageName(const wchar_t* path, size_t length)
+    {
+        size_t start = length;
+        while (start > 0 && path[start - 1] != L'\\')
+        {
+            start--;
+        }
+
+        std::wstring imageName(path + start, length - start);
+        for (wchar_t& c : imageName)
+        {
+            c = (wchar_t)towlower(c);
+        }
+
+        return imageName;
+    }
+
+    static bool IsCommandFor(const wchar_t* command, size_t commandLength, const std::wstring& lowCaseProcessName)
+    {
+        size_t processNameLength = lowCaseProcessName.length();
+        if (processNameLength > commandLength)
+        {
+            return false;
+        }
+
+        size_t start = commandLength - processNameLength;
+        if (start > 0 && command[start - 1] != L'\\')
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < processNameLength; i++)
+        {
+            if ((wchar_t)towlower(command[start + i]) != lowCaseProcessName[i])
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Process matches by the image name of their process name. Process names rarely have more than one component, so there
+    // is usually a single ProcessMatches per image name.
+    std::unordered_map<std::wstring, std::vector<ProcessMatches>> m_matchesByImageName;
+    bool m_empty = true;
+};
@@ -0,0 +1,222 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "StringOperations.h"
+
+// Matches the final component of a path against the special-case rules that depend on it (see GetSpecialCaseRules), with a
+// single backward pass over that component regardless of how many rules there are.
+// File name suffixes are kept in a trie over their reversed, upper-cased characters. A second root holds the suffixes that
+// come before trailing digits (build.exe trace logs). Nodes live in a single vector and refer to their children by index, like
+// in TranslatePathTrie. The same pass checks for named streams and for the fixed patterns of the rc.exe and mt.exe temporary
+// files.
+// Which rules are added depends on the process and on the manifest, so the matcher is built once at attach.
+// This class is not thread safe for writing. Lookups don't modify it.
+class SpecialCaseMatcher
+{
+public:
+    // The kinds of rules a path matched, which decide how the policy is overridden
+    enum Category : uint8_t
+    {
+        None = 0,
+        // Files loaded by code coverage runs
+        CodeCoverageFile = 0x1,
+        // Files special tools create or probe without declaring them (temporary files, pdbs, build.exe trace logs)
+        SpecialToolFile = 0x2,
+        // Alternate data streams (file:stream or file:stream:type)
+        NamedStream = 0x4,
+    };
+
+    SpecialCaseMatcher() : m_nodes(2), m_matchRCTempFiles(false), m_matchMtTempFiles(false)
+    {
+    }
+
+    // Matches file names ending with 'suffix' (case-insensitively)
+    void AddSuffix(const wchar_t* suffix, Category category)
+    {
+        Insert(PlainSuffixesRoot, suffix, category);
+    }
+
+    // Matches file names ending with 'suffix' (case-insensitively) followed by at least one digit
+    void AddSuffixBeforeDigits(const wchar_t* suffix, Category category)
+    {
+        Insert(SuffixesBeforeDigitsRoot, suffix, category);
+    }
+
+    // Matches the temporary files of rc.exe, see StringLooksLikeRCTempFile
+    void MatchRCTempFiles() { m_matchRCTempFiles = true; }
+
+    // Matches the temporary files of mt.exe, see StringLooksLikeMtTempFile
+    void MatchMtTempFiles() { m_matchMtTempFiles = true; }
+
+    // Returns the categories of all the rules the path matches
+    uint8_t Match(const wchar_t* path, size_t length) const
+    {
+        uint8_t categories = None;
+
+        size_t plainNode = PlainSuffixesRoot;
+        size_t beforeDigitsNode = SuffixesBeforeDigitsRoot;
+        bool inTrailingDigits = true;
+        size_t trailingDigits = 0;
+
+        // Same as IsPathToNamedStream: lengths of the (up to three) colon separated segments of the final component
+        size_t segmentLength[3] = {};
+        int segment = 0;
+        bool namedStreamDone = false;
+
+        // Position of the last backslash, or length if there is none
+        size_t lastBackslash = length;
+
+        for (size_t i = length; i > 0; i--)
+        {
+            const wchar_t c = path[i - 1];
+            if (c == L'\\')
+            {
+                lastBackslash = i - 1;
+                break;
+            }
+
+            if (IsDirectorySeparator(c) || segment == 3)
+            {
+                namedStreamDone = true;
+            }
+            else if (!namedStreamDone)
+            {
+                if (c == L':')
+                {
+                    segment++;
+                }
+                else
+                {
+                    segmentLength[segment]++;
+                }
+            }
+
+            const wchar_t normalized = NormalizePathChar(c);
+            if (plainNode != NoNode)
+            {
+                plainNode = FindChild(plainNode, normalized);
+                if (plainNode != NoNode)
+                {
+                    categories |= m_nodes[plainNode].Categories;
+                }
+            }
+
+            if (inTrailingDigits && c >= L'0' && c <= L'9')
+            {
+                trailingDigits++;
+                continue;
+            }
+
+            inTrailingDigits = false;
+            if (trailingDigits > 0 && beforeDigitsNode != NoNode)
+            {
+                beforeDigitsNode = FindChild(beforeDigitsNode, normalized);
+                if (beforeDigitsNode != NoNode)
+                {
+                    categories |= m_nodes[beforeDigitsNode].Categories;
+                }
+            }
+        }
+
+        if (segment == 2 ? segmentLength[1] > 0 && segmentLength[2] > 0 : segment == 1 && segmentLength[0] > 0 && segmentLength[1] > 0)
+        {
+            categories |= NamedStream;
+        }
+
+        if (m_matchRCTempFiles && IsRCTempFile(path, length))
+        {
+            categories |= SpecialToolFile;
+        }
+
+        if (m_matchMtTempFiles && IsMtTempFile(path, length, lastBackslash))
+        {
+            categories |= SpecialToolFile;
+        }
+
+        return categories;
+    }
+
+private:
+    static const size_t PlainSuffixesRoot = 0;
+    static const size_t SuffixesBeforeDigitsRoot = 1;
+    static const size_t NoNode = (size_t)-1;
+
+    struct Node
+    {
+        std::vector<std::pair<wchar_t, size_t>> Children;
+        uint8_t Categories = None;
+    };
+
+    void Insert(size_t root, const wchar_t* suffix, Category category)
+    {
+        size_t node = root;
+        for (size_t i = wcslen(suffix); i > 0; i--)
+        {
+            const wchar_t c = NormalizePathChar(suffix[i - 1]);
+            size_t child = FindChild(node, c);
+            if (child == NoNode)
+            {
+                child = m_nodes.size();
+                m_nodes.emplace_back();
+                m_nodes[node].Children.emplace_back(c, child);
+            }
+
+            node = child;
+        }
+
+        m_nodes[node].Categories |= category;
+    }
+
+    size_t FindChild(size_t node, wchar_t c) const
+    {
+        for (const auto& child : m_nodes[node].Children)
+        {
+            if (child.first == c)
+            {
+                return child.second;
+            }
+        }
+
+        return NoNode;
+    }
+
+    // \R[CDF]xxxxx with no extension, see StringLooksLikeRCTempFile
+    static bool IsRCTempFile(const wchar_t* path, size_t length)
+    {
+        if (length < 9 || path[length - 9] != L'\\')
+        {
+            return false;
+        }
+
+        const wchar_t c3 = NormalizePathChar(path[length - 7]);
+        return NormalizePathChar(path[length - 8]) == L'R' && (c3 == L'C' || c3 == L'D' || c3 == L'F') && path[length - 4] != L'.';
+    }
+
+    // \RCXxxxx.tmp, see StringLooksLikeMtTempFile
+    static bool IsMtTempFile(const wchar_t* path, size_t length, size_t lastBackslash)
+    {
+        if (length < 4 ||
+            path[length - 4] != L'.' ||
+            NormalizePathChar(path[length - 3]) != L'T' ||
+            NormalizePathChar(path[length - 2]) != L'M' ||
+            NormalizePathChar(path[length - 1]) != L'P')
+        {
+            return false;
+        }
+
+        return lastBackslash != length && lastBackslash + 3 < length &&
+            NormalizePathChar(path[lastBackslash + 1]) == L'R' &&
+            NormalizePathChar(path[lastBackslash + 2]) == L'C' &&
+            NormalizePathChar(path[lastBackslash + 3]) == L'X';
+    }
+
+    std::vector<Node> m_nodes;
+    bool m_matchRCTempFiles;
+    bool m_matchMtTempFiles;
+};
@@ -11,6 +11,13 @@
 
 #if _WIN32
 #include <pathcch.h>
+#if defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#define PATH_COMPARISON_SSE2 1
+#elif defined(_M_ARM64)
+#include <arm_neon.h>
+#define PATH_COMPARISON_NEON 1
+#endif
 #endif
 
 #define _MAX_EXTENDED_DIR_LENGTH (_MAX_EXTENDED_PATH_LENGTH - _MAX_DRIVE - _MAX_FNAME - _MAX_EXT - 4)
@@ -24,22 +31,6 @@
 // 
 #pragma warning( disable : 26472 26493 26461 26446 26482 )
 
-// Magic numbers known to provide good hash distributions.
-// See here: http://www.isthe.com/chongo/tech/comp/fnv/
-
-constexpr DWORD Fnv1Prime32 = 16777619;
-constexpr DWORD Fnv1Basis32 = static_cast<const unsigned int>(2166136261);
-
-constexpr inline static DWORD _Fold(DWORD hash, BYTE value) noexcept
-{
-    return (hash * Fnv1Prime32) ^ (DWORD)value;
-}
-
-constexpr inline static DWORD Fold(DWORD hash, WORD value) noexcept
-{
-    return _Fold(_Fold(hash, (BYTE)value), (BYTE)(((WORD)value) >> 8));
-}
-
 #pragma warning( push )
 #pragma warning( disable : 4100) // 'nBufferLength' : unreferenced formal parameter // in Release builds
 DWORD WINAPI NormalizeAndHashPath(
@@ -57,7 +48,7 @@ DWORD WINAPI NormalizeAndHashPath(
     for (i = 0; pPath[i]; i++) {
         const PathChar c = NormalizePathChar(pPath[i]);
         ((PPathChar)pBuffer)[i] = c;
-        hash = Fold(hash, c);
+        hash = HashNormalizedPathChar(hash, c);
     }
 
     ((PPathChar)pBuffer)[i] = 0;
@@ -78,7 +69,7 @@ DWORD WINAPI HashPath(
     size_t i;
     for (i = 0; i < nLength; i++) {
         const PathChar c = NormalizePathChar(pPath[i]);
-        hash = Fold(hash, c);
+        hash = HashNormalizedPathChar(hash, c);
     }
 
     return hash;
@@ -92,6 +83,157 @@ BOOL WINAPI AreBuffersEqual(
     return memcmp(pBuffer1, pBuffer2, nBufferLength) == 0;
 }
 
+#if PATH_COMPARISON_SSE2 || PATH_COMPARISON_NEON
+// Number of characters compared at once by CompareAsciiBlocks and CompareAsciiBlocksIgnoringCase
+constexpr size_t PathComparisonBlockLength = 8;
+
+// Block primitives: load PathComparisonBlockLength characters, check they are all ASCII, upper-case them the way NormalizePathChar
+// does (which is only valid for ASCII blocks) and compare two blocks. On Windows, where PathChar is UTF-16, two ASCII blocks can
+// also be narrowed into (or widened from) 2 * PathComparisonBlockLength bytes for transcoding.
+#if PATH_COMPARISON_SSE2
+typedef __m128i PathCharBlock;
+
+static inline PathCharBlock LoadPathCharBlock(PCPathChar chars) noexcept
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(chars));
+}
+
+static inline bool IsAsciiBlock(PathCharBlock chars) noexcept
+{
+    return _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(chars, _mm_set1_epi16((short)0xFF80)), _mm_setzero_si128())) == 0xFFFF;
+}
+
+static inline PathCharBlock UpperCaseAsciiBlock(PathCharBlock chars) noexcept
+{
+    // Signed comparisons are fine: every character is below 0x80
+    const __m128i isLower = _mm_and_si128(_mm_cmpgt_epi16(chars, _mm_set1_epi16(L'a' - 1)), _mm_cmplt_epi16(chars, _mm_set1_epi16(L'z' + 1)));
+    return _mm_sub_epi16(chars, _mm_and_si128(isLower, _mm_set1_epi16(L'a' - L'A')));
+}
+
+static inline bool AreBlocksEqual(PathCharBlock block1, PathCharBlock block2) noexcept
+{
+    return _mm_movemask_epi8(_mm_cmpeq_epi16(block1, block2)) == 0xFFFF;
+}
+
+static inline void StorePathCharBlock(PathChar* chars, PathCharBlock block) noexcept
+{
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(chars), block);
+}
+
+static inline void StoreNarrowedAsciiBlocks(PathCharBlock low, PathCharBlock high, char* bytes) noexcept
+{
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(bytes), _mm_packus_epi16(low, high));
+}
+
+static inline bool TryLoadWidenedAsciiBlocks(const char* bytes, PathCharBlock& low, PathCharBlock& high) noexcept
+{
+    const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes));
+    if (_mm_movemask_epi8(chars) != 0) {
+        return false;
+    }
+
+    low = _mm_unpacklo_epi8(chars, _mm_setzero_si128());
+    high = _mm_unpackhi_epi8(chars, _mm_setzero_si128());
+    return true;
+}
+#else
+typedef uint16x8_t PathCharBlock;
+
+static inline PathCharBlock LoadPathCharBlock(PCPathChar chars) noexcept
+{
+    return vld1q_u16(reinterpret_cast<const uint16_t*>(chars));
+}
+
+static inline bool IsAsciiBlock(PathCharBlock chars) noexcept
+{
+    return vmaxvq_u16(chars) < 0x80;
+}
+
+static inline PathCharBlock UpperCaseAsciiBlock(PathCharBlock chars) noexcept
+{
+    const uint16x8_t isLower = vandq_u16(vcgeq_u16(chars, vdupq_n_u16(L'a')), vcleq_u16(chars, vdupq_n_u16(L'z')));
+    return vsubq_u16(chars, vandq_u16(isLower, vdupq_n_u16(L'a' - L'A')));
+}
+
+static inline bool AreBlocksEqual(PathCharBlock block1, PathCharBlock block2) noexcept
+{
+    return vminvq_u16(vceqq_u16(block1, block2)) == 0xFFFF;
+}
+
+static inline void StorePathCharBlock(PathChar* chars, PathCharBlock block) noexcept
+{
+    vst1q_u16(reinterpret_cast<uint16_t*>(chars), block);
+}
+
+static inline void StoreNarrowedAsciiBlocks(PathCharBlock low, PathCharBlock high, char* bytes) noexcept
+{
+    vst1q_u8(reinterpret_cast<uint8_t*>(bytes), vcombine_u8(vmovn_u16(low), vmovn_u16(high)));
+}
+
+static inline bool TryLoadWidenedAsciiBlocks(const char* bytes, PathCharBlock& low, PathCharBlock& high) noexcept
+{
+    const uint8x16_t chars = vld1q_u8(reinterpret_cast<const uint8_t*>(bytes));
+    if (vmaxvq_u8(chars) >= 0x80) {
+        return false;
+    }
+
+    low = vmovl_u8(vget_low_u8(chars));
+    high = vmovl_u8(vget_high_u8(chars));
+    return true;
+}
+#endif
+
+/// CompareAsciiBlocks
+///
+/// Compares the prefix of pPath, upper-casing it the way NormalizePathChar does, against pNormalizedPath, a block of characters at a time,
+/// for as long as the characters of pPath are ASCII.
+/// Returns false if a mismatch was found. Otherwise sets comparedLength to how many characters are known to be equal.
+static bool CompareAsciiBlocks(PCPathChar pPath, PCPathChar pNormalizedPath, size_t nLength, size_t& comparedLength) noexcept
+{
+    size_t i = 0;
+    for (; i + PathComparisonBlockLength <= nLength; i += PathComparisonBlockLength) {
+        const PathCharBlock chars = LoadPathCharBlock(&pPath[i]);
+        if (!IsAsciiBlock(chars)) {
+            break;
+        }
+
+        if (!AreBlocksEqual(UpperCaseAsciiBlock(chars), LoadPathCharBlock(&pNormalizedPath[i]))) {
+            return false;
+        }
+    }
+
+    comparedLength = i;
+    return true;
+}
+
+/// CompareAsciiBlocksIgnoringCase
+///
+/// Same as CompareAsciiBlocks, but both strings are upper-cased, for as long as the characters of both are ASCII.
+static bool CompareAsciiBlocksIgnoringCase(PCPathChar str1, PCPathChar str2, size_t length, size_t& comparedLength) noexcept
+{
+    size_t i = 0;
+    for (; i + PathComparisonBlockLength <= length; i += PathComparisonBlockLength) {
+        const PathCharBlock chars1 = LoadPathCharBlock(&str1[i]);
+        const PathCharBlock chars2 = LoadPathCharBlock(&str2[i]);
+        if (AreBlocksEqual(chars1, chars2)) {
+            // Identical characters are equal whatever their case
+            continue;
+        }
+
+        if (!IsAsciiBlock(chars1) || !IsAsciiBlock(chars2)) {
+            break;
+        }
+
+        if (!AreBlocksEqual(UpperCaseAsciiBlock(chars1), UpperCaseAsciiBlock(chars2))) {
+            return false;
+        }
+    }
+
+    comparedLength = i;
+    return true;
+}
+#endif
+
 BOOL WINAPI ArePathsEqual(
     __in_ecount(nLength)        PCPathChar pPath,
     __in_ecount(nLength + 1)    PCPathChar pNormalizedPath,
@@ -100,8 +242,15 @@ BOOL WINAPI ArePathsEqual(
     assert(pPath != nullptr);
     assert(pNormalizedPath != nullptr);
 
-    size_t i;
-    for (i = 0; i < nLength; i++) {
+    size_t i = 0;
+
+#if PATH_COMPARISON_SSE2 || PATH_COMPARISON_NEON
+    if (!CompareAsciiBlocks(pPath, pNormalizedPath, nLength, i)) {
+        return false;
+    }
+#endif
+
+    for (; i < nLength; i++) {
         const PathChar c = NormalizePathChar(pPath[i]);
         if (c != pNormalizedPath[i]) {
             return false;
@@ -111,24 +260,40 @@ BOOL WINAPI ArePathsEqual(
     return !pNormalizedPath[i];
 }
 
-bool HasPrefix(PCPathChar str, PCPathChar prefix) noexcept
+bool ArePathCharsEqual(PCPathChar str1, PCPathChar str2, size_t length) noexcept
 {
-    assert(str != nullptr);
-    assert(prefix != nullptr);
+    assert(str1 != nullptr);
+    assert(str2 != nullptr);
 
-    for (size_t i = 0;; i++) {
-        if (str[i] == 0) {
-            return prefix[i] == 0;
-        }
+    size_t i = 0;
 
-        if (prefix[i] == 0) {
-            return true;
-        }
+#if PATH_COMPARISON_SSE2 || PATH_COMPARISON_NEON
+    if (!CompareAsciiBlocksIgnoringCase(str1, str2, length, i)) {
+        return false;
+    }
+#endif
 
-        if (!IsPathCharEqual(str[i], prefix[i])) {
+    for (; i < length; i++) {
+        if (!IsPathCharEqual(str1[i], str2[i])) {
             return false;
         }
     }
+
+    return true;
+}
+
+bool HasPrefix(PCPathChar str, PCPathChar prefix) noexcept
+{
+    assert(str != nullptr);
+    assert(prefix != nullptr);
+
+    // Make sure str is long enough before comparing blocks of it
+    const size_t prefix_length = pathlen(prefix);
+    if (pathnlen(str, prefix_length) < prefix_length) {
+        return false;
+    }
+
+    return ArePathCharsEqual(str, prefix, prefix_length);
 }
 
 #pragma warning(push)
@@ -144,15 +309,7 @@ bool HasSuffix(PCPathChar str, size_t str_length, PCPathChar suffix) noexcept
         return false;
     }
 
-    for (size_t i = 0; i < suffix_length; i++) {
-        const PathChar c1 = str[str_length - i - 1];
-        const PathChar c2 = suffix[suffix_length - i - 1];
-        if (!IsPathCharEqual(c1, c2)) {
-            return false;
-        }
-    }
-
-    return true;
+    return ArePathCharsEqual(str + str_length - suffix_length, suffix, suffix_length);
 }
 #pragma warning(pop)
 
@@ -252,18 +409,11 @@ bool IsPathWithinTree(PCPathChar tree, PCPathChar path) noexcept
         }
 
         // Are the current path elements equal?
-        if (treeElementLength != pathElementLength) {
+        if (treeElementLength != pathElementLength ||
+            !ArePathCharsEqual(&tree[treeElementStart], &path[pathElementStart], treeElementLength)) {
             return false;
         }
 
-        for (size_t i = 0; i < treeElementLength; i++) {
-            const PathChar ct = tree[treeElementStart + i];
-            const PathChar cp = path[pathElementStart + i];
-            if (!IsPathCharEqual(ct, cp)) {
-                return false;
-            }
-        }
-
         // Path element looks the same in both.
         // Keep searching.
     }
@@ -276,20 +426,21 @@ bool StringLooksLikeRCTempFile(PCPathChar str, size_t str_length) noexcept
     if (str_length < 9) {
         return false;
     }
+    // Separators and dots have no case, so only letters need NormalizePathChar
     const PathChar c1 = str[str_length - 9];
-    if (!IsPathCharEqual(c1, '\\')) {
+    if (c1 != '\\') {
         return false;
     }
-    const PathChar c2 = str[str_length - 8];
-    if (!IsPathCharEqual(c2, 'R')) {
+    const PathChar c2 = NormalizePathChar(str[str_length - 8]);
+    if (c2 != 'R') {
         return false;
     }
-    const PathChar c3 = str[str_length - 7];
-    if (!IsPathCharEqual(c3, 'C') && !IsPathCharEqual(c3, 'D') && !IsPathCharEqual(c3, 'F')) {
+    const PathChar c3 = NormalizePathChar(str[str_length - 7]);
+    if (c3 != 'C' && c3 != 'D' && c3 != 'F') {
         return false;
     }
     const PathChar c4 = str[str_length - 4];
-    if (IsPathCharEqual(c4, '.')) {
+    if (c4 == '.') {
         // RC's temp files have no extension.
         return false;
     }
@@ -327,12 +478,13 @@ bool StringLooksLikeMtTempFile(PCPathChar str, size_t str_length, PCPathChar exp
         return false;
     }
 
-    // Find last "\".
+    // Find last "\". Backslashes have no case, so a plain comparison is enough.
     size_t beginCharIndex = (size_t) -1;
 
-    for (size_t i = 0; i < str_length; ++i) {
-        if (IsPathCharEqual(str[i], '\\')) {
-            beginCharIndex = i;
+    for (size_t i = str_length; i > 0; --i) {
+        if (str[i - 1] == '\\') {
+            beginCharIndex = i - 1;
+            break;
         }
     }
 
@@ -491,54 +643,67 @@ PCPathChar GetPathWithoutPrefix(PCPathChar path) noexcept
 }
 
 #pragma warning( push )
-// warning C26414: Move, copy, reassign or reset a local smart pointer 'drive' (r.5).
 // warning C26485: Expression 'buffer': No array to pointer decay (bounds.3).
-#pragma warning( disable : 26414 26485 )
-// Returns a collection of all path atoms of the given path
-int TryDecomposePath(const std::wstring& path, std::vector<std::wstring>& elements)
+#pragma warning( disable : 26485 )
+int TryDecomposePath(std::wstring_view path, PathAtoms& atoms)
 {
-    auto drive = std::make_unique<wchar_t[]>(_MAX_DRIVE);
-    auto directory = std::make_unique<wchar_t[]>(_MAX_EXTENDED_DIR_LENGTH);
-    auto file_name = std::make_unique<wchar_t[]>(_MAX_FNAME);
-    auto extension = std::make_unique<wchar_t[]>(_MAX_EXT);
+    const size_t driveLength = path.size() >= 2 && path[1] == NT_VOLUME_SEPARATOR ? 2 : 0;
 
-    const errno_t err = _wsplitpath_s(
-        path.c_str(),
-        drive.get(), _MAX_DRIVE,
-        directory.get(), _MAX_EXTENDED_DIR_LENGTH,
-        file_name.get(), _MAX_FNAME,
-        extension.get(), _MAX_EXT);
+    size_t fileNameStart = driveLength;
+    for (size_t i = driveLength; i < path.size(); i++)
+    {
+        if (IsDirectorySeparator(path[i]))
+        {
+            fileNameStart = i + 1;
+        }
+    }
 
-    if (err != 0)
+    // Keep the limits of _wsplitpath_s, which this used to be built on
+    const std::wstring_view fileName = path.substr(fileNameStart);
+    const size_t extensionStart = fileName.rfind(PATH_DOT);
+    const size_t extensionLength = extensionStart == std::wstring_view::npos ? 0 : fileName.size() - extensionStart;
+    if (fileNameStart - driveLength >= _MAX_EXTENDED_DIR_LENGTH
+        || fileName.size() - extensionLength >= _MAX_FNAME
+        || extensionLength >= _MAX_EXT)
     {
-        return err;
+        return ERANGE;
     }
 
-    std::wstring wdrive = drive.get();
-    if (wdrive.size() > 0)
+    if (driveLength > 0)
     {
-        elements.push_back(std::move(wdrive));
+        atoms.push_back(path.substr(0, driveLength));
     }
 
-    wchar_t* context = nullptr;
-    wchar_t* next = wcstok_s(directory.get(), L"\\/", &context);
-    while (next)
+    size_t atomStart = driveLength;
+    for (size_t i = driveLength; i <= path.size(); i++)
     {
-        std::wstring dirAtom = next;
-        if (dirAtom.size() > 0)
+        if (i == path.size() || IsDirectorySeparator(path[i]))
         {
-            elements.push_back(std::move(next));
-        }
+            if (i > atomStart)
+            {
+                atoms.push_back(path.substr(atomStart, i - atomStart));
+            }
 
-        next = wcstok_s(nullptr, L"\\/", &context);
+            atomStart = i + 1;
+        }
     }
 
-    std::wstring filenameAndExtension = file_name.get();
-    filenameAndExtension.append(extension.get());
+    return 0;
+}
 
-    if (filenameAndExtension.size() > 0)
+// Returns a collection of all path atoms of the given path
+int TryDecomposePath(const std::wstring& path, std::vector<std::wstring>& elements)
+{
+    PathAtoms atoms;
+    const int err = TryDecomposePath(std::wstring_view(path), atoms);
+    if (err != 0)
+    {
+        return err;
+    }
+
+    for (const std::wstring_view& atom : atoms)
     {
-        elements.push_back(std::move(filenameAndExtension));
+        elements.emplace_back(atom);
     }
 
     return 0;
@@ -575,6 +740,243 @@ std::wstring NormalizePath(const std::wstring& path)
 }
 #pragma warning( pop )
 
+// Longest path Win32 handles (the capacity of a UNICODE_STRING, in characters)
+static const size_t MaxWin32PathLength = 32767;
+
+// Returns the length of the \\server\share\ root of a UNC path, or 0 if 'path' doesn't start with such a root.
+static size_t GetUncRootLength(PCPathChar path) noexcept
+{
+    // \\.\ and \\?\ are device prefixes, not servers
+    if (!IsDirectorySeparator(path[0]) || !IsDirectorySeparator(path[1]) || path[2] == L'.' || path[2] == L'?')
+    {
+        return 0;
+    }
+
+    // Both the server and the share have to be non-empty, and the share followed by a separator
+    size_t i = 2;
+    for (int component = 0; component < 2; component++)
+    {
+        size_t start = i;
+        while (path[i] != L'\0' && !IsDirectorySeparator(path[i]))
+        {
+            i++;
+        }
+
+        if (i == start || path[i] == L'\0')
+        {
+            return 0;
+        }
+
+        i++;
+    }
+
+    return i;
+}
+
+static bool HasDevicePrefix(PCPathChar name, PCPathChar device, size_t deviceLength) noexcept
+{
+    for (size_t i = 0; i < deviceLength; i++)
+    {
+        if (NormalizePathChar(name[i]) != device[i])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Checks whether Win32 maps a file name to a DOS device. The extension, a stream name and trailing spaces don't matter: "nul.txt" and "nul " are NUL too.
+// COM and LPT are followed by any character, since Win32 also accepts superscript digits there.
+static bool IsDosDeviceName(PCPathChar name, size_t length) noexcept
+{
+    size_t baseLength = 0;
+    while (baseLength < length && name[baseLength] != PATH_DOT && name[baseLength] != NT_VOLUME_SEPARATOR)
+    {
+        baseLength++;
+    }
+
+    while (baseLength > 0 && name[baseLength - 1] == L' ')
+    {
+        baseLength--;
+    }
+
+    switch (baseLength)
+    {
+    case 3:
+        return HasDevicePrefix(name, L"CON", 3) || HasDevicePrefix(name, L"PRN", 3) || HasDevicePrefix(name, L"AUX", 3) || HasDevicePrefix(name, L"NUL", 3);
+    case 4:
+        return HasDevicePrefix(name, L"COM", 3) || HasDevicePrefix(name, L"LPT", 3);
+    case 6:
+        return HasDevicePrefix(name, L"CONIN$", 6);
+    case 7:
+        return HasDevicePrefix(name, L"CONOUT$", 7);
+    default:
+        return false;
+    }
+}
+
+LexicalFullPathResult GetFullPathLexically(PCPathChar path, PCPathChar currentDirectory, PathChar* buffer, size_t bufferLength, size_t* fullPathLength) noexcept
+{
+    assert(path != nullptr);
+    assert(buffer != nullptr);
+    assert(fullPathLength != nullptr);
+
+    if (IsWin32NtPathName(path))
+    {
+        return LexicalFullPathResult::Unsupported;
+    }
+
+    // The full path is a root, which always ends with a separator, followed by what remains of the segments once . and .. are resolved.
+    // For a relative path, the segments of the current directory past its root come first.
+    PCPathChar root;
+    size_t rootLength;
+    PCPathChar directorySegments = L"";
+    PCPathChar pathSegments;
+
+    if (IsDriveLetter(path[0]) && path[1] == NT_VOLUME_SEPARATOR)
+    {
+        if (!IsDirectorySeparator(path[2]))
+        {
+            // Drive relative path
+            return LexicalFullPathResult::Unsupported;
+        }
+
+        root = path;
+        rootLength = 3;
+        pathSegments = path + rootLength;
+    }
+    else if (IsDirectorySeparator(path[0]) && IsDirectorySeparator(path[1]))
+    {
+        rootLength = path[2] == PATH_DOT && IsDirectorySeparator(path[3])
+            ? 4 // Local device
+            : GetUncRootLength(path);
+        if (rootLength == 0)
+        {
+            return LexicalFullPathResult::Unsupported;
+        }
+
+        root = path;
+        pathSegments = path + rootLength;
+    }
+    else
+    {
+        if (currentDirectory == nullptr || path[0] == L'\0')
+        {
+            return LexicalFullPathResult::Unsupported;
+        }
+
+        rootLength = IsDriveBasedAbsolutePath(currentDirectory) ? 3 : GetUncRootLength(currentDirectory);
+        if (rootLength == 0)
+        {
+            return LexicalFullPathResult::Unsupported;
+        }
+
+        // A rooted path (\foo) only takes the root of the current directory
+        root = currentDirectory;
+        directorySegments = IsDirectorySeparator(path[0]) ? L"" : currentDirectory + rootLength;
+        pathSegments = path;
+    }
+
+    if (bufferLength <= rootLength)
+    {
+        return LexicalFullPathResult::BufferTooSmall;
+    }
+
+    for (size_t i = 0; i < rootLength; i++)
+    {
+        buffer[i] = IsDirectorySeparator(root[i]) ? NT_DIRECTORY_SEPARATOR : root[i];
+    }
+
+    // Every segment kept is written followed by a separator
+    size_t length = rootLength;
+    for (PCPathChar segments : { directorySegments, pathSegments })
+    {
+        PCPathChar current = segments;
+        while (*current != L'\0')
+        {
+            while (IsDirectorySeparator(*current))
+            {
+                current++;
+            }
+
+            PCPathChar segment = current;
+            while (*current != L'\0' && !IsDirectorySeparator(*current))
+            {
+                current++;
+            }
+
+            size_t segmentLength = current - segment;
+            if (segmentLength == 0 || (segmentLength == 1 && segment[0] == PATH_DOT))
+            {
+                continue;
+            }
+
+            if (segmentLength == 2 && segment[0] == PATH_DOT && segment[1] == PATH_DOT)
+            {
+                if (length == rootLength)
+                {
+                    return LexicalFullPathResult::Unsupported;
+                }
+
+                // Drop the last segment kept, up to the separator preceding it (the root ends with one)
+                length--;
+                while (buffer[length - 1] != NT_DIRECTORY_SEPARATOR)
+                {
+                    length--;
+                }
+
+                continue;
+            }
+
+            if (segment[segmentLength - 1] == PATH_DOT || segment[segmentLength - 1] == L' ')
+            {
+                return LexicalFullPathResult::Unsupported;
+            }
+
+            // The segment, its separator and the null terminator
+            if (length + segmentLength + 2 > bufferLength)
+            {
+                return LexicalFullPathResult::BufferTooSmall;
+            }
+
+            wmemcpy(buffer + length, segment, segmentLength);
+            length += segmentLength;
+            buffer[length++] = NT_DIRECTORY_SEPARATOR;
+        }
+    }
+
+    if (length > rootLength)
+    {
+        size_t lastSegment = length - 1;
+        while (buffer[lastSegment - 1] != NT_DIRECTORY_SEPARATOR)
+        {
+            lastSegment--;
+        }
+
+        if (IsDosDeviceName(buffer + lastSegment, length - 1 - lastSegment))
+        {
+            return LexicalFullPathResult::Unsupported;
+        }
+
+        // Like Win32, keep a trailing separator only if the path has one
+        size_t pathLength = pathlen(path);
+        if (!IsDirectorySeparator(path[pathLength - 1]))
+        {
+            length--;
+        }
+    }
+
+    if (length >= MaxWin32PathLength)
+    {
+        return LexicalFullPathResult::Unsupported;
+    }
+
+    buffer[length] = L'\0';
+    *fullPathLength = length;
+    return LexicalFullPathResult::Success;
+}
+
 std::wstring PathCombine(const std::wstring& fragment1, const std::wstring& fragment2) noexcept
 {
     if (fragment2.size() == 0)
@@ -598,4 +1000,51 @@ std::wstring PathCombine(const std::wstring& fragment1, const std::wstring& frag
         ? fragment1 + NT_DIRECTORY_SEPARATOR + fragment2
         : fragment1 + fragment2;
 }
+
+size_t NarrowAsciiPrefix(const wchar_t* text, size_t length, char* ascii) noexcept
+{
+    size_t i = 0;
+
+#if PATH_COMPARISON_SSE2 || PATH_COMPARISON_NEON
+    for (; i + 2 * PathComparisonBlockLength <= length; i += 2 * PathComparisonBlockLength) {
+        const PathCharBlock low = LoadPathCharBlock(&text[i]);
+        const PathCharBlock high = LoadPathCharBlock(&text[i + PathComparisonBlockLength]);
+        if (!IsAsciiBlock(low) || !IsAsciiBlock(high)) {
+            break;
+        }
+
+        StoreNarrowedAsciiBlocks(low, high, &ascii[i]);
+    }
+#endif
+
+    for (; i < length && text[i] < 0x80; i++) {
+        ascii[i] = (char)text[i];
+    }
+
+    return i;
+}
+
+size_t WidenAsciiPrefix(const char* ascii, size_t length, wchar_t* text) noexcept
+{
+    size_t i = 0;
+
+#if PATH_COMPARISON_SSE2 || PATH_COMPARISON_NEON
+    for (; i + 2 * PathComparisonBlockLength <= length; i += 2 * PathComparisonBlockLength) {
+        PathCharBlock low;
+        PathCharBlock high;
+        if (!TryLoadWidenedAsciiBlocks(&ascii[i], low, high)) {
+            break;
+        }
+
+        StorePathCharBlock(&text[i], low);
+        StorePathCharBlock(&text[i + PathComparisonBlockLength], high);
+    }
+#endif
+
+    for (; i < length && (unsigned char)ascii[i] < 0x80; i++) {
+        text[i] = (wchar_t)ascii[i];
+    }
+
+    return i;
+}
 #endif // _WIN32
\ No newline at end of file
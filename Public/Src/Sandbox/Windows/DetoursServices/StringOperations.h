@@ -20,16 +20,25 @@
 
 typedef WCHAR PathChar;
 #define pathlen wcslen
+#define pathnlen wcsnlen
 #define BUILD_EXE_TRACE_FILE L"_buildc_dep_out.pass"
 
 #else
 
 typedef char PathChar;
 #define pathlen strlen
+#define pathnlen strnlen
 #define BUILD_EXE_TRACE_FILE "_buildc_dep_out.pass"
 
 #endif
 
+// Exported so the native unit tests can call into the cross-platform helpers below
+#if _WIN32
+#define STRING_OPERATIONS_EXPORT __declspec(dllexport)
+#else
+#define STRING_OPERATIONS_EXPORT
+#endif
+
 #if MAC_OS_LIBRARY || MAC_OS_SANDBOX
 #include "utf8proc.h"
 #endif // MAC_OS_LIBRARY || MAC_OS_SANDBOX
@@ -42,6 +51,7 @@ typedef const PathChar* PCPathChar;
 // ----------------------------------------------------------------------------
 
 #if _WIN32
+#include <string_view>
 extern _locale_t g_invariantLocale;
 #elif MAC_OS_LIBRARY
 #include <ctype.h>
@@ -76,6 +86,13 @@ extern _locale_t g_invariantLocale;
 inline PathChar NormalizePathChar(PathChar c) noexcept
 {
 #if _WIN32
+    // towupper goes through the CRT locale tables. ASCII characters, which make up most paths, are upper-cased the same
+    // way in every locale (towupper applies file system casing rules, not linguistic ones), so skip that for them.
+    if (c < 0x80)
+    {
+        return (c >= L'a' && c <= L'z') ? (PathChar)(c - (L'a' - L'A')) : c;
+    }
+
     const PathChar pc{ towupper(c) };
     return pc;
 #elif __linux__
@@ -197,6 +214,31 @@ inline bool IsUncPathName(PCPathChar path) noexcept
         (path[6] == L'\\');
 }
 
+// Magic numbers known to provide good hash distributions.
+// See here: http://www.isthe.com/chongo/tech/comp/fnv/
+
+constexpr DWORD Fnv1Prime32 = 16777619;
+constexpr DWORD Fnv1Basis32 = static_cast<const unsigned int>(2166136261);
+
+constexpr inline DWORD _Fold(DWORD hash, BYTE value) noexcept
+{
+    return (hash * Fnv1Prime32) ^ (DWORD)value;
+}
+
+constexpr inline DWORD Fold(DWORD hash, WORD value) noexcept
+{
+    return _Fold(_Fold(hash, (BYTE)value), (BYTE)(((WORD)value) >> 8));
+}
+
+/// HashNormalizedPathChar
+///
+/// Folds one more character, already normalized with NormalizePathChar, into a hash computed the way HashPath does.
+/// Starting from Fnv1Basis32, this allows hashing a path while scanning it for something else.
+constexpr inline DWORD HashNormalizedPathChar(DWORD hash, PathChar normalizedChar) noexcept
+{
+    return Fold(hash, normalizedChar);
+}
+
 // ----------------------------------------------------------------------------
 // FUNCTION DECLARATIONS
 // ----------------------------------------------------------------------------
@@ -224,9 +266,13 @@ BOOL WINAPI ArePathsEqual(
     __in_ecount(nLength + 1)    PCPathChar pNormalizedPath,
     __in                        size_t nLength) noexcept;
 
-// HasPrefix and HasSuffix compare using IsPathCharEqual
-bool HasPrefix(PCPathChar text, PCPathChar prefix) noexcept;
-bool HasSuffix(PCPathChar str, size_t str_length, PCPathChar suffix) noexcept;
+// Checks if the first 'length' characters of two strings are equal using IsPathCharEqual.
+// On Windows, runs of ASCII characters are case-folded and compared a block at a time (SSE2 or NEON).
+STRING_OPERATIONS_EXPORT bool ArePathCharsEqual(PCPathChar str1, PCPathChar str2, size_t length) noexcept;
+
+// HasPrefix and HasSuffix compare using ArePathCharsEqual
+STRING_OPERATIONS_EXPORT bool HasPrefix(PCPathChar text, PCPathChar prefix) noexcept;
+STRING_OPERATIONS_EXPORT bool HasSuffix(PCPathChar str, size_t str_length, PCPathChar suffix) noexcept;
 
 // Returns true if 'path' is exactly equal to 'tree' (ignoring case),
 // or if 'path' identifies a path within (under) 'tree'.  For example,
@@ -236,7 +282,7 @@ bool HasSuffix(PCPathChar str, size_t str_length, PCPathChar suffix) noexcept;
 //
 // Both values are required to be absolute paths, except 'tree' may be an empty string
 // (in which case any path is considered to be under it).
-bool IsPathWithinTree(PCPathChar tree, PCPathChar path) noexcept;
+STRING_OPERATIONS_EXPORT bool IsPathWithinTree(PCPathChar tree, PCPathChar path) noexcept;
 
 bool StringLooksLikeRCTempFile(PCPathChar str, size_t str_length) noexcept;
 
@@ -261,8 +307,62 @@ bool IsPathToNamedStream(PCPathChar const path, size_t pathLength) noexcept;
 size_t GetRootLength(PCPathChar path) noexcept;
 
 #if _WIN32
+// Number of atoms PathAtoms holds before it has to allocate. Covers the depth of almost every path seen in a build.
+#define PATH_ATOMS_INLINE_CAPACITY 32
+
+// The atoms of a path, as views of the path they were decomposed from (which must outlive them). The first
+// PATH_ATOMS_INLINE_CAPACITY atoms are kept inline, so decomposing a path usually doesn't allocate.
+class PathAtoms
+{
+public:
+    PathAtoms() = default;
+    PathAtoms(const PathAtoms&) = delete;
+    PathAtoms& operator=(const PathAtoms&) = delete;
+
+    size_t size() const noexcept { return m_count; }
+    bool empty() const noexcept { return m_count == 0; }
+
+    const std::wstring_view& operator[](size_t index) const noexcept { return begin()[index]; }
+    const std::wstring_view* begin() const noexcept { return m_count <= PATH_ATOMS_INLINE_CAPACITY ? m_inline : m_overflow.data(); }
+    const std::wstring_view* end() const noexcept { return begin() + m_count; }
+
+    void push_back(std::wstring_view atom)
+    {
+        if (m_count < PATH_ATOMS_INLINE_CAPACITY)
+        {
+            m_inline[m_count++] = atom;
+            return;
+        }
+
+        // Past the inline capacity every atom lives in the overflow vector, so they stay contiguous
+        if (m_count == PATH_ATOMS_INLINE_CAPACITY)
+        {
+            m_overflow.assign(m_inline, m_inline + PATH_ATOMS_INLINE_CAPACITY);
+        }
+
+        m_overflow.push_back(atom);
+        m_count++;
+    }
+
+    void clear() noexcept
+    {
+        m_overflow.clear();
+        m_count = 0;
+    }
+
+private:
+    std::wstring_view m_inline[PATH_ATOMS_INLINE_CAPACITY];
+    std::vector<std::wstring_view> m_overflow;
+    size_t m_count = 0;
+};
+
+// Decomposes a path into its atoms, the same way _wsplitpath_s splits it: the drive (if any), each directory and the file name
+// (with its extension). Empty atoms are skipped. The atoms are views of the given path. Returns 0 on success, or ERANGE if the
+// path is longer than _wsplitpath_s can handle.
+STRING_OPERATIONS_EXPORT int TryDecomposePath(std::wstring_view path, PathAtoms& atoms);
+
 // Returns a collection of all path atoms of the given path
-int TryDecomposePath(const std::wstring& path, std::vector<std::wstring>& elements);
+STRING_OPERATIONS_EXPORT int TryDecomposePath(const std::wstring& path, std::vector<std::wstring>& elements);
 
 // Combines two path fragments into a single path separated by a directory separator.
 std::wstring PathCombine(const std::wstring& fragment1, const std::wstring& fragment2) noexcept;
@@ -277,4 +377,37 @@ std::wstring NormalizePath(const std::wstring& path);
 // Removes NT or local device prefix from path.
 __declspec(dllexport)
 PCPathChar GetPathWithoutPrefix(PCPathChar path) noexcept;
+
+// Outcome of GetFullPathLexically.
+enum class LexicalFullPathResult
+{
+    // The full path was written to the buffer.
+    Success,
+    // The buffer is too small. A buffer of pathlen(path) + pathlen(currentDirectory) + 3 characters is always big enough.
+    BufferTooSmall,
+    // The full path cannot be computed lexically; GetFullPathNameW should be used instead.
+    Unsupported,
+};
+
+// Computes the full path GetFullPathNameW would return for 'path' without calling into the OS: applies the current directory to
+// relative and rooted (\foo) paths, resolves . and .. segments, collapses runs of separators and turns / into \.
+// Handles drive absolute, UNC and local device (\\.\) paths, and relative and rooted paths when 'currentDirectory' (as returned
+// by GetCurrentDirectoryW) is given. Returns Unsupported for everything Win32 treats in ways that are not purely lexical:
+//   - drive relative paths (C:foo), which use a per-drive current directory
+//   - segments ending with a dot or a space, which Win32 trims
+//   - a last segment naming a DOS device (NUL, CON, COM1, nul.txt, ...), which Win32 turns into \\.\ paths
+//   - .. segments that would go above the root
+//   - \\?\ and \??\ paths, which escape canonicalization altogether
+// On success, 'buffer' holds the null terminated full path and 'fullPathLength' its length.
+__declspec(dllexport)
+LexicalFullPathResult GetFullPathLexically(PCPathChar path, PCPathChar currentDirectory, PathChar* buffer, size_t bufferLength, size_t* fullPathLength) noexcept;
+
+// Copies the leading ASCII characters of the first 'length' characters of 'text' to 'ascii', one byte per character, and
+// returns how many were copied: the copy stops at the first non-ASCII character.
+// ASCII text reads the same in UTF-8, UTF-16 and every ANSI code page, so transcoding a path only needs the OS conversion
+// functions from its first non-ASCII character on.
+STRING_OPERATIONS_EXPORT size_t NarrowAsciiPrefix(const wchar_t* text, size_t length, char* ascii) noexcept;
+
+// Same as NarrowAsciiPrefix, the other way around.
+STRING_OPERATIONS_EXPORT size_t WidenAsciiPrefix(const char* ascii, size_t length, wchar_t* text) noexcept;
 #endif
\ No newline at end of file
@@ -7,16 +7,18 @@
 
 #include "DebuggingHelpers.h"
 #include "DetouredFunctions.h"
+#include "DetouredScope.h"
 #include "DetoursHelpers.h"
 #include "DetoursServices.h"
 #include "FileAccessHelpers.h"
 #include "StringOperations.h"
 #include "UnicodeConverter.h"
+#include "ShimProcessMatcher.h"
+#include "PluginVerdictCache.h"
 #include "SubstituteProcessExecution.h"
 
 using std::wstring;
 using std::unique_ptr;
-using std::vector;
 
 /// Runs an injected substitute shim instead of the actual child process, passing the
 /// original command and arguments to the shim along with, implicitly,
@@ -70,127 +72,258 @@ static BOOL WINAPI InjectShim(
     return rv;
 }
 
-// trim from start (in place)
-// https://stackoverflow.com/questions/216823/whats-the-best-way-to-trim-stdstring
-static inline void ltrim_inplace(std::wstring& s) {
-    s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](wchar_t ch) {
-        return !std::iswspace(ch);
-        }));
-}
+// Narrows [begin, end) down to exclude leading and trailing whitespace
+static inline void TrimRange(const wchar_t*& begin, const wchar_t*& end)
+{
+    while (begin < end && std::iswspace(*begin))
+    {
+        begin++;
+    }
 
-// trim from end (in place)
-// https://stackoverflow.com/questions/216823/whats-the-best-way-to-trim-stdstring
-static inline void rtrim_inplace(std::wstring& s) {
-    s.erase(std::find_if(s.rbegin(), s.rend(), [](wchar_t ch) {
-        return !std::iswspace(ch);
-        }).base(), s.end());
+    while (end > begin && std::iswspace(*(end - 1)))
+    {
+        end--;
+    }
 }
 
 // trim from both ends (in place)
-// https://stackoverflow.com/questions/216823/whats-the-best-way-to-trim-stdstring
-static inline void trim_inplace(std::wstring& s) {
-    ltrim_inplace(s);
-    rtrim_inplace(s);
+static inline void trim_inplace(std::wstring& s)
+{
+    const wchar_t* begin = s.c_str();
+    const wchar_t* end = begin + s.length();
+    TrimRange(begin, end);
+    s.assign(begin, end - begin);
 }
 
 // Returns in 'command' the command from lpCommandLine without quotes, and in commandArgs the arguments from the remainder of the string.
+// This runs on every process creation, so the pieces are located in place and only copied once into the outputs.
 static void FindApplicationNameFromCommandLine(const wchar_t *lpCommandLine, _Out_ wstring &command, _Out_ wstring &commandArgs)
 {
-    wstring fullCommandLine(lpCommandLine);
-    if (fullCommandLine.length() == 0)
+    const size_t fullCommandLineLength = wcslen(lpCommandLine);
+    const wchar_t* fullCommandLineEnd = lpCommandLine + fullCommandLineLength;
+    command.clear();
+    commandArgs.clear();
+
+    if (fullCommandLineLength == 0)
     {
-        command = wstring();
-        commandArgs = wstring();
         return;
     }
 
-    size_t argStartIndex;
-    const size_t fullCommandLineLength = fullCommandLine.length();
+    const wchar_t* argStart;
 
-    if (fullCommandLine[0] == L'"')
+    if (lpCommandLine[0] == L'"')
     {
         // Find the close quote. Might not be present which means the command
         // is the full command line minus the initial quote.
-        size_t closeQuoteIndex = fullCommandLine.find(L'"', 1);
-        if (closeQuoteIndex == wstring::npos)
+        const wchar_t* closeQuote = wcschr(lpCommandLine + 1, L'"');
+        if (closeQuote == nullptr)
         {
             // No close quote. Take everything through the end of the command line as the command.
-            command = fullCommandLine.substr(1);
-            trim_inplace(command);
-            commandArgs = wstring();
-            argStartIndex = fullCommandLineLength;
+            closeQuote = fullCommandLineEnd;
         }
-        else
+
+        if (closeQuote >= fullCommandLineEnd - 1)
         {
-            if (closeQuoteIndex == fullCommandLine.length() - 1)
-            {
-                // Quotes cover entire command line.
-                command = fullCommandLine.substr(1, fullCommandLine.length() - 2);
-                argStartIndex = fullCommandLineLength;
-            }
-            else
-            {
-                wstring noQuoteCommand = fullCommandLine.substr(1, closeQuoteIndex - 1);
-
-                // Find the next delimiting space after the close double-quote.
-                // For example a command like "c:\program files"\foo we need to
-                // keep \foo and cut the quotes to produce c:\program files\foo
-                size_t spaceDelimiterIndex = fullCommandLine.find(L' ', closeQuoteIndex + 1);
-                if (spaceDelimiterIndex == wstring::npos)
-                {
-                    // No space, take everything through the end of the command line.
-                    spaceDelimiterIndex = fullCommandLineLength;
-                }
-
-                command = (noQuoteCommand +
-                    fullCommandLine.substr(closeQuoteIndex + 1, spaceDelimiterIndex - closeQuoteIndex - 1));
-
-                argStartIndex = spaceDelimiterIndex + 1;
-            }
+            // Quotes cover entire command line.
+            const wchar_t* commandStart = lpCommandLine + 1;
+            TrimRange(commandStart, closeQuote);
+            command.assign(commandStart, closeQuote - commandStart);
+            return;
+        }
+
+        // Find the next delimiting space after the close double-quote.
+        // For example a command like "c:\program files"\foo we need to
+        // keep \foo and cut the quotes to produce c:\program files\foo
+        const wchar_t* spaceDelimiter = wcschr(closeQuote + 1, L' ');
+        if (spaceDelimiter == nullptr)
+        {
+            // No space, take everything through the end of the command line.
+            spaceDelimiter = fullCommandLineEnd;
         }
+
+        command.reserve((closeQuote - lpCommandLine - 1) + (spaceDelimiter - closeQuote - 1));
+        command.assign(lpCommandLine + 1, closeQuote - lpCommandLine - 1);
+        command.append(closeQuote + 1, spaceDelimiter - closeQuote - 1);
+        trim_inplace(command);
+
+        argStart = spaceDelimiter < fullCommandLineEnd ? spaceDelimiter + 1 : fullCommandLineEnd;
     }
     else
     {
         // No open quote, pure space delimiter.
-        size_t spaceDelimiterIndex = fullCommandLine.find(L' ');
-        if (spaceDelimiterIndex == wstring::npos)
+        const wchar_t* spaceDelimiter = wcschr(lpCommandLine, L' ');
+        if (spaceDelimiter == nullptr)
         {
             // No space, take everything through the end of the command line.
-            spaceDelimiterIndex = fullCommandLineLength;
+            spaceDelimiter = fullCommandLineEnd;
         }
 
-        command = fullCommandLine.substr(0, spaceDelimiterIndex);
-        argStartIndex = spaceDelimiterIndex + 1;
+        const wchar_t* commandStart = lpCommandLine;
+        const wchar_t* commandEnd = spaceDelimiter;
+        TrimRange(commandStart, commandEnd);
+        command.assign(commandStart, commandEnd - commandStart);
+
+        argStart = spaceDelimiter < fullCommandLineEnd ? spaceDelimiter + 1 : fullCommandLineEnd;
     }
 
-    trim_inplace(command);
+    if (argStart < fullCommandLineEnd)
+    {
+        const wchar_t* argEnd = fullCommandLineEnd;
+        TrimRange(argStart, argEnd);
+        commandArgs.assign(argStart, argEnd - argStart);
+    }
+}
+
+static SubstituteProcessExecutionPluginFunc GetSubstituteProcessExecutionPluginFunc()
+{
+    assert(g_SubstituteProcessExecutionPluginDllHandle != nullptr);
+
+    // Different compiler or different compiler settings can result in different function name variants.
+    //
+    // X64 version typically has:
+    //     ordinal hint RVA      name
+    //
+    //     1    0 00011069 CommandMatches = @ILT + 100(CommandMatches)
+    //
+    // X86 version can have:
+    //     ordinal hint RVA      name
+    //
+    //     1    0 00011276 _CommandMatches@24 = @ILT + 625(_CommandMatches@24)
+
+
+    // (1) Check for CommandMatches.
+    std::string winApiProcName("CommandMatches");
+    SubstituteProcessExecutionPluginFunc substituteProcessExecutionPluginFunc = reinterpret_cast<SubstituteProcessExecutionPluginFunc>(
+        reinterpret_cast<void*>(GetProcAddress(g_SubstituteProcessExecutionPluginDllHandle, winApiProcName.c_str())));
+    if (substituteProcessExecutionPluginFunc != nullptr)
+    {
+        return substituteProcessExecutionPluginFunc;
+    }
+
+    // (2) Check for CommandMatches@<param_size> based on platform.
+#if defined(_WIN64)
+    winApiProcName.append("@48"); // 6 64-bit parameters
+#elif defined(_WIN32)
+    winApiProcName.append("@24"); // 6 32-bit parameters
+#endif
+    substituteProcessExecutionPluginFunc = reinterpret_cast<SubstituteProcessExecutionPluginFunc>(
+        reinterpret_cast<void*>(GetProcAddress(g_SubstituteProcessExecutionPluginDllHandle, winApiProcName.c_str())));
+    if (substituteProcessExecutionPluginFunc != nullptr)
+    {
+        return substituteProcessExecutionPluginFunc;
+    }
 
-    if (argStartIndex < fullCommandLineLength)
+    // (3) Check for _CommandMatches@<param_size>.
+    winApiProcName.insert(0, 1, '_');
+    substituteProcessExecutionPluginFunc = reinterpret_cast<SubstituteProcessExecutionPluginFunc>(
+        reinterpret_cast<void*>(GetProcAddress(g_SubstituteProcessExecutionPluginDllHandle, winApiProcName.c_str())));
+    if (substituteProcessExecutionPluginFunc != nullptr)
     {
-        commandArgs = fullCommandLine.substr(argStartIndex);
-        trim_inplace(commandArgs);
+        return substituteProcessExecutionPluginFunc;
+    }
+
+    Dbg(L"Unable to find 'CommandMatches', 'CommandMatches@<param_size>', or '_CommandMatches@<param_size>' functions in SubstituteProcessExecutionPluginFunc '%s', lasterr=%d", g_SubstituteProcessExecutionPluginDllPath, GetLastError());
+    return nullptr;
+}
+
+static void LoadSubstituteProcessExecutionPluginDll()
+{
+    assert(g_SubstituteProcessExecutionPluginDllPath != nullptr);
+
+    Dbg(L"Loading substitute process plugin DLL at '%s'", g_SubstituteProcessExecutionPluginDllPath);
+
+    g_SubstituteProcessExecutionPluginDllHandle = LoadLibraryW(g_SubstituteProcessExecutionPluginDllPath);
+
+    if (g_SubstituteProcessExecutionPluginDllHandle != nullptr)
+    {
+        g_SubstituteProcessExecutionPluginFunc = GetSubstituteProcessExecutionPluginFunc();
+
+        if (g_SubstituteProcessExecutionPluginFunc == nullptr)
+        {
+            FreeLibrary(g_SubstituteProcessExecutionPluginDllHandle);
+        }
     }
     else
     {
-        commandArgs = wstring();
+        Dbg(L"Failed LoadLibrary for LoadSubstituteProcessExecutionPluginDll %s, lasterr=%d", g_SubstituteProcessExecutionPluginDllPath, GetLastError());
     }
 }
 
-static bool CommandArgsContainMatch(const wchar_t *commandArgs, const wchar_t *argMatch)
+static INIT_ONCE s_substituteProcessExecutionPluginDllLoad = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK LoadSubstituteProcessExecutionPluginDllOnce(PINIT_ONCE, PVOID, PVOID*)
 {
-    if (argMatch == nullptr)
+    // The plugin is BuildXL's, not the pip's: don't report or check the accesses made while loading it
+    DetouredScope scope;
+    LoadSubstituteProcessExecutionPluginDll();
+    return TRUE;
+}
+
+/// Returns the plugin filter function, or nullptr if there is no plugin or it could not be loaded.
+/// The plugin DLL is loaded the first time a process is about to be created instead of on process attach,
+/// so processes that never create one don't pay for it.
+static SubstituteProcessExecutionPluginFunc EnsureSubstituteProcessExecutionPluginLoaded()
+{
+    if (g_SubstituteProcessExecutionPluginDllPath == nullptr)
     {
-        // No optional match, meaning always match.
-        return true;
+        return nullptr;
     }
 
-    return wcsstr(commandArgs, argMatch) != nullptr;
+    InitOnceExecuteOnce(&s_substituteProcessExecutionPluginDllLoad, LoadSubstituteProcessExecutionPluginDllOnce, nullptr, nullptr);
+    return g_SubstituteProcessExecutionPluginFunc;
+}
+
+/// FNV-1a hash of an environment block, up to and including its terminating empty string.
+static unsigned long long HashEnvironmentBlock(LPVOID lpEnvironment, bool unicodeEnvironment)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    const size_t charSize = unicodeEnvironment ? sizeof(wchar_t) : sizeof(char);
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(lpEnvironment);
+
+    bool previousWasNull = false;
+    for (;;)
+    {
+        bool isNull = true;
+        for (size_t i = 0; i < charSize; i++)
+        {
+            isNull = isNull && bytes[i] == 0;
+            hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        }
+
+        bytes += charSize;
+        if (isNull && previousWasNull)
+        {
+            return hash;
+        }
+
+        previousWasNull = isNull;
+    }
+}
+
+/// Copies modified arguments remembered by PluginVerdictCache to the default process heap, where the plugin allocates them.
+static LPWSTR AllocateModifiedArguments(const wstring& arguments)
+{
+    HANDLE hDefaultProcessHeap = GetProcessHeap();
+    if (hDefaultProcessHeap == NULL)
+    {
+        return nullptr;
+    }
+
+    const size_t size = (arguments.length() + 1) * sizeof(wchar_t);
+    LPWSTR copy = reinterpret_cast<LPWSTR>(HeapAlloc(hDefaultProcessHeap, 0, size));
+    if (copy != nullptr)
+    {
+        memcpy_s(copy, size, arguments.c_str(), size);
+    }
+
+    return copy;
 }
 
 static bool CallPluginFunc(
     const wstring& command,
     const wstring& commandArgs,
     LPVOID lpEnvironment,
+    bool unicodeEnvironment,
     LPCWSTR lpWorkingDirectory,
     LPWSTR* modifiedArguments)
 {
@@ -199,6 +332,7 @@ static bool CallPluginFunc(
     if (lpEnvironment == nullptr)
     {
         lpEnvironment = GetEnvironmentStrings();
+        unicodeEnvironment = true;
     }
 
     wchar_t curDir[MAX_PATH];
@@ -208,31 +342,106 @@ static bool CallPluginFunc(
         lpWorkingDirectory = curDir;
     }
 
-    return g_SubstituteProcessExecutionPluginFunc(
+    const bool cacheVerdicts = CacheSubstituteProcessExecutionPluginVerdicts() && lpEnvironment != nullptr;
+    unsigned long long environmentHash = 0;
+    if (cacheVerdicts)
+    {
+        environmentHash = HashEnvironmentBlock(lpEnvironment, unicodeEnvironment);
+
+        PluginVerdict cachedVerdict;
+        if (PluginVerdictCache::Instance().TryGetVerdict(command, commandArgs, lpWorkingDirectory, environmentHash, cachedVerdict))
+        {
+            if (cachedVerdict.HasModifiedArguments)
+            {
+                *modifiedArguments = AllocateModifiedArguments(cachedVerdict.ModifiedArguments);
+            }
+
+            return cachedVerdict.Matches;
+        }
+    }
+
+    const bool matches = g_SubstituteProcessExecutionPluginFunc(
         command.c_str(),
         commandArgs.c_str(),
         lpEnvironment,
         lpWorkingDirectory,
         modifiedArguments,
         Dbg) != 0;
+
+    if (cacheVerdicts)
+    {
+        PluginVerdict verdict;
+        verdict.Matches = matches;
+        verdict.HasModifiedArguments = *modifiedArguments != nullptr;
+        if (verdict.HasModifiedArguments)
+        {
+            verdict.ModifiedArguments.assign(*modifiedArguments);
+        }
+
+        PluginVerdictCache::Instance().InsertVerdict(command, commandArgs, lpWorkingDirectory, environmentHash, verdict);
+    }
+
+    return matches;
+}
+
+/// Returns the shim process matcher, compiling it from the payload the first time it is needed.
+/// Threads creating processes concurrently may race to compile it, in which case the loser's copy is discarded.
+static ShimProcessMatcher* GetShimProcessMatcher()
+{
+    ShimProcessMatcher* matcher = g_pShimProcessMatcher;
+    if (matcher != nullptr || g_shimProcessMatchesPayload == nullptr)
+    {
+        return matcher;
+    }
+
+    size_t offset = 0;
+    uint32_t numProcessMatches = ParseUint32(g_shimProcessMatchesPayload, offset);
+    ShimProcessMatcher* newMatcher = new ShimProcessMatcher();
+    for (uint32_t i = 0; i < numProcessMatches; i++)
+    {
+        uint32_t processNameLength = ParseUint32(g_shimProcessMatchesPayload, offset);
+        const wchar_t* processName = reinterpret_cast<const wchar_t*>(&g_shimProcessMatchesPayload[offset]);
+        offset += sizeof(wchar_t) * processNameLength;
+
+        uint32_t argumentMatchLength = ParseUint32(g_shimProcessMatchesPayload, offset);
+        const wchar_t* argumentMatch = reinterpret_cast<const wchar_t*>(&g_shimProcessMatchesPayload[offset]);
+        offset += sizeof(wchar_t) * argumentMatchLength;
+
+        newMatcher->Add(processName, processNameLength, argumentMatch, argumentMatchLength);
+    }
+
+    newMatcher->Build();
+
+    matcher = reinterpret_cast<ShimProcessMatcher*>(
+        InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(&g_pShimProcessMatcher), newMatcher, nullptr));
+    if (matcher != nullptr)
+    {
+        delete newMatcher;
+        return matcher;
+    }
+
+    return newMatcher;
 }
 
 static bool ShouldSubstituteShim(
     const wstring &command,
     const wstring& commandArgs,
     LPVOID lpEnvironment,
+    bool unicodeEnvironment,
     LPCWSTR lpWorkingDirectory,
     LPWSTR* modifiedArguments)
 {
     assert(g_SubstituteProcessExecutionShimPath != nullptr);
 
+    ShimProcessMatcher* shimProcessMatcher = GetShimProcessMatcher();
+
     // Easy cases.
-    if (g_pShimProcessMatches == nullptr || g_pShimProcessMatches->empty())
+    if (shimProcessMatcher == nullptr || shimProcessMatcher->IsEmpty())
     {
-        if (g_SubstituteProcessExecutionPluginFunc != nullptr)
+        if (EnsureSubstituteProcessExecutionPluginLoaded() != nullptr)
         {
             // Filter meaning is exclusive if we're shimming all processes, inclusive otherwise.
-            bool filterMatch = CallPluginFunc(command, commandArgs, lpEnvironment, lpWorkingDirectory, modifiedArguments);
+            bool filterMatch = CallPluginFunc(command, commandArgs, lpEnvironment, unicodeEnvironment, lpWorkingDirectory, modifiedArguments);
 
             Dbg(L"Shim: Empty matches command='%s', args='%s', filterMatch=%d, g_ProcessExecutionShimAllProcesses=%d", command.c_str(), commandArgs.c_str(), filterMatch, g_ProcessExecutionShimAllProcesses);
 
@@ -245,45 +454,7 @@ static bool ShouldSubstituteShim(
         return g_ProcessExecutionShimAllProcesses;
     }
 
-    size_t commandLen = command.length();
-
-    bool foundMatch = false;
-
-    for (std::vector<ShimProcessMatch*>::iterator it = g_pShimProcessMatches->begin(); it != g_pShimProcessMatches->end(); ++it)
-    {
-        ShimProcessMatch* pMatch = *it;
-
-        const wchar_t* processName = pMatch->ProcessName.get();
-        size_t processLen = wcslen(processName);
-
-        // lpAppName is longer than e.g. "cmd.exe", see if lpAppName ends with e.g. "\cmd.exe"
-        if (processLen < commandLen)
-        {
-            if (command[commandLen - processLen - 1] == L'\\' &&
-                _wcsicmp(command.c_str() + commandLen - processLen, processName) == 0)
-            {
-                if (CommandArgsContainMatch(commandArgs.c_str(), pMatch->ArgumentMatch.get()))
-                {
-                    foundMatch = true;
-                    break;
-                }
-            }
-
-            continue;
-        }
-
-        if (processLen == commandLen)
-        {
-            if (_wcsicmp(processName, command.c_str()) == 0)
-            {
-                if (CommandArgsContainMatch(commandArgs.c_str(), pMatch->ArgumentMatch.get()))
-                {
-                    foundMatch = true;
-                    break;
-                }
-            }
-        }
-    }
+    bool foundMatch = shimProcessMatcher->Matches(command.c_str(), command.length(), commandArgs.c_str(), commandArgs.length());
 
     // Filter meaning is exclusive if we're shimming all processes, inclusive otherwise.
     bool filterMatch = !g_ProcessExecutionShimAllProcesses;
@@ -291,9 +462,9 @@ static bool ShouldSubstituteShim(
     if (foundMatch)
     {
         // Refine match by calling plugin.
-        if (g_SubstituteProcessExecutionPluginFunc != nullptr)
+        if (EnsureSubstituteProcessExecutionPluginLoaded() != nullptr)
         {
-            filterMatch = CallPluginFunc(command, commandArgs, lpEnvironment, lpWorkingDirectory, modifiedArguments) != 0;
+            filterMatch = CallPluginFunc(command, commandArgs, lpEnvironment, unicodeEnvironment, lpWorkingDirectory, modifiedArguments) != 0;
         }
     }
 
@@ -367,7 +538,8 @@ BOOL WINAPI MaybeInjectSubstituteProcessShim(
 
     LPWSTR modifiedArguments = nullptr;
     
-    if (ShouldSubstituteShim(command, commandArgs, lpEnvironment, lpCurrentDirectory, &modifiedArguments))
+    const bool unicodeEnvironment = (dwCreationFlags & CREATE_UNICODE_ENVIRONMENT) != 0;
+    if (ShouldSubstituteShim(command, commandArgs, lpEnvironment, unicodeEnvironment, lpCurrentDirectory, &modifiedArguments))
     {
         // Instead of Detouring the child, run the requested shim
         // passing the original command line, but only for appropriate commands.
@@ -0,0 +1,116 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <cwctype>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A case-insensitive prefix trie over the paths that translations go from (see TranslateFilePath), so the longest
+// translation that applies to a path is found in a single pass over it.
+// Every inserted path is associated with an id (its index among the translations). Nodes live in a single vector and
+// refer to their children by index. Translated paths tend to share long prefixes, so nodes have very few children and
+// those are just scanned.
+// This class is not thread safe for writing. Lookups don't modify it.
+class TranslatePathTrie
+{
+public:
+    TranslatePathTrie() : m_nodes(1)
+    {
+    }
+
+    // Adds a path to translate from. The path is expected to be lowercased already, which is how translations are stored
+    void Insert(const std::wstring& lowCaseFromPath, size_t id)
+    {
+        size_t node = 0;
+        for (const wchar_t c : lowCaseFromPath)
+        {
+            size_t child = FindChild(node, c);
+            if (child == 0)
+            {
+                child = m_nodes.size();
+                m_nodes.emplace_back();
+                m_nodes[node].Children.emplace_back(c, child);
+            }
+
+            node = child;
+        }
+
+        m_nodes[node].Ids.push_back(id);
+    }
+
+    // Finds the longest inserted path that is a prefix of the given one, compared case-insensitively, skipping the ids flagged in used
+    // (an id beyond the size of used is not used). An inserted path with a trailing backslash also matches the given path when it is the
+    // same directory without the backslash. When two inserted paths are equal, the one inserted first wins.
+    // Returns how many characters of path the match covers, or 0 if nothing matches, and sets id to the id of the match.
+    size_t FindLongestPrefix(const wchar_t* path, size_t length, const std::vector<bool>& used, size_t& id) const
+    {
+        size_t matchLength = 0;
+        size_t node = 0;
+        size_t i = 0;
+
+        for (; i < length; i++)
+        {
+            node = FindChild(node, (wchar_t)towlower(path[i]));
+            if (node == 0)
+            {
+                return matchLength;
+            }
+
+            if (TryGetUnusedId(node, used, id))
+            {
+                matchLength = i + 1;
+            }
+        }
+
+        if (length > 0 && path[length - 1] != L'\\')
+        {
+            const size_t directory = FindChild(node, L'\\');
+            if (directory != 0 && TryGetUnusedId(directory, used, id))
+            {
+                matchLength = length;
+            }
+        }
+
+        return matchLength;
+    }
+
+private:
+    struct Node
+    {
+        std::vector<std::pair<wchar_t, size_t>> Children;
+        std::vector<size_t> Ids;
+    };
+
+    // Returns the index of the child of node reached through c, or 0 (the root, which is nobody's child) if there is none
+    size_t FindChild(size_t node, wchar_t c) const
+    {
+        for (const auto& child : m_nodes[node].Children)
+        {
+            if (child.first == c)
+            {
+                return child.second;
+            }
+        }
+
+        return 0;
+    }
+
+    bool TryGetUnusedId(size_t node, const std::vector<bool>& used, size_t& id) const
+    {
+        for (const size_t candidate : m_nodes[node].Ids)
+        {
+            if (candidate >= used.size() || !used[candidate])
+            {
+                id = candidate;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    std::vector<Node> m_nodes;
+};
@@ -4,8 +4,63 @@
 #include "TreeNode.h"
 #include "UtilityHelpers.h"
 
+#if defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#define TREE_NODE_CHILDREN_SSE2 1
+#endif
+
 CaseInsensitiveStringComparer TreeNodeChildren::s_comparer;
 
+DWORD TreeNodeChildren::hash(std::wstring_view key) noexcept
+{
+    // FNV-1a over the lowercased characters. ASCII is lowercased inline, which is what towlower does for it anyway
+    DWORD hash = 2166136261U;
+    for (const wchar_t c : key)
+    {
+        const wchar_t lower = c < 0x80
+            ? (c >= L'A' && c <= L'Z' ? (wchar_t)(c + (L'a' - L'A')) : c)
+            : (wchar_t)towlower(c);
+        hash = (hash ^ (DWORD)lower) * 16777619U;
+    }
+
+    return hash;
+}
+
+long long TreeNodeChildren::findInVector(std::wstring_view key) const
+{
+    const DWORD keyHash = hash(key);
+    const DWORD* hashes = m_hashes.data();
+    const size_t count = m_hashes.size();
+    size_t i = 0;
+
+#if TREE_NODE_CHILDREN_SSE2
+    const __m128i target = _mm_set1_epi32((int)keyHash);
+    for (; i + 4 <= count; i += 4)
+    {
+        int matches = _mm_movemask_ps(_mm_castsi128_ps(
+            _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&hashes[i])), target)));
+
+        for (size_t j = 0; matches != 0; j++, matches >>= 1)
+        {
+            if ((matches & 1) != 0 && s_comparer(key, (*m_vector)[i + j].first))
+            {
+                return (long long)(i + j);
+            }
+        }
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        if (hashes[i] == keyHash && s_comparer(key, (*m_vector)[i].first))
+        {
+            return (long long)i;
+        }
+    }
+
+    return -1;
+}
+
 void TreeNodeChildren::forEach(std::function<void(std::pair<std::wstring, TreeNode*>*)> function)
 {
     if (m_map != NULL)
@@ -25,39 +80,36 @@ void TreeNodeChildren::forEach(std::function<void(std::pair<std::wstring, TreeNo
     }
 }
 
-void TreeNodeChildren::erase(const std::wstring& key)
+void TreeNodeChildren::erase(std::wstring_view key)
 {
     if (m_map != NULL)
     {
-        m_map->erase(key);
+        m_map->erase(std::wstring(key));
     }
     else
     {
-
-        for (auto it = m_vector->begin(); it != m_vector->end(); it++)
+        const long long index = findInVector(key);
+        if (index >= 0)
         {
-            if (s_comparer(key, it->first))
-            {
-                m_vector->erase(it);
-                return;
-            }
+            m_vector->erase(m_vector->begin() + index);
+            m_hashes.erase(m_hashes.begin() + index);
         }
     }
 }
 
-void TreeNodeChildren::emplace(const std::wstring& key, TreeNode*& value)
+void TreeNodeChildren::emplace(std::wstring_view key, TreeNode*& value)
 {
     // If the vector is in use an we haven't reached the capacity threshold, add it
     // to the vector
     if (m_vector != NULL && m_vector->size() <= TREE_NODE_CHILDREN_THRESHOLD)
     {
-        std::pair<const std::wstring&, TreeNode*&> pair(key, value);
-        m_vector->emplace(m_vector->begin(), pair);
+        m_vector->emplace_back(key, value);
+        m_hashes.push_back(hash(key));
     }
     // If the map is in use that means we already reached the threshold and we are using the map
     else if (m_map != NULL)
     {
-        m_map->emplace(key, value);
+        m_map->emplace(std::wstring(key), value);
     }
     else
     {
@@ -68,29 +120,29 @@ void TreeNodeChildren::emplace(const std::wstring& key, TreeNode*& value)
             (*m_map)[it->first] = it->second;
         }
 
-        m_map->emplace(key, value);
+        m_map->emplace(std::wstring(key), value);
 
         m_vector.reset();
         m_vector = NULL;
+        std::vector<DWORD>().swap(m_hashes);
     }
 }
 
-bool TreeNodeChildren::find(const std::wstring& key, std::pair<std::wstring, TreeNode*>& value)
+bool TreeNodeChildren::find(std::wstring_view key, std::pair<std::wstring, TreeNode*>& value)
 {
     if (m_vector != NULL)
     {
-        for (auto it = m_vector->begin(); it != m_vector->end(); it++)
+        const long long index = findInVector(key);
+        if (index >= 0)
         {
-            if (s_comparer(key, it->first))
-            {
-                value = std::make_pair(it->first, it->second);
-                return true;
-            }
+            const auto& entry = (*m_vector)[(size_t)index];
+            value = std::make_pair(entry.first, entry.second);
+            return true;
         }
     }
     else
     {
-        const auto it = m_map->find(key);
+        const auto it = m_map->find(std::wstring(key));
         if (it != m_map->end())
         {
             value = std::make_pair(it->first, it->second);
@@ -99,4 +151,17 @@ bool TreeNodeChildren::find(const std::wstring& key, std::pair<std::wstring, Tre
     }
 
     return false;
+}
+
+TreeNode* TreeNodeChildren::find(std::wstring_view key)
+{
+    if (m_vector != NULL)
+    {
+        const long long index = findInVector(key);
+        return index >= 0 ? (*m_vector)[(size_t)index].second : nullptr;
+    }
+
+    // The map can't be looked up with a view. It only takes over past TREE_NODE_CHILDREN_THRESHOLD children, which is rare
+    const auto it = m_map->find(std::wstring(key));
+    return it != m_map->end() ? it->second : nullptr;
 }
\ No newline at end of file
@@ -34,6 +34,8 @@ struct TreeNode;
 // number of children.
 // The implementation uses a vector as the underlying initial container and switches to an unordered map after the threshold capacity is met. The rationale
 // is that a vector behaves better (and has lower footprint) than a map for a low number of elements
+// While the vector is in use, the case-insensitive hash of every key is kept in a contiguous array with the same layout, so a lookup
+// scans a few cache lines of hashes (several at a time when SIMD is available) and only compares the keys whose hash matches
 // The class assumes a relatively low number of deletions: once the threshold is reached the map is used for the remainding lifetime of the instance
 // All comparisons againt the key are case insensitive, following the functionality of PathTree
 // This class is not thread safe
@@ -52,13 +54,16 @@ public:
 
     // Finds a key in the collection. Returns whether it was found
     // The given out value is populated with the result.
-    EXPORT bool find(const std::wstring& key, std::pair<std::wstring, TreeNode*>& value);
+    EXPORT bool find(std::wstring_view key, std::pair<std::wstring, TreeNode*>& value);
+
+    // Same as above, without copying the key out. Returns nullptr if the key is not there.
+    EXPORT TreeNode* find(std::wstring_view key);
 
     // Emplaces a key value association in the collection
-    EXPORT void emplace(const std::wstring& key, TreeNode*& value);
+    EXPORT void emplace(std::wstring_view key, TreeNode*& value);
     
     // Erases the given key, if present, from the collection
-    EXPORT void erase(const std::wstring& key);
+    EXPORT void erase(std::wstring_view key);
 
     // The current size of the collection
     EXPORT inline size_t size() noexcept
@@ -69,15 +74,31 @@ public:
     // Removes all elements from the collection
     EXPORT inline void clear() noexcept
     {
-        m_map != NULL ? m_map->clear() : m_vector->clear();
+        if (m_map != NULL)
+        {
+            m_map->clear();
+        }
+        else
+        {
+            m_vector->clear();
+            m_hashes.clear();
+        }
     }
 
     // Applies the given function to each element of the collection
     EXPORT void forEach(std::function<void(std::pair<std::wstring, TreeNode*>*)> function);
 
+    // Case-insensitive hash of a key: keys that are equal according to CaseInsensitiveStringComparer have the same hash
+    EXPORT static DWORD hash(std::wstring_view key) noexcept;
+
 private:
+    // Returns the position in the vector of the given key, or -1 if it is not there
+    long long findInVector(std::wstring_view key) const;
+
     std::unique_ptr<std::unordered_map<std::wstring, TreeNode*, CaseInsensitiveStringHasher, CaseInsensitiveStringComparer>> m_map;
     std::unique_ptr<std::vector<std::pair<std::wstring, TreeNode*>>> m_vector;
+    // The hashes of the keys in m_vector, at the same positions. Empty once the map is in use
+    std::vector<DWORD> m_hashes;
     static CaseInsensitiveStringComparer s_comparer;
 };
 
@@ -5,6 +5,7 @@
 
 #include "buildXL_mem.h"
 #include "DebuggingHelpers.h"
+#include "StringOperations.h"
 
 // ----------------------------------------------------------------------------
 // CLASSES
@@ -13,7 +14,37 @@
 class UnicodeConverter
 {
 private:
+    // Strings of up to this many characters (terminator included) are converted into an inline buffer instead of the heap
+    static const size_t InlineBufferLength = MAX_PATH;
+
     wchar_t *m_str;
+    wchar_t m_inlineBuffer[InlineBufferLength];
+
+    wchar_t* AllocateString(size_t length)
+    {
+        return length <= InlineBufferLength ? m_inlineBuffer : new wchar_t[length];
+    }
+
+    // Every ANSI code page maps 7-bit characters to the same UTF-16 code units, so pure ASCII strings (most paths handed to
+    // the A APIs) are widened directly rather than through two calls to MultiByteToWideChar.
+    bool TryWidenAscii(PCSTR s)
+    {
+        const size_t length = strlen(s) + 1;
+        m_str = AllocateString(length);
+        assert(m_str);
+
+        if (WidenAsciiPrefix(s, length, m_str) != length)
+        {
+            if (m_str != m_inlineBuffer)
+            {
+                delete[] m_str;
+            }
+
+            return false;
+        }
+
+        return true;
+    }
 
 public:
     UnicodeConverter(PCSTR s)
@@ -22,7 +53,7 @@ public:
         {
             m_str = NULL;
         }
-        else
+        else if (!TryWidenAscii(s))
         {
             int charsRequired = MultiByteToWideChar(CP_ACP, 0, s, -1, NULL, 0);
             if (charsRequired <= 0) {
@@ -31,7 +62,7 @@ public:
                 HandleDetoursInjectionAndCommunicationErrors(DETOURS_UNICODE_CONVERSION_18, errorMsg, DETOURS_UNICODE_LOG_MESSAGE_18);
             }
 
-            m_str = new wchar_t[(size_t)charsRequired];
+            m_str = AllocateString((size_t)charsRequired);
             assert(m_str);
 
             int charsConverted = MultiByteToWideChar(CP_ACP, 0, s, -1, m_str, charsRequired);
@@ -52,7 +83,10 @@ public:
 
     ~UnicodeConverter()
     {
-        delete[] m_str;
+        if (m_str != m_inlineBuffer)
+        {
+            delete[] m_str;
+        }
     }
 
     PWSTR GetMutableString()
@@ -6,11 +6,16 @@
 #include <unordered_set>
 #include <cwctype>
 #include <algorithm>
+#include <string_view>
 #include "DataTypes.h"
 
 // Case-insensitive equality for wstrings
 struct CaseInsensitiveStringComparer {
     bool operator()(const std::wstring& lhs, const std::wstring& rhs) const {
+        return operator()(std::wstring_view(lhs), std::wstring_view(rhs));
+    }
+
+    bool operator()(std::wstring_view lhs, std::wstring_view rhs) const {
         if (lhs.length() == rhs.length()) {
             
             // If the strings happen to be identical, then we can just return
@@ -41,6 +46,10 @@ struct CaseInsensitiveStringComparer {
 // such that is case-insensitive, so using length for different-size strings makes the comparison faster
 struct CaseInsensitiveStringLessThan {
     bool operator()(const std::wstring& lhs, const std::wstring& rhs) const {
+        return operator()(std::wstring_view(lhs), std::wstring_view(rhs));
+    }
+
+    bool operator()(std::wstring_view lhs, std::wstring_view rhs) const {
         if (lhs.length() == rhs.length())
         {
             // If the strings happen to be identical, then we can just return
@@ -70,12 +79,31 @@ struct CaseInsensitiveStringLessThan {
     }
 };
 
+// Continues a CaseInsensitiveHash64 with the characters of str: the hash of a string followed by str is CaseInsensitiveHash64(str, <hash of the string>).
+// This allows hashing all the prefixes of a string in one pass.
+inline unsigned long long CaseInsensitiveHash64(std::wstring_view str, unsigned long long hash) noexcept
+{
+    for (const wchar_t c : str)
+    {
+        const wchar_t lower = c < 0x80
+            ? (c >= L'A' && c <= L'Z' ? (wchar_t)(c + (L'a' - L'A')) : c)
+            : (wchar_t)towlower(c);
+        hash = (hash ^ (unsigned long long)lower) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+// Case-insensitive 64-bit hash of a wide string: strings that are equal according to CaseInsensitiveStringComparer have the same hash.
+// FNV-1a over the lowercased characters, without copying the string. ASCII is lowercased inline, which is what towlower does for it anyway
+inline unsigned long long CaseInsensitiveHash64(std::wstring_view str) noexcept
+{
+    return CaseInsensitiveHash64(str, 14695981039346656037ULL);
+}
+
 // Case-insensitive hasher for wstrings
 struct CaseInsensitiveStringHasher {
     size_t operator()(const std::wstring& str) const {
-        std::wstring lowerstr(str);
-        std::transform(lowerstr.begin(), lowerstr.end(), lowerstr.begin(), towlower);
-
-        return std::hash<std::wstring>()(lowerstr);
+        return (size_t)CaseInsensitiveHash64(str);
     }
 };
@@ -8,34 +8,85 @@
 extern volatile LONG64 g_detoursMaxAllocatedMemoryInBytes;
 extern volatile LONG64 g_detoursHeapAllocatedMemoryInBytes;
 
-#define BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS HEAP_ZERO_MEMORY
+// Nothing allocated by Detours relies on zeroed memory: objects get constructed, and the few raw allocations
+// (SLIST headers and nodes, proc thread attribute lists) are initialized by their owners.
+#define BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS 0
 
 // This file defines a memory interface for BuildXL Detours, using the dd_ prefix.
 // The general allocation APIs are stubbed out and one should call only the dd_* methods.
 // The memory allocation done from the BuildXL Detours library happens on a private heap.
+//
+// Most allocations are small (strings, policy results, handle overlays) and short lived. Those are rounded up to a size class,
+// and freed blocks are kept on a lock-free list per size class (like the NtClose handle pool, see HandleOverlay.cpp) to be handed
+// out again without going through the heap and its lock. Every block starts with a header holding its size, so freeing
+// and accounting don't need to ask the heap for it.
+
+#define DD_SIZE_CLASS_GRANULARITY MEMORY_ALLOCATION_ALIGNMENT
+#define DD_SIZE_CLASS_COUNT 32
+#define DD_MAX_SIZE_CLASS_BYTES (DD_SIZE_CLASS_GRANULARITY * DD_SIZE_CLASS_COUNT)
+
+// Blocks kept per size class at most; anything freed beyond this goes back to the heap.
+#define DD_MAX_CACHED_BLOCKS_PER_SIZE_CLASS 256
+
+// Header of every block. Its size is a multiple of MEMORY_ALLOCATION_ALIGNMENT, so the memory handed out keeps the heap's alignment.
+typedef union DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT) _DD_BLOCK_HEADER {
+    // While the block is in use: how many bytes follow the header (rounded up to the size class for small blocks)
+    size_t Size;
+    // While the block is cached on the free list of its size class
+    SLIST_ENTRY FreeListEntry;
+} DD_BLOCK_HEADER, *PDD_BLOCK_HEADER;
+
+// Free lists, indexed by size class. Zero-initialized SLIST headers are empty lists.
+extern SLIST_HEADER g_detoursSizeClassFreeLists[DD_SIZE_CLASS_COUNT];
+
+inline void dd_account_allocation(LONG64 size)
+{
+    LONG64 allocatedSize = InterlockedAdd64(&g_detoursHeapAllocatedMemoryInBytes, size);
+    LONG64 localMax = g_detoursMaxAllocatedMemoryInBytes;
+
+    // Update the global MaxAllocated heap only if the current allocated heap is bigger than what is recorded.
+    while (allocatedSize > localMax)
+    {
+        LONG64 previousMax = InterlockedCompareExchange64(&g_detoursMaxAllocatedMemoryInBytes, allocatedSize, localMax);
+        if (previousMax == localMax)
+        {
+            break;
+        }
+
+        localMax = previousMax;
+    }
+}
 
 // malloc and free versions for this DLL.
 inline void* dd_malloc(size_t size)
 {
     assert(g_hPrivateHeap != nullptr);
-    void* ret = HeapAlloc(g_hPrivateHeap, BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS, size);
-
-     if (ret != nullptr && ShouldLogProcessData())
-     {
-         // Get the size since alignment matters and the actual allocated bytes can be a bit moe than size.
-         LONG64 allocatedSize = (LONG64)HeapSize(g_hPrivateHeap, BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS, ret);
-         allocatedSize = InterlockedAdd64(&g_detoursHeapAllocatedMemoryInBytes, allocatedSize);
-         LONG64 localMax = InterlockedAdd64(&g_detoursMaxAllocatedMemoryInBytes, 0);
-       
-         // Update the global MaxAllocated heap only if the current allocated heap is bigger than what is recorded.
-         while (allocatedSize > localMax)
-         {
-             InterlockedCompareExchange64(&g_detoursMaxAllocatedMemoryInBytes, allocatedSize, localMax);
-             localMax = InterlockedAdd64(&g_detoursMaxAllocatedMemoryInBytes, 0);
-         }
-     }
-
-    return ret;
+
+    PDD_BLOCK_HEADER header = nullptr;
+    if (size <= DD_MAX_SIZE_CLASS_BYTES)
+    {
+        size_t sizeClass = size == 0 ? 0 : (size - 1) / DD_SIZE_CLASS_GRANULARITY;
+        size = (sizeClass + 1) * DD_SIZE_CLASS_GRANULARITY;
+        header = (PDD_BLOCK_HEADER)InterlockedPopEntrySList(&g_detoursSizeClassFreeLists[sizeClass]);
+    }
+
+    if (header == nullptr)
+    {
+        header = (PDD_BLOCK_HEADER)HeapAlloc(g_hPrivateHeap, BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS, sizeof(DD_BLOCK_HEADER) + size);
+        if (header == nullptr)
+        {
+            return nullptr;
+        }
+    }
+
+    header->Size = size;
+
+    if (ShouldLogProcessData())
+    {
+        dd_account_allocation((LONG64)size);
+    }
+
+    return header + 1;
 }
 
 inline void dd_free(void* pMem)
@@ -46,14 +97,25 @@ inline void dd_free(void* pMem)
         return;
     }
 
-     if (ShouldLogProcessData())
-     {
-         // Get the size since alignment matters and the actual allocated bytes can be a bit moe than size.
-         LONG64 deallocatedSize = (LONG64)HeapSize(g_hPrivateHeap, BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS, pMem);
-         InterlockedAdd64(&g_detoursHeapAllocatedMemoryInBytes, -(deallocatedSize));
-     }
+    PDD_BLOCK_HEADER header = reinterpret_cast<PDD_BLOCK_HEADER>(pMem) - 1;
+    size_t size = header->Size;
+
+    if (ShouldLogProcessData())
+    {
+        InterlockedAdd64(&g_detoursHeapAllocatedMemoryInBytes, -(LONG64)size);
+    }
+
+    if (size <= DD_MAX_SIZE_CLASS_BYTES)
+    {
+        PSLIST_HEADER freeList = &g_detoursSizeClassFreeLists[size / DD_SIZE_CLASS_GRANULARITY - 1];
+        if (QueryDepthSList(freeList) < DD_MAX_CACHED_BLOCKS_PER_SIZE_CLASS)
+        {
+            InterlockedPushEntrySList(freeList, &header->FreeListEntry);
+            return;
+        }
+    }
 
-    HeapFree(g_hPrivateHeap, HEAP_ZERO_MEMORY, pMem);
+    HeapFree(g_hPrivateHeap, 0, header);
 }
 
 // New news and deletes operators that call the private heap.
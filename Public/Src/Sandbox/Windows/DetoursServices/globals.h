@@ -23,7 +23,9 @@ using std::vector;
 // FORWARD DECLARATIONS
 // ----------------------------------------------------------------------------
 class TranslatePathTuple;
-class ShimProcessMatch;
+class TranslatePathTrie;
+class ShimProcessMatcher;
+class SpecialCaseMatcher;
 
 // ----------------------------------------------------------------------------
 // GLOBALS
@@ -45,10 +47,15 @@ extern uint64_t g_FileAccessManifestPipId;
 extern PCManifestRecord g_manifestTreeRoot;
 
 extern PManifestChildProcessesToBreakAwayFromJob g_manifestChildProcessesToBreakAwayFromJob;
-extern std::unordered_set<std::wstring, CaseInsensitiveStringHasher, CaseInsensitiveStringComparer>* g_processNamesToBreakAwayFromJob;
+// The Count process names (as written by FileAccessManifest.WriteChars) that follow g_manifestChildProcessesToBreakAwayFromJob in the payload
+extern LPCBYTE g_processNamesToBreakAwayFromJob;
 extern PManifestTranslatePathsStrings g_manifestTranslatePathsStrings;
 extern vector<TranslatePathTuple*>* g_pManifestTranslatePathTuples;
+// The paths of g_pManifestTranslatePathTuples to translate from, with the index of their tuple as ids
+extern TranslatePathTrie* g_pManifestTranslatePathTrie;
 extern std::unordered_set<std::wstring>* g_pManifestTranslatePathLookupTable;
+// The special-case rules that apply to this process, see CreateSpecialCaseMatcher
+extern SpecialCaseMatcher* g_pSpecialCaseMatcher;
 
 extern PManifestInternalDetoursErrorNotificationFileString g_manifestInternalDetoursErrorNotificationFileString;
 extern LPCTSTR g_internalDetoursErrorNotificationFile;
@@ -112,7 +119,10 @@ extern bool g_ProcessExecutionShimAllProcesses;
 extern wchar_t* g_SubstituteProcessExecutionPluginDllPath;
 extern HMODULE g_SubstituteProcessExecutionPluginDllHandle;
 extern SubstituteProcessExecutionPluginFunc g_SubstituteProcessExecutionPluginFunc;
-extern vector<ShimProcessMatch*>* g_pShimProcessMatches;
+// Points into the payload, to the count of shim process matches followed by the matches themselves
+extern LPCBYTE g_shimProcessMatchesPayload;
+// Compiled from g_shimProcessMatchesPayload the first time it is needed
+extern ShimProcessMatcher* volatile g_pShimProcessMatcher;
 
 // ----------------------------------------------------------------------------
 // Real Windows API function pointers
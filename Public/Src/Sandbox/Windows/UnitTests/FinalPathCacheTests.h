@@ -0,0 +1,48 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <FinalPathCache.h>
+
+BOOST_AUTO_TEST_SUITE(FinalPathCacheTests)
+
+static FILE_ID_INFO CreateFileId(ULONGLONG volumeSerialNumber, BYTE id)
+{
+    FILE_ID_INFO fileId = {};
+    fileId.VolumeSerialNumber = volumeSerialNumber;
+    fileId.FileId.Identifier[0] = id;
+    return fileId;
+}
+
+BOOST_AUTO_TEST_CASE( CachesFinalPathsByVolumeAndFileId )
+{
+    FinalPathCache cache;
+    std::wstring finalPath;
+
+    BOOST_CHECK(!cache.TryGetFinalPath(CreateFileId(1, 7), finalPath));
+
+    cache.InsertFinalPath(CreateFileId(1, 7), cache.Generation(), L"\\\\?\\C:\\out\\a.pdb");
+    BOOST_CHECK(cache.TryGetFinalPath(CreateFileId(1, 7), finalPath));
+    BOOST_CHECK(finalPath == L"\\\\?\\C:\\out\\a.pdb");
+
+    // The same file id on a different volume is a different file
+    BOOST_CHECK(!cache.TryGetFinalPath(CreateFileId(2, 7), finalPath));
+    BOOST_CHECK(!cache.TryGetFinalPath(CreateFileId(1, 8), finalPath));
+}
+
+BOOST_AUTO_TEST_CASE( InvalidateDropsEntriesAndPendingInsertions )
+{
+    FinalPathCache cache;
+    std::wstring finalPath;
+
+    cache.InsertFinalPath(CreateFileId(1, 7), cache.Generation(), L"\\\\?\\C:\\out\\a.pdb");
+
+    // Simulates a name queried before a rename in the process that got to be inserted after it
+    unsigned long long generation = cache.Generation();
+    cache.Invalidate();
+    cache.InsertFinalPath(CreateFileId(1, 8), generation, L"\\\\?\\C:\\out\\b.pdb");
+
+    BOOST_CHECK(!cache.TryGetFinalPath(CreateFileId(1, 7), finalPath));
+    BOOST_CHECK(!cache.TryGetFinalPath(CreateFileId(1, 8), finalPath));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,50 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <ImagePathCache.h>
+
+BOOST_AUTO_TEST_SUITE(ImagePathCacheTests)
+
+BOOST_AUTO_TEST_CASE( CachesImagePathsByNameDirectoryAndPath )
+{
+    ImagePathCache cache;
+    std::wstring imagePath;
+    const std::vector<std::wstring> searchedDirectories = { L"C:\\src", L"C:\\tools" };
+
+    BOOST_CHECK(!cache.TryGetImagePath(L"git", L"C:\\src", 10, imagePath));
+
+    cache.InsertImagePath(L"git", L"C:\\src", 10, cache.Generation(), searchedDirectories, L"C:\\tools\\git.exe");
+
+    // Lookups are case-insensitive
+    BOOST_CHECK(cache.TryGetImagePath(L"GIT", L"c:\\SRC", 10, imagePath));
+    BOOST_CHECK(imagePath == L"C:\\tools\\git.exe");
+
+    // A different current directory or PATH is a different search
+    BOOST_CHECK(!cache.TryGetImagePath(L"git", L"C:\\out", 10, imagePath));
+    BOOST_CHECK(!cache.TryGetImagePath(L"git", L"C:\\src", 11, imagePath));
+}
+
+BOOST_AUTO_TEST_CASE( WritesInSearchedDirectoriesInvalidate )
+{
+    ImagePathCache cache;
+    std::wstring imagePath;
+    const std::vector<std::wstring> searchedDirectories = { L"C:\\src", L"C:\\tools" };
+
+    cache.InsertImagePath(L"git", L"C:\\src", 10, cache.Generation(), searchedDirectories, L"C:\\tools\\git.exe");
+
+    // Only files directly in a searched directory matter
+    cache.InvalidateIfSearched(L"C:\\src\\obj\\git.exe");
+    cache.InvalidateIfSearched(L"C:\\toolsx\\git.exe");
+    BOOST_CHECK(cache.TryGetImagePath(L"git", L"C:\\src", 10, imagePath));
+
+    cache.InvalidateIfSearched(L"C:\\Tools\\git.exe");
+    BOOST_CHECK(!cache.TryGetImagePath(L"git", L"C:\\src", 10, imagePath));
+
+    // Simulates a search that started before a write in the process and got to insert its result after it
+    unsigned long long generation = cache.Generation();
+    cache.Invalidate();
+    cache.InsertImagePath(L"git", L"C:\\src", 10, generation, searchedDirectories, L"C:\\tools\\git.exe");
+    BOOST_CHECK(!cache.TryGetImagePath(L"git", L"C:\\src", 10, imagePath));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
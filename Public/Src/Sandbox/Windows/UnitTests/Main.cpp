@@ -16,4 +16,11 @@
 #include "PathTreeTests.h"
 #include "StringOperationsTests.h"
 #include "ResolvedPathCacheTests.h"
-#include "TreeNodeTests.h"
\ No newline at end of file
+#include "TreeNodeTests.h"
+#include "TranslatePathTrieTests.h"
+#include "ProbeResultCacheTests.h"
+#include "ImagePathCacheTests.h"
+#include "FinalPathCacheTests.h"
+#include "PluginVerdictCacheTests.h"
+#include "ShimProcessMatcherTests.h"
+#include "SpecialCaseMatcherTests.h"
\ No newline at end of file
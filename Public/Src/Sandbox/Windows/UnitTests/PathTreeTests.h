@@ -38,6 +38,22 @@ BOOST_AUTO_TEST_CASE( SimpleDescendants )
     BOOST_CHECK(contains(desc, L"C:\\a\\another-path"));
 }
 
+BOOST_AUTO_TEST_CASE( ContainsInsertedPathsAndTheirAncestors )
+{
+    PathTree t;
+    t.TryInsert(L"C:\\a\\path\\to\\something");
+
+    BOOST_CHECK(t.Contains(L"C:\\a\\path\\to\\something"));
+    BOOST_CHECK(t.Contains(L"C:\\a\\path"));
+    BOOST_CHECK(!t.Contains(L"C:\\a\\path\\to\\something\\else"));
+    BOOST_CHECK(!t.Contains(L"C:\\a\\another-path"));
+
+    // Removing the descendants of a path removes the intermediates that only led to them
+    std::vector<std::wstring> desc;
+    t.RetrieveAndRemoveAllDescendants(L"C:\\a\\path", desc);
+    BOOST_CHECK(!t.Contains(L"C:\\a\\path\\to"));
+}
+
 BOOST_AUTO_TEST_CASE( IntermediatesAreNotReturned )
 {
     PathTree t;
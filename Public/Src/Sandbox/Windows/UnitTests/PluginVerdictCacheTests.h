@@ -0,0 +1,60 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <PluginVerdictCache.h>
+
+BOOST_AUTO_TEST_SUITE(PluginVerdictCacheTests)
+
+BOOST_AUTO_TEST_CASE( CachesVerdictsByCommandArgumentsDirectoryAndEnvironment )
+{
+    PluginVerdictCache cache;
+    PluginVerdict verdict;
+
+    BOOST_CHECK(!cache.TryGetVerdict(L"cl.exe", L"/showIncludes a.cpp", L"C:\\src", 1, verdict));
+
+    PluginVerdict matches;
+    matches.Matches = true;
+    cache.InsertVerdict(L"cl.exe", L"/showIncludes a.cpp", L"C:\\src", 1, matches);
+
+    BOOST_CHECK(cache.TryGetVerdict(L"cl.exe", L"/showIncludes a.cpp", L"C:\\src", 1, verdict));
+    BOOST_CHECK(verdict.Matches);
+    BOOST_CHECK(!verdict.HasModifiedArguments);
+
+    // Any difference in what the plugin sees is a different command
+    BOOST_CHECK(!cache.TryGetVerdict(L"cl.exe", L"/showIncludes b.cpp", L"C:\\src", 1, verdict));
+    BOOST_CHECK(!cache.TryGetVerdict(L"cl.exe", L"/showIncludes a.cpp", L"C:\\src\\lib", 1, verdict));
+    BOOST_CHECK(!cache.TryGetVerdict(L"cl.exe", L"/showIncludes a.cpp", L"C:\\src", 2, verdict));
+
+    // Arguments are case-sensitive
+    BOOST_CHECK(!cache.TryGetVerdict(L"cl.exe", L"/SHOWINCLUDES a.cpp", L"C:\\src", 1, verdict));
+}
+
+BOOST_AUTO_TEST_CASE( KeepsModifiedArguments )
+{
+    PluginVerdictCache cache;
+    PluginVerdict verdict;
+
+    PluginVerdict modified;
+    modified.Matches = true;
+    modified.HasModifiedArguments = true;
+    modified.ModifiedArguments = L"/c a.cpp";
+    cache.InsertVerdict(L"cl.exe", L"/c a.cpp /Zi", L"C:\\src", 1, modified);
+
+    BOOST_CHECK(cache.TryGetVerdict(L"cl.exe", L"/c a.cpp /Zi", L"C:\\src", 1, verdict));
+    BOOST_CHECK(verdict.HasModifiedArguments);
+    BOOST_CHECK(verdict.ModifiedArguments == L"/c a.cpp");
+}
+
+BOOST_AUTO_TEST_CASE( SeparatorsInArgumentsDoNotCollide )
+{
+    PluginVerdictCache cache;
+    PluginVerdict verdict;
+
+    PluginVerdict matches;
+    matches.Matches = true;
+    cache.InsertVerdict(L"tool.exe", L"a|b", L"C:\\src", 1, matches);
+
+    BOOST_CHECK(!cache.TryGetVerdict(L"tool.exe|a", L"b", L"C:\\src", 1, verdict));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
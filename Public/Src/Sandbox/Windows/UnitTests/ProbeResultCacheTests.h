@@ -0,0 +1,54 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <ProbeResultCache.h>
+
+BOOST_AUTO_TEST_SUITE(ProbeResultCacheTests)
+
+BOOST_AUTO_TEST_CASE( CachesAttributesByPathAndUsn )
+{
+    ProbeResultCache cache;
+    DWORD attributes = 0;
+    DWORD error = ERROR_SUCCESS;
+
+    BOOST_CHECK(!cache.TryGetAttributes(L"C:\\inc\\a.h", 10, attributes, error));
+
+    cache.InsertAttributes(L"C:\\inc\\a.h", 10, cache.Generation(), FILE_ATTRIBUTE_ARCHIVE, ERROR_SUCCESS);
+
+    // Lookups are case-insensitive
+    BOOST_CHECK(cache.TryGetAttributes(L"c:\\INC\\a.h", 10, attributes, error));
+    BOOST_CHECK_EQUAL(FILE_ATTRIBUTE_ARCHIVE, attributes);
+    BOOST_CHECK_EQUAL(ERROR_SUCCESS, error);
+
+    // A different expected USN is a different version of the file
+    BOOST_CHECK(!cache.TryGetAttributes(L"C:\\inc\\a.h", 11, attributes, error));
+
+    // Each kind of probe is cached on its own
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    BOOST_CHECK(!cache.TryGetAttributeData(L"C:\\inc\\a.h", 10, data, error));
+}
+
+BOOST_AUTO_TEST_CASE( InvalidateDropsEntriesAndPendingInsertions )
+{
+    ProbeResultCache cache;
+    DWORD attributes = 0;
+    DWORD error = ERROR_SUCCESS;
+
+    WIN32_FILE_ATTRIBUTE_DATA data = {};
+    data.dwFileAttributes = FILE_ATTRIBUTE_READONLY;
+    cache.InsertAttributeData(L"C:\\inc\\a.h", 10, cache.Generation(), data, ERROR_SUCCESS);
+
+    // Simulates a probe that queried the filesystem before a write in the process and got to insert its result after it
+    unsigned long long generation = cache.Generation();
+    cache.Invalidate();
+    cache.InsertAttributes(L"C:\\inc\\b.h", 10, generation, INVALID_FILE_ATTRIBUTES, ERROR_FILE_NOT_FOUND);
+
+    BOOST_CHECK(!cache.TryGetAttributeData(L"C:\\inc\\a.h", 10, data, error));
+    BOOST_CHECK(!cache.TryGetAttributes(L"C:\\inc\\b.h", 10, attributes, error));
+
+    cache.InsertAttributes(L"C:\\inc\\b.h", 10, cache.Generation(), INVALID_FILE_ATTRIBUTES, ERROR_FILE_NOT_FOUND);
+    BOOST_CHECK(cache.TryGetAttributes(L"C:\\inc\\b.h", 10, attributes, error));
+    BOOST_CHECK_EQUAL(ERROR_FILE_NOT_FOUND, error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -34,4 +34,80 @@ BOOST_AUTO_TEST_CASE( TryInsertPath )
     BOOST_CHECK(!findResult.Found);
 }
 
+BOOST_AUTO_TEST_CASE( InvalidateDirectoryDescendants )
+{
+    ResolvedPathCache cache;
+
+    std::wstring target = L"C:\\target";
+    BOOST_CHECK(cache.InsertResolvedPathWithType(L"C:\\a\\link", target, IO_REPARSE_TAG_SYMLINK));
+    BOOST_CHECK(cache.InsertResolvingCheckResult(L"C:\\a\\link\\file", true));
+
+    // Lookups are case insensitive and ignore trailing separators
+    auto targetResult = cache.GetResolvedPathAndType(L"c:\\A\\LINK\\");
+    BOOST_CHECK(targetResult.Found);
+    BOOST_CHECK(targetResult.Value.first == target);
+
+    auto checkResult = cache.GetResolvingCheckResult(L"C:\\a\\link\\file");
+    BOOST_CHECK(checkResult.Found);
+    BOOST_CHECK(checkResult.Value);
+
+    // Invalidating a directory invalidates everything under it
+    cache.Invalidate(L"C:\\a", true);
+    BOOST_CHECK(!cache.GetResolvedPathAndType(L"C:\\a\\link").Found);
+    BOOST_CHECK(!cache.GetResolvingCheckResult(L"C:\\a\\link\\file").Found);
+
+    // And the paths can be cached again afterwards
+    BOOST_CHECK(cache.InsertResolvingCheckResult(L"C:\\a\\link\\file", false));
+    checkResult = cache.GetResolvingCheckResult(L"C:\\a\\link\\file");
+    BOOST_CHECK(checkResult.Found);
+    BOOST_CHECK(!checkResult.Value);
+}
+
+BOOST_AUTO_TEST_CASE( InvalidateUnknownPaths )
+{
+    ResolvedPathCache cache;
+
+    BOOST_CHECK(cache.InsertResolvingCheckResult(L"C:\\a\\link\\file", true));
+
+    // Paths the cache knows nothing about, under or next to the cached one, leave it untouched
+    cache.Invalidate(L"C:\\a\\link\\file\\child", true);
+    cache.Invalidate(L"C:\\a\\other", false);
+    cache.Invalidate(L"D:\\a", true);
+    BOOST_CHECK(cache.GetResolvingCheckResult(L"C:\\a\\link\\file").Found);
+
+    // Ancestors of a cached path are known to the cache even though nothing was cached for them
+    cache.Invalidate(L"C:\\A\\LINK\\", true);
+    BOOST_CHECK(!cache.GetResolvingCheckResult(L"C:\\a\\link\\file").Found);
+}
+
+BOOST_AUTO_TEST_CASE( InvalidateDirectoryOfResolvedPaths )
+{
+    ResolvedPathCache cache;
+
+    std::shared_ptr<std::vector<std::wstring>> order = std::make_shared<std::vector<std::wstring>>();
+    std::shared_ptr<std::map<std::wstring, ResolvedPathType, CaseInsensitiveStringLessThan>> resolvedPaths = std::make_shared<std::map<std::wstring, ResolvedPathType, CaseInsensitiveStringLessThan>>();
+    order->push_back(L"C:\\b\\link");
+    resolvedPaths->emplace(L"C:\\b\\link", ResolvedPathType::Intermediate);
+    order->push_back(L"C:\\c\\target");
+    resolvedPaths->emplace(L"C:\\c\\target", ResolvedPathType::FullyResolved);
+
+    BOOST_CHECK(cache.InsertResolvedPaths(L"C:\\a\\path", false, order, resolvedPaths));
+    BOOST_CHECK(cache.InsertResolvingCheckResult(L"C:\\d\\file", true));
+
+    // Invalidating a directory some resolved path goes through invalidates the resolved path, even though it is not under it
+    cache.Invalidate(L"C:\\c", true);
+    BOOST_CHECK(!cache.GetResolvedPaths(L"C:\\a\\path", false).Found);
+
+    // Nothing else is invalidated
+    BOOST_CHECK(cache.GetResolvingCheckResult(L"C:\\d\\file").Found);
+
+    // A path whose entry went stale can be cached again, and invalidating the same directory again invalidates it again
+    BOOST_CHECK(cache.InsertResolvedPaths(L"C:\\a\\path", false, order, resolvedPaths));
+    BOOST_CHECK(cache.GetResolvedPaths(L"C:\\a\\path", false).Found);
+    BOOST_CHECK(!cache.InsertResolvedPaths(L"C:\\a\\path", false, order, resolvedPaths));
+
+    cache.Invalidate(L"C:\\c\\", true);
+    BOOST_CHECK(!cache.GetResolvedPaths(L"C:\\a\\path", false).Found);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,72 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <ShimProcessMatcher.h>
+#include <cwchar>
+
+BOOST_AUTO_TEST_SUITE(ShimProcessMatcherTests)
+
+static void AddMatch(ShimProcessMatcher& matcher, const wchar_t* processName, const wchar_t* argumentMatch)
+{
+    matcher.Add(processName, wcslen(processName), argumentMatch, argumentMatch == nullptr ? 0 : wcslen(argumentMatch));
+}
+
+static bool Matches(const ShimProcessMatcher& matcher, const wchar_t* command, const wchar_t* arguments)
+{
+    return matcher.Matches(command, wcslen(command), arguments, wcslen(arguments));
+}
+
+BOOST_AUTO_TEST_CASE( MatchesProcessNames )
+{
+    ShimProcessMatcher matcher;
+    BOOST_CHECK(matcher.IsEmpty());
+
+    AddMatch(matcher, L"cmd.exe", nullptr);
+    AddMatch(matcher, L"tools\\cl.exe", nullptr);
+    matcher.Build();
+    BOOST_CHECK(!matcher.IsEmpty());
+
+    // Process names are compared case-insensitively, either to the whole command or to what follows a backslash
+    BOOST_CHECK(Matches(matcher, L"CMD.exe", L""));
+    BOOST_CHECK(Matches(matcher, L"c:\\windows\\system32\\cmd.exe", L"/c echo"));
+    BOOST_CHECK(!Matches(matcher, L"c:\\windows\\system32\\xcmd.exe", L""));
+    BOOST_CHECK(!Matches(matcher, L"cmd.exe.bak", L""));
+
+    BOOST_CHECK(Matches(matcher, L"c:\\Tools\\CL.exe", L""));
+    BOOST_CHECK(!Matches(matcher, L"c:\\bin\\cl.exe", L""));
+    BOOST_CHECK(!Matches(matcher, L"c:\\mytools\\cl.exe", L""));
+}
+
+BOOST_AUTO_TEST_CASE( MatchesArguments )
+{
+    ShimProcessMatcher matcher;
+    AddMatch(matcher, L"node.exe", L"webpack");
+    AddMatch(matcher, L"node.exe", L"tsc.js");
+    AddMatch(matcher, L"csc.exe", L"abcd");
+    AddMatch(matcher, L"csc.exe", L"bc");
+    matcher.Build();
+
+    BOOST_CHECK(Matches(matcher, L"c:\\node\\node.exe", L"c:\\src\\node_modules\\webpack\\bin\\webpack.js"));
+    BOOST_CHECK(Matches(matcher, L"node.exe", L"--max-old-space-size=4096 tsc.js -p ."));
+    BOOST_CHECK(!Matches(matcher, L"node.exe", L"eslint.js"));
+    BOOST_CHECK(!Matches(matcher, L"node.exe", L""));
+
+    // Arguments are compared case-sensitively
+    BOOST_CHECK(!Matches(matcher, L"node.exe", L"WEBPACK"));
+
+    // Argument matches only apply to their own process
+    BOOST_CHECK(!Matches(matcher, L"csc.exe", L"webpack"));
+
+    // A partial match of one argument match is still a match of another one it contains
+    BOOST_CHECK(Matches(matcher, L"csc.exe", L"abce"));
+    BOOST_CHECK(!Matches(matcher, L"csc.exe", L"acbd"));
+
+    // A match without an argument match applies to any arguments
+    ShimProcessMatcher anyArguments;
+    AddMatch(anyArguments, L"csc.exe", L"abcd");
+    AddMatch(anyArguments, L"csc.exe", nullptr);
+    anyArguments.Build();
+    BOOST_CHECK(Matches(anyArguments, L"csc.exe", L"acbd"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,67 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <SpecialCaseMatcher.h>
+
+BOOST_AUTO_TEST_SUITE(SpecialCaseMatcherTests)
+
+BOOST_AUTO_TEST_CASE( MatchesSuffixesCaseInsensitively )
+{
+    SpecialCaseMatcher matcher;
+    matcher.AddSuffix(L".pdb", SpecialCaseMatcher::CodeCoverageFile);
+    matcher.AddSuffix(L".dll", SpecialCaseMatcher::CodeCoverageFile);
+    matcher.AddSuffix(L".pdb", SpecialCaseMatcher::SpecialToolFile);
+
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::CodeCoverageFile | SpecialCaseMatcher::SpecialToolFile, matcher.Match(L"C:\\out\\Foo.PDB", 14));
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::CodeCoverageFile, matcher.Match(L"C:\\out\\foo.dll", 14));
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::None, matcher.Match(L"C:\\out\\foo.dl", 13));
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::None, matcher.Match(L"C:\\out.pdb\\foo", 14));
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::None, matcher.Match(L"", 0));
+}
+
+BOOST_AUTO_TEST_CASE( MatchesSuffixesBeforeTrailingDigits )
+{
+    SpecialCaseMatcher matcher;
+    matcher.AddSuffixBeforeDigits(L"_buildc_dep_out.pass", SpecialCaseMatcher::SpecialToolFile);
+
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::SpecialToolFile, matcher.Match(L"D:\\obj\\_BUILDC_DEP_OUT.PASS12", 29));
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::None, matcher.Match(L"D:\\obj\\_buildc_dep_out.pass", 27));
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::None, matcher.Match(L"D:\\obj\\_buildc_dep_out.pass1a", 29));
+}
+
+BOOST_AUTO_TEST_CASE( MatchesNamedStreams )
+{
+    SpecialCaseMatcher matcher;
+
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::NamedStream, matcher.Match(L"C:\\a\\file:stream", 16));
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::NamedStream, matcher.Match(L"C:\\a\\file:stream:$DATA", 22));
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::None, matcher.Match(L"C:\\a\\file", 9));
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::None, matcher.Match(L"C:\\a\\file:", 10));
+    // The default stream is not a named one
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::None, matcher.Match(L"C:\\a\\file::$DATA", 16));
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::None, matcher.Match(L"C:\\a\\f:s:t:u", 12));
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::None, matcher.Match(L"C:\\a:b\\file", 11));
+}
+
+BOOST_AUTO_TEST_CASE( MatchesToolTempFilesOnlyWhenEnabled )
+{
+    SpecialCaseMatcher matcher;
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::None, matcher.Match(L"C:\\out\\RCa01234", 15));
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::None, matcher.Match(L"C:\\out\\RCX1A2.tmp", 17));
+
+    SpecialCaseMatcher rc;
+    rc.MatchRCTempFiles();
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::SpecialToolFile, rc.Match(L"C:\\out\\RCa01234", 15));
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::SpecialToolFile, rc.Match(L"C:\\out\\rf001234", 15));
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::None, rc.Match(L"C:\\out\\RCa0.234", 15));
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::None, rc.Match(L"C:\\out\\RXa01234", 15));
+
+    SpecialCaseMatcher mt;
+    mt.MatchMtTempFiles();
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::SpecialToolFile, mt.Match(L"C:\\out\\RCX1A2.tmp", 17));
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::SpecialToolFile, mt.Match(L"C:\\out\\rcx1A2.TMP", 17));
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::None, mt.Match(L"C:\\out\\ABC1A2.tmp", 17));
+    BOOST_CHECK_EQUAL(SpecialCaseMatcher::None, mt.Match(L"C:\\out\\RCX1A2.txt", 17));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
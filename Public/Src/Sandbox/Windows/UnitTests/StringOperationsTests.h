@@ -161,4 +161,214 @@ BOOST_AUTO_TEST_CASE(NormalizeLongUncPathWithUncPrefixDottedSegment)
     BOOST_CHECK_EQUAL(expected.c_str(), result.c_str());
 }
 
+static LexicalFullPathResult GetFullPathLexically(PCPathChar path, PCPathChar currentDirectory, std::wstring& fullPath)
+{
+    PathChar buffer[MAX_PATH];
+    size_t length = 0;
+    LexicalFullPathResult result = GetFullPathLexically(path, currentDirectory, buffer, MAX_PATH, &length);
+    fullPath.assign(buffer, result == LexicalFullPathResult::Success ? length : 0);
+    return result;
+}
+
+BOOST_AUTO_TEST_CASE(GetFullPathLexicallyMatchesGetFullPathName)
+{
+    PathChar currentDirectory[MAX_PATH];
+    DWORD currentDirectoryLength = GetCurrentDirectoryW(MAX_PATH, currentDirectory);
+    BOOST_REQUIRE(currentDirectoryLength > 0 && currentDirectoryLength < MAX_PATH);
+
+    PCPathChar paths[] =
+    {
+        L"C:\\A\\B\\C",
+        L"c:/a//b/c/",
+        L"C:\\A\\.\\B\\..\\C",
+        L"C:\\A\\B\\.",
+        L"C:\\A\\B\\..\\",
+        L"C:\\A\\..",
+        L"C:\\",
+        L"\\\\server\\share\\A\\..\\B",
+        L"//server/share/A/",
+        L"\\\\.\\C:\\A\\..\\B",
+        L"\\\\.\\pipe\\name",
+        L"C:\\A\\file.txt:stream",
+        L"C:\\A\\nullx",
+        L"A\\B",
+        L"..\\A",
+        L".",
+        L".\\",
+        L"\\A\\B",
+        L"\\",
+    };
+
+    for (PCPathChar path : paths)
+    {
+        std::wstring fullPath;
+        BOOST_REQUIRE(GetFullPathLexically(path, currentDirectory, fullPath) == LexicalFullPathResult::Success);
+
+        PathChar expected[MAX_PATH];
+        DWORD expectedLength = GetFullPathNameW(path, MAX_PATH, expected, nullptr);
+        BOOST_REQUIRE(expectedLength > 0 && expectedLength < MAX_PATH);
+        BOOST_CHECK_EQUAL(std::wstring(expected, expectedLength).c_str(), fullPath.c_str());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(GetFullPathLexicallyLeavesWin32SpecialCasesToGetFullPathName)
+{
+    PCPathChar paths[] =
+    {
+        L"C:A",
+        L"C:\\A.\\B",
+        L"C:\\A\\B ",
+        L"C:\\A\\...",
+        L"C:\\A\\nul",
+        L"C:\\A\\Com1.txt",
+        L"C:\\A\\CONOUT$",
+        L"C:\\..",
+        L"\\\\server",
+        L"\\\\server\\share",
+        L"\\\\?\\C:\\A",
+        L"\\??\\C:\\A",
+        L"",
+    };
+
+    for (PCPathChar path : paths)
+    {
+        std::wstring fullPath;
+        BOOST_CHECK(GetFullPathLexically(path, L"C:\\Current", fullPath) == LexicalFullPathResult::Unsupported);
+    }
+
+    // Relative paths need the current directory
+    std::wstring fullPath;
+    BOOST_CHECK(GetFullPathLexically(L"A\\B", nullptr, fullPath) == LexicalFullPathResult::Unsupported);
+    BOOST_CHECK(GetFullPathLexically(L"A\\B", L"\\\\?\\C:\\Current", fullPath) == LexicalFullPathResult::Unsupported);
+}
+
+BOOST_AUTO_TEST_CASE(GetFullPathLexicallyUsesCurrentDirectory)
+{
+    std::wstring fullPath;
+    BOOST_CHECK(GetFullPathLexically(L"..\\A\\.\\B", L"C:\\X\\Y", fullPath) == LexicalFullPathResult::Success);
+    BOOST_CHECK_EQUAL(L"C:\\X\\A\\B", fullPath.c_str());
+
+    BOOST_CHECK(GetFullPathLexically(L"\\A", L"\\\\server\\share\\X", fullPath) == LexicalFullPathResult::Success);
+    BOOST_CHECK_EQUAL(L"\\\\server\\share\\A", fullPath.c_str());
+
+    // Absolute paths don't need it
+    BOOST_CHECK(GetFullPathLexically(L"D:\\A\\..\\B", nullptr, fullPath) == LexicalFullPathResult::Success);
+    BOOST_CHECK_EQUAL(L"D:\\B", fullPath.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(GetFullPathLexicallyReportsSmallBuffers)
+{
+    PathChar buffer[8];
+    size_t length = 0;
+    BOOST_CHECK(GetFullPathLexically(L"C:\\ABCDEFGH", nullptr, buffer, 8, &length) == LexicalFullPathResult::BufferTooSmall);
+    BOOST_CHECK(GetFullPathLexically(L"C:\\ABCD", nullptr, buffer, 8, &length) == LexicalFullPathResult::Success);
+    BOOST_CHECK_EQUAL((size_t)7, length);
+}
+
+BOOST_AUTO_TEST_CASE(ArePathCharsEqualIgnoresCase)
+{
+    // Long enough to go through whole blocks and a remainder, with and without non-ASCII characters in the blocks
+    BOOST_CHECK(ArePathCharsEqual(L"C:\\Program Files\\Microsoft Visual Studio", L"c:\\PROGRAM FILES\\microsoft visual studio", 40));
+    BOOST_CHECK(ArePathCharsEqual(L"C:\\Users\\\u00e9l\u00e8ve\\Documents\\Notes.txt", L"c:\\users\\\u00e9l\u00e8ve\\DOCUMENTS\\NOTES.TXT", 34));
+    BOOST_CHECK(!ArePathCharsEqual(L"C:\\Program Files\\Microsoft Visual Studio", L"C:\\Program Files\\Microsoft Visual Studia", 40));
+    BOOST_CHECK(!ArePathCharsEqual(L"C:\\Users\\\u00e9l\u00e8ve\\Documents\\Notes.txt", L"C:\\Users\\elEve\\Documents\\Notes.txt", 34));
+
+    // Characters around the letter ranges must not be folded
+    BOOST_CHECK(!ArePathCharsEqual(L"@@@@[[[[````{{{{", L"````{{{{@@@@[[[[", 16));
+
+    // Only the given length is compared
+    BOOST_CHECK(ArePathCharsEqual(L"C:\\Windows\\System32\\A", L"c:\\windows\\system32\\B", 20));
+    BOOST_CHECK(ArePathCharsEqual(L"A", L"B", 0));
+}
+
+BOOST_AUTO_TEST_CASE(HasPrefixAndSuffixIgnoreCase)
+{
+    BOOST_CHECK(HasPrefix(L"\\\\?\\C:\\Windows\\System32\\kernel32.dll", L"\\\\?\\"));
+    BOOST_CHECK(HasPrefix(L"c:\\windows\\system32\\kernel32.dll", L"C:\\Windows\\System32"));
+    BOOST_CHECK(HasPrefix(L"C:\\Windows", L"c:\\windows"));
+    BOOST_CHECK(!HasPrefix(L"C:\\Windows", L"C:\\Windows\\System32"));
+    BOOST_CHECK(!HasPrefix(L"C:\\Windows\\SysWOW64", L"C:\\Windows\\System32"));
+
+    const PathChar path[] = L"D:\\Out\\Obj\\_BUILDC_DEP_OUT.PASS";
+    BOOST_CHECK(HasSuffix(path, pathlen(path), BUILD_EXE_TRACE_FILE));
+    BOOST_CHECK(!HasSuffix(path, pathlen(path) - 1, BUILD_EXE_TRACE_FILE));
+    BOOST_CHECK(!HasSuffix(L"PASS", 4, BUILD_EXE_TRACE_FILE));
+}
+
+BOOST_AUTO_TEST_CASE(IsPathWithinTreeIgnoresCaseAndDuplicateSeparators)
+{
+    BOOST_CHECK(IsPathWithinTree(L"C:\\Program Files\\Microsoft Visual Studio", L"c:\\program files\\\\MICROSOFT VISUAL STUDIO\\VC\\bin\\cl.exe"));
+    BOOST_CHECK(IsPathWithinTree(L"C:\\Windows\\", L"C:\\Windows"));
+    BOOST_CHECK(IsPathWithinTree(L"", L"C:\\Windows"));
+    BOOST_CHECK(!IsPathWithinTree(L"C:\\Program Files\\Microsoft Visual Studio", L"C:\\Program Files\\Microsoft Visual Studio 14.0\\VC"));
+    BOOST_CHECK(!IsPathWithinTree(L"C:\\Windows\\System32", L"C:\\Windows"));
+    BOOST_CHECK(!IsPathWithinTree(L"C:\\Windows", L"D:\\Windows"));
+}
+
+BOOST_AUTO_TEST_CASE(DecomposePathIntoViews)
+{
+    const std::wstring path(L"C:\\a/b\\\\c.txt");
+    PathAtoms atoms;
+    BOOST_CHECK_EQUAL(0, TryDecomposePath(std::wstring_view(path), atoms));
+    BOOST_CHECK_EQUAL(4, atoms.size());
+    BOOST_CHECK(atoms[0] == L"C:");
+    BOOST_CHECK(atoms[1] == L"a");
+    BOOST_CHECK(atoms[2] == L"b");
+    BOOST_CHECK(atoms[3] == L"c.txt");
+
+    // The atoms are views of the path
+    BOOST_CHECK(atoms[3].data() == path.c_str() + path.size() - 5);
+
+    // Same atoms as the allocating version, for a UNC path with a trailing separator
+    std::vector<std::wstring> elements;
+    atoms.clear();
+    BOOST_CHECK_EQUAL(0, TryDecomposePath(std::wstring(L"\\\\server\\share\\dir\\"), elements));
+    BOOST_CHECK_EQUAL(0, TryDecomposePath(std::wstring_view(L"\\\\server\\share\\dir\\"), atoms));
+    BOOST_CHECK_EQUAL(3, elements.size());
+    BOOST_CHECK_EQUAL(elements.size(), atoms.size());
+    for (size_t i = 0; i < elements.size(); i++)
+    {
+        BOOST_CHECK(atoms[i] == elements[i]);
+    }
+
+    // Paths deeper than the inline capacity keep all their atoms, in order
+    std::wstring deep(L"C:");
+    for (int i = 0; i < PATH_ATOMS_INLINE_CAPACITY + 8; i++)
+    {
+        deep.append(L"\\d" + std::to_wstring(i));
+    }
+
+    atoms.clear();
+    BOOST_CHECK_EQUAL(0, TryDecomposePath(std::wstring_view(deep), atoms));
+    BOOST_CHECK_EQUAL(PATH_ATOMS_INLINE_CAPACITY + 9, atoms.size());
+    BOOST_CHECK(atoms[1] == L"d0");
+    BOOST_CHECK(atoms[PATH_ATOMS_INLINE_CAPACITY + 8] == L"d" + std::to_wstring(PATH_ATOMS_INLINE_CAPACITY + 7));
+
+    // File names that don't fit _wsplitpath_s are rejected
+    atoms.clear();
+    BOOST_CHECK_EQUAL(ERANGE, TryDecomposePath(std::wstring_view(L"C:\\" + std::wstring(_MAX_FNAME, L'a')), atoms));
+}
+
+BOOST_AUTO_TEST_CASE(NarrowAndWidenAsciiPrefixes)
+{
+    // Long enough to go through whole blocks before the remainder
+    const wchar_t text[] = L"C:\\Program Files\\Microsoft Visual Studio\\VC\\bin\\cl.exe";
+    const size_t length = wcslen(text);
+    char ascii[ARRAYSIZE(text)] = {};
+    BOOST_CHECK_EQUAL(length, NarrowAsciiPrefix(text, length, ascii));
+    BOOST_CHECK_EQUAL(std::string("C:\\Program Files\\Microsoft Visual Studio\\VC\\bin\\cl.exe"), std::string(ascii));
+
+    wchar_t widened[ARRAYSIZE(text)] = {};
+    BOOST_CHECK_EQUAL(length, WidenAsciiPrefix(ascii, length, widened));
+    BOOST_CHECK(wcscmp(text, widened) == 0);
+
+    // The copy stops at the first non-ASCII character, wherever it falls in a block
+    const wchar_t nonAscii[] = L"C:\\Program Files\\Caf\u00E9\\Microsoft Visual Studio";
+    BOOST_CHECK_EQUAL(20, NarrowAsciiPrefix(nonAscii, wcslen(nonAscii), ascii));
+    BOOST_CHECK_EQUAL(1, NarrowAsciiPrefix(L"C\u00E9", 2, ascii));
+
+    const char nonAsciiBytes[] = "C:\\Program Files\\Caf\xE9\\Microsoft Visual Studio";
+    BOOST_CHECK_EQUAL(20, WidenAsciiPrefix(nonAsciiBytes, strlen(nonAsciiBytes), widened));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
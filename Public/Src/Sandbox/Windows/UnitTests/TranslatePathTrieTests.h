@@ -0,0 +1,72 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <TranslatePathTrie.h>
+#include <vector>
+
+BOOST_AUTO_TEST_SUITE(TranslatePathTrieTests)
+
+BOOST_AUTO_TEST_CASE( FindsLongestPrefix )
+{
+    TranslatePathTrie trie;
+    trie.Insert(std::wstring(L"c:\\src\\"), 0);
+    trie.Insert(std::wstring(L"c:\\src\\repo\\"), 1);
+    trie.Insert(std::wstring(L"d:\\"), 2);
+
+    std::vector<bool> used;
+    size_t id = 42;
+
+    // Matching is case-insensitive
+    std::wstring path(L"C:\\Src\\Repo\\file.cpp");
+    BOOST_CHECK_EQUAL(12, trie.FindLongestPrefix(path.c_str(), path.length(), used, id));
+    BOOST_CHECK_EQUAL(1, id);
+
+    path.assign(L"c:\\src\\other\\file.cpp");
+    BOOST_CHECK_EQUAL(7, trie.FindLongestPrefix(path.c_str(), path.length(), used, id));
+    BOOST_CHECK_EQUAL(0, id);
+
+    path.assign(L"e:\\src\\file.cpp");
+    BOOST_CHECK_EQUAL(0, trie.FindLongestPrefix(path.c_str(), path.length(), used, id));
+}
+
+BOOST_AUTO_TEST_CASE( MatchesDirectoryWithoutTrailingBackslash )
+{
+    TranslatePathTrie trie;
+    trie.Insert(std::wstring(L"c:\\src\\"), 0);
+
+    std::vector<bool> used;
+    size_t id = 42;
+
+    std::wstring path(L"c:\\src");
+    BOOST_CHECK_EQUAL(6, trie.FindLongestPrefix(path.c_str(), path.length(), used, id));
+    BOOST_CHECK_EQUAL(0, id);
+
+    path.assign(L"c:\\sr");
+    BOOST_CHECK_EQUAL(0, trie.FindLongestPrefix(path.c_str(), path.length(), used, id));
+}
+
+BOOST_AUTO_TEST_CASE( SkipsUsedTranslations )
+{
+    TranslatePathTrie trie;
+    trie.Insert(std::wstring(L"c:\\src\\"), 0);
+    trie.Insert(std::wstring(L"c:\\src\\repo\\"), 1);
+    trie.Insert(std::wstring(L"c:\\src\\repo\\"), 2);
+
+    std::vector<bool> used(3);
+    size_t id = 42;
+    std::wstring path(L"c:\\src\\repo\\file.cpp");
+
+    // Among equal paths the first one inserted wins
+    BOOST_CHECK_EQUAL(12, trie.FindLongestPrefix(path.c_str(), path.length(), used, id));
+    BOOST_CHECK_EQUAL(1, id);
+
+    used[1] = true;
+    BOOST_CHECK_EQUAL(12, trie.FindLongestPrefix(path.c_str(), path.length(), used, id));
+    BOOST_CHECK_EQUAL(2, id);
+
+    used[2] = true;
+    BOOST_CHECK_EQUAL(7, trie.FindLongestPrefix(path.c_str(), path.length(), used, id));
+    BOOST_CHECK_EQUAL(0, id);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
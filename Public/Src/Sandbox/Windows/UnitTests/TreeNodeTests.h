@@ -59,6 +59,28 @@ BOOST_AUTO_TEST_CASE( TreeNodeUnderThreshold )
     TestBasicFunctionality(elements);
 }
 
+BOOST_AUTO_TEST_CASE( TreeNodeFindsEveryChild )
+{
+    // Enough children to go through both the blocks and the tail of the hash probing
+    TreeNodeChildren children;
+    std::vector<TreeNode> nodes(11);
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        TreeNode* node = &nodes[i];
+        children.emplace(std::wstring(L"Child" + std::to_wstring(i)), node);
+    }
+
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        std::pair<std::wstring, TreeNode*> result;
+        BOOST_CHECK(children.find(std::wstring(L"cHILD" + std::to_wstring(i)), result));
+        BOOST_CHECK(result.second == &nodes[i]);
+    }
+
+    std::pair<std::wstring, TreeNode*> result;
+    BOOST_CHECK(!children.find(std::wstring(L"Child11"), result));
+}
+
 BOOST_AUTO_TEST_CASE( TreeNodeBeyondThreshold )
 {
     
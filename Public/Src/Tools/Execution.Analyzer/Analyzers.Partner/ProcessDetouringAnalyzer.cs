@@ -103,6 +103,10 @@ namespace BuildXL.Execution.Analyzer
                                     writer.WriteLine("    Detoured = {0}", processDetouring.Detoured);
                                     writer.WriteLine("    Error = {0}", processDetouring.Error);
                                     writer.WriteLine("    CreateProcessStatusReturn = {0}", processDetouring.CreateProcessStatusReturn);
+                                    writer.WriteLine("    UpdateImportsMicroseconds = {0}", processDetouring.UpdateImportsMicroseconds);
+                                    writer.WriteLine("    ApplyMappingMicroseconds = {0}", processDetouring.ApplyMappingMicroseconds);
+                                    writer.WriteLine("    CopyPayloadMicroseconds = {0}", processDetouring.CopyPayloadMicroseconds);
+                                    writer.WriteLine("    RemoteInjectionMicroseconds = {0}", processDetouring.RemoteInjectionMicroseconds);
 
                                     writer.WriteLine();
                                 }
@@ -269,12 +269,27 @@ namespace BuildXL.Utilities.Configuration
         /// </summary>
         int VmConcurrencyLimit { get; }
 
+        /// <summary>
+        /// Memory, in MB, each per-process cache of the sandbox may use in the processes of service pips before it starts evicting entries.
+        /// </summary>
+        /// <remarks>
+        /// Service pips (e.g. compiler servers or build daemons) live for as long as the build, so their caches would otherwise keep growing.
+        /// 0 leaves the default budget of each cache.
+        /// </remarks>
+        int ServicePipSandboxCacheBudgetMb { get; }
+
         /// <summary>
         /// List of directory paths where full reparse point resolving will be applied to any path under them.
         /// This list is only considered when <see cref="IUnsafeSandboxConfiguration.IgnoreFullReparsePointResolving"/> is set to true and<see cref="IUnsafeSandboxConfiguration.EnableFullReparsePointResolving"/> is set to false. 
         /// </summary>
         IReadOnlyList<AbsolutePath> DirectoriesToEnableFullReparsePointParsing { get; }
 
+        /// <summary>
+        /// List of directory paths known not to contain any symlinks or junctions, neither themselves nor anywhere under them.
+        /// The sandbox skips reparse point and symlink resolution for any path under them.
+        /// </summary>
+        IReadOnlyList<AbsolutePath> DirectoriesWithoutReparsePoints { get; }
+
         /// <summary>
         /// Enable explicitly reporting directory probes from detours to help avoid underbuilds caused by unreported directory probes.
         /// </summary>
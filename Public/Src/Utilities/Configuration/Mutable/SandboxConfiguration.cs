@@ -50,7 +50,9 @@ namespace BuildXL.Utilities.Configuration.Mutable
             PreserveOutputsForIncrementalTool = false;
             GlobalUnsafePassthroughEnvironmentVariables = new List<string>();
             VmConcurrencyLimit = 0;
+            ServicePipSandboxCacheBudgetMb = 0;
             DirectoriesToEnableFullReparsePointParsing = new List<AbsolutePath>();
+            DirectoriesWithoutReparsePoints = new List<AbsolutePath>();
             ExplicitlyReportDirectoryProbes = OperatingSystemHelper.IsLinuxOS;
             PreserveFileSharingBehaviour = false;
             EnableLinuxPTraceSandbox = true;
@@ -107,7 +109,9 @@ namespace BuildXL.Utilities.Configuration.Mutable
             PreserveOutputsForIncrementalTool = template.PreserveOutputsForIncrementalTool;
             GlobalUnsafePassthroughEnvironmentVariables = new List<string>(template.GlobalUnsafePassthroughEnvironmentVariables);
             VmConcurrencyLimit = template.VmConcurrencyLimit;
+            ServicePipSandboxCacheBudgetMb = template.ServicePipSandboxCacheBudgetMb;
             DirectoriesToEnableFullReparsePointParsing = pathRemapper.Remap(template.DirectoriesToEnableFullReparsePointParsing);
+            DirectoriesWithoutReparsePoints = pathRemapper.Remap(template.DirectoriesWithoutReparsePoints);
             ExplicitlyReportDirectoryProbes = template.ExplicitlyReportDirectoryProbes;
             PreserveFileSharingBehaviour = template.PreserveFileSharingBehaviour;
             EnableLinuxPTraceSandbox = template.EnableLinuxPTraceSandbox;
@@ -278,12 +282,21 @@ namespace BuildXL.Utilities.Configuration.Mutable
         /// <inheritdoc />
         public int VmConcurrencyLimit { get; set; }
 
+        /// <inheritdoc />
+        public int ServicePipSandboxCacheBudgetMb { get; set; }
+
         /// <nodoc />
         public List<AbsolutePath> DirectoriesToEnableFullReparsePointParsing { get; set; }
 
         /// <inheritdoc />
         IReadOnlyList<AbsolutePath> ISandboxConfiguration.DirectoriesToEnableFullReparsePointParsing => DirectoriesToEnableFullReparsePointParsing;
 
+        /// <nodoc />
+        public List<AbsolutePath> DirectoriesWithoutReparsePoints { get; set; }
+
+        /// <inheritdoc />
+        IReadOnlyList<AbsolutePath> ISandboxConfiguration.DirectoriesWithoutReparsePoints => DirectoriesWithoutReparsePoints;
+
         /// <inheritdoc />
         public bool ExplicitlyReportDirectoryProbes { get; set; }
 
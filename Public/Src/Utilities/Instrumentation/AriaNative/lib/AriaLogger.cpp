@@ -7,9 +7,94 @@
 
  LOGMANAGER_INSTANCE
 
+//// Staging queue definition
+
+AriaEventQueue::AriaEventQueue(size_t capacity)
+    : slots_(new Slot[capacity]), mask_(capacity - 1), enqueuePosition_(0), dequeuePosition_(0)
+{
+    for (size_t i = 0; i < capacity; i++)
+    {
+        slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool AriaEventQueue::TryEnqueue(AriaStagedEvent& event)
+{
+    size_t position = enqueuePosition_.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;)
+    {
+        slot = &slots_[position & mask_];
+        const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        const intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if (difference == 0)
+        {
+            // The slot is free for this position, claim the position
+            if (enqueuePosition_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            // The slot still holds the event from a lap ago: the queue is full
+            return false;
+        }
+        else
+        {
+            // Another producer claimed this position
+            position = enqueuePosition_.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->event = std::move(event);
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+bool AriaEventQueue::TryDequeue(AriaStagedEvent& event)
+{
+    size_t position = dequeuePosition_.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;)
+    {
+        slot = &slots_[position & mask_];
+        const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        const intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+        if (difference == 0)
+        {
+            if (dequeuePosition_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            // Nothing was written at this position yet: the queue is empty
+            return false;
+        }
+        else
+        {
+            position = dequeuePosition_.load(std::memory_order_relaxed);
+        }
+    }
+
+    event = std::move(slot->event);
+    slot->sequence.store(position + mask_ + 1, std::memory_order_release);
+    return true;
+}
+
+size_t AriaEventQueue::ApproximateCount() const noexcept
+{
+    const size_t enqueued = enqueuePosition_.load(std::memory_order_relaxed);
+    const size_t dequeued = dequeuePosition_.load(std::memory_order_relaxed);
+    return enqueued > dequeued ? enqueued - dequeued : 0;
+}
+
 //// Aria logger class definition
 
 AriaLogger::AriaLogger(const char* token, const char *dbPath, int teardownTimeoutInSeconds)
+    : queue_(StagingQueueCapacity), droppedEventCount_(0), stopping_(false)
 {
     token_ = token;
     dbPath_ = dbPath;
@@ -20,6 +105,8 @@ AriaLogger::AriaLogger(const char* token, const char *dbPath, int teardownTimeou
 
     logger_ = LogManager::Initialize(token);
     LogManager::SetTransmitProfile(TransmitProfile_NearRealTime);
+
+    drainThread_ = std::thread(&AriaLogger::DrainLoop, this);
 }
 
 #pragma warning( push )
@@ -32,6 +119,11 @@ AriaLogger::~AriaLogger()
 // The function is declared 'noexcept' but calls function 'FlushAndTeardown()' which may throw exceptions
 // This destructor is not declared as noexcept, not sure why we get warning, but we can ignore it.
 #pragma warning( disable : 26447 )
+    // Let the background thread submit what is still staged before tearing the SDK down
+    stopping_.store(true);
+    drainRequested_.notify_one();
+    drainThread_.join();
+
     LogManager::FlushAndTeardown();
 #pragma warning( pop )
 }
@@ -42,6 +134,101 @@ ILogger *AriaLogger::GetLogger() const noexcept
     return logger_;
 };
 
+bool AriaLogger::Stage(const char *eventName, int eventPropertiesLength, const AriaEventProperty *eventProperties)
+{
+    AriaStagedEvent event;
+    event.name = eventName;
+    event.properties.resize(eventPropertiesLength);
+    for (int i = 0; i < eventPropertiesLength; i++)
+    {
+#pragma warning( push )
+// Don't use pointer arithmetic. Use span instead
+// No need to use spans for these since they are just being copied
+#pragma warning( disable : 26481 )
+        const AriaEventProperty &source = eventProperties[i];
+#pragma warning( pop )
+        AriaStagedEvent::Property &property = event.properties[i];
+        property.name = source.name;
+        property.hasValue = source.value != nullptr;
+        if (property.hasValue)
+        {
+            property.value = source.value;
+        }
+
+        property.piiOrLongValue = source.piiOrLongValue;
+    }
+
+    if (!queue_.TryEnqueue(event))
+    {
+        droppedEventCount_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Wake the background thread early when the queue fills up. A notification can be missed if the thread is just about
+    // to wait, which only delays the submission to the next drain interval.
+    if (queue_.ApproximateCount() == StagingQueueCapacity / 2)
+    {
+        drainRequested_.notify_one();
+    }
+
+    return true;
+}
+
+uint64_t AriaLogger::GetDroppedEventCount() const noexcept
+{
+    return droppedEventCount_.load(std::memory_order_relaxed);
+}
+
+void AriaLogger::DrainLoop()
+{
+    AriaStagedEvent event;
+    for (;;)
+    {
+        while (queue_.TryDequeue(event))
+        {
+            Submit(event);
+        }
+
+        if (stopping_.load())
+        {
+            // Producers are gone by the time the logger is disposed, so the queue was drained for good
+            break;
+        }
+
+        std::unique_lock<std::mutex> lock(drainLock_);
+        drainRequested_.wait_for(lock, DrainInterval, [this]() { return stopping_.load() || queue_.ApproximateCount() >= StagingQueueCapacity / 2; });
+    }
+}
+
+void AriaLogger::Submit(const AriaStagedEvent &event) const
+{
+    ILogger *log = GetLogger();
+    if (log == nullptr)
+    {
+        return;
+    }
+
+    EventProperties props;
+    props.SetName(event.name);
+    for (const AriaStagedEvent::Property &property : event.properties)
+    {
+        if (!property.hasValue)
+        {
+            props.SetProperty(property.name, property.piiOrLongValue);
+        }
+        else if (property.piiOrLongValue == (int)PiiKind::PiiKind_None)
+        {
+            props.SetProperty(property.name, property.value.c_str());
+        }
+        else
+        {
+            props.SetProperty(property.name, property.value.c_str(), static_cast<PiiKind>(property.piiOrLongValue));
+        }
+    }
+
+    log->LogEvent(props);
+}
+
 //// External Interface
 #pragma warning( push )
 // Avoid calling new and delete explicitly, use std::make_unique<T> instead
@@ -61,43 +248,37 @@ void WINAPI DisposeAriaLogger(const AriaLogger *logger) noexcept
     }
 }
 
-void WINAPI LogEvent(const AriaLogger *logger, const char *eventName, int eventPropertiesLength, const AriaEventProperty *eventProperties)
+void WINAPI LogEvent(AriaLogger *logger, const char *eventName, int eventPropertiesLength, const AriaEventProperty *eventProperties)
 {
     if (logger != nullptr && eventProperties != nullptr)
     {
-        EventProperties props;
-        props.SetName(eventName);
-        for (int i = 0; i < eventPropertiesLength; i++)
+        logger->Stage(eventName, eventPropertiesLength, eventProperties);
+    }
+}
+
+void WINAPI LogEvents(AriaLogger *logger, int eventsLength, const AriaEvent *events)
+{
+    if (logger != nullptr && events != nullptr)
+    {
+        for (int i = 0; i < eventsLength; i++)
         {
 #pragma warning( push )
 // Don't use pointer arithmetic. Use span instead
-// No need to use spans for these since they are just being passed into props
+// No need to use spans for these since they are just being passed into Stage
 #pragma warning( disable : 26481 )
-            const char *propName = eventProperties[i].name;
-            const char *propValue = eventProperties[i].value;
-            const int64_t piiOrValue = eventProperties[i].piiOrLongValue;
+            const AriaEvent &event = events[i];
 #pragma warning( pop )
-
-            if (propValue == nullptr)
-            {
-                props.SetProperty(propName, piiOrValue);
-            }
-            else if (piiOrValue == (int)PiiKind::PiiKind_None)
-            {
-                props.SetProperty(propName, propValue);
-            }
-            else
+            if (event.properties != nullptr)
             {
-                props.SetProperty(propName, propValue, static_cast<PiiKind>(piiOrValue));
+                logger->Stage(event.name, event.propertiesLength, event.properties);
             }
         }
-
-        ILogger *log = logger->GetLogger();
-        if (log != nullptr)
-        {
-            log->LogEvent(props);
-        }
     }
 }
 
+uint64_t WINAPI GetDroppedEventCount(const AriaLogger *logger) noexcept
+{
+    return logger != nullptr ? logger->GetDroppedEventCount() : 0;
+}
+
 #endif
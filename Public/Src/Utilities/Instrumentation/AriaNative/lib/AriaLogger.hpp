@@ -8,20 +8,111 @@
 
 #include <LogManager.hpp>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include <Windows.h>
 
 using namespace MAT;
 
+struct AriaEventProperty
+{
+    const char *name;
+    const char *value;
+    int64_t piiOrLongValue;
+};
+
+// An event as passed to LogEvents
+struct AriaEvent
+{
+    const char *name;
+    int propertiesLength;
+    const AriaEventProperty *properties;
+};
+
+// A copy of an event and its properties, owned by the staging queue until the background thread submits it
+struct AriaStagedEvent
+{
+    struct Property
+    {
+        std::string name;
+        std::string value;
+        bool hasValue;
+        int64_t piiOrLongValue;
+    };
+
+    std::string name;
+    std::vector<Property> properties;
+};
+
+// Bounded multi-producer multi-consumer queue of staged events.
+// Every slot carries a sequence number telling whether it is ready to be written or read at a given queue position,
+// so producers only contend on a compare-and-swap of the enqueue position and never wait for each other.
+class AriaEventQueue
+{
+
+private:
+
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        AriaStagedEvent event;
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t mask_;
+    std::atomic<size_t> enqueuePosition_;
+    std::atomic<size_t> dequeuePosition_;
+
+public:
+
+    // The capacity must be a power of two
+    explicit AriaEventQueue(size_t capacity);
+
+    // Moves the event into the queue. Returns false, leaving the event untouched, when the queue is full.
+    bool TryEnqueue(AriaStagedEvent& event);
+
+    // Moves the oldest event out of the queue. Returns false when the queue is empty.
+    bool TryDequeue(AriaStagedEvent& event);
+
+    size_t ApproximateCount() const noexcept;
+};
+
+// Events are not submitted to the Aria SDK on the thread logging them: they are copied into a bounded staging queue
+// that a background thread drains. When the queue is full, events are dropped and counted rather than making the
+// logging thread wait, so telemetry never stalls the build.
 class AriaLogger
 {
 
 private:
 
+    // Maximum number of events waiting for submission
+    static constexpr size_t StagingQueueCapacity = 4096;
+
+    // The background thread drains the queue at this interval, or as soon as it gets half full
+    static constexpr std::chrono::milliseconds DrainInterval { 200 };
+
     std::string token_;
     std::string dbPath_;
 
     ILogger *logger_;
 
+    AriaEventQueue queue_;
+    std::atomic<uint64_t> droppedEventCount_;
+    std::atomic<bool> stopping_;
+    std::mutex drainLock_;
+    std::condition_variable drainRequested_;
+    std::thread drainThread_;
+
+    void DrainLoop();
+    void Submit(const AriaStagedEvent& event) const;
+
 public:
 
     AriaLogger() = delete;
@@ -30,19 +121,20 @@ public:
     ~AriaLogger();
 
     ILogger *GetLogger() const noexcept;
-};
 
-struct AriaEventProperty
-{
-    const char *name;
-    const char *value;
-    int64_t piiOrLongValue;
+    // Copies the event into the staging queue. Returns false if the queue was full and the event got dropped.
+    bool Stage(const char *eventName, int eventPropertiesLength, const AriaEventProperty *eventProperties);
+
+    // Number of events dropped because the staging queue was full
+    uint64_t GetDroppedEventCount() const noexcept;
 };
 
 AriaLogger* WINAPI CreateAriaLogger(const char *token, const char *dbPath, int teardownTimeoutInSeconds);
 void WINAPI DisposeAriaLogger(const AriaLogger *) noexcept;
 
-void WINAPI LogEvent(const AriaLogger *logger, const char *eventName, int eventPropertiesLength, const AriaEventProperty *eventProperties);
+void WINAPI LogEvent(AriaLogger *logger, const char *eventName, int eventPropertiesLength, const AriaEventProperty *eventProperties);
+void WINAPI LogEvents(AriaLogger *logger, int eventsLength, const AriaEvent *events);
+uint64_t WINAPI GetDroppedEventCount(const AriaLogger *logger) noexcept;
 
 #endif
 #endif
@@ -0,0 +1,110 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+using System.Collections.Concurrent;
+using System.Threading;
+using System.Threading.Tasks;
+using BuildXL.Native.IO;
+
+#nullable enable
+
+namespace BuildXL.Processes
+{
+    /// <summary>
+    /// Job objects for the processes of pips, created and configured ahead of time.
+    /// </summary>
+    /// <remarks>
+    /// Creating a job, associating it with the completion port and setting its limits is on the critical path of every pip launch,
+    /// which shows for short pips. Jobs are taken from here instead, and the pool is refilled in the background.
+    ///
+    /// Jobs are never recycled after their processes exit: the accounting of a job (the peak memory in particular) can't be reset,
+    /// and a <see cref="JobObject"/> only completes once. Every pip still gets a job of its own, so isolation is the same.
+    /// </remarks>
+    public static class JobObjectPool
+    {
+        /// <summary>
+        /// Number of jobs kept ready for each configuration.
+        /// </summary>
+        public const int Capacity = 4;
+
+        private static readonly Pool s_pool = new Pool(allowProcessesToBreakAway: false);
+        private static readonly Pool s_breakawayPool = new Pool(allowProcessesToBreakAway: true);
+
+        /// <summary>
+        /// Takes a job that terminates its processes when closed, and lets them break away if <paramref name="allowProcessesToBreakAway"/> is set.
+        /// </summary>
+        /// <remarks>
+        /// The caller owns the job. Same as creating it and calling <see cref="JobObject.SetLimitInformation"/>, which is what happens if the pool is empty.
+        /// </remarks>
+        public static JobObject Take(bool allowProcessesToBreakAway) => (allowProcessesToBreakAway ? s_breakawayPool : s_pool).Take();
+
+        private static JobObject CreateJob(bool allowProcessesToBreakAway)
+        {
+            var job = new JobObject(null);
+
+            // We want the effects of SEM_NOGPFAULTERRORBOX on all children (but can't set that with CreateProcess).
+            // That's not set otherwise (even if set in this process) due to CREATE_DEFAULT_ERROR_MODE.
+            job.SetLimitInformation(terminateOnClose: true, failCriticalErrors: false, allowProcessesToBreakAway: allowProcessesToBreakAway);
+            return job;
+        }
+
+        private sealed class Pool
+        {
+            private readonly bool m_allowProcessesToBreakAway;
+            private readonly ConcurrentQueue<JobObject> m_jobs = new ConcurrentQueue<JobObject>();
+
+            /// <summary>
+            /// 1 while a background refill is running.
+            /// </summary>
+            private int m_refilling;
+
+            /// <summary>
+            /// Set once a background refill failed. Jobs are then only created by <see cref="Take"/>, so failures reach the caller.
+            /// </summary>
+            private volatile bool m_refillFailed;
+
+            public Pool(bool allowProcessesToBreakAway)
+            {
+                m_allowProcessesToBreakAway = allowProcessesToBreakAway;
+            }
+
+            public JobObject Take()
+            {
+                if (!m_jobs.TryDequeue(out JobObject? job))
+                {
+                    job = CreateJob(m_allowProcessesToBreakAway);
+                }
+
+                Refill();
+                return job;
+            }
+
+            private void Refill()
+            {
+                if (m_refillFailed || m_jobs.Count >= Capacity || Interlocked.CompareExchange(ref m_refilling, 1, 0) != 0)
+                {
+                    return;
+                }
+
+                Task.Run(() =>
+                {
+                    try
+                    {
+                        while (m_jobs.Count < Capacity)
+                        {
+                            m_jobs.Enqueue(CreateJob(m_allowProcessesToBreakAway));
+                        }
+                    }
+                    catch (NativeWin32Exception)
+                    {
+                        m_refillFailed = true;
+                    }
+                    finally
+                    {
+                        Volatile.Write(ref m_refilling, 0);
+                    }
+                });
+            }
+        }
+    }
+}
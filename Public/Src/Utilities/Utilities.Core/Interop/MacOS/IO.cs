@@ -2,6 +2,7 @@
 // Licensed under the MIT License.
 
 using System;
+using System.Collections.Generic;
 using System.Diagnostics.ContractsLight;
 using System.Runtime.InteropServices;
 using System.Text;
@@ -130,6 +131,38 @@ namespace BuildXL.Interop.Unix
             public DateTime ToUtcDateTime(long sec, long nsec) => new Timespec { Tv_sec = sec, Tv_nsec = nsec }.ToUtcTime();
         }
 
+        /// <summary>
+        /// An entry returned by <see cref="EnumerateDirectoryWithAttributes"/>.
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public unsafe struct DirectoryEntry
+        {
+            /// <summary>NAME_MAX + 1</summary>
+            public const int MaxNameLength = 256;
+
+            public ulong InodeNumber;
+            public long Size;
+            public long TimeLastModification;
+            public long TimeNSecLastModification;
+            public ushort Mode;
+            public ushort NameLength;
+            public int Error;
+            public fixed byte NameBytes[MaxNameLength];
+
+            public string Name
+            {
+                get
+                {
+                    fixed (byte* name = NameBytes)
+                    {
+                        return Encoding.UTF8.GetString(name, NameLength);
+                    }
+                }
+            }
+
+            public DateTime GetLastModificationUtcTime() => new Timespec { Tv_sec = TimeLastModification, Tv_nsec = TimeNSecLastModification }.ToUtcTime();
+        }
+
         public enum FilePermissions : int
         {
             S_ISUID = 0x0800, // Set user ID on execution
@@ -176,6 +209,37 @@ namespace BuildXL.Interop.Unix
             ? Impl_Mac.StatFile(path, followSymlink, ref statBuf)
             : Impl_Linux.StatFile(path, followSymlink, ref statBuf);
 
+        /// <summary>
+        /// Same as <see cref="StatFile" /> for all of <paramref name="paths"/> in a single call; consecutive paths
+        /// in the same directory are cheaper to stat, so callers should pass them sorted.
+        /// </summary>
+        /// <returns>
+        /// The number of paths that were stat'ed successfully, or -1 upon error.  For every path, <paramref name="results"/> holds
+        /// 0 if it succeeded (and <paramref name="statBufs"/> its result), or the errno it failed with.
+        /// </returns>
+        public static int StatFiles(string[] paths, bool followSymlink, StatBuffer[] statBufs, int[] results)
+        {
+            Contract.Requires(paths != null && statBufs != null && results != null);
+            Contract.Requires(statBufs.Length >= paths.Length && results.Length >= paths.Length);
+
+            return IsMacOS
+                ? Impl_Mac.StatFiles(paths, followSymlink, statBufs, results)
+                : Impl_Linux.StatFiles(paths, followSymlink, statBufs, results);
+        }
+
+        /// <summary>
+        /// Enumerates directory <paramref name="path"/> (not recursively) and adds its entries, with their type, size,
+        /// modification time and inode, to <paramref name="entries"/>.  The attributes of many entries are retrieved per system
+        /// call, instead of one <see cref="StatFile" /> call per entry.  Symlinks are not followed.
+        /// </summary>
+        /// <returns>
+        /// 0 on success, otherwise the errno of the failure.  Entries whose attributes could not be retrieved have a non-zero
+        /// <see cref="DirectoryEntry.Error"/>.
+        /// </returns>
+        public static int EnumerateDirectoryWithAttributes(string path, List<DirectoryEntry> entries) => IsMacOS
+            ? Impl_Mac.EnumerateDirectoryWithAttributes(path, entries)
+            : throw new NotImplementedException();
+
         /// <summary>
         /// Same as <see cref="StatFile" /> except that the target file is given as a file descriptor (<paramref name="fd" />).
         /// </summary>
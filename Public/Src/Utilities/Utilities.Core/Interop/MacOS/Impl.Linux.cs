@@ -116,6 +116,31 @@ namespace BuildXL.Interop.Unix
             return StatFile(AT_FDCWD, path, followSymlink, ref statBuf);
         }
 
+        /// <summary>
+        /// Linux specific implementation of <see cref="IO.StatFiles"/>
+        /// </summary>
+        /// <remarks>
+        /// There is no native interop library on Linux, every path costs one <code>statx</code> (or <code>fstatat</code>) call.
+        /// </remarks>
+        internal static int StatFiles(string[] paths, bool followSymlink, StatBuffer[] statBufs, int[] results)
+        {
+            int succeeded = 0;
+            for (int i = 0; i < paths.Length; i++)
+            {
+                if (StatFile(AT_FDCWD, paths[i], followSymlink, ref statBufs[i]) == 0)
+                {
+                    results[i] = 0;
+                    succeeded++;
+                }
+                else
+                {
+                    results[i] = Marshal.GetLastWin32Error();
+                }
+            }
+
+            return succeeded;
+        }
+
         private static int StatFile(int fd, string path, bool followSymlink, ref StatBuffer statBuf)
         {
             // If statx is supported, we prefer it since it gives us back the file creation time as well
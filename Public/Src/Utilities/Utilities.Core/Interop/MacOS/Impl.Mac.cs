@@ -2,6 +2,7 @@
 // Licensed under the MIT License.
 
 using System;
+using System.Collections.Generic;
 using System.Runtime.InteropServices;
 using System.Text;
 using Microsoft.Win32.SafeHandles;
@@ -145,6 +146,9 @@ namespace BuildXL.Interop.Unix
         [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true)]
         private static extern int StatFile(string path, bool followSymlink, ref StatBuffer statBuf, long statBufferSize);
 
+        [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true)]
+        private static extern int StatFiles(string[] paths, int count, bool followSymlink, [Out] StatBuffer[] statBufs, [Out] int[] results, long statBufferSize);
+
         /// <summary>OSX specific implementation of <see cref="IO.GetFileSystemType"/> </summary>
         [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true, CharSet = CharSet.Ansi)]
         internal static extern int GetFileSystemType(SafeFileHandle fd, StringBuilder fsTypeName, long bufferSize);
@@ -157,6 +161,40 @@ namespace BuildXL.Interop.Unix
         internal unsafe static int StatFile(string path, bool followSymlink, ref StatBuffer statBuf)
             => StatFile(path, followSymlink, ref statBuf, sizeof(StatBuffer));
 
+        [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true)]
+        private static extern int EnumerateDirectoryWithAttributes(SafeFileHandle fd, [Out] DirectoryEntry[] entries, int count, long entrySize);
+
+        /// <summary>Number of entries read per <see cref="EnumerateDirectoryWithAttributes(SafeFileHandle, DirectoryEntry[], int, long)"/> call</summary>
+        private const int DirectoryEntryBatchSize = 128;
+
+        /// <summary>OSX specific implementation of <see cref="IO.EnumerateDirectoryWithAttributes"/> </summary>
+        internal unsafe static int EnumerateDirectoryWithAttributes(string path, List<DirectoryEntry> entries)
+        {
+            using (var fd = Open(path, OpenFlags.O_RDONLY | OpenFlags.O_CLOEXEC, 0))
+            {
+                if (fd.IsInvalid)
+                {
+                    return Marshal.GetLastWin32Error();
+                }
+
+                var batch = new DirectoryEntry[DirectoryEntryBatchSize];
+                int count;
+                while ((count = EnumerateDirectoryWithAttributes(fd, batch, batch.Length, sizeof(DirectoryEntry))) > 0)
+                {
+                    for (int i = 0; i < count; i++)
+                    {
+                        entries.Add(batch[i]);
+                    }
+                }
+
+                return count == 0 ? 0 : Marshal.GetLastWin32Error();
+            }
+        }
+
+        /// <summary>OSX specific implementation of <see cref="IO.StatFiles"/> </summary>
+        internal unsafe static int StatFiles(string[] paths, bool followSymlink, StatBuffer[] statBufs, int[] results)
+            => StatFiles(paths, paths.Length, followSymlink, statBufs, results, sizeof(StatBuffer));
+
         /// <summary>OSX specific implementation of <see cref="IO.SafeReadLink"/> </summary>
         [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true, CharSet = CharSet.Ansi)]
         internal static extern long SafeReadLink(string link, StringBuilder buffer, long length);
@@ -201,6 +239,15 @@ namespace BuildXL.Interop.Unix
         [DllImport(Libraries.BuildXLInteropLibMacOS)]
         internal static extern int GetCpuLoadInfo(ref CpuLoadInfo buffer, long bufferSize);
 
+        [DllImport(Libraries.BuildXLInteropLibMacOS)]
+        internal static extern IntPtr CreateCpuLoadSampler();
+
+        [DllImport(Libraries.BuildXLInteropLibMacOS)]
+        internal static extern void FreeCpuLoadSampler(IntPtr sampler);
+
+        [DllImport(Libraries.BuildXLInteropLibMacOS)]
+        internal static extern int SampleCpuLoad(IntPtr sampler, ref CpuLoadInfo delta, long deltaSize, [Out] double[] coreUtilization, ref int coreCount);
+
         #region Sandbox
         [DllImport(Libraries.BuildXLInteropLibMacOS)]
         internal static extern unsafe int NormalizePathAndReturnHash(byte[] pPath, byte* buffer, int bufferLength);
@@ -1,6 +1,7 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
+using System;
 using System.Runtime.InteropServices;
 
 using static BuildXL.Interop.Dispatch;
@@ -30,5 +31,69 @@ namespace BuildXL.Interop.Unix
         public static int GetCpuLoadInfo(ref CpuLoadInfo buffer) => IsMacOS
             ? Impl_Mac.GetCpuLoadInfo(ref buffer, Marshal.SizeOf(buffer))
             : Impl_Linux.GetCpuLoadInfo(ref buffer, Marshal.SizeOf(buffer));
+
+        /// <summary>
+        /// Samples the CPU load of a macOS host incrementally: every sample returns the ticks spent since the previous one,
+        /// in total and as a busy percentage per core, without the caller keeping the previous snapshot around.
+        /// </summary>
+        public sealed class CpuLoadSampler : IDisposable
+        {
+            private IntPtr m_sampler;
+            private double[] m_coreUtilization = new double[Environment.ProcessorCount];
+
+            /// <summary>
+            /// Busy percentage of each core over the period covered by the last successful <see cref="Sample"/>
+            /// </summary>
+            public ReadOnlySpan<double> CoreUtilization => m_coreUtilization.AsSpan(0, CoreCount);
+
+            /// <summary>
+            /// Number of cores seen by the last successful <see cref="Sample"/>
+            /// </summary>
+            public int CoreCount { get; private set; }
+
+            /// <nodoc />
+            public CpuLoadSampler()
+            {
+                m_sampler = IsMacOS ? Impl_Mac.CreateCpuLoadSampler() : IntPtr.Zero;
+            }
+
+            /// <summary>
+            /// Returns the ticks spent since the previous sample, since boot for the first one
+            /// </summary>
+            public int Sample(out CpuLoadInfo delta)
+            {
+                delta = new CpuLoadInfo();
+                if (m_sampler == IntPtr.Zero)
+                {
+                    return ERROR;
+                }
+
+                int coreCount = m_coreUtilization.Length;
+                int result = Impl_Mac.SampleCpuLoad(m_sampler, ref delta, Marshal.SizeOf(delta), m_coreUtilization, ref coreCount);
+                if (result != MACOS_INTEROP_SUCCESS)
+                {
+                    return result;
+                }
+
+                CoreCount = Math.Min(coreCount, m_coreUtilization.Length);
+                if (coreCount > m_coreUtilization.Length)
+                {
+                    // More cores than expected: the next samples report all of them
+                    Array.Resize(ref m_coreUtilization, coreCount);
+                }
+
+                return result;
+            }
+
+            /// <nodoc />
+            public void Dispose()
+            {
+                if (m_sampler != IntPtr.Zero)
+                {
+                    Impl_Mac.FreeCpuLoadSampler(m_sampler);
+                    m_sampler = IntPtr.Zero;
+                }
+            }
+        }
     }
 }
@@ -60,7 +60,7 @@ namespace BuildXL.Interop.Unix
         [DllImport(Libraries.BuildXLInteropLibMacOS, CallingConvention=CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
         public static extern void ObserverFileAccessReports(
             ref SandboxConnectionInfo info,
-            [MarshalAs(UnmanagedType.FunctionPtr)] AccessReportCallback callbackPointer,
+            [MarshalAs(UnmanagedType.FunctionPtr)] AccessReportBatchCallback callbackPointer,
             long accessReportSize);
 
         [StructLayout(LayoutKind.Sequential)]
@@ -88,6 +88,9 @@ namespace BuildXL.Interop.Unix
             public int Error;
             public ulong Address;
             public uint Port;
+
+            /// <summary>Which of the report queues of the client to map (see <see cref="KextConfig.NumberOfReportQueues"/>)</summary>
+            public uint QueueIndex;
         }
 
         [DllImport(Libraries.BuildXLInteropLibMacOS, CallingConvention = CallingConvention.Cdecl)]
@@ -144,6 +147,16 @@ namespace BuildXL.Interop.Unix
             /// </summary>
             public uint MinAvailableRamMB;
 
+            /// <summary>
+            /// Block processes when the memory pressure level (1: normal, 2: warning, 4: critical) reaches this value (0 means never).
+            /// </summary>
+            public uint MemoryPressureLevelBlock;
+
+            /// <summary>
+            /// Block processes when the number of runnable threads per core (in percent) reaches this value (0 means never).
+            /// </summary>
+            public uint RunQueueLengthBlockPercent;
+
             /// <summary>
             /// Returns whether these resource threshold parameters enable process throttling or not.
             /// </summary>
@@ -151,6 +164,8 @@ namespace BuildXL.Interop.Unix
             {
                 return
                     MinAvailableRamMB > 0 ||
+                    MemoryPressureLevelBlock > 0 ||
+                    RunQueueLengthBlockPercent > 0 ||
                     isThresholdEnabled(CpuUsageBlockPercent);
 
                 static bool isThresholdEnabled(uint percent) => percent > 0 && percent < 100;
@@ -164,8 +179,19 @@ namespace BuildXL.Interop.Unix
             public bool EnableReportBatching;
             public ResourceThresholds ResourceThresholds;
             public bool EnableCatalinaDataPartitionFiltering;
+
+            /// <summary>
+            /// Number of report queues of each client, between 1 and <see cref="MaxReportQueues"/> (0 means 1).
+            /// Reports are sharded between them by pip id, and each one is drained by its own thread.
+            /// </summary>
+            public uint NumberOfReportQueues;
         }
 
+        /// <summary>
+        /// CODESYNC: Public/Src/Sandbox/MacOs/Sandbox/Src/BuildXLSandboxShared.hpp :: kMaxReportQueues
+        /// </summary>
+        public const uint MaxReportQueues = 16;
+
         [DllImport(Libraries.BuildXLInteropLibMacOS, EntryPoint = "Configure")]
         [return: MarshalAs(UnmanagedType.Bool)]
         public static extern bool Configure(KextConfig config, KextConnectionInfo info);
@@ -226,6 +252,9 @@ namespace BuildXL.Interop.Unix
 
             [MarshalAs(UnmanagedType.U4)][FieldOffset(40)]
             public uint NumHardLinkRetries;
+
+            [MarshalAs(UnmanagedType.U4)][FieldOffset(44)]
+            public uint NumCacheEvictions;
         }
 
         /// <remarks>
@@ -299,12 +328,19 @@ namespace BuildXL.Interop.Unix
             }
         }
 
+        /// <summary>
+        /// Receives a batch of <paramref name="count"/> reports from the kernel extension or the interop sandbox (or none, along
+        /// with an error code, when reports can't be delivered).
+        /// </summary>
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        public delegate void AccessReportCallback(AccessReport report, int error);
+        public delegate void AccessReportBatchCallback(
+            [MarshalAs(UnmanagedType.LPArray, SizeParamIndex = 1)] AccessReport[] reports,
+            int count,
+            int error);
 
         [DllImport(Libraries.BuildXLInteropLibMacOS, CallingConvention=CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
         public static extern void ListenForFileAccessReports(
-            [MarshalAs(UnmanagedType.FunctionPtr)] AccessReportCallback callbackPointer,
+            [MarshalAs(UnmanagedType.FunctionPtr)] AccessReportBatchCallback callbackPointer,
             long accessReportSize,
             ulong address,
             uint port);
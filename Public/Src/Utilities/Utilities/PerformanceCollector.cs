@@ -56,6 +56,7 @@ namespace BuildXL.Utilities
         private DateTime m_machineTimeLastCollectedAt = DateTime.MinValue;
         private long m_machineTimeLastVale;
         private CpuLoadInfo m_lastCpuLoadInfo;
+        private readonly CpuLoadSampler m_cpuLoadSampler = IsMacOS ? new CpuLoadSampler() : null;
 
         // Used for collecting disk activity
         private readonly (DriveInfo driveInfo, SafeFileHandle safeFileHandle, DISK_PERFORMANCE diskPerformance)[] m_drives;
@@ -549,6 +550,8 @@ namespace BuildXL.Utilities
             {
                 m_modifiedPageSizeWMIQuery?.Dispose();
             }
+
+            m_cpuLoadSampler?.Dispose();
         }
 
         #region Perf data collection implementations
@@ -776,6 +779,19 @@ namespace BuildXL.Utilities
         {
             double? machineCpu = null;
 
+            if (m_cpuLoadSampler != null)
+            {
+                // The sampler keeps the previous snapshot: the first sample covers everything since boot
+                if (m_cpuLoadSampler.Sample(out var delta) == MACOS_INTEROP_SUCCESS)
+                {
+                    double busyTicks = delta.SystemTime + delta.UserTime;
+                    double totalTicks = busyTicks + delta.IdleTime;
+                    machineCpu = totalTicks > 0 ? 100.0 * (busyTicks / totalTicks) : (double?)null;
+                }
+
+                return machineCpu;
+            }
+
             var buffer = new CpuLoadInfo();
 
             // Initialize the CPU load info